@@ -1,18 +1,37 @@
 ; ClaudeOS Enhanced Bootloader with Protected Mode
 ; Transitions from 16-bit real mode to 32-bit protected mode
+;
+; Built by "make disk" with the kernel's layout passed in: the flat kernel
+; image (objcopy -O binary, from its 1MB load address) follows this sector
+; on the disk. It is read with INT 13h extension packets, as many sectors
+; per call as the BIOS takes, into a bounce buffer that unreal mode copies
+; straight up to 1MB - a ~340KB kernel is six BIOS calls. Assembled on its
+; own (KERNEL_SECTORS undefined) it only enters protected mode, as before.
 
 [BITS 16]
 [ORG 0x7C00]
 
+%ifndef KERNEL_SECTORS
+%define KERNEL_SECTORS 0
+%endif
+
+KERNEL_LOAD         equ 0x100000    ; Must match linker.ld
+KERNEL_VIRT_BASE    equ 0xC0000000  ; kernel/pmm.h - KERNEL_END is linked here
+BOUNCE_SEG          equ 0x1000      ; 64KB bounce buffer at 0x10000
+READ_SECTORS        equ 127         ; Largest packet every EDD BIOS accepts
+
 ; Boot sector entry point
 start:
     ; Initialize segments and stack
     cli                     ; Disable interrupts
+    cld
     xor ax, ax
     mov ds, ax
     mov es, ax
     mov ss, ax
     mov sp, 0x7C00
+    sti                     ; The disk BIOS needs its interrupts
+    mov [boot_drive], dl
 
     ; Print initialization message
     mov si, msg_init
@@ -21,7 +40,12 @@ start:
     ; Enable A20 line (required for accessing >1MB memory)
     call enable_a20
 
+%if KERNEL_SECTORS
+    call load_kernel
+%endif
+
     ; Load Global Descriptor Table
+    cli
     lgdt [gdt_descriptor]
 
     ; Switch to protected mode
@@ -44,39 +68,121 @@ print_string_16:
 .done:
     ret
 
+%if KERNEL_SECTORS
+; Load the kernel image to KERNEL_LOAD and clear its BSS
+load_kernel:
+    ; Packet reads need the EDD extensions
+    mov ah, 0x41
+    mov bx, 0x55AA
+    mov dl, [boot_drive]
+    int 0x13
+    jc disk_error
+    cmp bx, 0xAA55
+    jne disk_error
+    test cl, 1              ; Fixed disk access subset (AH=42h)
+    jz disk_error
+
+    mov edi, KERNEL_LOAD
+.next:
+    mov si, dap
+    mov ah, 0x42
+    mov dl, [boot_drive]
+    int 0x13
+    jc disk_error
+
+    ; Copy the chunk up; EDI follows it
+    call unreal
+    movzx ecx, word [dap.count]
+    shl ecx, 7              ; Dwords
+    mov esi, BOUNCE_SEG << 4
+    a32 rep movsd
+
+    ; Advance the packet, the last one short
+    movzx eax, word [dap.count]
+    add [dap.lba], eax
+    sub [remaining], ax
+    jz .loaded
+    mov ax, READ_SECTORS
+    cmp [remaining], ax
+    jae .count
+    mov ax, [remaining]
+.count:
+    mov [dap.count], ax
+    jmp .next
+
+.loaded:
+    ; BSS from the end of the image (the last sector's padding is zeros)
+    mov ecx, KERNEL_END - KERNEL_VIRT_BASE + 3
+    sub ecx, edi
+    jbe .done
+    shr ecx, 2
+    xor eax, eax
+    a32 rep stosd
+.done:
+    ret
+
+; Give DS and ES a 4GB limit and return to real mode with base 0, so
+; 32-bit addresses reach past 1MB; redone per chunk in case the BIOS
+; reloaded the descriptor caches
+unreal:
+    cli
+    lgdt [gdt_descriptor]
+    mov eax, cr0
+    or al, 1
+    mov cr0, eax
+    mov bx, DATA_SEG
+    mov ds, bx
+    mov es, bx
+    and al, 0xFE
+    mov cr0, eax
+    xor bx, bx
+    mov ds, bx
+    mov es, bx
+    sti
+    ret
+
+disk_error:
+    mov si, msg_disk
+    call print_string_16
+    cli
+.hang:
+    hlt
+    jmp .hang
+%endif
+
 ; Enable A20 line using keyboard controller
 enable_a20:
     ; Method 1: Try fast A20 gate
     in al, 0x92
     or al, 2
     out 0x92, al
-    
+
     ; Method 2: Keyboard controller method (backup)
     call .wait_input
     mov al, 0xAD
     out 0x64, al            ; Disable keyboard
-    
+
     call .wait_input
     mov al, 0xD0
     out 0x64, al            ; Read output port
-    
+
     call .wait_output
     in al, 0x60
     push eax
-    
+
     call .wait_input
     mov al, 0xD1
     out 0x64, al            ; Write output port
-    
+
     call .wait_input
     pop eax
     or al, 2
     out 0x60, al            ; Enable A20
-    
+
     call .wait_input
     mov al, 0xAE
     out 0x64, al            ; Enable keyboard
-    
+
     call .wait_input
     ret
 
@@ -144,6 +250,14 @@ protected_mode_start:
     mov ebp, 0x90000
     mov esp, ebp
 
+%if KERNEL_SECTORS
+    ; Into the kernel's entry trampoline; EAX isn't the Multiboot magic, so
+    ; kernel_main knows there is no info block behind EBX
+    xor eax, eax
+    xor ebx, ebx
+    mov ecx, KERNEL_ENTRY
+    jmp ecx
+%else
     ; Print success message (VGA text mode)
     mov esi, msg_protected
     mov edi, 0xB8000        ; VGA text buffer
@@ -165,11 +279,35 @@ print_string_32:
     jmp .loop
 .done:
     ret
+%endif
 
 ; Messages
 msg_init db 'ClaudeOS: Initializing protected mode...', 0x0D, 0x0A, 0
+%if KERNEL_SECTORS
+msg_disk db 'ClaudeOS: Kernel read failed', 0
+
+boot_drive db 0
+remaining dw KERNEL_SECTORS
+
+; INT 13h extended read packet
+align 4
+dap:
+    db 0x10                 ; Packet size
+    db 0
+.count:
+%if KERNEL_SECTORS < READ_SECTORS
+    dw KERNEL_SECTORS
+%else
+    dw READ_SECTORS
+%endif
+    dw 0, BOUNCE_SEG        ; Buffer offset:segment
+.lba:
+    dd 1, 0                 ; The image starts in the sector after this one
+%else
 msg_protected db 'ClaudeOS: Protected mode active! 32-bit OS ready.', 0
+boot_drive db 0
+%endif
 
 ; Padding and boot signature
 times 510-($-$$) db 0
-dw 0xAA55
\ No newline at end of file
+dw 0xAA55
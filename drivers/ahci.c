@@ -0,0 +1,453 @@
+// ClaudeOS AHCI Driver Implementation - Day 21
+// Each drive's port keeps up to 32 commands in flight. With NCQ the drive
+// reorders them itself and reports finished tags through PxSACT; without
+// it the port holds one command at a time. Commands come from the block
+// layer and go back to it through blk_complete.
+
+#include "ahci.h"
+#include "ata.h"
+#include "../kernel/pic.h"
+#include "../kernel/irq.h"
+#include "../kernel/kernel.h"
+#include "../kernel/string.h"
+#include "../kernel/heap.h"
+#include "../kernel/lock.h"
+#include "../kernel/pci.h"
+#include "../kernel/pmm.h"
+#include "../kernel/block.h"
+
+// Polled waits (port stops, init commands) may run with interrupts off, so
+// they count iterations rather than ticks
+#define AHCI_SPIN_LIMIT     1000000
+
+typedef struct {
+    uint8_t port;                   // HBA port number
+    uint8_t drive;                  // Block-layer drive number
+    volatile uint8_t* regs;
+    spinlock_t lock;                // Unregistered; guards slots and outstanding
+    ahci_cmd_header_t* cmd_list;
+    ahci_cmd_table_t* tables;
+    uint32_t tables_phys;
+    blk_command_t* slots[AHCI_MAX_SLOTS];
+    uint32_t outstanding;           // Slots issued
+    bool ncq;
+    uint32_t sectors;
+    char model[41];
+    uint32_t commands;
+    uint32_t flushes;
+    uint32_t errors;
+    blk_driver_t driver;            // queue_depth is per drive
+} ahci_drive_t;
+
+static volatile uint8_t* hba;
+static uint32_t hba_slots;
+static bool hba_ncq;
+static uint8_t hba_irq;
+static ahci_drive_t ahci_drives[AHCI_MAX_DRIVES];
+static int ahci_drive_count = 0;
+
+static inline uint32_t hba_read(uint32_t reg) {
+    return *(volatile uint32_t*)(hba + reg);
+}
+
+static inline void hba_write(uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(hba + reg) = value;
+}
+
+static inline uint32_t port_read(ahci_drive_t* d, uint32_t reg) {
+    return *(volatile uint32_t*)(d->regs + reg);
+}
+
+static inline void port_write(ahci_drive_t* d, uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(d->regs + reg) = value;
+}
+
+static void ahci_map(uint32_t virt, uint32_t phys, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        vmm_map_page(kernel_page_directory, virt + i * PAGE_SIZE, phys + i * PAGE_SIZE,
+                     PAGE_PRESENT | PAGE_WRITABLE | PAGE_NOCACHE | PAGE_GLOBAL);
+    }
+    vmm_invalidate_range(virt, count);
+}
+
+// Spin until (reg & mask) == 0; 0 on time, -1 after AHCI_SPIN_LIMIT reads
+static int ahci_wait_clear(ahci_drive_t* d, uint32_t reg, uint32_t mask) {
+    for (int i = 0; i < AHCI_SPIN_LIMIT; i++) {
+        if (!(port_read(d, reg) & mask)) {
+            return 0;
+        }
+        asm volatile ("pause");
+    }
+    return -1;
+}
+
+static int ahci_port_stop(ahci_drive_t* d) {
+    port_write(d, AHCI_PxCMD, port_read(d, AHCI_PxCMD) & ~AHCI_PxCMD_ST);
+    if (ahci_wait_clear(d, AHCI_PxCMD, AHCI_PxCMD_CR) != 0) {
+        return -1;
+    }
+    port_write(d, AHCI_PxCMD, port_read(d, AHCI_PxCMD) & ~AHCI_PxCMD_FRE);
+    return ahci_wait_clear(d, AHCI_PxCMD, AHCI_PxCMD_FR);
+}
+
+static void ahci_port_start(ahci_drive_t* d) {
+    ahci_wait_clear(d, AHCI_PxCMD, AHCI_PxCMD_CR);
+    port_write(d, AHCI_PxCMD, port_read(d, AHCI_PxCMD) | AHCI_PxCMD_FRE);
+    port_write(d, AHCI_PxCMD, port_read(d, AHCI_PxCMD) | AHCI_PxCMD_ST);
+}
+
+// Describe a buffer to the HBA, one entry per physical page it touches.
+// Returns the next free entry, or -1 if the table is full.
+static int ahci_add_segment(ahci_cmd_table_t* table, int index, void* buffer, uint32_t bytes) {
+    uint32_t virt = (uint32_t)buffer;
+    while (bytes > 0) {
+        if (index >= AHCI_PRDT_ENTRIES) {
+            return -1;
+        }
+        uint32_t in_page = PAGE_SIZE - (virt & (PAGE_SIZE - 1));
+        uint32_t chunk = bytes < in_page ? bytes : in_page;
+        uint32_t phys = vmm_get_physical_address(kernel_page_directory, virt);
+        if (!phys) {
+            return -1;
+        }
+        // Physically adjacent pages share an entry
+        ahci_prd_t* prev = index > 0 ? &table->prdt[index - 1] : NULL;
+        if (prev && prev->phys + (prev->bytes & 0x3FFFFF) + 1 == phys) {
+            prev->bytes += chunk;
+        } else {
+            table->prdt[index].phys = phys;
+            table->prdt[index].phys_upper = 0;
+            table->prdt[index].reserved = 0;
+            table->prdt[index].bytes = chunk - 1;
+            index++;
+        }
+        virt += chunk;
+        bytes -= chunk;
+    }
+    return index;
+}
+
+// Fill slot's command header and table (port lock held, or init).
+// requests supplies the buffers in order.
+static int ahci_build(ahci_drive_t* d, uint32_t slot, uint8_t command, uint32_t lba, uint32_t count,
+                      blk_request_t* requests, bool write) {
+    ahci_cmd_table_t* table = &d->tables[slot];
+    memset(table, 0, sizeof(table->fis) + sizeof(table->atapi) + sizeof(table->reserved));
+    int entries = 0;
+    for (blk_request_t* req = requests; req; req = req->fifo_next) {
+        entries = ahci_add_segment(table, entries, req->buffer, req->count * BLK_SECTOR_SIZE);
+        if (entries < 0) {
+            return -1;
+        }
+    }
+
+    ahci_fis_h2d_t* fis = (ahci_fis_h2d_t*)table->fis;
+    fis->type = AHCI_FIS_H2D;
+    fis->flags = AHCI_FIS_COMMAND;
+    fis->command = command;
+    fis->lba0 = lba & 0xFF;
+    fis->lba1 = (lba >> 8) & 0xFF;
+    fis->lba2 = (lba >> 16) & 0xFF;
+    fis->lba3 = (lba >> 24) & 0xFF;
+    fis->device = 0x40;                         // LBA
+    if (command == AHCI_CMD_READ_FPDMA || command == AHCI_CMD_WRITE_FPDMA) {
+        // Queued: the count rides in the features, the tag in the count
+        fis->feature_low = count & 0xFF;
+        fis->feature_high = (count >> 8) & 0xFF;
+        fis->count_low = (uint8_t)(slot << 3);
+    } else {
+        fis->count_low = count & 0xFF;
+        fis->count_high = (count >> 8) & 0xFF;
+    }
+
+    ahci_cmd_header_t* header = &d->cmd_list[slot];
+    header->flags = (uint16_t)(sizeof(ahci_fis_h2d_t) / 4) | (write ? AHCI_CMD_WRITE : 0);
+    header->prdt_length = (uint16_t)entries;
+    header->prd_bytes = 0;
+    header->table = d->tables_phys + slot * sizeof(ahci_cmd_table_t);
+    header->table_upper = 0;
+    return 0;
+}
+
+// A non-queued command in slot 0, polled to completion (init only)
+static int ahci_exec_polled(ahci_drive_t* d, uint8_t command, void* buffer, uint32_t count) {
+    blk_request_t req;
+    memset(&req, 0, sizeof(req));
+    req.buffer = buffer;
+    req.count = count;
+    if (ahci_build(d, 0, command, 0, command == ATA_CMD_IDENTIFY ? 0 : count, &req, false) != 0) {
+        return -1;
+    }
+    port_write(d, AHCI_PxIS, 0xFFFFFFFF);
+    port_write(d, AHCI_PxCI, 1);
+    int spins = 0;
+    while (port_read(d, AHCI_PxCI) & 1) {
+        if ((port_read(d, AHCI_PxIS) & AHCI_PxIS_ERROR) || ++spins > AHCI_SPIN_LIMIT) {
+            return -1;
+        }
+        asm volatile ("pause");
+    }
+    return (port_read(d, AHCI_PxTFD) & ATA_STATUS_ERR) ? -1 : 0;
+}
+
+// Finish whatever the drive is done with. After an error the port is
+// restarted and everything in flight fails: a queued-command error aborts
+// every outstanding tag anyway.
+static void ahci_reap(ahci_drive_t* d) {
+    blk_command_t* done[AHCI_MAX_SLOTS];
+    int results[AHCI_MAX_SLOTS];
+    uint32_t count = 0;
+
+    uint32_t flags = spin_lock_irqsave(&d->lock);
+    uint32_t status = port_read(d, AHCI_PxIS);
+    port_write(d, AHCI_PxIS, status);
+    uint32_t finished;
+    bool failed = (status & AHCI_PxIS_ERROR) != 0;
+    if (failed) {
+        finished = d->outstanding;
+        d->errors++;
+        ahci_port_stop(d);
+        port_write(d, AHCI_PxSERR, 0xFFFFFFFF);
+        port_write(d, AHCI_PxIS, 0xFFFFFFFF);
+        ahci_port_start(d);
+    } else {
+        finished = d->outstanding & ~(port_read(d, AHCI_PxSACT) | port_read(d, AHCI_PxCI));
+    }
+    for (uint32_t slot = 0; slot < AHCI_MAX_SLOTS; slot++) {
+        if (finished & (1u << slot)) {
+            done[count] = d->slots[slot];
+            results[count++] = !failed;
+            d->slots[slot] = NULL;
+        }
+    }
+    d->outstanding &= ~finished;
+    spin_unlock_irqrestore(&d->lock, flags);
+
+    for (uint32_t i = 0; i < count; i++) {
+        blk_complete(done[i], results[i]);
+    }
+}
+
+static int ahci_irq(void* ctx) {
+    (void)ctx;
+    uint32_t pending = hba_read(AHCI_IS);
+    if (!pending) {
+        return IRQ_NONE;
+    }
+    for (int i = 0; i < ahci_drive_count; i++) {
+        if (pending & (1u << ahci_drives[i].port)) {
+            ahci_reap(&ahci_drives[i]);
+        }
+    }
+    hba_write(AHCI_IS, pending);
+    return IRQ_HANDLED;
+}
+
+static void ahci_poll(void) {
+    for (int i = 0; i < ahci_drive_count; i++) {
+        if (ahci_drives[i].outstanding) {
+            ahci_reap(&ahci_drives[i]);
+        }
+    }
+}
+
+static ahci_drive_t* ahci_drive_of(uint8_t drive) {
+    int index = (int)drive - AHCI_BLK_DRIVE_BASE;
+    return (index >= 0 && index < ahci_drive_count) ? &ahci_drives[index] : NULL;
+}
+
+// Block-layer entry: put cmd in a free slot and issue it. A flush is a
+// non-queued command even under NCQ; the block layer sends it alone.
+static int ahci_start(blk_command_t* cmd) {
+    ahci_drive_t* d = ahci_drive_of(cmd->drive);
+    bool flush = (cmd->flags & BLK_CMD_FLUSH) != 0;
+    if (!d || (!flush && (cmd->count == 0 || cmd->lba >= d->sectors ||
+                          cmd->count > d->sectors - cmd->lba))) {
+        return -1;
+    }
+    bool fua = cmd->write && (cmd->flags & BLK_CMD_FUA);
+    uint8_t command;
+    if (flush) {
+        command = ATA_CMD_FLUSH_CACHE_EXT;
+    } else if (d->ncq) {
+        command = cmd->write ? AHCI_CMD_WRITE_FPDMA : AHCI_CMD_READ_FPDMA;
+    } else if (cmd->write) {
+        command = fua ? ATA_CMD_WRITE_DMA_FUA_EXT : ATA_CMD_WRITE_DMA_EXT;
+    } else {
+        command = ATA_CMD_READ_DMA_EXT;
+    }
+    uint32_t flags = spin_lock_irqsave(&d->lock);
+    uint32_t slot = 0;
+    while (slot < d->driver.queue_depth && (d->outstanding & (1u << slot))) {
+        slot++;
+    }
+    if (slot == d->driver.queue_depth ||
+        ahci_build(d, slot, command, flush ? 0 : cmd->lba, flush ? 0 : cmd->count,
+                   flush ? NULL : cmd->requests, cmd->write && !flush) != 0) {
+        spin_unlock_irqrestore(&d->lock, flags);
+        return -1;
+    }
+    if (fua && d->ncq) {
+        ((ahci_fis_h2d_t*)d->tables[slot].fis)->device |= AHCI_FIS_DEVICE_FUA;
+    }
+    cmd->tag = slot;
+    d->slots[slot] = cmd;
+    d->outstanding |= 1u << slot;
+    d->commands++;
+    if (flush) {
+        d->flushes++;
+    } else if (d->ncq) {
+        port_write(d, AHCI_PxSACT, 1u << slot);
+    }
+    port_write(d, AHCI_PxCI, 1u << slot);
+    spin_unlock_irqrestore(&d->lock, flags);
+    return 0;
+}
+
+static void ahci_copy_string(const uint16_t* identify, char* dest, int start_word, int words) {
+    for (int i = 0; i < words; i++) {
+        dest[i * 2] = (char)(identify[start_word + i] >> 8);
+        dest[i * 2 + 1] = (char)(identify[start_word + i] & 0xFF);
+    }
+    dest[words * 2] = '\0';
+    for (int i = words * 2 - 1; i >= 0 && dest[i] == ' '; i--) {
+        dest[i] = '\0';
+    }
+}
+
+// Give the port its command list and FIS area, identify the drive and
+// register it with the block layer. 0 on success.
+static int ahci_port_init(ahci_drive_t* d, uint32_t port, uint16_t* identify) {
+    uint32_t phys = pmm_alloc_pages(AHCI_PORT_PAGES, 1);
+    if (!phys) {
+        return -1;
+    }
+    uint32_t virt = AHCI_PORT_VIRT(ahci_drive_count);
+    ahci_map(virt, phys, AHCI_PORT_PAGES);
+    memset((void*)virt, 0, AHCI_PORT_PAGES * PAGE_SIZE);
+
+    d->port = (uint8_t)port;
+    d->drive = (uint8_t)(AHCI_BLK_DRIVE_BASE + ahci_drive_count);
+    d->regs = hba + AHCI_PORT_BASE + port * AHCI_PORT_SIZE;
+    d->cmd_list = (ahci_cmd_header_t*)virt;
+    d->tables = (ahci_cmd_table_t*)(virt + PAGE_SIZE);
+    d->tables_phys = phys + PAGE_SIZE;
+    if (ahci_port_stop(d) != 0) {
+        pmm_free_pages(phys, AHCI_PORT_PAGES);
+        return -1;
+    }
+    port_write(d, AHCI_PxCLB, phys);
+    port_write(d, AHCI_PxCLBU, 0);
+    port_write(d, AHCI_PxFB, phys + AHCI_FIS_OFFSET);
+    port_write(d, AHCI_PxFBU, 0);
+    port_write(d, AHCI_PxSERR, 0xFFFFFFFF);
+    port_write(d, AHCI_PxIS, 0xFFFFFFFF);
+    port_write(d, AHCI_PxIE, 0);
+    ahci_port_start(d);
+
+    if (ahci_exec_polled(d, ATA_CMD_IDENTIFY, identify, 1) != 0) {
+        ahci_port_stop(d);
+        pmm_free_pages(phys, AHCI_PORT_PAGES);
+        return -1;
+    }
+    // Words 100-103: LBA48 capacity (the low 32 bits are all we address);
+    // 75: queue depth - 1; 76 bit 8: NCQ; 84 bit 6: FUA writes outside it
+    d->sectors = identify[100] | ((uint32_t)identify[101] << 16);
+    if (identify[102] || identify[103]) {
+        d->sectors = 0xFFFFFFFF;
+    }
+    if (d->sectors == 0) {
+        d->sectors = identify[60] | ((uint32_t)identify[61] << 16);
+    }
+    ahci_copy_string(identify, d->model, 27, 20);
+    d->ncq = hba_ncq && (identify[76] & (1 << 8));
+    uint32_t depth = d->ncq ? (identify[75] & 0x1F) + 1 : 1;
+    if (depth > hba_slots) {
+        depth = hba_slots;
+    }
+
+    d->driver.name = "ahci";
+    d->driver.queue_depth = depth;
+    d->driver.fua = d->ncq || ((identify[84] & 0xC000) == 0x4000 && (identify[84] & (1 << 6)));
+    d->driver.flush_alone = d->ncq;
+    d->driver.start = ahci_start;
+    d->driver.poll = ahci_poll;
+    port_write(d, AHCI_PxIE, AHCI_PxIS_DHRS | AHCI_PxIS_SDBS | AHCI_PxIS_ERROR);
+    return blk_register_driver(d->drive, &d->driver);
+}
+
+int ahci_init(void) {
+    if (!kernel_page_directory) {
+        return -1;
+    }
+    pci_init();
+    pci_device_t* dev = pci_find_class(AHCI_PCI_CLASS, AHCI_PCI_SUBCLASS);
+    if (!dev || (dev->bars[AHCI_PCI_ABAR] & PCI_BAR_IO)) {
+        return -1;
+    }
+    hba = (volatile uint8_t*)pci_map_bar(dev, AHCI_PCI_ABAR, AHCI_VIRT, AHCI_ABAR_PAGES);
+    if (!hba) {
+        return -1;
+    }
+    pci_enable_bus_master(dev);
+    hba_write(AHCI_GHC, hba_read(AHCI_GHC) | AHCI_GHC_AE);
+
+    uint32_t cap = hba_read(AHCI_CAP);
+    hba_slots = AHCI_CAP_NCS(cap);
+    hba_ncq = (cap & AHCI_CAP_SNCQ) != 0;
+    hba_irq = dev->irq_line;
+
+    uint16_t* identify = kmalloc(512);
+    if (!identify) {
+        return -1;
+    }
+    uint32_t implemented = hba_read(AHCI_PI);
+    for (uint32_t port = 0; port < 32 && ahci_drive_count < AHCI_MAX_DRIVES; port++) {
+        if (!(implemented & (1u << port))) {
+            continue;
+        }
+        volatile uint8_t* regs = hba + AHCI_PORT_BASE + port * AHCI_PORT_SIZE;
+        uint32_t ssts = *(volatile uint32_t*)(regs + AHCI_PxSSTS);
+        uint32_t sig = *(volatile uint32_t*)(regs + AHCI_PxSIG);
+        if (AHCI_PxSSTS_DET(ssts) != 3 || AHCI_PxSSTS_IPM(ssts) != 1 || sig != AHCI_SIG_ATA) {
+            continue;  // No SATA disk (or an ATAPI/port-multiplier one)
+        }
+        ahci_drive_t* d = &ahci_drives[ahci_drive_count];
+        if (ahci_port_init(d, port, identify) == 0) {
+            ahci_drive_count++;
+        } else {
+            terminal_printf("AHCI: Port %d did not come up\n", (int)port);
+        }
+    }
+    kfree(identify);
+
+    if (ahci_drive_count > 0) {
+        int msi = pci_enable_msi(dev, ahci_irq, NULL);
+        if (msi >= 0) {
+            hba_irq = (uint8_t)msi;
+        } else {
+            pic_route_pci(hba_irq);
+            irq_register(hba_irq, ahci_irq, NULL);
+        }
+        hba_write(AHCI_IS, 0xFFFFFFFF);
+        hba_write(AHCI_GHC, hba_read(AHCI_GHC) | AHCI_GHC_IE);
+    }
+    return ahci_drive_count;
+}
+
+void ahci_print_info(void) {
+    if (!hba) {
+        terminal_writestring("AHCI: No controller\n");
+        return;
+    }
+    terminal_printf("AHCI: %d command slots per port, NCQ %s, IRQ %d\n", (int)hba_slots,
+                    hba_ncq ? "supported" : "not supported", (int)hba_irq);
+    for (int i = 0; i < ahci_drive_count; i++) {
+        ahci_drive_t* d = &ahci_drives[i];
+        terminal_printf("  Drive %d (port %d): %s, %d MB\n", (int)d->drive, (int)d->port,
+                        d->model, (int)(d->sectors / 2048));
+        terminal_printf("    %s, depth %d, %d commands (%d flushes), %d errors\n",
+                        d->ncq ? "NCQ" : "one command at a time", (int)d->driver.queue_depth,
+                        (int)d->commands, (int)d->flushes, (int)d->errors);
+    }
+}
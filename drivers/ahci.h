@@ -0,0 +1,127 @@
+// ClaudeOS AHCI Driver - Day 21
+// SATA drives behind an AHCI host bus adapter, with native command queuing
+
+#ifndef AHCI_H
+#define AHCI_H
+
+#include "../kernel/types.h"
+#include "../kernel/vmm.h"
+
+#define AHCI_PCI_CLASS      0x01
+#define AHCI_PCI_SUBCLASS   0x06
+#define AHCI_PCI_ABAR       5           // BAR holding the HBA registers
+
+// Generic host control (offsets into the ABAR)
+#define AHCI_CAP            0x00
+#define AHCI_GHC            0x04
+#define AHCI_IS             0x08        // One pending bit per port
+#define AHCI_PI             0x0C        // Ports implemented
+#define AHCI_VS             0x10
+#define AHCI_CAP_NCS(cap)   ((((cap) >> 8) & 0x1F) + 1)   // Command slots per port
+#define AHCI_CAP_SNCQ       (1u << 30)
+#define AHCI_GHC_IE         (1u << 1)
+#define AHCI_GHC_AE         (1u << 31)  // AHCI mode rather than legacy IDE
+
+// Port registers, AHCI_PORT_SIZE apart from AHCI_PORT_BASE
+#define AHCI_PORT_BASE      0x100
+#define AHCI_PORT_SIZE      0x80
+#define AHCI_PxCLB          0x00        // Command list (1KB aligned)
+#define AHCI_PxCLBU         0x04
+#define AHCI_PxFB           0x08        // Received FIS area (256 bytes aligned)
+#define AHCI_PxFBU          0x0C
+#define AHCI_PxIS           0x10
+#define AHCI_PxIE           0x14
+#define AHCI_PxCMD          0x18
+#define AHCI_PxTFD          0x20        // Task file: status in the low byte
+#define AHCI_PxSIG          0x24
+#define AHCI_PxSSTS         0x28
+#define AHCI_PxSERR         0x30
+#define AHCI_PxSACT         0x34        // NCQ tags the drive still owns
+#define AHCI_PxCI           0x38        // Slots issued and not yet done
+
+#define AHCI_PxCMD_ST       (1u << 0)
+#define AHCI_PxCMD_FRE      (1u << 4)
+#define AHCI_PxCMD_FR       (1u << 14)
+#define AHCI_PxCMD_CR       (1u << 15)
+#define AHCI_PxIS_DHRS      (1u << 0)   // D2H register FIS: a non-queued command ended
+#define AHCI_PxIS_SDBS      (1u << 3)   // Set Device Bits FIS: queued commands ended
+#define AHCI_PxIS_ERROR     0x78000000  // Interface, host bus data/fatal, task file errors
+#define AHCI_PxSSTS_DET(s)  ((s) & 0xF)         // 3: device present, link up
+#define AHCI_PxSSTS_IPM(s)  (((s) >> 8) & 0xF)  // 1: interface active
+#define AHCI_SIG_ATA        0x00000101
+
+#define AHCI_FIS_H2D        0x27
+#define AHCI_FIS_COMMAND    0x80        // Register FIS carries a command
+#define AHCI_CMD_READ_FPDMA  0x60       // READ FPDMA QUEUED
+#define AHCI_CMD_WRITE_FPDMA 0x61
+#define AHCI_FIS_DEVICE_FUA (1 << 7)    // Queued writes: through the cache
+
+// Host-to-device register FIS
+typedef struct {
+    uint8_t type;
+    uint8_t flags;
+    uint8_t command;
+    uint8_t feature_low;
+    uint8_t lba0;
+    uint8_t lba1;
+    uint8_t lba2;
+    uint8_t device;
+    uint8_t lba3;
+    uint8_t lba4;
+    uint8_t lba5;
+    uint8_t feature_high;
+    uint8_t count_low;
+    uint8_t count_high;
+    uint8_t icc;
+    uint8_t control;
+    uint8_t reserved[4];
+} __attribute__((packed)) ahci_fis_h2d_t;
+
+// Command list entry, one per slot
+typedef struct {
+    uint16_t flags;             // FIS length in dwords, bit 6 = write
+    uint16_t prdt_length;
+    volatile uint32_t prd_bytes;    // Bytes the HBA moved
+    uint32_t table;             // Command table (128 bytes aligned)
+    uint32_t table_upper;
+    uint32_t reserved[4];
+} ahci_cmd_header_t;
+
+#define AHCI_CMD_WRITE      (1 << 6)
+
+typedef struct {
+    uint32_t phys;
+    uint32_t phys_upper;
+    uint32_t reserved;
+    uint32_t bytes;             // Byte count - 1 (bits 0-21)
+} ahci_prd_t;
+
+// Enough for BLK_MAX_SEGMENTS requests of BLK_MAX_MERGE_SECTORS between
+// them, each split at page boundaries
+#define AHCI_PRDT_ENTRIES   40
+
+typedef struct {
+    uint8_t fis[64];
+    uint8_t atapi[16];
+    uint8_t reserved[48];
+    ahci_prd_t prdt[AHCI_PRDT_ENTRIES];
+} ahci_cmd_table_t;
+
+// Each port: one page for the command list and received FISes, then 32
+// command tables
+#define AHCI_MAX_SLOTS      32
+#define AHCI_FIS_OFFSET     0x400
+#define AHCI_PORT_PAGES     7
+#define AHCI_ABAR_PAGES     2
+#define AHCI_MAX_DRIVES     12
+#define AHCI_VIRT           (VMM_MMIO_START + 0x300000)
+#define AHCI_PORT_VIRT(n)   (AHCI_VIRT + (AHCI_ABAR_PAGES + (n) * AHCI_PORT_PAGES) * 4096)
+
+// AHCI drives take block-layer drive numbers after the four ATA ones
+#define AHCI_BLK_DRIVE_BASE 4
+
+// Find the HBA and bring up its drives; returns how many, -1 without one
+int ahci_init(void);
+void ahci_print_info(void);
+
+#endif // AHCI_H
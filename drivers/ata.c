@@ -3,13 +3,600 @@
 
 #include "ata.h"
 #include "../kernel/pic.h"      // For I/O functions (inb, outb, inw)
+#include "../kernel/irq.h"
 #include "../kernel/kernel.h"
 #include "../kernel/string.h"
 #include "../kernel/heap.h"     // For kmalloc, kfree
+#include "../kernel/lock.h"
+#include "../kernel/process.h"
+#include "../kernel/timer.h"
+#include "../kernel/pci.h"
+#include "../kernel/pmm.h"
+#include "../kernel/vmm.h"
+
+#define ATA_IRQ_TIMEOUT_TICKS TIMER_FREQUENCY  // 1 s for the drive to raise its IRQ
+#define ATA_FLUSH_WAITS     30  // A flush writes the whole cache out: that many waits
+
+// Per-channel state for interrupt-driven transfers
+typedef struct {
+    uint16_t base;
+    uint8_t irq;
+    spinlock_t lock;                // Unregistered; guards the fields below
+    bool busy;                      // A transfer owns the channel
+    bool irq_pending;               // Completion not yet taken by the transfer
+    uint8_t irq_status;             // Status the handler read (which acks the drive)
+    process_t* waiter;              // Transfer sleeping until the completion
+    uint16_t bm_base;               // Bus-master registers, 0 without DMA
+    volatile ata_prd_t* prd;
+    uint32_t prd_phys;
+    uint8_t* dma_buffer;            // ATA_DMA_BYTES, physically contiguous
+    uint32_t dma_phys;
+    bool timed_out;                 // The current command's wait gave up
+} ata_channel_t;
 
 // Global drive array
 static ata_drive_t drives[4];  // Primary Master/Slave, Secondary Master/Slave
 static int drive_count = 0;
+static ata_channel_t channels[2];
+static ata_io_stats_t io_stats[4];
+static spinlock_t io_stats_lock;   // Unregistered; guards io_stats
+
+static ata_channel_t* ata_channel(uint16_t base) {
+    return base == ATA_PRIMARY_BASE ? &channels[0] : &channels[1];
+}
+
+// Completion for the channel's selected drive: latch the status and wake
+// whoever is waiting on it
+static int ata_irq(void* ctx) {
+    ata_channel_t* ch = (ata_channel_t*)ctx;
+    spin_lock(&ch->lock);
+    ch->irq_status = inb(ch->base + ATA_REG_STATUS);
+    ch->irq_pending = true;
+    process_t* waiter = ch->waiter;
+    ch->waiter = NULL;
+    spin_unlock(&ch->lock);
+    process_wake(waiter);
+    return IRQ_HANDLED;
+}
+
+// Transfers on a channel take turns. Returns whether this one may sleep:
+// only then are the drive's interrupts enabled, and boot-time or kernel
+// callers keep polling as before.
+static bool ata_claim(ata_channel_t* ch) {
+    process_t* process = current_process;
+    bool can_sleep = process && process->pid != KERNEL_PID && scheduler_preemptive;
+    uint32_t flags = spin_lock_irqsave(&ch->lock);
+    while (ch->busy) {
+        spin_unlock_irqrestore(&ch->lock, flags);
+        process_yield();
+        flags = spin_lock_irqsave(&ch->lock);
+    }
+    ch->busy = true;
+    ch->irq_pending = false;
+    ch->timed_out = false;
+    spin_unlock_irqrestore(&ch->lock, flags);
+    outb(ch->base + ATA_REG_CONTROL, can_sleep ? 0 : ATA_CTRL_NIEN);
+    return can_sleep;
+}
+
+static void ata_release(ata_channel_t* ch) {
+    uint32_t flags = spin_lock_irqsave(&ch->lock);
+    ch->busy = false;
+    spin_unlock_irqrestore(&ch->lock, flags);
+}
+
+// Task file for count sectors at lba (the command is issued next). LBA48
+// writes each register twice, high-order byte first; a count of 0 means
+// the command's maximum.
+static void ata_select_lba(uint16_t base, uint8_t drive_sel, uint32_t lba, uint32_t count, bool lba48) {
+    outb(base + ATA_REG_FEATURES, 0x00);           // Features = 0
+    if (lba48) {
+        outb(base + ATA_REG_SECCOUNT, (count >> 8) & 0xFF);
+        outb(base + ATA_REG_LBA_LOW, (lba >> 24) & 0xFF);  // LBA bits 24-31
+        outb(base + ATA_REG_LBA_MID, 0);                    // Bits 32-47: 2TB is plenty
+        outb(base + ATA_REG_LBA_HIGH, 0);
+    }
+    outb(base + ATA_REG_SECCOUNT, count & 0xFF);   // Sector count
+    outb(base + ATA_REG_LBA_LOW, lba & 0xFF);      // LBA bits 0-7
+    outb(base + ATA_REG_LBA_MID, (lba >> 8) & 0xFF);   // LBA bits 8-15
+    outb(base + ATA_REG_LBA_HIGH, (lba >> 16) & 0xFF); // LBA bits 16-23
+    
+    // Drive selection, with LBA bits 24-27 for LBA28
+    outb(base + ATA_REG_DRIVE, drive_sel | 0x40 | (lba48 ? 0 : ((lba >> 24) & 0x0F)));
+}
+
+// LBA28 is a register write shorter, so the 48-bit form is only used
+// for what needs it
+static bool ata_needs_lba48(uint32_t lba, uint32_t count) {
+    return count > ATA_LBA28_MAX_SECTORS || lba + count > ATA_LBA28_LIMIT;
+}
+
+// Wait for the drive to finish a sector: asleep until its interrupt, or by
+// polling when the caller can't sleep. Returns the status, -1 on timeout.
+static int ata_wait_irq(ata_channel_t* ch, bool can_sleep) {
+    if (!can_sleep) {
+        for (int timeout = 0; timeout < 100000; timeout++) {
+            uint8_t status = ata_read_status(ch->base);
+            if (!(status & ATA_STATUS_BSY)) {
+                return status;
+            }
+        }
+        ch->timed_out = true;
+        return -1;
+    }
+    
+    process_t* process = current_process;
+    uint32_t deadline = timer_get_ticks() + ATA_IRQ_TIMEOUT_TICKS;
+    uint32_t flags = spin_lock_irqsave(&ch->lock);
+    while (!ch->irq_pending) {
+        if ((int32_t)(timer_get_ticks() - deadline) >= 0) {
+            ch->timed_out = true;
+            spin_unlock_irqrestore(&ch->lock, flags);
+            return -1;
+        }
+        // Blocked before the lock drops, so the interrupt can't be missed
+        ch->waiter = process;
+        process_prepare_block();
+        timer_wake_at(process, deadline);
+        spin_unlock_irqrestore(&ch->lock, flags);
+        process_yield();
+        
+        // Nothing else may have been runnable when the slice ended
+        while (process->state == PROCESS_BLOCKED) {
+            asm volatile ("sti; hlt");
+        }
+        timer_cancel_sleep(process);
+        flags = spin_lock_irqsave(&ch->lock);
+        if (ch->waiter == process) {
+            ch->waiter = NULL;
+        }
+    }
+    ch->irq_pending = false;
+    int status = ch->irq_status;
+    spin_unlock_irqrestore(&ch->lock, flags);
+    return status;
+}
+
+// pic.h has byte and word port accessors; the PRD table address is a dword
+static inline void ata_outl(uint16_t port, uint32_t value) {
+    asm volatile ("outl %0, %1" : : "a" (value), "Nd" (port));
+}
+
+static void ata_dma_map(uint32_t virt, uint32_t phys, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        vmm_map_page(kernel_page_directory, virt + i * PAGE_SIZE, phys + i * PAGE_SIZE,
+                     PAGE_PRESENT | PAGE_WRITABLE | PAGE_NOCACHE | PAGE_GLOBAL);
+    }
+    vmm_invalidate_range(virt, count);
+}
+
+// Find the IDE controller's bus-master block (BAR4) and give each channel
+// a PRD table and a bounce buffer. A channel left without one keeps PIO.
+int ata_dma_init(void) {
+    if (!kernel_page_directory) {
+        return -1;
+    }
+    pci_init();
+    pci_device_t* dev = pci_find_class(ATA_PCI_CLASS, ATA_PCI_SUBCLASS);
+    if (!dev || !(dev->bars[4] & PCI_BAR_IO)) {
+        return -1;
+    }
+    uint32_t prd_phys = pmm_alloc_page();
+    if (!prd_phys) {
+        return -1;
+    }
+    ata_dma_map(ATA_DMA_VIRT, prd_phys, 1);
+    
+    uint16_t bm_base = dev->bars[4] & 0xFFFC;
+    uint32_t virt = ATA_DMA_VIRT + PAGE_SIZE;
+    for (int i = 0; i < 2; i++) {
+        // 64KB-aligned, so the buffer is one PRD entry
+        uint32_t phys = pmm_alloc_pages(ATA_DMA_PAGES, ATA_DMA_PAGES);
+        if (!phys) {
+            break;
+        }
+        ata_dma_map(virt, phys, ATA_DMA_PAGES);
+        ata_channel_t* ch = &channels[i];
+        ch->prd = (volatile ata_prd_t*)(ATA_DMA_VIRT + i * 64);
+        ch->prd_phys = prd_phys + i * 64;
+        ch->dma_buffer = (uint8_t*)virt;
+        ch->dma_phys = phys;
+        ch->bm_base = bm_base + i * ATA_BM_SECONDARY;
+        virt += ATA_DMA_BYTES;
+    }
+    pci_enable_bus_master(dev);
+    terminal_writestring("ATA: Bus-master DMA enabled\n");
+    return 0;
+}
+
+// One READ/WRITE DMA command for the whole request through the channel's
+// bounce buffer (channel claimed, drive ready). FUA writes only exist in
+// the 48-bit form. Returns 1 on success.
+static int ata_dma_transfer(ata_channel_t* ch, bool can_sleep, ata_drive_t* drive, uint32_t lba,
+                            uint32_t sector_count, void* buffer, bool write, bool fua) {
+    uint32_t bytes = sector_count * 512;
+    uint8_t drive_sel = drive->is_master ? ATA_DRIVE_MASTER : ATA_DRIVE_SLAVE;
+    bool lba48 = fua || ata_needs_lba48(lba, sector_count);
+    if (write) {
+        memcpy(ch->dma_buffer, buffer, bytes);
+    }
+    ch->prd[0].phys = ch->dma_phys;
+    ch->prd[0].bytes = (uint16_t)bytes;     // 64KB wraps to 0, which means 64KB
+    ch->prd[0].flags = ATA_PRD_EOT;
+    
+    outb(ch->bm_base + ATA_BM_COMMAND, 0);
+    ata_outl(ch->bm_base + ATA_BM_PRDT, ch->prd_phys);
+    // Error and interrupt bits are write-1-to-clear
+    outb(ch->bm_base + ATA_BM_STATUS, ATA_BM_STATUS_ERR | ATA_BM_STATUS_IRQ);
+    uint8_t direction = write ? 0 : ATA_BM_CMD_READ;
+    outb(ch->bm_base + ATA_BM_COMMAND, direction);
+    
+    ata_select_lba(ch->base, drive_sel, lba, sector_count, lba48);
+    if (fua) {
+        outb(ch->base + ATA_REG_COMMAND, ATA_CMD_WRITE_DMA_FUA_EXT);
+    } else if (lba48) {
+        outb(ch->base + ATA_REG_COMMAND, write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT);
+    } else {
+        outb(ch->base + ATA_REG_COMMAND, write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
+    }
+    outb(ch->bm_base + ATA_BM_COMMAND, direction | ATA_BM_CMD_START);
+    
+    // One interrupt (or BSY dropping) for the whole transfer
+    int status = ata_wait_irq(ch, can_sleep);
+    uint8_t bm_status = inb(ch->bm_base + ATA_BM_STATUS);
+    outb(ch->bm_base + ATA_BM_COMMAND, 0);
+    outb(ch->bm_base + ATA_BM_STATUS, ATA_BM_STATUS_ERR | ATA_BM_STATUS_IRQ);
+    if (status < 0 || (status & (ATA_STATUS_ERR | ATA_STATUS_DF)) || (bm_status & ATA_BM_STATUS_ERR)) {
+        terminal_writestring(write ? "ATA: DMA write error\n" : "ATA: DMA read error\n");
+        return 0;
+    }
+    if (!write) {
+        memcpy(buffer, ch->dma_buffer, bytes);
+    }
+    return 1;
+}
+
+// One PIO command for the request (channel claimed, drive ready). With a
+// multiple mode set, each DRQ moves a block of sectors rather than one;
+// only that form has a FUA write.
+static int ata_pio_transfer(ata_channel_t* ch, bool can_sleep, ata_drive_t* drive, uint32_t lba,
+                            uint32_t sector_count, uint16_t* buffer, bool write, bool fua) {
+    uint16_t base = ch->base;
+    uint8_t drive_sel = drive->is_master ? ATA_DRIVE_MASTER : ATA_DRIVE_SLAVE;
+    bool lba48 = fua || ata_needs_lba48(lba, sector_count);
+    bool multiple = drive->multiple > 1;
+    uint8_t command;
+    if (fua) {
+        command = ATA_CMD_WRITE_MULTIPLE_FUA_EXT;
+    } else if (write) {
+        command = multiple ? (lba48 ? ATA_CMD_WRITE_MULTIPLE_EXT : ATA_CMD_WRITE_MULTIPLE)
+                           : (lba48 ? ATA_CMD_WRITE_SECTORS_EXT : ATA_CMD_WRITE_SECTORS);
+    } else {
+        command = multiple ? (lba48 ? ATA_CMD_READ_MULTIPLE_EXT : ATA_CMD_READ_MULTIPLE)
+                           : (lba48 ? ATA_CMD_READ_SECTORS_EXT : ATA_CMD_READ_SECTORS);
+    }
+    ata_select_lba(base, drive_sel, lba, sector_count, lba48);
+    outb(base + ATA_REG_COMMAND, command);
+    
+    if (write) {
+        // The drive asks for the first block without an interrupt; it comes
+        // within microseconds, so that one wait still polls
+        int timeout = 0;
+        uint8_t status;
+        do {
+            status = ata_read_status(base);
+            if (status & ATA_STATUS_ERR) {
+                terminal_writestring("ATA: Write error detected\n");
+                return 0;
+            }
+            timeout++;
+            if (timeout > 100000) {
+                terminal_writestring("ATA: Write timeout\n");
+                return 0;
+            }
+        } while (!(status & ATA_STATUS_DRQ) && (status & ATA_STATUS_BSY));
+    }
+    
+    uint32_t done = 0;
+    while (done < sector_count) {
+        uint32_t block = sector_count - done;
+        if (block > drive->multiple) {
+            block = drive->multiple;
+        }
+        uint16_t* block_buffer = buffer + done * 256;
+        if (write) {
+            for (uint32_t i = 0; i < block * 256; i++) {
+                outw(base + ATA_REG_DATA, block_buffer[i]);
+            }
+            // The drive interrupts as each block is on disk
+            int status = ata_wait_irq(ch, can_sleep);
+            if (status < 0 || (status & (ATA_STATUS_ERR | ATA_STATUS_DF))) {
+                terminal_writestring("ATA: Write completion error\n");
+                return 0;
+            }
+        } else {
+            // ... and as each block is ready to be read
+            int status = ata_wait_irq(ch, can_sleep);
+            if (status < 0) {
+                terminal_writestring("ATA: Read timeout\n");
+                return 0;
+            }
+            if ((status & ATA_STATUS_ERR) || !(status & ATA_STATUS_DRQ)) {
+                terminal_writestring("ATA: Read error detected\n");
+                return 0;
+            }
+            for (uint32_t i = 0; i < block * 256; i++) {
+                block_buffer[i] = inw(base + ATA_REG_DATA);
+            }
+        }
+        done += block;
+    }
+    return 1;
+}
+
+// Whether writes to the drive can be FUA commands: DMA, or PIO in
+// multiple mode
+static bool ata_fua_native(ata_drive_t* drive) {
+    bool dma = ata_channel(drive->base_port)->bm_base && drive->dma;
+    return drive->fua && drive->lba48 && (dma || drive->multiple > 1);
+}
+
+// Largest single command for this drive on its channel
+static uint32_t ata_max_chunk(ata_drive_t* drive) {
+    if (ata_channel(drive->base_port)->bm_base && drive->dma) {
+        return ATA_DMA_BYTES / 512;         // The bounce buffer
+    }
+    return drive->lba48 ? ATA_LBA48_MAX_SECTORS : ATA_LBA28_MAX_SECTORS;
+}
+
+// Account one finished command
+static void ata_account(uint8_t drive_num, bool write, uint32_t sectors, uint64_t start_ns,
+                        int result, bool timed_out) {
+    uint64_t elapsed = clock_ns() - start_ns;
+    uint32_t us = (elapsed >> 32) ? 0xFFFFFFFF : (uint32_t)elapsed / 1000;
+    uint32_t bucket = 0;
+    while (bucket < ATA_IOSTAT_BUCKETS - 1 && (us >> (bucket + 1))) {
+        bucket++;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&io_stats_lock);
+    ata_io_stats_t* stats = &io_stats[drive_num];
+    if (write) {
+        stats->writes++;
+    } else {
+        stats->reads++;
+    }
+    if (result) {
+        if (write) {
+            stats->sectors_written += sectors;
+        } else {
+            stats->sectors_read += sectors;
+        }
+    } else if (timed_out) {
+        stats->timeouts++;
+    } else {
+        stats->errors++;
+    }
+    stats->depth_sum += stats->queued;
+    stats->busy_us += us;
+    stats->latency[bucket]++;
+    spin_unlock_irqrestore(&io_stats_lock, flags);
+}
+
+// Queue depth: transfers between entering the driver and leaving it
+static void ata_queue_adjust(uint8_t drive_num, int delta) {
+    uint32_t flags = spin_lock_irqsave(&io_stats_lock);
+    ata_io_stats_t* stats = &io_stats[drive_num];
+    stats->queued += delta;
+    if (stats->queued > stats->max_depth) {
+        stats->max_depth = stats->queued;
+    }
+    spin_unlock_irqrestore(&io_stats_lock, flags);
+}
+
+// Split a request into maximal commands; the channel is claimed per
+// command, so another drive's request can get in between
+static int ata_transfer(uint8_t drive_num, uint32_t lba, uint32_t sector_count, uint16_t* buffer,
+                        bool write, bool fua) {
+    if (drive_num >= drive_count || !drives[drive_num].exists) {
+        terminal_writestring("ATA: Invalid drive number\n");
+        return 0;
+    }
+    ata_drive_t* drive = &drives[drive_num];
+    if (sector_count == 0 || lba >= drive->sectors || sector_count > drive->sectors - lba) {
+        terminal_writestring("ATA: LBA beyond drive capacity\n");
+        return 0;
+    }
+    if (!drive->lba48 && lba + sector_count > ATA_LBA28_LIMIT) {
+        terminal_writestring("ATA: LBA beyond LBA28 range\n");
+        return 0;
+    }
+    
+    ata_channel_t* ch = ata_channel(drive->base_port);
+    uint32_t max_chunk = ata_max_chunk(drive);
+    ata_queue_adjust(drive_num, 1);
+    while (sector_count > 0) {
+        uint32_t chunk = sector_count < max_chunk ? sector_count : max_chunk;
+        bool can_sleep = ata_claim(ch);
+        ata_wait_ready(ch->base);
+        uint64_t start = clock_ns();
+        int result = ch->bm_base && drive->dma
+                     ? ata_dma_transfer(ch, can_sleep, drive, lba, chunk, buffer, write, fua)
+                     : ata_pio_transfer(ch, can_sleep, drive, lba, chunk, buffer, write, fua);
+        bool timed_out = ch->timed_out;
+        ata_release(ch);
+        ata_account(drive_num, write, chunk, start, result, timed_out);
+        if (!result) {
+            ata_queue_adjust(drive_num, -1);
+            return 0;
+        }
+        lba += chunk;
+        sector_count -= chunk;
+        buffer += chunk * 256;
+    }
+    ata_queue_adjust(drive_num, -1);
+    return 1;
+}
+
+int ata_read(uint8_t drive_num, uint32_t lba, uint32_t sector_count, void* buffer) {
+    return ata_transfer(drive_num, lba, sector_count, (uint16_t*)buffer, false, false);
+}
+
+int ata_write(uint8_t drive_num, uint32_t lba, uint32_t sector_count, const void* buffer) {
+    // Safety: Don't write to first few sectors (boot sectors)
+    if (lba < 64) {
+        terminal_writestring("ATA: Write to boot area prohibited for safety\n");
+        return 0;
+    }
+    // The buffer is only read on this path
+    return ata_transfer(drive_num, lba, sector_count, (uint16_t*)buffer, true, false);
+}
+
+int ata_flush(uint8_t drive_num) {
+    if (drive_num >= drive_count || !drives[drive_num].exists) {
+        terminal_writestring("ATA: Invalid drive number\n");
+        return 0;
+    }
+    ata_drive_t* drive = &drives[drive_num];
+    if (!drive->write_cache) {
+        return 1;                   // Completed writes are already on the media
+    }
+    
+    ata_channel_t* ch = ata_channel(drive->base_port);
+    bool can_sleep = ata_claim(ch);
+    outb(ch->base + ATA_REG_DRIVE, drive->is_master ? ATA_DRIVE_MASTER : ATA_DRIVE_SLAVE);
+    ata_wait_ready(ch->base);
+    outb(ch->base + ATA_REG_COMMAND, drive->lba48 ? ATA_CMD_FLUSH_CACHE_EXT : ATA_CMD_FLUSH_CACHE);
+    int status = -1;
+    for (int i = 0; i < ATA_FLUSH_WAITS && status < 0; i++) {
+        status = ata_wait_irq(ch, can_sleep);
+    }
+    ata_release(ch);
+    
+    int result = status >= 0 && !(status & (ATA_STATUS_ERR | ATA_STATUS_DF));
+    uint32_t flags = spin_lock_irqsave(&io_stats_lock);
+    io_stats[drive_num].flushes++;
+    if (status < 0) {
+        io_stats[drive_num].timeouts++;
+    } else if (!result) {
+        io_stats[drive_num].errors++;
+    }
+    spin_unlock_irqrestore(&io_stats_lock, flags);
+    if (!result) {
+        terminal_writestring("ATA: Cache flush failed\n");
+    }
+    return result;
+}
+
+int ata_write_fua(uint8_t drive_num, uint32_t lba, uint32_t sector_count, const void* buffer) {
+    if (drive_num >= drive_count || lba < 64 || !drives[drive_num].write_cache ||
+        !ata_fua_native(&drives[drive_num])) {
+        return ata_write(drive_num, lba, sector_count, buffer) && ata_flush(drive_num);
+    }
+    return ata_transfer(drive_num, lba, sector_count, (uint16_t*)buffer, true, true);
+}
+
+bool ata_trim_supported(uint8_t drive_num) {
+    if (drive_num >= drive_count || !drives[drive_num].exists) {
+        return false;
+    }
+    return drives[drive_num].trim && ata_channel(drives[drive_num].base_port)->bm_base;
+}
+
+// One DSM TRIM command for the blocks of ranges already in the channel's
+// bounce buffer (channel claimed, drive ready). Returns the status, -1 on
+// timeout.
+static int ata_dsm_trim(ata_channel_t* ch, bool can_sleep, ata_drive_t* drive, uint32_t blocks) {
+    ch->prd[0].phys = ch->dma_phys;
+    ch->prd[0].bytes = (uint16_t)(blocks * 512);
+    ch->prd[0].flags = ATA_PRD_EOT;
+    outb(ch->bm_base + ATA_BM_COMMAND, 0);
+    ata_outl(ch->bm_base + ATA_BM_PRDT, ch->prd_phys);
+    outb(ch->bm_base + ATA_BM_STATUS, ATA_BM_STATUS_ERR | ATA_BM_STATUS_IRQ);
+    
+    ata_select_lba(ch->base, drive->is_master ? ATA_DRIVE_MASTER : ATA_DRIVE_SLAVE, 0, blocks, true);
+    outb(ch->base + ATA_REG_FEATURES, 0);               // Features, high byte then low
+    outb(ch->base + ATA_REG_FEATURES, ATA_DSM_TRIM);
+    outb(ch->base + ATA_REG_COMMAND, ATA_CMD_DSM);
+    outb(ch->bm_base + ATA_BM_COMMAND, ATA_BM_CMD_START);   // Memory to drive
+    
+    int status = ata_wait_irq(ch, can_sleep);
+    uint8_t bm_status = inb(ch->bm_base + ATA_BM_STATUS);
+    outb(ch->bm_base + ATA_BM_COMMAND, 0);
+    outb(ch->bm_base + ATA_BM_STATUS, ATA_BM_STATUS_ERR | ATA_BM_STATUS_IRQ);
+    if (status >= 0 && (bm_status & ATA_BM_STATUS_ERR)) {
+        status |= ATA_STATUS_ERR;
+    }
+    return status;
+}
+
+int ata_trim(uint8_t drive_num, const ata_trim_range_t* ranges, uint32_t count) {
+    if (!ata_trim_supported(drive_num)) {
+        return 0;
+    }
+    ata_drive_t* drive = &drives[drive_num];
+    ata_channel_t* ch = ata_channel(drive->base_port);
+    uint32_t max_entries = drive->trim_blocks * ATA_TRIM_RANGES_PER_BLOCK;
+    if (max_entries > ATA_DMA_BYTES / 8) {
+        max_entries = ATA_DMA_BYTES / 8;
+    }
+    
+    // Entries are filled in straight into the bounce buffer, a command's
+    // worth at a time; the range being split carries over
+    uint32_t next = 0;
+    uint32_t lba = count ? ranges[0].lba : 0;
+    uint32_t left = count ? ranges[0].count : 0;
+    while (next < count) {
+        bool can_sleep = ata_claim(ch);
+        uint64_t* entries = (uint64_t*)ch->dma_buffer;
+        uint32_t used = 0;
+        uint32_t sectors = 0;
+        while (used < max_entries && next < count) {
+            if (left == 0 || lba >= drive->sectors) {
+                if (++next < count) {
+                    lba = ranges[next].lba;
+                    left = ranges[next].count;
+                }
+                continue;
+            }
+            if (left > drive->sectors - lba) {
+                left = drive->sectors - lba;
+            }
+            uint32_t length = left < ATA_TRIM_MAX_RANGE ? left : ATA_TRIM_MAX_RANGE;
+            entries[used++] = (uint64_t)lba | ((uint64_t)length << 48);
+            sectors += length;
+            lba += length;
+            left -= length;
+        }
+        if (used == 0) {
+            ata_release(ch);
+            break;
+        }
+        // Unused entries in the last block are zero (length 0: ignored)
+        uint32_t blocks = (used + ATA_TRIM_RANGES_PER_BLOCK - 1) / ATA_TRIM_RANGES_PER_BLOCK;
+        memset(&entries[used], 0, (blocks * ATA_TRIM_RANGES_PER_BLOCK - used) * sizeof(uint64_t));
+        ata_wait_ready(ch->base);
+        int status = ata_dsm_trim(ch, can_sleep, drive, blocks);
+        ata_release(ch);
+        
+        int result = status >= 0 && !(status & (ATA_STATUS_ERR | ATA_STATUS_DF));
+        uint32_t flags = spin_lock_irqsave(&io_stats_lock);
+        io_stats[drive_num].trims++;
+        if (result) {
+            io_stats[drive_num].sectors_trimmed += sectors;
+        } else if (status < 0) {
+            io_stats[drive_num].timeouts++;
+        } else {
+            io_stats[drive_num].errors++;
+        }
+        spin_unlock_irqrestore(&io_stats_lock, flags);
+        if (!result) {
+            terminal_writestring("ATA: TRIM failed\n");
+            return 0;
+        }
+    }
+    return 1;
+}
 
 // Initialize ATA subsystem
 void ata_init(void) {
@@ -27,10 +614,21 @@ void ata_init(void) {
     
     drive_count = 0;
     
+    channels[0].base = ATA_PRIMARY_BASE;
+    channels[0].irq = IRQ14_ATA1;
+    channels[1].base = ATA_SECONDARY_BASE;
+    channels[1].irq = IRQ15_ATA2;
+    
     // Detect drives on both channels
     int detected = ata_detect_drives();
     
     if (detected > 0) {
+        // Drives stay at nIEN until a transfer that can sleep clears it
+        irq_register(IRQ14_ATA1, ata_irq, &channels[0]);
+        irq_register(IRQ15_ATA2, ata_irq, &channels[1]);
+        if (ata_dma_init() != 0) {
+            terminal_writestring("ATA: No bus-master DMA, transfers use PIO\n");
+        }
         terminal_writestring("ATA: Drive detection completed successfully\n");
         ata_print_drive_info();
     } else {
@@ -120,6 +718,48 @@ static void ata_extract_string(uint16_t* source, char* dest, int start_word, int
     }
 }
 
+// Issue SET MULTIPLE MODE (polled; the IRQ isn't installed yet)
+static int ata_set_multiple(ata_drive_t* drive, uint16_t sectors) {
+    uint16_t base = drive->base_port;
+    outb(base + ATA_REG_DRIVE, drive->is_master ? ATA_DRIVE_MASTER : ATA_DRIVE_SLAVE);
+    ata_wait_ready(base);
+    outb(base + ATA_REG_SECCOUNT, sectors & 0xFF);
+    outb(base + ATA_REG_COMMAND, ATA_CMD_SET_MULTIPLE);
+    for (int timeout = 0; timeout < 100000; timeout++) {
+        uint8_t status = ata_read_status(base);
+        if (!(status & ATA_STATUS_BSY)) {
+            return (status & ATA_STATUS_ERR) ? 0 : 1;
+        }
+    }
+    return 0;
+}
+
+// Size, transfer modes and block size from IDENTIFY data (base_port and
+// is_master already set)
+static void ata_read_capabilities(ata_drive_t* drive, uint16_t* identify) {
+    drive->sectors = ((uint32_t)identify[61] << 16) | identify[60];
+    drive->dma = (identify[49] >> 8) & 1;
+    drive->lba48 = (identify[83] >> 10) & 1;
+    // Word 84 only counts with its bits 15:14 reading 01
+    drive->write_cache = (identify[85] >> 5) & 1;
+    drive->fua = (identify[84] & 0xC000) == 0x4000 && (identify[84] >> 6) & 1;
+    if (drive->lba48) {
+        // Words 100-103; anything past 32 bits is out of reach anyway
+        bool huge = identify[102] || identify[103];
+        drive->sectors = huge ? 0xFFFFFFFF : ((uint32_t)identify[101] << 16) | identify[100];
+    }
+    // Word 47's low byte is the largest block the drive takes per DRQ
+    drive->multiple = 1;
+    uint16_t max_multiple = identify[47] & 0xFF;
+    if (max_multiple > 1 && ata_set_multiple(drive, max_multiple)) {
+        drive->multiple = max_multiple;
+    }
+    // DSM is a DMA command in the 48-bit form; word 105 of 0 predates the
+    // limit and means one block
+    drive->trim = drive->lba48 && drive->dma && (identify[169] & 1);
+    drive->trim_blocks = identify[105] ? identify[105] : 1;
+}
+
 // Detect all ATA drives
 int ata_detect_drives(void) {
     uint16_t identify_buffer[256];
@@ -133,7 +773,7 @@ int ata_detect_drives(void) {
         drives[detected].exists = 1;
         drives[detected].is_master = 1;
         drives[detected].base_port = ATA_PRIMARY_BASE;
-        drives[detected].sectors = ((uint32_t)identify_buffer[61] << 16) | identify_buffer[60];
+        ata_read_capabilities(&drives[detected], identify_buffer);
         
         // Extract model and serial
         ata_extract_string(identify_buffer, drives[detected].model, 27, 40);
@@ -148,7 +788,7 @@ int ata_detect_drives(void) {
         drives[detected].exists = 1;
         drives[detected].is_master = 0;
         drives[detected].base_port = ATA_PRIMARY_BASE;
-        drives[detected].sectors = ((uint32_t)identify_buffer[61] << 16) | identify_buffer[60];
+        ata_read_capabilities(&drives[detected], identify_buffer);
         
         // Extract model and serial
         ata_extract_string(identify_buffer, drives[detected].model, 27, 40);
@@ -166,7 +806,7 @@ int ata_detect_drives(void) {
         drives[detected].exists = 1;
         drives[detected].is_master = 1;
         drives[detected].base_port = ATA_SECONDARY_BASE;
-        drives[detected].sectors = ((uint32_t)identify_buffer[61] << 16) | identify_buffer[60];
+        ata_read_capabilities(&drives[detected], identify_buffer);
         
         // Extract model and serial
         ata_extract_string(identify_buffer, drives[detected].model, 27, 40);
@@ -181,7 +821,7 @@ int ata_detect_drives(void) {
         drives[detected].exists = 1;
         drives[detected].is_master = 0;
         drives[detected].base_port = ATA_SECONDARY_BASE;
-        drives[detected].sectors = ((uint32_t)identify_buffer[61] << 16) | identify_buffer[60];
+        ata_read_capabilities(&drives[detected], identify_buffer);
         
         // Extract model and serial
         ata_extract_string(identify_buffer, drives[detected].model, 27, 40);
@@ -229,7 +869,11 @@ void ata_print_drive_info(void) {
             terminal_writestring(int_to_string(drives[i].sectors));
             terminal_writestring(" (");
             terminal_writestring(int_to_string(drives[i].sectors / 2048));
-            terminal_writestring(" MB)\n\n");
+            terminal_writestring(" MB)\n");
+            if (ata_trim_supported(i)) {
+                terminal_writestring("  TRIM supported\n");
+            }
+            terminal_writestring("\n");
         }
     }
 }
@@ -246,72 +890,73 @@ int ata_get_drive_info(uint8_t drive_num, ata_drive_t* info) {
     return 1;  // Success
 }
 
-// Safely read sectors from ATA drive (read-only, no writing)
-int ata_read_sectors(uint8_t drive_num, uint32_t lba, uint8_t sector_count, uint16_t* buffer) {
-    // Safety checks
+int ata_get_io_stats(uint8_t drive_num, ata_io_stats_t* stats) {
     if (drive_num >= drive_count || !drives[drive_num].exists) {
-        terminal_writestring("ATA: Invalid drive number\n");
-        return 0;
-    }
-    
-    if (sector_count == 0 || sector_count > 128) {  // Reduced for safety
-        terminal_writestring("ATA: Invalid sector count\n");
         return 0;
     }
-    
-    if (lba >= drives[drive_num].sectors) {
-        terminal_writestring("ATA: LBA beyond drive capacity\n");
-        return 0;
+    uint32_t flags = spin_lock_irqsave(&io_stats_lock);
+    *stats = io_stats[drive_num];
+    spin_unlock_irqrestore(&io_stats_lock, flags);
+    return 1;
+}
+
+// Deltas against a snapshot taken interval_ms earlier. Utilisation is the
+// share of the interval spent in commands; a slow operation with the disk
+// near 100% is waiting on it, one near 0% is spending its time elsewhere.
+void ata_iostat(uint32_t interval_ms) {
+    ata_io_stats_t before[4];
+    memset(before, 0, sizeof(before));
+    if (interval_ms > 0) {
+        for (int i = 0; i < drive_count; i++) {
+            ata_get_io_stats(i, &before[i]);
+        }
+        timer_sleep(interval_ms);
+    } else {
+        interval_ms = get_uptime_seconds() * 1000;
     }
     
-    ata_drive_t* drive = &drives[drive_num];
-    uint16_t base = drive->base_port;
-    uint8_t drive_sel = drive->is_master ? ATA_DRIVE_MASTER : ATA_DRIVE_SLAVE;
-    
-    // Wait for drive to be ready
-    ata_wait_ready(base);
-    
-    // Set up LBA addressing (LBA28 mode)
-    outb(base + ATA_REG_FEATURES, 0x00);           // Features = 0
-    outb(base + ATA_REG_SECCOUNT, sector_count);   // Sector count
-    outb(base + ATA_REG_LBA_LOW, lba & 0xFF);      // LBA bits 0-7
-    outb(base + ATA_REG_LBA_MID, (lba >> 8) & 0xFF);   // LBA bits 8-15
-    outb(base + ATA_REG_LBA_HIGH, (lba >> 16) & 0xFF); // LBA bits 16-23
-    
-    // Drive selection with LBA bits 24-27
-    uint8_t drive_head = drive_sel | 0x40 | ((lba >> 24) & 0x0F);
-    outb(base + ATA_REG_DRIVE, drive_head);
-    
-    // Send READ SECTORS command
-    outb(base + ATA_REG_COMMAND, ATA_CMD_READ_SECTORS);
-    
-    // Read sectors one by one
-    for (int sector = 0; sector < sector_count; sector++) {
-        // Wait for drive to be ready for data transfer
-        int timeout = 0;
-        uint8_t status;
-        
-        do {
-            status = ata_read_status(base);
-            if (status & ATA_STATUS_ERR) {
-                terminal_writestring("ATA: Read error detected\n");
-                return 0;
+    terminal_printf("Disk I/O over %d ms:\n", (int)interval_ms);
+    for (int i = 0; i < drive_count; i++) {
+        ata_io_stats_t now;
+        if (!ata_get_io_stats(i, &now)) {
+            continue;
+        }
+        ata_io_stats_t* old = &before[i];
+        uint32_t commands = (now.reads - old->reads) + (now.writes - old->writes);
+        uint32_t busy = now.busy_us - old->busy_us;
+        uint32_t util = interval_ms ? busy / 10 / interval_ms : 0;
+        terminal_printf("Drive %d: %d reads (%d KB), %d writes (%d KB)\n", i,
+                        (int)(now.reads - old->reads), (int)((now.sectors_read - old->sectors_read) / 2),
+                        (int)(now.writes - old->writes),
+                        (int)((now.sectors_written - old->sectors_written) / 2));
+        terminal_printf("  %d%% busy, %d us per command, queue depth %d avg / %d max\n",
+                        (int)(util > 100 ? 100 : util), commands ? (int)(busy / commands) : 0,
+                        commands ? (int)((now.depth_sum - old->depth_sum) / commands) : 0,
+                        (int)now.max_depth);
+        terminal_printf("  %d errors, %d timeouts, %d cache flushes\n", (int)(now.errors - old->errors),
+                        (int)(now.timeouts - old->timeouts), (int)(now.flushes - old->flushes));
+        if (now.trims != old->trims) {
+            terminal_printf("  %d TRIM commands (%d KB discarded)\n", (int)(now.trims - old->trims),
+                            (int)((now.sectors_trimmed - old->sectors_trimmed) / 2));
+        }
+        for (uint32_t b = 0; b < ATA_IOSTAT_BUCKETS; b++) {
+            uint32_t count = now.latency[b] - old->latency[b];
+            if (count == 0) {
+                continue;
             }
-            timeout++;
-            if (timeout > 100000) {
-                terminal_writestring("ATA: Read timeout\n");
-                return 0;
+            terminal_printf("    %d+ us: %d ", b ? (int)(1u << b) : 0, (int)count);
+            uint32_t bar = count * 40 / commands;
+            for (uint32_t j = 0; j < bar; j++) {
+                terminal_putchar('#');
             }
-        } while (!(status & ATA_STATUS_DRQ) && (status & ATA_STATUS_BSY));
-        
-        // Read 256 words (512 bytes) for this sector
-        uint16_t* sector_buffer = buffer + (sector * 256);
-        for (int i = 0; i < 256; i++) {
-            sector_buffer[i] = inw(base + ATA_REG_DATA);
+            terminal_putchar('\n');
         }
     }
-    
-    return 1;  // Success
+}
+
+// Safely read sectors from ATA drive (read-only, no writing)
+int ata_read_sectors(uint8_t drive_num, uint32_t lba, uint8_t sector_count, uint16_t* buffer) {
+    return ata_read(drive_num, lba, sector_count, buffer);
 }
 
 // Test function to safely read first sector from first drive
@@ -370,85 +1015,7 @@ int ata_test_read(void) {
 
 // Safely write sectors to ATA drive
 int ata_write_sectors(uint8_t drive_num, uint32_t lba, uint8_t sector_count, const uint16_t* buffer) {
-    // Safety checks
-    if (drive_num >= drive_count || !drives[drive_num].exists) {
-        terminal_writestring("ATA: Invalid drive number for write\n");
-        return 0;
-    }
-    
-    if (sector_count == 0 || sector_count > 64) {  // Conservative limit for writing
-        terminal_writestring("ATA: Invalid sector count for write\n");
-        return 0;
-    }
-    
-    if (lba >= drives[drive_num].sectors) {
-        terminal_writestring("ATA: LBA beyond drive capacity for write\n");
-        return 0;
-    }
-    
-    // Additional safety: Don't write to first few sectors (boot sectors)
-    if (lba < 64) {
-        terminal_writestring("ATA: Write to boot area prohibited for safety\n");
-        return 0;
-    }
-    
-    ata_drive_t* drive = &drives[drive_num];
-    uint16_t base = drive->base_port;
-    uint8_t drive_sel = drive->is_master ? ATA_DRIVE_MASTER : ATA_DRIVE_SLAVE;
-    
-    // Wait for drive to be ready
-    ata_wait_ready(base);
-    
-    // Set up LBA addressing (LBA28 mode)
-    outb(base + ATA_REG_FEATURES, 0x00);           // Features = 0
-    outb(base + ATA_REG_SECCOUNT, sector_count);   // Sector count
-    outb(base + ATA_REG_LBA_LOW, lba & 0xFF);      // LBA bits 0-7
-    outb(base + ATA_REG_LBA_MID, (lba >> 8) & 0xFF);   // LBA bits 8-15
-    outb(base + ATA_REG_LBA_HIGH, (lba >> 16) & 0xFF); // LBA bits 16-23
-    
-    // Drive selection with LBA bits 24-27
-    uint8_t drive_head = drive_sel | 0x40 | ((lba >> 24) & 0x0F);
-    outb(base + ATA_REG_DRIVE, drive_head);
-    
-    // Send WRITE SECTORS command
-    outb(base + ATA_REG_COMMAND, ATA_CMD_WRITE_SECTORS);
-    
-    // Write sectors one by one
-    for (int sector = 0; sector < sector_count; sector++) {
-        // Wait for drive to be ready for data transfer
-        int timeout = 0;
-        uint8_t status;
-        
-        do {
-            status = ata_read_status(base);
-            if (status & ATA_STATUS_ERR) {
-                terminal_writestring("ATA: Write error detected\n");
-                return 0;
-            }
-            timeout++;
-            if (timeout > 100000) {
-                terminal_writestring("ATA: Write timeout\n");
-                return 0;
-            }
-        } while (!(status & ATA_STATUS_DRQ) && (status & ATA_STATUS_BSY));
-        
-        // Write 256 words (512 bytes) for this sector
-        const uint16_t* sector_buffer = buffer + (sector * 256);
-        for (int i = 0; i < 256; i++) {
-            outw(base + ATA_REG_DATA, sector_buffer[i]);
-        }
-        
-        // Wait for write completion
-        do {
-            status = ata_read_status(base);
-            if (status & ATA_STATUS_ERR) {
-                terminal_writestring("ATA: Write completion error\n");
-                return 0;
-            }
-        } while (status & ATA_STATUS_BSY);
-    }
-    
-    return 1;  // Success
+    return ata_write(drive_num, lba, sector_count, buffer);
 }
 
 // Safe format function - creates a simple file system structure
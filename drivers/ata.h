@@ -23,6 +23,9 @@
 #define ATA_REG_CONTROL     0x206
 #define ATA_REG_ALTSTATUS   0x206
 
+// Device Control Register Bits
+#define ATA_CTRL_NIEN       (1 << 1)  // Interrupts off (polled transfers)
+
 // ATA Status Register Bits
 #define ATA_STATUS_BSY      (1 << 7)  // Busy
 #define ATA_STATUS_DRDY     (1 << 6)  // Drive Ready
@@ -37,6 +40,61 @@
 #define ATA_CMD_IDENTIFY    0xEC
 #define ATA_CMD_READ_SECTORS 0x20
 #define ATA_CMD_WRITE_SECTORS 0x30
+#define ATA_CMD_READ_DMA    0xC8
+#define ATA_CMD_WRITE_DMA   0xCA
+#define ATA_CMD_READ_SECTORS_EXT  0x24    // LBA48 forms
+#define ATA_CMD_WRITE_SECTORS_EXT 0x34
+#define ATA_CMD_READ_DMA_EXT      0x25
+#define ATA_CMD_WRITE_DMA_EXT     0x35
+#define ATA_CMD_READ_MULTIPLE     0xC4    // One DRQ per block of sectors
+#define ATA_CMD_WRITE_MULTIPLE    0xC5
+#define ATA_CMD_READ_MULTIPLE_EXT 0x29
+#define ATA_CMD_WRITE_MULTIPLE_EXT 0x39
+#define ATA_CMD_SET_MULTIPLE      0xC6
+#define ATA_CMD_WRITE_DMA_FUA_EXT      0x3D    // Written through the cache
+#define ATA_CMD_WRITE_MULTIPLE_FUA_EXT 0xCE
+#define ATA_CMD_FLUSH_CACHE       0xE7
+#define ATA_CMD_FLUSH_CACHE_EXT   0xEA
+#define ATA_CMD_DSM               0x06    // DATA SET MANAGEMENT (DMA, 48-bit form)
+#define ATA_DSM_TRIM              0x01    // Its feature: discard the listed ranges
+
+// TRIM ranges: 8-byte entries, LBA in bits 0-47 and length in 48-63, 64
+// to a 512-byte block
+#define ATA_TRIM_RANGES_PER_BLOCK 64
+#define ATA_TRIM_MAX_RANGE        0xFFFF
+
+// Sectors one command can move
+#define ATA_LBA28_MAX_SECTORS 256
+#define ATA_LBA48_MAX_SECTORS 65536
+#define ATA_LBA28_LIMIT     0x10000000  // First sector LBA28 can't address
+
+// PCI IDE controller bus-master registers (BAR4; the secondary channel's
+// set is 8 ports further on)
+#define ATA_PCI_CLASS       0x01
+#define ATA_PCI_SUBCLASS    0x01
+#define ATA_BM_COMMAND      0x00
+#define ATA_BM_STATUS       0x02
+#define ATA_BM_PRDT         0x04
+#define ATA_BM_SECONDARY    0x08
+#define ATA_BM_CMD_START    (1 << 0)
+#define ATA_BM_CMD_READ     (1 << 3)  // Bus master writes memory (a device read)
+#define ATA_BM_STATUS_ACTIVE (1 << 0)
+#define ATA_BM_STATUS_ERR   (1 << 1)
+#define ATA_BM_STATUS_IRQ   (1 << 2)
+#define ATA_PRD_EOT         0x8000    // Last entry in the table
+
+// One bounce buffer per channel: 64KB, aligned so its single PRD entry
+// never crosses a 64KB boundary, and a shared page for the PRD tables
+#define ATA_DMA_PAGES       16
+#define ATA_DMA_BYTES       (ATA_DMA_PAGES * 4096)
+#define ATA_DMA_VIRT        (VMM_MMIO_START + 0x200000)  // PRD page, then the buffers
+
+// Physical Region Descriptor
+typedef struct {
+    uint32_t phys;
+    uint16_t bytes;           // 0 means 64KB
+    uint16_t flags;
+} __attribute__((packed)) ata_prd_t;
 
 // Drive selection bits
 #define ATA_DRIVE_MASTER    0xA0
@@ -48,10 +106,39 @@ typedef struct {
     uint8_t is_master;      // 1 if master, 0 if slave
     uint16_t base_port;     // Base I/O port
     uint32_t sectors;       // Total number of sectors
+    uint8_t dma;            // 1 if the drive does DMA (IDENTIFY word 49 bit 8)
+    uint8_t lba48;          // 1 if the drive takes 48-bit commands (word 83 bit 10)
+    uint16_t multiple;      // Sectors per DRQ block once SET MULTIPLE took (1 if not)
+    uint8_t write_cache;    // 1 if its write cache is on (word 85 bit 5)
+    uint8_t fua;            // 1 if it takes the FUA write commands (word 84 bit 6)
+    uint8_t trim;           // 1 if it takes DSM TRIM (word 169 bit 0) as a 48-bit DMA command
+    uint16_t trim_blocks;   // Most 512-byte range blocks per DSM command (word 105)
     char model[41];         // Drive model string (40 chars + null)
     char serial[21];        // Drive serial number (20 chars + null)
 } ata_drive_t;
 
+// Per-drive I/O counters. Service time runs from the command being issued
+// to its completion, on the TSC-backed clock; the histogram buckets are
+// powers of two in microseconds (bucket i is 2^i us and up).
+#define ATA_IOSTAT_BUCKETS  16
+
+typedef struct {
+    uint32_t reads;             // Commands
+    uint32_t writes;
+    uint32_t sectors_read;
+    uint32_t sectors_written;
+    uint32_t errors;            // Failed commands other than timeouts
+    uint32_t timeouts;          // No completion within ATA_IRQ_TIMEOUT_TICKS
+    uint32_t flushes;           // FLUSH CACHE commands
+    uint32_t trims;             // DSM TRIM commands
+    uint32_t sectors_trimmed;
+    uint32_t queued;            // Transfers inside the driver right now
+    uint32_t depth_sum;         // queued as each command finished
+    uint32_t max_depth;
+    uint32_t busy_us;           // Total service time (wraps; use deltas)
+    uint32_t latency[ATA_IOSTAT_BUCKETS];
+} ata_io_stats_t;
+
 // Function declarations
 void ata_init(void);
 int ata_detect_drives(void);
@@ -62,6 +149,41 @@ uint8_t ata_read_status(uint16_t base);
 void ata_wait_ready(uint16_t base);
 int ata_identify_drive(uint16_t base, uint8_t drive, uint16_t* buffer);
 
+// Bus-master DMA through the PCI IDE controller (needs the VMM); transfers
+// fall back to PIO without it
+int ata_dma_init(void);
+
+// Any number of sectors; split into the largest commands the drive and
+// transfer mode allow. Return 1 on success, 0 on failure.
+int ata_read(uint8_t drive_num, uint32_t lba, uint32_t sector_count, void* buffer);
+int ata_write(uint8_t drive_num, uint32_t lba, uint32_t sector_count, const void* buffer);
+
+// Write-cache control. ata_flush makes every completed write durable;
+// ata_write_fua is a write that is durable when it returns, with FUA
+// commands where the drive has them and a flush after it where not.
+// Both are plain without a write cache on.
+int ata_flush(uint8_t drive_num);
+int ata_write_fua(uint8_t drive_num, uint32_t lba, uint32_t sector_count, const void* buffer);
+
+// Discard: tell the drive the sectors hold nothing worth keeping, so an
+// SSD or a thin-provisioned disk can reclaim them. Ranges over
+// ATA_TRIM_MAX_RANGE sectors are split, and as many ranges go into each
+// command as the drive takes. ata_trim_supported is false for drives
+// (or channels without DMA) that can't; ata_trim fails on them.
+typedef struct {
+    uint32_t lba;
+    uint32_t count;
+} ata_trim_range_t;
+
+bool ata_trim_supported(uint8_t drive_num);
+int ata_trim(uint8_t drive_num, const ata_trim_range_t* ranges, uint32_t count);
+
+// Copy a drive's counters; 0 if there is no such drive
+int ata_get_io_stats(uint8_t drive_num, ata_io_stats_t* stats);
+
+// Print what each drive did over interval_ms (0: since boot)
+void ata_iostat(uint32_t interval_ms);
+
 // Phase 2: Safe disk reading functions
 int ata_read_sectors(uint8_t drive_num, uint32_t lba, uint8_t sector_count, uint16_t* buffer);
 int ata_get_drive_info(uint8_t drive_num, ata_drive_t* info);
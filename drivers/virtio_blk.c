@@ -0,0 +1,330 @@
+// ClaudeOS Virtio Block Driver Implementation - Day 21
+// Like AHCI, each drive takes commands from the block layer until its
+// depth is reached and hands them back through blk_complete. A command's
+// data descriptors point straight at the requests' own buffers (buffer
+// cache blocks, swap pages), one per physical run, so nothing is copied.
+// Each command is published on its own, and the device is only notified
+// when avail_event says it went idle; completions interrupt once per
+// batch the device finishes, since used_event only moves on a reap.
+
+#include "virtio_blk.h"
+#include "../kernel/pci.h"
+#include "../kernel/pic.h"
+#include "../kernel/irq.h"
+#include "../kernel/pmm.h"
+#include "../kernel/lock.h"
+#include "../kernel/kernel.h"
+#include "../kernel/string.h"
+#include "../kernel/initcall.h"
+
+typedef struct {
+    pci_device_t* pci;
+    uint16_t io;
+    uint8_t drive;                  // Block-layer drive number
+    spinlock_t lock;                // Unregistered; guards the ring, slots and outstanding
+    virtq_t queue;
+    bool indirect;
+    bool read_only;
+    bool flush;                     // VIRTIO_BLK_F_FLUSH: a write-back cache to flush
+    uint32_t sectors;
+    uint32_t seg_max;               // Data descriptors a command may use
+    virtio_blk_slot_t* slots;
+    uint32_t slots_phys;
+    blk_command_t* commands[VIRTIO_BLK_SLOTS];
+    uint32_t outstanding;           // Slots issued
+    uint32_t issued;
+    uint32_t flushes;
+    uint32_t errors;
+    uint32_t irqs;
+    blk_driver_t driver;            // queue_depth is per drive
+} vblk_drive_t;
+
+static vblk_drive_t vblk_drives[VIRTIO_BLK_MAX_DRIVES];
+static int vblk_drive_count = 0;
+static bool vblk_probed = false;
+
+static inline uint32_t vblk_slot_phys(vblk_drive_t* d, uint32_t slot) {
+    return d->slots_phys + slot * VIRTIO_BLK_SLOT_SIZE;
+}
+
+// Describe a buffer to the device, one descriptor per physical run it
+// covers, chained on from index (table entries are numbered from base in
+// the ring). Returns the next free entry, or -1 past limit.
+static int vblk_add_segment(volatile virtq_desc_t* table, int index, int limit, uint32_t base,
+                            void* buffer, uint32_t bytes, uint16_t flags) {
+    uint32_t virt = (uint32_t)buffer;
+    while (bytes > 0) {
+        uint32_t in_page = PAGE_SIZE - (virt & (PAGE_SIZE - 1));
+        uint32_t chunk = bytes < in_page ? bytes : in_page;
+        uint32_t phys = vmm_get_physical_address(kernel_page_directory, virt);
+        if (!phys) {
+            return -1;
+        }
+        // Physically adjacent pages share a descriptor; entry 0 is the header
+        volatile virtq_desc_t* prev = index > 1 ? &table[index - 1] : NULL;
+        if (prev && prev->addr_low + prev->length == phys) {
+            prev->length += chunk;
+        } else {
+            if (index >= limit) {
+                return -1;
+            }
+            table[index].addr_low = phys;
+            table[index].addr_high = 0;
+            table[index].length = chunk;
+            table[index].flags = flags | VIRTQ_DESC_F_NEXT;
+            table[index].next = (uint16_t)(base + index + 1);
+            index++;
+        }
+        virt += chunk;
+        bytes -= chunk;
+    }
+    return index;
+}
+
+// Chain cmd in slot: header, data, status (drive lock held). *head gets
+// the ring descriptor to publish.
+static int vblk_build(vblk_drive_t* d, uint32_t slot, blk_command_t* cmd, uint16_t* head) {
+    virtio_blk_slot_t* s = &d->slots[slot];
+    uint32_t phys = vblk_slot_phys(d, slot);
+    uint32_t base = d->indirect ? 0 : slot * VIRTIO_BLK_CHAIN;
+    volatile virtq_desc_t* table = d->indirect ? s->table : &d->queue.desc[base];
+
+    bool flush = (cmd->flags & BLK_CMD_FLUSH) != 0;
+    s->header.type = flush ? VIRTIO_BLK_T_FLUSH : cmd->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    s->header.ioprio = 0;
+    s->header.sector_low = flush ? 0 : cmd->lba;
+    s->header.sector_high = 0;
+    s->status = 0xFF;
+    table[0].addr_low = phys + __builtin_offsetof(virtio_blk_slot_t, header);
+    table[0].addr_high = 0;
+    table[0].length = sizeof(virtio_blk_hdr_t);
+    table[0].flags = VIRTQ_DESC_F_NEXT;
+    table[0].next = (uint16_t)(base + 1);
+
+    int entries = 1;
+    uint16_t data_flags = cmd->write ? 0 : VIRTQ_DESC_F_WRITE;
+    for (blk_request_t* req = flush ? NULL : cmd->requests; req; req = req->fifo_next) {
+        entries = vblk_add_segment(table, entries, 1 + (int)d->seg_max, base, req->buffer,
+                                   req->count * BLK_SECTOR_SIZE, data_flags);
+        if (entries < 0) {
+            return -1;
+        }
+    }
+    table[entries].addr_low = phys + __builtin_offsetof(virtio_blk_slot_t, status);
+    table[entries].addr_high = 0;
+    table[entries].length = 1;
+    table[entries].flags = VIRTQ_DESC_F_WRITE;
+    table[entries].next = 0;
+    entries++;
+
+    if (d->indirect) {
+        volatile virtq_desc_t* desc = &d->queue.desc[slot];
+        desc->addr_low = phys + __builtin_offsetof(virtio_blk_slot_t, table);
+        desc->addr_high = 0;
+        desc->length = entries * sizeof(virtq_desc_t);
+        desc->flags = VIRTQ_DESC_F_INDIRECT;
+        desc->next = 0;
+        *head = (uint16_t)slot;
+    } else {
+        *head = (uint16_t)base;
+    }
+    return 0;
+}
+
+// Finish whatever the device is done with, then ask for an interrupt at
+// the next completion; anything that beat the request is taken too
+static void vblk_reap(vblk_drive_t* d) {
+    blk_command_t* done[VIRTIO_BLK_SLOTS];
+    int results[VIRTIO_BLK_SLOTS];
+    uint32_t count = 0;
+
+    uint32_t flags = spin_lock_irqsave(&d->lock);
+    do {
+        uint32_t head, length;
+        while (virtq_take(&d->queue, &head, &length)) {
+            uint32_t slot = d->indirect ? head : head / VIRTIO_BLK_CHAIN;
+            if (slot >= VIRTIO_BLK_SLOTS || !(d->outstanding & (1u << slot))) {
+                continue;
+            }
+            bool ok = d->slots[slot].status == VIRTIO_BLK_S_OK;
+            if (!ok) {
+                d->errors++;
+            }
+            done[count] = d->commands[slot];
+            results[count++] = ok;
+            d->commands[slot] = NULL;
+            d->outstanding &= ~(1u << slot);
+        }
+    } while (virtq_arm(&d->queue));
+    spin_unlock_irqrestore(&d->lock, flags);
+
+    for (uint32_t i = 0; i < count; i++) {
+        blk_complete(done[i], results[i]);
+    }
+}
+
+// Top half: reading the ISR byte acknowledges and deasserts the line
+static int vblk_irq(void* ctx) {
+    vblk_drive_t* d = (vblk_drive_t*)ctx;
+    uint8_t cause = inb(d->io + VIRTIO_PCI_ISR);
+    if (!cause) {
+        return IRQ_NONE;
+    }
+    d->irqs++;
+    if (cause & VIRTIO_ISR_QUEUE) {
+        vblk_reap(d);
+    }
+    return IRQ_HANDLED;
+}
+
+static void vblk_poll(void) {
+    for (int i = 0; i < vblk_drive_count; i++) {
+        if (vblk_drives[i].outstanding) {
+            vblk_reap(&vblk_drives[i]);
+        }
+    }
+}
+
+static vblk_drive_t* vblk_drive_of(uint8_t drive) {
+    int index = (int)drive - VIRTIO_BLK_DRIVE_BASE;
+    return (index >= 0 && index < vblk_drive_count) ? &vblk_drives[index] : NULL;
+}
+
+// Block-layer entry: put cmd in a free slot and publish it. There is no
+// FUA write, so the block layer follows those with a flush.
+static int vblk_start(blk_command_t* cmd) {
+    vblk_drive_t* d = vblk_drive_of(cmd->drive);
+    bool flush = (cmd->flags & BLK_CMD_FLUSH) != 0;
+    if (!d || (!flush && (cmd->count == 0 || cmd->lba >= d->sectors ||
+                          cmd->count > d->sectors - cmd->lba || (cmd->write && d->read_only)))) {
+        return -1;
+    }
+    if (flush && !d->flush) {
+        blk_complete(cmd, 1);       // Written through: nothing is cached
+        return 0;
+    }
+    uint32_t flags = spin_lock_irqsave(&d->lock);
+    uint32_t slot = 0;
+    while (slot < d->driver.queue_depth && (d->outstanding & (1u << slot))) {
+        slot++;
+    }
+    uint16_t head;
+    if (slot == d->driver.queue_depth || vblk_build(d, slot, cmd, &head) != 0) {
+        spin_unlock_irqrestore(&d->lock, flags);
+        return -1;
+    }
+    cmd->tag = slot;
+    d->commands[slot] = cmd;
+    d->outstanding |= 1u << slot;
+    d->issued++;
+    if (flush) {
+        d->flushes++;
+    }
+    uint16_t old = d->queue.avail_idx;
+    virtq_add(&d->queue, head);
+    virtq_publish(&d->queue, old);
+    spin_unlock_irqrestore(&d->lock, flags);
+    return 0;
+}
+
+// Negotiate, set up the queue and slots, and register the drive. 0 on success.
+static int vblk_device_init(vblk_drive_t* d, pci_device_t* dev, uint32_t virt) {
+    if (!(dev->bars[0] & PCI_BAR_IO)) {
+        return -1;
+    }
+    pci_enable_bus_master(dev);
+    d->pci = dev;
+    d->io = (uint16_t)(dev->bars[0] & 0xFFFC);
+    uint32_t features = virtio_negotiate(d->io, VIRTIO_BLK_FEATURES);
+    d->indirect = (features & VIRTIO_RING_F_INDIRECT_DESC) != 0;
+    d->read_only = (features & VIRTIO_BLK_F_RO) != 0;
+    d->flush = (features & VIRTIO_BLK_F_FLUSH) != 0;
+    if (virtq_setup(&d->queue, d->io, 0, d->indirect ? VIRTIO_BLK_SLOTS : VIRTIO_BLK_CHAIN,
+                    (features & VIRTIO_RING_F_EVENT_IDX) != 0, virt) != 0) {
+        virtio_fail(d->io);
+        return -1;
+    }
+    uint32_t phys = pmm_alloc_pages(VIRTIO_BLK_SLOT_PAGES, 1);
+    if (!phys) {
+        virtio_fail(d->io);
+        return -1;
+    }
+    uint32_t slots_virt = virt + VIRTQ_MAX_PAGES * PAGE_SIZE;
+    virtio_map(slots_virt, phys, VIRTIO_BLK_SLOT_PAGES);
+    memset((void*)slots_virt, 0, VIRTIO_BLK_SLOT_PAGES * PAGE_SIZE);
+    d->slots = (virtio_blk_slot_t*)slots_virt;
+    d->slots_phys = phys;
+
+    // The low 32 bits of the capacity are all we address
+    uint32_t config = d->io + VIRTIO_PCI_CONFIG;
+    d->sectors = inl(config + VIRTIO_BLK_CONFIG_CAPACITY + 4) ? 0xFFFFFFFF
+                                                               : inl(config + VIRTIO_BLK_CONFIG_CAPACITY);
+    d->seg_max = VIRTIO_BLK_MAX_SEGMENTS;
+    if (features & VIRTIO_BLK_F_SEG_MAX) {
+        uint32_t seg_max = inl(config + VIRTIO_BLK_CONFIG_SEG_MAX);
+        if (seg_max > 0 && seg_max < d->seg_max) {
+            d->seg_max = seg_max;
+        }
+    }
+    uint32_t depth = d->indirect ? VIRTIO_BLK_SLOTS : d->queue.size / VIRTIO_BLK_CHAIN;
+    if (depth > VIRTIO_BLK_SLOTS) {
+        depth = VIRTIO_BLK_SLOTS;
+    }
+
+    d->drive = (uint8_t)(VIRTIO_BLK_DRIVE_BASE + vblk_drive_count);
+    d->driver.name = "virtio-blk";
+    d->driver.queue_depth = depth;
+    d->driver.start = vblk_start;
+    d->driver.poll = vblk_poll;
+    virtio_driver_ok(d->io);
+    pic_route_pci(dev->irq_line);
+    irq_register(dev->irq_line, vblk_irq, d);
+    return blk_register_driver(d->drive, &d->driver);
+}
+
+int virtio_blk_init(void) {
+    if (vblk_probed) {
+        return vblk_drive_count > 0 ? vblk_drive_count : -1;
+    }
+    if (!kernel_page_directory) {
+        return -1;
+    }
+    vblk_probed = true;
+    pci_init();
+    pci_device_t* dev = pci_find_device(VIRTIO_VENDOR_ID, VIRTIO_BLK_DEVICE_ID);
+    for (; dev && vblk_drive_count < VIRTIO_BLK_MAX_DRIVES;
+         dev = pci_find_next(VIRTIO_VENDOR_ID, VIRTIO_BLK_DEVICE_ID, dev)) {
+        uint32_t virt = VIRTIO_BLK_VIRT + vblk_drive_count * VIRTIO_BLK_DRIVE_PAGES * PAGE_SIZE;
+        if (vblk_device_init(&vblk_drives[vblk_drive_count], dev, virt) == 0) {
+            vblk_drive_count++;
+        } else {
+            terminal_printf("virtio-blk: Device at %d:%d.%d did not come up\n",
+                            dev->bus, dev->slot, dev->function);
+        }
+    }
+    return vblk_drive_count > 0 ? vblk_drive_count : -1;
+}
+
+static void vblk_initcall(void) {
+    virtio_blk_init();
+}
+
+INITCALL(initcall_virtio_blk, "virtio-blk", vblk_initcall, INIT_LAZY, "pci");
+
+void virtio_blk_print_info(void) {
+    if (vblk_drive_count == 0) {
+        terminal_writestring("virtio-blk: No disks\n");
+        return;
+    }
+    terminal_printf("virtio-blk: %d disk%s\n", vblk_drive_count, vblk_drive_count == 1 ? "" : "s");
+    for (int i = 0; i < vblk_drive_count; i++) {
+        vblk_drive_t* d = &vblk_drives[i];
+        terminal_printf("  Drive %d (irq %d): %d MB%s, depth %d, %s descriptors\n", (int)d->drive,
+                        d->pci->irq_line, (int)(d->sectors / 2048), d->read_only ? " read-only" : "",
+                        (int)d->driver.queue_depth, d->indirect ? "indirect" : "direct");
+        terminal_printf("    %d commands (%d flushes%s), %d errors, %d IRQs; %d notified, %d suppressed\n",
+                        (int)d->issued, (int)d->flushes, d->flush ? "" : ", write-through",
+                        (int)d->errors, (int)d->irqs,
+                        (int)d->queue.kicks, (int)d->queue.kicks_saved);
+    }
+}
@@ -0,0 +1,74 @@
+// ClaudeOS Virtio Block Driver - Day 21
+// Legacy virtio-blk disks as queued block-layer drivers: many commands in
+// flight at once, each a scatter-gather chain over the callers' buffers
+
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+#include "../kernel/types.h"
+#include "../kernel/virtio.h"
+#include "../kernel/block.h"
+
+#define VIRTIO_BLK_DEVICE_ID        0x1001      // Transitional block device
+
+// Feature bits
+#define VIRTIO_BLK_F_SEG_MAX        (1u << 2)   // seg_max in the config space
+#define VIRTIO_BLK_F_RO             (1u << 5)
+#define VIRTIO_BLK_F_FLUSH          (1u << 9)   // Write-back cache; without it the device writes through
+#define VIRTIO_BLK_FEATURES         (VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_RO | VIRTIO_BLK_F_FLUSH | \
+                                     VIRTIO_RING_F_INDIRECT_DESC | VIRTIO_RING_F_EVENT_IDX)
+
+// Config space (after VIRTIO_PCI_CONFIG)
+#define VIRTIO_BLK_CONFIG_CAPACITY  0           // 64-bit, in 512-byte sectors
+#define VIRTIO_BLK_CONFIG_SEG_MAX   12
+
+#define VIRTIO_BLK_T_IN             0
+#define VIRTIO_BLK_T_OUT            1
+#define VIRTIO_BLK_T_FLUSH          4
+#define VIRTIO_BLK_S_OK             0
+
+// Data descriptors per command: enough for BLK_MAX_SEGMENTS requests of
+// BLK_MAX_MERGE_SECTORS between them, each split at page boundaries
+#define VIRTIO_BLK_MAX_SEGMENTS     40
+#define VIRTIO_BLK_CHAIN            (VIRTIO_BLK_MAX_SEGMENTS + 2)   // Header and status too
+
+// Commands a drive holds at once. With indirect descriptors each one
+// takes a single ring entry and its chain lives in its slot; without,
+// the slot owns VIRTIO_BLK_CHAIN ring descriptors and the ring size caps
+// the depth.
+#define VIRTIO_BLK_SLOTS            32
+#define VIRTIO_BLK_SLOT_SIZE        1024
+#define VIRTIO_BLK_SLOT_PAGES       (VIRTIO_BLK_SLOTS * VIRTIO_BLK_SLOT_SIZE / PAGE_SIZE)
+
+#define VIRTIO_BLK_MAX_DRIVES       4
+#define VIRTIO_BLK_VIRT             (VMM_MMIO_START + 0x100000)   // Ring, then slots, per drive
+#define VIRTIO_BLK_DRIVE_PAGES      (VIRTQ_MAX_PAGES + VIRTIO_BLK_SLOT_PAGES)
+
+// Block-layer drive numbers after the ATA and AHCI ones
+#define VIRTIO_BLK_DRIVE_BASE       16
+
+// The header descriptor: device-readable
+typedef struct {
+    uint32_t type;                      // VIRTIO_BLK_T_*
+    uint32_t ioprio;
+    uint32_t sector_low;
+    uint32_t sector_high;
+} virtio_blk_hdr_t;
+
+// One command's memory: its indirect table, header and status byte
+typedef struct {
+    virtq_desc_t table[VIRTIO_BLK_CHAIN];
+    virtio_blk_hdr_t header;
+    volatile uint8_t status;            // Device writes VIRTIO_BLK_S_*
+    uint8_t reserved[VIRTIO_BLK_SLOT_SIZE - VIRTIO_BLK_CHAIN * sizeof(virtq_desc_t) -
+                     sizeof(virtio_blk_hdr_t) - 1];
+} virtio_blk_slot_t;
+
+_Static_assert(sizeof(virtio_blk_slot_t) == VIRTIO_BLK_SLOT_SIZE, "virtio-blk slot size");
+
+// Find the virtio disks and register them with the block layer; returns
+// how many, -1 without any
+int virtio_blk_init(void);
+void virtio_blk_print_info(void);
+
+#endif // VIRTIO_BLK_H
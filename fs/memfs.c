@@ -4,6 +4,7 @@
 #include "memfs.h"
 #include "../kernel/kernel.h"
 #include "../kernel/heap.h"
+#include "../kernel/string.h"
 
 // Global file system state
 static memfs_file_t file_table[MEMFS_MAX_FILES];
@@ -11,45 +12,6 @@ static memfs_fd_t fd_table[MEMFS_MAX_FD];
 static bool memfs_initialized = false;
 static uint32_t next_timestamp = 1;
 
-// String utility functions for memfs
-static size_t memfs_strlen(const char* str) {
-    size_t len = 0;
-    while (str[len] && len < MEMFS_MAX_FILENAME - 1) len++;
-    return len;
-}
-
-static int memfs_strcmp(const char* str1, const char* str2) {
-    while (*str1 && *str2 && *str1 == *str2) {
-        str1++;
-        str2++;
-    }
-    return *str1 - *str2;
-}
-
-static void memfs_strcpy(char* dest, const char* src, size_t max_len) {
-    size_t i = 0;
-    while (src[i] && i < max_len - 1) {
-        dest[i] = src[i];
-        i++;
-    }
-    dest[i] = '\0';
-}
-
-static void memfs_memcpy(void* dest, const void* src, size_t count) {
-    uint8_t* d = (uint8_t*)dest;
-    const uint8_t* s = (const uint8_t*)src;
-    for (size_t i = 0; i < count; i++) {
-        d[i] = s[i];
-    }
-}
-
-static void memfs_memset(void* ptr, int value, size_t count) {
-    uint8_t* p = (uint8_t*)ptr;
-    for (size_t i = 0; i < count; i++) {
-        p[i] = (uint8_t)value;
-    }
-}
-
 // VGA helper function for memfs
 static inline uint8_t vga_entry_color(vga_color fg, vga_color bg) {
     return fg | bg << 4;
@@ -62,19 +24,19 @@ void memfs_init(void) {
     
     // Clear file table
     for (int i = 0; i < MEMFS_MAX_FILES; i++) {
-        memfs_memset(&file_table[i], 0, sizeof(memfs_file_t));
+        memset(&file_table[i], 0, sizeof(memfs_file_t));
         file_table[i].in_use = false;
     }
     
     // Clear file descriptor table
     for (int i = 0; i < MEMFS_MAX_FD; i++) {
-        memfs_memset(&fd_table[i], 0, sizeof(memfs_fd_t));
+        memset(&fd_table[i], 0, sizeof(memfs_fd_t));
         fd_table[i].file_index = -1;
         fd_table[i].in_use = false;
     }
     
     // Create root directory (index 0)
-    memfs_strcpy(file_table[0].name, "/", MEMFS_MAX_FILENAME);
+    strlcpy(file_table[0].name, "/", MEMFS_MAX_FILENAME);
     file_table[0].type = MEMFS_TYPE_DIR;
     file_table[0].size = 0;
     file_table[0].in_use = true;
@@ -111,7 +73,7 @@ static int memfs_find_file(const char* filename) {
     
     for (int i = 0; i < MEMFS_MAX_FILES; i++) {
         if (file_table[i].in_use && 
-            memfs_strcmp(file_table[i].name, filename) == 0) {
+            strcmp(file_table[i].name, filename) == 0) {
             return i;
         }
     }
@@ -141,7 +103,7 @@ static int memfs_find_free_fd(void) {
 // Validate filename
 static bool memfs_valid_filename(const char* filename) {
     if (!filename || filename[0] == '\0') return false;
-    if (memfs_strlen(filename) >= MEMFS_MAX_FILENAME) return false;
+    if (strnlen(filename, MEMFS_MAX_FILENAME - 1) >= MEMFS_MAX_FILENAME) return false;
     
     // Check for invalid characters
     for (size_t i = 0; filename[i]; i++) {
@@ -177,14 +139,14 @@ int memfs_create(const char* filename) {
     }
     
     // Create file
-    memfs_strcpy(file_table[index].name, filename, MEMFS_MAX_FILENAME);
+    strlcpy(file_table[index].name, filename, MEMFS_MAX_FILENAME);
     file_table[index].type = MEMFS_TYPE_FILE;
     file_table[index].size = 0;
     file_table[index].in_use = true;
     file_table[index].created_time = next_timestamp++;
     file_table[index].modified_time = file_table[index].created_time;
     
-    memfs_memset(file_table[index].data, 0, MEMFS_MAX_FILESIZE);
+    memset(file_table[index].data, 0, MEMFS_MAX_FILESIZE);
     
     return MEMFS_SUCCESS;
 }
@@ -263,7 +225,7 @@ int memfs_read(int fd, void* buffer, size_t count) {
     }
     
     // Copy data
-    memfs_memcpy(buffer, &file_table[file_index].data[position], bytes_to_read);
+    memcpy(buffer, &file_table[file_index].data[position], bytes_to_read);
     fd_table[fd].position += bytes_to_read;
     
     return bytes_to_read;
@@ -295,7 +257,7 @@ int memfs_write(int fd, const void* buffer, size_t count) {
     }
     
     // Copy data
-    memfs_memcpy(&file_table[file_index].data[position], buffer, count);
+    memcpy(&file_table[file_index].data[position], buffer, count);
     fd_table[fd].position += count;
     
     // Update file size if necessary
@@ -317,7 +279,7 @@ int memfs_list(memfs_dirent_t* entries, size_t max_entries) {
     size_t count = 0;
     for (int i = 0; i < MEMFS_MAX_FILES && count < max_entries; i++) {
         if (file_table[i].in_use) {
-            memfs_strcpy(entries[count].name, file_table[i].name, MEMFS_MAX_FILENAME);
+            strlcpy(entries[count].name, file_table[i].name, MEMFS_MAX_FILENAME);
             entries[count].type = file_table[i].type;
             entries[count].size = file_table[i].size;
             count++;
@@ -415,8 +377,167 @@ int memfs_delete(const char* filename) {
     }
     
     // Clear file entry
-    memfs_memset(&file_table[index], 0, sizeof(memfs_file_t));
+    memset(&file_table[index], 0, sizeof(memfs_file_t));
     file_table[index].in_use = false;
     
     return MEMFS_SUCCESS;
-}
\ No newline at end of file
+}
+
+// VFS side (Day 21). The namespace is flat: "/name" only, and handles are
+// slots in file_table, so this file system's own descriptors go unused.
+
+static const char* memfs_vfs_name(const char* path) {
+    while (*path == '/') {
+        path++;
+    }
+    for (const char* c = path; *c; c++) {
+        if (*c == '/') {
+            return NULL;
+        }
+    }
+    return path;
+}
+
+static int memfs_vfs_open(void* data, const char* path, uint32_t flags, int32_t* handle) {
+    (void)data;
+    const char* name = memfs_vfs_name(path);
+    if (!name) {
+        return VFS_ERROR_NOT_FOUND;
+    }
+    if (name[0] == '\0') {
+        return VFS_ERROR_IS_DIR;
+    }
+    int index = memfs_find_file(name);
+    if (index < 0 && (flags & VFS_O_CREATE)) {
+        int result = memfs_create(name);
+        if (result != MEMFS_SUCCESS) {
+            return result == MEMFS_NO_SPACE ? VFS_ERROR_NO_SPACE : VFS_ERROR_INVALID_PATH;
+        }
+        index = memfs_find_file(name);
+    }
+    if (index < 0) {
+        return VFS_ERROR_NOT_FOUND;
+    }
+    if ((flags & VFS_O_TRUNCATE) && (flags & VFS_O_WRITE)) {
+        file_table[index].size = 0;
+        memfs_update_timestamps(index);
+    }
+    *handle = index;
+    return VFS_SUCCESS;
+}
+
+static int memfs_vfs_close(void* data, int32_t handle) {
+    (void)data;
+    (void)handle;
+    return VFS_SUCCESS;
+}
+
+static memfs_file_t* memfs_vfs_file(int32_t handle) {
+    if (handle <= 0 || handle >= MEMFS_MAX_FILES || !file_table[handle].in_use) {
+        return NULL;
+    }
+    return &file_table[handle];
+}
+
+static int memfs_vfs_read(void* data, int32_t handle, uint32_t offset, void* buffer, uint32_t size) {
+    (void)data;
+    memfs_file_t* file = memfs_vfs_file(handle);
+    if (!file) {
+        return VFS_ERROR_INVALID_FD;
+    }
+    if (offset >= file->size) {
+        return 0;
+    }
+    if (size > file->size - offset) {
+        size = file->size - offset;
+    }
+    memcpy(buffer, &file->data[offset], size);
+    return (int)size;
+}
+
+static int memfs_vfs_write(void* data, int32_t handle, uint32_t offset, const void* buffer, uint32_t size) {
+    (void)data;
+    memfs_file_t* file = memfs_vfs_file(handle);
+    if (!file) {
+        return VFS_ERROR_INVALID_FD;
+    }
+    if (offset >= MEMFS_MAX_FILESIZE) {
+        return VFS_ERROR_NO_SPACE;
+    }
+    if (size > MEMFS_MAX_FILESIZE - offset) {
+        size = MEMFS_MAX_FILESIZE - offset;
+    }
+    if (offset > file->size) {
+        memset(&file->data[file->size], 0, offset - file->size);
+    }
+    memcpy(&file->data[offset], buffer, size);
+    if (offset + size > file->size) {
+        file->size = offset + size;
+    }
+    memfs_update_timestamps(handle);
+    return (int)size;
+}
+
+static int memfs_vfs_size(void* data, int32_t handle) {
+    (void)data;
+    memfs_file_t* file = memfs_vfs_file(handle);
+    return file ? (int)file->size : VFS_ERROR_INVALID_FD;
+}
+
+static int memfs_vfs_stat(void* data, const char* path, vfs_stat_t* stat) {
+    (void)data;
+    const char* name = memfs_vfs_name(path);
+    int index = !name ? -1 : name[0] == '\0' ? 0 : memfs_find_file(name);
+    if (index < 0) {
+        return VFS_ERROR_NOT_FOUND;
+    }
+    stat->size = file_table[index].size;
+    stat->type = file_table[index].type == MEMFS_TYPE_DIR ? VFS_TYPE_DIR : VFS_TYPE_FILE;
+    return VFS_SUCCESS;
+}
+
+static int memfs_vfs_readdir(void* data, const char* path, uint32_t* cursor, vfs_dirent_t* entries,
+                             int max_entries) {
+    (void)data;
+    const char* name = memfs_vfs_name(path);
+    if (!name || name[0] != '\0') {
+        return name && memfs_find_file(name) >= 0 ? VFS_ERROR_NOT_DIR : VFS_ERROR_NOT_FOUND;
+    }
+    int count = 0;
+    // Not the root itself; the cursor is the table slot to go on from
+    for (int i = *cursor > 1 ? (int)*cursor : 1; i < MEMFS_MAX_FILES && count < max_entries; i++) {
+        if (file_table[i].in_use) {
+            memset(&entries[count], 0, sizeof(vfs_dirent_t));
+            strlcpy(entries[count].name, file_table[i].name, VFS_MAX_NAME);
+            entries[count].size = file_table[i].size;
+            entries[count].type = file_table[i].type == MEMFS_TYPE_DIR ? VFS_TYPE_DIR : VFS_TYPE_FILE;
+            count++;
+            *cursor = i + 1;
+        }
+    }
+    return count;
+}
+
+static int memfs_vfs_unlink(void* data, const char* path) {
+    (void)data;
+    const char* name = memfs_vfs_name(path);
+    if (!name) {
+        return VFS_ERROR_NOT_FOUND;
+    }
+    int result = memfs_delete(name);
+    return result == MEMFS_SUCCESS ? VFS_SUCCESS : VFS_ERROR_NOT_FOUND;
+}
+
+// memfs_mkdir was never written, so there is no mkdir
+const vfs_ops_t memfs_vfs_ops = {
+    .name = "memfs",
+    .open = memfs_vfs_open,
+    .close = memfs_vfs_close,
+    .read = memfs_vfs_read,
+    .write = memfs_vfs_write,
+    .size = memfs_vfs_size,
+    .stat = memfs_vfs_stat,
+    .readdir = memfs_vfs_readdir,
+    .mkdir = NULL,
+    .unlink = memfs_vfs_unlink,
+};
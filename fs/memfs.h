@@ -5,6 +5,7 @@
 #define MEMFS_H
 
 #include "../kernel/types.h"
+#include "../kernel/vfs.h"
 
 // File system constants (no hardcoding)
 #define MEMFS_MAX_FILES 32          // Maximum number of files
@@ -96,4 +97,7 @@ void memfs_get_stats(memfs_stats_t* stats);
 void memfs_list_files(void);
 int memfs_copy(const char* source, const char* dest);
 
+// Day 21: the file system as the VFS sees it
+extern const vfs_ops_t memfs_vfs_ops;
+
 #endif // MEMFS_H
\ No newline at end of file
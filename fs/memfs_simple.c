@@ -4,6 +4,11 @@
 #include "memfs_simple.h"
 #include "../kernel/kernel.h"
 #include "../kernel/string.h"
+#include "../kernel/pmm.h"
+#include "../kernel/initcall.h"
+#include "../kernel/heap.h"
+#include "../kernel/block.h"
+#include "../kernel/crc32c.h"
 
 // Global file system state (Day 11 Enhanced)
 static memfs_simple_file_t file_table[MEMFS_MAX_FILES];
@@ -12,12 +17,12 @@ static uint32_t next_file_id = 1;
 static uint32_t current_dir_id = 0;  // Current directory (0 = root)
 static uint32_t time_counter = 1000; // Simple timestamp counter
 
-// String utility functions
-static size_t simple_strlen(const char* str) {
-    size_t len = 0;
-    while (str[len]) len++;  // Remove the MEMFS_MAX_FILENAME limit for content strings
-    return len;
-}
+// Day 21: lookups go through hashes instead of scanning the table
+static int16_t name_buckets[MEMFS_HASH_BUCKETS];   // (parent_id, name) -> index
+static int16_t id_buckets[MEMFS_HASH_BUCKETS];     // id -> index
+static int16_t root_first_child = -1;
+static int16_t root_last_child = -1;
+static int16_t free_head = -1;                      // Unused slots
 
 // Simple timestamp function (Day 11)
 uint32_t memfs_simple_get_time(void) {
@@ -53,36 +58,292 @@ void memfs_simple_format_time(uint32_t timestamp, char* buffer, size_t size) {
     buffer[pos] = '\0';
 }
 
-static int simple_strcmp(const char* str1, const char* str2) {
-    while (*str1 && *str2 && *str1 == *str2) {
-        str1++;
-        str2++;
+// File data (Day 21). Chunks are frames in the kernel's direct map, read
+// and written at PHYS_TO_VIRT of their physical address. One that was
+// never written reads as zeros. Copies share chunks, counted by the PMM's
+// frame references, until one of them writes; pmm_free_page only gives a
+// frame back once its last holder lets go.
+
+// A chunk restore left on disk: (its number in the data area << 1) | 1.
+// Frames are page aligned, so bit 0 tells the two apart.
+#define MEMFS_LAZY_CHUNK(slot) ((slot) & 1)
+#define MEMFS_CHECKSUM_SEED    0
+
+static memfs_simple_disk_t lazy_disk;          // Where lazy chunks are read from
+static uint32_t lazy_data_lba;
+static uint32_t lazy_sums[MEMFS_SNAPSHOT_MAX_CHUNKS];
+
+// CRC32C, continued from sum: a chunk costs a fraction of a cycle a byte
+// with SSE4.2 where FNV-1a took a multiply per byte
+static uint32_t memfs_simple_checksum(uint32_t sum, const void* data, size_t size) {
+    return crc32c(sum, data, size);
+}
+
+// Read a lazy chunk in from the snapshot; 0 when memory ran out. One that
+// can't be read or fails its checksum comes back as zeros.
+static uint32_t memfs_simple_fault(uint32_t* slot) {
+    uint32_t k = *slot >> 1;
+    uint32_t frame = pmm_alloc_zeroed_page();
+    if (!frame) {
+        return 0;
+    }
+    if (!lazy_disk.read(lazy_disk.drive, lazy_data_lba + k * MEMFS_CHUNK_SECTORS, MEMFS_CHUNK_SECTORS, PHYS_TO_VIRT(frame)) ||
+        memfs_simple_checksum(MEMFS_CHECKSUM_SEED, PHYS_TO_VIRT(frame), MEMFS_CHUNK_SIZE) != lazy_sums[k]) {
+        terminal_writestring("[MEMFS] A snapshot chunk didn't read back intact; it reads as zeros\n");
+        memset(PHYS_TO_VIRT(frame), 0, MEMFS_CHUNK_SIZE);
+    }
+    *slot = frame;
+    return frame;
+}
+
+// Where chunk n's frame is kept; with allocate, the index page is added
+// if this needs one. NULL when there is no index page or memory ran out.
+static uint32_t* memfs_simple_chunk_slot(memfs_simple_file_t* file, uint32_t n, bool allocate) {
+    if (n < MEMFS_DIRECT_CHUNKS) {
+        return &file->chunks[n];
+    }
+    if (!file->index_page) {
+        if (!allocate || !(file->index_page = pmm_alloc_zeroed_page())) {
+            return NULL;
+        }
+    }
+    return (uint32_t*)PHYS_TO_VIRT(file->index_page) + (n - MEMFS_DIRECT_CHUNKS);
+}
+
+// Frame of chunk n for reading, 0 when it doesn't exist
+static uint32_t memfs_simple_chunk(memfs_simple_file_t* file, uint32_t n) {
+    uint32_t* slot = memfs_simple_chunk_slot(file, n, false);
+    if (slot && MEMFS_LAZY_CHUNK(*slot)) {
+        return memfs_simple_fault(slot);
+    }
+    return slot ? *slot : 0;
+}
+
+// Frame of chunk n for writing: a zeroed one is added if missing, and one
+// shared with a copy is copied first. 0 when memory ran out.
+static uint32_t memfs_simple_chunk_writable(memfs_simple_file_t* file, uint32_t n) {
+    uint32_t* slot = memfs_simple_chunk_slot(file, n, true);
+    if (!slot || (MEMFS_LAZY_CHUNK(*slot) && !memfs_simple_fault(slot))) {
+        return 0;
+    }
+    if (!*slot) {
+        *slot = pmm_alloc_zeroed_page();
+    } else if (pmm_page_shares(*slot) > 0) {
+        uint32_t own = pmm_alloc_zeroed_page();
+        if (!own) {
+            return 0;
+        }
+        memcpy(PHYS_TO_VIRT(own), PHYS_TO_VIRT(*slot), MEMFS_CHUNK_SIZE);
+        pmm_free_page(*slot);   // Drops this file's reference
+        *slot = own;
+    }
+    return *slot;
+}
+
+// Copy out size bytes at offset (the caller keeps them within the file)
+static void memfs_simple_load(memfs_simple_file_t* file, size_t offset, void* buffer, size_t size) {
+    uint8_t* dest = (uint8_t*)buffer;
+    while (size > 0) {
+        size_t within = offset % MEMFS_CHUNK_SIZE;
+        size_t count = MEMFS_CHUNK_SIZE - within < size ? MEMFS_CHUNK_SIZE - within : size;
+        uint32_t chunk = memfs_simple_chunk(file, offset / MEMFS_CHUNK_SIZE);
+        if (chunk) {
+            memcpy(dest, (uint8_t*)PHYS_TO_VIRT(chunk) + within, count);
+        } else {
+            memset(dest, 0, count);
+        }
+        dest += count;
+        offset += count;
+        size -= count;
+    }
+}
+
+// Copy in size bytes at offset, growing the file to cover them; returns
+// how many fit before the limit or memory ran out. Everything past the
+// end is zero already, so a gap left by writing beyond it needs nothing.
+static size_t memfs_simple_store(memfs_simple_file_t* file, size_t offset, const void* buffer, size_t size) {
+    const uint8_t* src = (const uint8_t*)buffer;
+    size_t stored = 0;
+    if (offset >= MEMFS_MAX_FILESIZE) {
+        return 0;
+    }
+    if (size > MEMFS_MAX_FILESIZE - offset) {
+        size = MEMFS_MAX_FILESIZE - offset;
+    }
+    while (stored < size) {
+        size_t within = offset % MEMFS_CHUNK_SIZE;
+        size_t count = MEMFS_CHUNK_SIZE - within < size - stored ? MEMFS_CHUNK_SIZE - within : size - stored;
+        uint32_t chunk = memfs_simple_chunk_writable(file, offset / MEMFS_CHUNK_SIZE);
+        if (!chunk) {
+            break;
+        }
+        memcpy((uint8_t*)PHYS_TO_VIRT(chunk) + within, src + stored, count);
+        stored += count;
+        offset += count;
+    }
+    if (stored > 0 && offset > file->size) {
+        file->size = offset;
+    }
+    return stored;
+}
+
+// Cut the file to size bytes, giving back the chunks past it. The rest of
+// the last chunk is cleared, so growing the file again shows zeros.
+static void memfs_simple_truncate(memfs_simple_file_t* file, size_t size) {
+    uint32_t keep = (size + MEMFS_CHUNK_SIZE - 1) / MEMFS_CHUNK_SIZE;
+    for (uint32_t n = keep; n < MEMFS_DIRECT_CHUNKS; n++) {
+        if (file->chunks[n]) {
+            if (!MEMFS_LAZY_CHUNK(file->chunks[n])) {
+                pmm_free_page(file->chunks[n]);
+            }
+            file->chunks[n] = 0;
+        }
+    }
+    if (file->index_page) {
+        uint32_t* index = (uint32_t*)PHYS_TO_VIRT(file->index_page);
+        uint32_t first = keep > MEMFS_DIRECT_CHUNKS ? keep - MEMFS_DIRECT_CHUNKS : 0;
+        for (uint32_t n = first; n < MEMFS_INDEX_CHUNKS; n++) {
+            if (index[n]) {
+                if (!MEMFS_LAZY_CHUNK(index[n])) {
+                    pmm_free_page(index[n]);
+                }
+                index[n] = 0;
+            }
+        }
+        if (first == 0) {
+            pmm_free_page(file->index_page);
+            file->index_page = 0;
+        }
+    }
+    if (size % MEMFS_CHUNK_SIZE && memfs_simple_chunk(file, size / MEMFS_CHUNK_SIZE)) {
+        uint32_t chunk = memfs_simple_chunk_writable(file, size / MEMFS_CHUNK_SIZE);
+        if (chunk) {
+            memset((uint8_t*)PHYS_TO_VIRT(chunk) + size % MEMFS_CHUNK_SIZE, 0, MEMFS_CHUNK_SIZE - size % MEMFS_CHUNK_SIZE);
+        }
+    }
+    if (size < file->size) {
+        file->size = size;
+    }
+}
+
+// FNV-1a over the name, folded with the directory's id; its low bits
+// pick the bucket
+static uint32_t memfs_simple_name_hash(uint32_t parent_id, const char* name) {
+    uint32_t hash = 2166136261u ^ parent_id;
+    while (*name) {
+        hash = (hash ^ (uint8_t)*name++) * 16777619u;
+    }
+    return hash;
+}
+
+// Index of the entry with this id, -1 for the root or none
+static int memfs_simple_index_of(uint32_t id) {
+    if (id == 0) {
+        return -1;
+    }
+    for (int i = id_buckets[id & (MEMFS_HASH_BUCKETS - 1)]; i >= 0; i = file_table[i].id_next) {
+        if (file_table[i].id == id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Head of a directory's child list, by the directory's id
+static int memfs_simple_first_child(uint32_t dir_id) {
+    if (dir_id == 0) {
+        return root_first_child;
+    }
+    int dir = memfs_simple_index_of(dir_id);
+    return dir >= 0 ? file_table[dir].first_child : -1;
+}
+
+static void memfs_simple_hash_name(int index) {
+    uint32_t hash = memfs_simple_name_hash(file_table[index].parent_id, file_table[index].name);
+    uint32_t bucket = hash & (MEMFS_HASH_BUCKETS - 1);
+    file_table[index].name_hash = hash;
+    file_table[index].name_next = name_buckets[bucket];
+    name_buckets[bucket] = (int16_t)index;
+}
+
+static void memfs_simple_unhash_name(int index) {
+    int16_t* link = &name_buckets[file_table[index].name_hash & (MEMFS_HASH_BUCKETS - 1)];
+    while (*link != index) {
+        link = &file_table[*link].name_next;
     }
-    return *str1 - *str2;
+    *link = file_table[index].name_next;
 }
 
-static void simple_strcpy(char* dest, const char* src, size_t max_len) {
-    size_t i = 0;
-    while (src[i] && i < max_len - 1) {
-        dest[i] = src[i];
-        i++;
+// Put a filled-in entry on the hashes and the end of its directory's list
+static void memfs_simple_link(int index) {
+    memfs_simple_file_t* file = &file_table[index];
+    memfs_simple_hash_name(index);
+    uint32_t bucket = file->id & (MEMFS_HASH_BUCKETS - 1);
+    file->id_next = id_buckets[bucket];
+    id_buckets[bucket] = (int16_t)index;
+    
+    file->parent = (int16_t)memfs_simple_index_of(file->parent_id);
+    int16_t* first = file->parent >= 0 ? &file_table[file->parent].first_child : &root_first_child;
+    int16_t* last = file->parent >= 0 ? &file_table[file->parent].last_child : &root_last_child;
+    file->first_child = -1;
+    file->last_child = -1;
+    file->next_sibling = -1;
+    file->prev_sibling = *last;
+    if (*last >= 0) {
+        file_table[*last].next_sibling = (int16_t)index;
+    } else {
+        *first = (int16_t)index;
     }
-    dest[i] = '\0';
+    *last = (int16_t)index;
 }
 
-static void simple_memcpy(void* dest, const void* src, size_t count) {
-    uint8_t* d = (uint8_t*)dest;
-    const uint8_t* s = (const uint8_t*)src;
-    for (size_t i = 0; i < count; i++) {
-        d[i] = s[i];
+static void memfs_simple_unlink(int index) {
+    memfs_simple_file_t* file = &file_table[index];
+    memfs_simple_unhash_name(index);
+    int16_t* link = &id_buckets[file->id & (MEMFS_HASH_BUCKETS - 1)];
+    while (*link != index) {
+        link = &file_table[*link].id_next;
+    }
+    *link = file->id_next;
+    
+    int16_t* first = file->parent >= 0 ? &file_table[file->parent].first_child : &root_first_child;
+    int16_t* last = file->parent >= 0 ? &file_table[file->parent].last_child : &root_last_child;
+    if (file->prev_sibling >= 0) {
+        file_table[file->prev_sibling].next_sibling = file->next_sibling;
+    } else {
+        *first = file->next_sibling;
+    }
+    if (file->next_sibling >= 0) {
+        file_table[file->next_sibling].prev_sibling = file->prev_sibling;
+    } else {
+        *last = file->prev_sibling;
     }
 }
 
-static void simple_memset(void* ptr, int value, size_t count) {
-    uint8_t* p = (uint8_t*)ptr;
-    for (size_t i = 0; i < count; i++) {
-        p[i] = (uint8_t)value;
+// Free an entry's slot along with its data
+static void memfs_simple_release(int index) {
+    if (file_table[index].in_use) {
+        memfs_simple_unlink(index);
     }
+    memfs_simple_truncate(&file_table[index], 0);
+    memset(&file_table[index], 0, sizeof(memfs_simple_file_t));
+    file_table[index].in_use = false;
+    file_table[index].next_sibling = free_head;
+    free_head = (int16_t)index;
+}
+
+// Empty the file table, leaving the free list in slot order
+static void memfs_simple_reset(void) {
+    for (int i = MEMFS_MAX_FILES - 1; i >= 0; i--) {
+        memfs_simple_release(i);
+    }
+    for (int i = 0; i < MEMFS_HASH_BUCKETS; i++) {
+        name_buckets[i] = -1;
+        id_buckets[i] = -1;
+    }
+    root_first_child = -1;
+    root_last_child = -1;
+    current_dir_id = 0;  // Start in root directory
 }
 
 // Initialize the memory file system (Day 11 Enhanced)
@@ -91,13 +352,8 @@ void memfs_simple_init(void) {
     terminal_writestring("[MEMFS] Initializing Day 11 enhanced memory file system...\n");
     
     // Clear file table
-    for (int i = 0; i < MEMFS_MAX_FILES; i++) {
-        simple_memset(&file_table[i], 0, sizeof(memfs_simple_file_t));
-        file_table[i].in_use = false;
-    }
-    
+    memfs_simple_reset();
     memfs_initialized = true;
-    current_dir_id = 0;  // Start in root directory
     
     // Create root directory structure
     memfs_simple_mkdir("bin");
@@ -113,109 +369,90 @@ void memfs_simple_init(void) {
     int index = memfs_simple_find_file("hello.txt");
     if (index >= 0) {
         const char* content = "Hello, ClaudeOS!\nThis is a test file in memory.\nMemFS Day 9 working!";
-        size_t content_len = simple_strlen(content);
-        
-        // Clear data first and ensure proper copying
-        simple_memset(file_table[index].data, 0, MEMFS_MAX_FILESIZE);
-        
-        if (content_len <= MEMFS_MAX_FILESIZE) {
-            simple_memcpy(file_table[index].data, content, content_len);
-            file_table[index].size = content_len;
-            
-            // Ensure null termination
-            file_table[index].data[content_len] = '\0';
-        }
+        memfs_simple_store(&file_table[index], 0, content, strlen(content));
     }
     terminal_writestring("[MEMFS] Simple memory file system initialized!\n");
     memfs_simple_list_files();
 }
 
+INITCALL(initcall_memfs, "memfs", memfs_simple_init, INIT_LAZY);
+
 // Find file by name with path support (Day 11 Enhanced)
 int memfs_simple_find_file(const char* filename) {
     if (!filename) return -1;
     
-    // Handle absolute path (starts with /)
+    // Handle absolute path (starts with /): search in root directory
     if (filename[0] == '/') {
-        // Search in root directory
-        for (int i = 0; i < MEMFS_MAX_FILES; i++) {
-            if (file_table[i].in_use && 
-                file_table[i].parent_id == 0 &&
-                simple_strcmp(file_table[i].name, filename + 1) == 0) {
-                return i;
-            }
-        }
-        return -1;
+        return memfs_simple_find_in_dir(filename + 1, 0);
     }
     
     // Search in current directory
-    for (int i = 0; i < MEMFS_MAX_FILES; i++) {
-        if (file_table[i].in_use && 
-            file_table[i].parent_id == current_dir_id &&
-            simple_strcmp(file_table[i].name, filename) == 0) {
-            return i;
-        }
-    }
-    return -1;
+    return memfs_simple_find_in_dir(filename, current_dir_id);
 }
 
 // Find file/directory in specific directory (Day 11)
 int memfs_simple_find_in_dir(const char* name, uint32_t parent_id) {
     if (!name) return -1;
     
-    for (int i = 0; i < MEMFS_MAX_FILES; i++) {
-        if (file_table[i].in_use && 
-            file_table[i].parent_id == parent_id &&
-            simple_strcmp(file_table[i].name, name) == 0) {
+    // The full hash rules out nearly every other entry in the bucket
+    // without touching its name
+    uint32_t hash = memfs_simple_name_hash(parent_id, name);
+    for (int i = name_buckets[hash & (MEMFS_HASH_BUCKETS - 1)]; i >= 0; i = file_table[i].name_next) {
+        if (file_table[i].name_hash == hash && file_table[i].parent_id == parent_id &&
+            strcmp(file_table[i].name, name) == 0) {
             return i;
         }
     }
     return -1;
 }
 
-// Find free file slot
+// Take a free file slot
 static int memfs_simple_find_free_slot(void) {
-    for (int i = 0; i < MEMFS_MAX_FILES; i++) {
-        if (!file_table[i].in_use) {
-            return i;
-        }
+    int index = free_head;
+    if (index >= 0) {
+        free_head = file_table[index].next_sibling;
     }
-    return -1;
+    return index;
 }
 
-// Create a new file (Day 11 Enhanced)
-int memfs_simple_create(const char* filename) {
-    if (!filename || simple_strlen(filename) == 0) {
-        return MEMFS_ERROR;
-    }
-    
-    // Check if file already exists in current directory
-    if (memfs_simple_find_file(filename) >= 0) {
-        return MEMFS_EXISTS;
-    }
-    
+// Fill a free slot with a new, empty entry; returns its index
+static int memfs_simple_add(const char* name, uint8_t type, uint32_t parent_id) {
     // Find free slot
     int index = memfs_simple_find_free_slot();
     if (index < 0) {
         return MEMFS_NO_SPACE;
     }
     
-    // Create file
-    simple_strcpy(file_table[index].name, filename, MEMFS_MAX_FILENAME);
-    file_table[index].type = MEMFS_TYPE_FILE;
+    strlcpy(file_table[index].name, name, MEMFS_MAX_FILENAME);
+    file_table[index].type = type;
     file_table[index].size = 0;
     file_table[index].in_use = true;
     file_table[index].id = next_file_id++;
-    file_table[index].parent_id = current_dir_id;
+    file_table[index].parent_id = parent_id;
     file_table[index].created_time = memfs_simple_get_time();
     file_table[index].modified_time = file_table[index].created_time;
     file_table[index].accessed_time = file_table[index].created_time;
     file_table[index].permissions = MEMFS_PERM_DEFAULT;
     file_table[index].flags = 0;
-    simple_strcpy(file_table[index].owner, "system", 16);
+    strlcpy(file_table[index].owner, "system", 16);
+    memfs_simple_link(index);
+    
+    return index;
+}
+
+// Create a new file (Day 11 Enhanced)
+int memfs_simple_create(const char* filename) {
+    if (!filename || strlen(filename) == 0) {
+        return MEMFS_ERROR;
+    }
     
-    simple_memset(file_table[index].data, 0, MEMFS_MAX_FILESIZE);
+    // Check if file already exists in current directory
+    if (memfs_simple_find_file(filename) >= 0) {
+        return MEMFS_EXISTS;
+    }
     
-    return MEMFS_SUCCESS;
+    int index = memfs_simple_add(filename, MEMFS_TYPE_FILE, current_dir_id);
+    return index < 0 ? index : MEMFS_SUCCESS;
 }
 
 // Delete a file
@@ -230,8 +467,7 @@ int memfs_simple_delete(const char* filename) {
     }
     
     // Clear file entry
-    simple_memset(&file_table[index], 0, sizeof(memfs_simple_file_t));
-    file_table[index].in_use = false;
+    memfs_simple_release(index);
     
     return MEMFS_SUCCESS;
 }
@@ -265,10 +501,10 @@ int memfs_simple_read(const char* filename, char* buffer, size_t buffer_size) {
     size_t copy_size = (file_size < buffer_size - 1) ? file_size : buffer_size - 1;
     
     // Clear the buffer first
-    simple_memset(buffer, 0, buffer_size);
+    memset(buffer, 0, buffer_size);
     
     if (copy_size > 0) {
-        simple_memcpy(buffer, file_table[index].data, copy_size);
+        memfs_simple_load(&file_table[index], 0, buffer, copy_size);
     }
     
     // Ensure null termination
@@ -277,83 +513,146 @@ int memfs_simple_read(const char* filename, char* buffer, size_t buffer_size) {
     return copy_size;
 }
 
-// Write file content (simplified)
-int memfs_simple_write(const char* filename, const char* content) {
-    if (!filename || !content) {
+// Read up to size bytes starting at offset (no terminator added);
+// returns the count, 0 past the end of the file
+int memfs_simple_pread(const char* filename, size_t offset, void* buffer, size_t size) {
+    if (!filename || !buffer) {
         return MEMFS_ERROR;
     }
     
     int index = memfs_simple_find_file(filename);
     if (index < 0) {
-        // Create file if it doesn't exist
-        if (memfs_simple_create(filename) != MEMFS_SUCCESS) {
-            return MEMFS_ERROR;
+        return MEMFS_NOT_FOUND;
+    }
+    
+    size_t file_size = file_table[index].size;
+    if (offset >= file_size) {
+        return 0;
+    }
+    size_t copy_size = file_size - offset;
+    if (copy_size > size) {
+        copy_size = size;
+    }
+    memfs_simple_load(&file_table[index], offset, buffer, copy_size);
+    file_table[index].accessed_time = memfs_simple_get_time();
+    return copy_size;
+}
+
+int memfs_simple_read_at(const char* filename, size_t offset, char* buffer, size_t buffer_size) {
+    return memfs_simple_pread(filename, offset, buffer, buffer_size);
+}
+
+// Index of a file to write, created if it doesn't exist
+static int memfs_simple_writable(const char* filename) {
+    int index = memfs_simple_find_file(filename);
+    if (index < 0) {
+        int result = memfs_simple_create(filename);
+        if (result != MEMFS_SUCCESS) {
+            return result;
         }
         index = memfs_simple_find_file(filename);
         if (index < 0) {
             return MEMFS_ERROR;
         }
     }
+    if (file_table[index].type == MEMFS_TYPE_DIR) {
+        return MEMFS_IS_DIR;
+    }
+    return index;
+}
+
+// Write file content (simplified): replaces the whole file
+int memfs_simple_write(const char* filename, const char* content) {
+    if (!filename || !content) {
+        return MEMFS_ERROR;
+    }
     
-    size_t content_len = simple_strlen(content);
-    if (content_len > MEMFS_MAX_FILESIZE) {
-        content_len = MEMFS_MAX_FILESIZE;
+    int index = memfs_simple_writable(filename);
+    if (index < 0) {
+        return MEMFS_ERROR;
     }
     
-    simple_memcpy(file_table[index].data, content, content_len);
-    file_table[index].size = content_len;
+    memfs_simple_truncate(&file_table[index], 0);
+    size_t content_len = memfs_simple_store(&file_table[index], 0, content, strlen(content));
     file_table[index].modified_time = memfs_simple_get_time();  // Update modification time
     
     return content_len;
 }
 
+// Write size bytes at offset, touching only the chunks they land in (a
+// gap before them reads as zeros); returns how many were written
+int memfs_simple_pwrite(const char* filename, size_t offset, const void* buffer, size_t size) {
+    if (!filename || (!buffer && size > 0)) {
+        return MEMFS_ERROR;
+    }
+    
+    int index = memfs_simple_writable(filename);
+    if (index < 0) {
+        return index;
+    }
+    
+    size_t written = memfs_simple_store(&file_table[index], offset, buffer, size);
+    if (written == 0 && size > 0) {
+        return MEMFS_NO_SPACE;
+    }
+    file_table[index].modified_time = memfs_simple_get_time();
+    return written;
+}
+
+// Write size bytes at the end of the file
+int memfs_simple_append(const char* filename, const void* buffer, size_t size) {
+    int index = filename ? memfs_simple_writable(filename) : MEMFS_ERROR;
+    if (index < 0) {
+        return index;
+    }
+    return memfs_simple_pwrite(filename, file_table[index].size, buffer, size);
+}
+
 // List all files in current directory (Day 11 Fixed)
 void memfs_simple_list_files(void) {
     terminal_setcolor(vga_entry_color(VGA_COLOR_CYAN, VGA_COLOR_BLACK));
     terminal_writestring("[MEMFS] File listing for current directory:\n");
     
     int count = 0;
-    for (int i = 0; i < MEMFS_MAX_FILES; i++) {
-        if (file_table[i].in_use && file_table[i].parent_id == current_dir_id) {
+    for (int i = memfs_simple_first_child(current_dir_id); i >= 0; i = file_table[i].next_sibling) {
+        terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+        
+        // Type indicator and color
+        if (file_table[i].type == MEMFS_TYPE_DIR) {
+            terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK));
+            terminal_writestring("  ");
+            terminal_writestring(file_table[i].name);
+            terminal_writestring("/ (directory)\n");
+        } else {
             terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+            terminal_writestring("  ");
+            terminal_writestring(file_table[i].name);
+            terminal_writestring(" (");
             
-            // Type indicator and color
-            if (file_table[i].type == MEMFS_TYPE_DIR) {
-                terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK));
-                terminal_writestring("  ");
-                terminal_writestring(file_table[i].name);
-                terminal_writestring("/ (directory)\n");
+            // Simple number printing
+            char size_str[16];
+            uint32_t size = file_table[i].size;
+            int pos = 0;
+            if (size == 0) {
+                size_str[pos++] = '0';
             } else {
-                terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
-                terminal_writestring("  ");
-                terminal_writestring(file_table[i].name);
-                terminal_writestring(" (");
-                
-                // Simple number printing
-                char size_str[16];
-                uint32_t size = file_table[i].size;
-                int pos = 0;
-                if (size == 0) {
-                    size_str[pos++] = '0';
-                } else {
-                    while (size > 0) {
-                        size_str[pos++] = '0' + (size % 10);
-                        size /= 10;
-                    }
-                }
-                // Reverse string
-                for (int j = 0; j < pos / 2; j++) {
-                    char temp = size_str[j];
-                    size_str[j] = size_str[pos - 1 - j];
-                    size_str[pos - 1 - j] = temp;
+                while (size > 0) {
+                    size_str[pos++] = '0' + (size % 10);
+                    size /= 10;
                 }
-                size_str[pos] = '\0';
-                
-                terminal_writestring(size_str);
-                terminal_writestring(" bytes)\n");
             }
-            count++;
+            // Reverse string
+            for (int j = 0; j < pos / 2; j++) {
+                char temp = size_str[j];
+                size_str[j] = size_str[pos - 1 - j];
+                size_str[pos - 1 - j] = temp;
+            }
+            size_str[pos] = '\0';
+            
+            terminal_writestring(size_str);
+            terminal_writestring(" bytes)\n");
         }
+        count++;
     }
     
     if (count == 0) {
@@ -378,8 +677,9 @@ void memfs_simple_get_stats(memfs_simple_stats_t* stats) {
         }
     }
     
-    stats->total_space = MEMFS_MAX_FILES * MEMFS_MAX_FILESIZE;
-    stats->free_space = stats->total_space - stats->used_space;
+    // Data can grow into whatever memory is left
+    stats->free_space = pmm_get_free_pages() * MEMFS_CHUNK_SIZE;
+    stats->total_space = stats->used_space + stats->free_space;
 }
 
 // Display file system statistics
@@ -439,7 +739,7 @@ void memfs_simple_dump_stats(void) {
 
 // Create directory
 int memfs_simple_mkdir(const char* dirname) {
-    if (!dirname || simple_strlen(dirname) == 0) {
+    if (!dirname || strlen(dirname) == 0) {
         return MEMFS_ERROR;
     }
     
@@ -448,29 +748,8 @@ int memfs_simple_mkdir(const char* dirname) {
         return MEMFS_EXISTS;
     }
     
-    // Find free slot
-    int index = memfs_simple_find_free_slot();
-    if (index < 0) {
-        return MEMFS_NO_SPACE;
-    }
-    
-    // Create directory
-    simple_strcpy(file_table[index].name, dirname, MEMFS_MAX_FILENAME);
-    file_table[index].type = MEMFS_TYPE_DIR;
-    file_table[index].size = 0;
-    file_table[index].in_use = true;
-    file_table[index].id = next_file_id++;
-    file_table[index].parent_id = current_dir_id;
-    file_table[index].created_time = memfs_simple_get_time();
-    file_table[index].modified_time = file_table[index].created_time;
-    file_table[index].accessed_time = file_table[index].created_time;
-    file_table[index].permissions = MEMFS_PERM_DEFAULT;
-    file_table[index].flags = 0;
-    simple_strcpy(file_table[index].owner, "system", 16);
-    
-    simple_memset(file_table[index].data, 0, MEMFS_MAX_FILESIZE);
-    
-    return MEMFS_SUCCESS;
+    int index = memfs_simple_add(dirname, MEMFS_TYPE_DIR, current_dir_id);
+    return index < 0 ? index : MEMFS_SUCCESS;
 }
 
 // Remove directory (only if empty)
@@ -489,16 +768,12 @@ int memfs_simple_rmdir(const char* dirname) {
     }
     
     // Check if directory is empty
-    uint32_t dir_id = file_table[index].id;
-    for (int i = 0; i < MEMFS_MAX_FILES; i++) {
-        if (file_table[i].in_use && file_table[i].parent_id == dir_id) {
-            return MEMFS_ERROR; // Directory not empty
-        }
+    if (file_table[index].first_child >= 0) {
+        return MEMFS_ERROR; // Directory not empty
     }
     
     // Clear directory entry
-    simple_memset(&file_table[index], 0, sizeof(memfs_simple_file_t));
-    file_table[index].in_use = false;
+    memfs_simple_release(index);
     
     return MEMFS_SUCCESS;
 }
@@ -510,25 +785,24 @@ int memfs_simple_chdir(const char* dirname) {
     }
     
     // Handle special cases
-    if (simple_strcmp(dirname, ".") == 0) {
+    if (strcmp(dirname, ".") == 0) {
         return MEMFS_SUCCESS; // Stay in current directory
     }
     
-    if (simple_strcmp(dirname, "..") == 0) {
+    if (strcmp(dirname, "..") == 0) {
         // Go to parent directory
         if (current_dir_id != 0) {
             // Find current directory entry to get parent
-            for (int i = 0; i < MEMFS_MAX_FILES; i++) {
-                if (file_table[i].in_use && file_table[i].id == current_dir_id) {
-                    current_dir_id = file_table[i].parent_id;
-                    return MEMFS_SUCCESS;
-                }
+            int index = memfs_simple_index_of(current_dir_id);
+            if (index >= 0) {
+                current_dir_id = file_table[index].parent_id;
+                return MEMFS_SUCCESS;
             }
         }
         return MEMFS_SUCCESS; // Already in root
     }
     
-    if (simple_strcmp(dirname, "/") == 0) {
+    if (strcmp(dirname, "/") == 0) {
         current_dir_id = 0; // Go to root
         return MEMFS_SUCCESS;
     }
@@ -553,22 +827,29 @@ void memfs_simple_getcwd(char* buffer, size_t size) {
     
     if (current_dir_id == 0) {
         // Root directory
-        simple_strcpy(buffer, "/", size);
+        strlcpy(buffer, "/", size);
         return;
     }
     
-    // Find current directory name and build path
-    for (int i = 0; i < MEMFS_MAX_FILES; i++) {
-        if (file_table[i].in_use && file_table[i].id == current_dir_id) {
-            // Simple path for now: /dirname
-            buffer[0] = '/';
-            simple_strcpy(buffer + 1, file_table[i].name, size - 1);
-            return;
-        }
+    // Follow parent links up to the root, then write the names out
+    // top-down; each step is at least "/x", so the path bounds the depth
+    int chain[MEMFS_MAX_PATH / 2];
+    int depth = 0;
+    for (int i = memfs_simple_index_of(current_dir_id); i >= 0 && depth < MEMFS_MAX_PATH / 2;
+         i = file_table[i].parent) {
+        chain[depth++] = i;
     }
-    
-    // Fallback
-    simple_strcpy(buffer, "/", size);
+    if (depth == 0) {
+        strlcpy(buffer, "/", size);   // Fallback
+        return;
+    }
+    size_t length = 0;
+    while (depth > 0 && length + 1 < size) {
+        buffer[length++] = '/';
+        strlcpy(buffer + length, file_table[chain[--depth]].name, size - length);
+        length += strlen(buffer + length);
+    }
+    buffer[length] = '\0';
 }
 
 // List files with detailed information (ls -l equivalent)
@@ -577,44 +858,42 @@ void memfs_simple_list_detailed(void) {
     terminal_writestring("[MEMFS] Detailed file listing for current directory:\n");
     
     int count = 0;
-    for (int i = 0; i < MEMFS_MAX_FILES; i++) {
-        if (file_table[i].in_use && file_table[i].parent_id == current_dir_id) {
-            // Type indicator
-            terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
-            if (file_table[i].type == MEMFS_TYPE_DIR) {
-                terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK));
-                terminal_writestring("d ");
-            } else {
-                terminal_writestring("- ");
-            }
-            
-            // Name
-            terminal_writestring(file_table[i].name);
-            terminal_writestring(" (");
-            
-            // Size
-            char size_str[16];
-            uint32_t size = file_table[i].size;
-            int pos = 0;
-            if (size == 0) {
-                size_str[pos++] = '0';
-            } else {
-                while (size > 0) {
-                    size_str[pos++] = '0' + (size % 10);
-                    size /= 10;
-                }
-            }
-            for (int j = 0; j < pos / 2; j++) {
-                char temp = size_str[j];
-                size_str[j] = size_str[pos - 1 - j];
-                size_str[pos - 1 - j] = temp;
+    for (int i = memfs_simple_first_child(current_dir_id); i >= 0; i = file_table[i].next_sibling) {
+        // Type indicator
+        terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+        if (file_table[i].type == MEMFS_TYPE_DIR) {
+            terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK));
+            terminal_writestring("d ");
+        } else {
+            terminal_writestring("- ");
+        }
+        
+        // Name
+        terminal_writestring(file_table[i].name);
+        terminal_writestring(" (");
+        
+        // Size
+        char size_str[16];
+        uint32_t size = file_table[i].size;
+        int pos = 0;
+        if (size == 0) {
+            size_str[pos++] = '0';
+        } else {
+            while (size > 0) {
+                size_str[pos++] = '0' + (size % 10);
+                size /= 10;
             }
-            size_str[pos] = '\0';
-            
-            terminal_writestring(size_str);
-            terminal_writestring(" bytes)\n");
-            count++;
         }
+        for (int j = 0; j < pos / 2; j++) {
+            char temp = size_str[j];
+            size_str[j] = size_str[pos - 1 - j];
+            size_str[pos - 1 - j] = temp;
+        }
+        size_str[pos] = '\0';
+        
+        terminal_writestring(size_str);
+        terminal_writestring(" bytes)\n");
+        count++;
     }
     
     if (count == 0) {
@@ -629,7 +908,7 @@ void memfs_simple_list_detailed(void) {
 
 // Touch file - create or update timestamp
 int memfs_simple_touch(const char* filename) {
-    if (!filename || simple_strlen(filename) == 0) {
+    if (!filename || strlen(filename) == 0) {
         return MEMFS_ERROR;
     }
     
@@ -677,9 +956,27 @@ int memfs_simple_copy(const char* src, const char* dst) {
         return MEMFS_ERROR;
     }
     
-    // Copy file data
-    simple_memcpy(file_table[dst_index].data, file_table[src_index].data, file_table[src_index].size);
-    file_table[dst_index].size = file_table[src_index].size;
+    // Share the data chunks; whichever file writes one first copies it.
+    // Holes stay holes, and a chunk at its share limit is copied now.
+    memfs_simple_file_t* source = &file_table[src_index];
+    memfs_simple_file_t* dest = &file_table[dst_index];
+    for (size_t offset = 0; offset < source->size; offset += MEMFS_CHUNK_SIZE) {
+        uint32_t chunk = memfs_simple_chunk(source, offset / MEMFS_CHUNK_SIZE);
+        if (!chunk) {
+            continue;
+        }
+        uint32_t* slot = memfs_simple_chunk_slot(dest, offset / MEMFS_CHUNK_SIZE, true);
+        if (slot && pmm_page_ref(chunk) == 0) {
+            *slot = chunk;
+            continue;
+        }
+        size_t count = source->size - offset < MEMFS_CHUNK_SIZE ? source->size - offset : MEMFS_CHUNK_SIZE;
+        if (!slot || memfs_simple_store(dest, offset, PHYS_TO_VIRT(chunk), count) != count) {
+            memfs_simple_release(dst_index);
+            return MEMFS_NO_SPACE;
+        }
+    }
+    dest->size = source->size;
     file_table[dst_index].modified_time = memfs_simple_get_time();
     
     return MEMFS_SUCCESS;
@@ -703,7 +1000,9 @@ int memfs_simple_move(const char* src, const char* dst) {
     }
     
     // Simply rename by updating the name
-    simple_strcpy(file_table[src_index].name, dst, MEMFS_MAX_FILENAME);
+    memfs_simple_unhash_name(src_index);
+    strlcpy(file_table[src_index].name, dst, MEMFS_MAX_FILENAME);
+    memfs_simple_hash_name(src_index);
     file_table[src_index].modified_time = memfs_simple_get_time();
     
     return MEMFS_SUCCESS;
@@ -711,7 +1010,7 @@ int memfs_simple_move(const char* src, const char* dst) {
 
 // Find file by name (search all directories) 
 int memfs_simple_find(const char* name) {
-    if (!name || simple_strlen(name) == 0) {
+    if (!name || strlen(name) == 0) {
         return MEMFS_ERROR;
     }
     
@@ -730,8 +1029,8 @@ int memfs_simple_find(const char* name) {
             bool matches = false;
             
             // Simple substring search
-            size_t name_len = simple_strlen(name);
-            size_t file_len = simple_strlen(filename);
+            size_t name_len = strlen(name);
+            size_t file_len = strlen(filename);
             
             if (name_len <= file_len) {
                 for (size_t j = 0; j <= file_len - name_len; j++) {
@@ -757,14 +1056,12 @@ int memfs_simple_find(const char* name) {
                 if (file_table[i].parent_id == 0) {
                     terminal_writestring("/");
                 } else {
-                    // Find parent directory name
-                    for (int j = 0; j < MEMFS_MAX_FILES; j++) {
-                        if (file_table[j].in_use && file_table[j].id == file_table[i].parent_id) {
-                            terminal_writestring("/");
-                            terminal_writestring(file_table[j].name);
-                            terminal_writestring("/");
-                            break;
-                        }
+                    // Parent directory name
+                    int parent = file_table[i].parent;
+                    if (parent >= 0) {
+                        terminal_writestring("/");
+                        terminal_writestring(file_table[parent].name);
+                        terminal_writestring("/");
                     }
                 }
                 
@@ -917,4 +1214,700 @@ void memfs_simple_show_file_info(const char* filename) {
     memfs_simple_format_time(file->accessed_time, time_str, sizeof(time_str));
     terminal_writestring(time_str);
     terminal_writestring("\n");
-}
\ No newline at end of file
+}
+// Snapshots (Day 21). Entries go out in a walk of the tree that reaches
+// parents first, so restore can link each one as it arrives. Records and
+// data are written in one sequential run of MEMFS_SNAPSHOT_BATCH-sector
+// calls; the header goes last, so an image is only valid once whole.
+
+static uint8_t snapshot_buffer[MEMFS_SNAPSHOT_BATCH * MEMFS_SECTOR_SIZE];
+
+typedef struct {
+    const memfs_simple_disk_t* disk;    // Writing: NULL only counts and sums
+    uint32_t lba;                       // Next sector
+    uint32_t end_lba;                   // Reading: end of the section
+    uint32_t fill;                      // Bytes in snapshot_buffer
+    uint32_t pos;                       // Reading: bytes of it used
+    uint32_t checksum;
+    bool failed;
+} memfs_simple_stream_t;
+
+// First entry, then the next one, in a walk that visits parents first
+static int memfs_simple_walk_next(int i) {
+    if (file_table[i].first_child >= 0) {
+        return file_table[i].first_child;
+    }
+    for (; i >= 0; i = file_table[i].parent) {
+        if (file_table[i].next_sibling >= 0) {
+            return file_table[i].next_sibling;
+        }
+    }
+    return -1;
+}
+
+// Write out what is buffered, padded to a whole sector
+static void memfs_simple_stream_flush(memfs_simple_stream_t* stream) {
+    uint32_t sectors = (stream->fill + MEMFS_SECTOR_SIZE - 1) / MEMFS_SECTOR_SIZE;
+    if (stream->disk && sectors > 0 && !stream->failed) {
+        memset(snapshot_buffer + stream->fill, 0, sectors * MEMFS_SECTOR_SIZE - stream->fill);
+        if (!stream->disk->write(stream->disk->drive, stream->lba, sectors, snapshot_buffer)) {
+            stream->failed = true;
+        }
+    }
+    stream->lba += sectors;
+    stream->fill = 0;
+}
+
+static void memfs_simple_stream_put(memfs_simple_stream_t* stream, const void* data, uint32_t size) {
+    const uint8_t* src = (const uint8_t*)data;
+    stream->checksum = memfs_simple_checksum(stream->checksum, data, size);
+    while (size > 0) {
+        uint32_t n = sizeof(snapshot_buffer) - stream->fill;
+        if (n > size) {
+            n = size;
+        }
+        if (stream->disk) {
+            memcpy(snapshot_buffer + stream->fill, src, n);
+        }
+        stream->fill += n;
+        src += n;
+        size -= n;
+        if (stream->fill == sizeof(snapshot_buffer)) {
+            memfs_simple_stream_flush(stream);
+        }
+    }
+}
+
+static bool memfs_simple_stream_get(memfs_simple_stream_t* stream, void* data, uint32_t size) {
+    uint8_t* dest = (uint8_t*)data;
+    while (size > 0) {
+        if (stream->pos == stream->fill) {
+            uint32_t sectors = stream->end_lba - stream->lba;
+            if (sectors > MEMFS_SNAPSHOT_BATCH) {
+                sectors = MEMFS_SNAPSHOT_BATCH;
+            }
+            if (sectors == 0 || !stream->disk->read(stream->disk->drive, stream->lba, sectors, snapshot_buffer)) {
+                stream->failed = true;
+                return false;
+            }
+            stream->lba += sectors;
+            stream->fill = sectors * MEMFS_SECTOR_SIZE;
+            stream->pos = 0;
+        }
+        uint32_t n = stream->fill - stream->pos;
+        if (n > size) {
+            n = size;
+        }
+        memcpy(dest, snapshot_buffer + stream->pos, n);
+        stream->checksum = memfs_simple_checksum(stream->checksum, dest, n);
+        stream->pos += n;
+        dest += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Emit every entry record with its chunk list; with sum, the chunks'
+// checksums are taken into lazy_sums, otherwise read back from there
+static int memfs_simple_snapshot_records(memfs_simple_stream_t* stream, bool sum, uint32_t* entries, uint32_t* chunks) {
+    *entries = 0;
+    *chunks = 0;
+    for (int i = root_first_child; i >= 0; i = memfs_simple_walk_next(i)) {
+        memfs_simple_file_t* file = &file_table[i];
+        memfs_simple_snapshot_entry_t entry;
+        memset(&entry, 0, sizeof(entry));
+        memcpy(entry.name, file->name, MEMFS_MAX_FILENAME);
+        entry.type = file->type;
+        entry.size = file->size;
+        entry.id = file->id;
+        entry.parent_id = file->parent_id;
+        entry.created_time = file->created_time;
+        entry.modified_time = file->modified_time;
+        entry.accessed_time = file->accessed_time;
+        entry.permissions = file->permissions;
+        entry.flags = file->flags;
+        memcpy(entry.owner, file->owner, sizeof(entry.owner));
+        uint32_t count = (file->size + MEMFS_CHUNK_SIZE - 1) / MEMFS_CHUNK_SIZE;
+        for (uint32_t n = 0; n < count; n++) {
+            if (memfs_simple_chunk(file, n)) {
+                entry.chunk_count++;
+            }
+        }
+        memfs_simple_stream_put(stream, &entry, sizeof(entry));
+        
+        for (uint32_t n = 0; n < count; n++) {
+            uint32_t frame = memfs_simple_chunk(file, n);
+            if (!frame) {
+                continue;
+            }
+            if (*chunks == MEMFS_SNAPSHOT_MAX_CHUNKS) {
+                return MEMFS_NO_SPACE;
+            }
+            if (sum) {
+                lazy_sums[*chunks] = memfs_simple_checksum(MEMFS_CHECKSUM_SEED, PHYS_TO_VIRT(frame), MEMFS_CHUNK_SIZE);
+            }
+            memfs_simple_snapshot_chunk_t record = { n, lazy_sums[*chunks] };
+            memfs_simple_stream_put(stream, &record, sizeof(record));
+            (*chunks)++;
+        }
+        (*entries)++;
+    }
+    return MEMFS_SUCCESS;
+}
+
+int memfs_simple_snapshot(const memfs_simple_disk_t* disk) {
+    if (!disk || !disk->write || disk->sectors == 0) {
+        return MEMFS_ERROR;
+    }
+    
+    // Bring in what a restore left on disk: the new image may cover it.
+    // (Walking the records does that, and sums every chunk.)
+    memfs_simple_stream_t stream;
+    memset(&stream, 0, sizeof(stream));
+    stream.checksum = MEMFS_CHECKSUM_SEED;
+    uint32_t entries, chunks;
+    int result = memfs_simple_snapshot_records(&stream, true, &entries, &chunks);
+    if (result != MEMFS_SUCCESS) {
+        return result;
+    }
+    for (int i = 0; i < MEMFS_MAX_FILES; i++) {
+        uint32_t count = (file_table[i].size + MEMFS_CHUNK_SIZE - 1) / MEMFS_CHUNK_SIZE;
+        for (uint32_t n = 0; file_table[i].in_use && n < count; n++) {
+            uint32_t* slot = memfs_simple_chunk_slot(&file_table[i], n, false);
+            if (slot && MEMFS_LAZY_CHUNK(*slot)) {
+                return MEMFS_NO_SPACE;      // Memory ran out reading it in
+            }
+        }
+    }
+    
+    memfs_simple_snapshot_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = MEMFS_SNAPSHOT_MAGIC;
+    header.version = MEMFS_SNAPSHOT_VERSION;
+    header.entries = entries;
+    header.chunks = chunks;
+    header.next_file_id = next_file_id;
+    header.meta_bytes = stream.fill + (stream.lba * MEMFS_SECTOR_SIZE);
+    header.meta_checksum = stream.checksum;
+    uint32_t meta_sectors = (header.meta_bytes + MEMFS_SECTOR_SIZE - 1) / MEMFS_SECTOR_SIZE;
+    if (1 + meta_sectors + chunks * MEMFS_CHUNK_SECTORS > disk->sectors) {
+        return MEMFS_NO_SPACE;
+    }
+    header.header_checksum = memfs_simple_checksum(MEMFS_CHECKSUM_SEED, &header, sizeof(header));
+    
+    // Records, then the data in the same order, from the sector after the header
+    memset(&stream, 0, sizeof(stream));
+    stream.disk = disk;
+    stream.lba = disk->lba + 1;
+    memfs_simple_snapshot_records(&stream, false, &entries, &chunks);
+    memfs_simple_stream_flush(&stream);
+    for (int i = root_first_child; i >= 0; i = memfs_simple_walk_next(i)) {
+        uint32_t count = (file_table[i].size + MEMFS_CHUNK_SIZE - 1) / MEMFS_CHUNK_SIZE;
+        for (uint32_t n = 0; n < count; n++) {
+            uint32_t frame = memfs_simple_chunk(&file_table[i], n);
+            if (frame) {
+                memfs_simple_stream_put(&stream, PHYS_TO_VIRT(frame), MEMFS_CHUNK_SIZE);
+            }
+        }
+    }
+    memfs_simple_stream_flush(&stream);
+    if (stream.failed) {
+        return MEMFS_ERROR;
+    }
+    
+    memset(snapshot_buffer, 0, MEMFS_SECTOR_SIZE);
+    memcpy(snapshot_buffer, &header, sizeof(header));
+    if (!disk->write(disk->drive, disk->lba, 1, snapshot_buffer)) {
+        return MEMFS_ERROR;
+    }
+    return (int)entries;
+}
+
+// Replace the file system with the image on disk; returns the number of
+// entries. The table isn't touched unless the header and records check
+// out; a read failing after that leaves it empty.
+int memfs_simple_restore(const memfs_simple_disk_t* disk) {
+    if (!disk || !disk->read || disk->sectors == 0) {
+        return MEMFS_ERROR;
+    }
+    if (!disk->read(disk->drive, disk->lba, 1, snapshot_buffer)) {
+        return MEMFS_ERROR;
+    }
+    memfs_simple_snapshot_header_t header;
+    memcpy(&header, snapshot_buffer, sizeof(header));
+    uint32_t header_checksum = header.header_checksum;
+    header.header_checksum = 0;
+    if (header.magic != MEMFS_SNAPSHOT_MAGIC || header.version != MEMFS_SNAPSHOT_VERSION ||
+        memfs_simple_checksum(MEMFS_CHECKSUM_SEED, &header, sizeof(header)) != header_checksum) {
+        return MEMFS_NOT_FOUND;
+    }
+    uint32_t meta_sectors = (header.meta_bytes + MEMFS_SECTOR_SIZE - 1) / MEMFS_SECTOR_SIZE;
+    if (header.entries > MEMFS_MAX_FILES || header.chunks > MEMFS_SNAPSHOT_MAX_CHUNKS ||
+        1 + meta_sectors + header.chunks * MEMFS_CHUNK_SECTORS > disk->sectors) {
+        return MEMFS_ERROR;
+    }
+    
+    // Check the records as a whole first
+    memfs_simple_stream_t stream;
+    memset(&stream, 0, sizeof(stream));
+    stream.disk = disk;
+    stream.lba = disk->lba + 1;
+    stream.end_lba = stream.lba + meta_sectors;
+    stream.checksum = MEMFS_CHECKSUM_SEED;
+    uint8_t block[MEMFS_SECTOR_SIZE];
+    for (uint32_t left = header.meta_bytes; left > 0;) {
+        uint32_t n = left < sizeof(block) ? left : sizeof(block);
+        if (!memfs_simple_stream_get(&stream, block, n)) {
+            return MEMFS_ERROR;
+        }
+        left -= n;
+    }
+    if (stream.checksum != header.meta_checksum) {
+        return MEMFS_ERROR;
+    }
+    
+    // Then build the table from them; data stays on disk
+    memfs_simple_reset();
+    lazy_disk = *disk;
+    lazy_data_lba = disk->lba + 1 + meta_sectors;
+    memset(&stream, 0, sizeof(stream));
+    stream.disk = disk;
+    stream.lba = disk->lba + 1;
+    stream.end_lba = stream.lba + meta_sectors;
+    uint32_t chunk = 0;
+    for (uint32_t e = 0; e < header.entries; e++) {
+        memfs_simple_snapshot_entry_t entry;
+        int index = memfs_simple_find_free_slot();
+        if (index < 0 || !memfs_simple_stream_get(&stream, &entry, sizeof(entry)) ||
+            (entry.parent_id != 0 && memfs_simple_index_of(entry.parent_id) < 0)) {
+            memfs_simple_reset();
+            return MEMFS_ERROR;
+        }
+        memfs_simple_file_t* file = &file_table[index];
+        memcpy(file->name, entry.name, MEMFS_MAX_FILENAME);
+        file->name[MEMFS_MAX_FILENAME - 1] = '\0';
+        file->type = entry.type;
+        file->size = entry.size;
+        file->in_use = true;
+        file->id = entry.id;
+        file->parent_id = entry.parent_id;
+        file->created_time = entry.created_time;
+        file->modified_time = entry.modified_time;
+        file->accessed_time = entry.accessed_time;
+        file->permissions = entry.permissions;
+        file->flags = entry.flags;
+        memcpy(file->owner, entry.owner, sizeof(file->owner));
+        file->owner[sizeof(file->owner) - 1] = '\0';
+        memfs_simple_link(index);
+        
+        for (uint32_t c = 0; c < entry.chunk_count; c++) {
+            memfs_simple_snapshot_chunk_t record;
+            uint32_t* slot = NULL;
+            if (chunk < header.chunks && memfs_simple_stream_get(&stream, &record, sizeof(record)) &&
+                record.number < MEMFS_DIRECT_CHUNKS + MEMFS_INDEX_CHUNKS) {
+                slot = memfs_simple_chunk_slot(file, record.number, true);
+            }
+            if (!slot) {
+                memfs_simple_reset();
+                return MEMFS_ERROR;
+            }
+            lazy_sums[chunk] = record.checksum;
+            *slot = (chunk << 1) | 1;
+            chunk++;
+        }
+    }
+    next_file_id = header.next_file_id;
+    return (int)header.entries;
+}
+
+// VFS side (Day 21): absolute paths from the mount, handles are slots in
+// file_table. The directory the shell is in plays no part.
+
+// Index of the root as a lookup result; it has no slot of its own
+#define MEMFS_VFS_ROOT MEMFS_MAX_FILES
+
+static int memfs_simple_vfs_error(int result) {
+    switch (result) {
+        case MEMFS_NOT_FOUND: return VFS_ERROR_NOT_FOUND;
+        case MEMFS_EXISTS:    return VFS_ERROR_EXISTS;
+        case MEMFS_NO_SPACE:  return VFS_ERROR_NO_SPACE;
+        case MEMFS_NOT_DIR:   return VFS_ERROR_NOT_DIR;
+        case MEMFS_IS_DIR:    return VFS_ERROR_IS_DIR;
+        default:              return VFS_ERROR_INVALID_PATH;
+    }
+}
+
+// Walk a path to its last component: *parent_id is the directory holding
+// it and leaf its name. Returns the entry's index, MEMFS_VFS_ROOT for "/",
+// MEMFS_NOT_FOUND if only the leaf is missing, or another MEMFS_ error.
+static int memfs_simple_vfs_lookup(const char* path, uint32_t* parent_id, char* leaf) {
+    initcall_require("memfs");          // Every path through the VFS starts here
+    uint32_t dir_id = 0;
+    int index = MEMFS_VFS_ROOT;
+    leaf[0] = '\0';
+    while (*path == '/') {
+        path++;
+    }
+    while (*path) {
+        const char* end = path;
+        while (*end && *end != '/') {
+            end++;
+        }
+        size_t length = (size_t)(end - path);
+        if (length >= MEMFS_MAX_FILENAME) {
+            return MEMFS_ERROR;
+        }
+        if (index != MEMFS_VFS_ROOT) {
+            if (index < 0) {
+                return MEMFS_ERROR;         // A directory on the way is missing
+            }
+            if (file_table[index].type != MEMFS_TYPE_DIR) {
+                return MEMFS_NOT_DIR;
+            }
+            dir_id = file_table[index].id;
+        }
+        memcpy(leaf, path, length);
+        leaf[length] = '\0';
+        index = memfs_simple_find_in_dir(leaf, dir_id);
+        if (index < 0) {
+            index = MEMFS_NOT_FOUND;
+        }
+        path = end;
+        while (*path == '/') {
+            path++;
+        }
+    }
+    *parent_id = dir_id;
+    return index;
+}
+
+static int memfs_simple_vfs_open(void* data, const char* path, uint32_t flags, int32_t* handle) {
+    (void)data;
+    uint32_t parent_id;
+    char leaf[MEMFS_MAX_FILENAME];
+    int index = memfs_simple_vfs_lookup(path, &parent_id, leaf);
+    if (index == MEMFS_NOT_FOUND && (flags & VFS_O_CREATE)) {
+        index = memfs_simple_add(leaf, MEMFS_TYPE_FILE, parent_id);
+    }
+    if (index < 0) {
+        return memfs_simple_vfs_error(index);
+    }
+    if (index == MEMFS_VFS_ROOT || file_table[index].type == MEMFS_TYPE_DIR) {
+        return VFS_ERROR_IS_DIR;
+    }
+    if ((flags & VFS_O_READ) && !(file_table[index].permissions & MEMFS_PERM_READ)) {
+        return VFS_ERROR_PERMISSION;
+    }
+    if ((flags & VFS_O_WRITE) && !(file_table[index].permissions & MEMFS_PERM_WRITE)) {
+        return VFS_ERROR_PERMISSION;
+    }
+    if ((flags & VFS_O_TRUNCATE) && (flags & VFS_O_WRITE)) {
+        memfs_simple_truncate(&file_table[index], 0);
+        file_table[index].modified_time = memfs_simple_get_time();
+    }
+    *handle = index;
+    return VFS_SUCCESS;
+}
+
+static int memfs_simple_vfs_close(void* data, int32_t handle) {
+    (void)data;
+    (void)handle;
+    return VFS_SUCCESS;
+}
+
+// A handle whose file was deleted while open reads as gone
+static memfs_simple_file_t* memfs_simple_vfs_file(int32_t handle) {
+    if (handle < 0 || handle >= MEMFS_MAX_FILES || !file_table[handle].in_use) {
+        return NULL;
+    }
+    return &file_table[handle];
+}
+
+static int memfs_simple_vfs_read(void* data, int32_t handle, uint32_t offset, void* buffer, uint32_t size) {
+    (void)data;
+    memfs_simple_file_t* file = memfs_simple_vfs_file(handle);
+    if (!file) {
+        return VFS_ERROR_INVALID_FD;
+    }
+    if (offset >= file->size) {
+        return 0;
+    }
+    if (size > file->size - offset) {
+        size = file->size - offset;
+    }
+    memfs_simple_load(file, offset, buffer, size);
+    file->accessed_time = memfs_simple_get_time();
+    return (int)size;
+}
+
+// Writes past the end leave zeros in the gap; the file stops growing at
+// MEMFS_MAX_FILESIZE or when memory runs out
+static int memfs_simple_vfs_write(void* data, int32_t handle, uint32_t offset, const void* buffer, uint32_t size) {
+    (void)data;
+    memfs_simple_file_t* file = memfs_simple_vfs_file(handle);
+    if (!file) {
+        return VFS_ERROR_INVALID_FD;
+    }
+    size_t stored = memfs_simple_store(file, offset, buffer, size);
+    if (stored == 0 && size > 0) {
+        return VFS_ERROR_NO_SPACE;
+    }
+    file->modified_time = memfs_simple_get_time();
+    return (int)stored;
+}
+
+static int memfs_simple_vfs_size(void* data, int32_t handle) {
+    (void)data;
+    memfs_simple_file_t* file = memfs_simple_vfs_file(handle);
+    return file ? (int)file->size : VFS_ERROR_INVALID_FD;
+}
+
+// Chunks are page frames already; a hole lends the shared zero page
+static int memfs_simple_vfs_pin(void* data, int32_t handle, uint32_t offset, uint32_t* frame) {
+    (void)data;
+    memfs_simple_file_t* file = memfs_simple_vfs_file(handle);
+    if (!file) {
+        return VFS_ERROR_INVALID_FD;
+    }
+    if (offset >= file->size) {
+        return 0;
+    }
+    uint32_t chunk = memfs_simple_chunk(file, offset / MEMFS_CHUNK_SIZE);
+    if (!chunk) {
+        uint32_t* slot = memfs_simple_chunk_slot(file, offset / MEMFS_CHUNK_SIZE, false);
+        if (slot && *slot) {
+            return VFS_ERROR_NO_SPACE;  // A lazy chunk memory ran out for
+        }
+        chunk = pmm_get_zero_page();
+    }
+    if (pmm_page_ref(chunk) != 0) {
+        return VFS_ERROR_BUSY;          // At the share limit
+    }
+    uint32_t within = offset % MEMFS_CHUNK_SIZE;
+    uint32_t size = MEMFS_CHUNK_SIZE - within;
+    if (size > file->size - offset) {
+        size = (uint32_t)(file->size - offset);
+    }
+    *frame = chunk;
+    file->accessed_time = memfs_simple_get_time();
+    return (int)size;
+}
+
+// An asynchronous read waiting on lazy chunks: a block request for each
+// one still on disk, into a frame of its own
+typedef struct {
+    blk_request_t req;                  // First: the done callback casts back
+    struct memfs_simple_aio* parent;
+    uint32_t n;                         // Chunk number
+    uint32_t lazy;                      // The slot's value when it was sent
+    uint32_t frame;
+} memfs_simple_chunk_io_t;
+
+typedef struct memfs_simple_aio {
+    vfs_aio_t* aio;
+    int32_t handle;
+    uint32_t file_id;                   // A slot reused meanwhile gets no chunks
+    volatile uint32_t remaining;
+    uint32_t count;
+    memfs_simple_chunk_io_t ios[];
+} memfs_simple_aio_t;
+
+// The last chunk is in (block dispatcher): install the ones that read back
+// intact where nothing replaced them meanwhile, then copy out as a plain
+// read would, which faults in whatever is still lazy the old way
+static void memfs_simple_aio_chunk_done(blk_request_t* req) {
+    memfs_simple_chunk_io_t* io = (memfs_simple_chunk_io_t*)req;
+    memfs_simple_aio_t* pending = io->parent;
+    if (__sync_sub_and_fetch(&pending->remaining, 1) != 0) {
+        return;
+    }
+    memfs_simple_file_t* file = memfs_simple_vfs_file(pending->handle);
+    for (uint32_t i = 0; i < pending->count; i++) {
+        io = &pending->ios[i];
+        uint32_t* slot = (file && file->id == pending->file_id) ?
+                         memfs_simple_chunk_slot(file, io->n, false) : NULL;
+        if (slot && *slot == io->lazy && io->req.result &&
+            memfs_simple_checksum(MEMFS_CHECKSUM_SEED, PHYS_TO_VIRT(io->frame), MEMFS_CHUNK_SIZE) ==
+                lazy_sums[io->lazy >> 1]) {
+            *slot = io->frame;
+        } else {
+            pmm_free_page(io->frame);
+        }
+    }
+    vfs_aio_t* aio = pending->aio;
+    kfree(pending);
+    vfs_aio_complete(aio, memfs_simple_vfs_read(NULL, aio->handle, aio->offset, aio->buffer, aio->size));
+}
+
+// File data is in memory, so writes and resident reads finish at once;
+// only a read over chunks a restore left on disk has to wait for them
+static int memfs_simple_vfs_submit(void* data, int32_t handle, vfs_aio_t* aio) {
+    memfs_simple_file_t* file = memfs_simple_vfs_file(handle);
+    if (!file) {
+        return VFS_ERROR_INVALID_FD;
+    }
+    uint32_t size = 0;
+    if (aio->offset < file->size) {
+        size = aio->size < file->size - aio->offset ? aio->size : (uint32_t)(file->size - aio->offset);
+    }
+    uint32_t first = aio->offset / MEMFS_CHUNK_SIZE;
+    uint32_t last = (aio->offset + size + MEMFS_CHUNK_SIZE - 1) / MEMFS_CHUNK_SIZE;
+    uint32_t lazy = 0;
+    for (uint32_t n = first; !aio->write && lazy_disk.block && n < last; n++) {
+        uint32_t* slot = memfs_simple_chunk_slot(file, n, false);
+        lazy += slot && MEMFS_LAZY_CHUNK(*slot);
+    }
+    if (lazy == 0) {
+        int result = aio->write ? memfs_simple_vfs_write(data, handle, aio->offset, aio->buffer, aio->size)
+                                : memfs_simple_vfs_read(data, handle, aio->offset, aio->buffer, aio->size);
+        vfs_aio_complete(aio, result);
+        return VFS_SUCCESS;
+    }
+
+    memfs_simple_aio_t* pending = kmalloc(sizeof(*pending) + lazy * sizeof(memfs_simple_chunk_io_t));
+    if (!pending) {
+        return VFS_ERROR_NO_SPACE;
+    }
+    pending->aio = aio;
+    pending->handle = handle;
+    pending->file_id = file->id;
+    pending->count = 0;
+    for (uint32_t n = first; n < last && pending->count < lazy; n++) {
+        uint32_t* slot = memfs_simple_chunk_slot(file, n, false);
+        if (!slot || !MEMFS_LAZY_CHUNK(*slot)) {
+            continue;
+        }
+        uint32_t frame = pmm_alloc_page();
+        if (!frame) {
+            break;                      // Left for the synchronous fault
+        }
+        memfs_simple_chunk_io_t* io = &pending->ios[pending->count++];
+        memset(&io->req, 0, sizeof(io->req));
+        io->req.drive = lazy_disk.drive;
+        io->req.lba = lazy_data_lba + (*slot >> 1) * MEMFS_CHUNK_SECTORS;
+        io->req.count = MEMFS_CHUNK_SECTORS;
+        io->req.buffer = PHYS_TO_VIRT(frame);
+        io->req.done = memfs_simple_aio_chunk_done;
+        io->parent = pending;
+        io->n = n;
+        io->lazy = *slot;
+        io->frame = frame;
+    }
+    if (pending->count == 0) {
+        kfree(pending);
+        vfs_aio_complete(aio, memfs_simple_vfs_read(data, handle, aio->offset, aio->buffer, aio->size));
+        return VFS_SUCCESS;
+    }
+    // Every request is counted before the first can complete
+    pending->remaining = pending->count;
+    for (uint32_t i = 0; i < pending->count; i++) {
+        blk_submit(&pending->ios[i].req);
+    }
+    blk_unplug();
+    return VFS_SUCCESS;
+}
+
+static int memfs_simple_vfs_stat(void* data, const char* path, vfs_stat_t* stat) {
+    (void)data;
+    uint32_t parent_id;
+    char leaf[MEMFS_MAX_FILENAME];
+    int index = memfs_simple_vfs_lookup(path, &parent_id, leaf);
+    if (index < 0) {
+        return memfs_simple_vfs_error(index);
+    }
+    if (index == MEMFS_VFS_ROOT) {
+        stat->size = 0;
+        stat->type = VFS_TYPE_DIR;
+    } else {
+        stat->size = file_table[index].size;
+        stat->type = file_table[index].type == MEMFS_TYPE_DIR ? VFS_TYPE_DIR : VFS_TYPE_FILE;
+    }
+    return VFS_SUCCESS;
+}
+
+static int memfs_simple_vfs_readdir(void* data, const char* path, uint32_t* cursor, vfs_dirent_t* entries,
+                                    int max_entries) {
+    (void)data;
+    uint32_t parent_id;
+    char leaf[MEMFS_MAX_FILENAME];
+    int index = memfs_simple_vfs_lookup(path, &parent_id, leaf);
+    if (index < 0) {
+        return memfs_simple_vfs_error(index);
+    }
+    uint32_t dir_id = 0;
+    if (index != MEMFS_VFS_ROOT) {
+        if (file_table[index].type != MEMFS_TYPE_DIR) {
+            return VFS_ERROR_NOT_DIR;
+        }
+        dir_id = file_table[index].id;
+    }
+    // The cursor counts the children already listed
+    int count = 0;
+    uint32_t skip = *cursor;
+    for (int i = memfs_simple_first_child(dir_id); i >= 0 && count < max_entries; i = file_table[i].next_sibling) {
+        if (skip > 0) {
+            skip--;
+            continue;
+        }
+        memset(&entries[count], 0, sizeof(vfs_dirent_t));
+        strlcpy(entries[count].name, file_table[i].name, VFS_MAX_NAME);
+        entries[count].size = file_table[i].size;
+        entries[count].type = file_table[i].type == MEMFS_TYPE_DIR ? VFS_TYPE_DIR : VFS_TYPE_FILE;
+        count++;
+    }
+    *cursor += count;
+    return count;
+}
+
+static int memfs_simple_vfs_mkdir(void* data, const char* path) {
+    (void)data;
+    uint32_t parent_id;
+    char leaf[MEMFS_MAX_FILENAME];
+    int index = memfs_simple_vfs_lookup(path, &parent_id, leaf);
+    if (index >= 0) {
+        return VFS_ERROR_EXISTS;
+    }
+    if (index == MEMFS_NOT_FOUND) {
+        index = memfs_simple_add(leaf, MEMFS_TYPE_DIR, parent_id);
+    }
+    return index < 0 ? memfs_simple_vfs_error(index) : VFS_SUCCESS;
+}
+
+// Files and empty directories
+static int memfs_simple_vfs_unlink(void* data, const char* path) {
+    (void)data;
+    uint32_t parent_id;
+    char leaf[MEMFS_MAX_FILENAME];
+    int index = memfs_simple_vfs_lookup(path, &parent_id, leaf);
+    if (index < 0) {
+        return memfs_simple_vfs_error(index);
+    }
+    if (index == MEMFS_VFS_ROOT) {
+        return VFS_ERROR_BUSY;
+    }
+    if (file_table[index].type == MEMFS_TYPE_DIR) {
+        if (file_table[index].first_child >= 0) {
+            return VFS_ERROR_BUSY;
+        }
+        if (current_dir_id == file_table[index].id) {
+            return VFS_ERROR_BUSY;      // The shell is in it
+        }
+    }
+    memfs_simple_release(index);
+    return VFS_SUCCESS;
+}
+
+const vfs_ops_t memfs_simple_vfs_ops = {
+    .name = "memfs_simple",
+    .open = memfs_simple_vfs_open,
+    .close = memfs_simple_vfs_close,
+    .read = memfs_simple_vfs_read,
+    .write = memfs_simple_vfs_write,
+    .size = memfs_simple_vfs_size,
+    .stat = memfs_simple_vfs_stat,
+    .readdir = memfs_simple_vfs_readdir,
+    .mkdir = memfs_simple_vfs_mkdir,
+    .unlink = memfs_simple_vfs_unlink,
+    .pin = memfs_simple_vfs_pin,
+    .submit = memfs_simple_vfs_submit,
+};
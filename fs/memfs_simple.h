@@ -5,13 +5,29 @@
 #define MEMFS_SIMPLE_H
 
 #include "../kernel/types.h"
+#include "../kernel/vfs.h"
 
 // File system constants (Day 11 Phase 2 Enhanced)
-#define MEMFS_MAX_FILES 32          // Maximum number of files/directories
+#define MEMFS_MAX_FILES 2048        // Maximum number of files/directories
+#define MEMFS_HASH_BUCKETS 1024     // Name and id hash buckets (power of two)
 #define MEMFS_MAX_FILENAME 32       // Maximum filename length
-#define MEMFS_MAX_FILESIZE 16384    // Maximum file size (16KB for Day 18)
 #define MEMFS_MAX_PATH 128          // Maximum path length
 
+// File data lives in page-sized chunks taken from the PMM as it is
+// written: a few named by the entry itself, the rest by an index page
+#define MEMFS_CHUNK_SIZE    4096
+#define MEMFS_DIRECT_CHUNKS 4
+#define MEMFS_INDEX_CHUNKS  (MEMFS_CHUNK_SIZE / sizeof(uint32_t))
+#define MEMFS_MAX_FILESIZE  ((MEMFS_DIRECT_CHUNKS + MEMFS_INDEX_CHUNKS) * MEMFS_CHUNK_SIZE)   // ~4MB
+
+// Snapshots (Day 21): header sector, entry records, then the data chunks
+#define MEMFS_SNAPSHOT_MAGIC    0x504E534D  // "MSNP"
+#define MEMFS_SNAPSHOT_VERSION  2           // 2: CRC32C sums
+#define MEMFS_SECTOR_SIZE       512
+#define MEMFS_SNAPSHOT_BATCH    128         // Sectors per disk call
+#define MEMFS_CHUNK_SECTORS     (MEMFS_CHUNK_SIZE / MEMFS_SECTOR_SIZE)
+#define MEMFS_SNAPSHOT_MAX_CHUNKS 1024      // About what the direct map holds
+
 // File types (Day 11)
 #define MEMFS_TYPE_FILE     1
 #define MEMFS_TYPE_DIR      2
@@ -32,22 +48,86 @@
 #define MEMFS_NOT_DIR      -5
 #define MEMFS_IS_DIR       -6
 
-// File entry structure (Day 18 Enhanced)
+// File entry structure (Day 18 Enhanced). Lookups and directory walks
+// read only the first cache line - the name, its hash and the table
+// links; sizes, chunks, times and the owner sit in the second.
+#define MEMFS_ENTRY_ALIGN 64
+
 typedef struct memfs_simple_file {
-    char name[MEMFS_MAX_FILENAME];      // File/directory name
+    uint32_t name_hash;                 // FNV-1a of (parent_id, name), checked before the name
+    uint32_t parent_id;                 // Parent directory ID (0 = root)
+    uint32_t id;                        // Unique file ID
+    bool in_use;                        // Entry in use flag
     uint8_t type;                       // File type (MEMFS_TYPE_FILE or MEMFS_TYPE_DIR)
+    // Day 21: indexes into the file table, -1 for none (the root has no slot)
+    int16_t name_next;                  // Same (parent_id, name) bucket
+    int16_t id_next;                    // Same id bucket
+    int16_t parent;                     // Containing directory
+    int16_t first_child;                // Directories: entries in creation order
+    int16_t last_child;
+    int16_t next_sibling;               // Same directory; free slots chain through it
+    int16_t prev_sibling;
+    char name[MEMFS_MAX_FILENAME];      // File/directory name
     size_t size;                        // Current file size
-    uint8_t data[MEMFS_MAX_FILESIZE];   // File data
-    bool in_use;                        // Entry in use flag
-    uint32_t id;                        // Unique file ID
-    uint32_t parent_id;                 // Parent directory ID (0 = root)
+    uint32_t chunks[MEMFS_DIRECT_CHUNKS];   // Frames holding the first bytes (0 = none yet)
+    uint32_t index_page;                // Frame listing the chunks after those (0 = none)
     uint32_t created_time;              // Creation timestamp
     uint32_t modified_time;             // Last modification timestamp
     uint32_t accessed_time;             // Last access timestamp
     uint16_t permissions;               // File permissions (rwx format)
     uint16_t flags;                     // Additional file flags
     char owner[16];                     // File owner name
-} memfs_simple_file_t;
+} __attribute__((aligned(MEMFS_ENTRY_ALIGN))) memfs_simple_file_t;
+
+_Static_assert(__builtin_offsetof(memfs_simple_file_t, size) <= MEMFS_ENTRY_ALIGN,
+               "memfs_simple_file_t lookup fields spill past the first cache line");
+
+// Where snapshots go. read and write have ata_read/ata_write's signature
+// (nonzero = success).
+typedef struct memfs_simple_disk {
+    int (*read)(uint8_t drive, uint32_t lba, uint32_t count, void* buffer);
+    int (*write)(uint8_t drive, uint32_t lba, uint32_t count, const void* buffer);
+    uint8_t drive;
+    uint32_t lba;                       // First sector of the area
+    uint32_t sectors;                   // Its size
+    bool block;                         // drive is a block-layer drive: asynchronous
+                                        // reads fetch lazy chunks through it
+} memfs_simple_disk_t;
+
+typedef struct {
+    uint32_t magic;                     // MEMFS_SNAPSHOT_MAGIC
+    uint32_t version;
+    uint32_t entries;
+    uint32_t chunks;
+    uint32_t next_file_id;
+    uint32_t meta_bytes;                // Entry records after the header sector
+    uint32_t meta_checksum;
+    uint32_t header_checksum;           // Over this header with the field zero
+} __attribute__((packed)) memfs_simple_snapshot_header_t;
+
+// One per entry, parents before their children; chunk_count
+// memfs_simple_snapshot_chunk_t follow it
+typedef struct {
+    char name[MEMFS_MAX_FILENAME];
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t size;
+    uint32_t id;
+    uint32_t parent_id;
+    uint32_t created_time;
+    uint32_t modified_time;
+    uint32_t accessed_time;
+    uint16_t permissions;
+    uint16_t flags;
+    char owner[16];
+    uint32_t chunk_count;
+} __attribute__((packed)) memfs_simple_snapshot_entry_t;
+
+// A chunk's place in its file; its data is the next in the data area
+typedef struct {
+    uint32_t number;
+    uint32_t checksum;
+} __attribute__((packed)) memfs_simple_snapshot_chunk_t;
 
 // File system statistics
 typedef struct memfs_simple_stats {
@@ -83,8 +163,15 @@ void memfs_simple_getcwd(char* buffer, size_t size);
 
 // File I/O (simplified)
 int memfs_simple_read(const char* filename, char* buffer, size_t buffer_size);
+int memfs_simple_read_at(const char* filename, size_t offset, char* buffer, size_t buffer_size);
 int memfs_simple_write(const char* filename, const char* content);
 
+// Day 21: I/O at an offset, costing only the bytes it touches. Writes
+// create the file if it doesn't exist.
+int memfs_simple_pread(const char* filename, size_t offset, void* buffer, size_t size);
+int memfs_simple_pwrite(const char* filename, size_t offset, const void* buffer, size_t size);
+int memfs_simple_append(const char* filename, const void* buffer, size_t size);
+
 // Utility functions
 void memfs_simple_list_files(void);
 void memfs_simple_list_detailed(void);  // Day 11: ls -l equivalent
@@ -103,4 +190,13 @@ int memfs_simple_find_in_dir(const char* name, uint32_t parent_id);
 uint32_t memfs_simple_get_time(void);  // Simple timestamp function
 void memfs_simple_format_time(uint32_t timestamp, char* buffer, size_t size);  // Format timestamp for display
 
+// Day 21: the whole file system as one image on disk. Restore reads the
+// entries and leaves the data there until a chunk is first touched, so
+// the area must not be written until the next snapshot or restore.
+int memfs_simple_snapshot(const memfs_simple_disk_t* disk);
+int memfs_simple_restore(const memfs_simple_disk_t* disk);
+
+// Day 21: the file system as the VFS sees it
+extern const vfs_ops_t memfs_simple_vfs_ops;
+
 #endif // MEMFS_SIMPLE_H
\ No newline at end of file
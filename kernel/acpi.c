@@ -0,0 +1,121 @@
+// ClaudeOS ACPI Tables Implementation - Day 21
+// Only the 32-bit RSDT is used: every table it names lies below 4GB, which
+// is all this kernel can map anyway
+
+#include "acpi.h"
+#include "kernel.h"
+#include "pmm.h"
+
+#define ACPI_EBDA_POINTER   0x40E       // BIOS data area: EBDA segment
+#define ACPI_BIOS_START     0xE0000
+#define ACPI_BIOS_END       0x100000
+
+typedef struct {
+    char signature[8];                  // "RSD PTR "
+    uint8_t checksum;                   // Over these 20 bytes
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+} __attribute__((packed)) acpi_rsdp_t;
+
+static uint32_t acpi_rsdt_phys = 0;
+static bool acpi_searched = false;
+
+static uint8_t acpi_sum(const void* data, uint32_t length) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum;
+}
+
+static bool acpi_signature_is(const char* have, const char* want, uint32_t length) {
+    for (uint32_t i = 0; i < length; i++) {
+        if (have[i] != want[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Look for the RSDP on 16-byte boundaries in physical [start, end), which
+// lies in the direct map
+static const acpi_rsdp_t* acpi_scan(uint32_t start, uint32_t end) {
+    for (uint32_t addr = start; addr + sizeof(acpi_rsdp_t) <= end; addr += 16) {
+        const acpi_rsdp_t* rsdp = (const acpi_rsdp_t*)PHYS_TO_VIRT(addr);
+        if (acpi_signature_is(rsdp->signature, "RSD PTR ", 8) && acpi_sum(rsdp, 20) == 0) {
+            return rsdp;
+        }
+    }
+    return NULL;
+}
+
+// Map size bytes at phys into the window; NULL if they don't fit
+static const void* acpi_map(uint32_t phys, uint32_t size) {
+    uint32_t offset = phys & (PAGE_SIZE - 1);
+    uint32_t pages = PAGE_ALIGN(offset + size) / PAGE_SIZE;
+    if (size == 0 || pages > ACPI_WINDOW_PAGES) {
+        return NULL;
+    }
+    for (uint32_t i = 0; i < pages; i++) {
+        uint32_t virt = ACPI_WINDOW_VIRT + i * PAGE_SIZE;
+        vmm_map_page(kernel_page_directory, virt, PAGE_FLOOR(phys) + i * PAGE_SIZE, PAGE_PRESENT);
+        vmm_invalidate_page(virt);
+    }
+    return (const void*)(ACPI_WINDOW_VIRT + offset);
+}
+
+// Map a whole table by its header, checking its checksum
+static const acpi_header_t* acpi_map_table(uint32_t phys) {
+    const acpi_header_t* header = (const acpi_header_t*)acpi_map(phys, sizeof(acpi_header_t));
+    if (!header || header->length < sizeof(acpi_header_t)) {
+        return NULL;
+    }
+    header = (const acpi_header_t*)acpi_map(phys, header->length);
+    if (!header || acpi_sum(header, header->length) != 0) {
+        return NULL;
+    }
+    return header;
+}
+
+const acpi_header_t* acpi_find_table(const char* signature) {
+    if (!kernel_page_directory) {
+        return NULL;
+    }
+    if (!acpi_searched) {
+        acpi_searched = true;
+        uint32_t ebda = (uint32_t)(*(volatile uint16_t*)PHYS_TO_VIRT(ACPI_EBDA_POINTER)) << 4;
+        const acpi_rsdp_t* rsdp = ebda ? acpi_scan(ebda, ebda + 1024) : NULL;
+        if (!rsdp) {
+            rsdp = acpi_scan(ACPI_BIOS_START, ACPI_BIOS_END);
+        }
+        acpi_rsdt_phys = rsdp ? rsdp->rsdt_address : 0;
+    }
+    if (!acpi_rsdt_phys) {
+        return NULL;
+    }
+
+    // Copy the entries out: mapping each table replaces the RSDT
+    const acpi_header_t* rsdt = acpi_map_table(acpi_rsdt_phys);
+    if (!rsdt || !acpi_signature_is(rsdt->signature, "RSDT", 4)) {
+        return NULL;
+    }
+    uint32_t entries[ACPI_MAX_TABLES];
+    uint32_t count = (rsdt->length - sizeof(acpi_header_t)) / sizeof(uint32_t);
+    if (count > ACPI_MAX_TABLES) {
+        count = ACPI_MAX_TABLES;
+    }
+    const uint32_t* list = (const uint32_t*)(rsdt + 1);
+    for (uint32_t i = 0; i < count; i++) {
+        entries[i] = list[i];
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        const acpi_header_t* header = (const acpi_header_t*)acpi_map(entries[i], sizeof(acpi_header_t));
+        if (header && acpi_signature_is(header->signature, signature, 4)) {
+            return acpi_map_table(entries[i]);
+        }
+    }
+    return NULL;
+}
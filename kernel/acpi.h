@@ -0,0 +1,35 @@
+// ClaudeOS ACPI Tables - Day 21
+// Finds the RSDP in the BIOS areas and looks tables up through the RSDT.
+// Tables usually sit at the top of RAM, beyond the kernel's direct map,
+// so each one found is mapped into a small window that the next lookup
+// reuses: copy out what is needed before asking for another.
+
+#ifndef ACPI_H
+#define ACPI_H
+
+#include "types.h"
+#include "vmm.h"
+
+#define ACPI_WINDOW_VIRT    (VMM_MMIO_START + 0x8000)   // Below the e1000's registers
+#define ACPI_WINDOW_PAGES   8                           // Largest table that can be mapped
+#define ACPI_MAX_TABLES     32                          // RSDT entries searched
+
+// Common header of every system description table
+typedef struct {
+    char signature[4];
+    uint32_t length;                    // Header included
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_header_t;
+
+// The table with this signature (e.g. "APIC" for the MADT), checksum
+// verified, mapped until the next call; NULL if there is none. Needs
+// paging (vmm_init).
+const acpi_header_t* acpi_find_table(const char* signature);
+
+#endif // ACPI_H
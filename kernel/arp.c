@@ -0,0 +1,308 @@
+// ClaudeOS ARP Cache Implementation - Day 21
+// Fixed entry pool hashed by IP; stale entries are re-resolved on use.
+// Changes are made under arp_lock; resolved hits are looked up under RCU
+// alone. An entry never changes address or MAC while hashed: it is
+// retired instead and reused after a grace period, and ARP_RESOLVED is
+// only set once its MAC is in place.
+
+#include "arp.h"
+#include "ipv4.h"
+#include "kernel.h"
+
+#define ARP_HASH_BITS       6           // log2(ARP_HASH_BUCKETS)
+
+static arp_entry_t arp_entries[ARP_CACHE_SIZE];
+static arp_entry_t* arp_buckets[ARP_HASH_BUCKETS];
+static spinlock_t arp_lock;             // Unregistered; left zeroed
+static uint32_t arp_hits = 0;
+static uint32_t arp_misses = 0;
+static uint32_t arp_requests_sent = 0;
+static uint32_t arp_replies_sent = 0;
+
+static const uint8_t eth_broadcast[ETH_ALEN] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+// Multiplicative hash: neighbours on one subnet differ in the low bits
+static inline uint32_t arp_hash(uint32_t ip) {
+    return (ip * 2654435761u) >> (32 - ARP_HASH_BITS);
+}
+
+static bool arp_mac_equal(const uint8_t* a, const uint8_t* b) {
+    for (int i = 0; i < ETH_ALEN; i++) {
+        if (a[i] != b[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static arp_entry_t* arp_lookup(int interface_id, uint32_t ip) {
+    for (arp_entry_t* entry = rcu_dereference(arp_buckets[arp_hash(ip)]); entry;
+         entry = rcu_dereference(entry->next)) {
+        if (entry->ip == ip && entry->interface_id == interface_id) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void arp_free_rcu(rcu_head_t* head) {
+    arp_entry_t* entry = (arp_entry_t*)((uint8_t*)head - __builtin_offsetof(arp_entry_t, rcu));
+    uint32_t flags = spin_lock_irqsave(&arp_lock);
+    entry->next = NULL;
+    entry->state = ARP_FREE;
+    spin_unlock_irqrestore(&arp_lock, flags);
+}
+
+// Unhash an entry (arp_lookup callers may still be on it, so its own link
+// stays) and free it after a grace period; its parked packet is returned
+// for the caller to free (arp_lock held)
+static network_packet_t* arp_retire(arp_entry_t* entry) {
+    arp_entry_t** link = &arp_buckets[arp_hash(entry->ip)];
+    while (*link && *link != entry) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        rcu_assign_pointer(*link, entry->next);
+    }
+    network_packet_t* pending = entry->pending;
+    entry->pending = NULL;
+    entry->state = ARP_RETIRED;
+    call_rcu(&entry->rcu, arp_free_rcu);
+    return pending;
+}
+
+// A free entry (arp_lock held), or NULL with none left. Taking the last
+// one retires the least recently updated entry, so another is free by
+// the next miss; its parked packet is returned for the caller to free.
+static arp_entry_t* arp_alloc(int interface_id, uint32_t ip, network_packet_t** evicted) {
+    arp_entry_t* free_entry = NULL;
+    arp_entry_t* victim = NULL;
+    int free_count = 0;
+    uint32_t now = timer_get_ticks();
+    *evicted = NULL;
+    for (int i = 0; i < ARP_CACHE_SIZE; i++) {
+        arp_entry_t* entry = &arp_entries[i];
+        if (entry->state == ARP_FREE) {
+            free_entry = free_entry ? free_entry : entry;
+            free_count++;
+        } else if (entry->state != ARP_RETIRED &&
+                   (!victim || now - entry->updated > now - victim->updated)) {
+            victim = entry;
+        }
+    }
+    if (free_count <= 1 && victim) {
+        *evicted = arp_retire(victim);
+    }
+    if (!free_entry) {
+        return NULL;
+    }
+    free_entry->pending = NULL;
+    free_entry->ip = ip;
+    free_entry->interface_id = interface_id;
+    free_entry->state = ARP_PENDING;
+    free_entry->updated = now - ARP_RETRY_TICKS;  // Due for a request right away
+    uint32_t bucket = arp_hash(ip);
+    free_entry->next = arp_buckets[bucket];
+    rcu_assign_pointer(arp_buckets[bucket], free_entry);
+    return free_entry;
+}
+
+static void arp_fill(arp_packet_t* arp, uint16_t op, const uint8_t* sender_mac, uint32_t sender_ip,
+                     const uint8_t* target_mac, uint32_t target_ip) {
+    arp->htype = net_htons(ARP_HTYPE_ETHERNET);
+    arp->ptype = net_htons(ETH_TYPE_IPV4);
+    arp->hlen = ETH_ALEN;
+    arp->plen = 4;
+    arp->op = net_htons(op);
+    for (int i = 0; i < ETH_ALEN; i++) {
+        arp->sender_mac[i] = sender_mac[i];
+        arp->target_mac[i] = target_mac ? target_mac[i] : 0;
+    }
+    arp->sender_ip = net_htonl(sender_ip);
+    arp->target_ip = net_htonl(target_ip);
+}
+
+static void arp_send_request(network_interface_t* iface, uint32_t ip) {
+    network_packet_t* packet = network_alloc_packet();
+    arp_packet_t* arp = packet ? (arp_packet_t*)network_packet_put(packet, sizeof(arp_packet_t)) : NULL;
+    if (!arp) {
+        network_free_packet(packet);
+        return;
+    }
+    arp_fill(arp, ARP_OP_REQUEST, iface->mac_address, iface->ip_address, NULL, ip);
+    arp_requests_sent++;
+    eth_output(iface, eth_broadcast, ETH_TYPE_ARP, packet);
+}
+
+int arp_output(network_interface_t* iface, uint32_t next_hop, network_packet_t* packet) {
+    if (next_hop == IPV4_BROADCAST) {
+        return eth_output(iface, eth_broadcast, ETH_TYPE_IPV4, packet);
+    }
+
+    uint8_t mac[ETH_ALEN];
+    network_packet_t* dropped = NULL;
+    bool send_request = false;
+    uint32_t now = timer_get_ticks();
+    uint32_t flags = rcu_read_lock();
+    arp_entry_t* entry = arp_lookup(iface->id, next_hop);
+    if (entry && entry->state == ARP_RESOLVED && now - entry->updated < ARP_ENTRY_TTL_TICKS) {
+        for (int i = 0; i < ETH_ALEN; i++) {
+            mac[i] = entry->mac[i];
+        }
+        rcu_read_unlock(flags);
+        __sync_fetch_and_add(&arp_hits, 1);
+        return eth_output(iface, mac, ETH_TYPE_IPV4, packet);
+    }
+    rcu_read_unlock(flags);
+
+    // Resolved meanwhile, or a miss to record
+    flags = spin_lock_irqsave(&arp_lock);
+    entry = arp_lookup(iface->id, next_hop);
+    if (entry && entry->state == ARP_RESOLVED && now - entry->updated < ARP_ENTRY_TTL_TICKS) {
+        for (int i = 0; i < ETH_ALEN; i++) {
+            mac[i] = entry->mac[i];
+        }
+        __sync_fetch_and_add(&arp_hits, 1);
+        spin_unlock_irqrestore(&arp_lock, flags);
+        return eth_output(iface, mac, ETH_TYPE_IPV4, packet);
+    }
+
+    // Unknown or aged out: park the packet (replacing an older one) and
+    // ask again, at most once per retry interval
+    arp_misses++;
+    if (!entry) {
+        entry = arp_alloc(iface->id, next_hop, &dropped);
+        if (!entry) {
+            // Every entry is waiting out a grace period
+            spin_unlock_irqrestore(&arp_lock, flags);
+            network_free_packet(dropped);
+            network_free_packet(packet);
+            return -1;
+        }
+    } else if (entry->state == ARP_RESOLVED) {
+        entry->state = ARP_PENDING;
+        entry->updated = now - ARP_RETRY_TICKS;
+    }
+    network_packet_t* older = entry->pending;
+    entry->pending = packet;
+    if (now - entry->updated >= ARP_RETRY_TICKS) {
+        entry->updated = now;
+        send_request = true;
+    }
+    spin_unlock_irqrestore(&arp_lock, flags);
+
+    network_free_packet(older);
+    network_free_packet(dropped);
+    if (send_request) {
+        arp_send_request(iface, next_hop);
+    }
+    return 0;
+}
+
+void arp_input(network_interface_t* iface, network_packet_t* packet) {
+    if (packet->size < sizeof(arp_packet_t)) {
+        network_free_packet(packet);
+        return;
+    }
+    arp_packet_t* arp = (arp_packet_t*)packet->data;
+    if (net_ntohs(arp->htype) != ARP_HTYPE_ETHERNET || net_ntohs(arp->ptype) != ETH_TYPE_IPV4 ||
+        arp->hlen != ETH_ALEN || arp->plen != 4) {
+        network_free_packet(packet);
+        return;
+    }
+    uint32_t sender_ip = net_ntohl(arp->sender_ip);
+    uint32_t target_ip = net_ntohl(arp->target_ip);
+    bool for_us = target_ip == iface->ip_address;
+
+    // Learn the sender if it is already cached or is talking to us, and
+    // release whatever was waiting for it
+    network_packet_t* waiting = NULL;
+    network_packet_t* dropped = NULL;
+    uint32_t flags = spin_lock_irqsave(&arp_lock);
+    arp_entry_t* entry = arp_lookup(iface->id, sender_ip);
+    if (entry && entry->state == ARP_RESOLVED && !arp_mac_equal(entry->mac, arp->sender_mac)) {
+        // Moved to another MAC: lockless readers may be copying the old one
+        waiting = arp_retire(entry);
+        entry = arp_alloc(iface->id, sender_ip, &dropped);
+        if (entry) {
+            entry->pending = waiting;
+            waiting = NULL;
+        }
+    } else if (!entry && for_us) {
+        entry = arp_alloc(iface->id, sender_ip, &dropped);
+    }
+    if (entry) {
+        if (entry->state != ARP_RESOLVED) {
+            for (int i = 0; i < ETH_ALEN; i++) {
+                entry->mac[i] = arp->sender_mac[i];
+            }
+            asm volatile ("" : : : "memory");   // MAC before the state readers check
+        }
+        entry->state = ARP_RESOLVED;
+        entry->updated = timer_get_ticks();
+        waiting = entry->pending;
+        entry->pending = NULL;
+    }
+    spin_unlock_irqrestore(&arp_lock, flags);
+    network_free_packet(dropped);
+    if (waiting) {
+        eth_output(iface, arp->sender_mac, ETH_TYPE_IPV4, waiting);
+    }
+
+    // Answer a request in the buffer it arrived in
+    if (for_us && net_ntohs(arp->op) == ARP_OP_REQUEST) {
+        uint8_t requester[ETH_ALEN];
+        for (int i = 0; i < ETH_ALEN; i++) {
+            requester[i] = arp->sender_mac[i];
+        }
+        packet->size = sizeof(arp_packet_t);
+        arp_fill(arp, ARP_OP_REPLY, iface->mac_address, iface->ip_address, requester, sender_ip);
+        arp_replies_sent++;
+        eth_output(iface, requester, ETH_TYPE_ARP, packet);
+        return;
+    }
+    network_free_packet(packet);
+}
+
+void arp_flush(void) {
+    uint32_t flags = spin_lock_irqsave(&arp_lock);
+    network_packet_t* parked[ARP_CACHE_SIZE];
+    for (int i = 0; i < ARP_CACHE_SIZE; i++) {
+        arp_entry_t* entry = &arp_entries[i];
+        parked[i] = NULL;
+        if (entry->state == ARP_PENDING || entry->state == ARP_RESOLVED) {
+            parked[i] = arp_retire(entry);
+        }
+    }
+    spin_unlock_irqrestore(&arp_lock, flags);
+    for (int i = 0; i < ARP_CACHE_SIZE; i++) {
+        network_free_packet(parked[i]);
+    }
+}
+
+void arp_list(void) {
+    terminal_writestring("ARP Cache (address, MAC, state, age in ticks):\n");
+    uint32_t now = timer_get_ticks();
+    bool found_any = false;
+    for (int i = 0; i < ARP_CACHE_SIZE; i++) {
+        arp_entry_t* entry = &arp_entries[i];
+        if (entry->state == ARP_FREE || entry->state == ARP_RETIRED) {
+            continue;
+        }
+        found_any = true;
+        char ip_str[16];
+        char mac_str[18];
+        network_format_ip_address(entry->ip, ip_str, sizeof(ip_str));
+        network_format_mac_address(entry->mac, mac_str, sizeof(mac_str));
+        bool stale = now - entry->updated >= ARP_ENTRY_TTL_TICKS;
+        terminal_printf("  %s  %s  %s  %d\n", ip_str,
+                        entry->state == ARP_RESOLVED ? mac_str : "(incomplete)     ",
+                        entry->state == ARP_PENDING ? "pending" : (stale ? "stale" : "resolved"),
+                        (int)(now - entry->updated));
+    }
+    if (!found_any) {
+        terminal_writestring("  empty\n");
+    }
+    terminal_printf("Lookups: %d hits, %d misses; %d requests and %d replies sent\n",
+                    (int)arp_hits, (int)arp_misses, (int)arp_requests_sent, (int)arp_replies_sent);
+}
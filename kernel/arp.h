@@ -0,0 +1,63 @@
+// ClaudeOS ARP Cache - Day 21
+// IPv4-to-Ethernet address resolution with a hashed, aging neighbour cache
+
+#ifndef ARP_H
+#define ARP_H
+
+#include "types.h"
+#include "network.h"
+#include "timer.h"
+#include "rcu.h"
+
+#define ARP_CACHE_SIZE      32
+#define ARP_HASH_BUCKETS    64          // Power of two
+#define ARP_ENTRY_TTL_TICKS (60 * TIMER_FREQUENCY)       // Resolved entries go stale
+#define ARP_RETRY_TICKS     (TIMER_FREQUENCY / 2)        // Between requests for one address
+
+#define ARP_HTYPE_ETHERNET  1
+#define ARP_OP_REQUEST      1
+#define ARP_OP_REPLY        2
+
+typedef enum {
+    ARP_FREE = 0,
+    ARP_PENDING,                        // Request sent, no reply yet
+    ARP_RESOLVED,
+    ARP_RETIRED                         // Unhashed; free once lookups can't reach it
+} arp_state_t;
+
+typedef struct arp_entry {
+    uint32_t ip;                        // Host byte order
+    uint8_t mac[6];
+    arp_state_t state;
+    int interface_id;
+    uint32_t updated;                   // Tick of the last reply or request
+    network_packet_t* pending;          // Latest packet waiting for the reply
+    struct arp_entry* next;             // Hash chain
+    rcu_head_t rcu;
+} arp_entry_t;
+
+typedef struct {
+    uint16_t htype;
+    uint16_t ptype;
+    uint8_t hlen;
+    uint8_t plen;
+    uint16_t op;
+    uint8_t sender_mac[6];
+    uint32_t sender_ip;
+    uint8_t target_mac[6];
+    uint32_t target_ip;
+} __attribute__((packed)) arp_packet_t;
+
+// Send packet (with an IPv4 header already on it) to next_hop, resolving
+// its MAC first if need be. Cached addresses cost one hash lookup, made
+// under RCU without arp_lock; a miss parks the packet on the entry until
+// the reply arrives.
+int arp_output(network_interface_t* iface, uint32_t next_hop, network_packet_t* packet);
+
+// Handle an ARP frame (Ethernet header already pulled)
+void arp_input(network_interface_t* iface, network_packet_t* packet);
+
+void arp_flush(void);
+void arp_list(void);
+
+#endif // ARP_H
@@ -0,0 +1,452 @@
+// ClaudeOS Buffer Cache Implementation - Day 21
+// A fixed pool of block buffers hashed by (drive, LBA). Eviction is CLOCK:
+// the hand skips pinned buffers and gives referenced ones a second chance;
+// a dirty victim is written back before it is reused.
+
+#include "bcache.h"
+#include "kernel.h"
+#include "lock.h"
+#include "heap.h"
+#include "string.h"
+#include "process.h"
+#include "timer.h"
+
+static spinlock_t bcache_lock;          // Unregistered; guards the hash, pins and flags
+static bcache_buf_t buffers[BCACHE_BUFFERS];
+static bcache_buf_t* hash_table[BCACHE_HASH_BUCKETS];
+static uint8_t* pool;                   // Every buffer's data, back to back
+static uint32_t clock_hand = 0;
+static bcache_stats_t bcache_stats;
+static bool bcache_ready = false;
+static int flusher_pid = INVALID_PID;
+static void (*volatile flusher_hook)(void);
+
+static inline uint32_t bcache_hash(uint8_t drive, uint32_t lba) {
+    return ((lba / BCACHE_BLOCK_SECTORS + drive) * 2654435761u) >> (32 - BCACHE_HASH_BITS);
+}
+
+int bcache_init(void) {
+    if (bcache_ready) {
+        return 0;
+    }
+    pool = kmalloc(BCACHE_BUFFERS * BCACHE_BLOCK_SIZE);
+    if (!pool) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < BCACHE_BUFFERS; i++) {
+        memset(&buffers[i], 0, sizeof(bcache_buf_t));
+        buffers[i].data = pool + i * BCACHE_BLOCK_SIZE;
+    }
+    for (uint32_t i = 0; i < BCACHE_HASH_BUCKETS; i++) {
+        hash_table[i] = NULL;
+    }
+    bcache_ready = true;
+    if (blk_init() != 0) {
+        return -1;
+    }
+    bcache_flusher_start();
+    return 0;
+}
+
+// Cached buffer for the block (bcache_lock held)
+static bcache_buf_t* bcache_lookup(uint8_t drive, uint32_t lba) {
+    for (bcache_buf_t* buf = hash_table[bcache_hash(drive, lba)]; buf; buf = buf->hash_next) {
+        if (buf->drive == drive && buf->lba == lba) {
+            return buf;
+        }
+    }
+    return NULL;
+}
+
+static void bcache_unhash(bcache_buf_t* buf) {
+    bcache_buf_t** link = &hash_table[bcache_hash(buf->drive, buf->lba)];
+    while (*link && *link != buf) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) {
+        *link = buf->hash_next;
+    }
+    buf->hash_next = NULL;
+}
+
+// One block transfer through the block layer, waiting for it
+static int bcache_io(bcache_buf_t* buf, bool write) {
+    blk_request_t* req = &buf->request;
+    req->drive = buf->drive;
+    req->write = write;
+    req->flags = 0;
+    req->lba = buf->lba;
+    req->count = BCACHE_BLOCK_SECTORS;
+    req->buffer = buf->data;
+    req->done = NULL;
+    blk_submit(req);
+    blk_wait(req);
+    return req->result ? 0 : -1;
+}
+
+// Unpinned buffer to reuse, pinned for the caller (bcache_lock held). Two
+// sweeps: the first clears the referenced bits it passes.
+static bcache_buf_t* bcache_victim(bool allow_dirty) {
+    for (uint32_t step = 0; step < 2 * BCACHE_BUFFERS; step++) {
+        bcache_buf_t* buf = &buffers[clock_hand];
+        clock_hand = (clock_hand + 1) % BCACHE_BUFFERS;
+        if (buf->refcount > 0) {
+            continue;
+        }
+        if (buf->referenced) {
+            buf->referenced = false;
+            continue;
+        }
+        if (!allow_dirty && buf->valid && buf->dirty) {
+            continue;
+        }
+        buf->refcount = 1;
+        return buf;
+    }
+    return NULL;
+}
+
+// Give a pinned buffer to the block, hashed and marked loading (bcache_lock held)
+static void bcache_assign(bcache_buf_t* buf, uint8_t drive, uint32_t lba) {
+    buf->drive = drive;
+    buf->lba = lba;
+    buf->valid = false;
+    buf->dirty = false;
+    buf->checked = false;
+    buf->referenced = true;
+    buf->loading = true;
+    uint32_t bucket = bcache_hash(drive, lba);
+    buf->hash_next = hash_table[bucket];
+    hash_table[bucket] = buf;
+}
+
+// A read finished (bcache_lock held)
+static void bcache_loaded(bcache_buf_t* buf, bool ok) {
+    buf->loading = false;
+    buf->valid = ok;
+    if (!ok) {
+        bcache_unhash(buf);
+    }
+}
+
+bcache_buf_t* bcache_get(uint8_t drive, uint32_t lba) {
+    if (!bcache_ready && bcache_init() != 0) {
+        return NULL;
+    }
+    uint32_t flags = spin_lock_irqsave(&bcache_lock);
+    bcache_buf_t* buf = bcache_lookup(drive, lba);
+    if (buf) {
+        buf->refcount++;
+        buf->referenced = true;
+        bcache_stats.hits++;
+        // Someone else's read, or a read-ahead, is in progress
+        while (buf->loading) {
+            spin_unlock_irqrestore(&bcache_lock, flags);
+            blk_wait(&buf->request);
+            flags = spin_lock_irqsave(&bcache_lock);
+        }
+        bool valid = buf->valid;
+        spin_unlock_irqrestore(&bcache_lock, flags);
+        if (!valid) {
+            bcache_release(buf);  // That read failed
+            return NULL;
+        }
+        return buf;
+    }
+    bcache_stats.misses++;
+
+    buf = bcache_victim(true);
+    if (!buf) {
+        spin_unlock_irqrestore(&bcache_lock, flags);
+        return NULL;
+    }
+    bool writeback = buf->valid && buf->dirty;
+    if (buf->valid) {
+        bcache_stats.evictions++;
+    }
+    buf->dirty = false;
+    buf->writing = writeback;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+
+    // Write the old block out before its buffer changes hands; it stays
+    // hashed until then, so a get for it meanwhile still finds it
+    if (writeback) {
+        bcache_stats.writebacks++;
+        int result = bcache_io(buf, true);
+        flags = spin_lock_irqsave(&bcache_lock);
+        buf->writing = false;
+        spin_unlock_irqrestore(&bcache_lock, flags);
+        if (result != 0) {
+            bcache_mark_dirty(buf);
+            bcache_release(buf);
+            return NULL;
+        }
+    }
+
+    flags = spin_lock_irqsave(&bcache_lock);
+    if (buf->refcount != 1 || (writeback && buf->dirty)) {
+        // Claimed or dirtied again while it was being written
+        buf->refcount--;
+        spin_unlock_irqrestore(&bcache_lock, flags);
+        return bcache_get(drive, lba);
+    }
+    if (buf->valid) {
+        bcache_unhash(buf);
+    }
+    // Lost a race with another get for the same block: use theirs
+    bcache_buf_t* other = bcache_lookup(drive, lba);
+    if (other) {
+        buf->valid = false;
+        buf->refcount = 0;
+        spin_unlock_irqrestore(&bcache_lock, flags);
+        return bcache_get(drive, lba);
+    }
+    bcache_assign(buf, drive, lba);
+    spin_unlock_irqrestore(&bcache_lock, flags);
+
+    int result = bcache_io(buf, false);
+
+    flags = spin_lock_irqsave(&bcache_lock);
+    bcache_loaded(buf, result == 0);
+    spin_unlock_irqrestore(&bcache_lock, flags);
+    if (result != 0) {
+        bcache_release(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+void bcache_mark_dirty(bcache_buf_t* buf) {
+    if (flusher_pid == INVALID_PID) {
+        bcache_flusher_start();  // The scheduler may have come up since init
+    }
+    uint32_t flags = spin_lock_irqsave(&bcache_lock);
+    if (!buf->dirty) {
+        buf->dirty_since = timer_get_ticks();
+    }
+    buf->dirty = true;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+}
+
+void bcache_release(bcache_buf_t* buf) {
+    uint32_t flags = spin_lock_irqsave(&bcache_lock);
+    if (buf->refcount > 0) {
+        buf->refcount--;
+    }
+    spin_unlock_irqrestore(&bcache_lock, flags);
+}
+
+// Runs on the dispatcher; the pin taken by bcache_prefetch ends here
+static void bcache_prefetch_done(blk_request_t* req) {
+    bcache_buf_t* buf = (bcache_buf_t*)req->private_data;
+    uint32_t flags = spin_lock_irqsave(&bcache_lock);
+    bcache_loaded(buf, req->result != 0);
+    buf->refcount--;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+}
+
+// Only clean victims, so queueing never waits on a write-back
+int bcache_prefetch(uint8_t drive, uint32_t lba) {
+    if (!bcache_ready && bcache_init() != 0) {
+        return -1;
+    }
+    uint32_t flags = spin_lock_irqsave(&bcache_lock);
+    if (bcache_lookup(drive, lba)) {
+        spin_unlock_irqrestore(&bcache_lock, flags);
+        return 0;
+    }
+    bcache_buf_t* buf = bcache_victim(false);
+    if (!buf) {
+        spin_unlock_irqrestore(&bcache_lock, flags);
+        return -1;
+    }
+    if (buf->valid) {
+        bcache_unhash(buf);
+        bcache_stats.evictions++;
+    }
+    bcache_assign(buf, drive, lba);
+    bcache_stats.readaheads++;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+
+    blk_request_t* req = &buf->request;
+    req->drive = drive;
+    req->write = false;
+    req->flags = 0;
+    req->lba = lba;
+    req->count = BCACHE_BLOCK_SECTORS;
+    req->buffer = buf->data;
+    req->done = bcache_prefetch_done;
+    req->private_data = buf;
+    blk_submit(req);
+    return 0;
+}
+
+bool bcache_cached(uint8_t drive, uint32_t lba) {
+    if (!bcache_ready) {
+        return false;
+    }
+    uint32_t flags = spin_lock_irqsave(&bcache_lock);
+    bool cached = bcache_lookup(drive, lba) != NULL;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+    return cached;
+}
+
+bcache_buf_t* bcache_buffer_of(const void* data) {
+    const uint8_t* p = (const uint8_t*)data;
+    if (!pool || p < pool || p >= pool + BCACHE_BUFFERS * BCACHE_BLOCK_SIZE) {
+        return NULL;
+    }
+    uint32_t index = (uint32_t)(p - pool) / BCACHE_BLOCK_SIZE;
+    return buffers[index].data == p ? &buffers[index] : NULL;
+}
+
+// One pass over the dirty blocks of drive (0xFF: all) dirty for at least
+// min_age ticks. Dirty bits are cleared before the writes are queued, so a
+// block touched during its write stays dirty for the next pass. All the
+// writes go into the queue together for the elevator to merge. Sets *busy
+// if a matching block was skipped because it is already being written.
+static int bcache_flush(uint8_t drive, uint32_t min_age, bool* busy) {
+    bcache_buf_t* pending[BCACHE_BUFFERS];
+    uint32_t count = 0;
+    uint32_t now = timer_get_ticks();
+    *busy = false;
+    uint32_t flags = spin_lock_irqsave(&bcache_lock);
+    for (uint32_t i = 0; i < BCACHE_BUFFERS; i++) {
+        bcache_buf_t* buf = &buffers[i];
+        if (!buf->valid || !buf->dirty || (drive != 0xFF && buf->drive != drive) ||
+            now - buf->dirty_since < min_age) {
+            continue;
+        }
+        if (buf->writing) {
+            *busy = true;
+            continue;
+        }
+        buf->dirty = false;
+        buf->writing = true;
+        buf->refcount++;
+        pending[count++] = buf;
+    }
+    spin_unlock_irqrestore(&bcache_lock, flags);
+    if (count == 0) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        blk_request_t* req = &pending[i]->request;
+        req->drive = pending[i]->drive;
+        req->write = true;
+        req->flags = 0;
+        req->lba = pending[i]->lba;
+        req->count = BCACHE_BLOCK_SECTORS;
+        req->buffer = pending[i]->data;
+        req->done = NULL;
+        blk_submit(req);
+    }
+    blk_sync();
+
+    int result = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        flags = spin_lock_irqsave(&bcache_lock);
+        pending[i]->writing = false;
+        spin_unlock_irqrestore(&bcache_lock, flags);
+        if (!pending[i]->request.result) {
+            bcache_mark_dirty(pending[i]);
+            result = -1;
+        }
+        bcache_release(pending[i]);
+    }
+    flags = spin_lock_irqsave(&bcache_lock);
+    bcache_stats.writebacks += count;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+    return result;
+}
+
+// Everything dirty, including blocks another writer had in flight
+int bcache_sync(uint8_t drive) {
+    if (!bcache_ready) {
+        return 0;
+    }
+    bool busy;
+    int result = bcache_flush(drive, 0, &busy);
+    while (busy) {
+        process_yield();
+        if (bcache_flush(drive, 0, &busy) != 0) {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+static uint32_t bcache_dirty_count(void) {
+    uint32_t dirty = 0;
+    uint32_t flags = spin_lock_irqsave(&bcache_lock);
+    for (uint32_t i = 0; i < BCACHE_BUFFERS; i++) {
+        dirty += buffers[i].valid && buffers[i].dirty;
+    }
+    spin_unlock_irqrestore(&bcache_lock, flags);
+    return dirty;
+}
+
+// Wakes every BCACHE_FLUSH_INTERVAL_MS: blocks past BCACHE_DIRTY_AGE_MS go
+// out, or every dirty block once they fill more than BCACHE_DIRTY_HIGH
+// buffers, so eviction rarely has to write back in the reader's path
+static void bcache_flusher_main(void) {
+    uint32_t age = (BCACHE_DIRTY_AGE_MS * TIMER_FREQUENCY + 999) / 1000;
+    while (1) {
+        timer_sleep(BCACHE_FLUSH_INTERVAL_MS);
+        bool busy;
+        uint32_t dirty = bcache_dirty_count();
+        if (dirty > 0) {
+            uint32_t before = bcache_stats.writebacks;
+            bcache_flush(0xFF, dirty > BCACHE_DIRTY_HIGH ? 0 : age, &busy);
+            if (bcache_stats.writebacks != before) {
+                bcache_stats.flusher_runs++;
+            }
+        }
+        void (*hook)(void) = flusher_hook;
+        if (hook) {
+            hook();
+        }
+    }
+}
+
+void bcache_set_flusher_hook(void (*hook)(void)) {
+    flusher_hook = hook;
+}
+
+void bcache_flusher_start(void) {
+    if (!scheduler_preemptive) {
+        return;
+    }
+    if (flusher_pid != INVALID_PID && process_find(flusher_pid)) {
+        return;
+    }
+    flusher_pid = process_create(bcache_flusher_main, "bflush");
+}
+
+void bcache_get_stats(bcache_stats_t* stats) {
+    uint32_t flags = spin_lock_irqsave(&bcache_lock);
+    *stats = bcache_stats;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+}
+
+void bcache_dump_stats(void) {
+    bcache_stats_t stats;
+    bcache_get_stats(&stats);
+    uint32_t cached = 0, dirty = 0, pinned = 0;
+    uint32_t flags = spin_lock_irqsave(&bcache_lock);
+    for (uint32_t i = 0; i < BCACHE_BUFFERS; i++) {
+        cached += buffers[i].valid;
+        dirty += buffers[i].valid && buffers[i].dirty;
+        pinned += buffers[i].refcount > 0;
+    }
+    spin_unlock_irqrestore(&bcache_lock, flags);
+    terminal_printf("Buffer cache: %d/%d blocks (%d dirty, %d pinned)\n",
+                    (int)cached, BCACHE_BUFFERS, (int)dirty, (int)pinned);
+    terminal_printf("  %d hits, %d misses, %d evictions, %d written back, %d read ahead\n",
+                    (int)stats.hits, (int)stats.misses, (int)stats.evictions,
+                    (int)stats.writebacks, (int)stats.readaheads);
+    terminal_printf("  Flusher %s, %d passes wrote blocks\n",
+                    (flusher_pid != INVALID_PID && process_find(flusher_pid)) ? "running" : "not started",
+                    (int)stats.flusher_runs);
+}
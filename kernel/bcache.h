@@ -0,0 +1,79 @@
+// ClaudeOS Buffer Cache - Day 21
+// Disk blocks kept in memory by (drive, LBA), written back when dirty
+
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include "types.h"
+#include "block.h"
+
+#define BCACHE_BLOCK_SIZE       4096        // SimpleFS block: 8 sectors
+#define BCACHE_BLOCK_SECTORS    (BCACHE_BLOCK_SIZE / BLK_SECTOR_SIZE)
+#define BCACHE_BUFFERS          64          // 256KB of cached blocks
+#define BCACHE_HASH_BITS        6
+#define BCACHE_HASH_BUCKETS     (1 << BCACHE_HASH_BITS)
+#define BCACHE_DIRTY_AGE_MS     5000        // Flusher writes blocks dirty this long
+#define BCACHE_FLUSH_INTERVAL_MS 1000
+#define BCACHE_DIRTY_HIGH       (BCACHE_BUFFERS / 2)   // Past this, flush regardless of age
+
+typedef struct bcache_buf {
+    uint8_t drive;
+    uint32_t lba;                       // First sector of the block
+    uint8_t* data;                      // BCACHE_BLOCK_SIZE bytes
+    uint32_t refcount;                  // Pinned while above zero
+    bool valid;                         // data holds the block
+    bool dirty;                         // Newer than the disk
+    bool referenced;                    // CLOCK bit: used since the hand last passed
+    bool loading;                       // Being read in; others wait
+    bool writing;                       // request is carrying a write-back
+    bool checked;                       // The file system has verified data since it was read
+    uint32_t dirty_since;               // Tick it went dirty
+    struct bcache_buf* hash_next;
+    blk_request_t request;              // Reads and write-back go through the block layer
+} bcache_buf_t;
+
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t writebacks;                // Dirty blocks written, on eviction or sync
+    uint32_t readaheads;                // Blocks queued by bcache_prefetch
+    uint32_t flusher_runs;              // Flusher passes that wrote something
+} bcache_stats_t;
+
+int bcache_init(void);
+
+// Start the flusher process (init and the first dirtying try); without a
+// preemptive scheduler dirty blocks wait for bcache_sync or eviction
+void bcache_flusher_start(void);
+
+// Run hook from the flusher on every pass, after any write-back: for
+// background work of the file system above (one hook; NULL removes it)
+void bcache_set_flusher_hook(void (*hook)(void));
+
+// Pin the block at lba, reading it in on a miss; NULL on an I/O error or
+// when every buffer is pinned. Each get needs one release.
+bcache_buf_t* bcache_get(uint8_t drive, uint32_t lba);
+void bcache_mark_dirty(bcache_buf_t* buf);
+void bcache_release(bcache_buf_t* buf);
+
+// Queue a read of the block without waiting, if it isn't cached and a
+// clean buffer is free; call blk_unplug once the batch is queued.
+// Returns 0 when the block is cached or on its way, -1 otherwise.
+int bcache_prefetch(uint8_t drive, uint32_t lba);
+
+// Whether the block is cached or being read in; no pin, so only a hint
+// for callers choosing to bypass the cache
+bool bcache_cached(uint8_t drive, uint32_t lba);
+
+// Buffer whose data starts at data (NULL if it isn't the cache's)
+bcache_buf_t* bcache_buffer_of(const void* data);
+
+// Write back every dirty block of drive (all drives if drive is 0xFF);
+// returns 0, or -1 if any write failed
+int bcache_sync(uint8_t drive);
+
+void bcache_get_stats(bcache_stats_t* stats);
+void bcache_dump_stats(void);
+
+#endif // BCACHE_H
@@ -0,0 +1,464 @@
+// ClaudeOS Microbenchmarks Implementation - Day 21
+// Each benchmark is a setup that may decline to run (the subsystem isn't
+// initialised yet), one timed iteration, and a teardown. Samples are kept
+// as 32-bit cycle counts; anything longer is clamped.
+
+#include "bench.h"
+#include "kernel.h"
+#include "timer.h"
+#include "string.h"
+#include "lock.h"
+#include "pmm.h"
+#include "heap.h"
+#include "process.h"
+#include "gdt.h"
+#include "syscall.h"
+#include "ipc.h"
+#include "vfs.h"
+#include "ipv4.h"
+#include "crc32c.h"
+#include "serial.h"
+#include "initcall.h"
+
+typedef struct {
+    const char* name;
+    const char* what;                   // One iteration
+    const char* (*setup)(uint32_t arg); // NULL when ready, else why not
+    void (*run)(uint32_t arg);
+    void (*teardown)(uint32_t arg);
+    uint32_t arg;
+    uint32_t iterations;                // 0: BENCH_ITERATIONS
+} bench_t;
+
+static uint32_t bench_samples[BENCH_MAX_SAMPLES];
+
+// pmm: one frame out and back
+
+static void bench_pmm_run(uint32_t arg) {
+    (void)arg;
+    uint32_t page = pmm_alloc_page();
+    if (page) {
+        pmm_free_page(page);
+    }
+}
+
+// kmalloc: one block of arg bytes out and back
+
+static const char* bench_heap_setup(uint32_t arg) {
+    (void)arg;
+    return heap_initialized ? NULL : "heap not initialized (heap init)";
+}
+
+static void bench_kmalloc_run(uint32_t arg) {
+    void* block = kmalloc(arg);
+    if (block) {
+        kfree(block);
+    }
+}
+
+// vmm: map a frame at a spare page and unmap it again
+
+static uint32_t bench_frame = 0;
+
+static const char* bench_vmm_setup(uint32_t arg) {
+    (void)arg;
+    if (!kernel_page_directory) {
+        return "no kernel page directory (vmm init)";
+    }
+    bench_frame = pmm_alloc_page();
+    return bench_frame ? NULL : "out of frames";
+}
+
+static void bench_vmm_run(uint32_t arg) {
+    (void)arg;
+    vmm_map_page(kernel_page_directory, BENCH_MAP_VIRT, bench_frame, PAGE_PRESENT | PAGE_WRITABLE);
+    vmm_unmap_page(kernel_page_directory, BENCH_MAP_VIRT);
+}
+
+static void bench_vmm_teardown(uint32_t arg) {
+    (void)arg;
+    pmm_free_page(bench_frame);
+    bench_frame = 0;
+}
+
+// Context switch: to a partner context on its own stack and straight back
+// (two switch_contexts), with interrupts off so no tick lands in between
+
+static cpu_context_t bench_main_context;
+static cpu_context_t bench_partner_context;
+static uint8_t bench_partner_stack[4096] __attribute__((aligned(16)));
+
+static void bench_partner(void) {
+    for (;;) {
+        switch_context(&bench_partner_context, &bench_main_context);
+    }
+}
+
+static const char* bench_switch_setup(uint32_t arg) {
+    (void)arg;
+    memset(&bench_partner_context, 0, sizeof(bench_partner_context));
+    bench_partner_context.esp = (uint32_t)(bench_partner_stack + sizeof(bench_partner_stack));
+    bench_partner_context.eip = (uint32_t)bench_partner;
+    bench_partner_context.eflags = 0x2;                 // Interrupts off
+    bench_partner_context.ds = KERNEL_DATA_SELECTOR;
+    bench_partner_context.es = KERNEL_DATA_SELECTOR;
+    bench_partner_context.fs = KERNEL_DATA_SELECTOR;
+    bench_partner_context.gs = GDT_KERNEL_PERCPU;
+    bench_partner_context.ss = KERNEL_DATA_SELECTOR;
+    return NULL;
+}
+
+static void bench_switch_run(uint32_t arg) {
+    (void)arg;
+    uint32_t flags = lock_irq_save();
+    switch_context(&bench_main_context, &bench_partner_context);
+    lock_irq_restore(flags);
+}
+
+// Syscall: getpid through int 0x80 and back
+
+static void bench_syscall_run(uint32_t arg) {
+    (void)arg;
+    syscall_getpid();
+}
+
+// IPC: a message to our own mailbox, then receiving it
+
+static int bench_pid = 0;
+
+static const char* bench_ipc_setup(uint32_t arg) {
+    (void)arg;
+    if (initcall_require("ipc") < 0) {
+        return "IPC can't be started";
+    }
+    process_t* self = current_process ? current_process : process_find(KERNEL_PID);
+    if (!self) {
+        return "no kernel process (proc init)";
+    }
+    bench_pid = self->pid;
+    return NULL;
+}
+
+static void bench_ipc_run(uint32_t arg) {
+    char message[64];
+    memset(message, 'm', sizeof(message));
+    if (ipc_send_message(bench_pid, message, arg) >= 0) {
+        ipc_receive_message(bench_pid, message, sizeof(message));
+    }
+}
+
+// fs: open/close, and reads and writes at offset 0 of a scratch file
+
+static int bench_fd = -1;
+static char bench_io[BENCH_IO_SIZE];
+
+static const char* bench_fs_setup(uint32_t arg) {
+    (void)arg;
+    if (!current_process && !process_find(KERNEL_PID)) {
+        return "no process for descriptors (proc init)";
+    }
+    bench_fd = vfs_open(BENCH_FILE, VFS_O_READ | VFS_O_WRITE | VFS_O_CREATE | VFS_O_TRUNCATE);
+    if (bench_fd < 0) {
+        return "can't create " BENCH_FILE;
+    }
+    memset(bench_io, 'f', sizeof(bench_io));
+    if (vfs_pwrite(bench_fd, bench_io, sizeof(bench_io), 0) != (int)sizeof(bench_io)) {
+        vfs_close(bench_fd);
+        vfs_unlink(BENCH_FILE);
+        return "can't write " BENCH_FILE;
+    }
+    return NULL;
+}
+
+static void bench_fs_open_run(uint32_t arg) {
+    (void)arg;
+    int fd = vfs_open(BENCH_FILE, VFS_O_READ);
+    if (fd >= 0) {
+        vfs_close(fd);
+    }
+}
+
+static void bench_fs_read_run(uint32_t arg) {
+    vfs_pread(bench_fd, bench_io, arg, 0);
+}
+
+static void bench_fs_write_run(uint32_t arg) {
+    vfs_pwrite(bench_fd, bench_io, arg, 0);
+}
+
+static void bench_fs_teardown(uint32_t arg) {
+    (void)arg;
+    vfs_close(bench_fd);
+    vfs_unlink(BENCH_FILE);
+    bench_fd = -1;
+}
+
+// Console: one 40-column line, flushed to the screen by its newline
+
+static void bench_console_run(uint32_t arg) {
+    (void)arg;
+    terminal_writestring("benchmark: console output line .........\n");
+}
+
+static const bench_t benches[] = {
+    { "pmm",        "alloc+free a frame",       NULL,               bench_pmm_run,      NULL,               0,    1024 },
+    { "kmalloc16",  "kmalloc+kfree 16 bytes",   bench_heap_setup,   bench_kmalloc_run,  NULL,               16,   1024 },
+    { "kmalloc64",  "kmalloc+kfree 64 bytes",   bench_heap_setup,   bench_kmalloc_run,  NULL,               64,   1024 },
+    { "kmalloc256", "kmalloc+kfree 256 bytes",  bench_heap_setup,   bench_kmalloc_run,  NULL,               256,  1024 },
+    { "kmalloc1k",  "kmalloc+kfree 1KB",        bench_heap_setup,   bench_kmalloc_run,  NULL,               1024, 1024 },
+    { "kmalloc4k",  "kmalloc+kfree 4KB",        bench_heap_setup,   bench_kmalloc_run,  NULL,               4096, 256 },
+    { "vmm",        "map+unmap a page",         bench_vmm_setup,    bench_vmm_run,      bench_vmm_teardown, 0,    1024 },
+    { "switch",     "context switch there+back", bench_switch_setup, bench_switch_run,  NULL,               0,    1024 },
+    { "syscall",    "getpid via int 0x80",      NULL,               bench_syscall_run,  NULL,               0,    1024 },
+    { "ipc",        "send+receive 64 bytes",    bench_ipc_setup,    bench_ipc_run,      NULL,               64,   256 },
+    { "fsopen",     "open+close",               bench_fs_setup,     bench_fs_open_run,  bench_fs_teardown,  0,    256 },
+    { "fsread",     "pread 512 bytes",          bench_fs_setup,     bench_fs_read_run,  bench_fs_teardown,  BENCH_IO_SIZE, 256 },
+    { "fswrite",    "pwrite 512 bytes",         bench_fs_setup,     bench_fs_write_run, bench_fs_teardown,  BENCH_IO_SIZE, 256 },
+    { "console",    "print one line",           NULL,               bench_console_run,  NULL,               0,    64 },
+};
+
+#define BENCH_COUNT (sizeof(benches) / sizeof(benches[0]))
+
+static uint32_t bench_cycles_since(uint64_t start) {
+    uint64_t cycles = clock_cycles() - start;
+    return cycles > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)cycles;
+}
+
+// Cheapest back-to-back pair of timer reads
+static uint32_t bench_overhead(void) {
+    uint32_t best = 0xFFFFFFFF;
+    for (int i = 0; i < 64; i++) {
+        uint64_t start = clock_cycles();
+        uint32_t cycles = bench_cycles_since(start);
+        if (cycles < best) {
+            best = cycles;
+        }
+    }
+    return best;
+}
+
+static void bench_sort(uint32_t* samples, uint32_t count) {
+    for (uint32_t i = 1; i < count; i++) {
+        uint32_t value = samples[i];
+        uint32_t j = i;
+        while (j > 0 && samples[j - 1] > value) {
+            samples[j] = samples[j - 1];
+            j--;
+        }
+        samples[j] = value;
+    }
+}
+
+static uint32_t bench_to_ns(uint32_t cycles) {
+    uint32_t mult;
+    uint64_t base;
+    clock_tsc_params(&mult, &base);
+    uint64_t ns = ((uint64_t)cycles * mult) >> CLOCK_NS_SHIFT;
+    return ns > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)ns;
+}
+
+// Results are printed once every sample is in, so that console output
+// (the console bench's own lines aside) stays out of the timed loop
+typedef struct {
+    const bench_t* bench;
+    const char* skipped;                // Why it didn't run, or NULL
+    uint32_t count;
+    uint32_t min, median, p99;
+} bench_result_t;
+
+static void bench_run(const bench_t* bench, uint32_t iterations, uint32_t overhead,
+                      bench_result_t* result) {
+    result->bench = bench;
+    result->count = 0;
+    result->skipped = bench->setup ? bench->setup(bench->arg) : NULL;
+    if (result->skipped) {
+        return;
+    }
+    for (uint32_t i = 0; i < BENCH_WARMUP; i++) {
+        bench->run(bench->arg);
+    }
+    for (uint32_t i = 0; i < iterations; i++) {
+        uint64_t start = clock_cycles();
+        bench->run(bench->arg);
+        uint32_t cycles = bench_cycles_since(start);
+        bench_samples[i] = cycles > overhead ? cycles - overhead : 0;
+    }
+    if (bench->teardown) {
+        bench->teardown(bench->arg);
+    }
+    
+    bench_sort(bench_samples, iterations);
+    result->count = iterations;
+    result->min = bench_samples[0];
+    result->median = bench_samples[iterations / 2];
+    result->p99 = bench_samples[(iterations * 99) / 100];
+}
+
+static void bench_print(const bench_result_t* result) {
+    const bench_t* bench = result->bench;
+    if (result->skipped) {
+        terminal_printf("  %s: skipped - %s\n", bench->name, result->skipped);
+        return;
+    }
+    terminal_printf("  %s: %d x %s\n", bench->name, (int)result->count, bench->what);
+    terminal_printf("      min %d  median %d  p99 %d cycles  (median %d ns)\n", (int)result->min,
+                    (int)result->median, (int)result->p99, (int)bench_to_ns(result->median));
+}
+
+// {"bench":"pmm","what":"...","iterations":1024,"min":..,"median":..,"p99":..,"median_ns":..}
+// or {"bench":"vmm","skipped":"..."}; names and reasons never need escaping
+static void bench_json_string(char* line, const char* key, const char* value, bool first) {
+    strcat(line, first ? "{\"" : ",\"");
+    strcat(line, key);
+    strcat(line, "\":\"");
+    strcat(line, value);
+    strcat(line, "\"");
+}
+
+static void bench_json_number(char* line, const char* key, uint32_t value) {
+    char num[12];
+    strcat(line, ",\"");
+    strcat(line, key);
+    strcat(line, "\":");
+    strcat(line, itoa((int)value, num, 10));
+}
+
+static void bench_json(const bench_result_t* result) {
+    char line[256];
+    line[0] = '\0';
+    bench_json_string(line, "bench", result->bench->name, true);
+    if (result->skipped) {
+        bench_json_string(line, "skipped", result->skipped, false);
+    } else {
+        bench_json_string(line, "what", result->bench->what, false);
+        bench_json_number(line, "iterations", result->count);
+        bench_json_number(line, "min", result->min);
+        bench_json_number(line, "median", result->median);
+        bench_json_number(line, "p99", result->p99);
+        bench_json_number(line, "median_ns", bench_to_ns(result->median));
+    }
+    strcat(line, "}\n");
+    serial_write_string(SERIAL_COM1_BASE, line);
+}
+
+// 64-bit total over a 32-bit count, saturating, without libgcc's division
+static uint32_t bench_per_round(uint64_t total, uint32_t rounds) {
+    uint32_t high = (uint32_t)(total >> 32);
+    if (high >= rounds) {
+        return 0xFFFFFFFF;
+    }
+    uint32_t quotient, remainder;
+    asm ("divl %4" : "=a" (quotient), "=d" (remainder)
+         : "a" ((uint32_t)total), "d" (high), "rm" (rounds));
+    (void)remainder;
+    return quotient;
+}
+
+// pingpong: a token bounced between two tasks, once per way of handing it
+// over; one total per kind rather than per-iteration samples, since each
+// round is two context switches rather than something the loop can time
+static void bench_pingpong(uint32_t rounds) {
+    static const char* const kinds[] = { "yield", "semaphore", "message", "rpc" };
+    terminal_printf("Ping-pong round trips (%d each, TSC %d kHz)\n", (int)rounds,
+                    (int)clock_tsc_khz());
+    for (int mode = PINGPONG_YIELD; mode <= PINGPONG_RPC; mode++) {
+        uint64_t cycles = 0;
+        const char* skipped = test_pingpong(mode, rounds, &cycles);
+        if (skipped) {
+            terminal_printf("  %s: skipped - %s\n", kinds[mode], skipped);
+            continue;
+        }
+        uint32_t per_round = bench_per_round(cycles, rounds);
+        terminal_printf("  %s: %d cycles per round trip (%d ns)\n", kinds[mode],
+                        (int)per_round, (int)bench_to_ns(per_round));
+    }
+}
+
+static const bench_t* bench_find(const char* name) {
+    for (uint32_t i = 0; i < BENCH_COUNT; i++) {
+        if (strcmp(benches[i].name, name) == 0) {
+            return &benches[i];
+        }
+    }
+    return NULL;
+}
+
+void bench_command(int argc, char argv[][64]) {
+    if (argc >= 2 && strcmp(argv[1], "list") == 0) {
+        terminal_writestring("Benchmarks (benchmark [<name>...] [-n <iterations>] [--json]):\n");
+        for (uint32_t i = 0; i < BENCH_COUNT; i++) {
+            terminal_printf("  %s - %s\n", benches[i].name, benches[i].what);
+        }
+        terminal_writestring("  checksum - Internet checksum and CRC32C throughput (its own report)\n");
+        terminal_printf("  pingpong - yield/semaphore/message/rpc round trips, %d by default (its own report)\n",
+                        BENCH_PINGPONG_ROUNDS);
+        return;
+    }
+    if (!clock_tsc_khz()) {
+        terminal_writestring("benchmark: no invariant TSC to time with\n");
+        return;
+    }
+    
+    // Pick the benchmarks; none named runs them all
+    const bench_t* chosen[BENCH_COUNT];
+    uint32_t count = 0;
+    uint32_t iterations = 0;
+    int rounds = 0;                     // -n as given: pingpong isn't held to the sample buffer
+    bool checksum = false;
+    bool pingpong = false;
+    bool json = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            int n = atoi(argv[++i]);
+            rounds = n < 1 ? 1 : n;
+            iterations = n < 1 ? 1 : (n > BENCH_MAX_SAMPLES ? BENCH_MAX_SAMPLES : (uint32_t)n);
+        } else if (strcmp(argv[i], "checksum") == 0) {
+            checksum = true;
+        } else if (strcmp(argv[i], "pingpong") == 0) {
+            pingpong = true;
+        } else {
+            const bench_t* bench = bench_find(argv[i]);
+            if (!bench) {
+                terminal_printf("benchmark: no benchmark '%s' (benchmark list)\n", argv[i]);
+                return;
+            }
+            if (count < BENCH_COUNT) {
+                chosen[count++] = bench;
+            }
+        }
+    }
+    if (count == 0 && !checksum && !pingpong) {
+        for (uint32_t i = 0; i < BENCH_COUNT; i++) {
+            chosen[count++] = &benches[i];
+        }
+    }
+    
+    static bench_result_t results[BENCH_COUNT];
+    uint32_t overhead = bench_overhead();
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t n = iterations ? iterations : chosen[i]->iterations;
+        bench_run(chosen[i], n ? n : BENCH_ITERATIONS, overhead, &results[i]);
+    }
+    
+    if (count && json) {
+        for (uint32_t i = 0; i < count; i++) {
+            bench_json(&results[i]);
+        }
+        terminal_printf("%d benchmark results written to COM1 as JSON lines\n", (int)count);
+    } else if (count) {
+        terminal_printf("Microbenchmarks (%d warmup runs each; timer overhead %d cycles removed, TSC %d kHz)\n",
+                        BENCH_WARMUP, (int)overhead, (int)clock_tsc_khz());
+        for (uint32_t i = 0; i < count; i++) {
+            bench_print(&results[i]);
+        }
+    }
+    if (checksum) {
+        ipv4_checksum_benchmark();
+        crc32c_benchmark();
+    }
+    if (pingpong) {
+        bench_pingpong(rounds ? (uint32_t)rounds : BENCH_PINGPONG_ROUNDS);
+    }
+}
@@ -0,0 +1,28 @@
+// ClaudeOS Microbenchmarks - Day 21
+// TSC-timed loops over the kernel's hot paths: after a warmup, every
+// iteration is timed on its own and the run is summarised as min, median
+// and 99th percentile cycles (the timer read's own cost taken off).
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "types.h"
+#include "vmm.h"
+
+#define BENCH_WARMUP        16
+#define BENCH_ITERATIONS    256         // Default per benchmark
+#define BENCH_MAX_SAMPLES   1024
+#define BENCH_MAP_VIRT      (VMM_MMIO_START + VMM_MMIO_SIZE - PAGE_SIZE)   // Last page of the MMIO window
+#define BENCH_FILE          "/bench.tmp"
+#define BENCH_IO_SIZE       512         // Bytes per fs read/write
+#define BENCH_PINGPONG_ROUNDS 100000    // Round trips per ping-pong kind
+
+// Booting with "bench" on the command line runs the suite with --json
+// and then writes here: QEMU's isa-debug-exit, as make bench sets it up
+#define BENCH_QEMU_EXIT_PORT 0xF4
+
+// Shell: benchmark [list | <name>...] [-n <iterations>] [--json]; --json
+// sends one JSON line per benchmark to COM1 instead of the screen
+void bench_command(int argc, char argv[][64]);
+
+#endif // BENCH_H
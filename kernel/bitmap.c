@@ -0,0 +1,144 @@
+// ClaudeOS Bitmap Implementation - Day 21
+
+#include "bitmap.h"
+
+void bitmap_init(bitmap_t* map, uint32_t* words, uint32_t* summary, uint32_t bits, bool set) {
+    map->words = words;
+    map->summary = summary;
+    map->bits = bits;
+    map->word_count = BITMAP_WORDS(bits);
+    for (uint32_t i = 0; i < map->word_count; i++) {
+        words[i] = set ? 0xFFFFFFFF : 0;
+    }
+    if (summary) {
+        uint32_t summary_words = BITMAP_WORDS(map->word_count);
+        for (uint32_t i = 0; i < summary_words; i++) {
+            summary[i] = 0;
+        }
+        if (!set) {
+            for (uint32_t word = 0; word < map->word_count; word++) {
+                summary[word / 32] |= 1u << (word % 32);
+            }
+        }
+    }
+}
+
+// The bits of word that fall in [start, end) (end > the word's first bit)
+static inline uint32_t bitmap_word_mask(uint32_t word, uint32_t start, uint32_t end) {
+    uint32_t base = word * 32;
+    uint32_t lo = start > base ? start - base : 0;
+    uint32_t hi = end - base >= 32 ? 32 : end - base;
+    uint32_t mask = 0xFFFFFFFF << lo;
+    if (hi < 32) {
+        mask &= (1u << hi) - 1;
+    }
+    return mask;
+}
+
+void bitmap_set_range(bitmap_t* map, uint32_t start, uint32_t count) {
+    if (start >= map->bits || count == 0) {
+        return;
+    }
+    uint32_t end = count > map->bits - start ? map->bits : start + count;
+    for (uint32_t word = start / 32; word <= (end - 1) / 32; word++) {
+        map->words[word] |= bitmap_word_mask(word, start, end);
+        if (map->summary && map->words[word] == 0xFFFFFFFF) {
+            map->summary[word / 32] &= ~(1u << (word % 32));
+        }
+    }
+}
+
+void bitmap_clear_range(bitmap_t* map, uint32_t start, uint32_t count) {
+    if (start >= map->bits || count == 0) {
+        return;
+    }
+    uint32_t end = count > map->bits - start ? map->bits : start + count;
+    for (uint32_t word = start / 32; word <= (end - 1) / 32; word++) {
+        map->words[word] &= ~bitmap_word_mask(word, start, end);
+        if (map->summary) {
+            map->summary[word / 32] |= 1u << (word % 32);
+        }
+    }
+}
+
+uint32_t bitmap_find_set_in(const bitmap_t* map, uint32_t from, uint32_t limit) {
+    if (limit > map->bits) {
+        limit = map->bits;
+    }
+    if (from >= limit) {
+        return BITMAP_NONE;
+    }
+    for (uint32_t word = from / 32; word <= (limit - 1) / 32; word++) {
+        uint32_t bits = map->words[word] & bitmap_word_mask(word, from, limit);
+        if (bits) {
+            return word * 32 + bit_ffs(bits);
+        }
+    }
+    return BITMAP_NONE;
+}
+
+uint32_t bitmap_find_set(const bitmap_t* map, uint32_t from) {
+    return bitmap_find_set_in(map, from, map->bits);
+}
+
+// First word at or after word with a clear bit, from the summary
+static uint32_t bitmap_summary_find(const bitmap_t* map, uint32_t word) {
+    uint32_t summary_words = BITMAP_WORDS(map->word_count);
+    uint32_t s = word / 32;
+    if (s >= summary_words) {
+        return BITMAP_NONE;
+    }
+    uint32_t candidates = map->summary[s] & (0xFFFFFFFF << (word % 32));
+    while (!candidates) {
+        if (++s >= summary_words) {
+            return BITMAP_NONE;
+        }
+        candidates = map->summary[s];
+    }
+    word = s * 32 + bit_ffs(candidates);
+    return word < map->word_count ? word : BITMAP_NONE;
+}
+
+uint32_t bitmap_find_clear(const bitmap_t* map, uint32_t from) {
+    if (from >= map->bits) {
+        return BITMAP_NONE;
+    }
+    // The first word only from the bit asked for
+    uint32_t word = from / 32;
+    uint32_t clear = ~map->words[word] & (0xFFFFFFFF << (from % 32));
+    while (!clear) {
+        if (map->summary) {
+            word = bitmap_summary_find(map, word + 1);
+            if (word == BITMAP_NONE) {
+                return BITMAP_NONE;
+            }
+        } else if (++word >= map->word_count) {
+            return BITMAP_NONE;
+        }
+        clear = ~map->words[word];
+    }
+    uint32_t bit = word * 32 + bit_ffs(clear);
+    return bit < map->bits ? bit : BITMAP_NONE;
+}
+
+// Each failed candidate resumes at the first clear bit past the set one
+// that ended it, which the summary finds without walking full words
+uint32_t bitmap_find_clear_run(const bitmap_t* map, uint32_t from, uint32_t count, uint32_t align) {
+    if (count == 0) {
+        return BITMAP_NONE;
+    }
+    uint32_t mask = align > 1 ? align - 1 : 0;
+    uint32_t start = bitmap_find_clear(map, from);
+    while (start != BITMAP_NONE) {
+        start = (start + mask) & ~mask;
+        if (start < from || start >= map->bits || count > map->bits - start) {
+            return BITMAP_NONE;
+        }
+        uint32_t used = bitmap_find_set_in(map, start, start + count);
+        if (used == BITMAP_NONE) {
+            return start;
+        }
+        start = bitmap_find_clear(map, used + 1);
+    }
+    return BITMAP_NONE;
+}
@@ -0,0 +1,82 @@
+// ClaudeOS Bitmaps - Day 21
+// Bit arrays over 32-bit words. Single words are searched with bsf/bsr,
+// whole words are skipped at a time, and an optional summary level (one
+// bit per word, set while that word still has a clear bit) lets
+// bitmap_find_clear jump straight to a word with room in it, so a large
+// and mostly full map costs a few summary words rather than a scan.
+// Allocators keep "1 = in use"; the summary serves exactly that. A map
+// does no locking of its own.
+
+#ifndef BITMAP_H
+#define BITMAP_H
+
+#include "types.h"
+
+#define BITMAP_NONE                 0xFFFFFFFF
+#define BITMAP_WORDS(bits)          (((bits) + 31) / 32)
+#define BITMAP_SUMMARY_WORDS(bits)  BITMAP_WORDS(BITMAP_WORDS(bits))
+
+// Lowest and highest set bit of a non-zero word
+static inline uint32_t bit_ffs(uint32_t value) {
+    uint32_t index;
+    asm ("bsf %1, %0" : "=r" (index) : "rm" (value) : "cc");
+    return index;
+}
+
+static inline uint32_t bit_fls(uint32_t value) {
+    uint32_t index;
+    asm ("bsr %1, %0" : "=r" (index) : "rm" (value) : "cc");
+    return index;
+}
+
+typedef struct {
+    uint32_t* words;
+    uint32_t* summary;                  // BITMAP_SUMMARY_WORDS(bits) words, or NULL
+    uint32_t bits;
+    uint32_t word_count;
+} bitmap_t;
+
+// Lay a map over caller storage, every bit set or clear (tail bits of the
+// last word too)
+void bitmap_init(bitmap_t* map, uint32_t* words, uint32_t* summary, uint32_t bits, bool set);
+
+static inline bool bitmap_test(const bitmap_t* map, uint32_t bit) {
+    return (map->words[bit / 32] >> (bit % 32)) & 1;
+}
+
+static inline void bitmap_set(bitmap_t* map, uint32_t bit) {
+    uint32_t word = bit / 32;
+    map->words[word] |= 1u << (bit % 32);
+    if (map->summary && map->words[word] == 0xFFFFFFFF) {
+        map->summary[word / 32] &= ~(1u << (word % 32));
+    }
+}
+
+static inline void bitmap_clear(bitmap_t* map, uint32_t bit) {
+    uint32_t word = bit / 32;
+    map->words[word] &= ~(1u << (bit % 32));
+    if (map->summary) {
+        map->summary[word / 32] |= 1u << (word % 32);
+    }
+}
+
+void bitmap_set_range(bitmap_t* map, uint32_t start, uint32_t count);
+void bitmap_clear_range(bitmap_t* map, uint32_t start, uint32_t count);
+
+// First set / clear bit at or after from, or BITMAP_NONE
+uint32_t bitmap_find_set(const bitmap_t* map, uint32_t from);
+uint32_t bitmap_find_clear(const bitmap_t* map, uint32_t from);
+
+// First set bit in [from, limit), or BITMAP_NONE
+uint32_t bitmap_find_set_in(const bitmap_t* map, uint32_t from, uint32_t limit);
+
+// Start of the first run of count clear bits at or after from that starts
+// on a multiple of align (a power of two; 0 or 1: any), or BITMAP_NONE
+uint32_t bitmap_find_clear_run(const bitmap_t* map, uint32_t from, uint32_t count, uint32_t align);
+
+// Every bit of [start, start + count) is clear
+static inline bool bitmap_range_clear(const bitmap_t* map, uint32_t start, uint32_t count) {
+    return bitmap_find_set_in(map, start, start + count) == BITMAP_NONE;
+}
+
+#endif // BITMAP_H
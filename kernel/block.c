@@ -0,0 +1,427 @@
+// ClaudeOS Block Layer Implementation - Day 21
+// Requests wait in a (drive, lba)-sorted queue. The dispatcher sweeps it in
+// one direction (C-LOOK), coalesces runs of adjacent requests into a single
+// driver call and serves anything past its deadline out of turn. Queued
+// drivers (AHCI, virtio-blk) get commands until their depth is reached and finish them
+// through blk_complete; everything else is an ATA call made in place.
+// Flags don't order anything by themselves: a caller that needs a write
+// behind others waits for those, then sends it with a preflush, so the
+// rest of the queue stays write-cached and reorderable.
+
+#include "block.h"
+#include "kernel.h"
+#include "lock.h"
+#include "heap.h"
+#include "string.h"
+#include "timer.h"
+#include "process.h"
+#include "softirq.h"
+#include "../drivers/ata.h"
+
+// A queued command's starts, lowest first
+#define BLK_STEP_PREFLUSH       (1 << 0)
+#define BLK_STEP_DATA           (1 << 1)
+#define BLK_STEP_POSTFLUSH      (1 << 2)
+#define BLK_STEP_FLUSHES        (BLK_STEP_PREFLUSH | BLK_STEP_POSTFLUSH)
+
+static spinlock_t blk_lock;             // Unregistered; guards the queue and counters
+static blk_request_t* sort_head;
+static blk_request_t* fifo_head;
+static blk_request_t* fifo_tail;
+static volatile uint32_t queued;
+static volatile uint32_t in_flight;     // Requests taken off the queue, not yet completed
+static uint8_t head_drive;              // Where the last command ended
+static uint32_t head_lba;
+static uint8_t* bounce;                 // For merges whose buffers aren't back to back
+static work_t blk_work;
+static blk_stats_t blk_stats;
+static bool blk_ready = false;
+static const blk_driver_t* blk_drivers[BLK_MAX_DRIVES];
+static uint32_t blk_active[BLK_MAX_DRIVES];   // Commands a queued driver holds
+static bool blk_alone[BLK_MAX_DRIVES];         // A flushing command has it to itself
+static blk_command_t blk_commands[BLK_MAX_COMMANDS];
+static blk_command_t* free_commands;
+static blk_command_t* completed_commands;
+
+static void blk_dispatch_work(void* arg);
+
+int blk_init(void) {
+    if (blk_ready) {
+        return 0;
+    }
+    bounce = kmalloc(BLK_MAX_MERGE_SECTORS * BLK_SECTOR_SIZE);
+    if (!bounce) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < BLK_MAX_COMMANDS; i++) {
+        blk_commands[i].next = free_commands;
+        free_commands = &blk_commands[i];
+    }
+    work_init(&blk_work, blk_dispatch_work, NULL);
+    blk_ready = true;
+    return 0;
+}
+
+int blk_register_driver(uint8_t drive, const blk_driver_t* driver) {
+    if (drive >= BLK_MAX_DRIVES || !driver || driver->queue_depth == 0) {
+        return -1;
+    }
+    if (!blk_ready && blk_init() != 0) {
+        return -1;
+    }
+    uint32_t flags = spin_lock_irqsave(&blk_lock);
+    blk_drivers[drive] = driver;
+    spin_unlock_irqrestore(&blk_lock, flags);
+    return 0;
+}
+
+static const blk_driver_t* blk_driver(uint8_t drive) {
+    return drive < BLK_MAX_DRIVES ? blk_drivers[drive] : NULL;
+}
+
+// Starts a command led by first needs from a queued driver
+static uint8_t blk_steps(const blk_driver_t* driver, const blk_request_t* first, uint32_t total) {
+    uint8_t steps = total > 0 ? BLK_STEP_DATA : 0;
+    if (first->flags & BLK_REQ_PREFLUSH) {
+        steps |= BLK_STEP_PREFLUSH;
+    }
+    if (first->write && total > 0 && (first->flags & BLK_REQ_FUA) && !driver->fua) {
+        steps |= BLK_STEP_POSTFLUSH;
+    }
+    return steps;
+}
+
+// Whether a command led by req can go out now (blk_lock held). One that
+// flushes on a flush_alone drive waits for the drive to empty, and
+// nothing joins it there.
+static bool blk_can_start(blk_request_t* req) {
+    const blk_driver_t* driver = blk_driver(req->drive);
+    if (!driver) {
+        return true;
+    }
+    if (blk_alone[req->drive]) {
+        return false;
+    }
+    if (driver->flush_alone && (blk_steps(driver, req, req->count) & BLK_STEP_FLUSHES)) {
+        return blk_active[req->drive] == 0 && free_commands;
+    }
+    return blk_active[req->drive] < driver->queue_depth && free_commands;
+}
+
+static uint32_t blk_ms_to_ticks(uint32_t ms) {
+    return (ms * TIMER_FREQUENCY + 999) / 1000;
+}
+
+// Sort order: drive, then LBA
+static bool blk_before(blk_request_t* a, blk_request_t* b) {
+    return a->drive < b->drive || (a->drive == b->drive && a->lba <= b->lba);
+}
+
+void blk_submit(blk_request_t* req) {
+    req->result = 0;
+    req->completed = false;
+    if (req->count == 0) {
+        req->flags |= BLK_REQ_PREFLUSH;
+    }
+    if (!blk_ready && blk_init() != 0) {
+        req->completed = true;
+        if (req->done) {
+            req->done(req);
+        }
+        return;
+    }
+    req->deadline = timer_get_ticks() +
+                    blk_ms_to_ticks(req->write ? BLK_WRITE_DEADLINE_MS : BLK_READ_DEADLINE_MS);
+    req->fifo_next = NULL;
+
+    uint32_t flags = spin_lock_irqsave(&blk_lock);
+    // Equal keys keep their arrival order
+    blk_request_t** link = &sort_head;
+    while (*link && blk_before(*link, req)) {
+        link = &(*link)->sort_next;
+    }
+    req->sort_next = *link;
+    *link = req;
+    if (fifo_tail) {
+        fifo_tail->fifo_next = req;
+    } else {
+        fifo_head = req;
+    }
+    fifo_tail = req;
+    queued++;
+    blk_stats.submitted++;
+    spin_unlock_irqrestore(&blk_lock, flags);
+}
+
+// Take req off both lists (blk_lock held)
+static void blk_unlink(blk_request_t* req) {
+    blk_request_t** link = &sort_head;
+    while (*link != req) {
+        link = &(*link)->sort_next;
+    }
+    *link = req->sort_next;
+
+    blk_request_t* prev = NULL;
+    link = &fifo_head;
+    while (*link != req) {
+        prev = *link;
+        link = &(*link)->fifo_next;
+    }
+    *link = req->fifo_next;
+    if (fifo_tail == req) {
+        fifo_tail = prev;
+    }
+    req->fifo_next = NULL;
+    queued--;
+}
+
+// Request the next command starts with (blk_lock held, queue not empty);
+// NULL when every drive with work queued is at its depth
+static blk_request_t* blk_pick(void) {
+    if ((int32_t)(timer_get_ticks() - fifo_head->deadline) >= 0 && blk_can_start(fifo_head)) {
+        blk_stats.deadline_picks++;
+        return fifo_head;
+    }
+    // The first at or past the head, else wrap around to the lowest
+    blk_request_t* wrap = NULL;
+    for (blk_request_t* req = sort_head; req; req = req->sort_next) {
+        if (!blk_can_start(req)) {
+            continue;
+        }
+        if (req->drive > head_drive || (req->drive == head_drive && req->lba >= head_lba)) {
+            return req;
+        }
+        if (!wrap) {
+            wrap = req;
+        }
+    }
+    return wrap;
+}
+
+// Report a finished run of requests. A completed request may be freed by
+// its owner at once.
+static void blk_finish(blk_request_t* first, int result) {
+    blk_request_t* req = first;
+    while (req) {
+        blk_request_t* following = req->fifo_next;
+        req->result = result;
+        req->completed = true;
+        if (req->done) {
+            req->done(req);
+        }
+        uint32_t flags = spin_lock_irqsave(&blk_lock);
+        in_flight--;
+        spin_unlock_irqrestore(&blk_lock, flags);
+        req = following;
+    }
+}
+
+void blk_complete(blk_command_t* cmd, int result) {
+    cmd->result = result;
+    uint32_t flags = spin_lock_irqsave(&blk_lock);
+    cmd->next = completed_commands;
+    completed_commands = cmd;
+    spin_unlock_irqrestore(&blk_lock, flags);
+    work_schedule(&blk_work);
+}
+
+// Give cmd's next step to its driver; nonzero if the driver refused it
+static int blk_start_step(const blk_driver_t* driver, blk_command_t* cmd) {
+    uint8_t step = cmd->steps & (uint8_t)-cmd->steps;
+    cmd->steps &= (uint8_t)~step;
+    cmd->result = 0;
+    if (step == BLK_STEP_DATA) {
+        bool fua = cmd->write && (cmd->requests->flags & BLK_REQ_FUA) && driver->fua;
+        cmd->flags = fua ? BLK_CMD_FUA : 0;
+    } else {
+        cmd->flags = BLK_CMD_FLUSH;
+        uint32_t flags = spin_lock_irqsave(&blk_lock);
+        blk_stats.flushes++;
+        spin_unlock_irqrestore(&blk_lock, flags);
+    }
+    return driver->start(cmd);
+}
+
+// Finish what the queued drivers completed, freeing their slots. A
+// command with steps left goes straight back to its driver instead.
+static void blk_reap(void) {
+    uint32_t flags = spin_lock_irqsave(&blk_lock);
+    blk_command_t* cmd = completed_commands;
+    completed_commands = NULL;
+    spin_unlock_irqrestore(&blk_lock, flags);
+    while (cmd) {
+        blk_command_t* next = cmd->next;
+        if (cmd->result && cmd->steps && blk_start_step(blk_driver(cmd->drive), cmd) == 0) {
+            cmd = next;
+            continue;
+        }
+        blk_finish(cmd->requests, cmd->result);
+        flags = spin_lock_irqsave(&blk_lock);
+        blk_active[cmd->drive]--;
+        blk_alone[cmd->drive] = false;          // Nothing else was out beside it
+        cmd->next = free_commands;
+        free_commands = cmd;
+        spin_unlock_irqrestore(&blk_lock, flags);
+        cmd = next;
+    }
+}
+
+// Drain the queue one merged command at a time, until it is empty or the
+// drives it waits on are full (their completions schedule this again)
+static void blk_dispatch_work(void* arg) {
+    (void)arg;
+    while (1) {
+        blk_reap();
+        uint32_t flags = spin_lock_irqsave(&blk_lock);
+        blk_request_t* first = queued > 0 ? blk_pick() : NULL;
+        if (!first) {
+            spin_unlock_irqrestore(&blk_lock, flags);
+            return;
+        }
+        const blk_driver_t* driver = blk_driver(first->drive);
+        blk_request_t* next = first->sort_next;
+        blk_unlink(first);
+
+        // Pull in what follows in sort order while it continues the run
+        uint32_t total = first->count;
+        uint32_t segments = 1;
+        bool contiguous = true;
+        blk_request_t* last = first;
+        while (next && next->drive == first->drive && next->write == first->write &&
+               next->flags == first->flags && next->lba == first->lba + total &&
+               total + next->count <= BLK_MAX_MERGE_SECTORS &&
+               (!driver || segments < BLK_MAX_SEGMENTS)) {
+            blk_request_t* after = next->sort_next;
+            blk_unlink(next);
+            if ((uint8_t*)next->buffer != (uint8_t*)first->buffer + total * BLK_SECTOR_SIZE) {
+                contiguous = false;
+            }
+            last->fifo_next = next;
+            last = next;
+            total += next->count;
+            segments++;
+            blk_stats.merged++;
+            next = after;
+        }
+        for (blk_request_t* req = first; req; req = req->fifo_next) {
+            in_flight++;
+        }
+        head_drive = first->drive;
+        head_lba = first->lba + total;
+        blk_stats.commands++;
+        
+        // A queued driver takes the requests' buffers as they are
+        if (driver) {
+            blk_command_t* cmd = free_commands;
+            free_commands = cmd->next;
+            blk_active[first->drive]++;
+            if (blk_active[first->drive] > blk_stats.max_outstanding) {
+                blk_stats.max_outstanding = blk_active[first->drive];
+            }
+            spin_unlock_irqrestore(&blk_lock, flags);
+            cmd->steps = blk_steps(driver, first, total);
+            if (driver->flush_alone && (cmd->steps & BLK_STEP_FLUSHES)) {
+                blk_alone[first->drive] = true;
+            }
+            spin_unlock_irqrestore(&blk_lock, flags);
+            cmd->drive = first->drive;
+            cmd->write = first->write;
+            cmd->lba = first->lba;
+            cmd->count = total;
+            cmd->requests = first;
+            if (blk_start_step(driver, cmd) != 0) {
+                cmd->steps = 0;
+                blk_complete(cmd, 0);
+            }
+            continue;
+        }
+        if (!contiguous) {
+            blk_stats.bounced++;
+        }
+        if (first->flags & BLK_REQ_PREFLUSH) {
+            blk_stats.flushes++;
+        }
+        spin_unlock_irqrestore(&blk_lock, flags);
+
+        // Buffers laid out back to back go to the driver as they are
+        uint8_t* data = contiguous ? (uint8_t*)first->buffer : bounce;
+        if (!contiguous && first->write) {
+            uint8_t* dest = bounce;
+            for (blk_request_t* req = first; req; req = req->fifo_next) {
+                memcpy(dest, req->buffer, req->count * BLK_SECTOR_SIZE);
+                dest += req->count * BLK_SECTOR_SIZE;
+            }
+        }
+        // The driver emulates FUA where the drive lacks it
+        int result = (first->flags & BLK_REQ_PREFLUSH) ? ata_flush(first->drive) : 1;
+        if (result && total > 0) {
+            if (!first->write) {
+                result = ata_read(first->drive, first->lba, total, data);
+            } else if (first->flags & BLK_REQ_FUA) {
+                result = ata_write_fua(first->drive, first->lba, total, data);
+            } else {
+                result = ata_write(first->drive, first->lba, total, data);
+            }
+        }
+        if (!contiguous && !first->write && result) {
+            uint8_t* src = bounce;
+            for (blk_request_t* req = first; req; req = req->fifo_next) {
+                memcpy(req->buffer, src, req->count * BLK_SECTOR_SIZE);
+                src += req->count * BLK_SECTOR_SIZE;
+            }
+        }
+
+        blk_finish(first, result);
+    }
+}
+
+// Hand the queue to the work queue (already scheduled is fine)
+void blk_unplug(void) {
+    if (blk_ready && queued > 0) {
+        work_schedule(&blk_work);
+    }
+}
+
+static void blk_wait_step(void) {
+    for (uint32_t i = 0; i < BLK_MAX_DRIVES; i++) {
+        if (blk_drivers[i] && blk_drivers[i]->poll && blk_active[i] > 0) {
+            blk_drivers[i]->poll();
+        }
+    }
+    blk_unplug();
+    workqueue_idle();  // Runs the dispatch here when there's no worker
+    if (scheduler_preemptive) {
+        process_yield();
+    } else {
+        asm volatile ("pause");
+    }
+}
+
+void blk_wait(blk_request_t* req) {
+    while (!req->completed) {
+        blk_wait_step();
+    }
+}
+
+void blk_sync(void) {
+    while (queued > 0 || in_flight > 0) {
+        blk_wait_step();
+    }
+}
+
+void blk_get_stats(blk_stats_t* stats) {
+    uint32_t flags = spin_lock_irqsave(&blk_lock);
+    *stats = blk_stats;
+    spin_unlock_irqrestore(&blk_lock, flags);
+}
+
+void blk_dump_stats(void) {
+    blk_stats_t stats;
+    blk_get_stats(&stats);
+    terminal_printf("Block layer: %d requests in %d commands (%d merged, %d bounced)\n",
+                    (int)stats.submitted, (int)stats.commands, (int)stats.merged,
+                    (int)stats.bounced);
+    terminal_printf("  %d dispatched past their deadline, %d queued, at most %d out on a drive\n",
+                    (int)stats.deadline_picks, (int)queued, (int)stats.max_outstanding);
+    terminal_printf("  %d cache flushes\n", (int)stats.flushes);
+}
@@ -0,0 +1,108 @@
+// ClaudeOS Block Layer - Day 21
+// Asynchronous disk requests, merged and ordered by an elevator
+
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include "types.h"
+
+#define BLK_SECTOR_SIZE         512
+#define BLK_MAX_MERGE_SECTORS   128         // One command: the ATA DMA bounce buffer
+#define BLK_READ_DEADLINE_MS    500         // Served ahead of the sweep once this old
+#define BLK_WRITE_DEADLINE_MS   5000
+#define BLK_MAX_DRIVES          20          // Drive numbers a queued driver can take
+#define BLK_MAX_COMMANDS        64          // Queued-driver commands out at once, all drives
+#define BLK_MAX_SEGMENTS        16          // Requests merged into one queued-driver command
+
+// Request flags, for ordering against drives' write caches. A preflush
+// makes every write that completed before the request was submitted
+// durable before the request starts; FUA makes a write durable before it
+// completes. A request of count 0 is a bare flush (it gets
+// BLK_REQ_PREFLUSH). Only requests with the same flags share a command.
+#define BLK_REQ_PREFLUSH        (1 << 0)
+#define BLK_REQ_FUA             (1 << 1)
+
+// What one start of a command asks its driver for
+#define BLK_CMD_FLUSH           (1 << 0)    // Flush the cache; lba, count and requests unused
+#define BLK_CMD_FUA             (1 << 1)    // Write through (drivers with fua set only)
+
+struct blk_request;
+typedef void (*blk_done_t)(struct blk_request* req);
+
+// Owned by the submitter until done runs; done is called from the
+// dispatcher (the work queue) with result 1 on success, 0 on failure
+typedef struct blk_request {
+    uint8_t drive;
+    bool write;
+    uint8_t flags;                      // BLK_REQ_*
+    uint32_t lba;
+    uint32_t count;                     // Sectors
+    void* buffer;                       // count * BLK_SECTOR_SIZE bytes
+    blk_done_t done;                    // May be NULL
+    void* private_data;
+    int result;
+    volatile bool completed;
+    uint32_t deadline;                  // Tick it jumps the sweep at
+    struct blk_request* sort_next;      // Queue in (drive, lba) order
+    struct blk_request* fifo_next;      // Queue in arrival order
+} blk_request_t;
+
+// One command as a driver sees it: a run of requests, adjacent on disk
+typedef struct blk_command {
+    uint8_t drive;
+    bool write;
+    uint32_t lba;
+    uint32_t count;                     // Sectors, over the whole run
+    blk_request_t* requests;            // Chained through fifo_next in LBA order
+    int result;
+    uint8_t flags;                      // BLK_CMD_*, for this start
+    uint8_t steps;                      // Block layer: flush, data, flush still to start
+    uint32_t tag;                       // The driver's own (e.g. its slot)
+    struct blk_command* next;           // Completion list
+} blk_command_t;
+
+// A driver that takes several commands at once (AHCI, virtio-blk). Drives
+// without one go to drivers/ata.c, one command at a time. A command with
+// flags runs as up to three starts of the same cmd: a flush, the data,
+// and a flush after a FUA write for drivers that can't do one.
+typedef struct {
+    const char* name;
+    uint32_t queue_depth;               // Commands the drive holds at once
+    bool fua;                           // Takes BLK_CMD_FUA writes
+    bool flush_alone;                   // A flush can't overlap other commands (NCQ)
+    // Issue cmd (each request's buffer is its own segment) and return 0;
+    // blk_complete follows from any context. Nonzero fails it at once.
+    int (*start)(blk_command_t* cmd);
+    void (*poll)(void);                 // Reap completions without the IRQ; may be NULL
+} blk_driver_t;
+
+typedef struct {
+    uint32_t submitted;
+    uint32_t commands;                  // Driver calls the requests became
+    uint32_t merged;                    // Requests that rode another's command
+    uint32_t bounced;                   // Merges copied through the bounce buffer
+    uint32_t deadline_picks;            // Dispatches taken out of sweep order
+    uint32_t flushes;                   // Preflushes, and flushes after queued FUA writes
+    uint32_t max_outstanding;           // Most commands out at once on one drive
+} blk_stats_t;
+
+int blk_init(void);
+
+// Hand a drive number to a queued driver (before requests for it arrive)
+int blk_register_driver(uint8_t drive, const blk_driver_t* driver);
+
+// A queued driver finished cmd: 1 on success, 0 on failure
+void blk_complete(blk_command_t* cmd, int result);
+
+// Queue a request; nothing reaches the disk until the queue is unplugged
+void blk_submit(blk_request_t* req);
+void blk_unplug(void);
+
+// Unplug and wait for one request, or until every submitted one has completed
+void blk_wait(blk_request_t* req);
+void blk_sync(void);
+
+void blk_get_stats(blk_stats_t* stats);
+void blk_dump_stats(void);
+
+#endif // BLOCK_H
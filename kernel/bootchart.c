@@ -0,0 +1,89 @@
+// ClaudeOS Boot Timeline Implementation - Day 21
+
+#include "bootchart.h"
+#include "kernel.h"
+#include "timer.h"
+
+typedef struct {
+    const char* name;
+    uint64_t tsc;                       // When the phase ended
+} boot_mark_t;
+
+static boot_mark_t boot_marks[BOOT_PHASES_MAX];
+static uint32_t boot_mark_count = 0;
+
+static inline uint64_t boot_rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static uint64_t boot_entry_tsc(void) {
+    return ((uint64_t)boot_tsc_entry[1] << 32) | boot_tsc_entry[0];
+}
+
+void boot_phase(const char* name) {
+    // entry.asm only latched the TSC if CPUID said there was one
+    if (!boot_entry_tsc() || boot_mark_count == BOOT_PHASES_MAX) {
+        return;
+    }
+    boot_marks[boot_mark_count].name = name;
+    boot_marks[boot_mark_count].tsc = boot_rdtsc();
+    boot_mark_count++;
+}
+
+// Microseconds in cycles TSC cycles: cycles * mult >> shift is in ns,
+// then a divl by 1000, which holds for anything under an hour
+static uint32_t boot_cycles_to_us(uint64_t cycles) {
+    uint32_t mult;
+    uint64_t base;
+    clock_tsc_params(&mult, &base);
+    uint64_t low = (uint64_t)(uint32_t)cycles * mult;
+    uint64_t high = (uint64_t)(uint32_t)(cycles >> 32) * mult;
+    uint64_t ns = (low >> CLOCK_NS_SHIFT) + (high << (32 - CLOCK_NS_SHIFT));
+    if ((ns >> 32) >= 1000) {
+        return 0xFFFFFFFF;
+    }
+    uint32_t us, remainder;
+    asm volatile ("divl %3" : "=a" (us), "=d" (remainder)
+                  : "a" ((uint32_t)ns), "r" (1000), "d" ((uint32_t)(ns >> 32)));
+    return us;
+}
+
+void bootchart_command(int argc, char argv[][64]) {
+    (void)argv;
+    if (argc > 1) {
+        terminal_writestring("Usage: bootchart\n");
+        return;
+    }
+    if (!boot_entry_tsc()) {
+        terminal_writestring("No TSC - boot phases weren't timed\n");
+        return;
+    }
+    if (!clock_tsc_khz()) {
+        terminal_writestring("TSC not calibrated - boot phases can't be converted to time\n");
+        return;
+    }
+    uint64_t entry = boot_entry_tsc();
+    uint64_t end = boot_mark_count ? boot_marks[boot_mark_count - 1].tsc : entry;
+    uint32_t total = boot_cycles_to_us(end - entry);
+    terminal_printf("Boot timeline, TSC at %d MHz (us, share of _start to the last mark):\n",
+                    (int)(clock_tsc_khz() / 1000));
+    terminal_printf("  firmware + loader  %d  (TSC at _start; it counts from reset)\n",
+                    (int)boot_cycles_to_us(entry));
+
+    uint64_t previous = entry;
+    for (uint32_t i = 0; i < boot_mark_count; i++) {
+        uint32_t us = boot_cycles_to_us(boot_marks[i].tsc - previous);
+        uint32_t share = 0;
+        if (total > 0xFFFFFFFF / 1000) {
+            share = us / (total / 1000);
+        } else if (total) {
+            share = us * 1000 / total;
+        }
+        terminal_printf("  %s  %d  %d.%d%%\n", boot_marks[i].name, (int)us, (int)(share / 10),
+                        (int)(share % 10));
+        previous = boot_marks[i].tsc;
+    }
+    terminal_printf("  total  %d\n", (int)total);
+}
@@ -0,0 +1,25 @@
+// ClaudeOS Boot Timeline - Day 21
+// kernel_main marks the end of each init phase with boot_phase(); every
+// mark is a raw TSC reading, so phases that run before the timer has
+// calibrated the TSC are timed too, and converted when the report is
+// asked for. entry.asm latches the TSC before anything else runs, which
+// also says how long firmware and the loader took (the TSC counts from
+// reset).
+
+#ifndef BOOTCHART_H
+#define BOOTCHART_H
+
+#include "types.h"
+
+#define BOOT_PHASES_MAX     32
+
+// Raw TSC at _start, 0 without a TSC (kernel/entry.asm)
+extern uint32_t boot_tsc_entry[2];
+
+// End the phase in progress, naming it (a string literal; kept, not copied)
+void boot_phase(const char* name);
+
+// Shell: bootchart
+void bootchart_command(int argc, char argv[][64]);
+
+#endif // BOOTCHART_H
@@ -0,0 +1,217 @@
+// ClaudeOS Packet Filters Implementation - Day 21
+// The verifier makes the interpreter's job small: with every jump known
+// to land forward and inside the program, the loop needs no step limit
+// and no bounds check on pc, and only loads and X divisors are left to
+// check as the program runs.
+
+#include "bpf.h"
+#include "string.h"
+
+static bool bpf_load_size_ok(uint16_t code) {
+    return BPF_SIZE(code) == BPF_W || BPF_SIZE(code) == BPF_H || BPF_SIZE(code) == BPF_B;
+}
+
+// Whether instruction pc of length is well formed and keeps control in
+// the program
+static bool bpf_insn_ok(const bpf_insn_t* insn, uint32_t pc, uint32_t length) {
+    uint16_t code = insn->code;
+    if (code & 0xFF00) {
+        return false;
+    }
+    switch (BPF_CLASS(code)) {
+        case BPF_LD:
+            switch (BPF_MODE(code)) {
+                case BPF_ABS:
+                case BPF_IND:
+                    return bpf_load_size_ok(code);
+                case BPF_MEM:
+                    return BPF_SIZE(code) == BPF_W && insn->k < BPF_MEMWORDS;
+                case BPF_IMM:
+                case BPF_LEN:
+                    return BPF_SIZE(code) == BPF_W;
+                default:
+                    return false;
+            }
+        case BPF_LDX:
+            switch (BPF_MODE(code)) {
+                case BPF_MEM:
+                    return BPF_SIZE(code) == BPF_W && insn->k < BPF_MEMWORDS;
+                case BPF_IMM:
+                case BPF_LEN:
+                    return BPF_SIZE(code) == BPF_W;
+                case BPF_MSH:
+                    return BPF_SIZE(code) == BPF_B;
+                default:
+                    return false;
+            }
+        case BPF_ST:
+        case BPF_STX:
+            return (code & ~0x07) == 0 && insn->k < BPF_MEMWORDS;
+        case BPF_ALU:
+            switch (BPF_OP(code)) {
+                case BPF_NEG:
+                    return BPF_SRC(code) == BPF_K;
+                case BPF_DIV:
+                case BPF_MOD:
+                    return BPF_SRC(code) == BPF_X || insn->k != 0;
+                case BPF_ADD: case BPF_SUB: case BPF_MUL: case BPF_OR:
+                case BPF_AND: case BPF_LSH: case BPF_RSH: case BPF_XOR:
+                    return true;
+                default:
+                    return false;
+            }
+        case BPF_JMP:
+            if (BPF_OP(code) == BPF_JA) {
+                return BPF_SRC(code) == BPF_K && insn->k < length - pc - 1;
+            }
+            if (BPF_OP(code) > BPF_JSET) {
+                return false;
+            }
+            return insn->jt < length - pc - 1 && insn->jf < length - pc - 1;
+        case BPF_RET:
+            return (code & 0xE0) == 0 && (BPF_RVAL(code) == BPF_K || BPF_RVAL(code) == BPF_A);
+        case BPF_MISC:
+            return BPF_MISCOP(code) == BPF_TAX || BPF_MISCOP(code) == BPF_TXA;
+    }
+    return false;
+}
+
+int bpf_verify(const bpf_insn_t* insns, uint32_t length, uint32_t* where) {
+    *where = 0;
+    if (length == 0 || length > BPF_MAX_INSNS) {
+        return -1;
+    }
+    for (uint32_t pc = 0; pc < length; pc++) {
+        if (!bpf_insn_ok(&insns[pc], pc, length)) {
+            *where = pc;
+            return -1;
+        }
+    }
+    // Jumps only go forward, so this is where every path ends
+    if (BPF_CLASS(insns[length - 1].code) != BPF_RET) {
+        *where = length - 1;
+        return -1;
+    }
+    return 0;
+}
+
+// width bytes at offset, big-endian as on the wire; false past the end
+static inline bool bpf_load(const uint8_t* data, uint32_t size, uint32_t offset, uint16_t code,
+                            uint32_t* value) {
+    uint32_t width = BPF_SIZE(code) == BPF_W ? 4 : BPF_SIZE(code) == BPF_H ? 2 : 1;
+    if (offset > size || size - offset < width) {
+        return false;
+    }
+    const uint8_t* p = data + offset;
+    if (width == 4) {
+        *value = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    } else if (width == 2) {
+        *value = ((uint32_t)p[0] << 8) | p[1];
+    } else {
+        *value = p[0];
+    }
+    return true;
+}
+
+uint32_t bpf_run(const bpf_prog_t* prog, const uint8_t* data, uint32_t size) {
+    uint32_t a = 0;
+    uint32_t x = 0;
+    uint32_t mem[BPF_MEMWORDS];
+    memset(mem, 0, sizeof(mem));
+
+    for (uint32_t pc = 0; ; pc++) {
+        const bpf_insn_t* insn = &prog->insns[pc];
+        uint16_t code = insn->code;
+        uint32_t k = insn->k;
+        switch (BPF_CLASS(code)) {
+            case BPF_LD:
+                switch (BPF_MODE(code)) {
+                    case BPF_ABS:
+                        if (!bpf_load(data, size, k, code, &a)) {
+                            return 0;
+                        }
+                        break;
+                    case BPF_IND:
+                        if (x + k < x || !bpf_load(data, size, x + k, code, &a)) {
+                            return 0;
+                        }
+                        break;
+                    case BPF_MEM: a = mem[k]; break;
+                    case BPF_LEN: a = size; break;
+                    default:      a = k; break;
+                }
+                break;
+            case BPF_LDX:
+                switch (BPF_MODE(code)) {
+                    case BPF_MSH:
+                        if (k >= size) {
+                            return 0;
+                        }
+                        x = (data[k] & 0xF) * 4;
+                        break;
+                    case BPF_MEM: x = mem[k]; break;
+                    case BPF_LEN: x = size; break;
+                    default:      x = k; break;
+                }
+                break;
+            case BPF_ST:
+                mem[k] = a;
+                break;
+            case BPF_STX:
+                mem[k] = x;
+                break;
+            case BPF_ALU: {
+                uint32_t operand = BPF_SRC(code) == BPF_X ? x : k;
+                switch (BPF_OP(code)) {
+                    case BPF_ADD: a += operand; break;
+                    case BPF_SUB: a -= operand; break;
+                    case BPF_MUL: a *= operand; break;
+                    case BPF_DIV:
+                        if (!operand) {
+                            return 0;           // Only X can be zero here
+                        }
+                        a /= operand;
+                        break;
+                    case BPF_MOD:
+                        if (!operand) {
+                            return 0;
+                        }
+                        a %= operand;
+                        break;
+                    case BPF_OR:  a |= operand; break;
+                    case BPF_AND: a &= operand; break;
+                    case BPF_LSH: a = operand < 32 ? a << operand : 0; break;
+                    case BPF_RSH: a = operand < 32 ? a >> operand : 0; break;
+                    case BPF_XOR: a ^= operand; break;
+                    default:      a = -a; break;
+                }
+                break;
+            }
+            case BPF_JMP: {
+                if (BPF_OP(code) == BPF_JA) {
+                    pc += k;
+                    break;
+                }
+                uint32_t operand = BPF_SRC(code) == BPF_X ? x : k;
+                bool taken;
+                switch (BPF_OP(code)) {
+                    case BPF_JEQ: taken = a == operand; break;
+                    case BPF_JGT: taken = a > operand; break;
+                    case BPF_JGE: taken = a >= operand; break;
+                    default:      taken = (a & operand) != 0; break;
+                }
+                pc += taken ? insn->jt : insn->jf;
+                break;
+            }
+            case BPF_RET:
+                return BPF_RVAL(code) == BPF_A ? a : k;
+            default:
+                if (BPF_MISCOP(code) == BPF_TAX) {
+                    x = a;
+                } else {
+                    a = x;
+                }
+                break;
+        }
+    }
+}
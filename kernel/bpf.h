@@ -0,0 +1,94 @@
+// ClaudeOS Packet Filters - Day 21
+// Classic BPF: an accumulator, an index register and sixteen scratch
+// words, over the bytes of one frame. Programs are checked once when they
+// are attached: every opcode known, every jump forward and inside the
+// program, no constant divisor of zero, and a return at the end, so each
+// run is a straight walk of at most BPF_MAX_INSNS instructions. Loads
+// past the frame end the run with 0, as they do elsewhere.
+
+#ifndef BPF_VM_H
+#define BPF_VM_H
+
+#include "types.h"
+
+#define BPF_MAX_INSNS   64
+#define BPF_MEMWORDS    16
+
+// Instruction classes
+#define BPF_CLASS(code) ((code) & 0x07)
+#define BPF_LD          0x00
+#define BPF_LDX         0x01
+#define BPF_ST          0x02
+#define BPF_STX         0x03
+#define BPF_ALU         0x04
+#define BPF_JMP         0x05
+#define BPF_RET         0x06
+#define BPF_MISC        0x07
+
+// Load sizes and modes
+#define BPF_SIZE(code)  ((code) & 0x18)
+#define BPF_W           0x00
+#define BPF_H           0x08
+#define BPF_B           0x10
+#define BPF_MODE(code)  ((code) & 0xE0)
+#define BPF_IMM         0x00
+#define BPF_ABS         0x20            // data[k]
+#define BPF_IND         0x40            // data[X + k]
+#define BPF_MEM         0x60            // M[k]
+#define BPF_LEN         0x80            // Frame length
+#define BPF_MSH         0xA0            // LDX only: X = 4 * (data[k] & 0xF), an IPv4 header size
+
+// ALU and jump operations, and their operand
+#define BPF_OP(code)    ((code) & 0xF0)
+#define BPF_ADD         0x00
+#define BPF_SUB         0x10
+#define BPF_MUL         0x20
+#define BPF_DIV         0x30
+#define BPF_OR          0x40
+#define BPF_AND         0x50
+#define BPF_LSH         0x60
+#define BPF_RSH         0x70
+#define BPF_NEG         0x80
+#define BPF_MOD         0x90
+#define BPF_XOR         0xA0
+#define BPF_JA          0x00
+#define BPF_JEQ         0x10
+#define BPF_JGT         0x20
+#define BPF_JGE         0x30
+#define BPF_JSET        0x40
+#define BPF_SRC(code)   ((code) & 0x08)
+#define BPF_K           0x00
+#define BPF_X           0x08
+
+// Return value source, and the register moves
+#define BPF_RVAL(code)  ((code) & 0x18)
+#define BPF_A           0x10
+#define BPF_MISCOP(code) ((code) & 0xF8)
+#define BPF_TAX         0x00
+#define BPF_TXA         0x80
+
+typedef struct {
+    uint16_t code;
+    uint8_t jt;                         // Conditional jumps: skip this many when true
+    uint8_t jf;                         // ...and this many when false
+    uint32_t k;
+} bpf_insn_t;
+
+#define BPF_STMT(code, k)           { (uint16_t)(code), 0, 0, (k) }
+#define BPF_JUMP(code, k, jt, jf)   { (uint16_t)(code), (jt), (jf), (k) }
+
+// A checked program, as attached
+typedef struct {
+    uint32_t length;
+    bpf_insn_t insns[BPF_MAX_INSNS];
+} bpf_prog_t;
+
+// 0 if insns can be run, -1 with the first problem's index in *where
+int bpf_verify(const bpf_insn_t* insns, uint32_t length, uint32_t* where);
+
+// Run a verified program over size bytes of data; returns what it
+// returned (for a filter, 0 means reject and anything else how many
+// bytes to keep)
+uint32_t bpf_run(const bpf_prog_t* prog, const uint8_t* data, uint32_t size);
+
+#endif // BPF_VM_H
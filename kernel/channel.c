@@ -0,0 +1,397 @@
+// ClaudeOS Broadcast Channel Implementation - Day 21
+// Publishers serialise on the channel lock; readers take no lock at all.
+// A reader checks the slot's sequence number before and after copying,
+// so a message the ring overwrote under it is noticed and skipped rather
+// than returned torn. A channel's ring outlives the channel itself (pool
+// slots survive a free), so a reader racing a destroy reads stale data
+// rather than freed memory, and the reopened channel reuses the buffer.
+
+#include "channel.h"
+#include "process.h"
+#include "heap.h"
+#include "kernel.h"
+#include "string.h"
+#include "pool.h"
+
+DEFINE_POOL(channels, channel_t, MAX_CHANNELS);
+DEFINE_POOL(channel_subs, channel_sub_t, MAX_SUBSCRIPTIONS);
+static spinlock_t channel_table_lock;   // Unregistered; both pools and the names
+
+#define CHANNEL_MASK        (CHANNEL_SLOTS - 1)
+
+static inline void channel_barrier(void) {
+    asm volatile ("" : : : "memory");   // x86 keeps stores (and loads) in order
+}
+
+static inline uint32_t slot_done(uint32_t n) {
+    return 2 * n + 2;
+}
+
+static inline bool channel_can_sleep(process_t* process) {
+    return process && process->pid != KERNEL_PID && scheduler_preemptive;
+}
+
+// Channel by name (table lock held)
+static channel_t* channel_find_locked(const char* name) {
+    channel_t* channel;
+    POOL_FOR_EACH(channels, channel) {
+        if (strcmp(channel->name, name) == 0) {
+            return channel;
+        }
+    }
+    return NULL;
+}
+
+// Wake every sleeping subscriber (channel lock held)
+static void channel_wake_all(channel_t* channel) {
+    channel_sub_t* sub = channel->sleepers;
+    channel->sleepers = NULL;
+    while (sub) {
+        channel_sub_t* next = sub->next_sleeper;
+        process_t* waiter = sub->waiter;
+        sub->next_sleeper = NULL;
+        sub->waiter = NULL;
+        process_wake(waiter);
+        sub = next;
+    }
+}
+
+int channel_open(const char* name) {
+    if (!name || !name[0] || strlen(name) >= CHANNEL_NAME_SIZE) {
+        return -1;
+    }
+    uint32_t flags = spin_lock_irqsave(&channel_table_lock);
+    channel_t* channel = channel_find_locked(name);
+    if (channel) {
+        int id = channel->id;
+        spin_unlock_irqrestore(&channel_table_lock, flags);
+        return id;
+    }
+    channel = channels_alloc();
+    if (channel) {
+        channel->id = channels_handle(channel);
+        channel->name[0] = '\0';        // Not findable until it is set up
+    }
+    spin_unlock_irqrestore(&channel_table_lock, flags);
+    if (!channel) {
+        return -1;
+    }
+
+    if (!channel->slots) {
+        channel->slots = (channel_slot_t*)kmalloc(sizeof(channel_slot_t) * CHANNEL_SLOTS);
+    }
+    if (!channel->slots) {
+        flags = spin_lock_irqsave(&channel_table_lock);
+        channels_free(channel);
+        spin_unlock_irqrestore(&channel_table_lock, flags);
+        return -1;
+    }
+    for (uint32_t i = 0; i < CHANNEL_SLOTS; i++) {
+        channel->slots[i].seq = 0;
+        channel->slots[i].length = 0;
+    }
+    channel->head = 0;
+    channel->sleepers = NULL;
+    channel->subscribers = 0;
+
+    // Two openers of a new name may both get here; the later one yields
+    flags = spin_lock_irqsave(&channel_table_lock);
+    channel_t* other = channel_find_locked(name);
+    int id = other ? other->id : channel->id;
+    if (other) {
+        channels_free(channel);
+    } else {
+        strlcpy(channel->name, name, CHANNEL_NAME_SIZE);
+    }
+    spin_unlock_irqrestore(&channel_table_lock, flags);
+    return id;
+}
+
+int channel_destroy(int channel_id) {
+    uint32_t flags = spin_lock_irqsave(&channel_table_lock);
+    channel_t* channel = channels_lookup(channel_id);
+    if (channel) {
+        channel->name[0] = '\0';
+        channels_free(channel);         // Subscriptions now fail their lookup
+    }
+    spin_unlock_irqrestore(&channel_table_lock, flags);
+    if (!channel) {
+        return -1;
+    }
+    flags = spin_lock_irqsave(&channel->lock);
+    channel_wake_all(channel);
+    spin_unlock_irqrestore(&channel->lock, flags);
+    return 0;
+}
+
+int channel_publish(int channel_id, const void* data, uint32_t length) {
+    if (!data || length > CHANNEL_MSG_SIZE) {
+        return -1;
+    }
+    channel_t* channel = channels_lookup(channel_id);
+    if (!channel) {
+        return -1;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&channel->lock);
+    uint32_t n = channel->head;
+    channel_slot_t* slot = &channel->slots[n & CHANNEL_MASK];
+    slot->seq = slot_done(n) - 1;       // Readers of the old message see it change
+    channel_barrier();
+    memcpy(slot->data, data, length);
+    slot->length = length;
+    channel_barrier();
+    slot->seq = slot_done(n);
+    channel_barrier();
+    channel->head = n + 1;
+    channel_wake_all(channel);
+    spin_unlock_irqrestore(&channel->lock, flags);
+    return 0;
+}
+
+int channel_subscribe(int channel_id) {
+    process_t* process = current_process;
+    uint32_t flags = spin_lock_irqsave(&channel_table_lock);
+    channel_t* channel = channels_lookup(channel_id);
+    channel_sub_t* sub = channel ? channel_subs_alloc() : NULL;
+    if (sub) {
+        sub->id = channel_subs_handle(sub);
+        sub->channel = channel;
+        sub->owner_pid = process ? process->pid : KERNEL_PID;
+        sub->cursor = channel->head;
+        sub->lost = 0;
+        sub->waiter = NULL;
+        sub->next_sleeper = NULL;
+        channel->subscribers++;
+    }
+    spin_unlock_irqrestore(&channel_table_lock, flags);
+    return sub ? sub->id : -1;
+}
+
+int channel_unsubscribe(int sub_id) {
+    uint32_t flags = spin_lock_irqsave(&channel_table_lock);
+    channel_sub_t* sub = channel_subs_lookup(sub_id);
+    if (sub) {
+        if (channels_live(sub->channel) && sub->channel->subscribers) {
+            sub->channel->subscribers--;
+        }
+        channel_subs_free(sub);
+    }
+    spin_unlock_irqrestore(&channel_table_lock, flags);
+    return sub ? 0 : -1;
+}
+
+// The subscription's channel, if both still exist
+static channel_t* sub_channel(channel_sub_t* sub, int sub_id) {
+    uint32_t flags = spin_lock_irqsave(&channel_table_lock);
+    channel_t* channel = NULL;
+    if (channel_subs_lookup(sub_id) == sub && channels_live(sub->channel) && sub->channel->name[0]) {
+        channel = sub->channel;
+    }
+    spin_unlock_irqrestore(&channel_table_lock, flags);
+    return channel;
+}
+
+int channel_receive(int sub_id, void* buffer, uint32_t size, bool wait, uint32_t* lost) {
+    channel_sub_t* sub = channel_subs_lookup(sub_id);
+    channel_t* channel = sub ? sub_channel(sub, sub_id) : NULL;
+    if (!channel || !buffer) {
+        return -1;
+    }
+    process_t* process = current_process;
+    uint32_t skipped = 0;
+    int result;
+
+    while (1) {
+        uint32_t head = channel->head;
+        if (sub->cursor == head) {
+            if (!wait || !channel_can_sleep(process)) {
+                result = CHANNEL_WOULD_BLOCK;
+                break;
+            }
+            uint32_t flags = spin_lock_irqsave(&channel->lock);
+            bool sleep = channel->head == sub->cursor;
+            if (sleep) {
+                sub->waiter = process;
+                sub->next_sleeper = channel->sleepers;
+                channel->sleepers = sub;
+                process_prepare_block();
+            }
+            spin_unlock_irqrestore(&channel->lock, flags);
+            if (sleep) {
+                process_sleep_while(sub->waiter, process);
+            }
+            if (sub_channel(sub, sub_id) != channel) {
+                result = -1;            // Destroyed while we slept
+                break;
+            }
+            continue;
+        }
+
+        // Lapped: the oldest messages are gone, start from the oldest kept
+        if (head - sub->cursor > CHANNEL_SLOTS) {
+            skipped += head - CHANNEL_SLOTS - sub->cursor;
+            sub->cursor = head - CHANNEL_SLOTS;
+        }
+        channel_slot_t* slot = &channel->slots[sub->cursor & CHANNEL_MASK];
+        uint32_t seq = slot->seq;
+        channel_barrier();
+        if (seq != slot_done(sub->cursor)) {
+            continue;                   // Being overwritten; head shows it next time
+        }
+        uint32_t n = slot->length < size ? slot->length : size;
+        memcpy(buffer, slot->data, n);
+        channel_barrier();
+        if (slot->seq != seq) {
+            continue;                   // Overwritten while we copied
+        }
+        sub->cursor++;
+        result = (int)n;
+        break;
+    }
+
+    sub->lost += skipped;
+    if (lost) {
+        *lost = skipped;
+    }
+    return result;
+}
+
+// Drop a killed process from any channel it sleeps on
+void channel_cancel_wait(process_t* process) {
+    channel_t* channel;
+    POOL_FOR_EACH(channels, channel) {
+        uint32_t flags = spin_lock_irqsave(&channel->lock);
+        for (channel_sub_t** link = &channel->sleepers; *link; link = &(*link)->next_sleeper) {
+            if ((*link)->waiter == process) {
+                channel_sub_t* sub = *link;
+                *link = sub->next_sleeper;
+                sub->next_sleeper = NULL;
+                sub->waiter = NULL;
+                break;
+            }
+        }
+        spin_unlock_irqrestore(&channel->lock, flags);
+    }
+}
+
+void channel_release_owned(process_t* process) {
+    channel_sub_t* sub;
+    POOL_FOR_EACH(channel_subs, sub) {
+        if (sub->owner_pid == process->pid) {
+            channel_unsubscribe(sub->id);
+        }
+    }
+}
+
+static void channel_list(void) {
+    terminal_writestring("Channels:\n");
+    bool found_any = false;
+    channel_t* channel;
+    POOL_FOR_EACH(channels, channel) {
+        if (!channel->name[0]) {
+            continue;
+        }
+        found_any = true;
+        terminal_printf("  %d  %s  %d published, %d subscribers\n", channel->id, channel->name,
+                        (int)channel->head, (int)channel->subscribers);
+    }
+    if (!found_any) {
+        terminal_writestring("  none\n");
+    }
+    channel_sub_t* sub;
+    POOL_FOR_EACH(channel_subs, sub) {
+        bool live = channels_live(sub->channel) && sub->channel->name[0];
+        terminal_printf("  sub %d  %s  pid %d  %d unread, %d lost\n", sub->id,
+                        live ? sub->channel->name : "(closed)", sub->owner_pid,
+                        live ? (int)(sub->channel->head - sub->cursor) : 0, (int)sub->lost);
+    }
+}
+
+// Channel id for a name the shell gave, or -1 with a message
+static int channel_shell_id(const char* name) {
+    uint32_t flags = spin_lock_irqsave(&channel_table_lock);
+    channel_t* channel = channel_find_locked(name);
+    int id = channel ? channel->id : -1;
+    spin_unlock_irqrestore(&channel_table_lock, flags);
+    if (id < 0) {
+        terminal_printf("chan: no channel '%s'\n", name);
+    }
+    return id;
+}
+
+void channel_command(int argc, char argv[][64]) {
+    if (argc < 2) {
+        channel_list();
+        return;
+    }
+    if (strcmp(argv[1], "open") == 0 && argc == 3) {
+        int id = channel_open(argv[2]);
+        if (id < 0) {
+            terminal_writestring("chan: can't open (bad name, or no free channel)\n");
+        } else {
+            terminal_printf("Channel '%s' is %d\n", argv[2], id);
+        }
+    } else if (strcmp(argv[1], "close") == 0 && argc == 3) {
+        int id = channel_shell_id(argv[2]);
+        if (id >= 0) {
+            channel_destroy(id);
+        }
+    } else if (strcmp(argv[1], "pub") == 0 && argc >= 4) {
+        int id = channel_shell_id(argv[2]);
+        if (id < 0) {
+            return;
+        }
+        char text[CHANNEL_MSG_SIZE];
+        size_t used = 0;
+        text[0] = '\0';
+        for (int i = 3; i < argc && used + 1 < sizeof(text); i++) {
+            if (i > 3) {
+                text[used++] = ' ';
+            }
+            strlcpy(text + used, argv[i], sizeof(text) - used);
+            used += strlen(text + used);
+        }
+        if (channel_publish(id, text, (uint32_t)strlen(text) + 1) != 0) {
+            terminal_writestring("chan: publish failed\n");
+        }
+    } else if (strcmp(argv[1], "sub") == 0 && argc == 3) {
+        int id = channel_shell_id(argv[2]);
+        if (id < 0) {
+            return;
+        }
+        int sub = channel_subscribe(id);
+        if (sub < 0) {
+            terminal_writestring("chan: no free subscription\n");
+        } else {
+            terminal_printf("Subscription %d on '%s'\n", sub, argv[2]);
+        }
+    } else if (strcmp(argv[1], "read") == 0 && argc == 3) {
+        int sub = atoi(argv[2]);
+        char text[CHANNEL_MSG_SIZE + 1];
+        int count = 0;
+        while (1) {
+            uint32_t lost = 0;
+            int n = channel_receive(sub, text, CHANNEL_MSG_SIZE, false, &lost);
+            if (lost) {
+                terminal_printf("  (%d messages lost)\n", (int)lost);
+            }
+            if (n < 0) {
+                if (n == -1) {
+                    terminal_writestring("chan: no such subscription, or its channel is closed\n");
+                }
+                break;
+            }
+            text[n] = '\0';
+            terminal_printf("  %s\n", text);
+            count++;
+        }
+        terminal_printf("%d messages\n", count);
+    } else if (strcmp(argv[1], "unsub") == 0 && argc == 3) {
+        if (channel_unsubscribe(atoi(argv[2])) != 0) {
+            terminal_writestring("chan: no such subscription\n");
+        }
+    } else {
+        terminal_writestring("Usage: chan [open|close <name> | pub <name> <text> | sub <name> | read|unsub <sub>]\n");
+    }
+}
@@ -0,0 +1,82 @@
+// ClaudeOS Broadcast Channels - Day 21
+// Named publish/subscribe channels: a publisher writes each message once
+// into the channel's ring, and every subscriber reads it from there with
+// a cursor of its own. Nothing waits for slow readers: the ring simply
+// wraps, and a subscriber that falls more than CHANNEL_SLOTS behind finds
+// its next message overwritten (by the slot's sequence number), skips to
+// the oldest one still there and is told how many it lost. Publishing
+// costs one copy however many subscribers there are.
+
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include "types.h"
+#include "lock.h"
+
+#define MAX_CHANNELS        8
+#define MAX_SUBSCRIPTIONS   32
+#define CHANNEL_SLOTS       64          // Messages kept per channel (power of two)
+#define CHANNEL_MSG_SIZE    120         // Bytes per message: a slot is 128
+#define CHANNEL_NAME_SIZE   16
+
+// channel_receive result when nothing is new and the caller can't sleep
+#define CHANNEL_WOULD_BLOCK -2
+
+struct process;
+
+// One ring entry. seq is 2n+1 while message n is being written and 2n+2
+// once it is complete, so a reader can tell a finished message from one
+// being overwritten under it.
+typedef struct {
+    volatile uint32_t seq;
+    uint32_t length;
+    uint8_t data[CHANNEL_MSG_SIZE];
+} channel_slot_t;
+
+struct channel_sub;
+
+typedef struct channel {
+    int id;                             // Pool handle
+    char name[CHANNEL_NAME_SIZE];
+    channel_slot_t* slots;              // CHANNEL_SLOTS of them
+    volatile uint32_t head;             // Messages published so far
+    spinlock_t lock;                    // Unregistered; publishers and sleepers
+    struct channel_sub* sleepers;       // Subscribers blocked in channel_receive
+    uint32_t subscribers;
+} channel_t;
+
+typedef struct channel_sub {
+    int id;                             // Pool handle
+    channel_t* channel;
+    int owner_pid;
+    uint32_t cursor;                    // Next message number to read
+    uint32_t lost;                      // Messages overwritten before it got to them
+    struct process* waiter;             // Owner, while asleep
+    struct channel_sub* next_sleeper;
+} channel_sub_t;
+
+// Open the channel called name, creating it if need be; its id, or -1
+int channel_open(const char* name);
+int channel_destroy(int channel_id);
+
+// Write one message of up to CHANNEL_MSG_SIZE bytes; 0, or -1
+int channel_publish(int channel_id, const void* data, uint32_t length);
+
+// A cursor that starts at the next message published; its id, or -1
+int channel_subscribe(int channel_id);
+int channel_unsubscribe(int sub_id);
+
+// Copy the subscriber's next message out and return its length (cut to
+// size). With wait it sleeps until one is published; otherwise, or if
+// the caller can't sleep, CHANNEL_WOULD_BLOCK. -1 for a bad id or once
+// the channel is destroyed. *lost (if not NULL) gets the number of
+// messages skipped because the ring overtook this subscriber.
+int channel_receive(int sub_id, void* buffer, uint32_t size, bool wait, uint32_t* lost);
+
+void channel_cancel_wait(struct process* process);
+void channel_release_owned(struct process* process);
+
+// Shell: chan [open|pub|sub|read|unsub|close] - broadcast channels
+void channel_command(int argc, char argv[][64]);
+
+#endif // CHANNEL_H
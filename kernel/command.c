@@ -0,0 +1,100 @@
+// ClaudeOS Shell Command Registry Implementation - Day 21
+// Registration happens while booting, before the shell reads a line, and
+// the shell is the only reader, so nothing here is locked.
+
+#include "command.h"
+#include "initcall.h"
+#include "string.h"
+
+typedef struct {
+    const char* name;
+    command_handler_t handler;
+    const char* needs;                  // Initcall to run first, or NULL
+} command_t;
+
+static command_t command_slots[COMMAND_SLOTS];
+static const char* command_sorted[COMMAND_MAX];     // Names in strcmp order
+static int command_count = 0;
+
+// FNV-1a over the name
+static uint32_t command_hash(const char* name) {
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// name's slot, or the empty slot where it would go (linear probing)
+static command_t* command_slot(const char* name) {
+    uint32_t index = command_hash(name) & (COMMAND_SLOTS - 1);
+    while (command_slots[index].name && strcmp(command_slots[index].name, name) != 0) {
+        index = (index + 1) & (COMMAND_SLOTS - 1);
+    }
+    return &command_slots[index];
+}
+
+// Index of the first sorted name not below key
+static int command_lower_bound(const char* key) {
+    int low = 0;
+    int high = command_count;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (strcmp(command_sorted[mid], key) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+int command_register(const char* name, command_handler_t handler) {
+    return command_register_needs(name, handler, NULL);
+}
+
+int command_register_needs(const char* name, command_handler_t handler, const char* needs) {
+    if (!name || !name[0] || !handler || command_count == COMMAND_MAX) {
+        return -1;
+    }
+    command_t* slot = command_slot(name);
+    if (slot->name) {
+        return -1;
+    }
+    slot->name = name;
+    slot->handler = handler;
+    slot->needs = needs;
+    
+    int at = command_lower_bound(name);
+    for (int i = command_count; i > at; i--) {
+        command_sorted[i] = command_sorted[i - 1];
+    }
+    command_sorted[at] = name;
+    command_count++;
+    return 0;
+}
+
+command_handler_t command_find(const char* name) {
+    if (!name) {
+        return NULL;
+    }
+    command_t* slot = command_slot(name);
+    if (slot->handler && slot->needs) {
+        initcall_require(slot->needs);
+    }
+    return slot->handler;
+}
+
+const char* command_complete(const char* prefix, int* count) {
+    size_t length = strlen(prefix);
+    int first = command_lower_bound(prefix);
+    int last = first;
+    while (last < command_count && strncmp(command_sorted[last], prefix, length) == 0) {
+        last++;
+    }
+    if (count) {
+        *count = last - first;
+    }
+    return last > first ? command_sorted[first] : NULL;
+}
@@ -0,0 +1,32 @@
+// ClaudeOS Shell Command Registry - Day 21
+// Commands are found by name in an open-addressed hash table instead of
+// being compared one by one. Any subsystem can add its own; a sorted
+// index of the names serves tab completion.
+
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include "types.h"
+
+#define COMMAND_MAX         128
+#define COMMAND_SLOTS       256         // Power of two, twice COMMAND_MAX
+#define COMMAND_ARG_LEN     64          // The shell's argument buffers
+
+typedef void (*command_handler_t)(int argc, char argv[][COMMAND_ARG_LEN]);
+
+// Add a command; name must outlive the table (a string literal). 0 on
+// success, -1 if the name is taken or the table is full.
+int command_register(const char* name, command_handler_t handler);
+
+// The same, for a command that needs a lazy subsystem: the initcall
+// named needs is run the first time the command is looked up
+int command_register_needs(const char* name, command_handler_t handler, const char* needs);
+
+// Handler for name, with what it needs started; NULL if there is none
+command_handler_t command_find(const char* name);
+
+// First command, in name order, that starts with prefix (NULL if none);
+// *count is set to how many do
+const char* command_complete(const char* prefix, int* count);
+
+#endif // COMMAND_H
@@ -1,80 +1,141 @@
 ; ClaudeOS Context Switch - Day 7 Minimal Implementation
-; Simple context switching without complex features
+; Full register context switch (FPU/SSE state is switched lazily in fpu.c)
 
 [BITS 32]
 
-; Export function
+; Export functions
 global switch_context
+global enter_user_frame
 
 section .text
 
-; Minimal context switch function
+; cpu_context_t field offsets
+%define CTX_EAX     0
+%define CTX_EBX     4
+%define CTX_ECX     8
+%define CTX_EDX     12
+%define CTX_ESI     16
+%define CTX_EDI     20
+%define CTX_ESP     24
+%define CTX_EBP     28
+%define CTX_EIP     32
+%define CTX_EFLAGS  36
+%define CTX_DS      40
+%define CTX_ES      44
+%define CTX_FS      48
+%define CTX_GS      52
+%define CTX_SS      56
+
+; Context switch function
 ; Parameters:
-;   [esp+4] = old_context pointer (cpu_context_t*)
-;   [esp+8] = new_context pointer (cpu_context_t*)
+;   [esp+4] = old_context pointer (cpu_context_t*, may be 0)
+;   [esp+8] = new_context pointer (cpu_context_t*, may be 0)
+; The old context resumes as if switch_context had returned normally.
 switch_context:
-    ; Get parameters
-    mov eax, [esp+4]        ; old_context
-    mov edx, [esp+8]        ; new_context
+    ; Keep the caller's EAX/EDX while they hold the pointers
+    push eax
+    push edx                ; [esp] = EDX, [esp+4] = EAX, [esp+8] = return address
     
-    ; Save old context (if valid)
+    mov eax, [esp+12]       ; old_context
     test eax, eax
     jz .load_new
     
-    ; Save registers to old context (simplified)
-    mov [eax+0], eax        ; EAX (will fix below)
-    mov [eax+4], ebx        ; EBX
-    mov [eax+8], ecx        ; ECX
-    mov [eax+12], edx       ; EDX (will fix below)
-    mov [eax+16], esi       ; ESI
-    mov [eax+20], edi       ; EDI
-    mov [eax+24], esp       ; ESP
-    mov [eax+28], ebp       ; EBP
+    ; Save registers to old context
+    mov [eax+CTX_EBX], ebx
+    mov [eax+CTX_ECX], ecx
+    mov [eax+CTX_ESI], esi
+    mov [eax+CTX_EDI], edi
+    mov [eax+CTX_EBP], ebp
+    mov edx, [esp+4]
+    mov [eax+CTX_EAX], edx  ; Caller's EAX
+    mov edx, [esp]
+    mov [eax+CTX_EDX], edx  ; Caller's EDX
     
-    ; Save return address as EIP
-    mov ebx, [esp]
-    mov [eax+32], ebx       ; EIP
+    ; Resume at the return address with the caller's stack pointer
+    mov edx, [esp+8]
+    mov [eax+CTX_EIP], edx
+    lea edx, [esp+12]
+    mov [eax+CTX_ESP], edx
     
     ; Save EFLAGS
     pushfd
-    pop ebx
-    mov [eax+36], ebx       ; EFLAGS
+    pop edx
+    mov [eax+CTX_EFLAGS], edx
     
-    ; Fix EAX and EDX values
-    mov ebx, [esp+4]        ; Get original old_context
-    mov [eax+0], ebx        ; Save as EAX value
-    mov ebx, [esp+8]        ; Get original new_context
-    mov [eax+12], ebx       ; Save as EDX value
+    ; Save segment registers
+    xor edx, edx
+    mov dx, ds
+    mov [eax+CTX_DS], edx
+    mov dx, es
+    mov [eax+CTX_ES], edx
+    mov dx, fs
+    mov [eax+CTX_FS], edx
+    mov dx, gs
+    mov [eax+CTX_GS], edx
+    mov dx, ss
+    mov [eax+CTX_SS], edx
 
 .load_new:
-    ; Load new context
+    mov edx, [esp+16]       ; new_context
     test edx, edx
     jz .done
     
-    ; Load all registers except EAX/EDX (using them for pointer)
-    mov ebx, [edx+4]        ; EBX
-    mov ecx, [edx+8]        ; ECX
-    mov esi, [edx+16]       ; ESI
-    mov edi, [edx+20]       ; EDI
-    mov esp, [edx+24]       ; ESP
-    mov ebp, [edx+28]       ; EBP
+    ; Load segment registers (ss together with esp, below)
+    mov eax, [edx+CTX_DS]
+    mov ds, ax
+    mov eax, [edx+CTX_ES]
+    mov es, ax
+    mov eax, [edx+CTX_FS]
+    mov fs, ax
+    mov eax, [edx+CTX_GS]
+    mov gs, ax
+    
+    ; Load general registers except EAX/EDX (using them for pointer)
+    mov ebx, [edx+CTX_EBX]
+    mov ecx, [edx+CTX_ECX]
+    mov esi, [edx+CTX_ESI]
+    mov edi, [edx+CTX_EDI]
+    mov ebp, [edx+CTX_EBP]
+    
+    ; Switch stacks - a mov to ss holds off interrupts for one instruction
+    mov eax, [edx+CTX_SS]
+    mov ss, ax
+    mov esp, [edx+CTX_ESP]
     
     ; Load EFLAGS
-    push dword [edx+36]
+    push dword [edx+CTX_EFLAGS]
     popfd
     
     ; Prepare jump to new EIP
-    push dword [edx+32]     ; Push new EIP
+    push dword [edx+CTX_EIP]
     
     ; Load final registers
-    mov eax, [edx+0]        ; EAX
-    mov edx, [edx+12]       ; EDX
+    mov eax, [edx+CTX_EAX]
+    mov edx, [edx+CTX_EDX]
     
     ; Jump to new process
     ret                     ; Pop EIP and jump
 
 .done:
+    pop edx
+    pop eax
     ret
 
+; void enter_user_frame(uint32_t frame)
+; Resume a register frame laid out as irq_common_stub leaves it (ds, pusha,
+; int_no/err_code, iret state) - for a ring 3 process, the iret drops to
+; user mode on its own stack. Does not return.
+enter_user_frame:
+    cli
+    mov esp, [esp+4]
+    pop eax
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    popa
+    add esp, 8          ; int_no and err_code
+    iret
+
 ; GNU stack note section
-section .note.GNU-stack noalloc noexec nowrite progbits
\ No newline at end of file
+section .note.GNU-stack noalloc noexec nowrite progbits
@@ -0,0 +1,374 @@
+// ClaudeOS Kernel Coroutines Implementation - Day 21
+// A coroutine's control block sits at the bottom of its page and its
+// stack grows down towards it, so the running coroutine is found by
+// masking ESP, and a canary just above the block catches a stack that
+// ran into it. A run loop is a work item: work items never run twice at
+// once, so each CPU's loop is single-threaded and its queue only needs a
+// lock against co_complete from other contexts. A coroutine that blocks
+// in co_await switches back to its loop, which goes on to the next one;
+// the completion puts it back on the queue and schedules the loop again.
+
+#include "coro.h"
+#include "softirq.h"
+#include "block.h"
+#include "heap.h"
+#include "smp.h"
+#include "lock.h"
+#include "timer.h"
+#include "kernel.h"
+#include "string.h"
+#include "stats.h"
+
+#define CO_MAGIC            0xC0DEC0DE
+#define CO_CANARY           0x5AFE57AC
+
+#define CO_READY            0
+#define CO_WAITING          1
+#define CO_DONE             2
+
+STAT_DEFINE(stat_co_switches, "coro.switches", STAT_COUNTER, "switches into a coroutine");
+STAT_DEFINE(stat_co_awaits, "coro.awaits", STAT_COUNTER, "co_await calls that had to wait");
+
+struct co_runner;
+
+typedef struct coroutine {
+    uint32_t magic;
+    uint32_t esp;                       // Saved by co_switch while it is off the CPU
+    void (*fn)(void* arg);
+    void* arg;
+    struct co_runner* runner;
+    struct coroutine* next;             // Run queue, or the stack cache
+    int state;                          // CO_*
+    uint32_t canary;                    // The stack's far end; overwritten on overflow
+} coroutine_t;
+
+typedef struct co_runner {
+    spinlock_t lock;                    // Unregistered; run queue, cache, stats
+    coroutine_t* head;
+    coroutine_t* tail;
+    coroutine_t* current;               // Running under this loop
+    uint32_t loop_esp;                  // The loop's own, while a coroutine runs
+    work_t work;
+    coroutine_t* cache;
+    uint32_t cached;
+    co_stats_t stats;
+} co_runner_t;
+
+static co_runner_t runners[SMP_MAX_CPUS];
+static spinlock_t co_lock;              // Unregistered; event waiters
+
+extern void co_switch(uint32_t* save_esp, uint32_t new_esp);
+
+static coroutine_t* co_current(void) {
+    uint32_t esp;
+    asm volatile ("mov %%esp, %0" : "=r"(esp));
+    // The masked address is in the same page as ESP, so it is always mapped
+    coroutine_t* co = (coroutine_t*)(esp & ~(uint32_t)(CO_STACK_SIZE - 1));
+    if (co->magic != CO_MAGIC || !co->runner || co->runner->current != co) {
+        return NULL;
+    }
+    return co;
+}
+
+static void co_check_stack(coroutine_t* co) {
+    if (co->canary != CO_CANARY) {
+        kernel_panic("coroutine stack overflow");
+    }
+}
+
+// Append co to its loop's queue (runner lock held)
+static void co_enqueue_locked(co_runner_t* runner, coroutine_t* co) {
+    co->state = CO_READY;
+    co->next = NULL;
+    if (runner->tail) {
+        runner->tail->next = co;
+    } else {
+        runner->head = co;
+    }
+    runner->tail = co;
+}
+
+static void co_make_ready(coroutine_t* co) {
+    co_runner_t* runner = co->runner;
+    uint32_t flags = spin_lock_irqsave(&runner->lock);
+    co_enqueue_locked(runner, co);
+    spin_unlock_irqrestore(&runner->lock, flags);
+    work_schedule(&runner->work);
+}
+
+// Back to the run loop; returns when the loop next picks co
+static void co_switch_out(coroutine_t* co) {
+    co_check_stack(co);
+    co_switch(&co->esp, co->runner->loop_esp);
+}
+
+static void co_entry(void) {
+    coroutine_t* co = co_current();
+    co->fn(co->arg);
+    co->state = CO_DONE;
+    co_switch_out(co);
+}
+
+// A finished coroutine's stack goes to the cache, or back to the heap
+static void co_release(co_runner_t* runner, coroutine_t* co) {
+    uint32_t flags = spin_lock_irqsave(&runner->lock);
+    runner->stats.finished++;
+    runner->stats.live--;
+    bool keep = runner->cached < CO_STACK_CACHE;
+    if (keep) {
+        co->magic = 0;
+        co->next = runner->cache;
+        runner->cache = co;
+        runner->cached++;
+    }
+    spin_unlock_irqrestore(&runner->lock, flags);
+    if (!keep) {
+        kfree_page(co);
+    }
+}
+
+static void co_run_loop(void* arg) {
+    co_runner_t* runner = (co_runner_t*)arg;
+    for (;;) {
+        uint32_t flags = spin_lock_irqsave(&runner->lock);
+        coroutine_t* co = runner->head;
+        if (co) {
+            runner->head = co->next;
+            if (!runner->head) {
+                runner->tail = NULL;
+            }
+            co->next = NULL;
+            runner->current = co;
+            runner->stats.switches++;
+        }
+        spin_unlock_irqrestore(&runner->lock, flags);
+        if (!co) {
+            return;
+        }
+
+        stat_inc(&stat_co_switches);
+        co_switch(&runner->loop_esp, co->esp);
+        runner->current = NULL;
+        co_check_stack(co);
+        if (co->state == CO_DONE) {
+            co_release(runner, co);
+        }
+    }
+}
+
+int co_spawn(void (*fn)(void* arg), void* arg) {
+    if (!fn) {
+        return -1;
+    }
+    co_runner_t* runner = &runners[smp_current_cpu()->id];
+    uint32_t flags = spin_lock_irqsave(&runner->lock);
+    coroutine_t* co = runner->cache;
+    if (co) {
+        runner->cache = co->next;
+        runner->cached--;
+    }
+    spin_unlock_irqrestore(&runner->lock, flags);
+    if (!co) {
+        co = (coroutine_t*)kmalloc_page();
+        if (!co) {
+            return -1;
+        }
+    }
+
+    memset(co, 0, sizeof(*co));
+    co->magic = CO_MAGIC;
+    co->canary = CO_CANARY;
+    co->fn = fn;
+    co->arg = arg;
+    co->runner = runner;
+
+    // First switch in pops four zero registers and returns into co_entry
+    uint32_t* sp = (uint32_t*)((uint8_t*)co + CO_STACK_SIZE);
+    *--sp = 0;                          // co_entry never returns
+    *--sp = (uint32_t)co_entry;
+    for (int i = 0; i < 4; i++) {
+        *--sp = 0;                      // EBP, EBX, ESI, EDI
+    }
+    co->esp = (uint32_t)sp;
+
+    flags = spin_lock_irqsave(&runner->lock);
+    if (!runner->work.func) {
+        work_init(&runner->work, co_run_loop, runner);
+    }
+    runner->stats.spawned++;
+    runner->stats.live++;
+    co_enqueue_locked(runner, co);
+    spin_unlock_irqrestore(&runner->lock, flags);
+    work_schedule(&runner->work);
+    return 0;
+}
+
+void co_yield(void) {
+    coroutine_t* co = co_current();
+    if (!co) {
+        return;
+    }
+    uint32_t flags = spin_lock_irqsave(&co->runner->lock);
+    co_enqueue_locked(co->runner, co);
+    spin_unlock_irqrestore(&co->runner->lock, flags);
+    co_switch_out(co);
+}
+
+bool co_active(void) {
+    return co_current() != NULL;
+}
+
+void co_event_init(co_event_t* event) {
+    event->done = 0;
+    event->result = 0;
+    event->waiter = NULL;
+}
+
+int co_await(co_event_t* event) {
+    coroutine_t* co = co_current();
+    if (!co) {
+        while (!event->done) {
+            workqueue_idle();
+            if (!event->done) {
+                asm volatile ("sti; hlt");
+            }
+        }
+        return event->result;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&co_lock);
+    bool wait = !event->done;
+    if (wait) {
+        event->waiter = co;
+        co->state = CO_WAITING;
+    }
+    spin_unlock_irqrestore(&co_lock, flags);
+    if (wait) {
+        // A completion from here on queues co, but its loop can't pick it
+        // before this switch is over: the loop is the one we switch to
+        stat_inc(&stat_co_awaits);
+        flags = spin_lock_irqsave(&co->runner->lock);
+        co->runner->stats.awaits++;
+        spin_unlock_irqrestore(&co->runner->lock, flags);
+        co_switch_out(co);
+    }
+    return event->result;
+}
+
+void co_complete(co_event_t* event, int result) {
+    uint32_t flags = spin_lock_irqsave(&co_lock);
+    event->result = result;
+    event->done = 1;
+    coroutine_t* waiter = event->waiter;
+    event->waiter = NULL;
+    spin_unlock_irqrestore(&co_lock, flags);
+    if (waiter) {
+        co_make_ready(waiter);
+    }
+}
+
+typedef struct {
+    blk_request_t req;                  // First: the done callback casts back
+    co_event_t event;
+} co_blk_t;
+
+static void co_blk_done(blk_request_t* req) {
+    co_blk_t* io = (co_blk_t*)req;
+    co_complete(&io->event, req->result);
+}
+
+int co_blk_io(uint8_t drive, bool write, uint32_t lba, uint32_t count, void* buffer) {
+    co_blk_t io;
+    memset(&io, 0, sizeof(io));
+    io.req.drive = drive;
+    io.req.write = write;
+    io.req.lba = lba;
+    io.req.count = count;
+    io.req.buffer = buffer;
+    io.req.done = co_blk_done;
+    co_event_init(&io.event);
+    blk_submit(&io.req);
+    blk_unplug();
+
+    if (!co_active()) {
+        // Run the queue ourselves; the callback still has io to finish with
+        blk_wait(&io.req);
+        while (!io.event.done) {
+            asm volatile ("pause");
+        }
+        return io.event.result ? 0 : -1;
+    }
+    return co_await(&io.event) ? 0 : -1;
+}
+
+void co_get_stats(co_stats_t* stats) {
+    memset(stats, 0, sizeof(*stats));
+    for (int i = 0; i < SMP_MAX_CPUS; i++) {
+        co_runner_t* runner = &runners[i];
+        uint32_t flags = spin_lock_irqsave(&runner->lock);
+        stats->spawned += runner->stats.spawned;
+        stats->finished += runner->stats.finished;
+        stats->switches += runner->stats.switches;
+        stats->awaits += runner->stats.awaits;
+        stats->live += runner->stats.live;
+        spin_unlock_irqrestore(&runner->lock, flags);
+    }
+}
+
+// coro bench: bounce between the shell and a bare context on a spare page
+#define CO_BENCH_ROUNDS     10000
+
+static uint32_t bench_shell_esp;
+static uint32_t bench_co_esp;
+
+static void co_bench_entry(void) {
+    for (;;) {
+        co_switch(&bench_co_esp, bench_shell_esp);
+    }
+}
+
+static void co_bench(void) {
+    uint8_t* page = (uint8_t*)kmalloc_page();
+    if (!page) {
+        terminal_writestring("coro: out of memory\n");
+        return;
+    }
+    uint32_t* sp = (uint32_t*)(page + CO_STACK_SIZE);
+    *--sp = 0;
+    *--sp = (uint32_t)co_bench_entry;
+    for (int i = 0; i < 4; i++) {
+        *--sp = 0;
+    }
+    bench_co_esp = (uint32_t)sp;
+
+    uint32_t irq_flags = lock_irq_save();
+    co_switch(&bench_shell_esp, bench_co_esp);    // Warm up
+    uint64_t start = clock_cycles();
+    for (int i = 0; i < CO_BENCH_ROUNDS; i++) {
+        co_switch(&bench_shell_esp, bench_co_esp);
+    }
+    uint32_t cycles = (uint32_t)(clock_cycles() - start);    // Far below 2^32 here
+    lock_irq_restore(irq_flags);
+    kfree_page(page);
+
+    // Each round is two switches: there and back
+    terminal_printf("co_switch: %d cycles per switch (%d round trips)\n",
+                    (int)(cycles / (2 * CO_BENCH_ROUNDS)), CO_BENCH_ROUNDS);
+}
+
+void coro_command(int argc, char argv[][64]) {
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        co_bench();
+        return;
+    }
+    if (argc > 1) {
+        terminal_writestring("Usage: coro [bench]\n");
+        return;
+    }
+    co_stats_t stats;
+    co_get_stats(&stats);
+    terminal_printf("Coroutines: %d live, %d spawned, %d finished\n",
+                    (int)stats.live, (int)stats.spawned, (int)stats.finished);
+    terminal_printf("  Switches in: %d  Waits in co_await: %d\n",
+                    (int)stats.switches, (int)stats.awaits);
+}
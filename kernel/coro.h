@@ -0,0 +1,65 @@
+// ClaudeOS Kernel Coroutines - Day 21
+// Direct-style async code: a coroutine runs on a one-page stack of its own
+// and gives up the CPU with co_await until an I/O completion (or any
+// co_complete) resumes it, so a chain of disk or network steps reads as
+// a straight function instead of a chain of callbacks. Switching saves
+// only the callee-saved registers (coro_switch.asm). Each CPU has a run
+// loop - a work item the kworkers run - and a coroutine stays on the
+// loop of the CPU it was spawned on. Thousands can be in flight: a
+// waiting one costs its CO_STACK_SIZE stack and nothing else.
+
+#ifndef CORO_H
+#define CORO_H
+
+#include "types.h"
+
+#define CO_STACK_SIZE       4096        // Stack and control block: one kmalloc_page
+#define CO_STACK_CACHE      64          // Freed stacks kept for the next spawn, per CPU
+
+struct coroutine;
+struct blk_request;
+
+// One completion a coroutine can wait for. Completed once; co_event_init
+// makes it reusable.
+typedef struct {
+    volatile int done;
+    int result;
+    struct coroutine* waiter;           // Sleeping in co_await (co_lock)
+} co_event_t;
+
+typedef struct {
+    uint32_t spawned;
+    uint32_t finished;
+    uint32_t switches;                  // Into a coroutine, from its run loop
+    uint32_t awaits;                    // co_await calls that had to wait
+    uint32_t live;
+} co_stats_t;
+
+// Start fn(arg) as a coroutine on this CPU's run loop; -1 if there is no
+// memory for its stack
+int co_spawn(void (*fn)(void* arg), void* arg);
+
+// Inside a coroutine: let the others on this run loop go first
+void co_yield(void);
+
+// Whether the caller is running as a coroutine
+bool co_active(void);
+
+// Wait for event and return its result. Outside a coroutine this waits
+// the ordinary way, halting between interrupts.
+void co_event_init(co_event_t* event);
+int co_await(co_event_t* event);
+
+// Complete event from any context, resuming its waiter
+void co_complete(co_event_t* event, int result);
+
+// Read or write count sectors through the block layer, waiting as a
+// coroutine; 0 on success, -1 on failure
+int co_blk_io(uint8_t drive, bool write, uint32_t lba, uint32_t count, void* buffer);
+
+void co_get_stats(co_stats_t* stats);
+
+// Shell: coro [bench] - coroutine counters, or time a switch
+void coro_command(int argc, char argv[][64]);
+
+#endif // CORO_H
@@ -0,0 +1,31 @@
+; ClaudeOS Coroutine Switch - Day 21
+; The cheap half of context_switch.asm: a coroutine only ever switches
+; by calling co_switch, so the cdecl caller-saved registers (EAX, ECX,
+; EDX), EFLAGS and the segments are already the caller's problem. Only
+; the callee-saved registers are kept, on the stack being left.
+
+[BITS 32]
+
+global co_switch
+
+section .text
+
+; co_switch(uint32_t* save_esp, uint32_t new_esp)
+; Parameters:
+;   [esp+4] = where to store the current stack pointer
+;   [esp+8] = stack pointer of the context to resume, as saved here
+; The saved context resumes as if co_switch had returned.
+co_switch:
+    mov eax, [esp+4]
+    mov edx, [esp+8]
+    push ebp
+    push ebx
+    push esi
+    push edi
+    mov [eax], esp
+    mov esp, edx
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
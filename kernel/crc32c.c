@@ -0,0 +1,184 @@
+// ClaudeOS CRC32C Implementation - Day 21
+// crc32 takes four bytes at a time but has a three-cycle latency, so one
+// stream leaves two thirds of the unit idle. Buffers are taken three
+// lanes at a time, each with its own register, and the lanes are joined
+// by shifting the earlier ones past CRC32C_LANE zero bytes: a linear map,
+// so four table lookups. crc32 works on general registers only, so none
+// of this touches the FPU/SSE state.
+
+#include "crc32c.h"
+#include "kernel.h"
+#include "timer.h"
+
+static uint32_t crc32c_table[8][256];   // Slicing-by-8: [k][b] is b followed by k zero bytes
+static uint32_t crc32c_shift[4][256];   // One lane of zeros, per byte of the register
+static int crc32c_state = -1;           // -1: not set up, else CPUID.1:ECX.SSE4_2
+
+static void crc32c_setup(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc32c_table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int k = 1; k < 8; k++) {
+            uint32_t prev = crc32c_table[k - 1][i];
+            crc32c_table[k][i] = (prev >> 8) ^ crc32c_table[0][prev & 0xFF];
+        }
+    }
+    
+    // Each register bit pushed through a lane of zeros, then every byte
+    // value as the sum of its bits
+    uint32_t columns[32];
+    for (int bit = 0; bit < 32; bit++) {
+        uint32_t crc = 1u << bit;
+        for (uint32_t n = 0; n < CRC32C_LANE; n++) {
+            crc = (crc >> 8) ^ crc32c_table[0][crc & 0xFF];
+        }
+        columns[bit] = crc;
+    }
+    for (int k = 0; k < 4; k++) {
+        for (uint32_t v = 0; v < 256; v++) {
+            uint32_t sum = 0;
+            for (int bit = 0; bit < 8; bit++) {
+                if (v & (1u << bit)) {
+                    sum ^= columns[k * 8 + bit];
+                }
+            }
+            crc32c_shift[k][v] = sum;
+        }
+    }
+    
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
+    asm volatile ("" : : : "memory");   // Tables before the state another CPU may read
+    crc32c_state = (ecx >> 20) & 1;
+}
+
+static inline uint32_t crc32c_lane_shift(uint32_t crc) {
+    return crc32c_shift[0][crc & 0xFF] ^ crc32c_shift[1][(crc >> 8) & 0xFF] ^
+           crc32c_shift[2][(crc >> 16) & 0xFF] ^ crc32c_shift[3][crc >> 24];
+}
+
+static inline uint32_t crc32c_hw_byte(uint32_t crc, uint8_t value) {
+    asm ("crc32b %1, %0" : "+r" (crc) : "rm" (value));
+    return crc;
+}
+
+static inline uint32_t crc32c_hw_word(uint32_t crc, uint32_t value) {
+    asm ("crc32l %1, %0" : "+r" (crc) : "rm" (value));
+    return crc;
+}
+
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t* p, size_t size) {
+    while (size > 0 && ((uint32_t)p & 3)) {
+        crc = crc32c_hw_byte(crc, *p++);
+        size--;
+    }
+    while (size >= 3 * CRC32C_LANE) {
+        const uint32_t* a = (const uint32_t*)p;
+        const uint32_t* b = a + CRC32C_LANE / 4;
+        const uint32_t* c = b + CRC32C_LANE / 4;
+        uint32_t crc_b = 0;
+        uint32_t crc_c = 0;
+        for (uint32_t i = 0; i < CRC32C_LANE / 4; i++) {
+            crc = crc32c_hw_word(crc, a[i]);
+            crc_b = crc32c_hw_word(crc_b, b[i]);
+            crc_c = crc32c_hw_word(crc_c, c[i]);
+        }
+        crc = crc32c_lane_shift(crc32c_lane_shift(crc) ^ crc_b) ^ crc_c;
+        p += 3 * CRC32C_LANE;
+        size -= 3 * CRC32C_LANE;
+    }
+    while (size >= 4) {
+        crc = crc32c_hw_word(crc, *(const uint32_t*)p);
+        p += 4;
+        size -= 4;
+    }
+    while (size > 0) {
+        crc = crc32c_hw_byte(crc, *p++);
+        size--;
+    }
+    return crc;
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t* p, size_t size) {
+    while (size > 0 && ((uint32_t)p & 3)) {
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xFF];
+        size--;
+    }
+    while (size >= 8) {
+        uint32_t low = *(const uint32_t*)p ^ crc;
+        uint32_t high = *(const uint32_t*)(p + 4);
+        crc = crc32c_table[7][low & 0xFF] ^ crc32c_table[6][(low >> 8) & 0xFF] ^
+              crc32c_table[5][(low >> 16) & 0xFF] ^ crc32c_table[4][low >> 24] ^
+              crc32c_table[3][high & 0xFF] ^ crc32c_table[2][(high >> 8) & 0xFF] ^
+              crc32c_table[1][(high >> 16) & 0xFF] ^ crc32c_table[0][high >> 24];
+        p += 8;
+        size -= 8;
+    }
+    while (size > 0) {
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xFF];
+        size--;
+    }
+    return crc;
+}
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t size) {
+    if (crc32c_state < 0) {
+        crc32c_setup();
+    }
+    const uint8_t* p = (const uint8_t*)data;
+    crc = ~crc;
+    crc = crc32c_state ? crc32c_hw(crc, p, size) : crc32c_sw(crc, p, size);
+    return ~crc;
+}
+
+bool crc32c_hardware(void) {
+    if (crc32c_state < 0) {
+        crc32c_setup();
+    }
+    return crc32c_state != 0;
+}
+
+// Hundredths of a cycle per byte; total stays small enough for * 100
+static void crc32c_bench_print(const char* what, uint32_t cycles, uint32_t total) {
+    uint32_t rate = total ? cycles * 100 / total : 0;
+    terminal_printf("  %s %d.%s%d cycles/byte (%d cycles per block)\n", what,
+                    (int)(rate / 100), rate % 100 < 10 ? "0" : "", (int)(rate % 100),
+                    (int)(cycles / CRC32C_BENCH_ROUNDS));
+}
+
+void crc32c_benchmark(void) {
+    static uint8_t buffer[CRC32C_BENCH_SIZE];
+    for (uint32_t i = 0; i < sizeof(buffer); i++) {
+        buffer[i] = (uint8_t)(i * 7 + 3);
+    }
+    if (!clock_tsc_khz()) {
+        terminal_writestring("  No TSC: cycle counts unavailable\n");
+        return;
+    }
+    bool hardware = crc32c_hardware();
+    uint32_t table = 0, instruction = 0;
+    uint64_t start = clock_cycles();
+    for (int i = 0; i < CRC32C_BENCH_ROUNDS; i++) {
+        table += crc32c_sw(~0u, buffer, sizeof(buffer));
+    }
+    uint32_t table_cycles = (uint32_t)(clock_cycles() - start);
+    uint32_t total = CRC32C_BENCH_ROUNDS * sizeof(buffer);
+    terminal_printf("  CRC32C, %d x %d bytes\n", CRC32C_BENCH_ROUNDS, CRC32C_BENCH_SIZE);
+    crc32c_bench_print("slicing-by-8:   ", table_cycles, total);
+    if (!hardware) {
+        terminal_writestring("  SSE4.2 crc32:    not supported\n");
+        return;
+    }
+    start = clock_cycles();
+    for (int i = 0; i < CRC32C_BENCH_ROUNDS; i++) {
+        instruction += crc32c_hw(~0u, buffer, sizeof(buffer));
+    }
+    uint32_t instruction_cycles = (uint32_t)(clock_cycles() - start);
+    crc32c_bench_print("SSE4.2, 3 lanes:", instruction_cycles, total);
+    terminal_printf("  results %s\n", table == instruction ? "match" : "DIFFER");
+}
@@ -0,0 +1,27 @@
+// ClaudeOS CRC32C - Day 21
+// The Castagnoli CRC (as iSCSI, ext4 and btrfs use it) over byte buffers:
+// the SSE4.2 crc32 instruction when CPUID reports it, slicing-by-8 tables
+// otherwise. Both give the same value.
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include "types.h"
+
+#define CRC32C_POLY     0x82F63B78u     // Reflected
+#define CRC32C_LANE     256             // Bytes per stream in one interleaved round
+
+// Continue crc (0 to start) over size bytes:
+// crc32c(crc32c(0, a, n), b, m) is the CRC of a followed by b, and
+// crc32c(0, "123456789", 9) == 0xE3069283
+uint32_t crc32c(uint32_t crc, const void* data, size_t size);
+
+// Whether the instruction is in use (sets the tables up if need be)
+bool crc32c_hardware(void);
+
+// Time the instruction against the tables over 4KB blocks
+#define CRC32C_BENCH_SIZE       4096
+#define CRC32C_BENCH_ROUNDS     256
+void crc32c_benchmark(void);
+
+#endif // CRC32C_H
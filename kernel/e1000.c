@@ -0,0 +1,484 @@
+// ClaudeOS Intel 8254x (e1000) Driver Implementation - Day 21
+// The IRQ top half only reads ICR; received buffers are lent out by a
+// poll with RX interrupts masked and transmit descriptors are reclaimed
+// a group at a time
+
+#include "e1000.h"
+#include "pci.h"
+#include "pic.h"
+#include "irq.h"
+#include "lock.h"
+#include "kernel.h"
+#include "string.h"
+
+typedef struct {
+    pci_device_t* pci;
+    network_interface_t* iface;
+    bool ready;
+    bool link_up;
+    volatile uint8_t* regs;
+    volatile e1000_rx_desc_t* rx_descs;
+    volatile e1000_tx_desc_t* tx_descs;
+    uint8_t* rx_pool[E1000_RX_BUFFERS];         // Every RX buffer, by index
+    uint32_t rx_pool_phys[E1000_RX_BUFFERS];
+    uint8_t rx_desc_buffer[E1000_RX_DESCS];     // Pool index behind each descriptor
+    uint8_t rx_spare[E1000_RX_BUFFERS];         // Stack of buffers nobody holds
+    uint32_t rx_spare_count;
+    spinlock_t rx_spare_lock;       // Unregistered; consumers return buffers from any context
+    uint8_t* tx_bounce[E1000_TX_DESCS];         // For frames that aren't DMA-able in place
+    uint32_t tx_bounce_phys[E1000_TX_DESCS];
+    network_packet_t* tx_packets[E1000_TX_DESCS];   // Sent in place; freed on reclaim
+    uint32_t rx_next;               // Next descriptor the driver expects back
+    uint32_t tx_tail;               // Descriptors queued (wraps freely)
+    uint32_t tx_clean;              // Descriptors reclaimed
+    spinlock_t tx_lock;             // Unregistered; left zeroed
+    uint32_t irqs;
+    uint32_t rx_batches;            // Softirq passes that found packets
+    uint32_t rx_packets;
+    uint32_t rx_errors;
+    uint32_t rx_starved;            // Frames dropped with every spare lent out
+    uint32_t tx_packets_sent;
+    uint32_t tx_bounced;            // Frames copied to a bounce buffer
+    uint32_t tx_frags;              // Frames sent with a page fragment in place
+    uint32_t tx_reclaims;           // Reclaim passes that freed a group
+    uint32_t tx_full;               // Sends refused on a full ring
+    uint32_t tx_csum_offloaded;     // Frames the NIC checksummed
+    uint32_t rx_csum_offloaded;     // Frames whose TCP/UDP checksum the NIC checked
+} e1000_t;
+
+static e1000_t nic;
+
+static inline uint32_t e1000_read(uint32_t reg) {
+    return *(volatile uint32_t*)(nic.regs + reg);
+}
+
+static inline void e1000_write(uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(nic.regs + reg) = value;
+}
+
+// Map count uncached pages of phys contiguously starting at virt
+static void e1000_map(uint32_t virt, uint32_t phys, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        vmm_map_page(kernel_page_directory, virt + i * PAGE_SIZE, phys + i * PAGE_SIZE,
+                     PAGE_PRESENT | PAGE_WRITABLE | PAGE_NOCACHE | PAGE_GLOBAL);
+    }
+    vmm_invalidate_range(virt, count);
+}
+
+// Map a fresh frame at virt and split it into E1000_BUFFER_SIZE buffers
+static int e1000_alloc_buffers(uint32_t virt, uint8_t** buffers, uint32_t* phys_out, uint32_t count) {
+    for (uint32_t i = 0; i < count; i += E1000_BUFFERS_PER_PAGE) {
+        uint32_t phys = pmm_alloc_page();
+        if (!phys) {
+            return -1;
+        }
+        e1000_map(virt, phys, 1);
+        for (uint32_t j = 0; j < E1000_BUFFERS_PER_PAGE && i + j < count; j++) {
+            buffers[i + j] = (uint8_t*)(virt + j * E1000_BUFFER_SIZE);
+            phys_out[i + j] = phys + j * E1000_BUFFER_SIZE;
+        }
+        virt += PAGE_SIZE;
+    }
+    return 0;
+}
+
+// Descriptor page first, then the RX pool, then the TX bounce buffers;
+// each frame is mapped on its own, so none of them need to be contiguous
+static int e1000_alloc_rings(void) {
+    uint32_t virt = E1000_DMA_VIRT;
+    uint32_t desc_phys = pmm_alloc_page();
+    if (!desc_phys) {
+        return -1;
+    }
+    e1000_map(virt, desc_phys, 1);
+    uint8_t* desc_page = (uint8_t*)virt;
+    for (uint32_t i = 0; i < PAGE_SIZE; i++) {
+        desc_page[i] = 0;
+    }
+    nic.rx_descs = (volatile e1000_rx_desc_t*)desc_page;
+    nic.tx_descs = (volatile e1000_tx_desc_t*)(desc_page + E1000_RX_DESCS * sizeof(e1000_rx_desc_t));
+    virt += PAGE_SIZE;
+
+    if (e1000_alloc_buffers(virt, nic.rx_pool, nic.rx_pool_phys, E1000_RX_BUFFERS) != 0) {
+        return -1;
+    }
+    virt += E1000_RX_BUFFERS / E1000_BUFFERS_PER_PAGE * PAGE_SIZE;
+    if (e1000_alloc_buffers(virt, nic.tx_bounce, nic.tx_bounce_phys, E1000_TX_DESCS) != 0) {
+        return -1;
+    }
+
+    // The first buffers sit behind the descriptors; the rest are spares
+    for (uint32_t i = 0; i < E1000_RX_DESCS; i++) {
+        nic.rx_desc_buffer[i] = i;
+        nic.rx_descs[i].addr_low = nic.rx_pool_phys[i];
+        nic.rx_descs[i].addr_high = 0;
+    }
+    nic.rx_spare_count = 0;
+    for (uint32_t i = E1000_RX_DESCS; i < E1000_RX_BUFFERS; i++) {
+        nic.rx_spare[nic.rx_spare_count++] = i;
+    }
+    return 0;
+}
+
+// EEPROM words 0-2 hold the MAC; without an EEPROM the firmware has
+// already loaded it into receive address 0
+static void e1000_read_mac(uint8_t* mac) {
+    bool eeprom = true;
+    for (uint32_t word = 0; word < 3 && eeprom; word++) {
+        e1000_write(E1000_EERD, (word << 8) | E1000_EERD_START);
+        uint32_t value = 0;
+        int spins = 10000;
+        while (!((value = e1000_read(E1000_EERD)) & E1000_EERD_DONE) && --spins > 0) {
+        }
+        if (spins == 0) {
+            eeprom = false;
+            break;
+        }
+        mac[word * 2] = (value >> 16) & 0xFF;
+        mac[word * 2 + 1] = value >> 24;
+    }
+    if (!eeprom) {
+        uint32_t low = e1000_read(E1000_RAL0);
+        uint32_t high = e1000_read(E1000_RAH0);
+        for (int i = 0; i < 4; i++) {
+            mac[i] = (low >> (i * 8)) & 0xFF;
+        }
+        mac[4] = high & 0xFF;
+        mac[5] = (high >> 8) & 0xFF;
+    }
+}
+
+// Free whole RS groups the hardware has finished with (tx_lock held).
+// Only the last descriptor of a group reports DD, so one read per group.
+static void e1000_tx_reclaim(void) {
+    while (nic.tx_tail - nic.tx_clean >= E1000_TX_RS_INTERVAL) {
+        uint32_t first = nic.tx_clean & (E1000_TX_DESCS - 1);
+        if (!(nic.tx_descs[first + E1000_TX_RS_INTERVAL - 1].status & E1000_TXD_DD)) {
+            break;
+        }
+        for (uint32_t i = first; i < first + E1000_TX_RS_INTERVAL; i++) {
+            network_free_packet(nic.tx_packets[i]);
+            nic.tx_packets[i] = NULL;
+        }
+        nic.tx_clean += E1000_TX_RS_INTERVAL;
+        nic.tx_reclaims++;
+    }
+}
+
+// Physical address of a frame if it is contiguous in memory, else 0
+static uint32_t e1000_dma_address(const uint8_t* data, size_t size) {
+    uint32_t virt = (uint32_t)data;
+    uint32_t phys = vmm_get_physical_address(kernel_page_directory, virt);
+    for (uint32_t page = (virt & ~(PAGE_SIZE - 1)) + PAGE_SIZE; phys && page < virt + size;
+         page += PAGE_SIZE) {
+        if (vmm_get_physical_address(kernel_page_directory, page) != phys + (page - virt)) {
+            return 0;
+        }
+    }
+    return phys;
+}
+
+// Fill the legacy descriptor at index for size bytes at phys
+static void e1000_tx_fill(uint32_t index, uint32_t phys, uint32_t size, bool eop, bool csum,
+                          uint32_t csum_start, uint32_t csum_offset) {
+    volatile e1000_tx_desc_t* desc = &nic.tx_descs[index];
+    desc->addr_low = phys;
+    desc->addr_high = 0;
+    desc->length = (uint16_t)size;
+    desc->status = 0;
+    desc->cmd = E1000_TXD_CMD_IFCS | (eop ? E1000_TXD_CMD_EOP : 0);
+    desc->css = 0;
+    desc->cso = 0;
+    if (csum) {
+        // Legacy descriptors finish one checksum: the sum from CSS to the
+        // end of the frame, stored complemented at CSO
+        desc->css = (uint8_t)csum_start;
+        desc->cso = (uint8_t)(csum_start + csum_offset);
+        desc->cmd |= E1000_TXD_CMD_IC;
+    }
+    if ((index & (E1000_TX_RS_INTERVAL - 1)) == E1000_TX_RS_INTERVAL - 1) {
+        desc->cmd |= E1000_TXD_CMD_RS;
+    }
+}
+
+// The descriptor points at the packet's own bytes, and a page fragment
+// gets a second one of its own; the packet is held until the group of
+// its last descriptor is reclaimed. Only frames that straddle
+// discontiguous frames (heap-grown buffers) are copied.
+static int e1000_transmit(network_interface_t* iface, network_packet_t* packet) {
+    (void)iface;
+    size_t total = network_packet_length(packet);
+    if (!nic.ready || total > E1000_BUFFER_SIZE) {
+        network_free_packet(packet);
+        return -1;
+    }
+    uint32_t flags = spin_lock_irqsave(&nic.tx_lock);
+    // Finished groups hold packets, so they are handed back on every send;
+    // TDT == TDH means empty, so one descriptor always stays unused
+    e1000_tx_reclaim();
+    uint32_t needed = packet->frag_frame ? 2 : 1;
+    if (nic.tx_tail - nic.tx_clean + needed > E1000_TX_DESCS - 1) {
+        nic.tx_full++;
+        spin_unlock_irqrestore(&nic.tx_lock, flags);
+        network_free_packet(packet);
+        return -1;
+    }
+
+    uint32_t index = nic.tx_tail & (E1000_TX_DESCS - 1);
+    // Offsets into the frame; the packet may be gone by the time they're used
+    bool csum = (packet->csum & NET_CSUM_PARTIAL) != 0;
+    uint32_t csum_start = packet->csum_start - (uint32_t)(packet->data - packet->head);
+    uint32_t csum_offset = packet->csum_offset;
+    uint32_t phys = e1000_dma_address(packet->data, packet->size);
+    if (phys && packet->frag_frame) {
+        // DD on a group's last descriptor means everything before it is
+        // done too, so the packet waits behind its fragment's descriptor
+        e1000_tx_fill(index, phys, packet->size, false, csum, csum_start, csum_offset);
+        index = (index + 1) & (E1000_TX_DESCS - 1);
+        e1000_tx_fill(index, packet->frag_frame + packet->frag_offset, packet->frag_size, true,
+                      csum, csum_start, csum_offset);
+        nic.tx_packets[index] = packet;
+        nic.tx_tail++;
+        nic.tx_frags++;
+    } else if (phys) {
+        e1000_tx_fill(index, phys, packet->size, true, csum, csum_start, csum_offset);
+        nic.tx_packets[index] = packet;
+    } else {
+        memcpy(nic.tx_bounce[index], packet->data, packet->size);
+        if (packet->frag_frame) {
+            memcpy(nic.tx_bounce[index] + packet->size,
+                   (uint8_t*)PHYS_TO_VIRT(packet->frag_frame) + packet->frag_offset, packet->frag_size);
+        }
+        e1000_tx_fill(index, nic.tx_bounce_phys[index], total, true, csum, csum_start, csum_offset);
+        nic.tx_bounced++;
+        network_free_packet(packet);
+    }
+    if (csum) {
+        nic.tx_csum_offloaded++;
+    }
+    nic.tx_tail++;
+    nic.tx_packets_sent++;
+    e1000_write(E1000_TDT, nic.tx_tail & (E1000_TX_DESCS - 1));
+    spin_unlock_irqrestore(&nic.tx_lock, flags);
+    return 0;
+}
+
+// Last reference to a received packet dropped: its buffer is a spare again
+static void e1000_rx_release(network_packet_t* packet) {
+    uint32_t index = ((uint32_t)packet->head - (uint32_t)nic.rx_pool[0]) / E1000_BUFFER_SIZE;
+    uint32_t flags = spin_lock_irqsave(&nic.rx_spare_lock);
+    nic.rx_spare[nic.rx_spare_count++] = index;
+    spin_unlock_irqrestore(&nic.rx_spare_lock, flags);
+}
+
+// Poll: lend each completed buffer to the network layer as a packet, put
+// a spare behind its descriptor, and give the batch back to the hardware
+// with a single tail write
+static int e1000_poll(network_interface_t* iface, int budget) {
+    (void)iface;
+    if (!nic.ready) {
+        return 0;
+    }
+    int done = 0;
+    uint32_t last = 0;
+    while (done < budget && (nic.rx_descs[nic.rx_next].status & E1000_RXD_DD)) {
+        volatile e1000_rx_desc_t* desc = &nic.rx_descs[nic.rx_next];
+        // A failed checksum isn't a receive error: the stack checks again
+        // and counts it
+        if ((desc->status & E1000_RXD_EOP) && !(desc->errors & ~E1000_RXD_ERR_CSUM)) {
+            // Errored frames, and frames nobody can take, keep their buffer
+            uint32_t flags = spin_lock_irqsave(&nic.rx_spare_lock);
+            int spare = nic.rx_spare_count > 0 ? nic.rx_spare[--nic.rx_spare_count] : -1;
+            spin_unlock_irqrestore(&nic.rx_spare_lock, flags);
+            network_packet_t* packet = NULL;
+            if (spare >= 0) {
+                packet = network_attach_packet(nic.rx_pool[nic.rx_desc_buffer[nic.rx_next]],
+                                               E1000_BUFFER_SIZE, desc->length,
+                                               e1000_rx_release, &nic);
+            }
+            if (packet) {
+                if (!(desc->status & E1000_RXD_IXSM)) {
+                    if ((desc->status & E1000_RXD_IPCS) && !(desc->errors & E1000_RXD_ERR_IPE)) {
+                        packet->csum |= NET_CSUM_IP_OK;
+                    }
+                    if ((desc->status & E1000_RXD_TCPCS) && !(desc->errors & E1000_RXD_ERR_TCPE)) {
+                        packet->csum |= NET_CSUM_L4_OK;
+                        nic.rx_csum_offloaded++;
+                    }
+                }
+                nic.rx_desc_buffer[nic.rx_next] = spare;
+                desc->addr_low = nic.rx_pool_phys[spare];
+                network_deliver_packet(nic.iface->id, packet);
+                nic.rx_packets++;
+            } else {
+                if (spare >= 0) {
+                    flags = spin_lock_irqsave(&nic.rx_spare_lock);
+                    nic.rx_spare[nic.rx_spare_count++] = spare;
+                    spin_unlock_irqrestore(&nic.rx_spare_lock, flags);
+                }
+                nic.rx_starved++;
+            }
+        } else {
+            nic.rx_errors++;  // Errored, or spans buffers (never without LPE)
+        }
+        desc->status = 0;
+        last = nic.rx_next;
+        nic.rx_next = (nic.rx_next + 1) & (E1000_RX_DESCS - 1);
+        done++;
+    }
+    if (done > 0) {
+        nic.rx_batches++;
+        e1000_write(E1000_RDT, last);
+    }
+    return done;
+}
+
+// Frames that arrive while masked still latch their cause in ICR, so
+// unmasking with frames waiting interrupts straight away and none are
+// left sitting in the ring
+static void e1000_rx_irq(network_interface_t* iface, bool enable) {
+    (void)iface;
+    e1000_write(enable ? E1000_IMS : E1000_IMC, E1000_ICR_RX);
+}
+
+// Top half: reading ICR acknowledges and deasserts the line
+static int e1000_irq(void* ctx) {
+    (void)ctx;
+    uint32_t cause = e1000_read(E1000_ICR);
+    if (!cause) {
+        return IRQ_NONE;    // Another device on a shared line
+    }
+    nic.irqs++;
+    if (cause & E1000_ICR_LSC) {
+        nic.link_up = (e1000_read(E1000_STATUS) & E1000_STATUS_LU) != 0;
+    }
+    if (cause & E1000_ICR_RX) {
+        network_rx_interrupt(nic.iface);
+    }
+    return IRQ_HANDLED;
+}
+
+// Interface open: needs the kernel page directory for the MMIO window
+static int e1000_open(network_interface_t* iface) {
+    if (nic.ready) {
+        return 0;
+    }
+    if (!kernel_page_directory || (nic.pci->bars[0] & PCI_BAR_IO)) {
+        return -1;
+    }
+
+    nic.regs = (volatile uint8_t*)pci_map_bar(nic.pci, 0, E1000_MMIO_VIRT, E1000_MMIO_PAGES);
+    if (!nic.regs) {
+        return -1;
+    }
+    pci_enable_bus_master(nic.pci);
+
+    // Reset with interrupts masked, then force the link up
+    e1000_write(E1000_IMC, 0xFFFFFFFF);
+    e1000_write(E1000_CTRL, e1000_read(E1000_CTRL) | E1000_CTRL_RST);
+    for (int spins = 100000; (e1000_read(E1000_CTRL) & E1000_CTRL_RST) && spins > 0; spins--) {
+    }
+    e1000_write(E1000_IMC, 0xFFFFFFFF);
+    (void)e1000_read(E1000_ICR);
+    e1000_write(E1000_CTRL, e1000_read(E1000_CTRL) | E1000_CTRL_SLU | E1000_CTRL_ASDE);
+
+    if (e1000_alloc_rings() != 0) {
+        return -1;
+    }
+
+    e1000_read_mac(iface->mac_address);
+    e1000_write(E1000_RAL0, iface->mac_address[0] | (iface->mac_address[1] << 8) |
+                            (iface->mac_address[2] << 16) | ((uint32_t)iface->mac_address[3] << 24));
+    e1000_write(E1000_RAH0, iface->mac_address[4] | (iface->mac_address[5] << 8) | E1000_RAH_AV);
+    for (uint32_t i = 0; i < 128; i++) {
+        e1000_write(E1000_MTA + i * 4, 0);
+    }
+
+    // The hardware owns every RX descriptor but the one at the tail
+    uint32_t desc_phys = vmm_get_physical_address(kernel_page_directory, E1000_DMA_VIRT);
+    e1000_write(E1000_RDBAL, desc_phys);
+    e1000_write(E1000_RDBAH, 0);
+    e1000_write(E1000_RDLEN, E1000_RX_DESCS * sizeof(e1000_rx_desc_t));
+    e1000_write(E1000_RDH, 0);
+    e1000_write(E1000_RDT, E1000_RX_DESCS - 1);
+    nic.rx_next = 0;
+    e1000_write(E1000_RXCSUM, E1000_RXCSUM_IPOFL | E1000_RXCSUM_TUOFL);
+    e1000_write(E1000_RCTL, E1000_RCTL_EN | E1000_RCTL_BAM | E1000_RCTL_SECRC);
+
+    e1000_write(E1000_TDBAL, desc_phys + E1000_RX_DESCS * sizeof(e1000_rx_desc_t));
+    e1000_write(E1000_TDBAH, 0);
+    e1000_write(E1000_TDLEN, E1000_TX_DESCS * sizeof(e1000_tx_desc_t));
+    e1000_write(E1000_TDH, 0);
+    e1000_write(E1000_TDT, 0);
+    nic.tx_tail = 0;
+    nic.tx_clean = 0;
+    e1000_write(E1000_TIPG, E1000_TIPG_DEFAULT);
+    e1000_write(E1000_TCTL, E1000_TCTL_EN | E1000_TCTL_PSP | E1000_TCTL_CT | E1000_TCTL_COLD);
+
+    e1000_write(E1000_ITR, E1000_ITR_DEFAULT);
+    e1000_write(E1000_RDTR, E1000_RDTR_DEFAULT);
+    e1000_write(E1000_RADV, E1000_RADV_DEFAULT);
+
+    nic.iface = iface;
+    iface->features = NET_FEATURE_TX_CSUM | NET_FEATURE_RX_CSUM;
+    nic.link_up = (e1000_read(E1000_STATUS) & E1000_STATUS_LU) != 0;
+    nic.ready = true;
+    // Parts after the 82540 can signal with MSI; the rest share their line
+    if (pci_enable_msi(nic.pci, e1000_irq, NULL) < 0) {
+        pic_route_pci(nic.pci->irq_line);
+        irq_register(nic.pci->irq_line, e1000_irq, NULL);
+    }
+    e1000_write(E1000_IMS, E1000_ICR_RX | E1000_ICR_LSC);
+    return 0;
+}
+
+static int e1000_set_affinity(network_interface_t* iface, uint32_t cpu) {
+    (void)iface;
+    return pci_set_affinity(nic.pci, cpu);
+}
+
+static const net_driver_t e1000_driver = {
+    "e1000",
+    e1000_open,
+    e1000_transmit,
+    e1000_poll,
+    e1000_rx_irq,
+    e1000_set_affinity
+};
+
+int e1000_probe(network_interface_t* iface) {
+    pci_device_t* dev = pci_find_device(E1000_VENDOR_ID, E1000_DEVICE_ID);
+    if (!dev || (nic.pci && nic.iface && nic.iface != iface)) {
+        return -1;
+    }
+    nic.pci = dev;
+    nic.iface = iface;
+    iface->driver = &e1000_driver;
+    iface->driver_data = &nic;
+    return 0;
+}
+
+void e1000_dump_stats(void) {
+    if (!nic.pci) {
+        terminal_writestring("e1000: no device\n");
+        return;
+    }
+    terminal_printf("e1000 (irq %d): %s, link %s\n", nic.pci->irq_line,
+                    nic.ready ? "up" : "down", nic.link_up ? "up" : "down");
+    if (!nic.ready) {
+        return;
+    }
+    terminal_printf("  IRQs: %d  RX: %d packets in %d batches, %d errors, %d starved\n",
+                    (int)nic.irqs, (int)nic.rx_packets, (int)nic.rx_batches, (int)nic.rx_errors,
+                    (int)nic.rx_starved);
+    terminal_printf("  RX buffers lent out: %d/%d\n",
+                    (int)(E1000_RX_BUFFERS - E1000_RX_DESCS - nic.rx_spare_count),
+                    E1000_RX_BUFFERS - E1000_RX_DESCS);
+    terminal_printf("  TX: %d packets (%d bounced, %d with a page fragment), %d descriptors in flight, "
+                    "%d reclaim passes, %d ring full\n",
+                    (int)nic.tx_packets_sent, (int)nic.tx_bounced, (int)nic.tx_frags,
+                    (int)(nic.tx_tail - nic.tx_clean),
+                    (int)nic.tx_reclaims, (int)nic.tx_full);
+    terminal_printf("  Checksum offload: %d TX, %d RX\n",
+                    (int)nic.tx_csum_offloaded, (int)nic.rx_csum_offloaded);
+}
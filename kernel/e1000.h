@@ -0,0 +1,136 @@
+// ClaudeOS Intel 8254x (e1000) Driver - Day 21
+// Descriptor-ring NIC with coalesced RX interrupts and batched TX reclaim
+
+#ifndef E1000_H
+#define E1000_H
+
+#include "types.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "network.h"
+
+#define E1000_VENDOR_ID         0x8086
+#define E1000_DEVICE_ID         0x100E      // 82540EM, what QEMU emulates
+
+// Register offsets (in the memory BAR)
+#define E1000_CTRL              0x0000
+#define E1000_STATUS            0x0008
+#define E1000_EERD              0x0014
+#define E1000_ICR               0x00C0
+#define E1000_ITR               0x00C4
+#define E1000_IMS               0x00D0
+#define E1000_IMC               0x00D8
+#define E1000_RCTL              0x0100
+#define E1000_TCTL              0x0400
+#define E1000_TIPG              0x0410
+#define E1000_RDBAL             0x2800
+#define E1000_RDBAH             0x2804
+#define E1000_RDLEN             0x2808
+#define E1000_RDH               0x2810
+#define E1000_RDT               0x2818
+#define E1000_RDTR              0x2820
+#define E1000_RADV              0x282C
+#define E1000_TDBAL             0x3800
+#define E1000_TDBAH             0x3804
+#define E1000_TDLEN             0x3808
+#define E1000_TDH               0x3810
+#define E1000_TDT               0x3818
+#define E1000_RXCSUM            0x5000
+#define E1000_MTA               0x5200
+#define E1000_RAL0              0x5400
+#define E1000_RAH0              0x5404
+
+// Register bits
+#define E1000_CTRL_ASDE         (1 << 5)
+#define E1000_CTRL_SLU          (1 << 6)
+#define E1000_CTRL_RST          (1 << 26)
+#define E1000_STATUS_LU         (1 << 1)
+#define E1000_EERD_START        (1 << 0)
+#define E1000_EERD_DONE         (1 << 4)
+#define E1000_RAH_AV            (1u << 31)
+#define E1000_RCTL_EN           (1 << 1)
+#define E1000_RCTL_BAM          (1 << 15)   // Accept broadcast
+#define E1000_RCTL_SECRC        (1 << 26)   // Strip the CRC
+#define E1000_TCTL_EN           (1 << 1)
+#define E1000_TCTL_PSP          (1 << 3)    // Pad short packets
+#define E1000_TCTL_CT           (0x10 << 4)
+#define E1000_TCTL_COLD         (0x40 << 12)
+#define E1000_TIPG_DEFAULT      0x0060200A
+#define E1000_RXCSUM_IPOFL      (1 << 8)    // Check IPv4 header checksums
+#define E1000_RXCSUM_TUOFL      (1 << 9)    // Check TCP/UDP checksums
+
+// Interrupt causes
+#define E1000_ICR_LSC           (1 << 2)    // Link status change
+#define E1000_ICR_RXDMT0        (1 << 4)    // RX ring running low
+#define E1000_ICR_RXO           (1 << 6)    // RX overrun
+#define E1000_ICR_RXT0          (1 << 7)    // RX timer (coalesced packets)
+#define E1000_ICR_RX            (E1000_ICR_RXDMT0 | E1000_ICR_RXO | E1000_ICR_RXT0)
+
+// Descriptor bits
+#define E1000_RXD_DD            (1 << 0)
+#define E1000_RXD_EOP           (1 << 1)
+#define E1000_RXD_IXSM          (1 << 2)    // Ignore the checksum bits
+#define E1000_RXD_TCPCS         (1 << 5)    // TCP/UDP checksum checked
+#define E1000_RXD_IPCS          (1 << 6)    // IPv4 checksum checked
+#define E1000_RXD_ERR_TCPE      (1 << 5)
+#define E1000_RXD_ERR_IPE       (1 << 6)
+#define E1000_RXD_ERR_CSUM      (E1000_RXD_ERR_TCPE | E1000_RXD_ERR_IPE)
+#define E1000_TXD_CMD_EOP       (1 << 0)
+#define E1000_TXD_CMD_IFCS      (1 << 1)
+#define E1000_TXD_CMD_IC        (1 << 2)    // Insert a checksum at CSO, summed from CSS
+#define E1000_TXD_CMD_RS        (1 << 3)    // Write back DD when sent
+#define E1000_TXD_DD            (1 << 0)
+
+// Ring geometry (powers of two; 16-byte descriptors, so one page holds both)
+#define E1000_RX_DESCS          32
+#define E1000_TX_DESCS          32
+#define E1000_BUFFER_SIZE       2048        // RCTL.BSIZE default
+#define E1000_BUFFERS_PER_PAGE  (PAGE_SIZE / E1000_BUFFER_SIZE)
+
+// Received buffers are lent to the network layer as they are, so the pool
+// holds spares to refill descriptors while consumers still own packets
+#define E1000_RX_BUFFERS        (E1000_RX_DESCS * 2)
+
+// Only every Nth transmit asks for a status write-back; reclaim frees a
+// whole group of descriptors with one check
+#define E1000_TX_RS_INTERVAL    8
+
+// Interrupt moderation: at most one interrupt per ITR * 256ns (~10k/s),
+// and RX interrupts held back by RDTR (and never past RADV) * 1.024us so
+// a burst of frames is drained in one pass
+#define E1000_ITR_DEFAULT       390
+#define E1000_RDTR_DEFAULT      32
+#define E1000_RADV_DEFAULT      128
+
+// Kernel virtual layout inside the MMIO window
+#define E1000_MMIO_VIRT         (VMM_MMIO_START + 0x10000)
+#define E1000_MMIO_PAGES        32          // 128KB register BAR
+#define E1000_DMA_VIRT          (VMM_MMIO_START + 0x40000)  // Descriptors, RX pool, TX bounce
+
+typedef struct {
+    uint32_t addr_low;
+    uint32_t addr_high;
+    uint16_t length;
+    uint16_t checksum;
+    uint8_t status;
+    uint8_t errors;
+    uint16_t special;
+} __attribute__((packed)) e1000_rx_desc_t;
+
+typedef struct {
+    uint32_t addr_low;
+    uint32_t addr_high;
+    uint16_t length;
+    uint8_t cso;
+    uint8_t cmd;
+    uint8_t status;
+    uint8_t css;
+    uint16_t special;
+} __attribute__((packed)) e1000_tx_desc_t;
+
+// Bind iface to the first e1000 on the PCI bus (-1 if there is none).
+// The hardware is brought up later by the interface's open.
+int e1000_probe(network_interface_t* iface);
+void e1000_dump_stats(void);
+
+#endif // E1000_H
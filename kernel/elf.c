@@ -0,0 +1,190 @@
+// ClaudeOS ELF Loader Implementation - Day 21
+// An image holds the file open for its process's faults. The page with a
+// segment's last file bytes is zeroed past them by the fill; the pages
+// after it are an anonymous area, so BSS never touches the file.
+
+#include "elf.h"
+#include "kernel.h"
+#include "process.h"
+#include "vfs.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "user.h"
+#include "lock.h"
+#include "string.h"
+
+struct elf_image;
+
+typedef struct {
+    struct elf_image* image;
+    uint32_t file_end;                  // File offset the segment's bytes stop at
+} elf_segment_t;
+
+typedef struct elf_image {
+    bool in_use;
+    int owner_pid;
+    vfs_kfile_t file;
+    elf_segment_t segments[ELF_MAX_SEGMENTS];
+} elf_image_t;
+
+static elf_image_t elf_images[ELF_MAX_IMAGES];
+static spinlock_t elf_lock;             // Unregistered; guards in_use
+
+// Fill one page of a segment from the file, zeroing what lies past it
+static int elf_fill(vm_area_t* area, uint32_t offset, void* page) {
+    elf_segment_t* segment = (elf_segment_t*)area->backing;
+    uint32_t length = 0;
+    if (offset < segment->file_end) {
+        length = segment->file_end - offset;
+        if (length > PAGE_SIZE) {
+            length = PAGE_SIZE;
+        }
+        int result = vfs_kread(&segment->image->file, page, length, offset);
+        if (result < 0) {
+            return -1;
+        }
+        length = (uint32_t)result;
+    }
+    memset((uint8_t*)page + length, 0, PAGE_SIZE - length);
+    return 0;
+}
+
+static elf_image_t* elf_image_alloc(int pid) {
+    elf_image_t* image = NULL;
+    uint32_t flags = spin_lock_irqsave(&elf_lock);
+    for (int i = 0; i < ELF_MAX_IMAGES; i++) {
+        if (!elf_images[i].in_use) {
+            image = &elf_images[i];
+            image->in_use = true;
+            image->owner_pid = pid;
+            image->file.mount = NULL;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&elf_lock, flags);
+    return image;
+}
+
+static void elf_image_free(elf_image_t* image) {
+    vfs_kclose(&image->file);
+    uint32_t flags = spin_lock_irqsave(&elf_lock);
+    image->in_use = false;
+    spin_unlock_irqrestore(&elf_lock, flags);
+}
+
+static int elf_check_header(const elf32_header_t* header) {
+    if (header->magic != ELF_MAGIC || header->class != ELF_CLASS_32 ||
+        header->data != ELF_DATA_LSB || header->version != ELF_VERSION_CURRENT ||
+        header->type != ELF_TYPE_EXEC || header->machine != ELF_MACHINE_386 ||
+        header->phentsize != sizeof(elf32_phdr_t) ||
+        header->phnum == 0 || header->phnum > ELF_MAX_PHDRS) {
+        return ELF_ERROR_FORMAT;
+    }
+    return ELF_SUCCESS;
+}
+
+// A loadable segment has to fit between the null page and the guard page
+// under the user stack, and come from inside the file
+static int elf_check_segment(const elf32_phdr_t* phdr, uint32_t file_size) {
+    uint32_t end = phdr->vaddr + phdr->memsz;
+    if (phdr->memsz == 0 || phdr->filesz > phdr->memsz || end < phdr->vaddr ||
+        phdr->vaddr < VMM_USER_SPACE_START || end > USER_STACK_BOTTOM - PAGE_SIZE ||
+        (phdr->vaddr & (PAGE_SIZE - 1)) != (phdr->offset & (PAGE_SIZE - 1)) ||
+        phdr->offset + phdr->filesz < phdr->offset || phdr->offset + phdr->filesz > file_size) {
+        return ELF_ERROR_FORMAT;
+    }
+    return ELF_SUCCESS;
+}
+
+// Register one segment: file pages, then the demand-zero rest
+static int elf_add_segment(vm_space_t* space, elf_segment_t* segment, const elf32_phdr_t* phdr) {
+    uint32_t flags = VMA_USER | VMA_READ | ((phdr->flags & ELF_PF_W) ? VMA_WRITE : 0);
+    uint32_t start = PAGE_FLOOR(phdr->vaddr);
+    uint32_t file_pages_end = PAGE_ALIGN(phdr->vaddr + phdr->filesz);
+    uint32_t end = PAGE_ALIGN(phdr->vaddr + phdr->memsz);
+
+    if (phdr->filesz > 0) {
+        segment->file_end = phdr->offset + phdr->filesz;
+        if (!vmm_add_file_area(space, start, file_pages_end - start, flags, elf_fill, segment,
+                               phdr->offset - (phdr->vaddr - start))) {
+            return ELF_ERROR_NO_SPACE;  // Or overlaps another segment's page
+        }
+        start = file_pages_end;
+    }
+    if (end > start && !vmm_add_area(space, start, end - start, flags)) {
+        return ELF_ERROR_NO_SPACE;
+    }
+    return ELF_SUCCESS;
+}
+
+static int elf_load_segments(elf_image_t* image, vm_space_t* space, uint32_t* entry) {
+    elf32_header_t header;
+    elf32_phdr_t phdrs[ELF_MAX_PHDRS];
+    int file_size = vfs_ksize(&image->file);
+    if (file_size < 0 || vfs_kread(&image->file, &header, sizeof(header), 0) != (int)sizeof(header)) {
+        return ELF_ERROR_IO;
+    }
+    if (elf_check_header(&header) != ELF_SUCCESS) {
+        return ELF_ERROR_FORMAT;
+    }
+    uint32_t table_size = header.phnum * sizeof(elf32_phdr_t);
+    if (vfs_kread(&image->file, phdrs, table_size, header.phoff) != (int)table_size) {
+        return ELF_ERROR_IO;
+    }
+
+    uint32_t loaded = 0;
+    bool entry_found = false;
+    for (uint32_t i = 0; i < header.phnum; i++) {
+        const elf32_phdr_t* phdr = &phdrs[i];
+        if (phdr->type == ELF_PT_INTERP) {
+            return ELF_ERROR_FORMAT;    // Dynamically linked
+        }
+        if (phdr->type != ELF_PT_LOAD) {
+            continue;
+        }
+        if (loaded == ELF_MAX_SEGMENTS || elf_check_segment(phdr, (uint32_t)file_size) != ELF_SUCCESS) {
+            return ELF_ERROR_FORMAT;
+        }
+        elf_segment_t* segment = &image->segments[loaded++];
+        segment->image = image;
+        int result = elf_add_segment(space, segment, phdr);
+        if (result != ELF_SUCCESS) {
+            return result;
+        }
+        if ((phdr->flags & ELF_PF_X) && header.entry >= phdr->vaddr &&
+            header.entry < phdr->vaddr + phdr->memsz) {
+            entry_found = true;
+        }
+    }
+    if (!entry_found) {
+        return ELF_ERROR_FORMAT;
+    }
+    *entry = header.entry;
+    return ELF_SUCCESS;
+}
+
+int elf_load(process_t* process, const char* path, uint32_t* entry) {
+    vm_space_t* space = &process->vm_space;
+    if (!space->dir || space->areas) {
+        return ELF_ERROR_NO_SPACE;
+    }
+    elf_image_t* image = elf_image_alloc(process->pid);
+    if (!image) {
+        return ELF_ERROR_NO_SPACE;
+    }
+    int result = vfs_kopen(path, &image->file) < 0 ? ELF_ERROR_IO
+                                                   : elf_load_segments(image, space, entry);
+    if (result != ELF_SUCCESS) {
+        vmm_release_areas(space);       // Nothing was faulted in yet
+        elf_image_free(image);
+    }
+    return result;
+}
+
+void elf_release_owned(process_t* process) {
+    for (int i = 0; i < ELF_MAX_IMAGES; i++) {
+        if (elf_images[i].in_use && elf_images[i].owner_pid == process->pid) {
+            elf_image_free(&elf_images[i]);
+        }
+    }
+}
@@ -0,0 +1,80 @@
+// ClaudeOS ELF Loader - Day 21
+// Static ELF32 executables for ring 3. Loading reads only the headers:
+// each PT_LOAD segment becomes an area of the process's address space,
+// file-backed up to its file size and demand-zero beyond, and pages are
+// read from the file the first time the program touches them.
+
+#ifndef ELF_H
+#define ELF_H
+
+#include "types.h"
+
+#define ELF_MAX_IMAGES      8           // Processes running a loaded file at once
+#define ELF_MAX_SEGMENTS    4           // PT_LOAD segments per image
+#define ELF_MAX_PHDRS       16          // Program headers read from one file
+
+// e_ident
+#define ELF_MAGIC           0x464C457F  // "\x7FELF", little-endian
+#define ELF_CLASS_32        1
+#define ELF_DATA_LSB        1
+#define ELF_VERSION_CURRENT 1
+
+#define ELF_TYPE_EXEC       2
+#define ELF_MACHINE_386     3
+
+#define ELF_PT_LOAD         1
+#define ELF_PT_INTERP       3
+
+#define ELF_PF_X            0x1
+#define ELF_PF_W            0x2
+#define ELF_PF_R            0x4
+
+// Results
+#define ELF_SUCCESS         0
+#define ELF_ERROR_IO        -1          // Missing or unreadable file
+#define ELF_ERROR_FORMAT    -2          // Not a static i386 executable we can place
+#define ELF_ERROR_NO_SPACE  -3          // Out of image slots or area descriptors
+
+typedef struct {
+    uint32_t magic;
+    uint8_t class;
+    uint8_t data;
+    uint8_t ident_version;
+    uint8_t ident_pad[9];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint32_t entry;
+    uint32_t phoff;
+    uint32_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+} __attribute__((packed)) elf32_header_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t offset;
+    uint32_t vaddr;
+    uint32_t paddr;
+    uint32_t filesz;
+    uint32_t memsz;
+    uint32_t flags;
+    uint32_t align;
+} __attribute__((packed)) elf32_phdr_t;
+
+struct process;
+
+// Register path's segments in process's address space (own directory,
+// nothing mapped yet) and return its entry point. The file stays open
+// until the process is cleaned up.
+int elf_load(struct process* process, const char* path, uint32_t* entry);
+
+// Close a terminated process's image (from cleanup)
+void elf_release_owned(struct process* process);
+
+#endif // ELF_H
@@ -5,35 +5,117 @@
 MULTIBOOT_MAGIC     equ 0x1BADB002
 MULTIBOOT_PAGE_ALIGN equ 1 << 0
 MULTIBOOT_MEMORY_INFO equ 1 << 1
+MULTIBOOT_VIDEO_MODE equ 1 << 2
+%ifdef CONSOLE_FB
+MULTIBOOT_FLAGS     equ MULTIBOOT_PAGE_ALIGN | MULTIBOOT_MEMORY_INFO | MULTIBOOT_VIDEO_MODE
+%else
 MULTIBOOT_FLAGS     equ MULTIBOOT_PAGE_ALIGN | MULTIBOOT_MEMORY_INFO
+%endif
 MULTIBOOT_CHECKSUM  equ -(MULTIBOOT_MAGIC + MULTIBOOT_FLAGS)
 
+; The kernel runs at KERNEL_VIRT_BASE + its load address (kernel/pmm.h)
+KERNEL_VIRT_BASE    equ 0xC0000000
+KERNEL_PDE          equ KERNEL_VIRT_BASE >> 22
+BOOT_PAGE_FLAGS     equ 0x003           ; Present, writable
+
 section .multiboot
 align 4
     dd MULTIBOOT_MAGIC
     dd MULTIBOOT_FLAGS
     dd MULTIBOOT_CHECKSUM
+%ifdef CONSOLE_FB
+    ; Address fields (unused without the a.out kludge), then the preferred
+    ; mode: linear graphics, 1024x768x32 - kernel/fbcon.c
+    dd 0, 0, 0, 0, 0
+    dd 0, 1024, 768, 32
+%endif
 
-section .text
+; Linked at its load address: paging is still off, so every symbol from
+; the rest of the kernel is reached at its address minus KERNEL_VIRT_BASE
+section .boot
 global _start
+global boot_tsc_entry
 extern kernel_main
 
 _start:
+    ; Latch the TSC before anything else runs, where CPUID reports one
+    ; (kernel/bootchart.c); cpuid clobbers the Multiboot registers
+    mov esi, eax
+    mov edi, ebx
+    mov eax, 1
+    cpuid
+    test edx, 1 << 4
+    jz .no_tsc
+    rdtsc
+    mov [boot_tsc_entry - KERNEL_VIRT_BASE], eax
+    mov [boot_tsc_entry - KERNEL_VIRT_BASE + 4], edx
+.no_tsc:
+
+    ; One page table covering the first 4MB
+    mov edx, boot_page_table - KERNEL_VIRT_BASE
+    xor ecx, ecx
+.fill:
+    mov eax, ecx
+    shl eax, 12
+    or eax, BOOT_PAGE_FLAGS
+    mov [edx + ecx * 4], eax
+    inc ecx
+    cmp ecx, 1024
+    jne .fill
+
+    ; Mapped at 0, so this code keeps running once paging is on, and at
+    ; KERNEL_VIRT_BASE, where the kernel is linked
+    or edx, BOOT_PAGE_FLAGS
+    mov [boot_page_directory - KERNEL_VIRT_BASE], edx
+    mov [boot_page_directory - KERNEL_VIRT_BASE + KERNEL_PDE * 4], edx
+    mov eax, boot_page_directory - KERNEL_VIRT_BASE
+    mov cr3, eax
+    mov eax, cr0
+    or eax, 0x80010000      ; PG, and WP so kernel stores honour read-only pages
+    mov cr0, eax
+
+    ; An absolute jump - a relative one would stay in low memory
+    mov eax, higher_half
+    jmp eax
+
+section .text
+higher_half:
+    ; The low mapping was only needed for the jump; vmm_init replaces the
+    ; boot directory with the master before anything else maps a page
+    mov dword [boot_page_directory], 0
+    mov eax, cr3
+    mov cr3, eax
+
     ; Set up stack
     mov esp, stack_top
-    
+
+    ; Pass the Multiboot info pointer (ebx) and magic (eax) to the kernel;
+    ; the pointer is still physical
+    push edi
+    push esi
+
     ; Call the main kernel function
     call kernel_main
-    
+
     ; If kernel_main returns, halt
 .hang:
     hlt
     jmp .hang
 
-section .bss
+section .data
+align 4
+boot_tsc_entry:
+    dd 0, 0
+
+section .bss align=4096
+; Zeroed by the loader: every other PDE starts out not present
+boot_page_directory:
+    resb 4096
+boot_page_table:
+    resb 4096
 stack_bottom:
     resb 16384  ; 16 KiB stack
 stack_top:
 
 ; GNU stack note section (prevents executable stack warning)
-section .note.GNU-stack noalloc noexec nowrite progbits
\ No newline at end of file
+section .note.GNU-stack noalloc noexec nowrite progbits
@@ -0,0 +1,293 @@
+// ClaudeOS Framebuffer Console Implementation - Day 21
+// Drawing and flushing may come from any CPU (the timer softirq flushes
+// too), so both run under one lock with interrupts off.
+
+#include "fbcon.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "lock.h"
+#include "kernel.h"
+#include "string.h"
+
+#define FBCON_CELL_NONE     0xFFFFFFFF  // Cache entry: not drawn yet
+#define FBCON_CURSOR_FIRST  14          // Cursor: an underline over the last two scanlines
+
+bool fbcon_active = false;
+
+// What the loader described, saved by fbcon_probe
+static multiboot_info_t fbcon_boot;
+static bool fbcon_found = false;
+
+static uint32_t* fb_screen;             // The mapped framebuffer
+static uint32_t* fb_back;               // RAM copy, width pixels a scanline
+static uint32_t fb_width, fb_height;
+static uint32_t fb_pitch;               // Bytes per framebuffer scanline
+static uint32_t fb_back_phys, fb_back_pages;
+static uint32_t fb_columns, fb_rows;
+static spinlock_t fbcon_lock;
+
+// VGA's 16 colors in the framebuffer's pixel format
+static uint32_t fbcon_palette[16];
+
+// Each glyph's scanlines for every cell value's character, and every
+// scanline byte spread to eight pixel masks, so a cell is drawn as
+// bg ^ (mask & (fg ^ bg)) a pixel at a time with no branch per bit
+static uint8_t fbcon_glyphs[256][FBCON_GLYPH_HEIGHT];
+static uint32_t fbcon_masks[256][FBCON_GLYPH_WIDTH];
+
+// The cell each position of the back buffer shows
+static uint32_t fbcon_cells[FBCON_MAX_COLUMNS * FBCON_MAX_ROWS];
+
+// Cells changed since the last flush: [dirty_x0, dirty_x1) x [dirty_y0, dirty_y1)
+static uint32_t dirty_x0, dirty_y0, dirty_x1, dirty_y1;
+
+// The cell showing the cursor, and whether its underline is in the back buffer
+static uint32_t cursor_x, cursor_y;
+static bool cursor_drawn = false;
+
+static const uint8_t vga_rgb[16][3] = {
+    {0x00, 0x00, 0x00}, {0x00, 0x00, 0xAA}, {0x00, 0xAA, 0x00}, {0x00, 0xAA, 0xAA},
+    {0xAA, 0x00, 0x00}, {0xAA, 0x00, 0xAA}, {0xAA, 0x55, 0x00}, {0xAA, 0xAA, 0xAA},
+    {0x55, 0x55, 0x55}, {0x55, 0x55, 0xFF}, {0x55, 0xFF, 0x55}, {0x55, 0xFF, 0xFF},
+    {0xFF, 0x55, 0x55}, {0xFF, 0x55, 0xFF}, {0xFF, 0xFF, 0x55}, {0xFF, 0xFF, 0xFF},
+};
+
+static inline uint32_t fbcon_channel(uint8_t value, uint8_t position, uint8_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    if (size > 8) {
+        size = 8;
+    }
+    return ((uint32_t)value >> (8 - size)) << position;
+}
+
+void fbcon_probe(const multiboot_info_t* mbi) {
+    if (!(mbi->flags & MULTIBOOT_INFO_FRAMEBUFFER)) {
+        return;
+    }
+    fbcon_boot = *mbi;
+    fbcon_found = true;
+}
+
+uint32_t fbcon_columns(void) {
+    return fb_columns;
+}
+
+uint32_t fbcon_rows(void) {
+    return fb_rows;
+}
+
+static void fbcon_prepare_glyphs(void) {
+    for (uint32_t byte = 0; byte < 256; byte++) {
+        for (uint32_t bit = 0; bit < FBCON_GLYPH_WIDTH; bit++) {
+            fbcon_masks[byte][bit] = (byte & (0x80 >> bit)) ? 0xFFFFFFFF : 0;
+        }
+    }
+    // Control characters draw blank, anything above ASCII as a box
+    for (uint32_t c = 0; c < 256; c++) {
+        uint8_t* rows = fbcon_glyphs[c];
+        if (c >= FBCON_FONT_FIRST && c < FBCON_FONT_FIRST + FBCON_FONT_GLYPHS) {
+            memcpy(rows, fbcon_font[c - FBCON_FONT_FIRST], FBCON_GLYPH_HEIGHT);
+        } else if (c >= 0x80) {
+            for (uint32_t y = 0; y < FBCON_GLYPH_HEIGHT; y++) {
+                rows[y] = (y == 2 || y == 13) ? 0x7C : (y > 2 && y < 13) ? 0x44 : 0;
+            }
+        } else {
+            memset(rows, 0, FBCON_GLYPH_HEIGHT);
+        }
+    }
+}
+
+int fbcon_init(void) {
+    const multiboot_info_t* info = &fbcon_boot;
+    if (!fbcon_found || info->framebuffer_type != MULTIBOOT_FRAMEBUFFER_RGB ||
+        info->framebuffer_bpp != 32 || (info->framebuffer_addr >> 32) != 0) {
+        return -1;
+    }
+    fb_width = info->framebuffer_width;
+    fb_height = info->framebuffer_height;
+    fb_pitch = info->framebuffer_pitch;
+    fb_columns = fb_width / FBCON_GLYPH_WIDTH;
+    fb_rows = fb_height / FBCON_GLYPH_HEIGHT;
+    if (fb_columns == 0 || fb_rows == 0 || fb_pitch < fb_width * 4) {
+        return -1;
+    }
+    if (fb_columns > FBCON_MAX_COLUMNS) {
+        fb_columns = FBCON_MAX_COLUMNS;
+    }
+    if (fb_rows > FBCON_MAX_ROWS) {
+        fb_rows = FBCON_MAX_ROWS;
+    }
+
+    // The screen, then the back buffer, both in the framebuffer window
+    uint32_t phys = (uint32_t)info->framebuffer_addr;
+    uint32_t offset = phys & (PAGE_SIZE - 1);
+    uint32_t screen_pages = (offset + fb_pitch * fb_height + PAGE_SIZE - 1) / PAGE_SIZE;
+    fb_back_pages = (fb_width * fb_height * 4 + PAGE_SIZE - 1) / PAGE_SIZE;
+    if ((screen_pages + fb_back_pages) * PAGE_SIZE > VMM_FB_SIZE) {
+        terminal_printf("FB: %dx%d does not fit the framebuffer window\n", (int)fb_width,
+                        (int)fb_height);
+        return -1;
+    }
+    fb_back_phys = pmm_alloc_pages(fb_back_pages, 1);
+    if (!fb_back_phys) {
+        terminal_writestring("FB: No memory for the back buffer\n");
+        return -1;
+    }
+    uint32_t back_virt = VMM_FB_START + screen_pages * PAGE_SIZE;
+    uint32_t cache = vmm_pat_enabled ? PAGE_WRITECOMBINE : PAGE_NOCACHE;
+    if (vmm_map_range(kernel_page_directory, VMM_FB_START, phys - offset, screen_pages,
+                      PAGE_PRESENT | PAGE_WRITABLE | PAGE_GLOBAL | cache) != 0 ||
+        vmm_map_range(kernel_page_directory, back_virt, fb_back_phys, fb_back_pages,
+                      PAGE_PRESENT | PAGE_WRITABLE | PAGE_GLOBAL) != 0) {
+        pmm_free_pages(fb_back_phys, fb_back_pages);
+        terminal_writestring("FB: Could not map the framebuffer\n");
+        return -1;
+    }
+    fb_screen = (uint32_t*)(VMM_FB_START + offset);
+    fb_back = (uint32_t*)back_virt;
+
+    for (uint32_t i = 0; i < 16; i++) {
+        fbcon_palette[i] = fbcon_channel(vga_rgb[i][0], info->red_position, info->red_size) |
+                           fbcon_channel(vga_rgb[i][1], info->green_position, info->green_size) |
+                           fbcon_channel(vga_rgb[i][2], info->blue_position, info->blue_size);
+    }
+    fbcon_prepare_glyphs();
+
+    // Black everywhere, the strip past the last whole cell included
+    memset(fb_back, 0, fb_width * fb_height * 4);
+    for (uint32_t line = 0; line < fb_height; line++) {
+        memset((uint8_t*)fb_screen + line * fb_pitch, 0, fb_width * 4);
+    }
+    for (uint32_t i = 0; i < fb_columns * fb_rows; i++) {
+        fbcon_cells[i] = FBCON_CELL_NONE;
+    }
+    dirty_x0 = 0;
+    dirty_y0 = 0;
+    dirty_x1 = fb_columns;
+    dirty_y1 = fb_rows;
+    spin_lock_init(&fbcon_lock, "fbcon");
+    fbcon_active = true;
+
+    terminal_printf("FB: %dx%dx32, %dx%d console, %s\n", (int)fb_width, (int)fb_height,
+                    (int)fb_columns, (int)fb_rows, vmm_pat_enabled ? "write-combining" : "uncached");
+    return 0;
+}
+
+static inline void fbcon_mark(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) {
+    if (x0 < dirty_x0) dirty_x0 = x0;
+    if (y0 < dirty_y0) dirty_y0 = y0;
+    if (x1 > dirty_x1) dirty_x1 = x1;
+    if (y1 > dirty_y1) dirty_y1 = y1;
+}
+
+// Render one cell into the back buffer, with the cursor's underline if asked
+static void fbcon_draw_cell(uint32_t x, uint32_t y, uint16_t cell, bool cursor) {
+    const uint8_t* glyph = fbcon_glyphs[cell & 0xFF];
+    uint32_t fg = fbcon_palette[(cell >> 8) & 0x0F];
+    uint32_t bg = fbcon_palette[(cell >> 12) & 0x0F];
+    uint32_t diff = fg ^ bg;
+    uint32_t* dest = fb_back + y * FBCON_GLYPH_HEIGHT * fb_width + x * FBCON_GLYPH_WIDTH;
+    for (uint32_t row = 0; row < FBCON_GLYPH_HEIGHT; row++) {
+        uint8_t bits = (cursor && row >= FBCON_CURSOR_FIRST) ? 0xFF : glyph[row];
+        const uint32_t* mask = fbcon_masks[bits];
+        dest[0] = bg ^ (mask[0] & diff);
+        dest[1] = bg ^ (mask[1] & diff);
+        dest[2] = bg ^ (mask[2] & diff);
+        dest[3] = bg ^ (mask[3] & diff);
+        dest[4] = bg ^ (mask[4] & diff);
+        dest[5] = bg ^ (mask[5] & diff);
+        dest[6] = bg ^ (mask[6] & diff);
+        dest[7] = bg ^ (mask[7] & diff);
+        dest += fb_width;
+    }
+    fbcon_mark(x, y, x + 1, y + 1);
+}
+
+void fbcon_draw_row(uint32_t y, const uint16_t* cells) {
+    if (!fbcon_active || y >= fb_rows) {
+        return;
+    }
+    uint32_t flags = spin_lock_irqsave(&fbcon_lock);
+    uint32_t* drawn = &fbcon_cells[y * fb_columns];
+    for (uint32_t x = 0; x < fb_columns; x++) {
+        if (drawn[x] == cells[x]) {
+            continue;
+        }
+        drawn[x] = cells[x];
+        fbcon_draw_cell(x, y, cells[x], false);
+        if (x == cursor_x && y == cursor_y) {
+            cursor_drawn = false;
+        }
+    }
+    spin_unlock_irqrestore(&fbcon_lock, flags);
+}
+
+void fbcon_scroll(void) {
+    if (!fbcon_active) {
+        return;
+    }
+    uint32_t flags = spin_lock_irqsave(&fbcon_lock);
+    uint32_t row_pixels = FBCON_GLYPH_HEIGHT * fb_width;
+    memmove(fb_back, fb_back + row_pixels, (fb_rows - 1) * row_pixels * 4);
+    memmove(fbcon_cells, &fbcon_cells[fb_columns], (fb_rows - 1) * fb_columns * 4);
+    for (uint32_t x = 0; x < fb_columns; x++) {
+        fbcon_cells[(fb_rows - 1) * fb_columns + x] = FBCON_CELL_NONE;
+    }
+
+    // The underline moved up with its row; the cell is drawn again plain
+    if (cursor_drawn && cursor_y > 0) {
+        fbcon_cells[(cursor_y - 1) * fb_columns + cursor_x] = FBCON_CELL_NONE;
+    }
+    cursor_drawn = false;
+    fbcon_mark(0, 0, fb_columns, fb_rows);
+    spin_unlock_irqrestore(&fbcon_lock, flags);
+}
+
+void fbcon_flush(uint32_t x, uint32_t y) {
+    if (!fbcon_active) {
+        return;
+    }
+    uint32_t flags = spin_lock_irqsave(&fbcon_lock);
+    if (x >= fb_columns) x = fb_columns - 1;
+    if (y >= fb_rows) y = fb_rows - 1;
+
+    if (x != cursor_x || y != cursor_y) {
+        uint32_t old = fbcon_cells[cursor_y * fb_columns + cursor_x];
+        if (cursor_drawn && old != FBCON_CELL_NONE) {
+            fbcon_draw_cell(cursor_x, cursor_y, (uint16_t)old, false);
+        }
+        cursor_x = x;
+        cursor_y = y;
+        cursor_drawn = false;
+    }
+    uint32_t drawn = fbcon_cells[y * fb_columns + x];
+    if (!cursor_drawn && drawn != FBCON_CELL_NONE) {
+        fbcon_draw_cell(x, y, (uint16_t)drawn, true);
+        cursor_drawn = true;
+    }
+
+    // The changed rectangle, a scanline of movsl at a time: the screen is
+    // only ever written, and write-combining turns each run into bursts
+    if (dirty_x0 < dirty_x1) {
+        uint32_t first = dirty_y0 * FBCON_GLYPH_HEIGHT;
+        uint32_t last = dirty_y1 * FBCON_GLYPH_HEIGHT;
+        uint32_t left = dirty_x0 * FBCON_GLYPH_WIDTH;
+        uint32_t width = (dirty_x1 - dirty_x0) * FBCON_GLYPH_WIDTH;
+        for (uint32_t line = first; line < last; line++) {
+            uint32_t src = (uint32_t)(fb_back + line * fb_width + left);
+            uint32_t dest = (uint32_t)fb_screen + line * fb_pitch + left * 4;
+            uint32_t count = width;
+            asm volatile ("rep movsl"
+                          : "+S" (src), "+D" (dest), "+c" (count)
+                          :
+                          : "memory");
+        }
+    }
+    dirty_x0 = fb_columns;
+    dirty_y0 = fb_rows;
+    dirty_x1 = 0;
+    dirty_y1 = 0;
+    spin_unlock_irqrestore(&fbcon_lock, flags);
+}
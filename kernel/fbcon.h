@@ -0,0 +1,49 @@
+// ClaudeOS Framebuffer Console - Day 21
+// The terminal drawn on a linear framebuffer the loader set up (a
+// Multiboot video mode), at 8x16 pixels a cell: 128x48 at 1024x768. The
+// terminal's cell shadow stays the source of truth; the console keeps a
+// copy of what it last drew, renders the cells that differ into a RAM
+// back buffer a 32-bit pixel at a time, and copies only the rectangle
+// that changed to the screen, mapped write-combining. Only 32 bpp RGB
+// modes are driven; otherwise the terminal stays in VGA text mode.
+
+#ifndef FBCON_H
+#define FBCON_H
+
+#include "types.h"
+#include "multiboot.h"
+
+#define FBCON_GLYPH_WIDTH   8
+#define FBCON_GLYPH_HEIGHT  16
+#define FBCON_FONT_FIRST    0x20        // The font covers printable ASCII
+#define FBCON_FONT_GLYPHS   95
+#define FBCON_MAX_COLUMNS   160         // 1280 pixels
+#define FBCON_MAX_ROWS      64          // 1024 pixels
+
+extern const uint8_t fbcon_font[FBCON_FONT_GLYPHS][FBCON_GLYPH_HEIGHT];
+
+// Save the loader's framebuffer description, before the PMM can hand out
+// the memory the info block sits in
+void fbcon_probe(const multiboot_info_t* mbi);
+
+// Map the framebuffer and allocate the back buffer; after vmm_init, and
+// before process page directories copy the kernel's. Returns 0 when the
+// console is drawn on the framebuffer from now on, -1 to stay in text mode.
+int fbcon_init(void);
+
+extern bool fbcon_active;
+
+// Size of the cell grid
+uint32_t fbcon_columns(void);
+uint32_t fbcon_rows(void);
+
+// Render row y of the terminal (VGA-style char | color << 8 cells)
+void fbcon_draw_row(uint32_t y, const uint16_t* cells);
+
+// The terminal moved its cells up a row: move the pixels with them
+void fbcon_scroll(void);
+
+// Copy what changed to the screen, with the cursor at (x, y)
+void fbcon_flush(uint32_t x, uint32_t y);
+
+#endif // FBCON_H
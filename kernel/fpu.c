@@ -0,0 +1,162 @@
+// ClaudeOS FPU/SSE Context Implementation - Day 21
+// The FPU keeps the last user's registers; they are only saved when a
+// different process touches the FPU and traps with #NM
+
+#include "fpu.h"
+#include "process.h"
+#include "heap.h"
+#include "kernel.h"
+
+#define CR0_MP  0x02    // Monitor coprocessor: wait/fwait honour TS
+#define CR0_EM  0x04    // Emulation: must be clear for real FPU/SSE use
+#define CR0_TS  0x08    // Task switched: next FPU instruction raises #NM
+#define CR0_NE  0x20    // Native x87 error reporting
+#define CR4_OSFXSR      0x200   // fxsave/fxrstor and SSE enabled
+#define CR4_OSXMMEXCPT  0x400   // Unmasked SSE exceptions raise #XM
+
+int fpu_lazy_enabled = 0;
+static uint32_t fpu_traps = 0;          // #NM traps taken
+static uint32_t fpu_saves = 0;          // States written back on a trap
+
+// Register image right after fninit, loaded on a process's first FPU use
+static uint8_t fpu_clean_state[FPU_STATE_SIZE] __attribute__((aligned(FPU_STATE_ALIGN)));
+
+static inline void set_ts(void) {
+    uint32_t cr0;
+    asm volatile ("mov %%cr0, %0" : "=r" (cr0));
+    if (!(cr0 & CR0_TS)) {
+        asm volatile ("mov %0, %%cr0" : : "r" (cr0 | CR0_TS));
+    }
+}
+
+static inline void clear_ts(void) {
+    asm volatile ("clts");
+}
+
+// The fxsave area lives in the over-allocated block, rounded up
+static inline uint8_t* state_area(process_t* process) {
+    return (uint8_t*)(((uint32_t)process->fpu_alloc + FPU_STATE_ALIGN - 1) &
+                      ~(FPU_STATE_ALIGN - 1));
+}
+
+// Enable the FPU and SSE; lazy switching needs fxsave (CPUID.1:EDX.FXSR).
+// Every CPU runs this; the shared state is only set up the first time.
+void fpu_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
+    
+    uint32_t cr0;
+    asm volatile ("mov %%cr0, %0" : "=r" (cr0));
+    cr0 = (cr0 & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE;
+    asm volatile ("mov %0, %%cr0" : : "r" (cr0));
+    asm volatile ("fninit");
+    
+    if (!(edx & (1 << 24))) {
+        terminal_writestring("[FPU] No fxsave support - FPU state is shared\n");
+        return;
+    }
+    uint32_t cr4;
+    asm volatile ("mov %%cr4, %0" : "=r" (cr4));
+    cr4 |= CR4_OSFXSR;
+    if (edx & (1 << 25)) {
+        cr4 |= CR4_OSXMMEXCPT;  // SSE present
+    }
+    asm volatile ("mov %0, %%cr4" : : "r" (cr4));
+    fpu_owner = 0;
+    if (fpu_lazy_enabled) {
+        return;
+    }
+    
+    asm volatile ("fxsave (%0)" : : "r" (fpu_clean_state) : "memory");
+    fpu_traps = 0;
+    fpu_saves = 0;
+    fpu_lazy_enabled = 1;
+}
+
+// Give a process a save area, initialized to the clean fninit state
+int fpu_state_alloc(process_t* process) {
+    process->fpu_alloc = 0;
+    process->fpu_used = 0;
+    if (!fpu_lazy_enabled) {
+        return 0;
+    }
+    process->fpu_alloc = kmalloc(FPU_STATE_SIZE + FPU_STATE_ALIGN);
+    return process->fpu_alloc ? 0 : -1;
+}
+
+// Drop a process's FPU state (its registers may still be loaded)
+void fpu_state_free(process_t* process) {
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        if (cpus[i].fpu_loaded == process) {
+            cpus[i].fpu_loaded = 0;
+        }
+    }
+    if (process->fpu_alloc) {
+        kfree(process->fpu_alloc);
+        process->fpu_alloc = 0;
+    }
+    process->fpu_used = 0;
+}
+
+// Called when next is about to run: only the owner may touch the FPU freely
+void fpu_switch(process_t* next) {
+    if (!fpu_lazy_enabled) {
+        return;
+    }
+    if (next == fpu_owner) {
+        clear_ts();
+    } else {
+        set_ts();
+    }
+}
+
+// Called when prev is switched out. With more than one CPU it may resume
+// elsewhere, where this FPU's registers can't be reached - so an owner's
+// state is written back now. Processes that never trapped pay nothing.
+void fpu_switch_out(process_t* prev) {
+    if (!fpu_lazy_enabled || smp_cpu_count < 2 || fpu_owner != prev || !prev->fpu_alloc) {
+        return;
+    }
+    clear_ts();
+    asm volatile ("fxsave (%0)" : : "r" (state_area(prev)) : "memory");
+    prev->fpu_used = 1;
+    fpu_saves++;
+    fpu_owner = 0;
+}
+
+// #NM: save the previous owner's registers and load the current process's.
+// Returns 0 when the faulting instruction can be retried.
+int fpu_handle_nm(void) {
+    if (!fpu_lazy_enabled) {
+        return -1;
+    }
+    clear_ts();
+    fpu_traps++;
+    
+    process_t* process = current_process;
+    if (fpu_owner == process) {
+        return 0;
+    }
+    if (fpu_owner && fpu_owner->fpu_alloc) {
+        asm volatile ("fxsave (%0)" : : "r" (state_area(fpu_owner)) : "memory");
+        fpu_owner->fpu_used = 1;
+        fpu_saves++;
+    }
+    
+    if (process && process->fpu_alloc && process->fpu_used) {
+        asm volatile ("fxrstor (%0)" : : "r" (state_area(process)) : "memory");
+    } else {
+        // First use starts from a clean state, not the last owner's
+        asm volatile ("fxrstor (%0)" : : "r" (fpu_clean_state) : "memory");
+    }
+    fpu_owner = process;
+    return 0;
+}
+
+// Debug function to dump lazy switching statistics
+void fpu_dump_stats(void) {
+    terminal_writestring("FPU Context:\n");
+    terminal_printf("  Lazy switching: %s\n", fpu_lazy_enabled ? "on (fxsave)" : "off");
+    terminal_printf("  Owner PID: %d\n", fpu_owner ? fpu_owner->pid : INVALID_PID);
+    terminal_printf("  #NM traps: %d, states saved: %d\n", (int)fpu_traps, (int)fpu_saves);
+}
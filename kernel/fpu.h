@@ -0,0 +1,29 @@
+// ClaudeOS FPU/SSE Context - Day 21
+// Lazy x87/SSE state switching through CR0.TS and #NM
+
+#ifndef FPU_H
+#define FPU_H
+
+#include "types.h"
+#include "smp.h"
+
+#define FPU_STATE_SIZE  512     // fxsave area
+#define FPU_STATE_ALIGN 16      // fxsave/fxrstor need a 16-byte aligned area
+#define FPU_NM_VECTOR   7       // Device Not Available
+
+struct process;
+
+// FPU functions
+void fpu_init(void);
+int fpu_state_alloc(struct process* process);
+void fpu_state_free(struct process* process);
+void fpu_switch(struct process* next);
+void fpu_switch_out(struct process* prev);
+int fpu_handle_nm(void);
+void fpu_dump_stats(void);
+
+// FPU state (read-only access for external code)
+extern int fpu_lazy_enabled;
+#define fpu_owner (smp_current_cpu()->fpu_loaded)   // Per CPU
+
+#endif // FPU_H
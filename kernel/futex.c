@@ -0,0 +1,162 @@
+// ClaudeOS Futex Implementation - Day 21
+// Hashed wait queues: the slow path of futex_mutex_t and similar locks
+
+#include "futex.h"
+#include "process.h"
+#include "vmm.h"
+#include "lock.h"
+#include "kernel.h"
+
+// A sleeping waiter (lives on the waiting process's stack)
+typedef struct futex_waiter {
+    uint32_t key;                       // Physical address of the word
+    process_t* process;
+    volatile int woken;
+    struct futex_waiter* next;
+} futex_waiter_t;
+
+// Bucket locks are left unnamed, so the `locks` listing isn't flooded
+// with 64 identical entries
+typedef struct {
+    spinlock_t lock;
+    futex_waiter_t* head;               // FIFO
+    futex_waiter_t* tail;
+} futex_bucket_t;
+
+static futex_bucket_t futex_buckets[FUTEX_HASH_BUCKETS];
+static uint32_t futex_waits = 0;
+static uint32_t futex_retries = 0;      // Waits that found the word already changed
+static uint32_t futex_wakes = 0;
+
+static inline futex_bucket_t* futex_bucket(uint32_t key) {
+    // Words in one page differ in the low bits, pages in the high ones
+    return &futex_buckets[((key >> 2) ^ (key >> 12)) & (FUTEX_HASH_BUCKETS - 1)];
+}
+
+// Physical address of a futex word in the caller's address space (0 if
+// it is misaligned or unmapped)
+static uint32_t futex_key(volatile uint32_t* addr) {
+    if (!addr || ((uint32_t)addr & 3)) {
+        return 0;
+    }
+    if (!current_page_directory) {
+        return (uint32_t)addr;  // No master directory yet: one address space
+    }
+    return vmm_get_physical_address(current_page_directory, (uint32_t)addr);
+}
+
+int futex_wait(volatile uint32_t* addr, uint32_t expected) {
+    uint32_t key = futex_key(addr);
+    if (!key) {
+        return -1;
+    }
+    process_t* process = current_process;
+    if (!process || process->pid == KERNEL_PID || !scheduler_preemptive) {
+        __sync_fetch_and_add(&futex_retries, 1);
+        return 1;
+    }
+
+    futex_bucket_t* bucket = futex_bucket(key);
+    uint32_t flags = spin_lock_irqsave(&bucket->lock);
+    // Checked under the bucket lock: a waker changes the word before it
+    // takes the lock, so it either sees this waiter or we see its change
+    if (*addr != expected) {
+        spin_unlock_irqrestore(&bucket->lock, flags);
+        __sync_fetch_and_add(&futex_retries, 1);
+        return 1;
+    }
+    futex_waiter_t waiter;
+    waiter.key = key;
+    waiter.process = process;
+    waiter.woken = 0;
+    waiter.next = NULL;
+    if (bucket->tail) {
+        bucket->tail->next = &waiter;
+    } else {
+        bucket->head = &waiter;
+    }
+    bucket->tail = &waiter;
+    process_prepare_block();
+    futex_waits++;
+    spin_unlock_irqrestore(&bucket->lock, flags);
+
+    process_sleep_while(waiter.woken, 0);
+    return 0;
+}
+
+int futex_wake(volatile uint32_t* addr, int count) {
+    uint32_t key = futex_key(addr);
+    if (!key || count <= 0) {
+        return 0;
+    }
+
+    futex_bucket_t* bucket = futex_bucket(key);
+    int woken = 0;
+    uint32_t flags = spin_lock_irqsave(&bucket->lock);
+    futex_waiter_t* prev = NULL;
+    futex_waiter_t* waiter = bucket->head;
+    while (waiter && woken < count) {
+        futex_waiter_t* next = waiter->next;
+        if (waiter->key != key) {
+            prev = waiter;
+            waiter = next;
+            continue;
+        }
+        if (prev) {
+            prev->next = next;
+        } else {
+            bucket->head = next;
+        }
+        if (bucket->tail == waiter) {
+            bucket->tail = prev;
+        }
+
+        // The waiter's stack frame goes away once it sees woken
+        process_t* process = waiter->process;
+        waiter->woken = 1;
+        process_wake(process);
+        woken++;
+        waiter = next;
+    }
+    futex_wakes += woken;
+    spin_unlock_irqrestore(&bucket->lock, flags);
+    return woken;
+}
+
+void futex_cancel_wait(process_t* process) {
+    for (uint32_t i = 0; i < FUTEX_HASH_BUCKETS; i++) {
+        futex_bucket_t* bucket = &futex_buckets[i];
+        if (!bucket->head) {
+            continue;
+        }
+        uint32_t flags = spin_lock_irqsave(&bucket->lock);
+        futex_waiter_t* prev = NULL;
+        for (futex_waiter_t* w = bucket->head; w; prev = w, w = w->next) {
+            if (w->process != process) {
+                continue;
+            }
+            if (prev) {
+                prev->next = w->next;
+            } else {
+                bucket->head = w->next;
+            }
+            if (bucket->tail == w) {
+                bucket->tail = prev;
+            }
+            spin_unlock_irqrestore(&bucket->lock, flags);
+            return;  // A process waits on one futex at a time
+        }
+        spin_unlock_irqrestore(&bucket->lock, flags);
+    }
+}
+
+void futex_dump_stats(void) {
+    int sleeping = 0;
+    for (uint32_t i = 0; i < FUTEX_HASH_BUCKETS; i++) {
+        for (futex_waiter_t* w = futex_buckets[i].head; w; w = w->next) {
+            sleeping++;
+        }
+    }
+    terminal_printf("Futexes: %d waits, %d retries, %d woken, %d sleeping now\n",
+                    (int)futex_waits, (int)futex_retries, (int)futex_wakes, sleeping);
+}
@@ -0,0 +1,58 @@
+// ClaudeOS Futexes - Day 21
+// Wait queues keyed by physical address, for locks that live in shared memory
+
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include "types.h"
+
+#define FUTEX_HASH_BUCKETS  64          // Power of two
+
+struct process;
+
+// Sleep until futex_wake on the same word, if it still holds expected.
+// The word is identified by its physical address, so processes that map
+// one shared page at different addresses still meet. Returns 0 once
+// woken, 1 if the word had already changed (or the caller can't sleep -
+// the kernel task, or no preemption) so the caller should re-check, and
+// -1 for an unmapped or misaligned address.
+int futex_wait(volatile uint32_t* addr, uint32_t expected);
+
+// Wake up to count waiters on the word; returns how many were woken
+int futex_wake(volatile uint32_t* addr, int count);
+
+// Drop a killed process from any futex queue
+void futex_cancel_wait(struct process* process);
+void futex_dump_stats(void);
+
+// Mutex on one futex word: 0 free, 1 locked, 2 locked with (possible)
+// waiters. Locking and unlocking without contention is a single atomic
+// instruction; only contended operations reach futex_wait/futex_wake.
+typedef struct {
+    volatile uint32_t state;
+} futex_mutex_t;
+
+#define FUTEX_MUTEX_INIT { 0 }
+
+static inline int futex_mutex_trylock(futex_mutex_t* mutex) {
+    return __sync_bool_compare_and_swap(&mutex->state, 0, 1);
+}
+
+static inline void futex_mutex_lock(futex_mutex_t* mutex) {
+    if (__sync_bool_compare_and_swap(&mutex->state, 0, 1)) {
+        return;  // Fast path
+    }
+    // Mark it contended; whoever unlocks then has to wake someone
+    while (__sync_lock_test_and_set(&mutex->state, 2) != 0) {
+        futex_wait(&mutex->state, 2);
+    }
+}
+
+static inline void futex_mutex_unlock(futex_mutex_t* mutex) {
+    if (__sync_fetch_and_sub(&mutex->state, 1) != 1) {
+        mutex->state = 0;
+        futex_wake(&mutex->state, 1);
+    }
+}
+
+#endif // FUTEX_H
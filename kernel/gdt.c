@@ -3,18 +3,21 @@
 
 #include "gdt.h"
 #include "kernel.h"
+#include "smp.h"
 
-#define GDT_ENTRIES 5
+#define GDT_ENTRIES (GDT_TSS_FIRST + SMP_MAX_CPUS)
 
-// GDT entries array
-struct gdt_entry gdt_entries[GDT_ENTRIES];
+// One GDT per CPU; gdt_ptr is the BSP's, which APs start on
+static struct gdt_entry gdt_entries[SMP_MAX_CPUS][GDT_ENTRIES];
+static struct gdt_ptr gdt_cpu_ptrs[SMP_MAX_CPUS];
 struct gdt_ptr gdt_ptr;
 
+static struct tss_entry tss_entries[SMP_MAX_CPUS];
+
+static void gdt_set_entry(struct gdt_entry* entry, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran);
+
 // Initialize GDT
 void gdt_init(void) {
-    gdt_ptr.limit = (sizeof(struct gdt_entry) * GDT_ENTRIES) - 1;
-    gdt_ptr.base = (uint32_t)&gdt_entries;
-
     // Null descriptor (required)
     gdt_set_gate(0, 0, 0, 0, 0);
     
@@ -38,22 +41,60 @@ void gdt_init(void) {
                  GDT_ACCESS_PRESENT | GDT_ACCESS_RING3 | GDT_ACCESS_SYSTEM | GDT_ACCESS_RW, 
                  GDT_GRAN_4K | GDT_GRAN_32BIT | 0x0F);
 
-    // Load the GDT
-    gdt_flush((uint32_t)&gdt_ptr);
+    // One TSS per CPU, since a loaded TSS is marked busy
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        struct tss_entry* tss = &tss_entries[cpu];
+        tss->ss0 = GDT_KERNEL_DATA;
+        tss->iomap_base = sizeof(struct tss_entry);
+        gdt_set_gate(GDT_TSS_FIRST + cpu, (uint32_t)tss, sizeof(struct tss_entry) - 1,
+                     GDT_ACCESS_PRESENT | GDT_ACCESS_RING0 | GDT_ACCESS_TSS, 0);
+    }
+    
+    // Each CPU's per-CPU segment covers its cpu_t and nothing else
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        cpus[cpu].self = &cpus[cpu];
+        gdt_set_entry(&gdt_entries[cpu][GDT_PERCPU], (uint32_t)&cpus[cpu], sizeof(cpu_t) - 1,
+                      GDT_ACCESS_PRESENT | GDT_ACCESS_RING0 | GDT_ACCESS_SYSTEM | GDT_ACCESS_RW,
+                      GDT_GRAN_32BIT);
+        gdt_cpu_ptrs[cpu].limit = sizeof(gdt_entries[cpu]) - 1;
+        gdt_cpu_ptrs[cpu].base = (uint32_t)&gdt_entries[cpu];
+    }
+    gdt_ptr = gdt_cpu_ptrs[0];
+
+    gdt_load_cpu(0);
+}
+
+// esp0 stays 0 until process_activate switches to a process with its own
+// stack, and only those ever run in ring 3
+void gdt_load_cpu(uint32_t cpu) {
+    gdt_flush((uint32_t)&gdt_cpu_ptrs[cpu]);
+    asm volatile ("movw %w0, %%gs" : : "r" (GDT_KERNEL_PERCPU) : "memory");
+    asm volatile ("ltr %w0" : : "r" (GDT_TSS_SELECTOR(cpu)));
+}
+
+void tss_set_kernel_stack(uint32_t esp0) {
+    tss_entries[percpu_read(id)].esp0 = esp0;
 }
 
 // Set a GDT gate/entry
-void gdt_set_gate(int32_t num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
+static void gdt_set_entry(struct gdt_entry* entry, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
     // Base address
-    gdt_entries[num].base_low = (base & 0xFFFF);
-    gdt_entries[num].base_middle = (base >> 16) & 0xFF;
-    gdt_entries[num].base_high = (base >> 24) & 0xFF;
+    entry->base_low = (base & 0xFFFF);
+    entry->base_middle = (base >> 16) & 0xFF;
+    entry->base_high = (base >> 24) & 0xFF;
 
     // Limit
-    gdt_entries[num].limit_low = (limit & 0xFFFF);
-    gdt_entries[num].granularity = (limit >> 16) & 0x0F;
+    entry->limit_low = (limit & 0xFFFF);
+    entry->granularity = (limit >> 16) & 0x0F;
 
     // Granularity and access
-    gdt_entries[num].granularity |= gran & 0xF0;
-    gdt_entries[num].access = access;
-}
\ No newline at end of file
+    entry->granularity |= gran & 0xF0;
+    entry->access = access;
+}
+
+// The same entry in every CPU's GDT
+void gdt_set_gate(int32_t num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        gdt_set_entry(&gdt_entries[cpu][num], base, limit, access, gran);
+    }
+}
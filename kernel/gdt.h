@@ -19,6 +19,35 @@ struct gdt_ptr {
     uint32_t base;           // Address of the first gdt_entry struct
 } __attribute__((packed));
 
+// Task state segment. Only ss0/esp0 are used: the stack the CPU switches
+// to when an interrupt or int 0x80 arrives from ring 3.
+struct tss_entry {
+    uint32_t prev_tss;
+    uint32_t esp0;
+    uint32_t ss0;
+    uint32_t esp1, ss1, esp2, ss2;
+    uint32_t cr3, eip, eflags;
+    uint32_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    uint32_t es, cs, ss, ds, fs, gs;
+    uint32_t ldt;
+    uint16_t trap;
+    uint16_t iomap_base;     // Past the limit: no I/O permission bitmap
+} __attribute__((packed));
+
+// Selectors: kernel segments, user segments (RPL 3), the per-CPU data
+// segment, then one TSS per CPU. Each CPU loads its own copy of the GDT,
+// which differ only in where GDT_KERNEL_PERCPU is based: the kernel keeps
+// it in GS, so the same selector means "this CPU's cpu_t" on every CPU
+// and a saved GS stays right when its task moves to another one.
+#define GDT_KERNEL_CODE      0x08
+#define GDT_KERNEL_DATA      0x10
+#define GDT_USER_CODE        0x1B
+#define GDT_USER_DATA        0x23
+#define GDT_KERNEL_PERCPU    0x28
+#define GDT_PERCPU           5      // Entry of the per-CPU data segment
+#define GDT_TSS_FIRST        6      // Entry of CPU 0's TSS
+#define GDT_TSS_SELECTOR(cpu) ((GDT_TSS_FIRST + (cpu)) * 8)
+
 // GDT Access Byte Flags
 #define GDT_ACCESS_PRESENT    0x80  // Present bit
 #define GDT_ACCESS_RING0      0x00  // Ring 0 (kernel)
@@ -28,6 +57,7 @@ struct gdt_ptr {
 #define GDT_ACCESS_DC         0x04  // Direction/Conforming bit
 #define GDT_ACCESS_RW         0x02  // Read/Write bit
 #define GDT_ACCESS_ACCESSED   0x01  // Accessed bit
+#define GDT_ACCESS_TSS        0x09  // 32-bit available TSS (system type)
 
 // GDT Granularity Byte Flags
 #define GDT_GRAN_4K          0x80   // 4K granularity
@@ -38,6 +68,13 @@ struct gdt_ptr {
 void gdt_init(void);
 void gdt_set_gate(int32_t num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran);
 
+// Load this CPU's GDT, per-CPU segment and TSS (the BSP's from gdt_init,
+// each AP's first thing as it starts)
+void gdt_load_cpu(uint32_t cpu);
+
+// Stack for entries from ring 3 on this CPU
+void tss_set_kernel_stack(uint32_t esp0);
+
 // Assembly function to flush GDT
 extern void gdt_flush(uint32_t);
 
@@ -12,18 +12,75 @@
 #endif
 
 // Heap configuration
-#define HEAP_START          0x400000    // 4MB - start of kernel heap
+#define HEAP_START          0xC0400000  // Just above the 4MB direct map
 #define HEAP_INITIAL_SIZE   0x100000    // 1MB - initial heap size
 #define HEAP_MAX_SIZE       0x800000    // 8MB - maximum heap size
 
+// Size-binned free lists for non-slab allocations
+#define HEAP_FL_SHIFT       4           // Smallest first-level class is 16 bytes
+#define HEAP_FL_COUNT       20          // 16 bytes .. 8MB
+#define HEAP_SL_BITS        2
+#define HEAP_SL_COUNT       (1 << HEAP_SL_BITS)   // Linear sub-bins per power of two
+#define HEAP_BIN_SCAN_LIMIT 8           // Blocks examined for best fit in the request's bin
+
+// Allocation paths, switchable so heap stress can compare them. Frees
+// always go back to the bins, so the heap stays consistent across a switch.
+#define HEAP_POLICY_SLAB        0       // Slabs up to SLAB_MAX_OBJECT, then the bins (default)
+#define HEAP_POLICY_BINS        1       // Size-binned good fit (TLSF) for everything
+#define HEAP_POLICY_FIRST_FIT   2       // Lowest-addressed free block that fits
+#define HEAP_POLICY_COUNT       3
+
 // Block header structure for free list
 typedef struct block_header {
-    size_t size;                    // Size of this block (excluding header)
+    size_t size;                    // Size of this block (excluding header and footer)
     int is_free;                    // 1 if free, 0 if allocated
     struct block_header* next;      // Next block in free list
     struct block_header* prev;      // Previous block in free list
 } block_header_t;
 
+// Boundary tag at the end of every block, so kfree can find the
+// physically preceding block in O(1)
+typedef struct block_footer {
+    size_t size;                    // Copy of the owning block's size
+    uint32_t magic;                 // HEAP_BLOCK_MAGIC (also keeps blocks 8-byte aligned)
+} block_footer_t;
+
+#define HEAP_BLOCK_MAGIC 0xB10CF007
+
+#define BLOCK_OVERHEAD (sizeof(block_header_t) + sizeof(block_footer_t))
+
+// Bump-pointer arenas carved out of the heap. Allocations are never freed
+// individually - the whole arena is reset or destroyed in one call.
+#define HEAP_ARENA_DEFAULT_CHUNK 4096
+
+typedef struct heap_arena_chunk {
+    struct heap_arena_chunk* next;  // Older chunks
+    size_t used;                    // Bytes handed out from data[]
+    size_t capacity;                // Usable bytes in data[]
+    uint32_t reserved;              // Pads the header so data[] stays 8-byte aligned
+} heap_arena_chunk_t;
+
+typedef struct {
+    heap_arena_chunk_t* chunks;     // Current chunk first
+    size_t chunk_size;              // Default chunk allocation size
+    size_t bytes_allocated;         // Bytes handed out since create/reset
+    uint32_t allocations;
+} heap_arena_t;
+
+// Allocation profiler - fixed tables, enabled at runtime with heap_profile_start()
+#define HEAP_PROFILE_SITES      64      // Distinct call sites tracked
+#define HEAP_PROFILE_LIVE       1024    // Live allocations tracked (power of two)
+#define HEAP_PROFILE_BUCKETS    13      // Power-of-two size buckets: <=16 .. >32K
+
+typedef struct {
+    uint32_t site;                  // Return address of the allocating call
+    uint32_t allocs;
+    uint32_t frees;
+    size_t live_bytes;
+    size_t peak_bytes;
+    size_t total_bytes;
+} heap_profile_site_t;
+
 // Heap manager functions
 void heap_init(void);
 void* kmalloc(size_t size);
@@ -31,18 +88,47 @@ void kfree(void* ptr);
 void* krealloc(void* ptr, size_t new_size);
 void* kcalloc(size_t count, size_t size);
 
+// size bytes at a multiple of align (a power of two); freed with kfree.
+// krealloc keeps only the 8-byte alignment.
+void* kmalloc_aligned(size_t size, size_t align);
+
+// One zeroed, page-aligned page, physically contiguous by definition.
+// Usually a direct-map frame with no heap block around it (VIRT_TO_PHYS
+// gives its frame); must go back through kfree_page.
+void* kmalloc_page(void);
+void kfree_page(void* page);
+
+// Arena functions
+heap_arena_t* heap_arena_create(size_t chunk_size);
+void* heap_arena_alloc(heap_arena_t* arena, size_t size);
+void heap_arena_reset(heap_arena_t* arena);
+void heap_arena_destroy(heap_arena_t* arena);
+
+// Profiler functions
+void heap_profile_start(void);
+void heap_profile_stop(void);
+void heap_profile_dump(void);
+
+// Allocation path selection
+void heap_set_policy(int policy);
+int heap_get_policy(void);
+const char* heap_policy_name(int policy);
+
 // Heap statistics and debugging
 size_t heap_get_total_size(void);
 size_t heap_get_used_size(void);
 size_t heap_get_free_size(void);
 void heap_dump_stats(void);
 void heap_dump_blocks(void);
+void heap_free_extents(size_t* free_bytes, size_t* largest);   // Bin heap only, no slabs
 
 // Internal heap management
 int heap_expand(size_t min_size);
-void heap_coalesce_free_blocks(void);
+int heap_coalesce_free_blocks(void);
+bool heap_locked(void);         // Someone holds the heap lock (reclaim must not wait on it)
 
 // Heap state (read-only access for external code)
 extern int heap_initialized;
+extern int heap_profiling;
 
 #endif // HEAP_H
\ No newline at end of file
@@ -0,0 +1,281 @@
+// ClaudeOS Heap Stress Test Implementation - Day 21
+// Live allocations sit in a fixed slot table; each is also linked into
+// the timing-wheel bucket of the step it dies at, so freeing is as cheap
+// as allocating and the trace needs no heap of its own. Only the kmalloc
+// and kfree calls are timed.
+
+#include "heapstress.h"
+#include "heap.h"
+#include "kernel.h"
+#include "timer.h"
+#include "string.h"
+
+#define STRESS_NONE     0xFFFF
+#define STRESS_MAGIC    0x5EEDF00D
+
+typedef struct {
+    uint32_t* ptr;                      // NULL: slot free
+    uint32_t size;
+    uint16_t next;                      // Next slot dying at the same step
+} stress_slot_t;
+
+typedef struct {
+    uint32_t allocs, frees, failed, corrupted;
+    uint64_t alloc_cycles, free_cycles;
+    uint32_t alloc_max, free_max;
+    uint32_t peak_live;                 // Bytes requested and not yet freed
+    size_t free_bytes, largest;         // At the end of the trace, before draining
+    size_t growth;
+} stress_result_t;
+
+static const char* const stress_dist_names[HEAP_STRESS_DISTS] = { "small", "mixed", "large" };
+
+static stress_slot_t stress_slots[HEAP_STRESS_SLOTS];
+static uint16_t stress_wheel[HEAP_STRESS_MAX_LIFE];
+static uint16_t stress_free_slots[HEAP_STRESS_SLOTS];
+static uint32_t stress_state;
+
+static uint32_t stress_random(void) {
+    uint32_t x = stress_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    stress_state = x;
+    return x;
+}
+
+// Uniform in [low, high]
+static uint32_t stress_between(uint32_t low, uint32_t high) {
+    return low + stress_random() % (high - low + 1);
+}
+
+static uint32_t stress_size(int dist) {
+    if (dist == HEAP_STRESS_SMALL) {
+        return stress_between(8, 256);
+    }
+    if (dist == HEAP_STRESS_LARGE) {
+        return stress_between(2048, 32768);
+    }
+    uint32_t pick = stress_random() % 100;
+    if (pick < 70) {
+        return stress_between(16, 128);
+    } else if (pick < 90) {
+        return stress_between(129, 1024);
+    } else if (pick < 98) {
+        return stress_between(1025, 8192);
+    }
+    return stress_between(8193, 65536);
+}
+
+// Mostly short-lived, with a share that stays around for most of the wheel
+static uint32_t stress_lifetime(uint32_t mean) {
+    if (stress_random() % 100 < HEAP_STRESS_LONG_PCT) {
+        return stress_between(mean, HEAP_STRESS_MAX_LIFE - 1);
+    }
+    uint32_t longest = 2 * mean < HEAP_STRESS_MAX_LIFE - 1 ? 2 * mean : HEAP_STRESS_MAX_LIFE - 1;
+    return stress_between(1, longest);
+}
+
+static uint32_t stress_ns(uint32_t cycles) {
+    uint32_t mult;
+    uint64_t base;
+    clock_tsc_params(&mult, &base);
+    uint64_t ns = ((uint64_t)cycles * mult) >> CLOCK_NS_SHIFT;
+    return ns > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)ns;
+}
+
+// Average of a 64-bit total over a 32-bit count, saturating
+static uint32_t stress_average(uint64_t total, uint32_t count) {
+    uint32_t high = (uint32_t)(total >> 32);
+    if (!count || high >= count) {
+        return count ? 0xFFFFFFFF : 0;
+    }
+    uint32_t quotient, remainder;
+    asm ("divl %4" : "=a" (quotient), "=d" (remainder)
+         : "a" ((uint32_t)total), "d" (high), "rm" (count));
+    (void)remainder;
+    return quotient;
+}
+
+static void stress_free(stress_result_t* result, uint16_t slot, uint32_t* live) {
+    stress_slot_t* s = &stress_slots[slot];
+    if (s->ptr[0] != (STRESS_MAGIC ^ slot)) {
+        result->corrupted++;
+    }
+    uint64_t start = clock_cycles();
+    kfree(s->ptr);
+    uint32_t cycles = (uint32_t)(clock_cycles() - start);
+    result->free_cycles += cycles;
+    if (cycles > result->free_max) {
+        result->free_max = cycles;
+    }
+    result->frees++;
+    *live -= s->size;
+    s->ptr = NULL;
+}
+
+static void stress_run(int policy, int dist, uint32_t mean, uint32_t steps, uint32_t seed,
+                       stress_result_t* result) {
+    memset(result, 0, sizeof(*result));
+    memset(stress_slots, 0, sizeof(stress_slots));
+    for (uint32_t i = 0; i < HEAP_STRESS_MAX_LIFE; i++) {
+        stress_wheel[i] = STRESS_NONE;
+    }
+    uint32_t spare = HEAP_STRESS_SLOTS;
+    for (uint32_t i = 0; i < HEAP_STRESS_SLOTS; i++) {
+        stress_free_slots[i] = (uint16_t)(HEAP_STRESS_SLOTS - 1 - i);
+    }
+    stress_state = seed ? seed : HEAP_STRESS_SEED;
+
+    int old_policy = heap_get_policy();
+    heap_set_policy(policy);
+    size_t total_before = heap_get_total_size();
+    uint32_t live = 0;
+
+    for (uint32_t step = 0; step < steps; step++) {
+        uint16_t* bucket = &stress_wheel[step % HEAP_STRESS_MAX_LIFE];
+        while (*bucket != STRESS_NONE) {
+            uint16_t slot = *bucket;
+            *bucket = stress_slots[slot].next;
+            stress_free(result, slot, &live);
+            stress_free_slots[spare++] = slot;
+        }
+
+        // The draws happen whether or not there is room, so every path
+        // sees the same sizes at the same steps
+        uint32_t size = stress_size(dist);
+        uint32_t lifetime = stress_lifetime(mean);
+        if (!spare) {
+            result->failed++;
+            continue;
+        }
+        uint64_t start = clock_cycles();
+        uint32_t* ptr = (uint32_t*)kmalloc(size);
+        uint32_t cycles = (uint32_t)(clock_cycles() - start);
+        result->alloc_cycles += cycles;
+        if (cycles > result->alloc_max) {
+            result->alloc_max = cycles;
+        }
+        result->allocs++;
+        if (!ptr) {
+            result->failed++;
+            continue;
+        }
+        uint16_t slot = stress_free_slots[--spare];
+        ptr[0] = STRESS_MAGIC ^ slot;
+        stress_slot_t* s = &stress_slots[slot];
+        s->ptr = ptr;
+        s->size = size;
+        uint16_t* due = &stress_wheel[(step + lifetime) % HEAP_STRESS_MAX_LIFE];
+        s->next = *due;
+        *due = slot;
+        live += size;
+        if (live > result->peak_live) {
+            result->peak_live = live;
+        }
+    }
+
+    heap_free_extents(&result->free_bytes, &result->largest);
+    for (uint32_t i = 0; i < HEAP_STRESS_SLOTS; i++) {
+        if (stress_slots[i].ptr) {
+            stress_free(result, (uint16_t)i, &live);
+        }
+    }
+    result->growth = heap_get_total_size() - total_before;
+    heap_set_policy(old_policy);
+}
+
+static void stress_report(int policy, const stress_result_t* result) {
+    uint32_t alloc_avg = stress_average(result->alloc_cycles, result->allocs);
+    uint32_t free_avg = stress_average(result->free_cycles, result->frees);
+    uint32_t per_pair = stress_ns(alloc_avg + free_avg);
+    terminal_printf("  %s: %d allocs, %d frees", heap_policy_name(policy), (int)result->allocs,
+                    (int)result->frees);
+    if (result->failed) {
+        terminal_printf(", %d failed", (int)result->failed);
+    }
+    if (result->corrupted) {
+        terminal_printf(", %d CORRUPTED", (int)result->corrupted);
+    }
+    terminal_writestring("\n");
+    terminal_printf("      throughput %d alloc+free pairs/ms; avg %d/%d ns, worst %d/%d ns (alloc/free)\n",
+                    per_pair ? (int)(1000000 / per_pair) : 0, (int)stress_ns(alloc_avg),
+                    (int)stress_ns(free_avg), (int)stress_ns(result->alloc_max),
+                    (int)stress_ns(result->free_max));
+    uint32_t kept = 0;
+    if (result->free_bytes) {
+        // Both in KB first, so the percentage fits in 32 bits
+        uint32_t largest_kb = (uint32_t)(result->largest >> 10);
+        uint32_t free_kb = (uint32_t)(result->free_bytes >> 10);
+        kept = free_kb ? largest_kb * 100 / free_kb : 100;
+    }
+    terminal_printf("      largest free block %d%% of %d KB free; heap grew %d KB (peak live %d KB)\n",
+                    (int)kept, (int)(result->free_bytes >> 10), (int)(result->growth >> 10),
+                    (int)(result->peak_live >> 10));
+}
+
+void heap_stress_command(int argc, char argv[][64]) {
+    if (!heap_initialized) {
+        terminal_writestring("ERROR: Heap not initialized. Run 'heap init' first.\n");
+        return;
+    }
+    int dist = HEAP_STRESS_MIXED;
+    uint32_t mean = HEAP_STRESS_LIFETIME;
+    uint32_t steps = HEAP_STRESS_STEPS;
+    uint32_t seed = HEAP_STRESS_SEED;
+    int only = -1;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            i++;
+            dist = -1;
+            for (int d = 0; d < HEAP_STRESS_DISTS; d++) {
+                if (strcmp(argv[i], stress_dist_names[d]) == 0) {
+                    dist = d;
+                }
+            }
+            if (dist < 0) {
+                terminal_printf("Unknown distribution '%s' (small, mixed, large)\n", argv[i]);
+                return;
+            }
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            int value = atoi(argv[++i]);
+            mean = value < 1 ? 1 : (value >= HEAP_STRESS_MAX_LIFE ? HEAP_STRESS_MAX_LIFE - 1
+                                                                  : (uint32_t)value);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            int value = atoi(argv[++i]);
+            steps = value < 1 ? 1 : (uint32_t)value;
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            seed = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "all") == 0) {
+            only = -1;
+        } else {
+            only = -2;
+            for (int p = 0; p < HEAP_POLICY_COUNT; p++) {
+                if (strcmp(argv[i], heap_policy_name(p)) == 0) {
+                    only = p;
+                }
+            }
+            if (only == -2) {
+                terminal_writestring("Usage: heap stress [slab|tlsf|first-fit|all] [-d small|mixed|large]\n"
+                                     "                   [-l lifetime] [-n steps] [-s seed]\n");
+                return;
+            }
+        }
+    }
+
+    terminal_printf("Heap stress: %d steps, %s sizes, mean lifetime %d steps (%d%% long-lived), seed %d\n",
+                    (int)steps, stress_dist_names[dist], (int)mean, HEAP_STRESS_LONG_PCT, (int)seed);
+    if (!clock_tsc_khz()) {
+        terminal_writestring("  (no TSC: times read as 0)\n");
+    }
+    // The heap never shrinks, so only the first path run starts from a
+    // heap of the size it had before; run one path alone to compare growth
+    static stress_result_t result;
+    for (int p = 0; p < HEAP_POLICY_COUNT; p++) {
+        if (only >= 0 && p != only) {
+            continue;
+        }
+        stress_run(p, dist, mean, steps, seed, &result);
+        stress_report(p, &result);
+    }
+}
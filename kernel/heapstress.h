@@ -0,0 +1,30 @@
+// ClaudeOS Heap Stress Test - Day 21
+// Replays a randomized allocation trace against one or more of the heap's
+// allocation paths: every step frees whatever has reached the end of its
+// lifetime and makes one new allocation. The xorshift generator is seeded
+// from the command line, so the same seed gives the same trace on every
+// path and every boot.
+
+#ifndef HEAPSTRESS_H
+#define HEAPSTRESS_H
+
+#include "types.h"
+
+#define HEAP_STRESS_SLOTS       1024    // Allocations live at once
+#define HEAP_STRESS_MAX_LIFE    1024    // Lifetime cap in steps (the timing wheel's size)
+#define HEAP_STRESS_STEPS       20000   // Default trace length
+#define HEAP_STRESS_LIFETIME    32      // Default mean short lifetime
+#define HEAP_STRESS_LONG_PCT    10      // Allocations that outlive the short ones
+#define HEAP_STRESS_SEED        0x2545F491
+
+// Size distributions
+#define HEAP_STRESS_SMALL       0       // 8-256 bytes
+#define HEAP_STRESS_MIXED       1       // Mostly small, a tail up to 64K
+#define HEAP_STRESS_LARGE       2       // 2K-32K
+#define HEAP_STRESS_DISTS       3
+
+// Shell: heap stress [slab|tlsf|first-fit|all] [-d small|mixed|large]
+//                    [-l lifetime] [-n steps] [-s seed]
+void heap_stress_command(int argc, char argv[][64]);
+
+#endif // HEAPSTRESS_H
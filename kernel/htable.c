@@ -0,0 +1,122 @@
+// ClaudeOS Hash Table Implementation - Day 21
+
+#include "htable.h"
+#include "heap.h"
+
+void htable_init(htable_t* table, htable_node_t** buckets, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        buckets[i] = NULL;
+    }
+    table->buckets = buckets;
+    table->bucket_count = count;
+    table->min_buckets = count;
+    table->initial = buckets;
+    table->count = 0;
+    table->resizes = 0;
+}
+
+// Relink every node into count buckets; the old array stays on failure
+static void htable_resize(htable_t* table, uint32_t count) {
+    htable_node_t** buckets = table->initial;
+    if (count != table->min_buckets) {
+        buckets = (htable_node_t**)kcalloc(count, sizeof(htable_node_t*));
+        if (!buckets) {
+            return;
+        }
+    } else {
+        for (uint32_t i = 0; i < count; i++) {
+            buckets[i] = NULL;
+        }
+    }
+
+    for (uint32_t i = 0; i < table->bucket_count; i++) {
+        htable_node_t* node = table->buckets[i];
+        while (node) {
+            htable_node_t* next = node->next;
+            htable_node_t** head = &buckets[node->hash & (count - 1)];
+            node->next = *head;
+            *head = node;
+            node = next;
+        }
+    }
+    if (table->buckets != table->initial) {
+        kfree(table->buckets);
+    }
+    table->buckets = buckets;
+    table->bucket_count = count;
+    table->resizes++;
+}
+
+void htable_insert(htable_t* table, htable_node_t* node, uint32_t hash) {
+    node->hash = hash;
+    htable_node_t** head = &table->buckets[hash & (table->bucket_count - 1)];
+    node->next = *head;
+    *head = node;
+    if (++table->count > table->bucket_count) {
+        htable_resize(table, table->bucket_count * 2);
+    }
+}
+
+void htable_remove(htable_t* table, htable_node_t* node) {
+    htable_node_t** link = &table->buckets[node->hash & (table->bucket_count - 1)];
+    while (*link && *link != node) {
+        link = &(*link)->next;
+    }
+    if (!*link) {
+        return;  // Not in this table
+    }
+    *link = node->next;
+    node->next = NULL;
+    table->count--;
+    if (table->bucket_count > table->min_buckets && table->count < table->bucket_count / 4) {
+        htable_resize(table, table->bucket_count / 2);
+    }
+}
+
+htable_node_t* htable_first(const htable_t* table, uint32_t hash) {
+    htable_node_t* node = table->buckets[hash & (table->bucket_count - 1)];
+    while (node && node->hash != hash) {
+        node = node->next;
+    }
+    return node;
+}
+
+htable_node_t* htable_next(const htable_node_t* node, uint32_t hash) {
+    htable_node_t* next = node->next;
+    while (next && next->hash != hash) {
+        next = next->next;
+    }
+    return next;
+}
+
+htable_node_t* htable_iterate(const htable_t* table, uint32_t* cursor, htable_node_t* node) {
+    if (node) {
+        if (node->next) {
+            return node->next;
+        }
+        (*cursor)++;
+    }
+    for (; *cursor < table->bucket_count; (*cursor)++) {
+        if (table->buckets[*cursor]) {
+            return table->buckets[*cursor];
+        }
+    }
+    return NULL;
+}
+
+uint32_t htable_hash_bytes(const void* data, size_t length) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+uint32_t htable_hash_string(const char* str) {
+    uint32_t hash = 2166136261u;
+    while (*str) {
+        hash = (hash ^ (uint8_t)*str++) * 16777619u;
+    }
+    return hash;
+}
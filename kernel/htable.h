@@ -0,0 +1,72 @@
+// ClaudeOS Hash Tables - Day 21
+// Intrusive open hashing: the object embeds an htable_node_t and the
+// caller supplies the hash, so one table type serves any key. Each node
+// keeps its full hash, which makes a resize a relink with no rehashing
+// and lets a lookup skip most non-matching nodes without touching the
+// key. The bucket count is a power of two; it doubles once there are more
+// nodes than buckets and halves again below a quarter, never under the
+// size the table started with. A table starts on caller-provided buckets
+// (static ones work before the heap is up); a grow that can't get memory
+// just leaves chains longer. Tables do no locking of their own.
+//
+//   htable_node_t* node;
+//   HTABLE_FOR_EACH_HASH(&table, node, hash) {
+//       conn_t* conn = HTABLE_ENTRY(node, conn_t, hash_node);
+//       if (conn->key == key) ...
+//   }
+
+#ifndef HTABLE_H
+#define HTABLE_H
+
+#include "types.h"
+
+typedef struct htable_node {
+    struct htable_node* next;
+    uint32_t hash;
+} htable_node_t;
+
+typedef struct {
+    htable_node_t** buckets;
+    uint32_t bucket_count;              // Power of two
+    uint32_t min_buckets;               // The caller's initial array, never shrunk below
+    htable_node_t** initial;            // That array, reused when shrinking back to it
+    uint32_t count;
+    uint32_t resizes;
+} htable_t;
+
+#define HTABLE_ENTRY(node, type, member) \
+    ((type*)((uint8_t*)(node) - __builtin_offsetof(type, member)))
+
+#define HTABLE_FOR_EACH_HASH(table, node, hash) \
+    for ((node) = htable_first((table), (hash)); (node); (node) = htable_next((node), (hash)))
+
+// buckets holds count (a power of two) entries; it is cleared here
+void htable_init(htable_t* table, htable_node_t** buckets, uint32_t count);
+void htable_insert(htable_t* table, htable_node_t* node, uint32_t hash);
+void htable_remove(htable_t* table, htable_node_t* node);
+
+// First node with this hash, and the next one after node
+htable_node_t* htable_first(const htable_t* table, uint32_t hash);
+htable_node_t* htable_next(const htable_node_t* node, uint32_t hash);
+
+// Every node, in no particular order; *cursor starts at 0
+htable_node_t* htable_iterate(const htable_t* table, uint32_t* cursor, htable_node_t* node);
+
+// Hashes to build keys from
+static inline uint32_t htable_hash32(uint32_t key) {
+    key ^= key >> 16;
+    key *= 0x7FEB352Du;
+    key ^= key >> 15;
+    key *= 0x846CA68Bu;
+    key ^= key >> 16;
+    return key;
+}
+
+static inline uint32_t htable_hash_combine(uint32_t hash, uint32_t key) {
+    return htable_hash32(hash ^ (key + 0x9E3779B9u + (hash << 6) + (hash >> 2)));
+}
+
+uint32_t htable_hash_bytes(const void* data, size_t length);   // FNV-1a
+uint32_t htable_hash_string(const char* str);
+
+#endif // HTABLE_H
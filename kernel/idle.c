@@ -0,0 +1,108 @@
+// ClaudeOS Idle Implementation - Day 21
+// The waiter arms the monitor before it says it is waiting, then looks at
+// its wake word once more with interrupts off: a store lands either
+// before that look or after the monitor is armed, and sti's one
+// instruction shadow covers the mwait (or hlt), so neither a store nor an
+// interrupt slips past. A waker reads the state first, so a busy CPU's
+// line isn't pulled away from it for nothing. The first interrupt to come
+// in ends the idle period, so handlers (and whatever the CPU switches to
+// from one) are not counted as idle.
+
+#include "idle.h"
+#include "smp.h"
+#include "timer.h"
+#include "rcu.h"
+
+#define IDLE_RUNNING    0
+#define IDLE_HALT       1
+#define IDLE_MWAIT      2
+
+// A cache line per CPU: the wake word is all the monitor watches
+typedef struct {
+    volatile uint32_t wake;             // Stored to by idle_wake
+    volatile uint32_t state;            // IDLE_*
+    uint64_t since;                     // clock_ns the wait began, 0 outside one
+    idle_stats_t stats;
+} __attribute__((aligned(64))) idle_cpu_t;
+
+static idle_cpu_t idle_cpus[SMP_MAX_CPUS];
+static int idle_mwait_state = -1;       // -1: not checked yet, else CPUID.1:ECX.MONITOR
+
+bool idle_mwait(void) {
+    if (idle_mwait_state < 0) {
+        uint32_t eax, ebx, ecx, edx;
+        asm volatile ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (0));
+        uint32_t max_leaf = eax;
+        asm volatile ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
+        idle_mwait_state = max_leaf >= 5 && ((ecx >> 3) & 1);
+    }
+    return idle_mwait_state;
+}
+
+static void idle_end(idle_cpu_t* idle) {
+    if (idle->since) {
+        idle->stats.idle_ns += clock_ns() - idle->since;
+        idle->since = 0;
+        rcu_idle_exit();
+    }
+}
+
+void idle_irq_enter(void) {
+    idle_cpu_t* idle = &idle_cpus[smp_current_cpu()->id];
+    if (idle->since) {
+        idle_end(idle);
+        idle->state = IDLE_RUNNING;     // The handler may switch to a task
+    }
+}
+
+bool cpu_idle(void) {
+    asm volatile ("cli");
+    idle_cpu_t* idle = &idle_cpus[smp_current_cpu()->id];
+    bool mwait = idle_mwait();
+    idle->stats.entries++;
+    if (mwait) {
+        idle->wake = 0;
+        asm volatile ("monitor" : : "a" (&idle->wake), "c" (0), "d" (0) : "memory");
+        idle->state = IDLE_MWAIT;
+        __sync_synchronize();
+    } else {
+        idle->state = IDLE_HALT;
+    }
+    idle->since = clock_ns();
+    rcu_idle_enter();
+    if (!mwait) {
+        asm volatile ("sti; hlt" : : : "memory");
+    } else if (!idle->wake) {
+        asm volatile ("sti; mwait" : : "a" (0), "c" (0) : "memory");  // Hint 0: C1
+    }
+
+    asm volatile ("cli");
+    idle_end(idle);
+    idle->state = IDLE_RUNNING;
+    bool woken = mwait && idle->wake;
+    if (woken) {
+        idle->stats.store_wakes++;
+    }
+    asm volatile ("sti");
+    return woken;
+}
+
+void idle_wake(uint32_t cpu) {
+    if (cpu < SMP_MAX_CPUS && idle_cpus[cpu].state == IDLE_MWAIT && !idle_cpus[cpu].wake) {
+        idle_cpus[cpu].wake = 1;
+    }
+}
+
+void idle_wake_any(void) {
+    uint32_t self = smp_current_cpu()->id;
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        if (i != self && cpus[i].online && idle_cpus[i].state == IDLE_MWAIT) {
+            idle_wake(i);
+            return;
+        }
+    }
+}
+
+void idle_get_stats(uint32_t cpu, idle_stats_t* stats) {
+    *stats = idle_cpus[cpu < SMP_MAX_CPUS ? cpu : 0].stats;
+}
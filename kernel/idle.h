@@ -0,0 +1,37 @@
+// ClaudeOS Idle - Day 21
+// Where a CPU waits for work. With MONITOR/MWAIT it sleeps watching its own
+// wake word, so another CPU that queues work for it wakes it with a store
+// rather than an IPI (and a hypervisor sees a vCPU that asked to sleep);
+// without them it halts until the next interrupt, as before. Each CPU's
+// time in here is counted for top.
+
+#ifndef IDLE_H
+#define IDLE_H
+
+#include "types.h"
+
+// Per-CPU idle counters
+typedef struct {
+    uint64_t idle_ns;                   // clock_ns spent waiting (interrupts taken meanwhile included)
+    uint32_t entries;                   // Waits
+    uint32_t store_wakes;               // Ended by idle_wake's store
+} idle_stats_t;
+
+// Wait with interrupts enabled until one arrives or idle_wake(this CPU);
+// returns with them enabled, true if it was the wake. Callable with
+// interrupts either way.
+bool cpu_idle(void);
+
+// Bring cpu out of cpu_idle to look at its queue, if it waits on MWAIT
+// there; a halted CPU finds the work at its next interrupt
+void idle_wake(uint32_t cpu);
+// The same for some idle CPU other than this one, to steal new work
+void idle_wake_any(void);
+
+// First thing in irq_handler: an interrupt ends the idle period
+void idle_irq_enter(void);
+
+bool idle_mwait(void);                  // MONITOR/MWAIT in use
+void idle_get_stats(uint32_t cpu, idle_stats_t* stats);
+
+#endif // IDLE_H
@@ -81,6 +81,18 @@ extern void irq12(void);  // Mouse
 extern void irq13(void);  // FPU
 extern void irq14(void);  // ATA 1
 extern void irq15(void);  // ATA 2
+extern void irq16(void);  // Local APIC timer
+extern void irq17(void);  // Local APIC spurious
+extern void irq18(void);  // TLB shootdown IPI
+extern void irq19(void);  // Scheduler yield
+extern void irq20(void);  // MSI
+extern void irq21(void);  // MSI
+extern void irq22(void);  // MSI
+extern void irq23(void);  // MSI
+extern void irq24(void);  // MSI
+extern void irq25(void);  // MSI
+extern void irq26(void);  // MSI
+extern void irq27(void);  // MSI
 
 // System call handler
 extern void syscall_interrupt_handler(void);  // System calls (INT 0x80)
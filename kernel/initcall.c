@@ -0,0 +1,169 @@
+// ClaudeOS Initcalls Implementation - Day 21
+// An initcall's index is its position in the linker's .initcalls table,
+// and its state lives in a parallel array. Initcalls run on the shell's
+// CPU only (at boot, from a shell command or from the idle loop), so the
+// state needs no lock; a call still marked running when it is asked for
+// again is a dependency cycle. Ring 3 code reaches subsystems through
+// system calls rather than the shell, so the shell finishes every lazy
+// call before it starts a user program.
+
+#include "initcall.h"
+#include "kernel.h"
+#include "timer.h"
+#include "bootchart.h"
+#include "string.h"
+
+#define INITCALL_PENDING    0
+#define INITCALL_RUNNING    1
+#define INITCALL_DONE       2
+#define INITCALL_FAILED     3           // A dependency is missing or circular
+
+// How a call came to run, for the report
+#define INITCALL_BY_BOOT    0
+#define INITCALL_BY_USE     1
+#define INITCALL_BY_IDLE    2
+
+extern const initcall_t _initcalls_start[];
+extern const initcall_t _initcalls_end[];
+
+typedef struct {
+    uint8_t state;
+    uint8_t started_by;
+    uint32_t ns;                        // Its own time, dependencies not included
+} initcall_state_t;
+
+static initcall_state_t initcall_states[INITCALL_MAX];
+
+static const char* const initcall_how[] = { "boot", "first use", "idle" };
+
+static uint32_t initcall_count(void) {
+    uint32_t count = (uint32_t)(_initcalls_end - _initcalls_start);
+    return count < INITCALL_MAX ? count : INITCALL_MAX;
+}
+
+static int initcall_find(const char* name) {
+    for (uint32_t i = 0; i < initcall_count(); i++) {
+        if (strcmp(_initcalls_start[i].name, name) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+// Nanoseconds between two TSC readings, saturating at 32 bits
+static uint32_t initcall_delta_ns(uint64_t from, uint64_t to) {
+    uint32_t mult;
+    uint64_t base;
+    clock_tsc_params(&mult, &base);
+    uint64_t cycles = to - from;
+    if (cycles > 0xFFFFFFFF) {
+        cycles = 0xFFFFFFFF;
+    }
+    uint64_t ns = ((uint64_t)(uint32_t)cycles * mult) >> CLOCK_NS_SHIFT;
+    return ns > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)ns;
+}
+
+static int initcall_run(uint32_t index, uint8_t started_by) {
+    initcall_state_t* state = &initcall_states[index];
+    const initcall_t* call = &_initcalls_start[index];
+    if (state->state == INITCALL_DONE) {
+        return 0;
+    }
+    if (state->state == INITCALL_FAILED) {
+        return -1;
+    }
+    if (state->state == INITCALL_RUNNING) {
+        terminal_printf("initcall: %s depends on itself\n", call->name);
+        return -1;
+    }
+    state->state = INITCALL_RUNNING;
+    for (int d = 0; d < INITCALL_MAX_DEPS && call->deps[d]; d++) {
+        int dep = initcall_find(call->deps[d]);
+        if (dep < 0 || initcall_run((uint32_t)dep, started_by) < 0) {
+            terminal_printf("initcall: %s needs %s, which can't be started\n", call->name,
+                            call->deps[d]);
+            state->state = INITCALL_FAILED;
+            return -1;
+        }
+    }
+    uint64_t start = clock_cycles();
+    call->init();
+    state->ns = initcall_delta_ns(start, clock_cycles());
+    state->started_by = started_by;
+    state->state = INITCALL_DONE;
+    if (started_by == INITCALL_BY_BOOT) {
+        boot_phase(call->name);
+    }
+    return 1;
+}
+
+void initcall_run_eager(bool all) {
+    for (uint32_t i = 0; i < initcall_count(); i++) {
+        if (all || _initcalls_start[i].when == INIT_EAGER) {
+            initcall_run(i, INITCALL_BY_BOOT);
+        }
+    }
+}
+
+int initcall_require(const char* name) {
+    int index = initcall_find(name);
+    if (index < 0) {
+        return -1;
+    }
+    if (initcall_states[index].state == INITCALL_DONE) {
+        return 0;                       // The common case, kept cheap
+    }
+    return initcall_run((uint32_t)index, INITCALL_BY_USE);
+}
+
+bool initcall_lazy_pending(void) {
+    for (uint32_t i = 0; i < initcall_count(); i++) {
+        if (initcall_states[i].state == INITCALL_PENDING) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool initcall_idle(void) {
+    for (uint32_t i = 0; i < initcall_count(); i++) {
+        if (initcall_states[i].state == INITCALL_PENDING) {
+            initcall_run(i, INITCALL_BY_IDLE);      // Done or failed, it's no longer waiting
+            return true;
+        }
+    }
+    return false;
+}
+
+void initcall_finish(void) {
+    while (initcall_idle()) {
+    }
+}
+
+void initcall_command(int argc, char argv[][64]) {
+    (void)argv;
+    if (argc > 1) {
+        terminal_writestring("Usage: initcalls\n");
+        return;
+    }
+    uint32_t total = (uint32_t)(_initcalls_end - _initcalls_start);
+    if (total > INITCALL_MAX) {
+        terminal_printf("initcalls: %d defined, only the first %d can run\n", (int)total,
+                        INITCALL_MAX);
+    }
+    terminal_writestring("  NAME        WHEN   STATE    STARTED BY  US      NEEDS\n");
+    for (uint32_t i = 0; i < initcall_count(); i++) {
+        const initcall_t* call = &_initcalls_start[i];
+        const initcall_state_t* state = &initcall_states[i];
+        bool done = state->state == INITCALL_DONE;
+        terminal_printf("  %s  %s  %s  %s  %d ", call->name,
+                        call->when == INIT_EAGER ? "eager" : "lazy",
+                        done ? "done" : state->state == INITCALL_FAILED ? "failed" : "waiting",
+                        done ? initcall_how[state->started_by] : "-",
+                        done ? (int)(state->ns / 1000) : 0);
+        for (int d = 0; d < INITCALL_MAX_DEPS && call->deps[d]; d++) {
+            terminal_printf(" %s", call->deps[d]);
+        }
+        terminal_writestring("\n");
+    }
+}
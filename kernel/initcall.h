@@ -0,0 +1,53 @@
+// ClaudeOS Initcalls - Day 21
+// Subsystems declare how they start with INITCALL next to their init
+// function, naming the initcalls that must have run first. The linker
+// gathers the descriptors into one table. kernel_main runs the eager ones
+// before the prompt; a lazy one runs the first time something asks for
+// it with initcall_require, or from the shell's idle loop once the prompt
+// is up, whichever comes first. Dependencies always run before the call
+// that needs them, and nothing runs twice.
+
+#ifndef INITCALL_H
+#define INITCALL_H
+
+#include "types.h"
+
+#define INITCALL_MAX        32          // Descriptors the state table has room for
+#define INITCALL_MAX_DEPS   4
+
+#define INIT_EAGER          0           // Before the prompt
+#define INIT_LAZY           1           // On first use, or when the shell is idle
+
+typedef struct {
+    const char* name;
+    void (*init)(void);
+    uint32_t when;
+    const char* deps[INITCALL_MAX_DEPS];    // Initcall names; the rest NULL
+} initcall_t;
+
+#define INITCALL(var, name, init, when, ...) \
+    static const initcall_t var __attribute__((section(".initcalls"), used, aligned(4))) = \
+        { name, init, when, { __VA_ARGS__ } }
+
+// Run every eager initcall, and with all set the lazy ones too, marking
+// each as a boot phase
+void initcall_run_eager(bool all);
+
+// Make sure name has run, with its dependencies: 1 if it ran just now,
+// 0 if it already had, -1 if there is no such initcall or a dependency
+// is missing or circular
+int initcall_require(const char* name);
+
+// A lazy initcall is still waiting
+bool initcall_lazy_pending(void);
+
+// Run the next waiting lazy initcall, if any; true if one was tried
+bool initcall_idle(void);
+
+// Run every lazy initcall still waiting
+void initcall_finish(void);
+
+// Shell: initcalls - each one's state, how it was started and its time
+void initcall_command(int argc, char argv[][64]);
+
+#endif // INITCALL_H
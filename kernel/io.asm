@@ -5,6 +5,8 @@ global outb
 global inb
 global outw
 global inw
+global outl
+global inl
 global io_wait
 
 ; Write byte to I/O port
@@ -37,6 +39,21 @@ inw:
     in ax, dx            ; Input data from port
     ret
 
+; Write dword to I/O port
+; void outl(uint16_t port, uint32_t data)
+outl:
+    mov eax, [esp + 8]   ; Get data (second parameter)
+    mov dx, [esp + 4]    ; Get port (first parameter)
+    out dx, eax          ; Output data to port
+    ret
+
+; Read dword from I/O port
+; uint32_t inl(uint16_t port)
+inl:
+    mov dx, [esp + 4]    ; Get port (first parameter)
+    in eax, dx           ; Input data from port
+    ret
+
 ; I/O wait function (small delay for older hardware)
 ; void io_wait(void)
 io_wait:
@@ -0,0 +1,275 @@
+// ClaudeOS I/O APIC Implementation - Day 21
+// ISA line n arrives at the global system interrupt the MADT's overrides
+// name (n itself without one; on PCs IRQ0 is usually GSI 2) with the
+// polarity and trigger mode given there. PCI INTx lines take the same
+// numbers as the 8259 saw them; the true pins would need the AML _PRT.
+
+#include "ioapic.h"
+#include "acpi.h"
+#include "pic.h"
+#include "smp.h"
+#include "lock.h"
+#include "pmm.h"
+#include "kernel.h"
+
+#define MADT_LOCAL_APIC         0
+#define MADT_IO_APIC            1
+#define MADT_OVERRIDE           2
+#define MADT_CPU_ENABLED        0x1
+
+// Override flags: polarity in bits 0-1, trigger mode in bits 2-3
+#define MADT_POLARITY_LOW       0x3
+#define MADT_TRIGGER_LEVEL      0x3
+
+// The IMCR, on boards that route the 8259 straight to the BSP
+#define IMCR_SELECT             0x22
+#define IMCR_DATA               0x23
+
+typedef struct {
+    acpi_header_t header;
+    uint32_t lapic_address;
+    uint32_t flags;
+} __attribute__((packed)) madt_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed)) madt_entry_t;
+
+typedef struct {
+    madt_entry_t entry;
+    uint8_t acpi_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} __attribute__((packed)) madt_lapic_t;
+
+typedef struct {
+    madt_entry_t entry;
+    uint8_t id;
+    uint8_t reserved;
+    uint32_t address;
+    uint32_t gsi_base;
+} __attribute__((packed)) madt_ioapic_t;
+
+typedef struct {
+    madt_entry_t entry;
+    uint8_t bus;                        // 0: ISA
+    uint8_t source;                     // ISA IRQ
+    uint32_t gsi;
+    uint16_t flags;
+} __attribute__((packed)) madt_override_t;
+
+typedef struct {
+    volatile uint32_t* regs;
+    uint32_t gsi_base;
+    uint32_t count;                     // Redirection entries
+    uint8_t id;
+} ioapic_t;
+
+typedef struct {
+    uint32_t gsi;
+    uint16_t flags;                     // MADT override flags (0: bus default)
+    bool pci;                           // Installed as a PCI line: level, active low by default
+    bool masked;
+    uint8_t cpu;                        // cpus[] index it is delivered to
+} ioapic_line_t;
+
+int ioapic_active = 0;
+
+static ioapic_t ioapics[IOAPIC_MAX];
+static uint32_t ioapic_count = 0;
+static ioapic_line_t ioapic_lines[IOAPIC_IRQS];
+static uint32_t madt_cpus = 0;
+static spinlock_t ioapic_lock;          // The select/window pair is not atomic
+
+static uint32_t ioapic_read(ioapic_t* ioapic, uint32_t reg) {
+    ioapic->regs[IOAPIC_REGSEL / 4] = reg;
+    return ioapic->regs[IOAPIC_WINDOW / 4];
+}
+
+static void ioapic_write(ioapic_t* ioapic, uint32_t reg, uint32_t value) {
+    ioapic->regs[IOAPIC_REGSEL / 4] = reg;
+    ioapic->regs[IOAPIC_WINDOW / 4] = value;
+}
+
+static ioapic_t* ioapic_for(uint32_t gsi) {
+    for (uint32_t i = 0; i < ioapic_count; i++) {
+        if (gsi >= ioapics[i].gsi_base && gsi < ioapics[i].gsi_base + ioapics[i].count) {
+            return &ioapics[i];
+        }
+    }
+    return NULL;
+}
+
+static bool ioapic_line_level(const ioapic_line_t* line) {
+    uint32_t trigger = (line->flags >> 2) & 3;
+    return trigger == MADT_TRIGGER_LEVEL || (trigger == 0 && line->pci);
+}
+
+static bool ioapic_line_low(const ioapic_line_t* line) {
+    uint32_t polarity = line->flags & 3;
+    return polarity == MADT_POLARITY_LOW || (polarity == 0 && line->pci);
+}
+
+// Write irq's redirection entry from its line state (ioapic_lock held)
+static void ioapic_program(uint8_t irq) {
+    ioapic_line_t* line = &ioapic_lines[irq];
+    ioapic_t* ioapic = ioapic_for(line->gsi);
+    if (!ioapic) {
+        return;
+    }
+    uint32_t low = 32 + irq;            // Fixed delivery, physical destination
+    if (ioapic_line_low(line)) {
+        low |= IOAPIC_ACTIVE_LOW;
+    }
+    if (ioapic_line_level(line)) {
+        low |= IOAPIC_LEVEL;
+    }
+    if (line->masked) {
+        low |= IOAPIC_MASKED;
+    }
+    uint32_t reg = IOAPIC_REG_REDIR + 2 * (line->gsi - ioapic->gsi_base);
+    ioapic_write(ioapic, reg, IOAPIC_MASKED);
+    ioapic_write(ioapic, reg + 1, cpus[line->cpu].apic_id << 24);
+    ioapic_write(ioapic, reg, low);
+}
+
+// Record the I/O APICs and ISA overrides the MADT lists
+static int ioapic_parse_madt(void) {
+    const madt_t* madt = (const madt_t*)acpi_find_table("APIC");
+    if (!madt) {
+        return -1;
+    }
+    const uint8_t* entry = (const uint8_t*)(madt + 1);
+    const uint8_t* end = (const uint8_t*)madt + madt->header.length;
+    while (entry + sizeof(madt_entry_t) <= end) {
+        const madt_entry_t* header = (const madt_entry_t*)entry;
+        if (header->length < sizeof(madt_entry_t) || entry + header->length > end) {
+            break;
+        }
+        if (header->type == MADT_LOCAL_APIC && header->length >= sizeof(madt_lapic_t)) {
+            if (((const madt_lapic_t*)entry)->flags & MADT_CPU_ENABLED) {
+                madt_cpus++;
+            }
+        } else if (header->type == MADT_IO_APIC && header->length >= sizeof(madt_ioapic_t) &&
+                   ioapic_count < IOAPIC_MAX) {
+            const madt_ioapic_t* info = (const madt_ioapic_t*)entry;
+            ioapic_t* ioapic = &ioapics[ioapic_count];
+            uint32_t virt = IOAPIC_VIRT + ioapic_count * PAGE_SIZE;
+            vmm_map_page(kernel_page_directory, virt, info->address & ~(PAGE_SIZE - 1),
+                         PAGE_PRESENT | PAGE_WRITABLE | PAGE_NOCACHE | PAGE_GLOBAL);
+            ioapic->regs = (volatile uint32_t*)(virt + (info->address & (PAGE_SIZE - 1)));
+            ioapic->gsi_base = info->gsi_base;
+            ioapic->id = info->id;
+            ioapic->count = ((ioapic_read(ioapic, IOAPIC_REG_VERSION) >> 16) & 0xFF) + 1;
+            ioapic_count++;
+        } else if (header->type == MADT_OVERRIDE && header->length >= sizeof(madt_override_t)) {
+            const madt_override_t* info = (const madt_override_t*)entry;
+            if (info->bus == 0 && info->source < IOAPIC_IRQS) {
+                ioapic_lines[info->source].gsi = info->gsi;
+                ioapic_lines[info->source].flags = info->flags;
+            }
+        }
+        entry += header->length;
+    }
+    return ioapic_count ? 0 : -1;
+}
+
+int ioapic_init(void) {
+    if (ioapic_active) {
+        return 0;
+    }
+    for (uint8_t irq = 0; irq < IOAPIC_IRQS; irq++) {
+        ioapic_lines[irq].gsi = irq;
+        ioapic_lines[irq].flags = 0;
+        ioapic_lines[irq].pci = false;
+        ioapic_lines[irq].cpu = 0;
+    }
+    if (ioapic_parse_madt() != 0) {
+        terminal_writestring("[APIC] No I/O APIC in the MADT - keeping the 8259 PIC\n");
+        return -1;
+    }
+
+    spin_lock_init(&ioapic_lock, "ioapic");
+    uint32_t flags = spin_lock_irqsave(&ioapic_lock);
+    for (uint32_t i = 0; i < ioapic_count; i++) {
+        for (uint32_t pin = 0; pin < ioapics[i].count; pin++) {
+            ioapic_write(&ioapics[i], IOAPIC_REG_REDIR + 2 * pin, IOAPIC_MASKED);
+        }
+    }
+
+    // Every line keeps the mask it had on the 8259; IRQ2 was only the cascade
+    uint16_t pic_masks = inb(PIC1_DATA) | (inb(PIC2_DATA) << 8);
+    for (uint8_t irq = 0; irq < IOAPIC_IRQS; irq++) {
+        ioapic_lines[irq].masked = (pic_masks >> irq) & 1;
+        if (irq != IRQ2_CASCADE) {
+            ioapic_program(irq);
+        }
+    }
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+    outb(IMCR_SELECT, 0x70);
+    outb(IMCR_DATA, 0x01);              // Symmetric I/O mode, where there is an IMCR
+    ioapic_active = 1;
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+
+    terminal_printf("[APIC] Interrupts routed through %d I/O APIC(s); %d CPU(s) in the MADT\n",
+                    (int)ioapic_count, (int)madt_cpus);
+    return 0;
+}
+
+void ioapic_set_masked(uint8_t irq, bool masked) {
+    if (irq >= IOAPIC_IRQS || irq == IRQ2_CASCADE) {
+        return;
+    }
+    uint32_t flags = spin_lock_irqsave(&ioapic_lock);
+    ioapic_lines[irq].masked = masked;
+    ioapic_program(irq);
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+}
+
+void ioapic_route_pci(uint8_t irq) {
+    if (irq >= IOAPIC_IRQS || irq == IRQ2_CASCADE) {
+        return;
+    }
+    uint32_t flags = spin_lock_irqsave(&ioapic_lock);
+    ioapic_lines[irq].pci = true;
+    ioapic_program(irq);
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+}
+
+// The timer stays on the BSP, which keeps the time and runs the shell
+int ioapic_set_affinity(uint8_t irq, uint32_t cpu) {
+    if (!ioapic_active || irq >= IOAPIC_IRQS || irq == IRQ0_TIMER || irq == IRQ2_CASCADE ||
+        cpu >= SMP_MAX_CPUS || !cpus[cpu].online) {
+        return -1;
+    }
+    uint32_t flags = spin_lock_irqsave(&ioapic_lock);
+    ioapic_lines[irq].cpu = (uint8_t)cpu;
+    ioapic_program(irq);
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+    return 0;
+}
+
+void ioapic_dump(void) {
+    if (!ioapic_active) {
+        terminal_writestring("Interrupts: 8259 PIC\n");
+        return;
+    }
+    terminal_printf("Interrupts: %d I/O APIC(s), EOI through the local APIC\n", (int)ioapic_count);
+    for (uint32_t i = 0; i < ioapic_count; i++) {
+        terminal_printf("  I/O APIC %d: GSI %d-%d\n", (int)ioapics[i].id, (int)ioapics[i].gsi_base,
+                        (int)(ioapics[i].gsi_base + ioapics[i].count - 1));
+    }
+    terminal_writestring("  IRQ  GSI  Vector  Trigger  Polarity  State   CPU\n");
+    for (uint8_t irq = 0; irq < IOAPIC_IRQS; irq++) {
+        const ioapic_line_t* line = &ioapic_lines[irq];
+        if (irq == IRQ2_CASCADE) {
+            continue;
+        }
+        terminal_printf("  %d    %d    %d      %s    %s      %s  %d\n", (int)irq, (int)line->gsi,
+                        32 + irq, ioapic_line_level(line) ? "level" : "edge ",
+                        ioapic_line_low(line) ? "low " : "high",
+                        line->masked ? "masked" : "on    ", (int)line->cpu);
+    }
+}
@@ -0,0 +1,46 @@
+// ClaudeOS I/O APIC - Day 21
+// Routes the device lines through the I/O APICs the ACPI MADT lists rather
+// than the 8259 pair: each line keeps its vector (32 + IRQ), is delivered
+// to one CPU's local APIC and acknowledged with one write to that CPU's
+// EOI register. pic.c's interface stays the front door; it forwards here
+// once ioapic_init has switched over, and the 8259s stay in charge on
+// machines without an I/O APIC.
+
+#ifndef IOAPIC_H
+#define IOAPIC_H
+
+#include "types.h"
+#include "vmm.h"
+
+#define IOAPIC_MAX          4
+#define IOAPIC_VIRT         (VMM_MMIO_START + 0x1000)   // One page each, after the local APIC
+#define IOAPIC_IRQS         16                          // ISA lines routed (PCI INTx reuses them)
+
+// Register access: select at +0x00, data at +0x10
+#define IOAPIC_REGSEL       0x00
+#define IOAPIC_WINDOW       0x10
+#define IOAPIC_REG_VERSION  0x01                        // Bits 16-23: last redirection entry
+#define IOAPIC_REG_REDIR    0x10                        // Two registers per entry
+
+// Redirection entry, low half (the high half's top byte is the CPU)
+#define IOAPIC_ACTIVE_LOW   0x2000
+#define IOAPIC_LEVEL        0x8000
+#define IOAPIC_MASKED       0x10000
+
+extern int ioapic_active;               // Set once the 8259s are masked off
+
+// Parse the MADT and move every ISA line over from the 8259s, preserving
+// which are masked (after the BSP's local APIC is enabled). 0 on success,
+// -1 with the 8259s left in charge.
+int ioapic_init(void);
+
+// pic.c forwards to these while ioapic_active
+void ioapic_set_masked(uint8_t irq, bool masked);
+void ioapic_route_pci(uint8_t irq);     // Level, active low, unless the MADT says otherwise
+
+// Deliver irq to a CPU (a cpus[] index); -1 if it can't be moved
+int ioapic_set_affinity(uint8_t irq, uint32_t cpu);
+
+void ioapic_dump(void);
+
+#endif // IOAPIC_H
@@ -5,166 +5,614 @@
 #include "timer.h"
 #include "heap.h"
 #include "string.h"
+#include "lock.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "printk.h"
+#include "trace.h"
+#include "stats.h"
+#include "procfs.h"
+#include "initcall.h"
+#include "pool.h"
+#include "mpmc.h"
+
+STAT_DEFINE(stat_ipc_sent, "ipc.sent", STAT_COUNTER, "messages delivered to a mailbox");
+STAT_DEFINE(stat_ipc_received, "ipc.received", STAT_COUNTER, "messages taken from a mailbox");
 
 // Global IPC data structures
-message_t message_pool[MAX_MESSAGES];
-semaphore_t semaphore_pool[MAX_SEMAPHORES];
-shared_memory_t shared_memory_pool[8];  // Basic shared memory pool
+kmem_cache_t message_cache;
+kmem_cache_t semaphore_cache;
+kmem_cache_t mailbox_cache;
+semaphore_t* semaphore_list_head = NULL;
+DEFINE_POOL(shm_pool, shared_memory_t, MAX_SHARED_MEMORY);
+DEFINE_POOL(condvar_pool, ipc_condvar_t, MAX_CONDVARS);
+DEFINE_POOL(rwlock_pool, ipc_rwlock_t, MAX_RWLOCKS);
 int next_semaphore_id = 1;
+static int next_message_id = 1;
+int ipc_debug = 0;
+
+// Protects the semaphore list and semaphore values. Messages only take
+// their mailbox's lock. Lock order: ipc, then a mailbox, then the
+// scheduler (process_wake).
+static spinlock_t ipc_lock;
+
+// Boot-time backing storage for the caches (usable before the heap exists)
+static message_t message_storage[MAX_MESSAGES];
+static semaphore_t semaphore_storage[MAX_SEMAPHORES];
+bool ipc_caches_ready = false;
+
+// Recorded in the kernel log, not printed on the send and receive paths
+#define ipc_log(...) do { if (ipc_debug) printk(KLOG_INFO, __VA_ARGS__); } while (0)
+
+// Return every message still queued in a mailbox to the cache
+// Return a message to the cache, with any frames it still carries
+static void message_free(message_t* msg) {
+    for (uint32_t i = 0; i < msg->page_count; i++) {
+        pmm_free_page(msg->frames[i]);
+    }
+    msg->page_count = 0;
+    msg->is_used = false;
+    kmem_cache_free(&message_cache, msg);
+}
+
+static void mailbox_drain(mailbox_t* mailbox) {
+    uint32_t flags = spin_lock_irqsave(&mailbox->lock);
+    while (mailbox->head != mailbox->tail) {
+        message_free(mailbox->slots[mailbox->head++ & (IPC_MAILBOX_SIZE - 1)]);
+    }
+    spin_unlock_irqrestore(&mailbox->lock, flags);
+}
+
+// RPC: fail every call on mailbox (its owner is gone); mailbox lock held
+static void rpc_fail_all_locked(mailbox_t* mailbox) {
+    ipc_rpc_call_t* lists[2] = { mailbox->calls, mailbox->serving };
+    mailbox->calls = NULL;
+    mailbox->serving = NULL;
+    for (int i = 0; i < 2; i++) {
+        ipc_rpc_call_t* call = lists[i];
+        while (call) {
+            ipc_rpc_call_t* next = call->next;
+            process_t* client = call->client;
+            call->state = RPC_FAILED;   // Its stack frame may go from here on
+            process_wake(client);
+            call = next;
+        }
+    }
+}
 
 // IPC initialization
 void ipc_init(void) {
-    // Initialize message pool
-    for (int i = 0; i < MAX_MESSAGES; i++) {
-        message_pool[i].sender_pid = INVALID_PID;
-        message_pool[i].receiver_pid = INVALID_PID;
-        message_pool[i].message_size = 0;
-        message_pool[i].is_used = false;
-        message_pool[i].timestamp = 0;
-        // Clear message data
-        for (int j = 0; j < MAX_MESSAGE_SIZE; j++) {
-            message_pool[i].data[j] = 0;
-        }
-    }
-    
-    // Initialize semaphore pool
-    for (int i = 0; i < MAX_SEMAPHORES; i++) {
-        semaphore_pool[i].id = INVALID_SEMAPHORE_ID;
-        semaphore_pool[i].value = 0;
-        semaphore_pool[i].is_used = false;
-        semaphore_pool[i].waiting_queue_head = NULL;
-        semaphore_pool[i].waiting_queue_tail = NULL;
-        semaphore_pool[i].creation_time = 0;
-        // Clear semaphore name
-        for (int j = 0; j < 32; j++) {
-            semaphore_pool[i].name[j] = 0;
-        }
-    }
-    
-    // Initialize shared memory pool
-    for (int i = 0; i < 8; i++) {
-        shared_memory_pool[i].id = -1;
-        shared_memory_pool[i].address = NULL;
-        shared_memory_pool[i].size = 0;
-        shared_memory_pool[i].owner_pid = INVALID_PID;
-        shared_memory_pool[i].is_used = false;
+    if (!ipc_caches_ready) {
+        spin_lock_init(&ipc_lock, "ipc");
+        kmem_cache_init(&message_cache, "ipc_message", sizeof(message_t), NULL);
+        kmem_cache_seed(&message_cache, message_storage, MAX_MESSAGES);
+        kmem_cache_init(&semaphore_cache, "ipc_semaphore", sizeof(semaphore_t), NULL);
+        kmem_cache_seed(&semaphore_cache, semaphore_storage, MAX_SEMAPHORES);
+        kmem_cache_init(&mailbox_cache, "ipc_mailbox", sizeof(mailbox_t), NULL);
+        ipc_caches_ready = true;
+    }
+    
+    // Drop any queued messages
+    for (int slot = 0; slot < process_table_size; slot++) {
+        process_t* process = process_slot(slot);
+        if (process && process->mailbox) {
+            mailbox_drain(process->mailbox);
+        }
+    }
+    
+    // Drop any semaphores
+    while (semaphore_list_head) {
+        semaphore_t* sem = semaphore_list_head;
+        semaphore_list_head = sem->next;
+        kmem_cache_free(&semaphore_cache, sem);
     }
     
     next_semaphore_id = 1;
+    next_message_id = 1;
     
     terminal_printf("✅ IPC system initialized\n");
-    terminal_printf("   - Message slots: %d\n", MAX_MESSAGES);
-    terminal_printf("   - Semaphore slots: %d\n", MAX_SEMAPHORES);
-    terminal_printf("   - Shared memory slots: 8\n");
+    terminal_printf("   - Message slots: %d (grows on demand)\n", MAX_MESSAGES);
+    terminal_printf("   - Mailbox depth: %d per process\n", IPC_MAILBOX_SIZE);
+    terminal_printf("   - Semaphore slots: %d (grows on demand)\n", MAX_SEMAPHORES);
+    terminal_printf("   - Shared memory slots: %d (up to %d KB each)\n",
+                   MAX_SHARED_MEMORY, IPC_SHM_MAX_SIZE / 1024);
+}
+
+INITCALL(initcall_ipc, "ipc", ipc_init, INIT_LAZY);
+
+// A process's mailbox, created on first use. Two racing creators both
+// allocate; the loser gives its copy back.
+static mailbox_t* mailbox_get(process_t* process) {
+    if (process->mailbox) {
+        return process->mailbox;
+    }
+    
+    mailbox_t* mailbox = (mailbox_t*)kmem_cache_alloc(&mailbox_cache);
+    if (!mailbox) {
+        return NULL;
+    }
+    uint8_t* bytes = (uint8_t*)mailbox;
+    for (size_t i = 0; i < sizeof(mailbox_t); i++) {
+        bytes[i] = 0;
+    }
+    if (!__sync_bool_compare_and_swap(&process->mailbox, NULL, mailbox)) {
+        kmem_cache_free(&mailbox_cache, mailbox);
+    }
+    return process->mailbox;
+}
+
+// The process's mailbox, created on first use (NULL if out of memory)
+mailbox_t* ipc_process_mailbox(process_t* process) {
+    return mailbox_get(process);
+}
+
+// Free a process's mailbox along with anything still queued (the process
+// slot is being released)
+void ipc_mailbox_release(process_t* process) {
+    mailbox_t* mailbox = process->mailbox;
+    if (!mailbox) {
+        return;
+    }
+    process->mailbox = NULL;
+    waitset_source_gone(&mailbox->watchers);
+    uint32_t flags = spin_lock_irqsave(&mailbox->lock);
+    rpc_fail_all_locked(mailbox);
+    spin_unlock_irqrestore(&mailbox->lock, flags);
+    mailbox_drain(mailbox);
+    kmem_cache_free(&mailbox_cache, mailbox);
+}
+
+// The process IPC calls act for (the kernel task before the scheduler has
+// a current process)
+static process_t* ipc_caller(void) {
+    return current_process ? current_process : process_find(KERNEL_PID);
+}
+
+// Append a message to a mailbox and wake its owner; returns the message
+// ID, or -1 if the mailbox is full (msg is still the caller's then)
+static int mailbox_deliver(mailbox_t* mailbox, message_t* msg) {
+    uint32_t flags = spin_lock_irqsave(&mailbox->lock);
+    if (mailbox->tail - mailbox->head == IPC_MAILBOX_SIZE) {
+        mailbox->refused++;
+        spin_unlock_irqrestore(&mailbox->lock, flags);
+        return -1;
+    }
+    int id = msg->id;  // The receiver may free msg once the lock drops
+    mailbox->slots[mailbox->tail++ & (IPC_MAILBOX_SIZE - 1)] = msg;
+    mailbox->delivered++;
+    process_t* waiter = mailbox->waiter;
+    mailbox->waiter = NULL;
+    if (waiter) {
+        process_wake(waiter);
+    }
+    waitset_notify(&mailbox->watchers);
+    spin_unlock_irqrestore(&mailbox->lock, flags);
+    return id;
+}
+
+// A fresh message from the calling process
+static message_t* message_new(int receiver_pid, size_t size) {
+    message_t* msg = (message_t*)kmem_cache_alloc(&message_cache);
+    if (!msg) {
+        return NULL;
+    }
+    msg->id = __sync_fetch_and_add(&next_message_id, 1);
+    msg->sender_pid = current_process ? current_process->pid : 0;
+    msg->receiver_pid = receiver_pid;
+    msg->message_size = size;
+    msg->is_used = true;
+    msg->timestamp = get_uptime_seconds();
+    msg->page_count = 0;
+    return msg;
+}
+
+// Receiver lookup shared by both send paths
+static mailbox_t* receiver_mailbox(int receiver_pid) {
+    process_t* receiver = process_find(receiver_pid);
+    if (!receiver || receiver->state == PROCESS_TERMINATED) {
+        ipc_log("❌ Receiver process PID %d not found\n", receiver_pid);
+        return NULL;
+    }
+    mailbox_t* mailbox = mailbox_get(receiver);
+    if (!mailbox) {
+        ipc_log("❌ No memory for PID %d's mailbox\n", receiver_pid);
+    }
+    return mailbox;
 }
 
 // Message passing implementation
 int ipc_send_message(int receiver_pid, const char* data, size_t size) {
+    TRACE(TRACE_IPC_SEND, receiver_pid, size);
     if (!data || size == 0 || size > MAX_MESSAGE_SIZE) {
-        terminal_printf("❌ Invalid message data or size\n");
+        ipc_log("❌ Invalid message data or size\n");
         return -1;
     }
     
-    // Verify receiver process exists
-    process_t* receiver = process_find(receiver_pid);
-    if (!receiver) {
-        terminal_printf("❌ Receiver process PID %d not found\n", receiver_pid);
+    mailbox_t* mailbox = receiver_mailbox(receiver_pid);
+    if (!mailbox) {
         return -1;
     }
     
-    // Find free message slot
-    for (int i = 0; i < MAX_MESSAGES; i++) {
-        if (!message_pool[i].is_used) {
-            message_pool[i].sender_pid = current_process ? current_process->pid : 0;
-            message_pool[i].receiver_pid = receiver_pid;
-            message_pool[i].message_size = size;
-            message_pool[i].is_used = true;
-            message_pool[i].timestamp = get_uptime_seconds();
-            
-            // Copy message data
-            for (size_t j = 0; j < size && j < MAX_MESSAGE_SIZE; j++) {
-                message_pool[i].data[j] = data[j];
-            }
-            
-            terminal_printf("✅ Message sent to PID %d (slot %d, %d bytes)\n", 
-                           receiver_pid, i, (int)size);
-            return i;  // Return message slot ID
+    // Take a message from the cache
+    message_t* msg = message_new(receiver_pid, size);
+    if (!msg) {
+        ipc_log("❌ No free message slots available\n");
+        return -1;
+    }
+    
+    // Copy message data
+    for (size_t j = 0; j < size && j < MAX_MESSAGE_SIZE; j++) {
+        msg->data[j] = data[j];
+    }
+    
+    // Append to the receiver's mailbox (FIFO delivery order)
+    int id = mailbox_deliver(mailbox, msg);
+    if (id < 0) {
+        message_free(msg);
+        ipc_log("❌ Mailbox of PID %d is full\n", receiver_pid);
+        return -1;
+    }
+    
+    stat_inc(&stat_ipc_sent);
+    ipc_log("✅ Message sent to PID %d (id %d, %d bytes)\n", 
+            receiver_pid, id, (int)size);
+    return id;  // Return message ID
+}
+
+// Take the oldest data (pages = 0) or page-transfer (pages = 1) message
+// from sender_pid (-1 = anyone) out of a mailbox (its lock held). Later
+// messages move up a slot, so each sender's messages stay in order.
+static message_t* mailbox_take(mailbox_t* mailbox, int sender_pid, int pages) {
+    for (uint32_t i = mailbox->head; i != mailbox->tail; i++) {
+        message_t* msg = mailbox->slots[i & (IPC_MAILBOX_SIZE - 1)];
+        if ((sender_pid != -1 && msg->sender_pid != sender_pid) ||
+            (msg->page_count != 0) != (pages != 0)) {
+            continue;
+        }
+        for (uint32_t j = i; j != mailbox->head; j--) {
+            mailbox->slots[j & (IPC_MAILBOX_SIZE - 1)] =
+                mailbox->slots[(j - 1) & (IPC_MAILBOX_SIZE - 1)];
         }
+        mailbox->head++;
+        return msg;
+    }
+    return NULL;
+}
+
+// Wait up to timeout_ms (IPC_WAIT_FOREVER: no limit) for a matching
+// message and take it. Only a preemptible process other than the kernel
+// task sleeps; anyone else just polls once.
+static message_t* mailbox_receive(process_t* process, mailbox_t* mailbox, int sender_pid,
+                                  int pages, uint32_t timeout_ms) {
+    int can_sleep = timeout_ms && process->pid != KERNEL_PID && scheduler_preemptive;
+    int forever = (timeout_ms == IPC_WAIT_FOREVER);
+    uint32_t deadline = 0;
+    if (can_sleep && !forever) {
+        uint32_t ticks = (timeout_ms / 1000) * TIMER_FREQUENCY +
+                         ((timeout_ms % 1000) * TIMER_FREQUENCY + 999) / 1000;
+        deadline = timer_get_ticks() + ticks;
     }
     
-    terminal_printf("❌ No free message slots available\n");
-    return -1;
+    while (1) {
+        uint32_t flags = spin_lock_irqsave(&mailbox->lock);
+        message_t* msg = mailbox_take(mailbox, sender_pid, pages);
+        if (msg || !can_sleep ||
+            (!forever && (int32_t)(timer_get_ticks() - deadline) >= 0)) {
+            spin_unlock_irqrestore(&mailbox->lock, flags);
+            return msg;
+        }
+        
+        // Blocked before the lock drops, so a send can't be missed
+        mailbox->waiter = process;
+        process_prepare_block();
+        if (!forever) {
+            timer_wake_at(process, deadline);
+        }
+        spin_unlock_irqrestore(&mailbox->lock, flags);
+        process_sleep_while(process->state, PROCESS_BLOCKED);
+        
+        // Woken by a send or by the deadline: clear whichever didn't fire
+        if (!forever) {
+            timer_cancel_sleep(process);
+        }
+        flags = spin_lock_irqsave(&mailbox->lock);
+        if (mailbox->waiter == process) {
+            mailbox->waiter = NULL;
+        }
+        spin_unlock_irqrestore(&mailbox->lock, flags);
+    }
 }
 
+// Receive without waiting; returns the sender's PID or -1
 int ipc_receive_message(int sender_pid, char* buffer, size_t buffer_size) {
+    return ipc_receive_message_timeout(sender_pid, buffer, buffer_size, 0);
+}
+
+// Receive, sleeping up to timeout_ms for a matching message
+int ipc_receive_message_timeout(int sender_pid, char* buffer, size_t buffer_size,
+                                uint32_t timeout_ms) {
     if (!buffer || buffer_size == 0) {
-        terminal_printf("❌ Invalid receive buffer\n");
+        ipc_log("❌ Invalid receive buffer\n");
         return -1;
     }
     
-    int receiver_pid = current_process ? current_process->pid : 0;
+    process_t* process = ipc_caller();
+    mailbox_t* mailbox = process ? mailbox_get(process) : NULL;
+    if (!mailbox) {
+        return -1;
+    }
     
-    // Search for message
-    for (int i = 0; i < MAX_MESSAGES; i++) {
-        if (message_pool[i].is_used && 
-            message_pool[i].receiver_pid == receiver_pid &&
-            (sender_pid == -1 || message_pool[i].sender_pid == sender_pid)) {
-            
-            // Copy message data
-            size_t copy_size = message_pool[i].message_size;
-            if (copy_size > buffer_size - 1) {
-                copy_size = buffer_size - 1;
-            }
-            
-            for (size_t j = 0; j < copy_size; j++) {
-                buffer[j] = message_pool[i].data[j];
+    message_t* msg = mailbox_receive(process, mailbox, sender_pid, 0, timeout_ms);
+    if (!msg) {
+        ipc_log("❌ No messages found from PID %d\n", sender_pid);
+        return -1;
+    }
+    
+    // Copy message data
+    size_t copy_size = msg->message_size;
+    if (copy_size > buffer_size - 1) {
+        copy_size = buffer_size - 1;
+    }
+    for (size_t j = 0; j < copy_size; j++) {
+        buffer[j] = msg->data[j];
+    }
+    buffer[copy_size] = '\0';  // Null terminate
+    
+    int sender = msg->sender_pid;
+    message_free(msg);
+    stat_inc(&stat_ipc_received);
+    
+    ipc_log("✅ Message received from PID %d (%d bytes)\n", 
+            sender, (int)copy_size);
+    return sender;  // Return sender PID
+}
+
+// Transfer window slots
+static inline uint32_t window_slot_address(int slot) {
+    return IPC_WINDOW_BASE + (uint32_t)slot * IPC_WINDOW_SLOT_SIZE;
+}
+
+// Slot holding addr, or -1 outside the window
+static int window_slot_of(uint32_t addr) {
+    if (addr < IPC_WINDOW_BASE || addr >= window_slot_address(IPC_WINDOW_SLOTS)) {
+        return -1;
+    }
+    return (int)((addr - IPC_WINDOW_BASE) / IPC_WINDOW_SLOT_SIZE);
+}
+
+static int window_slot_alloc(mailbox_t* mailbox) {
+    uint32_t flags = spin_lock_irqsave(&mailbox->lock);
+    for (int slot = 0; slot < IPC_WINDOW_SLOTS; slot++) {
+        if (!(mailbox->window_map & (1u << slot))) {
+            mailbox->window_map |= 1u << slot;
+            spin_unlock_irqrestore(&mailbox->lock, flags);
+            return slot;
+        }
+    }
+    spin_unlock_irqrestore(&mailbox->lock, flags);
+    return -1;
+}
+
+static void window_slot_free(mailbox_t* mailbox, int slot) {
+    uint32_t flags = spin_lock_irqsave(&mailbox->lock);
+    mailbox->window_map &= ~(1u << slot);
+    spin_unlock_irqrestore(&mailbox->lock, flags);
+}
+
+static inline uint32_t transfer_pages(size_t size) {
+    return (uint32_t)((size + PAGE_SIZE - 1) / PAGE_SIZE);
+}
+
+// Allocate a zeroed buffer of up to IPC_MAX_PAGES pages in the caller's
+// transfer window, to be filled and passed on with ipc_send_pages
+void* ipc_alloc_pages(size_t size) {
+    uint32_t count = transfer_pages(size);
+    process_t* process = ipc_caller();
+    mailbox_t* mailbox = process ? mailbox_get(process) : NULL;
+    if (!mailbox || count == 0 || count > IPC_MAX_PAGES) {
+        return NULL;
+    }
+    int slot = window_slot_alloc(mailbox);
+    if (slot < 0) {
+        ipc_log("❌ Transfer window of PID %d is full\n", process->pid);
+        return NULL;
+    }
+    
+    uint32_t base = window_slot_address(slot);
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t frame = pmm_alloc_zeroed_page();
+        if (!frame) {
+            while (i-- > 0) {
+                uint32_t addr = base + i * PAGE_SIZE;
+                pmm_free_page(vmm_get_page_entry(process->page_directory, addr) & ~0xFFF);
+                vmm_unmap_page(process->page_directory, addr);
             }
-            buffer[copy_size] = '\0';  // Null terminate
-            
-            int sender = message_pool[i].sender_pid;
-            
-            // Mark message as free
-            message_pool[i].is_used = false;
-            message_pool[i].sender_pid = INVALID_PID;
-            message_pool[i].receiver_pid = INVALID_PID;
-            
-            terminal_printf("✅ Message received from PID %d (%d bytes)\n", 
-                           sender, (int)copy_size);
-            return sender;  // Return sender PID
+            window_slot_free(mailbox, slot);
+            return NULL;
+        }
+        vmm_map_page(process->page_directory, base + i * PAGE_SIZE, frame,
+                     PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER);
+    }
+    return (void*)base;
+}
+
+// Move the pages under [addr, addr + size) to another process without
+// copying: the frames are unmapped here (a TLB shootdown covers other CPUs
+// with this address space loaded), travel in the message, and are mapped
+// into the receiver's window by ipc_receive_pages. Returns the message ID.
+int ipc_send_pages(int receiver_pid, void* addr, size_t size) {
+    uint32_t base = (uint32_t)addr;
+    uint32_t count = transfer_pages(size);
+    if ((base & (PAGE_SIZE - 1)) || base < VMM_USER_SPACE_START || base >= VMM_USER_SPACE_END ||
+        count == 0 || count > IPC_MAX_PAGES || count > (VMM_USER_SPACE_END - base) / PAGE_SIZE) {
+        ipc_log("❌ Page transfer must be 1-%d private pages, page aligned\n", IPC_MAX_PAGES);
+        return -1;
+    }
+    
+    process_t* sender = ipc_caller();
+    mailbox_t* mailbox = receiver_mailbox(receiver_pid);
+    if (!sender || !mailbox) {
+        return -1;
+    }
+    page_directory_t* dir = sender->page_directory;
+    
+    // Every page must be present and ours alone (a copy-on-write frame is
+    // still shared with another address space)
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t pte = vmm_get_page_entry(dir, base + i * PAGE_SIZE);
+        if (!(pte & PAGE_PRESENT) || (pte & PAGE_COW)) {
+            ipc_log("❌ Page at %d is not an unshared present page\n", (int)(base + i * PAGE_SIZE));
+            return -1;
         }
     }
     
-    terminal_printf("❌ No messages found from PID %d\n", sender_pid);
-    return -1;
+    message_t* msg = message_new(receiver_pid, size);
+    if (!msg) {
+        ipc_log("❌ No free message slots available\n");
+        return -1;
+    }
+    msg->page_count = count;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t pte = vmm_get_page_entry(dir, base + i * PAGE_SIZE);
+        msg->frames[i] = pte & ~0xFFF;
+        msg->page_flags[i] = pte & (PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER);
+        vmm_unmap_page(dir, base + i * PAGE_SIZE);
+    }
+    smp_tlb_shootdown(dir, base, count);
+    
+    int id = mailbox_deliver(mailbox, msg);
+    if (id < 0) {
+        // Still ours - put the pages back where they were
+        for (uint32_t i = 0; i < count; i++) {
+            vmm_map_page(dir, base + i * PAGE_SIZE, msg->frames[i], msg->page_flags[i]);
+        }
+        msg->page_count = 0;
+        message_free(msg);
+        ipc_log("❌ Mailbox of PID %d is full\n", receiver_pid);
+        return -1;
+    }
+    
+    // A window slot that is now empty can take the next buffer
+    int slot = window_slot_of(base);
+    if (slot >= 0 && sender->mailbox) {
+        uint32_t slot_base = window_slot_address(slot);
+        int empty = 1;
+        for (uint32_t i = 0; i < IPC_MAX_PAGES && empty; i++) {
+            empty = !(vmm_get_page_entry(dir, slot_base + i * PAGE_SIZE) & PAGE_PRESENT);
+        }
+        if (empty) {
+            window_slot_free(sender->mailbox, slot);
+        }
+    }
+    
+    ipc_log("✅ %d pages moved to PID %d (id %d)\n", (int)count, receiver_pid, id);
+    return id;
 }
 
-int ipc_message_count(int pid) {
-    int count = 0;
-    for (int i = 0; i < MAX_MESSAGES; i++) {
-        if (message_pool[i].is_used && message_pool[i].receiver_pid == pid) {
-            count++;
+// Receive a page transfer into a free slot of the caller's window. On
+// success *addr and *size describe the buffer and the sender's PID is
+// returned; the buffer stays mapped until ipc_release_pages or until it
+// is sent on.
+int ipc_receive_pages(int sender_pid, void** addr, size_t* size, uint32_t timeout_ms) {
+    if (!addr || !size) {
+        return -1;
+    }
+    process_t* process = ipc_caller();
+    mailbox_t* mailbox = process ? mailbox_get(process) : NULL;
+    if (!mailbox) {
+        return -1;
+    }
+    
+    // Reserve the destination first, so a taken message always has a home
+    int slot = window_slot_alloc(mailbox);
+    if (slot < 0) {
+        ipc_log("❌ Transfer window of PID %d is full\n", process->pid);
+        return -1;
+    }
+    message_t* msg = mailbox_receive(process, mailbox, sender_pid, 1, timeout_ms);
+    if (!msg) {
+        window_slot_free(mailbox, slot);
+        ipc_log("❌ No page transfers found from PID %d\n", sender_pid);
+        return -1;
+    }
+    
+    // The slot was unmapped (and shot down) when it was last freed, so
+    // these are new translations and need no TLB maintenance
+    uint32_t base = window_slot_address(slot);
+    for (uint32_t i = 0; i < msg->page_count; i++) {
+        vmm_map_page(process->page_directory, base + i * PAGE_SIZE,
+                     msg->frames[i], msg->page_flags[i]);
+    }
+    *addr = (void*)base;
+    *size = msg->message_size;
+    int sender = msg->sender_pid;
+    
+    ipc_log("✅ %d pages received from PID %d\n", (int)msg->page_count, sender);
+    msg->page_count = 0;  // The frames belong to the receiver now
+    message_free(msg);
+    return sender;
+}
+
+// Unmap a received (or allocated) buffer and free its frames
+int ipc_release_pages(void* addr) {
+    process_t* process = ipc_caller();
+    int slot = window_slot_of((uint32_t)addr);
+    if (!process || !process->mailbox || slot < 0 ||
+        (uint32_t)addr != window_slot_address(slot) ||
+        !(process->mailbox->window_map & (1u << slot))) {
+        return -1;
+    }
+    
+    page_directory_t* dir = process->page_directory;
+    uint32_t base = window_slot_address(slot);
+    tlb_batch_t batch;
+    smp_tlb_batch_init(&batch, dir);
+    for (uint32_t i = 0; i < IPC_MAX_PAGES; i++) {
+        uint32_t pte = vmm_get_page_entry(dir, base + i * PAGE_SIZE);
+        if (pte & PAGE_PRESENT) {
+            vmm_unmap_page(dir, base + i * PAGE_SIZE);
+            smp_tlb_batch_add(&batch, base + i * PAGE_SIZE, 1);
+            smp_tlb_batch_free(&batch, pte & ~0xFFF);
         }
     }
-    return count;
+    smp_tlb_batch_flush(&batch);
+    window_slot_free(process->mailbox, slot);
+    return 0;
+}
+
+int ipc_message_count(int pid) {
+    process_t* process = process_find(pid);
+    if (!process || !process->mailbox) {
+        return 0;
+    }
+    mailbox_t* mailbox = process->mailbox;
+    return (int)(mailbox->tail - mailbox->head);
 }
 
 void ipc_list_messages(void) {
     terminal_writestring("📬 Message Queue Status:\n");
-    terminal_writestring("Slot Sender Receiver Size  Data\n");
+    terminal_writestring("ID   Sender Receiver Size  Data\n");
     terminal_writestring("---- ------ -------- ----  ----\n");
     
     bool found_any = false;
-    for (int i = 0; i < MAX_MESSAGES; i++) {
-        if (message_pool[i].is_used) {
+    for (int slot = 0; slot < process_table_size; slot++) {
+        process_t* process = process_slot(slot);
+        if (!process || process->pid == INVALID_PID || !process->mailbox) {
+            continue;
+        }
+        mailbox_t* mailbox = process->mailbox;
+        uint32_t flags = spin_lock_irqsave(&mailbox->lock);
+        for (uint32_t i = mailbox->head; i != mailbox->tail; i++) {
+            message_t* msg = mailbox->slots[i & (IPC_MAILBOX_SIZE - 1)];
             found_any = true;
             // Simple number display without printf formatting
-            char slot_str[8], sender_str[8], receiver_str[8], size_str[8];
-            itoa(i, slot_str, 10);
-            itoa(message_pool[i].sender_pid, sender_str, 10);
-            itoa(message_pool[i].receiver_pid, receiver_str, 10);
-            itoa((int)message_pool[i].message_size, size_str, 10);
+            char id_str[8], sender_str[8], receiver_str[8], size_str[8];
+            itoa(msg->id, id_str, 10);
+            itoa(msg->sender_pid, sender_str, 10);
+            itoa(msg->receiver_pid, receiver_str, 10);
+            itoa((int)msg->message_size, size_str, 10);
             
-            terminal_writestring(slot_str);
+            terminal_writestring(id_str);
             terminal_writestring("   ");
             terminal_writestring(sender_str);
             terminal_writestring("    ");
@@ -173,16 +621,20 @@ void ipc_list_messages(void) {
             terminal_writestring(size_str);
             terminal_writestring("   \"");
             
-            // Print first 20 chars of message
-            for (int j = 0; j < 20 && j < (int)message_pool[i].message_size; j++) {
-                if (message_pool[i].data[j] >= 32 && message_pool[i].data[j] <= 126) {
-                    terminal_putchar(message_pool[i].data[j]);
+            // Print first 20 chars of message (page transfers carry no data)
+            if (msg->page_count) {
+                terminal_printf("[%d pages]", (int)msg->page_count);
+            }
+            for (int j = 0; j < 20 && !msg->page_count && j < (int)msg->message_size; j++) {
+                if (msg->data[j] >= 32 && msg->data[j] <= 126) {
+                    terminal_putchar(msg->data[j]);
                 } else {
                     terminal_putchar('.');
                 }
             }
             terminal_writestring("\"\n");
         }
+        spin_unlock_irqrestore(&mailbox->lock, flags);
     }
     
     if (!found_any) {
@@ -197,124 +649,178 @@ int ipc_create_semaphore(const char* name, int initial_value) {
         return INVALID_SEMAPHORE_ID;
     }
     
-    // Find free semaphore slot
-    for (int i = 0; i < MAX_SEMAPHORES; i++) {
-        if (!semaphore_pool[i].is_used) {
-            semaphore_pool[i].id = next_semaphore_id++;
-            semaphore_pool[i].value = initial_value;
-            semaphore_pool[i].is_used = true;
-            semaphore_pool[i].waiting_queue_head = NULL;
-            semaphore_pool[i].waiting_queue_tail = NULL;
-            semaphore_pool[i].creation_time = get_uptime_seconds();
-            
-            // Copy name
-            int j;
-            for (j = 0; j < 31 && name[j] != '\0'; j++) {
-                semaphore_pool[i].name[j] = name[j];
-            }
-            semaphore_pool[i].name[j] = '\0';
-            
-            terminal_printf("✅ Semaphore '%s' created (ID: %d, value: %d)\n", 
-                           name, semaphore_pool[i].id, initial_value);
-            return semaphore_pool[i].id;
-        }
+    // Take a semaphore from the cache
+    semaphore_t* sem = (semaphore_t*)kmem_cache_alloc(&semaphore_cache);
+    if (!sem) {
+        terminal_printf("❌ No free semaphore slots available\n");
+        return INVALID_SEMAPHORE_ID;
+    }
+    
+    sem->value = initial_value;
+    sem->is_used = true;
+    sem->waiting_queue_head = NULL;
+    sem->waiting_queue_tail = NULL;
+    sem->watchers.watchers = NULL;
+    sem->creation_time = get_uptime_seconds();
+    
+    // Copy name
+    int j;
+    for (j = 0; j < 31 && name[j] != '\0'; j++) {
+        sem->name[j] = name[j];
     }
+    sem->name[j] = '\0';
     
-    terminal_printf("❌ No free semaphore slots available\n");
-    return INVALID_SEMAPHORE_ID;
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+    int id = sem->id = next_semaphore_id++;
+    sem->next = semaphore_list_head;
+    semaphore_list_head = sem;
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    
+    terminal_printf("✅ Semaphore '%s' created (ID: %d, value: %d)\n", 
+                   name, id, initial_value);
+    return id;
 }
 
+// Look a semaphore up by ID (with ipc_lock held)
 semaphore_t* ipc_find_semaphore(int semaphore_id) {
-    for (int i = 0; i < MAX_SEMAPHORES; i++) {
-        if (semaphore_pool[i].is_used && semaphore_pool[i].id == semaphore_id) {
-            return &semaphore_pool[i];
+    for (semaphore_t* sem = semaphore_list_head; sem; sem = sem->next) {
+        if (sem->id == semaphore_id) {
+            return sem;
         }
     }
     return NULL;
 }
 
+// Attach a wait set entry to a semaphore; under ipc_lock, so a destroy
+// can't slip in between the lookup and the link
+int ipc_watch_semaphore(int semaphore_id, wait_entry_t* entry) {
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+    semaphore_t* sem = ipc_find_semaphore(semaphore_id);
+    if (sem) {
+        waitset_link(entry, &sem->watchers, sem);
+    }
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    return sem ? 0 : -1;
+}
+
+// P operation. A process that has to wait sleeps until a signal hands it
+// the unit (returns 0) or the semaphore is destroyed (-1). The shell's
+// kernel task, and anything running without preemption, can't sleep and
+// gets 1 ("would block") instead.
 int ipc_semaphore_wait(int semaphore_id) {
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
     semaphore_t* sem = ipc_find_semaphore(semaphore_id);
     if (!sem) {
+        spin_unlock_irqrestore(&ipc_lock, flags);
         terminal_printf("❌ Semaphore ID %d not found\n", semaphore_id);
         return -1;
     }
     
     if (sem->value > 0) {
-        sem->value--;
-        terminal_printf("✅ Semaphore %d acquired (value: %d)\n", 
-                       semaphore_id, sem->value);
+        int value = --sem->value;
+        spin_unlock_irqrestore(&ipc_lock, flags);
+        ipc_log("Semaphore %d acquired (value: %d)\n", semaphore_id, value);
         return 0;
-    } else {
-        // Add current process to waiting queue
-        if (current_process) {
-            current_process->state = PROCESS_BLOCKED;
-            ipc_add_to_waiting_queue(sem, current_process);
-            terminal_writestring("⏳ Process ");
-            char pid_str[8];
-            itoa(current_process->pid, pid_str, 10);
-            terminal_writestring(pid_str);
-            terminal_writestring(" waiting on semaphore ");
-            char sem_str[8];
-            itoa(semaphore_id, sem_str, 10);
-            terminal_writestring(sem_str);
-            terminal_writestring("\n");
-            // In real implementation, this would trigger process switch
-            return 1;  // Indicate blocking
-        } else {
-            terminal_writestring("⏳ Kernel process waiting on semaphore ");
-            char sem_str[8];
-            itoa(semaphore_id, sem_str, 10);
-            terminal_writestring(sem_str);
-            terminal_writestring(" (would block in real system)\n");
-            return 1;
-        }
     }
+    
+    process_t* process = current_process;
+    if (!process || process->pid == KERNEL_PID || !scheduler_preemptive) {
+        spin_unlock_irqrestore(&ipc_lock, flags);
+        ipc_log("Semaphore %d busy (would block without a scheduler)\n", semaphore_id);
+        return 1;
+    }
+    
+    // Marked blocked before the lock drops, so a signal can't be lost
+    sem_waiter_t waiter;
+    waiter.process = process;
+    waiter.status = SEM_WAITING;
+    ipc_add_to_waiting_queue(sem, &waiter);
+    process_prepare_block();
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    
+    ipc_log("Process %d waiting on semaphore %d\n", process->pid, semaphore_id);
+    process_sleep_while(waiter.status, SEM_WAITING);
+    
+    if (waiter.status == SEM_DESTROYED) {
+        return -1;
+    }
+    ipc_log("Semaphore %d handed to PID %d\n", semaphore_id, process->pid);
+    return 0;
 }
 
+// V operation. With a waiter present the unit goes straight to the oldest
+// one rather than to the count, so a process that never waited can't take
+// it first.
 int ipc_semaphore_signal(int semaphore_id) {
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
     semaphore_t* sem = ipc_find_semaphore(semaphore_id);
     if (!sem) {
+        spin_unlock_irqrestore(&ipc_lock, flags);
         terminal_printf("❌ Semaphore ID %d not found\n", semaphore_id);
         return -1;
     }
     
     // Check if any process is waiting
-    process_t* waiting_process = ipc_remove_from_waiting_queue(sem);
+    sem_waiter_t* waiter = ipc_remove_from_waiting_queue(sem);
+    process_t* waiting_process = NULL;
+    int value = sem->value;
+    if (waiter) {
+        // The waiter's stack frame goes away once it sees its status
+        waiting_process = waiter->process;
+        waiter->status = SEM_GRANTED;
+        process_wake(waiting_process);
+    } else {
+        value = ++sem->value;
+        waitset_notify(&sem->watchers);
+    }
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    
     if (waiting_process) {
-        waiting_process->state = PROCESS_READY;
-        terminal_printf("✅ Process %d unblocked from semaphore %d\n", 
-                       waiting_process->pid, semaphore_id);
+        ipc_log("Process %d unblocked from semaphore %d\n", waiting_process->pid, semaphore_id);
     } else {
-        sem->value++;
-        terminal_printf("✅ Semaphore %d signaled (value: %d)\n", 
-                       semaphore_id, sem->value);
+        ipc_log("Semaphore %d signaled (value: %d)\n", semaphore_id, value);
     }
     
     return 0;
 }
 
 int ipc_destroy_semaphore(int semaphore_id) {
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
     semaphore_t* sem = ipc_find_semaphore(semaphore_id);
     if (!sem) {
+        spin_unlock_irqrestore(&ipc_lock, flags);
         terminal_printf("❌ Semaphore ID %d not found\n", semaphore_id);
         return -1;
     }
+    semaphore_t** link = &semaphore_list_head;
+    while (*link && *link != sem) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = sem->next;
+    }
     
-    // Wake up all waiting processes
-    while (sem->waiting_queue_head) {
-        process_t* waiting_process = ipc_remove_from_waiting_queue(sem);
-        if (waiting_process) {
-            waiting_process->state = PROCESS_READY;
-            terminal_printf("⚠️  Process %d unblocked (semaphore destroyed)\n", 
-                           waiting_process->pid);
-        }
+    // Wake up all waiting processes; their waits fail
+    int woken = 0;
+    sem_waiter_t* waiter;
+    while ((waiter = ipc_remove_from_waiting_queue(sem)) != NULL) {
+        process_t* waiting_process = waiter->process;
+        waiter->status = SEM_DESTROYED;
+        process_wake(waiting_process);
+        woken++;
+    }
+    waitset_source_gone(&sem->watchers);
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    
+    if (woken) {
+        terminal_printf("⚠️  %d process(es) unblocked (semaphore destroyed)\n", woken);
     }
     
-    // Clear semaphore
+    // Once unlinked nobody else can find it, so it can go back unlocked
     sem->is_used = false;
     sem->id = INVALID_SEMAPHORE_ID;
     sem->value = 0;
+    kmem_cache_free(&semaphore_cache, sem);
     
     terminal_printf("✅ Semaphore %d destroyed\n", semaphore_id);
     return 0;
@@ -326,40 +832,36 @@ void ipc_list_semaphores(void) {
     terminal_writestring("---- -------------------- ----- -------\n");
     
     bool found_any = false;
-    for (int i = 0; i < MAX_SEMAPHORES; i++) {
-        if (semaphore_pool[i].is_used) {
-            found_any = true;
-            
-            // Count waiting processes
-            int waiting_count = 0;
-            process_t* p = semaphore_pool[i].waiting_queue_head;
-            while (p) {
-                waiting_count++;
-                p = p->next;
-            }
-            
-            // Simple display without printf formatting
-            char id_str[8], value_str[8], waiting_str[8];
-            itoa(semaphore_pool[i].id, id_str, 10);
-            itoa(semaphore_pool[i].value, value_str, 10);
-            itoa(waiting_count, waiting_str, 10);
-            
-            terminal_writestring(id_str);
-            terminal_writestring("  ");
-            terminal_writestring(semaphore_pool[i].name);
-            
-            // Pad name to 20 chars
-            int name_len = strlen(semaphore_pool[i].name);
-            for (int j = name_len; j < 20; j++) {
-                terminal_writestring(" ");
-            }
-            
+    for (semaphore_t* sem = semaphore_list_head; sem; sem = sem->next) {
+        found_any = true;
+        
+        // Count waiting processes
+        int waiting_count = 0;
+        for (sem_waiter_t* w = sem->waiting_queue_head; w; w = w->next) {
+            waiting_count++;
+        }
+        
+        // Simple display without printf formatting
+        char id_str[8], value_str[8], waiting_str[8];
+        itoa(sem->id, id_str, 10);
+        itoa(sem->value, value_str, 10);
+        itoa(waiting_count, waiting_str, 10);
+        
+        terminal_writestring(id_str);
+        terminal_writestring("  ");
+        terminal_writestring(sem->name);
+        
+        // Pad name to 20 chars
+        int name_len = strlen(sem->name);
+        for (int j = name_len; j < 20; j++) {
             terminal_writestring(" ");
-            terminal_writestring(value_str);
-            terminal_writestring("   ");
-            terminal_writestring(waiting_str);
-            terminal_writestring("\n");
         }
+        
+        terminal_writestring(" ");
+        terminal_writestring(value_str);
+        terminal_writestring("   ");
+        terminal_writestring(waiting_str);
+        terminal_writestring("\n");
     }
     
     if (!found_any) {
@@ -367,94 +869,1015 @@ void ipc_list_semaphores(void) {
     }
 }
 
-// Queue management for semaphores
-void ipc_add_to_waiting_queue(semaphore_t* sem, process_t* process) {
-    if (!sem || !process) return;
+// Queue management for semaphores (ipc_lock held)
+void ipc_add_to_waiting_queue(semaphore_t* sem, sem_waiter_t* waiter) {
+    if (!sem || !waiter) return;
     
-    process->next = NULL;
+    waiter->next = NULL;
     
     if (!sem->waiting_queue_head) {
-        sem->waiting_queue_head = process;
-        sem->waiting_queue_tail = process;
+        sem->waiting_queue_head = waiter;
+        sem->waiting_queue_tail = waiter;
     } else {
-        sem->waiting_queue_tail->next = process;
-        sem->waiting_queue_tail = process;
+        sem->waiting_queue_tail->next = waiter;
+        sem->waiting_queue_tail = waiter;
     }
 }
 
-process_t* ipc_remove_from_waiting_queue(semaphore_t* sem) {
+sem_waiter_t* ipc_remove_from_waiting_queue(semaphore_t* sem) {
     if (!sem || !sem->waiting_queue_head) {
         return NULL;
     }
     
-    process_t* process = sem->waiting_queue_head;
-    sem->waiting_queue_head = process->next;
+    sem_waiter_t* waiter = sem->waiting_queue_head;
+    sem->waiting_queue_head = waiter->next;
     
     if (!sem->waiting_queue_head) {
         sem->waiting_queue_tail = NULL;
     }
     
-    process->next = NULL;
-    return process;
+    waiter->next = NULL;
+    return waiter;
 }
 
-// IPC statistics
-void ipc_stats(void) {
-    terminal_writestring("📊 IPC System Statistics:\n");
-    
-    int used_messages = 0;
-    int used_semaphores = 0;
-    
-    for (int i = 0; i < MAX_MESSAGES; i++) {
-        if (message_pool[i].is_used) used_messages++;
-    }
-    
-    for (int i = 0; i < MAX_SEMAPHORES; i++) {
-        if (semaphore_pool[i].is_used) used_semaphores++;
+// Waiter FIFOs for condition variables and rwlocks (the object's lock held)
+static void waitq_push(sem_waiter_t** head, sem_waiter_t** tail, sem_waiter_t* waiter) {
+    waiter->next = NULL;
+    if (*tail) {
+        (*tail)->next = waiter;
+    } else {
+        *head = waiter;
     }
-    
-    terminal_printf("Messages: %d/%d used\n", used_messages, MAX_MESSAGES);
-    terminal_printf("Semaphores: %d/%d used\n", used_semaphores, MAX_SEMAPHORES);
-    terminal_printf("Next semaphore ID: %d\n", next_semaphore_id);
+    *tail = waiter;
 }
 
-// IPC command handler
-void ipc_command_handler(int argc, char argv[][64]) {
-    if (argc < 2) {
-        terminal_writestring("IPC Commands:\n");
-        terminal_writestring("  ipc init        - Initialize IPC system\n");
-        terminal_writestring("  ipc send <pid> <message>  - Send message\n");
-        terminal_writestring("  ipc recv [pid]  - Receive message\n");
-        terminal_writestring("  ipc messages    - List all messages\n");
-        terminal_writestring("  ipc sem create <name> <value> - Create semaphore\n");
-        terminal_writestring("  ipc sem wait <id>     - Wait on semaphore\n");
-        terminal_writestring("  ipc sem signal <id>   - Signal semaphore\n");
-        terminal_writestring("  ipc sem list    - List semaphores\n");
-        terminal_writestring("  ipc sem destroy <id>  - Destroy semaphore\n");
-        terminal_writestring("  ipc stats       - Show IPC statistics\n");
-        return;
-    }
-    
-    if (strcmp(argv[1], "init") == 0) {
-        ipc_init();
-    }
-    else if (strcmp(argv[1], "send") == 0) {
-        if (argc < 4) {
-            terminal_writestring("Usage: ipc send <pid> <message>\n");
-            return;
+static sem_waiter_t* waitq_pop(sem_waiter_t** head, sem_waiter_t** tail) {
+    sem_waiter_t* waiter = *head;
+    if (waiter) {
+        *head = waiter->next;
+        if (!*head) {
+            *tail = NULL;
         }
-        int pid = atoi(argv[2]);
-        ipc_send_message(pid, argv[3], strlen(argv[3]));
+        waiter->next = NULL;
     }
-    else if (strcmp(argv[1], "recv") == 0) {
-        char buffer[MAX_MESSAGE_SIZE];
-        int sender_pid = (argc >= 3) ? atoi(argv[2]) : -1;
-        int result = ipc_receive_message(sender_pid, buffer, sizeof(buffer));
-        if (result >= 0) {
-            terminal_printf("Received: \"%s\"\n", buffer);
+    return waiter;
+}
+
+static bool waitq_unlink(sem_waiter_t** head, sem_waiter_t** tail, process_t* process) {
+    sem_waiter_t* prev = NULL;
+    for (sem_waiter_t* w = *head; w; prev = w, w = w->next) {
+        if (w->process != process) {
+            continue;
         }
-    }
-    else if (strcmp(argv[1], "messages") == 0) {
+        if (prev) {
+            prev->next = w->next;
+        } else {
+            *head = w->next;
+        }
+        if (*tail == w) {
+            *tail = prev;
+        }
+        return true;
+    }
+    return false;
+}
+
+// Hand the waiter its outcome; its stack frame goes away once it sees it
+static void waitq_grant(sem_waiter_t* waiter, int status) {
+    process_t* process = waiter->process;
+    waiter->status = status;
+    process_wake(process);
+}
+
+static bool ipc_can_sleep(process_t* process) {
+    return process && process->pid != KERNEL_PID && scheduler_preemptive;
+}
+
+// Block on a waiter record just queued under lock; returns its outcome
+static int ipc_sleep(spinlock_t* lock, uint32_t flags, sem_waiter_t* waiter) {
+    process_prepare_block();
+    spin_unlock_irqrestore(lock, flags);
+    process_sleep_while(waiter->status, SEM_WAITING);
+    return waiter->status;
+}
+
+// Condition variables
+int ipc_cond_create(const char* name) {
+    if (!name) {
+        return -1;
+    }
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+    ipc_condvar_t* cond = condvar_pool_alloc();
+    if (!cond) {
+        spin_unlock_irqrestore(&ipc_lock, flags);
+        terminal_printf("❌ No free condition variable slots available\n");
+        return -1;
+    }
+    int id = condvar_pool_handle(cond);
+    strlcpy(cond->name, name, sizeof(cond->name));
+    cond->waiters_head = NULL;
+    cond->waiters_tail = NULL;
+    cond->signals = 0;
+    cond->id = id;
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    
+    terminal_printf("✅ Condition variable '%s' created (ID: %d)\n", cond->name, id);
+    return id;
+}
+
+// The live condition variable id names, with its lock held; NULL if none.
+// The lookup takes no table lock: a destroy clears id under the object's
+// lock, so a stale match is caught here.
+static ipc_condvar_t* cond_lock(int cond_id, uint32_t* flags) {
+    ipc_condvar_t* cond = condvar_pool_lookup(cond_id);
+    if (!cond) {
+        return NULL;
+    }
+    *flags = spin_lock_irqsave(&cond->lock);
+    if (cond->id != cond_id) {
+        spin_unlock_irqrestore(&cond->lock, *flags);
+        return NULL;
+    }
+    return cond;
+}
+
+int ipc_cond_wait(int cond_id, mutex_t* mutex) {
+    process_t* process = current_process;
+    uint32_t flags;
+    ipc_condvar_t* cond = cond_lock(cond_id, &flags);
+    if (!cond) {
+        return -1;
+    }
+    if (!ipc_can_sleep(process)) {
+        spin_unlock_irqrestore(&cond->lock, flags);
+        return 1;
+    }
+    
+    // Queued first: a signal between the unlock and the sleep finds it
+    sem_waiter_t waiter;
+    waiter.process = process;
+    waiter.status = SEM_WAITING;
+    waitq_push(&cond->waiters_head, &cond->waiters_tail, &waiter);
+    spin_unlock_irqrestore(&cond->lock, flags);
+    mutex_unlock(mutex);
+    
+    flags = spin_lock_irqsave(&cond->lock);
+    int status = waiter.status;
+    if (status == SEM_WAITING) {
+        status = ipc_sleep(&cond->lock, flags, &waiter);
+    } else {
+        spin_unlock_irqrestore(&cond->lock, flags);
+    }
+    mutex_lock(mutex);
+    return status == SEM_GRANTED ? 0 : -1;
+}
+
+// Wake up to count waiters (-1: all); how many, or -1 for no such condition
+static int cond_wake(int cond_id, int count) {
+    uint32_t flags;
+    ipc_condvar_t* cond = cond_lock(cond_id, &flags);
+    if (!cond) {
+        return -1;
+    }
+    int woken = 0;
+    sem_waiter_t* waiter;
+    while (woken != count && (waiter = waitq_pop(&cond->waiters_head, &cond->waiters_tail)) != NULL) {
+        waitq_grant(waiter, SEM_GRANTED);
+        woken++;
+    }
+    cond->signals += (uint32_t)woken;
+    spin_unlock_irqrestore(&cond->lock, flags);
+    return woken;
+}
+
+int ipc_cond_signal(int cond_id) {
+    return cond_wake(cond_id, 1) < 0 ? -1 : 0;
+}
+
+int ipc_cond_broadcast(int cond_id) {
+    return cond_wake(cond_id, -1);
+}
+
+int ipc_cond_destroy(int cond_id) {
+    uint32_t flags;
+    ipc_condvar_t* cond = cond_lock(cond_id, &flags);
+    if (!cond) {
+        terminal_printf("❌ Condition variable ID %d not found\n", cond_id);
+        return -1;
+    }
+    cond->id = INVALID_SEMAPHORE_ID;
+    sem_waiter_t* waiter;
+    while ((waiter = waitq_pop(&cond->waiters_head, &cond->waiters_tail)) != NULL) {
+        waitq_grant(waiter, SEM_DESTROYED);
+    }
+    spin_unlock_irqrestore(&cond->lock, flags);
+    
+    flags = spin_lock_irqsave(&ipc_lock);
+    condvar_pool_free(cond);
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    terminal_printf("✅ Condition variable %d destroyed\n", cond_id);
+    return 0;
+}
+
+void ipc_list_condvars(void) {
+    terminal_writestring("Condition variables:\n");
+    ipc_condvar_t* cond;
+    int shown = 0;
+    POOL_FOR_EACH(condvar_pool, cond) {
+        int waiting = 0;
+        for (sem_waiter_t* w = cond->waiters_head; w; w = w->next) {
+            waiting++;
+        }
+        terminal_printf("  %d  %s: %d waiting, %d woken\n", cond->id, cond->name, waiting, (int)cond->signals);
+        shown++;
+    }
+    if (!shown) {
+        terminal_writestring("  None created\n");
+    }
+}
+
+// Reader-writer locks
+int ipc_rwlock_create(const char* name) {
+    if (!name) {
+        return -1;
+    }
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+    ipc_rwlock_t* rw = rwlock_pool_alloc();
+    if (!rw) {
+        spin_unlock_irqrestore(&ipc_lock, flags);
+        terminal_printf("❌ No free reader-writer lock slots available\n");
+        return -1;
+    }
+    int id = rwlock_pool_handle(rw);
+    strlcpy(rw->name, name, sizeof(rw->name));
+    rw->readers = 0;
+    rw->writer_pid = INVALID_PID;
+    rw->readers_head = rw->readers_tail = NULL;
+    rw->writers_head = rw->writers_tail = NULL;
+    rw->read_acquires = rw->write_acquires = rw->contended = 0;
+    rw->id = id;
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    
+    terminal_printf("✅ Reader-writer lock '%s' created (ID: %d)\n", rw->name, id);
+    return id;
+}
+
+static ipc_rwlock_t* rw_lock(int rwlock_id, uint32_t* flags) {
+    ipc_rwlock_t* rw = rwlock_pool_lookup(rwlock_id);
+    if (!rw) {
+        return NULL;
+    }
+    *flags = spin_lock_irqsave(&rw->lock);
+    if (rw->id != rwlock_id) {
+        spin_unlock_irqrestore(&rw->lock, *flags);
+        return NULL;
+    }
+    return rw;
+}
+
+// Let every queued reader in at once
+static void rw_admit_readers(ipc_rwlock_t* rw) {
+    sem_waiter_t* reader;
+    while ((reader = waitq_pop(&rw->readers_head, &rw->readers_tail)) != NULL) {
+        rw->readers++;
+        rw->read_acquires++;
+        waitq_grant(reader, SEM_GRANTED);
+    }
+}
+
+// Pass a free lock on: the queued readers if a writer just left (so a
+// stream of writers can't starve them), else the oldest writer
+static void rw_hand_off(ipc_rwlock_t* rw, bool writer_left) {
+    if (rw->writer_pid != INVALID_PID || rw->readers) {
+        return;
+    }
+    if (writer_left || !rw->writers_head) {
+        rw_admit_readers(rw);
+        if (rw->readers) {
+            return;
+        }
+    }
+    sem_waiter_t* writer = waitq_pop(&rw->writers_head, &rw->writers_tail);
+    if (writer) {
+        rw->writer_pid = writer->process->pid;
+        rw->write_acquires++;
+        waitq_grant(writer, SEM_GRANTED);
+    }
+}
+
+// Shared and exclusive acquire: take it now, or queue and sleep until a
+// release hands it over already taken
+static int rw_acquire(int rwlock_id, bool write) {
+    process_t* process = current_process;
+    uint32_t flags;
+    ipc_rwlock_t* rw = rw_lock(rwlock_id, &flags);
+    if (!rw) {
+        return -1;
+    }
+    bool free = rw->writer_pid == INVALID_PID && !rw->writers_head && (!write || !rw->readers);
+    if (free) {
+        if (write) {
+            rw->writer_pid = process ? process->pid : KERNEL_PID;
+            rw->write_acquires++;
+        } else {
+            rw->readers++;
+            rw->read_acquires++;
+        }
+        spin_unlock_irqrestore(&rw->lock, flags);
+        return 0;
+    }
+    if (!ipc_can_sleep(process)) {
+        spin_unlock_irqrestore(&rw->lock, flags);
+        return 1;
+    }
+    
+    sem_waiter_t waiter;
+    waiter.process = process;
+    waiter.status = SEM_WAITING;
+    if (write) {
+        waitq_push(&rw->writers_head, &rw->writers_tail, &waiter);
+    } else {
+        waitq_push(&rw->readers_head, &rw->readers_tail, &waiter);
+    }
+    rw->contended++;
+    return ipc_sleep(&rw->lock, flags, &waiter) == SEM_GRANTED ? 0 : -1;
+}
+
+int ipc_read_lock(int rwlock_id) {
+    return rw_acquire(rwlock_id, false);
+}
+
+int ipc_write_lock(int rwlock_id) {
+    return rw_acquire(rwlock_id, true);
+}
+
+int ipc_read_unlock(int rwlock_id) {
+    uint32_t flags;
+    ipc_rwlock_t* rw = rw_lock(rwlock_id, &flags);
+    if (!rw || rw->readers == 0) {
+        if (rw) {
+            spin_unlock_irqrestore(&rw->lock, flags);
+        }
+        return -1;
+    }
+    rw->readers--;
+    rw_hand_off(rw, false);
+    spin_unlock_irqrestore(&rw->lock, flags);
+    return 0;
+}
+
+int ipc_write_unlock(int rwlock_id) {
+    process_t* process = current_process;
+    uint32_t flags;
+    ipc_rwlock_t* rw = rw_lock(rwlock_id, &flags);
+    if (!rw || rw->writer_pid != (process ? process->pid : KERNEL_PID)) {
+        if (rw) {
+            spin_unlock_irqrestore(&rw->lock, flags);
+        }
+        return -1;
+    }
+    rw->writer_pid = INVALID_PID;
+    rw_hand_off(rw, true);
+    spin_unlock_irqrestore(&rw->lock, flags);
+    return 0;
+}
+
+int ipc_rwlock_destroy(int rwlock_id) {
+    uint32_t flags;
+    ipc_rwlock_t* rw = rw_lock(rwlock_id, &flags);
+    if (!rw) {
+        terminal_printf("❌ Reader-writer lock ID %d not found\n", rwlock_id);
+        return -1;
+    }
+    rw->id = INVALID_SEMAPHORE_ID;
+    sem_waiter_t* waiter;
+    while ((waiter = waitq_pop(&rw->readers_head, &rw->readers_tail)) != NULL) {
+        waitq_grant(waiter, SEM_DESTROYED);
+    }
+    while ((waiter = waitq_pop(&rw->writers_head, &rw->writers_tail)) != NULL) {
+        waitq_grant(waiter, SEM_DESTROYED);
+    }
+    spin_unlock_irqrestore(&rw->lock, flags);
+    
+    flags = spin_lock_irqsave(&ipc_lock);
+    rwlock_pool_free(rw);
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    terminal_printf("✅ Reader-writer lock %d destroyed\n", rwlock_id);
+    return 0;
+}
+
+void ipc_list_rwlocks(void) {
+    terminal_writestring("Reader-writer locks:\n");
+    ipc_rwlock_t* rw;
+    int shown = 0;
+    POOL_FOR_EACH(rwlock_pool, rw) {
+        int queued = 0;
+        for (sem_waiter_t* w = rw->readers_head; w; w = w->next) {
+            queued++;
+        }
+        for (sem_waiter_t* w = rw->writers_head; w; w = w->next) {
+            queued++;
+        }
+        if (rw->writer_pid != INVALID_PID) {
+            terminal_printf("  %d  %s: written by PID %d", rw->id, rw->name, rw->writer_pid);
+        } else {
+            terminal_printf("  %d  %s: %d readers", rw->id, rw->name, rw->readers);
+        }
+        terminal_printf(", %d queued; %d reads, %d writes, %d waited\n", queued,
+                        (int)rw->read_acquires, (int)rw->write_acquires, (int)rw->contended);
+        shown++;
+    }
+    if (!shown) {
+        terminal_writestring("  None created\n");
+    }
+}
+
+// Synchronous RPC. A call record lives on the client's stack: it waits
+// on the server mailbox's calls list, moves to serving once the server
+// takes it, and its state tells the client when the frame is its own
+// again. Queued calls are answered oldest first; the server may hold
+// several and answer them in any order.
+
+static bool rpc_unlink(ipc_rpc_call_t** list, ipc_rpc_call_t* call) {
+    for (ipc_rpc_call_t** link = list; *link; link = &(*link)->next) {
+        if (*link == call) {
+            *link = call->next;
+            return true;
+        }
+    }
+    return false;
+}
+
+// The oldest queued call, now being served (mailbox lock held)
+static ipc_rpc_call_t* rpc_take_locked(mailbox_t* mailbox) {
+    ipc_rpc_call_t* call = mailbox->calls;
+    if (call) {
+        mailbox->calls = call->next;
+        call->state = RPC_SERVING;
+        call->next = mailbox->serving;
+        mailbox->serving = call;
+    }
+    return call;
+}
+
+// Answer client_pid's call (mailbox lock held); returns the client to
+// wake, or NULL if it has no call being served here
+static process_t* rpc_answer_locked(mailbox_t* mailbox, int client_pid, const ipc_rpc_msg_t* reply) {
+    for (ipc_rpc_call_t** link = &mailbox->serving; *link; link = &(*link)->next) {
+        ipc_rpc_call_t* call = *link;
+        if (call->client->pid != client_pid) {
+            continue;
+        }
+        *link = call->next;
+        process_t* client = call->client;
+        if (reply) {
+            call->msg = *reply;
+        }
+        call->state = RPC_REPLIED;      // Its stack frame may go from here on
+        return client;
+    }
+    return NULL;
+}
+
+int ipc_call(int server_pid, const ipc_rpc_msg_t* msg, ipc_rpc_msg_t* reply) {
+    process_t* self = ipc_caller();
+    process_t* server = process_find(server_pid);
+    if (!self || !server || server == self || server->state == PROCESS_TERMINATED ||
+        !scheduler_preemptive) {
+        return -1;
+    }
+    mailbox_t* box = mailbox_get(server);
+    mailbox_t* own = mailbox_get(self);
+    if (!box || !own) {
+        return -1;
+    }
+    
+    ipc_rpc_call_t call;
+    call.client = self;
+    call.msg = *msg;
+    call.state = RPC_QUEUED;
+    call.server = box;
+    call.next = NULL;
+    bool can_sleep = self->pid != KERNEL_PID;
+    
+    // Queued and marked blocked before the lock drops, so the reply can't
+    // be missed
+    uint32_t flags = spin_lock_irqsave(&box->lock);
+    ipc_rpc_call_t** link = &box->calls;
+    while (*link) {
+        link = &(*link)->next;
+    }
+    *link = &call;
+    process_t* waiter = box->rpc_waiter;
+    box->rpc_waiter = NULL;
+    own->pending_call = &call;
+    if (can_sleep) {
+        process_prepare_block();
+    }
+    spin_unlock_irqrestore(&box->lock, flags);
+    
+    if (waiter && can_sleep) {
+        process_yield_to(waiter);       // Straight to the server
+    } else {
+        if (waiter) {
+            process_wake(waiter);
+        }
+        if (can_sleep) {
+            process_yield();
+        }
+    }
+    
+    // The kernel task, or nothing else runnable when the slice ended
+    while (call.state != RPC_REPLIED && call.state != RPC_FAILED) {
+        asm volatile ("sti; hlt");
+    }
+    own->pending_call = NULL;
+    if (call.state == RPC_FAILED) {
+        return -1;
+    }
+    if (reply) {
+        *reply = call.msg;
+    }
+    return 0;
+}
+
+int ipc_reply_wait(int reply_to, const ipc_rpc_msg_t* reply, ipc_rpc_msg_t* request) {
+    process_t* self = ipc_caller();
+    mailbox_t* box = self ? mailbox_get(self) : NULL;
+    if (!box) {
+        return -1;
+    }
+    bool can_sleep = self->pid != KERNEL_PID && scheduler_preemptive;
+    
+    uint32_t flags = spin_lock_irqsave(&box->lock);
+    process_t* client = reply_to >= 0 ? rpc_answer_locked(box, reply_to, reply) : NULL;
+    while (1) {
+        ipc_rpc_call_t* call = rpc_take_locked(box);
+        if (call || !can_sleep) {
+            int pid = -1;
+            if (call) {
+                *request = call->msg;
+                pid = call->client->pid;
+            }
+            spin_unlock_irqrestore(&box->lock, flags);
+            if (client) {
+                process_wake(client);   // More work queued: no handoff
+            }
+            return pid;
+        }
+        
+        box->rpc_waiter = self;
+        process_prepare_block();
+        spin_unlock_irqrestore(&box->lock, flags);
+        if (client) {
+            process_yield_to(client);   // The reverse handoff
+            client = NULL;
+        } else {
+            process_yield();
+        }
+        while (box->rpc_waiter == self) {
+            asm volatile ("sti; hlt");
+        }
+        flags = spin_lock_irqsave(&box->lock);
+    }
+}
+
+int ipc_reply(int client_pid, const ipc_rpc_msg_t* reply) {
+    process_t* self = ipc_caller();
+    mailbox_t* box = self ? self->mailbox : NULL;
+    if (!box) {
+        return -1;
+    }
+    uint32_t flags = spin_lock_irqsave(&box->lock);
+    process_t* client = rpc_answer_locked(box, client_pid, reply);
+    spin_unlock_irqrestore(&box->lock, flags);
+    if (!client) {
+        return -1;
+    }
+    process_wake(client);
+    return 0;
+}
+
+// A killed process's side of any call: a client's record leaves the
+// server's lists, a server's callers are failed
+static void rpc_cancel(process_t* process) {
+    mailbox_t* own = process->mailbox;
+    if (!own) {
+        return;
+    }
+    ipc_rpc_call_t* call = own->pending_call;
+    if (call) {
+        mailbox_t* box = call->server;
+        uint32_t flags = spin_lock_irqsave(&box->lock);
+        if (!rpc_unlink(&box->calls, call)) {
+            rpc_unlink(&box->serving, call);
+        }
+        own->pending_call = NULL;
+        spin_unlock_irqrestore(&box->lock, flags);
+    }
+    uint32_t flags = spin_lock_irqsave(&own->lock);
+    if (own->rpc_waiter == process) {
+        own->rpc_waiter = NULL;
+        rpc_fail_all_locked(own);
+    }
+    spin_unlock_irqrestore(&own->lock, flags);
+}
+
+// Drop a killed process from any semaphore, condition variable or rwlock
+// it waits on (its waiter record is on the stack being freed)
+void ipc_cancel_wait(process_t* process) {
+    rpc_cancel(process);
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+    for (semaphore_t* sem = semaphore_list_head; sem; sem = sem->next) {
+        sem_waiter_t* prev = NULL;
+        for (sem_waiter_t* w = sem->waiting_queue_head; w; prev = w, w = w->next) {
+            if (w->process != process) {
+                continue;
+            }
+            if (prev) {
+                prev->next = w->next;
+            } else {
+                sem->waiting_queue_head = w->next;
+            }
+            if (sem->waiting_queue_tail == w) {
+                sem->waiting_queue_tail = prev;
+            }
+            spin_unlock_irqrestore(&ipc_lock, flags);
+            return;  // A process waits on one object at a time
+        }
+    }
+    
+    // Pool walks under ipc_lock, each object's queue under its own lock
+    bool found = false;
+    ipc_condvar_t* cond;
+    POOL_FOR_EACH(condvar_pool, cond) {
+        spin_lock(&cond->lock);
+        found = waitq_unlink(&cond->waiters_head, &cond->waiters_tail, process);
+        spin_unlock(&cond->lock);
+        if (found) {
+            break;
+        }
+    }
+    ipc_rwlock_t* rw;
+    POOL_FOR_EACH(rwlock_pool, rw) {
+        if (found) {
+            break;
+        }
+        spin_lock(&rw->lock);
+        found = waitq_unlink(&rw->readers_head, &rw->readers_tail, process) ||
+                waitq_unlink(&rw->writers_head, &rw->writers_tail, process);
+        if (found && rw->writer_pid == INVALID_PID && !rw->writers_head) {
+            rw_admit_readers(rw);       // Queued only behind the writer that went
+        }
+        spin_unlock(&rw->lock);
+    }
+    spin_unlock_irqrestore(&ipc_lock, flags);
+}
+
+// Shared memory implementation
+static shared_memory_t* find_shared_memory(int shared_mem_id) {
+    return shm_pool_lookup(shared_mem_id);
+}
+
+// Create a segment of size bytes (rounded up to pages) backed by zeroed
+// frames; returns its ID. It lives until the last attached process detaches.
+int ipc_create_shared_memory(const char* name, size_t size) {
+    uint32_t count = (uint32_t)((size + PAGE_SIZE - 1) / PAGE_SIZE);
+    if (!name || count == 0 || size > IPC_SHM_MAX_SIZE) {
+        terminal_printf("❌ Shared memory size must be 1-%d KB\n", IPC_SHM_MAX_SIZE / 1024);
+        return -1;
+    }
+    
+    uint32_t* frames = (uint32_t*)kmalloc(count * sizeof(uint32_t));
+    if (!frames) {
+        terminal_printf("❌ Out of memory for shared memory\n");
+        return -1;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        frames[i] = pmm_alloc_zeroed_page();
+        if (!frames[i]) {
+            while (i-- > 0) {
+                pmm_free_page(frames[i]);
+            }
+            kfree(frames);
+            terminal_printf("❌ Out of physical memory for shared memory\n");
+            return -1;
+        }
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+    shared_memory_t* shm = shm_pool_alloc();
+    if (!shm) {
+        spin_unlock_irqrestore(&ipc_lock, flags);
+        for (uint32_t i = 0; i < count; i++) {
+            pmm_free_page(frames[i]);
+        }
+        kfree(frames);
+        terminal_printf("❌ No free shared memory slots available\n");
+        return -1;
+    }
+    
+    int id = shm->id = shm_pool_handle(shm);
+    shm->address = (void*)(IPC_SHM_BASE + (uint32_t)shm_pool_index(shm) * IPC_SHM_MAX_SIZE);
+    shm->size = size;
+    shm->page_count = count;
+    shm->frames = frames;
+    shm->owner_pid = current_process ? current_process->pid : KERNEL_PID;
+    shm->dying = false;
+    shm->attach_count = 0;
+    for (int i = 0; i < IPC_SHM_MAX_ATTACH; i++) {
+        shm->attached_pids[i] = INVALID_PID;
+    }
+    int j;
+    for (j = 0; j < 31 && name[j] != '\0'; j++) {
+        shm->name[j] = name[j];
+    }
+    shm->name[j] = '\0';
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    
+    terminal_printf("✅ Shared memory '%s' created (ID: %d, %d pages)\n", shm->name, id, (int)count);
+    return id;
+}
+
+// Map a segment into the calling process at the segment's address
+void* ipc_attach_shared_memory(int shared_mem_id) {
+    process_t* process = ipc_caller();
+    if (!process) {
+        return NULL;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+    shared_memory_t* shm = find_shared_memory(shared_mem_id);
+    if (!shm || shm->dying) {
+        spin_unlock_irqrestore(&ipc_lock, flags);
+        terminal_printf("❌ Shared memory ID %d not found\n", shared_mem_id);
+        return NULL;
+    }
+    int entry = -1;
+    for (int i = 0; i < IPC_SHM_MAX_ATTACH; i++) {
+        if (shm->attached_pids[i] == process->pid) {
+            spin_unlock_irqrestore(&ipc_lock, flags);
+            return shm->address;  // Already mapped here
+        }
+        if (entry < 0 && shm->attached_pids[i] == INVALID_PID) {
+            entry = i;
+        }
+    }
+    if (entry < 0) {
+        spin_unlock_irqrestore(&ipc_lock, flags);
+        terminal_printf("❌ Shared memory ID %d has too many users\n", shared_mem_id);
+        return NULL;
+    }
+    shm->attached_pids[entry] = process->pid;
+    shm->attach_count++;
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    
+    // Counted as attached, so the frames can't go away under the mapping
+    uint32_t base = (uint32_t)shm->address;
+    for (uint32_t i = 0; i < shm->page_count; i++) {
+        if (pmm_page_ref(shm->frames[i]) != 0) {
+            while (i-- > 0) {
+                vmm_unmap_page(process->page_directory, base + i * PAGE_SIZE);
+                pmm_free_page(shm->frames[i]);
+            }
+            flags = spin_lock_irqsave(&ipc_lock);
+            shm->attached_pids[entry] = INVALID_PID;
+            shm->attach_count--;
+            spin_unlock_irqrestore(&ipc_lock, flags);
+            terminal_printf("❌ Shared memory ID %d: frame shared too many times\n", shared_mem_id);
+            return NULL;
+        }
+        vmm_map_page(process->page_directory, base + i * PAGE_SIZE, shm->frames[i],
+                     PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER);
+    }
+    
+    terminal_printf("✅ Shared memory %d attached to PID %d\n", shared_mem_id, process->pid);
+    return shm->address;
+}
+
+// Unmap a segment from a process; the last detach frees the segment
+static int shm_detach(shared_memory_t* shm, process_t* process) {
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+    int entry = -1;
+    for (int i = 0; i < IPC_SHM_MAX_ATTACH && entry < 0; i++) {
+        if (shm->attached_pids[i] == process->pid) {
+            entry = i;
+        }
+    }
+    if (entry < 0) {
+        spin_unlock_irqrestore(&ipc_lock, flags);
+        return -1;
+    }
+    shm->attached_pids[entry] = INVALID_PID;
+    int last = (--shm->attach_count == 0);
+    if (last) {
+        shm->dying = true;  // No new attaches while it is torn down
+    }
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    
+    // The shootdown waits on other CPUs, so it runs without ipc_lock
+    page_directory_t* dir = process->page_directory;
+    uint32_t base = (uint32_t)shm->address;
+    tlb_batch_t batch;
+    smp_tlb_batch_init(&batch, dir);
+    for (uint32_t i = 0; i < shm->page_count; i++) {
+        vmm_unmap_page(dir, base + i * PAGE_SIZE);
+        smp_tlb_batch_add(&batch, base + i * PAGE_SIZE, 1);
+        smp_tlb_batch_free(&batch, shm->frames[i]);
+    }
+    smp_tlb_batch_flush(&batch);
+    
+    if (last) {
+        for (uint32_t i = 0; i < shm->page_count; i++) {
+            pmm_free_page(shm->frames[i]);  // The segment's own reference
+        }
+        kfree(shm->frames);
+        flags = spin_lock_irqsave(&ipc_lock);
+        shm->frames = NULL;
+        shm->page_count = 0;
+        shm->size = 0;
+        shm->id = -1;
+        shm_pool_free(shm);
+        spin_unlock_irqrestore(&ipc_lock, flags);
+    }
+    return last;
+}
+
+int ipc_detach_shared_memory(int shared_mem_id) {
+    process_t* process = ipc_caller();
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+    shared_memory_t* shm = find_shared_memory(shared_mem_id);
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    if (!shm || !process) {
+        terminal_printf("❌ Shared memory ID %d not found\n", shared_mem_id);
+        return -1;
+    }
+    
+    int result = shm_detach(shm, process);
+    if (result < 0) {
+        terminal_printf("❌ Shared memory %d is not attached to PID %d\n",
+                       shared_mem_id, process->pid);
+        return -1;
+    }
+    terminal_printf("✅ Shared memory %d detached%s\n", shared_mem_id,
+                   result ? " and freed" : "");
+    return 0;
+}
+
+// Detach everything a dying process still has mapped (its address space
+// is about to be destroyed)
+void ipc_shm_detach_all(process_t* process) {
+    shared_memory_t* shm;
+    POOL_FOR_EACH(shm_pool, shm) {
+        shm_detach(shm, process);
+    }
+}
+
+void ipc_list_shared_memory(void) {
+    terminal_writestring("🧩 Shared Memory Segments:\n");
+    bool found_any = false;
+    shared_memory_t* shm;
+    POOL_FOR_EACH(shm_pool, shm) {
+        found_any = true;
+        terminal_printf("  %d  %s  %d pages at %d, %d attached (owner PID %d)\n", shm->id,
+                        shm->name, (int)shm->page_count, (int)(uint32_t)shm->address,
+                        (int)shm->attach_count, shm->owner_pid);
+    }
+    if (!found_any) {
+        terminal_writestring("No shared memory segments\n");
+    }
+}
+
+// IPC statistics
+void ipc_proc_show(proc_seq_t* seq) {
+    proc_printf(seq, "messages.used: %u\n", (uint32_t)message_cache.in_use);
+    proc_printf(seq, "messages.total: %u\n", (uint32_t)message_cache.total);
+    proc_printf(seq, "messages.peak: %u\n", (uint32_t)message_cache.peak);
+    proc_printf(seq, "messages.sent: %u\n", stat_read(&stat_ipc_sent));
+    proc_printf(seq, "messages.received: %u\n", stat_read(&stat_ipc_received));
+    proc_printf(seq, "mailboxes.used: %u\n", (uint32_t)mailbox_cache.in_use);
+    proc_printf(seq, "semaphores.used: %u\n", (uint32_t)semaphore_cache.in_use);
+    proc_printf(seq, "semaphores.total: %u\n", (uint32_t)semaphore_cache.total);
+    proc_printf(seq, "semaphores.peak: %u\n", (uint32_t)semaphore_cache.peak);
+    proc_printf(seq, "semaphores.next_id: %d\n", next_semaphore_id);
+    proc_printf(seq, "condvars.used: %d\n", condvar_pool_count());
+    proc_printf(seq, "rwlocks.used: %d\n", rwlock_pool_count());
+}
+
+void ipc_stats(void) {
+    procfs_print(ipc_proc_show);
+}
+
+// ipc queue <init|stat|send|recv> <id> [text]: the shell's end of a
+// segment's mpmc queue, attaching the segment here first
+static void ipc_queue_command(int argc, char argv[][64]) {
+    int id = atoi(argv[3]);
+    uint32_t flags = spin_lock_irqsave(&ipc_lock);
+    shared_memory_t* shm = find_shared_memory(id);
+    size_t size = shm ? shm->size : 0;
+    spin_unlock_irqrestore(&ipc_lock, flags);
+    void* segment = size ? ipc_attach_shared_memory(id) : NULL;
+    if (!segment) {
+        terminal_printf("❌ Shared memory ID %d not found\n", id);
+        return;
+    }
+    
+    if (strcmp(argv[2], "init") == 0) {
+        mpmc_queue_t* queue = mpmc_init(segment, size);
+        if (!queue) {
+            terminal_writestring("❌ Segment too small for a queue\n");
+        } else {
+            terminal_printf("✅ Queue of %d messages in shared memory %d\n", (int)(queue->mask + 1), id);
+        }
+        return;
+    }
+    mpmc_queue_t* queue = mpmc_open(segment);
+    if (!queue) {
+        terminal_printf("❌ No queue in shared memory %d (ipc queue init %d)\n", id, id);
+    } else if (strcmp(argv[2], "stat") == 0) {
+        mpmc_dump(queue);
+    } else if (strcmp(argv[2], "send") == 0 && argc >= 5) {
+        int result = mpmc_try_send(queue, argv[4], (uint32_t)strlen(argv[4]) + 1);
+        if (result == MPMC_WOULD_BLOCK) {
+            terminal_writestring("Queue full\n");
+        } else if (result < 0) {
+            terminal_printf("❌ Messages are at most %d bytes\n", MPMC_MSG_SIZE);
+        }
+    } else if (strcmp(argv[2], "recv") == 0) {
+        char text[MPMC_MSG_SIZE + 1];
+        int length = mpmc_try_receive(queue, text, MPMC_MSG_SIZE);
+        if (length < 0) {
+            terminal_writestring("Queue empty\n");
+        } else {
+            text[length] = '\0';
+            terminal_printf("Received: %s\n", text);
+        }
+    } else {
+        terminal_writestring("Usage: ipc queue <init|stat|recv> <id> | send <id> <text>\n");
+    }
+}
+
+// IPC command handler
+void ipc_command_handler(int argc, char argv[][64]) {
+    if (argc < 2) {
+        terminal_writestring("IPC Commands:\n");
+        terminal_writestring("  ipc init        - Reset the IPC system\n");
+        terminal_writestring("  ipc send <pid> <message>  - Send message\n");
+        terminal_writestring("  ipc recv [pid]  - Receive message\n");
+        terminal_writestring("  ipc messages    - List all messages\n");
+        terminal_writestring("  ipc debug [on|off] - Log every send and receive\n");
+        terminal_writestring("  ipc sem create <name> <value> - Create semaphore\n");
+        terminal_writestring("  ipc sem wait <id>     - Wait on semaphore\n");
+        terminal_writestring("  ipc sem signal <id>   - Signal semaphore\n");
+        terminal_writestring("  ipc sem list    - List semaphores\n");
+        terminal_writestring("  ipc sem destroy <id>  - Destroy semaphore\n");
+        terminal_writestring("  ipc cond create|signal|broadcast|destroy|list - Condition variables\n");
+        terminal_writestring("  ipc rw create|rlock|runlock|wlock|wunlock|destroy|list - Reader-writer locks\n");
+        terminal_writestring("  ipc shm create <name> <bytes> - Create shared memory\n");
+        terminal_writestring("  ipc shm attach|detach <id>    - Map/unmap it in this process\n");
+        terminal_writestring("  ipc shm list    - List shared memory\n");
+        terminal_writestring("  ipc queue init|stat <id>  - Lock-free queue in a segment\n");
+        terminal_writestring("  ipc queue send <id> <text> | recv <id> - Without blocking\n");
+        terminal_writestring("  ipc stats       - Show IPC statistics\n");
+        return;
+    }
+    
+    // The first IPC command starts the system; an explicit init after
+    // that starts it over
+    int started = initcall_require("ipc");
+    if (strcmp(argv[1], "init") == 0) {
+        if (started == 0) {
+            ipc_init();
+        }
+    }
+    else if (strcmp(argv[1], "send") == 0) {
+        if (argc < 4) {
+            terminal_writestring("Usage: ipc send <pid> <message>\n");
+            return;
+        }
+        int pid = atoi(argv[2]);
+        int id = ipc_send_message(pid, argv[3], strlen(argv[3]));
+        if (id >= 0) {
+            terminal_printf("✅ Message %d sent to PID %d\n", id, pid);
+        } else {
+            terminal_printf("❌ Send to PID %d failed\n", pid);
+        }
+    }
+    else if (strcmp(argv[1], "recv") == 0) {
+        char buffer[MAX_MESSAGE_SIZE];
+        int sender_pid = (argc >= 3) ? atoi(argv[2]) : -1;
+        int result = ipc_receive_message(sender_pid, buffer, sizeof(buffer));
+        if (result >= 0) {
+            terminal_printf("Received from PID %d: \"%s\"\n", result, buffer);
+        } else {
+            terminal_writestring("No messages waiting\n");
+        }
+    }
+    else if (strcmp(argv[1], "debug") == 0) {
+        ipc_debug = (argc >= 3 && strcmp(argv[2], "off") == 0) ? 0 : 1;
+        terminal_printf("IPC message logging %s\n", ipc_debug ? "on" : "off");
+    }
+    else if (strcmp(argv[1], "messages") == 0) {
         ipc_list_messages();
     }
     else if (strcmp(argv[1], "sem") == 0) {
@@ -477,7 +1900,12 @@ void ipc_command_handler(int argc, char argv[][64]) {
                 return;
             }
             int id = atoi(argv[3]);
-            ipc_semaphore_wait(id);
+            int result = ipc_semaphore_wait(id);
+            if (result == 0) {
+                terminal_printf("✅ Semaphore %d acquired\n", id);
+            } else if (result == 1) {
+                terminal_printf("⏳ Semaphore %d busy (would block without a scheduler)\n", id);
+            }
         }
         else if (strcmp(argv[2], "signal") == 0) {
             if (argc < 4) {
@@ -485,7 +1913,9 @@ void ipc_command_handler(int argc, char argv[][64]) {
                 return;
             }
             int id = atoi(argv[3]);
-            ipc_semaphore_signal(id);
+            if (ipc_semaphore_signal(id) == 0) {
+                terminal_printf("✅ Semaphore %d signaled\n", id);
+            }
         }
         else if (strcmp(argv[2], "list") == 0) {
             ipc_list_semaphores();
@@ -499,6 +1929,71 @@ void ipc_command_handler(int argc, char argv[][64]) {
             ipc_destroy_semaphore(id);
         }
     }
+    else if (strcmp(argv[1], "cond") == 0) {
+        int id = argc >= 4 ? atoi(argv[3]) : 0;
+        if (argc >= 4 && strcmp(argv[2], "create") == 0) {
+            ipc_cond_create(argv[3]);
+        } else if (argc >= 4 && strcmp(argv[2], "signal") == 0) {
+            if (ipc_cond_signal(id) == 0) {
+                terminal_printf("✅ Condition variable %d signaled\n", id);
+            }
+        } else if (argc >= 4 && strcmp(argv[2], "broadcast") == 0) {
+            int woken = ipc_cond_broadcast(id);
+            if (woken >= 0) {
+                terminal_printf("✅ Condition variable %d: %d waiter(s) woken\n", id, woken);
+            }
+        } else if (argc >= 4 && strcmp(argv[2], "destroy") == 0) {
+            ipc_cond_destroy(id);
+        } else if (argc >= 3 && strcmp(argv[2], "list") == 0) {
+            ipc_list_condvars();
+        } else {
+            terminal_writestring("Usage: ipc cond <create <name>|signal <id>|broadcast <id>|destroy <id>|list>\n");
+        }
+    }
+    else if (strcmp(argv[1], "rw") == 0) {
+        int id = argc >= 4 ? atoi(argv[3]) : 0;
+        int result = -2;
+        if (argc >= 4 && strcmp(argv[2], "create") == 0) {
+            ipc_rwlock_create(argv[3]);
+        } else if (argc >= 4 && strcmp(argv[2], "rlock") == 0) {
+            result = ipc_read_lock(id);
+        } else if (argc >= 4 && strcmp(argv[2], "runlock") == 0) {
+            result = ipc_read_unlock(id);
+        } else if (argc >= 4 && strcmp(argv[2], "wlock") == 0) {
+            result = ipc_write_lock(id);
+        } else if (argc >= 4 && strcmp(argv[2], "wunlock") == 0) {
+            result = ipc_write_unlock(id);
+        } else if (argc >= 4 && strcmp(argv[2], "destroy") == 0) {
+            ipc_rwlock_destroy(id);
+        } else if (argc >= 3 && strcmp(argv[2], "list") == 0) {
+            ipc_list_rwlocks();
+        } else {
+            terminal_writestring("Usage: ipc rw <create <name>|rlock|runlock|wlock|wunlock|destroy <id>|list>\n");
+        }
+        if (result == 0) {
+            terminal_printf("✅ Lock %d: %s done\n", id, argv[2]);
+        } else if (result == 1) {
+            terminal_printf("⏳ Lock %d busy (would block without a scheduler)\n", id);
+        } else if (result == -1) {
+            terminal_printf("❌ Lock %d: no such lock, or not held that way\n", id);
+        }
+    }
+    else if (strcmp(argv[1], "shm") == 0) {
+        if (argc >= 5 && strcmp(argv[2], "create") == 0) {
+            ipc_create_shared_memory(argv[3], (size_t)atoi(argv[4]));
+        } else if (argc >= 4 && strcmp(argv[2], "attach") == 0) {
+            ipc_attach_shared_memory(atoi(argv[3]));
+        } else if (argc >= 4 && strcmp(argv[2], "detach") == 0) {
+            ipc_detach_shared_memory(atoi(argv[3]));
+        } else if (argc >= 3 && strcmp(argv[2], "list") == 0) {
+            ipc_list_shared_memory();
+        } else {
+            terminal_writestring("Usage: ipc shm <create <name> <bytes>|attach <id>|detach <id>|list>\n");
+        }
+    }
+    else if (strcmp(argv[1], "queue") == 0 && argc >= 4) {
+        ipc_queue_command(argc, argv);
+    }
     else if (strcmp(argv[1], "stats") == 0) {
         ipc_stats();
     }
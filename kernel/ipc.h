@@ -6,48 +6,172 @@
 
 #include "types.h"
 #include "process.h"
+#include "slab.h"
+#include "lock.h"
+#include "waitset.h"
+#include "mutex.h"
 
 // IPC configuration constants
-#define MAX_MESSAGES 16
+#define MAX_MESSAGES 16                // Messages preallocated at boot (cache grows past this)
 #define MAX_MESSAGE_SIZE 256
-#define MAX_SEMAPHORES 8
+#define MAX_SEMAPHORES 8               // Semaphores preallocated at boot (cache grows past this)
 #define INVALID_SEMAPHORE_ID -1
+#define IPC_MAILBOX_SIZE 16            // Messages a process can have queued (power of two)
+#define IPC_WAIT_FOREVER 0xFFFFFFFF    // Receive timeout that never expires
+
+// Page transfer: buffers move between address spaces by remapping their
+// frames. Each process receives them in a private window above kernel
+// space, one slot per buffer.
+#define IPC_MAX_PAGES 16               // Pages per transfer (64KB)
+#define IPC_WINDOW_BASE 0x4000000      // Transfer window start (per address space)
+#define IPC_WINDOW_SLOTS 16            // Buffers a process can hold at once
+#define IPC_WINDOW_SLOT_SIZE (IPC_MAX_PAGES * 4096)
 
 // Message structure for IPC
-typedef struct {
+typedef struct message {
+    int id;                            // Message ID
     int sender_pid;                    // Sender process ID
     int receiver_pid;                  // Receiver process ID
     size_t message_size;               // Message size in bytes
     char data[MAX_MESSAGE_SIZE];       // Message data
     bool is_used;                      // Message slot usage flag
     uint32_t timestamp;                // Message timestamp
+    uint32_t page_count;               // Page transfer: frames moved instead of data
+    uint32_t frames[IPC_MAX_PAGES];    // Physical frames, owned by the message in transit
+    uint32_t page_flags[IPC_MAX_PAGES];    // Their PTE permission bits in the sender
 } message_t;
 
-// Semaphore structure for process synchronization
+// Synchronous RPC (ipc_call / ipc_reply_wait): a few words copied straight
+// between the two tasks, with the CPU handed over directly each way
+#define IPC_RPC_WORDS 4
+
 typedef struct {
+    uint32_t words[IPC_RPC_WORDS];
+} ipc_rpc_msg_t;
+
+#define RPC_QUEUED      0              // Waiting for the server to take it
+#define RPC_SERVING     1              // Taken; the server owes a reply
+#define RPC_REPLIED     2
+#define RPC_FAILED      3              // The server went away
+
+// One outstanding call (lives on the caller's stack)
+typedef struct ipc_rpc_call {
+    process_t* client;
+    ipc_rpc_msg_t msg;                 // The request, then the reply
+    volatile int state;                // RPC_*
+    struct mailbox* server;            // Queued on this mailbox
+    struct ipc_rpc_call* next;
+} ipc_rpc_call_t;
+
+// Per-process receive queue: a bounded FIFO of message descriptors. Any
+// number of senders append under the mailbox's own lock, so unrelated
+// process pairs never contend.
+typedef struct mailbox {
+    message_t* slots[IPC_MAILBOX_SIZE];
+    uint32_t head;                     // Next slot to receive (free-running)
+    uint32_t tail;                     // Next slot to fill
+    spinlock_t lock;                   // Not registered: mailboxes come and go
+    process_t* waiter;                 // Owner blocked in a receive
+    uint32_t delivered;                // Messages queued here so far
+    uint32_t refused;                  // Sends that found the mailbox full
+    uint32_t window_map;               // Transfer window slots in use (bit per slot)
+    wait_source_t watchers;            // Wait sets told about each delivery
+    ipc_rpc_call_t* calls;             // RPC: calls not yet taken, oldest first
+    ipc_rpc_call_t* serving;           // Taken and not yet answered
+    process_t* rpc_waiter;             // Owner blocked in ipc_reply_wait
+    ipc_rpc_call_t* pending_call;      // As a client: the call it waits on
+} mailbox_t;
+
+// Outcome of a semaphore wait, set by the waker
+#define SEM_WAITING     0
+#define SEM_GRANTED     1              // Handed the unit directly by a signal
+#define SEM_DESTROYED   2
+
+// A blocked waiter (lives on the waiting process's stack)
+typedef struct sem_waiter {
+    process_t* process;
+    volatile int status;
+    struct sem_waiter* next;
+} sem_waiter_t;
+
+// Semaphore structure for process synchronization
+typedef struct semaphore {
     int id;                            // Semaphore ID
     int value;                         // Semaphore value (resource count)
     bool is_used;                      // Semaphore slot usage flag
-    process_t* waiting_queue_head;     // Waiting processes queue head
-    process_t* waiting_queue_tail;     // Waiting processes queue tail
+    sem_waiter_t* waiting_queue_head;  // Waiting processes queue head (FIFO)
+    sem_waiter_t* waiting_queue_tail;  // Waiting processes queue tail
     char name[32];                     // Semaphore name
     uint32_t creation_time;            // Creation timestamp
+    struct semaphore* next;            // Next active semaphore
+    wait_source_t watchers;            // Wait sets told when a unit comes free
 } semaphore_t;
 
+// Condition variables and reader-writer locks live in fixed pools and
+// are named by pool handles. Each has a lock of its own, so unrelated
+// objects (and a reader taking a free rwlock) never meet on ipc_lock.
+// Waiters use the semaphore's waiter record and SEM_* outcomes.
+#define MAX_CONDVARS 8
+#define MAX_RWLOCKS 8
+
+typedef struct {
+    int id;                            // Pool handle, INVALID_SEMAPHORE_ID once destroyed
+    char name[32];
+    spinlock_t lock;                   // Unregistered: survives in the pool slot
+    sem_waiter_t* waiters_head;        // FIFO of sleepers in ipc_cond_wait
+    sem_waiter_t* waiters_tail;
+    uint32_t signals;                  // Waiters woken, all told
+} ipc_condvar_t;
+
+// Readers share it while no writer holds it or waits for it; a writer
+// that arrives queues new readers behind it, and releasing a write lock
+// lets every queued reader in at once before the next writer, so neither
+// side starves
+typedef struct {
+    int id;
+    char name[32];
+    spinlock_t lock;
+    int readers;                       // Holding it shared
+    int writer_pid;                    // Holding it exclusive (INVALID_PID: nobody)
+    sem_waiter_t* readers_head;        // Queued behind a writer
+    sem_waiter_t* readers_tail;
+    sem_waiter_t* writers_head;
+    sem_waiter_t* writers_tail;
+    uint32_t read_acquires;
+    uint32_t write_acquires;
+    uint32_t contended;                // Acquires that had to queue
+} ipc_rwlock_t;
+
+// Shared memory: segments are backed by PMM frames and mapped at the same
+// address (one fixed window per segment) in every process that attaches.
+// Each mapping holds a frame reference; the last detach frees the frames.
+#define MAX_SHARED_MEMORY 8
+#define IPC_SHM_MAX_ATTACH 8           // Processes attached to one segment
+#define IPC_SHM_BASE 0x5000000         // Segment windows, above the transfer window
+#define IPC_SHM_MAX_SIZE 0x100000      // Window per segment (1MB)
+
 // Shared memory structure
 typedef struct {
-    int id;                            // Shared memory ID
-    void* address;                     // Memory address
+    int id;                            // Shared memory ID (pool handle)
+    void* address;                     // Virtual address in every attached process
     size_t size;                       // Memory size
+    uint32_t page_count;
+    uint32_t* frames;                  // Physical frames (the segment holds one reference)
     int owner_pid;                     // Owner process ID
-    bool is_used;                      // Usage flag
+    bool dying;                        // Last detach in progress
+    uint32_t attach_count;
+    int attached_pids[IPC_SHM_MAX_ATTACH];  // INVALID_PID for a free entry
     char name[32];                     // Shared memory name
 } shared_memory_t;
 
 // Global IPC data structures
-extern message_t message_pool[MAX_MESSAGES];
-extern semaphore_t semaphore_pool[MAX_SEMAPHORES];
+extern kmem_cache_t message_cache;
+extern kmem_cache_t semaphore_cache;
+extern kmem_cache_t mailbox_cache;
+extern semaphore_t* semaphore_list_head;
 extern int next_semaphore_id;
+extern int ipc_debug;                  // Log every send and receive
+extern bool ipc_caches_ready;          // ipc_init has run
 
 // IPC initialization
 void ipc_init(void);
@@ -55,7 +179,27 @@ void ipc_init(void);
 // Message passing functions
 int ipc_send_message(int receiver_pid, const char* data, size_t size);
 int ipc_receive_message(int sender_pid, char* buffer, size_t buffer_size);
+int ipc_receive_message_timeout(int sender_pid, char* buffer, size_t buffer_size,
+                                uint32_t timeout_ms);
 int ipc_message_count(int pid);
+void ipc_mailbox_release(process_t* process);
+mailbox_t* ipc_process_mailbox(process_t* process);
+
+// Synchronous RPC. ipc_call sends msg to server_pid, switches straight to
+// it if it is waiting, and sleeps until the reply (0, or -1 if the server
+// doesn't exist or goes away). ipc_reply_wait answers reply_to (if not
+// -1), then waits for the next call, switching straight back to the
+// client when there is none yet; it returns the new caller's PID with its
+// request in *request. ipc_reply only answers.
+int ipc_call(int server_pid, const ipc_rpc_msg_t* msg, ipc_rpc_msg_t* reply);
+int ipc_reply_wait(int reply_to, const ipc_rpc_msg_t* reply, ipc_rpc_msg_t* request);
+int ipc_reply(int client_pid, const ipc_rpc_msg_t* reply);
+
+// Zero-copy page transfer
+void* ipc_alloc_pages(size_t size);
+int ipc_send_pages(int receiver_pid, void* addr, size_t size);
+int ipc_receive_pages(int sender_pid, void** addr, size_t* size, uint32_t timeout_ms);
+int ipc_release_pages(void* addr);
 void ipc_list_messages(void);
 
 // Semaphore functions
@@ -65,18 +209,48 @@ int ipc_semaphore_signal(int semaphore_id);
 int ipc_destroy_semaphore(int semaphore_id);
 void ipc_list_semaphores(void);
 semaphore_t* ipc_find_semaphore(int semaphore_id);
+int ipc_watch_semaphore(int semaphore_id, wait_entry_t* entry);
+
+// Condition variables. ipc_cond_wait queues the caller before it releases
+// mutex, so a signal sent after the release is never missed, and takes
+// mutex again before returning: 0 once signalled, -1 if the condition
+// was destroyed, 1 (mutex still held) when the caller can't sleep.
+int ipc_cond_create(const char* name);
+int ipc_cond_wait(int cond_id, mutex_t* mutex);
+int ipc_cond_signal(int cond_id);          // Wake the oldest waiter
+int ipc_cond_broadcast(int cond_id);       // Wake them all; how many, or -1
+int ipc_cond_destroy(int cond_id);
+void ipc_list_condvars(void);
+
+// Reader-writer locks: the lock calls return 0 once held, -1 for no such
+// lock (or destroyed while waiting), 1 when the caller would have to
+// sleep and can't
+int ipc_rwlock_create(const char* name);
+int ipc_read_lock(int rwlock_id);
+int ipc_read_unlock(int rwlock_id);
+int ipc_write_lock(int rwlock_id);
+int ipc_write_unlock(int rwlock_id);       // -1 unless the caller holds it
+int ipc_rwlock_destroy(int rwlock_id);
+void ipc_list_rwlocks(void);
 
 // Shared memory functions (basic implementation)
 int ipc_create_shared_memory(const char* name, size_t size);
 void* ipc_attach_shared_memory(int shared_mem_id);
 int ipc_detach_shared_memory(int shared_mem_id);
+void ipc_shm_detach_all(process_t* process);
+void ipc_list_shared_memory(void);
 
 // IPC command handlers
 void ipc_command_handler(int argc, char argv[][64]);
 
 // Helper functions
-void ipc_add_to_waiting_queue(semaphore_t* sem, process_t* process);
-process_t* ipc_remove_from_waiting_queue(semaphore_t* sem);
+void ipc_add_to_waiting_queue(semaphore_t* sem, sem_waiter_t* waiter);
+sem_waiter_t* ipc_remove_from_waiting_queue(semaphore_t* sem);
+void ipc_cancel_wait(process_t* process);
 void ipc_stats(void);
 
+// /proc/ipc: message, mailbox and semaphore usage
+struct proc_seq;
+void ipc_proc_show(struct proc_seq* seq);
+
 #endif // IPC_H
\ No newline at end of file
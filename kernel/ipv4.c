@@ -0,0 +1,426 @@
+// ClaudeOS IPv4 Stack Implementation - Day 21
+// Frames are parsed and answered in the buffers they arrived in; headers
+// are pushed into packet headroom on the way out
+
+#include "ipv4.h"
+#include "arp.h"
+#include "udp.h"
+#include "tcp.h"
+#include "timer.h"
+#include "pmm.h"
+#include "kernel.h"
+
+static ipv4_template_t ipv4_templates[MAX_NETWORK_INTERFACES];
+
+// The echo reply ping is waiting for (written by the RX work)
+static volatile uint16_t ping_wanted_seq = 0;
+static volatile uint16_t ping_reply_seq = 0;
+static volatile uint64_t ping_reply_ns = 0;
+static volatile uint32_t ping_reply_size = 0;
+
+static uint32_t ipv4_received = 0;
+static uint32_t ipv4_dropped = 0;
+static uint32_t icmp_echoes_answered = 0;
+
+static inline ipv4_template_t* ipv4_template(network_interface_t* iface) {
+    return &ipv4_templates[iface - network_interfaces];
+}
+
+// Ones' complement sum 32 bits at a time. The sum doesn't depend on byte
+// order (RFC 1071), so words are added as they lie in memory with the
+// carry wrapped back in (adc), and only the folded result is swapped into
+// the network-order values callers keep in sum.
+uint32_t ipv4_checksum_add(uint32_t sum, const void* data, size_t len) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint32_t acc = 0;
+    for (; len >= 16; bytes += 16, len -= 16) {
+        asm ("addl 0(%2), %0\n\t"
+             "adcl 4(%2), %0\n\t"
+             "adcl 8(%2), %0\n\t"
+             "adcl 12(%2), %0\n\t"
+             "adcl $0, %0"
+             : "=r" (acc) : "0" (acc), "r" (bytes) : "cc", "memory");
+    }
+    for (; len >= 4; bytes += 4, len -= 4) {
+        asm ("addl (%2), %0\n\t"
+             "adcl $0, %0"
+             : "=r" (acc) : "0" (acc), "r" (bytes) : "cc", "memory");
+    }
+    uint32_t tail = 0;
+    if (len >= 2) {
+        tail = bytes[0] | ((uint32_t)bytes[1] << 8);
+        bytes += 2;
+        len -= 2;
+    }
+    if (len) {
+        tail += bytes[0];  // The low byte of a little-endian word
+    }
+    acc += tail;
+    if (acc < tail) {
+        acc++;
+    }
+    acc = (acc & 0xFFFF) + (acc >> 16);
+    acc = (acc & 0xFFFF) + (acc >> 16);
+    return sum + (((acc & 0xFF) << 8) | (acc >> 8));
+}
+
+// The RFC 1071 byte loop, kept to measure the word loop against
+static uint32_t ipv4_checksum_add_bytes(uint32_t sum, const uint8_t* bytes, size_t len) {
+    size_t i = 0;
+    for (; i + 1 < len; i += 2) {
+        sum += ((uint32_t)bytes[i] << 8) | bytes[i + 1];
+    }
+    if (i < len) {
+        sum += (uint32_t)bytes[i] << 8;
+    }
+    return sum;
+}
+
+uint16_t ipv4_checksum_fold(uint32_t sum) {
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+// Fill in the TCP/UDP checksum offset bytes into the L4 header at
+// packet->data. Segments that stay on this host aren't summed at all; a
+// NIC with TX offload is left the pseudo-header sum to finish. A page
+// fragment is summed where it lies, carrying on from the linear bytes.
+void ipv4_l4_checksum(network_interface_t* iface, network_packet_t* packet, uint32_t src,
+                      uint32_t dest, uint8_t protocol, uint32_t offset) {
+    uint32_t sum = (src >> 16) + (src & 0xFFFF) + (dest >> 16) + (dest & 0xFFFF) +
+                   protocol + (uint32_t)network_packet_length(packet);
+    uint8_t* field = packet->data + offset;
+    uint16_t checksum = 0;
+    if (!iface) {
+        packet->csum = NET_CSUM_IP_OK | NET_CSUM_L4_OK;
+    } else if (iface->features & NET_FEATURE_TX_CSUM) {
+        checksum = (uint16_t)~ipv4_checksum_fold(sum);
+        packet->csum = NET_CSUM_PARTIAL;
+        packet->csum_start = (uint16_t)(packet->data - packet->head);
+        packet->csum_offset = (uint16_t)offset;
+    } else {
+        field[0] = field[1] = 0;
+        if (packet->frag_frame && (packet->size & 1)) {
+            network_packet_linearize(packet);  // The fragment's words would be misaligned
+        }
+        sum = ipv4_checksum_add(sum, packet->data, packet->size);
+        if (packet->frag_frame) {
+            sum = ipv4_checksum_add(sum, (uint8_t*)PHYS_TO_VIRT(packet->frag_frame) + packet->frag_offset,
+                                    packet->frag_size);
+        }
+        checksum = ipv4_checksum_fold(sum);
+        if (checksum == 0 && protocol == IPV4_PROTO_UDP) {
+            checksum = 0xFFFF;  // 0 means "no checksum" to UDP
+        }
+    }
+    field[0] = (uint8_t)(checksum >> 8);
+    field[1] = (uint8_t)checksum;
+}
+
+int eth_output(network_interface_t* iface, const uint8_t* dest, uint16_t type,
+               network_packet_t* packet) {
+    eth_header_t* eth = (eth_header_t*)network_packet_push(packet, ETH_HEADER_SIZE);
+    if (!eth) {
+        network_free_packet(packet);
+        return -1;
+    }
+    for (int i = 0; i < ETH_ALEN; i++) {
+        eth->dest[i] = dest[i];
+        eth->src[i] = iface->mac_address[i];
+    }
+    eth->type = net_htons(type);
+    return network_transmit(iface->id, packet);
+}
+
+int ipv4_output(network_interface_t* iface, uint32_t dest, uint8_t protocol,
+                network_packet_t* packet) {
+    ipv4_template_t* template = ipv4_template(iface);
+    ipv4_header_t* ip = (ipv4_header_t*)network_packet_push(packet, IPV4_HEADER_SIZE);
+    if (!ip) {
+        network_free_packet(packet);
+        return -1;
+    }
+
+    // Copy the fixed header, then fold only the four variable fields into
+    // the precomputed sum
+    *ip = template->header;
+    uint16_t length = (uint16_t)network_packet_length(packet);
+    uint16_t id = __sync_fetch_and_add(&template->next_id, 1);  // RX queues reply concurrently
+    ip->total_length = net_htons(length);
+    ip->id = net_htons(id);
+    ip->protocol = protocol;
+    ip->dest = net_htonl(dest);
+    uint32_t sum = template->partial_sum + length + id + protocol + (dest >> 16) + (dest & 0xFFFF);
+    ip->checksum = net_htons(ipv4_checksum_fold(sum));
+
+    uint32_t next_hop = dest;
+    if (dest != IPV4_BROADCAST && ((dest ^ iface->ip_address) & iface->netmask) != 0) {
+        next_hop = iface->gateway;
+        if (!next_hop) {
+            network_free_packet(packet);
+            return -1;  // No route
+        }
+    }
+    return arp_output(iface, next_hop, packet);
+}
+
+// Interface to send to dest from: one whose subnet holds it, else the
+// first with a gateway
+network_interface_t* ipv4_route(uint32_t dest) {
+    network_interface_t* fallback = NULL;
+    for (int i = 0; i < MAX_NETWORK_INTERFACES; i++) {
+        network_interface_t* iface = &network_interfaces[i];
+        if (iface->id == -1 || !iface->enabled || !iface->rx_queues[0].work.func) {
+            continue;
+        }
+        if (((dest ^ iface->ip_address) & iface->netmask) == 0) {
+            return iface;
+        }
+        if (!fallback && iface->gateway) {
+            fallback = iface;
+        }
+    }
+    return fallback;
+}
+
+// Loopback addresses and our own: traffic to these never reaches a NIC
+bool ipv4_is_local(uint32_t addr) {
+    if ((addr >> 24) == 127) {
+        return true;
+    }
+    for (int i = 0; i < MAX_NETWORK_INTERFACES; i++) {
+        if (network_interfaces[i].id != -1 && network_interfaces[i].enabled &&
+            network_interfaces[i].ip_address == addr) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void icmp_input(network_interface_t* iface, network_packet_t* packet, uint32_t src) {
+    if (packet->size < ICMP_HEADER_SIZE || ipv4_checksum_fold(ipv4_checksum_add(0, packet->data, packet->size)) != 0) {
+        ipv4_dropped++;
+        network_free_packet(packet);
+        return;
+    }
+    icmp_header_t* icmp = (icmp_header_t*)packet->data;
+    if (icmp->type == ICMP_ECHO_REQUEST && icmp->code == 0) {
+        // Turn the request around in place: the headers it came with left
+        // exactly the headroom the reply's headers need
+        icmp->type = ICMP_ECHO_REPLY;
+        icmp->checksum = 0;
+        icmp->checksum = net_htons(ipv4_checksum_fold(ipv4_checksum_add(0, packet->data, packet->size)));
+        icmp_echoes_answered++;
+        ipv4_output(iface, src, IPV4_PROTO_ICMP, packet);
+        return;
+    }
+    if (icmp->type == ICMP_ECHO_REPLY && net_ntohs(icmp->id) == ICMP_PING_ID &&
+        net_ntohs(icmp->sequence) == ping_wanted_seq) {
+        ping_reply_ns = clock_ns();
+        ping_reply_size = packet->size;
+        ping_reply_seq = net_ntohs(icmp->sequence);
+    }
+    network_free_packet(packet);
+}
+
+static void ipv4_input(network_interface_t* iface, network_packet_t* packet) {
+    ipv4_header_t* ip = (ipv4_header_t*)packet->data;
+    uint32_t header_size = (ip->version_ihl & 0x0F) * 4;
+    if (packet->size < IPV4_HEADER_SIZE || (ip->version_ihl >> 4) != 4 ||
+        header_size < IPV4_HEADER_SIZE || header_size > packet->size) {
+        ipv4_dropped++;
+        network_free_packet(packet);
+        return;
+    }
+    uint16_t length = net_ntohs(ip->total_length);
+    uint32_t dest = net_ntohl(ip->dest);
+    // Fragments (MF set or a non-zero offset) are not reassembled
+    if (length < header_size || length > packet->size ||
+        (net_ntohs(ip->frag_offset) & 0x3FFF) != 0 ||
+        (dest != iface->ip_address && dest != IPV4_BROADCAST) ||
+        (!(packet->csum & NET_CSUM_IP_OK) && ipv4_checksum_fold(ipv4_checksum_add(0, ip, header_size)) != 0)) {
+        ipv4_dropped++;
+        network_free_packet(packet);
+        return;
+    }
+    ipv4_received++;
+    packet->size = length;  // Drop Ethernet padding
+    uint32_t src = net_ntohl(ip->src);
+    uint8_t protocol = ip->protocol;
+    network_packet_pull(packet, header_size);
+
+    if (protocol == IPV4_PROTO_ICMP) {
+        icmp_input(iface, packet, src);
+    } else if (protocol == IPV4_PROTO_UDP) {
+        udp_input(packet, src, dest);
+    } else if (protocol == IPV4_PROTO_TCP) {
+        tcp_input(packet, src, dest);
+    } else {
+        network_free_packet(packet);
+    }
+}
+
+// Work item, one per RX queue: the stack is the only consumer of an
+// attached interface's queues, and the queues run concurrently
+static void ipv4_rx_work(void* arg) {
+    net_rx_queue_t* queue = (net_rx_queue_t*)arg;
+    network_interface_t* iface = queue->iface;
+    network_packet_t* packet;
+    while ((packet = network_receive_queue(queue)) != NULL) {
+        if (packet->size < ETH_HEADER_SIZE) {
+            network_free_packet(packet);
+            continue;
+        }
+        uint16_t type = net_ntohs(((eth_header_t*)packet->data)->type);
+        network_packet_pull(packet, ETH_HEADER_SIZE);
+        if (type == ETH_TYPE_ARP) {
+            arp_input(iface, packet);
+        } else if (type == ETH_TYPE_IPV4) {
+            ipv4_input(iface, packet);
+        } else {
+            network_free_packet(packet);
+        }
+    }
+}
+
+void ipv4_attach(network_interface_t* iface) {
+    ipv4_template_t* template = ipv4_template(iface);
+    ipv4_header_t* h = &template->header;
+    h->version_ihl = 0x45;
+    h->tos = 0;
+    h->total_length = 0;
+    h->id = 0;
+    h->frag_offset = net_htons(0x4000);  // Don't fragment
+    h->ttl = IPV4_DEFAULT_TTL;
+    h->protocol = 0;
+    h->checksum = 0;
+    h->src = net_htonl(iface->ip_address);
+    h->dest = 0;
+    // The variable fields are zero here, so this sums just the fixed ones
+    template->partial_sum = ipv4_checksum_add(0, h, IPV4_HEADER_SIZE);
+    template->next_id = 1;
+    for (int q = 0; q < NET_RX_QUEUES; q++) {
+        work_init(&iface->rx_queues[q].work, ipv4_rx_work, &iface->rx_queues[q]);
+    }
+}
+
+// Print a microsecond count as milliseconds with three decimals
+static void icmp_print_ms(uint32_t us) {
+    uint32_t fraction = us % 1000;
+    terminal_printf("%d.%s%s%d", (int)(us / 1000), fraction < 100 ? "0" : "",
+                    fraction < 10 ? "0" : "", (int)fraction);
+}
+
+void icmp_ping(network_interface_t* iface, uint32_t dest, int count) {
+    char ip_str[16];
+    network_format_ip_address(dest, ip_str, sizeof(ip_str));
+    terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK));
+    terminal_printf("PING %s from %s: %d data bytes\n", ip_str, iface->name,
+                    NETWORK_PING_SIZE - ICMP_HEADER_SIZE);
+    terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+
+    int received = 0;
+    uint32_t min = 0xFFFFFFFF, max = 0, total = 0;
+    for (int seq = 1; seq <= count; seq++) {
+        network_packet_t* packet = network_alloc_packet();
+        uint8_t* body = packet ? network_packet_put(packet, NETWORK_PING_SIZE) : NULL;
+        if (!body) {
+            network_free_packet(packet);
+            terminal_writestring("ping: out of packet buffers\n");
+            break;
+        }
+        icmp_header_t* icmp = (icmp_header_t*)body;
+        icmp->type = ICMP_ECHO_REQUEST;
+        icmp->code = 0;
+        icmp->checksum = 0;
+        icmp->id = net_htons(ICMP_PING_ID);
+        icmp->sequence = net_htons((uint16_t)seq);
+        for (int i = ICMP_HEADER_SIZE; i < NETWORK_PING_SIZE; i++) {
+            body[i] = (uint8_t)i;
+        }
+        icmp->checksum = net_htons(ipv4_checksum_fold(ipv4_checksum_add(0, body, NETWORK_PING_SIZE)));
+
+        ping_wanted_seq = (uint16_t)seq;
+        ping_reply_seq = 0;
+        uint64_t start = clock_ns();
+        if (ipv4_output(iface, dest, IPV4_PROTO_ICMP, packet) != 0) {
+            terminal_writestring("ping: no route to host\n");
+            break;
+        }
+
+        // The reply is handled by the RX work; run it here when nothing
+        // else will (no worker, or no preemption to give it the CPU)
+        uint32_t deadline = timer_get_ticks() + ICMP_PING_TIMEOUT_MS * TIMER_FREQUENCY / 1000;
+        while (ping_reply_seq != seq && (int32_t)(deadline - timer_get_ticks()) > 0) {
+            workqueue_idle();
+            if (ping_reply_seq != seq) {
+                asm volatile ("sti; hlt");
+            }
+        }
+        if (ping_reply_seq != seq) {
+            terminal_printf("Request timeout for icmp_seq %d\n", seq);
+            continue;
+        }
+        uint32_t us = (uint32_t)(ping_reply_ns - start) / 1000;
+        terminal_printf("%d bytes from %s: icmp_seq=%d time=", (int)ping_reply_size, ip_str, seq);
+        icmp_print_ms(us);
+        terminal_writestring(" ms\n");
+        received++;
+        total += us;
+        if (us < min) min = us;
+        if (us > max) max = us;
+    }
+    ping_wanted_seq = 0;
+
+    terminal_printf("\n--- %s ping statistics ---\n", ip_str);
+    terminal_printf("%d packets transmitted, %d received\n", count, received);
+    if (received > 0) {
+        terminal_writestring("rtt min/avg/max = ");
+        icmp_print_ms(min);
+        terminal_writestring("/");
+        icmp_print_ms(total / received);
+        terminal_writestring("/");
+        icmp_print_ms(max);
+        terminal_writestring(" ms\n");
+    }
+    terminal_printf("IPv4: %d received, %d dropped, %d echo requests answered\n",
+                    (int)ipv4_received, (int)ipv4_dropped, (int)icmp_echoes_answered);
+}
+
+// Time the word loop against the byte loop over MSS-sized payloads
+void ipv4_checksum_benchmark(void) {
+    static uint8_t buffer[IPV4_CHECKSUM_BENCH_SIZE];
+    for (uint32_t i = 0; i < sizeof(buffer); i++) {
+        buffer[i] = (uint8_t)(i * 7 + 3);
+    }
+    if (!clock_tsc_khz()) {
+        terminal_writestring("  No TSC: cycle counts unavailable\n");
+        return;
+    }
+    uint32_t words = 0, bytes = 0;
+    uint64_t start = clock_cycles();
+    for (int i = 0; i < IPV4_CHECKSUM_BENCH_ROUNDS; i++) {
+        words += ipv4_checksum_fold(ipv4_checksum_add(0, buffer, sizeof(buffer)));
+    }
+    uint32_t word_cycles = (uint32_t)(clock_cycles() - start);
+    start = clock_cycles();
+    for (int i = 0; i < IPV4_CHECKSUM_BENCH_ROUNDS; i++) {
+        bytes += ipv4_checksum_fold(ipv4_checksum_add_bytes(0, buffer, sizeof(buffer)));
+    }
+    uint32_t byte_cycles = (uint32_t)(clock_cycles() - start);
+
+    uint32_t total = IPV4_CHECKSUM_BENCH_ROUNDS * sizeof(buffer);
+    // Hundredths of a byte per cycle; total * 100 stays within 32 bits
+    uint32_t word_rate = word_cycles ? total * 100 / word_cycles : 0;
+    uint32_t byte_rate = byte_cycles ? total * 100 / byte_cycles : 0;
+    terminal_printf("  %d x %d bytes, results %s\n", IPV4_CHECKSUM_BENCH_ROUNDS,
+                    IPV4_CHECKSUM_BENCH_SIZE, words == bytes ? "match" : "DIFFER");
+    terminal_printf("  32-bit adc loop: %d.%s%d bytes/cycle (%d cycles per packet)\n",
+                    (int)(word_rate / 100), word_rate % 100 < 10 ? "0" : "", (int)(word_rate % 100),
+                    (int)(word_cycles / IPV4_CHECKSUM_BENCH_ROUNDS));
+    terminal_printf("  byte loop:       %d.%s%d bytes/cycle (%d cycles per packet)\n",
+                    (int)(byte_rate / 100), byte_rate % 100 < 10 ? "0" : "", (int)(byte_rate % 100),
+                    (int)(byte_cycles / IPV4_CHECKSUM_BENCH_ROUNDS));
+}
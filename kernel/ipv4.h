@@ -0,0 +1,104 @@
+// ClaudeOS IPv4 Stack - Day 21
+// Ethernet framing, IPv4 input/output and ICMP echo over NIC interfaces
+
+#ifndef IPV4_H
+#define IPV4_H
+
+#include "types.h"
+#include "network.h"
+
+#define ETH_ALEN            6
+#define ETH_HEADER_SIZE     14
+#define ETH_TYPE_IPV4       0x0800
+#define ETH_TYPE_ARP        0x0806
+
+#define IPV4_HEADER_SIZE    20          // No options, ever, on output
+#define IPV4_DEFAULT_TTL    64
+#define IPV4_PROTO_ICMP     1
+#define IPV4_BROADCAST      0xFFFFFFFF
+
+#define ICMP_HEADER_SIZE    8
+#define ICMP_ECHO_REPLY     0
+#define ICMP_ECHO_REQUEST   8
+
+#define ICMP_PING_ID        0x4344      // Identifier on our echo requests
+#define ICMP_PING_TIMEOUT_MS 1000
+
+typedef struct {
+    uint8_t dest[ETH_ALEN];
+    uint8_t src[ETH_ALEN];
+    uint16_t type;                      // Network byte order
+} __attribute__((packed)) eth_header_t;
+
+typedef struct {
+    uint8_t version_ihl;
+    uint8_t tos;
+    uint16_t total_length;
+    uint16_t id;
+    uint16_t frag_offset;
+    uint8_t ttl;
+    uint8_t protocol;
+    uint16_t checksum;
+    uint32_t src;
+    uint32_t dest;
+} __attribute__((packed)) ipv4_header_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t code;
+    uint16_t checksum;
+    uint16_t id;
+    uint16_t sequence;
+} __attribute__((packed)) icmp_header_t;
+
+// Everything in a header but the length, ID, protocol and destination is
+// fixed per interface, so output copies a template and finishes a sum
+// that already covers the fixed words
+typedef struct {
+    ipv4_header_t header;
+    uint32_t partial_sum;               // Ones' complement sum of the fixed words
+    uint16_t next_id;
+} ipv4_template_t;
+
+static inline uint16_t net_htons(uint16_t value) {
+    return (uint16_t)((value << 8) | (value >> 8));
+}
+
+static inline uint32_t net_htonl(uint32_t value) {
+    return (value << 24) | ((value & 0xFF00) << 8) | ((value >> 8) & 0xFF00) | (value >> 24);
+}
+
+#define net_ntohs net_htons
+#define net_ntohl net_htonl
+
+#define IPV4_CHECKSUM_BENCH_SIZE   1460
+#define IPV4_CHECKSUM_BENCH_ROUNDS 1000
+
+// Internet checksum over len bytes, added to sum (network-order 16-bit
+// values); fold reduces a sum to the complemented 16-bit checksum
+uint32_t ipv4_checksum_add(uint32_t sum, const void* data, size_t len);
+uint16_t ipv4_checksum_fold(uint32_t sum);
+void ipv4_l4_checksum(network_interface_t* iface, network_packet_t* packet, uint32_t src,
+                      uint32_t dest, uint8_t protocol, uint32_t offset);
+void ipv4_checksum_benchmark(void);
+
+// Run the stack on iface: its RX ring is drained by the work queue from
+// then on, so nothing else may consume it
+void ipv4_attach(network_interface_t* iface);
+
+// Prepend an Ethernet header and transmit (takes over the packet)
+int eth_output(network_interface_t* iface, const uint8_t* dest, uint16_t type,
+               network_packet_t* packet);
+
+// Prepend an IPv4 header and route the packet to dest, on this
+// interface's subnet or via its gateway (takes over the packet)
+int ipv4_output(network_interface_t* iface, uint32_t dest, uint8_t protocol,
+                network_packet_t* packet);
+
+network_interface_t* ipv4_route(uint32_t dest);
+bool ipv4_is_local(uint32_t addr);
+
+// Echo dest count times from iface and print RTTs (TSC clock)
+void icmp_ping(network_interface_t* iface, uint32_t dest, int count);
+
+#endif // IPV4_H
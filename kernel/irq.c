@@ -0,0 +1,219 @@
+// ClaudeOS IRQ Dispatch Implementation - Day 21
+// Chains only ever grow, and a new action is fully written before it is
+// linked in, so the dispatcher walks them without taking the lock. Each
+// dispatch is timed with the TSC from entry to EOI; the local APIC
+// vectors fire on every CPU at once, so the counters are updated atomically.
+
+#include "irq.h"
+#include "pic.h"
+#include "lock.h"
+#include "kernel.h"
+#include "timer.h"
+#include "string.h"
+#include "stats.h"
+#include "procfs.h"
+#include "smp.h"
+
+STAT_DEFINE(stat_irq_taken, "irq.taken", STAT_COUNTER, "interrupts dispatched, all vectors");
+STAT_DEFINE(stat_irq_unhandled, "irq.unhandled", STAT_COUNTER, "interrupts no handler claimed");
+
+typedef struct irq_action {
+    irq_handler_t handler;
+    void* ctx;
+    struct irq_action* next;
+} irq_action_t;
+
+typedef struct {
+    irq_action_t* actions;
+    uint32_t count;                     // Interrupts taken
+    uint32_t unhandled;                 // No handler claimed them
+    uint32_t spurious;                  // 8259 IRQ7/15 with no request behind them
+    uint64_t total_ns;                  // Time in the handlers, EOI included
+    uint32_t max_ns;
+    uint32_t hist[IRQ_HIST_BUCKETS];
+    uint32_t seen_count;                // count at the last irqstat
+} irq_desc_t;
+
+static irq_desc_t irq_descs[IRQ_COUNT];
+static irq_action_t irq_action_pool[IRQ_MAX_ACTIONS];
+static uint32_t irq_actions_used = 0;
+static uint32_t irq_msi_used = 0;       // MSI vectors handed out, in order
+static spinlock_t irq_lock;             // Unregistered; guards the pool and chain tails
+static uint32_t irq_seen_tick = 0;      // When irqstat last looked
+
+static const char* const irq_hist_labels[IRQ_HIST_BUCKETS] = {
+    "<1us", "<4us", "<16us", "<64us", "<256us", "<1ms", "<4ms", "more"
+};
+
+// Record one dispatch that took cycles TSC cycles
+static void irq_account(irq_desc_t* desc, uint64_t cycles) {
+    uint32_t mult;
+    uint64_t base;
+    clock_tsc_params(&mult, &base);
+    if (cycles > 0xFFFFFFFF) {
+        cycles = 0xFFFFFFFF;
+    }
+    uint64_t ns64 = ((uint64_t)(uint32_t)cycles * mult) >> CLOCK_NS_SHIFT;
+    uint32_t ns = ns64 > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)ns64;
+
+    uint32_t bucket = 0;
+    for (uint32_t units = ns >> 10; units && bucket < IRQ_HIST_BUCKETS - 1; units >>= 2) {
+        bucket++;
+    }
+    __sync_fetch_and_add(&desc->hist[bucket], 1);
+    __sync_fetch_and_add(&desc->total_ns, (uint64_t)ns);
+    uint32_t max = desc->max_ns;
+    while (ns > max && !__sync_bool_compare_and_swap(&desc->max_ns, max, ns)) {
+        max = desc->max_ns;
+    }
+}
+
+int irq_register(uint8_t irq, irq_handler_t handler, void* ctx) {
+    if (irq >= IRQ_COUNT || !handler) {
+        return -1;
+    }
+    uint32_t flags = spin_lock_irqsave(&irq_lock);
+    if (irq_actions_used == IRQ_MAX_ACTIONS) {
+        spin_unlock_irqrestore(&irq_lock, flags);
+        return -1;
+    }
+    irq_action_t* action = &irq_action_pool[irq_actions_used++];
+    action->handler = handler;
+    action->ctx = ctx;
+    action->next = NULL;
+
+    irq_action_t** link = &irq_descs[irq].actions;
+    int first = (*link == NULL);
+    while (*link) {
+        link = &(*link)->next;
+    }
+    __sync_synchronize();
+    *link = action;
+    spin_unlock_irqrestore(&irq_lock, flags);
+
+    if (first && irq < IRQ_LINES) {
+        pic_clear_mask(irq);
+    }
+    return 0;
+}
+
+int irq_alloc_msi(void) {
+    uint32_t flags = spin_lock_irqsave(&irq_lock);
+    int irq = -1;
+    if (irq_msi_used < IRQ_MSI_COUNT) {
+        irq = IRQ_MSI_BASE + (int)irq_msi_used++;
+    }
+    spin_unlock_irqrestore(&irq_lock, flags);
+    return irq;
+}
+
+int irq_dispatch(uint32_t vector) {
+    uint32_t irq = vector - IRQ_VECTOR_BASE;
+    if (irq >= IRQ_COUNT) {
+        return IRQ_NONE;
+    }
+    irq_desc_t* desc = &irq_descs[irq];
+    if (irq < IRQ_LINES && pic_spurious((uint8_t)irq)) {
+        desc->spurious++;
+        return IRQ_NONE;
+    }
+
+    uint64_t start = clock_cycles();
+    __sync_fetch_and_add(&desc->count, 1);
+    stat_inc(&stat_irq_taken);
+    int result = IRQ_NONE;
+    for (irq_action_t* action = desc->actions; action; action = action->next) {
+        result |= action->handler(action->ctx);
+    }
+    if (!(result & IRQ_HANDLED)) {
+        desc->unhandled++;
+        stat_inc(&stat_irq_unhandled);
+    }
+    if (irq < IRQ_LINES) {
+        pic_send_eoi((uint8_t)irq);
+    } else if (irq >= IRQ_MSI_BASE && irq < IRQ_MSI_BASE + IRQ_MSI_COUNT) {
+        lapic_eoi();
+    }
+    if (start) {
+        irq_account(desc, clock_cycles() - start);
+    }
+    return result;
+}
+
+void irq_proc_show(proc_seq_t* seq) {
+    proc_puts(seq, "  IRQ  Vector  Handlers  Count     Unhandled  Spurious\n");
+    for (uint32_t irq = 0; irq < IRQ_COUNT; irq++) {
+        irq_desc_t* desc = &irq_descs[irq];
+        if (!desc->actions && !desc->count && !desc->spurious) {
+            continue;
+        }
+        int handlers = 0;
+        for (irq_action_t* action = desc->actions; action; action = action->next) {
+            handlers++;
+        }
+        proc_printf(seq, "  %u    %u      %d         %u       %u          %u\n", irq,
+                    irq + IRQ_VECTOR_BASE, handlers, desc->count, desc->unhandled,
+                    desc->spurious);
+    }
+}
+
+void irq_dump(void) {
+    procfs_print(irq_proc_show);
+}
+
+void irq_stat_command(int argc, char argv[][64]) {
+    if (argc >= 2 && strcmp(argv[1], "reset") == 0) {
+        for (uint32_t irq = 0; irq < IRQ_COUNT; irq++) {
+            irq_desc_t* desc = &irq_descs[irq];
+            desc->total_ns = 0;
+            desc->max_ns = 0;
+            memset(desc->hist, 0, sizeof(desc->hist));
+            desc->seen_count = desc->count;
+        }
+        irq_seen_tick = timer_get_ticks();
+        terminal_writestring("IRQ statistics reset\n");
+        return;
+    } else if (argc >= 2) {
+        terminal_writestring("Usage: irqstat [reset]\n");
+        return;
+    }
+
+    uint32_t now = timer_get_ticks();
+    uint32_t elapsed = now - irq_seen_tick;
+    irq_seen_tick = now;
+    terminal_printf("Interrupts over the last %d ms%s\n", (int)(elapsed * (1000 / TIMER_FREQUENCY)),
+                    clock_tsc_khz() ? "" : " (no TSC: handler times not measured)");
+    terminal_writestring("  IRQ  Vector  Count     Rate/s  Avg ns  Max ns\n");
+    for (uint32_t irq = 0; irq < IRQ_COUNT; irq++) {
+        irq_desc_t* desc = &irq_descs[irq];
+        uint32_t count = desc->count;
+        if (!count) {
+            continue;
+        }
+        uint32_t recent = count - desc->seen_count;
+        desc->seen_count = count;
+        uint32_t rate = 0;
+        if (elapsed) {
+            rate = recent / elapsed * TIMER_FREQUENCY + (recent % elapsed) * TIMER_FREQUENCY / elapsed;
+        }
+        uint32_t timed = 0;
+        for (uint32_t b = 0; b < IRQ_HIST_BUCKETS; b++) {
+            timed += desc->hist[b];
+        }
+        uint32_t avg = 0;
+        if (timed) {
+            uint64_t total = desc->total_ns;
+            avg = total > 0xFFFFFFFF ? 0xFFFFFFFF / timed : (uint32_t)total / timed;
+        }
+        terminal_printf("  %d    %d      %d       %d      %d     %d\n", (int)irq,
+                        (int)(irq + IRQ_VECTOR_BASE), (int)count, (int)rate, (int)avg,
+                        (int)desc->max_ns);
+        terminal_writestring("       ");
+        for (uint32_t b = 0; b < IRQ_HIST_BUCKETS; b++) {
+            if (desc->hist[b]) {
+                terminal_printf(" %s:%d", irq_hist_labels[b], (int)desc->hist[b]);
+            }
+        }
+        terminal_writestring("\n");
+    }
+}
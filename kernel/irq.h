@@ -0,0 +1,51 @@
+// ClaudeOS IRQ Dispatch - Day 21
+// Every interrupt vector from 32 up is an entry in one table: the 16 device
+// lines first, then the local APIC's own vectors (irq = vector - 32), among
+// them a block handed out to PCI devices for MSI.
+// Drivers register a handler and a context pointer for their line; lines
+// can be shared, in which case every handler on the chain is called and
+// each one checks whether its device raised the interrupt. Device lines are
+// acknowledged by the dispatcher once the chain has run, so handlers don't
+// send EOIs, and neither are MSI vectors; the local APIC's own vectors
+// acknowledge themselves.
+
+#ifndef IRQ_H
+#define IRQ_H
+
+#include "types.h"
+
+#define IRQ_VECTOR_BASE     32
+#define IRQ_LINES           16          // 8259 / I/O APIC device lines
+#define IRQ_COUNT           48          // Vectors 32-79
+#define IRQ_MSI_BASE        19          // Vectors 51-58: message-signalled, one device each
+#define IRQ_MSI_COUNT       8
+#define IRQ_MAX_ACTIONS     32          // Handlers registered across all lines
+#define IRQ_HIST_BUCKETS    8           // Handler times: <1us, <4us, ... x4 each, and beyond
+
+// Handler results
+#define IRQ_NONE            0           // Not this device
+#define IRQ_HANDLED         1
+#define IRQ_RESCHEDULE      2           // | IRQ_HANDLED: tick the scheduler on the way out
+#define IRQ_YIELD           4           // | IRQ_HANDLED: switch on the way out, no tick
+
+typedef int (*irq_handler_t)(void* ctx);
+
+// Add handler to irq's chain; a device line is unmasked with its first
+// handler. 0 on success, -1 if irq is out of range or the pool is full.
+int irq_register(uint8_t irq, irq_handler_t handler, void* ctx);
+
+// Claim an unused MSI vector; returns its irq, -1 once they are all taken
+int irq_alloc_msi(void);
+
+// Run vector's chain and acknowledge it; returns the handlers' results OR'ed
+int irq_dispatch(uint32_t vector);
+
+// /proc/interrupts: every vector with a handler or a count
+struct proc_seq;
+void irq_proc_show(struct proc_seq* seq);
+void irq_dump(void);
+
+// Shell: irqstat [reset] - rates since the last look, handler times
+void irq_stat_command(int argc, char argv[][64]);
+
+#endif // IRQ_H
@@ -4,6 +4,22 @@
 ; External functions
 extern isr_handler
 extern irq_handler
+extern process_finish_switch
+
+%define GDT_KERNEL_PERCPU 0x28  ; kernel/gdt.h
+
+; Load the saved data segment (in AX) into DS/ES/FS, and GS for a ring 3
+; frame. A kernel frame keeps the per-CPU segment the stub loaded, since
+; the frame may have been saved on another CPU.
+%macro RESTORE_SEGMENTS 0
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    cmp ax, 0x10
+    je %%kernel
+    mov gs, ax
+%%kernel:
+%endmacro
 
 ; Macro to create ISR stub without error code
 %macro ISR_NOERRCODE 1
@@ -68,6 +84,18 @@ IRQ 12, 44  ; Mouse
 IRQ 13, 45  ; FPU
 IRQ 14, 46  ; ATA 1
 IRQ 15, 47  ; ATA 2
+IRQ 16, 48  ; Local APIC timer (scheduler tick on the APs)
+IRQ 17, 79  ; Local APIC spurious
+IRQ 18, 49  ; TLB shootdown IPI
+IRQ 19, 50  ; Scheduler yield (int from process_yield)
+IRQ 20, 51  ; MSI
+IRQ 21, 52  ; MSI
+IRQ 22, 53  ; MSI
+IRQ 23, 54  ; MSI
+IRQ 24, 55  ; MSI
+IRQ 25, 56  ; MSI
+IRQ 26, 57  ; MSI
+IRQ 27, 58  ; MSI
 
 ; Common ISR handler
 isr_common_stub:
@@ -80,15 +108,13 @@ isr_common_stub:
     mov ds, ax
     mov es, ax
     mov fs, ax
-    mov gs, ax
+    mov ax, GDT_KERNEL_PERCPU
+    mov gs, ax          ; This CPU's cpu_t
     
     call isr_handler    ; Call C handler
     
     pop eax             ; Restore data segment
-    mov ds, ax
-    mov es, ax
-    mov fs, ax
-    mov gs, ax
+    RESTORE_SEGMENTS
     
     popa                ; Restore all general purpose registers
     add esp, 8          ; Clean up error code and interrupt number
@@ -106,15 +132,16 @@ irq_common_stub:
     mov ds, ax
     mov es, ax
     mov fs, ax
-    mov gs, ax
+    mov ax, GDT_KERNEL_PERCPU
+    mov gs, ax          ; This CPU's cpu_t
     
-    call irq_handler    ; Call C handler
+    push esp            ; Pass the register frame
+    call irq_handler    ; Returns the frame to resume (another task's on preemption)
+    mov esp, eax        ; Switch to that task's stack
+    call process_finish_switch  ; Requeue the task we left, now that it is off its stack
     
     pop eax             ; Restore data segment
-    mov ds, ax
-    mov es, ax
-    mov fs, ax
-    mov gs, ax
+    RESTORE_SEGMENTS
     
     popa                ; Restore all general purpose registers
     add esp, 8          ; Clean up error code and IRQ number
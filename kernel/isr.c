@@ -5,6 +5,18 @@
 #include "types.h"
 #include "timer.h"
 #include "keyboard.h"
+#include "serial.h"
+#include "vmm.h"
+#include "process.h"
+#include "kstack.h"
+#include "fpu.h"
+#include "softirq.h"
+#include "pic.h"
+#include "printk.h"
+#include "irq.h"
+#include "profile.h"
+#include "trace.h"
+#include "idle.h"
 
 // Register structure for ISR context
 struct registers {
@@ -36,6 +48,20 @@ static const char* exception_names[] = {
 
 // ISR handler function
 void isr_handler(struct registers regs) {
+    // Page faults inside a registered area are resolved and retried
+    uint32_t fault_addr = 0;
+    if (regs.int_no == 14) {
+        asm volatile ("mov %%cr2, %0" : "=r" (fault_addr));
+        if (vmm_handle_page_fault(fault_addr, regs.err_code) == 0) {
+            return;
+        }
+    }
+    
+    // #NM: another process's FPU state is loaded - switch it lazily
+    if (regs.int_no == FPU_NM_VECTOR && fpu_handle_nm() == 0) {
+        return;
+    }
+    
     // Get exception name
     const char* exception_name;
     if (regs.int_no < 15) {
@@ -43,8 +69,21 @@ void isr_handler(struct registers regs) {
     } else {
         exception_name = exception_names[15]; // "Unknown Interrupt"
     }
-    
-    // Display exception information
+
+    // A fault in ring 3 only ends the process that took it; its kernel
+    // stack holds nothing but this frame, so it is never resumed
+    if ((regs.cs & 3) == 3 && current_process && current_process->pid != KERNEL_PID) {
+        terminal_printf("[PROCESS] '%s' (PID %d) killed: %s\n", current_process->info->name,
+                        current_process->pid, exception_name);
+        process_exit(-1);
+        while (1) {
+            asm volatile ("sti; hlt");
+        }
+    }
+
+    // Display exception information, after what the log still holds
+    printk_drain(0);
+    serial_flush();
     terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_RED));
     terminal_writestring("\n*** EXCEPTION OCCURRED ***\n");
     
@@ -68,6 +107,22 @@ void isr_handler(struct registers regs) {
         terminal_writestring("(Present)\n");
     }
     
+    if (regs.int_no == 14) {
+        terminal_printf("Faulting address: %dKB (%s, %s)\n", (int)(fault_addr / 1024),
+                        (regs.err_code & PF_WRITE) ? "write" : "read",
+                        (regs.err_code & PF_PRESENT) ? "protection" : "not present");
+        if (kstack_is_guard(fault_addr)) {
+            terminal_writestring("Kernel stack overflow (guard page hit)\n");
+        }
+        
+        // Invalid access by a process: kill it. Processes run on the kernel
+        // stack, so there is no context to return to and we still halt.
+        if (current_process && current_process->pid != KERNEL_PID &&
+            current_process->state == PROCESS_RUNNING) {
+            process_kill(current_process->pid);
+        }
+    }
+    
     terminal_writestring("System halted due to exception.\n");
     
     // Halt the system
@@ -76,25 +131,25 @@ void isr_handler(struct registers regs) {
     }
 }
 
-// IRQ handler function
-void irq_handler(struct registers regs) {
-    // Check if this is a spurious interrupt from the slave PIC
-    if (regs.int_no >= 40) {
-        // Send EOI to slave PIC
-        // (We'll implement this when we add PIC functions)
+// IRQ handler function. Returns the register frame to resume, which is a
+// different task's frame when the timer tick preempts the current one.
+uint32_t irq_handler(struct registers* regs) {
+    // Top halves only acknowledge the device and raise a softirq; the
+    // scheduler ticks reschedule after those have run. The spurious
+    // vector has no handler and needs no EOI.
+    idle_irq_enter();
+    TRACE(TRACE_IRQ, regs->int_no, regs->eip);
+    if (profile_active) {
+        profile_sample(regs->int_no, regs->eip, regs->cs, regs->ebp, (uint32_t)regs);
     }
+    int result = irq_dispatch(regs->int_no);
     
-    // Handle specific IRQs
-    switch (regs.int_no) {
-        case 32:  // IRQ0 - Timer
-            timer_handler();
-            break;
-        case 33:  // IRQ1 - Keyboard
-            keyboard_handler();
-            break;
-        default:
-            // Unknown IRQ - just send EOI
-            // For now, we'll handle this in each specific handler
-            break;
+    softirq_irq_exit();
+    if (result & IRQ_RESCHEDULE) {
+        return process_preempt((uint32_t)regs);
+    }
+    if ((result & IRQ_YIELD) || percpu_read(need_resched)) {
+        return process_reschedule((uint32_t)regs);
     }
+    return (uint32_t)regs;
 }
\ No newline at end of file
@@ -0,0 +1,174 @@
+// ClaudeOS Shell Jobs Implementation - Day 21
+// Only the shell touches the table. A job's thread reads nothing but its
+// own arguments, which stay put until the job has ended and been reported.
+
+#include "jobs.h"
+#include "process.h"
+#include "keyboard.h"
+#include "kernel.h"
+#include "string.h"
+
+typedef struct {
+    bool used;
+    int pid;
+    command_handler_t handler;
+    int argc;
+    char argv[JOB_MAX_ARGS][COMMAND_ARG_LEN];
+    char line[JOB_LINE];
+} job_t;
+
+static job_t jobs[JOB_MAX];
+
+// A job's thread: the command, then the exit kthreads take on return
+static void job_main(void* arg) {
+    job_t* job = (job_t*)arg;
+    job->handler(job->argc, job->argv);
+}
+
+static inline int job_number(const job_t* job) {
+    return (int)(job - jobs) + 1;
+}
+
+// Terminated, or already reaped
+static bool job_ended(const job_t* job) {
+    process_t* process = process_find(job->pid);
+    return !process || process->state == PROCESS_TERMINATED;
+}
+
+static const char* job_status(const job_t* job) {
+    process_t* process = process_find(job->pid);
+    if (!process || process->state == PROCESS_TERMINATED) {
+        return process && process->info->exit_code == -1 ? "Killed" : "Done";
+    }
+    return process->stopped ? "Stopped" : "Running";
+}
+
+int job_start(command_handler_t handler, int argc, char argv[][COMMAND_ARG_LEN]) {
+    if (!scheduler_preemptive) {
+        terminal_writestring("Background jobs need preemption: proc preempt on\n");
+        return -1;
+    }
+    job_t* job = NULL;
+    for (int i = 0; i < JOB_MAX && !job; i++) {
+        if (!jobs[i].used) {
+            job = &jobs[i];
+        }
+    }
+    if (!job) {
+        terminal_printf("Too many jobs (%d)\n", JOB_MAX);
+        return -1;
+    }
+
+    job->handler = handler;
+    job->argc = argc < JOB_MAX_ARGS ? argc : JOB_MAX_ARGS;
+    job->line[0] = '\0';
+    size_t length = 0;
+    for (int i = 0; i < job->argc; i++) {
+        strcpy(job->argv[i], argv[i]);
+        for (const char* c = argv[i]; *c && length < JOB_LINE - 1; c++) {
+            job->line[length++] = *c;
+        }
+        if (i + 1 < job->argc && length < JOB_LINE - 1) {
+            job->line[length++] = ' ';
+        }
+    }
+    job->line[length] = '\0';
+
+    char name[32];
+    strncpy(name, argv[0], sizeof(name) - 1);
+    name[sizeof(name) - 1] = '\0';
+    job->used = true;
+    job->pid = kthread_create(job_main, job, name);
+    if (job->pid == INVALID_PID) {
+        job->used = false;
+        terminal_writestring("Couldn't start the job\n");
+        return -1;
+    }
+    terminal_printf("[%d] %d\n", job_number(job), job->pid);
+    return job_number(job);
+}
+
+void jobs_report(void) {
+    for (int i = 0; i < JOB_MAX; i++) {
+        if (jobs[i].used && job_ended(&jobs[i])) {
+            terminal_printf("[%d]  %s  %s\n", i + 1, job_status(&jobs[i]), jobs[i].line);
+            jobs[i].used = false;
+        }
+    }
+}
+
+void jobs_command(int argc, char argv[][COMMAND_ARG_LEN]) {
+    (void)argv;
+    if (argc > 1) {
+        terminal_writestring("Usage: jobs\n");
+        return;
+    }
+    for (int i = 0; i < JOB_MAX; i++) {
+        if (!jobs[i].used) {
+            continue;
+        }
+        terminal_printf("[%d]  %s  %s  (pid %d)\n", i + 1, job_status(&jobs[i]), jobs[i].line,
+                        jobs[i].pid);
+        if (job_ended(&jobs[i])) {
+            jobs[i].used = false;
+        }
+    }
+}
+
+// The job fg or bg names: [%]n, or the newest one still going
+static job_t* job_argument(int argc, char argv[][COMMAND_ARG_LEN], const char* command) {
+    if (argc > 2) {
+        terminal_printf("Usage: %s [n]\n", command);
+        return NULL;
+    }
+    if (argc == 2) {
+        int number = atoi(argv[1][0] == '%' ? argv[1] + 1 : argv[1]);
+        if (number < 1 || number > JOB_MAX || !jobs[number - 1].used || job_ended(&jobs[number - 1])) {
+            terminal_printf("%s: no job %s\n", command, argv[1]);
+            return NULL;
+        }
+        return &jobs[number - 1];
+    }
+    for (int i = JOB_MAX - 1; i >= 0; i--) {
+        if (jobs[i].used && !job_ended(&jobs[i])) {
+            return &jobs[i];
+        }
+    }
+    terminal_printf("%s: no current job\n", command);
+    return NULL;
+}
+
+void fg_command(int argc, char argv[][COMMAND_ARG_LEN]) {
+    job_t* job = job_argument(argc, argv, "fg");
+    if (!job) {
+        return;
+    }
+    terminal_printf("%s\n", job->line);
+    terminal_flush();
+    process_signal(job->pid, SIGCONT);
+
+    // Ctrl+C / Ctrl+Z reach it while the shell sleeps here
+    keyboard_set_foreground(job->pid);
+    int status = 0;
+    int result = process_wait_job(job->pid, &status);
+    keyboard_set_foreground(INVALID_PID);
+    if (result == PROCESS_WAIT_STOPPED) {
+        terminal_printf("\n[%d]+  Stopped  %s\n", job_number(job), job->line);
+        return;
+    }
+    job->used = false;  // Reaped by the wait (or by the reaper before it)
+}
+
+void bg_command(int argc, char argv[][COMMAND_ARG_LEN]) {
+    job_t* job = job_argument(argc, argv, "bg");
+    if (!job) {
+        return;
+    }
+    process_t* process = process_find(job->pid);
+    if (!process || !process->stopped) {
+        terminal_printf("bg: job %d is already running\n", job_number(job));
+        return;
+    }
+    process_signal(job->pid, SIGCONT);
+    terminal_printf("[%d]+ %s &\n", job_number(job), job->line);
+}
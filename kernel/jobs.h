@@ -0,0 +1,33 @@
+// ClaudeOS Shell Jobs - Day 21
+// "cmd &" runs a command in a kernel thread of its own, so the console
+// stays free while it works; its output goes straight to the screen,
+// between the shell's. fg waits for a job with Ctrl+C and Ctrl+Z sent to
+// it as SIGINT and SIGTSTP, and bg lets a stopped one carry on. Jobs need
+// preemption to share the CPU with the shell, and run on an ordinary
+// kernel-thread stack (one page): the deepest commands belong in the
+// foreground.
+
+#ifndef JOBS_H
+#define JOBS_H
+
+#include "types.h"
+#include "command.h"
+
+#define JOB_MAX         8
+#define JOB_MAX_ARGS    16              // The shell's MAX_ARGS
+#define JOB_LINE        64              // Command line kept for jobs (truncated)
+
+// Run handler(argc, argv) as a background job and print its number;
+// the arguments are copied. Returns the number, or -1.
+int job_start(command_handler_t handler, int argc, char argv[][COMMAND_ARG_LEN]);
+
+// Before the prompt: report the jobs that ended since the last look and
+// free their numbers
+void jobs_report(void);
+
+// Shell: jobs, fg [n], bg [n] - n defaults to the newest job
+void jobs_command(int argc, char argv[][COMMAND_ARG_LEN]);
+void fg_command(int argc, char argv[][COMMAND_ARG_LEN]);
+void bg_command(int argc, char argv[][COMMAND_ARG_LEN]);
+
+#endif // JOBS_H
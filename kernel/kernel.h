@@ -31,6 +31,9 @@ void terminal_putchar(char c);
 void terminal_setcolor(uint8_t color);
 void terminal_clear(void);
 void terminal_scroll(void);
+void terminal_flush(void);              // Copy pending output to the screen
+void terminal_write(const char* data, size_t size);
+void terminal_write_console(const char* data, size_t size, uint8_t color);
 
 // Utility Functions
 size_t strlen(const char* str);
@@ -60,5 +63,20 @@ void test_process_ipc_receiver(void);
 void test_process_producer(void);
 void test_process_consumer(void);
 void test_process_simple(void);
+void test_process_ping(void);
+void test_process_pong(void);
+
+// Ping-pong round trips between two test tasks: NULL with the cycles for
+// all of them, or why it couldn't run
+#define PINGPONG_YIELD      0
+#define PINGPONG_SEMAPHORE  1
+#define PINGPONG_MESSAGE    2
+#define PINGPONG_RPC        3
+const char* test_pingpong(int mode, uint32_t rounds, uint64_t* cycles);
+
+// Ring 3 test processes (in the user image)
+void test_user_hello(void);
+void test_user_fault(void);
+void test_user_badptr(void);
 
 #endif // KERNEL_H
\ No newline at end of file
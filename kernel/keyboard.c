@@ -4,6 +4,11 @@
 #include "keyboard.h"
 #include "pic.h"
 #include "kernel.h"
+#include "process.h"
+#include "ring.h"
+#include "softirq.h"
+#include "irq.h"
+#include "lock.h"
 
 // US QWERTY keyboard layout (lowercase)
 static const char scancode_to_ascii[] = {
@@ -28,17 +33,33 @@ static int shift_pressed = 0;
 static int caps_lock = 0;
 static int ctrl_pressed = 0;
 
-// Simple circular buffer for keyboard input
-#define KEYBOARD_BUFFER_SIZE 256
+// Keyboard input ring: the keyboard softirq produces, the shell consumes
+#define KEYBOARD_BUFFER_SIZE 256    // Power of two
 static char keyboard_buffer[KEYBOARD_BUFFER_SIZE];
-static volatile int buffer_start = 0;
-static volatile int buffer_end = 0;
+static ring_t keyboard_ring;
+
+// The process reading keyboard_ring (the shell, in the kernel task, until
+// someone calls keyboard_wait_char), and whether it sleeps until a key
+static spinlock_t keyboard_lock;
+static int keyboard_reader = KERNEL_PID;
+static bool keyboard_reader_sleeping = false;
+static int keyboard_foreground = INVALID_PID;
+
+// Raw scancodes from the IRQ, decoded by the keyboard softirq
+#define SCANCODE_BUFFER_SIZE 64     // Power of two
+static uint8_t scancode_buffer[SCANCODE_BUFFER_SIZE];
+static ring_t scancode_ring;
+
+static void keyboard_softirq(void);
+static int keyboard_irq(void* ctx);
 
 // Initialize keyboard
 void keyboard_init(void) {
     // Clear keyboard buffer
-    buffer_start = 0;
-    buffer_end = 0;
+    ring_init(&keyboard_ring, keyboard_buffer, KEYBOARD_BUFFER_SIZE, sizeof(char));
+    ring_init(&scancode_ring, scancode_buffer, SCANCODE_BUFFER_SIZE, sizeof(uint8_t));
+    softirq_register(SOFTIRQ_KEYBOARD, keyboard_softirq);
+    spin_lock_init(&keyboard_lock, "keyboard");
     
     // Reset keyboard state
     shift_pressed = 0;
@@ -46,12 +67,26 @@ void keyboard_init(void) {
     ctrl_pressed = 0;
     
     // Enable keyboard IRQ (IRQ1)
-    pic_clear_mask(IRQ1_KEYBOARD);
+    irq_register(IRQ1_KEYBOARD, keyboard_irq, NULL);
 }
 
-// Keyboard interrupt handler
-void keyboard_handler(void) {
-    uint8_t scancode = inb(KEYBOARD_DATA_PORT);
+// A key is in the ring: wake the reader if it sleeps, or keep it
+// responsive if it polls
+static void keyboard_wake_reader(void) {
+    uint32_t flags = spin_lock_irqsave(&keyboard_lock);
+    process_t* reader = process_find(keyboard_reader);
+    bool sleeping = keyboard_reader_sleeping;
+    keyboard_reader_sleeping = false;
+    spin_unlock_irqrestore(&keyboard_lock, flags);
+    if (sleeping) {
+        process_wake_preempt(reader);
+    } else {
+        process_boost(reader);
+    }
+}
+
+// Decode one scancode into keyboard_ring (keyboard softirq)
+static void keyboard_decode(uint8_t scancode) {
     
     // Check if this is a key release (bit 7 set)
     if (scancode & SCANCODE_RELEASE_FLAG) {
@@ -65,27 +100,23 @@ void keyboard_handler(void) {
             ctrl_pressed = 0;
         }
         
-        // Send EOI and return (we don't process key releases further)
-        pic_send_eoi(IRQ1_KEYBOARD);
+        // We don't process key releases further
         return;
     }
     
     // Key press - handle modifier keys
     if (scancode == SCANCODE_LSHIFT || scancode == SCANCODE_RSHIFT) {
         shift_pressed = 1;
-        pic_send_eoi(IRQ1_KEYBOARD);
         return;
     }
     
     if (scancode == SCANCODE_CTRL) {
         ctrl_pressed = 1;
-        pic_send_eoi(IRQ1_KEYBOARD);
         return;
     }
     
     if (scancode == SCANCODE_CAPS) {
         caps_lock = !caps_lock;  // Toggle caps lock
-        pic_send_eoi(IRQ1_KEYBOARD);
         return;
     }
     
@@ -102,6 +133,14 @@ void keyboard_handler(void) {
         else if (scancode == 0x31) {  // N key
             ascii = 0x0E;  // Ctrl+N
         }
+        // Ctrl+C and Ctrl+Z signal the foreground job
+        else if (scancode == 0x2E || scancode == 0x2C) {  // C, Z keys
+            int pid = keyboard_foreground;
+            if (pid != INVALID_PID) {
+                process_signal(pid, scancode == 0x2E ? SIGINT : SIGTSTP);
+            }
+            return;
+        }
         // Other Ctrl combinations can be added here
         else {
             ascii = 0;  // Ignore other Ctrl combinations
@@ -123,30 +162,66 @@ void keyboard_handler(void) {
     }
     
     // Add to buffer if we got a valid character
-    if (ascii != 0) {
-        int next_end = (buffer_end + 1) % KEYBOARD_BUFFER_SIZE;
-        if (next_end != buffer_start) {  // Buffer not full
-            keyboard_buffer[buffer_end] = ascii;
-            buffer_end = next_end;
-        }
+    if (ascii != 0 && ring_push(&keyboard_ring, &ascii) == 0) {
+        keyboard_wake_reader();
     }
-    
-    // Send EOI to PIC
-    pic_send_eoi(IRQ1_KEYBOARD);
+}
+
+// Keyboard bottom half: decode everything the IRQ has queued
+static void keyboard_softirq(void) {
+    uint8_t scancode;
+    while (ring_pop(&scancode_ring, &scancode) == 0) {
+        keyboard_decode(scancode);
+    }
+}
+
+// Keyboard interrupt handler: take the scancode off the controller and
+// leave decoding to the softirq
+static int keyboard_irq(void* ctx) {
+    (void)ctx;
+    uint8_t scancode = inb(KEYBOARD_DATA_PORT);
+    ring_push(&scancode_ring, &scancode);
+    softirq_raise(SOFTIRQ_KEYBOARD);
+    return IRQ_HANDLED;
 }
 
 // Get a character from keyboard buffer
 char keyboard_get_char(void) {
-    if (buffer_start == buffer_end) {
+    char c;
+    if (ring_pop(&keyboard_ring, &c) != 0) {
         return 0;  // No input available
     }
-    
-    char c = keyboard_buffer[buffer_start];
-    buffer_start = (buffer_start + 1) % KEYBOARD_BUFFER_SIZE;
     return c;
 }
 
+char keyboard_wait_char(void) {
+    char c;
+    while (ring_pop(&keyboard_ring, &c) != 0) {
+        if (!process_can_block()) {
+            return 0;
+        }
+        // Blocked under the lock after a last look at the ring, so a key
+        // decoded meanwhile finds the reader asleep and wakes it
+        uint32_t flags = spin_lock_irqsave(&keyboard_lock);
+        keyboard_reader = current_process->pid;
+        bool sleeping = ring_empty(&keyboard_ring);
+        if (sleeping) {
+            keyboard_reader_sleeping = true;
+            process_prepare_block();
+        }
+        spin_unlock_irqrestore(&keyboard_lock, flags);
+        if (sleeping) {
+            process_yield();
+        }
+    }
+    return c;
+}
+
+void keyboard_set_foreground(int pid) {
+    keyboard_foreground = pid;
+}
+
 // Check if keyboard input is available
 int keyboard_has_input(void) {
-    return buffer_start != buffer_end;
+    return !ring_empty(&keyboard_ring);
 }
\ No newline at end of file
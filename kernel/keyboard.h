@@ -35,8 +35,16 @@
 
 // Function declarations
 void keyboard_init(void);
-void keyboard_handler(void);
 char keyboard_get_char(void);
 int keyboard_has_input(void);
 
+// The next character, sleeping until one is typed (a key wakes the reader
+// ahead of what it interrupted). 0 at once if the caller can't sleep -
+// no preemption, or no idle task to stand in - and must poll instead.
+char keyboard_wait_char(void);
+
+// Ctrl+C and Ctrl+Z send SIGINT and SIGTSTP to pid (INVALID_PID: they are
+// ignored, and nothing reaches the ring either way)
+void keyboard_set_foreground(int pid);
+
 #endif // KEYBOARD_H
\ No newline at end of file
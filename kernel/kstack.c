@@ -0,0 +1,120 @@
+// ClaudeOS Kernel Stack Pool Implementation - Day 21
+// Recycled, guard-paged process stacks mapped on first use
+
+#include "kstack.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "kernel.h"
+
+// Pool state
+static void* free_stacks = 0;               // Recycled stacks (linked through their lowest word)
+static uint32_t kstack_mapped_slots = 0;    // Slots mapped so far (grows upward)
+static uint32_t kstack_in_use = 0;
+static uint32_t kstack_peak = 0;
+static uint32_t kstack_reuses = 0;
+int kstack_initialized = 0;
+
+static inline uint32_t slot_base(uint32_t slot) {
+    return KSTACK_START + slot * KSTACK_SLOT_SIZE + KSTACK_GUARD_SIZE;
+}
+
+// Initialize the pool. The region's page table is created in the master
+// directory now so every process directory shares it - a context switch
+// must never land on a stack the new directory can't see.
+void kstack_init(void) {
+    if (kstack_initialized) {
+        return;
+    }
+    uint32_t phys_page = pmm_alloc_page();
+    if (!phys_page) {
+        terminal_writestring("[KSTACK] ERROR: No memory for the stack page table\n");
+        return;
+    }
+    vmm_map_page(kernel_page_directory, KSTACK_START, phys_page, PAGE_PRESENT | PAGE_WRITABLE);
+    vmm_unmap_page(kernel_page_directory, KSTACK_START);
+    pmm_free_page(phys_page);
+    
+    free_stacks = 0;
+    kstack_mapped_slots = 0;
+    kstack_in_use = 0;
+    kstack_peak = 0;
+    kstack_reuses = 0;
+    kstack_initialized = 1;
+}
+
+// Get a KSTACK_SIZE stack; returns its lowest address (0 on failure)
+void* kstack_alloc(void) {
+    if (!kstack_initialized) {
+        return 0;
+    }
+    
+    void* stack = free_stacks;
+    if (stack) {
+        free_stacks = *(void**)stack;
+        kstack_reuses++;
+    } else {
+        if (kstack_mapped_slots >= KSTACK_MAX_SLOTS) {
+            return 0;  // Stack region exhausted
+        }
+        uint32_t base = slot_base(kstack_mapped_slots);
+        uint32_t pages = KSTACK_SIZE / PAGE_SIZE;
+        for (uint32_t i = 0; i < pages; i++) {
+            uint32_t phys_page = pmm_alloc_page();
+            if (!phys_page) {
+                while (i-- > 0) {
+                    uint32_t virt = base + i * PAGE_SIZE;
+                    pmm_free_page(vmm_get_physical_address(kernel_page_directory, virt));
+                    vmm_unmap_page(kernel_page_directory, virt);
+                }
+                return 0;  // Out of physical memory
+            }
+            vmm_map_page(kernel_page_directory, base + i * PAGE_SIZE, phys_page,
+                         PAGE_PRESENT | PAGE_WRITABLE | PAGE_GLOBAL);
+        }
+        kstack_mapped_slots++;  // The guard page below stays unmapped
+        stack = (void*)base;
+    }
+    
+    kstack_in_use++;
+    if (kstack_in_use > kstack_peak) {
+        kstack_peak = kstack_in_use;
+    }
+    return stack;
+}
+
+// Return a stack to the pool; its pages stay mapped for the next process
+void kstack_free(void* stack) {
+    if (!kstack_owns(stack)) {
+        return;  // Invalid pointer
+    }
+    *(void**)stack = free_stacks;
+    free_stacks = stack;
+    kstack_in_use--;
+}
+
+// Check whether a pointer is the base of a mapped pool stack
+int kstack_owns(const void* stack) {
+    uint32_t addr = (uint32_t)stack;
+    if (addr < KSTACK_START + KSTACK_GUARD_SIZE ||
+        addr >= KSTACK_START + kstack_mapped_slots * KSTACK_SLOT_SIZE) {
+        return 0;
+    }
+    return (addr - KSTACK_START) % KSTACK_SLOT_SIZE == KSTACK_GUARD_SIZE;
+}
+
+// Check whether an address lies in the guard page of any slot
+int kstack_is_guard(uint32_t addr) {
+    if (addr < KSTACK_START || addr >= KSTACK_START + KSTACK_REGION_SIZE) {
+        return 0;
+    }
+    return (addr - KSTACK_START) % KSTACK_SLOT_SIZE < KSTACK_GUARD_SIZE;
+}
+
+// Debug function to dump pool statistics
+void kstack_dump_stats(void) {
+    terminal_writestring("Kernel Stack Pool:\n");
+    terminal_printf("  Stack size: %d bytes (+%d guard)\n", KSTACK_SIZE, KSTACK_GUARD_SIZE);
+    terminal_printf("  Mapped: %d of %d slots\n", (int)kstack_mapped_slots, KSTACK_MAX_SLOTS);
+    terminal_printf("  In use: %d (peak %d), reused: %d\n",
+                    (int)kstack_in_use, (int)kstack_peak, (int)kstack_reuses);
+}
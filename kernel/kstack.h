@@ -0,0 +1,29 @@
+// ClaudeOS Kernel Stack Pool - Day 21
+// Per-process stacks in their own region, each with an unmapped guard page
+
+#ifndef KSTACK_H
+#define KSTACK_H
+
+#include "types.h"
+
+// Stack region sits directly above the slab region, inside the kernel
+// space every directory shares (one page table covers all of it)
+#define KSTACK_START        0xC1000000  // SLAB_START + SLAB_MAX_SIZE
+#define KSTACK_REGION_SIZE  0x400000    // 4MB of stack slots
+#define KSTACK_SIZE         0x1000      // Usable bytes per stack (STACK_SIZE)
+#define KSTACK_GUARD_SIZE   0x1000      // Unmapped page below each stack
+#define KSTACK_SLOT_SIZE    (KSTACK_GUARD_SIZE + KSTACK_SIZE)
+#define KSTACK_MAX_SLOTS    (KSTACK_REGION_SIZE / KSTACK_SLOT_SIZE)
+
+// Stack pool functions
+void kstack_init(void);
+void* kstack_alloc(void);
+void kstack_free(void* stack);
+int kstack_owns(const void* stack);
+int kstack_is_guard(uint32_t addr);
+void kstack_dump_stats(void);
+
+// Stack pool state (read-only access for external code)
+extern int kstack_initialized;
+
+#endif // KSTACK_H
@@ -0,0 +1,32 @@
+// ClaudeOS Kernel Symbol Table Implementation - Day 21
+
+#include "ksyms.h"
+
+uint32_t ksym_total(void) {
+    return &ksym_count ? ksym_count : 0;
+}
+
+int ksym_index(uint32_t address) {
+    uint32_t count = ksym_total();
+    if (count == 0 || address < ksym_table[0].address) {
+        return -1;
+    }
+    uint32_t low = 0;
+    uint32_t high = count;              // Answer in [low, high)
+    while (high - low > 1) {
+        uint32_t mid = (low + high) / 2;
+        if (ksym_table[mid].address <= address) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return (int)low;
+}
+
+const char* ksym_name(int index) {
+    if (index < 0 || (uint32_t)index >= ksym_total()) {
+        return "?";
+    }
+    return ksym_table[index].name;
+}
@@ -0,0 +1,28 @@
+// ClaudeOS Kernel Symbol Table - Day 21
+// Function addresses and names, generated by the Makefile from a first
+// link of the kernel (nm) and linked into the second. Until then - or in a
+// kernel linked any other way - the table is simply empty.
+
+#ifndef KSYMS_H
+#define KSYMS_H
+
+#include "types.h"
+
+typedef struct {
+    uint32_t address;
+    const char* name;
+} ksym_t;
+
+// Sorted by address (build/ksyms.c); weak, so a link without it works
+extern const ksym_t ksym_table[] __attribute__((weak));
+extern const uint32_t ksym_count __attribute__((weak));
+
+uint32_t ksym_total(void);
+
+// Index of the function containing address (the last one starting at or
+// below it), or -1
+int ksym_index(uint32_t address);
+
+const char* ksym_name(int index);
+
+#endif // KSYMS_H
@@ -0,0 +1,213 @@
+// ClaudeOS Kernel Locks Implementation - Day 21
+// Lock primitives built on the i686 atomic builtins, plus the `locks` listing
+
+#include "lock.h"
+#include "timer.h"
+#include "kernel.h"
+
+// Registered locks, newest first. The registry is itself an RW lock:
+// registration writes, the listing reads.
+static lock_stats_t* lock_list = 0;
+static rwlock_t registry_lock;
+
+static inline void cpu_relax(void) {
+    asm volatile ("pause");
+}
+
+static inline uint32_t lock_timestamp(void) {
+    return (uint32_t)clock_cycles();
+}
+
+// Bookkeeping once a lock is held
+static inline void stats_acquired(lock_stats_t* stats, int contended) {
+    stats->acquisitions++;
+    if (contended) {
+        stats->contended++;
+    }
+    stats->hold_start = lock_timestamp();
+}
+
+// Bookkeeping just before a lock is released
+static inline void stats_releasing(lock_stats_t* stats) {
+    uint32_t held = lock_timestamp() - stats->hold_start;
+    if (held > stats->max_hold) {
+        stats->max_hold = held;
+    }
+}
+
+static void stats_init(lock_stats_t* stats, const char* name, uint32_t kind) {
+    stats->name = name;
+    stats->kind = kind;
+    stats->acquisitions = 0;
+    stats->contended = 0;
+    stats->max_hold = 0;
+    stats->hold_start = 0;
+    if (stats->registered) {
+        return;  // Re-initializing keeps the list position
+    }
+
+    uint32_t flags = write_lock_irqsave(&registry_lock);
+    stats->registered = 1;
+    stats->next = lock_list;
+    lock_list = stats;
+    write_unlock_irqrestore(&registry_lock, flags);
+}
+
+// Spinlocks
+void spin_lock_init(spinlock_t* lock, const char* name) {
+    lock->locked = 0;
+    stats_init(&lock->stats, name, LOCK_KIND_SPIN);
+}
+
+void spin_lock(spinlock_t* lock) {
+    int contended = 0;
+    while (__sync_lock_test_and_set(&lock->locked, 1)) {
+        contended = 1;
+        while (lock->locked) {
+            cpu_relax();
+        }
+    }
+    stats_acquired(&lock->stats, contended);
+}
+
+void spin_unlock(spinlock_t* lock) {
+    stats_releasing(&lock->stats);
+    __sync_lock_release(&lock->locked);
+}
+
+// Take the lock only if it is free; returns 1 on success
+int spin_trylock(spinlock_t* lock) {
+    if (__sync_lock_test_and_set(&lock->locked, 1)) {
+        return 0;
+    }
+    stats_acquired(&lock->stats, 0);
+    return 1;
+}
+
+uint32_t spin_lock_irqsave(spinlock_t* lock) {
+    uint32_t flags = lock_irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+void spin_unlock_irqrestore(spinlock_t* lock, uint32_t flags) {
+    spin_unlock(lock);
+    lock_irq_restore(flags);
+}
+
+// Ticket locks
+void ticket_lock_init(ticket_lock_t* lock, const char* name) {
+    lock->next = 0;
+    lock->serving = 0;
+    stats_init(&lock->stats, name, LOCK_KIND_TICKET);
+}
+
+void ticket_lock(ticket_lock_t* lock) {
+    uint32_t ticket = __sync_fetch_and_add(&lock->next, 1);
+    int contended = 0;
+    while (lock->serving != ticket) {
+        contended = 1;
+        cpu_relax();
+    }
+    __sync_synchronize();
+    stats_acquired(&lock->stats, contended);
+}
+
+void ticket_unlock(ticket_lock_t* lock) {
+    stats_releasing(&lock->stats);
+    __sync_synchronize();
+    lock->serving = lock->serving + 1;  // Only the holder writes serving
+}
+
+uint32_t ticket_lock_irqsave(ticket_lock_t* lock) {
+    uint32_t flags = lock_irq_save();
+    ticket_lock(lock);
+    return flags;
+}
+
+void ticket_unlock_irqrestore(ticket_lock_t* lock, uint32_t flags) {
+    ticket_unlock(lock);
+    lock_irq_restore(flags);
+}
+
+// Reader-writer locks
+void rwlock_init(rwlock_t* lock, const char* name) {
+    lock->count = 0;
+    lock->writers_waiting = 0;
+    stats_init(&lock->stats, name, LOCK_KIND_RW);
+}
+
+uint32_t read_lock_irqsave(rwlock_t* lock) {
+    uint32_t flags = lock_irq_save();
+    int contended = 0;
+    while (1) {
+        int32_t count = lock->count;
+        if (count >= 0 && !lock->writers_waiting &&
+            __sync_bool_compare_and_swap(&lock->count, count, count + 1)) {
+            break;
+        }
+        contended = 1;
+        cpu_relax();
+    }
+    // Readers run concurrently, so their counts are updated atomically
+    __sync_fetch_and_add(&lock->stats.acquisitions, 1);
+    if (contended) {
+        __sync_fetch_and_add(&lock->stats.contended, 1);
+    }
+    return flags;
+}
+
+void read_unlock_irqrestore(rwlock_t* lock, uint32_t flags) {
+    __sync_fetch_and_sub(&lock->count, 1);
+    lock_irq_restore(flags);
+}
+
+uint32_t write_lock_irqsave(rwlock_t* lock) {
+    uint32_t flags = lock_irq_save();
+    int contended = 0;
+    __sync_fetch_and_add(&lock->writers_waiting, 1);
+    while (!__sync_bool_compare_and_swap(&lock->count, 0, -1)) {
+        contended = 1;
+        cpu_relax();
+    }
+    __sync_fetch_and_sub(&lock->writers_waiting, 1);
+    __sync_fetch_and_add(&lock->stats.acquisitions, 1);
+    if (contended) {
+        __sync_fetch_and_add(&lock->stats.contended, 1);
+    }
+    lock->stats.hold_start = lock_timestamp();
+    return flags;
+}
+
+void write_unlock_irqrestore(rwlock_t* lock, uint32_t flags) {
+    stats_releasing(&lock->stats);
+    __sync_synchronize();
+    lock->count = 0;
+    lock_irq_restore(flags);
+}
+
+// Zero every registered lock's counters
+void lock_reset_stats(void) {
+    uint32_t flags = read_lock_irqsave(&registry_lock);
+    for (lock_stats_t* stats = lock_list; stats; stats = stats->next) {
+        stats->acquisitions = 0;
+        stats->contended = 0;
+        stats->max_hold = 0;
+    }
+    read_unlock_irqrestore(&registry_lock, flags);
+}
+
+// Debug function to dump lock contention statistics
+void lock_dump_stats(void) {
+    static const char* kind_names[] = { "spin  ", "ticket", "rw    " };
+
+    terminal_writestring("Lock Statistics (hold times in TSC cycles):\n");
+    terminal_writestring("  Kind    Acquired  Contended  Max hold  Name\n");
+    uint32_t flags = read_lock_irqsave(&registry_lock);
+    for (lock_stats_t* stats = lock_list; stats; stats = stats->next) {
+        terminal_printf("  %s  %d      %d        %d      %s\n", kind_names[stats->kind],
+                        (int)stats->acquisitions, (int)stats->contended,
+                        (int)stats->max_hold, stats->name ? stats->name : "?");
+    }
+    read_unlock_irqrestore(&registry_lock, flags);
+}
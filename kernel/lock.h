@@ -0,0 +1,86 @@
+// ClaudeOS Kernel Locks - Day 21
+// Spinlocks, ticket locks and reader-writer locks with contention statistics
+
+#ifndef LOCK_H
+#define LOCK_H
+
+#include "types.h"
+
+// Lock kinds (for the statistics listing)
+#define LOCK_KIND_SPIN      0
+#define LOCK_KIND_TICKET    1
+#define LOCK_KIND_RW        2
+
+// Per-lock statistics, updated by the holder. A zeroed lock is a valid
+// unlocked lock; *_init only names it and adds it to the `locks` listing.
+typedef struct lock_stats {
+    const char* name;
+    uint32_t kind;
+    uint32_t acquisitions;
+    uint32_t contended;             // Acquisitions that had to spin
+    uint32_t max_hold;              // Longest hold in TSC cycles (writers only for RW)
+    uint32_t hold_start;            // Low TSC bits at the current acquisition
+    int registered;
+    struct lock_stats* next;        // Registered locks
+} lock_stats_t;
+
+// Test-and-set spinlock
+typedef struct {
+    volatile uint32_t locked;
+    lock_stats_t stats;
+} spinlock_t;
+
+// FIFO ticket lock: waiters are served in arrival order
+typedef struct {
+    volatile uint32_t next;         // Next ticket to hand out
+    volatile uint32_t serving;      // Ticket allowed in
+    lock_stats_t stats;
+} ticket_lock_t;
+
+// Reader-writer lock: count > 0 readers, -1 a writer. Waiting writers hold
+// off new readers so they can't be starved.
+typedef struct {
+    volatile int32_t count;
+    volatile uint32_t writers_waiting;
+    lock_stats_t stats;
+} rwlock_t;
+
+// Interrupt flag helpers for the *_irqsave variants
+static inline uint32_t lock_irq_save(void) {
+    uint32_t flags;
+    asm volatile ("pushf; pop %0; cli" : "=r" (flags) : : "memory");
+    return flags;
+}
+
+static inline void lock_irq_restore(uint32_t flags) {
+    asm volatile ("push %0; popf" : : "r" (flags) : "memory", "cc");
+}
+
+// Spinlocks. Data shared with an interrupt handler must use the irqsave
+// forms: an IRQ on the same CPU spinning on its holder never returns.
+void spin_lock_init(spinlock_t* lock, const char* name);
+void spin_lock(spinlock_t* lock);
+void spin_unlock(spinlock_t* lock);
+int spin_trylock(spinlock_t* lock);
+uint32_t spin_lock_irqsave(spinlock_t* lock);
+void spin_unlock_irqrestore(spinlock_t* lock, uint32_t flags);
+
+// Ticket locks
+void ticket_lock_init(ticket_lock_t* lock, const char* name);
+void ticket_lock(ticket_lock_t* lock);
+void ticket_unlock(ticket_lock_t* lock);
+uint32_t ticket_lock_irqsave(ticket_lock_t* lock);
+void ticket_unlock_irqrestore(ticket_lock_t* lock, uint32_t flags);
+
+// Reader-writer locks
+void rwlock_init(rwlock_t* lock, const char* name);
+uint32_t read_lock_irqsave(rwlock_t* lock);
+void read_unlock_irqrestore(rwlock_t* lock, uint32_t flags);
+uint32_t write_lock_irqsave(rwlock_t* lock);
+void write_unlock_irqrestore(rwlock_t* lock, uint32_t flags);
+
+// Statistics
+void lock_reset_stats(void);
+void lock_dump_stats(void);
+
+#endif // LOCK_H
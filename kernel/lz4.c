@@ -0,0 +1,185 @@
+// ClaudeOS LZ4 Block Codec Implementation - Day 21
+// A single-pass compressor: each 4-byte sequence is hashed into a table of
+// the positions last seen with that hash, and a hit that really matches is
+// extended both ways and emitted as a back reference. The decoder checks
+// every length and offset against its buffers, so a corrupt block fails
+// instead of writing past them.
+
+#include "lz4.h"
+#include "string.h"
+
+#define LZ4_MIN_MATCH       4
+#define LZ4_LAST_LITERALS   5           // The format ends on at least this many literals
+#define LZ4_MATCH_LIMIT     12          // and no match starts closer than this to the end
+#define LZ4_MAX_OFFSET      65535
+
+typedef uint32_t __attribute__((may_alias, aligned(1))) lz4_word_t;
+
+static uint32_t lz4_read32(const uint8_t* p) {
+    return *(const lz4_word_t*)p;
+}
+
+static uint32_t lz4_hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+// Length bytes past the 15 the token holds
+static uint8_t* lz4_put_length(uint8_t* op, uint32_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+// One sequence: literals from anchor, then a match of match_length bytes
+// offset back (match_length 0: the closing literals-only sequence). NULL
+// when it doesn't fit before limit.
+static uint8_t* lz4_put_sequence(uint8_t* op, uint8_t* limit, const uint8_t* anchor,
+                                 uint32_t literals, uint32_t offset, uint32_t match_length) {
+    if ((uint32_t)(limit - op) < 1 + literals + literals / 255 + 1 + 2 + match_length / 255 + 1) {
+        return NULL;
+    }
+    uint8_t* token = op++;
+    *token = (uint8_t)((literals >= 15 ? 15 : literals) << 4);
+    if (literals >= 15) {
+        op = lz4_put_length(op, literals - 15);
+    }
+    memcpy(op, anchor, literals);
+    op += literals;
+    if (offset == 0) {
+        return op;
+    }
+    *op++ = (uint8_t)offset;
+    *op++ = (uint8_t)(offset >> 8);
+    match_length -= LZ4_MIN_MATCH;
+    *token |= (uint8_t)(match_length >= 15 ? 15 : match_length);
+    if (match_length >= 15) {
+        op = lz4_put_length(op, match_length - 15);
+    }
+    return op;
+}
+
+uint32_t lz4_compress(const void* src, uint32_t length, void* dst, uint32_t capacity,
+                      uint16_t table[LZ4_HASH_SIZE]) {
+    if (length > LZ4_MAX_INPUT) {
+        return 0;
+    }
+    const uint8_t* base = (const uint8_t*)src;
+    const uint8_t* end = base + length;
+    const uint8_t* ip = base;
+    const uint8_t* anchor = base;
+    uint8_t* op = (uint8_t*)dst;
+    uint8_t* limit = op + capacity;
+    
+    if (length > LZ4_MATCH_LIMIT) {
+        const uint8_t* match_end = end - LZ4_LAST_LITERALS;
+        const uint8_t* search_end = end - LZ4_MATCH_LIMIT;
+        memset(table, 0, LZ4_HASH_SIZE * sizeof(uint16_t));
+        ip++;
+        while (ip < search_end) {
+            uint32_t sequence = lz4_read32(ip);
+            uint32_t hash = lz4_hash(sequence);
+            const uint8_t* ref = base + table[hash];
+            table[hash] = (uint16_t)(ip - base);
+            if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || lz4_read32(ref) != sequence) {
+                ip++;
+                continue;
+            }
+            
+            // Take in what the literals before it share with the reference
+            while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const uint8_t* scan = ip + LZ4_MIN_MATCH;
+            const uint8_t* match = ref + LZ4_MIN_MATCH;
+            while (scan + 4 <= match_end && lz4_read32(scan) == lz4_read32(match)) {
+                scan += 4;
+                match += 4;
+            }
+            while (scan < match_end && *scan == *match) {
+                scan++;
+                match++;
+            }
+            
+            op = lz4_put_sequence(op, limit, anchor, (uint32_t)(ip - anchor),
+                                  (uint32_t)(ip - ref), (uint32_t)(scan - ip));
+            if (!op) {
+                return 0;
+            }
+            ip = anchor = scan;
+            if (ip - 2 > base && ip < search_end) {
+                table[lz4_hash(lz4_read32(ip - 2))] = (uint16_t)(ip - 2 - base);
+            }
+        }
+    }
+    
+    op = lz4_put_sequence(op, limit, anchor, (uint32_t)(end - anchor), 0, 0);
+    return op ? (uint32_t)(op - (uint8_t*)dst) : 0;
+}
+
+static int lz4_get_length(const uint8_t** ip, const uint8_t* end, uint32_t* length) {
+    uint8_t byte;
+    do {
+        if (*ip >= end) {
+            return -1;
+        }
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+    return 0;
+}
+
+int lz4_decompress(const void* src, uint32_t length, void* dst, uint32_t capacity) {
+    const uint8_t* ip = (const uint8_t*)src;
+    const uint8_t* end = ip + length;
+    uint8_t* op = (uint8_t*)dst;
+    uint8_t* limit = op + capacity;
+    
+    while (ip < end) {
+        uint32_t token = *ip++;
+        uint32_t literals = token >> 4;
+        if (literals == 15 && lz4_get_length(&ip, end, &literals) != 0) {
+            return -1;
+        }
+        if (literals > (uint32_t)(end - ip) || literals > (uint32_t)(limit - op)) {
+            return -1;
+        }
+        memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+        if (ip == end) {
+            break;  // The closing sequence has no match
+        }
+        
+        if (end - ip < 2) {
+            return -1;
+        }
+        uint32_t offset = ip[0] | ((uint32_t)ip[1] << 8);
+        ip += 2;
+        uint32_t match_length = token & 15;
+        if (match_length == 15 && lz4_get_length(&ip, end, &match_length) != 0) {
+            return -1;
+        }
+        match_length += LZ4_MIN_MATCH;
+        if (offset == 0 || offset > (uint32_t)(op - (uint8_t*)dst) ||
+            match_length > (uint32_t)(limit - op)) {
+            return -1;
+        }
+        
+        // A reference at least its own length back is one copy; closer ones
+        // overlap what they produce and go a byte at a time
+        const uint8_t* ref = op - offset;
+        if (offset >= match_length) {
+            memcpy(op, ref, match_length);
+            op += match_length;
+        } else {
+            for (uint32_t i = 0; i < match_length; i++) {
+                *op++ = *ref++;
+            }
+        }
+    }
+    return (int)(op - (uint8_t*)dst);
+}
@@ -0,0 +1,25 @@
+// ClaudeOS LZ4 Block Codec - Day 21
+// The LZ4 block format: runs of literals and (offset, length) back
+// references, decoded with nothing but byte copies
+
+#ifndef LZ4_H
+#define LZ4_H
+
+#include "types.h"
+
+#define LZ4_HASH_BITS       12
+#define LZ4_HASH_SIZE       (1 << LZ4_HASH_BITS)
+#define LZ4_MAX_INPUT       65536       // Positions in the match table are 16 bits
+#define LZ4_BOUND(n)        ((n) + (n) / 255 + 16)  // Worst case for n incompressible bytes
+
+// Compress length bytes of src (at most LZ4_MAX_INPUT) into dst. table is
+// scratch for the match finder. Returns the compressed size, or 0 when it
+// doesn't fit in capacity.
+uint32_t lz4_compress(const void* src, uint32_t length, void* dst, uint32_t capacity,
+                      uint16_t table[LZ4_HASH_SIZE]);
+
+// Decode length bytes of compressed src into dst. Returns the bytes
+// produced, or -1 when the input is malformed or would overrun capacity.
+int lz4_decompress(const void* src, uint32_t length, void* dst, uint32_t capacity);
+
+#endif // LZ4_H
@@ -0,0 +1,164 @@
+// ClaudeOS Shared-Memory Message Queue Implementation - Day 21
+// Positions are free-running 32-bit counters compared by signed
+// difference, so they wrap safely. A sleeper registers in the waiter
+// count before it looks at the queue one last time, and a waker publishes
+// its slot before it reads the count; the locked instructions on both
+// sides order the two, so either the sleeper sees the new state or the
+// waker sees the sleeper. The futex word itself only changes when someone
+// might be asleep on it, which keeps the steady state free of both
+// syscalls and shared writes beyond the head, tail and slot.
+
+#include "mpmc.h"
+#include "futex.h"
+#include "kernel.h"
+#include "string.h"
+
+static inline void mpmc_barrier(void) {
+    asm volatile ("" : : : "memory");   // x86 keeps stores (and loads) in order
+}
+
+mpmc_queue_t* mpmc_init(void* segment, size_t size) {
+    if (!segment || size < sizeof(mpmc_queue_t) + MPMC_MIN_SLOTS * sizeof(mpmc_slot_t)) {
+        return NULL;
+    }
+    uint32_t fit = (uint32_t)((size - sizeof(mpmc_queue_t)) / sizeof(mpmc_slot_t));
+    uint32_t slots = MPMC_MIN_SLOTS;
+    while (slots * 2 <= fit) {
+        slots *= 2;
+    }
+
+    mpmc_queue_t* queue = (mpmc_queue_t*)segment;
+    memset(queue, 0, sizeof(mpmc_queue_t));
+    queue->mask = slots - 1;
+    for (uint32_t i = 0; i < slots; i++) {
+        queue->slots[i].seq = i;
+        queue->slots[i].length = 0;
+    }
+    mpmc_barrier();
+    queue->magic = MPMC_MAGIC;          // Last: mpmc_open trusts the rest once it's there
+    return queue;
+}
+
+mpmc_queue_t* mpmc_open(void* segment) {
+    mpmc_queue_t* queue = (mpmc_queue_t*)segment;
+    return queue && queue->magic == MPMC_MAGIC ? queue : NULL;
+}
+
+// Bump word and wake one sleeper on it, if the count says there may be one
+static void mpmc_wake(mpmc_queue_t* queue, volatile uint32_t* word, volatile uint32_t* waiters) {
+    __sync_synchronize();               // The slot's seq store before the waiter count load
+    if (*waiters) {
+        __sync_fetch_and_add(word, 1);
+        futex_wake(word, 1);
+        queue->wakes++;
+    }
+}
+
+int mpmc_try_send(mpmc_queue_t* queue, const void* data, uint32_t length) {
+    if (length > MPMC_MSG_SIZE) {
+        return -1;
+    }
+    uint32_t pos = queue->tail;
+    mpmc_slot_t* slot;
+    while (1) {
+        slot = &queue->slots[pos & queue->mask];
+        int32_t diff = (int32_t)(slot->seq - pos);
+        if (diff == 0) {
+            if (__sync_bool_compare_and_swap(&queue->tail, pos, pos + 1)) {
+                break;
+            }
+            pos = queue->tail;
+        } else if (diff < 0) {
+            return MPMC_WOULD_BLOCK;    // A lap behind: its message is still unread
+        } else {
+            pos = queue->tail;          // Another producer took it first
+        }
+    }
+    memcpy(slot->data, data, length);
+    slot->length = length;
+    mpmc_barrier();
+    slot->seq = pos + 1;
+    mpmc_wake(queue, &queue->not_empty, &queue->empty_waiters);
+    return 0;
+}
+
+int mpmc_try_receive(mpmc_queue_t* queue, void* buffer, uint32_t size) {
+    uint32_t pos = queue->head;
+    mpmc_slot_t* slot;
+    while (1) {
+        slot = &queue->slots[pos & queue->mask];
+        int32_t diff = (int32_t)(slot->seq - (pos + 1));
+        if (diff == 0) {
+            if (__sync_bool_compare_and_swap(&queue->head, pos, pos + 1)) {
+                break;
+            }
+            pos = queue->head;
+        } else if (diff < 0) {
+            return MPMC_WOULD_BLOCK;    // Not yet published
+        } else {
+            pos = queue->head;
+        }
+    }
+    uint32_t length = slot->length < size ? slot->length : size;
+    memcpy(buffer, slot->data, length);
+    mpmc_barrier();
+    slot->seq = pos + queue->mask + 1;  // Free for the producer a lap later
+    mpmc_wake(queue, &queue->not_full, &queue->full_waiters);
+    return (int)length;
+}
+
+// Register on word, try once more, then sleep unless it changed since the
+// snapshot; the caller loops. -1 if the futex can't be used at all.
+static int mpmc_wait(mpmc_queue_t* queue, volatile uint32_t* word, volatile uint32_t* waiters,
+                     int (*attempt)(mpmc_queue_t*, void*, uint32_t), void* arg, uint32_t length,
+                     int* result) {
+    uint32_t snapshot = *word;
+    __sync_fetch_and_add(waiters, 1);
+    *result = attempt(queue, arg, length);
+    int status = 0;
+    if (*result == MPMC_WOULD_BLOCK) {
+        queue->sleeps++;
+        status = futex_wait(word, snapshot) < 0 ? -1 : 0;
+    }
+    __sync_fetch_and_sub(waiters, 1);
+    return status;
+}
+
+static int mpmc_attempt_send(mpmc_queue_t* queue, void* data, uint32_t length) {
+    return mpmc_try_send(queue, data, length);
+}
+
+int mpmc_send(mpmc_queue_t* queue, const void* data, uint32_t length) {
+    int result = mpmc_try_send(queue, data, length);
+    while (result == MPMC_WOULD_BLOCK) {
+        if (mpmc_wait(queue, &queue->not_full, &queue->full_waiters, mpmc_attempt_send,
+                      (void*)data, length, &result) < 0) {
+            return -1;
+        }
+    }
+    return result;
+}
+
+int mpmc_receive(mpmc_queue_t* queue, void* buffer, uint32_t size) {
+    int result = mpmc_try_receive(queue, buffer, size);
+    while (result == MPMC_WOULD_BLOCK) {
+        if (mpmc_wait(queue, &queue->not_empty, &queue->empty_waiters, mpmc_try_receive,
+                      buffer, size, &result) < 0) {
+            return -1;
+        }
+    }
+    return result;
+}
+
+uint32_t mpmc_count(const mpmc_queue_t* queue) {
+    uint32_t count = queue->tail - queue->head;
+    return count > queue->mask + 1 ? 0 : count;     // Read mid-update
+}
+
+void mpmc_dump(const mpmc_queue_t* queue) {
+    terminal_printf("Queue: %d of %d slots used, %d sent, %d received\n", (int)mpmc_count(queue),
+                    (int)(queue->mask + 1), (int)queue->tail, (int)queue->head);
+    terminal_printf("  %d sleeps, %d wakes; %d senders and %d receivers waiting\n",
+                    (int)queue->sleeps, (int)queue->wakes, (int)queue->full_waiters,
+                    (int)queue->empty_waiters);
+}
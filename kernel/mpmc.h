@@ -0,0 +1,71 @@
+// ClaudeOS Shared-Memory Message Queues - Day 21
+// A bounded multi-producer/multi-consumer queue laid out inside a shared
+// memory segment, so processes that attach it exchange messages without
+// the kernel. Each slot carries a sequence number saying whose turn it is
+// (Vyukov's design): a producer claims position n by moving tail from n
+// to n+1 when slot n's sequence reads n, fills it and publishes n+1; a
+// consumer claims it by moving head once the sequence reads n+1 and hands
+// the slot back to the producer n+slots later. Sending and receiving cost
+// one compare-and-swap each. Only a sender that finds the queue full or a
+// receiver that finds it empty reaches futex_wait, and the other side
+// calls futex_wake only when someone is registered as sleeping there.
+
+#ifndef MPMC_H
+#define MPMC_H
+
+#include "types.h"
+
+#define MPMC_MAGIC          0x4D504D43  // "MPMC"
+#define MPMC_LINE           64
+#define MPMC_MSG_SIZE       56          // Bytes per message: a slot is one line
+#define MPMC_MIN_SLOTS      2
+
+// mpmc_try_send / mpmc_try_receive result when the queue is full / empty
+#define MPMC_WOULD_BLOCK    -2
+
+typedef struct {
+    volatile uint32_t seq;              // n: free for position n; n+1: holds message n
+    uint32_t length;
+    uint8_t data[MPMC_MSG_SIZE];
+} __attribute__((aligned(MPMC_LINE))) mpmc_slot_t;
+
+// The segment's first bytes. Producers and consumers each write their own
+// line, so the two ends don't bounce one between CPUs.
+typedef struct {
+    uint32_t magic;
+    uint32_t mask;                      // Slots - 1 (a power of two)
+    uint32_t sleeps;                    // futex_wait calls (racy counts, for mpmc_dump)
+    uint32_t wakes;                     // futex_wake calls
+
+    // Producers
+    volatile uint32_t tail __attribute__((aligned(MPMC_LINE)));   // Next position to fill
+    volatile uint32_t not_full;         // Futex word: bumped when a full queue drains
+    volatile uint32_t full_waiters;     // Senders between registering and waking
+
+    // Consumers
+    volatile uint32_t head __attribute__((aligned(MPMC_LINE)));   // Next position to take
+    volatile uint32_t not_empty;        // Futex word: bumped when an empty queue fills
+    volatile uint32_t empty_waiters;
+
+    mpmc_slot_t slots[];
+} mpmc_queue_t;
+
+// Lay a queue out over a zeroed segment of size bytes (as many slots as
+// fit, rounded down to a power of two); NULL if fewer than MPMC_MIN_SLOTS
+// fit. Every other process attaching the segment uses mpmc_open.
+mpmc_queue_t* mpmc_init(void* segment, size_t size);
+mpmc_queue_t* mpmc_open(void* segment);     // NULL if no queue was laid out there
+
+// Without blocking: 0 / the message length, MPMC_WOULD_BLOCK, or -1 for
+// a message over MPMC_MSG_SIZE (one longer than size is cut short)
+int mpmc_try_send(mpmc_queue_t* queue, const void* data, uint32_t length);
+int mpmc_try_receive(mpmc_queue_t* queue, void* buffer, uint32_t size);
+
+// The same, sleeping on the queue's futex words while it is full / empty
+int mpmc_send(mpmc_queue_t* queue, const void* data, uint32_t length);
+int mpmc_receive(mpmc_queue_t* queue, void* buffer, uint32_t size);
+
+uint32_t mpmc_count(const mpmc_queue_t* queue);    // Messages queued (a snapshot)
+void mpmc_dump(const mpmc_queue_t* queue);
+
+#endif // MPMC_H
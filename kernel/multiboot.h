@@ -0,0 +1,71 @@
+// ClaudeOS Multiboot Information - Day 21
+// Structures handed to the kernel by a Multiboot-compliant bootloader
+
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+#include "types.h"
+
+// Value in eax when the kernel was started by a Multiboot loader
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
+
+// multiboot_info_t.flags bits
+#define MULTIBOOT_INFO_MEMORY   (1 << 0)   // mem_lower / mem_upper valid
+#define MULTIBOOT_INFO_CMDLINE  (1 << 2)   // cmdline valid
+#define MULTIBOOT_INFO_MEM_MAP  (1 << 6)   // mmap_addr / mmap_length valid
+#define MULTIBOOT_INFO_FRAMEBUFFER (1 << 12)    // framebuffer_* valid
+
+// framebuffer_type values
+#define MULTIBOOT_FRAMEBUFFER_INDEXED   0
+#define MULTIBOOT_FRAMEBUFFER_RGB       1
+#define MULTIBOOT_FRAMEBUFFER_TEXT      2   // Still EGA text (0xB8000)
+
+// Memory map region types
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+
+// Boot information structure, through the framebuffer fields
+typedef struct {
+    uint32_t flags;
+    uint32_t mem_lower;      // KB below 1MB
+    uint32_t mem_upper;      // KB above 1MB
+    uint32_t boot_device;
+    uint32_t cmdline;
+    uint32_t mods_count;
+    uint32_t mods_addr;
+    uint32_t syms[4];
+    uint32_t mmap_length;    // Size of the memory map buffer in bytes
+    uint32_t mmap_addr;      // Physical address of the first entry
+    uint32_t drives_length;
+    uint32_t drives_addr;
+    uint32_t config_table;
+    uint32_t boot_loader_name;
+    uint32_t apm_table;
+    uint32_t vbe_control_info;
+    uint32_t vbe_mode_info;
+    uint16_t vbe_mode;
+    uint16_t vbe_interface_seg;
+    uint16_t vbe_interface_off;
+    uint16_t vbe_interface_len;
+    uint64_t framebuffer_addr;   // Physical
+    uint32_t framebuffer_pitch;  // Bytes per scanline
+    uint32_t framebuffer_width;  // Pixels
+    uint32_t framebuffer_height;
+    uint8_t framebuffer_bpp;
+    uint8_t framebuffer_type;
+    uint8_t red_position;        // RGB type: where each channel sits in a pixel
+    uint8_t red_size;
+    uint8_t green_position;
+    uint8_t green_size;
+    uint8_t blue_position;
+    uint8_t blue_size;
+} __attribute__((packed)) multiboot_info_t;
+
+// Memory map entry - size does not include the size field itself
+typedef struct {
+    uint32_t size;
+    uint64_t addr;
+    uint64_t len;
+    uint32_t type;
+} __attribute__((packed)) multiboot_mmap_entry_t;
+
+#endif // MULTIBOOT_H
@@ -0,0 +1,206 @@
+// ClaudeOS Kernel Mutexes Implementation - Day 21
+// One lock covers every mutex: a boost follows owner -> blocked_on ->
+// owner across several mutexes, and taking their locks in chain order
+// could deadlock against a chain running the other way. Each walk is
+// bounded by MUTEX_PI_DEPTH, so a cycle (a deadlock already) can't spin.
+// A task's level is its MLFQ level, 0 for a deadline task. Inheriting
+// raises the owner to the best level among the first waiters of every
+// mutex it holds and keeps it from being demoted below that; releasing
+// lifts the floor again and the MLFQ lowers it as usual.
+
+#include "mutex.h"
+#include "process.h"
+#include "kernel.h"
+#include "lock.h"
+#include "stats.h"
+
+STAT_DEFINE(stat_mutex_contended, "mutex.contended", STAT_COUNTER, "mutex locks that had to wait");
+STAT_DEFINE(stat_mutex_boosts, "mutex.pi_boosts", STAT_COUNTER, "owners raised by a waiter's priority");
+
+static spinlock_t mutex_lock_all;       // Unregistered; every mutex, taken before sched_lock
+
+static inline uint32_t waiter_level(process_t* process) {
+    return process->dl.period ? 0 : process->priority;
+}
+
+// The best level among the first waiters of what owner holds
+static uint32_t held_floor(process_t* owner) {
+    uint32_t level = PROCESS_PRIORITY_LEVELS - 1;
+    for (mutex_t* mutex = owner->held_mutexes; mutex; mutex = mutex->held_next) {
+        if (mutex->waiters && waiter_level(mutex->waiters->process) < level) {
+            level = waiter_level(mutex->waiters->process);
+        }
+    }
+    return level;
+}
+
+// Behind every waiter at the same or a better level
+static void waiter_insert(mutex_t* mutex, mutex_waiter_t* waiter) {
+    uint32_t level = waiter_level(waiter->process);
+    mutex_waiter_t** link = &mutex->waiters;
+    while (*link && waiter_level((*link)->process) <= level) {
+        link = &(*link)->next;
+    }
+    waiter->next = *link;
+    *link = waiter;
+}
+
+static mutex_waiter_t* waiter_remove(mutex_t* mutex, process_t* process) {
+    for (mutex_waiter_t** link = &mutex->waiters; *link; link = &(*link)->next) {
+        if ((*link)->process == process) {
+            mutex_waiter_t* waiter = *link;
+            *link = waiter->next;
+            waiter->next = NULL;
+            return waiter;
+        }
+    }
+    return NULL;
+}
+
+// mutex's waiters changed: bring its owner's floor up to date, and the
+// owner's place in whatever it waits on in turn
+static void pi_propagate(mutex_t* mutex) {
+    for (int depth = 0; mutex && mutex->owner && depth < MUTEX_PI_DEPTH; depth++) {
+        process_t* owner = mutex->owner;
+        uint32_t floor = held_floor(owner);
+        uint32_t level = owner->priority;
+        if (floor == owner->pi_level && level <= floor) {
+            return;                     // Nothing further along changes
+        }
+        process_inherit_priority(owner, floor);
+        if (owner->priority < level) {
+            stat_inc(&stat_mutex_boosts);
+        }
+        mutex = owner->blocked_on;
+        mutex_waiter_t* waiter = mutex ? waiter_remove(mutex, owner) : NULL;
+        if (waiter) {
+            waiter_insert(mutex, waiter);   // Re-sorted at its new level
+        }
+    }
+}
+
+static void mutex_take_locked(mutex_t* mutex, process_t* process) {
+    mutex->owner = process;
+    mutex->held_next = process->held_mutexes;
+    process->held_mutexes = mutex;
+    mutex->acquired++;
+}
+
+// The owner lets go: the first waiter, if any, owns it now
+static void mutex_hand_on_locked(mutex_t* mutex) {
+    process_t* old = mutex->owner;
+    for (mutex_t** link = &old->held_mutexes; *link; link = &(*link)->held_next) {
+        if (*link == mutex) {
+            *link = mutex->held_next;
+            break;
+        }
+    }
+    mutex->held_next = NULL;
+    process_inherit_priority(old, held_floor(old));
+
+    mutex_waiter_t* waiter = mutex->waiters;
+    if (!waiter) {
+        mutex->owner = NULL;
+        return;
+    }
+    mutex->waiters = waiter->next;
+    process_t* next = waiter->process;
+    next->blocked_on = NULL;
+    mutex_take_locked(mutex, next);
+    process_inherit_priority(next, held_floor(next));
+    waiter->granted = 1;                // Its stack frame goes once it sees this
+    process_wake(next);
+}
+
+void mutex_init(mutex_t* mutex, const char* name) {
+    mutex->owner = NULL;
+    mutex->waiters = NULL;
+    mutex->held_next = NULL;
+    mutex->name = name;
+    mutex->acquired = 0;
+    mutex->contended = 0;
+}
+
+bool mutex_trylock(mutex_t* mutex) {
+    process_t* self = current_process;
+    if (!self) {
+        return true;                    // Boot: nothing else runs yet
+    }
+    uint32_t flags = spin_lock_irqsave(&mutex_lock_all);
+    bool taken = mutex->owner == NULL;
+    if (taken) {
+        mutex_take_locked(mutex, self);
+    }
+    spin_unlock_irqrestore(&mutex_lock_all, flags);
+    return taken;
+}
+
+void mutex_lock(mutex_t* mutex) {
+    process_t* self = current_process;
+    if (!self) {
+        return;
+    }
+    uint32_t flags = spin_lock_irqsave(&mutex_lock_all);
+    if (!mutex->owner) {
+        mutex_take_locked(mutex, self);
+        spin_unlock_irqrestore(&mutex_lock_all, flags);
+        return;
+    }
+    if (mutex->owner == self) {
+        kernel_panic("mutex: recursive lock");
+    }
+    mutex->contended++;
+    stat_inc(&stat_mutex_contended);
+
+    if (self->pid == KERNEL_PID || !scheduler_preemptive) {
+        spin_unlock_irqrestore(&mutex_lock_all, flags);
+        while (!mutex_trylock(mutex)) {
+            asm volatile ("sti; hlt");
+        }
+        return;
+    }
+
+    // Queued and marked blocked before the lock drops, so the hand-off
+    // can't be missed
+    mutex_waiter_t waiter;
+    waiter.process = self;
+    waiter.granted = 0;
+    waiter.next = NULL;
+    waiter_insert(mutex, &waiter);
+    self->blocked_on = mutex;
+    pi_propagate(mutex);
+    process_prepare_block();
+    spin_unlock_irqrestore(&mutex_lock_all, flags);
+    process_sleep_while(waiter.granted, 0);
+}
+
+void mutex_unlock(mutex_t* mutex) {
+    uint32_t flags = spin_lock_irqsave(&mutex_lock_all);
+    if (mutex->owner) {
+        mutex_hand_on_locked(mutex);
+    }
+    spin_unlock_irqrestore(&mutex_lock_all, flags);
+}
+
+bool mutex_is_held(const mutex_t* mutex) {
+    return mutex->owner != NULL;
+}
+
+void mutex_cancel_wait(process_t* process) {
+    uint32_t flags = spin_lock_irqsave(&mutex_lock_all);
+    mutex_t* mutex = process->blocked_on;
+    if (mutex) {
+        waiter_remove(mutex, process);
+        process->blocked_on = NULL;
+        pi_propagate(mutex);            // The owner may have been lent its level
+    }
+    spin_unlock_irqrestore(&mutex_lock_all, flags);
+}
+
+void mutex_release_owned(process_t* process) {
+    uint32_t flags = spin_lock_irqsave(&mutex_lock_all);
+    while (process->held_mutexes) {
+        mutex_hand_on_locked(process->held_mutexes);
+    }
+    spin_unlock_irqrestore(&mutex_lock_all, flags);
+}
@@ -0,0 +1,49 @@
+// ClaudeOS Kernel Mutexes - Day 21
+// Sleeping locks with an owner and priority inheritance. A task that
+// blocks on a held mutex lends its scheduling level to the owner, and on
+// along the chain if the owner is itself blocked on another mutex, so a
+// high-priority task is never stuck behind a low-priority holder that
+// the MLFQ keeps off the CPU. Waiters queue highest level first (FIFO
+// within a level) and unlock hands the mutex straight to the first one.
+// A deadline task waiting lends level 0.
+
+#ifndef MUTEX_H
+#define MUTEX_H
+
+#include "types.h"
+
+#define MUTEX_PI_DEPTH      8           // Owners boosted along one chain, at most
+
+struct process;
+
+typedef struct mutex_waiter {
+    struct process* process;
+    volatile int granted;
+    struct mutex_waiter* next;
+} mutex_waiter_t;
+
+typedef struct mutex {
+    struct process* owner;
+    mutex_waiter_t* waiters;            // Highest priority first
+    struct mutex* held_next;            // Owner's other held mutexes
+    const char* name;
+    uint32_t acquired;
+    uint32_t contended;                 // Locks that had to wait
+} mutex_t;
+
+#define MUTEX_INIT(mutex_name) { NULL, NULL, NULL, mutex_name, 0, 0 }
+
+void mutex_init(mutex_t* mutex, const char* name);
+
+// Sleep until the mutex is the caller's. A caller that can't sleep (the
+// kernel task, or no preemption) waits between interrupts instead.
+void mutex_lock(mutex_t* mutex);
+bool mutex_trylock(mutex_t* mutex);
+void mutex_unlock(mutex_t* mutex);
+bool mutex_is_held(const mutex_t* mutex);
+
+// Drop a killed process's wait, and hand on whatever it still holds
+void mutex_cancel_wait(struct process* process);
+void mutex_release_owned(struct process* process);
+
+#endif // MUTEX_H
@@ -5,35 +5,40 @@
 #include "kernel.h"
 #include "timer.h"
 #include "string.h"
+#include "slab.h"
+#include "heap.h"
+#include "pmm.h"
+#include "e1000.h"
+#include "virtio_net.h"
+#include "ipv4.h"
+#include "tcp.h"
+#include "udp.h"
+#include "arp.h"
+#include "procfs.h"
+#include "initcall.h"
 
 // Global network state
 network_interface_t network_interfaces[MAX_NETWORK_INTERFACES];
-network_packet_t packet_buffers[PACKET_BUFFER_COUNT];
+static network_packet_t packet_headers[PACKET_BUFFER_COUNT];  // Boot-time backing for packet_cache
+static uint8_t packet_storage[PACKET_BUFFER_COUNT][NET_BUFFER_SIZE]
+    __attribute__((aligned(NET_BUFFER_SIZE)));                 // ...and for packet_buffer_cache
+kmem_cache_t packet_cache;
+static kmem_cache_t packet_buffer_cache;
 int next_interface_id = 0;
 bool network_initialized = false;
 
-// Simple string utilities for network
-static size_t net_strlen(const char* str) {
-    size_t len = 0;
-    while (str[len] && len < 64) len++;
-    return len;
-}
-
-static void net_strcpy(char* dest, const char* src, size_t max_len) {
-    size_t i = 0;
-    while (src[i] && i < max_len - 1) {
-        dest[i] = src[i];
-        i++;
-    }
-    dest[i] = '\0';
-}
-
-static int net_strcmp(const char* str1, const char* str2) {
-    while (*str1 && *str2 && *str1 == *str2) {
-        str1++;
-        str2++;
-    }
-    return *str1 - *str2;
+// Packet cache constructor - puts a fresh header in the free state
+static void network_packet_ctor(void* object) {
+    network_packet_t* packet = (network_packet_t*)object;
+    packet->head = NULL;
+    packet->data = NULL;
+    packet->size = 0;
+    packet->refcount = 0;
+    packet->interface_id = -1;
+    packet->timestamp = 0;
+    packet->release = NULL;
+    packet->frag_frame = 0;
+    packet->frag_size = 0;
 }
 
 // Network system initialization
@@ -42,8 +47,27 @@ void network_init(void) {
     terminal_writestring("[NETWORK] Initializing Day 19 network foundation...\n");
     terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
     
-    // Clear network interfaces
+    // Clear network interfaces, returning packets left in their RX rings
     for (int i = 0; i < MAX_NETWORK_INTERFACES; i++) {
+        for (int q = 0; q < NET_RX_QUEUES; q++) {
+            net_rx_queue_t* queue = &network_interfaces[i].rx_queues[q];
+            network_packet_t* stale;
+            while (queue->ring.buffer && ring_pop(&queue->ring, &stale) == 0) {
+                network_free_packet(stale);
+            }
+            queue->work.func = NULL;
+            queue->packets = 0;
+        }
+        network_packet_t* stale;
+        while (network_interfaces[i].capture_ring.buffer &&
+               ring_pop(&network_interfaces[i].capture_ring, &stale) == 0) {
+            network_free_packet(stale);
+        }
+        network_attach_filter(&network_interfaces[i], NET_FILTER_RX, NULL, 0);
+        network_attach_filter(&network_interfaces[i], NET_FILTER_CAPTURE, NULL, 0);
+        network_interfaces[i].filter_dropped = 0;
+        network_interfaces[i].captured = 0;
+        waitset_source_gone(&network_interfaces[i].rx_watchers);
         network_interfaces[i].id = -1;
         network_interfaces[i].enabled = false;
         network_interfaces[i].state = NET_STATE_DOWN;
@@ -52,6 +76,12 @@ void network_init(void) {
         network_interfaces[i].bytes_sent = 0;
         network_interfaces[i].bytes_received = 0;
         network_interfaces[i].errors = 0;
+        network_interfaces[i].driver = NULL;
+        network_interfaces[i].driver_data = NULL;
+        network_interfaces[i].features = 0;
+        network_interfaces[i].netmask = 0;
+        network_interfaces[i].gateway = 0;
+        network_interfaces[i].poll_work.func = NULL;
         for (int j = 0; j < 16; j++) {
             network_interfaces[i].name[j] = 0;
         }
@@ -60,15 +90,19 @@ void network_init(void) {
         }
     }
     
-    // Clear packet buffers
-    for (int i = 0; i < PACKET_BUFFER_COUNT; i++) {
-        packet_buffers[i].in_use = false;
-        packet_buffers[i].size = 0;
-        packet_buffers[i].interface_id = -1;
-        packet_buffers[i].timestamp = 0;
-        for (int j = 0; j < MAX_PACKET_SIZE; j++) {
-            packet_buffers[i].data[j] = 0;
-        }
+    // Packet headers and their buffers come from object caches seeded
+    // with static pools; both free lists make allocation O(1), and both
+    // keep their alignment when they grow
+    static bool packet_cache_ready = false;
+    if (!packet_cache_ready) {
+        kmem_cache_init_aligned(&packet_cache, "net_packet", sizeof(network_packet_t),
+                                NET_PACKET_ALIGN, network_packet_ctor);
+        kmem_cache_seed(&packet_cache, packet_headers, PACKET_BUFFER_COUNT);
+        kmem_cache_init_aligned(&packet_buffer_cache, "net_buffer", NET_BUFFER_SIZE,
+                                NET_BUFFER_SIZE, NULL);
+        kmem_cache_seed(&packet_buffer_cache, packet_storage, PACKET_BUFFER_COUNT);
+        packet_cache_ready = true;
+        tcp_init();
     }
     
     next_interface_id = 0;
@@ -86,10 +120,22 @@ void network_init(void) {
         network_enable_interface(lo_id);
     }
     
-    // Create virtual ethernet interface
+    // Create the ethernet interface. With a NIC behind it the MAC comes
+    // from the card once the interface is opened.
     int eth_id = network_create_interface("eth0", NET_INTERFACE_ETHERNET);
-    if (eth_id >= 0) {
+    if (eth_id >= 0 && network_interfaces[eth_id].driver) {
+        // A real NIC runs the IPv4 stack, addressed for QEMU user networking
+        network_interfaces[eth_id].ip_address = 0x0A00020F; // 10.0.2.15
+        network_interfaces[eth_id].netmask = 0xFFFFFF00;
+        network_interfaces[eth_id].gateway = 0x0A000202;    // 10.0.2.2
+        ipv4_attach(&network_interfaces[eth_id]);
+        if (network_enable_interface(eth_id) != 0) {
+            terminal_printf("  - eth0: %s found; 'vmm init' then 'ifup eth0' to start it\n",
+                            network_interfaces[eth_id].driver->name);
+        }
+    } else if (eth_id >= 0) {
         network_interfaces[eth_id].ip_address = 0xC0A80101; // 192.168.1.1
+        network_interfaces[eth_id].netmask = 0xFFFFFF00;
         network_interfaces[eth_id].mac_address[0] = 0x52;
         network_interfaces[eth_id].mac_address[1] = 0x54;
         network_interfaces[eth_id].mac_address[2] = 0x00;
@@ -105,10 +151,17 @@ void network_init(void) {
     terminal_writestring("[NETWORK] Network foundation initialized!\n");
     terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
     terminal_writestring("  - Loopback interface: lo (127.0.0.1)\n");
-    terminal_writestring("  - Ethernet interface: eth0 (192.168.1.1)\n");
+    if (eth_id >= 0) {
+        char ip_str[16];
+        network_format_ip_address(network_interfaces[eth_id].ip_address, ip_str, sizeof(ip_str));
+        terminal_printf("  - Ethernet interface: eth0 (%s)\n", ip_str);
+    }
     terminal_writestring("  - Packet buffers: 32 available\n");
 }
 
+// The NIC behind eth0 is found by the PCI scan
+INITCALL(initcall_network, "network", network_init, INIT_LAZY, "pci");
+
 // Interface management
 int network_create_interface(const char* name, net_interface_type_t type) {
     if (!name || next_interface_id >= MAX_NETWORK_INTERFACES) {
@@ -119,10 +172,21 @@ int network_create_interface(const char* name, net_interface_type_t type) {
     for (int i = 0; i < MAX_NETWORK_INTERFACES; i++) {
         if (network_interfaces[i].id == -1) {
             network_interfaces[i].id = next_interface_id++;
-            net_strcpy(network_interfaces[i].name, name, 16);
+            strlcpy(network_interfaces[i].name, name, 16);
             network_interfaces[i].type = type;
             network_interfaces[i].state = NET_STATE_DOWN;
             network_interfaces[i].enabled = false;
+            for (int q = 0; q < NET_RX_QUEUES; q++) {
+                net_rx_queue_t* queue = &network_interfaces[i].rx_queues[q];
+                ring_init(&queue->ring, queue->slots, NETWORK_QUEUE_SIZE, sizeof(network_packet_t*));
+                queue->iface = &network_interfaces[i];
+            }
+            ring_init(&network_interfaces[i].capture_ring, network_interfaces[i].capture_slots,
+                      NET_CAPTURE_SLOTS, sizeof(network_packet_t*));
+            // Paravirtual first: under a hypervisor it costs far fewer exits
+            if (type == NET_INTERFACE_ETHERNET && virtio_net_probe(&network_interfaces[i]) != 0) {
+                e1000_probe(&network_interfaces[i]);
+            }
             return network_interfaces[i].id;
         }
     }
@@ -130,10 +194,46 @@ int network_create_interface(const char* name, net_interface_type_t type) {
     return -1;
 }
 
+// Work item: drain up to a budget. A full budget means the ring is still
+// busy, so polling continues behind whatever else is queued; interrupts
+// come back only once a poll falls short.
+static void network_poll_work(void* arg) {
+    network_interface_t* iface = (network_interface_t*)arg;
+    int done = iface->driver->poll(iface, NET_NAPI_BUDGET);
+    iface->rx_polls++;
+    iface->rx_polled += (uint32_t)done;
+    if (done >= NET_NAPI_BUDGET) {
+        work_schedule(&iface->poll_work);
+        return;
+    }
+    // Last: once unmasked, the next interrupt may queue this again
+    iface->driver->rx_irq(iface, true);
+}
+
+// Driver top half for received frames
+void network_rx_interrupt(network_interface_t* iface) {
+    uint32_t now = timer_get_ticks();
+    iface->rx_interrupts++;
+    iface->irq_window_count++;
+    if (now - iface->irq_window_start >= TIMER_FREQUENCY) {
+        iface->irq_rate = iface->irq_window_count * TIMER_FREQUENCY / (now - iface->irq_window_start);
+        iface->irq_window_start = now;
+        iface->irq_window_count = 0;
+    }
+    iface->driver->rx_irq(iface, false);
+    work_schedule(&iface->poll_work);
+}
+
 int network_enable_interface(int interface_id) {
     network_interface_t* iface = network_find_interface(interface_id);
     if (!iface) return -1;
     
+    if (!iface->enabled && iface->driver && iface->driver->open(iface) != 0) {
+        return -1;
+    }
+    if (iface->driver && iface->driver->poll && !iface->poll_work.func) {
+        work_init(&iface->poll_work, network_poll_work, iface);
+    }
     iface->enabled = true;
     iface->state = NET_STATE_UP;
     return 0;
@@ -157,12 +257,22 @@ network_interface_t* network_find_interface(int interface_id) {
     return NULL;
 }
 
+// Receive interrupts go to that CPU; pin the kworkers that poll the
+// interface there too (proc affinity) and its frames stay in one cache
+int network_set_affinity(const char* name, uint32_t cpu) {
+    network_interface_t* iface = network_find_interface_by_name(name);
+    if (!iface || !iface->driver || !iface->driver->set_affinity) {
+        return -1;
+    }
+    return iface->driver->set_affinity(iface, cpu);
+}
+
 network_interface_t* network_find_interface_by_name(const char* name) {
     if (!name) return NULL;
     
     for (int i = 0; i < MAX_NETWORK_INTERFACES; i++) {
         if (network_interfaces[i].id != -1 && 
-            net_strcmp(network_interfaces[i].name, name) == 0) {
+            strcmp(network_interfaces[i].name, name) == 0) {
             return &network_interfaces[i];
         }
     }
@@ -170,48 +280,401 @@ network_interface_t* network_find_interface_by_name(const char* name) {
 }
 
 // Packet buffer management
+static network_packet_t* network_packet_header(uint8_t* buffer, size_t capacity) {
+    network_packet_t* packet = (network_packet_t*)kmem_cache_alloc(&packet_cache);
+    if (!packet) {
+        return NULL; // No free headers
+    }
+    packet->head = buffer;
+    packet->data = buffer;
+    packet->size = 0;
+    packet->capacity = capacity;
+    packet->refcount = 1;
+    packet->timestamp = get_uptime_seconds();
+    packet->interface_id = -1;
+    packet->release = NULL;
+    packet->owner = NULL;
+    packet->csum = 0;
+    packet->frag_frame = 0;
+    packet->frag_offset = 0;
+    packet->frag_size = 0;
+    return packet;
+}
+
 network_packet_t* network_alloc_packet(void) {
-    for (int i = 0; i < PACKET_BUFFER_COUNT; i++) {
-        if (!packet_buffers[i].in_use) {
-            packet_buffers[i].in_use = true;
-            packet_buffers[i].size = 0;
-            packet_buffers[i].timestamp = get_uptime_seconds();
-            packet_buffers[i].interface_id = -1;
-            return &packet_buffers[i];
-        }
+    uint8_t* buffer = (uint8_t*)kmem_cache_alloc(&packet_buffer_cache);
+    if (!buffer) {
+        return NULL; // No free buffers
     }
-    return NULL; // No free buffers
+    network_packet_t* packet = network_packet_header(buffer, NET_BUFFER_SIZE);
+    if (!packet) {
+        kmem_cache_free(&packet_buffer_cache, buffer);
+        return NULL;
+    }
+    packet->data = buffer + NET_HEADROOM;
+    return packet;
 }
 
-void network_free_packet(network_packet_t* packet) {
+// Wrap size bytes a driver already holds at buffer (no headroom). The
+// buffer is handed back through release(packet) after the last reference.
+network_packet_t* network_attach_packet(uint8_t* buffer, size_t capacity, size_t size,
+                                        net_release_t release, void* owner) {
+    if (!buffer || size > capacity) {
+        return NULL;
+    }
+    network_packet_t* packet = network_packet_header(buffer, capacity);
+    if (!packet) {
+        return NULL;
+    }
+    packet->size = size;
+    packet->release = release;
+    packet->owner = owner;
+    return packet;
+}
+
+// Another reference, for handing one packet to several consumers
+network_packet_t* network_packet_get(network_packet_t* packet) {
     if (packet) {
-        packet->in_use = false;
-        packet->size = 0;
-        packet->interface_id = -1;
+        __sync_fetch_and_add(&packet->refcount, 1);
     }
+    return packet;
 }
 
-int network_send_packet(int interface_id, const uint8_t* data, size_t size) {
-    if (!data || size == 0 || size > MAX_PACKET_SIZE) return -1;
+void network_free_packet(network_packet_t* packet) {
+    if (!packet || packet->refcount == 0) {
+        return;
+    }
+    if (__sync_sub_and_fetch(&packet->refcount, 1) != 0) {
+        return;
+    }
+    if (packet->frag_frame) {
+        network_frame_put(packet->frag_frame);
+        packet->frag_frame = 0;
+        packet->frag_size = 0;
+    }
+    if (packet->release) {
+        packet->release(packet);
+    } else {
+        kmem_cache_free(&packet_buffer_cache, packet->head);
+    }
+    packet->head = NULL;
+    packet->data = NULL;
+    packet->size = 0;
+    packet->interface_id = -1;
+    kmem_cache_free(&packet_cache, packet);
+}
+
+uint8_t* network_packet_push(network_packet_t* packet, size_t len) {
+    if (!packet || (size_t)(packet->data - packet->head) < len) {
+        return NULL;  // Out of headroom
+    }
+    packet->data -= len;
+    packet->size += len;
+    return packet->data;
+}
+
+uint8_t* network_packet_pull(network_packet_t* packet, size_t len) {
+    if (!packet || packet->size < len) {
+        return NULL;
+    }
+    packet->data += len;
+    packet->size -= len;
+    return packet->data;
+}
+
+uint8_t* network_packet_put(network_packet_t* packet, size_t len) {
+    if (!packet) {
+        return NULL;
+    }
+    uint8_t* tail = packet->data + packet->size;
+    if ((size_t)(tail - packet->head) + len > packet->capacity) {
+        return NULL;  // Out of tailroom
+    }
+    packet->size += len;
+    return tail;
+}
+
+int network_packet_frag(network_packet_t* packet, uint32_t frame, uint32_t offset, uint32_t size) {
+    if (!packet || packet->frag_frame || offset + size > PAGE_SIZE) {
+        network_frame_put(frame);
+        return -1;
+    }
+    packet->frag_frame = frame;
+    packet->frag_offset = (uint16_t)offset;
+    packet->frag_size = (uint16_t)size;
+    return 0;
+}
+
+int network_packet_linearize(network_packet_t* packet) {
+    if (!packet->frag_frame) {
+        return 0;
+    }
+    uint32_t size = packet->frag_size;
+    uint8_t* tail = network_packet_put(packet, size);
+    if (!tail) {
+        return -1;
+    }
+    memcpy(tail, (uint8_t*)PHYS_TO_VIRT(packet->frag_frame) + packet->frag_offset, size);
+    network_frame_put(packet->frag_frame);
+    packet->frag_frame = 0;
+    packet->frag_size = 0;
+    return 0;
+}
+
+// The last packet holding a frame may go in a NIC's reclaim, under its
+// lock with interrupts off; the PMM's magazines are only safe from one
+// context at a time on a CPU
+void network_frame_put(uint32_t frame) {
+    uint32_t flags = lock_irq_save();
+    pmm_free_page(frame);
+    lock_irq_restore(flags);
+}
+
+// Hand a packet to the interface's hardware. Loopback delivers the same
+// buffer to its own receive side, so nothing is copied either way.
+int network_transmit(int interface_id, network_packet_t* packet) {
+    if (!packet) return -1;
     
     network_interface_t* iface = network_find_interface(interface_id);
-    if (!iface || !iface->enabled) return -1;
+    size_t size = network_packet_length(packet);
+    if (!iface || !iface->enabled || packet->size == 0 || size > MAX_PACKET_SIZE) {
+        network_free_packet(packet);
+        return -1;
+    }
+    
+    if (iface->driver) {
+        if (iface->driver->transmit(iface, packet) != 0) {
+            iface->errors++;
+            return -1;
+        }
+    } else if (iface->type == NET_INTERFACE_LOOPBACK) {
+        // Transmit is the RX ring's producer; any number of tasks may send,
+        // so they take turns being the single producer the ring allows.
+        // The receive side reads frames as one run of bytes.
+        if (network_packet_linearize(packet) != 0) {
+            network_free_packet(packet);
+            iface->errors++;
+            return -1;
+        }
+        uint32_t flags = spin_lock_irqsave(&iface->loopback_lock);
+        network_deliver_packet(interface_id, packet);
+        spin_unlock_irqrestore(&iface->loopback_lock, flags);
+    } else {
+        network_free_packet(packet);  // Simulated wire
+    }
     
-    // Simulate packet sending (just update statistics)
     iface->packets_sent++;
     iface->bytes_sent += size;
-    
     return 0; // Success
 }
 
+// Convenience for callers holding raw bytes: copies them into a packet
+int network_send_packet(int interface_id, const uint8_t* data, size_t size) {
+    if (!data || size == 0 || size > MAX_PACKET_SIZE) return -1;
+    
+    network_packet_t* packet = network_alloc_packet();
+    if (!packet) return -1;
+    memcpy(network_packet_put(packet, size), data, size);
+    return network_transmit(interface_id, packet);
+}
+
+// The Microsoft RSS key: what NICs hash with unless told otherwise, so
+// a flow lands on the queue hardware RSS would have picked
+static const uint8_t net_rss_key[16] = {
+    0x6D, 0x5A, 0x56, 0xDA, 0x25, 0x5B, 0x0E, 0xC2,
+    0x41, 0x67, 0x25, 0x3D, 0x43, 0xA3, 0x8F, 0xB0
+};
+
+// Toeplitz hash of up to 12 bytes: every set input bit XORs in the 32
+// key bits starting at its position
+static uint32_t net_rss_toeplitz(const uint8_t* input, uint32_t length) {
+    uint32_t hash = 0;
+    uint32_t window = ((uint32_t)net_rss_key[0] << 24) | ((uint32_t)net_rss_key[1] << 16) |
+                      ((uint32_t)net_rss_key[2] << 8) | net_rss_key[3];
+    for (uint32_t i = 0; i < length; i++) {
+        for (int bit = 7; bit >= 0; bit--) {
+            if (input[i] & (1u << bit)) {
+                hash ^= window;
+            }
+            window = (window << 1) | ((net_rss_key[i + 4] >> bit) & 1);
+        }
+    }
+    return hash;
+}
+
+// Queue for an Ethernet frame: its IPv4 addresses and, unless it is a
+// fragment (whose pieces must stay together), its TCP/UDP ports. Other
+// frames (ARP) all go to queue 0.
+static uint32_t network_rx_queue_index(const network_packet_t* packet) {
+    const uint8_t* frame = packet->data;
+    if (packet->size < ETH_HEADER_SIZE + IPV4_HEADER_SIZE ||
+        net_ntohs(((const eth_header_t*)frame)->type) != ETH_TYPE_IPV4) {
+        return 0;
+    }
+    const ipv4_header_t* ip = (const ipv4_header_t*)(frame + ETH_HEADER_SIZE);
+    uint32_t header_size = (ip->version_ihl & 0xF) * 4;
+    uint8_t tuple[12];
+    uint32_t length = 8;
+    memcpy(tuple, &ip->src, 4);
+    memcpy(tuple + 4, &ip->dest, 4);
+    if ((ip->protocol == IPV4_PROTO_TCP || ip->protocol == IPV4_PROTO_UDP) &&
+        !(net_ntohs(ip->frag_offset) & 0x3FFF) &&           // MF and the offset
+        packet->size >= ETH_HEADER_SIZE + header_size + 4) {
+        memcpy(tuple + 8, frame + ETH_HEADER_SIZE + header_size, 4);
+        length = 12;
+    }
+    return net_rss_toeplitz(tuple, length) & (NET_RX_QUEUES - 1);
+}
+
+int network_attach_filter(network_interface_t* iface, int which, const bpf_insn_t* insns,
+                          uint32_t length) {
+    if (which != NET_FILTER_RX && which != NET_FILTER_CAPTURE) {
+        return -1;
+    }
+    bpf_prog_t* prog = NULL;
+    if (length) {
+        uint32_t where;
+        if (!insns || bpf_verify(insns, length, &where) != 0) {
+            return -1;
+        }
+        prog = (bpf_prog_t*)kmalloc(sizeof(bpf_prog_t));
+        if (!prog) {
+            return -1;
+        }
+        prog->length = length;
+        memcpy(prog->insns, insns, length * sizeof(bpf_insn_t));
+    }
+    bpf_prog_t** slot = which == NET_FILTER_RX ? &iface->rx_filter : &iface->capture_filter;
+    uint32_t flags = spin_lock_irqsave(&iface->filter_lock);
+    bpf_prog_t* old = *slot;
+    *slot = prog;
+    spin_unlock_irqrestore(&iface->filter_lock, flags);
+    if (old) {
+        kfree(old);     // No run can still be inside it once the lock is dropped
+    }
+    return 0;
+}
+
+// Copy up to snap bytes of packet onto the capture ring (RX producer side)
+static void network_capture(network_interface_t* iface, network_packet_t* packet, uint32_t snap) {
+    uint32_t length = (uint32_t)packet->size;
+    if (length > snap) length = snap;
+    if (length > NET_CAPTURE_SNAPLEN) length = NET_CAPTURE_SNAPLEN;
+    network_packet_t* copy = network_alloc_packet();
+    uint8_t* body = copy ? network_packet_put(copy, length) : NULL;
+    if (!body) {
+        network_free_packet(copy);
+        iface->capture_ring.dropped++;
+        return;
+    }
+    memcpy(body, packet->data, length);
+    copy->interface_id = iface->id;
+    copy->timestamp = timer_get_ticks();
+    if (ring_push(&iface->capture_ring, &copy) != 0) {
+        network_free_packet(copy);      // Counted in the ring's dropped
+        return;
+    }
+    iface->captured++;
+}
+
+// Run an interface's filters over a frame on its way in; false drops it
+static bool network_filter_rx(network_interface_t* iface, network_packet_t* packet) {
+    uint32_t snap = 0;
+    bool keep = true;
+    uint32_t flags = spin_lock_irqsave(&iface->filter_lock);
+    if (iface->capture_filter) {
+        snap = bpf_run(iface->capture_filter, packet->data, (uint32_t)packet->size);
+    }
+    if (iface->rx_filter) {
+        keep = bpf_run(iface->rx_filter, packet->data, (uint32_t)packet->size) != 0;
+    }
+    spin_unlock_irqrestore(&iface->filter_lock, flags);
+    if (snap) {
+        network_capture(iface, packet, snap);
+    }
+    if (!keep) {
+        iface->filter_dropped++;
+    }
+    return keep;
+}
+
+network_packet_t* network_capture_next(network_interface_t* iface) {
+    network_packet_t* packet;
+    if (ring_pop(&iface->capture_ring, &packet) != 0) {
+        return NULL;
+    }
+    return packet;
+}
+
+// RX producer - called by the interface's driver (its poll for a NIC).
+// Filters it, then queues the packet itself on its flow's queue, without
+// copying or taking locks when no filter is attached.
+int network_deliver_packet(int interface_id, network_packet_t* packet) {
+    if (!packet) return -1;
+    
+    network_interface_t* iface = network_find_interface(interface_id);
+    if (!iface || !iface->enabled || packet->size == 0 || packet->size > MAX_PACKET_SIZE) {
+        network_free_packet(packet);
+        return -1;
+    }
+    packet->interface_id = interface_id;
+    if ((iface->rx_filter || iface->capture_filter) && !network_filter_rx(iface, packet)) {
+        network_free_packet(packet);
+        return -1;
+    }
+
+    net_rx_queue_t* queue = &iface->rx_queues[network_rx_queue_index(packet)];
+    if (ring_push(&queue->ring, &packet) != 0) {
+        network_free_packet(packet);  // Ring full - counted in the ring's dropped
+        return -1;
+    }
+    queue->packets++;
+    waitset_notify(&iface->rx_watchers);
+    if (queue->work.func) {
+        work_schedule(&queue->work);  // Already queued is fine
+    }
+    return 0;
+}
+
+// RX consumer for one queue. The queues' works run concurrently, so the
+// interface counters are updated atomically.
+network_packet_t* network_receive_queue(net_rx_queue_t* queue) {
+    if (!queue->iface->enabled) return NULL;
+
+    network_packet_t* packet;
+    if (ring_pop(&queue->ring, &packet) != 0) {
+        return NULL;
+    }
+    __sync_fetch_and_add(&queue->iface->packets_received, 1);
+    __sync_fetch_and_add(&queue->iface->bytes_received, (uint32_t)packet->size);
+    return packet;
+}
+
+// RX consumer over every queue (interfaces without a stack attached, where
+// the caller is the only consumer) - the caller owns the packet and frees
+// it when done
 network_packet_t* network_receive_packet(int interface_id) {
     network_interface_t* iface = network_find_interface(interface_id);
-    if (!iface || !iface->enabled) return NULL;
-    
-    // Simulate packet reception (no actual packets in basic implementation)
+    if (!iface) return NULL;
+
+    for (int q = 0; q < NET_RX_QUEUES; q++) {
+        network_packet_t* packet = network_receive_queue(&iface->rx_queues[q]);
+        if (packet) {
+            return packet;
+        }
+    }
     return NULL;
 }
 
+bool network_rx_pending(network_interface_t* iface) {
+    for (int q = 0; q < NET_RX_QUEUES; q++) {
+        if (!ring_empty(&iface->rx_queues[q].ring)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 // Network statistics
 void network_get_stats(network_stats_t* stats) {
     if (!stats) return;
@@ -235,10 +698,15 @@ void network_get_stats(network_stats_t* stats) {
     }
     
     // Count used packet buffers
-    stats->buffer_usage = 0;
-    for (int i = 0; i < PACKET_BUFFER_COUNT; i++) {
-        if (packet_buffers[i].in_use) {
-            stats->buffer_usage++;
+    stats->buffer_usage = packet_cache.in_use;
+    stats->rx_queued = 0;
+    stats->rx_dropped = 0;
+    for (int i = 0; i < MAX_NETWORK_INTERFACES; i++) {
+        if (network_interfaces[i].id != -1) {
+            for (int q = 0; q < NET_RX_QUEUES; q++) {
+                stats->rx_queued += ring_count(&network_interfaces[i].rx_queues[q].ring);
+                stats->rx_dropped += network_interfaces[i].rx_queues[q].ring.dropped;
+            }
         }
     }
 }
@@ -328,26 +796,26 @@ void network_show_interfaces(void) {
             terminal_writestring(iface->name);
             
             // Pad to align columns
-            int name_len = net_strlen(iface->name);
+            int name_len = strnlen(iface->name, 64);
             for (int j = name_len; j < 7; j++) terminal_writestring(" ");
             
             // Interface type
             const char* type_str = network_interface_type_string(iface->type);
             terminal_writestring(type_str);
-            int type_len = net_strlen(type_str);
+            int type_len = strnlen(type_str, 64);
             for (int j = type_len; j < 10; j++) terminal_writestring(" ");
             
             // State
             const char* state_str = network_interface_state_string(iface->state);
             terminal_writestring(state_str);
-            int state_len = net_strlen(state_str);
+            int state_len = strnlen(state_str, 64);
             for (int j = state_len; j < 7; j++) terminal_writestring(" ");
             
             // IP Address
             char ip_str[16];
             network_format_ip_address(iface->ip_address, ip_str, 16);
             terminal_writestring(ip_str);
-            int ip_len = net_strlen(ip_str);
+            int ip_len = strnlen(ip_str, 64);
             for (int j = ip_len; j < 15; j++) terminal_writestring(" ");
             
             // MAC Address
@@ -360,47 +828,259 @@ void network_show_interfaces(void) {
     }
 }
 
+// /proc/net: totals over every interface, then each polled one's RX path
+void network_proc_show(proc_seq_t* seq) {
+    if (!network_initialized) {
+        proc_puts(seq, "interfaces.active: 0\n");     // Lazy, and nothing has used it yet
+        return;
+    }
+    network_stats_t stats;
+    network_get_stats(&stats);
+    proc_printf(seq, "interfaces.active: %u\n", (uint32_t)stats.active_interfaces);
+    proc_printf(seq, "packets.sent: %u\n", (uint32_t)stats.total_packets_sent);
+    proc_printf(seq, "packets.received: %u\n", (uint32_t)stats.total_packets_received);
+    proc_printf(seq, "bytes.sent: %u\n", (uint32_t)stats.total_bytes_sent);
+    proc_printf(seq, "bytes.received: %u\n", (uint32_t)stats.total_bytes_received);
+    proc_printf(seq, "buffers.used: %u\n", (uint32_t)stats.buffer_usage);
+    proc_printf(seq, "buffers.total: %u\n", (uint32_t)packet_cache.total);
+    proc_printf(seq, "rx.queued: %u\n", (uint32_t)stats.rx_queued);
+    proc_printf(seq, "rx.dropped: %u\n", (uint32_t)stats.rx_dropped);
+
+    for (int i = 0; i < MAX_NETWORK_INTERFACES; i++) {
+        network_interface_t* iface = &network_interfaces[i];
+        if (iface->id == -1 || !iface->poll_work.func) {
+            continue;
+        }
+        // Hundredths of a packet per poll
+        uint32_t per_poll = iface->rx_polls ? iface->rx_polled * 100 / iface->rx_polls : 0;
+        proc_printf(seq, "%s.rx: %u interrupts (%u/s), %u polls, %u.%s%u packets per poll\n",
+                    iface->name, iface->rx_interrupts, iface->irq_rate, iface->rx_polls,
+                    per_poll / 100, per_poll % 100 < 10 ? "0" : "", per_poll % 100);
+        for (int q = 0; q < NET_RX_QUEUES; q++) {
+            net_rx_queue_t* queue = &iface->rx_queues[q];
+            proc_printf(seq, "%s.rxq%d: %u packets, %u queued, %u dropped\n", iface->name, q,
+                        queue->packets, ring_count(&queue->ring), queue->ring.dropped);
+        }
+    }
+}
+
 void network_show_stats(void) {
+    procfs_print(network_proc_show);
+}
+
+static bool network_is_loopback_target(const char* target) {
+    return strcmp(target, "localhost") == 0 || strcmp(target, "lo") == 0 ||
+           (target[0] == '1' && target[1] == '2' && target[2] == '7' && target[3] == '.');
+}
+
+// Echo over "lo": each request goes out through network_transmit and is
+// taken off the RX ring again, so the round trip is the stack's own cost
+// (allocation, transmit, ring hand-off, receive) in TSC cycles
+static void network_ping_loopback(const char* target) {
+    network_interface_t* lo = network_find_interface_by_name("lo");
+    if (!lo || !lo->enabled) {
+        terminal_writestring("ping: loopback interface is down\n");
+        return;
+    }
     terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK));
-    terminal_writestring("Network Statistics:\n");
+    terminal_printf("PING %s via lo, %d bytes\n", target, NETWORK_PING_SIZE);
     terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
     
-    network_stats_t stats;
-    network_get_stats(&stats);
+    uint32_t received = 0;
+    uint32_t min = 0xFFFFFFFF, max = 0, total = 0;
+    for (uint32_t seq = 1; seq <= NETWORK_PING_COUNT; seq++) {
+        network_packet_t* request = network_alloc_packet();
+        uint8_t* payload = request ? network_packet_put(request, NETWORK_PING_SIZE) : NULL;
+        if (!payload) {
+            network_free_packet(request);
+            terminal_writestring("ping: out of packet buffers\n");
+            break;
+        }
+        for (uint32_t i = 0; i < NETWORK_PING_SIZE; i++) {
+            payload[i] = (uint8_t)i;
+        }
+        payload[0] = (uint8_t)seq;
+        
+        uint64_t start = clock_cycles();
+        if (network_transmit(lo->id, request) != 0) {
+            terminal_printf("seq=%d: send failed\n", (int)seq);
+            continue;
+        }
+        // Skip anything else that was sitting on the ring
+        network_packet_t* reply;
+        while ((reply = network_receive_packet(lo->id)) != NULL && reply->data[0] != (uint8_t)seq) {
+            network_free_packet(reply);
+        }
+        uint32_t cycles = (uint32_t)(clock_cycles() - start);
+        if (!reply) {
+            terminal_printf("seq=%d: lost\n", (int)seq);
+            continue;
+        }
+        terminal_printf("%d bytes from %s: seq=%d time=%d cycles\n",
+                        (int)reply->size, target, (int)seq, (int)cycles);
+        network_free_packet(reply);
+        
+        received++;
+        total += cycles;
+        if (cycles < min) min = cycles;
+        if (cycles > max) max = cycles;
+    }
     
-    terminal_writestring("  Active Interfaces: ");
-    char num_str[16];
-    itoa((int)stats.active_interfaces, num_str, 10);
-    terminal_writestring(num_str);
-    terminal_writestring("\n");
-    
-    terminal_writestring("  Packets Sent: ");
-    itoa((int)stats.total_packets_sent, num_str, 10);
-    terminal_writestring(num_str);
-    terminal_writestring("\n");
-    
-    terminal_writestring("  Packets Received: ");
-    itoa((int)stats.total_packets_received, num_str, 10);
-    terminal_writestring(num_str);
-    terminal_writestring("\n");
-    
-    terminal_writestring("  Bytes Sent: ");
-    itoa((int)stats.total_bytes_sent, num_str, 10);
-    terminal_writestring(num_str);
-    terminal_writestring("\n");
-    
-    terminal_writestring("  Bytes Received: ");
-    itoa((int)stats.total_bytes_received, num_str, 10);
-    terminal_writestring(num_str);
-    terminal_writestring("\n");
-    
-    terminal_writestring("  Buffer Usage: ");
-    itoa((int)stats.buffer_usage, num_str, 10);
-    terminal_writestring(num_str);
-    terminal_writestring("/");
-    itoa(PACKET_BUFFER_COUNT, num_str, 10);
-    terminal_writestring(num_str);
-    terminal_writestring(" buffers\n");
+    terminal_printf("\n--- %s ping statistics ---\n", target);
+    terminal_printf("%d packets transmitted, %d received\n", NETWORK_PING_COUNT, (int)received);
+    if (received > 0) {
+        terminal_printf("rtt min/avg/max = %d/%d/%d cycles\n",
+                        (int)min, (int)(total / received), (int)max);
+    }
+    if (clock_tsc_khz() == 0) {
+        terminal_writestring("(no TSC: cycle counts are unavailable)\n");
+    }
+}
+
+// a * b / c for the rate figures: 64-bit products, but both sides are
+// shifted down until the divide fits in 32 bits (no libgcc here)
+static uint32_t netbench_scale(uint64_t a, uint64_t b, uint64_t c) {
+    uint64_t num = a * b;
+    while ((num >> 32) || (c >> 32)) {
+        num >>= 1;
+        c >>= 1;
+    }
+    return c ? (uint32_t)num / (uint32_t)c : 0;
+}
+
+static void netbench_record(uint32_t* histogram, uint32_t cycles) {
+    uint32_t bucket = 0;
+    while (bucket < NETBENCH_HIST_BUCKETS - 1 && (cycles >> (bucket + 1))) {
+        bucket++;
+    }
+    histogram[bucket]++;
+}
+
+// Build one benchmark packet; lo carries the payload as is, a NIC gets
+// an Ethernet header in front
+static network_packet_t* netbench_packet(uint32_t size, uint32_t seq) {
+    network_packet_t* packet = network_alloc_packet();
+    uint8_t* payload = packet ? network_packet_put(packet, size) : NULL;
+    if (!payload) {
+        network_free_packet(packet);
+        return NULL;
+    }
+    uint32_t stamp = (uint32_t)clock_cycles();
+    memcpy(payload, &stamp, sizeof(stamp));
+    memcpy(payload + 4, &seq, sizeof(seq));
+    return packet;
+}
+
+// Push count packets through target in batches. Over lo each batch is sent
+// and then taken back off the RX ring, and the histogram is each packet's
+// send-to-receive time; a NIC can only be measured on transmit, so there
+// it is the cost of each network_transmit call.
+void network_benchmark(const char* target, uint32_t size, uint32_t batch, uint32_t count) {
+    network_interface_t* iface = network_find_interface_by_name(target);
+    if (!iface || !iface->enabled) {
+        terminal_printf("netbench: %s is not up\n", target);
+        return;
+    }
+    bool loopback = iface->type == NET_INTERFACE_LOOPBACK;
+    if (!loopback && !iface->driver) {
+        terminal_printf("netbench: %s has no driver\n", target);
+        return;
+    }
+    if (!clock_tsc_khz()) {
+        terminal_writestring("netbench: no TSC, cycle counts unavailable\n");
+        return;
+    }
+    if (size < NETBENCH_MIN_SIZE) size = NETBENCH_MIN_SIZE;
+    if (size > NETBENCH_MAX_SIZE) size = NETBENCH_MAX_SIZE;
+    if (batch < 1) batch = 1;
+    if (loopback && batch > NETWORK_QUEUE_SIZE) batch = NETWORK_QUEUE_SIZE;  // RX ring depth
+    if (count < batch) count = batch;
+    
+    static const uint8_t broadcast[ETH_ALEN] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+    uint32_t histogram[NETBENCH_HIST_BUCKETS];
+    memset(histogram, 0, sizeof(histogram));
+    uint32_t sent = 0, received = 0, failed = 0;
+    
+    terminal_printf("netbench %s: %d packets of %d bytes, batch %d\n",
+                    iface->name, (int)count, (int)size, (int)batch);
+    uint64_t start = clock_cycles();
+    for (uint32_t seq = 0; seq < count; ) {
+        uint32_t in_flight = 0;
+        for (uint32_t i = 0; i < batch && seq < count; i++, seq++) {
+            network_packet_t* packet = netbench_packet(size, seq);
+            if (!packet) {
+                failed++;
+                continue;
+            }
+            uint32_t before = (uint32_t)clock_cycles();
+            int result = loopback ? network_transmit(iface->id, packet)
+                                  : eth_output(iface, broadcast, NETBENCH_ETH_TYPE, packet);
+            if (result != 0) {
+                failed++;
+                continue;
+            }
+            sent++;
+            in_flight++;
+            if (!loopback) {
+                netbench_record(histogram, (uint32_t)clock_cycles() - before);
+            }
+        }
+        network_packet_t* packet;
+        while (loopback && in_flight > 0 && (packet = network_receive_packet(iface->id)) != NULL) {
+            uint32_t stamp;
+            memcpy(&stamp, packet->data, sizeof(stamp));
+            netbench_record(histogram, (uint32_t)clock_cycles() - stamp);
+            network_free_packet(packet);
+            received++;
+            in_flight--;
+        }
+    }
+    uint64_t cycles = clock_cycles() - start;
+    
+    uint32_t moved = loopback ? received : sent;
+    uint64_t hz = (uint64_t)clock_tsc_khz() * 1000;
+    uint32_t pps = netbench_scale(moved, hz, cycles);
+    // Payload bits per microsecond is Mbit/s
+    uint32_t mbits = netbench_scale((uint64_t)moved * size * 8, clock_tsc_khz(), cycles * 1000);
+    uint32_t per_packet = moved ? netbench_scale(cycles, 1, moved) : 0;
+    terminal_printf("  sent %d, received %d, failed %d\n", (int)sent, (int)received, (int)failed);
+    terminal_printf("  %d packets/s, %d.%s%s%d Gbit/s, %d cycles per packet\n",
+                    (int)pps, (int)(mbits / 1000), mbits % 1000 < 100 ? "0" : "",
+                    mbits % 1000 < 10 ? "0" : "", (int)(mbits % 1000), (int)per_packet);
+    terminal_printf("  %s (cycles):\n", loopback ? "Round trip" : "Transmit call");
+    for (uint32_t i = 0; i < NETBENCH_HIST_BUCKETS; i++) {
+        if (histogram[i] == 0) {
+            continue;
+        }
+        terminal_printf("    %d+: %d ", i ? (int)(1u << i) : 0, (int)histogram[i]);
+        uint32_t bar = moved ? histogram[i] * 40 / moved : 0;
+        for (uint32_t j = 0; j < bar; j++) {
+            terminal_putchar('#');
+        }
+        terminal_putchar('\n');
+    }
+}
+
+// Parse a dotted quad; returns -1 if str isn't one
+int network_parse_ip_address(const char* str, uint32_t* ip) {
+    uint32_t value = 0;
+    for (int octet = 0; octet < 4; octet++) {
+        uint32_t part = 0;
+        int digits = 0;
+        while (*str >= '0' && *str <= '9' && digits < 3) {
+            part = part * 10 + (uint32_t)(*str++ - '0');
+            digits++;
+        }
+        if (digits == 0 || part > 255 || *str != (octet < 3 ? '.' : '\0')) {
+            return -1;
+        }
+        if (octet < 3) {
+            str++;
+        }
+        value = (value << 8) | part;
+    }
+    *ip = value;
+    return 0;
 }
 
 void network_ping_simulation(const char* target) {
@@ -408,6 +1088,21 @@ void network_ping_simulation(const char* target) {
         terminal_writestring("Usage: ping <target>\n");
         return;
     }
+    if (network_is_loopback_target(target)) {
+        network_ping_loopback(target);
+        return;
+    }
+    // Real echo requests from the first interface running the IP stack
+    uint32_t dest;
+    if (network_parse_ip_address(target, &dest) == 0) {
+        for (int i = 0; i < MAX_NETWORK_INTERFACES; i++) {
+            network_interface_t* iface = &network_interfaces[i];
+            if (iface->id != -1 && iface->enabled && iface->rx_queues[0].work.func) {
+                icmp_ping(iface, dest, NETWORK_PING_COUNT);
+                return;
+            }
+        }
+    }
     
     terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK));
     terminal_writestring("PING ");
@@ -459,26 +1154,271 @@ void network_command_handler(int argc, char argv[][64]) {
         terminal_writestring("Network Commands:\n");
         terminal_writestring("  netinfo  - Show network interface information\n");
         terminal_writestring("  netstat  - Show network statistics\n");
-        terminal_writestring("  ping <target> - Ping simulation\n");
+        terminal_writestring("  ping <target> - Ping (measured in cycles over lo)\n");
+        terminal_writestring("  bench [iface] [size] [batch] [count] - Throughput and latency\n");
+        terminal_writestring("  affinity <iface> <cpu> - Deliver the NIC's interrupts to one CPU\n");
         return;
     }
     
-    if (net_strcmp(argv[1], "info") == 0) {
+    if (strcmp(argv[1], "info") == 0) {
         network_show_interfaces();
     }
-    else if (net_strcmp(argv[1], "stat") == 0) {
+    else if (strcmp(argv[1], "stat") == 0) {
         network_show_stats();
     }
-    else if (net_strcmp(argv[1], "ping") == 0) {
+    else if (strcmp(argv[1], "ping") == 0) {
         if (argc >= 3) {
             network_ping_simulation(argv[2]);
         } else {
             network_ping_simulation("127.0.0.1");
         }
     }
+    else if (strcmp(argv[1], "bench") == 0) {
+        network_benchmark(argc >= 3 ? argv[2] : "lo",
+                          argc >= 4 ? (uint32_t)atoi(argv[3]) : NETBENCH_SIZE,
+                          argc >= 5 ? (uint32_t)atoi(argv[4]) : NETBENCH_BATCH,
+                          argc >= 6 ? (uint32_t)atoi(argv[5]) : NETBENCH_COUNT);
+    }
+    else if (strcmp(argv[1], "affinity") == 0 && argc >= 4) {
+        int cpu = atoi(argv[3]);
+        if (cpu < 0 || network_set_affinity(argv[2], (uint32_t)cpu) != 0) {
+            terminal_writestring("Can't move that interface's interrupts (needs a NIC and an online CPU)\n");
+        } else {
+            terminal_printf("%s interrupts now delivered to CPU %d\n", argv[2], cpu);
+        }
+    }
     else {
         terminal_writestring("Unknown network command: ");
         terminal_writestring(argv[1]);
         terminal_writestring("\n");
     }
-}
\ No newline at end of file
+}
+// netfilter expressions compile to one test chain: each instruction that
+// fails a test jumps to the no-match return, host and port jump straight
+// to the match return, and a frame that passes them all falls through to
+// it. The returns are placed last and the placeholders patched to them.
+#define NETFILTER_MATCH     0xFF
+#define NETFILTER_NOMATCH   0xFE
+
+static void netfilter_emit(bpf_prog_t* prog, uint16_t code, uint32_t k, uint8_t jt, uint8_t jf) {
+    bpf_insn_t* insn = &prog->insns[prog->length++];
+    insn->code = code;
+    insn->jt = jt;
+    insn->jf = jf;
+    insn->k = k;
+}
+
+// [not] all | arp | ip | icmp | host A.B.C.D | [tcp|udp] port N | tcp | udp
+static int netfilter_compile(int argc, char argv[][64], int i, bpf_prog_t* prog,
+                             uint32_t match, uint32_t nomatch) {
+    prog->length = 0;
+    if (i < argc && strcmp(argv[i], "not") == 0) {
+        uint32_t swap = match;
+        match = nomatch;
+        nomatch = swap;
+        i++;
+    }
+    if (i >= argc) {
+        return -1;
+    }
+    const char* what = argv[i++];
+    uint32_t protocol = 0;
+    if (strcmp(what, "tcp") == 0) {
+        protocol = IPV4_PROTO_TCP;
+    } else if (strcmp(what, "udp") == 0) {
+        protocol = IPV4_PROTO_UDP;
+    } else if (strcmp(what, "icmp") == 0) {
+        protocol = IPV4_PROTO_ICMP;
+    }
+    bool port = strcmp(what, "port") == 0;
+    if (protocol && protocol != IPV4_PROTO_ICMP && i < argc && strcmp(argv[i], "port") == 0) {
+        port = true;
+        i++;
+    }
+    uint32_t value = 0;
+    if (port || strcmp(what, "host") == 0) {
+        if (i >= argc) {
+            return -1;
+        }
+        if (port) {
+            value = (uint32_t)atoi(argv[i]);
+        } else if (network_parse_ip_address(argv[i], &value) != 0) {
+            return -1;
+        }
+        i++;
+    }
+    if (i != argc) {
+        return -1;
+    }
+
+    if (strcmp(what, "arp") == 0) {
+        netfilter_emit(prog, BPF_LD | BPF_H | BPF_ABS, 12, 0, 0);
+        netfilter_emit(prog, BPF_JMP | BPF_JEQ | BPF_K, ETH_TYPE_ARP, 0, NETFILTER_NOMATCH);
+    } else if (strcmp(what, "all") != 0) {
+        if (!protocol && !port && strcmp(what, "ip") != 0 && strcmp(what, "host") != 0) {
+            return -1;
+        }
+        netfilter_emit(prog, BPF_LD | BPF_H | BPF_ABS, 12, 0, 0);
+        netfilter_emit(prog, BPF_JMP | BPF_JEQ | BPF_K, ETH_TYPE_IPV4, 0, NETFILTER_NOMATCH);
+    }
+    if (protocol || port) {
+        netfilter_emit(prog, BPF_LD | BPF_B | BPF_ABS, ETH_HEADER_SIZE + 9, 0, 0);
+        if (protocol) {
+            netfilter_emit(prog, BPF_JMP | BPF_JEQ | BPF_K, protocol, 0, NETFILTER_NOMATCH);
+        } else {
+            netfilter_emit(prog, BPF_JMP | BPF_JEQ | BPF_K, IPV4_PROTO_TCP, 1, 0);
+            netfilter_emit(prog, BPF_JMP | BPF_JEQ | BPF_K, IPV4_PROTO_UDP, 0, NETFILTER_NOMATCH);
+        }
+    }
+    if (port) {
+        // Only a first fragment has the ports; X = the IPv4 header's size
+        netfilter_emit(prog, BPF_LD | BPF_H | BPF_ABS, ETH_HEADER_SIZE + 6, 0, 0);
+        netfilter_emit(prog, BPF_JMP | BPF_JSET | BPF_K, 0x1FFF, NETFILTER_NOMATCH, 0);
+        netfilter_emit(prog, BPF_LDX | BPF_B | BPF_MSH, ETH_HEADER_SIZE, 0, 0);
+        netfilter_emit(prog, BPF_LD | BPF_H | BPF_IND, ETH_HEADER_SIZE, 0, 0);
+        netfilter_emit(prog, BPF_JMP | BPF_JEQ | BPF_K, value, NETFILTER_MATCH, 0);
+        netfilter_emit(prog, BPF_LD | BPF_H | BPF_IND, ETH_HEADER_SIZE + 2, 0, 0);
+        netfilter_emit(prog, BPF_JMP | BPF_JEQ | BPF_K, value, NETFILTER_MATCH, NETFILTER_NOMATCH);
+    } else if (strcmp(what, "host") == 0) {
+        netfilter_emit(prog, BPF_LD | BPF_W | BPF_ABS, ETH_HEADER_SIZE + 12, 0, 0);
+        netfilter_emit(prog, BPF_JMP | BPF_JEQ | BPF_K, value, NETFILTER_MATCH, 0);
+        netfilter_emit(prog, BPF_LD | BPF_W | BPF_ABS, ETH_HEADER_SIZE + 16, 0, 0);
+        netfilter_emit(prog, BPF_JMP | BPF_JEQ | BPF_K, value, NETFILTER_MATCH, NETFILTER_NOMATCH);
+    }
+
+    uint32_t match_pc = prog->length;
+    netfilter_emit(prog, BPF_RET | BPF_K, match, 0, 0);
+    netfilter_emit(prog, BPF_RET | BPF_K, nomatch, 0, 0);
+    for (uint32_t pc = 0; pc < match_pc; pc++) {
+        bpf_insn_t* insn = &prog->insns[pc];
+        if (BPF_CLASS(insn->code) != BPF_JMP) {
+            continue;
+        }
+        if (insn->jt >= NETFILTER_NOMATCH) {
+            insn->jt = (uint8_t)(match_pc + (insn->jt == NETFILTER_NOMATCH) - pc - 1);
+        }
+        if (insn->jf >= NETFILTER_NOMATCH) {
+            insn->jf = (uint8_t)(match_pc + (insn->jf == NETFILTER_NOMATCH) - pc - 1);
+        }
+    }
+    return 0;
+}
+
+static void netfilter_print_hex(const uint8_t* bytes, uint32_t count) {
+    static const char digits[] = "0123456789abcdef";
+    char line[3 * 16 + 1];
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < count && i < 16; i++) {
+        line[n++] = digits[bytes[i] >> 4];
+        line[n++] = digits[bytes[i] & 0xF];
+        line[n++] = ' ';
+    }
+    line[n] = 0;
+    terminal_writestring(line);
+}
+
+static void netfilter_show(network_interface_t* iface) {
+    terminal_printf("%s: drop filter ", iface->name);
+    if (iface->rx_filter) {
+        terminal_printf("%d insns", (int)iface->rx_filter->length);
+    } else {
+        terminal_writestring("off");
+    }
+    terminal_printf(" (%d dropped), capture filter ", (int)iface->filter_dropped);
+    if (iface->capture_filter) {
+        terminal_printf("%d insns", (int)iface->capture_filter->length);
+    } else {
+        terminal_writestring("off");
+    }
+    terminal_printf(" (%d captured, %d waiting, %d lost)\n", (int)iface->captured,
+                    (int)ring_count(&iface->capture_ring), (int)iface->capture_ring.dropped);
+}
+
+// Take every waiting capture off the ring: addresses for IPv4, the
+// EtherType otherwise, then the first bytes
+static void netfilter_dump(network_interface_t* iface) {
+    network_packet_t* packet;
+    int count = 0;
+    while ((packet = network_capture_next(iface)) != NULL) {
+        const uint8_t* frame = packet->data;
+        terminal_printf("  tick %d, %d bytes: ", (int)packet->timestamp, (int)packet->size);
+        if (packet->size >= ETH_HEADER_SIZE + IPV4_HEADER_SIZE &&
+            net_ntohs(((const eth_header_t*)frame)->type) == ETH_TYPE_IPV4) {
+            const ipv4_header_t* ip = (const ipv4_header_t*)(frame + ETH_HEADER_SIZE);
+            char src[16], dest[16];
+            network_format_ip_address(net_ntohl(ip->src), src, sizeof(src));
+            network_format_ip_address(net_ntohl(ip->dest), dest, sizeof(dest));
+            terminal_printf("%s -> %s proto %d\n    ", src, dest, (int)ip->protocol);
+        } else if (packet->size >= ETH_HEADER_SIZE) {
+            terminal_writestring("type ");
+            netfilter_print_hex(frame + 12, 2);
+            terminal_writestring("\n    ");
+        }
+        netfilter_print_hex(frame, (uint32_t)packet->size);
+        terminal_writestring("\n");
+        network_free_packet(packet);
+        count++;
+    }
+    if (count == 0) {
+        terminal_writestring("  nothing captured\n");
+    }
+}
+
+void network_filter_command(int argc, char argv[][64]) {
+    if (argc < 2) {
+        bool any = false;
+        for (int i = 0; i < MAX_NETWORK_INTERFACES; i++) {
+            if (network_interfaces[i].id != -1) {
+                netfilter_show(&network_interfaces[i]);
+                any = true;
+            }
+        }
+        if (!any) {
+            terminal_writestring("No interfaces\n");
+        }
+        terminal_writestring("Usage: netfilter <iface> drop|capture [not] <expr> | off [drop|capture] | dump\n");
+        terminal_writestring("  expr: all, arp, ip, icmp, tcp, udp, host A.B.C.D, [tcp|udp] port N\n");
+        return;
+    }
+    network_interface_t* iface = network_find_interface_by_name(argv[1]);
+    if (!iface) {
+        terminal_printf("netfilter: no interface %s\n", argv[1]);
+        return;
+    }
+    if (argc < 3) {
+        netfilter_show(iface);
+        return;
+    }
+
+    const char* op = argv[2];
+    if (strcmp(op, "drop") == 0 || strcmp(op, "capture") == 0) {
+        bool drop = op[0] == 'd';
+        bpf_prog_t prog;
+        // Drop filters keep what doesn't match; capture filters take a snapshot of what does
+        if (netfilter_compile(argc, argv, 3, &prog, drop ? 0 : NET_CAPTURE_SNAPLEN,
+                              drop ? 0xFFFFFFFF : 0) != 0) {
+            terminal_writestring("netfilter: bad expression\n");
+            return;
+        }
+        if (network_attach_filter(iface, drop ? NET_FILTER_RX : NET_FILTER_CAPTURE,
+                                  prog.insns, prog.length) != 0) {
+            terminal_writestring("netfilter: filter rejected\n");
+            return;
+        }
+        terminal_printf("%s: %s filter attached, %d insns\n", iface->name, op, (int)prog.length);
+    } else if (strcmp(op, "off") == 0) {
+        if (argc < 4 || strcmp(argv[3], "drop") == 0) {
+            network_attach_filter(iface, NET_FILTER_RX, NULL, 0);
+        }
+        if (argc < 4 || strcmp(argv[3], "capture") == 0) {
+            network_attach_filter(iface, NET_FILTER_CAPTURE, NULL, 0);
+        }
+        netfilter_show(iface);
+    } else if (strcmp(op, "dump") == 0) {
+        netfilter_dump(iface);
+    } else if (strcmp(op, "show") == 0) {
+        netfilter_show(iface);
+    } else {
+        terminal_printf("netfilter: unknown operation %s\n", op);
+    }
+}
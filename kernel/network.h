@@ -5,12 +5,32 @@
 #define NETWORK_H
 
 #include "types.h"
+#include "ring.h"
+#include "lock.h"
+#include "softirq.h"
+#include "waitset.h"
+#include "bpf.h"
 
 // Network configuration constants (no hardcoding)
 #define MAX_NETWORK_INTERFACES 4
 #define MAX_PACKET_SIZE 1518          // Standard Ethernet frame size
-#define PACKET_BUFFER_COUNT 32        // Number of packet buffers
-#define NETWORK_QUEUE_SIZE 16         // Network queue depth
+#define PACKET_BUFFER_COUNT 32        // Packets and buffers preallocated at boot (caches grow past this)
+#define NETWORK_QUEUE_SIZE 16         // RX ring depth per queue (power of two)
+#define NET_RX_QUEUES 2               // Flow-hashed RX queues per interface (power of two)
+#define NET_CAPTURE_SLOTS 16          // Captured copies waiting per interface (power of two)
+#define NET_CAPTURE_SNAPLEN 128       // Most bytes kept of a captured frame
+#define NETWORK_PING_COUNT 4
+#define NETWORK_PING_SIZE 64          // Echo payload bytes
+#define NET_NAPI_BUDGET 64            // Frames per RX poll before other work gets a turn
+
+// netbench defaults and limits
+#define NETBENCH_COUNT 10000          // Packets per run
+#define NETBENCH_SIZE 64              // Payload bytes (frame bytes past the Ethernet header on a NIC)
+#define NETBENCH_MIN_SIZE 8           // Room for the timestamp and sequence
+#define NETBENCH_MAX_SIZE 1500
+#define NETBENCH_BATCH 8              // Packets in flight before any are taken back
+#define NETBENCH_ETH_TYPE 0x88B5      // IEEE local experimental EtherType
+#define NETBENCH_HIST_BUCKETS 24      // Powers of two of cycles
 
 // Network interface types
 typedef enum {
@@ -26,29 +46,127 @@ typedef enum {
     NET_STATE_TESTING = 2
 } net_interface_state_t;
 
-// Basic packet structure (simplified)
-typedef struct {
-    uint8_t data[MAX_PACKET_SIZE];     // Packet data
-    size_t size;                       // Actual packet size
+// Packet buffers reserve headroom so each protocol layer can prepend its
+// header in place instead of copying the payload behind it
+#define NET_HEADROOM 64                                 // Ethernet + IPv4 + ICMP, rounded up
+#define NET_BUFFER_SIZE 2048                            // NET_HEADROOM + MAX_PACKET_SIZE fits
+
+struct network_packet;
+typedef void (*net_release_t)(struct network_packet* packet);
+
+// Packet: a refcounted header over a buffer. The buffer is either a pooled
+// NET_BUFFER_SIZE block or memory a driver lent out (a NIC's DMA buffer),
+// which goes back to the driver through release once the last reference
+// is dropped. Readers of a shared packet must not modify it.
+//
+// Headers and pooled buffers come from separate caches: headers are
+// packed a cache line each, so walking them never drags frame data in,
+// and buffers start on NET_BUFFER_SIZE boundaries, ready for DMA.
+//
+// A transmitted frame may also end in a page fragment: frag_size bytes of
+// a physical frame (a file's page, for sendfile) after the size bytes at
+// data. The packet holds a PMM reference on the frame until it is freed.
+// Only the transmit path sees fragments; anything that reads the frame as
+// one run of bytes linearizes it first.
+#define NET_PACKET_ALIGN 64
+
+typedef struct network_packet {
+    uint8_t* head;                     // Start of the buffer
+    uint8_t* data;                     // First byte of the frame
+    size_t size;                       // Frame bytes from data
+    volatile uint32_t refcount;
+    net_release_t release;             // NULL for pooled buffers
+    void* owner;                       // For release
+    size_t capacity;                   // Buffer bytes from head
     uint32_t timestamp;                // Packet timestamp
-    bool in_use;                       // Buffer in use flag
-    int interface_id;                  // Source/destination interface
-} network_packet_t;
+    uint8_t cb[16];                    // Scratch for the layer currently holding the packet
+    uint32_t frag_frame;               // Physical frame of the fragment (0: none)
+    uint16_t csum_start;               // NET_CSUM_PARTIAL: L4 header offset from head
+    uint16_t csum_offset;              // And the checksum field's offset in that header
+    uint16_t frag_offset;              // First fragment byte in the frame
+    uint16_t frag_size;
+    int16_t interface_id;              // Source/destination interface
+    uint8_t csum;                      // NET_CSUM_* state of the checksums
+} __attribute__((aligned(NET_PACKET_ALIGN))) network_packet_t;
 
-// Network interface structure (basic abstraction)
+_Static_assert(sizeof(network_packet_t) == NET_PACKET_ALIGN,
+               "network_packet_t spills past one cache line");
+
+// Checksum state: checked on receive by the NIC (or never at risk, on
+// loopback), or left for the NIC to finish on transmit
+#define NET_CSUM_IP_OK      0x01
+#define NET_CSUM_L4_OK      0x02       // TCP/UDP
+#define NET_CSUM_PARTIAL    0x04       // L4 field holds the pseudo-header sum
+
+// Interface offload features
+#define NET_FEATURE_TX_CSUM 0x01
+#define NET_FEATURE_RX_CSUM 0x02
+
+struct network_interface;
+
+// Receive-side scaling in software: the driver's poll hashes each frame's
+// flow (Toeplitz, over the IPv4 addresses and TCP/UDP ports, with the key
+// NICs ship) to one of the interface's queues, and each queue has its own
+// work item. Flows on different queues run through the stack on different
+// workers at once; one flow stays on one queue, so it stays in order.
 typedef struct {
+    ring_t ring;                      // The poll produces, the queue's work consumes
+    network_packet_t* slots[NETWORK_QUEUE_SIZE];
+    work_t work;                      // Protocol input over ring, if a stack is attached
+    struct network_interface* iface;
+    uint32_t packets;                 // Frames hashed here
+} net_rx_queue_t;
+
+// Hardware behind an interface. Interfaces without one (loopback, or no
+// NIC found) keep the simulated behaviour.
+typedef struct {
+    const char* name;
+    int (*open)(struct network_interface* iface);       // Bring the device up
+    // Takes over the caller's reference to packet, also on failure
+    int (*transmit)(struct network_interface* iface, struct network_packet* packet);
+    // NAPI-style receive: with the RX interrupt masked, poll takes up to
+    // budget frames off the hardware and returns how many it took
+    int (*poll)(struct network_interface* iface, int budget);
+    void (*rx_irq)(struct network_interface* iface, bool enable);
+    int (*set_affinity)(struct network_interface* iface, uint32_t cpu);    // Move its interrupt
+} net_driver_t;
+
+// Network interface structure (basic abstraction)
+typedef struct network_interface {
     int id;                           // Interface ID
     char name[16];                    // Interface name (e.g., "eth0", "lo")
     net_interface_type_t type;        // Interface type
     net_interface_state_t state;      // Interface state
     uint8_t mac_address[6];           // MAC address (simulated)
-    uint32_t ip_address;              // IP address (simulated)
+    uint32_t ip_address;              // IP address (simulated without a driver)
+    uint32_t netmask;
+    uint32_t gateway;                 // Next hop off the subnet (0 if none)
     uint32_t packets_sent;            // Statistics: packets sent
     uint32_t packets_received;        // Statistics: packets received
     uint32_t bytes_sent;              // Statistics: bytes sent
     uint32_t bytes_received;          // Statistics: bytes received
     uint32_t errors;                  // Error count
     bool enabled;                     // Interface enabled flag
+    net_rx_queue_t rx_queues[NET_RX_QUEUES];   // Received packets, by flow hash
+    wait_source_t rx_watchers;        // Wait sets told about each received packet
+    spinlock_t loopback_lock;         // Unregistered; keeps loopback senders to one RX producer
+    spinlock_t filter_lock;           // Unregistered; held while the filters run or change
+    bpf_prog_t* rx_filter;            // Frames it returns 0 for never reach the queues
+    bpf_prog_t* capture_filter;       // Copies of frames it accepts go to capture_ring
+    ring_t capture_ring;              // The RX producer's copies, for network_capture_next
+    network_packet_t* capture_slots[NET_CAPTURE_SLOTS];
+    uint32_t filter_dropped;
+    uint32_t captured;
+    work_t poll_work;                 // Driver RX poll, run while its interrupt is masked
+    uint32_t rx_interrupts;
+    uint32_t rx_polls;
+    uint32_t rx_polled;               // Frames taken by polls
+    uint32_t irq_window_start;        // Tick the current one-second window began
+    uint32_t irq_window_count;
+    uint32_t irq_rate;                // RX interrupts in the last whole window, per second
+    uint32_t features;                // NET_FEATURE_* the driver turned on
+    const net_driver_t* driver;       // Bound NIC driver (NULL if simulated)
+    void* driver_data;
 } network_interface_t;
 
 // Network statistics
@@ -60,11 +178,12 @@ typedef struct {
     uint32_t total_errors;
     uint32_t active_interfaces;
     uint32_t buffer_usage;
+    uint32_t rx_queued;               // Packets waiting in RX rings
+    uint32_t rx_dropped;              // Packets dropped on a full RX ring
 } network_stats_t;
 
 // Global variables
 extern network_interface_t network_interfaces[MAX_NETWORK_INTERFACES];
-extern network_packet_t packet_buffers[PACKET_BUFFER_COUNT];
 extern int next_interface_id;
 extern bool network_initialized;
 
@@ -80,12 +199,55 @@ int network_enable_interface(int interface_id);
 int network_disable_interface(int interface_id);
 network_interface_t* network_find_interface(int interface_id);
 network_interface_t* network_find_interface_by_name(const char* name);
+int network_set_affinity(const char* name, uint32_t cpu);   // The NIC's interrupt to cpus[cpu]
 
-// Packet buffer management
+// Packet buffer management. A new packet holds one reference and has
+// NET_HEADROOM bytes free in front of data.
 network_packet_t* network_alloc_packet(void);
-void network_free_packet(network_packet_t* packet);
-int network_send_packet(int interface_id, const uint8_t* data, size_t size);
-network_packet_t* network_receive_packet(int interface_id);
+network_packet_t* network_attach_packet(uint8_t* buffer, size_t capacity, size_t size,
+                                        net_release_t release, void* owner);
+network_packet_t* network_packet_get(network_packet_t* packet);
+void network_free_packet(network_packet_t* packet);  // Drops one reference
+uint8_t* network_packet_push(network_packet_t* packet, size_t len);  // Prepend a header
+uint8_t* network_packet_pull(network_packet_t* packet, size_t len);  // Strip a header
+uint8_t* network_packet_put(network_packet_t* packet, size_t len);   // Append at the tail
+
+// Fragments. frag takes over a frame reference the caller holds (also on
+// failure, -1 if the packet already has one); linearize copies the
+// fragment into the tailroom and drops it (-1 if it doesn't fit).
+int network_packet_frag(network_packet_t* packet, uint32_t frame, uint32_t offset, uint32_t size);
+int network_packet_linearize(network_packet_t* packet);
+void network_frame_put(uint32_t frame);         // Drop a frame reference from any context
+
+static inline size_t network_packet_length(const network_packet_t* packet) {
+    return packet->size + packet->frag_size;
+}
+
+// Transmit and deliver take over the caller's reference, also on failure
+int network_transmit(int interface_id, network_packet_t* packet);
+int network_send_packet(int interface_id, const uint8_t* data, size_t size);  // Copies data
+network_packet_t* network_receive_packet(int interface_id);     // From any queue
+network_packet_t* network_receive_queue(net_rx_queue_t* queue);  // Its work's consumer side
+bool network_rx_pending(network_interface_t* iface);
+int network_deliver_packet(int interface_id, network_packet_t* packet);
+
+// Packet filters on the RX path, run on each frame the driver hands over
+// before it is queued: the capture filter first (it sees what the RX
+// filter then drops), returning how many bytes to copy. 0 on success, -1
+// if which is unknown or the program fails bpf_verify, in which case the
+// old filter stays; length 0 detaches.
+#define NET_FILTER_RX       0
+#define NET_FILTER_CAPTURE  1
+int network_attach_filter(network_interface_t* iface, int which, const bpf_insn_t* insns,
+                          uint32_t length);
+network_packet_t* network_capture_next(network_interface_t* iface);  // One consumer at a time
+
+// Shell: netfilter <iface> drop|capture [not] <expr> | off | show
+void network_filter_command(int argc, char argv[][64]);
+
+// Driver RX interrupt: masks it and leaves the frames to a poll on the
+// work queue, which unmasks it again once the hardware ring is empty
+void network_rx_interrupt(network_interface_t* iface);
 
 // Network statistics and monitoring
 void network_get_stats(network_stats_t* stats);
@@ -97,11 +259,15 @@ const char* network_interface_type_string(net_interface_type_t type);
 const char* network_interface_state_string(net_interface_state_t state);
 void network_format_mac_address(const uint8_t* mac, char* buffer, size_t size);
 void network_format_ip_address(uint32_t ip, char* buffer, size_t size);
+int network_parse_ip_address(const char* str, uint32_t* ip);
 
 // Network commands (safe simulation)
 void network_command_handler(int argc, char argv[][64]);
 void network_ping_simulation(const char* target);
+void network_benchmark(const char* target, uint32_t size, uint32_t batch, uint32_t count);
 void network_show_interfaces(void);
 void network_show_stats(void);
+struct proc_seq;
+void network_proc_show(struct proc_seq* seq);     // /proc/net
 
 #endif // NETWORK_H
\ No newline at end of file
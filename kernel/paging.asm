@@ -6,6 +6,7 @@
 global vmm_load_page_directory
 global vmm_enable_paging
 global vmm_flush_tlb
+global vmm_invalidate_page
 
 ; Load page directory into CR3
 vmm_load_page_directory:
@@ -16,7 +17,7 @@ vmm_load_page_directory:
 ; Enable paging by setting bit 31 in CR0
 vmm_enable_paging:
     mov eax, cr0        ; Get CR0
-    or eax, 0x80000000  ; Set paging bit (bit 31)
+    or eax, 0x80010000  ; Set paging bit (bit 31) and WP (bit 16)
     mov cr0, eax        ; Enable paging
     ret
 
@@ -26,5 +27,11 @@ vmm_flush_tlb:
     mov cr3, eax        ; Reload CR3 to flush TLB
     ret
 
+; Invalidate the TLB entry for a single page
+vmm_invalidate_page:
+    mov eax, [esp+4]    ; Get virtual address
+    invlpg [eax]        ; Drop its translation (global or not)
+    ret
+
 ; Add GNU stack note
 section .note.GNU-stack noalloc noexec nowrite progbits
\ No newline at end of file
@@ -0,0 +1,274 @@
+// ClaudeOS PCI Bus Implementation - Day 21
+// Brute-force scan of every bus/slot/function through ports 0xCF8/0xCFC.
+// BARs are sized there, once, by the usual write-all-ones probe with the
+// device's decoding switched off so the probe value is never claimed.
+
+#include "pci.h"
+#include "kernel.h"
+#include "initcall.h"
+#include "vmm.h"
+#include "smp.h"
+#include "lock.h"
+#include "ioapic.h"
+
+static pci_device_t pci_devices[PCI_MAX_DEVICES];
+static int pci_device_count = 0;
+static bool pci_scanned = false;
+
+// io.asm only has byte and word accessors; config space is dword-wide
+static inline void pci_outl(uint16_t port, uint32_t value) {
+    asm volatile ("outl %0, %1" : : "a" (value), "Nd" (port));
+}
+
+static inline uint32_t pci_inl(uint16_t port) {
+    uint32_t value;
+    asm volatile ("inl %1, %0" : "=a" (value) : "Nd" (port));
+    return value;
+}
+
+static inline uint32_t pci_address(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset) {
+    return 0x80000000 | ((uint32_t)bus << 16) | ((uint32_t)(slot & 0x1F) << 11) |
+           ((uint32_t)(function & 0x7) << 8) | (offset & 0xFC);
+}
+
+uint32_t pci_config_read(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset) {
+    pci_outl(PCI_CONFIG_ADDRESS, pci_address(bus, slot, function, offset));
+    uint32_t value = pci_inl(PCI_CONFIG_DATA);
+    return value >> ((offset & 3) * 8);  // Sub-dword fields come back in the low bits
+}
+
+void pci_config_write(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset, uint32_t value) {
+    pci_outl(PCI_CONFIG_ADDRESS, pci_address(bus, slot, function, offset));
+    pci_outl(PCI_CONFIG_DATA, value);
+}
+
+// Size every BAR: all ones in, the address bits the device implements out
+static void pci_size_bars(pci_device_t* dev) {
+    uint32_t flags = lock_irq_save();   // The console's VGA memory may be behind this device
+    uint32_t command = pci_config_read(dev->bus, dev->slot, dev->function, PCI_COMMAND) & 0xFFFF;
+    pci_config_write(dev->bus, dev->slot, dev->function, PCI_COMMAND,
+                     command & ~(PCI_COMMAND_IO | PCI_COMMAND_MEMORY));
+    for (int i = 0; i < 6; i++) {
+        uint8_t offset = PCI_BAR0 + i * 4;
+        pci_config_write(dev->bus, dev->slot, dev->function, offset, 0xFFFFFFFF);
+        uint32_t probe = pci_config_read(dev->bus, dev->slot, dev->function, offset);
+        pci_config_write(dev->bus, dev->slot, dev->function, offset, dev->bars[i]);
+        if (dev->bars[i] & PCI_BAR_IO) {
+            dev->bar_sizes[i] = (~(probe & 0xFFFC) + 1) & 0xFFFF;
+        } else {
+            dev->bar_sizes[i] = (probe & 0xFFFFFFF0) ? ~(probe & 0xFFFFFFF0) + 1 : 0;
+            if ((dev->bars[i] & PCI_BAR_MEM_TYPE) == PCI_BAR_MEM_64) {
+                i++;                    // The high half; nothing of ours sits above 4GB
+            }
+        }
+    }
+    pci_config_write(dev->bus, dev->slot, dev->function, PCI_COMMAND, command);
+    lock_irq_restore(flags);
+}
+
+static void pci_record(uint8_t bus, uint8_t slot, uint8_t function) {
+    if (pci_device_count == PCI_MAX_DEVICES) {
+        return;
+    }
+    uint32_t id = pci_config_read(bus, slot, function, PCI_VENDOR_ID);
+    uint32_t class_rev = pci_config_read(bus, slot, function, PCI_CLASS_REVISION);
+    pci_device_t* dev = &pci_devices[pci_device_count++];
+    dev->bus = bus;
+    dev->slot = slot;
+    dev->function = function;
+    dev->vendor_id = id & 0xFFFF;
+    dev->device_id = id >> 16;
+    dev->class_code = class_rev >> 24;
+    dev->subclass = (class_rev >> 16) & 0xFF;
+    dev->irq_line = pci_config_read(bus, slot, function, PCI_INTERRUPT_LINE) & 0xFF;
+    for (int i = 0; i < 6; i++) {
+        dev->bars[i] = pci_config_read(bus, slot, function, PCI_BAR0 + i * 4);
+        dev->bar_sizes[i] = 0;
+    }
+    dev->msi_irq = 0;
+    // Bridges (header type 1) have only two BARs and a different layout
+    if ((pci_config_read(bus, slot, function, PCI_HEADER_TYPE) & 0x7F) == 0) {
+        pci_size_bars(dev);
+    } else {
+        for (int i = 2; i < 6; i++) {
+            dev->bars[i] = 0;
+        }
+    }
+    dev->msi_cap = pci_find_capability(dev, PCI_CAP_ID_MSI);
+}
+
+// Find every device once; later calls keep the first scan
+void pci_init(void) {
+    if (pci_scanned) {
+        return;
+    }
+    pci_scanned = true;
+    for (uint32_t bus = 0; bus < 256; bus++) {
+        for (uint8_t slot = 0; slot < 32; slot++) {
+            if ((pci_config_read(bus, slot, 0, PCI_VENDOR_ID) & 0xFFFF) == 0xFFFF) {
+                continue;  // Nothing in this slot
+            }
+            pci_record(bus, slot, 0);
+            // Only multi-function devices answer on functions 1-7
+            if (!(pci_config_read(bus, slot, 0, PCI_HEADER_TYPE) & 0x80)) {
+                continue;
+            }
+            for (uint8_t function = 1; function < 8; function++) {
+                if ((pci_config_read(bus, slot, function, PCI_VENDOR_ID) & 0xFFFF) != 0xFFFF) {
+                    pci_record(bus, slot, function);
+                }
+            }
+        }
+    }
+}
+
+INITCALL(initcall_pci, "pci", pci_init, INIT_LAZY);
+
+pci_device_t* pci_find_device(uint16_t vendor_id, uint16_t device_id) {
+    for (int i = 0; i < pci_device_count; i++) {
+        if (pci_devices[i].vendor_id == vendor_id && pci_devices[i].device_id == device_id) {
+            return &pci_devices[i];
+        }
+    }
+    return NULL;
+}
+
+pci_device_t* pci_find_next(uint16_t vendor_id, uint16_t device_id, pci_device_t* prev) {
+    for (int i = (int)(prev - pci_devices) + 1; i < pci_device_count; i++) {
+        if (pci_devices[i].vendor_id == vendor_id && pci_devices[i].device_id == device_id) {
+            return &pci_devices[i];
+        }
+    }
+    return NULL;
+}
+
+// First device of a class (e.g. 1/1 for an IDE controller)
+pci_device_t* pci_find_class(uint8_t class_code, uint8_t subclass) {
+    for (int i = 0; i < pci_device_count; i++) {
+        if (pci_devices[i].class_code == class_code && pci_devices[i].subclass == subclass) {
+            return &pci_devices[i];
+        }
+    }
+    return NULL;
+}
+
+// Let the device decode its BARs and master the bus for DMA
+void pci_enable_bus_master(pci_device_t* dev) {
+    uint32_t command = pci_config_read(dev->bus, dev->slot, dev->function, PCI_COMMAND) & 0xFFFF;
+    command |= PCI_COMMAND_IO | PCI_COMMAND_MEMORY | PCI_COMMAND_BUS_MASTER;
+    // The status half of the dword is write-1-to-clear, so write zeros there
+    pci_config_write(dev->bus, dev->slot, dev->function, PCI_COMMAND, command);
+}
+
+uint8_t pci_find_capability(pci_device_t* dev, uint8_t id) {
+    if (!(pci_config_read(dev->bus, dev->slot, dev->function, PCI_STATUS) & PCI_STATUS_CAP_LIST)) {
+        return 0;
+    }
+    uint8_t offset = pci_config_read(dev->bus, dev->slot, dev->function, PCI_CAP_POINTER) & 0xFC;
+    // Bounded, in case a broken list loops
+    for (int hops = 0; offset >= 0x40 && hops < 48; hops++) {
+        uint32_t header = pci_config_read(dev->bus, dev->slot, dev->function, offset);
+        if ((header & 0xFF) == id) {
+            return offset;
+        }
+        offset = (header >> 8) & 0xFC;
+    }
+    return 0;
+}
+
+uint32_t pci_map_bar(pci_device_t* dev, int bar, uint32_t virt, uint32_t max_pages) {
+    if (bar < 0 || bar > 5 || !kernel_page_directory || (dev->bars[bar] & PCI_BAR_IO) ||
+        !dev->bar_sizes[bar]) {
+        return 0;
+    }
+    if ((dev->bars[bar] & PCI_BAR_MEM_TYPE) == PCI_BAR_MEM_64 && (bar == 5 || dev->bars[bar + 1])) {
+        return 0;
+    }
+    uint32_t phys = dev->bars[bar] & 0xFFFFFFF0;
+    uint32_t offset = phys & (PAGE_SIZE - 1);
+    uint32_t pages = PAGE_ALIGN(offset + dev->bar_sizes[bar]) / PAGE_SIZE;
+    if (pages > max_pages) {
+        pages = max_pages;
+    }
+    for (uint32_t i = 0; i < pages; i++) {
+        vmm_map_page(kernel_page_directory, virt + i * PAGE_SIZE, (phys - offset) + i * PAGE_SIZE,
+                     PAGE_PRESENT | PAGE_WRITABLE | PAGE_NOCACHE | PAGE_GLOBAL);
+    }
+    vmm_invalidate_range(virt, pages);
+    return virt + offset;
+}
+
+// One vector, fixed delivery, edge-triggered, to the boot CPU
+int pci_enable_msi(pci_device_t* dev, irq_handler_t handler, void* ctx) {
+    if (!dev->msi_cap || dev->msi_irq || !lapic_present()) {
+        return -1;
+    }
+    int irq = irq_alloc_msi();
+    if (irq < 0 || irq_register((uint8_t)irq, handler, ctx) != 0) {
+        return -1;
+    }
+
+    uint8_t cap = dev->msi_cap;
+    uint32_t header = pci_config_read(dev->bus, dev->slot, dev->function, cap);
+    uint32_t control = header >> 16;
+    pci_config_write(dev->bus, dev->slot, dev->function, cap + PCI_MSI_ADDRESS,
+                     PCI_MSI_ADDRESS_BASE | (cpus[0].apic_id << 12));
+    uint8_t data = PCI_MSI_DATA_32;
+    if (control & PCI_MSI_CTRL_64BIT) {
+        pci_config_write(dev->bus, dev->slot, dev->function, cap + PCI_MSI_ADDRESS + 4, 0);
+        data = PCI_MSI_DATA_64;
+    }
+    pci_config_write(dev->bus, dev->slot, dev->function, cap + data, IRQ_VECTOR_BASE + irq);
+    control = (control & ~PCI_MSI_CTRL_MME) | PCI_MSI_CTRL_ENABLE;
+    pci_config_write(dev->bus, dev->slot, dev->function, cap, (header & 0xFFFF) | (control << 16));
+
+    // Status is write-1-to-clear, as in pci_enable_bus_master
+    uint32_t command = pci_config_read(dev->bus, dev->slot, dev->function, PCI_COMMAND) & 0xFFFF;
+    pci_config_write(dev->bus, dev->slot, dev->function, PCI_COMMAND,
+                     command | PCI_COMMAND_INTX_DISABLE);
+    dev->msi_irq = (uint8_t)irq;
+    return irq;
+}
+
+int pci_set_affinity(pci_device_t* dev, uint32_t cpu) {
+    if (!dev->msi_irq) {
+        return ioapic_set_affinity(dev->irq_line, cpu);
+    }
+    if (cpu >= SMP_MAX_CPUS || !cpus[cpu].online) {
+        return -1;
+    }
+    pci_config_write(dev->bus, dev->slot, dev->function, dev->msi_cap + PCI_MSI_ADDRESS,
+                     PCI_MSI_ADDRESS_BASE | (cpus[cpu].apic_id << 12));
+    return 0;
+}
+
+void pci_list_devices(void) {
+    terminal_writestring("PCI Devices (bus:slot.fn vendor:device class/subclass irq):\n");
+    for (int i = 0; i < pci_device_count; i++) {
+        pci_device_t* dev = &pci_devices[i];
+        terminal_printf("  %d:%d.%d  %d:%d  %d/%d  irq %d", dev->bus, dev->slot, dev->function,
+                        dev->vendor_id, dev->device_id, dev->class_code, dev->subclass,
+                        dev->irq_line);
+        if (dev->msi_irq) {
+            terminal_printf("  msi irq %d\n", dev->msi_irq);
+        } else {
+            terminal_writestring(dev->msi_cap ? "  msi\n" : "\n");
+        }
+        for (int bar = 0; bar < 6; bar++) {
+            uint32_t size = dev->bar_sizes[bar];
+            if (!size) {
+                continue;
+            }
+            if (dev->bars[bar] & PCI_BAR_IO) {
+                terminal_printf("      bar%d io  %d ports\n", bar, (int)size);
+            } else if (size < 1024) {
+                terminal_printf("      bar%d mem %d bytes\n", bar, (int)size);
+            } else {
+                terminal_printf("      bar%d mem %dKB\n", bar, (int)(size >> 10));
+            }
+        }
+    }
+    if (pci_device_count == 0) {
+        terminal_writestring("  none found\n");
+    }
+}
@@ -0,0 +1,96 @@
+// ClaudeOS PCI Bus - Day 21
+// Configuration-space access (mechanism #1) and device enumeration. The
+// scan sizes every BAR once, so drivers map exactly what the device
+// decodes, and notes the MSI capability for those that would rather have
+// an unshared, edge-triggered vector than a routed INTx line.
+
+#ifndef PCI_H
+#define PCI_H
+
+#include "types.h"
+#include "irq.h"
+
+#define PCI_CONFIG_ADDRESS  0xCF8
+#define PCI_CONFIG_DATA     0xCFC
+#define PCI_MAX_DEVICES     32
+
+// Configuration space offsets
+#define PCI_VENDOR_ID       0x00
+#define PCI_DEVICE_ID       0x02
+#define PCI_COMMAND         0x04
+#define PCI_STATUS          0x06
+#define PCI_CLASS_REVISION  0x08
+#define PCI_HEADER_TYPE     0x0E
+#define PCI_BAR0            0x10
+#define PCI_CAP_POINTER     0x34
+#define PCI_INTERRUPT_LINE  0x3C
+
+// Command register bits
+#define PCI_COMMAND_IO          0x0001
+#define PCI_COMMAND_MEMORY      0x0002
+#define PCI_COMMAND_BUS_MASTER  0x0004  // Device may DMA
+#define PCI_COMMAND_INTX_DISABLE 0x0400
+
+#define PCI_STATUS_CAP_LIST     0x0010  // Capability list at PCI_CAP_POINTER
+
+#define PCI_BAR_IO          0x1     // BAR bit 0: I/O port range
+#define PCI_BAR_MEM_TYPE    0x6     // Memory BAR bits 2:1
+#define PCI_BAR_MEM_64      0x4     // ...a 64-bit BAR, high half in the next one
+
+// MSI capability (offsets from the capability)
+#define PCI_CAP_ID_MSI          0x05
+#define PCI_MSI_CONTROL         0x02
+#define PCI_MSI_ADDRESS         0x04
+#define PCI_MSI_DATA_32         0x08
+#define PCI_MSI_DATA_64         0x0C    // With PCI_MSI_CTRL_64BIT
+#define PCI_MSI_CTRL_ENABLE     0x0001
+#define PCI_MSI_CTRL_MME        0x0070  // Vectors enabled, log2; we use one
+#define PCI_MSI_CTRL_64BIT      0x0080
+#define PCI_MSI_ADDRESS_BASE    0xFEE00000  // | destination APIC ID << 12
+
+typedef struct {
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t function;
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint8_t class_code;
+    uint8_t subclass;
+    uint8_t irq_line;               // PIC line the firmware routed INTx to
+    uint8_t msi_cap;                // MSI capability offset, 0 without one
+    uint8_t msi_irq;                // Its irq once enabled, 0 before
+    uint32_t bars[6];
+    uint32_t bar_sizes[6];          // Bytes decoded; 0 unused (or a 64-bit BAR's high half)
+} pci_device_t;
+
+void pci_init(void);
+uint32_t pci_config_read(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset);
+void pci_config_write(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset, uint32_t value);
+
+// First device with this vendor and device ID (NULL if absent)
+pci_device_t* pci_find_device(uint16_t vendor_id, uint16_t device_id);
+// The next one after prev (NULL if there are no more)
+pci_device_t* pci_find_next(uint16_t vendor_id, uint16_t device_id, pci_device_t* prev);
+pci_device_t* pci_find_class(uint8_t class_code, uint8_t subclass);
+void pci_enable_bus_master(pci_device_t* dev);
+
+// Offset of the device's capability id in config space, 0 if it has none
+uint8_t pci_find_capability(pci_device_t* dev, uint8_t id);
+
+// Map memory BAR bar uncached at virt, at most max_pages of it; returns
+// the address of the BAR's first byte (virt plus its offset in the page),
+// 0 for an I/O, empty or above-4GB BAR
+uint32_t pci_map_bar(pci_device_t* dev, int bar, uint32_t virt, uint32_t max_pages);
+
+// Give the device an MSI vector on the boot CPU's local APIC, register
+// handler on it and turn INTx off. Returns the irq, -1 without MSI, a
+// local APIC or a free vector (the caller falls back to its INTx line).
+int pci_enable_msi(pci_device_t* dev, irq_handler_t handler, void* ctx);
+
+// Deliver the device's interrupt to a CPU (a cpus[] index): the MSI
+// destination once enabled, else its INTx line through the I/O APIC
+// (with whatever shares it). -1 if it can't be moved.
+int pci_set_affinity(pci_device_t* dev, uint32_t cpu);
+void pci_list_devices(void);
+
+#endif // PCI_H
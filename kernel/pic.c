@@ -2,6 +2,8 @@
 // Programmable Interrupt Controller management
 
 #include "pic.h"
+#include "ioapic.h"
+#include "smp.h"
 #include "kernel.h"
 
 // Initialize the PIC
@@ -39,8 +41,37 @@ void pic_init(void) {
     outb(PIC2_DATA, 0xFF);  // Mask all IRQs on slave
 }
 
-// Send End of Interrupt signal
+// Mark a PCI INTx line level triggered and active low. The 8259's ELCR
+// was set up by the BIOS; only the I/O APIC needs telling.
+void pic_route_pci(uint8_t irq) {
+    if (ioapic_active) {
+        ioapic_route_pci(irq);
+    }
+}
+
+// An IRQ7 or IRQ15 the 8259 raised with nothing in service (the request
+// went away before it was acknowledged) is spurious and gets no EOI; the
+// slave's still took the master's cascade input, which does.
+int pic_spurious(uint8_t irq) {
+    if (ioapic_active || (irq != IRQ7_PARALLEL1 && irq != IRQ15_ATA2)) {
+        return 0;
+    }
+    if (pic_get_isr() & (1 << irq)) {
+        return 0;
+    }
+    if (irq == IRQ15_ATA2) {
+        outb(PIC1_COMMAND, PIC_EOI);
+    }
+    return 1;
+}
+
+// Send End of Interrupt signal (to this CPU's local APIC once the I/O
+// APIC delivers the lines)
 void pic_send_eoi(uint8_t irq) {
+    if (ioapic_active) {
+        lapic_eoi();
+        return;
+    }
     if (irq >= 8) {
         // Send EOI to slave PIC
         outb(PIC2_COMMAND, PIC_EOI);
@@ -54,6 +85,11 @@ void pic_set_mask(uint8_t irq) {
     uint16_t port;
     uint8_t value;
     
+    if (ioapic_active) {
+        ioapic_set_masked(irq, true);
+        return;
+    }
+    
     if (irq < 8) {
         port = PIC1_DATA;
     } else {
@@ -65,11 +101,19 @@ void pic_set_mask(uint8_t irq) {
     outb(port, value);
 }
 
-// Clear IRQ mask (enable IRQ)
+// Clear IRQ mask (enable IRQ, and the cascade for slave lines)
 void pic_clear_mask(uint8_t irq) {
     uint16_t port;
     uint8_t value;
     
+    if (ioapic_active) {
+        ioapic_set_masked(irq, false);
+        return;
+    }
+    
+    if (irq >= 8) {
+        pic_clear_mask(IRQ2_CASCADE);
+    }
     if (irq < 8) {
         port = PIC1_DATA;
     } else {
@@ -0,0 +1,264 @@
+// ClaudeOS Pipe Implementation - Day 21
+// Page-sized ring per pipe; sleeping ends are woken on watermark crossings
+
+#include "pipe.h"
+#include "process.h"
+#include "heap.h"
+#include "kernel.h"
+#include "pool.h"
+
+DEFINE_POOL(pipe_pool, pipe_t, MAX_PIPES);
+static spinlock_t pipe_table_lock;      // Unregistered; guards the pool only
+
+static inline uint32_t pipe_min(uint32_t a, uint32_t b) {
+    return a < b ? a : b;
+}
+
+static inline bool pipe_can_sleep(process_t* process) {
+    return process && process->pid != KERNEL_PID && scheduler_preemptive;
+}
+
+// Wake whoever sleeps in slot (pipe lock held)
+static void pipe_wake(pipe_t* pipe, struct process* volatile* slot) {
+    process_t* process = *slot;
+    if (!process) {
+        return;
+    }
+    *slot = NULL;
+    pipe->wakeups++;
+    process_wake(process);
+}
+
+// Sleep in slot until the other end clears it. Called with the pipe lock
+// held; returns with it released.
+static void pipe_sleep(pipe_t* pipe, struct process* volatile* slot,
+                       process_t* process, uint32_t flags) {
+    *slot = process;
+    process_prepare_block();
+    spin_unlock_irqrestore(&pipe->lock, flags);
+
+    process_sleep_while(*slot, process);
+}
+
+pipe_t* pipe_create(void) {
+    pipe_t* pipe = NULL;
+    uint32_t flags = spin_lock_irqsave(&pipe_table_lock);
+    pipe = pipe_pool_alloc();
+    if (pipe) {
+        pipe->id = (uint32_t)pipe_pool_handle(pipe);
+    }
+    spin_unlock_irqrestore(&pipe_table_lock, flags);
+    if (!pipe) {
+        return NULL;
+    }
+
+    pipe->buffer = (uint8_t*)kmalloc(PIPE_BUFFER_SIZE);
+    if (!pipe->buffer) {
+        flags = spin_lock_irqsave(&pipe_table_lock);
+        pipe_pool_free(pipe);
+        spin_unlock_irqrestore(&pipe_table_lock, flags);
+        return NULL;
+    }
+    pipe->head = 0;
+    pipe->tail = 0;
+    pipe->reader = NULL;
+    pipe->writer = NULL;
+    pipe->bytes = 0;
+    pipe->wakeups = 0;
+    pipe->watchers.watchers = NULL;
+    pipe->read_open = true;
+    pipe->write_open = true;
+    return pipe;
+}
+
+static void pipe_release(pipe_t* pipe) {
+    uint32_t flags = spin_lock_irqsave(&pipe->lock);
+    waitset_source_gone(&pipe->watchers);
+    spin_unlock_irqrestore(&pipe->lock, flags);
+    kfree(pipe->buffer);
+    pipe->buffer = NULL;
+    flags = spin_lock_irqsave(&pipe_table_lock);
+    pipe_pool_free(pipe);
+    spin_unlock_irqrestore(&pipe_table_lock, flags);
+}
+
+int pipe_read(pipe_t* pipe, void* buffer, size_t size) {
+    if (!buffer || !pipe_pool_live(pipe) || !pipe->read_open) {
+        return -1;
+    }
+    if (size == 0) {
+        return 0;
+    }
+
+    process_t* process = current_process;
+    uint32_t flags = spin_lock_irqsave(&pipe->lock);
+    while (pipe->head == pipe->tail) {
+        if (!pipe->write_open) {
+            spin_unlock_irqrestore(&pipe->lock, flags);
+            return 0;  // End of stream
+        }
+        if (!pipe_can_sleep(process)) {
+            spin_unlock_irqrestore(&pipe->lock, flags);
+            return PIPE_WOULD_BLOCK;
+        }
+        pipe_sleep(pipe, &pipe->reader, process, flags);
+        flags = spin_lock_irqsave(&pipe->lock);
+    }
+
+    uint32_t used = pipe->head - pipe->tail;
+    uint32_t n = pipe_min((uint32_t)size, used);
+    uint32_t offset = pipe->tail & (PIPE_BUFFER_SIZE - 1);
+    uint32_t first = pipe_min(n, PIPE_BUFFER_SIZE - offset);
+    uint8_t* dest = (uint8_t*)buffer;
+    for (uint32_t i = 0; i < first; i++) {
+        dest[i] = pipe->buffer[offset + i];
+    }
+    for (uint32_t i = first; i < n; i++) {
+        dest[i] = pipe->buffer[i - first];
+    }
+    pipe->tail += n;
+    pipe->bytes += n;
+
+    // A writer only sleeps on a full pipe, so it is woken once a quarter
+    // of the buffer is free again rather than after every read
+    uint32_t space_before = PIPE_BUFFER_SIZE - used;
+    if (space_before < PIPE_WAKE_WATERMARK && space_before + n >= PIPE_WAKE_WATERMARK) {
+        pipe_wake(pipe, &pipe->writer);
+    }
+    spin_unlock_irqrestore(&pipe->lock, flags);
+    return (int)n;
+}
+
+int pipe_write(pipe_t* pipe, const void* data, size_t size) {
+    if (!data || !pipe_pool_live(pipe) || !pipe->write_open) {
+        return -1;
+    }
+
+    const uint8_t* src = (const uint8_t*)data;
+    uint32_t done = 0;
+    process_t* process = current_process;
+    uint32_t flags = spin_lock_irqsave(&pipe->lock);
+    while (done < size) {
+        if (!pipe->read_open) {
+            spin_unlock_irqrestore(&pipe->lock, flags);
+            return -1;  // Nobody will ever read it
+        }
+        uint32_t used = pipe->head - pipe->tail;
+        if (used == PIPE_BUFFER_SIZE) {
+            if (!pipe_can_sleep(process)) {
+                break;
+            }
+            pipe_sleep(pipe, &pipe->writer, process, flags);
+            flags = spin_lock_irqsave(&pipe->lock);
+            continue;
+        }
+
+        uint32_t n = pipe_min((uint32_t)size - done, PIPE_BUFFER_SIZE - used);
+        uint32_t offset = pipe->head & (PIPE_BUFFER_SIZE - 1);
+        uint32_t first = pipe_min(n, PIPE_BUFFER_SIZE - offset);
+        for (uint32_t i = 0; i < first; i++) {
+            pipe->buffer[offset + i] = src[done + i];
+        }
+        for (uint32_t i = first; i < n; i++) {
+            pipe->buffer[i - first] = src[done + i];
+        }
+        pipe->head += n;
+        done += n;
+
+        // Mid-write, a sleeping reader only gets up for a batch
+        if (used < PIPE_WAKE_WATERMARK && used + n >= PIPE_WAKE_WATERMARK) {
+            pipe_wake(pipe, &pipe->reader);
+        }
+    }
+    // The writer may not come back for a while, so whatever is in the
+    // pipe at the end of a write is handed over
+    if (done > 0) {
+        pipe_wake(pipe, &pipe->reader);
+        waitset_notify(&pipe->watchers);
+    }
+    spin_unlock_irqrestore(&pipe->lock, flags);
+    return (int)done;
+}
+
+void pipe_close_read(pipe_t* pipe) {
+    if (!pipe_pool_live(pipe) || !pipe->read_open) {
+        return;
+    }
+    uint32_t flags = spin_lock_irqsave(&pipe->lock);
+    pipe->read_open = false;
+    pipe_wake(pipe, &pipe->writer);  // Its write fails now
+    bool unused = !pipe->write_open;
+    spin_unlock_irqrestore(&pipe->lock, flags);
+    if (unused) {
+        pipe_release(pipe);
+    }
+}
+
+void pipe_close_write(pipe_t* pipe) {
+    if (!pipe_pool_live(pipe) || !pipe->write_open) {
+        return;
+    }
+    uint32_t flags = spin_lock_irqsave(&pipe->lock);
+    pipe->write_open = false;
+    pipe_wake(pipe, &pipe->reader);  // Sees the rest, then end of stream
+    waitset_notify(&pipe->watchers);
+    bool unused = !pipe->read_open;
+    spin_unlock_irqrestore(&pipe->lock, flags);
+    if (unused) {
+        pipe_release(pipe);
+    }
+}
+
+uint32_t pipe_available(pipe_t* pipe) {
+    return pipe ? pipe->head - pipe->tail : 0;
+}
+
+// Attach a wait set entry to pipe id. Linked under the pipe lock while the
+// read end is open, so pipe_release always finds it.
+int pipe_watch(uint32_t id, wait_entry_t* entry) {
+    pipe_t* pipe = pipe_pool_lookup((int)id);
+    if (!pipe) {
+        return -1;
+    }
+    uint32_t flags = spin_lock_irqsave(&pipe->lock);
+    bool open = pipe_pool_live(pipe) && pipe->id == id && pipe->read_open;
+    if (open) {
+        waitset_link(entry, &pipe->watchers, pipe);
+    }
+    spin_unlock_irqrestore(&pipe->lock, flags);
+    return open ? 0 : -1;
+}
+
+// Drop a killed process from any pipe it sleeps on
+void pipe_cancel_wait(process_t* process) {
+    pipe_t* pipe;
+    POOL_FOR_EACH(pipe_pool, pipe) {
+        if (pipe->reader != process && pipe->writer != process) {
+            continue;
+        }
+        uint32_t flags = spin_lock_irqsave(&pipe->lock);
+        if (pipe->reader == process) {
+            pipe->reader = NULL;
+        }
+        if (pipe->writer == process) {
+            pipe->writer = NULL;
+        }
+        spin_unlock_irqrestore(&pipe->lock, flags);
+    }
+}
+
+void pipe_list(void) {
+    terminal_writestring("Pipes:\n");
+    bool found_any = false;
+    pipe_t* pipe;
+    POOL_FOR_EACH(pipe_pool, pipe) {
+        found_any = true;
+        terminal_printf("  %d  %d/%d buffered, %d bytes moved, %d wakeups, %s%s\n",
+                        (int)pipe->id, (int)pipe_available(pipe), PIPE_BUFFER_SIZE,
+                        (int)pipe->bytes, (int)pipe->wakeups,
+                        pipe->read_open ? "r" : "-", pipe->write_open ? "w" : "-");
+    }
+    if (!found_any) {
+        terminal_writestring("No open pipes\n");
+    }
+}
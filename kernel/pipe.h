@@ -0,0 +1,62 @@
+// ClaudeOS Pipes - Day 21
+// One-page byte streams between a writer and a reader, with blocking ends
+
+#ifndef PIPE_H
+#define PIPE_H
+
+#include "types.h"
+#include "lock.h"
+#include "waitset.h"
+
+#define MAX_PIPES           16
+#define PIPE_BUFFER_SIZE    4096            // One page (power of two)
+
+// A sleeping side is only woken when the fill level (for a reader) or
+// the free space (for a writer) crosses this mark, so a stream moves in
+// large batches instead of one context switch per write
+#define PIPE_WAKE_WATERMARK (PIPE_BUFFER_SIZE / 4)
+
+// pipe_read result when the pipe is empty and the caller can't sleep
+#define PIPE_WOULD_BLOCK    -2
+
+struct process;
+
+typedef struct pipe {
+    uint32_t id;                    // Pool handle: reused slots get new ids
+    bool read_open;
+    bool write_open;
+    uint8_t* buffer;                // PIPE_BUFFER_SIZE bytes
+    volatile uint32_t head;         // Bytes written so far (wraps freely)
+    volatile uint32_t tail;         // Bytes read so far
+    spinlock_t lock;                // Unregistered; left zeroed
+    struct process* reader;         // Sleeping on an empty pipe
+    struct process* writer;         // Sleeping on a full pipe
+    uint32_t bytes;                 // Total bytes transferred
+    uint32_t wakeups;               // Times one side woke the other
+    wait_source_t watchers;         // Wait sets told when it becomes readable
+} pipe_t;
+
+// Create a pipe with both ends open (NULL if none are free)
+pipe_t* pipe_create(void);
+
+// Copy out up to size bytes. Sleeps while the pipe is empty but still
+// has a writer; returns the byte count, 0 at end of stream, or
+// PIPE_WOULD_BLOCK when empty and the caller can't sleep (the kernel
+// task, or no preemption).
+int pipe_read(pipe_t* pipe, void* buffer, size_t size);
+
+// Copy in all size bytes, sleeping while the pipe is full. Returns the
+// byte count (short for a caller that can't sleep), or -1 once the read
+// end is closed.
+int pipe_write(pipe_t* pipe, const void* data, size_t size);
+
+// Close one end; the pipe is freed when both are closed
+void pipe_close_read(pipe_t* pipe);
+void pipe_close_write(pipe_t* pipe);
+
+uint32_t pipe_available(pipe_t* pipe);
+int pipe_watch(uint32_t id, wait_entry_t* entry);
+void pipe_cancel_wait(struct process* process);
+void pipe_list(void);
+
+#endif // PIPE_H
@@ -1,72 +1,292 @@
 // ClaudeOS Physical Memory Manager Implementation - Day 6
-// Bitmap-based physical page frame allocator
+// Bitmap-based physical page frame allocator. pmm_lock covers the bitmap,
+// the buddy lists, the free count and the zero pool; each CPU's magazine
+// is touched only by that CPU with interrupts off, so the common alloc and
+// free take no lock at all.
 
 #include "pmm.h"
 #include "kernel.h"
+#include "procfs.h"
+#include "reclaim.h"
+#include "bitmap.h"
+#include "lock.h"
+#include "smp.h"
 
-// Memory bitmap - each bit represents one 4KB page
-static uint8_t memory_bitmap[BITMAP_SIZE];
-static uint32_t total_pages;
+// Kernel image extent (virtual addresses), provided by linker.ld
+extern uint8_t _kernel_start[];
+extern uint8_t _kernel_end[];
+
+// Memory bitmap - each bit represents one 4KB page (1 = used), with a
+// summary level so a search skips full words. Sized at boot from the
+// memory map and placed right after the kernel image.
+static bitmap_t page_map;
+static uint32_t total_pages;     // Pages spanned by the bitmap (including holes)
+static uint32_t usable_pages;    // Pages reported usable by the memory map
+static uint32_t metadata_end;    // First byte after the PMM's own tables
+static page_t* frames;           // Descriptor per frame, indexed by frame number
+static uint32_t zero_page;       // The shared zero page (kept out of every free list)
 static uint32_t free_pages;
 static uint32_t first_free_page;
+static spinlock_t pmm_lock;
 
-// Bitmap manipulation functions
 static inline void set_bit(uint32_t bit) {
-    memory_bitmap[bit / 8] |= (1 << (bit % 8));
+    bitmap_set(&page_map, bit);
 }
 
 static inline void clear_bit(uint32_t bit) {
-    memory_bitmap[bit / 8] &= ~(1 << (bit % 8));
+    bitmap_clear(&page_map, bit);
 }
 
 static inline int test_bit(uint32_t bit) {
-    return memory_bitmap[bit / 8] & (1 << (bit % 8));
+    return bitmap_test(&page_map, bit);
+}
+
+// Clear one directly addressable frame a word at a time
+static inline void zero_frame(uint32_t phys_addr) {
+    uint32_t dest = (uint32_t)PHYS_TO_VIRT(phys_addr);
+    uint32_t count = PAGE_SIZE / 4;
+    asm volatile ("rep stosl"
+                  : "+D" (dest), "+c" (count)
+                  : "a" (0)
+                  : "memory");
 }
 
-// Find first free page in bitmap
+#ifndef PMM_BUDDY
+// Find first free page in bitmap, from the hint and then from the bottom
 static uint32_t find_free_page(void) {
-    for (uint32_t i = first_free_page; i < total_pages; i++) {
-        if (!test_bit(i)) {
-            return i;
+    uint32_t page = bitmap_find_clear(&page_map, first_free_page);
+    if (page == BITMAP_NONE) {
+        page = bitmap_find_clear(&page_map, 0);
+    }
+    return page;
+}
+#else
+// Buddy allocator engine - free lists per order, linked through the frame
+// descriptors (free frames are not necessarily mapped)
+static uint32_t buddy_head[BUDDY_MAX_ORDER + 1];
+static uint32_t buddy_free_blocks[BUDDY_MAX_ORDER + 1];
+
+static void buddy_push(uint32_t pfn, uint32_t order) {
+    frames[pfn].order = order;
+    frames[pfn].prev = PMM_LIST_END;
+    frames[pfn].next = buddy_head[order];
+    if (buddy_head[order] != PMM_LIST_END) {
+        frames[buddy_head[order]].prev = pfn;
+    }
+    buddy_head[order] = pfn;
+    buddy_free_blocks[order]++;
+}
+
+static void buddy_remove(uint32_t pfn) {
+    page_t* page = &frames[pfn];
+    uint32_t order = page->order;
+    if (page->prev != PMM_LIST_END) {
+        frames[page->prev].next = page->next;
+    } else {
+        buddy_head[order] = page->next;
+    }
+    if (page->next != PMM_LIST_END) {
+        frames[page->next].prev = page->prev;
+    }
+    page->order = PMM_ORDER_NONE;
+    page->next = PMM_LIST_END;
+    page->prev = PMM_LIST_END;
+    buddy_free_blocks[order]--;
+}
+
+// Return a single frame to the free lists, merging with free buddies
+static void buddy_release(uint32_t pfn) {
+    uint32_t order = 0;
+    while (order < BUDDY_MAX_ORDER) {
+        uint32_t buddy = pfn ^ (1 << order);
+        if (buddy >= total_pages || frames[buddy].order != order) {
+            break;
         }
+        buddy_remove(buddy);
+        pfn &= ~(1 << order);
+        order++;
     }
-    
-    // Search from beginning if not found after first_free_page
-    for (uint32_t i = 0; i < first_free_page; i++) {
-        if (!test_bit(i)) {
-            return i;
+    buddy_push(pfn, order);
+}
+
+// Take a block of the given order, splitting a larger one if needed
+static uint32_t buddy_take(uint32_t order) {
+    uint32_t k = order;
+    while (k <= BUDDY_MAX_ORDER && buddy_head[k] == PMM_LIST_END) {
+        k++;
+    }
+    if (k > BUDDY_MAX_ORDER) {
+        return 0xFFFFFFFF;
+    }
+
+    uint32_t pfn = buddy_head[k];
+    buddy_remove(pfn);
+    while (k > order) {
+        k--;
+        buddy_push(pfn + (1 << k), k);
+    }
+    return pfn;
+}
+
+static void buddy_init(void) {
+    for (uint32_t i = 0; i <= BUDDY_MAX_ORDER; i++) {
+        buddy_head[i] = PMM_LIST_END;
+        buddy_free_blocks[i] = 0;
+    }
+    // Release from the top down so the lowest (directly mapped) frames end
+    // up at the head of each free list
+    for (uint32_t i = total_pages; i > 0; i--) {
+        if (!test_bit(i - 1)) {
+            buddy_release(i - 1);
         }
     }
-    
-    return 0xFFFFFFFF;  // No free pages
 }
+#endif
 
-// Initialize physical memory manager
-void pmm_init(void) {
-    total_pages = MEMORY_END / PAGE_SIZE;
-    free_pages = total_pages;
-    first_free_page = 0;
-    
-    // Clear bitmap (all pages initially free)
-    for (uint32_t i = 0; i < BITMAP_SIZE; i++) {
-        memory_bitmap[i] = 0;
+// Bytes of allocator metadata needed to track the given number of pages
+static uint32_t metadata_size(uint32_t pages) {
+    return (BITMAP_WORDS(pages) + BITMAP_SUMMARY_WORDS(pages)) * 4 + pages * sizeof(page_t);
+}
+
+// Mark every page overlapping [start, end) as used
+static void reserve_range(uint32_t start, uint32_t end) {
+    for (uint32_t page = PAGE_FLOOR(start) / PAGE_SIZE; page < total_pages && page < PAGE_ALIGN(end) / PAGE_SIZE; page++) {
+        if (!test_bit(page)) {
+            set_bit(page);
+            free_pages--;
+        }
+        frames[page].flags |= PG_RESERVED;
     }
-    
-    // Mark kernel pages as used (0-1MB + kernel size)
-    uint32_t kernel_end_page = PAGE_ALIGN(KERNEL_START + 0x100000) / PAGE_SIZE;  // Assume 1MB kernel max
-    for (uint32_t i = 0; i < kernel_end_page; i++) {
-        set_bit(i);
-        free_pages--;
+}
+
+// Mark every page fully inside [start, end) as free
+static void release_range(uint64_t start, uint64_t end) {
+    uint64_t first = (start + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint64_t last = end / PAGE_SIZE;
+    for (uint64_t page = first; page < last && page < total_pages; page++) {
+        if (test_bit((uint32_t)page)) {
+            clear_bit((uint32_t)page);
+            frames[page].flags &= ~PG_RESERVED;
+            free_pages++;
+            usable_pages++;
+        }
     }
-    
+}
+
+// Highest usable physical address reported by the bootloader
+static uint64_t detect_memory_end(multiboot_info_t* mbi) {
+    if (!mbi) {
+        return MEMORY_END;
+    }
+
+    if (mbi->flags & MULTIBOOT_INFO_MEM_MAP) {
+        uint64_t highest = 0;
+        uint32_t offset = 0;
+        while (offset < mbi->mmap_length) {
+            multiboot_mmap_entry_t* entry = (multiboot_mmap_entry_t*)PHYS_TO_VIRT(mbi->mmap_addr + offset);
+            if (entry->type == MULTIBOOT_MEMORY_AVAILABLE) {
+                uint64_t region_end = entry->addr + entry->len;
+                if (region_end > highest) {
+                    highest = region_end;
+                }
+            }
+            offset += entry->size + sizeof(entry->size);
+        }
+        if (highest > 0) {
+            return highest;
+        }
+    }
+
+    if (mbi->flags & MULTIBOOT_INFO_MEMORY) {
+        return 0x100000 + (uint64_t)mbi->mem_upper * 1024;
+    }
+
+    return MEMORY_END;
+}
+
+static uint32_t alloc_frame_global(void);
+static void free_frame_global(uint32_t page);
+
+// Initialize physical memory manager from the Multiboot memory map.
+// mbi may be NULL, in which case MEMORY_END of contiguous RAM is assumed.
+void pmm_init(multiboot_info_t* mbi) {
+    // 32-bit frames only - memory above 4GB is ignored
+    uint64_t memory_end = detect_memory_end(mbi);
+    if (memory_end > PMM_MAX_MEMORY) {
+        memory_end = PMM_MAX_MEMORY;
+    }
+    total_pages = (uint32_t)(memory_end / PAGE_SIZE);
+
+    // Place the bitmap and descriptors right after the kernel image. They
+    // must stay inside the direct map, so trim the tracked range if a huge
+    // memory map would push them past it.
+    uint32_t metadata_start = PAGE_ALIGN(VIRT_TO_PHYS(_kernel_end));
+    while (total_pages > 0 && metadata_start + metadata_size(total_pages) > PMM_METADATA_LIMIT) {
+        total_pages = total_pages > 1024 ? total_pages - 1024 : 0;
+    }
+    metadata_end = PAGE_ALIGN(metadata_start + metadata_size(total_pages));
+
+    uint32_t* bitmap_words = (uint32_t*)PHYS_TO_VIRT(metadata_start);
+    uint32_t* summary_words = bitmap_words + BITMAP_WORDS(total_pages);
+    frames = (page_t*)(summary_words + BITMAP_SUMMARY_WORDS(total_pages));
+    for (uint32_t i = 0; i < total_pages; i++) {
+        frames[i].next = PMM_LIST_END;
+        frames[i].prev = PMM_LIST_END;
+        frames[i].shares = 0;
+        frames[i].order = PMM_ORDER_NONE;
+        frames[i].flags = PG_RESERVED;     // Until the memory map says otherwise
+    }
+
+    // Start with everything used, then free what the memory map says is RAM
+    free_pages = 0;
+    usable_pages = 0;
+    bitmap_init(&page_map, bitmap_words, summary_words, total_pages, true);
+
+    if (mbi && (mbi->flags & MULTIBOOT_INFO_MEM_MAP)) {
+        uint32_t offset = 0;
+        while (offset < mbi->mmap_length) {
+            multiboot_mmap_entry_t* entry = (multiboot_mmap_entry_t*)PHYS_TO_VIRT(mbi->mmap_addr + offset);
+            if (entry->type == MULTIBOOT_MEMORY_AVAILABLE) {
+                release_range(entry->addr, entry->addr + entry->len);
+            }
+            offset += entry->size + sizeof(entry->size);
+        }
+    } else {
+        release_range(0, memory_end);
+    }
+
+    // Low 1MB (IVT, BIOS data, VGA, ROMs) and frame 0, which doubles as
+    // the allocation failure value
+    reserve_range(0, KERNEL_START);
+    // Kernel image plus the tables we just placed after it
+    reserve_range(VIRT_TO_PHYS(_kernel_start), metadata_end);
+
     // Set first free page after kernel
-    first_free_page = kernel_end_page;
+    first_free_page = metadata_end / PAGE_SIZE;
+    spin_lock_init(&pmm_lock, "pmm");
+
+#ifdef PMM_BUDDY
+    buddy_init();
+    terminal_writestring("PMM: Buddy allocator engine\n");
+#endif
+
+    // The shared zero page, from the direct map like the zero pool's frames
+    zero_page = alloc_frame_global();
+    if (zero_page && zero_page + PAGE_SIZE <= PMM_DIRECT_LIMIT) {
+        zero_frame(zero_page);
+        frames[ADDR_TO_PFN(zero_page)].flags |= PG_ZERO_PAGE;
+    } else if (zero_page) {
+        free_frame_global(ADDR_TO_PFN(zero_page));
+        zero_page = 0;
+    }
     
     terminal_writestring("PMM: Physical Memory Manager initialized\n");
+    terminal_printf("PMM: Detected %d MB, kernel ends at %d KB\n",
+                    (int)(usable_pages / 256), (int)(VIRT_TO_PHYS(_kernel_end) / 1024));
     terminal_writestring("PMM: Total pages: ");
     // Simple number printing
     char buffer[16];
-    uint32_t num = total_pages;
+    uint32_t num = usable_pages;
     int pos = 0;
     if (num == 0) {
         buffer[pos++] = '0';
@@ -108,14 +328,18 @@ void pmm_init(void) {
     terminal_writestring("\n");
 }
 
-// Allocate a physical page (returns physical address)
-uint32_t pmm_alloc_page(void) {
+// Take one frame from the global bitmap / buddy lists (0 on failure)
+static uint32_t alloc_frame_global(void) {
     if (free_pages == 0) {
         return 0;  // No free pages
     }
     
+#ifdef PMM_BUDDY
+    uint32_t page = buddy_take(0);
+#else
     uint32_t page = find_free_page();
-    if (page == 0xFFFFFFFF) {
+#endif
+    if (page == BITMAP_NONE) {
         return 0;  // No free pages found
     }
     
@@ -131,21 +355,105 @@ uint32_t pmm_alloc_page(void) {
     return PFN_TO_ADDR(page);
 }
 
-// Free a physical page
-void pmm_free_page(uint32_t page_addr) {
+// Take an extra reference on an allocated frame. Returns 0 on success,
+// -1 if the frame is free or already at PMM_MAX_SHARES.
+int pmm_page_ref(uint32_t page_addr) {
+    uint32_t page = ADDR_TO_PFN(page_addr);
+    if (page >= total_pages || !test_bit(page)) {
+        return -1;
+    }
+    if (frames[page].flags & PG_ZERO_PAGE) {
+        return 0;  // Never freed, so never counted
+    }
+    // Lock-free, as drop_share takes them away without pmm_lock
+    uint8_t shares;
+    do {
+        shares = frames[page].shares;
+        if (shares >= PMM_MAX_SHARES) {
+            return -1;
+        }
+    } while (!__sync_bool_compare_and_swap(&frames[page].shares, shares, shares + 1));
+    return 0;
+}
+
+// Extra references held on a frame (0 = single owner)
+uint32_t pmm_page_shares(uint32_t page_addr) {
     uint32_t page = ADDR_TO_PFN(page_addr);
-    
     if (page >= total_pages) {
-        return;  // Invalid page
+        return 0;
     }
-    
-    if (!test_bit(page)) {
-        return;  // Page already free
+    return (frames[page].flags & PG_ZERO_PAGE) ? PMM_MAX_SHARES : frames[page].shares;
+}
+
+page_t* pmm_page(uint32_t page_addr) {
+    uint32_t page = ADDR_TO_PFN(page_addr);
+    return page < total_pages ? &frames[page] : 0;
+}
+
+uint32_t pmm_get_zero_page(void) {
+    return zero_page;
+}
+
+// Allocate count physically contiguous pages whose first frame number is a
+// multiple of align (in pages, power of two; 0 or 1 means no alignment)
+static uint32_t alloc_run(uint32_t count, uint32_t align) {
+    if (count > free_pages) {
+        return 0;
     }
-    
+
+#ifdef PMM_BUDDY
+    // Take the smallest block covering both count and align, then hand the
+    // unused tail back so it coalesces into smaller blocks
+    uint32_t order = 0;
+    while ((1U << order) < count || (1U << order) < align) {
+        order++;
+    }
+    if (order > BUDDY_MAX_ORDER) {
+        return 0;
+    }
+
+    uint32_t base = buddy_take(order);
+    if (base == 0xFFFFFFFF) {
+        return 0;
+    }
+    bitmap_set_range(&page_map, base, count);
+    for (uint32_t i = count; i < (1U << order); i++) {
+        buddy_release(base + i);
+    }
+    free_pages -= count;
+    return PFN_TO_ADDR(base);
+#else
+    // First fit from the hint: each candidate is checked a word at a time
+    // and a failed one resumes past the used frame that ended it
+    uint32_t start = bitmap_find_clear_run(&page_map, first_free_page, count, align);
+    if (start != BITMAP_NONE) {
+        bitmap_set_range(&page_map, start, count);
+        free_pages -= count;
+        if (start == first_free_page) {
+            first_free_page += count;
+        }
+        return PFN_TO_ADDR(start);
+    }
+
+    return 0;  // No run large enough
+#endif
+}
+
+static uint32_t alloc_run_locked(uint32_t count, uint32_t align) {
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    uint32_t addr = alloc_run(count, align);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return addr;
+}
+
+// Return one frame to the global bitmap / buddy lists
+static void free_frame_global(uint32_t page) {
     // Mark page as free
     clear_bit(page);
     free_pages++;
+#ifdef PMM_BUDDY
+    buddy_release(page);
+#endif
     
     // Update first_free_page hint
     if (page < first_free_page) {
@@ -153,83 +461,328 @@ void pmm_free_page(uint32_t page_addr) {
     }
 }
 
-// Get memory statistics
-uint32_t pmm_get_total_pages(void) {
-    return total_pages;
+// Drop one extra reference if the frame has any (false: the caller held
+// the last one). Lock-free, like pmm_page_ref.
+static bool drop_share(uint32_t page) {
+    uint8_t shares;
+    while ((shares = frames[page].shares) > 0) {
+        if (__sync_bool_compare_and_swap(&frames[page].shares, shares, shares - 1)) {
+            return true;
+        }
+    }
+    return false;
 }
 
-uint32_t pmm_get_free_pages(void) {
-    return free_pages;
+// Per-CPU frame magazines - the alloc/free hot path pops and pushes a
+// local array and only touches the global bitmap in batches. Callers hold
+// interrupts off from finding their magazine until they are done with it.
+static pmm_magazine_t pmm_magazines[PMM_MAX_CPUS];
+
+static inline pmm_magazine_t* local_magazine(void) {
+    return &pmm_magazines[percpu_read(id)];
 }
 
-uint32_t pmm_get_used_pages(void) {
-    return total_pages - free_pages;
+// Return this CPU's cached frames to the global allocator. Other CPUs'
+// magazines are theirs alone; they hold at most PMM_MAGAZINE_SIZE frames
+// each.
+static void drain_magazines(void) {
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    pmm_magazine_t* mag = local_magazine();
+    while (mag->count > 0) {
+        free_frame_global(mag->frames[--mag->count]);
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
 }
 
-// Debug function to dump memory statistics
-void pmm_dump_stats(void) {
-    terminal_writestring("PMM Statistics:\n");
-    terminal_writestring("  Total pages: ");
-    
-    // Simple number printing function
-    char buffer[16];
-    uint32_t num = total_pages;
-    int pos = 0;
-    if (num == 0) {
-        buffer[pos++] = '0';
+// Allocate a physical page (returns physical address)
+uint32_t pmm_alloc_page(void) {
+    uint32_t flags = lock_irq_save();
+    pmm_magazine_t* mag = local_magazine();
+
+    if (mag->count > 0) {
+        mag->hits++;
     } else {
-        while (num > 0) {
-            buffer[pos++] = '0' + (num % 10);
-            num /= 10;
+        // Empty - refill half a magazine from the global bitmap, letting
+        // the caches give pages back first when it is running low. The
+        // shrinkers run with interrupts back on and may move us elsewhere.
+        mag->misses++;
+        if (free_pages < PMM_WATERMARK_MIN) {
+            lock_irq_restore(flags);
+            reclaim_pages(PMM_MAGAZINE_BATCH);
+            flags = lock_irq_save();
+            mag = local_magazine();
+        }
+        spin_lock(&pmm_lock);
+        while (mag->count < PMM_MAGAZINE_BATCH) {
+            uint32_t frame = alloc_frame_global();
+            if (frame == 0) {
+                break;
+            }
+            mag->frames[mag->count++] = ADDR_TO_PFN(frame);
+        }
+        spin_unlock(&pmm_lock);
+        if (mag->count == 0) {
+            lock_irq_restore(flags);
+            return 0;  // Out of physical memory
         }
     }
-    // Reverse string
-    for (int i = 0; i < pos / 2; i++) {
-        char temp = buffer[i];
-        buffer[i] = buffer[pos - 1 - i];
-        buffer[pos - 1 - i] = temp;
+
+    uint32_t frame = PFN_TO_ADDR(mag->frames[--mag->count]);
+    lock_irq_restore(flags);
+    return frame;
+}
+
+// Free a physical page
+void pmm_free_page(uint32_t page_addr) {
+    uint32_t page = ADDR_TO_PFN(page_addr);
+    
+    if (page >= total_pages) {
+        return;  // Invalid page
     }
-    buffer[pos] = '\0';
-    terminal_writestring(buffer);
-    terminal_writestring("\n");
     
-    terminal_writestring("  Free pages: ");
-    num = free_pages;
-    pos = 0;
-    if (num == 0) {
-        buffer[pos++] = '0';
-    } else {
-        while (num > 0) {
-            buffer[pos++] = '0' + (num % 10);
-            num /= 10;
+    if (!test_bit(page) || (frames[page].flags & (PG_RESERVED | PG_ZERO_PAGE))) {
+        return;  // Page already free, or never allocated
+    }
+
+    if (drop_share(page)) {
+        return;  // Still mapped elsewhere
+    }
+
+    uint32_t flags = lock_irq_save();
+    pmm_magazine_t* mag = local_magazine();
+    for (uint32_t i = 0; i < mag->count; i++) {
+        if (mag->frames[i] == page) {
+            lock_irq_restore(flags);
+            return;  // Page already free (cached)
         }
     }
-    for (int i = 0; i < pos / 2; i++) {
-        char temp = buffer[i];
-        buffer[i] = buffer[pos - 1 - i];
-        buffer[pos - 1 - i] = temp;
+
+    // Full - drain half a magazine back to the global bitmap
+    if (mag->count == PMM_MAGAZINE_SIZE) {
+        spin_lock(&pmm_lock);
+        while (mag->count > PMM_MAGAZINE_SIZE - PMM_MAGAZINE_BATCH) {
+            free_frame_global(mag->frames[--mag->count]);
+        }
+        spin_unlock(&pmm_lock);
     }
-    buffer[pos] = '\0';
-    terminal_writestring(buffer);
-    terminal_writestring("\n");
-    
-    terminal_writestring("  Used pages: ");
-    num = total_pages - free_pages;
-    pos = 0;
-    if (num == 0) {
-        buffer[pos++] = '0';
-    } else {
-        while (num > 0) {
-            buffer[pos++] = '0' + (num % 10);
-            num /= 10;
+    mag->frames[mag->count++] = page;
+    lock_irq_restore(flags);
+}
+
+// Allocate count physically contiguous pages whose first frame number is a
+// multiple of align (in pages, power of two; 0 or 1 means no alignment)
+uint32_t pmm_alloc_pages(uint32_t count, uint32_t align) {
+    if (count == 0) {
+        return 0;
+    }
+    if (align == 0) {
+        align = 1;
+    }
+    if (align & (align - 1)) {
+        return 0;  // Alignment must be a power of two
+    }
+    if (count == 1 && align == 1) {
+        return pmm_alloc_page();
+    }
+
+    uint32_t addr = alloc_run_locked(count, align);
+    if (addr == 0) {
+        // Cached frames may be what splits the run - give them back and retry
+        drain_magazines();
+        addr = alloc_run_locked(count, align);
+    }
+    if (addr == 0 && reclaim_pages(count) > 0) {
+        drain_magazines();
+        addr = alloc_run_locked(count, align);
+    }
+    return addr;
+}
+
+// Free count contiguous pages starting at page_addr
+void pmm_free_pages(uint32_t page_addr, uint32_t count) {
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t page = ADDR_TO_PFN(page_addr) + i;
+        if (page < total_pages && test_bit(page) && !(frames[page].flags & (PG_RESERVED | PG_ZERO_PAGE))) {
+            if (!drop_share(page)) {
+                free_frame_global(page);
+            }
         }
     }
-    for (int i = 0; i < pos / 2; i++) {
-        char temp = buffer[i];
-        buffer[i] = buffer[pos - 1 - i];
-        buffer[pos - 1 - i] = temp;
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+// Pre-zeroed frame pool. Frames are taken from the direct map so they can
+// be cleared without a temporary mapping and handed straight to page-table
+// code, which writes them at PHYS_TO_VIRT of their address.
+static uint32_t zero_pool[PMM_ZERO_POOL_SIZE];
+static uint32_t zero_pool_count;
+static uint32_t zero_pool_hits;
+static uint32_t zero_pool_misses;
+
+// Top up the zero pool by at most max_pages frames. Called from idle
+// paths; returns the number of frames zeroed. Frames only go into the pool
+// while free memory is above the high watermark, so the pool never takes
+// what the idle reclaimer has just won back.
+uint32_t pmm_zero_pool_fill(uint32_t max_pages) {
+    uint32_t filled = 0;
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    while (filled < max_pages && zero_pool_count < PMM_ZERO_POOL_SIZE &&
+           free_pages > PMM_WATERMARK_HIGH) {
+        uint32_t frame = alloc_frame_global();
+        if (frame == 0) {
+            break;
+        }
+        if (frame + PAGE_SIZE > PMM_DIRECT_LIMIT) {
+            free_frame_global(ADDR_TO_PFN(frame));
+            break;  // Low memory exhausted - nothing addressable left
+        }
+        // Cleared outside the lock; the frame is ours until it is pooled
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        zero_frame(frame);
+        flags = spin_lock_irqsave(&pmm_lock);
+        if (zero_pool_count == PMM_ZERO_POOL_SIZE) {
+            free_frame_global(ADDR_TO_PFN(frame));
+            break;  // Filled from elsewhere meanwhile
+        }
+        zero_pool[zero_pool_count++] = frame;
+        filled++;
     }
-    buffer[pos] = '\0';
-    terminal_writestring(buffer);
-    terminal_writestring("\n");
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return filled;
+}
+
+// Allocate a zeroed, directly mapped frame (0 on failure). Served from
+// the pre-zeroed pool when possible, zeroed on the spot otherwise.
+uint32_t pmm_alloc_zeroed_page(void) {
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    if (zero_pool_count > 0) {
+        zero_pool_hits++;
+        uint32_t frame = zero_pool[--zero_pool_count];
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        return frame;
+    }
+    zero_pool_misses++;
+    spin_unlock_irqrestore(&pmm_lock, flags);
+
+    uint32_t frame = pmm_alloc_page();
+    if (frame == 0) {
+        return 0;
+    }
+    if (frame + PAGE_SIZE > PMM_DIRECT_LIMIT) {
+        pmm_free_page(frame);
+        return 0;  // Not directly addressable
+    }
+    zero_frame(frame);
+    return frame;
+}
+
+// Shrinker: hand the zero pool back to the global bitmap
+static uint32_t zero_pool_reclaimable(void) {
+    return zero_pool_count;
+}
+
+static uint32_t zero_pool_shrink(uint32_t target) {
+    uint32_t released = 0;
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    while (released < target && zero_pool_count > 0) {
+        free_frame_global(ADDR_TO_PFN(zero_pool[--zero_pool_count]));
+        released++;
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return released;
+}
+
+SHRINKER(shrinker_zero_pool, "zero_pool", zero_pool_reclaimable, zero_pool_shrink, 0);
+
+static uint32_t magazine_pages(void) {
+    uint32_t cached = 0;
+    for (uint32_t cpu = 0; cpu < PMM_MAX_CPUS; cpu++) {
+        cached += pmm_magazines[cpu].count;
+    }
+    return cached;
+}
+
+// Frames sitting in magazines count as free
+static uint32_t cached_pages(void) {
+    return magazine_pages() + zero_pool_count;
+}
+
+// Get memory statistics
+uint32_t pmm_get_total_pages(void) {
+    return usable_pages;
+}
+
+uint32_t pmm_get_free_pages(void) {
+    return free_pages + cached_pages();
+}
+
+// Free frames the watermarks are measured against - the zero pool is left
+// out, being a cache its shrinker empties
+uint32_t pmm_get_watermark_pages(void) {
+    return free_pages + magazine_pages();
+}
+
+uint32_t pmm_get_used_pages(void) {
+    return usable_pages - pmm_get_free_pages();
+}
+
+// /proc/meminfo's page frame lines
+void pmm_proc_show(proc_seq_t* seq) {
+    proc_printf(seq, "pmm.total_pages: %u\n", usable_pages);
+    proc_printf(seq, "pmm.free_pages: %u\n", pmm_get_free_pages());
+    proc_printf(seq, "pmm.used_pages: %u\n", pmm_get_used_pages());
+    proc_printf(seq, "pmm.descriptors: %u (%u KB)\n", total_pages,
+                (uint32_t)(total_pages * sizeof(page_t) / 1024));
+    // Magazine hit rate - allocations served without touching the bitmap
+    for (uint32_t cpu = 0; cpu < PMM_MAX_CPUS; cpu++) {
+        pmm_magazine_t* mag = &pmm_magazines[cpu];
+        uint32_t requests = mag->hits + mag->misses;
+        proc_printf(seq, "pmm.cpu%u.magazine: %u cached, %u/%u hits (%u%%)\n", cpu, mag->count,
+                    mag->hits, requests, requests ? mag->hits * 100 / requests : 0);
+    }
+
+    uint32_t zero_requests = zero_pool_hits + zero_pool_misses;
+    proc_printf(seq, "pmm.zero_pool: %u/%d frames, %u/%u hits\n", zero_pool_count,
+                PMM_ZERO_POOL_SIZE, zero_pool_hits, zero_requests);
+
+    // Free memory broken down into power-of-two blocks, so the two engines
+    // can be compared for fragmentation
+    uint32_t order_counts[BUDDY_MAX_ORDER + 1];
+#ifdef PMM_BUDDY
+    proc_puts(seq, "pmm.engine: buddy\n");
+#else
+    proc_puts(seq, "pmm.engine: bitmap\n");
+#endif
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+#ifdef PMM_BUDDY
+    for (uint32_t i = 0; i <= BUDDY_MAX_ORDER; i++) {
+        order_counts[i] = buddy_free_blocks[i];
+    }
+#else
+    for (uint32_t i = 0; i <= BUDDY_MAX_ORDER; i++) {
+        order_counts[i] = 0;
+    }
+    // Split each free run into the aligned blocks a buddy allocator would hold
+    uint32_t pfn = bitmap_find_clear(&page_map, 0);
+    while (pfn != BITMAP_NONE) {
+        uint32_t order = 0;
+        while (order < BUDDY_MAX_ORDER && (pfn & ((2U << order) - 1)) == 0 &&
+               pfn + (2U << order) <= total_pages &&
+               bitmap_range_clear(&page_map, pfn + (1U << order), 1U << order)) {
+            order++;
+        }
+        order_counts[order]++;
+        pfn = bitmap_find_clear(&page_map, pfn + (1U << order));
+    }
+#endif
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    for (uint32_t i = 0; i <= BUDDY_MAX_ORDER; i++) {
+        proc_printf(seq, "pmm.free_blocks.order%u: %u (%u KB each)\n", i, order_counts[i],
+                    (1U << i) * 4);
+    }
+}
+
+void pmm_dump_stats(void) {
+    procfs_print(pmm_proc_show);
 }
\ No newline at end of file
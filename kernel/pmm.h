@@ -1,10 +1,12 @@
 // ClaudeOS Physical Memory Manager - Day 6
-// Simple bitmap-based physical memory allocator
+// Simple bitmap-based physical memory allocator, with a descriptor per frame
 
 #ifndef PMM_H
 #define PMM_H
 
 #include "types.h"
+#include "multiboot.h"
+#include "smp.h"
 
 // Memory constants
 #define PAGE_SIZE 4096
@@ -17,18 +19,91 @@
 
 // Memory layout constants
 #define KERNEL_START 0x100000     // 1MB - where kernel is loaded
-#define MEMORY_END   0x2000000    // 32MB - maximum for our simple OS
-#define BITMAP_SIZE  (MEMORY_END / PAGE_SIZE / 8)  // 1 bit per page
+#define MEMORY_END   0x2000000    // 32MB - assumed when the bootloader gives no memory map
+#define PMM_MAX_MEMORY 0xFFFFF000ULL   // Highest frame reachable without PAE
+#define PMM_DIRECT_LIMIT 0x400000      // Frames below this are in the direct map
+#define PMM_METADATA_LIMIT PMM_DIRECT_LIMIT   // PMM tables must be directly addressable
+
+// The kernel is linked and runs at KERNEL_VIRT_BASE + its load address.
+// Frames below PMM_DIRECT_LIMIT are mapped there in every address space
+// (the direct map), so the kernel reaches them with PHYS_TO_VIRT.
+#define KERNEL_VIRT_BASE 0xC0000000
+#define PHYS_TO_VIRT(phys) ((void*)((uint32_t)(phys) + KERNEL_VIRT_BASE))
+#define VIRT_TO_PHYS(virt) ((uint32_t)(virt) - KERNEL_VIRT_BASE)
+
+// Buddy engine (build with PMM_ENGINE=buddy) - orders 0..10, 4KB to 4MB
+#define BUDDY_MAX_ORDER 10
+
+// Per-CPU frame magazines in front of the global allocator
+#define PMM_MAX_CPUS SMP_MAX_CPUS
+#define PMM_MAGAZINE_SIZE 32
+#define PMM_MAGAZINE_BATCH (PMM_MAGAZINE_SIZE / 2)   // Frames moved per refill/drain
+
+typedef struct {
+    uint32_t frames[PMM_MAGAZINE_SIZE];   // Cached frame numbers (still marked used)
+    uint32_t count;
+    uint32_t hits;
+    uint32_t misses;
+} pmm_magazine_t;
+
+// Pool of pre-zeroed, directly mapped frames refilled at idle time
+#define PMM_ZERO_POOL_SIZE 64
+#define PMM_ZERO_FILL_BATCH 4     // Frames zeroed per idle call
+
+// Free-page watermarks (kernel/reclaim.h): below MIN an allocation reclaims
+// before it takes a frame; the idle loop reclaims from LOW back up to HIGH
+// and only refills the zero pool above HIGH
+#define PMM_WATERMARK_MIN 64
+#define PMM_WATERMARK_LOW 128
+#define PMM_WATERMARK_HIGH 256
+
+// Frames shared by copy-on-write mappings carry an extra-reference count;
+// pmm_free_page only releases a frame once that count is back at zero
+#define PMM_MAX_SHARES 255
+
+// Page frame descriptor, one per tracked frame in an array beside the
+// bitmap. next/prev are frame numbers linking the frame into one list at
+// a time: the buddy free lists while it is free, whatever list its owner
+// keeps (an LRU, say) while it is allocated.
+typedef struct page {
+    uint32_t next;                  // PMM_LIST_END terminates
+    uint32_t prev;
+    uint8_t shares;                 // References beyond the first
+    uint8_t order;                  // Buddy engine: order of a free block head
+    uint16_t flags;                 // PG_*
+} page_t;
+
+#define PMM_LIST_END    0xFFFFFFFF
+#define PMM_ORDER_NONE  0xFF        // Not the head of a free buddy block
+
+// Page flags
+#define PG_RESERVED     0x0001      // Firmware, memory holes, the kernel and PMM tables: never freed
+#define PG_ZERO_PAGE    0x0002      // The shared zero page
 
 // Physical memory manager functions
-void pmm_init(void);
+void pmm_init(multiboot_info_t* mbi);
 uint32_t pmm_alloc_page(void);
 void pmm_free_page(uint32_t page_addr);
+uint32_t pmm_alloc_pages(uint32_t count, uint32_t align);
+void pmm_free_pages(uint32_t page_addr, uint32_t count);
+uint32_t pmm_alloc_zeroed_page(void);
+uint32_t pmm_zero_pool_fill(uint32_t max_pages);
+int pmm_page_ref(uint32_t page_addr);
+uint32_t pmm_page_shares(uint32_t page_addr);
+page_t* pmm_page(uint32_t page_addr);       // A tracked frame's descriptor, or NULL
+
+// One read-only frame of zeros, mapped wherever a demand-zero page is read
+// before it is written. Taking references on it and freeing it do nothing,
+// and it always counts as shared, so a write copies it.
+uint32_t pmm_get_zero_page(void);
 uint32_t pmm_get_total_pages(void);
 uint32_t pmm_get_free_pages(void);
+uint32_t pmm_get_watermark_pages(void);
 uint32_t pmm_get_used_pages(void);
 
 // Debug functions
 void pmm_dump_stats(void);
+struct proc_seq;
+void pmm_proc_show(struct proc_seq* seq);     // The pmm.* lines of /proc/meminfo
 
 #endif // PMM_H
\ No newline at end of file
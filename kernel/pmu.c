@@ -0,0 +1,253 @@
+// ClaudeOS Performance Counters Implementation - Day 21
+// Counters are handed out once, at pmu_init: an event goes to its fixed
+// counter if it has one, otherwise to the next free general-purpose
+// counter, and goes without when they run out. Version 1 PMUs have no
+// global control, so there each counter is started and stopped through
+// its own enable bit.
+
+#include "pmu.h"
+#include "kernel.h"
+#include "smp.h"
+#include "lock.h"
+
+#define PMU_CPUID_LEAF      0xA
+#define PMU_MAX_GP          8           // Counters this layer programs
+#define PMU_FIXED_ENABLE    0x3         // Fixed counter control: ring 0 and ring 3
+#define PMU_NO_COUNTER      -1
+#define PMU_FIXED_SLOT      0x100       // Slot values from here are fixed counters
+
+typedef struct {
+    const char* name;
+    uint8_t event;
+    uint8_t umask;
+    int8_t arch_bit;                    // CPUID.0AH:EBX bit (set: absent); -1 model specific
+    int8_t fixed;                       // Fixed counter that counts it, or -1
+} pmu_event_t;
+
+static const pmu_event_t pmu_events[PMU_EVENTS] = {
+    { "cycles",        0x3C, 0x00,  0,  1 },    // UnHalted Core Cycles
+    { "instructions",  0xC0, 0x00,  1,  0 },    // Instructions Retired
+    { "LLC misses",    0x2E, 0x41,  4, -1 },    // LLC Misses
+    { "branch misses", 0xC5, 0x00,  6, -1 },    // Branch Misses Retired
+    { "dTLB misses",   0x08, 0x01, -1, -1 },    // DTLB_LOAD_MISSES.MISS_CAUSES_A_WALK
+};
+
+static bool pmu_probed = false;
+static uint32_t pmu_version = 0;
+static uint32_t pmu_gp_count = 0;
+static uint32_t pmu_gp_width = 0;
+static uint32_t pmu_fixed_count = 0;
+static uint32_t pmu_fixed_width = 0;
+static int pmu_slot[PMU_EVENTS];        // GP counter, PMU_FIXED_SLOT + n, or PMU_NO_COUNTER
+static uint32_t pmu_running_cpu = 0;
+
+static inline void pmu_cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx,
+                             uint32_t* edx) {
+    asm volatile ("cpuid" : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx) : "a" (leaf), "c" (0));
+}
+
+static inline uint64_t pmu_rdmsr(uint32_t msr) {
+    uint32_t low, high;
+    asm volatile ("rdmsr" : "=a" (low), "=d" (high) : "c" (msr));
+    return ((uint64_t)high << 32) | low;
+}
+
+static inline void pmu_wrmsr(uint32_t msr, uint64_t value) {
+    asm volatile ("wrmsr" : : "a" ((uint32_t)value), "d" ((uint32_t)(value >> 32)), "c" (msr));
+}
+
+static uint64_t pmu_mask(uint32_t width) {
+    return width >= 64 ? ~0ULL : (1ULL << width) - 1;
+}
+
+int pmu_init(void) {
+    if (pmu_probed) {
+        return pmu_version ? 0 : -1;
+    }
+    pmu_probed = true;
+    for (int e = 0; e < PMU_EVENTS; e++) {
+        pmu_slot[e] = PMU_NO_COUNTER;
+    }
+
+    uint32_t eax, ebx, ecx, edx;
+    pmu_cpuid(0, &eax, &ebx, &ecx, &edx);
+    if (eax < PMU_CPUID_LEAF) {
+        return -1;
+    }
+    pmu_cpuid(1, &eax, &ebx, &ecx, &edx);
+    bool family6 = ((eax >> 8) & 0xF) == 6;
+    pmu_cpuid(PMU_CPUID_LEAF, &eax, &ebx, &ecx, &edx);
+    pmu_version = eax & 0xFF;
+    if (!pmu_version) {
+        return -1;
+    }
+    pmu_gp_count = (eax >> 8) & 0xFF;
+    pmu_gp_width = (eax >> 16) & 0xFF;
+    uint32_t arch_events = (eax >> 24) & 0xFF;      // EBX bits that mean anything
+    if (pmu_gp_count > PMU_MAX_GP) {
+        pmu_gp_count = PMU_MAX_GP;
+    }
+    if (pmu_version >= 2) {
+        pmu_fixed_count = edx & 0x1F;
+        pmu_fixed_width = (edx >> 5) & 0xFF;
+    }
+
+    uint32_t next_gp = 0;
+    for (int e = 0; e < PMU_EVENTS; e++) {
+        const pmu_event_t* event = &pmu_events[e];
+        if (event->arch_bit >= 0 &&
+            ((uint32_t)event->arch_bit >= arch_events || (ebx & (1u << event->arch_bit)))) {
+            continue;
+        }
+        if (event->arch_bit < 0 && (!family6 || pmu_version < 3)) {
+            continue;
+        }
+        if (event->fixed >= 0 && (uint32_t)event->fixed < pmu_fixed_count) {
+            pmu_slot[e] = PMU_FIXED_SLOT + event->fixed;
+        } else if (next_gp < pmu_gp_count) {
+            pmu_slot[e] = (int)next_gp++;
+        }
+    }
+    return 0;
+}
+
+int pmu_start(void) {
+    if (pmu_init() != 0) {
+        return -1;
+    }
+    uint32_t flags = lock_irq_save();
+    pmu_running_cpu = (uint32_t)(smp_current_cpu() - cpus);
+    uint64_t global = 0;
+    uint32_t fixed_ctrl = 0;
+    if (pmu_version >= 2) {
+        pmu_wrmsr(IA32_PERF_GLOBAL_CTRL, 0);
+    }
+    for (int e = 0; e < PMU_EVENTS; e++) {
+        int slot = pmu_slot[e];
+        if (slot == PMU_NO_COUNTER) {
+            continue;
+        }
+        if (slot >= PMU_FIXED_SLOT) {
+            uint32_t n = (uint32_t)(slot - PMU_FIXED_SLOT);
+            pmu_wrmsr(IA32_FIXED_CTR0 + n, 0);
+            fixed_ctrl |= PMU_FIXED_ENABLE << (4 * n);
+            global |= 1ULL << (32 + n);
+        } else {
+            const pmu_event_t* event = &pmu_events[e];
+            pmu_wrmsr(IA32_PERFEVTSEL0 + slot, 0);
+            pmu_wrmsr(IA32_PMC0 + slot, 0);
+            pmu_wrmsr(IA32_PERFEVTSEL0 + slot, event->event | ((uint32_t)event->umask << 8) |
+                      PMU_EVTSEL_USR | PMU_EVTSEL_OS | PMU_EVTSEL_EN);
+            global |= 1ULL << slot;
+        }
+    }
+    if (pmu_fixed_count) {
+        pmu_wrmsr(IA32_FIXED_CTR_CTRL, fixed_ctrl);
+    }
+    if (pmu_version >= 2) {
+        pmu_wrmsr(IA32_PERF_GLOBAL_CTRL, global);
+    }
+    lock_irq_restore(flags);
+    return 0;
+}
+
+void pmu_stop(pmu_counts_t* counts) {
+    if (pmu_version >= 2) {
+        pmu_wrmsr(IA32_PERF_GLOBAL_CTRL, 0);       // Freeze them all at once
+    }
+    counts->counted = 0;
+    counts->cpu = pmu_running_cpu;
+    for (int e = 0; e < PMU_EVENTS; e++) {
+        int slot = pmu_slot[e];
+        counts->count[e] = 0;
+        if (slot == PMU_NO_COUNTER) {
+            continue;
+        }
+        if (slot >= PMU_FIXED_SLOT) {
+            uint32_t n = (uint32_t)(slot - PMU_FIXED_SLOT);
+            counts->count[e] = pmu_rdmsr(IA32_FIXED_CTR0 + n) & pmu_mask(pmu_fixed_width);
+        } else {
+            counts->count[e] = pmu_rdmsr(IA32_PMC0 + slot) & pmu_mask(pmu_gp_width);
+            pmu_wrmsr(IA32_PERFEVTSEL0 + slot, 0);
+        }
+        counts->counted |= 1u << e;
+    }
+    if (pmu_fixed_count) {
+        pmu_wrmsr(IA32_FIXED_CTR_CTRL, 0);
+    }
+}
+
+// Print a 64-bit count in decimal, dividing 16 bits at a time so no
+// 64-bit division is needed
+static void pmu_print_count(uint64_t value) {
+    char digits[24];
+    int length = 0;
+    do {
+        uint32_t remainder = 0;
+        uint64_t quotient = 0;
+        for (int shift = 48; shift >= 0; shift -= 16) {
+            uint32_t part = (remainder << 16) | (uint32_t)((value >> shift) & 0xFFFF);
+            quotient |= (uint64_t)(part / 10) << shift;
+            remainder = part % 10;
+        }
+        digits[length++] = (char)('0' + remainder);
+        value = quotient;
+    } while (value);
+    while (length) {
+        terminal_putchar(digits[--length]);
+    }
+}
+
+// numerator * scale / denominator, close enough for a ratio: both are
+// shifted down until the arithmetic fits in 32 bits
+static uint32_t pmu_ratio(uint64_t numerator, uint64_t denominator, uint32_t scale) {
+    while (denominator > 0xFFFFFFFF || numerator > 0xFFFFFFFF / scale) {
+        numerator >>= 1;
+        denominator >>= 1;
+    }
+    return denominator ? (uint32_t)numerator * scale / (uint32_t)denominator : 0;
+}
+
+void pmu_report(const pmu_counts_t* counts, uint64_t ns) {
+    terminal_printf("Performance counters on CPU %d over %d us:\n", (int)counts->cpu,
+                    (int)pmu_ratio(ns, 1000, 1));
+    bool have_instructions = counts->counted & (1u << PMU_INSTRUCTIONS);
+    uint64_t instructions = counts->count[PMU_INSTRUCTIONS];
+    for (int e = 0; e < PMU_EVENTS; e++) {
+        terminal_printf("  %s: ", pmu_events[e].name);
+        if (!(counts->counted & (1u << e))) {
+            terminal_writestring("not counted\n");
+            continue;
+        }
+        pmu_print_count(counts->count[e]);
+        if (e == PMU_INSTRUCTIONS && (counts->counted & (1u << PMU_CYCLES))) {
+            uint32_t ipc = pmu_ratio(instructions, counts->count[PMU_CYCLES], 100);
+            terminal_printf("  (%d.%d%d per cycle)", (int)(ipc / 100), (int)(ipc / 10 % 10),
+                            (int)(ipc % 10));
+        } else if (e >= PMU_LLC_MISSES && have_instructions && instructions) {
+            uint32_t pki = pmu_ratio(counts->count[e], instructions, 10000);
+            terminal_printf("  (%d.%d per 1000 instructions)", (int)(pki / 10), (int)(pki % 10));
+        }
+        terminal_writestring("\n");
+    }
+}
+
+void pmu_dump(void) {
+    if (pmu_init() != 0) {
+        terminal_writestring("No architectural performance counters (CPUID leaf 0xA)\n");
+        return;
+    }
+    terminal_printf("PMU version %d: %d general counters of %d bits, %d fixed of %d bits\n",
+                    (int)pmu_version, (int)pmu_gp_count, (int)pmu_gp_width,
+                    (int)pmu_fixed_count, (int)pmu_fixed_width);
+    for (int e = 0; e < PMU_EVENTS; e++) {
+        int slot = pmu_slot[e];
+        if (slot == PMU_NO_COUNTER) {
+            terminal_printf("  %s: unavailable\n", pmu_events[e].name);
+        } else if (slot >= PMU_FIXED_SLOT) {
+            terminal_printf("  %s: fixed counter %d\n", pmu_events[e].name, slot - PMU_FIXED_SLOT);
+        } else {
+            terminal_printf("  %s: IA32_PMC%d\n", pmu_events[e].name, slot);
+        }
+    }
+}
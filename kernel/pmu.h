@@ -0,0 +1,53 @@
+// ClaudeOS Performance Counters - Day 21
+// Intel's architectural performance monitoring, as CPUID leaf 0xA
+// describes it: cycles and instructions on the fixed counters where there
+// are any, everything else on the general-purpose IA32_PMCx, each chosen
+// by its IA32_PERFEVTSELx. Counting is per CPU and covers everything that
+// CPU runs, kernel and user alike, interrupts included.
+
+#ifndef PMU_H
+#define PMU_H
+
+#include "types.h"
+
+// Events, in the order they're given counters
+#define PMU_CYCLES          0
+#define PMU_INSTRUCTIONS    1
+#define PMU_LLC_MISSES      2
+#define PMU_BRANCH_MISSES   3
+#define PMU_DTLB_MISSES     4           // Model specific: family 6 load walks
+#define PMU_EVENTS          5
+
+// MSRs
+#define IA32_PMC0               0xC1
+#define IA32_PERFEVTSEL0        0x186
+#define IA32_FIXED_CTR0         0x309   // Instructions retired; CTR1 is core cycles
+#define IA32_FIXED_CTR_CTRL     0x38D   // Four bits per fixed counter
+#define IA32_PERF_GLOBAL_CTRL   0x38F   // Version 2+: GP enables in 0-31, fixed in 32+
+
+// IA32_PERFEVTSELx
+#define PMU_EVTSEL_USR      (1 << 16)
+#define PMU_EVTSEL_OS       (1 << 17)
+#define PMU_EVTSEL_EN       (1 << 22)
+
+typedef struct {
+    uint64_t count[PMU_EVENTS];
+    uint32_t counted;                   // Bit per event that had a counter
+    uint32_t cpu;                       // cpus[] index the counters ran on
+} pmu_counts_t;
+
+// Read CPUID leaf 0xA and assign counters; 0 if there is a PMU to use
+int pmu_init(void);
+
+// Zero and start every assigned counter on this CPU; -1 without a PMU
+int pmu_start(void);
+
+// Stop them and read them out; only valid on the CPU that started them
+void pmu_stop(pmu_counts_t* counts);
+
+// Counts with IPC and misses per thousand instructions, over ns of wall time
+void pmu_report(const pmu_counts_t* counts, uint64_t ns);
+
+void pmu_dump(void);
+
+#endif // PMU_H
@@ -0,0 +1,117 @@
+// ClaudeOS Fixed Pools - Day 21
+// DEFINE_POOL(name, type, capacity) declares a static array of capacity
+// objects and the functions that manage it, specialised for that type:
+//
+//   type* name_alloc(void)           A free slot (not cleared), or NULL
+//   void  name_free(type* obj)       Give a slot back; a free slot is ignored
+//   bool  name_live(const type* obj) obj is an allocated slot of this pool
+//   int   name_index(const type* obj)
+//   type* name_get(int index)        The slot at index, allocated or not
+//   int   name_handle(const type* obj)
+//   type* name_lookup(int handle)    The slot a handle names, if still live
+//   type* name_next(int* cursor)     The next allocated slot from *cursor
+//   int   name_count(void)           Allocated slots
+//
+// Free slots are chained through a side array of indices, so alloc and
+// free are constant time; slots past the high-water mark have never been
+// used and need no chaining, so a pool needs no init call. A bitmap marks
+// the allocated slots for name_live and for POOL_FOR_EACH, which skips
+// 32 free slots per word. Slot contents survive free, so a lock embedded
+// in the type stays valid and a racing reader sees the old object.
+//
+// A handle is positive and names one allocation of one slot: the slot's
+// generation, bumped on every free, is folded in with the index, so an id
+// kept past a close never finds the slot's next occupant. Pools do no
+// locking of their own; callers hold whatever lock guarded the table.
+
+#ifndef POOL_H
+#define POOL_H
+
+#include "types.h"
+
+#define POOL_MAX_CAPACITY   0x7FFF      // Handles stay below 2^31
+
+#define POOL_FOR_EACH(name, var) \
+    for (int name##_cursor = 0; ((var) = name##_next(&name##_cursor)) != NULL; )
+
+#define DEFINE_POOL(name, type, capacity) \
+    _Static_assert((capacity) > 0 && (capacity) <= POOL_MAX_CAPACITY, #name ": bad pool capacity"); \
+    static type name##_slots[capacity]; \
+    static uint16_t name##_links[capacity];             /* Next free slot + 1 (0: end) */ \
+    static uint16_t name##_gens[capacity];              /* Frees of each slot */ \
+    static uint32_t name##_map[((capacity) + 31) / 32]; /* Allocated slots */ \
+    static uint16_t name##_free_head;                   /* First free slot + 1 (0: none) */ \
+    static uint16_t name##_fresh;                       /* Slots ever handed out */ \
+    static uint16_t name##_used; \
+    \
+    static inline __attribute__((unused)) type* name##_get(int index) { \
+        return index >= 0 && index < (capacity) ? &name##_slots[index] : NULL; \
+    } \
+    static inline __attribute__((unused)) int name##_index(const type* obj) { \
+        return (int)(obj - name##_slots); \
+    } \
+    static inline __attribute__((unused)) bool name##_live(const type* obj) { \
+        if (!obj || obj < name##_slots || obj >= name##_slots + (capacity)) { \
+            return false; \
+        } \
+        uint32_t index = (uint32_t)(obj - name##_slots); \
+        return (name##_map[index >> 5] >> (index & 31)) & 1; \
+    } \
+    static inline __attribute__((unused)) type* name##_alloc(void) { \
+        uint32_t index; \
+        if (name##_free_head) { \
+            index = name##_free_head - 1u; \
+            name##_free_head = name##_links[index]; \
+        } else if (name##_fresh < (capacity)) { \
+            index = name##_fresh++; \
+        } else { \
+            return NULL; \
+        } \
+        name##_map[index >> 5] |= 1u << (index & 31); \
+        name##_used++; \
+        return &name##_slots[index]; \
+    } \
+    static inline __attribute__((unused)) void name##_free(type* obj) { \
+        if (!name##_live(obj)) { \
+            return; \
+        } \
+        uint32_t index = (uint32_t)(obj - name##_slots); \
+        name##_map[index >> 5] &= ~(1u << (index & 31)); \
+        name##_gens[index]++; \
+        name##_links[index] = name##_free_head; \
+        name##_free_head = (uint16_t)(index + 1); \
+        name##_used--; \
+    } \
+    static inline __attribute__((unused)) int name##_handle(const type* obj) { \
+        uint32_t index = (uint32_t)(obj - name##_slots); \
+        return (int)(((uint32_t)name##_gens[index] + 1) * (capacity) + index); \
+    } \
+    static inline __attribute__((unused)) type* name##_lookup(int handle) { \
+        if (handle < (capacity)) { \
+            return NULL; \
+        } \
+        uint32_t index = (uint32_t)handle % (capacity); \
+        uint32_t gen = (uint32_t)handle / (capacity) - 1; \
+        type* obj = &name##_slots[index]; \
+        return gen == name##_gens[index] && name##_live(obj) ? obj : NULL; \
+    } \
+    static inline __attribute__((unused)) type* name##_next(int* cursor) { \
+        uint32_t index = (uint32_t)*cursor; \
+        while (index < name##_fresh) { \
+            uint32_t word = name##_map[index >> 5] >> (index & 31); \
+            if (!word) { \
+                index = (index | 31) + 1; \
+                continue; \
+            } \
+            index += (uint32_t)__builtin_ctz(word); \
+            *cursor = (int)index + 1; \
+            return &name##_slots[index]; \
+        } \
+        *cursor = (capacity); \
+        return NULL; \
+    } \
+    static inline __attribute__((unused)) int name##_count(void) { \
+        return name##_used; \
+    }
+
+#endif // POOL_H
@@ -0,0 +1,230 @@
+// ClaudeOS Kernel Log Implementation - Day 21
+// Writers take a sequence number with one atomic add and own the slot it
+// names. A slot's sequence is 0 while it is written and seq + 1 once it is
+// complete, so the drain can tell a record still being written from one
+// a writer PRINTK_SLOTS ahead has overwritten, and skip the latter.
+
+#include "printk.h"
+#include "kernel.h"
+#include "timer.h"
+#include "serial.h"
+#include "string.h"
+
+typedef __builtin_va_list va_list;
+#define va_start(v,l) __builtin_va_start(v,l)
+#define va_end(v) __builtin_va_end(v)
+#define va_arg(v,l) __builtin_va_arg(v,l)
+
+typedef struct {
+    volatile uint32_t sequence;         // 0: being written, else seq + 1
+    uint32_t tick;
+    uint8_t level;
+    uint8_t length;
+    char text[PRINTK_LINE];
+} printk_record_t;
+
+int printk_level = KLOG_INFO;
+
+static printk_record_t printk_ring[PRINTK_SLOTS];
+static volatile uint32_t printk_head = 0;       // Next sequence to hand out
+static uint32_t printk_tail = 0;                // Next to drain (drainer only)
+static volatile int printk_draining = 0;
+static uint16_t printk_serial = 0;
+static uint32_t printk_dropped = 0;             // Overwritten before they were drained
+
+static const char* const printk_level_names[] = { "err", "warn", "info", "debug" };
+
+static uint8_t printk_color(uint8_t level) {
+    switch (level) {
+        case KLOG_ERR:  return vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+        case KLOG_WARN: return vga_entry_color(VGA_COLOR_YELLOW, VGA_COLOR_BLACK);
+        case KLOG_INFO: return vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+        default:        return vga_entry_color(VGA_COLOR_DARK_GREY, VGA_COLOR_BLACK);
+    }
+}
+
+// Append value in base to out; returns the new length
+static uint32_t printk_number(char* out, uint32_t length, uint32_t size, uint32_t value,
+                              uint32_t base, bool negative) {
+    char digits[12];
+    int count = 0;
+    do {
+        uint32_t digit = value % base;
+        digits[count++] = (char)(digit < 10 ? '0' + digit : 'a' + digit - 10);
+        value /= base;
+    } while (value);
+    if (negative) {
+        digits[count++] = '-';
+    }
+    while (count > 0 && length < size) {
+        out[length++] = digits[--count];
+    }
+    return length;
+}
+
+// The same conversions as terminal_printf, plus %u, %x and %c
+uint32_t printk_vformat(char* out, uint32_t size, const char* format, va_list args) {
+    uint32_t length = 0;
+    for (; *format && length < size; format++) {
+        if (*format != '%') {
+            out[length++] = *format;
+            continue;
+        }
+        switch (*++format) {
+            case 'd': {
+                int value = va_arg(args, int);
+                length = printk_number(out, length, size,
+                                       value < 0 ? 0u - (uint32_t)value : (uint32_t)value, 10, value < 0);
+                break;
+            }
+            case 'u':
+                length = printk_number(out, length, size, va_arg(args, uint32_t), 10, false);
+                break;
+            case 'x':
+                length = printk_number(out, length, size, va_arg(args, uint32_t), 16, false);
+                break;
+            case 'c':
+                out[length++] = (char)va_arg(args, int);
+                break;
+            case 's': {
+                const char* str = va_arg(args, const char*);
+                for (str = str ? str : "(null)"; *str && length < size; str++) {
+                    out[length++] = *str;
+                }
+                break;
+            }
+            case '\0':
+                return length;
+            case '%':
+                out[length++] = '%';
+                break;
+            default:
+                out[length++] = '%';
+                if (length < size) {
+                    out[length++] = *format;
+                }
+                break;
+        }
+    }
+    return length;
+}
+
+void printk_emit(int level, const char* format, ...) {
+    char text[PRINTK_LINE];
+    va_list args;
+    va_start(args, format);
+    uint32_t length = printk_vformat(text, PRINTK_LINE, format, args);
+    va_end(args);
+
+    // A cut message still ends its line
+    uint32_t format_length = strlen(format);
+    if (length == PRINTK_LINE && format_length > 0 && format[format_length - 1] == '\n') {
+        text[PRINTK_LINE - 1] = '\n';
+    }
+
+    uint32_t seq = __sync_fetch_and_add(&printk_head, 1);
+    printk_record_t* record = &printk_ring[seq & (PRINTK_SLOTS - 1)];
+    record->sequence = 0;
+    __sync_synchronize();
+    record->tick = timer_get_ticks();
+    record->level = (uint8_t)level;
+    record->length = (uint8_t)length;
+    memcpy(record->text, text, length);
+    __sync_synchronize();
+    record->sequence = seq + 1;
+}
+
+void printk_init(uint16_t serial_port) {
+    printk_serial = serial_port;
+}
+
+static void printk_write(const printk_record_t* record, const char* text) {
+    terminal_write_console(text, record->length, printk_color(record->level));
+    if (printk_serial) {
+        // One queued write per line, the terminal's CR before each LF
+        uint32_t start = 0;
+        for (uint32_t i = 0; i < record->length; i++) {
+            if (text[i] == '\n') {
+                serial_write(printk_serial, text + start, i - start);
+                serial_write(printk_serial, "\r\n", 2);
+                start = i + 1;
+            }
+        }
+        serial_write(printk_serial, text + start, record->length - start);
+    }
+}
+
+void printk_drain(uint32_t max) {
+    if (__sync_lock_test_and_set(&printk_draining, 1)) {
+        return;
+    }
+    char text[PRINTK_LINE];
+    uint32_t written = 0;
+    while (max == 0 || written < max) {
+        uint32_t head = printk_head;
+        if (printk_tail == head) {
+            break;
+        }
+        if (head - printk_tail > PRINTK_SLOTS) {
+            printk_dropped += head - printk_tail - PRINTK_SLOTS;
+            printk_tail = head - PRINTK_SLOTS;
+        }
+
+        printk_record_t* record = &printk_ring[printk_tail & (PRINTK_SLOTS - 1)];
+        uint32_t seq = record->sequence;
+        if (seq != printk_tail + 1) {
+            if (seq == 0 || (int32_t)(seq - (printk_tail + 1)) < 0) {
+                break;  // Still being written
+            }
+            printk_dropped++;   // Overwritten by a later message
+            printk_tail++;
+            continue;
+        }
+        memcpy(text, record->text, record->length);
+        __sync_synchronize();
+        if (record->sequence != seq) {
+            printk_dropped++;
+            printk_tail++;
+            continue;
+        }
+        printk_write(record, text);
+        printk_tail++;
+        written++;
+    }
+    __sync_lock_release(&printk_draining);
+}
+
+void printk_command(int argc, char argv[][64]) {
+    if (argc >= 3 && strcmp(argv[1], "level") == 0) {
+        int level = argv[2][0] - '0';
+        if (level < KLOG_ERR || level > KLOG_DEBUG || argv[2][1]) {
+            terminal_writestring("Usage: log level <0-3>  (err, warn, info, debug)\n");
+            return;
+        }
+        printk_level = level;
+        terminal_printf("Log level: %s\n", printk_level_names[level]);
+
+    } else if (argc >= 2 && strcmp(argv[1], "stats") == 0) {
+        terminal_printf("Log level: %s (compiled up to %s)\n", printk_level_names[printk_level],
+                        printk_level_names[PRINTK_COMPILE_LEVEL]);
+        terminal_printf("  Messages: %d, waiting: %d, dropped: %d\n", (int)printk_head,
+                        (int)(printk_head - printk_tail), (int)printk_dropped);
+
+    } else if (argc < 2 || strcmp(argv[1], "dump") == 0) {
+        // Everything still in the ring, drained or not
+        printk_drain(0);
+        uint32_t head = printk_head;
+        uint32_t first = head > PRINTK_SLOTS ? head - PRINTK_SLOTS : 0;
+        for (uint32_t seq = first; seq < head; seq++) {
+            const printk_record_t* record = &printk_ring[seq & (PRINTK_SLOTS - 1)];
+            if (record->sequence != seq + 1) {
+                continue;
+            }
+            terminal_printf("[%d] %s: ", (int)record->tick, printk_level_names[record->level]);
+            terminal_write(record->text, record->length);
+        }
+
+    } else {
+        terminal_writestring("Usage: log [dump|stats|level <0-3>]\n");
+    }
+}
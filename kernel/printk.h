@@ -0,0 +1,50 @@
+// ClaudeOS Kernel Log - Day 21
+// printk formats into a ring of fixed-size records and returns: no lock,
+// no console I/O. The ring is drained to the screen and the serial line
+// when the CPU has nothing better to do (the idle loop, the shell prompt)
+// and at once on a panic. Messages above the level are dropped before
+// they are formatted, and above PRINTK_COMPILE_LEVEL not even compiled.
+
+#ifndef PRINTK_H
+#define PRINTK_H
+
+#include "types.h"
+
+#define KLOG_ERR        0
+#define KLOG_WARN       1
+#define KLOG_INFO       2
+#define KLOG_DEBUG      3
+
+#ifndef PRINTK_COMPILE_LEVEL
+#define PRINTK_COMPILE_LEVEL    KLOG_DEBUG  // -DPRINTK_COMPILE_LEVEL=KLOG_INFO drops debug calls
+#endif
+
+#define PRINTK_SLOTS    128                 // Records kept; a power of two
+#define PRINTK_LINE     118                 // Text bytes per record (longer is cut)
+
+extern int printk_level;                    // Highest level recorded, KLOG_INFO at boot
+
+#define printk(level, ...) do { \
+    if ((level) <= PRINTK_COMPILE_LEVEL && (level) <= printk_level) { \
+        printk_emit((level), __VA_ARGS__); \
+    } \
+} while (0)
+
+// Record a message (%d %u %x %s %c %%); use printk() for the level check
+void printk_emit(int level, const char* format, ...);
+
+// The formatter printk uses, for other code that builds text in a buffer:
+// at most size bytes, no terminator; returns the length
+uint32_t printk_vformat(char* out, uint32_t size, const char* format, __builtin_va_list args);
+
+// Echo drained records to serial_port too (0: the screen only)
+void printk_init(uint16_t serial_port);
+
+// Write up to max records (0: all) to the console. One CPU drains at a
+// time; others return at once.
+void printk_drain(uint32_t max);
+
+// Shell: log [level <0-3>|dump|stats]
+void printk_command(int argc, char argv[][64]);
+
+#endif // PRINTK_H
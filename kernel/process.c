@@ -6,32 +6,892 @@
 #include "heap.h"
 #include "timer.h"
 #include "vmm.h"
+#include "pmm.h"
+#include "lock.h"
+#include "softirq.h"
+#include "ipc.h"
+#include "futex.h"
+#include "mutex.h"
+#include "pipe.h"
+#include "channel.h"
+#include "waitset.h"
+#include "udp.h"
+#include "tcp.h"
+#include "vfs.h"
+#include "sysenter.h"
+#include "vdata.h"
+#include "uring.h"
+#include "gdt.h"
+#include "user.h"
+#include "elf.h"
+#include "printk.h"
+#include "string.h"
+#include "trace.h"
+#include "idle.h"
+#include "irq.h"
+#include "stats.h"
+#include "procfs.h"
+#include "initcall.h"
+#include "reclaim.h"
+
+STAT_DEFINE(stat_sched_switches, "sched.switches", STAT_COUNTER, "context switches");
+STAT_DEFINE(stat_sched_handoffs, "sched.handoffs", STAT_COUNTER, "directed switches that skipped the ready queues");
+STAT_DEFINE(stat_sched_wake_preempts, "sched.wake_preempts", STAT_COUNTER, "wakeups that ended the running task's slice early");
+STAT_DEFINE(stat_proc_created, "proc.created", STAT_COUNTER, "processes created");
+STAT_DEFINE(stat_proc_live, "proc.live", STAT_GAUGE, "process table slots in use");
+STAT_DEFINE(stat_proc_reaped, "proc.reaped", STAT_COUNTER, "terminated processes freed");
 
 // Global process management variables
-process_t* current_process = NULL;
-process_t* ready_queue_head = NULL;
-process_t* ready_queue_tail = NULL;
-process_t process_table[MAX_PROCESSES];
+int process_table_size = 0;
 int next_pid = FIRST_USER_PID;
 static int process_system_initialized = 0;
+int scheduler_preemptive = 0;
+uint32_t scheduler_quantum = PROCESS_DEFAULT_QUANTUM;
+
+// Per-CPU MLFQ ready queues, each with a bitmap of non-empty levels for
+// O(1) selection. A CPU whose queue runs dry steals from the one with the
+// heaviest recent load.
+typedef struct {
+    process_t* heads[PROCESS_PRIORITY_LEVELS];
+    process_t* tails[PROCESS_PRIORITY_LEVELS];
+    uint32_t bitmap;
+    uint32_t count;
+    spinlock_t lock;
+    char name[12];                  // Lock name for the statistics
+    load_avg_t util;                // The CPU's busy share (owner CPU only)
+    load_avg_t load;                // Runnable tasks here, the running one included
+} run_queue_t;
+
+static run_queue_t run_queues[SMP_MAX_CPUS];
+static uint32_t ticks_since_boost = 0;
+
+// Directed switches: the task process_yield_to left for each CPU, run at
+// its next reschedule ahead of the ready queues
+static process_t* handoff_next[SMP_MAX_CPUS];
+
+// Idle tasks for the application processors (never in the table)
+static process_t idle_tasks[SMP_MAX_CPUS];
+static process_info_t idle_infos[SMP_MAX_CPUS];
+
+// Protects states, on_cpu, the counters and the zombie list. Taken on its
+// own or before a run queue lock; two run queue locks are only ever taken
+// together in CPU index order (stealing).
+static ticket_lock_t sched_lock;
+
+// Process table: chunks of slots added on demand (the first is static so
+// the kernel task never depends on the heap), a stack of free slots, a
+// PID hash and per-state counts kept up to date on every transition.
+// Each chunk of process_t has a matching chunk of process_info_t, so the
+// scheduler's slots stay dense and cold names and counters stay out of
+// its cache lines.
+static process_t process_table_initial[PROCESS_TABLE_CHUNK];
+static process_info_t process_info_initial[PROCESS_TABLE_CHUNK];
+static process_t* process_chunks[MAX_PROCESSES / PROCESS_TABLE_CHUNK];
+static int free_slots[MAX_PROCESSES];
+static int free_slot_count = 0;
+static process_t* pid_hash[PROCESS_HASH_BUCKETS];
+static int state_counts[PROCESS_STATE_COUNT];
+static int live_processes = 0;
+static process_t* zombie_list = NULL;
+
+// The reaper thread, and whether it is asleep waiting for an exit
+static int reaper_pid = INVALID_PID;
+static bool reaper_sleeping = false;
+static spinlock_t reaper_lock;          // Unregistered; taken before sched_lock
+static void reaper_start(void);
+static void reaper_kick(void);
+
+// Own address space for a new process with its shared data pages; falls
+// back to the kernel's
+static void process_new_directory(process_t* process) {
+    page_directory_t* dir = vmm_create_process_directory();
+    process->page_directory = dir ? dir : kernel_page_directory;
+    process->vm_space.dir = dir;        // Areas only in a directory of its own
+    process->vm_space.areas = NULL;
+    process->vm_space.faults_handled = 0;
+    process->vm_space.faults_failed = 0;
+    process->vm_space.cow_copies = 0;
+    process->vm_space.zero_maps = 0;
+    process->vm_space.swap_hand = 0;
+    vdata_map(process);
+}
+
+// Load a process's address space if it isn't already active
+static void process_load_directory(process_t* process) {
+    if (process->page_directory && process->page_directory != current_page_directory) {
+        vmm_switch_page_directory(process->page_directory);
+    }
+}
+
+// Everything beyond the registers that has to follow a switch to process
+static void process_activate(process_t* process) {
+    process_load_directory(process);
+    fpu_switch(process);
+    sysenter_switch(process);
+    smp_current_cpu()->vm_space = process->vm_space.dir ? &process->vm_space : NULL;
+    if (process->stack) {
+        // Entries from ring 3 start on an empty kernel stack
+        tss_set_kernel_stack((uint32_t)process->stack + STACK_SIZE);
+    }
+}
+
+// The queues are shared with the timer interrupt
+static inline uint32_t irq_save(void) {
+    uint32_t flags;
+    asm volatile ("pushf; pop %0; cli" : "=r" (flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint32_t flags) {
+    asm volatile ("push %0; popf" : : "r" (flags) : "memory", "cc");
+}
+
+static inline uint32_t sched_lock_acquire(void) {
+    return ticket_lock_irqsave(&sched_lock);
+}
+
+static inline void sched_lock_release(uint32_t flags) {
+    ticket_unlock_irqrestore(&sched_lock, flags);
+}
+
+// Slot index to process (NULL past the allocated part of the table)
+process_t* process_slot(int slot) {
+    if (slot < 0 || slot >= process_table_size) {
+        return NULL;
+    }
+    return &process_chunks[slot / PROCESS_TABLE_CHUNK][slot % PROCESS_TABLE_CHUNK];
+}
+
+static inline uint32_t pid_bucket(int pid) {
+    return (uint32_t)pid & (PROCESS_HASH_BUCKETS - 1);
+}
+
+// Blank slot: no PID, not counted in any state
+static void slot_reset(process_t* process, process_info_t* info, int slot) {
+    memset(process, 0, sizeof(process_t));
+    memset(info, 0, sizeof(process_info_t));
+    process->info = info;
+    process->pid = INVALID_PID;
+    process->parent_pid = INVALID_PID;
+    process->state = PROCESS_TERMINATED;
+    process->slot = slot;
+}
+
+// Add another chunk of slots; the lowest new slot is handed out first
+static int table_grow(void) {
+    if (process_table_size >= MAX_PROCESSES) {
+        return -1;
+    }
+    process_t* chunk = process_table_initial;
+    process_info_t* info = process_info_initial;
+    if (process_table_size > 0) {
+        chunk = (process_t*)kmalloc_aligned(sizeof(process_t) * PROCESS_TABLE_CHUNK,
+                                            PROCESS_HOT_ALIGN);
+        info = (process_info_t*)kmalloc(sizeof(process_info_t) * PROCESS_TABLE_CHUNK);
+        if (!chunk || !info) {
+            if (chunk) {
+                kfree(chunk);
+            }
+            if (info) {
+                kfree(info);
+            }
+            return -1;
+        }
+    }
+    
+    int base = process_table_size;
+    process_chunks[base / PROCESS_TABLE_CHUNK] = chunk;
+    for (int i = 0; i < PROCESS_TABLE_CHUNK; i++) {
+        slot_reset(&chunk[i], &info[i], base + i);
+    }
+    for (int i = PROCESS_TABLE_CHUNK - 1; i >= 0; i--) {
+        free_slots[free_slot_count++] = base + i;
+    }
+    process_table_size += PROCESS_TABLE_CHUNK;
+    return 0;
+}
+
+// Claim a free slot for pid, growing the table when none is left
+static process_t* slot_alloc(int pid, process_state_t state) {
+    if (free_slot_count == 0 && table_grow() != 0) {
+        return NULL;
+    }
+    
+    uint32_t flags = sched_lock_acquire();
+    process_t* process = process_slot(free_slots[--free_slot_count]);
+    process->pid = pid;
+    process->state = state;
+    process->held_mutexes = NULL;
+    process->blocked_on = NULL;
+    process->signals = 0;
+    process->stopped = 0;
+    process->user = 0;
+    process->pi_level = PROCESS_PRIORITY_LEVELS - 1;
+    process->cpumask = 0;
+    process->util.stamp = 0;
+    process->util.avg = 0;
+    process->exec_start = 0;
+    process->run_ns = 0;
+    process->hash_next = pid_hash[pid_bucket(pid)];
+    rcu_assign_pointer(pid_hash[pid_bucket(pid)], process);
+    state_counts[state]++;
+    live_processes++;
+    stat_inc(&stat_proc_live);
+    sched_lock_release(flags);
+    return process;
+}
+
+// process_find readers may still be walking through the slot's hash link
+static void slot_free_rcu(rcu_head_t* head) {
+    process_t* process = (process_t*)((uint8_t*)head - __builtin_offsetof(process_t, rcu));
+    uint32_t flags = sched_lock_acquire();
+    process->hash_next = NULL;
+    free_slots[free_slot_count++] = process->slot;
+    sched_lock_release(flags);
+}
+
+// Unhash a slot; it returns to the free stack once no lookup can reach it
+static void slot_release(process_t* process) {
+    ipc_mailbox_release(process);
+    if (process->dl.period) {
+        dl_release(process);
+    }
+    
+    uint32_t flags = sched_lock_acquire();
+    process_t** link = &pid_hash[pid_bucket(process->pid)];
+    while (*link && *link != process) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) {
+        rcu_assign_pointer(*link, process->hash_next);
+    }
+    state_counts[process->state]--;
+    live_processes--;
+    stat_dec(&stat_proc_live);
+    
+    process->pid = INVALID_PID;
+    process->state = PROCESS_TERMINATED;
+    process->zombie_next = NULL;
+    process->zombie_prev = NULL;
+    sched_lock_release(flags);
+    call_rcu(&process->rcu, slot_free_rcu);
+}
+
+// Whether process is still on the zombie list (sched_lock held)
+static inline bool zombie_linked(process_t* process) {
+    return process->zombie_prev || zombie_list == process;
+}
+
+// Take process off the zombie list (sched_lock held)
+static void zombie_unlink(process_t* process) {
+    if (process->zombie_prev) {
+        process->zombie_prev->zombie_next = process->zombie_next;
+    } else if (zombie_list == process) {
+        zombie_list = process->zombie_next;
+    }
+    if (process->zombie_next) {
+        process->zombie_next->zombie_prev = process->zombie_prev;
+    }
+    process->zombie_next = NULL;
+    process->zombie_prev = NULL;
+}
+
+// Every state change goes through here so the counters stay exact
+static void set_state_locked(process_t* process, process_state_t state) {
+    if (process->pid != INVALID_PID) {
+        state_counts[process->state]--;
+        state_counts[state]++;
+        if (state == PROCESS_TERMINATED && process->state != PROCESS_TERMINATED) {
+            process->zombie_prev = NULL;
+            process->zombie_next = zombie_list;
+            if (zombie_list) {
+                zombie_list->zombie_prev = process;
+            }
+            zombie_list = process;
+        }
+    }
+    process->state = state;
+}
+
+static void process_set_state(process_t* process, process_state_t state) {
+    uint32_t flags = sched_lock_acquire();
+    set_state_locked(process, state);
+    sched_lock_release(flags);
+}
+
+// Change state only if the process is still in from
+static int process_change_state(process_t* process, process_state_t from, process_state_t to) {
+    uint32_t flags = sched_lock_acquire();
+    int changed = (process->state == from);
+    if (changed) {
+        set_state_locked(process, to);
+    }
+    sched_lock_release(flags);
+    return changed;
+}
+
+// Quantum for a level: doubles per level
+static inline uint32_t level_quantum(uint32_t level) {
+    return scheduler_quantum << level;
+}
+
+static inline uint32_t rq_lock(run_queue_t* rq) {
+    return spin_lock_irqsave(&rq->lock);
+}
+
+static inline void rq_unlock(run_queue_t* rq, uint32_t flags) {
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+// Queue primitives - the queue's lock must be held
+static void rq_append(run_queue_t* rq, process_t* process) {
+    uint32_t level = process->priority;
+    process->next = NULL;
+    process->cpu = (int)(rq - run_queues);
+    if (rq->tails[level]) {
+        rq->tails[level]->next = process;
+    } else {
+        rq->heads[level] = process;
+    }
+    rq->tails[level] = process;
+    rq->bitmap |= 1u << level;
+    rq->count++;
+}
+
+static int rq_unlink(run_queue_t* rq, process_t* process) {
+    // Every level is searched: a boost can change priority while queued
+    for (uint32_t level = 0; level < PROCESS_PRIORITY_LEVELS; level++) {
+        process_t* prev = NULL;
+        for (process_t* p = rq->heads[level]; p; prev = p, p = p->next) {
+            if (p != process) {
+                continue;
+            }
+            if (prev) {
+                prev->next = p->next;
+            } else {
+                rq->heads[level] = p->next;
+            }
+            if (rq->tails[level] == p) {
+                rq->tails[level] = prev;
+            }
+            if (!rq->heads[level]) {
+                rq->bitmap &= ~(1u << level);
+            }
+            p->next = NULL;
+            rq->count--;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Take the first READY process from the highest non-empty level. It is
+// marked on_cpu before the lock drops, so a kill can't free its stack.
+static process_t* rq_pop(run_queue_t* rq) {
+    process_t* process = NULL;
+    while (rq->bitmap && !process) {
+        uint32_t level;
+        asm volatile ("bsf %1, %0" : "=r" (level) : "rm" (rq->bitmap));
+        process = rq->heads[level];
+        rq->heads[level] = process->next;
+        if (!rq->heads[level]) {
+            rq->tails[level] = NULL;
+            rq->bitmap &= ~(1u << level);
+        }
+        process->next = NULL;
+        rq->count--;
+        if (process->state != PROCESS_READY) {
+            process = NULL;  // Killed while queued
+        } else {
+            process->on_cpu = 1;
+        }
+    }
+    return process;
+}
+
+// Whether a process's cpumask lets it run on cpus[cpu]
+static inline bool process_allowed(const process_t* process, uint32_t cpu) {
+    return !process->cpumask || (process->cpumask & PROCESS_CPU(cpu));
+}
+
+// Append a process to the queue of its priority level: this CPU's if its
+// mask allows, else the one it was last on or the first its mask names.
+// Deadline tasks go on the EDF queue every CPU shares.
+static void ready_enqueue(process_t* process) {
+    if (process->dl.period) {
+        dl_enqueue(process);
+        return;
+    }
+    uint32_t self = smp_current_cpu()->id;
+    uint32_t cpu = self;
+    if (!process_allowed(process, self)) {
+        cpu = process_allowed(process, (uint32_t)process->cpu) ? (uint32_t)process->cpu
+                                                               : (uint32_t)__builtin_ctz(process->cpumask);
+    }
+    run_queue_t* rq = &run_queues[cpu];
+    uint32_t flags = rq_lock(rq);
+    rq_append(rq, process);
+    rq_unlock(rq, flags);
+    // Its CPU (or an idle one, to steal it) looks now rather than at its next tick
+    if (cpu != self) {
+        idle_wake(cpu);
+    } else if (smp_cpu_count > 1) {
+        idle_wake_any();
+    }
+}
+
+// Move half of the processes queued on the CPU with the heaviest recent
+// load (of those with any queued) to this CPU's queue, those whose mask
+// allows it. A momentary queue length would chase bursts; the decayed
+// load follows where work has been piling up.
+static uint32_t ready_steal(cpu_t* cpu) {
+    uint32_t victim = cpu->id;
+    uint32_t heaviest = 0;
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        uint32_t load = run_queues[i].load.avg + 1;     // A queue yet to build up load still counts
+        if (i != cpu->id && run_queues[i].count > 0 && load > heaviest) {
+            heaviest = load;
+            victim = i;
+        }
+    }
+    if (victim == cpu->id) {
+        return 0;
+    }
+    
+    run_queue_t* local = &run_queues[cpu->id];
+    run_queue_t* remote = &run_queues[victim];
+    run_queue_t* first = cpu->id < victim ? local : remote;
+    run_queue_t* second = cpu->id < victim ? remote : local;
+    uint32_t flags = irq_save();
+    spin_lock(&first->lock);
+    spin_lock(&second->lock);
+    
+    uint32_t quota = (remote->count + 1) / 2;
+    uint32_t moved = 0;
+    for (uint32_t level = 0; level < PROCESS_PRIORITY_LEVELS && moved < quota; level++) {
+        process_t* p = remote->heads[level];
+        while (p && moved < quota) {
+            process_t* next = p->next;
+            if (process_allowed(p, cpu->id) && p->state == PROCESS_READY) {
+                rq_unlink(remote, p);
+                rq_append(local, p);
+                moved++;
+            }
+            p = next;
+        }
+    }
+    
+    spin_unlock(&second->lock);
+    spin_unlock(&first->lock);
+    irq_restore(flags);
+    
+    if (moved > 0) {
+        cpu->steals++;
+        cpu->stolen += moved;
+    }
+    return moved;
+}
+
+// Next process for this CPU: the earliest deadline if any deadline task
+// is ready, else its own queue, then a steal
+static process_t* ready_dequeue(void) {
+    cpu_t* cpu = smp_current_cpu();
+    run_queue_t* rq = &run_queues[cpu->id];
+    
+    process_t* process = dl_pop();
+    if (process) {
+        return process;
+    }
+    uint32_t flags = rq_lock(rq);
+    process = rq_pop(rq);
+    rq_unlock(rq, flags);
+    if (process || smp_cpu_count < 2 || ready_steal(cpu) == 0) {
+        return process;
+    }
+    
+    flags = rq_lock(rq);
+    process = rq_pop(rq);
+    rq_unlock(rq, flags);
+    return process;
+}
+
+// Unlink a process from its queue; returns 0 if it wasn't queued
+static int ready_remove(process_t* process) {
+    if (process->dl.period) {
+        return dl_unlink(process);
+    }
+    while (1) {
+        run_queue_t* rq = &run_queues[process->cpu];
+        uint32_t flags = rq_lock(rq);
+        if (&run_queues[process->cpu] != rq) {
+            rq_unlock(rq, flags);
+            continue;  // Stolen in the meantime
+        }
+        int removed = rq_unlink(rq, process);
+        rq_unlock(rq, flags);
+        return removed;
+    }
+}
+
+// Periodic reset: everything back to level 0, keeping priority order
+static void ready_boost_all(void) {
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        run_queue_t* rq = &run_queues[cpu];
+        process_t* head = NULL;
+        process_t* tail = NULL;
+        uint32_t flags = rq_lock(rq);
+        for (uint32_t level = 0; level < PROCESS_PRIORITY_LEVELS; level++) {
+            for (process_t* p = rq->heads[level]; p; p = p->next) {
+                p->priority = 0;
+            }
+            if (rq->heads[level]) {
+                if (tail) {
+                    tail->next = rq->heads[level];
+                } else {
+                    head = rq->heads[level];
+                }
+                tail = rq->tails[level];
+            }
+            rq->heads[level] = NULL;
+            rq->tails[level] = NULL;
+        }
+        rq->heads[0] = head;
+        rq->tails[0] = tail;
+        rq->bitmap = head ? 1 : 0;
+        rq_unlock(rq, flags);
+    }
+    
+    for (int i = 0; i < process_table_size; i++) {
+        process_t* process = process_slot(i);
+        if (process->pid != INVALID_PID) {
+            process->priority = 0;
+        }
+    }
+}
+
+// Check whether any process is waiting to run
+int process_has_ready(void) {
+    if (dl_ready_count()) {
+        return 1;
+    }
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (run_queues[cpu].count) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Raise a process to the top level (interactive / I/O-bound work)
+void process_boost(process_t* process) {
+    if (!process_system_initialized || !process || process->priority == 0) {
+        return;
+    }
+    if (process->state == PROCESS_READY && ready_remove(process)) {
+        process->priority = 0;
+        ready_enqueue(process);
+    } else {
+        process->priority = 0;
+    }
+}
+
+// Priority inheritance: keep process at level or above until the next
+// call lifts the floor (PROCESS_PRIORITY_LEVELS - 1: none). Raising it
+// moves it to its new level's queue if it is waiting for a CPU.
+void process_inherit_priority(process_t* process, uint32_t level) {
+    if (!process_system_initialized || !process) {
+        return;
+    }
+    if (level > PROCESS_PRIORITY_LEVELS - 1) {
+        level = PROCESS_PRIORITY_LEVELS - 1;
+    }
+    process->pi_level = level;
+    if (process->priority <= level) {
+        return;
+    }
+    if (process->state == PROCESS_READY && ready_remove(process)) {
+        process->priority = level;
+        ready_enqueue(process);
+    } else {
+        process->priority = level;
+    }
+}
+
+// Whether the running process may sleep. An idle task never does, and
+// the kernel task (the shell) only under preemption with CPU 0's idle
+// task there to take its place.
+bool process_can_block(void) {
+    cpu_t* cpu = smp_current_cpu();
+    process_t* self = cpu->current;
+    if (!self || self == cpu->idle) {
+        return false;
+    }
+    return self->pid != KERNEL_PID || (scheduler_preemptive && cpu->idle);
+}
+
+// Mark the running process blocked without giving up the CPU yet, so it
+// can publish itself on a wait queue before the switch
+void process_prepare_block(void) {
+    if (!process_can_block()) {
+        return;
+    }
+    process_set_state(current_process, PROCESS_BLOCKED);
+}
+
+// Block the running process until process_wake()
+void process_block(void) {
+    if (!process_can_block()) {
+        return;
+    }
+    process_prepare_block();
+    if (scheduler_preemptive) {
+        process_yield();
+    }
+}
+
+// Nothing else may have been runnable when the slice ended, so the yield
+// can come straight back: idle until the waker's store lands
+void process_sleep_on(volatile const uint32_t* word, uint32_t value) {
+    process_yield();
+    while (*word == value) {
+        asm volatile ("sti; hlt");
+    }
+}
+
+// Make a blocked process runnable again; it returns at the top level. One
+// still on its CPU is queued by process_finish_switch once it is off.
+void process_wake(process_t* process) {
+    if (!process) {
+        return;
+    }
+    uint32_t flags = sched_lock_acquire();
+    int queue = 0;
+    if (process->state == PROCESS_BLOCKED) {
+        process->priority = 0;
+        set_state_locked(process, PROCESS_READY);
+        queue = !process->on_cpu;
+    }
+    sched_lock_release(flags);
+    if (queue) {
+        ready_enqueue(process);
+    }
+}
 
-// String functions (copied from string.c for now)
-static void strcpy_local(char* dest, const char* src) {
-    while (*src) {
-        *dest++ = *src++;
+// process_wake, and if the woken process now outranks the task running
+// here, end that task's slice so the switch happens on the way out of the
+// current interrupt rather than at its next tick (keyboard input for the
+// shell). The task loses the rest of its slice but not its level.
+void process_wake_preempt(process_t* process) {
+    process_wake(process);
+    if (!scheduler_preemptive || !process) {
+        return;
+    }
+    uint32_t flags = irq_save();
+    cpu_t* cpu = smp_current_cpu();
+    process_t* running = cpu->current;
+    bool here = process_allowed(process, cpu->id);
+    if (here && running && running != process && process->state == PROCESS_READY &&
+        (running == cpu->idle || (!running->dl.period && process->priority < running->priority))) {
+        running->time_slice = 0;
+        cpu->need_resched = 1;
+        stat_inc(&stat_sched_wake_preempts);
     }
-    *dest = '\0';
+    irq_restore(flags);
 }
 
-static int simple_strcmp(const char* str1, const char* str2) {
-    while (*str1 && *str2 && *str1 == *str2) {
-        str1++;
-        str2++;
+// Wake target and hand it the caller's CPU at once, without the ready
+// queues: target is claimed (on_cpu) so no queue holds it and no other
+// CPU can pick it. Falls back to process_wake and an ordinary yield when
+// target isn't simply blocked, its mask leaves out this CPU, or there is no
+// preemption.
+void process_yield_to(process_t* target) {
+    uint32_t irq_flags = irq_save();
+    cpu_t* cpu = smp_current_cpu();
+    bool direct = false;
+    if (scheduler_preemptive && target && current_process && target != current_process &&
+        !handoff_next[cpu->id] && process_allowed(target, cpu->id)) {
+        uint32_t flags = sched_lock_acquire();
+        direct = target->state == PROCESS_BLOCKED && !target->on_cpu;
+        if (direct) {
+            target->priority = 0;
+            set_state_locked(target, PROCESS_READY);
+            target->on_cpu = 1;
+        }
+        sched_lock_release(flags);
     }
-    return *str1 - *str2;
+    if (direct) {
+        handoff_next[cpu->id] = target;     // Whichever reschedule comes first takes it
+        stat_inc(&stat_sched_handoffs);
+    } else if (target) {
+        process_wake(target);
+    }
+    irq_restore(irq_flags);
+    process_yield();
+}
+
+// The task process_yield_to left for this CPU, if it is still there to run
+static process_t* handoff_take(cpu_t* cpu) {
+    process_t* next = handoff_next[cpu->id];
+    if (!next) {
+        return NULL;
+    }
+    handoff_next[cpu->id] = NULL;
+    uint32_t flags = sched_lock_acquire();
+    bool runnable = next->state == PROCESS_READY;
+    if (!runnable) {
+        next->on_cpu = 0;               // Killed meanwhile; the reaper may have it
+    }
+    sched_lock_release(flags);
+    return runnable ? next : NULL;
+}
+
+// Runs on the new stack after every interrupt-driven switch: the process
+// that was left is no longer on its stack, so it may be queued (and
+// stolen) or freed now
+void process_finish_switch(void) {
+    cpu_t* cpu = smp_current_cpu();
+    process_t* prev = cpu->switched_from;
+    if (!prev) {
+        return;
+    }
+    cpu->switched_from = NULL;
+    
+    uint32_t flags = sched_lock_acquire();
+    prev->on_cpu = 0;
+    int queue = (prev->state == PROCESS_READY);
+    sched_lock_release(flags);
+    if (queue) {
+        ready_enqueue(prev);
+    }
+}
+
+// Idle task for a CPU, run whenever it has nothing else to do: an AP's
+// runs smp_ap_main's halt loop on its boot stack, CPU 0's the loop below
+process_t* process_idle_task(uint32_t cpu) {
+    process_t* idle = &idle_tasks[cpu];
+    idle->info = &idle_infos[cpu];
+    idle->pid = KERNEL_PID;
+    idle->parent_pid = INVALID_PID;
+    idle->state = PROCESS_RUNNING;
+    strcpy(idle->info->name, "idle0");
+    idle->info->name[4] = (char)('0' + cpu);
+    idle->page_directory = kernel_page_directory;
+    idle->slot = -1;
+    idle->cpu = (int)cpu;
+    idle->cpumask = PROCESS_CPU(cpu);
+    idle->on_cpu = 1;
+    return idle;
+}
+
+// Where a process's entry function returns to
+static void process_entry_return(void) {
+    process_exit(0);
+    
+    // Terminated - the next timer tick switches away for good
+    while (1) {
+        asm volatile ("sti; hlt");
+    }
+}
+
+// Give a process its own stack, laid out so it can be started either by
+// the timer (an interrupt frame to iret through) or by switch_context.
+// arg sits where a cdecl entry_point finds its first argument.
+static int process_setup_stack(process_t* process, void (*entry_point)(void), void* arg) {
+    uint32_t* stack = (uint32_t*)kstack_alloc();
+    if (!stack) {
+        return -1;
+    }
+    process->stack = stack;
+    process->stack_size = STACK_SIZE;
+    process->info->memory_usage = STACK_SIZE;
+    
+    uint32_t* top = (uint32_t*)((uint8_t*)stack + STACK_SIZE);
+    *--top = (uint32_t)arg;
+    *--top = (uint32_t)process_entry_return;    // Return address of entry_point
+    process->context.esp = (uint32_t)top;
+    
+    // Frame popped by irq_common_stub: iret state, int_no/err_code, pusha, ds
+    *--top = DEFAULT_EFLAGS;
+    *--top = KERNEL_CODE_SELECTOR;
+    *--top = (uint32_t)entry_point;
+    *--top = 0;                                 // Error code
+    *--top = 32;                                // IRQ0
+    for (int i = 0; i < 8; i++) {
+        *--top = 0;                             // EAX..EDI
+    }
+    *--top = KERNEL_DATA_SELECTOR;
+    process->saved_esp = (uint32_t)top;
+    process->context.ds = KERNEL_DATA_SELECTOR;
+    process->context.es = KERNEL_DATA_SELECTOR;
+    process->context.fs = KERNEL_DATA_SELECTOR;
+    process->context.gs = GDT_KERNEL_PERCPU;
+    process->context.ss = KERNEL_DATA_SELECTOR;
+    process->time_slice = level_quantum(0);
+    return 0;
+}
+
+// CPU 0's idle task. The boot stack belongs to the kernel task, so this
+// one runs on a stack from the pool, doing between other tasks what the
+// shell loop does between keys when it can't sleep.
+static void process_boot_idle_main(void) {
+    while (1) {
+        reclaim_idle();
+        pmm_zero_pool_fill(PMM_ZERO_FILL_BATCH);
+        workqueue_idle();
+        timer_idle();
+    }
+}
+
+static void process_boot_idle_start(void) {
+    if (smp_current_cpu()->idle) {
+        return;  // proc init again
+    }
+    process_t* idle = process_idle_task(0);
+    if (process_setup_stack(idle, process_boot_idle_main, NULL) != 0) {
+        terminal_writestring("[PROCESS] No stack for idle0 - the shell will poll\n");
+        return;
+    }
+    uint32_t flags = irq_save();
+    smp_current_cpu()->idle = idle;
+    irq_restore(flags);
+}
+
+// First run of a ring 3 process when switch_context starts it: drop to
+// the interrupt frame process_setup_user_stack built
+static void process_user_start(void) {
+    enter_user_frame(current_process->saved_esp);
+}
+
+// A ring 3 process's kernel stack holds nothing but the frame that irets
+// to entry_point on the user stack, with the user segments loaded
+static int process_setup_user_stack(process_t* process, void (*entry_point)(void)) {
+    if (process_setup_stack(process, entry_point, NULL) != 0) {
+        return -1;
+    }
+    uint32_t* top = (uint32_t*)((uint8_t*)process->stack + STACK_SIZE);
+    *--top = GDT_USER_DATA;                     // SS
+    *--top = USER_STACK_TOP;                    // ESP
+    *--top = USER_EFLAGS;
+    *--top = GDT_USER_CODE;
+    *--top = (uint32_t)entry_point;
+    *--top = 0;                                 // Error code
+    *--top = 32;                                // IRQ0
+    for (int i = 0; i < 8; i++) {
+        *--top = 0;                             // EAX..EDI
+    }
+    *--top = GDT_USER_DATA;
+    process->saved_esp = (uint32_t)top;
+    process->context.esp = (uint32_t)top;       // Below the frame, which it never returns to
+    process->context.eip = (uint32_t)process_user_start;
+    return 0;
 }
 
 // Initialize process management system
+static int process_yield_irq(void* ctx) {
+    (void)ctx;
+    return IRQ_HANDLED | IRQ_YIELD;
+}
+
 void process_init(void) {
     // Prevent double initialization
     if (process_system_initialized) {
@@ -53,128 +913,103 @@ void process_init(void) {
         heap_init();
     }
     
-    terminal_writestring("[PROCESS] Forcing complete process table reset...\n");
-    
-    // AGGRESSIVE CLEAR: Zero out entire process table first
-    uint8_t* table_ptr = (uint8_t*)process_table;
-    for (size_t i = 0; i < sizeof(process_table); i++) {
-        table_ptr[i] = 0;
+    // Process stacks come from their own guard-paged pool
+    kstack_init();
+    fpu_init();
+    smp_init();
+    irq_register(PROCESS_YIELD_VECTOR - IRQ_VECTOR_BASE, process_yield_irq, NULL);
+    
+    terminal_writestring("[PROCESS] Resetting process table...\n");
+    
+    // Start from an empty table with one chunk of free slots
+    ticket_lock_init(&sched_lock, "sched");
+    process_table_size = 0;
+    free_slot_count = 0;
+    live_processes = 0;
+    zombie_list = NULL;
+    for (int i = 0; i < PROCESS_HASH_BUCKETS; i++) {
+        pid_hash[i] = NULL;
     }
-    
-    // Then explicitly set INVALID_PID for each slot
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        process_table[i].pid = INVALID_PID;  // -1
-        process_table[i].parent_pid = INVALID_PID;
-        process_table[i].state = PROCESS_TERMINATED;
-        process_table[i].stack = NULL;
-        process_table[i].stack_size = 0;
-        process_table[i].next = NULL;
-        process_table[i].creation_time = 0;
-        process_table[i].cpu_time = 0;
-        process_table[i].exit_code = 0;
-        process_table[i].memory_usage = 0;
-        // Clear name
-        for (int j = 0; j < 32; j++) {
-            process_table[i].name[j] = '\0';
-        }
+    for (int i = 0; i < PROCESS_STATE_COUNT; i++) {
+        state_counts[i] = 0;
     }
-    
-    // Verify all slots are INVALID_PID
-    terminal_printf("[PROCESS] Verifying slots (INVALID_PID = %d):\n", INVALID_PID);
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        terminal_printf("  Slot %d: PID=%d\n", i, process_table[i].pid);
-        if (process_table[i].pid != INVALID_PID) {
-            terminal_printf("[ERROR] Slot %d still has PID %d!\n", i, process_table[i].pid);
+    table_grow();
+    
+    // Initialize queues
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        run_queue_t* rq = &run_queues[cpu];
+        for (int level = 0; level < PROCESS_PRIORITY_LEVELS; level++) {
+            rq->heads[level] = NULL;
+            rq->tails[level] = NULL;
         }
+        rq->bitmap = 0;
+        rq->count = 0;
+        strcpy(rq->name, "runqueue0");
+        rq->name[8] = (char)('0' + cpu);
+        spin_lock_init(&rq->lock, rq->name);
     }
+    ticks_since_boost = 0;
     
-    // Initialize queue
-    ready_queue_head = NULL;
-    ready_queue_tail = NULL;
-    
-    // Setup kernel process (Day 15 enhanced) - ONLY slot 0
+    // Setup kernel process (Day 15 enhanced) - always slot 0
     terminal_writestring("[PROCESS] Setting up kernel process...\n");
-    current_process = &process_table[KERNEL_PID];
-    current_process->pid = KERNEL_PID;  // This is 0
+    percpu_write(current, slot_alloc(KERNEL_PID, PROCESS_RUNNING));
     current_process->parent_pid = INVALID_PID;
-    current_process->state = PROCESS_RUNNING;
-    strcpy_local(current_process->name, "kernel");
+    strcpy(current_process->info->name, "kernel");
     current_process->stack = NULL;  // Kernel uses current stack
     current_process->stack_size = 0;
     current_process->next = NULL;
-    current_process->creation_time = get_uptime_seconds();
+    current_process->info->creation_time = get_uptime_seconds();
     current_process->cpu_time = 0;
-    current_process->exit_code = 0;
-    current_process->memory_usage = 0;
-    
-    // Final verification: ALL other slots must be INVALID_PID
-    terminal_writestring("[PROCESS] Final verification...\n");
-    int errors = 0;
-    for (int i = 1; i < MAX_PROCESSES; i++) {
-        if (process_table[i].pid != INVALID_PID) {
-            terminal_printf("[ERROR] Slot %d has PID %d (should be %d)\n", i, process_table[i].pid, INVALID_PID);
-            process_table[i].pid = INVALID_PID;  // Force correct
-            errors++;
-        }
-    }
-    
-    if (errors == 0) {
-        terminal_writestring("[PROCESS] ✓ All slots correctly initialized\n");
-    } else {
-        terminal_printf("[PROCESS] Fixed %d slot initialization errors\n", errors);
-    }
+    current_process->info->exit_code = 0;
+    current_process->info->memory_usage = 0;
+    current_process->page_directory = kernel_page_directory;
+    current_process->time_slice = scheduler_quantum;
+    current_process->cpu = 0;
+    current_process->cpumask = PROCESS_CPU(0);  // Owns the shell, the PIC and the BSP
+    current_process->on_cpu = 1;
+    fpu_state_alloc(current_process);
     
     // Mark system as initialized
     process_system_initialized = 1;
     
     terminal_writestring("[PROCESS] ✓ Process system initialization complete\n");
-    terminal_printf("[PROCESS] ✓ Kernel process ready (PID: %d)\n", current_process->pid);
-    
-    // Final debug count
-    int debug_active = 0;
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].pid != INVALID_PID) {
-            debug_active++;
-        }
-    }
-    terminal_printf("[DEBUG] ✓ Active processes: %d (should be 1)\n", debug_active);
+    terminal_printf("[PROCESS] ✓ Kernel process ready (PID: %d, slot %d)\n",
+                   current_process->pid, current_process->slot);
+    terminal_printf("[PROCESS] Table: %d slots, grows to %d\n", process_table_size, MAX_PROCESSES);
+    
+    // Bottom halves that need a process context run here
+    workqueue_start();
+    reaper_start();
+    process_boot_idle_start();
 }
 
 // Phase 2: Simple process creation without stack allocation
 int process_create_simple(void (*entry_point)(void), const char* name) {
     terminal_printf("[PHASE2] Starting simple process creation for '%s'\n", name);
     
-    // Find free slot in process table
-    int slot = INVALID_PID;
-    for (int i = FIRST_USER_PID; i < MAX_PROCESSES; i++) {
-        if (process_table[i].pid == INVALID_PID) {
-            slot = i;
-            terminal_printf("[PHASE2] Found free slot: %d\n", slot);
-            break;
-        }
-    }
-    
-    if (slot == INVALID_PID) {
+    // Take a free slot from the process table
+    process_t* process = slot_alloc(next_pid, PROCESS_CREATED);
+    if (!process) {
         terminal_writestring("[PHASE2] ERROR: Process table full\n");
         return INVALID_PID;
     }
+    terminal_printf("[PHASE2] Found free slot: %d\n", process->slot);
     
     // Initialize process (Phase 2: NO STACK ALLOCATION)
-    process_t* process = &process_table[slot];
     int new_pid = next_pid++;
     
-    process->pid = new_pid;
     process->parent_pid = current_process ? current_process->pid : INVALID_PID;
-    process->state = PROCESS_CREATED;
-    strcpy_local(process->name, name);
-    process->creation_time = get_uptime_seconds();
+    strcpy(process->info->name, name);
+    process->info->creation_time = get_uptime_seconds();
     process->cpu_time = 0;
-    process->exit_code = 0;
+    process->info->exit_code = 0;
     
     // Phase 2: NO stack allocation - use kernel stack
     process->stack = NULL;
     process->stack_size = 0;
-    process->memory_usage = 0;
+    process->info->memory_usage = 0;
+    process_new_directory(process);
+    fpu_state_alloc(process);
     
     // Minimal context (not used in Phase 2)
     process->context.esp = 0;
@@ -183,7 +1018,7 @@ int process_create_simple(void (*entry_point)(void), const char* name) {
     process->context.eflags = DEFAULT_EFLAGS;
     
     // Set state to ready but DON'T add to ready queue yet
-    process->state = PROCESS_READY;
+    process_set_state(process, PROCESS_READY);
     process->next = NULL;
     
     terminal_printf("[PHASE2] Created process '%s' (PID: %d) without stack\n", name, new_pid);
@@ -217,24 +1052,28 @@ int process_execute_simple(int pid) {
     
     // Change state to RUNNING
     process_t* old_current = current_process;
-    current_process = process;
-    process->state = PROCESS_RUNNING;
+    percpu_write(current, process);
+    process_set_state(process, PROCESS_RUNNING);
     
     terminal_setcolor(vga_entry_color(VGA_COLOR_YELLOW, VGA_COLOR_BLACK));
-    terminal_printf("[PHASE3] Executing process '%s' (PID: %d)...\n", process->name, pid);
+    terminal_printf("[PHASE3] Executing process '%s' (PID: %d)...\n", process->info->name, pid);
     terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
     
     // Execute the process function directly
+    process_activate(process);
     entry_point();
     
     // Process completed - restore state and mark as terminated
-    current_process = old_current;
-    process->state = PROCESS_TERMINATED;
-    process->exit_code = 0;  // Normal termination
+    percpu_write(current, old_current);
+    if (old_current) {
+        process_activate(old_current);
+    }
+    process_set_state(process, PROCESS_TERMINATED);
+    process->info->exit_code = 0;  // Normal termination
     
     terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
     terminal_printf("[PHASE3] Process '%s' (PID: %d) completed successfully\n", 
-                   process->name, pid);
+                   process->info->name, pid);
     terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
     
     return 0;
@@ -249,22 +1088,24 @@ int process_run_all_ready(void) {
     int executed_count = 0;
     
     // First pass: count and display ready processes
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].pid != INVALID_PID && process_table[i].state == PROCESS_READY) {
+    for (int i = 0; i < process_table_size; i++) {
+        process_t* process = process_slot(i);
+        if (process->pid != INVALID_PID && process->state == PROCESS_READY) {
             terminal_printf("[PHASE4] Found ready process: '%s' (PID: %d)\n", 
-                           process_table[i].name, process_table[i].pid);
+                           process->info->name, process->pid);
         }
     }
     
     // Second pass: execute all ready processes
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].pid != INVALID_PID && process_table[i].state == PROCESS_READY) {
+    for (int i = 0; i < process_table_size; i++) {
+        process_t* process = process_slot(i);
+        if (process->pid != INVALID_PID && process->state == PROCESS_READY) {
             terminal_setcolor(vga_entry_color(VGA_COLOR_YELLOW, VGA_COLOR_BLACK));
             terminal_printf("\n[PHASE4] === Executing process %d/%d ===\n", 
                            executed_count + 1, process_count_by_state(PROCESS_READY));
             terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
             
-            int result = process_execute_simple(process_table[i].pid);
+            int result = process_execute_simple(process->pid);
             if (result == 0) {
                 executed_count++;
                 terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
@@ -288,110 +1129,153 @@ int process_run_all_ready(void) {
     return executed_count;
 }
 
-// Original process create (kept for compatibility)
-int process_create(void (*entry_point)(void), const char* name) {
-    terminal_printf("[DEBUG] Starting process creation for '%s'\n", name);
-    terminal_printf("[DEBUG] Current next_pid: %d\n", next_pid);
-    
-    // Check process table state BEFORE creation
-    int pre_active = 0;
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].pid != INVALID_PID) {
-            pre_active++;
-            terminal_printf("[DEBUG] Pre-creation: Slot %d has PID %d\n", i, process_table[i].pid);
-        }
-    }
-    terminal_printf("[DEBUG] Active processes before creation: %d\n", pre_active);
-    
-    // Find free slot in process table
-    int slot = INVALID_PID;
-    for (int i = FIRST_USER_PID; i < MAX_PROCESSES; i++) {
-        if (process_table[i].pid == INVALID_PID) {
-            slot = i;
-            terminal_printf("[DEBUG] Found free slot: %d\n", slot);
-            break;
-        }
-    }
-    
-    if (slot == INVALID_PID) {
+// A kernel-mode process on its own pooled stack, entered with arg
+static int process_spawn_kernel(void (*entry_point)(void), void* arg, const char* name) {
+    // Take a free slot from the process table
+    process_t* process = slot_alloc(next_pid, PROCESS_CREATED);
+    if (!process) {
         terminal_writestring("[PROCESS] ERROR: Process table full\n");
         return INVALID_PID;
     }
     
-    // Initialize process (Day 15 enhanced) with EXTRA SAFETY
-    process_t* process = &process_table[slot];
-    terminal_printf("[DEBUG] Before setting PID, slot %d has PID %d\n", slot, process->pid);
-    
     int new_pid = next_pid++;
-    process->pid = new_pid;
-    terminal_printf("[DEBUG] Set new PID %d to slot %d\n", new_pid, slot);
+    TRACE(TRACE_PROC_CREATE, new_pid, process->slot);
+    stat_inc(&stat_proc_created);
     
     process->parent_pid = current_process ? current_process->pid : INVALID_PID;
-    process->state = PROCESS_CREATED;
-    strcpy_local(process->name, name);
-    process->creation_time = get_uptime_seconds();
+    strcpy(process->info->name, name);
+    process->info->creation_time = get_uptime_seconds();
     process->cpu_time = 0;
-    process->exit_code = 0;
-    
-    terminal_printf("[DEBUG] After setting fields, process PID: %d\n", process->pid);
-    
-    // SKIP stack allocation for now - use static stack
-    terminal_writestring("[DEBUG] Skipping stack allocation to avoid memory corruption\n");
-    process->stack = NULL;  // Use kernel stack for now
-    process->stack_size = 0;
-    process->memory_usage = 0;
-    
-    // CHECK: Verify PID hasn't been corrupted
-    terminal_printf("[DEBUG] After stack allocation, PID: %d\n", process->pid);
+    process->info->exit_code = 0;
     
-    // Initialize context (minimal) - use current stack
-    process->context.esp = 0;  // Will use current stack
+    // Own stack, so the process can be preempted and resumed
     process->context.ebp = 0;
     process->context.eip = (uint32_t)entry_point;
     process->context.eflags = DEFAULT_EFLAGS;
-    
-    // Set state to ready and add to ready queue
-    process->state = PROCESS_READY;
-    process->next = NULL;
-    if (ready_queue_tail) {
-        ready_queue_tail->next = process;
-    } else {
-        ready_queue_head = process;
+    if (process_setup_stack(process, entry_point, arg) != 0) {
+        terminal_writestring("[PROCESS] ERROR: Out of memory for process stack\n");
+        slot_release(process);
+        return INVALID_PID;
     }
-    ready_queue_tail = process;
+    process_new_directory(process);
+    fpu_state_alloc(process);
     
-    // Final verification
-    terminal_printf("[DEBUG] Process creation complete. Final PID: %d, State: %d\n", 
-                   process->pid, process->state);
+    // Set state to ready and add to the top-level ready queue
+    process_set_state(process, PROCESS_READY);
+    process->priority = 0;
+    ready_enqueue(process);
     
-    // Check entire table state AFTER creation
-    int post_active = 0;
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].pid != INVALID_PID) {
-            post_active++;
-            if (i <= 2) {  // Only show first few for brevity
-                terminal_printf("[DEBUG] Post-creation: Slot %d has PID %d\n", i, process_table[i].pid);
-            }
+    terminal_printf("[PROCESS] Created process '%s' (PID: %d)\n", name, process->pid);
+    return process->pid;
+}
+
+// Original process create (kept for compatibility)
+int process_create(void (*entry_point)(void), const char* name) {
+    return process_spawn_kernel(entry_point, NULL, name);
+}
+
+int kthread_create(void (*fn)(void* arg), void* arg, const char* name) {
+    return process_spawn_kernel((void (*)(void))fn, arg, name);
+}
+
+// Create a process that runs entry_point (in the ring 3 image) in user
+// mode, in a directory of its own. It has to end with SYS_EXIT.
+// Map a ring 3 process's image and stack: the built-in image, or path's
+// segments with entry_point set to the file's entry
+static int process_map_user(process_t* process, const char* path, void (**entry_point)(void)) {
+    if (!path) {
+        return user_map(process->page_directory);
+    }
+    uint32_t entry;
+    int result = elf_load(process, path, &entry);
+    if (result != ELF_SUCCESS) {
+        terminal_printf("[PROCESS] ERROR: Can't load '%s' (%s)\n", path,
+                        result == ELF_ERROR_IO ? "unreadable" :
+                        result == ELF_ERROR_FORMAT ? "not a static i386 executable" : "no space");
+        return -1;
+    }
+    *entry_point = (void (*)(void))entry;
+    return user_map_stack(process->page_directory);
+}
+
+static int process_spawn_user(void (*entry_point)(void), const char* path, const char* name) {
+    process_t* process = slot_alloc(next_pid, PROCESS_CREATED);
+    if (!process) {
+        terminal_writestring("[PROCESS] ERROR: Process table full\n");
+        return INVALID_PID;
+    }
+    next_pid++;
+    
+    process->parent_pid = current_process ? current_process->pid : INVALID_PID;
+    strcpy(process->info->name, name);
+    process->info->creation_time = get_uptime_seconds();
+    process->cpu_time = 0;
+    process->info->exit_code = 0;
+    process->context.ebp = 0;
+    process->context.eflags = DEFAULT_EFLAGS;
+    process->user = 1;
+    process_new_directory(process);
+    if (process->page_directory == kernel_page_directory ||
+        process_map_user(process, path, &entry_point) != 0 ||
+        process_setup_user_stack(process, entry_point) != 0) {
+        terminal_writestring("[PROCESS] ERROR: No address space for user process\n");
+        elf_release_owned(process);
+        vmm_release_areas(&process->vm_space);
+        process->vm_space.dir = NULL;
+        if (process->page_directory != kernel_page_directory) {
+            vmm_destroy_directory(process->page_directory);
+        }
+        process->page_directory = NULL;
+        if (process->stack) {
+            kstack_free(process->stack);
+            process->stack = NULL;
         }
+        slot_release(process);
+        return INVALID_PID;
     }
-    terminal_printf("[DEBUG] Active processes after creation: %d\n", post_active);
+    fpu_state_alloc(process);
     
-    terminal_printf("[PROCESS] Created process '%s' (PID: %d)\n", name, process->pid);
+    process_set_state(process, PROCESS_READY);
+    process->priority = 0;
+    ready_enqueue(process);
+    
+    terminal_printf("[PROCESS] Created user process '%s' (PID: %d)\n", name, process->pid);
     return process->pid;
 }
 
+int process_create_user(void (*entry_point)(void), const char* name) {
+    if (!process_system_initialized || !kernel_page_directory || !user_is_entry(entry_point)) {
+        terminal_writestring("[PROCESS] ERROR: User processes need paging and a ring 3 entry point\n");
+        return INVALID_PID;
+    }
+    return process_spawn_user(entry_point, NULL, name);
+}
+
+int process_create_elf(const char* path, const char* name) {
+    if (!process_system_initialized || !kernel_page_directory) {
+        terminal_writestring("[PROCESS] ERROR: User processes need paging\n");
+        return INVALID_PID;
+    }
+    return process_spawn_user(NULL, path, name);
+}
+
 // Find process by PID (Day 15)
 process_t* process_find(int pid) {
-    if (pid < 0 || pid >= MAX_PROCESSES) {
+    if (pid < 0 || !process_system_initialized) {
         return NULL;
     }
     
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].pid == pid && process_table[i].pid != INVALID_PID) {
-            return &process_table[i];
+    // Lock-free: slots only leave a chain a grace period before reuse
+    uint32_t flags = rcu_read_lock();
+    process_t* found = NULL;
+    for (process_t* p = rcu_dereference(pid_hash[pid_bucket(pid)]); p; p = rcu_dereference(p->hash_next)) {
+        if (p->pid == pid) {
+            found = p;
+            break;
         }
     }
-    return NULL;
+    rcu_read_unlock(flags);
+    return found;
 }
 
 // Get process state as string (Day 15)
@@ -406,24 +1290,142 @@ const char* process_state_string(process_state_t state) {
     }
 }
 
-// Enhanced process exit (Day 15)
+// Enhanced process exit (Day 15)
+static void process_reap(process_t* process);
+
+// Wake everything sleeping in process_wait for process, which has just
+// terminated (or stopped, for process_wait_job). Waiters are taken one at
+// a time: a woken one may wait again.
+static void process_notify_exit(process_t* process) {
+    while (1) {
+        uint32_t flags = sched_lock_acquire();
+        process_t* waiter = process->exit_waiters;
+        if (waiter) {
+            process->exit_waiters = waiter->wait_next;
+            waiter->wait_next = NULL;
+            waiter->wait_child = NULL;
+        }
+        sched_lock_release(flags);
+        if (!waiter) {
+            return;
+        }
+        process_wake(waiter);
+    }
+}
+
+// Drop a killed process from the waiters of the process it waits for
+static void process_cancel_exit_wait(process_t* process) {
+    uint32_t flags = sched_lock_acquire();
+    process_t* child = process->wait_child;
+    if (child) {
+        process_t** link = &child->exit_waiters;
+        while (*link && *link != process) {
+            link = &(*link)->wait_next;
+        }
+        if (*link) {
+            *link = process->wait_next;
+        }
+        process->wait_next = NULL;
+        process->wait_child = NULL;
+    }
+    sched_lock_release(flags);
+}
+
+// Whether a process_wait caller for child can stop waiting
+static inline bool process_wait_done(process_t* child, int pid, bool stops) {
+    if (child->pid != pid) {
+        return true;
+    }
+    if (stops && child->stopped && child->state != PROCESS_TERMINATED) {
+        return true;
+    }
+    return child->state == PROCESS_TERMINATED && !child->on_cpu;
+}
+
+// Sleep until the caller's child pid has terminated, then reap it: no
+// table scan, the child is taken straight off the zombie list. Returns
+// pid with its exit code in *status, or -1 if pid is no (longer a) child.
+// A caller that can't sleep idles between interrupts instead.
+static int process_wait_common(int pid, int* status, bool stops) {
+    process_t* self = current_process;
+    process_t* child = process_find(pid);
+    if (!self || !child || child == self || child->parent_pid != self->pid) {
+        return -1;
+    }
+    
+    // Queued under the scheduler lock, so the exit (or stop) can't slip past
+    bool can_sleep = process_can_block();
+    uint32_t flags = sched_lock_acquire();
+    bool sleeping = can_sleep && child->state != PROCESS_TERMINATED && !(stops && child->stopped);
+    if (sleeping) {
+        self->wait_child = child;
+        self->wait_next = child->exit_waiters;
+        child->exit_waiters = self;
+        set_state_locked(self, PROCESS_BLOCKED);
+    }
+    sched_lock_release(flags);
+    if (sleeping) {
+        process_sleep_while(self->wait_child, child);
+    }
+    
+    // Terminated and off its CPU's stack (or stopped, waiting for a job)
+    while (!process_wait_done(child, pid, stops)) {
+        if (scheduler_preemptive) {
+            asm volatile ("sti; hlt");
+        } else {
+            process_yield();
+        }
+    }
+    if (stops && child->pid == pid && child->state != PROCESS_TERMINATED) {
+        return PROCESS_WAIT_STOPPED;
+    }
+    
+    flags = sched_lock_acquire();
+    bool mine = child->pid == pid && child->state == PROCESS_TERMINATED && zombie_linked(child);
+    if (mine) {
+        zombie_unlink(child);
+    }
+    int exit_code = child->info->exit_code;
+    sched_lock_release(flags);
+    if (!mine) {
+        return -1;  // Reaped by a cleanup meanwhile
+    }
+    if (status) {
+        *status = exit_code;
+    }
+    process_reap(child);
+    return pid;
+}
+
+int process_wait(int pid, int* status) {
+    return process_wait_common(pid, status, false);
+}
+
+int process_wait_job(int pid, int* status) {
+    return process_wait_common(pid, status, true);
+}
+
 void process_exit(int exit_code) {
     if (!current_process || current_process->pid == KERNEL_PID) {
         terminal_writestring("[PROCESS] Cannot exit kernel process\n");
         return;
     }
     
-    current_process->state = PROCESS_TERMINATED;
-    current_process->exit_code = exit_code;
+    current_process->info->exit_code = exit_code;    // Before a waiter can see the state
+    current_process->info->exit_tick = timer_get_ticks();
+    mutex_release_owned(current_process);
+    process_set_state(current_process, PROCESS_TERMINATED);
     
-    // Free stack memory
-    if (current_process->stack) {
-        kfree(current_process->stack);
+    // A preempted process is still running on its stack - cleanup frees it
+    if (current_process->stack && !scheduler_preemptive) {
+        kstack_free(current_process->stack);
         current_process->stack = NULL;
     }
     
     terminal_printf("[PROCESS] Process '%s' (PID: %d) exited with code %d\n", 
-                   current_process->name, current_process->pid, exit_code);
+                   current_process->info->name, current_process->pid, exit_code);
+    process_notify_exit(current_process);
+    reaper_kick();
     
     // Simple implementation: just mark as terminated
     // In a full OS, we would switch to another process here
@@ -447,27 +1449,153 @@ void process_kill(int pid) {
         return;
     }
     
-    process->state = PROCESS_TERMINATED;
-    process->exit_code = -1; // Killed
-    
-    // Free stack memory
-    if (process->stack) {
-        kfree(process->stack);
+    if (process->state == PROCESS_READY) {
+        ready_remove(process);
+    } else if (process->state == PROCESS_BLOCKED) {
+        timer_cancel_sleep(process);
+        ipc_cancel_wait(process);
+        futex_cancel_wait(process);
+        mutex_cancel_wait(process);
+        pipe_cancel_wait(process);
+        channel_cancel_wait(process);
+        waitset_cancel_wait(process);
+        udp_cancel_wait(process);
+        tcp_cancel_wait(process);
+        uring_cancel_wait(process);
+        process_cancel_exit_wait(process);
+    }
+    process->info->exit_code = -1; // Killed
+    process->info->exit_tick = timer_get_ticks();
+    mutex_release_owned(process);
+    process_set_state(process, PROCESS_TERMINATED);
+    
+    // Free stack memory (cleanup does it once a running process is off its CPU)
+    if (process->stack && !process->on_cpu) {
+        kstack_free(process->stack);
         process->stack = NULL;
     }
     
-    terminal_printf("[PROCESS] Killed process '%s' (PID: %d)\n", process->name, pid);
+    terminal_printf("[PROCESS] Killed process '%s' (PID: %d)\n", process->info->name, pid);
+    process_notify_exit(process);
+    reaper_kick();
+}
+
+// Send sig to pid. SIGCONT and a signal for a process off every CPU act at
+// once; one that is running has it queued and taken by
+// process_take_signals at its next preemption, which is asked for now if
+// it runs on this CPU.
+int process_signal(int pid, int sig) {
+    process_t* process = process_find(pid);
+    if (!process || process->pid == KERNEL_PID || process->state == PROCESS_TERMINATED) {
+        return -1;
+    }
+    if (sig == SIGCONT) {
+        __sync_fetch_and_and(&process->signals, ~SIGNAL_BIT(SIGTSTP));
+        if (process->stopped) {
+            process->stopped = 0;
+            process_wake(process);
+        }
+        return 0;
+    }
+    if (sig != SIGINT && sig != SIGTSTP) {
+        return -1;
+    }
+    
+    if (process->stopped && sig == SIGTSTP) {
+        return 0;
+    }
+    if (sig == SIGTSTP && process->state == PROCESS_READY && ready_remove(process)) {
+        process->stopped = 1;
+        process_set_state(process, PROCESS_BLOCKED);
+        process_notify_exit(process);
+        return 0;
+    }
+    if (sig == SIGINT && !process->on_cpu) {
+        process_kill(pid);
+        return 0;
+    }
+    
+    __sync_fetch_and_or(&process->signals, SIGNAL_BIT(sig));
+    uint32_t flags = irq_save();
+    cpu_t* cpu = smp_current_cpu();
+    if (cpu->current == process) {
+        process->time_slice = 0;
+        cpu->need_resched = 1;
+    }
+    irq_restore(flags);
+    return 0;
+}
+
+// Act on the signals queued for the task leaving this CPU, which was
+// interrupted with interrupts on and so holds no spinlock
+static void process_take_signals(process_t* process) {
+    uint32_t pending = __sync_lock_test_and_set(&process->signals, 0);
+    if (pending & SIGNAL_BIT(SIGINT)) {
+        process_kill(process->pid);
+    } else if ((pending & SIGNAL_BIT(SIGTSTP)) && process->state == PROCESS_RUNNING) {
+        process->stopped = 1;
+        process_set_state(process, PROCESS_BLOCKED);
+        process_notify_exit(process);
+    } else if (pending & SIGNAL_BIT(SIGTSTP)) {
+        __sync_fetch_and_or(&process->signals, SIGNAL_BIT(SIGTSTP));   // Still blocking: next time
+    }
 }
 
 // Count processes by state (Day 15)
 int process_count_by_state(process_state_t state) {
-    int count = 0;
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].pid != INVALID_PID && process_table[i].state == state) {
-            count++;
+    if ((int)state < 0 || state >= PROCESS_STATE_COUNT) {
+        return 0;
+    }
+    return state_counts[state];
+}
+
+// Load readers peek rather than update: the averages belong to the CPU
+// that runs the task or owns the queue, and may be a tick or two behind
+static bool cpu_busy(uint32_t cpu) {
+    process_t* running = cpus[cpu].current;
+    return running && running != cpus[cpu].idle;
+}
+
+uint32_t process_cpu_util(uint32_t cpu) {
+    if (cpu >= SMP_MAX_CPUS || !cpus[cpu].online) {
+        return 0;
+    }
+    return load_peek(&run_queues[cpu].util, clock_ns(), cpu_busy(cpu) ? LOAD_SCALE : 0);
+}
+
+uint32_t process_cpu_load(uint32_t cpu) {
+    if (cpu >= SMP_MAX_CPUS || !cpus[cpu].online) {
+        return 0;
+    }
+    uint32_t runnable = run_queues[cpu].count + (cpu_busy(cpu) ? 1 : 0);
+    return load_peek(&run_queues[cpu].load, clock_ns(), runnable * LOAD_SCALE);
+}
+
+// A task's utilisation as of now: a running one has been earning weight
+// since its last tick, any other has been decaying since it stopped
+static uint32_t process_util(const process_t* process, uint64_t now) {
+    bool running = process->state == PROCESS_RUNNING && process->on_cpu;
+    return load_peek(&process->util, now, running ? LOAD_SCALE : 0);
+}
+
+// CPU time in ms from ns, without a 64-bit division: 2^20 ns periods
+// times 1074/1024
+static uint32_t process_run_ms(const process_t* process) {
+    return (uint32_t)(((process->run_ns >> LOAD_PERIOD_SHIFT) * 1074) >> 10);
+}
+
+// The CPUs a cpumask names, then the end of the line
+static void process_print_cpus(uint32_t cpumask) {
+    if (!cpumask) {
+        terminal_writestring(" any\n");
+        return;
+    }
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        if (cpumask & PROCESS_CPU(i)) {
+            terminal_printf(" %d", (int)i);
         }
     }
-    return count;
+    terminal_writestring("\n");
 }
 
 // Show detailed process information (Day 15)
@@ -484,31 +1612,91 @@ void process_show_info(int pid) {
     
     terminal_printf("  PID: %d\n", process->pid);
     terminal_printf("  Parent PID: %d\n", process->parent_pid);
-    terminal_printf("  Name: %s\n", process->name);
+    terminal_printf("  Name: %s\n", process->info->name);
     terminal_printf("  State: %s\n", process_state_string(process->state));
-    terminal_printf("  Creation Time: %d seconds\n", process->creation_time);
-    terminal_printf("  CPU Time: %d ticks\n", process->cpu_time);
-    terminal_printf("  Memory Usage: %d bytes\n", process->memory_usage);
+    terminal_printf("  Creation Time: %d seconds\n", process->info->creation_time);
+    terminal_printf("  CPU Time: %d ticks (%d ms)\n", process->cpu_time, (int)process_run_ms(process));
+    terminal_printf("  CPU Utilisation: %d%% (decayed)\n",
+                    (int)load_percent(process_util(process, clock_ns())));
+    terminal_printf("  Scheduler Level: %d\n", process->priority);
+    terminal_writestring("  CPU Affinity:");
+    process_print_cpus(process->cpumask);
+    terminal_printf("  Memory Usage: %d bytes\n", process->info->memory_usage);
     
     if (process->state == PROCESS_TERMINATED) {
-        terminal_printf("  Exit Code: %d\n", process->exit_code);
+        terminal_printf("  Exit Code: %d\n", process->info->exit_code);
     }
 }
 
-// Cleanup terminated processes (Day 15)
-void process_cleanup_terminated(void) {
-    int cleaned = 0;
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].pid != INVALID_PID && 
-            process_table[i].state == PROCESS_TERMINATED &&
-            process_table[i].pid != KERNEL_PID) {
-            
-            // Mark as unused
-            process_table[i].pid = INVALID_PID;
-            cleaned++;
-        }
+// Free everything a terminated process still holds and its slot; it is
+// off its CPU and already taken off the zombie list
+static void process_reap(process_t* process) {
+    waitset_release_owned(process);
+    udp_release_owned(process);
+    tcp_release_owned(process);
+    channel_release_owned(process);
+    vfs_release_owned(process);
+    uring_release_owned(process);
+    elf_release_owned(process);
+    
+    // Release the address space (never the one that is loaded)
+    ipc_shm_detach_all(process);
+    vmm_release_areas(&process->vm_space);
+    process->vm_space.dir = NULL;
+    if (process->page_directory &&
+        process->page_directory != kernel_page_directory &&
+        process->page_directory != current_page_directory) {
+        vmm_destroy_directory(process->page_directory);
+    }
+    process->page_directory = NULL;
+    if (process->stack) {
+        kstack_free(process->stack);
+        process->stack = NULL;
     }
+    fpu_state_free(process);
     
+    // Mark as unused
+    slot_release(process);
+}
+
+// Reap up to max zombies that have been terminated for min_age ticks;
+// one still on a CPU's stack or with a process_wait caller is skipped
+static int zombies_reap(int max, uint32_t min_age) {
+    int reaped = 0;
+    uint32_t now = timer_get_ticks();
+    
+    // Only terminated processes are visited, not the whole table
+    while (reaped < max) {
+        uint32_t flags = sched_lock_acquire();
+        process_t* process = zombie_list;
+        while (process && (process->on_cpu || process->exit_waiters ||
+                           now - process->info->exit_tick < min_age)) {
+            process = process->zombie_next;
+        }
+        if (process) {
+            zombie_unlink(process);
+        }
+        sched_lock_release(flags);
+        if (!process) {
+            break;
+        }
+        if (process->pid == INVALID_PID || process->pid == KERNEL_PID ||
+            process->state != PROCESS_TERMINATED) {
+            continue;
+        }
+        process_reap(process);
+        reaped++;
+    }
+    if (reaped) {
+        stat_add(&stat_proc_reaped, (int32_t)reaped);
+    }
+    return reaped;
+}
+
+// Cleanup terminated processes (Day 15). One with a process_wait caller
+// is left for it to reap, with its exit code.
+void process_cleanup_terminated(void) {
+    int cleaned = zombies_reap(MAX_PROCESSES, 0);
     if (cleaned > 0) {
         terminal_printf("[PROCESS] Cleaned up %d terminated processes\n", cleaned);
     } else {
@@ -516,40 +1704,104 @@ void process_cleanup_terminated(void) {
     }
 }
 
-// Simple process switch (round-robin)
+// The reaper: frees zombies a batch at a time, off the exit path. It
+// sleeps on its own until an exit kicks it, or on a timer while the
+// zombies it left are still in their grace period or on a CPU.
+static void reaper_main(void* arg) {
+    (void)arg;
+    while (1) {
+        while (zombies_reap(REAPER_BATCH, REAPER_GRACE_TICKS) == REAPER_BATCH) {
+            process_yield();    // Let everyone else in between batches
+        }
+        
+        uint32_t flags = spin_lock_irqsave(&reaper_lock);
+        bool idle = zombie_list == NULL;
+        if (idle) {
+            reaper_sleeping = true;
+            process_prepare_block();
+        }
+        spin_unlock_irqrestore(&reaper_lock, flags);
+        if (idle) {
+            process_yield();
+        } else {
+            timer_sleep(REAPER_RETRY_MS);
+        }
+    }
+}
+
+// A process just terminated: have the reaper look at it
+static void reaper_kick(void) {
+    uint32_t flags = spin_lock_irqsave(&reaper_lock);
+    process_t* reaper = reaper_sleeping ? process_find(reaper_pid) : NULL;
+    reaper_sleeping = false;
+    spin_unlock_irqrestore(&reaper_lock, flags);
+    if (reaper) {
+        process_wake(reaper);
+    }
+}
+
+static void reaper_start(void) {
+    reaper_pid = kthread_create(reaper_main, NULL, "kreaper");
+    process_t* reaper = process_find(reaper_pid);
+    if (reaper) {
+        reaper->priority = PROCESS_PRIORITY_LEVELS - 1;     // Below everything until a boost
+    }
+}
+
+// Bring this CPU's averages and its running task's up to now. running
+// had the CPU since the last update; next, if any, takes it over, and its
+// time off the CPU is folded in first. Called on every tick and switch.
+static void load_account(cpu_t* cpu, process_t* running, process_t* next) {
+    uint64_t now = clock_ns();
+    run_queue_t* rq = &run_queues[cpu->id];
+    bool busy = running && running != cpu->idle;
+    if (busy) {
+        if (running->exec_start && now > running->exec_start) {
+            running->run_ns += now - running->exec_start;
+        }
+        running->exec_start = now;
+        load_update(&running->util, now, LOAD_SCALE);
+    }
+    load_update(&rq->util, now, busy ? LOAD_SCALE : 0);
+    load_update(&rq->load, now, (rq->count + (busy ? 1 : 0)) * LOAD_SCALE);
+    if (next && next != cpu->idle) {
+        load_update(&next->util, now, 0);
+        next->exec_start = now;
+    }
+}
+
+// Simple process switch (highest ready level first)
 void process_switch(void) {
-    if (!ready_queue_head) {
-        return; // No processes to switch to
+    rcu_quiescent();
+    process_t* next_process = ready_dequeue();
+    if (!next_process) {
+        // No processes to switch to - spend the idle time pre-zeroing frames
+        pmm_zero_pool_fill(PMM_ZERO_FILL_BATCH);
+        return;
     }
     
-    // Get next process from queue
-    process_t* next_process = ready_queue_head;
-    ready_queue_head = ready_queue_head->next;
-    
-    if (!ready_queue_head) {
-        ready_queue_tail = NULL;
+    // Add current process back to queue (if not kernel). Without preemption
+    // the other CPUs don't schedule, so it can be queued before the switch.
+    process_t* old_process = current_process;
+    if (old_process) {
+        old_process->on_cpu = 0;
     }
-    
-    // Add current process back to queue (if not kernel)
-    if (current_process && current_process->pid != KERNEL_PID) {
-        current_process->state = PROCESS_READY;
-        current_process->next = NULL;
-        
-        if (ready_queue_tail) {
-            ready_queue_tail->next = current_process;
-        } else {
-            ready_queue_head = current_process;
-        }
-        ready_queue_tail = current_process;
+    if (old_process && old_process->pid != KERNEL_PID &&
+        old_process->state == PROCESS_RUNNING) {
+        process_set_state(old_process, PROCESS_READY);
+        ready_enqueue(old_process);
     }
     
     // Switch to next process
-    process_t* old_process = current_process;
-    current_process = next_process;
-    current_process->state = PROCESS_RUNNING;
+    load_account(smp_current_cpu(), old_process, next_process);
+    percpu_write(current, next_process);
+    process_set_state(current_process, PROCESS_RUNNING);
     
-    terminal_printf("[PROCESS] Switch: PID %d -> PID %d\n", 
-                   old_process ? old_process->pid : 0, current_process->pid);
+    TRACE(TRACE_SWITCH, old_process ? old_process->pid : 0, current_process->pid);
+    stat_inc(&stat_sched_switches);
+    
+    // Kernel pages are global, so the CR3 reload keeps their TLB entries
+    process_activate(current_process);
     
     // Context switch (assembly function)
     if (old_process) {
@@ -559,137 +1811,252 @@ void process_switch(void) {
 
 // Yield CPU 
 void process_yield(void) {
+    if (scheduler_preemptive && current_process) {
+        // Give up the rest of the slice without being demoted
+        current_process->time_slice = 0;
+        asm volatile ("int %0" : : "i" (PROCESS_YIELD_VECTOR));
+        return;
+    }
     process_switch();
 }
 
-// Legacy function removed - replaced with enhanced process_exit(int exit_code)
+// Timer-tick scheduling, on every CPU. esp is the interrupted task's
+// register frame; the return value is the frame to resume, belonging to the
+// next task once the current one has used up its quantum (or stopped
+// running). The task left behind is queued by process_finish_switch.
+uint32_t process_preempt(uint32_t esp) {
+    cpu_t* cpu = smp_current_cpu();
+    rcu_quiescent();                    // Interrupted with interrupts on: outside any reader
+    process_t* old_process = cpu->current;
+    if (!old_process || !process_system_initialized) {
+        return esp;
+    }
+    old_process->cpu_time++;
+    cpu->ticks++;
+    load_account(cpu, old_process, NULL);
+    
+    // Deadline budgets: the running task's is charged, throttled ones refilled
+    uint32_t now = timer_get_ticks();
+    if (old_process->dl.period && old_process->state == PROCESS_RUNNING) {
+        dl_charge(old_process, now);
+    }
+    if (cpu->id == 0) {
+        dl_replenish(now);
+    }
+    
+    // Periodic reset so demoted tasks can't starve
+    if (scheduler_preemptive && cpu->id == 0 && ++ticks_since_boost >= PROCESS_BOOST_INTERVAL) {
+        ticks_since_boost = 0;
+        ready_boost_all();
+    }
+    return process_reschedule(esp);
+}
 
-// Enhanced process list (Day 15)
-void process_list(void) {
-    terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK));
-    terminal_writestring("Process List (Day 15 Enhanced)\n");
-    terminal_writestring("==============================\n");
-    terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+uint32_t process_reschedule(uint32_t esp) {
+    cpu_t* cpu = smp_current_cpu();
+    process_t* old_process = cpu->current;
+    if (!old_process || !process_system_initialized) {
+        return esp;
+    }
     
-    terminal_writestring("PID  PPID State      Name           CPU    Memory   Time\n");
-    terminal_writestring("---  ---- ---------  -------------- ------ -------- -----\n");
-    
-    // Quick debug check BEFORE displaying anything
-    terminal_printf("[DEBUG] Process List Check (INVALID_PID = %d):\n", INVALID_PID);
-    int debug_count = 0;
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].pid != INVALID_PID) {
-            debug_count++;
-            terminal_printf("[DEBUG] ✓ Slot %d: PID=%d, State=%s, Name='%s'\n", 
-                          i, process_table[i].pid, 
-                          process_state_string(process_table[i].state),
-                          process_table[i].name);
+    // A tick taken while softirqs run on this stack: they finish first
+    if (!scheduler_preemptive || cpu->in_softirq) {
+        return esp;
+    }
+    cpu->need_resched = 0;
+    
+    int idle = (old_process == cpu->idle);
+    if (!idle) {
+        // Blocked and woken again before it left the CPU: keep running
+        process_change_state(old_process, PROCESS_READY, PROCESS_RUNNING);
+        if (old_process->signals) {
+            process_take_signals(old_process);
+        }
+        int running = (old_process->state == PROCESS_RUNNING);
+        int preempted = running && dl_preempts(old_process);
+        
+        if (old_process->dl.period) {
+            // Runs until it yields, blocks, is throttled or an earlier deadline arrives
+            if (running && old_process->time_slice && !old_process->dl.throttled && !preempted) {
+                return esp;
+            }
         } else {
-            terminal_printf("[DEBUG] - Slot %d: INVALID (PID=%d)\n", i, process_table[i].pid);
+            if (running && old_process->time_slice > 1 && !preempted) {
+                old_process->time_slice--;
+                return esp;
+            }
+            
+            // Burning the whole quantum marks a CPU hog - drop a level,
+            // unless a mutex waiter it holds up has lent it a higher one
+            if (running && old_process->time_slice == 1 &&
+                old_process->priority < old_process->pi_level) {
+                old_process->priority++;
+            }
         }
     }
-    terminal_printf("[DEBUG] Found %d active processes\n\n", debug_count);
     
-    if (debug_count == 0) {
-        terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
-        terminal_writestring("ERROR: No processes found! System may be corrupted.\n");
-        terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
-        return;
+    process_t* next = handoff_take(cpu);
+    if (!next) {
+        next = ready_dequeue();
+    }
+    if (!next) {
+        if (idle || old_process->state == PROCESS_RUNNING || !cpu->idle) {
+            old_process->time_slice = level_quantum(old_process->priority);
+            return esp;  // Nothing else to run
+        }
+        next = cpu->idle;  // An AP whose task stopped
     }
     
-    int active_count = 0;
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].pid != INVALID_PID) {
-            process_t* proc = &process_table[i];
-            active_count++;
-            
-            // PID
-            terminal_printf("%d", proc->pid);
-            if (proc->pid < 10) terminal_writestring("   ");
-            else if (proc->pid < 100) terminal_writestring("  ");
-            else terminal_writestring(" ");
-            
-            // Parent PID
-            if (proc->parent_pid == INVALID_PID) {
-                terminal_writestring(" ---  ");
-            } else {
-                terminal_writestring(" ");
-                terminal_printf("%d", proc->parent_pid);
-                if (proc->parent_pid < 10) terminal_writestring("   ");
-                else if (proc->parent_pid < 100) terminal_writestring("  ");
-                else terminal_writestring(" ");
-            }
-            
-            // State (color coded)
-            if (proc->state == PROCESS_RUNNING) {
-                terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
-            } else if (proc->state == PROCESS_TERMINATED) {
-                terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
-            } else {
-                terminal_setcolor(vga_entry_color(VGA_COLOR_YELLOW, VGA_COLOR_BLACK));
-            }
-            
-            const char* state_str = process_state_string(proc->state);
-            terminal_writestring(" ");
-            terminal_writestring(state_str);
-            // Pad state to 9 characters
-            int state_len = 0;
-            while (state_str[state_len]) state_len++;
-            for (int pad = state_len; pad < 9; pad++) terminal_writestring(" ");
-            terminal_writestring("  ");
-            terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
-            
-            // Name
-            terminal_writestring(proc->name);
-            // Pad name to 14 characters
-            int name_len = 0;
-            while (proc->name[name_len]) name_len++;
-            for (int pad = name_len; pad < 14; pad++) terminal_writestring(" ");
-            terminal_writestring(" ");
-            
-            // CPU time
-            terminal_printf("%d", proc->cpu_time);
-            if (proc->cpu_time < 10) terminal_writestring("      ");
-            else if (proc->cpu_time < 100) terminal_writestring("     ");
-            else if (proc->cpu_time < 1000) terminal_writestring("    ");
-            else if (proc->cpu_time < 10000) terminal_writestring("   ");
-            else if (proc->cpu_time < 100000) terminal_writestring("  ");
-            else terminal_writestring(" ");
-            
-            // Memory usage
-            if (proc->memory_usage > 1024) {
-                terminal_printf("%d", proc->memory_usage / 1024);
-                terminal_writestring("K");
-                int kb = proc->memory_usage / 1024;
-                if (kb < 10) terminal_writestring("    ");
-                else if (kb < 100) terminal_writestring("   ");
-                else if (kb < 1000) terminal_writestring("  ");
-                else terminal_writestring(" ");
-            } else {
-                terminal_printf("%d", proc->memory_usage);
-                if (proc->memory_usage < 10) terminal_writestring("      ");
-                else if (proc->memory_usage < 100) terminal_writestring("     ");
-                else if (proc->memory_usage < 1000) terminal_writestring("    ");
-                else if (proc->memory_usage < 10000) terminal_writestring("   ");
-                else if (proc->memory_usage < 100000) terminal_writestring("  ");
-                else terminal_writestring(" ");
+    old_process->saved_esp = esp;
+    if (!idle) {
+        process_change_state(old_process, PROCESS_RUNNING, PROCESS_READY);
+        fpu_switch_out(old_process);
+        cpu->switched_from = old_process;
+    }
+    
+    if (next != cpu->idle) {
+        process_change_state(next, PROCESS_READY, PROCESS_RUNNING);
+        next->time_slice = level_quantum(next->priority);
+    }
+    TRACE(TRACE_SWITCH, old_process->pid, next->pid);
+    stat_inc(&stat_sched_switches);
+    load_account(cpu, old_process, next);
+    cpu->current = next;
+    process_activate(next);
+    return next->saved_esp;
+}
+
+// Move a process into the deadline class (runtime_ms 0: back to the
+// MLFQ), requeueing it if it is waiting to run. -1 if it doesn't exist,
+// is the kernel task, or admission control turns it away.
+int process_set_deadline(int pid, uint32_t runtime_ms, uint32_t deadline_ms, uint32_t period_ms) {
+    process_t* process = process_find(pid);
+    if (!process || process->pid == KERNEL_PID || process->state == PROCESS_TERMINATED) {
+        return -1;
+    }
+    int requeue = (process->state == PROCESS_READY) && ready_remove(process);
+    int result = dl_set_params(process, runtime_ms, deadline_ms, period_ms);
+    if (result == 0 && !process->dl.period) {
+        process->dl.misses = 0;
+        process->priority = 0;
+    }
+    if (requeue) {
+        ready_enqueue(process);
+    }
+    return result;
+}
+
+// Restrict a process to the CPUs in cpumask; offline ones are dropped and
+// all of them means any. A queued process moves to an allowed queue now,
+// a running one at the end of its slice (the caller yields at once).
+// Deadline tasks still run wherever the shared EDF queue is served.
+int process_set_affinity(int pid, uint32_t cpumask) {
+    process_t* process = process_find(pid);
+    if (!process || process->pid == KERNEL_PID || process->state == PROCESS_TERMINATED) {
+        return -1;
+    }
+    uint32_t online = 0;
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        if (cpus[i].online) {
+            online |= PROCESS_CPU(i);
+        }
+    }
+    cpumask &= online;
+    if (!cpumask) {
+        return -1;
+    }
+    
+    int requeue = (process->state == PROCESS_READY) && ready_remove(process);
+    process->cpumask = cpumask == online ? 0 : cpumask;
+    if (requeue) {
+        ready_enqueue(process);
+    } else if (process->state == PROCESS_RUNNING && process != current_process) {
+        process->time_slice = 0;
+    }
+    if (process == current_process && !process_allowed(process, smp_current_cpu()->id)) {
+        process_yield();
+    }
+    return 0;
+}
+
+// Turn timer preemption on or off
+void process_set_preemption(int enabled) {
+    scheduler_preemptive = enabled ? 1 : 0;
+    if (current_process) {
+        current_process->time_slice = level_quantum(current_process->priority);
+    }
+}
+
+// Set the time slice length in timer ticks
+void process_set_quantum(uint32_t ticks) {
+    scheduler_quantum = ticks ? ticks : 1;
+}
+
+// Legacy function removed - replaced with enhanced process_exit(int exit_code)
+
+#define PROCESS_TOP_ROWS 12
+
+// top: the busiest tasks by decayed utilisation, with their CPU time
+void process_top_show(void) {
+    process_t* rows[PROCESS_TOP_ROWS];
+    uint32_t utils[PROCESS_TOP_ROWS];
+    int shown = 0;
+    uint64_t now = clock_ns();
+    for (int i = 0; i < process_table_size; i++) {
+        process_t* proc = process_slot(i);
+        if (proc->pid == INVALID_PID || proc->state == PROCESS_TERMINATED) {
+            continue;
+        }
+        // Insertion into the sorted top rows; the lightest falls off the end
+        uint32_t util = process_util(proc, now);
+        int at = shown < PROCESS_TOP_ROWS ? shown++ : PROCESS_TOP_ROWS;
+        while (at > 0 && utils[at - 1] < util) {
+            if (at < PROCESS_TOP_ROWS) {
+                rows[at] = rows[at - 1];
+                utils[at] = utils[at - 1];
             }
-            
-            // Creation time
-            terminal_printf("%d", proc->creation_time);
-            terminal_writestring("s");
-            
-            terminal_writestring("\n");
+            at--;
+        }
+        if (at < PROCESS_TOP_ROWS) {
+            rows[at] = proc;
+            utils[at] = util;
         }
     }
     
-    terminal_writestring("\n");
-    terminal_printf("Total processes: %d\n", active_count);
-    terminal_printf("Running: %d, Ready: %d, Blocked: %d, Terminated: %d\n",
-                   process_count_by_state(PROCESS_RUNNING),
-                   process_count_by_state(PROCESS_READY),
-                   process_count_by_state(PROCESS_BLOCKED),
-                   process_count_by_state(PROCESS_TERMINATED));
+    terminal_writestring("  PID   CPU%  TIME(ms)  CPU  STATE       NAME\n");
+    for (int i = 0; i < shown; i++) {
+        process_t* proc = rows[i];
+        terminal_printf("  %d", proc->pid);
+        for (int pad = proc->pid < 10 ? 1 : proc->pid < 100 ? 2 : 3; pad < 6; pad++) {
+            terminal_putchar(' ');
+        }
+        terminal_printf("%d%%   %d", (int)load_percent(utils[i]), (int)process_run_ms(proc));
+        terminal_printf("  %d    %s  %s\n", proc->cpu, process_state_string(proc->state), proc->info->name);
+    }
+}
+
+// /proc/processes: one line per live slot, fields separated by spaces and
+// the name last so it may hold anything
+void process_proc_show(proc_seq_t* seq) {
+    proc_puts(seq, "PID PPID STATE LEVEL CPU MEMORY CREATED DLMISS NAME\n");
+    for (int i = 0; i < process_table_size; i++) {
+        process_t* proc = process_slot(i);
+        if (proc->pid == INVALID_PID) {
+            continue;
+        }
+        proc_printf(seq, "%d %d %s %u %u %u %u %u %s\n", proc->pid,
+                    proc->parent_pid == INVALID_PID ? 0 : proc->parent_pid,
+                    process_state_string(proc->state), proc->priority, proc->cpu_time,
+                    proc->info->memory_usage, proc->info->creation_time, proc->dl.misses, proc->info->name);
+    }
+    proc_printf(seq, "# %d processes: %d running, %d ready, %d blocked, %d terminated\n",
+                live_processes, process_count_by_state(PROCESS_RUNNING),
+                process_count_by_state(PROCESS_READY), process_count_by_state(PROCESS_BLOCKED),
+                process_count_by_state(PROCESS_TERMINATED));
+}
+
+void process_list(void) {
+    procfs_print(process_proc_show);
 }
 
 // Process command handler (Day 15)
@@ -702,18 +2069,27 @@ void process_command_handler(int argc, char argv[][64]) {
         terminal_writestring("  list          - List all processes\n");
         terminal_writestring("  info <pid>    - Show process information\n");
         terminal_writestring("  kill <pid>    - Kill process by PID\n");
+        terminal_writestring("  wait <pid>    - Wait for a process to end and reap it\n");
+        terminal_writestring("  deadline <pid> <runtime> <deadline> <period> - EDF class (ms; runtime 0 leaves it)\n");
+        terminal_writestring("  affinity <pid> <cpu>[,<cpu>...] - CPUs it may run on\n");
         terminal_writestring("  cleanup       - Clean up terminated processes\n");
         terminal_writestring("  stats         - Show process statistics\n");
+        terminal_writestring("  cpus          - Show per-CPU scheduler state\n");
+        terminal_writestring("  user <name>   - Start a ring 3 test process (hello, fault)\n");
+        terminal_writestring("  exec <path>   - Start a static ELF executable in ring 3\n");
+        terminal_writestring("  areas <pid>   - Show a process's demand-paged areas\n");
         terminal_writestring("  run <name>    - Run test process directly (Phase 1)\n");
         terminal_writestring("  create2 <name> - Create process in table (Phase 2)\n");
         terminal_writestring("  execute <pid> - Execute ready process (Phase 3)\n");
         terminal_writestring("  runall       - Execute all ready processes (Phase 4)\n");
         terminal_writestring("  yield         - Yield CPU to next process\n");
+        terminal_writestring("  preempt on|off - Toggle timer-driven preemption\n");
+        terminal_writestring("  quantum <ticks> - Set the scheduler time slice\n");
         terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
         return;
     }
     
-    if (simple_strcmp(argv[1], "init") == 0) {
+    if (strcmp(argv[1], "init") == 0) {
         terminal_setcolor(vga_entry_color(VGA_COLOR_YELLOW, VGA_COLOR_BLACK));
         terminal_writestring("Initializing Process Management System...\n");
         terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
@@ -724,10 +2100,10 @@ void process_command_handler(int argc, char argv[][64]) {
         terminal_writestring("Process management initialized successfully!\n");
         terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
         
-    } else if (simple_strcmp(argv[1], "list") == 0) {
+    } else if (strcmp(argv[1], "list") == 0) {
         process_list();
         
-    } else if (simple_strcmp(argv[1], "info") == 0) {
+    } else if (strcmp(argv[1], "info") == 0) {
         if (argc < 3) {
             terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
             terminal_writestring("Usage: proc info <pid>\n");
@@ -745,7 +2121,7 @@ void process_command_handler(int argc, char argv[][64]) {
         
         process_show_info(pid);
         
-    } else if (simple_strcmp(argv[1], "kill") == 0) {
+    } else if (strcmp(argv[1], "kill") == 0) {
         if (argc < 3) {
             terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
             terminal_writestring("Usage: proc kill <pid>\n");
@@ -763,32 +2139,148 @@ void process_command_handler(int argc, char argv[][64]) {
         
         process_kill(pid);
         
-    } else if (simple_strcmp(argv[1], "cleanup") == 0) {
-        process_cleanup_terminated();
+    } else if (strcmp(argv[1], "wait") == 0) {
+        if (argc < 3) {
+            terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
+            terminal_writestring("Usage: proc wait <pid>\n");
+            terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+            return;
+        }
         
-    } else if (simple_strcmp(argv[1], "stats") == 0) {
-        terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK));
-        terminal_writestring("Process Statistics:\n");
-        terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+        int pid = atoi(argv[2]);
+        int status = 0;
+        if (process_wait(pid, &status) < 0) {
+            terminal_printf("[PROCESS] PID %d is not a child of this process\n", pid);
+        } else {
+            terminal_printf("[PROCESS] PID %d reaped, exit code %d\n", pid, status);
+        }
+        
+    } else if (strcmp(argv[1], "deadline") == 0) {
+        if (argc < 4 || (atoi(argv[3]) != 0 && argc < 6)) {
+            terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
+            terminal_writestring("Usage: proc deadline <pid> <runtime> <deadline> <period>\n");
+            terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+            return;
+        }
+        
+        int pid = atoi(argv[2]);
+        int runtime = atoi(argv[3]);
+        int deadline = runtime ? atoi(argv[4]) : 0;
+        int period = runtime ? atoi(argv[5]) : 0;
+        if (runtime < 0 || deadline < 0 || period < 0 ||
+            process_set_deadline(pid, (uint32_t)runtime, (uint32_t)deadline, (uint32_t)period) != 0) {
+            terminal_printf("[PROCESS] Deadline parameters refused for PID %d (%d/1024 of a CPU admitted)\n",
+                            pid, (int)dl_total_util());
+        } else if (runtime) {
+            terminal_printf("[PROCESS] PID %d: %d ms every %d ms, due after %d ms (%d/1024 admitted)\n",
+                            pid, runtime, period, deadline, (int)dl_total_util());
+        } else {
+            terminal_printf("[PROCESS] PID %d back in the normal class\n", pid);
+        }
         
-        terminal_printf("  Total slots: %d\n", MAX_PROCESSES);
+    } else if (strcmp(argv[1], "affinity") == 0) {
+        if (argc < 4) {
+            terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
+            terminal_writestring("Usage: proc affinity <pid> <cpu>[,<cpu>...]\n");
+            terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+            return;
+        }
         
-        int total_active = 0;
-        for (int i = 0; i < MAX_PROCESSES; i++) {
-            if (process_table[i].pid != INVALID_PID) {
-                total_active++;
+        int pid = atoi(argv[2]);
+        uint32_t mask = 0;
+        for (const char* c = argv[3]; *c; c++) {
+            if (*c >= '0' && *c <= '9' && (c == argv[3] || c[-1] == ',')) {
+                int cpu = atoi(c);
+                if (cpu < SMP_MAX_CPUS) {
+                    mask |= PROCESS_CPU(cpu);
+                }
             }
         }
+        if (process_set_affinity(pid, mask) != 0) {
+            terminal_printf("[PROCESS] Can't restrict PID %d to those CPUs\n", pid);
+        } else {
+            terminal_printf("[PROCESS] PID %d may run on CPUs", pid);
+            process_print_cpus(mask);
+        }
+        
+    } else if (strcmp(argv[1], "cleanup") == 0) {
+        process_cleanup_terminated();
+        
+    } else if (strcmp(argv[1], "stats") == 0) {
+        terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK));
+        terminal_writestring("Process Statistics:\n");
+        terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
         
-        terminal_printf("  Active processes: %d\n", total_active);
-        terminal_printf("  Available slots: %d\n", MAX_PROCESSES - total_active);
+        terminal_printf("  Total slots: %d (max %d)\n", process_table_size, MAX_PROCESSES);
+        terminal_printf("  Active processes: %d\n", live_processes);
+        terminal_printf("  Available slots: %d\n", MAX_PROCESSES - live_processes);
         terminal_printf("  Running: %d\n", process_count_by_state(PROCESS_RUNNING));
         terminal_printf("  Ready: %d\n", process_count_by_state(PROCESS_READY));
         terminal_printf("  Blocked: %d\n", process_count_by_state(PROCESS_BLOCKED));
         terminal_printf("  Terminated: %d\n", process_count_by_state(PROCESS_TERMINATED));
         terminal_printf("  Next PID: %d\n", next_pid);
+        kstack_dump_stats();
+        fpu_dump_stats();
+        timer_dump_stats();
+        
+    } else if (strcmp(argv[1], "cpus") == 0) {
+        smp_dump();
+        
+    } else if (strcmp(argv[1], "user") == 0) {
+        void (*entry_point)(void) = NULL;
+        if (argc >= 3 && strcmp(argv[2], "hello") == 0) {
+            entry_point = test_user_hello;
+        } else if (argc >= 3 && strcmp(argv[2], "fault") == 0) {
+            entry_point = test_user_fault;
+        } else if (argc >= 3 && strcmp(argv[2], "badptr") == 0) {
+            entry_point = test_user_badptr;
+        }
+        if (!entry_point) {
+            terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
+            terminal_writestring("Usage: proc user <hello|fault|badptr>\n");
+            terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+            return;
+        }
+        initcall_finish();              // Its system calls don't come through the shell
+        process_create_user(entry_point, argv[2]);
+        
+    } else if (strcmp(argv[1], "exec") == 0) {
+        if (argc < 3) {
+            terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
+            terminal_writestring("Usage: proc exec <path>\n");
+            terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+            return;
+        }
+        initcall_finish();
+        // Named after the file, cut to fit the process name
+        const char* base = argv[2];
+        for (const char* c = argv[2]; *c; c++) {
+            if (*c == '/' && c[1]) {
+                base = c + 1;
+            }
+        }
+        char name[sizeof(((process_info_t*)0)->name)];
+        uint32_t length = 0;
+        while (base[length] && base[length] != '/' && length < sizeof(name) - 1) {
+            name[length] = base[length];
+            length++;
+        }
+        name[length] = '\0';
+        process_create_elf(argv[2], name);
+        
+    } else if (strcmp(argv[1], "areas") == 0) {
+        int pid = 0;
+        for (const char* c = argc >= 3 ? argv[2] : ""; *c >= '0' && *c <= '9'; c++) {
+            pid = pid * 10 + (*c - '0');
+        }
+        process_t* process = argc >= 3 ? process_find(pid) : NULL;
+        if (!process || !process->vm_space.dir) {
+            terminal_writestring("Usage: proc areas <pid> (a process with its own address space)\n");
+            return;
+        }
+        vmm_dump_areas(&process->vm_space);
         
-    } else if (simple_strcmp(argv[1], "create") == 0) {
+    } else if (strcmp(argv[1], "create") == 0) {
         if (argc < 3) {
             terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
             terminal_writestring("Usage: proc create <name>\n");
@@ -805,9 +2297,9 @@ void process_command_handler(int argc, char argv[][64]) {
         const char* proc_name = argv[2];
         
         // Select test process based on name
-        if (simple_strcmp(proc_name, "test1") == 0) {
+        if (strcmp(proc_name, "test1") == 0) {
             entry_point = test_process_1;
-        } else if (simple_strcmp(proc_name, "test2") == 0) {
+        } else if (strcmp(proc_name, "test2") == 0) {
             entry_point = test_process_2;
         } else {
             terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
@@ -828,27 +2320,27 @@ void process_command_handler(int argc, char argv[][64]) {
             terminal_printf("Process '%s' created successfully with PID %d\n", proc_name, pid);
             terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
             
-            // Start the process immediately
+            // Start the process immediately (the scheduler runs it when preemptive)
             process_t* process = process_find(pid);
-            if (process && process->state == PROCESS_READY) {
+            if (process && process->state == PROCESS_READY && !scheduler_preemptive) {
                 terminal_printf("Starting process execution...\n");
                 // For now, we'll execute the process directly
                 // In a full implementation, this would be handled by the scheduler
                 entry_point();
                 
                 // After process function returns, mark as terminated
-                process->state = PROCESS_TERMINATED;
-                process->exit_code = 0;  // Normal termination
+                process_set_state(process, PROCESS_TERMINATED);
+                process->info->exit_code = 0;  // Normal termination
                 
                 // Free stack memory
                 if (process->stack) {
-                    kfree(process->stack);
+                    kstack_free(process->stack);
                     process->stack = NULL;
                 }
                 
                 terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
                 terminal_printf("[PROCESS] Process '%s' (PID: %d) completed and terminated\n", 
-                               process->name, process->pid);
+                               process->info->name, process->pid);
                 terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
             }
         } else {
@@ -857,7 +2349,7 @@ void process_command_handler(int argc, char argv[][64]) {
             terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
         }
         
-    } else if (simple_strcmp(argv[1], "run") == 0) {
+    } else if (strcmp(argv[1], "run") == 0) {
         // Phase 1: Direct execution without process creation
         if (argc < 3) {
             terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
@@ -875,9 +2367,9 @@ void process_command_handler(int argc, char argv[][64]) {
         const char* proc_name = argv[2];
         
         // Select test process based on name
-        if (simple_strcmp(proc_name, "test1") == 0) {
+        if (strcmp(proc_name, "test1") == 0) {
             entry_point = test_process_1;
-        } else if (simple_strcmp(proc_name, "test2") == 0) {
+        } else if (strcmp(proc_name, "test2") == 0) {
             entry_point = test_process_2;
         } else {
             terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
@@ -899,7 +2391,7 @@ void process_command_handler(int argc, char argv[][64]) {
         terminal_printf("Test process '%s' completed successfully!\n", proc_name);
         terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
         
-    } else if (simple_strcmp(argv[1], "create2") == 0) {
+    } else if (strcmp(argv[1], "create2") == 0) {
         // Phase 2: Simple process creation with process table entry
         if (argc < 3) {
             terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
@@ -917,9 +2409,9 @@ void process_command_handler(int argc, char argv[][64]) {
         const char* proc_name = argv[2];
         
         // Select test process based on name
-        if (simple_strcmp(proc_name, "test1") == 0) {
+        if (strcmp(proc_name, "test1") == 0) {
             entry_point = test_process_1;
-        } else if (simple_strcmp(proc_name, "test2") == 0) {
+        } else if (strcmp(proc_name, "test2") == 0) {
             entry_point = test_process_2;
         } else {
             terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
@@ -946,7 +2438,7 @@ void process_command_handler(int argc, char argv[][64]) {
             terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
         }
         
-    } else if (simple_strcmp(argv[1], "execute") == 0) {
+    } else if (strcmp(argv[1], "execute") == 0) {
         // Phase 3: Execute a ready process by PID
         if (argc < 3) {
             terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
@@ -978,7 +2470,7 @@ void process_command_handler(int argc, char argv[][64]) {
             terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
         }
         
-    } else if (simple_strcmp(argv[1], "runall") == 0) {
+    } else if (strcmp(argv[1], "runall") == 0) {
         // Phase 4: Execute all ready processes in sequence
         terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK));
         terminal_writestring("Starting batch execution of all ready processes...\n");
@@ -996,12 +2488,12 @@ void process_command_handler(int argc, char argv[][64]) {
             terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
         }
         
-    } else if (simple_strcmp(argv[1], "yield") == 0) {
+    } else if (strcmp(argv[1], "yield") == 0) {
         terminal_setcolor(vga_entry_color(VGA_COLOR_YELLOW, VGA_COLOR_BLACK));
         terminal_writestring("Yielding CPU to next process...\n");
         terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
         
-        if (ready_queue_head) {
+        if (process_has_ready()) {
             process_yield();
             terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
             terminal_writestring("Returned from process yield\n");
@@ -1012,6 +2504,34 @@ void process_command_handler(int argc, char argv[][64]) {
             terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
         }
         
+    } else if (strcmp(argv[1], "preempt") == 0) {
+        if (argc < 3) {
+            terminal_printf("Preemption: %s, quantum: %d ticks\n",
+                           scheduler_preemptive ? "on" : "off", (int)scheduler_quantum);
+            return;
+        }
+        process_set_preemption(strcmp(argv[2], "on") == 0);
+        terminal_printf("Preemption %s\n", scheduler_preemptive ? "enabled" : "disabled");
+        
+    } else if (strcmp(argv[1], "quantum") == 0) {
+        if (argc < 3) {
+            terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
+            terminal_writestring("Usage: proc quantum <ticks>\n");
+            terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+            return;
+        }
+        
+        // Simple string to number conversion
+        uint32_t ticks = 0;
+        const char* ticks_str = argv[2];
+        while (*ticks_str >= '0' && *ticks_str <= '9') {
+            ticks = ticks * 10 + (*ticks_str - '0');
+            ticks_str++;
+        }
+        
+        process_set_quantum(ticks);
+        terminal_printf("Scheduler quantum set to %d ticks\n", (int)scheduler_quantum);
+        
     } else {
         terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
         terminal_printf("Unknown process command: %s\n", argv[1]);
@@ -1021,14 +2541,6 @@ void process_command_handler(int argc, char argv[][64]) {
 
 // Day 19: Get total number of active processes
 int process_get_count(void) {
-    int count = 0;
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].pid != INVALID_PID && 
-            (process_table[i].state == PROCESS_READY || 
-             process_table[i].state == PROCESS_RUNNING || 
-             process_table[i].state == PROCESS_BLOCKED)) {
-            count++;
-        }
-    }
-    return count;
+    return state_counts[PROCESS_READY] + state_counts[PROCESS_RUNNING] +
+           state_counts[PROCESS_BLOCKED];
 }
\ No newline at end of file
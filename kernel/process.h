@@ -5,14 +5,43 @@
 #define PROCESS_H
 
 #include "types.h"
+#include "vmm.h"
+#include "kstack.h"
+#include "fpu.h"
+#include "smp.h"
+#include "sched_dl.h"
+#include "sched_load.h"
+#include "rcu.h"
 
 // Process configuration constants (no hardcoding)
-#define MAX_PROCESSES 8
-#define STACK_SIZE 0x1000      // 4KB stack
+#define MAX_PROCESSES 512      // Hard cap; the table grows on demand up to this
+#define PROCESS_TABLE_CHUNK 32 // Slots added each time the table grows
+#define PROCESS_HASH_BUCKETS 64 // PID lookup buckets (power of two)
+#define STACK_SIZE KSTACK_SIZE  // 4KB stack from the kernel stack pool
 #define KERNEL_PID 0           // Kernel process ID
 #define INVALID_PID -1         // Invalid/unused process ID
 #define FIRST_USER_PID 1       // First user process ID
 #define DEFAULT_EFLAGS 0x202   // Default EFLAGS (interrupts enabled)
+#define KERNEL_CODE_SELECTOR 0x08
+#define KERNEL_DATA_SELECTOR 0x10
+#define PROCESS_DEFAULT_QUANTUM 5   // Timer ticks per time slice (50ms at 100Hz)
+#define PROCESS_HOT_ALIGN 64   // Cache line each process_t starts on
+#define PROCESS_CPU(cpu) (1u << (cpu))  // cpumask bit for a cpus[] index
+
+// The reaper thread frees terminated processes in batches. A zombie is
+// left for REAPER_GRACE_TICKS so a parent can still process_wait for it.
+#define REAPER_BATCH 16
+#define REAPER_GRACE_TICKS 100
+#define REAPER_RETRY_MS 100    // Recheck while zombies are too young or on a CPU
+
+// Multi-level feedback queue: level 0 is the highest priority, and each
+// lower level gets twice the previous level's quantum
+#define PROCESS_PRIORITY_LEVELS 4
+#define PROCESS_BOOST_INTERVAL  100     // Ticks between resets of every task to level 0
+
+// Software interrupt process_yield raises under preemption, so the switch
+// happens at once instead of at the next timer interrupt
+#define PROCESS_YIELD_VECTOR    50
 
 // Process states (enhanced for Day 15)
 typedef enum {
@@ -23,53 +52,155 @@ typedef enum {
     PROCESS_CREATED = 4
 } process_state_t;
 
-// Simple CPU context (registers only, no page directory)
+#define PROCESS_STATE_COUNT 5
+
+// Job-control signals (the POSIX numbers). A process can't catch them:
+// SIGINT terminates it, SIGTSTP parks it blocked until SIGCONT. One that
+// is running takes them at its next preemption, not in the middle of a
+// critical section.
+#define SIGINT      2
+#define SIGCONT     18
+#define SIGTSTP     20
+#define SIGNAL_BIT(sig)     (1u << (sig))
+#define PROCESS_WAIT_STOPPED    -2
+
+// CPU context saved by switch_context (offsets are used by the assembly).
+// FPU/SSE state is switched lazily and kept in process_t, not here.
 typedef struct {
     uint32_t eax, ebx, ecx, edx;
     uint32_t esi, edi, esp, ebp;
     uint32_t eip, eflags;
+    uint32_t ds, es, fs, gs, ss;
 } cpu_context_t;
 
-// Enhanced process structure (Day 15)
-typedef struct process {
-    int pid;                        // Process ID
-    int parent_pid;                 // Parent process ID
-    process_state_t state;          // Process state
-    cpu_context_t context;          // CPU registers
-    void* stack;                    // Stack pointer (allocated by kmalloc)
-    size_t stack_size;              // Stack size
-    struct process* next;           // Next in ready queue
+// Cold side of a process: what only listings, /proc and exit reporting
+// read. Kept out of process_t in a table of its own, one per slot.
+typedef struct {
     char name[32];                  // Process name
     uint32_t creation_time;         // Process creation time
-    uint32_t cpu_time;              // CPU time used
     int exit_code;                  // Exit code
     uint32_t memory_usage;          // Memory usage in bytes
-} process_t;
+    uint32_t exit_tick;             // When it terminated (the reaper's grace period)
+} process_info_t;
+
+// Enhanced process structure (Day 15). The fields the scheduler touches
+// on every pick, enqueue and tick come first and fill the first cache
+// line; slots are line-aligned, so a run queue walk reads one line per
+// task. Display and accounting data lives behind info.
+typedef struct process {
+    // Hot: run queues, state changes, the tick
+    process_state_t state;          // Process state
+    struct process* next;           // Next in ready queue
+    int on_cpu;                     // Still running on (or leaving) a CPU's stack
+    int cpu;                        // Run queue the process was last put on
+    uint32_t cpumask;               // CPUs it may run on (PROCESS_CPU bits), 0 = any
+    uint32_t priority;              // MLFQ level, 0 = highest
+    uint32_t time_slice;            // Ticks left in the current quantum (0 = yielded)
+    uint32_t saved_esp;             // Interrupt frame to resume from (preemptive switch)
+    int pid;                        // Process ID
+    int slot;                       // Index in the process table
+    struct process* hash_next;      // Next in PID hash bucket
+    uint32_t cpu_time;              // CPU time used
+    page_directory_t* page_directory;   // Address space (kernel half shared with the master)
+    void* stack;                    // Stack base (from the kernel stack pool)
+    uint64_t wake_ns;               // clock_ns to wake at while on the sleep queue
+
+    // Warm: switches, sleeping, waiting
+    struct process* sleep_next;     // Next sleeper (sorted by wake_ns)
+    process_info_t* info;           // Cold side (fixed for the slot)
+    int parent_pid;                 // Parent process ID
+    size_t stack_size;              // Stack size
+    struct process* zombie_next;    // Next terminated process awaiting cleanup
+    struct process* zombie_prev;    // Previous one (NULL at the head)
+    struct process* exit_waiters;   // Sleeping in process_wait for this one
+    struct process* wait_next;      // Next waiter on the same process
+    struct process* wait_child;     // The process this one sleeps in process_wait for
+    struct mutex* held_mutexes;     // Mutexes it owns, chained through held_next
+    struct mutex* blocked_on;       // The mutex it sleeps in mutex_lock for
+    volatile uint32_t signals;      // Sent and not yet acted on (SIGNAL_BIT)
+    int stopped;                    // Blocked by SIGTSTP until SIGCONT
+    int user;                       // Runs in ring 3: its pointers must stay below the kernel
+    uint32_t pi_level;              // Lowest MLFQ level it may drop to (inherited)
+    void* fpu_alloc;                // fxsave area (over-allocated for alignment)
+    int fpu_used;                   // fpu_alloc holds a saved state
+    cpu_context_t context;          // CPU registers
+    dl_entity_t dl;                 // Deadline class state (dl.period 0: normal task)
+    load_avg_t util;                // Decayed share of recent time on a CPU
+    uint64_t exec_start;            // clock_ns it last went on a CPU (or was last charged)
+    uint64_t run_ns;                // Time on a CPU, all told (cpu_time counts ticks)
+    struct mailbox* mailbox;        // IPC receive queue (allocated on first use)
+    struct vfs_fd_table* files;     // Open descriptors (allocated on first open)
+    vm_space_t vm_space;            // Areas faulted in on demand (own directory only)
+    rcu_head_t rcu;                 // Slot goes back on the free stack after a grace period
+} __attribute__((aligned(PROCESS_HOT_ALIGN))) process_t;
+
+_Static_assert(__builtin_offsetof(process_t, sleep_next) <= PROCESS_HOT_ALIGN,
+               "process_t hot fields spill past the first cache line");
 
 // Global variables
-extern process_t* current_process;
-extern process_t* ready_queue_head;
-extern process_t* ready_queue_tail;
-extern process_t process_table[MAX_PROCESSES];
+#define current_process percpu_read(current)   // Per CPU; set with percpu_write
+extern int process_table_size;     // Slots allocated so far
 extern int next_pid;
+extern int scheduler_preemptive;
+extern uint32_t scheduler_quantum;
 
 // Function declarations (enhanced for Day 15)
 void process_init(void);
 int process_create(void (*entry_point)(void), const char* name);
+int kthread_create(void (*fn)(void* arg), void* arg, const char* name);  // fn(arg), then exit
 int process_create_simple(void (*entry_point)(void), const char* name);  // Phase 2
+int process_create_user(void (*entry_point)(void), const char* name);    // Ring 3
+int process_create_elf(const char* path, const char* name);             // Ring 3, from a file
 int process_execute_simple(int pid);  // Phase 3
 int process_run_all_ready(void);  // Phase 4
 void process_switch(void);
 void process_yield(void);
 void process_exit(int exit_code);
+int process_wait(int pid, int* status);     // Sleep until child pid ends, then reap it
+int process_wait_job(int pid, int* status); // The same, or PROCESS_WAIT_STOPPED once SIGTSTP stops it
+int process_set_deadline(int pid, uint32_t runtime_ms, uint32_t deadline_ms, uint32_t period_ms);
+int process_set_affinity(int pid, uint32_t cpumask);  // 0, or -1 if no online CPU is left in it
+uint32_t process_cpu_util(uint32_t cpu);    // Decayed busy share of a CPU, LOAD_SCALE = always
+uint32_t process_cpu_load(uint32_t cpu);    // Decayed runnable tasks, LOAD_SCALE each
+void process_top_show(void);                // top's per-task lines
 void process_kill(int pid);
+int process_signal(int pid, int sig);      // 0, or -1 for no such (killable) process
 void process_list(void);
+struct proc_seq;
+void process_proc_show(struct proc_seq* seq);      // /proc/processes
 process_t* process_find(int pid);
+process_t* process_slot(int slot);
 const char* process_state_string(process_state_t state);
 void process_show_info(int pid);
 int process_count_by_state(process_state_t state);
 void process_cleanup_terminated(void);
 
+// Preemptive scheduling (driven by IRQ0). process_reschedule is the
+// switch without the tick: what a yield takes.
+uint32_t process_preempt(uint32_t esp);
+uint32_t process_reschedule(uint32_t esp);
+void process_set_preemption(int enabled);
+void process_set_quantum(uint32_t ticks);
+int process_has_ready(void);
+bool process_can_block(void);
+void process_block(void);
+void process_prepare_block(void);
+
+// After process_prepare_block and publishing itself to a waker: switch
+// away, and return once the waker has changed word from value (a 32-bit
+// field: a waiter pointer, a flag, a state).
+void process_sleep_on(volatile const uint32_t* word, uint32_t value);
+#define process_sleep_while(field, value) ({ \
+    _Static_assert(sizeof(field) == 4, "process_sleep_while on a field that isn't 32 bits"); \
+    process_sleep_on((volatile const uint32_t*)&(field), (uint32_t)(value)); })
+void process_wake(process_t* process);
+void process_wake_preempt(process_t* process);  // And run it now if it outranks this CPU's task
+void process_yield_to(process_t* target);     // Wake target and switch straight to it
+void process_boost(process_t* process);
+void process_inherit_priority(process_t* process, uint32_t level);
+void process_finish_switch(void);
+process_t* process_idle_task(uint32_t cpu);
+
 // Process management commands
 void process_command_handler(int argc, char argv[][64]);
 
@@ -78,5 +209,6 @@ int process_get_count(void);
 
 // Assembly function (to be implemented)
 extern void switch_context(cpu_context_t* old_context, cpu_context_t* new_context);
+extern void enter_user_frame(uint32_t frame);   // iret through an irq_common_stub frame
 
 #endif // PROCESS_H
\ No newline at end of file
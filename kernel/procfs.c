@@ -0,0 +1,208 @@
+// ClaudeOS Process File System Implementation - Day 21
+// A handle is an index into the file table. Sizes aren't known until a
+// file has been generated, so stat, readdir and size each run the show
+// function once with nowhere to put the text.
+
+#include "procfs.h"
+#include "printk.h"
+#include "kernel.h"
+#include "heap.h"
+#include "slab.h"
+#include "pmm.h"
+#include "ipc.h"
+#include "irq.h"
+#include "network.h"
+#include "process.h"
+#include "stats.h"
+#include "string.h"
+
+typedef __builtin_va_list va_list;
+#define va_start(v, l) __builtin_va_start(v, l)
+#define va_end(v) __builtin_va_end(v)
+
+typedef struct {
+    const char* name;
+    proc_show_t show;
+} proc_entry_t;
+
+static void procfs_meminfo_show(proc_seq_t* seq);
+
+static const proc_entry_t proc_entries[] = {
+    { "stats",      stats_proc_show },
+    { "processes",  process_proc_show },
+    { "interrupts", irq_proc_show },
+    { "meminfo",    procfs_meminfo_show },
+    { "ipc",        ipc_proc_show },
+    { "net",        network_proc_show },
+};
+
+#define PROC_ENTRIES (sizeof(proc_entries) / sizeof(proc_entries[0]))
+
+static void proc_emit(proc_seq_t* seq, const char* data, uint32_t length) {
+    seq->total += length;
+    if (seq->console) {
+        terminal_write(data, length);
+        return;
+    }
+    if (seq->skip >= length) {
+        seq->skip -= length;
+        return;
+    }
+    data += seq->skip;
+    length -= seq->skip;
+    seq->skip = 0;
+    if (length > seq->room) {
+        length = seq->room;
+    }
+    if (seq->out && length) {
+        memcpy(seq->out + seq->written, data, length);
+        seq->written += length;
+        seq->room -= length;
+    }
+}
+
+void proc_printf(proc_seq_t* seq, const char* format, ...) {
+    char line[PROCFS_LINE];
+    va_list args;
+    va_start(args, format);
+    uint32_t length = printk_vformat(line, PROCFS_LINE, format, args);
+    va_end(args);
+    proc_emit(seq, line, length);
+}
+
+void proc_puts(proc_seq_t* seq, const char* text) {
+    proc_emit(seq, text, strlen(text));
+}
+
+void procfs_print(proc_show_t show) {
+    proc_seq_t seq = { NULL, 0, 0, 0, 0, true };
+    show(&seq);
+}
+
+// Bytes show produces right now
+static uint32_t procfs_measure(proc_show_t show) {
+    proc_seq_t seq = { NULL, 0, 0, 0, 0, false };
+    show(&seq);
+    return seq.total;
+}
+
+static void procfs_meminfo_show(proc_seq_t* seq) {
+    size_t free_bytes, largest;
+    heap_free_extents(&free_bytes, &largest);
+    proc_printf(seq, "heap.policy: %s\n", heap_policy_name(heap_get_policy()));
+    proc_printf(seq, "heap.total_bytes: %u\n", (uint32_t)heap_get_total_size());
+    proc_printf(seq, "heap.used_bytes: %u\n", (uint32_t)heap_get_used_size());
+    proc_printf(seq, "heap.free_bytes: %u\n", (uint32_t)heap_get_free_size());
+    proc_printf(seq, "heap.largest_free: %u\n", (uint32_t)largest);
+    proc_printf(seq, "slab.used_bytes: %u\n", (uint32_t)slab_get_used_size());
+    proc_printf(seq, "slab.total_bytes: %u\n", (uint32_t)slab_get_total_size());
+    pmm_proc_show(seq);
+}
+
+static int procfs_lookup(const char* path) {
+    if (path[0] == '/') {
+        path++;
+    }
+    for (uint32_t i = 0; i < PROC_ENTRIES; i++) {
+        if (strcmp(proc_entries[i].name, path) == 0) {
+            return (int)i;
+        }
+    }
+    return VFS_ERROR_NOT_FOUND;
+}
+
+static int procfs_open(void* data, const char* path, uint32_t flags, int32_t* handle) {
+    (void)data;
+    if (flags & (VFS_O_WRITE | VFS_O_CREATE | VFS_O_TRUNCATE | VFS_O_APPEND)) {
+        return VFS_ERROR_READ_ONLY;
+    }
+    if (strcmp(path, "/") == 0) {
+        return VFS_ERROR_IS_DIR;
+    }
+    int index = procfs_lookup(path);
+    if (index < 0) {
+        return index;
+    }
+    *handle = index;
+    return VFS_SUCCESS;
+}
+
+static int procfs_close(void* data, int32_t handle) {
+    (void)data;
+    (void)handle;
+    return VFS_SUCCESS;
+}
+
+static int procfs_read(void* data, int32_t handle, uint32_t offset, void* buffer, uint32_t size) {
+    (void)data;
+    if (handle < 0 || (uint32_t)handle >= PROC_ENTRIES) {
+        return VFS_ERROR_INVALID_FD;
+    }
+    proc_seq_t seq = { (char*)buffer, offset, size, 0, 0, false };
+    proc_entries[handle].show(&seq);
+    return (int)seq.written;
+}
+
+static int procfs_write(void* data, int32_t handle, uint32_t offset, const void* buffer, uint32_t size) {
+    (void)data;
+    (void)handle;
+    (void)offset;
+    (void)buffer;
+    (void)size;
+    return VFS_ERROR_READ_ONLY;
+}
+
+static int procfs_size(void* data, int32_t handle) {
+    (void)data;
+    if (handle < 0 || (uint32_t)handle >= PROC_ENTRIES) {
+        return VFS_ERROR_INVALID_FD;
+    }
+    return (int)procfs_measure(proc_entries[handle].show);
+}
+
+static int procfs_stat(void* data, const char* path, vfs_stat_t* stat) {
+    (void)data;
+    if (strcmp(path, "/") == 0) {
+        stat->size = 0;
+        stat->type = VFS_TYPE_DIR;
+        return VFS_SUCCESS;
+    }
+    int index = procfs_lookup(path);
+    if (index < 0) {
+        return index;
+    }
+    stat->size = procfs_measure(proc_entries[index].show);
+    stat->type = VFS_TYPE_FILE;
+    return VFS_SUCCESS;
+}
+
+static int procfs_readdir(void* data, const char* path, uint32_t* cursor, vfs_dirent_t* entries,
+                          int max_entries) {
+    (void)data;
+    if (strcmp(path, "/") != 0) {
+        return procfs_lookup(path) < 0 ? VFS_ERROR_NOT_FOUND : VFS_ERROR_NOT_DIR;
+    }
+    int count = 0;
+    for (uint32_t i = *cursor; i < PROC_ENTRIES && count < max_entries; i++) {
+        memset(&entries[count], 0, sizeof(vfs_dirent_t));
+        strlcpy(entries[count].name, proc_entries[i].name, VFS_MAX_NAME);
+        entries[count].size = procfs_measure(proc_entries[i].show);
+        entries[count].type = VFS_TYPE_FILE;
+        count++;
+        *cursor = i + 1;
+    }
+    return count;
+}
+
+const vfs_ops_t procfs_vfs_ops = {
+    .name = "procfs",
+    .open = procfs_open,
+    .close = procfs_close,
+    .read = procfs_read,
+    .write = procfs_write,
+    .size = procfs_size,
+    .stat = procfs_stat,
+    .readdir = procfs_readdir,
+    .mkdir = NULL,
+    .unlink = NULL,
+};
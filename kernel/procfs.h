@@ -0,0 +1,39 @@
+// ClaudeOS Process File System - Day 21
+// Read-only files under /proc whose text is produced when they are read.
+// Each file is a show function that prints its whole contents through
+// proc_printf; the sequence keeps only the bytes that fall inside the
+// reader's window and counts the rest, so a read at any offset simply
+// runs the function again and nothing is kept between reads. Nothing is
+// formatted unless a file is actually read.
+
+#ifndef PROCFS_H
+#define PROCFS_H
+
+#include "types.h"
+#include "vfs.h"
+
+#define PROCFS_MOUNT        "/proc"
+#define PROCFS_LINE         160         // Longest line one proc_printf produces
+
+typedef struct proc_seq {
+    char* out;                          // Reader's buffer; NULL only counts
+    uint32_t skip;                      // Bytes still to pass over before out
+    uint32_t room;                      // Space left in out
+    uint32_t written;                   // Bytes stored in out
+    uint32_t total;                     // Bytes the show function produced
+    bool console;                       // Straight to the terminal instead
+} proc_seq_t;
+
+typedef void (*proc_show_t)(proc_seq_t* seq);
+
+// Same conversions as printk (%d %u %x %s %c %%)
+void proc_printf(proc_seq_t* seq, const char* format, ...);
+void proc_puts(proc_seq_t* seq, const char* text);
+
+// Run show with its output going to the terminal, for the shell commands
+// that used to print these tables themselves
+void procfs_print(proc_show_t show);
+
+extern const vfs_ops_t procfs_vfs_ops;
+
+#endif // PROCFS_H
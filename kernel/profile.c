@@ -0,0 +1,250 @@
+// ClaudeOS Sampling Profiler Implementation - Day 21
+// Each CPU only ever writes its own buffer, and only from its timer
+// interrupt, so recording takes no lock. The report is built from the raw
+// samples each time it is asked for: self counts for the function that
+// was running, total counts for every function on the recorded stack.
+
+#include "profile.h"
+#include "ksyms.h"
+#include "kernel.h"
+#include "smp.h"
+#include "irq.h"
+#include "pic.h"
+#include "kstack.h"
+#include "pmm.h"
+#include "timer.h"
+#include "string.h"
+
+extern uint8_t _kernel_start[];
+extern uint8_t _kernel_end[];
+
+typedef struct {
+    uint32_t eip;
+    uint32_t callers[PROFILE_DEPTH];    // Return addresses, innermost first; 0 ends
+} profile_sample_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t user;                      // Interrupted ring 3; counted, not stored
+    uint32_t dropped;                   // Arrived with the buffer full
+    profile_sample_t samples[PROFILE_SAMPLES];
+} profile_cpu_t;
+
+volatile int profile_active = 0;
+uint32_t profile_period_ns = 0;
+
+static profile_cpu_t profile_cpus[SMP_MAX_CPUS];
+static int profile_callers = 0;         // -g: walk the frame chain
+static uint32_t profile_hz = 0;
+static uint32_t profile_start_tick = 0;
+static uint32_t profile_ticks = 0;      // Length of the last finished run
+
+// Report scratch, indexed by ksym_index
+static uint32_t profile_self[PROFILE_MAX_SYMBOLS];
+static uint32_t profile_total[PROFILE_MAX_SYMBOLS];
+
+// Highest address a frame on the stack holding frame may reach: the rest of
+// its page for a pool stack, the image for the boot stack; 0 if unknown
+static uint32_t profile_stack_limit(uint32_t frame) {
+    if (frame >= KSTACK_START && frame < KSTACK_START + KSTACK_REGION_SIZE) {
+        return PAGE_FLOOR(frame) + PAGE_SIZE;
+    }
+    if (frame >= (uint32_t)_kernel_start && frame < (uint32_t)_kernel_end) {
+        return (uint32_t)_kernel_end;
+    }
+    return 0;
+}
+
+// Follow the saved EBPs up from the interrupted frame; every link must stay
+// on the same stack and move towards its top
+static void profile_backtrace(profile_sample_t* sample, uint32_t ebp, uint32_t frame) {
+    uint32_t limit = profile_stack_limit(frame);
+    uint32_t depth = 0;
+    while (depth < PROFILE_DEPTH && limit && ebp > frame && ebp + 8 <= limit && !(ebp & 3)) {
+        const uint32_t* link = (const uint32_t*)ebp;
+        if (!link[1]) {
+            break;
+        }
+        sample->callers[depth++] = link[1];
+        frame = ebp;
+        ebp = link[0];
+    }
+    if (depth < PROFILE_DEPTH) {
+        sample->callers[depth] = 0;
+    }
+}
+
+void profile_sample(uint32_t vector, uint32_t eip, uint32_t cs, uint32_t ebp, uint32_t frame) {
+    // The PIT only drives the scheduler when the local APICs aren't one-shot
+    if (vector != LAPIC_TIMER_VECTOR &&
+        (vector != IRQ_VECTOR_BASE + IRQ0_TIMER || lapic_timer_oneshot)) {
+        return;
+    }
+    profile_cpu_t* pc = &profile_cpus[smp_current_cpu() - cpus];
+    if (cs & 3) {
+        pc->user++;
+        return;
+    }
+    if (pc->count == PROFILE_SAMPLES) {
+        pc->dropped++;
+        return;
+    }
+    profile_sample_t* sample = &pc->samples[pc->count];
+    sample->eip = eip;
+    sample->callers[0] = 0;
+    if (profile_callers) {
+        profile_backtrace(sample, ebp, frame);
+    }
+    pc->count++;
+}
+
+static void profile_start(int callers, uint32_t hz) {
+    profile_active = 0;
+    __sync_synchronize();
+    memset(profile_cpus, 0, sizeof(profile_cpus));
+    profile_callers = callers;
+    profile_hz = lapic_timer_oneshot ? hz : TIMER_FREQUENCY;
+    profile_period_ns = lapic_timer_oneshot ? 1000000000 / hz : 0;
+    profile_start_tick = timer_get_ticks();
+    __sync_synchronize();
+    profile_active = 1;
+    terminal_printf("Profiling at %d Hz per CPU%s, %d samples per CPU\n", (int)profile_hz,
+                    callers ? " with call chains" : "", PROFILE_SAMPLES);
+}
+
+static void profile_stop(void) {
+    if (!profile_active) {
+        terminal_writestring("Profiler is not running\n");
+        return;
+    }
+    profile_active = 0;
+    profile_period_ns = 0;
+    profile_ticks = timer_get_ticks() - profile_start_tick;
+    terminal_writestring("Profiler stopped - 'profile report' to see the results\n");
+}
+
+// Bucket for an address: a ksym_index, or PROFILE_MAX_SYMBOLS for unknown
+static uint32_t profile_bucket(uint32_t address) {
+    int index = ksym_index(address);
+    return (index < 0 || index >= PROFILE_MAX_SYMBOLS) ? PROFILE_MAX_SYMBOLS : (uint32_t)index;
+}
+
+static void profile_print_row(uint32_t self, uint32_t total, uint32_t samples, const char* name) {
+    uint32_t self_pct = self * 1000 / samples;
+    terminal_printf("  %d.%d%%  %d", (int)(self_pct / 10), (int)(self_pct % 10), (int)self);
+    if (profile_callers) {
+        uint32_t total_pct = total * 1000 / samples;
+        terminal_printf("  %d.%d%%  %d", (int)(total_pct / 10), (int)(total_pct % 10), (int)total);
+    }
+    terminal_printf("  %s\n", name);
+}
+
+static void profile_report(uint32_t top) {
+    memset(profile_self, 0, sizeof(profile_self));
+    memset(profile_total, 0, sizeof(profile_total));
+    uint32_t kernel = 0, user = 0, dropped = 0, unknown = 0, cpus_seen = 0;
+    for (uint32_t c = 0; c < SMP_MAX_CPUS; c++) {
+        profile_cpu_t* pc = &profile_cpus[c];
+        uint32_t count = pc->count;
+        user += pc->user;
+        dropped += pc->dropped;
+        if (count || pc->user) {
+            cpus_seen++;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            const profile_sample_t* sample = &pc->samples[i];
+            uint32_t seen[PROFILE_DEPTH + 1];
+            uint32_t bucket = profile_bucket(sample->eip);
+            if (bucket == PROFILE_MAX_SYMBOLS) {
+                unknown++;
+            } else {
+                profile_self[bucket]++;
+            }
+            // Total: each function once per sample, however often it recurses
+            uint32_t distinct = 0;
+            for (uint32_t d = 0; d <= PROFILE_DEPTH; d++) {
+                uint32_t address = d ? sample->callers[d - 1] : sample->eip;
+                if (d && !address) {
+                    break;
+                }
+                // A return address is just past the call, which may be a
+                // function's last instruction
+                bucket = profile_bucket(d ? address - 1 : address);
+                bool repeat = (bucket == PROFILE_MAX_SYMBOLS);
+                for (uint32_t s = 0; s < distinct && !repeat; s++) {
+                    repeat = (seen[s] == bucket);
+                }
+                if (!repeat) {
+                    seen[distinct++] = bucket;
+                    profile_total[bucket]++;
+                }
+            }
+        }
+        kernel += count;
+    }
+
+    uint32_t samples = kernel + user;
+    uint32_t ticks = profile_active ? timer_get_ticks() - profile_start_tick : profile_ticks;
+    terminal_printf("Profile: %d samples on %d CPU(s) over %d ms at %d Hz%s\n", (int)samples,
+                    (int)cpus_seen, (int)(ticks * (1000 / TIMER_FREQUENCY)), (int)profile_hz,
+                    profile_active ? " (still running)" : "");
+    if (dropped) {
+        terminal_printf("  %d samples dropped with the buffers full\n", (int)dropped);
+    }
+    if (!samples) {
+        return;
+    }
+    if (!ksym_total()) {
+        terminal_writestring("  No symbol table linked in - functions can't be named\n");
+    }
+    terminal_writestring(profile_callers ? "  Self          Total         Function\n"
+                                         : "  Self          Function\n");
+
+    uint32_t symbols = ksym_total() < PROFILE_MAX_SYMBOLS ? ksym_total() : PROFILE_MAX_SYMBOLS;
+    for (uint32_t rank = 0; rank < top; rank++) {
+        uint32_t best = 0;
+        for (uint32_t s = 1; s < symbols; s++) {
+            if (profile_self[s] > profile_self[best]) {
+                best = s;
+            }
+        }
+        if (best >= symbols || !profile_self[best]) {
+            break;
+        }
+        profile_print_row(profile_self[best], profile_total[best], samples, ksym_name((int)best));
+        profile_self[best] = 0;         // Taken; the scratch is rebuilt every report
+    }
+    if (user) {
+        profile_print_row(user, user, samples, "[user mode]");
+    }
+    if (unknown) {
+        profile_print_row(unknown, unknown, samples, "[unknown]");
+    }
+}
+
+void profile_command(int argc, char argv[][64]) {
+    if (argc >= 2 && strcmp(argv[1], "start") == 0) {
+        int callers = 0;
+        uint32_t hz = PROFILE_HZ;
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "-g") == 0) {
+                callers = 1;
+            } else {
+                int value = atoi(argv[i]);
+                if (value <= 0 || value > PROFILE_MAX_HZ) {
+                    terminal_printf("Sampling rate must be 1-%d Hz\n", PROFILE_MAX_HZ);
+                    return;
+                }
+                hz = (uint32_t)value;
+            }
+        }
+        profile_start(callers, hz);
+    } else if (argc == 2 && strcmp(argv[1], "stop") == 0) {
+        profile_stop();
+    } else if (argc >= 2 && argc <= 3 && strcmp(argv[1], "report") == 0) {
+        int top = argc == 3 ? atoi(argv[2]) : PROFILE_TOP;
+        profile_report(top > 0 ? (uint32_t)top : PROFILE_TOP);
+    } else {
+        terminal_writestring("Usage: profile start [-g] [hz] | stop | report [n]\n");
+    }
+}
@@ -0,0 +1,31 @@
+// ClaudeOS Sampling Profiler - Day 21
+// While running, every timer interrupt records where it interrupted the
+// CPU it arrived on - the EIP and, with -g, the return addresses of a few
+// frames up the EBP chain - into that CPU's sample buffer. The report
+// resolves them against the kernel's symbol table (ksyms.h). With the
+// local APICs in one-shot mode each CPU is interrupted at the sampling
+// rate; otherwise samples come at the scheduler tick. Code running with
+// interrupts disabled is never sampled.
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "types.h"
+
+#define PROFILE_SAMPLES     2048        // Per CPU; recording stops when full
+#define PROFILE_DEPTH       4           // Callers kept per sample with -g
+#define PROFILE_HZ          250         // Default sampling rate
+#define PROFILE_MAX_HZ      10000
+#define PROFILE_MAX_SYMBOLS 4096        // Functions the report can count apart
+#define PROFILE_TOP         15          // Functions listed by default
+
+extern volatile int profile_active;
+extern uint32_t profile_period_ns;      // One-shot timers fire at least this often (0: off)
+
+// From irq_handler, for every interrupt while profile_active
+void profile_sample(uint32_t vector, uint32_t eip, uint32_t cs, uint32_t ebp, uint32_t frame);
+
+// Shell: profile start [-g] [hz] | stop | report [n]
+void profile_command(int argc, char argv[][64]);
+
+#endif // PROFILE_H
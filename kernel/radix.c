@@ -0,0 +1,186 @@
+// ClaudeOS Radix Tree Implementation - Day 21
+
+#include "radix.h"
+#include "heap.h"
+
+void radix_init(radix_tree_t* tree) {
+    tree->root = NULL;
+    tree->height = 0;
+    tree->count = 0;
+    tree->nodes = 0;
+}
+
+// Whether a tree of height holds key
+static inline bool radix_fits(uint32_t height, uint32_t key) {
+    return height >= RADIX_MAX_HEIGHT || key < (1u << (RADIX_BITS * height));
+}
+
+static inline uint32_t radix_index(uint32_t key, uint32_t level) {
+    return (key >> (RADIX_BITS * level)) & (RADIX_SLOTS - 1);
+}
+
+static radix_node_t* radix_node_alloc(radix_tree_t* tree) {
+    radix_node_t* node = (radix_node_t*)kcalloc(1, sizeof(radix_node_t));
+    if (node) {
+        tree->nodes++;
+    }
+    return node;
+}
+
+static void radix_node_free(radix_tree_t* tree, radix_node_t* node) {
+    kfree(node);
+    tree->nodes--;
+}
+
+int radix_insert(radix_tree_t* tree, uint32_t key, void* item) {
+    if (!item) {
+        return -1;
+    }
+    if (!tree->root) {
+        tree->root = radix_node_alloc(tree);
+        if (!tree->root) {
+            return -1;
+        }
+        tree->height = 1;
+    }
+    // Taller: the old root becomes slot 0 of a new one
+    while (!radix_fits(tree->height, key)) {
+        radix_node_t* root = radix_node_alloc(tree);
+        if (!root) {
+            return -1;
+        }
+        root->slots[0] = tree->root;
+        root->count = 1;
+        tree->root = root;
+        tree->height++;
+    }
+
+    radix_node_t* node = tree->root;
+    for (uint32_t level = tree->height - 1; level > 0; level--) {
+        uint32_t index = radix_index(key, level);
+        if (!node->slots[index]) {
+            radix_node_t* child = radix_node_alloc(tree);
+            if (!child) {
+                return -1;  // The empty nodes above go with the next delete under them
+            }
+            node->slots[index] = child;
+            node->count++;
+        }
+        node = (radix_node_t*)node->slots[index];
+    }
+    uint32_t index = radix_index(key, 0);
+    if (node->slots[index]) {
+        return -1;
+    }
+    node->slots[index] = item;
+    node->count++;
+    tree->count++;
+    return 0;
+}
+
+void* radix_lookup(const radix_tree_t* tree, uint32_t key) {
+    if (!tree->root || !radix_fits(tree->height, key)) {
+        return NULL;
+    }
+    radix_node_t* node = tree->root;
+    for (uint32_t level = tree->height - 1; level > 0; level--) {
+        node = (radix_node_t*)node->slots[radix_index(key, level)];
+        if (!node) {
+            return NULL;
+        }
+    }
+    return node->slots[radix_index(key, 0)];
+}
+
+void* radix_delete(radix_tree_t* tree, uint32_t key) {
+    if (!tree->root || !radix_fits(tree->height, key)) {
+        return NULL;
+    }
+    radix_node_t* path[RADIX_MAX_HEIGHT];
+    radix_node_t* node = tree->root;
+    for (uint32_t level = tree->height - 1; level > 0; level--) {
+        path[level] = node;
+        node = (radix_node_t*)node->slots[radix_index(key, level)];
+        if (!node) {
+            return NULL;
+        }
+    }
+    uint32_t index = radix_index(key, 0);
+    void* item = node->slots[index];
+    if (!item) {
+        return NULL;
+    }
+    node->slots[index] = NULL;
+    node->count--;
+    tree->count--;
+
+    // Free the nodes left empty, bottom up
+    for (uint32_t level = 0; node->count == 0; level++) {
+        radix_node_free(tree, node);
+        if (level + 1 >= tree->height) {
+            tree->root = NULL;
+            tree->height = 0;
+            return item;
+        }
+        node = path[level + 1];
+        node->slots[radix_index(key, level + 1)] = NULL;
+        node->count--;
+    }
+
+    // Shorter: a root with only slot 0 in use is not needed
+    while (tree->height > 1 && tree->root->count == 1 && tree->root->slots[0]) {
+        radix_node_t* root = tree->root;
+        tree->root = (radix_node_t*)root->slots[0];
+        tree->height--;
+        radix_node_free(tree, root);
+    }
+    return item;
+}
+
+// Smallest item at or after from under node, which covers keys from base
+static void* radix_scan(const radix_node_t* node, uint32_t level, uint32_t base, uint32_t from,
+                        uint32_t* key) {
+    uint32_t shift = RADIX_BITS * level;
+    uint32_t start = from > base ? (from - base) >> shift : 0;
+    for (uint32_t i = start; i < RADIX_SLOTS; i++) {
+        void* slot = node->slots[i];
+        if (!slot) {
+            continue;
+        }
+        uint32_t slot_base = base + (i << shift);
+        if (level == 0) {
+            *key = slot_base;
+            return slot;
+        }
+        void* item = radix_scan((const radix_node_t*)slot, level - 1, slot_base, from, key);
+        if (item) {
+            return item;
+        }
+    }
+    return NULL;
+}
+
+void* radix_next(const radix_tree_t* tree, uint32_t* key) {
+    if (!tree->root || !radix_fits(tree->height, *key)) {
+        return NULL;
+    }
+    return radix_scan(tree->root, tree->height - 1, 0, *key, key);
+}
+
+static void radix_free_level(radix_tree_t* tree, radix_node_t* node, uint32_t level) {
+    if (level > 0) {
+        for (uint32_t i = 0; i < RADIX_SLOTS; i++) {
+            if (node->slots[i]) {
+                radix_free_level(tree, (radix_node_t*)node->slots[i], level - 1);
+            }
+        }
+    }
+    radix_node_free(tree, node);
+}
+
+void radix_destroy(radix_tree_t* tree) {
+    if (tree->root) {
+        radix_free_level(tree, tree->root, tree->height - 1);
+    }
+    radix_init(tree);
+}
@@ -0,0 +1,54 @@
+// ClaudeOS Radix Trees - Day 21
+// Sparse 32-bit keys to non-NULL pointers, 6 key bits per level (64
+// slots a node). The tree is only as tall as its largest key needs: keys
+// under 64 take one node, under 4096 two, and so on up to six, growing
+// at the root as bigger keys arrive and shrinking back as they go. Empty
+// nodes are freed on delete, so memory follows the keys present rather
+// than the key range. Lookups walk at most six nodes with no hashing and
+// radix_next visits keys in order, which suits offsets, block numbers
+// and other dense-in-places indices. Trees do no locking of their own.
+//
+//   uint32_t key = 0;
+//   for (void* item; (item = radix_next(&tree, &key)) != NULL; key++) {
+//       ...
+//       if (key == 0xFFFFFFFF) break;
+//   }
+
+#ifndef RADIX_H
+#define RADIX_H
+
+#include "types.h"
+
+#define RADIX_BITS          6
+#define RADIX_SLOTS         (1 << RADIX_BITS)
+#define RADIX_MAX_HEIGHT    6           // ceil(32 / RADIX_BITS)
+
+typedef struct radix_node {
+    void* slots[RADIX_SLOTS];           // Children, or items at the bottom level
+    uint32_t count;                     // Slots in use
+} radix_node_t;
+
+typedef struct {
+    radix_node_t* root;
+    uint32_t height;                    // Levels below and including root (0: empty)
+    uint32_t count;                     // Items
+    uint32_t nodes;
+} radix_tree_t;
+
+#define RADIX_TREE_INIT { NULL, 0, 0, 0 }
+
+void radix_init(radix_tree_t* tree);
+
+// Store item (not NULL) at key: 0, or -1 if key is taken or out of memory
+int radix_insert(radix_tree_t* tree, uint32_t key, void* item);
+void* radix_lookup(const radix_tree_t* tree, uint32_t key);
+// Remove key's item and return it (NULL if there was none)
+void* radix_delete(radix_tree_t* tree, uint32_t key);
+
+// The item with the smallest key >= *key, which is updated to its key
+void* radix_next(const radix_tree_t* tree, uint32_t* key);
+
+// Free every node; the items are the caller's
+void radix_destroy(radix_tree_t* tree);
+
+#endif // RADIX_H
@@ -0,0 +1,159 @@
+// ClaudeOS Read-Copy-Update Implementation - Day 21
+// Quiescent-state based: each CPU bumps its cpu_t.rcu_qs by two at every
+// quiescent state, and by one going into and out of cpu_idle, so an odd
+// count means "idle, no reader possible". A grace period snapshots the
+// counts of the online CPUs and ends once each has moved on or was idle
+// at the snapshot. Callbacks queue for the next grace period while one is
+// running; when it ends they are handed to the RCU softirq on the CPU
+// that noticed.
+
+#include "rcu.h"
+#include "smp.h"
+#include "lock.h"
+#include "softirq.h"
+#include "process.h"
+#include "kernel.h"
+
+typedef struct {
+    rcu_head_t* head;
+    rcu_head_t** tail;
+} rcu_list_t;
+
+static spinlock_t rcu_lock;
+static rcu_list_t rcu_next = { NULL, &rcu_next.head };     // For the next grace period
+static rcu_list_t rcu_wait = { NULL, &rcu_wait.head };     // For the current one
+static rcu_list_t rcu_done = { NULL, &rcu_done.head };     // Ready to run
+static volatile int rcu_gp_active = 0;
+static uint32_t rcu_snap[SMP_MAX_CPUS];     // Counts at the start of the current grace period
+static uint32_t rcu_grace_periods = 0;
+static uint32_t rcu_callbacks_queued = 0;
+static uint32_t rcu_callbacks_run = 0;
+
+static void rcu_list_splice(rcu_list_t* to, rcu_list_t* from) {
+    if (!from->head) {
+        return;
+    }
+    *to->tail = from->head;
+    to->tail = from->tail;
+    from->head = NULL;
+    from->tail = &from->head;
+}
+
+// Start a grace period for everything queued so far (rcu_lock held). The
+// fence orders the writer's unlinking before the snapshot.
+static void rcu_gp_start(void) {
+    rcu_list_splice(&rcu_wait, &rcu_next);
+    __sync_synchronize();
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        rcu_snap[i] = cpus[i].rcu_qs;
+    }
+    rcu_gp_active = 1;
+}
+
+static bool rcu_gp_passed(void) {
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        if (cpus[i].online && !(rcu_snap[i] & 1) && cpus[i].rcu_qs == rcu_snap[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// End the current grace period if every CPU has passed (rcu_lock held)
+static void rcu_gp_check(void) {
+    if (!rcu_gp_active || !rcu_gp_passed()) {
+        return;
+    }
+    rcu_list_splice(&rcu_done, &rcu_wait);
+    rcu_grace_periods++;
+    rcu_gp_active = 0;
+    softirq_raise(SOFTIRQ_RCU);
+    if (rcu_next.head) {
+        rcu_gp_start();
+    }
+}
+
+void call_rcu(rcu_head_t* head, void (*func)(rcu_head_t* head)) {
+    head->next = NULL;
+    head->func = func;
+    uint32_t flags = spin_lock_irqsave(&rcu_lock);
+    *rcu_next.tail = head;
+    rcu_next.tail = &head->next;
+    rcu_callbacks_queued++;
+    if (!rcu_gp_active) {
+        rcu_gp_start();
+    }
+    spin_unlock_irqrestore(&rcu_lock, flags);
+}
+
+void rcu_quiescent(void) {
+    percpu_add(rcu_qs, 2);
+    if (rcu_gp_active) {
+        uint32_t flags = spin_lock_irqsave(&rcu_lock);
+        rcu_gp_check();
+        spin_unlock_irqrestore(&rcu_lock, flags);
+    }
+}
+
+// Interrupts are off in both: the count is odd only while nothing runs
+void rcu_idle_enter(void) {
+    percpu_inc(rcu_qs);
+    if (rcu_gp_active) {
+        uint32_t flags = spin_lock_irqsave(&rcu_lock);
+        rcu_gp_check();
+        spin_unlock_irqrestore(&rcu_lock, flags);
+    }
+}
+
+void rcu_idle_exit(void) {
+    percpu_inc(rcu_qs);
+}
+
+static void rcu_softirq(void) {
+    uint32_t flags = spin_lock_irqsave(&rcu_lock);
+    rcu_head_t* head = rcu_done.head;
+    rcu_done.head = NULL;
+    rcu_done.tail = &rcu_done.head;
+    spin_unlock_irqrestore(&rcu_lock, flags);
+    while (head) {
+        rcu_head_t* next = head->next;
+        head->func(head);
+        __sync_fetch_and_add(&rcu_callbacks_run, 1);
+        head = next;
+    }
+}
+
+typedef struct {
+    rcu_head_t head;                    // First, so the callback can cast back
+    volatile int done;
+} rcu_waiter_t;
+
+static void rcu_waiter_done(rcu_head_t* head) {
+    ((rcu_waiter_t*)head)->done = 1;
+}
+
+// Yielding is itself a quiescent state, so this CPU never holds it up
+void synchronize_rcu(void) {
+    rcu_waiter_t waiter;
+    waiter.done = 0;
+    call_rcu(&waiter.head, rcu_waiter_done);
+    while (!waiter.done) {
+        process_yield();
+    }
+}
+
+void rcu_init(void) {
+    spin_lock_init(&rcu_lock, "rcu");
+    softirq_register(SOFTIRQ_RCU, rcu_softirq);
+}
+
+void rcu_dump_stats(void) {
+    terminal_printf("RCU: %d grace periods, %d callbacks queued, %d run, grace period %s\n",
+                    (int)rcu_grace_periods, (int)rcu_callbacks_queued, (int)rcu_callbacks_run,
+                    rcu_gp_active ? "running" : "idle");
+    for (uint32_t cpu = 0; cpu < smp_cpu_count; cpu++) {
+        uint32_t qs = cpus[cpu].rcu_qs;
+        terminal_printf("  cpu%d: %d quiescent states%s\n", (int)cpu, (int)(qs >> 1),
+                        (qs & 1) ? " (idle)" : "");
+    }
+}
@@ -0,0 +1,55 @@
+// ClaudeOS Read-Copy-Update - Day 21
+// Lock-free readers for read-mostly tables (PID hash, ARP cache). A reader
+// runs between rcu_read_lock and rcu_read_unlock with interrupts off, so
+// it is never preempted and never sleeps; a CPU has no reader left from
+// before once it context switches, takes a scheduler tick from interrupted
+// code or waits in cpu_idle. A writer unlinks or replaces an object under
+// its own lock and hands the old one to call_rcu, which runs the callback
+// after every online CPU has passed one of those quiescent states.
+
+#ifndef RCU_H
+#define RCU_H
+
+#include "types.h"
+
+typedef struct rcu_head {
+    struct rcu_head* next;
+    void (*func)(struct rcu_head* head);
+} rcu_head_t;
+
+static inline uint32_t rcu_read_lock(void) {
+    uint32_t flags;
+    asm volatile ("pushf; pop %0; cli" : "=r" (flags) : : "memory");
+    return flags;
+}
+
+static inline void rcu_read_unlock(uint32_t flags) {
+    asm volatile ("push %0; popf" : : "r" (flags) : "memory", "cc");
+}
+
+// Pointer loads and stores readers may race with. x86 keeps stores in
+// order, so publishing only has to stop the compiler moving the object's
+// initialisation past the store.
+#define rcu_dereference(p) (*(__typeof__(p) volatile*)&(p))
+#define rcu_assign_pointer(p, v) do { \
+    asm volatile ("" : : : "memory"); \
+    (p) = (v); \
+} while (0)
+
+// Run func(head) once every reader that could have seen the object is
+// done. Callable from any context; callbacks run from the RCU softirq.
+void call_rcu(rcu_head_t* head, void (*func)(rcu_head_t* head));
+
+// Wait for a full grace period (may sleep; not from interrupt handlers)
+void synchronize_rcu(void);
+
+// Quiescent states, reported by the scheduler (interrupts off) ...
+void rcu_quiescent(void);
+// ... and by cpu_idle around its wait: an idle CPU holds up no grace period
+void rcu_idle_enter(void);
+void rcu_idle_exit(void);
+
+void rcu_init(void);
+void rcu_dump_stats(void);
+
+#endif // RCU_H
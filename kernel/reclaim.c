@@ -0,0 +1,121 @@
+// ClaudeOS Memory Reclaim Implementation - Day 21
+// A shrinker's index is its position in the linker's .shrinkers table,
+// and its counters live in a parallel array. Only one reclaim runs at a
+// time: shrinkers free pages, and a shrinker whose work allocates would
+// otherwise recurse into reclaim through the PMM. Several passes are made
+// because shrinkers feed each other - object caches hand memory back to
+// the heap, and the heap's own shrinker returns it to the PMM.
+
+#include "reclaim.h"
+#include "pmm.h"
+#include "heap.h"
+#include "kernel.h"
+#include "string.h"
+#include "stats.h"
+
+STAT_DEFINE(stat_reclaim_direct, "reclaim.direct", STAT_COUNTER, "reclaims run by an allocation");
+STAT_DEFINE(stat_reclaim_idle, "reclaim.idle", STAT_COUNTER, "reclaims run by the idle loop");
+STAT_DEFINE(stat_reclaim_pages, "reclaim.pages", STAT_COUNTER, "pages the shrinkers released");
+
+extern const shrinker_t _shrinkers_start[];
+extern const shrinker_t _shrinkers_end[];
+
+typedef struct {
+    uint32_t calls;
+    uint32_t released;                  // Pages, over every call
+} shrinker_state_t;
+
+static shrinker_state_t shrinker_states[RECLAIM_MAX_SHRINKERS];
+static volatile uint32_t reclaim_running = 0;
+static bool reclaim_from_idle = false;
+static bool reclaim_may_wait = false;   // SHRINK_IO shrinkers run (idle loop, shell)
+
+static uint32_t shrinker_count(void) {
+    uint32_t count = (uint32_t)(_shrinkers_end - _shrinkers_start);
+    return count < RECLAIM_MAX_SHRINKERS ? count : RECLAIM_MAX_SHRINKERS;
+}
+
+uint32_t reclaim_pages(uint32_t target) {
+    if (target == 0 || !__sync_bool_compare_and_swap(&reclaim_running, 0, 1)) {
+        return 0;
+    }
+    stat_inc(reclaim_from_idle ? &stat_reclaim_idle : &stat_reclaim_direct);
+
+    uint32_t released = 0;
+    for (uint32_t pass = 0; pass < RECLAIM_MAX_PASSES && released < target; pass++) {
+        uint32_t progress = released;
+        for (uint32_t i = 0; i < shrinker_count() && released < target; i++) {
+            const shrinker_t* shrinker = &_shrinkers_start[i];
+            if ((shrinker->flags & SHRINK_HEAP) && heap_locked()) {
+                continue;               // The caller may be the holder
+            }
+            if ((shrinker->flags & SHRINK_IO) && !reclaim_may_wait) {
+                continue;               // An allocation can't wait on a write-out
+            }
+            if (shrinker->count() == 0) {
+                continue;
+            }
+            uint32_t freed = shrinker->scan(target - released);
+            shrinker_states[i].calls++;
+            shrinker_states[i].released += freed;
+            released += freed;
+        }
+        if (released == progress) {
+            break;                      // Nothing left to give
+        }
+    }
+
+    stat_add(&stat_reclaim_pages, (int32_t)released);
+    __sync_lock_release(&reclaim_running);
+    return released;
+}
+
+bool reclaim_idle(void) {
+    uint32_t free_now = pmm_get_watermark_pages();
+    if (free_now >= PMM_WATERMARK_LOW) {
+        return false;
+    }
+    uint32_t target = PMM_WATERMARK_HIGH - free_now;
+    reclaim_from_idle = true;
+    reclaim_may_wait = true;
+    reclaim_pages(target < RECLAIM_IDLE_BATCH ? target : RECLAIM_IDLE_BATCH);
+    reclaim_may_wait = false;
+    reclaim_from_idle = false;
+    return true;
+}
+
+void reclaim_command(int argc, char argv[][64]) {
+    if (argc > 2) {
+        terminal_writestring("Usage: reclaim [pages]\n");
+        return;
+    }
+    if (argc == 2) {
+        int target = atoi(argv[1]);
+        if (target <= 0) {
+            terminal_writestring("Usage: reclaim [pages]\n");
+            return;
+        }
+        reclaim_may_wait = true;
+        uint32_t released = reclaim_pages((uint32_t)target);
+        reclaim_may_wait = false;
+        terminal_printf("Released %d of %d pages\n", (int)released, target);
+        return;
+    }
+
+    terminal_printf("Free pages: %d (watermarks: min %d, low %d, high %d)\n",
+                    (int)pmm_get_watermark_pages(), PMM_WATERMARK_MIN, PMM_WATERMARK_LOW,
+                    PMM_WATERMARK_HIGH);
+    uint32_t total = (uint32_t)(_shrinkers_end - _shrinkers_start);
+    if (total > RECLAIM_MAX_SHRINKERS) {
+        terminal_printf("reclaim: %d shrinkers defined, only the first %d run\n", (int)total,
+                        RECLAIM_MAX_SHRINKERS);
+    }
+    terminal_writestring("  NAME        RECLAIMABLE  CALLS  RELEASED\n");
+    for (uint32_t i = 0; i < shrinker_count(); i++) {
+        const shrinker_t* shrinker = &_shrinkers_start[i];
+        terminal_printf("  %s  %d  %d  %d%s\n", shrinker->name, (int)shrinker->count(),
+                        (int)shrinker_states[i].calls, (int)shrinker_states[i].released,
+                        (shrinker->flags & SHRINK_HEAP) ? "  (heap)" :
+                        (shrinker->flags & SHRINK_IO) ? "  (waits for I/O)" : "");
+    }
+}
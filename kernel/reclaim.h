@@ -0,0 +1,46 @@
+// ClaudeOS Memory Reclaim - Day 21
+// Caches that hold memory they could give back declare a shrinker with
+// SHRINKER next to the cache; the linker gathers them into one table.
+// An allocation that finds the PMM under its minimum watermark, or a
+// kmalloc the heap can't grow for, runs them in turn until enough pages
+// are back (direct reclaim). The shell's idle loop does the same whenever
+// free memory is under the low watermark, topping it up to the high one,
+// so foreground allocations rarely have to wait.
+
+#ifndef RECLAIM_H
+#define RECLAIM_H
+
+#include "types.h"
+
+#define RECLAIM_MAX_SHRINKERS   16      // Descriptors the state table has room for
+#define RECLAIM_MAX_PASSES      4       // Rounds over the table per reclaim
+#define RECLAIM_IDLE_BATCH      16      // Pages one idle step aims to release
+
+// Shrinker flags
+#define SHRINK_HEAP             1       // Takes the heap lock; skipped while it is held
+#define SHRINK_IO               2       // Waits for the disk; only the idle loop and shell run it
+
+typedef struct {
+    const char* name;
+    uint32_t (*count)(void);            // Pages it could release right now
+    uint32_t (*scan)(uint32_t target);  // Release up to target pages; returns pages released
+    uint32_t flags;
+} shrinker_t;
+
+#define SHRINKER(var, name, count, scan, flags) \
+    static const shrinker_t var __attribute__((section(".shrinkers"), used, aligned(4))) = \
+        { name, count, scan, flags }
+
+// Run the shrinkers until target pages are released or a whole pass
+// frees nothing; returns the pages released. Safe from any allocation
+// path: a reclaim already running on the way in returns 0.
+uint32_t reclaim_pages(uint32_t target);
+
+// Idle-loop step: when free memory is below the low watermark, reclaim
+// one batch towards the high watermark; true if it ran
+bool reclaim_idle(void);
+
+// Shell: reclaim [pages] - the shrinkers and watermarks, or run a reclaim
+void reclaim_command(int argc, char argv[][64]);
+
+#endif // RECLAIM_H
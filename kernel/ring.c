@@ -0,0 +1,109 @@
+// ClaudeOS Ring Buffers Implementation - Day 21
+// SPSC rings relying on x86 store and load ordering (compiler barriers only)
+
+#include "ring.h"
+#include "string.h"
+
+// x86 never reorders a store with an earlier store, or a load with an
+// earlier load, so only the compiler has to be kept from moving the
+// element copies across the index updates
+static inline void ring_barrier(void) {
+    asm volatile ("" : : : "memory");
+}
+
+// Set up a ring over caller-provided storage (-1 if capacity isn't a power of two)
+int ring_init(ring_t* ring, void* storage, uint32_t capacity, uint32_t elem_size) {
+    if (!ring || !storage || capacity == 0 || (capacity & (capacity - 1)) || elem_size == 0) {
+        return -1;
+    }
+    ring->buffer = (uint8_t*)storage;
+    ring->mask = capacity - 1;
+    ring->elem_size = elem_size;
+    ring_reset(ring);
+    return 0;
+}
+
+// Empty the ring (neither side may be using it)
+void ring_reset(ring_t* ring) {
+    ring->head = 0;
+    ring->tail = 0;
+    ring->tail_cache = 0;
+    ring->head_cache = 0;
+    ring->dropped = 0;
+}
+
+// Copy count elements starting at index, wrapping at the end of the buffer
+static void ring_copy_in(ring_t* ring, uint32_t index, const uint8_t* src, uint32_t count) {
+    uint32_t capacity = ring->mask + 1;
+    uint32_t offset = index & ring->mask;
+    uint32_t first = capacity - offset < count ? capacity - offset : count;
+    memcpy(ring->buffer + offset * ring->elem_size, src, first * ring->elem_size);
+    memcpy(ring->buffer, src + first * ring->elem_size, (count - first) * ring->elem_size);
+}
+
+static void ring_copy_out(ring_t* ring, uint32_t index, uint8_t* dest, uint32_t count) {
+    uint32_t capacity = ring->mask + 1;
+    uint32_t offset = index & ring->mask;
+    uint32_t first = capacity - offset < count ? capacity - offset : count;
+    memcpy(dest, ring->buffer + offset * ring->elem_size, first * ring->elem_size);
+    memcpy(dest + first * ring->elem_size, ring->buffer, (count - first) * ring->elem_size);
+}
+
+// Add up to count elements; returns how many fit (the rest count as dropped)
+uint32_t ring_enqueue(ring_t* ring, const void* elems, uint32_t count) {
+    uint32_t head = ring->head;
+    uint32_t capacity = ring->mask + 1;
+    uint32_t space = capacity - (head - ring->tail_cache);
+    if (space < count) {
+        ring->tail_cache = ring->tail;  // Only look at the consumer's line when short
+        space = capacity - (head - ring->tail_cache);
+    }
+    uint32_t n = count < space ? count : space;
+    ring->dropped += count - n;
+    if (n == 0) {
+        return 0;
+    }
+
+    ring_copy_in(ring, head, (const uint8_t*)elems, n);
+    ring_barrier();  // Elements are visible before the new head
+    ring->head = head + n;
+    return n;
+}
+
+// Add one element; returns 0 on success, -1 if the ring is full
+int ring_push(ring_t* ring, const void* elem) {
+    return ring_enqueue(ring, elem, 1) == 1 ? 0 : -1;
+}
+
+// Remove up to count elements; returns how many were copied out
+uint32_t ring_dequeue(ring_t* ring, void* elems, uint32_t count) {
+    uint32_t tail = ring->tail;
+    uint32_t available = ring->head_cache - tail;
+    if (available < count) {
+        ring->head_cache = ring->head;
+        available = ring->head_cache - tail;
+    }
+    uint32_t n = count < available ? count : available;
+    if (n == 0) {
+        return 0;
+    }
+
+    ring_barrier();  // Read the elements only after seeing the head
+    ring_copy_out(ring, tail, (uint8_t*)elems, n);
+    ring_barrier();  // Done with the slots before handing them back
+    ring->tail = tail + n;
+    return n;
+}
+
+// Remove one element; returns 0 on success, -1 if the ring is empty
+int ring_pop(ring_t* ring, void* elem) {
+    return ring_dequeue(ring, elem, 1) == 1 ? 0 : -1;
+}
+
+uint32_t ring_count(const ring_t* ring) {
+    return ring->head - ring->tail;
+}
+
+int ring_empty(const ring_t* ring) {
+    return ring->head == ring->tail;
+}
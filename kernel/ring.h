@@ -0,0 +1,50 @@
+// ClaudeOS Ring Buffers - Day 21
+// Lock-free single-producer/single-consumer rings for IRQ-to-task queues
+
+#ifndef RING_H
+#define RING_H
+
+#include "types.h"
+
+#define RING_CACHE_LINE 64
+
+// One producer (usually an interrupt handler) and one consumer may use a
+// ring concurrently without locks or disabling interrupts. Indices run
+// freely and are masked on access, so all capacity slots are usable.
+// Each side's index lives on its own cache line together with its cached
+// copy of the other side's index, which it only re-reads when it appears
+// to have run out of room (or of data).
+typedef struct {
+    // Producer side
+    volatile uint32_t head __attribute__((aligned(RING_CACHE_LINE)));
+    uint32_t tail_cache;
+    uint32_t dropped;                   // Elements refused because the ring was full
+
+    // Consumer side
+    volatile uint32_t tail __attribute__((aligned(RING_CACHE_LINE)));
+    uint32_t head_cache;
+
+    // Read-only after ring_init
+    uint8_t* buffer __attribute__((aligned(RING_CACHE_LINE)));
+    uint32_t mask;                      // capacity - 1
+    uint32_t elem_size;
+} ring_t;
+
+// Ring functions (capacity must be a power of two; storage holds
+// capacity * elem_size bytes)
+int ring_init(ring_t* ring, void* storage, uint32_t capacity, uint32_t elem_size);
+void ring_reset(ring_t* ring);
+
+// Producer side
+uint32_t ring_enqueue(ring_t* ring, const void* elems, uint32_t count);
+int ring_push(ring_t* ring, const void* elem);
+
+// Consumer side
+uint32_t ring_dequeue(ring_t* ring, void* elems, uint32_t count);
+int ring_pop(ring_t* ring, void* elem);
+
+// Either side (a snapshot: the other side may move meanwhile)
+uint32_t ring_count(const ring_t* ring);
+int ring_empty(const ring_t* ring);
+
+#endif // RING_H
@@ -0,0 +1,238 @@
+// ClaudeOS Deadline Scheduling Implementation - Day 21
+// One queue shared by every CPU (global EDF): deadline tasks are few, so
+// the sorted insert is a short walk. Throttled tasks wait on a second list
+// that CPU 0's tick looks through. A job that is still running when its
+// deadline passes counts as a miss and carries on with a fresh budget
+// and deadline, so one overrun doesn't turn into a string of them.
+
+#include "sched_dl.h"
+#include "process.h"
+#include "timer.h"
+#include "lock.h"
+#include "stats.h"
+
+STAT_DEFINE(stat_dl_misses, "sched.dl_misses", STAT_COUNTER, "deadline task jobs that missed");
+STAT_DEFINE(stat_dl_throttled, "sched.dl_throttled", STAT_COUNTER, "deadline tasks that used up a budget");
+
+static process_t* dl_ready;             // Sorted by abs_deadline
+static process_t* dl_throttled_list;
+static uint32_t dl_ready_tasks = 0;
+static uint32_t dl_util = 0;            // Admitted, in DL_UTIL_ONE units
+static spinlock_t dl_lock;              // Unregistered; guards both lists and dl_util
+
+static inline bool tick_reached(uint32_t now, uint32_t when) {
+    return (int32_t)(now - when) >= 0;
+}
+
+static inline uint32_t ms_to_ticks(uint32_t ms) {
+    return (ms * TIMER_FREQUENCY + 999) / 1000;
+}
+
+// A new job from now: full budget, deadline and period counted from here
+static void dl_renew(dl_entity_t* dl, uint32_t now) {
+    dl->budget = dl->runtime;
+    dl->abs_deadline = now + dl->deadline;
+    dl->period_end = now + dl->period;
+    dl->throttled = 0;
+}
+
+// Account a job still unfinished at its deadline (dl_lock held)
+static void dl_check_miss(dl_entity_t* dl, uint32_t now) {
+    if (dl->budget > 0 && tick_reached(now, dl->abs_deadline)) {
+        dl->misses++;
+        stat_inc(&stat_dl_misses);
+        dl_renew(dl, now);
+    }
+}
+
+static void dl_insert_ready(process_t* process) {
+    // Behind every earlier or equal deadline, so ties keep arrival order
+    process_t** link = &dl_ready;
+    while (*link && tick_reached(process->dl.abs_deadline, (*link)->dl.abs_deadline)) {
+        link = &(*link)->dl.dl_next;
+    }
+    process->dl.dl_next = *link;
+    *link = process;
+    process->dl.queued = DL_QUEUED_READY;
+    dl_ready_tasks++;
+}
+
+static int dl_remove_from(process_t** list, process_t* process) {
+    for (process_t** link = list; *link; link = &(*link)->dl.dl_next) {
+        if (*link == process) {
+            *link = process->dl.dl_next;
+            process->dl.dl_next = NULL;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Unlink from whichever list holds it (dl_lock held)
+static int dl_unlink_locked(process_t* process) {
+    int removed = 0;
+    if (process->dl.queued == DL_QUEUED_READY) {
+        removed = dl_remove_from(&dl_ready, process);
+        dl_ready_tasks -= (uint32_t)removed;
+    } else if (process->dl.queued == DL_QUEUED_THROTTLED) {
+        removed = dl_remove_from(&dl_throttled_list, process);
+    }
+    process->dl.queued = DL_QUEUED_NONE;
+    return removed;
+}
+
+int dl_set_params(process_t* process, uint32_t runtime_ms, uint32_t deadline_ms, uint32_t period_ms) {
+    if (!process) {
+        return -1;
+    }
+    uint32_t runtime = 0, deadline = 0, period = 0, util = 0;
+    if (runtime_ms) {
+        if (!deadline_ms) {
+            deadline_ms = period_ms;
+        }
+        if (runtime_ms > deadline_ms || deadline_ms > period_ms || period_ms > 60000) {
+            return -1;
+        }
+        runtime = ms_to_ticks(runtime_ms);
+        deadline = ms_to_ticks(deadline_ms);
+        period = ms_to_ticks(period_ms);
+        util = (runtime * DL_UTIL_ONE + period - 1) / period;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&dl_lock);
+    if (dl_util - process->dl.util + util > DL_MAX_UTIL) {
+        spin_unlock_irqrestore(&dl_lock, flags);
+        return -1;
+    }
+    dl_unlink_locked(process);
+    dl_util = dl_util - process->dl.util + util;
+    process->dl.runtime = runtime;
+    process->dl.deadline = deadline;
+    process->dl.period = period;
+    process->dl.util = util;
+    dl_renew(&process->dl, timer_get_ticks());
+    spin_unlock_irqrestore(&dl_lock, flags);
+    return 0;
+}
+
+void dl_release(process_t* process) {
+    uint32_t flags = spin_lock_irqsave(&dl_lock);
+    dl_unlink_locked(process);
+    dl_util -= process->dl.util;
+    process->dl.util = 0;
+    process->dl.period = 0;
+    process->dl.runtime = 0;
+    spin_unlock_irqrestore(&dl_lock, flags);
+}
+
+void dl_enqueue(process_t* process) {
+    uint32_t now = timer_get_ticks();
+    uint32_t flags = spin_lock_irqsave(&dl_lock);
+    dl_entity_t* dl = &process->dl;
+    if (dl->throttled && tick_reached(now, dl->period_end)) {
+        dl_renew(dl, dl->period_end);
+    }
+    if (dl->throttled) {
+        dl->dl_next = dl_throttled_list;
+        dl_throttled_list = process;
+        dl->queued = DL_QUEUED_THROTTLED;
+    } else {
+        // Woken after its deadline: the old job is over, start a new one
+        if (tick_reached(now, dl->abs_deadline)) {
+            dl_renew(dl, now);
+        }
+        dl_insert_ready(process);
+    }
+    spin_unlock_irqrestore(&dl_lock, flags);
+}
+
+process_t* dl_pop(void) {
+    if (!dl_ready) {
+        return NULL;
+    }
+    uint32_t now = timer_get_ticks();
+    uint32_t flags = spin_lock_irqsave(&dl_lock);
+    process_t* process = NULL;
+    while (dl_ready && !process) {
+        process = dl_ready;
+        dl_ready = process->dl.dl_next;
+        process->dl.dl_next = NULL;
+        process->dl.queued = DL_QUEUED_NONE;
+        dl_ready_tasks--;
+        if (process->state != PROCESS_READY) {
+            process = NULL;  // Killed while queued
+        } else {
+            dl_check_miss(&process->dl, now);   // Waited past its deadline
+            process->on_cpu = 1;
+        }
+    }
+    spin_unlock_irqrestore(&dl_lock, flags);
+    return process;
+}
+
+int dl_unlink(process_t* process) {
+    uint32_t flags = spin_lock_irqsave(&dl_lock);
+    int removed = dl_unlink_locked(process);
+    spin_unlock_irqrestore(&dl_lock, flags);
+    return removed;
+}
+
+uint32_t dl_ready_count(void) {
+    return dl_ready_tasks;
+}
+
+void dl_charge(process_t* process, uint32_t now) {
+    uint32_t flags = spin_lock_irqsave(&dl_lock);
+    dl_entity_t* dl = &process->dl;
+    if (dl->throttled) {
+        // Ran on for want of anything else; its next period may be here
+        if (tick_reached(now, dl->period_end)) {
+            dl_renew(dl, dl->period_end);
+        }
+    } else if (dl->budget > 0) {
+        dl->budget--;
+        dl_check_miss(dl, now);
+        if (dl->budget == 0) {
+            dl->throttled = 1;
+            stat_inc(&stat_dl_throttled);
+            if (tick_reached(now, dl->period_end)) {
+                dl_renew(dl, now);      // Overran into its next period
+            }
+        }
+    }
+    spin_unlock_irqrestore(&dl_lock, flags);
+}
+
+void dl_replenish(uint32_t now) {
+    if (!dl_throttled_list) {
+        return;
+    }
+    uint32_t flags = spin_lock_irqsave(&dl_lock);
+    process_t** link = &dl_throttled_list;
+    while (*link) {
+        process_t* process = *link;
+        if (!tick_reached(now, process->dl.period_end)) {
+            link = &process->dl.dl_next;
+            continue;
+        }
+        *link = process->dl.dl_next;
+        dl_renew(&process->dl, process->dl.period_end);
+        dl_insert_ready(process);
+    }
+    spin_unlock_irqrestore(&dl_lock, flags);
+}
+
+int dl_preempts(process_t* current) {
+    process_t* head = dl_ready;         // A hint; dl_pop re-checks under the lock
+    if (!head) {
+        return 0;
+    }
+    if (!current->dl.period || current->dl.throttled) {
+        return 1;
+    }
+    return (int32_t)(head->dl.abs_deadline - current->dl.abs_deadline) < 0;
+}
+
+uint32_t dl_total_util(void) {
+    return dl_util;
+}
@@ -0,0 +1,70 @@
+// ClaudeOS Deadline Scheduling - Day 21
+// An EDF class above the MLFQ: a deadline task asks for runtime out of
+// every period, each job due deadline after its period starts. Ready
+// deadline tasks sit on one global queue sorted by absolute deadline and
+// are always picked before normal tasks; a tick that finds one due
+// earlier than the running task preempts it. A task that uses up its
+// runtime is throttled until its next period, so an overrunning task
+// cannot eat into anyone else's reservation. Admission control keeps
+// the sum of runtime/period under DL_MAX_UTIL, leaving the rest of one
+// CPU to normal tasks.
+
+#ifndef SCHED_DL_H
+#define SCHED_DL_H
+
+#include "types.h"
+
+#define DL_UTIL_ONE         1024        // Utilisation of a whole CPU
+#define DL_MAX_UTIL         972         // 95% of one CPU for every deadline task together
+
+struct process;
+
+// Per-process deadline state (period 0: a normal task). Times in ticks.
+typedef struct {
+    uint32_t runtime;                   // Budget per period
+    uint32_t deadline;                  // Relative to the period's start
+    uint32_t period;
+    uint32_t util;                      // runtime/period in DL_UTIL_ONE units
+    uint32_t budget;                    // Left in this job
+    uint32_t abs_deadline;              // Tick this job is due
+    uint32_t period_end;                // Tick the next job's budget arrives
+    uint32_t misses;                    // Jobs still running at their deadline
+    uint32_t throttled;                 // Budget gone; waits for period_end
+    uint32_t queued;                    // DL_QUEUED_* (dl lock)
+    struct process* dl_next;
+} dl_entity_t;
+
+#define DL_QUEUED_NONE      0
+#define DL_QUEUED_READY     1           // On the EDF queue
+#define DL_QUEUED_THROTTLED 2           // Waiting for its replenishment
+
+// Make process a deadline task (runtime 0: back to a normal one). Times
+// in milliseconds, rounded up to ticks; runtime <= deadline <= period.
+// Returns -1 if the parameters are invalid or admitting it would take
+// the total utilisation past DL_MAX_UTIL. The caller has it off every
+// queue.
+int dl_set_params(struct process* process, uint32_t runtime_ms, uint32_t deadline_ms,
+                  uint32_t period_ms);
+
+// Drop a process's reservation (it is leaving the table)
+void dl_release(struct process* process);
+
+// Queue operations for the scheduler. dl_pop marks what it returns
+// on_cpu, as the MLFQ queues do.
+void dl_enqueue(struct process* process);
+struct process* dl_pop(void);
+int dl_unlink(struct process* process);
+uint32_t dl_ready_count(void);
+
+// Timer tick: charge the running deadline task, and (CPU 0) hand
+// throttled tasks their next period's budget
+void dl_charge(struct process* process, uint32_t now);
+void dl_replenish(uint32_t now);
+
+// Whether a queued deadline task should take the CPU from current
+int dl_preempts(struct process* current);
+
+// Total admitted utilisation, in DL_UTIL_ONE units
+uint32_t dl_total_util(void);
+
+#endif // SCHED_DL_H
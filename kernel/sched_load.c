@@ -0,0 +1,58 @@
+// ClaudeOS Load Tracking Implementation - Day 21
+// Decay is a shift for every whole half-life and one multiply by y^k
+// from a table for the rest, so no division and no floating point.
+
+#include "sched_load.h"
+
+// y^k as a 0.32 fixed-point fraction, y^32 = 1/2
+static const uint32_t load_decay_table[LOAD_HALFLIFE] = {
+    0xffffffff, 0xfa83b2db, 0xf5257d15, 0xefe4b99b,
+    0xeac0c6e7, 0xe5b906e7, 0xe0ccdeec, 0xdbfbb797,
+    0xd744fcca, 0xd2a81d91, 0xce248c15, 0xc9b9bd86,
+    0xc5672a11, 0xc12c4cca, 0xbd08a39f, 0xb8fbaf47,
+    0xb504f333, 0xb123f581, 0xad583eea, 0xa9a15ab4,
+    0xa5fed6a9, 0xa2704303, 0x9ef53260, 0x9b8d39b9,
+    0x9837f051, 0x94f4efa8, 0x91c3d373, 0x8ea4398b,
+    0x8b95c1e3, 0x88980e80, 0x85aac367, 0x82cd8698,
+};
+
+// value * y^periods
+static uint32_t load_decay(uint32_t value, uint64_t periods) {
+    if (periods >= LOAD_HALFLIFE * 32) {
+        return 0;                       // Past 32 half-lives nothing of a 32-bit value is left
+    }
+    uint32_t k = (uint32_t)periods;
+    value >>= k / LOAD_HALFLIFE;
+    if (k % LOAD_HALFLIFE) {
+        value = (uint32_t)(((uint64_t)value * load_decay_table[k % LOAD_HALFLIFE]) >> 32);
+    }
+    return value;
+}
+
+static uint32_t load_fold(uint32_t avg, uint64_t periods, uint32_t weight) {
+    // avg * y^n + weight * (1 - y^n): the old average fades as the new
+    // weight takes its place
+    return load_decay(avg, periods) + (weight - load_decay(weight, periods));
+}
+
+void load_update(load_avg_t* load, uint64_t now, uint32_t weight) {
+    if (!load->stamp) {
+        load->stamp = now;
+        return;
+    }
+    if (now <= load->stamp) {
+        return;
+    }
+    uint64_t periods = (now - load->stamp) >> LOAD_PERIOD_SHIFT;
+    if (periods) {
+        load->avg = load_fold(load->avg, periods, weight);
+        load->stamp += periods << LOAD_PERIOD_SHIFT;
+    }
+}
+
+uint32_t load_peek(const load_avg_t* load, uint64_t now, uint32_t weight) {
+    if (!load->stamp || now <= load->stamp) {
+        return load->avg;
+    }
+    return load_fold(load->avg, (now - load->stamp) >> LOAD_PERIOD_SHIFT, weight);
+}
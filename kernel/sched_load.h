@@ -0,0 +1,39 @@
+// ClaudeOS Load Tracking - Day 21
+// Exponentially decayed averages in the style of Linux's PELT: time is
+// cut into periods of 2^20 ns (about a millisecond), and a period's
+// contribution counts y^k as much k periods later, with y^32 = 1/2. An
+// average fed a constant weight w settles at w, so a task's utilisation
+// (weight LOAD_SCALE while it runs, 0 otherwise) reads as the share of
+// the last few tens of milliseconds it spent on a CPU, and a run queue's
+// load (LOAD_SCALE per runnable task) as its recent queue length.
+// Averages only move forward in whole periods; the remainder carries to
+// the next update, so frequent updates cost no accuracy.
+
+#ifndef SCHED_LOAD_H
+#define SCHED_LOAD_H
+
+#include "types.h"
+
+#define LOAD_SCALE          1024        // One task running all the time
+#define LOAD_PERIOD_SHIFT   20          // ns per period, log2
+#define LOAD_HALFLIFE       32          // Periods for a contribution to halve
+
+typedef struct {
+    uint64_t stamp;                     // clock_ns the average covers up to (0: never updated)
+    uint32_t avg;
+} load_avg_t;
+
+// Fold in the time since the last update at weight; the first call only
+// starts the clock
+void load_update(load_avg_t* load, uint64_t now, uint32_t weight);
+
+// The average as load_update would leave it, without changing it: for
+// readers on other CPUs, and for tasks that haven't run for a while
+uint32_t load_peek(const load_avg_t* load, uint64_t now, uint32_t weight);
+
+// Percent of LOAD_SCALE, rounded
+static inline uint32_t load_percent(uint32_t avg) {
+    return (avg * 100 + LOAD_SCALE / 2) / LOAD_SCALE;
+}
+
+#endif // SCHED_LOAD_H
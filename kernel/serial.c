@@ -4,6 +4,23 @@
 #include "serial.h"
 #include "pic.h"
 #include "kernel.h"
+#include "ring.h"
+#include "lock.h"
+#include "irq.h"
+
+// COM1 input: the IRQ produces, readers consume, neither disables interrupts
+static char serial_rx_buffer[SERIAL_RX_BUFFER_SIZE];
+static ring_t serial_rx_ring;
+static int serial_rx_irq = 0;      // COM1 receive interrupt enabled
+
+// COM1 output: any CPU may write, so both ends of the ring are taken under
+// serial_tx_lock. Writers never wait for the line unless the ring is full.
+static char serial_tx_buffer[SERIAL_TX_BUFFER_SIZE];
+static ring_t serial_tx_ring;
+static spinlock_t serial_tx_lock;   // Unregistered; taken from IRQ4 too
+static int serial_tx_irq = 0;      // COM1 transmit interrupt enabled
+
+static int serial_irq(void* ctx);
 
 // Initialize serial port
 int serial_init(uint16_t port) {
@@ -42,6 +59,18 @@ int serial_init(uint16_t port) {
     // Disable loopback and enable normal operation
     outb(port + SERIAL_MODEM_CTRL_REG, SERIAL_MCR_DTR | SERIAL_MCR_RTS | SERIAL_MCR_OUT2);
     
+    // COM1 is interrupt driven both ways instead of polled byte by byte
+    if (port == SERIAL_COM1_BASE) {
+        ring_init(&serial_rx_ring, serial_rx_buffer, SERIAL_RX_BUFFER_SIZE, sizeof(char));
+        ring_init(&serial_tx_ring, serial_tx_buffer, SERIAL_TX_BUFFER_SIZE, sizeof(char));
+        outb(port + SERIAL_INT_ENABLE_REG, SERIAL_IER_RX_AVAILABLE | SERIAL_IER_TX_EMPTY);
+        if (!serial_rx_irq) {
+            irq_register(IRQ4_SERIAL1, serial_irq, NULL);
+        }
+        serial_rx_irq = 1;
+        serial_tx_irq = 1;
+    }
+    
     return 0;  // Success
 }
 
@@ -52,30 +81,149 @@ int serial_received(uint16_t port) {
 
 // Read a character from serial port
 char serial_getchar(uint16_t port) {
+    if (port == SERIAL_COM1_BASE && serial_rx_irq) {
+        char c;
+        while (ring_pop(&serial_rx_ring, &c) != 0) {
+            // The IRQ handler owns the port: sleep until it has run
+            uint32_t flags;
+            asm volatile ("pushf; pop %0" : "=r" (flags));
+            if (flags & 0x200) {
+                asm volatile ("hlt");
+            } else {
+                asm volatile ("pause");
+            }
+        }
+        return c;
+    }
     while (!serial_received(port)) {
         // Wait for data
     }
     return inb(port + SERIAL_DATA_REG);
 }
 
+// Move up to a FIFO's worth of queued output to the UART if its transmit
+// FIFO is empty (serial_tx_lock held)
+static void serial_tx_pump(void) {
+    if (!serial_is_transmit_empty(SERIAL_COM1_BASE)) {
+        return;     // Still sending; its empty interrupt brings us back
+    }
+    char burst[SERIAL_TX_BURST];
+    uint32_t count = ring_dequeue(&serial_tx_ring, burst, SERIAL_TX_BURST);
+    for (uint32_t i = 0; i < count; i++) {
+        outb(SERIAL_COM1_BASE + SERIAL_DATA_REG, burst[i]);
+    }
+}
+
+// Drain the UART FIFO into the receive ring in batches
+static void serial_rx_drain(void) {
+    char batch[SERIAL_RX_BATCH];
+    uint32_t count = 0;
+    while (serial_received(SERIAL_COM1_BASE)) {
+        batch[count++] = inb(SERIAL_COM1_BASE + SERIAL_DATA_REG);
+        if (count == SERIAL_RX_BATCH) {
+            ring_enqueue(&serial_rx_ring, batch, count);  // Overflow is counted as dropped
+            count = 0;
+        }
+    }
+    if (count) {
+        ring_enqueue(&serial_rx_ring, batch, count);
+    }
+}
+
+// IRQ4: serve every cause the UART reports until it has none left
+static int serial_irq(void* ctx) {
+    (void)ctx;
+    int result = IRQ_NONE;
+    uint8_t iir;
+    while (!((iir = inb(SERIAL_COM1_BASE + SERIAL_FIFO_CTRL_REG)) & SERIAL_IIR_NONE)) {
+        result = IRQ_HANDLED;
+        switch (iir & SERIAL_IIR_ID_MASK) {
+            case SERIAL_IIR_RX_DATA:
+            case SERIAL_IIR_RX_TIMEOUT:
+                serial_rx_drain();
+                break;
+            case SERIAL_IIR_TX_EMPTY: {
+                uint32_t flags = spin_lock_irqsave(&serial_tx_lock);
+                serial_tx_pump();
+                spin_unlock_irqrestore(&serial_tx_lock, flags);
+                break;
+            }
+            case SERIAL_IIR_LINE:
+                inb(SERIAL_COM1_BASE + SERIAL_LINE_STATUS_REG);
+                break;
+            default:
+                inb(SERIAL_COM1_BASE + SERIAL_MODEM_STATUS_REG);
+                break;
+        }
+    }
+    return result;
+}
+
+// Copy up to size received COM1 bytes into buffer; returns the count
+uint32_t serial_read(char* buffer, uint32_t size) {
+    return ring_dequeue(&serial_rx_ring, buffer, size);
+}
+
+// Check whether received COM1 bytes are waiting
+int serial_has_input(void) {
+    return !ring_empty(&serial_rx_ring);
+}
+
 // Check if transmit buffer is empty
 int serial_is_transmit_empty(uint16_t port) {
     return inb(port + SERIAL_LINE_STATUS_REG) & SERIAL_LSR_TX_EMPTY;
 }
 
+// Send bytes to a serial port. COM1 queues them and returns; only a full
+// ring makes the writer feed the UART itself until the rest fits.
+void serial_write(uint16_t port, const char* data, uint32_t size) {
+    if (port != SERIAL_COM1_BASE || !serial_tx_irq) {
+        for (uint32_t i = 0; i < size; i++) {
+            while (!serial_is_transmit_empty(port)) {
+                // Wait for transmit buffer to be empty
+            }
+            outb(port + SERIAL_DATA_REG, data[i]);
+        }
+        return;
+    }
+    while (size > 0) {
+        uint32_t flags = spin_lock_irqsave(&serial_tx_lock);
+        uint32_t room = SERIAL_TX_BUFFER_SIZE - ring_count(&serial_tx_ring);
+        uint32_t queued = ring_enqueue(&serial_tx_ring, data, size < room ? size : room);
+        serial_tx_pump();   // An idle transmitter raises no interrupt to start it
+        spin_unlock_irqrestore(&serial_tx_lock, flags);
+        data += queued;
+        size -= queued;
+        if (size > 0) {
+            asm volatile ("pause");
+        }
+    }
+}
+
 // Send a character to serial port
 void serial_putchar(uint16_t port, char c) {
-    while (!serial_is_transmit_empty(port)) {
-        // Wait for transmit buffer to be empty
-    }
-    outb(port + SERIAL_DATA_REG, c);
+    serial_write(port, &c, 1);
 }
 
 // Send a string to serial port
 void serial_write_string(uint16_t port, const char* str) {
-    while (*str) {
-        serial_putchar(port, *str);
-        str++;
+    uint32_t length = 0;
+    while (str[length]) {
+        length++;
+    }
+    serial_write(port, str, length);
+}
+
+// Push out everything queued for COM1 without its interrupt
+void serial_flush(void) {
+    if (!serial_tx_irq) {
+        return;
+    }
+    while (!ring_empty(&serial_tx_ring)) {
+        uint32_t flags = spin_lock_irqsave(&serial_tx_lock);
+        serial_tx_pump();
+        spin_unlock_irqrestore(&serial_tx_lock, flags);
+        asm volatile ("pause");
     }
 }
 
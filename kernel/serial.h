@@ -53,6 +53,28 @@
 #define SERIAL_FCR_TRIGGER_8    0x80  // 8-byte trigger level
 #define SERIAL_FCR_TRIGGER_14   0xC0  // 14-byte trigger level
 
+// Interrupt Enable Register bits
+#define SERIAL_IER_RX_AVAILABLE 0x01  // Received data available
+#define SERIAL_IER_TX_EMPTY     0x02  // Transmitter holding register empty
+
+// Interrupt Identification Register (read at the FIFO control offset)
+#define SERIAL_IIR_NONE         0x01  // No interrupt pending
+#define SERIAL_IIR_ID_MASK      0x0E
+#define SERIAL_IIR_MODEM        0x00  // Modem status changed (read MSR)
+#define SERIAL_IIR_TX_EMPTY     0x02  // Holding register / FIFO empty
+#define SERIAL_IIR_RX_DATA      0x04  // Received data at the trigger level
+#define SERIAL_IIR_LINE         0x06  // Line status (read LSR)
+#define SERIAL_IIR_RX_TIMEOUT   0x0C  // Received data below the trigger, gone quiet
+
+// COM1 receive ring (filled by the IRQ4 handler)
+#define SERIAL_RX_BUFFER_SIZE   256   // Power of two
+#define SERIAL_RX_BATCH         16    // Bytes drained per ring enqueue (the UART FIFO depth)
+
+// COM1 transmit ring (drained into the UART FIFO by IRQ4, and by the
+// writer that finds the transmitter idle)
+#define SERIAL_TX_BUFFER_SIZE   1024  // Power of two
+#define SERIAL_TX_BURST         16    // Bytes written per empty FIFO
+
 // Modem Control Register bits
 #define SERIAL_MCR_DTR          0x01  // Data Terminal Ready
 #define SERIAL_MCR_RTS          0x02  // Request To Send
@@ -74,9 +96,13 @@
 int serial_init(uint16_t port);
 void serial_putchar(uint16_t port, char c);
 void serial_write_string(uint16_t port, const char* str);
+void serial_write(uint16_t port, const char* data, uint32_t size);
+void serial_flush(void);        // Wait until COM1's transmit ring is empty (panics)
 char serial_getchar(uint16_t port);
 int serial_received(uint16_t port);
 int serial_is_transmit_empty(uint16_t port);
+uint32_t serial_read(char* buffer, uint32_t size);
+int serial_has_input(void);
 
 // Debug output functions (using COM1)
 void debug_putchar(char c);
@@ -9,6 +9,7 @@
 #include "pmm.h"
 #include "heap.h"
 #include "../fs/memfs.h"
+#include "../drivers/ata.h"
 
 // Shell state
 static char shell_buffer[SHELL_BUFFER_SIZE];
@@ -169,6 +170,8 @@ void shell_execute_command(const char* command) {
         cmd_meminfo();
     } else if (strcmp(cmd, "syscalls") == 0) {
         cmd_syscalls();
+    } else if (strcmp(cmd, "iostat") == 0) {
+        cmd_iostat(arg);
     }
     // Phase 3 commands (directory operations)
     else if (strcmp(cmd, "mkdir") == 0) {
@@ -223,7 +226,8 @@ void cmd_help(void) {
     terminal_writestring("System Information:\n");
     terminal_setcolor(VGA_COLOR_WHITE);
     terminal_writestring("  meminfo        - Display memory statistics\n");
-    terminal_writestring("  syscalls       - List available system calls\n\n");
+    terminal_writestring("  syscalls       - List available system calls\n");
+    terminal_writestring("  iostat [secs]  - Disk I/O over an interval (0: since boot)\n\n");
     
     terminal_setcolor(VGA_COLOR_YELLOW);
     terminal_writestring("Directory Operations:\n");
@@ -452,6 +456,16 @@ void cmd_syscalls(void) {
     terminal_setcolor(VGA_COLOR_WHITE);
 }
 
+// Default interval is one second
+void cmd_iostat(const char* seconds) {
+    int interval = strlen(seconds) > 0 ? atoi(seconds) : 1;
+    if (interval < 0 || interval > 60) {
+        terminal_writestring("Usage: iostat [0-60 seconds]\n");
+        return;
+    }
+    ata_iostat((uint32_t)interval * 1000);
+}
+
 // ====== Phase 3: Directory Commands ======
 
 // Shell state for current directory
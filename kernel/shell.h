@@ -34,6 +34,7 @@ void cmd_write(const char* filename);
 // System information commands
 void cmd_meminfo(void);
 void cmd_syscalls(void);
+void cmd_iostat(const char* seconds);
 
 // Directory commands (Phase 3)
 void cmd_mkdir(const char* dirname);
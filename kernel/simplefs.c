@@ -5,6 +5,16 @@
 #include "../kernel/kernel.h"
 #include "../kernel/heap.h"
 #include "../kernel/string.h"
+#include "../kernel/lock.h"
+#include "../kernel/block.h"
+#include "../kernel/bcache.h"
+#include "../kernel/vmm.h"
+#include "../kernel/pmm.h"
+#include "../kernel/lz4.h"
+#include "../kernel/crc32c.h"
+#include "../kernel/swap.h"
+#include "../kernel/process.h"
+#include "../kernel/mutex.h"
 #include "../drivers/ata.h"    // For disk I/O operations
 
 // Global file system state
@@ -13,16 +23,723 @@ fs_state_t g_fs_state;
 // Day 10: Disk persistence state
 static uint8_t fs_disk_drive = 0;      // Drive number for persistence
 static int fs_disk_enabled = 0;       // Whether disk persistence is enabled
+static int fs_cached = 0;             // Mounted from disk: data blocks live in the buffer cache
+static uint8_t fs_dirty[SIMPLEFS_MAX_BLOCKS / 8];  // Resident blocks changed since the last save
+static uint8_t fs_meta[SIMPLEFS_MAX_BLOCKS / 8];   // Resident data-area blocks holding metadata
 
-// End of file marker for FAT
+// The open journal transaction: cached metadata blocks changed since the
+// last commit, kept pinned and clean so nothing writes them in place first
+static bcache_buf_t* fs_tx_pins[SIMPLEFS_JOURNAL_PINS];
+static uint32_t fs_tx_pinned = 0;
+static uint32_t fs_journal_sequence = 1;
+
+// Metadata that grows with the volume, kept as a run of blocks in the
+// data area: the allocation bitmap past its first block (which stays
+// resident at FAT_BLOCK_NUM) and the block checksums. Each block is read
+// on first use and goes home with the next journal commit once changed,
+// so until then a volume costs a pointer per block of each.
+typedef struct {
+    uint32_t start;             // First block of the run
+    uint32_t pieces;            // Blocks in it
+    uint8_t** data;             // Each one's copy, NULL until read in
+    uint8_t* dirty;             // One bit each: changed since the last commit
+    int resident;               // The copies are g_fs_state.blocks, not ours
+} fs_table_t;
+
+// Block checksums (v4): a CRC32C of each block, by number. 0 means none
+// yet: blocks not written since the upgrade, free ones, and metadata the
+// journal checksum covers instead (below the data area, and the tables).
+static fs_table_t fs_sums;
+static fs_table_t fs_bitmap_table;      // Bitmap blocks 1..bitmap_blocks-1 (v5)
+static uint32_t fs_bitmap_missing;      // Set by fs_bitmap_scan (alloc_lock held)
+static uint32_t fs_sum_failures = 0;
+
+// Every block the formatter reserves goes in the first bitmap block
+_Static_assert(DATA_START_BLOCK_NUM + SIMPLEFS_MAX_VOLUME_BLOCKS / SIMPLEFS_BITMAP_SPAN +
+               SIMPLEFS_MAX_VOLUME_BLOCKS / SIMPLEFS_SUMS_SPAN <= SIMPLEFS_BITMAP_SPAN,
+               "reserved blocks fit in the first bitmap block");
+
+// Block allocation may come from any CPU; the bitmap scan runs under this
+static spinlock_t alloc_lock;
+static uint32_t alloc_cursor = DATA_START_BLOCK_NUM;  // Where the next search starts
+
+// Discard of freed blocks, on drives that take TRIM. Until the
+// transaction that frees a block commits, the block on disk may still be
+// named by a file, so frees collect in fs_trim_freed and move over to
+// fs_trim_ready with the commit. The flusher sends the ready runs to the
+// drive, sorted and coalesced, while they sit in fs_trim_busy; an
+// allocation that lands on a busy run waits for it, and takes anything
+// it allocates out of the other two lists. All of it is best effort: a
+// run that finds its list full is never discarded. Under alloc_lock.
+typedef struct {
+    uint32_t start;
+    uint32_t count;
+} fs_trim_extent_t;
+
+static int fs_trim_enabled = 0;
+static fs_trim_extent_t fs_trim_freed[SIMPLEFS_TRIM_EXTENTS];
+static uint32_t fs_trim_freed_count = 0;
+static fs_trim_extent_t fs_trim_ready[SIMPLEFS_TRIM_EXTENTS];
+static uint32_t fs_trim_ready_count = 0;
+static fs_trim_extent_t fs_trim_busy[SIMPLEFS_TRIM_EXTENTS];
+static uint32_t fs_trim_busy_count = 0;
+static ata_trim_range_t fs_trim_ranges[SIMPLEFS_TRIM_EXTENTS];
+static uint32_t fs_trimmed_blocks = 0;
+
+// One caller in the file system at a time. The public entry points take
+// fs_mutex through fs_enter, and one called from inside another (fs_open
+// creating, a commit from a full transaction) passes straight through, so
+// background work can have the whole file system between calls.
+static mutex_t fs_mutex = MUTEX_INIT("simplefs");
+
+// Background defragmentation, a few blocks per flusher pass while the
+// disk is otherwise idle. A round walks the directory tree; each closed
+// file it meets in more than one fragment is copied, a window at a time,
+// into a free run long enough for all of it, and each window's new
+// extent goes in with one journal commit.
+typedef struct {
+    uint32_t dirs[SIMPLEFS_DEFRAG_DEPTH];   // Directories being walked, the root first
+    uint32_t slots[SIMPLEFS_DEFRAG_DEPTH];  // Next entry of each
+    uint32_t depth;                         // 0 between rounds
+    uint32_t file;                          // Map block of the file being moved, 0 if none
+    uint32_t blocks;                        // Its length when the move started
+    uint32_t target;                        // The free run it is going to
+    uint32_t done;                          // File blocks in place so far
+    uint32_t rest;                          // Passes still to sit out
+    uint32_t moved_round;                   // Files moved this round
+    uint32_t requests;                      // Block layer submissions after the last pass
+    uint32_t files_moved;
+    uint32_t blocks_moved;
+    uint32_t busy_passes;                   // Passes given up to other I/O
+} fs_defrag_t;
+
+static fs_defrag_t fs_defrag;
+
+// In-memory index of a directory block: names hashed to their slots, so a
+// lookup compares the one or two names in its bucket instead of all 64
+typedef struct fs_dir_index {
+    uint32_t block;
+    int8_t buckets[SIMPLEFS_DIR_HASH_BUCKETS];  // First slot in the chain, -1 if none
+    int8_t chain[SIMPLEFS_DIR_ENTRIES];         // Next slot in the same bucket
+    uint32_t hashes[SIMPLEFS_DIR_ENTRIES];
+    uint32_t free_hint;                         // No free slot below this one
+    struct fs_dir_index* next;
+} fs_dir_index_t;
+
+static fs_dir_index_t* fs_dir_indexes[SIMPLEFS_DIR_INDEXES];
+
+// Dentry cache: (directory block, name) -> where the name lives, so a path
+// walk takes each component it has seen before without reading the
+// directory. A slot of -1 records a name known to be absent. Entries sit
+// on an LRU list and the tail makes room for new ones.
+typedef struct fs_dentry {
+    uint32_t parent;            // Directory block the name is in
+    uint32_t hash;
+    int32_t slot;               // Entry in the parent, -1 = negative
+    uint32_t first_block;
+    uint8_t type;
+    uint8_t in_use;
+    char name[SIMPLEFS_MAX_FILENAME];
+    struct fs_dentry* hash_next;
+    struct fs_dentry* lru_prev;
+    struct fs_dentry* lru_next;
+} fs_dentry_t;
+
+static fs_dentry_t fs_dentries[SIMPLEFS_DCACHE_ENTRIES];
+static fs_dentry_t* fs_dentry_buckets[SIMPLEFS_DCACHE_BUCKETS];
+static fs_dentry_t* fs_dentry_lru_head;     // Most recently used
+static fs_dentry_t* fs_dentry_lru_tail;
+
+// Inodes of open files, hashed by first block
+static fs_inode_t* fs_inodes[SIMPLEFS_INODE_BUCKETS];
+
+// Compressed runs lately read, decompressed: the file blocks of one
+// extent each, reused least recently used first
+typedef struct {
+    uint32_t run;               // Disk block the compressed run starts at, 0 = empty
+    uint32_t used;              // fs_unpack_clock when last hit
+    uint8_t* data;              // SIMPLEFS_PACK_BLOCKS blocks
+} fs_unpacked_t;
+
+static fs_unpacked_t fs_unpacked[SIMPLEFS_UNPACK_SLOTS];
+static uint32_t fs_unpack_clock = 0;
+static uint8_t* fs_pack_buffer;             // A compressed run, header included
+static uint16_t fs_pack_table[LZ4_HASH_SIZE];
+
+#define FS_PACK_BUFFER_BLOCKS   (SIMPLEFS_PACK_BLOCKS + 1)  // LZ4_BOUND of a group, and its header
+
+static void fs_pack_file(fs_inode_t* inode);
+static void fs_trim_flush(void);
+
+// Blocks fs_read moves straight to the caller in one command
+#define FS_DIRECT_BLOCKS    (BLK_MAX_MERGE_SECTORS * BLK_SECTOR_SIZE / SIMPLEFS_BLOCK_SIZE)
+
+// End of file marker for FAT (v1)
 #define FAT_END_OF_FILE     0xFFFFFFFF
 
+// Returns whether it took fs_mutex, for fs_leave
+static int fs_enter(void) {
+    if (current_process && fs_mutex.owner == current_process) {
+        return 0;
+    }
+    mutex_lock(&fs_mutex);
+    return 1;
+}
+
+static void fs_leave(int entered) {
+    if (entered) {
+        mutex_unlock(&fs_mutex);
+    }
+}
+
+static void fs_mark_dirty(uint32_t block_num) {
+    fs_dirty[block_num / 8] |= (uint8_t)(1 << (block_num % 8));
+}
+
+static int fs_is_dirty(uint32_t block_num) {
+    return (fs_dirty[block_num / 8] >> (block_num % 8)) & 1;
+}
+
+// Superblock, bitmap and root directory, or a resident block put as metadata
+static int fs_is_metadata(uint32_t block_num) {
+    return block_num < DATA_START_BLOCK_NUM ||
+           (block_num < SIMPLEFS_MAX_BLOCKS && ((fs_meta[block_num / 8] >> (block_num % 8)) & 1));
+}
+
+// Test and clear a block's dirty bit
+static int fs_take_dirty(uint32_t block_num) {
+    uint8_t bit = (uint8_t)(1 << (block_num % 8));
+    int dirty = (fs_dirty[block_num / 8] & bit) != 0;
+    fs_dirty[block_num / 8] &= (uint8_t)~bit;
+    return dirty;
+}
+
+static uint32_t fs_block_lba(uint32_t block_num) {
+    return (FS_DISK_START_LBA + block_num) * 8;
+}
+
+static uint32_t fs_total_blocks(void) {
+    return g_fs_state.superblock->total_blocks;
+}
+
+// Set a table up over pieces blocks from start. Fresh ones start zeroed
+// and changed instead of being read.
+static int fs_table_init(fs_table_t* table, uint32_t start, uint32_t pieces, int fresh) {
+    memset(table, 0, sizeof(*table));
+    if (pieces == 0) {
+        return FS_SUCCESS;
+    }
+    table->data = kmalloc(pieces * sizeof(uint8_t*));
+    table->dirty = kmalloc((pieces + 7) / 8);
+    if (!table->data || !table->dirty) {
+        kfree(table->data);
+        kfree(table->dirty);
+        memset(table, 0, sizeof(*table));
+        return FS_ERROR_NO_SPACE;
+    }
+    memset(table->data, 0, pieces * sizeof(uint8_t*));
+    memset(table->dirty, fresh ? 0xFF : 0, (pieces + 7) / 8);
+    table->start = start;
+    table->pieces = pieces;
+    for (uint32_t i = 0; fresh && i < pieces; i++) {
+        table->data[i] = kmalloc_page();    // Zeroed
+        if (!table->data[i]) {
+            return FS_ERROR_NO_SPACE;       // The caller releases it
+        }
+    }
+    return FS_SUCCESS;
+}
+
+static void fs_table_release(fs_table_t* table) {
+    for (uint32_t i = 0; i < table->pieces && !table->resident; i++) {
+        kfree_page(table->data[i]);
+    }
+    kfree(table->data);
+    kfree(table->dirty);
+    memset(table, 0, sizeof(*table));
+}
+
+static int fs_table_holds(const fs_table_t* table, uint32_t block_num) {
+    return block_num >= table->start && block_num - table->start < table->pieces;
+}
+
+static void fs_table_mark(fs_table_t* table, uint32_t piece) {
+    table->dirty[piece / 8] |= (uint8_t)(1 << (piece % 8));
+}
+
+// A table's block, read in on first use; NULL on a read error or without
+// memory. Not under alloc_lock: it may wait for the disk.
+static uint8_t* fs_table_piece(fs_table_t* table, uint32_t piece) {
+    if (piece >= table->pieces) {
+        return NULL;
+    }
+    if (table->data[piece]) {
+        return table->data[piece];
+    }
+    uint8_t* data = kmalloc_page();
+    if (!data) {
+        return NULL;
+    }
+    if (!ata_read(fs_disk_drive, fs_block_lba(table->start + piece),
+                  SIMPLEFS_BLOCK_SIZE / BLK_SECTOR_SIZE, data)) {
+        kfree_page(data);
+        return NULL;
+    }
+    uint32_t flags = spin_lock_irqsave(&alloc_lock);
+    if (table->data[piece]) {
+        kfree_page(data);                   // Another CPU read it first
+    } else {
+        table->data[piece] = data;
+    }
+    spin_unlock_irqrestore(&alloc_lock, flags);
+    return table->data[piece];
+}
+
+// Add a table's changed blocks to a journal transaction; 0 if it is full
+static int fs_table_log(fs_table_t* table, journal_header_t* header, void** log, uint32_t* count) {
+    for (uint32_t i = 0; i < table->pieces; i++) {
+        if (!((table->dirty[i / 8] >> (i % 8)) & 1)) {
+            continue;
+        }
+        if (*count == SIMPLEFS_JOURNAL_MAX_TX) {
+            return 0;
+        }
+        header->blocks[*count] = table->start + i;
+        log[1 + (*count)++] = table->data[i];
+    }
+    return 1;
+}
+
+static void fs_table_clean(fs_table_t* table) {
+    if (table->pieces) {
+        memset(table->dirty, 0, (table->pieces + 7) / 8);
+    }
+}
+
+static void fs_tables_release(void) {
+    fs_table_release(&fs_bitmap_table);
+    fs_table_release(&fs_sums);
+}
+
+// Bitmap words of the block covering block_num: the resident first one,
+// or one from the table if it has been read in (NULL before)
+static uint32_t* fs_bitmap_words(uint32_t block_num) {
+    uint32_t piece = block_num / SIMPLEFS_BITMAP_SPAN;
+    if (piece == 0) {
+        return (uint32_t*)g_fs_state.bitmap;
+    }
+    return piece - 1 < fs_bitmap_table.pieces ? (uint32_t*)fs_bitmap_table.data[piece - 1] : NULL;
+}
+
+// Read in the bitmap block covering block_num; 0 if it can't be
+static int fs_bitmap_load(uint32_t block_num) {
+    uint32_t piece = block_num / SIMPLEFS_BITMAP_SPAN;
+    return piece == 0 || fs_table_piece(&fs_bitmap_table, piece - 1) != NULL;
+}
+
+// Whether block_num is allocated; its bitmap block must be read in
+static int fs_block_used(uint32_t block_num) {
+    const uint32_t* words = fs_bitmap_words(block_num);
+    uint32_t bit = block_num % SIMPLEFS_BITMAP_SPAN;
+    return words && ((words[bit / 32] >> (bit % 32)) & 1);
+}
+
+// Allocate or free block_num in the bitmap (alloc_lock held, block read in)
+static void fs_bitmap_set(uint32_t block_num, int used) {
+    uint32_t* words = fs_bitmap_words(block_num);
+    uint32_t bit = block_num % SIMPLEFS_BITMAP_SPAN;
+    if (used) {
+        words[bit / 32] |= 1u << (bit % 32);
+    } else {
+        words[bit / 32] &= ~(1u << (bit % 32));
+    }
+    uint32_t piece = block_num / SIMPLEFS_BITMAP_SPAN;
+    if (piece == 0) {
+        fs_mark_dirty(FAT_BLOCK_NUM);
+    } else {
+        fs_table_mark(&fs_bitmap_table, piece - 1);
+    }
+}
+
+static uint32_t fs_block_sum(const void* data) {
+    uint32_t sum = crc32c(0, data, SIMPLEFS_BLOCK_SIZE);
+    return sum ? sum : 0xFFFFFFFFu;     // 0 is "no sum"
+}
+
+// Where block_num's sum is kept, read in if need be; NULL for a block
+// without one
+static uint32_t* fs_sum_slot(uint32_t block_num, uint32_t* piece) {
+    if (!fs_sums.pieces || block_num < DATA_START_BLOCK_NUM || block_num >= fs_total_blocks() ||
+        fs_table_holds(&fs_sums, block_num) || fs_table_holds(&fs_bitmap_table, block_num)) {
+        return NULL;
+    }
+    *piece = block_num / SIMPLEFS_SUMS_SPAN;
+    uint32_t* sums = (uint32_t*)fs_table_piece(&fs_sums, *piece);
+    return sums ? &sums[block_num % SIMPLEFS_SUMS_SPAN] : NULL;
+}
+
+// A block is about to go to disk holding data
+static void fs_sum_update(uint32_t block_num, const void* data) {
+    uint32_t piece;
+    uint32_t* slot = fs_sum_slot(block_num, &piece);
+    if (slot) {
+        *slot = fs_block_sum(data);
+        fs_table_mark(&fs_sums, piece);
+    }
+}
+
+// A block was freed: nothing to check it against until it is written
+static void fs_sum_clear(uint32_t block_num) {
+    uint32_t piece;
+    uint32_t* slot = fs_sum_slot(block_num, &piece);
+    if (slot && *slot) {
+        *slot = 0;
+        fs_table_mark(&fs_sums, piece);
+    }
+}
+
+// Whether a block just read holds what was last written to it
+static int fs_sum_ok(uint32_t block_num, const void* data) {
+    uint32_t piece;
+    uint32_t* slot = fs_sum_slot(block_num, &piece);
+    if (!slot || *slot == 0 || fs_block_sum(data) == *slot) {
+        return 1;
+    }
+    fs_sum_failures++;
+    terminal_printf("SimpleFS: Block %d failed its checksum\n", (int)block_num);
+    return 0;
+}
+
+// FNV-1a
+static uint32_t fs_name_hash(const char* name) {
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash = (hash ^ (uint8_t)*name++) * 16777619u;
+    }
+    return hash;
+}
+
+static void fs_dir_index_link(fs_dir_index_t* index, int slot, const char* name) {
+    uint32_t hash = fs_name_hash(name);
+    uint32_t bucket = hash & (SIMPLEFS_DIR_HASH_BUCKETS - 1);
+    index->hashes[slot] = hash;
+    index->chain[slot] = index->buckets[bucket];
+    index->buckets[bucket] = (int8_t)slot;
+}
+
+static void fs_dir_index_unlink(fs_dir_index_t* index, int slot) {
+    int8_t* link = &index->buckets[index->hashes[slot] & (SIMPLEFS_DIR_HASH_BUCKETS - 1)];
+    while (*link >= 0 && *link != slot) {
+        link = &index->chain[(int)*link];
+    }
+    if (*link == slot) {
+        *link = index->chain[slot];
+    }
+    if ((uint32_t)slot < index->free_hint) {
+        index->free_hint = slot;
+    }
+}
+
+// Index for a directory block, built from its entries on first use; NULL
+// if there is no memory for one (callers then scan the block)
+static fs_dir_index_t* fs_dir_index(uint32_t dir_block, dir_entry_t* dir) {
+    fs_dir_index_t** head = &fs_dir_indexes[dir_block % SIMPLEFS_DIR_INDEXES];
+    for (fs_dir_index_t* index = *head; index; index = index->next) {
+        if (index->block == dir_block) {
+            return index;
+        }
+    }
+    fs_dir_index_t* index = kmalloc(sizeof(fs_dir_index_t));
+    if (!index) {
+        return NULL;
+    }
+    index->block = dir_block;
+    memset(index->buckets, -1, sizeof(index->buckets));
+    index->free_hint = SIMPLEFS_DIR_ENTRIES;
+    for (int i = SIMPLEFS_DIR_ENTRIES - 1; i >= 0; i--) {
+        if (dir[i].name[0] != '\0') {
+            fs_dir_index_link(index, i, dir[i].name);
+        } else {
+            index->free_hint = i;
+        }
+    }
+    index->next = *head;
+    *head = index;
+    return index;
+}
+
+// Slot holding name, or -1
+static int fs_dir_index_find(fs_dir_index_t* index, dir_entry_t* dir, const char* name) {
+    uint32_t hash = fs_name_hash(name);
+    for (int slot = index->buckets[hash & (SIMPLEFS_DIR_HASH_BUCKETS - 1)]; slot >= 0;
+         slot = index->chain[slot]) {
+        if (index->hashes[slot] == hash && strcmp(dir[slot].name, name) == 0) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+// Forget a directory block's index (freed, or about to be rebuilt)
+static void fs_dir_index_drop(uint32_t dir_block) {
+    fs_dir_index_t** link = &fs_dir_indexes[dir_block % SIMPLEFS_DIR_INDEXES];
+    while (*link && (*link)->block != dir_block) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        fs_dir_index_t* index = *link;
+        *link = index->next;
+        kfree(index);
+    }
+}
+
+static void fs_dir_index_drop_all(void) {
+    for (uint32_t i = 0; i < SIMPLEFS_DIR_INDEXES; i++) {
+        while (fs_dir_indexes[i]) {
+            fs_dir_index_drop(fs_dir_indexes[i]->block);
+        }
+    }
+}
+
+// Build the root directory's index up front (mount)
+static void fs_dir_index_root(void) {
+    dir_entry_t* root_dir = (dir_entry_t*)fs_get_block(ROOT_DIR_BLOCK_NUM);
+    if (root_dir) {
+        fs_dir_index(ROOT_DIR_BLOCK_NUM, root_dir);
+        fs_put_block(root_dir, 0);
+    }
+}
+
+static uint32_t fs_dentry_bucket(uint32_t parent, uint32_t hash) {
+    return (hash ^ (parent * 2654435761u)) & (SIMPLEFS_DCACHE_BUCKETS - 1);
+}
+
+static void fs_dentry_lru_unlink(fs_dentry_t* d) {
+    if (d->lru_prev) {
+        d->lru_prev->lru_next = d->lru_next;
+    } else {
+        fs_dentry_lru_head = d->lru_next;
+    }
+    if (d->lru_next) {
+        d->lru_next->lru_prev = d->lru_prev;
+    } else {
+        fs_dentry_lru_tail = d->lru_prev;
+    }
+    d->lru_prev = d->lru_next = NULL;
+}
+
+static void fs_dentry_lru_push(fs_dentry_t* d) {
+    d->lru_prev = NULL;
+    d->lru_next = fs_dentry_lru_head;
+    if (fs_dentry_lru_head) {
+        fs_dentry_lru_head->lru_prev = d;
+    } else {
+        fs_dentry_lru_tail = d;
+    }
+    fs_dentry_lru_head = d;
+}
+
+// Take a dentry off its hash chain; it stays on the LRU list, now free
+static void fs_dentry_release(fs_dentry_t* d) {
+    fs_dentry_t** link = &fs_dentry_buckets[fs_dentry_bucket(d->parent, d->hash)];
+    while (*link && *link != d) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) {
+        *link = d->hash_next;
+    }
+    d->in_use = 0;
+    fs_dentry_lru_unlink(d);
+    d->lru_prev = fs_dentry_lru_tail;   // Free ones go to the tail, taken first
+    if (fs_dentry_lru_tail) {
+        fs_dentry_lru_tail->lru_next = d;
+    } else {
+        fs_dentry_lru_head = d;
+    }
+    fs_dentry_lru_tail = d;
+}
+
+// Empty the cache (mount, format, unmount)
+static void fs_dentry_clear(void) {
+    memset(fs_dentries, 0, sizeof(fs_dentries));
+    memset(fs_dentry_buckets, 0, sizeof(fs_dentry_buckets));
+    fs_dentry_lru_head = fs_dentry_lru_tail = NULL;
+    for (uint32_t i = 0; i < SIMPLEFS_DCACHE_ENTRIES; i++) {
+        fs_dentry_lru_push(&fs_dentries[i]);
+    }
+}
+
+static fs_dentry_t* fs_dentry_find(uint32_t parent, const char* name, uint32_t hash) {
+    for (fs_dentry_t* d = fs_dentry_buckets[fs_dentry_bucket(parent, hash)]; d; d = d->hash_next) {
+        if (d->parent == parent && d->hash == hash && strcmp(d->name, name) == 0) {
+            fs_dentry_lru_unlink(d);
+            fs_dentry_lru_push(d);
+            return d;
+        }
+    }
+    return NULL;
+}
+
+// Remember name in parent, reusing the least recently used dentry
+static void fs_dentry_insert(uint32_t parent, const char* name, uint32_t hash, int32_t slot,
+                             uint32_t first_block, uint8_t type) {
+    if (strlen(name) >= SIMPLEFS_MAX_FILENAME || !fs_dentry_lru_tail) {
+        return;
+    }
+    fs_dentry_t* d = fs_dentry_find(parent, name, hash);
+    if (!d) {
+        d = fs_dentry_lru_tail;
+        if (d->in_use) {
+            fs_dentry_release(d);
+        }
+        d->parent = parent;
+        d->hash = hash;
+        strcpy(d->name, name);
+        uint32_t bucket = fs_dentry_bucket(parent, hash);
+        d->hash_next = fs_dentry_buckets[bucket];
+        fs_dentry_buckets[bucket] = d;
+        d->in_use = 1;
+        fs_dentry_lru_unlink(d);
+        fs_dentry_lru_push(d);
+    }
+    d->slot = slot;
+    d->first_block = first_block;
+    d->type = type;
+}
+
+static void fs_dentry_forget(uint32_t parent, const char* name) {
+    fs_dentry_t* d = fs_dentry_find(parent, name, fs_name_hash(name));
+    if (d) {
+        fs_dentry_release(d);
+    }
+}
+
+// Drop every name cached under a directory block that is being freed
+static void fs_dentry_forget_dir(uint32_t parent) {
+    for (uint32_t i = 0; i < SIMPLEFS_DCACHE_ENTRIES; i++) {
+        if (fs_dentries[i].in_use && fs_dentries[i].parent == parent) {
+            fs_dentry_release(&fs_dentries[i]);
+        }
+    }
+}
+
+// Open file's inode, if any descriptor has it
+static fs_inode_t* fs_inode_find(uint32_t first_block) {
+    for (fs_inode_t* inode = fs_inodes[first_block % SIMPLEFS_INODE_BUCKETS]; inode;
+         inode = inode->next) {
+        if (inode->first_block == first_block) {
+            return inode;
+        }
+    }
+    return NULL;
+}
+
+// Take a reference on the inode for entry (slot in dir_block), loading it
+// from the entry on the first open; NULL without memory
+static fs_inode_t* fs_inode_get(const dir_entry_t* entry, uint32_t dir_block, int slot) {
+    fs_inode_t* inode = fs_inode_find(entry->first_block);
+    if (inode) {
+        inode->refcount++;
+        return inode;
+    }
+    inode = kmalloc(sizeof(fs_inode_t));
+    if (!inode) {
+        return NULL;
+    }
+    memset(inode, 0, sizeof(fs_inode_t));
+    inode->first_block = entry->first_block;
+    inode->dir_block = dir_block;
+    inode->slot = slot;
+    inode->size = entry->size;
+    inode->flags = entry->flags;
+    inode->refcount = 1;
+    fs_inode_t** head = &fs_inodes[entry->first_block % SIMPLEFS_INODE_BUCKETS];
+    inode->next = *head;
+    *head = inode;
+    return inode;
+}
+
+// The file grew to size through some descriptor
+static void fs_inode_grow(fs_inode_t* inode, uint32_t size) {
+    if (size > inode->size) {
+        inode->size = size;
+        inode->dirty = 1;
+    }
+}
+
+// Write a changed inode back into its directory entry
+static void fs_inode_sync(fs_inode_t* inode) {
+    if (!inode->dirty) {
+        return;
+    }
+    dir_entry_t* dir = (dir_entry_t*)fs_get_block(inode->dir_block);
+    if (!dir) {
+        return;
+    }
+    int valid = inode->slot >= 0 && inode->slot < SIMPLEFS_DIR_ENTRIES &&
+                dir[inode->slot].first_block == inode->first_block;
+    if (valid) {
+        dir[inode->slot].size = inode->size;
+        dir[inode->slot].flags = inode->flags;
+        inode->dirty = 0;
+    }
+    fs_put_metadata(dir, valid);
+}
+
+static void fs_inode_sync_all(void) {
+    for (uint32_t i = 0; i < SIMPLEFS_INODE_BUCKETS; i++) {
+        for (fs_inode_t* inode = fs_inodes[i]; inode; inode = inode->next) {
+            fs_inode_sync(inode);
+        }
+    }
+}
+
+// Drop a reference; the last one writes the inode back and frees it
+static void fs_inode_put(fs_inode_t* inode) {
+    if (--inode->refcount > 0) {
+        return;
+    }
+    if (inode->flags & FS_FLAG_COMPRESS) {
+        fs_pack_file(inode);
+    }
+    fs_inode_sync(inode);
+    fs_inode_t** link = &fs_inodes[inode->first_block % SIMPLEFS_INODE_BUCKETS];
+    while (*link != inode) {
+        link = &(*link)->next;
+    }
+    *link = inode->next;
+    kfree(inode);
+}
+
+// A compressed run was freed: its decompressed copy goes too
+static void fs_unpack_forget(uint32_t run) {
+    for (uint32_t i = 0; i < SIMPLEFS_UNPACK_SLOTS; i++) {
+        if (fs_unpacked[i].run == run) {
+            fs_unpacked[i].run = 0;
+        }
+    }
+}
+
+static void fs_unpack_clear(void) {
+    for (uint32_t i = 0; i < SIMPLEFS_UNPACK_SLOTS; i++) {
+        kfree(fs_unpacked[i].data);
+        fs_unpacked[i].data = NULL;
+        fs_unpacked[i].run = 0;
+    }
+    kfree(fs_pack_buffer);
+    fs_pack_buffer = NULL;
+}
+
 // Initialize the file system
 int fs_init(void) {
     terminal_writestring("Initializing SimpleFS...\n");
     
     // Clear the file system state
     memset(&g_fs_state, 0, sizeof(fs_state_t));
+    memset(fs_dirty, 0, sizeof(fs_dirty));
+    memset(fs_meta, 0, sizeof(fs_meta));
+    fs_tables_release();
+    fs_cached = 0;
     
     // Allocate memory for the entire file system
     size_t total_fs_size = SIMPLEFS_MAX_BLOCKS * SIMPLEFS_BLOCK_SIZE;
@@ -41,118 +758,1101 @@ int fs_init(void) {
     
     // Set up pointers to specific blocks
     g_fs_state.superblock = (superblock_t*)fs_get_block(SUPERBLOCK_NUM);
-    g_fs_state.fat = (fat_entry_t*)fs_get_block(FAT_BLOCK_NUM);
+    g_fs_state.bitmap = (uint8_t*)fs_get_block(FAT_BLOCK_NUM);
+    spin_lock_init(&alloc_lock, "simplefs_alloc");
+    
+    // Format the file system
+    int result = fs_format();
+    if (result != FS_SUCCESS) {
+        terminal_writestring("ERROR: Failed to format file system\n");
+        kfree(g_fs_state.blocks);
+        return result;
+    }
+    
+    // Initialize current directory to root
+    strcpy(g_fs_state.current_dir, "/");
+    fs_dentry_clear();
+    fs_unpack_clear();
+    fs_dir_index_root();
+    
+    // Mark as initialized
+    g_fs_state.initialized = 1;
+    
+    terminal_writestring("SimpleFS initialized successfully!\n");
+    return FS_SUCCESS;
+}
+
+// Format the file system (create initial structures)
+int fs_format(void) {
+    // Initialize superblock
+    superblock_t* sb = g_fs_state.superblock;
+    sb->magic = SIMPLEFS_MAGIC;
+    sb->total_blocks = SIMPLEFS_MAX_BLOCKS;
+    sb->free_blocks = SIMPLEFS_MAX_BLOCKS - DATA_START_BLOCK_NUM - 1; // System blocks and checksums
+    sb->root_dir_block = ROOT_DIR_BLOCK_NUM;
+    sb->fat_block = FAT_BLOCK_NUM;
+    sb->data_start_block = DATA_START_BLOCK_NUM;
+    sb->max_files = SIMPLEFS_MAX_FILES;
+    sb->block_size = SIMPLEFS_BLOCK_SIZE;
+    sb->version = SIMPLEFS_VERSION;
+    sb->journal_start = SIMPLEFS_JOURNAL_START;
+    sb->journal_blocks = SIMPLEFS_JOURNAL_BLOCKS;
+    sb->checksum_block = DATA_START_BLOCK_NUM;
+    sb->checksum_blocks = 1;
+    sb->bitmap_blocks = 1;
+    sb->bitmap_start = 0;
+    
+    // Mark superblock, bitmap, root directory and the checksum table as
+    // allocated, all other blocks free
+    memset(g_fs_state.bitmap, 0, SIMPLEFS_BLOCK_SIZE);
+    for (uint32_t i = 0; i <= DATA_START_BLOCK_NUM; i++) {
+        g_fs_state.bitmap[i / 8] |= (uint8_t)(1 << (i % 8));
+    }
+    alloc_cursor = DATA_START_BLOCK_NUM + 1;
+    
+    // Initialize root directory (empty)
+    dir_entry_t* root_dir = (dir_entry_t*)fs_get_block(ROOT_DIR_BLOCK_NUM);
+    memset(root_dir, 0, SIMPLEFS_BLOCK_SIZE);
+    memset(fs_meta, 0, sizeof(fs_meta));
+    fs_dir_index_drop_all();
+    fs_dentry_clear();
+    fs_unpack_clear();
+    
+    // Journaled like the other metadata, so never written in place
+    void* sums = fs_get_block(sb->checksum_block);
+    memset(sums, 0, SIMPLEFS_BLOCK_SIZE);
+    fs_meta[sb->checksum_block / 8] |= (uint8_t)(1 << (sb->checksum_block % 8));
+    fs_tables_release();
+    if (fs_table_init(&fs_sums, sb->checksum_block, 1, 0) == FS_SUCCESS) {
+        fs_sums.data[0] = sums;
+        fs_sums.resident = 1;
+        fs_table_mark(&fs_sums, 0);
+    }
+    
+    fs_mark_dirty(SUPERBLOCK_NUM);
+    fs_mark_dirty(FAT_BLOCK_NUM);
+    fs_mark_dirty(ROOT_DIR_BLOCK_NUM);
+    terminal_writestring("File system formatted successfully\n");
+    return FS_SUCCESS;
+}
+
+// Get pointer to a specific block. Mounted from disk, only the metadata
+// blocks are resident and data blocks are pinned in the buffer cache
+// until fs_put_block; each is checked against its sum the first time it
+// is used after being read, and one that fails comes back NULL.
+void* fs_get_block(uint32_t block_num) {
+    if (fs_cached && block_num >= DATA_START_BLOCK_NUM) {
+        if (block_num >= fs_total_blocks()) {
+            return NULL;
+        }
+        bcache_buf_t* buf = bcache_get(fs_disk_drive, fs_block_lba(block_num));
+        if (buf && !buf->checked) {
+            if (!fs_sum_ok(block_num, buf->data)) {
+                bcache_release(buf);
+                return NULL;
+            }
+            buf->checked = true;
+        }
+        return buf ? buf->data : NULL;
+    }
+    if (block_num >= SIMPLEFS_MAX_BLOCKS) {
+        return NULL;
+    }
+    
+    char* base = (char*)g_fs_state.blocks;
+    return base + (block_num * SIMPLEFS_BLOCK_SIZE);
+}
+
+// Done with a block from fs_get_block; dirty if it was changed
+void fs_put_block(void* block, int dirty) {
+    bcache_buf_t* buf = block ? bcache_buffer_of(block) : NULL;
+    if (!buf) {
+        if (block && dirty) {
+            // Resident: remembered for the next save
+            fs_mark_dirty((uint32_t)((char*)block - (char*)g_fs_state.blocks) / SIMPLEFS_BLOCK_SIZE);
+        }
+        return;
+    }
+    if (dirty) {
+        fs_sum_update(buf->lba / 8 - FS_DISK_START_LBA, buf->data);
+        bcache_mark_dirty(buf);
+    }
+    bcache_release(buf);
+}
+
+// First free (or, with used, allocated) block at or after from; returns
+// the volume's size if none. Skips a word of 32 blocks at a time. A
+// bitmap block not read in yet ends the scan there as if the volume did,
+// with fs_bitmap_missing set to a block it covers (alloc_lock held).
+static uint32_t fs_bitmap_scan(uint32_t from, int used) {
+    uint32_t total = fs_total_blocks();
+    while (from < total) {
+        const uint32_t* words = fs_bitmap_words(from);
+        if (!words) {
+            fs_bitmap_missing = from;
+            return total;
+        }
+        uint32_t base = from - from % SIMPLEFS_BITMAP_SPAN;
+        uint32_t w = (from - base) / 32;
+        uint32_t bits = (used ? words[w] : ~words[w]) & (0xFFFFFFFFu << (from % 32));
+        while (bits == 0 && ++w < SIMPLEFS_BITMAP_SPAN / 32) {
+            bits = used ? words[w] : ~words[w];
+        }
+        if (bits) {
+            uint32_t found = base + w * 32 + (uint32_t)__builtin_ctz(bits);
+            return found < total ? found : total;
+        }
+        from = base + SIMPLEFS_BITMAP_SPAN;
+    }
+    return total;
+}
+
+// Done with a directory or extent map block. Changes to it are journaled:
+// resident, it is saved through the journal; cached, it stays pinned in
+// the open transaction (committed early when that is full).
+void fs_put_metadata(void* block, int dirty) {
+    bcache_buf_t* buf = block ? bcache_buffer_of(block) : NULL;
+    if (!buf || !dirty) {
+        if (!buf && block && dirty) {
+            uint32_t block_num = (uint32_t)((char*)block - (char*)g_fs_state.blocks) / SIMPLEFS_BLOCK_SIZE;
+            fs_meta[block_num / 8] |= (uint8_t)(1 << (block_num % 8));
+        }
+        fs_put_block(block, dirty);
+        return;
+    }
+    for (uint32_t i = 0; i < fs_tx_pinned; i++) {
+        if (fs_tx_pins[i] == buf) {
+            bcache_release(buf);  // The transaction holds it already
+            return;
+        }
+    }
+    if (fs_tx_pinned == SIMPLEFS_JOURNAL_PINS) {
+        fs_journal_commit();
+    }
+    if (fs_tx_pinned == SIMPLEFS_JOURNAL_PINS) {
+        fs_put_block(block, dirty);  // No journal to commit to: written in place
+        return;
+    }
+    fs_tx_pins[fs_tx_pinned++] = buf;  // Keeps the caller's pin
+}
+
+// Give back the open transaction's pins without committing it
+static void fs_journal_drop(void) {
+    for (uint32_t i = 0; i < fs_tx_pinned; i++) {
+        bcache_release(fs_tx_pins[i]);
+    }
+    fs_tx_pinned = 0;
+}
+
+// Add a freed run to a trim list, growing a neighbouring run if there is one
+static void fs_trim_add(fs_trim_extent_t* list, uint32_t* count, uint32_t start, uint32_t length) {
+    for (uint32_t i = 0; i < *count; i++) {
+        if (list[i].start + list[i].count == start) {
+            list[i].count += length;
+            return;
+        }
+        if (start + length == list[i].start) {
+            list[i].start = start;
+            list[i].count += length;
+            return;
+        }
+    }
+    if (*count < SIMPLEFS_TRIM_EXTENTS) {
+        list[*count].start = start;
+        list[*count].count = length;
+        (*count)++;
+    }
+}
+
+// Take [start, start + length) out of a trim list. A run split in two
+// keeps its tail only if there is room for it.
+static void fs_trim_remove(fs_trim_extent_t* list, uint32_t* count, uint32_t start, uint32_t length) {
+    uint32_t end = start + length;
+    for (uint32_t i = 0; i < *count;) {
+        uint32_t run_end = list[i].start + list[i].count;
+        if (run_end <= start || list[i].start >= end) {
+            i++;
+            continue;
+        }
+        if (list[i].start < start && run_end > end && *count < SIMPLEFS_TRIM_EXTENTS) {
+            list[*count].start = end;
+            list[*count].count = run_end - end;
+            (*count)++;
+        }
+        if (list[i].start < start) {
+            list[i].count = start - list[i].start;
+            i++;
+        } else if (run_end > end) {
+            list[i].start = end;
+            list[i].count = run_end - end;
+            i++;
+        } else {
+            list[i] = list[--(*count)];
+        }
+    }
+}
+
+static bool fs_trim_overlaps(const fs_trim_extent_t* list, uint32_t count, uint32_t start,
+                             uint32_t length) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (list[i].start < start + length && start < list[i].start + list[i].count) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// fs_alloc_extent's search (alloc_lock held)
+static void fs_alloc_search(uint32_t goal, uint32_t want, uint32_t* start_out, uint32_t* length_out) {
+    uint32_t start = 0;
+    uint32_t length = 0;
+    if (goal >= DATA_START_BLOCK_NUM && !fs_block_used(goal)) {
+        start = goal;
+        length = fs_bitmap_scan(goal, 1) - goal;
+    } else {
+        uint32_t from = alloc_cursor;
+        uint32_t to = fs_total_blocks();
+        for (int pass = 0; pass < 2 && length < want; pass++) {
+            uint32_t i = fs_bitmap_scan(from, 0);
+            while (i < to && length < want) {
+                uint32_t end = fs_bitmap_scan(i, 1);
+                if (end - i > length) {
+                    start = i;
+                    length = end - i;
+                }
+                i = fs_bitmap_scan(end, 0);
+            }
+            to = from;
+            from = DATA_START_BLOCK_NUM;
+        }
+    }
+    if (length > want) {
+        length = want;
+    }
+    *start_out = start;
+    *length_out = length;
+}
+
+// fs_alloc_extent's search with the bitmap blocks it reaches read in:
+// returns with alloc_lock held (*flags to restore) and the run in *start
+// and *length, or 0 unlocked if the volume is full or a read fails
+static int fs_alloc_find(uint32_t goal, uint32_t want, uint32_t* start, uint32_t* length,
+                         uint32_t* flags) {
+    uint32_t total = fs_total_blocks();
+    if (goal >= total || !fs_bitmap_load(goal)) {
+        goal = 0;
+    }
+    for (;;) {
+        *flags = spin_lock_irqsave(&alloc_lock);
+        if (g_fs_state.superblock->free_blocks == 0) {
+            spin_unlock_irqrestore(&alloc_lock, *flags);
+            return 0;
+        }
+        fs_bitmap_missing = total;
+        fs_alloc_search(goal, want, start, length);
+        if (fs_bitmap_missing == total) {
+            if (!fs_trim_overlaps(fs_trim_busy, fs_trim_busy_count, *start, *length)) {
+                return 1;
+            }
+            // Being discarded: written before the TRIM lands, it would be lost
+            spin_unlock_irqrestore(&alloc_lock, *flags);
+            process_yield();
+            continue;
+        }
+        uint32_t missing = fs_bitmap_missing;
+        spin_unlock_irqrestore(&alloc_lock, *flags);
+        if (!fs_bitmap_load(missing)) {
+            return 0;
+        }
+    }
+}
+
+// Allocate up to want consecutive blocks, starting at goal when it is free
+// (so a file grows in place). Otherwise the search is next-fit: from where
+// the last allocation ended, wrapping once, it takes the first free run
+// that long, else the longest it passed. Returns the first block and sets
+// *got, 0 if full. A search that reaches a bitmap block not read in yet
+// reads it (unlocked) and starts over, so only the bitmap blocks of the
+// volume's used part, and the one past it, are ever read.
+uint32_t fs_alloc_extent(uint32_t goal, uint32_t want, uint32_t* got) {
+    *got = 0;
+    if (want == 0) {
+        return 0;
+    }
+    uint32_t total = fs_total_blocks();
+    uint32_t flags;
+    uint32_t start;
+    uint32_t length;
+    if (!fs_alloc_find(goal, want, &start, &length, &flags)) {
+        return 0;
+    }
+    
+    for (uint32_t i = start; i < start + length; i++) {
+        fs_bitmap_set(i, 1);
+    }
+    if (length) {
+        fs_trim_remove(fs_trim_freed, &fs_trim_freed_count, start, length);
+        fs_trim_remove(fs_trim_ready, &fs_trim_ready_count, start, length);
+        alloc_cursor = start + length < total ? start + length : DATA_START_BLOCK_NUM;
+        g_fs_state.superblock->free_blocks -= length;
+        fs_mark_dirty(SUPERBLOCK_NUM);
+    }
+    spin_unlock_irqrestore(&alloc_lock, flags);
+    *got = length;
+    return length ? start : 0;
+}
+
+// Allocate a free block
+uint32_t fs_alloc_block(void) {
+    uint32_t got;
+    return fs_alloc_extent(0, 1, &got);
+}
+
+// Free a block
+int fs_free_block(uint32_t block_num) {
+    if (block_num < DATA_START_BLOCK_NUM || block_num >= fs_total_blocks()) {
+        return FS_ERROR_INVALID_PATH;
+    }
+    if (!fs_bitmap_load(block_num)) {
+        return FS_ERROR_NO_SPACE;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&alloc_lock);
+    if (!fs_block_used(block_num)) {
+        spin_unlock_irqrestore(&alloc_lock, flags);
+        return FS_ERROR_NOT_FOUND; // Already free
+    }
+    
+    fs_bitmap_set(block_num, 0);
+    if (block_num < SIMPLEFS_MAX_BLOCKS) {
+        fs_meta[block_num / 8] &= (uint8_t)~(1 << (block_num % 8));
+    }
+    g_fs_state.superblock->free_blocks++;
+    fs_mark_dirty(SUPERBLOCK_NUM);
+    if (fs_trim_enabled) {
+        fs_trim_add(fs_trim_freed, &fs_trim_freed_count, block_num, 1);
+    }
+    spin_unlock_irqrestore(&alloc_lock, flags);
+    fs_sum_clear(block_num);
+    fs_dir_index_drop(block_num);  // In case it held a directory
+    fs_dentry_forget_dir(block_num);
+    fs_unpack_forget(block_num);
+    
+    return FS_SUCCESS;
+}
+
+// Check if a block is allocated
+int fs_is_block_allocated(uint32_t block_num) {
+    if (block_num >= fs_total_blocks() || !fs_bitmap_load(block_num)) {
+        return 0;
+    }
+    
+    return fs_block_used(block_num);
+}
+
+// Extent holding file block file_block, or NULL past the mapped end.
+// A binary search over the sorted extents.
+static const fs_extent_t* fs_extent_find(const fs_extent_map_t* map, uint32_t file_block) {
+    if (map->magic != SIMPLEFS_EXTENT_MAGIC || file_block >= map->blocks) {
+        return NULL;
+    }
+    uint32_t low = 0;
+    uint32_t high = map->count;
+    while (high - low > 1) {
+        uint32_t mid = (low + high) / 2;
+        if (map->extents[mid].file_block <= file_block) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    const fs_extent_t* extent = &map->extents[low];
+    return file_block - extent->file_block < extent->length ? extent : NULL;
+}
+
+// Disk block holding file block file_block, or 0 past the mapped end
+static uint32_t fs_extent_lookup(const fs_extent_map_t* map, uint32_t file_block) {
+    const fs_extent_t* extent = fs_extent_find(map, file_block);
+    return extent ? extent->start + (file_block - extent->file_block) : 0;
+}
+
+// The same for an open file, from the extent it used last when that covers
+// the block. Extents only ever grow, so a remembered one stays right.
+static uint32_t fs_bmap(file_descriptor_t* fdp, uint32_t file_block) {
+    if (file_block - fdp->ext_file_block < fdp->ext_length) {
+        return fdp->ext_start + (file_block - fdp->ext_file_block);
+    }
+    fs_extent_map_t* map = (fs_extent_map_t*)fs_get_block(fdp->first_block);
+    if (!map) {
+        return 0;
+    }
+    const fs_extent_t* extent = fs_extent_find(map, file_block);
+    if (extent) {
+        fdp->ext_file_block = extent->file_block;
+        fdp->ext_start = extent->start;
+        fdp->ext_length = extent->length;
+    }
+    fs_put_block(map, 0);
+    return extent ? extent->start + (file_block - extent->file_block) : 0;
+}
+
+// Map want more blocks onto the end of a file, right after its last extent
+// where they are free. Returns how many were mapped (fewer when the
+// disk or the map is full).
+static uint32_t fs_extend(uint32_t map_block, uint32_t want) {
+    fs_extent_map_t* map = (fs_extent_map_t*)fs_get_block(map_block);
+    if (!map) {
+        return 0;
+    }
+    uint32_t mapped = 0;
+    while (mapped < want && map->magic == SIMPLEFS_EXTENT_MAGIC) {
+        fs_extent_t* last = map->count ? &map->extents[map->count - 1] : NULL;
+        uint32_t got;
+        uint32_t goal = last && !(last->start & SIMPLEFS_EXTENT_PACKED) ? last->start + last->length : 0;
+        uint32_t start = fs_alloc_extent(goal, want - mapped, &got);
+        if (start == 0) {
+            break;
+        }
+        if (last && start == last->start + last->length) {
+            last->length += got;
+        } else if (map->count < SIMPLEFS_MAX_EXTENTS) {
+            fs_extent_t* extent = &map->extents[map->count++];
+            extent->file_block = map->blocks;
+            extent->start = start;
+            extent->length = got;
+        } else {
+            for (uint32_t i = 0; i < got; i++) {
+                fs_free_block(start + i);
+            }
+            break;
+        }
+        map->blocks += got;
+        mapped += got;
+    }
+    fs_put_metadata(map, mapped > 0);
+    return mapped;
+}
+
+static int fs_pack_setup(void) {
+    if (!fs_pack_buffer) {
+        fs_pack_buffer = kmalloc(FS_PACK_BUFFER_BLOCKS * SIMPLEFS_BLOCK_SIZE);
+    }
+    return fs_pack_buffer != NULL;
+}
+
+// Disk blocks of the compressed run at run, from its header; 0 if it has none
+static uint32_t fs_packed_blocks(uint32_t run, fs_pack_header_t* header) {
+    fs_pack_header_t* block = (fs_pack_header_t*)fs_get_block(run);
+    if (!block) {
+        return 0;
+    }
+    memcpy(header, block, sizeof(fs_pack_header_t));
+    fs_put_block(block, 0);
+    if (header->magic != SIMPLEFS_PACK_MAGIC || header->disk_blocks == 0 ||
+        header->disk_blocks >= SIMPLEFS_PACK_BLOCKS ||
+        header->packed_bytes > header->disk_blocks * SIMPLEFS_BLOCK_SIZE - sizeof(fs_pack_header_t)) {
+        return 0;
+    }
+    return header->disk_blocks;
+}
+
+// The file blocks a compressed extent holds, blocks of them, decompressed
+// through the unpack cache; NULL if the run can't be read. Mounted from
+// disk, the run's blocks are queued together after the header, so it
+// costs about one command.
+static uint8_t* fs_unpack(uint32_t run, uint32_t blocks) {
+    fs_unpacked_t* victim = &fs_unpacked[0];
+    for (uint32_t i = 0; i < SIMPLEFS_UNPACK_SLOTS; i++) {
+        if (fs_unpacked[i].run == run && fs_unpacked[i].data) {
+            fs_unpacked[i].used = ++fs_unpack_clock;
+            return fs_unpacked[i].data;
+        }
+        if (fs_unpacked[i].used < victim->used) {
+            victim = &fs_unpacked[i];
+        }
+    }
+    if (blocks > SIMPLEFS_PACK_BLOCKS || !fs_pack_setup()) {
+        return NULL;
+    }
+    if (!victim->data) {
+        victim->data = kmalloc(SIMPLEFS_PACK_BLOCKS * SIMPLEFS_BLOCK_SIZE);
+        if (!victim->data) {
+            return NULL;
+        }
+    }
+    victim->run = 0;
+    
+    fs_pack_header_t header;
+    uint32_t disk_blocks = fs_packed_blocks(run, &header);
+    if (disk_blocks == 0 || header.raw_bytes != blocks * SIMPLEFS_BLOCK_SIZE) {
+        return NULL;
+    }
+    if (fs_cached) {
+        for (uint32_t i = 1; i < disk_blocks; i++) {
+            bcache_prefetch(fs_disk_drive, fs_block_lba(run + i));
+        }
+        blk_unplug();
+    }
+    for (uint32_t i = 0; i < disk_blocks; i++) {
+        void* data = fs_get_block(run + i);
+        if (!data) {
+            return NULL;
+        }
+        memcpy(fs_pack_buffer + i * SIMPLEFS_BLOCK_SIZE, data, SIMPLEFS_BLOCK_SIZE);
+        fs_put_block(data, 0);
+    }
+    if (lz4_decompress(fs_pack_buffer + sizeof(fs_pack_header_t), header.packed_bytes,
+                       victim->data, header.raw_bytes) != (int)header.raw_bytes) {
+        return NULL;
+    }
+    victim->run = run;
+    victim->used = ++fs_unpack_clock;
+    return victim->data;
+}
+
+// Free the disk blocks behind file blocks from..to-1 of an extent (all of
+// a compressed one)
+static void fs_extent_release(const fs_extent_t* extent, uint32_t from, uint32_t to) {
+    if (extent->start & SIMPLEFS_EXTENT_PACKED) {
+        uint32_t run = extent->start & ~SIMPLEFS_EXTENT_PACKED;
+        fs_pack_header_t header;
+        uint32_t disk_blocks = fs_packed_blocks(run, &header);
+        for (uint32_t i = 0; i < disk_blocks; i++) {
+            fs_free_block(run + i);
+        }
+        return;
+    }
+    for (uint32_t block = from; block < to; block++) {
+        fs_free_block(extent->start + (block - extent->file_block));
+    }
+}
+
+// Map file blocks file_block..file_block+count-1 to the run at start
+// (flagged SIMPLEFS_EXTENT_PACKED when compressed), freeing what held
+// them. Plain extents are split around the range; compressed ones can
+// only be replaced whole.
+static int fs_extent_replace(uint32_t map_block, uint32_t file_block, uint32_t count, uint32_t start) {
+    fs_extent_map_t* map = (fs_extent_map_t*)fs_get_block(map_block);
+    if (!map) {
+        return FS_ERROR_NOT_FOUND;
+    }
+    uint32_t end = file_block + count;
+    fs_extent_t* old = NULL;
+    if (map->magic == SIMPLEFS_EXTENT_MAGIC && end <= map->blocks &&
+        map->count + 2 <= SIMPLEFS_MAX_EXTENTS) {
+        old = kmalloc(map->count * sizeof(fs_extent_t));
+    }
+    if (!old) {
+        fs_put_block(map, 0);
+        return FS_ERROR_NO_SPACE;
+    }
+    uint32_t old_count = map->count;
+    memcpy(old, map->extents, old_count * sizeof(fs_extent_t));
+    for (uint32_t i = 0; i < old_count; i++) {
+        uint32_t old_end = old[i].file_block + old[i].length;
+        if ((old[i].start & SIMPLEFS_EXTENT_PACKED) && old_end > file_block && old[i].file_block < end &&
+            (old[i].file_block < file_block || old_end > end)) {
+            kfree(old);
+            fs_put_block(map, 0);
+            return FS_ERROR_INVALID_PATH;
+        }
+    }
+    
+    uint32_t n = 0;
+    int placed = 0;
+    for (uint32_t i = 0; i < old_count; i++) {
+        fs_extent_t* extent = &old[i];
+        uint32_t old_end = extent->file_block + extent->length;
+        if (!placed && extent->file_block >= file_block) {
+            map->extents[n].file_block = file_block;
+            map->extents[n].start = start;
+            map->extents[n++].length = count;
+            placed = 1;
+        }
+        if (old_end <= file_block || extent->file_block >= end) {
+            map->extents[n++] = *extent;
+            continue;
+        }
+        if (extent->file_block < file_block) {
+            map->extents[n].file_block = extent->file_block;
+            map->extents[n].start = extent->start;
+            map->extents[n++].length = file_block - extent->file_block;
+            map->extents[n].file_block = file_block;
+            map->extents[n].start = start;
+            map->extents[n++].length = count;
+            placed = 1;
+        }
+        if (old_end > end) {
+            map->extents[n].file_block = end;
+            map->extents[n].start = extent->start + (end - extent->file_block);
+            map->extents[n++].length = old_end - end;
+        }
+    }
+    map->count = n;
+    fs_put_metadata(map, 1);
+    
+    for (uint32_t i = 0; i < old_count; i++) {
+        uint32_t from = old[i].file_block > file_block ? old[i].file_block : file_block;
+        uint32_t to = old[i].file_block + old[i].length < end ? old[i].file_block + old[i].length : end;
+        if (from < to) {
+            fs_extent_release(&old[i], from, to);
+        }
+    }
+    kfree(old);
+    return FS_SUCCESS;
+}
+
+// The map of a file changed under its descriptors: drop the extents they remember
+static void fs_fd_forget_extents(uint32_t map_block) {
+    for (uint32_t i = 0; i < g_fs_state.fd_capacity; i++) {
+        file_descriptor_t* fdp = g_fs_state.fd_table[i];
+        if (fdp && fdp->first_block == map_block) {
+            fdp->ext_length = 0;
+        }
+    }
+}
+
+// Put back in plain blocks the compressed extent holding file_block (if
+// it is one), so it can be written in place. The last close packs it again.
+static int fs_unpack_extent(uint32_t map_block, uint32_t file_block) {
+    fs_extent_map_t* map = (fs_extent_map_t*)fs_get_block(map_block);
+    if (!map) {
+        return FS_ERROR_NOT_FOUND;
+    }
+    const fs_extent_t* found = fs_extent_find(map, file_block);
+    fs_extent_t extent;
+    int packed = found && (found->start & SIMPLEFS_EXTENT_PACKED);
+    if (packed) {
+        extent = *found;
+    }
+    fs_put_block(map, 0);
+    if (!packed) {
+        return FS_SUCCESS;
+    }
+    
+    uint8_t* data = fs_unpack(extent.start & ~SIMPLEFS_EXTENT_PACKED, extent.length);
+    if (!data) {
+        return FS_ERROR_NOT_FOUND;
+    }
+    uint32_t got;
+    uint32_t start = fs_alloc_extent(0, extent.length, &got);
+    int result = got == extent.length ? FS_SUCCESS : FS_ERROR_NO_SPACE;
+    for (uint32_t i = 0; i < got && result == FS_SUCCESS; i++) {
+        void* block = fs_get_block(start + i);
+        if (!block) {
+            result = FS_ERROR_NO_SPACE;
+            break;
+        }
+        memcpy(block, data + i * SIMPLEFS_BLOCK_SIZE, SIMPLEFS_BLOCK_SIZE);
+        fs_put_block(block, 1);
+    }
+    if (result == FS_SUCCESS) {
+        result = fs_extent_replace(map_block, extent.file_block, extent.length, start);
+    }
+    if (result != FS_SUCCESS) {
+        for (uint32_t i = 0; i < got; i++) {
+            fs_free_block(start + i);
+        }
+    }
+    fs_fd_forget_extents(map_block);
+    return result;
+}
+
+// Compress file blocks file_block.. (one group) if they are all plain and
+// the result frees at least one block
+static int fs_pack_group(uint32_t map_block, uint32_t file_block, uint8_t* input) {
+    fs_extent_map_t* map = (fs_extent_map_t*)fs_get_block(map_block);
+    if (!map) {
+        return FS_ERROR_NOT_FOUND;
+    }
+    uint32_t blocks[SIMPLEFS_PACK_BLOCKS];
+    int plain = 1;
+    for (uint32_t i = 0; i < SIMPLEFS_PACK_BLOCKS && plain; i++) {
+        const fs_extent_t* extent = fs_extent_find(map, file_block + i);
+        plain = extent && !(extent->start & SIMPLEFS_EXTENT_PACKED);
+        if (plain) {
+            blocks[i] = extent->start + (file_block + i - extent->file_block);
+        }
+    }
+    fs_put_block(map, 0);
+    if (!plain) {
+        return FS_SUCCESS;
+    }
+    for (uint32_t i = 0; i < SIMPLEFS_PACK_BLOCKS; i++) {
+        void* data = fs_get_block(blocks[i]);
+        if (!data) {
+            return FS_ERROR_NOT_FOUND;
+        }
+        memcpy(input + i * SIMPLEFS_BLOCK_SIZE, data, SIMPLEFS_BLOCK_SIZE);
+        fs_put_block(data, 0);
+    }
     
-    // Format the file system
-    int result = fs_format();
+    // Capped so that anything it accepts is at least a block smaller
+    fs_pack_header_t* header = (fs_pack_header_t*)fs_pack_buffer;
+    uint32_t packed = lz4_compress(input, SIMPLEFS_PACK_BLOCKS * SIMPLEFS_BLOCK_SIZE,
+                                   fs_pack_buffer + sizeof(fs_pack_header_t),
+                                   (SIMPLEFS_PACK_BLOCKS - 1) * SIMPLEFS_BLOCK_SIZE - sizeof(fs_pack_header_t),
+                                   fs_pack_table);
+    if (packed == 0) {
+        return FS_SUCCESS;
+    }
+    uint32_t used = sizeof(fs_pack_header_t) + packed;
+    uint32_t disk_blocks = (used + SIMPLEFS_BLOCK_SIZE - 1) / SIMPLEFS_BLOCK_SIZE;
+    header->magic = SIMPLEFS_PACK_MAGIC;
+    header->raw_bytes = SIMPLEFS_PACK_BLOCKS * SIMPLEFS_BLOCK_SIZE;
+    header->packed_bytes = packed;
+    header->disk_blocks = disk_blocks;
+    memset(fs_pack_buffer + used, 0, disk_blocks * SIMPLEFS_BLOCK_SIZE - used);
+    
+    uint32_t got;
+    uint32_t run = fs_alloc_extent(0, disk_blocks, &got);
+    int result = got == disk_blocks ? FS_SUCCESS : FS_ERROR_NO_SPACE;
+    for (uint32_t i = 0; i < got && result == FS_SUCCESS; i++) {
+        void* data = fs_get_block(run + i);
+        if (!data) {
+            result = FS_ERROR_NO_SPACE;
+            break;
+        }
+        memcpy(data, fs_pack_buffer + i * SIMPLEFS_BLOCK_SIZE, SIMPLEFS_BLOCK_SIZE);
+        fs_put_block(data, 1);
+    }
+    if (result == FS_SUCCESS) {
+        result = fs_extent_replace(map_block, file_block, SIMPLEFS_PACK_BLOCKS,
+                                   run | SIMPLEFS_EXTENT_PACKED);
+    }
     if (result != FS_SUCCESS) {
-        terminal_writestring("ERROR: Failed to format file system\n");
-        kfree(g_fs_state.blocks);
-        return result;
+        for (uint32_t i = 0; i < got; i++) {
+            fs_free_block(run + i);
+        }
     }
-    
-    // Initialize current directory to root
-    strcpy(g_fs_state.current_dir, "/");
-    
-    // Mark as initialized
-    g_fs_state.initialized = 1;
-    
-    terminal_writestring("SimpleFS initialized successfully!\n");
-    return FS_SUCCESS;
+    return result;
 }
 
-// Format the file system (create initial structures)
-int fs_format(void) {
-    // Initialize superblock
-    superblock_t* sb = g_fs_state.superblock;
-    sb->magic = SIMPLEFS_MAGIC;
-    sb->total_blocks = SIMPLEFS_MAX_BLOCKS;
-    sb->free_blocks = SIMPLEFS_MAX_BLOCKS - DATA_START_BLOCK_NUM; // Subtract system blocks
-    sb->root_dir_block = ROOT_DIR_BLOCK_NUM;
-    sb->fat_block = FAT_BLOCK_NUM;
-    sb->data_start_block = DATA_START_BLOCK_NUM;
-    sb->max_files = SIMPLEFS_MAX_FILES;
-    sb->block_size = SIMPLEFS_BLOCK_SIZE;
-    
-    // Initialize FAT - mark system blocks as allocated
-    fat_entry_t* fat = g_fs_state.fat;
-    
-    // Mark superblock, FAT, and root directory as allocated
-    fat[SUPERBLOCK_NUM].allocated = 1;
-    fat[SUPERBLOCK_NUM].next_block = FAT_END_OF_FILE;
-    
-    fat[FAT_BLOCK_NUM].allocated = 1;
-    fat[FAT_BLOCK_NUM].next_block = FAT_END_OF_FILE;
-    
-    fat[ROOT_DIR_BLOCK_NUM].allocated = 1;
-    fat[ROOT_DIR_BLOCK_NUM].next_block = FAT_END_OF_FILE;
-    
-    // Mark all other blocks as free
-    for (uint32_t i = DATA_START_BLOCK_NUM; i < SIMPLEFS_MAX_BLOCKS; i++) {
-        fat[i].allocated = 0;
-        fat[i].next_block = 0;
+// Compress a file's whole groups of SIMPLEFS_PACK_BLOCKS still in plain
+// blocks (at its last close). The partial group at the end stays plain,
+// so appending goes on in place.
+static void fs_pack_file(fs_inode_t* inode) {
+    uint32_t groups = inode->size / (SIMPLEFS_PACK_BLOCKS * SIMPLEFS_BLOCK_SIZE);
+    if (groups == 0 || !fs_pack_setup()) {
+        return;
     }
-    
-    // Initialize root directory (empty)
-    dir_entry_t* root_dir = (dir_entry_t*)fs_get_block(ROOT_DIR_BLOCK_NUM);
-    memset(root_dir, 0, SIMPLEFS_BLOCK_SIZE);
-    
-    terminal_writestring("File system formatted successfully\n");
-    return FS_SUCCESS;
+    uint8_t* input = kmalloc(SIMPLEFS_PACK_BLOCKS * SIMPLEFS_BLOCK_SIZE);
+    if (!input) {
+        return;
+    }
+    for (uint32_t group = 0; group < groups; group++) {
+        if (fs_pack_group(inode->first_block, group * SIMPLEFS_PACK_BLOCKS, input) != FS_SUCCESS) {
+            break;
+        }
+    }
+    kfree(input);
 }
 
-// Get pointer to a specific block
-void* fs_get_block(uint32_t block_num) {
-    if (block_num >= SIMPLEFS_MAX_BLOCKS) {
-        return NULL;
+// Runs of a file's blocks that follow one another on disk, however many
+// extents map them, and its length in *blocks. 0 for a file the
+// defragmenter leaves alone: inline, or with compressed extents.
+static uint32_t fs_extent_fragments(const fs_extent_map_t* map, uint32_t* blocks) {
+    *blocks = 0;
+    if (map->magic != SIMPLEFS_EXTENT_MAGIC || map->count > SIMPLEFS_MAX_EXTENTS) {
+        return 0;
     }
-    
-    char* base = (char*)g_fs_state.blocks;
-    return base + (block_num * SIMPLEFS_BLOCK_SIZE);
+    uint32_t fragments = 0;
+    for (uint32_t i = 0; i < map->count; i++) {
+        const fs_extent_t* extent = &map->extents[i];
+        if (extent->start & SIMPLEFS_EXTENT_PACKED) {
+            return 0;
+        }
+        if (i == 0 || extent->start != extent[-1].start + extent[-1].length) {
+            fragments++;
+        }
+    }
+    *blocks = map->blocks;
+    return fragments;
 }
 
-// Allocate a free block
-uint32_t fs_alloc_block(void) {
-    fat_entry_t* fat = g_fs_state.fat;
-    
-    // Find first free block starting from data area
-    for (uint32_t i = DATA_START_BLOCK_NUM; i < SIMPLEFS_MAX_BLOCKS; i++) {
-        if (!fat[i].allocated) {
-            fat[i].allocated = 1;
-            fat[i].next_block = FAT_END_OF_FILE;
-            g_fs_state.superblock->free_blocks--;
-            return i;
+// Join neighbouring plain extents whose blocks follow one another on disk
+static void fs_extent_coalesce(fs_extent_map_t* map) {
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < map->count; i++) {
+        fs_extent_t* extent = &map->extents[i];
+        fs_extent_t* last = n > 0 ? &map->extents[n - 1] : NULL;
+        if (last && !((last->start | extent->start) & SIMPLEFS_EXTENT_PACKED) &&
+            last->file_block + last->length == extent->file_block &&
+            last->start + last->length == extent->start) {
+            last->length += extent->length;
+        } else {
+            map->extents[n++] = *extent;
         }
     }
-    
-    return 0; // No free blocks
+    map->count = n;
 }
 
-// Free a block
-int fs_free_block(uint32_t block_num) {
-    if (block_num < DATA_START_BLOCK_NUM || block_num >= SIMPLEFS_MAX_BLOCKS) {
-        return FS_ERROR_INVALID_PATH;
+// Next file of the round that may want moving (its map block); 0 once
+// the round has walked every directory
+static uint32_t fs_defrag_next(void) {
+    while (fs_defrag.depth > 0) {
+        uint32_t level = fs_defrag.depth - 1;
+        dir_entry_t* dir = (dir_entry_t*)fs_get_block(fs_defrag.dirs[level]);
+        if (!dir) {
+            fs_defrag.depth = 0;
+            return 0;
+        }
+        uint32_t file = 0;
+        uint32_t sub = 0;
+        while (fs_defrag.slots[level] < (uint32_t)SIMPLEFS_DIR_ENTRIES && !file && !sub) {
+            const dir_entry_t* entry = &dir[fs_defrag.slots[level]++];
+            if (entry->name[0] == '\0') {
+                continue;
+            }
+            if (entry->type == FS_TYPE_DIRECTORY) {
+                sub = fs_defrag.depth < SIMPLEFS_DEFRAG_DEPTH ? entry->first_block : 0;
+            } else if (!(entry->flags & FS_FLAG_COMPRESS)) {
+                file = entry->first_block;  // Packing at close owns these
+            }
+        }
+        fs_put_block(dir, 0);
+        if (file) {
+            return file;
+        }
+        if (sub) {
+            fs_defrag.dirs[fs_defrag.depth] = sub;
+            fs_defrag.slots[fs_defrag.depth++] = 0;
+        } else {
+            fs_defrag.depth--;
+        }
     }
-    
-    fat_entry_t* fat = g_fs_state.fat;
-    if (!fat[block_num].allocated) {
-        return FS_ERROR_NOT_FOUND; // Already free
+    return 0;
+}
+
+// Take on the file at map_block if it is closed and fragmented and a free
+// run can hold all of it. The run is only looked at: each window
+// allocates its own part, and one found taken since starts over.
+static int fs_defrag_begin(uint32_t map_block) {
+    fs_extent_map_t* map = (fs_extent_map_t*)fs_get_block(map_block);
+    if (!map) {
+        return 0;
     }
-    
-    fat[block_num].allocated = 0;
-    fat[block_num].next_block = 0;
-    g_fs_state.superblock->free_blocks++;
-    
-    return FS_SUCCESS;
+    uint32_t blocks;
+    uint32_t fragments = fs_extent_fragments(map, &blocks);
+    fs_put_block(map, 0);
+    if (fragments <= 1 || fs_inode_find(map_block)) {
+        return 0;
+    }
+    uint32_t flags;
+    uint32_t start;
+    uint32_t length;
+    if (!fs_alloc_find(0, blocks, &start, &length, &flags)) {
+        return 0;
+    }
+    spin_unlock_irqrestore(&alloc_lock, flags);
+    if (length < blocks) {
+        return 0;
+    }
+    fs_defrag.file = map_block;
+    fs_defrag.blocks = blocks;
+    fs_defrag.target = start;
+    fs_defrag.done = 0;
+    return 1;
 }
 
-// Check if a block is allocated
-int fs_is_block_allocated(uint32_t block_num) {
-    if (block_num >= SIMPLEFS_MAX_BLOCKS) {
+// Copy the next blocks of the file being moved, up to budget of them,
+// into their place in the target run, switch its map over and commit.
+// Returns the blocks moved; 0 when the move is over, finished or not.
+static uint32_t fs_defrag_window(uint32_t budget) {
+    uint32_t map_block = fs_defrag.file;
+    fs_extent_map_t* map = (fs_extent_map_t*)fs_get_block(map_block);
+    if (!map) {
+        fs_defrag.file = 0;
+        return 0;
+    }
+    uint32_t blocks;
+    uint32_t fragments = fs_extent_fragments(map, &blocks);
+    uint32_t source[SIMPLEFS_DEFRAG_BLOCKS];
+    uint32_t count = 0;
+    if (fragments > 1 && blocks == fs_defrag.blocks && !fs_inode_find(map_block)) {
+        while (fs_defrag.done < blocks &&
+               fs_extent_lookup(map, fs_defrag.done) == fs_defrag.target + fs_defrag.done) {
+            fs_defrag.done++;           // In place already
+        }
+        while (fs_defrag.done + count < blocks && count < budget && count < SIMPLEFS_DEFRAG_BLOCKS) {
+            uint32_t file_block = fs_defrag.done + count;
+            uint32_t block = fs_extent_lookup(map, file_block);
+            if (block == fs_defrag.target + file_block) {
+                break;
+            }
+            source[count++] = block;
+        }
+    }
+    fs_put_block(map, 0);
+    if (count == 0) {
+        if (fragments == 1 && fs_defrag.done > 0) {
+            fs_defrag.files_moved++;
+            fs_defrag.moved_round++;
+        }
+        fs_defrag.file = 0;
         return 0;
     }
     
-    return g_fs_state.fat[block_num].allocated;
+    uint32_t goal = fs_defrag.target + fs_defrag.done;
+    uint32_t got;
+    uint32_t start = fs_alloc_extent(goal, count, &got);
+    int result = start == goal ? FS_SUCCESS : FS_ERROR_NO_SPACE;  // Else taken since
+    if (result == FS_SUCCESS) {
+        for (uint32_t i = 0; i < got; i++) {
+            bcache_prefetch(fs_disk_drive, fs_block_lba(source[i]));
+        }
+        blk_unplug();
+    }
+    for (uint32_t i = 0; i < got && result == FS_SUCCESS; i++) {
+        void* from = fs_get_block(source[i]);
+        void* to = from ? fs_get_block(start + i) : NULL;
+        if (!to) {
+            fs_put_block(from, 0);
+            result = FS_ERROR_NO_SPACE;
+            break;
+        }
+        memcpy(to, from, SIMPLEFS_BLOCK_SIZE);
+        fs_put_block(from, 0);
+        fs_put_block(to, 1);
+    }
+    if (result == FS_SUCCESS) {
+        result = fs_extent_replace(map_block, fs_defrag.done, got, start);
+    }
+    if (result != FS_SUCCESS) {
+        for (uint32_t i = 0; i < got; i++) {
+            fs_free_block(start + i);
+        }
+        fs_defrag.file = 0;
+        return 0;
+    }
+    map = (fs_extent_map_t*)fs_get_block(map_block);
+    if (map) {
+        fs_extent_coalesce(map);
+        fs_put_metadata(map, 1);
+    }
+    fs_journal_commit();            // Data first, then the new map and the old blocks' release
+    fs_defrag.done += got;
+    fs_defrag.blocks_moved += got;
+    return got;
+}
+
+// One pass of the defragmenter, from the flusher: nothing while other
+// I/O keeps the disk busy or a caller is in the file system, else up to
+// SIMPLEFS_DEFRAG_BLOCKS blocks moved. A round that moves nothing is
+// followed by SIMPLEFS_DEFRAG_REST passes of rest.
+static void fs_defrag_pass(void) {
+    if (!fs_cached || !g_fs_state.initialized) {
+        return;
+    }
+    blk_stats_t stats;
+    blk_get_stats(&stats);
+    uint32_t others = stats.submitted - fs_defrag.requests;
+    fs_defrag.requests = stats.submitted;
+    if (others > SIMPLEFS_DEFRAG_IDLE) {
+        fs_defrag.busy_passes++;
+        return;
+    }
+    if (fs_defrag.file == 0 && fs_defrag.depth == 0 && fs_defrag.rest > 0) {
+        fs_defrag.rest--;
+        return;
+    }
+    if (!mutex_trylock(&fs_mutex)) {
+        return;
+    }
+    if (fs_cached && g_fs_state.initialized) {
+        if (fs_defrag.file == 0 && fs_defrag.depth == 0) {
+            fs_defrag.dirs[0] = ROOT_DIR_BLOCK_NUM;
+            fs_defrag.slots[0] = 0;
+            fs_defrag.depth = 1;
+            fs_defrag.moved_round = 0;
+        }
+        uint32_t budget = SIMPLEFS_DEFRAG_BLOCKS;
+        uint32_t looks = SIMPLEFS_DIR_ENTRIES;      // Maps read per pass, moving or not
+        while (budget > 0 && looks > 0) {
+            if (fs_defrag.file) {
+                budget -= fs_defrag_window(budget);
+                continue;
+            }
+            uint32_t map_block = fs_defrag_next();
+            if (map_block == 0) {
+                fs_defrag.rest = fs_defrag.moved_round ? 0 : SIMPLEFS_DEFRAG_REST;
+                break;
+            }
+            fs_defrag_begin(map_block);
+            looks--;
+        }
+    }
+    mutex_unlock(&fs_mutex);
+    blk_get_stats(&stats);
+    fs_defrag.requests = stats.submitted;   // Its own I/O doesn't count against the next pass
+}
+
+// The buffer cache flusher's hook
+static void fs_flusher_work(void) {
+    fs_trim_flush();
+    fs_defrag_pass();
+}
+
+// Print the files under the directory at dir_block, whose path (ending in
+// '/') is path[0..len), and add them to totals: files, fragmented, blocks
+static void fs_defrag_report_dir(uint32_t dir_block, char* path, uint32_t len, uint32_t depth,
+                                 uint32_t* totals) {
+    dir_entry_t* dir = (dir_entry_t*)fs_get_block(dir_block);
+    if (!dir) {
+        return;
+    }
+    for (int i = 0; i < SIMPLEFS_DIR_ENTRIES; i++) {
+        uint32_t name_len = strlen(dir[i].name);
+        if (name_len == 0 || len + name_len + 2 > SIMPLEFS_MAX_PATH) {
+            continue;
+        }
+        memcpy(path + len, dir[i].name, name_len + 1);
+        if (dir[i].type == FS_TYPE_DIRECTORY) {
+            if (depth < SIMPLEFS_DEFRAG_DEPTH) {
+                path[len + name_len] = '/';
+                path[len + name_len + 1] = '\0';
+                fs_defrag_report_dir(dir[i].first_block, path, len + name_len + 1, depth + 1, totals);
+            }
+            continue;
+        }
+        fs_extent_map_t* map = (fs_extent_map_t*)fs_get_block(dir[i].first_block);
+        if (!map) {
+            continue;
+        }
+        uint32_t blocks;
+        uint32_t fragments = fs_extent_fragments(map, &blocks);
+        uint32_t magic = map->magic;
+        uint32_t extents = map->count;
+        fs_put_block(map, 0);
+        totals[0]++;
+        if (magic == SIMPLEFS_INLINE_MAGIC) {
+            terminal_printf("  %s: inline\n", path);
+        } else if (fragments == 0 && extents > 0 && magic == SIMPLEFS_EXTENT_MAGIC) {
+            terminal_printf("  %s: compressed\n", path);
+        } else {
+            terminal_printf("  %s: %d blocks in %d fragment%s\n", path, (int)blocks, (int)fragments,
+                            fragments == 1 ? "" : "s");
+            totals[1] += fragments > 1;
+            totals[2] += blocks;
+        }
+    }
+    fs_put_block(dir, 0);
+}
+
+// The shell's defrag: each file's fragments, and the defragmenter's progress
+void fs_defrag_report(void) {
+    int entered = fs_enter();
+    if (g_fs_state.initialized) {
+        char path[SIMPLEFS_MAX_PATH] = "/";
+        uint32_t totals[3] = { 0, 0, 0 };
+        fs_defrag_report_dir(ROOT_DIR_BLOCK_NUM, path, 1, 1, totals);
+        terminal_printf("%d files, %d fragmented, %d blocks\n", (int)totals[0], (int)totals[1],
+                        (int)totals[2]);
+        terminal_printf("Defragmenter: %d files made contiguous, %d blocks moved, %d passes left to other I/O%s\n",
+                        (int)fs_defrag.files_moved, (int)fs_defrag.blocks_moved,
+                        (int)fs_defrag.busy_passes, fs_cached ? "" : " (off: resident file system)");
+    }
+    fs_leave(entered);
 }
 
 // Find a directory entry by name
@@ -162,23 +1862,28 @@ int fs_find_dir_entry(uint32_t dir_block, const char* name, dir_entry_t* entry)
         return FS_ERROR_INVALID_PATH;
     }
     
-    int entries_per_block = SIMPLEFS_BLOCK_SIZE / sizeof(dir_entry_t);
-    
-    for (int i = 0; i < entries_per_block; i++) {
-        if (dir[i].name[0] != '\0' && strcmp(dir[i].name, name) == 0) {
-            if (entry) {
-                memcpy(entry, &dir[i], sizeof(dir_entry_t));
+    int found = -1;
+    fs_dir_index_t* index = fs_dir_index(dir_block, dir);
+    if (index) {
+        found = fs_dir_index_find(index, dir, name);
+    } else {
+        for (int i = 0; i < SIMPLEFS_DIR_ENTRIES && found < 0; i++) {
+            if (dir[i].name[0] != '\0' && strcmp(dir[i].name, name) == 0) {
+                found = i;
             }
-            return i; // Return index
         }
     }
+    if (found >= 0 && entry) {
+        memcpy(entry, &dir[found], sizeof(dir_entry_t));
+    }
     
-    return FS_ERROR_NOT_FOUND;
+    fs_put_block(dir, 0);
+    return found >= 0 ? found : FS_ERROR_NOT_FOUND; // Return index
 }
 
 // Add a directory entry
 int fs_add_dir_entry(uint32_t dir_block, const char* name, uint32_t first_block,
-                     uint32_t size, uint8_t type) {
+                     uint32_t size, uint8_t type, uint8_t flags) {
     dir_entry_t* dir = (dir_entry_t*)fs_get_block(dir_block);
     if (!dir) {
         return FS_ERROR_INVALID_PATH;
@@ -186,23 +1891,36 @@ int fs_add_dir_entry(uint32_t dir_block, const char* name, uint32_t first_block,
     
     // Check if entry already exists
     if (fs_find_dir_entry(dir_block, name, NULL) >= 0) {
+        fs_put_block(dir, 0);
         return FS_ERROR_EXISTS;
     }
     
-    int entries_per_block = SIMPLEFS_BLOCK_SIZE / sizeof(dir_entry_t);
-    
-    // Find first empty slot
-    for (int i = 0; i < entries_per_block; i++) {
+    // Find first empty slot, from where the last one was taken
+    fs_dir_index_t* index = fs_dir_index(dir_block, dir);
+    for (int i = index ? (int)index->free_hint : 0; i < SIMPLEFS_DIR_ENTRIES; i++) {
         if (dir[i].name[0] == '\0') {
             strncpy(dir[i].name, name, SIMPLEFS_MAX_FILENAME - 1);
             dir[i].name[SIMPLEFS_MAX_FILENAME - 1] = '\0';
             dir[i].first_block = first_block;
             dir[i].size = size;
             dir[i].type = type;
+            dir[i].flags = flags;
+            if (index) {
+                fs_dir_index_link(index, i, dir[i].name);
+                index->free_hint = i + 1;
+            }
+            // Replaces a negative dentry for the name, if there was one
+            fs_dentry_insert(dir_block, dir[i].name, fs_name_hash(dir[i].name), i,
+                             first_block, type);
+            fs_put_metadata(dir, 1);
             return FS_SUCCESS;
         }
     }
+    if (index) {
+        index->free_hint = SIMPLEFS_DIR_ENTRIES;
+    }
     
+    fs_put_block(dir, 0);
     return FS_ERROR_NO_SPACE; // Directory full
 }
 
@@ -215,69 +1933,291 @@ int fs_remove_dir_entry(uint32_t dir_block, const char* name) {
     
     int index = fs_find_dir_entry(dir_block, name, NULL);
     if (index < 0) {
+        fs_put_block(dir, 0);
         return FS_ERROR_NOT_FOUND;
     }
     
     // Clear the entry
+    fs_dir_index_t* dir_index = fs_dir_index(dir_block, dir);
+    if (dir_index) {
+        fs_dir_index_unlink(dir_index, index);
+    }
     memset(&dir[index], 0, sizeof(dir_entry_t));
+    fs_put_metadata(dir, 1);
+    fs_dentry_forget(dir_block, name);
+    
+    return FS_SUCCESS;
+}
+
+// Find name in a directory through the dentry cache; fs_find_dir_entry
+// reads the directory only on a miss. Returns the slot like it does.
+int fs_lookup(uint32_t dir_block, const char* name, dir_entry_t* entry) {
+    uint32_t hash = fs_name_hash(name);
+    fs_dentry_t* d = fs_dentry_find(dir_block, name, hash);
+    if (d) {
+        if (d->slot < 0) {
+            return FS_ERROR_NOT_FOUND;
+        }
+        if (!entry) {
+            return d->slot;
+        }
+        // The size changes under the dentry, so the entry itself is read
+        dir_entry_t* dir = (dir_entry_t*)fs_get_block(dir_block);
+        if (dir) {
+            int slot = d->slot;
+            int valid = strcmp(dir[slot].name, name) == 0;
+            if (valid) {
+                memcpy(entry, &dir[slot], sizeof(dir_entry_t));
+            }
+            fs_put_block(dir, 0);
+            if (valid) {
+                return slot;
+            }
+        }
+        fs_dentry_release(d);
+    }
     
+    dir_entry_t found;
+    int slot = fs_find_dir_entry(dir_block, name, &found);
+    if (slot >= 0) {
+        fs_dentry_insert(dir_block, name, hash, slot, found.first_block, found.type);
+        if (entry) {
+            memcpy(entry, &found, sizeof(dir_entry_t));
+        }
+    } else if (slot == FS_ERROR_NOT_FOUND) {
+        fs_dentry_insert(dir_block, name, hash, -1, 0, 0);
+    }
+    return slot;
+}
+
+// Append one component to a path being resolved, applying "." and ".."
+static int fs_path_push(char* out, uint32_t* len, const char* name, uint32_t name_len) {
+    if (name_len == 0 || (name_len == 1 && name[0] == '.')) {
+        return FS_SUCCESS;
+    }
+    if (name_len == 2 && name[0] == '.' && name[1] == '.') {
+        while (*len > 0 && out[*len - 1] != '/') {
+            (*len)--;
+        }
+        if (*len > 0) {
+            (*len)--;   // The slash before it; ".." at the root stays there
+        }
+        out[*len] = '\0';
+        return FS_SUCCESS;
+    }
+    if (name_len >= SIMPLEFS_MAX_FILENAME || *len + 1 + name_len >= SIMPLEFS_MAX_PATH) {
+        return FS_ERROR_INVALID_PATH;
+    }
+    out[(*len)++] = '/';
+    memcpy(out + *len, name, name_len);
+    *len += name_len;
+    out[*len] = '\0';
+    return FS_SUCCESS;
+}
+
+static int fs_path_push_all(char* out, uint32_t* len, const char* path) {
+    while (*path) {
+        const char* end = path;
+        while (*end && *end != '/') {
+            end++;
+        }
+        int result = fs_path_push(out, len, path, (uint32_t)(end - path));
+        if (result != FS_SUCCESS) {
+            return result;
+        }
+        path = *end ? end + 1 : end;
+    }
+    return FS_SUCCESS;
+}
+
+// Absolute form of path (relative ones start at the current directory),
+// without ".", ".." or repeated and trailing slashes
+int fs_resolve_path(const char* path, char* resolved_path) {
+    if (!path || !resolved_path || path[0] == '\0') {
+        return FS_ERROR_INVALID_PATH;
+    }
+    char out[SIMPLEFS_MAX_PATH];
+    uint32_t len = 0;
+    out[0] = '\0';
+    if (path[0] != '/') {
+        int result = fs_path_push_all(out, &len, g_fs_state.current_dir);
+        if (result != FS_SUCCESS) {
+            return result;
+        }
+    }
+    int result = fs_path_push_all(out, &len, path);
+    if (result != FS_SUCCESS) {
+        return result;
+    }
+    if (len == 0) {
+        out[len++] = '/';
+        out[len] = '\0';
+    }
+    memcpy(resolved_path, out, len + 1);
+    return FS_SUCCESS;
+}
+
+// Walk a resolved path to the directory holding its last component, which
+// is copied to leaf ("/" gives the root and an empty leaf)
+static int fs_walk(const char* resolved, uint32_t* dir_block, char* leaf) {
+    uint32_t block = ROOT_DIR_BLOCK_NUM;
+    const char* p = resolved + 1;
+    while (1) {
+        const char* end = p;
+        while (*end && *end != '/') {
+            end++;
+        }
+        uint32_t len = (uint32_t)(end - p);
+        memcpy(leaf, p, len);
+        leaf[len] = '\0';
+        if (*end == '\0') {
+            *dir_block = block;
+            return FS_SUCCESS;
+        }
+        dir_entry_t entry;
+        if (fs_lookup(block, leaf, &entry) < 0) {
+            return FS_ERROR_NOT_FOUND;
+        }
+        if (entry.type != FS_TYPE_DIRECTORY) {
+            return FS_ERROR_NOT_DIR;
+        }
+        block = entry.first_block;
+        p = end + 1;
+    }
+}
+
+// Resolve and walk path, then look up its last component: fills entry
+// (the root has a made-up one) and the directory it is in
+static int fs_path_lookup(const char* path, uint32_t* dir_block, char* leaf, dir_entry_t* entry) {
+    char resolved[SIMPLEFS_MAX_PATH];
+    int result = fs_resolve_path(path, resolved);
+    if (result != FS_SUCCESS) {
+        return result;
+    }
+    result = fs_walk(resolved, dir_block, leaf);
+    if (result != FS_SUCCESS) {
+        return result;
+    }
+    if (leaf[0] == '\0') {
+        memset(entry, 0, sizeof(dir_entry_t));
+        entry->first_block = ROOT_DIR_BLOCK_NUM;
+        entry->type = FS_TYPE_DIRECTORY;
+        return FS_SUCCESS;
+    }
+    if (fs_lookup(*dir_block, leaf, entry) < 0) {
+        return FS_ERROR_NOT_FOUND;
+    }
+    fs_inode_t* inode = entry->type == FS_TYPE_FILE ? fs_inode_find(entry->first_block) : NULL;
+    if (inode) {
+        entry->size = inode->size;
+    }
     return FS_SUCCESS;
 }
 
-// Allocate a file descriptor
+// Allocate a file descriptor, lowest number first. The table doubles when
+// it is full, up to SIMPLEFS_MAX_FD; descriptors are allocated one by one
+// so pointers to them stay put as it grows.
 int fs_alloc_fd(void) {
-    for (int i = 0; i < SIMPLEFS_MAX_FD; i++) {
-        if (!g_fs_state.fd_table[i].in_use) {
-            memset(&g_fs_state.fd_table[i], 0, sizeof(file_descriptor_t));
-            g_fs_state.fd_table[i].fd = i;
-            g_fs_state.fd_table[i].in_use = 1;
-            return i;
+    uint32_t fd = 0;
+    while (fd < g_fs_state.fd_capacity && g_fs_state.fd_table[fd]) {
+        fd++;
+    }
+    if (fd == g_fs_state.fd_capacity) {
+        uint32_t capacity = fd ? fd * 2 : SIMPLEFS_FD_TABLE_INITIAL;
+        if (capacity > SIMPLEFS_MAX_FD) {
+            capacity = SIMPLEFS_MAX_FD;
+        }
+        if (capacity <= fd) {
+            return FS_ERROR_NO_FD;
         }
+        file_descriptor_t** table = krealloc(g_fs_state.fd_table, capacity * sizeof(file_descriptor_t*));
+        if (!table) {
+            return FS_ERROR_NO_FD;
+        }
+        memset(table + fd, 0, (capacity - fd) * sizeof(file_descriptor_t*));
+        g_fs_state.fd_table = table;
+        g_fs_state.fd_capacity = capacity;
+    }
+    
+    file_descriptor_t* fdp = kmalloc(sizeof(file_descriptor_t));
+    if (!fdp) {
+        return FS_ERROR_NO_FD;
     }
-    return FS_ERROR_NO_FD;
+    memset(fdp, 0, sizeof(file_descriptor_t));
+    fdp->fd = (int32_t)fd;
+    fdp->in_use = 1;
+    g_fs_state.fd_table[fd] = fdp;
+    g_fs_state.fd_count++;
+    return (int)fd;
 }
 
 // Free a file descriptor
 void fs_free_fd(int fd) {
-    if (fd >= 0 && fd < SIMPLEFS_MAX_FD) {
-        g_fs_state.fd_table[fd].in_use = 0;
+    if (fd >= 0 && (uint32_t)fd < g_fs_state.fd_capacity && g_fs_state.fd_table[fd]) {
+        kfree(g_fs_state.fd_table[fd]);
+        g_fs_state.fd_table[fd] = NULL;
+        g_fs_state.fd_count--;
     }
 }
 
 // Get file descriptor structure
 file_descriptor_t* fs_get_fd(int fd) {
-    if (fd < 0 || fd >= SIMPLEFS_MAX_FD || !g_fs_state.fd_table[fd].in_use) {
+    if (fd < 0 || (uint32_t)fd >= g_fs_state.fd_capacity) {
         return NULL;
     }
-    return &g_fs_state.fd_table[fd];
+    return g_fs_state.fd_table[fd];
+}
+
+// Drop every descriptor and inode without writing anything back (the state
+// they refer to is going away)
+static void fs_fd_reset(void) {
+    for (uint32_t i = 0; i < g_fs_state.fd_capacity; i++) {
+        fs_free_fd((int)i);
+    }
+    kfree(g_fs_state.fd_table);
+    g_fs_state.fd_table = NULL;
+    g_fs_state.fd_capacity = 0;
+    for (uint32_t i = 0; i < SIMPLEFS_INODE_BUCKETS; i++) {
+        while (fs_inodes[i]) {
+            fs_inode_t* inode = fs_inodes[i];
+            fs_inodes[i] = inode->next;
+            kfree(inode);
+        }
+    }
 }
 
 // Create a file or directory
-int fs_create(const char* path, uint8_t type) {
+static int fs_do_create(const char* path, uint8_t type) {
     if (!g_fs_state.initialized) {
         return FS_ERROR_PERMISSION;
     }
     
-    // For simplicity, only support files in root directory for now
-    if (path[0] != '/' || strchr(path + 1, '/') != NULL) {
-        return FS_ERROR_INVALID_PATH;
+    char resolved[SIMPLEFS_MAX_PATH];
+    char filename[SIMPLEFS_MAX_FILENAME];
+    uint32_t dir_block;
+    int result = fs_resolve_path(path, resolved);
+    if (result == FS_SUCCESS) {
+        result = fs_walk(resolved, &dir_block, filename);
+    }
+    if (result != FS_SUCCESS) {
+        return result;
     }
     
-    const char* filename = path + 1; // Skip leading '/'
-    
-    // Check if file already exists
-    if (fs_find_dir_entry(ROOT_DIR_BLOCK_NUM, filename, NULL) >= 0) {
+    // Check if file already exists ("/" always does)
+    if (filename[0] == '\0' || fs_lookup(dir_block, filename, NULL) >= 0) {
         return FS_ERROR_EXISTS;
     }
     
-    // Allocate a block for the file
+    // Allocate the directory's block, or the file's map (which holds its
+    // data until it outgrows it)
     uint32_t block = fs_alloc_block();
     if (block == 0) {
         return FS_ERROR_NO_SPACE;
     }
     
-    // Add entry to root directory
-    int result = fs_add_dir_entry(ROOT_DIR_BLOCK_NUM, filename, block, 0, type);
+    // Add entry to its directory
+    result = fs_add_dir_entry(dir_block, filename, block, 0, type,
+                              type == FS_TYPE_FILE ? FS_FLAG_INLINE : 0);
     if (result != FS_SUCCESS) {
         fs_free_block(block);
         return result;
@@ -285,76 +2225,302 @@ int fs_create(const char* path, uint8_t type) {
     
     // Initialize the block
     void* block_data = fs_get_block(block);
-    memset(block_data, 0, SIMPLEFS_BLOCK_SIZE);
+    if (block_data) {
+        memset(block_data, 0, SIMPLEFS_BLOCK_SIZE);
+        if (type == FS_TYPE_FILE) {
+            ((fs_inline_map_t*)block_data)->magic = SIMPLEFS_INLINE_MAGIC;
+        }
+        fs_put_metadata(block_data, 1);
+    }
     
     return FS_SUCCESS;
 }
 
+int fs_create(const char* path, uint8_t type) {
+    int entered = fs_enter();
+    int result = fs_do_create(path, type);
+    fs_leave(entered);
+    return result;
+}
+
 // Open a file
-int fs_open(const char* path, uint8_t mode) {
+static int fs_do_open(const char* path, uint8_t mode) {
     if (!g_fs_state.initialized) {
         return FS_ERROR_PERMISSION;
     }
     
-    // For simplicity, only support files in root directory for now
-    if (path[0] != '/' || strchr(path + 1, '/') != NULL) {
-        return FS_ERROR_INVALID_PATH;
-    }
-    
-    const char* filename = path + 1; // Skip leading '/'
-    
     // Find the file
-    dir_entry_t entry;
-    if (fs_find_dir_entry(ROOT_DIR_BLOCK_NUM, filename, &entry) < 0) {
-        // File doesn't exist - create it if O_CREATE flag is set
-        if (mode & O_CREATE) {
-            int result = fs_create(path, FS_TYPE_FILE);
-            if (result != FS_SUCCESS) {
-                return result;
-            }
-            // Find the newly created file
-            if (fs_find_dir_entry(ROOT_DIR_BLOCK_NUM, filename, &entry) < 0) {
-                return FS_ERROR_NOT_FOUND;
-            }
-        } else {
-            return FS_ERROR_NOT_FOUND;
+    dir_entry_t entry;
+    char filename[SIMPLEFS_MAX_FILENAME];
+    uint32_t dir_block;
+    int found = fs_path_lookup(path, &dir_block, filename, &entry);
+    if (found == FS_ERROR_NOT_FOUND && (mode & O_CREATE) && filename[0] != '\0') {
+        // File doesn't exist - create it if O_CREATE flag is set
+        int result = fs_create(path, FS_TYPE_FILE);
+        if (result != FS_SUCCESS) {
+            return result;
         }
+        // Find the newly created file
+        found = fs_path_lookup(path, &dir_block, filename, &entry);
     }
+    if (found != FS_SUCCESS) {
+        return found;
+    }
+    int slot = fs_lookup(dir_block, filename, NULL);
     
     // Check if it's a directory
     if (entry.type == FS_TYPE_DIRECTORY) {
         return FS_ERROR_IS_DIR;
     }
     
-    // Allocate file descriptor
+    // Allocate file descriptor, sharing the inode of any other open on it
+    fs_inode_t* inode = fs_inode_get(&entry, dir_block, slot);
+    if (!inode) {
+        return FS_ERROR_NO_SPACE;
+    }
     int fd = fs_alloc_fd();
     if (fd < 0) {
+        fs_inode_put(inode);
         return FS_ERROR_NO_FD;
     }
     
     file_descriptor_t* fdp = fs_get_fd(fd);
     fdp->first_block = entry.first_block;
-    fdp->current_block = entry.first_block;
+    fdp->inode = inode;
+    fdp->current_block = 0;
+    fdp->ext_length = 0;
     fdp->position = 0;
-    fdp->file_size = entry.size;
+    fdp->ra_next = 0;
+    fdp->ra_end = 0;
+    fdp->ra_window = 0;
     fdp->mode = mode;
     
-    // If truncate mode, reset file size
-    if (mode & O_TRUNCATE) {
-        fdp->file_size = 0;
-        // Update directory entry
-        dir_entry_t* dir = (dir_entry_t*)fs_get_block(ROOT_DIR_BLOCK_NUM);
-        int index = fs_find_dir_entry(ROOT_DIR_BLOCK_NUM, filename, NULL);
-        if (index >= 0) {
-            dir[index].size = 0;
-        }
+    if ((mode & O_COMPRESS) && !(inode->flags & FS_FLAG_COMPRESS)) {
+        inode->flags |= FS_FLAG_COMPRESS;
+        inode->dirty = 1;
+    }
+    
+    // If truncate mode, reset file size (the entry follows at close)
+    if ((mode & O_TRUNCATE) && inode->size != 0) {
+        inode->size = 0;
+        inode->dirty = 1;
     }
     
     return fd;
 }
 
+int fs_open(const char* path, uint8_t mode) {
+    int entered = fs_enter();
+    int result = fs_do_open(path, mode);
+    fs_leave(entered);
+    return result;
+}
+
 // Read from a file
-int fs_read(int fd, void* buffer, uint32_t size) {
+// Sequential reads keep a window of the blocks after the current one queued
+// in the buffer cache. The window starts at SIMPLEFS_RA_MIN and doubles each
+// time the reader has used up half of it; any other access drops it.
+static void fs_readahead(file_descriptor_t* fdp) {
+    if (!fs_cached || fdp->position >= fdp->inode->size) {
+        return;
+    }
+    if (fdp->position != fdp->ra_next) {
+        fdp->ra_window = 0;
+        fdp->ra_end = 0;
+        return;
+    }
+    uint32_t index = fdp->position / SIMPLEFS_BLOCK_SIZE;
+    if (fdp->ra_end <= index) {
+        fdp->ra_end = index + 1;
+    }
+    if (fdp->ra_window == 0) {
+        fdp->ra_window = SIMPLEFS_RA_MIN;
+    } else if (fdp->ra_end - index > fdp->ra_window / 2) {
+        return;  // Still well ahead of the reader
+    } else if (fdp->ra_window < SIMPLEFS_RA_MAX) {
+        fdp->ra_window *= 2;
+    }
+    
+    // Queue from where read-ahead stopped up to the window, short of the end
+    // of the file. Runs within an extent are adjacent on disk, so the block
+    // layer merges them into a few large commands.
+    uint32_t target = index + 1 + fdp->ra_window;
+    uint32_t file_blocks = (fdp->inode->size + SIMPLEFS_BLOCK_SIZE - 1) / SIMPLEFS_BLOCK_SIZE;
+    if (target > file_blocks) {
+        target = file_blocks;
+    }
+    fs_extent_map_t* map = (fs_extent_map_t*)fs_get_block(fdp->first_block);
+    if (!map) {
+        return;
+    }
+    for (uint32_t i = fdp->ra_end; i < target; i++) {
+        uint32_t block = fs_extent_lookup(map, i);
+        if (block == 0 || (block & SIMPLEFS_EXTENT_PACKED) ||
+            bcache_prefetch(fs_disk_drive, fs_block_lba(block)) != 0) {
+            break;  // Unmapped, compressed, or no clean buffer to spare
+        }
+        fdp->ra_end = i + 1;
+    }
+    fs_put_block(map, 0);
+    blk_unplug();
+}
+
+// Blocks after fdp->current_block that follow it on disk, itself included
+static uint32_t fs_run_blocks(file_descriptor_t* fdp) {
+    return fdp->ext_start + fdp->ext_length - fdp->current_block;
+}
+
+// Read more than the rest of the current block in one pass, or return 0
+// for the block-at-a-time path. Resident blocks of an extent lie back to
+// back and take a single copy. Mounted from disk, a page-aligned buffer
+// has whole blocks that aren't cached read straight into it, up to one
+// block-layer command at a time; cached ones (maybe dirty) stay with the
+// cache.
+static uint32_t fs_read_run(file_descriptor_t* fdp, char* dest, uint32_t want) {
+    uint32_t offset = fdp->position % SIMPLEFS_BLOCK_SIZE;
+    uint32_t run = fs_run_blocks(fdp);
+    if (want <= SIMPLEFS_BLOCK_SIZE - offset) {
+        return 0;
+    }
+    if (!fs_cached) {
+        uint32_t bytes = run * SIMPLEFS_BLOCK_SIZE - offset;
+        if (bytes > want) {
+            bytes = want;
+        }
+        memcpy(dest, (char*)fs_get_block(fdp->current_block) + offset, bytes);
+        return bytes;
+    }
+    
+    if (offset != 0 || (uint32_t)dest % SIMPLEFS_BLOCK_SIZE != 0) {
+        return 0;
+    }
+    uint32_t blocks = want / SIMPLEFS_BLOCK_SIZE;
+    if (blocks > run) {
+        blocks = run;
+    }
+    if (blocks > FS_DIRECT_BLOCKS) {
+        blocks = FS_DIRECT_BLOCKS;
+    }
+    uint32_t count = 0;
+    while (count < blocks && !bcache_cached(fs_disk_drive, fs_block_lba(fdp->current_block + count))) {
+        count++;
+    }
+    if (count == 0) {
+        return 0;
+    }
+    blk_request_t req;
+    req.drive = fs_disk_drive;
+    req.write = false;
+    req.flags = 0;
+    req.lba = fs_block_lba(fdp->current_block);
+    req.count = count * (SIMPLEFS_BLOCK_SIZE / BLK_SECTOR_SIZE);
+    req.buffer = dest;
+    req.done = NULL;
+    blk_submit(&req);
+    blk_wait(&req);
+    if (!req.result) {
+        return 0;
+    }
+    // Up to the first block that fails its sum; the block path reports it
+    for (uint32_t i = 0; i < count; i++) {
+        if (!fs_sum_ok(fdp->current_block + i, dest + i * SIMPLEFS_BLOCK_SIZE)) {
+            return i * SIMPLEFS_BLOCK_SIZE;
+        }
+    }
+    return count * SIMPLEFS_BLOCK_SIZE;
+}
+
+// A small file's map, holding its bytes; NULL if it holds extents after
+// all (the file moved to a data block, and a crash kept the entry's flag
+// from catching up), which clears the flag
+static fs_inline_map_t* fs_inline_get(file_descriptor_t* fdp) {
+    fs_inline_map_t* map = (fs_inline_map_t*)fs_get_block(fdp->first_block);
+    if (map && map->magic == SIMPLEFS_INLINE_MAGIC) {
+        return map;
+    }
+    fs_put_block(map, 0);
+    fdp->inode->flags &= ~FS_FLAG_INLINE;
+    fdp->inode->dirty = 1;
+    return NULL;
+}
+
+// Move a small file's size bytes out to a data block, turning its map
+// into an ordinary one mapping that block. Releases map either way.
+static int fs_inline_spill(uint32_t map_block, fs_inline_map_t* map, uint32_t size) {
+    uint32_t block = 0;
+    if (size > SIMPLEFS_INLINE_MAX) {
+        size = SIMPLEFS_INLINE_MAX;
+    }
+    if (size > 0) {
+        block = fs_alloc_block();
+        void* data = block ? fs_get_block(block) : NULL;
+        if (!data) {
+            if (block) {
+                fs_free_block(block);
+            }
+            fs_put_block(map, 0);
+            return FS_ERROR_NO_SPACE;
+        }
+        memcpy(data, map->data, size);
+        memset((char*)data + size, 0, SIMPLEFS_BLOCK_SIZE - size);
+        fs_put_block(data, 1);
+    }
+    fs_extent_map_t* extents = (fs_extent_map_t*)map;
+    memset(extents, 0, SIMPLEFS_BLOCK_SIZE);
+    extents->magic = SIMPLEFS_EXTENT_MAGIC;
+    if (block) {
+        extents->count = 1;
+        extents->blocks = 1;
+        extents->extents[0].file_block = 0;
+        extents->extents[0].start = block;
+        extents->extents[0].length = 1;
+    }
+    fs_put_metadata(extents, 1);
+    fs_fd_forget_extents(map_block);
+    return FS_SUCCESS;
+}
+
+// Read a small file out of its map; -1 if it isn't one
+static int fs_read_inline(file_descriptor_t* fdp, char* dest, uint32_t size) {
+    fs_inline_map_t* map = fs_inline_get(fdp);
+    if (!map) {
+        return -1;
+    }
+    uint32_t end = fdp->inode->size < SIMPLEFS_INLINE_MAX ? fdp->inode->size : SIMPLEFS_INLINE_MAX;
+    uint32_t bytes = fdp->position < end ? end - fdp->position : 0;
+    if (bytes > size) {
+        bytes = size;
+    }
+    memcpy(dest, map->data + fdp->position, bytes);
+    fs_put_block(map, 0);
+    fdp->position += bytes;
+    return (int)bytes;
+}
+
+// Write into a small file's map while the result fits there. A write
+// past SIMPLEFS_INLINE_MAX first moves the file to a data block and
+// returns -1 for the extent path to do it; 0 without space to move.
+static int fs_write_inline(file_descriptor_t* fdp, const char* src, uint32_t size) {
+    fs_inline_map_t* map = fs_inline_get(fdp);
+    if (!map) {
+        return -1;
+    }
+    if (fdp->position <= SIMPLEFS_INLINE_MAX && size <= SIMPLEFS_INLINE_MAX - fdp->position) {
+        memcpy(map->data + fdp->position, src, size);
+        fs_put_metadata(map, 1);
+        fdp->position += size;
+        fs_inode_grow(fdp->inode, fdp->position);
+        return (int)size;
+    }
+    if (fs_inline_spill(fdp->first_block, map, fdp->inode->size) != FS_SUCCESS) {
+        return 0;
+    }
+    fdp->inode->flags &= ~FS_FLAG_INLINE;
+    fdp->inode->dirty = 1;
+    return -1;
+}
+
+static int fs_do_read(int fd, void* buffer, uint32_t size) {
     file_descriptor_t* fdp = fs_get_fd(fd);
     if (!fdp) {
         return FS_ERROR_INVALID_FD;
@@ -364,11 +2530,54 @@ int fs_read(int fd, void* buffer, uint32_t size) {
         return FS_ERROR_PERMISSION;
     }
     
+    if (fdp->inode->flags & FS_FLAG_INLINE) {
+        int bytes = fs_read_inline(fdp, (char*)buffer, size);
+        if (bytes >= 0) {
+            return bytes;
+        }
+    }
+    
     uint32_t bytes_read = 0;
     char* buf = (char*)buffer;
     
-    while (bytes_read < size && fdp->position < fdp->file_size) {
+    while (bytes_read < size && fdp->position < fdp->inode->size) {
         // Get current block
+        fdp->current_block = fs_bmap(fdp, fdp->position / SIMPLEFS_BLOCK_SIZE);
+        if (fdp->current_block == 0) {
+            break;
+        }
+        
+        uint32_t wanted = size - bytes_read;
+        if (wanted > fdp->inode->size - fdp->position) {
+            wanted = fdp->inode->size - fdp->position;
+        }
+        
+        // A compressed extent is read whole and copied out of the unpack cache
+        if (fdp->current_block & SIMPLEFS_EXTENT_PACKED) {
+            uint8_t* data = fs_unpack(fdp->ext_start & ~SIMPLEFS_EXTENT_PACKED, fdp->ext_length);
+            if (!data) {
+                break;
+            }
+            uint32_t offset = fdp->position - fdp->ext_file_block * SIMPLEFS_BLOCK_SIZE;
+            uint32_t bytes = fdp->ext_length * SIMPLEFS_BLOCK_SIZE - offset;
+            if (bytes > wanted) {
+                bytes = wanted;
+            }
+            memcpy(buf + bytes_read, data + offset, bytes);
+            bytes_read += bytes;
+            fdp->position += bytes;
+            fdp->ra_next = fdp->position;
+            continue;
+        }
+        uint32_t run_bytes = fs_read_run(fdp, buf + bytes_read, wanted);
+        if (run_bytes > 0) {
+            bytes_read += run_bytes;
+            fdp->position += run_bytes;
+            fdp->ra_next = fdp->position;
+            continue;
+        }
+        
+        fs_readahead(fdp);
         void* block_data = fs_get_block(fdp->current_block);
         if (!block_data) {
             break;
@@ -377,7 +2586,7 @@ int fs_read(int fd, void* buffer, uint32_t size) {
         // Calculate position within block
         uint32_t block_offset = fdp->position % SIMPLEFS_BLOCK_SIZE;
         uint32_t bytes_in_block = SIMPLEFS_BLOCK_SIZE - block_offset;
-        uint32_t bytes_remaining = fdp->file_size - fdp->position;
+        uint32_t bytes_remaining = fdp->inode->size - fdp->position;
         uint32_t bytes_to_read = size - bytes_read;
         
         if (bytes_to_read > bytes_in_block) {
@@ -389,25 +2598,24 @@ int fs_read(int fd, void* buffer, uint32_t size) {
         
         // Copy data
         memcpy(buf + bytes_read, (char*)block_data + block_offset, bytes_to_read);
+        fs_put_block(block_data, 0);
         bytes_read += bytes_to_read;
         fdp->position += bytes_to_read;
-        
-        // Move to next block if we've reached the end of current block
-        if (fdp->position % SIMPLEFS_BLOCK_SIZE == 0 && 
-            fdp->position < fdp->file_size) {
-            uint32_t next_block = g_fs_state.fat[fdp->current_block].next_block;
-            if (next_block == FAT_END_OF_FILE) {
-                break; // End of file
-            }
-            fdp->current_block = next_block;
-        }
+        fdp->ra_next = fdp->position;
     }
     
     return bytes_read;
 }
 
+int fs_read(int fd, void* buffer, uint32_t size) {
+    int entered = fs_enter();
+    int result = fs_do_read(fd, buffer, size);
+    fs_leave(entered);
+    return result;
+}
+
 // Write to a file
-int fs_write(int fd, const void* buffer, uint32_t size) {
+static int fs_do_write(int fd, const void* buffer, uint32_t size) {
     file_descriptor_t* fdp = fs_get_fd(fd);
     if (!fdp) {
         return FS_ERROR_INVALID_FD;
@@ -419,16 +2627,67 @@ int fs_write(int fd, const void* buffer, uint32_t size) {
     
     uint32_t bytes_written = 0;
     const char* buf = (const char*)buffer;
+    if (fdp->mode & O_APPEND) {
+        fdp->position = fdp->inode->size;
+    }
+    if (fdp->inode->flags & FS_FLAG_INLINE) {
+        int bytes = fs_write_inline(fdp, buf, size);
+        if (bytes >= 0) {
+            return bytes;
+        }
+    }
     
     while (bytes_written < size) {
-        // Get current block
+        // Get current block, mapping the rest of this write onto the file
+        // in one go when it runs past the end, so it lands in one extent
+        uint32_t file_block = fdp->position / SIMPLEFS_BLOCK_SIZE;
+        fdp->current_block = fs_bmap(fdp, file_block);
+        if ((fdp->current_block & SIMPLEFS_EXTENT_PACKED) &&
+            fs_unpack_extent(fdp->first_block, file_block) == FS_SUCCESS) {
+            fdp->current_block = fs_bmap(fdp, file_block);
+        }
+        if (fdp->current_block & SIMPLEFS_EXTENT_PACKED) {
+            break;  // No space to unpack it
+        }
+        if (fdp->current_block == 0) {
+            fs_extent_map_t* map = (fs_extent_map_t*)fs_get_block(fdp->first_block);
+            uint32_t mapped = map ? map->blocks : 0;
+            fs_put_block(map, 0);
+            uint32_t end = (fdp->position + (size - bytes_written) + SIMPLEFS_BLOCK_SIZE - 1) /
+                           SIMPLEFS_BLOCK_SIZE;
+            if (map && end > mapped && fs_extend(fdp->first_block, end - mapped) > 0) {
+                fdp->current_block = fs_bmap(fdp, file_block);
+            }
+        }
+        if (fdp->current_block == 0) {
+            break; // No space
+        }
+        
+        // Resident blocks of an extent lie back to back: one copy for
+        // everything past the current block
+        uint32_t block_offset = fdp->position % SIMPLEFS_BLOCK_SIZE;
+        if (!fs_cached && size - bytes_written > SIMPLEFS_BLOCK_SIZE - block_offset) {
+            uint32_t bytes = fs_run_blocks(fdp) * SIMPLEFS_BLOCK_SIZE - block_offset;
+            if (bytes > size - bytes_written) {
+                bytes = size - bytes_written;
+            }
+            memcpy((char*)fs_get_block(fdp->current_block) + block_offset, buf + bytes_written, bytes);
+            uint32_t last = fdp->current_block + (block_offset + bytes - 1) / SIMPLEFS_BLOCK_SIZE;
+            for (uint32_t block = fdp->current_block; block <= last; block++) {
+                fs_mark_dirty(block);
+            }
+            bytes_written += bytes;
+            fdp->position += bytes;
+            fs_inode_grow(fdp->inode, fdp->position);
+            continue;
+        }
+        
         void* block_data = fs_get_block(fdp->current_block);
         if (!block_data) {
             break;
         }
         
         // Calculate position within block
-        uint32_t block_offset = fdp->position % SIMPLEFS_BLOCK_SIZE;
         uint32_t bytes_in_block = SIMPLEFS_BLOCK_SIZE - block_offset;
         uint32_t bytes_to_write = size - bytes_written;
         
@@ -438,87 +2697,458 @@ int fs_write(int fd, const void* buffer, uint32_t size) {
         
         // Copy data
         memcpy((char*)block_data + block_offset, buf + bytes_written, bytes_to_write);
+        fs_put_block(block_data, 1);
         bytes_written += bytes_to_write;
         fdp->position += bytes_to_write;
         
         // Update file size if we've extended the file
-        if (fdp->position > fdp->file_size) {
-            fdp->file_size = fdp->position;
+        fs_inode_grow(fdp->inode, fdp->position);
+    }
+    
+    return bytes_written;
+}
+
+int fs_write(int fd, const void* buffer, uint32_t size) {
+    int entered = fs_enter();
+    int result = fs_do_write(fd, buffer, size);
+    fs_leave(entered);
+    return result;
+}
+
+// Move an open file's position; the block there is looked up on the next
+// read or write. Positions past the end are refused, as a write there
+// would expose whatever the skipped blocks held.
+int fs_seek(int fd, int32_t offset, int whence) {
+    file_descriptor_t* fdp = fs_get_fd(fd);
+    if (!fdp) {
+        return FS_ERROR_INVALID_FD;
+    }
+    
+    int32_t base;
+    switch (whence) {
+        case SEEK_SET: base = 0; break;
+        case SEEK_CUR: base = (int32_t)fdp->position; break;
+        case SEEK_END: base = (int32_t)fdp->inode->size; break;
+        default: return FS_ERROR_INVALID_SEEK;
+    }
+    // Another descriptor may have truncated the file under this position
+    uint32_t size = fdp->inode->size;
+    if ((offset < 0 && base + offset < 0) ||
+        (offset > 0 && ((uint32_t)base > size || (uint32_t)offset > size - (uint32_t)base))) {
+        return FS_ERROR_INVALID_SEEK;
+    }
+    fdp->position = (uint32_t)(base + offset);
+    return (int)fdp->position;
+}
+
+// What an fs_mmap area maps: the file as it was when mapped
+typedef struct {
+    uint32_t map_block;         // The file's extent map
+    uint32_t size;
+} fs_mapping_t;
+
+// Page fault in a mapping: the file's block at offset through the cache,
+// zeros past the end
+static int fs_do_mmap_fill(vm_area_t* area, uint32_t offset, void* page) {
+    fs_mapping_t* mapping = (fs_mapping_t*)area->backing;
+    uint32_t bytes = offset < mapping->size ? mapping->size - offset : 0;
+    if (bytes > SIMPLEFS_BLOCK_SIZE) {
+        bytes = SIMPLEFS_BLOCK_SIZE;
+    }
+    if (bytes > 0) {
+        uint32_t file_block = offset / SIMPLEFS_BLOCK_SIZE;
+        fs_extent_map_t* map = (fs_extent_map_t*)fs_get_block(mapping->map_block);
+        if (map && map->magic == SIMPLEFS_INLINE_MAGIC) {
+            // All of a small file is in the first page
+            int fits = offset == 0 && bytes <= SIMPLEFS_INLINE_MAX;
+            if (fits) {
+                memcpy(page, ((fs_inline_map_t*)map)->data, bytes);
+                memset((char*)page + bytes, 0, SIMPLEFS_BLOCK_SIZE - bytes);
+            }
+            fs_put_block(map, 0);
+            return fits ? 0 : -1;
         }
-        
-        // Check if we need to allocate a new block
-        if (bytes_written < size && (fdp->position % SIMPLEFS_BLOCK_SIZE == 0)) {
-            uint32_t next_block = g_fs_state.fat[fdp->current_block].next_block;
-            if (next_block == FAT_END_OF_FILE) {
-                // Allocate new block
-                next_block = fs_alloc_block();
-                if (next_block == 0) {
-                    break; // No space
+        const fs_extent_t* found = map ? fs_extent_find(map, file_block) : NULL;
+        fs_extent_t extent;
+        if (found) {
+            extent = *found;
+        }
+        fs_put_block(map, 0);
+        if (!found) {
+            return -1;
+        }
+        if (extent.start & SIMPLEFS_EXTENT_PACKED) {
+            uint8_t* unpacked = fs_unpack(extent.start & ~SIMPLEFS_EXTENT_PACKED, extent.length);
+            if (!unpacked) {
+                return -1;
+            }
+            memcpy(page, unpacked + (file_block - extent.file_block) * SIMPLEFS_BLOCK_SIZE, bytes);
+        } else {
+            void* data = fs_get_block(extent.start + (file_block - extent.file_block));
+            if (!data) {
+                return -1;
+            }
+            memcpy(page, data, bytes);
+            fs_put_block(data, 0);
+        }
+    }
+    memset((char*)page + bytes, 0, SIMPLEFS_BLOCK_SIZE - bytes);
+    return 0;
+}
+
+static int fs_mmap_fill(vm_area_t* area, uint32_t offset, void* page) {
+    int entered = fs_enter();
+    int result = fs_do_mmap_fill(area, offset, page);
+    fs_leave(entered);
+    return result;
+}
+
+// A stored-to page goes back into its block, dirty in the cache for the
+// flusher (or marked for the next save when resident)
+static int fs_do_mmap_writeback(vm_area_t* area, uint32_t offset, const void* page) {
+    fs_mapping_t* mapping = (fs_mapping_t*)area->backing;
+    if (offset >= mapping->size) {
+        return 0;
+    }
+    uint32_t bytes = mapping->size - offset;
+    if (bytes > SIMPLEFS_BLOCK_SIZE) {
+        bytes = SIMPLEFS_BLOCK_SIZE;
+    }
+    if (fs_unpack_extent(mapping->map_block, offset / SIMPLEFS_BLOCK_SIZE) != FS_SUCCESS) {
+        return -1;
+    }
+    fs_extent_map_t* map = (fs_extent_map_t*)fs_get_block(mapping->map_block);
+    if (map && map->magic == SIMPLEFS_INLINE_MAGIC && offset == 0 && bytes <= SIMPLEFS_INLINE_MAX) {
+        memcpy(((fs_inline_map_t*)map)->data, page, bytes);
+        fs_put_metadata(map, 1);
+        return 0;
+    }
+    uint32_t block = map ? fs_extent_lookup(map, offset / SIMPLEFS_BLOCK_SIZE) : 0;
+    fs_put_block(map, 0);
+    void* data = block ? fs_get_block(block) : NULL;
+    if (!data) {
+        return -1;
+    }
+    memcpy(data, page, bytes);
+    fs_put_block(data, 1);
+    return 0;
+}
+
+static int fs_mmap_writeback(vm_area_t* area, uint32_t offset, const void* page) {
+    int entered = fs_enter();
+    int result = fs_do_mmap_writeback(area, offset, page);
+    fs_leave(entered);
+    return result;
+}
+
+// First gap of size bytes in the mapping window, 0 if there is none
+static uint32_t fs_mmap_slot(uint32_t size) {
+    uint32_t addr = SIMPLEFS_MMAP_BASE;
+    for (vm_area_t* area = kernel_vm_space.areas; area; area = area->next) {
+        if (area->end <= addr) {
+            continue;
+        }
+        if (area->start >= addr + size) {
+            break;
+        }
+        addr = area->end;
+    }
+    return addr + size <= SIMPLEFS_MMAP_BASE + SIMPLEFS_MMAP_SIZE ? addr : 0;
+}
+
+void* fs_mmap(int fd, uint32_t offset, uint32_t length, uint32_t prot) {
+    file_descriptor_t* fdp = fs_get_fd(fd);
+    if (!fdp || length == 0 || length > SIMPLEFS_MMAP_SIZE || offset % SIMPLEFS_BLOCK_SIZE != 0 ||
+        ((prot & VMA_READ) && !(fdp->mode & O_READ)) ||
+        ((prot & VMA_WRITE) && !(fdp->mode & O_WRITE))) {
+        return NULL;
+    }
+    
+    fs_mapping_t* mapping = kmalloc(sizeof(fs_mapping_t));
+    if (!mapping) {
+        return NULL;
+    }
+    mapping->map_block = fdp->first_block;
+    mapping->size = fdp->inode->size;
+    
+    uint32_t addr = fs_mmap_slot(PAGE_ALIGN(length));
+    vm_area_t* area = addr ? vmm_add_file_area(&kernel_vm_space, addr, length,
+                                               prot & (VMA_READ | VMA_WRITE | VMA_USER),
+                                               fs_mmap_fill, mapping, offset) : NULL;
+    if (!area) {
+        kfree(mapping);
+        return NULL;
+    }
+    if (prot & VMA_WRITE) {
+        area->writeback = fs_mmap_writeback;
+    }
+    return (void*)addr;
+}
+
+// The fs_mmap area starting at addr, or NULL
+static vm_area_t* fs_mmap_area(void* addr) {
+    vm_area_t* area = vmm_find_area(&kernel_vm_space, (uint32_t)addr);
+    return area && area->start == (uint32_t)addr && area->fill == fs_mmap_fill ? area : NULL;
+}
+
+int fs_msync(void* addr) {
+    vm_area_t* area = fs_mmap_area(addr);
+    if (!area) {
+        return FS_ERROR_INVALID_PATH;
+    }
+    return vmm_sync_area(area) == 0 ? FS_SUCCESS : FS_ERROR_NO_SPACE;
+}
+
+int fs_munmap(void* addr) {
+    vm_area_t* area = fs_mmap_area(addr);
+    if (!area) {
+        return FS_ERROR_INVALID_PATH;
+    }
+    fs_mapping_t* mapping = (fs_mapping_t*)area->backing;
+    vmm_remove_area(&kernel_vm_space, area->start);
+    kfree(mapping);
+    return FS_SUCCESS;
+}
+
+// Close a file; the last close of a changed file writes its entry
+int fs_close(int fd) {
+    file_descriptor_t* fdp = fs_get_fd(fd);
+    if (!fdp) {
+        return FS_ERROR_INVALID_FD;
+    }
+    
+    int entered = fs_enter();
+    fs_inode_put(fdp->inode);
+    fs_free_fd(fd);
+    fs_leave(entered);
+    return FS_SUCCESS;
+}
+
+int fs_mkdir(const char* path) {
+    return fs_create(path, FS_TYPE_DIRECTORY);
+}
+
+// List directory contents
+int fs_list(const char* path, dir_entry_t* entries, int max_entries) {
+    uint32_t cursor = 0;
+    return fs_list_from(path, &cursor, entries, max_entries);
+}
+
+// The same from directory slot *cursor on, leaving it past the last one listed
+static int fs_do_list_from(const char* path, uint32_t* cursor, dir_entry_t* entries, int max_entries) {
+    if (!g_fs_state.initialized) {
+        return FS_ERROR_PERMISSION;
+    }
+    
+    dir_entry_t entry;
+    char name[SIMPLEFS_MAX_FILENAME];
+    uint32_t parent;
+    int result = fs_path_lookup(path, &parent, name, &entry);
+    if (result != FS_SUCCESS) {
+        return result;
+    }
+    if (entry.type != FS_TYPE_DIRECTORY) {
+        return FS_ERROR_NOT_DIR;
+    }
+    
+    dir_entry_t* dir = (dir_entry_t*)fs_get_block(entry.first_block);
+    if (!dir) {
+        return FS_ERROR_INVALID_PATH;
+    }
+    int count = 0;
+    
+    for (uint32_t i = *cursor; i < (uint32_t)SIMPLEFS_DIR_ENTRIES && count < max_entries; i++) {
+        if (dir[i].name[0] != '\0') {
+            if (entries) {
+                memcpy(&entries[count], &dir[i], sizeof(dir_entry_t));
+                fs_inode_t* inode = dir[i].type == FS_TYPE_FILE ? fs_inode_find(dir[i].first_block) : NULL;
+                if (inode) {
+                    entries[count].size = inode->size;
                 }
-                g_fs_state.fat[fdp->current_block].next_block = next_block;
             }
-            fdp->current_block = next_block;
+            count++;
+            *cursor = i + 1;
         }
     }
-    
-    return bytes_written;
+    fs_put_block(dir, 0);
+    
+    return count;
+}
+
+int fs_list_from(const char* path, uint32_t* cursor, dir_entry_t* entries, int max_entries) {
+    int entered = fs_enter();
+    int result = fs_do_list_from(path, cursor, entries, max_entries);
+    fs_leave(entered);
+    return result;
+}
+
+int fs_chdir(const char* path) {
+    if (!g_fs_state.initialized) {
+        return FS_ERROR_PERMISSION;
+    }
+    
+    char resolved[SIMPLEFS_MAX_PATH];
+    int result = fs_resolve_path(path, resolved);
+    if (result != FS_SUCCESS) {
+        return result;
+    }
+    if (!fs_is_directory(resolved)) {
+        return fs_exists(resolved) ? FS_ERROR_NOT_DIR : FS_ERROR_NOT_FOUND;
+    }
+    strcpy(g_fs_state.current_dir, resolved);
+    return FS_SUCCESS;
+}
+
+char* fs_getcwd(void) {
+    return g_fs_state.current_dir;
+}
+
+int fs_exists(const char* path) {
+    dir_entry_t entry;
+    char name[SIMPLEFS_MAX_FILENAME];
+    uint32_t parent;
+    int entered = fs_enter();
+    int exists = g_fs_state.initialized && fs_path_lookup(path, &parent, name, &entry) == FS_SUCCESS;
+    fs_leave(entered);
+    return exists;
+}
+
+int fs_is_directory(const char* path) {
+    dir_entry_t entry;
+    char name[SIMPLEFS_MAX_FILENAME];
+    uint32_t parent;
+    int entered = fs_enter();
+    int is_dir = g_fs_state.initialized && fs_path_lookup(path, &parent, name, &entry) == FS_SUCCESS &&
+                 entry.type == FS_TYPE_DIRECTORY;
+    fs_leave(entered);
+    return is_dir;
+}
+
+// VFS side (Day 21). The handle is a SimpleFS descriptor whose position
+// each call sets first; the VFS keeps the real one and does appends.
+static int simplefs_vfs_open(void* data, const char* path, uint32_t flags, int32_t* handle) {
+    (void)data;
+    int fd = fs_open(path, (uint8_t)(flags & ~VFS_O_APPEND));
+    if (fd < 0) {
+        return fd;
+    }
+    *handle = fd;
+    return VFS_SUCCESS;
+}
+
+static int simplefs_vfs_close(void* data, int32_t handle) {
+    (void)data;
+    return fs_close(handle);
+}
+
+static int simplefs_vfs_read(void* data, int32_t handle, uint32_t offset, void* buffer, uint32_t size) {
+    (void)data;
+    int result = fs_seek(handle, (int32_t)offset, SEEK_SET);
+    if (result < 0) {
+        return result == FS_ERROR_INVALID_SEEK ? 0 : result;  // Past the end
+    }
+    return fs_read(handle, buffer, size);
+}
+
+static int simplefs_vfs_write(void* data, int32_t handle, uint32_t offset, const void* buffer, uint32_t size) {
+    (void)data;
+    int result = fs_seek(handle, (int32_t)offset, SEEK_SET);
+    if (result < 0) {
+        return result;
+    }
+    return fs_write(handle, buffer, size);
+}
+
+static int simplefs_vfs_size(void* data, int32_t handle) {
+    (void)data;
+    file_descriptor_t* fdp = fs_get_fd(handle);
+    return fdp ? (int)fdp->inode->size : FS_ERROR_INVALID_FD;
+}
+
+static int simplefs_vfs_do_stat(void* data, const char* path, vfs_stat_t* stat) {
+    (void)data;
+    if (!g_fs_state.initialized) {
+        return FS_ERROR_PERMISSION;
+    }
+    dir_entry_t entry;
+    char name[SIMPLEFS_MAX_FILENAME];
+    uint32_t parent;
+    int result = fs_path_lookup(path, &parent, name, &entry);
+    if (result != FS_SUCCESS) {
+        return result;
+    }
+    stat->size = entry.size;
+    stat->type = entry.type == FS_TYPE_DIRECTORY ? VFS_TYPE_DIR : VFS_TYPE_FILE;
+    return VFS_SUCCESS;
 }
 
-// Close a file
-int fs_close(int fd) {
-    file_descriptor_t* fdp = fs_get_fd(fd);
-    if (!fdp) {
-        return FS_ERROR_INVALID_FD;
+static int simplefs_vfs_stat(void* data, const char* path, vfs_stat_t* stat) {
+    int entered = fs_enter();
+    int result = simplefs_vfs_do_stat(data, path, stat);
+    fs_leave(entered);
+    return result;
+}
+
+static int simplefs_vfs_readdir(void* data, const char* path, uint32_t* cursor, vfs_dirent_t* entries,
+                                int max_entries) {
+    (void)data;
+    if (max_entries <= 0) {
+        return 0;
     }
-    
-    // Update directory entry with new file size if file was written to
-    if (fdp->mode & O_WRITE) {
-        // For simplicity, assume file is in root directory
-        dir_entry_t* dir = (dir_entry_t*)fs_get_block(ROOT_DIR_BLOCK_NUM);
-        int entries_per_block = SIMPLEFS_BLOCK_SIZE / sizeof(dir_entry_t);
-        
-        for (int i = 0; i < entries_per_block; i++) {
-            if (dir[i].first_block == fdp->first_block && dir[i].type == FS_TYPE_FILE) {
-                dir[i].size = fdp->file_size;
-                break;
-            }
-        }
+    dir_entry_t* list = kmalloc(max_entries * sizeof(dir_entry_t));
+    if (!list) {
+        return FS_ERROR_NO_SPACE;
     }
-    
-    fs_free_fd(fd);
-    return FS_SUCCESS;
+    int count = fs_list_from(path, cursor, list, max_entries);
+    for (int i = 0; i < count; i++) {
+        memset(&entries[i], 0, sizeof(vfs_dirent_t));
+        strncpy(entries[i].name, list[i].name, VFS_MAX_NAME - 1);
+        entries[i].size = list[i].size;
+        entries[i].type = list[i].type == FS_TYPE_DIRECTORY ? VFS_TYPE_DIR : VFS_TYPE_FILE;
+    }
+    kfree(list);
+    return count;
 }
 
-// Simple mkdir implementation (creates in root directory only)
-int fs_mkdir(const char* path) {
-    return fs_create(path, FS_TYPE_DIRECTORY);
+static int simplefs_vfs_mkdir(void* data, const char* path) {
+    (void)data;
+    return fs_mkdir(path);
 }
 
-// List directory contents
-int fs_list(const char* path, dir_entry_t* entries, int max_entries) {
+// Nothing is ever deleted from SimpleFS yet, so there is no unlink
+const vfs_ops_t simplefs_vfs_ops = {
+    .name = "simplefs",
+    .open = simplefs_vfs_open,
+    .close = simplefs_vfs_close,
+    .read = simplefs_vfs_read,
+    .write = simplefs_vfs_write,
+    .size = simplefs_vfs_size,
+    .stat = simplefs_vfs_stat,
+    .readdir = simplefs_vfs_readdir,
+    .mkdir = simplefs_vfs_mkdir,
+    .unlink = NULL,
+};
+
+// Size in bytes, or an error
+static int fs_do_get_file_size(const char* path) {
     if (!g_fs_state.initialized) {
         return FS_ERROR_PERMISSION;
     }
-    
-    // For simplicity, only support root directory
-    if (strcmp(path, "/") != 0) {
-        return FS_ERROR_INVALID_PATH;
-    }
-    
-    dir_entry_t* dir = (dir_entry_t*)fs_get_block(ROOT_DIR_BLOCK_NUM);
-    int entries_per_block = SIMPLEFS_BLOCK_SIZE / sizeof(dir_entry_t);
-    int count = 0;
-    
-    for (int i = 0; i < entries_per_block && count < max_entries; i++) {
-        if (dir[i].name[0] != '\0') {
-            if (entries) {
-                memcpy(&entries[count], &dir[i], sizeof(dir_entry_t));
-            }
-            count++;
-        }
+    dir_entry_t entry;
+    char name[SIMPLEFS_MAX_FILENAME];
+    uint32_t parent;
+    int result = fs_path_lookup(path, &parent, name, &entry);
+    if (result != FS_SUCCESS) {
+        return result;
     }
-    
-    return count;
+    return entry.type == FS_TYPE_DIRECTORY ? FS_ERROR_IS_DIR : (int)entry.size;
+}
+
+int fs_get_file_size(const char* path) {
+    int entered = fs_enter();
+    int result = fs_do_get_file_size(path);
+    fs_leave(entered);
+    return result;
 }
 
 // Dump file system statistics
@@ -532,12 +3162,34 @@ void fs_dump_stats(void) {
     
     terminal_writestring("SimpleFS Statistics:\n");
     terminal_printf("  Magic: 0x%x\n", sb->magic);
+    terminal_printf("  Version: %d\n", sb->version);
     terminal_printf("  Total blocks: %d\n", sb->total_blocks);
     terminal_printf("  Free blocks: %d\n", sb->free_blocks);
     terminal_printf("  Used blocks: %d\n", sb->total_blocks - sb->free_blocks);
     terminal_printf("  Block size: %d bytes\n", sb->block_size);
-    terminal_printf("  Total size: %d KB\n", (sb->total_blocks * sb->block_size) / 1024);
-    terminal_printf("  Free space: %d KB\n", (sb->free_blocks * sb->block_size) / 1024);
+    terminal_printf("  Total size: %d KB\n", sb->total_blocks * (sb->block_size / 1024));
+    terminal_printf("  Free space: %d KB\n", sb->free_blocks * (sb->block_size / 1024));
+    if (fs_sums.pieces) {
+        terminal_printf("  Checksums: CRC32C (%s), %d failures\n",
+                        crc32c_hardware() ? "SSE4.2" : "tables", (int)fs_sum_failures);
+    }
+    if (fs_cached) {
+        terminal_printf("  Defrag: %d files made contiguous, %d blocks moved\n",
+                        (int)fs_defrag.files_moved, (int)fs_defrag.blocks_moved);
+    }
+    if (fs_trim_enabled) {
+        uint32_t pending = 0;
+        uint32_t flags = spin_lock_irqsave(&alloc_lock);
+        for (uint32_t i = 0; i < fs_trim_freed_count; i++) {
+            pending += fs_trim_freed[i].count;
+        }
+        for (uint32_t i = 0; i < fs_trim_ready_count; i++) {
+            pending += fs_trim_ready[i].count;
+        }
+        spin_unlock_irqrestore(&alloc_lock, flags);
+        terminal_printf("  TRIM: %d blocks discarded, %d waiting\n", (int)fs_trimmed_blocks,
+                        (int)pending);
+    }
     
     // Count files and directories
     int file_count = 0;
@@ -555,18 +3207,14 @@ void fs_dump_stats(void) {
             }
         }
     }
+    fs_put_block(root_dir, 0);
     
     terminal_printf("  Files: %d\n", file_count);
     terminal_printf("  Directories: %d\n", dir_count);
     
     // File descriptor usage
-    int fd_used = 0;
-    for (int i = 0; i < SIMPLEFS_MAX_FD; i++) {
-        if (g_fs_state.fd_table[i].in_use) {
-            fd_used++;
-        }
-    }
-    terminal_printf("  Open file descriptors: %d/%d\n", fd_used, SIMPLEFS_MAX_FD);
+    terminal_printf("  Open file descriptors: %d (table of %d, at most %d)\n",
+                    (int)g_fs_state.fd_count, (int)g_fs_state.fd_capacity, SIMPLEFS_MAX_FD);
 }
 
 // Check if file system is initialized
@@ -576,10 +3224,27 @@ int fs_is_initialized(void) {
 
 // Cleanup file system
 void fs_cleanup(void) {
+    bcache_set_flusher_hook(NULL);
+    int entered = fs_enter();
+    fs_inode_sync_all();
+    fs_fd_reset();
+    if (fs_cached) {
+        fs_journal_commit();
+        fs_journal_drop();
+        bcache_sync(fs_disk_drive);
+        fs_trim_flush();
+    }
+    fs_tables_release();
+    fs_cached = 0;
     if (g_fs_state.blocks) {
         kfree(g_fs_state.blocks);
     }
+    fs_dir_index_drop_all();
+    fs_dentry_clear();
+    fs_unpack_clear();
+    memset(&fs_defrag, 0, sizeof(fs_defrag_t));
     memset(&g_fs_state, 0, sizeof(fs_state_t));
+    fs_leave(entered);
 }
 
 // Day 10: Disk persistence implementation
@@ -587,8 +3252,15 @@ void fs_cleanup(void) {
 // Set disk persistence mode
 void fs_set_disk_mode(int enabled) {
     fs_disk_enabled = enabled;
+    uint32_t flags = spin_lock_irqsave(&alloc_lock);
+    fs_trim_enabled = enabled && ata_trim_supported(fs_disk_drive);
+    fs_trim_freed_count = 0;
+    fs_trim_ready_count = 0;
+    spin_unlock_irqrestore(&alloc_lock, flags);
+    bcache_set_flusher_hook(enabled ? fs_flusher_work : NULL);
     if (enabled) {
-        terminal_writestring("SimpleFS: Disk persistence enabled\n");
+        terminal_writestring(fs_trim_enabled ? "SimpleFS: Disk persistence enabled, freed blocks TRIMmed\n"
+                                             : "SimpleFS: Disk persistence enabled\n");
     } else {
         terminal_writestring("SimpleFS: Disk persistence disabled\n");
     }
@@ -612,12 +3284,17 @@ int fs_init_disk(uint8_t drive_num) {
         return FS_ERROR_NOT_FOUND;
     }
     
-    // Try to load existing file system from disk
-    if (fs_load_from_disk() == FS_SUCCESS) {
+    // Try to load existing file system from disk; one that is there but
+    // can't be mounted is left alone
+    int load_result = fs_load_from_disk();
+    if (load_result == FS_SUCCESS) {
         terminal_writestring("SimpleFS: Existing file system loaded from disk\n");
         fs_set_disk_mode(1);
         return FS_SUCCESS;
     }
+    if (load_result != FS_ERROR_NOT_FOUND) {
+        return load_result;
+    }
     
     // No existing file system found, create new one
     terminal_writestring("SimpleFS: No existing file system found, formatting disk...\n");
@@ -633,104 +3310,654 @@ int fs_init_disk(uint8_t drive_num) {
     }
 }
 
-// Format disk with SimpleFS
+// Write zeros over count blocks from first, a run at a time
+static int fs_zero_blocks(uint32_t first, uint32_t count, const uint8_t* zeros) {
+    while (count > 0) {
+        uint32_t n = count < FS_DIRECT_BLOCKS ? count : FS_DIRECT_BLOCKS;
+        if (!ata_write(fs_disk_drive, fs_block_lba(first), n * (SIMPLEFS_BLOCK_SIZE / BLK_SECTOR_SIZE),
+                       zeros)) {
+            return FS_ERROR_NO_SPACE;
+        }
+        first += n;
+        count -= n;
+    }
+    return FS_SUCCESS;
+}
+
+// Format disk with SimpleFS, sized to the drive: everything from the FS
+// start up to the journal and the swap area at the end, up to
+// SIMPLEFS_MAX_VOLUME_BLOCKS. Blocks 0-2 are the superblock, the bitmap's
+// first block and the root directory as always; the rest of the bitmap
+// and the checksums take the start of the data area. Only those and the
+// journal header are written, a pass over 1/1024th of the volume, and the
+// result is then mounted like any other.
 int fs_format_disk(uint8_t drive_num) {
     terminal_writestring("SimpleFS: Formatting disk with SimpleFS...\n");
+    ata_drive_t drive_info;
+    if (!ata_get_drive_info(drive_num, &drive_info)) {
+        return FS_ERROR_NOT_FOUND;
+    }
+    uint32_t disk_blocks = drive_info.sectors / (SIMPLEFS_BLOCK_SIZE / BLK_SECTOR_SIZE);
+    uint32_t reserved = FS_DISK_START_LBA + SIMPLEFS_JOURNAL_BLOCKS + SWAP_MAX_SLOTS;
+    uint32_t total = disk_blocks > reserved ? disk_blocks - reserved : 0;
+    if (total > SIMPLEFS_MAX_VOLUME_BLOCKS) {
+        total = SIMPLEFS_MAX_VOLUME_BLOCKS;
+    }
+    if (total < SIMPLEFS_MIN_BLOCKS) {
+        terminal_writestring("SimpleFS: Disk too small to format\n");
+        return FS_ERROR_NO_SPACE;
+    }
     
-    // Initialize in-memory file system first
-    if (!g_fs_state.initialized) {
-        int init_result = fs_init();
-        if (init_result != FS_SUCCESS) {
-            return init_result;
-        }
+    uint32_t bitmap_blocks = (total + SIMPLEFS_BITMAP_SPAN - 1) / SIMPLEFS_BITMAP_SPAN;
+    uint32_t checksum_blocks = (total + SIMPLEFS_SUMS_SPAN - 1) / SIMPLEFS_SUMS_SPAN;
+    uint32_t used = DATA_START_BLOCK_NUM + (bitmap_blocks - 1) + checksum_blocks;
+    uint8_t* zeros = kmalloc(FS_DIRECT_BLOCKS * SIMPLEFS_BLOCK_SIZE);
+    superblock_t* sb = kmalloc_page();          // Zeroed
+    uint8_t* bitmap = kmalloc_page();
+    if (!zeros || !sb || !bitmap) {
+        kfree(zeros);
+        kfree_page(sb);
+        kfree_page(bitmap);
+        return FS_ERROR_NO_SPACE;
     }
+    memset(zeros, 0, FS_DIRECT_BLOCKS * SIMPLEFS_BLOCK_SIZE);
     
-    // Save the fresh file system to disk
-    fs_disk_drive = drive_num;
-    int save_result = fs_save_to_disk();
+    sb->magic = SIMPLEFS_MAGIC;
+    sb->total_blocks = total;
+    sb->free_blocks = total - used;
+    sb->root_dir_block = ROOT_DIR_BLOCK_NUM;
+    sb->fat_block = FAT_BLOCK_NUM;
+    sb->data_start_block = DATA_START_BLOCK_NUM;
+    sb->max_files = SIMPLEFS_MAX_FILES;
+    sb->block_size = SIMPLEFS_BLOCK_SIZE;
+    sb->version = SIMPLEFS_VERSION;
+    sb->journal_start = total;
+    sb->journal_blocks = SIMPLEFS_JOURNAL_BLOCKS;
+    sb->bitmap_blocks = bitmap_blocks;
+    sb->bitmap_start = DATA_START_BLOCK_NUM;
+    sb->checksum_block = DATA_START_BLOCK_NUM + (bitmap_blocks - 1);
+    sb->checksum_blocks = checksum_blocks;
+    for (uint32_t i = 0; i < used; i++) {
+        bitmap[i / 8] |= (uint8_t)(1 << (i % 8));
+    }
     
-    if (save_result == FS_SUCCESS) {
-        terminal_writestring("SimpleFS: Disk formatting completed\n");
-    } else {
+    // The journal header first, so nothing older is replayed over the
+    // result, and the superblock last, once the rest is down
+    fs_disk_drive = drive_num;
+    uint32_t block_sectors = SIMPLEFS_BLOCK_SIZE / BLK_SECTOR_SIZE;
+    int result = FS_ERROR_NO_SPACE;
+    if (fs_zero_blocks(total, 1, zeros) == FS_SUCCESS &&
+        fs_zero_blocks(ROOT_DIR_BLOCK_NUM, used - ROOT_DIR_BLOCK_NUM, zeros) == FS_SUCCESS &&
+        ata_write(drive_num, fs_block_lba(FAT_BLOCK_NUM), block_sectors, bitmap) &&
+        ata_flush(drive_num) &&
+        ata_write(drive_num, fs_block_lba(SUPERBLOCK_NUM), block_sectors, sb) &&
+        ata_flush(drive_num)) {
+        result = FS_SUCCESS;
+    }
+    kfree(zeros);
+    kfree_page(sb);
+    kfree_page(bitmap);
+    if (result != FS_SUCCESS) {
         terminal_writestring("SimpleFS: Disk formatting failed\n");
+        return result;
     }
-    
-    return save_result;
+    terminal_printf("SimpleFS: Formatted %d blocks (%d MB)\n", (int)total,
+                    (int)(total / (1024 * 1024 / SIMPLEFS_BLOCK_SIZE)));
+    return fs_load_from_disk();
 }
 
-// Convert 4KB blocks to 512-byte sectors for disk I/O
-static int fs_write_block_to_disk(uint32_t block_num, void* block_data) {
-    uint32_t lba = FS_DISK_START_LBA + block_num;
-    
-    // Write 8 sectors (4KB = 8 * 512 bytes)
-    uint16_t* sector_buffer = (uint16_t*)block_data;
+// Queue blocks first..end-1, then wait: for a write the resident data
+// blocks changed since the last save (metadata goes through the journal),
+// for a read the allocated ones. The block
+// layer turns neighbouring blocks into a few large commands.
+static int fs_transfer_blocks(bool write, uint32_t first, uint32_t end) {
+    blk_request_t* reqs = kmalloc(SIMPLEFS_MAX_BLOCKS * sizeof(blk_request_t));
+    if (!reqs) {
+        return FS_ERROR_NO_SPACE;
+    }
     
-    for (int sector = 0; sector < 8; sector++) {
-        uint32_t sector_lba = lba * 8 + sector;
-        uint16_t* sector_data = sector_buffer + (sector * 256);
-        
-        if (!ata_write_sectors(fs_disk_drive, sector_lba, 1, sector_data)) {
-            terminal_writestring("SimpleFS: Error writing block to disk\n");
-            return FS_ERROR_NO_SPACE;
+    uint32_t count = 0;
+    for (uint32_t i = first; i < end; i++) {
+        if (write ? (fs_is_metadata(i) || !fs_take_dirty(i))
+                  : (i >= DATA_START_BLOCK_NUM && !fs_is_block_allocated(i))) {
+            continue;
+        }
+        blk_request_t* req = &reqs[count++];
+        req->drive = fs_disk_drive;
+        req->write = write;
+        req->flags = 0;
+        req->lba = fs_block_lba(i);
+        req->count = 8;
+        req->buffer = fs_get_block(i);
+        req->done = NULL;
+        if (write) {
+            fs_sum_update(i, req->buffer);
+        }
+        blk_submit(req);
+    }
+    blk_sync();
+    
+    int result = FS_SUCCESS;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!reqs[i].result) {
+            result = write ? FS_ERROR_NO_SPACE : FS_ERROR_NOT_FOUND;
+            if (write) {
+                fs_mark_dirty(reqs[i].lba / 8 - FS_DISK_START_LBA);  // Retried next save
+            }
+        }
+    }
+    kfree(reqs);
+    return result;
+}
+
+// FNV-1a over one block, continuing from hash
+static uint32_t fs_journal_checksum(uint32_t hash, const void* block) {
+    const uint8_t* p = (const uint8_t*)block;
+    for (uint32_t i = 0; i < SIMPLEFS_BLOCK_SIZE; i++) {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Write count blocks and wait: to blocks[i], or with blocks NULL to the
+// run starting at first, each request taking flags (BLK_REQ_*)
+static int fs_write_blocks(const uint32_t* blocks, uint32_t first, void** data, uint32_t count,
+                           uint8_t flags) {
+    blk_request_t* reqs = kmalloc(count * sizeof(blk_request_t));
+    if (!reqs) {
+        return FS_ERROR_NO_SPACE;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        reqs[i].drive = fs_disk_drive;
+        reqs[i].write = true;
+        reqs[i].flags = flags;
+        reqs[i].lba = fs_block_lba(blocks ? blocks[i] : first + i);
+        reqs[i].count = SIMPLEFS_BLOCK_SIZE / BLK_SECTOR_SIZE;
+        reqs[i].buffer = data[i];
+        reqs[i].done = NULL;
+        blk_submit(&reqs[i]);
+    }
+    blk_sync();
+    int result = FS_SUCCESS;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!reqs[i].result) {
+            result = FS_ERROR_NO_SPACE;
+        }
+    }
+    kfree(reqs);
+    return result;
+}
+
+// The frees of a transaction that just committed may be discarded now
+static void fs_trim_commit(void) {
+    uint32_t flags = spin_lock_irqsave(&alloc_lock);
+    for (uint32_t i = 0; i < fs_trim_freed_count; i++) {
+        fs_trim_add(fs_trim_ready, &fs_trim_ready_count, fs_trim_freed[i].start,
+                    fs_trim_freed[i].count);
+    }
+    fs_trim_freed_count = 0;
+    spin_unlock_irqrestore(&alloc_lock, flags);
+}
+
+// Discard the committed frees: the buffer cache flusher's hook, and after
+// a save. The runs are sorted and merged, so neighbours freed apart go
+// out as one range, and all of them in as few commands as the drive allows.
+static void fs_trim_flush(void) {
+    if (!fs_trim_enabled || fs_trim_ready_count == 0) {
+        return;
+    }
+    uint32_t flags = spin_lock_irqsave(&alloc_lock);
+    if (fs_trim_busy_count != 0) {
+        spin_unlock_irqrestore(&alloc_lock, flags);
+        return;                     // Another caller is discarding
+    }
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < fs_trim_ready_count; i++) {
+        fs_trim_extent_t run = fs_trim_ready[i];
+        uint32_t j = count;
+        while (j > 0 && fs_trim_busy[j - 1].start > run.start) {
+            fs_trim_busy[j] = fs_trim_busy[j - 1];
+            j--;
+        }
+        fs_trim_busy[j] = run;
+        count++;
+    }
+    uint32_t merged = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (merged > 0 && fs_trim_busy[merged - 1].start + fs_trim_busy[merged - 1].count ==
+                          fs_trim_busy[i].start) {
+            fs_trim_busy[merged - 1].count += fs_trim_busy[i].count;
+        } else {
+            fs_trim_busy[merged++] = fs_trim_busy[i];
         }
     }
+    fs_trim_busy_count = merged;
+    fs_trim_ready_count = 0;
+    spin_unlock_irqrestore(&alloc_lock, flags);
+    
+    uint32_t blocks = 0;
+    for (uint32_t i = 0; i < merged; i++) {
+        fs_trim_ranges[i].lba = fs_block_lba(fs_trim_busy[i].start);
+        fs_trim_ranges[i].count = fs_trim_busy[i].count * (SIMPLEFS_BLOCK_SIZE / BLK_SECTOR_SIZE);
+        blocks += fs_trim_busy[i].count;
+    }
+    int result = ata_trim(fs_disk_drive, fs_trim_ranges, merged);
     
-    return FS_SUCCESS;
+    flags = spin_lock_irqsave(&alloc_lock);
+    fs_trim_busy_count = 0;
+    if (result) {
+        fs_trimmed_blocks += blocks;
+    }
+    spin_unlock_irqrestore(&alloc_lock, flags);
+}
+
+// Make every write that has completed durable: one bare flush
+static int fs_flush_disk(void) {
+    blk_request_t req;
+    memset(&req, 0, sizeof(req));
+    req.drive = fs_disk_drive;
+    req.write = true;
+    blk_submit(&req);
+    blk_wait(&req);
+    return req.result ? FS_SUCCESS : FS_ERROR_NO_SPACE;
 }
 
-static int fs_read_block_from_disk(uint32_t block_num, void* block_data) {
-    uint32_t lba = FS_DISK_START_LBA + block_num;
+// Commit the open transaction: every metadata block changed since the last
+// commit goes to the journal as one sequential run, then a commit record
+// once that is on disk, then each block to its home. The journal is
+// emptied again when the last of those lands, so replay only happens after
+// a crash in between. File data written by then goes first, so committed
+// metadata never names blocks that were never written.
+// The drive's write cache stays on throughout. The commit record is the
+// barrier: its preflush makes the data and the log durable before it and
+// its FUA makes it durable itself. The emptied header's preflush does the
+// same for the home blocks, and nothing waits on the header itself.
+// The bitmap and checksum blocks kept outside the resident area ride along
+// whenever they changed (a sum changes with any data write), so they are
+// never newer or older on disk than the blocks the transaction sends home.
+static int fs_do_journal_commit(void) {
+    if (!fs_disk_enabled || !g_fs_state.initialized) {
+        return FS_ERROR_NOT_FOUND;
+    }
     
-    // Read 8 sectors (4KB = 8 * 512 bytes)
-    uint16_t* sector_buffer = (uint16_t*)block_data;
+    void** log = kmalloc((SIMPLEFS_JOURNAL_MAX_TX + 1) * sizeof(void*));
+    journal_header_t* header = kmalloc_page();       // Zeroed, one block each
+    journal_commit_t* commit = kmalloc_page();
+    if (!log || !header || !commit) {
+        kfree(log);
+        kfree_page(header);
+        kfree_page(commit);
+        return FS_ERROR_NO_SPACE;
+    }
     
-    for (int sector = 0; sector < 8; sector++) {
-        uint32_t sector_lba = lba * 8 + sector;
-        uint16_t* sector_data = sector_buffer + (sector * 256);
-        
-        if (!ata_read_sectors(fs_disk_drive, sector_lba, 1, sector_data)) {
-            terminal_writestring("SimpleFS: Error reading block from disk\n");
-            return FS_ERROR_NOT_FOUND;
+    // log[0] is the header, log[1..count] the blocks it lists
+    int result = FS_SUCCESS;
+    uint32_t count = 0;
+    uint32_t end = fs_cached ? DATA_START_BLOCK_NUM : SIMPLEFS_MAX_BLOCKS;
+    for (uint32_t i = 0; i < end && result == FS_SUCCESS; i++) {
+        if (fs_is_dirty(i) && fs_is_metadata(i)) {
+            if (count == SIMPLEFS_JOURNAL_MAX_TX) {
+                result = FS_ERROR_NO_SPACE;
+                break;
+            }
+            header->blocks[count] = i;
+            log[1 + count++] = fs_get_block(i);
+        }
+    }
+    for (uint32_t i = 0; i < fs_tx_pinned && result == FS_SUCCESS; i++) {
+        if (count == SIMPLEFS_JOURNAL_MAX_TX) {
+            result = FS_ERROR_NO_SPACE;
+            break;
+        }
+        header->blocks[count] = fs_tx_pins[i]->lba / 8 - FS_DISK_START_LBA;
+        log[1 + count++] = fs_tx_pins[i]->data;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        fs_sum_update(header->blocks[i], log[1 + i]);
+    }
+    if (result == FS_SUCCESS && (!fs_table_log(&fs_bitmap_table, header, log, &count) ||
+                                 !fs_table_log(&fs_sums, header, log, &count))) {
+        result = FS_ERROR_NO_SPACE;
+    }
+    if (result != FS_SUCCESS || count == 0) {
+        if (result != FS_SUCCESS) {
+            terminal_writestring("SimpleFS: Too many metadata blocks for one journal transaction\n");
         }
+        kfree(log);
+        kfree_page(header);
+        kfree_page(commit);
+        return result;
     }
     
-    return FS_SUCCESS;
+    header->magic = SIMPLEFS_JOURNAL_MAGIC;
+    header->sequence = fs_journal_sequence;
+    header->count = count;
+    commit->magic = SIMPLEFS_COMMIT_MAGIC;
+    commit->sequence = fs_journal_sequence;
+    commit->checksum = 2166136261u;
+    for (uint32_t i = 0; i < count; i++) {
+        commit->checksum = fs_journal_checksum(commit->checksum, log[1 + i]);
+    }
+    log[0] = header;
+    
+    void* record = commit;
+    void* empty = header;
+    uint32_t journal = g_fs_state.superblock->journal_start;
+    if ((fs_cached && bcache_sync(fs_disk_drive) != 0) ||
+        fs_write_blocks(NULL, journal, log, count + 1, 0) != FS_SUCCESS ||
+        fs_write_blocks(NULL, journal + 1 + count, &record, 1,
+                        BLK_REQ_PREFLUSH | BLK_REQ_FUA) != FS_SUCCESS ||
+        fs_write_blocks(header->blocks, 0, log + 1, count, 0) != FS_SUCCESS) {
+        result = FS_ERROR_NO_SPACE;
+    } else {
+        memset(header, 0, SIMPLEFS_BLOCK_SIZE);
+        // Replaying it would be harmless
+        fs_write_blocks(NULL, journal, &empty, 1, BLK_REQ_PREFLUSH);
+        for (uint32_t i = 0; i < end; i++) {
+            if (fs_is_metadata(i)) {
+                fs_take_dirty(i);
+            }
+        }
+        fs_journal_drop();
+        fs_journal_sequence++;
+        fs_table_clean(&fs_bitmap_table);
+        fs_table_clean(&fs_sums);
+        fs_trim_commit();
+    }
+    
+    kfree(log);
+    kfree_page(header);
+    kfree_page(commit);
+    return result;
 }
 
-// Save memory file system to disk
-int fs_save_to_disk(void) {
+int fs_journal_commit(void) {
+    int entered = fs_enter();
+    int result = fs_do_journal_commit();
+    fs_leave(entered);
+    return result;
+}
+
+// At mount, before anything but the superblock is read: redo a
+// transaction that was committed but maybe not all written home. One
+// whose commit record is missing or doesn't match never reached its home
+// blocks and is ignored. The journal is journal_start onwards, after a
+// file system of total blocks.
+static void fs_journal_recover(uint32_t journal_start, uint32_t total) {
+    uint8_t* buffer = kmalloc(2 * SIMPLEFS_BLOCK_SIZE);
+    if (!buffer) {
+        return;
+    }
+    journal_header_t* header = (journal_header_t*)buffer;
+    uint8_t* block = buffer + SIMPLEFS_BLOCK_SIZE;
+    if (!ata_read(fs_disk_drive, fs_block_lba(journal_start), 8, header) ||
+        header->magic != SIMPLEFS_JOURNAL_MAGIC) {
+        kfree(buffer);
+        return;
+    }
+    fs_journal_sequence = header->sequence + 1;
+    
+    uint32_t count = header->count;
+    journal_commit_t* commit = (journal_commit_t*)block;
+    if (count == 0 || count > SIMPLEFS_JOURNAL_MAX_TX ||
+        !ata_read(fs_disk_drive, fs_block_lba(journal_start + 1 + count), 8, block) ||
+        commit->magic != SIMPLEFS_COMMIT_MAGIC || commit->sequence != header->sequence) {
+        kfree(buffer);
+        return;
+    }
+    uint32_t expected = commit->checksum;
+    
+    // Check the whole transaction before writing any of it
+    uint32_t checksum = 2166136261u;
+    for (uint32_t i = 0; i < count; i++) {
+        if (header->blocks[i] >= total ||
+            !ata_read(fs_disk_drive, fs_block_lba(journal_start + 1 + i), 8, block)) {
+            kfree(buffer);
+            return;
+        }
+        checksum = fs_journal_checksum(checksum, block);
+    }
+    if (checksum != expected) {
+        kfree(buffer);
+        return;
+    }
+    
+    for (uint32_t i = 0; i < count; i++) {
+        if (!ata_read(fs_disk_drive, fs_block_lba(journal_start + 1 + i), 8, block) ||
+            !ata_write(fs_disk_drive, fs_block_lba(header->blocks[i]), 8, block)) {
+            terminal_writestring("SimpleFS: Error replaying journal\n");
+            kfree(buffer);
+            return;
+        }
+    }
+    terminal_printf("SimpleFS: Replayed journal transaction %d (%d blocks)\n",
+                    (int)header->sequence, (int)count);
+    memset(header, 0, SIMPLEFS_BLOCK_SIZE);
+    if (ata_flush(fs_disk_drive)) {   // The home blocks before the journal lets go of them
+        ata_write(fs_disk_drive, fs_block_lba(journal_start), 8, header);
+    }
+    kfree(buffer);
+}
+
+// Write what changed since the last save: the dirty resident data blocks
+// in place and (mounted from disk) the buffer cache's dirty blocks for
+// this drive, then the metadata through the journal, whose commit record
+// makes all of it durable. With no metadata to commit a bare flush does
+// that instead. The cache's flusher also writes its blocks on its own
+// once they age.
+static int fs_do_save_to_disk(void) {
     if (!fs_disk_enabled || !g_fs_state.initialized) {
         return FS_ERROR_NOT_FOUND;
     }
     
     terminal_writestring("SimpleFS: Saving file system to disk...\n");
-    
-    // Save superblock
-    if (fs_write_block_to_disk(SUPERBLOCK_NUM, fs_get_block(SUPERBLOCK_NUM)) != FS_SUCCESS) {
+    fs_inode_sync_all();  // Sizes of files still open
+    
+    uint32_t end = fs_cached ? DATA_START_BLOCK_NUM : SIMPLEFS_MAX_BLOCKS;
+    uint32_t sequence = fs_journal_sequence;
+    if (fs_transfer_blocks(true, SUPERBLOCK_NUM, end) != FS_SUCCESS ||
+        (fs_cached && bcache_sync(fs_disk_drive) != 0) ||
+        fs_journal_commit() != FS_SUCCESS ||
+        (fs_journal_sequence == sequence && fs_flush_disk() != FS_SUCCESS)) {
+        terminal_writestring("SimpleFS: Error writing block to disk\n");
         return FS_ERROR_NO_SPACE;
     }
     
-    // Save FAT
-    if (fs_write_block_to_disk(FAT_BLOCK_NUM, fs_get_block(FAT_BLOCK_NUM)) != FS_SUCCESS) {
-        return FS_ERROR_NO_SPACE;
+    fs_trim_flush();
+    terminal_writestring("SimpleFS: File system saved to disk successfully\n");
+    return FS_SUCCESS;
+}
+
+int fs_save_to_disk(void) {
+    int entered = fs_enter();
+    int result = fs_do_save_to_disk();
+    fs_leave(entered);
+    return result;
+}
+
+// Blocks of a v1 file, following its FAT chain into chain. A block seen
+// before (a loop, or another file's) ends it.
+static uint32_t fs_v1_chain(const fat_entry_t* fat, uint32_t block, uint8_t* seen, uint32_t* chain) {
+    uint32_t count = 0;
+    while (block >= DATA_START_BLOCK_NUM && block < SIMPLEFS_MAX_BLOCKS &&
+           !(seen[block / 8] & (1 << (block % 8)))) {
+        seen[block / 8] |= (uint8_t)(1 << (block % 8));
+        chain[count++] = block;
+        block = fat[block].next_block;
+    }
+    return count;
+}
+
+// Walk the root directory of a v1 image, marking what its entries use in
+// seen (a bitmap). With chain, also give each file an extent map.
+static int fs_v1_walk(const fat_entry_t* fat, dir_entry_t* dir, uint8_t* seen, uint32_t* chain,
+                      int convert) {
+    uint32_t files = 0;
+    for (int i = 0; i < SIMPLEFS_DIR_ENTRIES; i++) {
+        if (dir[i].name[0] == '\0') {
+            continue;
+        }
+        if (dir[i].type == FS_TYPE_DIRECTORY) {
+            if (dir[i].first_block < SIMPLEFS_MAX_BLOCKS) {
+                seen[dir[i].first_block / 8] |= (uint8_t)(1 << (dir[i].first_block % 8));
+            }
+            continue;
+        }
+        uint32_t count = fs_v1_chain(fat, dir[i].first_block, seen, chain);
+        uint32_t runs = 0;
+        for (uint32_t k = 0; k < count; k++) {
+            if (k == 0 || chain[k] != chain[k - 1] + 1) {
+                runs++;
+            }
+        }
+        if (runs > SIMPLEFS_MAX_EXTENTS) {
+            return FS_ERROR_NO_SPACE;
+        }
+        files++;
+        if (!convert) {
+            continue;
+        }
+        
+        uint32_t map_block = fs_alloc_block();
+        fs_extent_map_t* map = map_block ? (fs_extent_map_t*)fs_get_block(map_block) : NULL;
+        if (!map) {
+            return FS_ERROR_NO_SPACE;
+        }
+        memset(map, 0, SIMPLEFS_BLOCK_SIZE);
+        map->magic = SIMPLEFS_EXTENT_MAGIC;
+        for (uint32_t k = 0; k < count; k++) {
+            fs_extent_t* last = map->count ? &map->extents[map->count - 1] : NULL;
+            if (last && chain[k] == last->start + last->length) {
+                last->length++;
+            } else {
+                fs_extent_t* extent = &map->extents[map->count++];
+                extent->file_block = k;
+                extent->start = chain[k];
+                extent->length = 1;
+            }
+        }
+        map->blocks = count;
+        fs_put_block(map, 1);
+        dir[i].first_block = map_block;
+        if (dir[i].size > count * SIMPLEFS_BLOCK_SIZE) {
+            dir[i].size = count * SIMPLEFS_BLOCK_SIZE;
+        }
+    }
+    return (int)files;
+}
+
+// A v1 disk keeps its data where it is: the FAT becomes the allocation
+// bitmap and each file's chain an extent map, written out with the next
+// save. Before the metadata is swapped in, check it will fit and build
+// the bitmap; returns the v1 FAT (as v1 saw it, running into the root
+// directory block) for fs_v1_convert, or NULL.
+static fat_entry_t* fs_v1_prepare(uint8_t* metadata) {
+    fat_entry_t* fat = kmalloc(2 * SIMPLEFS_BLOCK_SIZE);
+    uint32_t* chain = kmalloc(SIMPLEFS_MAX_BLOCKS * sizeof(uint32_t));
+    if (!fat || !chain) {
+        kfree(fat);
+        kfree(chain);
+        return NULL;
+    }
+    memcpy(fat, metadata + FAT_BLOCK_NUM * SIMPLEFS_BLOCK_SIZE, 2 * SIMPLEFS_BLOCK_SIZE);
+    
+    superblock_t* sb = (superblock_t*)(metadata + SUPERBLOCK_NUM * SIMPLEFS_BLOCK_SIZE);
+    uint8_t* bitmap = metadata + FAT_BLOCK_NUM * SIMPLEFS_BLOCK_SIZE;
+    memset(bitmap, 0, SIMPLEFS_BLOCK_SIZE);
+    for (uint32_t i = 0; i < DATA_START_BLOCK_NUM; i++) {
+        bitmap[i / 8] |= (uint8_t)(1 << (i % 8));
     }
+    int files = fs_v1_walk(fat, (dir_entry_t*)(metadata + ROOT_DIR_BLOCK_NUM * SIMPLEFS_BLOCK_SIZE),
+                           bitmap, chain, 0);
+    kfree(chain);
     
-    // Save root directory
-    if (fs_write_block_to_disk(ROOT_DIR_BLOCK_NUM, fs_get_block(ROOT_DIR_BLOCK_NUM)) != FS_SUCCESS) {
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < SIMPLEFS_MAX_BLOCKS; i++) {
+        used += (bitmap[i / 8] >> (i % 8)) & 1;
+    }
+    if (files < 0 || (uint32_t)files > SIMPLEFS_MAX_BLOCKS - used) {
+        kfree(fat);
+        return NULL;
+    }
+    sb->free_blocks = SIMPLEFS_MAX_BLOCKS - used;
+    return fat;
+}
+
+// Give the mounted v1 files their extent maps
+static int fs_v1_convert(const fat_entry_t* fat) {
+    uint32_t* chain = kmalloc(SIMPLEFS_MAX_BLOCKS * sizeof(uint32_t));
+    if (!chain) {
+        return FS_ERROR_NO_SPACE;
+    }
+    uint8_t seen[SIMPLEFS_MAX_BLOCKS / 8];
+    memset(seen, 0, sizeof(seen));
+    dir_entry_t* root_dir = (dir_entry_t*)fs_get_block(ROOT_DIR_BLOCK_NUM);
+    int result = fs_v1_walk(fat, root_dir, seen, chain, 1);
+    fs_put_block(root_dir, 1);
+    kfree(chain);
+    if (result < 0) {
+        return result;
+    }
+    g_fs_state.superblock->version = SIMPLEFS_VERSION_PACKED;   // fs_tables_mount goes on from there
+    fs_mark_dirty(SUPERBLOCK_NUM);
+    fs_mark_dirty(FAT_BLOCK_NUM);
+    return FS_SUCCESS;
+}
+
+// Whether blocks start.. (count of them) sit inside the data area
+static int fs_run_ok(uint32_t start, uint32_t count, uint32_t total) {
+    return start >= DATA_START_BLOCK_NUM && start < total && count <= total - start;
+}
+
+// Mounting: set up the bitmap past its first block and the checksums,
+// neither read until used. Older file systems have one bitmap block; one
+// from before v4 gets an empty checksum table (its blocks are summed as
+// they are next written), or none without room for it.
+static int fs_tables_mount(void) {
+    superblock_t* sb = g_fs_state.superblock;
+    uint32_t total = sb->total_blocks;
+    uint32_t sum_blocks = (total + SIMPLEFS_SUMS_SPAN - 1) / SIMPLEFS_SUMS_SPAN;
+    if (sb->version < SIMPLEFS_VERSION_WIDE) {
+        sb->bitmap_blocks = 1;
+        sb->bitmap_start = 0;
+        sb->checksum_blocks = sb->version == SIMPLEFS_VERSION_SUMS ? 1 : 0;
+    }
+    if (total < DATA_START_BLOCK_NUM || total > SIMPLEFS_MAX_VOLUME_BLOCKS ||
+        sb->bitmap_blocks != (total + SIMPLEFS_BITMAP_SPAN - 1) / SIMPLEFS_BITMAP_SPAN ||
+        (sb->bitmap_blocks > 1 && !fs_run_ok(sb->bitmap_start, sb->bitmap_blocks - 1, total)) ||
+        (sb->checksum_blocks && (sb->checksum_blocks != sum_blocks ||
+                                 !fs_run_ok(sb->checksum_block, sum_blocks, total)))) {
+        terminal_writestring("SimpleFS: Inconsistent file system geometry\n");
+        return FS_ERROR_NOT_FOUND;
+    }
+    if (fs_table_init(&fs_bitmap_table, sb->bitmap_start, sb->bitmap_blocks - 1, 0) != FS_SUCCESS) {
         return FS_ERROR_NO_SPACE;
     }
     
-    // Save data blocks (only used ones)
-    fat_entry_t* fat = (fat_entry_t*)fs_get_block(FAT_BLOCK_NUM);
-    for (uint32_t i = DATA_START_BLOCK_NUM; i < SIMPLEFS_MAX_BLOCKS; i++) {
-        if (fat[i].allocated) {
-            if (fs_write_block_to_disk(i, fs_get_block(i)) != FS_SUCCESS) {
-                return FS_ERROR_NO_SPACE;
+    if (sb->checksum_blocks) {
+        if (fs_table_init(&fs_sums, sb->checksum_block, sb->checksum_blocks, 0) != FS_SUCCESS) {
+            fs_tables_release();
+            return FS_ERROR_NO_SPACE;
+        }
+    } else {
+        uint32_t got;
+        uint32_t table = fs_alloc_extent(0, sum_blocks, &got);
+        if (got == sum_blocks && fs_table_init(&fs_sums, table, sum_blocks, 1) == FS_SUCCESS) {
+            sb->checksum_block = table;
+            sb->checksum_blocks = sum_blocks;
+            terminal_writestring("SimpleFS: Added block checksums\n");
+        } else {
+            fs_table_release(&fs_sums);
+            for (uint32_t i = 0; i < got; i++) {
+                fs_free_block(table + i);
             }
+            terminal_writestring("SimpleFS: No room for block checksums; mounted without them\n");
         }
     }
-    
-    terminal_writestring("SimpleFS: File system saved to disk successfully\n");
+    if (sb->version != SIMPLEFS_VERSION) {
+        sb->version = SIMPLEFS_VERSION;
+        fs_mark_dirty(SUPERBLOCK_NUM);
+    }
     return FS_SUCCESS;
 }
 
@@ -738,60 +3965,112 @@ int fs_save_to_disk(void) {
 int fs_load_from_disk(void) {
     terminal_writestring("SimpleFS: Loading file system from disk...\n");
     
-    // Initialize memory structures if not already done
-    if (!g_fs_state.initialized) {
-        // Allocate memory for the entire file system
-        size_t total_fs_size = SIMPLEFS_MAX_BLOCKS * SIMPLEFS_BLOCK_SIZE;
-        g_fs_state.blocks = kmalloc(total_fs_size);
-        
-        if (!g_fs_state.blocks) {
-            terminal_writestring("SimpleFS: Failed to allocate memory\n");
-            return FS_ERROR_NO_SPACE;
-        }
-        
-        // Clear all file descriptors
-        for (int i = 0; i < SIMPLEFS_MAX_FD; i++) {
-            g_fs_state.fd_table[i].in_use = 0;
-        }
+    // Only the metadata blocks stay resident; data blocks are read through
+    // the buffer cache on first use, so mounting costs one command for the
+    // superblock, bitmap and root directory (adjacent on disk) however much
+    // data there is. They are read aside so a failed load leaves the
+    // current state alone.
+    if (bcache_init() != 0) {
+        terminal_writestring("SimpleFS: Failed to set up the buffer cache\n");
+        return FS_ERROR_NO_SPACE;
+    }
+    uint8_t* metadata = kmalloc(DATA_START_BLOCK_NUM * SIMPLEFS_BLOCK_SIZE);
+    if (!metadata) {
+        terminal_writestring("SimpleFS: Failed to allocate memory\n");
+        return FS_ERROR_NO_SPACE;
+    }
+    
+    // The superblock alone first: it says where the journal is, and that
+    // is replayed before anything else is read. Where it is never changes.
+    superblock_t* sb = (superblock_t*)(metadata + SUPERBLOCK_NUM * SIMPLEFS_BLOCK_SIZE);
+    if (ata_read(fs_disk_drive, fs_block_lba(SUPERBLOCK_NUM), SIMPLEFS_BLOCK_SIZE / BLK_SECTOR_SIZE, sb) &&
+        sb->magic == SIMPLEFS_MAGIC) {
+        fs_journal_recover(sb->journal_blocks ? sb->journal_start : SIMPLEFS_JOURNAL_START,
+                           sb->total_blocks);
     }
     
-    // Try to read superblock
-    if (fs_read_block_from_disk(SUPERBLOCK_NUM, fs_get_block(SUPERBLOCK_NUM)) != FS_SUCCESS) {
-        terminal_writestring("SimpleFS: Failed to read superblock from disk\n");
+    // Read superblock, allocation bitmap (v1: FAT) and root directory
+    if (!ata_read(fs_disk_drive, fs_block_lba(SUPERBLOCK_NUM),
+                  DATA_START_BLOCK_NUM * (SIMPLEFS_BLOCK_SIZE / BLK_SECTOR_SIZE), metadata)) {
+        terminal_writestring("SimpleFS: Failed to read metadata from disk\n");
+        kfree(metadata);
         return FS_ERROR_NOT_FOUND;
     }
     
     // Verify superblock
-    superblock_t* sb = (superblock_t*)fs_get_block(SUPERBLOCK_NUM);
     if (sb->magic != SIMPLEFS_MAGIC) {
         terminal_writestring("SimpleFS: Invalid file system magic number\n");
+        kfree(metadata);
         return FS_ERROR_NOT_FOUND;
     }
     
-    // Load FAT
-    if (fs_read_block_from_disk(FAT_BLOCK_NUM, fs_get_block(FAT_BLOCK_NUM)) != FS_SUCCESS) {
-        terminal_writestring("SimpleFS: Failed to read FAT from disk\n");
-        return FS_ERROR_NOT_FOUND;
+    if (sb->version != SIMPLEFS_VERSION && sb->version != SIMPLEFS_VERSION_WIDE &&
+        sb->version != SIMPLEFS_VERSION_SUMS &&
+        sb->version != SIMPLEFS_VERSION_PACKED && sb->version != SIMPLEFS_VERSION_PLAIN &&
+        sb->version != 0) {
+        terminal_printf("SimpleFS: Unsupported file system version %d\n", (int)sb->version);
+        kfree(metadata);
+        return FS_ERROR_PERMISSION;
     }
     
-    // Load root directory
-    if (fs_read_block_from_disk(ROOT_DIR_BLOCK_NUM, fs_get_block(ROOT_DIR_BLOCK_NUM)) != FS_SUCCESS) {
-        terminal_writestring("SimpleFS: Failed to read root directory from disk\n");
-        return FS_ERROR_NOT_FOUND;
+    fat_entry_t* v1_fat = NULL;
+    if (sb->version == 0) {
+        v1_fat = fs_v1_prepare(metadata);
+        if (!v1_fat) {
+            terminal_writestring("SimpleFS: Cannot convert v1 file system to extents\n");
+            kfree(metadata);
+            return FS_ERROR_NO_SPACE;
+        }
     }
     
-    // Load data blocks (only allocated ones)
-    fat_entry_t* fat = (fat_entry_t*)fs_get_block(FAT_BLOCK_NUM);
-    for (uint32_t i = DATA_START_BLOCK_NUM; i < SIMPLEFS_MAX_BLOCKS; i++) {
-        if (fat[i].allocated) {
-            if (fs_read_block_from_disk(i, fs_get_block(i)) != FS_SUCCESS) {
-                terminal_writestring("SimpleFS: Failed to read data block from disk\n");
-                return FS_ERROR_NOT_FOUND;
-            }
+    if (g_fs_state.blocks) {
+        kfree(g_fs_state.blocks);
+    }
+    fs_journal_drop();
+    fs_tables_release();
+    g_fs_state.blocks = metadata;
+    memset(fs_dirty, 0, sizeof(fs_dirty));
+    memset(fs_meta, 0, sizeof(fs_meta));
+    fs_cached = 1;
+    g_fs_state.superblock = (superblock_t*)fs_get_block(SUPERBLOCK_NUM);
+    g_fs_state.bitmap = (uint8_t*)fs_get_block(FAT_BLOCK_NUM);
+    alloc_cursor = DATA_START_BLOCK_NUM;
+    if (g_fs_state.superblock->journal_blocks == 0) {
+        // Made before the journal: it goes just past the file system
+        g_fs_state.superblock->journal_start = SIMPLEFS_JOURNAL_START;
+        g_fs_state.superblock->journal_blocks = SIMPLEFS_JOURNAL_BLOCKS;
+        fs_mark_dirty(SUPERBLOCK_NUM);
+    }
+    if (g_fs_state.superblock->version == SIMPLEFS_VERSION_PLAIN) {
+        // Nothing compressed yet; marked so older kernels leave it alone
+        g_fs_state.superblock->version = SIMPLEFS_VERSION_PACKED;
+        fs_mark_dirty(SUPERBLOCK_NUM);
+    }
+    
+    // Clear all file descriptors
+    fs_fd_reset();
+    
+    fs_dir_index_drop_all();
+    fs_dentry_clear();
+    fs_unpack_clear();
+    if (v1_fat) {
+        int result = fs_v1_convert(v1_fat);
+        kfree(v1_fat);
+        if (result != FS_SUCCESS) {
+            terminal_writestring("SimpleFS: Failed to convert v1 file system\n");
+            g_fs_state.initialized = 0;
+            return result;
         }
+        terminal_writestring("SimpleFS: Converted v1 file system to extents\n");
+    }
+    int result = fs_tables_mount();
+    if (result != FS_SUCCESS) {
+        g_fs_state.initialized = 0;
+        return result;
     }
     
     g_fs_state.initialized = 1;
+    fs_dir_index_root();
     terminal_writestring("SimpleFS: File system loaded from disk successfully\n");
     return FS_SUCCESS;
 }
\ No newline at end of file
@@ -2,20 +2,50 @@
 #define SIMPLEFS_H
 
 #include "../kernel/types.h"
+#include "../kernel/vfs.h"
 
 // ClaudeOS Simple File System (SimpleFS)
 // Day 10 Implementation - Persistent disk-based file system
 
 // File System Constants
 #define SIMPLEFS_MAGIC          0xC1ADEFU  // ClaudeFS magic number
+#define SIMPLEFS_VERSION        6           // Small files keep their data in their map block
+#define SIMPLEFS_VERSION_WIDE   5           // Sized to the disk: bitmap and checksums span blocks
+#define SIMPLEFS_VERSION_SUMS   4           // Blocks carry CRC32C checksums
+#define SIMPLEFS_VERSION_PACKED 3           // Extents may be compressed
+#define SIMPLEFS_VERSION_PLAIN  2           // Extent-mapped files; v1 chained them in a FAT
 #define SIMPLEFS_BLOCK_SIZE     4096        // 4KB blocks
-#define SIMPLEFS_MAX_BLOCKS     1024        // Maximum blocks in FS
+#define SIMPLEFS_MAX_BLOCKS     1024        // Blocks of a resident (in-memory) file system
+#define SIMPLEFS_MIN_BLOCKS     64          // Smallest one formatted on a disk
+#define SIMPLEFS_MAX_VOLUME_BLOCKS (1u << 24)  // Largest (64GB); the rest of a bigger disk is left
+#define SIMPLEFS_BITMAP_SPAN    (SIMPLEFS_BLOCK_SIZE * 8)  // Blocks one bitmap block covers
+#define SIMPLEFS_SUMS_SPAN      (SIMPLEFS_BLOCK_SIZE / 4)  // Blocks one checksum block covers
 #define SIMPLEFS_MAX_FILES      256         // Maximum files per directory
 #define SIMPLEFS_MAX_FILENAME   56          // Maximum filename length
 #define SIMPLEFS_MAX_PATH       256         // Maximum path length
-#define SIMPLEFS_MAX_FD         32          // Maximum open file descriptors
+#define SIMPLEFS_MAX_FD         1024        // Maximum open file descriptors
+#define SIMPLEFS_FD_TABLE_INITIAL 32        // Descriptor table size before it first grows
+#define SIMPLEFS_INODE_BUCKETS  32          // Hash of open files' inodes
+#define SIMPLEFS_RA_MIN         4           // First read-ahead window (blocks)
+#define SIMPLEFS_RA_MAX         32          // Window cap: half the buffer cache
+#define SIMPLEFS_DIR_HASH_BUCKETS 128       // Per directory index
+#define SIMPLEFS_DIR_INDEXES    32          // Buckets of the index table, by block
+#define SIMPLEFS_DCACHE_ENTRIES 128         // Names remembered by fs_lookup
+#define SIMPLEFS_DCACHE_BUCKETS 64
+#define SIMPLEFS_PACK_BLOCKS    16          // File blocks one compressed extent holds
+#define SIMPLEFS_UNPACK_SLOTS   2           // Compressed extents kept decompressed
+#define SIMPLEFS_TRIM_EXTENTS   64          // Freed runs remembered for TRIM, per list
+#define SIMPLEFS_DEFRAG_BLOCKS  64          // Blocks the defragmenter moves per flusher pass
+#define SIMPLEFS_DEFRAG_IDLE    8           // Others' requests per pass that still leave the disk idle
+#define SIMPLEFS_DEFRAG_DEPTH   8           // Directory levels it descends
+#define SIMPLEFS_DEFRAG_REST    30          // Passes it sits out after a round with nothing to move
 
 // File System Block Numbers (disk LBA mapping)
+#define SIMPLEFS_JOURNAL_START  SIMPLEFS_MAX_BLOCKS  // Journal: the blocks just past the FS (when resident)
+#define SIMPLEFS_JOURNAL_BLOCKS 128         // Header, up to 126 blocks, commit record
+#define SIMPLEFS_JOURNAL_PINS   16          // Cached metadata blocks one transaction holds
+#define SIMPLEFS_MMAP_BASE      0x3000000   // fs_mmap places mappings in this window
+#define SIMPLEFS_MMAP_SIZE      0x1000000
 #define FS_DISK_START_LBA       128         // Start FS at LBA 128 (safe area)
 #define SUPERBLOCK_LBA          (FS_DISK_START_LBA + 0)   // Superblock at LBA 128
 #define FAT_BLOCK_LBA           (FS_DISK_START_LBA + 1)   // FAT at LBA 129
@@ -24,7 +54,7 @@
 
 // Legacy in-memory block numbers (for compatibility)
 #define SUPERBLOCK_NUM          0           // Superblock at block 0
-#define FAT_BLOCK_NUM           1           // FAT at block 1  
+#define FAT_BLOCK_NUM           1           // Allocation bitmap (v1: FAT) at block 1
 #define ROOT_DIR_BLOCK_NUM      2           // Root directory at block 2
 #define DATA_START_BLOCK_NUM    3           // Data blocks start at block 3
 
@@ -37,6 +67,17 @@
 #define O_WRITE                 0x02        // Write mode
 #define O_CREATE                0x04        // Create if not exists
 #define O_TRUNCATE              0x08        // Truncate to zero length
+#define O_APPEND                0x10        // Every write goes to the end
+#define O_COMPRESS              0x20        // Compress the file from now on
+
+// Directory entry flags
+#define FS_FLAG_COMPRESS        0x01        // Whole groups of blocks are stored compressed
+#define FS_FLAG_INLINE          0x02        // Data held in the map block itself (fs_inline_map_t)
+
+// fs_seek origins
+#define SEEK_SET                0
+#define SEEK_CUR                1
+#define SEEK_END                2
 
 // Error Codes
 #define FS_SUCCESS              0           // Operation successful
@@ -50,6 +91,7 @@
 #define FS_ERROR_INVALID_FD     -8          // Invalid file descriptor
 #define FS_ERROR_READ_ONLY      -9          // Read-only file system
 #define FS_ERROR_PERMISSION     -10         // Permission denied
+#define FS_ERROR_INVALID_SEEK   -11         // Seek before the start or past the end
 
 // Superblock Structure
 typedef struct {
@@ -61,32 +103,130 @@ typedef struct {
     uint32_t data_start_block;  // First data block number
     uint32_t max_files;         // Maximum files per directory
     uint32_t block_size;        // Size of each block in bytes
-    uint8_t  reserved[4072];    // Reserved space (pad to 4KB)
+    uint32_t version;           // SIMPLEFS_VERSION (0 on v1 disks)
+    uint32_t journal_start;     // First journal block (SIMPLEFS_JOURNAL_START)
+    uint32_t journal_blocks;    // Journal length in blocks
+    uint32_t checksum_block;    // CRC32C of every block, by number (v4)
+    uint32_t checksum_blocks;   // Its length (v5; 0 = none)
+    uint32_t bitmap_blocks;     // Bitmap length (v5): fat_block, then bitmap_start..
+    uint32_t bitmap_start;      // Where the bitmap's second block onwards lie
+    uint8_t  reserved[4044];    // Reserved space (pad to 4KB)
 } __attribute__((packed)) superblock_t;
 
-// File Allocation Table Entry
+// File Allocation Table Entry (v1 only; converted to extents at mount)
 typedef struct {
     uint32_t next_block;        // Next block in file (0xFFFFFFFF = end)
     uint8_t  allocated;         // 1 = allocated, 0 = free
     uint8_t  reserved[3];       // Reserved for future use
 } __attribute__((packed)) fat_entry_t;
 
+// A run of consecutive blocks holding file blocks file_block.. onwards
+typedef struct {
+    uint32_t file_block;        // First file block the run maps
+    uint32_t start;             // Its block number on disk
+    uint32_t length;            // Blocks in the run
+} __attribute__((packed)) fs_extent_t;
+
+#define SIMPLEFS_EXTENT_MAGIC   0x45585431  // "EXT1"
+#define SIMPLEFS_EXTENT_PACKED  0x80000000u // In start: a compressed run, not the blocks themselves
+#define SIMPLEFS_MAX_EXTENTS    ((SIMPLEFS_BLOCK_SIZE - 16) / sizeof(fs_extent_t))  // 340
+
+// A file's extent map: one block, the file's first_block. Extents are
+// sorted by file_block and cover file blocks 0..blocks-1 without gaps.
+typedef struct {
+    uint32_t magic;             // SIMPLEFS_EXTENT_MAGIC
+    uint32_t count;             // Extents in use
+    uint32_t blocks;            // File blocks mapped (may run past the size)
+    uint32_t reserved;
+    fs_extent_t extents[SIMPLEFS_MAX_EXTENTS];
+} __attribute__((packed)) fs_extent_map_t;
+
+// A small file's map block holds its bytes in place of extents, so it
+// needs no data block and reading it touches nothing past the map. New
+// files start this way; one that outgrows it moves to a data block.
+#define SIMPLEFS_INLINE_MAGIC   0x494E4C31  // "INL1"
+#define SIMPLEFS_INLINE_MAX     (SIMPLEFS_BLOCK_SIZE - 16)  // 4080 bytes
+
+typedef struct {
+    uint32_t magic;             // SIMPLEFS_INLINE_MAGIC
+    uint32_t count;             // 0, as for an empty extent map
+    uint32_t blocks;            // 0
+    uint32_t reserved;
+    uint8_t  data[SIMPLEFS_INLINE_MAX];
+} __attribute__((packed)) fs_inline_map_t;
+
+// Start of a compressed run: the LZ4 block follows the header, and the run
+// decompresses to the extent's length in file blocks
+#define SIMPLEFS_PACK_MAGIC     0x50345A4C  // "LZ4P"
+
+typedef struct {
+    uint32_t magic;             // SIMPLEFS_PACK_MAGIC
+    uint32_t raw_bytes;
+    uint32_t packed_bytes;      // LZ4 data after the header
+    uint32_t disk_blocks;       // Blocks the run takes, header included
+} __attribute__((packed)) fs_pack_header_t;
+
 // Directory Entry
 typedef struct {
     char     name[SIMPLEFS_MAX_FILENAME];  // File/directory name
-    uint32_t first_block;       // First block of file/directory data
+    uint32_t first_block;       // A file's extent map, or the directory block
     uint32_t size;              // File size in bytes (0 for directories)
     uint8_t  type;              // File type (FS_TYPE_FILE or FS_TYPE_DIRECTORY)
-    uint8_t  reserved[3];       // Reserved for future use
+    uint8_t  flags;             // FS_FLAG_*
+    uint8_t  reserved[2];       // Reserved for future use
 } __attribute__((packed)) dir_entry_t;
 
+// Journal transaction: this header, the blocks it lists in order, then a
+// commit record. Only a transaction whose commit record matches is
+// replayed at mount; a header of zeros is an empty journal.
+#define SIMPLEFS_JOURNAL_MAGIC  0x4A524E4C  // "JRNL"
+#define SIMPLEFS_COMMIT_MAGIC   0x4A434D54  // "JCMT"
+#define SIMPLEFS_JOURNAL_MAX_TX (SIMPLEFS_JOURNAL_BLOCKS - 2)
+
+typedef struct {
+    uint32_t magic;             // SIMPLEFS_JOURNAL_MAGIC
+    uint32_t sequence;
+    uint32_t count;             // Blocks in the transaction
+    uint32_t reserved;
+    uint32_t blocks[SIMPLEFS_JOURNAL_MAX_TX];  // Home block of each
+} journal_header_t;                 // All words: no padding to pack away
+
+typedef struct {
+    uint32_t magic;             // SIMPLEFS_COMMIT_MAGIC
+    uint32_t sequence;          // The header's
+    uint32_t checksum;          // FNV-1a over the logged blocks
+} __attribute__((packed)) journal_commit_t;
+
+#define SIMPLEFS_DIR_ENTRIES    ((int)(SIMPLEFS_BLOCK_SIZE / sizeof(dir_entry_t)))  // 60 per block
+
+// In-memory inode of an open file, shared by every descriptor on it. The
+// size lives here while the file is open; the directory entry catches up
+// when the last descriptor closes (or the file system is saved).
+typedef struct fs_inode {
+    uint32_t first_block;       // The file's extent map, which identifies it
+    uint32_t dir_block;         // Directory holding its entry
+    int32_t  slot;              // Entry in that directory
+    uint32_t size;
+    uint32_t refcount;          // Descriptors open on it
+    uint8_t  dirty;             // Size or flags differ from the entry's
+    uint8_t  flags;             // FS_FLAG_*
+    uint8_t  reserved[2];
+    struct fs_inode* next;      // Hash chain
+} fs_inode_t;
+
 // File Descriptor Structure
 typedef struct {
     int32_t  fd;                // File descriptor number
-    uint32_t first_block;       // First block of file
-    uint32_t current_block;     // Current block for read/write
+    uint32_t first_block;       // The file's extent map
+    fs_inode_t* inode;          // Shared with other descriptors on the file
+    uint32_t current_block;     // Disk block last read or written
+    uint32_t ext_file_block;    // Extent last used, so sequential access and
+    uint32_t ext_start;         // appends skip the map: file blocks
+    uint32_t ext_length;        // ext_file_block.. live at ext_start.. (0 = none)
     uint32_t position;          // Current position in file (bytes)
-    uint32_t file_size;         // Total file size
+    uint32_t ra_next;           // Position a sequential read would start at
+    uint32_t ra_end;            // File block index read-ahead has reached
+    uint32_t ra_window;         // Blocks to keep ahead; 0 until reads look sequential
     uint8_t  mode;              // Access mode (O_READ, O_WRITE, etc.)
     uint8_t  in_use;            // 1 = active, 0 = available
     uint8_t  reserved[2];       // Reserved for future use
@@ -95,9 +235,11 @@ typedef struct {
 // File System State
 typedef struct {
     superblock_t* superblock;   // Pointer to superblock
-    fat_entry_t*  fat;          // Pointer to FAT
+    uint8_t*      bitmap;       // Block allocation bitmap, one bit per block
     void*         blocks;       // Pointer to all blocks
-    file_descriptor_t fd_table[SIMPLEFS_MAX_FD]; // File descriptor table
+    file_descriptor_t** fd_table; // File descriptor table, NULL where free
+    uint32_t      fd_capacity;  // Slots in fd_table
+    uint32_t      fd_count;     // Descriptors open
     char          current_dir[SIMPLEFS_MAX_PATH]; // Current directory path
     uint8_t       initialized;  // 1 = initialized, 0 = not initialized
 } fs_state_t;
@@ -114,15 +256,19 @@ int fs_format(void);
 
 // Block management
 void* fs_get_block(uint32_t block_num);
+void fs_put_block(void* block, int dirty);  // Once per fs_get_block
+void fs_put_metadata(void* block, int dirty);  // The same, for directory and extent map blocks
 uint32_t fs_alloc_block(void);
+uint32_t fs_alloc_extent(uint32_t goal, uint32_t want, uint32_t* got);  // Up to want in a row
 int fs_free_block(uint32_t block_num);
 int fs_is_block_allocated(uint32_t block_num);
 
 // Path and directory utilities
 int fs_resolve_path(const char* path, char* resolved_path);
 int fs_find_dir_entry(uint32_t dir_block, const char* name, dir_entry_t* entry);
+int fs_lookup(uint32_t dir_block, const char* name, dir_entry_t* entry);  // Through the dentry cache
 int fs_add_dir_entry(uint32_t dir_block, const char* name, uint32_t first_block, 
-                     uint32_t size, uint8_t type);
+                     uint32_t size, uint8_t type, uint8_t flags);
 int fs_remove_dir_entry(uint32_t dir_block, const char* name);
 
 // File descriptor management
@@ -136,12 +282,22 @@ int fs_open(const char* path, uint8_t mode);
 int fs_read(int fd, void* buffer, uint32_t size);
 int fs_write(int fd, const void* buffer, uint32_t size);
 int fs_close(int fd);
+int fs_seek(int fd, int32_t offset, int whence);  // New position, or an error
+
+// Map length bytes of an open file from offset (block aligned); prot takes
+// VMA_READ / VMA_WRITE / VMA_USER. Pages are read in on first touch; with
+// VMA_WRITE the ones stored to go back to the file on fs_msync or
+// fs_munmap, within its size at mapping time. NULL on error.
+void* fs_mmap(int fd, uint32_t offset, uint32_t length, uint32_t prot);
+int fs_msync(void* addr);
+int fs_munmap(void* addr);
 int fs_delete(const char* path);
 
 // Directory operations
 int fs_mkdir(const char* path);
 int fs_rmdir(const char* path);
 int fs_list(const char* path, dir_entry_t* entries, int max_entries);
+int fs_list_from(const char* path, uint32_t* cursor, dir_entry_t* entries, int max_entries);
 int fs_chdir(const char* path);
 char* fs_getcwd(void);
 
@@ -150,6 +306,7 @@ int fs_exists(const char* path);
 int fs_is_directory(const char* path);
 int fs_get_file_size(const char* path);
 void fs_dump_stats(void);
+void fs_defrag_report(void);  // Fragments of every file (the shell's defrag)
 
 // Debug functions
 void fs_dump_superblock(void);
@@ -160,8 +317,12 @@ void fs_dump_directory(uint32_t dir_block);
 int fs_init_disk(uint8_t drive_num);          // Initialize persistent FS on disk
 int fs_load_from_disk(void);                  // Load FS from disk to memory
 int fs_save_to_disk(void);                    // Save memory FS to disk
+int fs_journal_commit(void);                  // Log and write back the metadata changed so far
 int fs_format_disk(uint8_t drive_num);        // Format disk with SimpleFS
 void fs_set_disk_mode(int enabled);           // Enable/disable disk persistence
 int fs_is_disk_mode(void);                    // Check if disk mode is enabled
 
+// Day 21: the file system as the VFS sees it
+extern const vfs_ops_t simplefs_vfs_ops;
+
 #endif // SIMPLEFS_H
\ No newline at end of file
@@ -0,0 +1,539 @@
+// ClaudeOS Slab Allocator Implementation - Day 21
+// O(1) small-object allocation from per-size-class page caches
+
+#include "slab.h"
+#include "heap.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "kernel.h"
+#include "stats.h"
+#include "reclaim.h"
+
+STAT_DEFINE(stat_slab_pages, "slab.pages", STAT_GAUGE, "pages mapped for the size classes");
+
+// Slab state
+static slab_class_t slab_classes[SLAB_CLASS_COUNT];
+static slab_page_t slab_pages[SLAB_MAX_PAGES];
+static slab_page_t* empty_pages = 0;        // Mapped pages not owned by any class
+static slab_page_t* unbacked_pages = 0;     // Reclaimed: no frame behind them
+static uint32_t empty_count = 0;
+static uint32_t unbacked_count = 0;
+static uint32_t slab_mapped_pages = 0;      // Pages of the region used so far (grows upward)
+int slab_initialized = 0;
+
+// Registered object caches
+static kmem_cache_t* kmem_cache_list = 0;
+
+// Size class for a request (size must be 1..SLAB_MAX_OBJECT)
+static inline uint32_t size_to_class(size_t size) {
+    if (size <= SLAB_MIN_OBJECT) {
+        return 0;
+    }
+    uint32_t high_bit;
+    asm volatile ("bsr %1, %0" : "=r" (high_bit) : "rm" (size - 1));
+    return high_bit - 3;  // 17..32 -> 1, 33..64 -> 2, ...
+}
+
+static inline uint32_t page_index(const void* ptr) {
+    return ((uint32_t)ptr - SLAB_START) / PAGE_SIZE;
+}
+
+static inline uint8_t* page_address(slab_page_t* page) {
+    return (uint8_t*)(SLAB_START + (uint32_t)(page - slab_pages) * PAGE_SIZE);
+}
+
+// Partial list management
+static void partial_push(slab_class_t* cls, slab_page_t* page) {
+    page->prev = 0;
+    page->next = cls->partial;
+    if (cls->partial) {
+        cls->partial->prev = page;
+    }
+    cls->partial = page;
+}
+
+static void partial_remove(slab_class_t* cls, slab_page_t* page) {
+    if (page->prev) {
+        page->prev->next = page->next;
+    } else {
+        cls->partial = page->next;
+    }
+    if (page->next) {
+        page->next->prev = page->prev;
+    }
+    page->next = 0;
+    page->prev = 0;
+}
+
+// Get a mapped page for a class, reusing an empty one when possible
+static slab_page_t* get_page(uint32_t class_index) {
+    slab_page_t* page = empty_pages;
+
+    if (page) {
+        empty_pages = page->next;
+        empty_count--;
+    } else {
+        // A reclaimed page gets a new frame before the region grows
+        if (!unbacked_pages && slab_mapped_pages >= SLAB_MAX_PAGES) {
+            return 0;  // Slab region exhausted
+        }
+        uint32_t phys_page = pmm_alloc_page();
+        if (!phys_page) {
+            return 0;  // Out of physical memory
+        }
+        if (unbacked_pages) {
+            page = unbacked_pages;
+            unbacked_pages = page->next;
+            unbacked_count--;
+        } else {
+            page = &slab_pages[slab_mapped_pages++];
+        }
+        vmm_map_page(current_page_directory, (uint32_t)page_address(page), phys_page,
+                     PAGE_PRESENT | PAGE_WRITABLE | PAGE_GLOBAL);
+        stat_inc(&stat_slab_pages);
+    }
+
+    // Carve the page into a free list of objects
+    slab_class_t* cls = &slab_classes[class_index];
+    uint8_t* base = page_address(page);
+    page->free_list = 0;
+    for (uint32_t i = cls->objects_per_page; i > 0; i--) {
+        void** object = (void**)(base + (i - 1) * cls->object_size);
+        *object = page->free_list;
+        page->free_list = object;
+    }
+    page->in_use = 0;
+    page->class_index = class_index;
+    page->next = 0;
+    page->prev = 0;
+    cls->pages++;
+
+    return page;
+}
+
+// Hand a page with no live objects back to the empty list
+static void release_page(slab_page_t* page) {
+    slab_classes[page->class_index].pages--;
+    page->class_index = SLAB_PAGE_UNUSED;
+    page->free_list = 0;
+    page->prev = 0;
+    page->next = empty_pages;
+    empty_pages = page;
+    empty_count++;
+}
+
+// Initialize slab caches
+void slab_init(void) {
+    size_t object_size = SLAB_MIN_OBJECT;
+    for (uint32_t i = 0; i < SLAB_CLASS_COUNT; i++) {
+        slab_classes[i].object_size = object_size;
+        slab_classes[i].objects_per_page = PAGE_SIZE / object_size;
+        slab_classes[i].partial = 0;
+        slab_classes[i].pages = 0;
+        slab_classes[i].in_use = 0;
+        slab_classes[i].allocs = 0;
+        slab_classes[i].frees = 0;
+        object_size *= 2;
+    }
+    for (uint32_t i = 0; i < SLAB_MAX_PAGES; i++) {
+        slab_pages[i].class_index = SLAB_PAGE_UNUSED;
+    }
+    empty_pages = 0;
+    unbacked_pages = 0;
+    empty_count = 0;
+    unbacked_count = 0;
+    slab_mapped_pages = 0;
+    slab_initialized = 1;
+}
+
+// Allocate an object of at least size bytes (0 if size is not a slab size)
+void* slab_alloc(size_t size) {
+    if (!slab_initialized || size == 0 || size > SLAB_MAX_OBJECT) {
+        return 0;
+    }
+
+    uint32_t class_index = size_to_class(size);
+    slab_class_t* cls = &slab_classes[class_index];
+
+    slab_page_t* page = cls->partial;
+    if (!page) {
+        page = get_page(class_index);
+        if (!page) {
+            return 0;
+        }
+        partial_push(cls, page);
+    }
+
+    // Pop an object; a page with nothing left leaves the partial list
+    void** object = (void**)page->free_list;
+    page->free_list = *object;
+    page->in_use++;
+    if (!page->free_list) {
+        partial_remove(cls, page);
+    }
+
+    cls->in_use++;
+    cls->allocs++;
+    return object;
+}
+
+// Free an object previously returned by slab_alloc
+void slab_free(void* ptr) {
+    if (!slab_owns(ptr)) {
+        return;  // Invalid pointer
+    }
+
+    slab_page_t* page = &slab_pages[page_index(ptr)];
+    if (page->class_index == SLAB_PAGE_UNUSED) {
+        return;  // Page not in use
+    }
+    slab_class_t* cls = &slab_classes[page->class_index];
+    if (((uint32_t)ptr - (uint32_t)page_address(page)) % cls->object_size != 0) {
+        return;  // Not the start of an object
+    }
+
+    // A full page becomes partial again once it has a free object
+    int was_full = (page->free_list == 0);
+    *(void**)ptr = page->free_list;
+    page->free_list = ptr;
+    page->in_use--;
+    if (was_full) {
+        partial_push(cls, page);
+    }
+
+    cls->in_use--;
+    cls->frees++;
+
+    // Release empty pages, but keep the last partial page of a class so
+    // alloc/free pairs don't thrash a page in and out
+    if (page->in_use == 0 && (cls->partial != page || page->next)) {
+        partial_remove(cls, page);
+        release_page(page);
+    }
+}
+
+// A class's last partial page with nothing allocated from it - kept back
+// by slab_free, but fair game for reclaim
+static slab_page_t* idle_partial(slab_class_t* cls) {
+    slab_page_t* page = cls->partial;
+    return page && page->in_use == 0 && !page->next ? page : 0;
+}
+
+// Pages slab_shrink could give back now
+uint32_t slab_reclaimable(void) {
+    uint32_t pages = empty_count;
+    for (uint32_t i = 0; i < SLAB_CLASS_COUNT; i++) {
+        if (idle_partial(&slab_classes[i])) {
+            pages++;
+        }
+    }
+    return pages;
+}
+
+// Return the frames behind up to target empty pages to the PMM. The pages
+// stay in the region, unmapped, for get_page to back again.
+uint32_t slab_shrink(uint32_t target) {
+    for (uint32_t i = 0; i < SLAB_CLASS_COUNT && empty_count < target; i++) {
+        slab_page_t* page = idle_partial(&slab_classes[i]);
+        if (page) {
+            partial_remove(&slab_classes[i], page);
+            release_page(page);
+        }
+    }
+
+    uint32_t released = 0;
+    while (empty_pages && released < target) {
+        slab_page_t* page = empty_pages;
+        empty_pages = page->next;
+        empty_count--;
+        uint32_t virt = (uint32_t)page_address(page);
+        uint32_t phys_page = vmm_get_physical_address(current_page_directory, virt);
+        vmm_unmap_page(current_page_directory, virt);
+        pmm_free_page(phys_page);
+        page->next = unbacked_pages;
+        unbacked_pages = page;
+        unbacked_count++;
+        stat_dec(&stat_slab_pages);
+        released++;
+    }
+    return released;
+}
+
+// Check whether a pointer lies in the slab region
+int slab_owns(const void* ptr) {
+    return (uint32_t)ptr >= SLAB_START &&
+           (uint32_t)ptr < SLAB_START + slab_mapped_pages * PAGE_SIZE;
+}
+
+// Usable size of a slab object (0 if not a slab pointer)
+size_t slab_object_size(const void* ptr) {
+    if (!slab_owns(ptr)) {
+        return 0;
+    }
+    slab_page_t* page = &slab_pages[page_index(ptr)];
+    if (page->class_index == SLAB_PAGE_UNUSED) {
+        return 0;
+    }
+    return slab_classes[page->class_index].object_size;
+}
+
+// Get slab statistics
+size_t slab_get_used_size(void) {
+    size_t used = 0;
+    for (uint32_t i = 0; i < SLAB_CLASS_COUNT; i++) {
+        used += slab_classes[i].in_use * slab_classes[i].object_size;
+    }
+    return used;
+}
+
+size_t slab_get_total_size(void) {
+    return (slab_mapped_pages - unbacked_count) * PAGE_SIZE;
+}
+
+// Debug function to dump per-class statistics
+void slab_dump_stats(void) {
+    terminal_writestring("SLAB Statistics:\n");
+    terminal_printf("  Mapped pages: %d (%d empty, %d more reclaimed)\n",
+                    (int)(slab_mapped_pages - unbacked_count), (int)empty_count,
+                    (int)unbacked_count);
+    terminal_writestring("  Size   Pages  In use  Allocs  Frees\n");
+    for (uint32_t i = 0; i < SLAB_CLASS_COUNT; i++) {
+        slab_class_t* cls = &slab_classes[i];
+        terminal_printf("  %d    %d      %d      %d      %d\n",
+                        (int)cls->object_size, (int)cls->pages, (int)cls->in_use,
+                        (int)cls->allocs, (int)cls->frees);
+    }
+}
+
+// Set up a caller-provided cache descriptor and register it
+void kmem_cache_init(kmem_cache_t* cache, const char* name, size_t object_size, kmem_ctor_t ctor) {
+    kmem_cache_init_aligned(cache, name, object_size, sizeof(void*), ctor);
+}
+
+// align must be a power of two; object sizes are rounded up to it, so
+// every object of a refill lands on a multiple of it
+void kmem_cache_init_aligned(kmem_cache_t* cache, const char* name, size_t object_size,
+                             size_t align, kmem_ctor_t ctor) {
+    int i;
+    for (i = 0; i < KMEM_CACHE_NAME_LEN - 1 && name[i] != '\0'; i++) {
+        cache->name[i] = name[i];
+    }
+    cache->name[i] = '\0';
+
+    // Every object must be able to hold the free-list link
+    if (object_size < sizeof(void*)) {
+        object_size = sizeof(void*);
+    }
+    if (align < sizeof(void*)) {
+        align = sizeof(void*);
+    }
+    cache->object_size = (object_size + align - 1) & ~(align - 1);
+    cache->align = align;
+    cache->grow_count = PAGE_SIZE / cache->object_size;
+    if (cache->grow_count == 0) {
+        cache->grow_count = 1;
+    }
+    cache->ctor = ctor;
+    cache->free_list = 0;
+    cache->total = 0;
+    cache->in_use = 0;
+    cache->peak = 0;
+    cache->grows = 0;
+    cache->shrinks = 0;
+    cache->chunks = 0;
+    spin_lock_init(&cache->lock, cache->name);
+
+    // Register once (re-initializing a cache keeps its list position)
+    kmem_cache_t* existing = kmem_cache_list;
+    while (existing && existing != cache) {
+        existing = existing->next;
+    }
+    if (!existing) {
+        cache->next = kmem_cache_list;
+        kmem_cache_list = cache;
+    }
+}
+
+// Allocate a cache descriptor from the heap
+kmem_cache_t* kmem_cache_create(const char* name, size_t object_size, kmem_ctor_t ctor) {
+    kmem_cache_t* cache = (kmem_cache_t*)kmalloc(sizeof(kmem_cache_t));
+    if (!cache) {
+        return 0;
+    }
+    kmem_cache_init(cache, name, object_size, ctor);
+    return cache;
+}
+
+// Add count objects laid out back to back in storage
+void kmem_cache_seed(kmem_cache_t* cache, void* storage, uint32_t count) {
+    uint32_t flags = spin_lock_irqsave(&cache->lock);
+    uint8_t* base = (uint8_t*)storage;
+    for (uint32_t i = count; i > 0; i--) {
+        void** object = (void**)(base + (i - 1) * cache->object_size);
+        if (cache->ctor) {
+            cache->ctor(object);
+        }
+        *object = cache->free_list;
+        cache->free_list = object;
+    }
+    cache->total += count;
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+// Allocate one object - O(1) unless the cache has to grow
+void* kmem_cache_alloc(kmem_cache_t* cache) {
+    if (!cache) {
+        return 0;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&cache->lock);
+    while (!cache->free_list) {
+        // Grow by roughly a page worth of objects from the heap. The lock
+        // is dropped meanwhile (kmalloc takes the heap lock), so someone
+        // else may have refilled the cache by the time it is retaken.
+        spin_unlock_irqrestore(&cache->lock, flags);
+        size_t span = cache->object_size * cache->grow_count;
+        uint8_t* base = kmalloc_aligned(span + sizeof(kmem_chunk_t), cache->align);
+        if (!base) {
+            return 0;
+        }
+        kmem_cache_seed(cache, base, cache->grow_count);
+        kmem_chunk_t* chunk = (kmem_chunk_t*)(base + span);
+        flags = spin_lock_irqsave(&cache->lock);
+        chunk->next = cache->chunks;
+        cache->chunks = chunk;
+        cache->grows++;
+    }
+
+    void** object = (void**)cache->free_list;
+    cache->free_list = *object;
+    cache->in_use++;
+    if (cache->in_use > cache->peak) {
+        cache->peak = cache->in_use;
+    }
+    spin_unlock_irqrestore(&cache->lock, flags);
+    return object;
+}
+
+// Return an object to its cache
+void kmem_cache_free(kmem_cache_t* cache, void* object) {
+    if (!cache || !object) {
+        return;
+    }
+    uint32_t flags = spin_lock_irqsave(&cache->lock);
+    *(void**)object = cache->free_list;
+    cache->free_list = object;
+    cache->in_use--;
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+// The chunk in list holding object, if any
+static kmem_chunk_t* kmem_chunk_of(kmem_cache_t* cache, kmem_chunk_t* list, void* object) {
+    size_t span = cache->object_size * cache->grow_count;
+    for (kmem_chunk_t* chunk = list; chunk; chunk = chunk->next) {
+        uint8_t* base = (uint8_t*)chunk - span;
+        if ((uint8_t*)object >= base && (uint8_t*)object < base + span) {
+            return chunk;
+        }
+    }
+    return 0;
+}
+
+// Hand every heap refill whose objects are all free back to the heap;
+// returns the bytes released. Seeded storage is never released. Each free
+// object is matched against the chunk list, which is slow but only runs
+// under memory pressure. A cache that is busy is left alone - the caller
+// may have interrupted its holder.
+size_t kmem_cache_shrink(kmem_cache_t* cache) {
+    uint32_t flags = lock_irq_save();
+    if (!spin_trylock(&cache->lock)) {
+        lock_irq_restore(flags);
+        return 0;
+    }
+    if (!cache->chunks || cache->total - cache->in_use < cache->grow_count) {
+        spin_unlock_irqrestore(&cache->lock, flags);
+        return 0;                       // Not a whole chunk's worth free
+    }
+
+    for (kmem_chunk_t* chunk = cache->chunks; chunk; chunk = chunk->next) {
+        chunk->free = 0;
+    }
+    for (void** object = (void**)cache->free_list; object; object = (void**)*object) {
+        kmem_chunk_t* chunk = kmem_chunk_of(cache, cache->chunks, object);
+        if (chunk) {
+            chunk->free++;
+        }
+    }
+
+    // Detach the chunks with nothing allocated, then their objects
+    kmem_chunk_t* released = 0;
+    uint32_t count = 0;
+    kmem_chunk_t** link = &cache->chunks;
+    while (*link) {
+        kmem_chunk_t* chunk = *link;
+        if (chunk->free == cache->grow_count) {
+            *link = chunk->next;
+            chunk->next = released;
+            released = chunk;
+            count++;
+        } else {
+            link = &chunk->next;
+        }
+    }
+    void** prev = (void**)&cache->free_list;
+    while (count && *prev) {
+        void** object = (void**)*prev;
+        if (kmem_chunk_of(cache, released, object)) {
+            *prev = *object;
+        } else {
+            prev = object;
+        }
+    }
+    cache->total -= count * cache->grow_count;
+    cache->shrinks += count;
+    spin_unlock_irqrestore(&cache->lock, flags);
+
+    // The heap lock is taken outside the cache lock, as when growing
+    while (released) {
+        kmem_chunk_t* next = released->next;
+        kfree((uint8_t*)released - cache->object_size * cache->grow_count);
+        released = next;
+    }
+    return count * (sizeof(kmem_chunk_t) + cache->object_size * cache->grow_count);
+}
+
+// Shrinker: refills sitting wholly free in the object caches
+static uint32_t kmem_cache_reclaimable(void) {
+    uint32_t pages = 0;
+    for (kmem_cache_t* cache = kmem_cache_list; cache; cache = cache->next) {
+        uint32_t idle = cache->total - cache->in_use;
+        if (cache->chunks && idle >= cache->grow_count) {
+            pages += (idle / cache->grow_count) * cache->grow_count * cache->object_size / PAGE_SIZE;
+        }
+    }
+    return pages;
+}
+
+static uint32_t kmem_cache_reclaim(uint32_t target) {
+    size_t bytes = 0;
+    for (kmem_cache_t* cache = kmem_cache_list; cache && bytes < target * PAGE_SIZE;
+         cache = cache->next) {
+        bytes += kmem_cache_shrink(cache);
+    }
+    return bytes / PAGE_SIZE;
+}
+
+// Freed into the heap; the heap's shrinker trims it back to the PMM
+SHRINKER(shrinker_kmem_caches, "kmem_caches", kmem_cache_reclaimable, kmem_cache_reclaim,
+         SHRINK_HEAP);
+
+// Debug function to dump all registered object caches
+void kmem_cache_dump_stats(void) {
+    terminal_writestring("Object Caches:\n");
+    terminal_writestring("  Name            Size  Total  In use  Peak  Grows  Shrinks\n");
+    for (kmem_cache_t* cache = kmem_cache_list; cache; cache = cache->next) {
+        terminal_printf("  %s  %d  %d  %d  %d  %d  %d\n", cache->name,
+                        (int)cache->object_size, (int)cache->total, (int)cache->in_use,
+                        (int)cache->peak, (int)cache->grows, (int)cache->shrinks);
+    }
+}
@@ -0,0 +1,103 @@
+// ClaudeOS Slab Allocator - Day 21
+// Size-class caches for small kernel allocations, backed by whole pages
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "types.h"
+#include "lock.h"
+
+// Slab region sits directly above the general heap's maximum extent
+#define SLAB_START          0xC0C00000  // HEAP_START + HEAP_MAX_SIZE
+#define SLAB_MAX_SIZE       0x400000    // 4MB of slab pages
+#define SLAB_MAX_PAGES      (SLAB_MAX_SIZE / 4096)
+
+// Size classes: 16, 32, 64, 128, 256, 512, 1024, 2048 bytes
+#define SLAB_MIN_OBJECT     16
+#define SLAB_MAX_OBJECT     2048
+#define SLAB_CLASS_COUNT    8
+
+#define SLAB_PAGE_UNUSED    0xFF        // Descriptor class for pages not in a cache
+
+// Per-page descriptor, kept out of line so objects can fill the whole page
+typedef struct slab_page {
+    void* free_list;                // Free objects in this page (linked through the objects)
+    uint16_t in_use;                // Allocated objects in this page
+    uint8_t class_index;            // Size class, or SLAB_PAGE_UNUSED
+    struct slab_page* next;         // Next page in class partial list / empty list
+    struct slab_page* prev;
+} slab_page_t;
+
+// One cache per size class
+typedef struct {
+    size_t object_size;
+    uint32_t objects_per_page;
+    slab_page_t* partial;           // Pages with at least one free object
+    uint32_t pages;                 // Pages currently owned by this class
+    uint32_t in_use;                // Objects currently allocated
+    uint32_t allocs;
+    uint32_t frees;
+} slab_class_t;
+
+// Object caches - typed free lists for fixed-size kernel objects. A cache
+// can be seeded with static storage (usable before the heap exists) and
+// grows from kmalloc once the heap is up. Under memory pressure the heap
+// refills whose objects are all free again go back to the heap.
+#define KMEM_CACHE_NAME_LEN 16
+
+typedef void (*kmem_ctor_t)(void* object);
+
+// One heap refill, its objects in front of the header - an aligned
+// cache's objects start where the heap block does
+typedef struct kmem_chunk {
+    struct kmem_chunk* next;
+    uint32_t free;                  // Scratch count for kmem_cache_shrink
+} kmem_chunk_t;
+
+typedef struct kmem_cache {
+    char name[KMEM_CACHE_NAME_LEN];
+    size_t object_size;             // Rounded up to hold the free-list link (and to align)
+    size_t align;                   // Objects start on a multiple of this (heap refills)
+    uint32_t grow_count;            // Objects added per heap refill
+    kmem_ctor_t ctor;               // Optional, run once when an object is first added
+    void* free_list;                // Free objects (linked through the objects)
+    uint32_t total;                 // Objects owned by the cache
+    uint32_t in_use;                // Objects currently allocated
+    uint32_t peak;
+    uint32_t grows;                 // Heap refills performed
+    uint32_t shrinks;               // Refills handed back
+    kmem_chunk_t* chunks;           // Refills still owned
+    spinlock_t lock;                // Taken with interrupts off (IRQ paths allocate too)
+    struct kmem_cache* next;        // Registered caches (for stats)
+} kmem_cache_t;
+
+// Slab allocator functions (called from the heap with its lock held)
+void slab_init(void);
+void* slab_alloc(size_t size);
+void slab_free(void* ptr);
+int slab_owns(const void* ptr);
+size_t slab_object_size(const void* ptr);
+uint32_t slab_reclaimable(void);
+uint32_t slab_shrink(uint32_t target);
+
+// Object cache functions
+void kmem_cache_init(kmem_cache_t* cache, const char* name, size_t object_size, kmem_ctor_t ctor);
+// Seeded storage must be aligned by the caller
+void kmem_cache_init_aligned(kmem_cache_t* cache, const char* name, size_t object_size,
+                             size_t align, kmem_ctor_t ctor);
+kmem_cache_t* kmem_cache_create(const char* name, size_t object_size, kmem_ctor_t ctor);
+void kmem_cache_seed(kmem_cache_t* cache, void* storage, uint32_t count);
+void* kmem_cache_alloc(kmem_cache_t* cache);
+void kmem_cache_free(kmem_cache_t* cache, void* object);
+size_t kmem_cache_shrink(kmem_cache_t* cache);
+void kmem_cache_dump_stats(void);
+
+// Slab statistics
+size_t slab_get_used_size(void);
+size_t slab_get_total_size(void);
+void slab_dump_stats(void);
+
+// Slab state (read-only access for external code)
+extern int slab_initialized;
+
+#endif // SLAB_H
@@ -0,0 +1,474 @@
+// ClaudeOS Symmetric Multiprocessing Implementation - Day 21
+// Brings the application processors up with INIT-SIPI-SIPI and starts a
+// local APIC timer on each so it can run the scheduler. With a TSC the
+// timers are one-shots re-armed on every interrupt for the next deadline.
+
+#include "smp.h"
+#include "process.h"
+#include "kstack.h"
+#include "timer.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "fpu.h"
+#include "sysenter.h"
+#include "gdt.h"
+#include "idt.h"
+#include "kernel.h"
+#include "lock.h"
+#include "ioapic.h"
+#include "irq.h"
+#include "profile.h"
+#include "idle.h"
+
+#define IA32_APIC_BASE_MSR      0x1B
+#define IA32_APIC_BASE_ENABLE   0x800
+
+// SMP state
+cpu_t cpus[SMP_MAX_CPUS];
+uint32_t smp_cpu_count = 1;
+int smp_active = 0;
+static volatile uint32_t* lapic = 0;
+static uint32_t lapic_timer_count = 0;      // Initial count for one scheduler tick
+static uint32_t lapic_ns_mult = 0;          // Timer counts per ns, << 32
+int lapic_timer_oneshot = 0;
+
+// The shootdown in progress (one at a time, under shootdown_lock). Its
+// ranges are read under shootdown_sequence, odd while a sender writes
+// them: a CPU that takes a request late, once its sender has stopped
+// waiting, still reads some batch whole. The even value names the request.
+static spinlock_t shootdown_lock;
+static tlb_batch_t shootdown_batch;         // Ranges only; the frames stay with the sender
+static volatile uint32_t shootdown_sequence;
+static int smp_tlb_shootdown_irq(void* ctx);
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return lapic[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+    lapic[reg / 4] = value;
+    (void)lapic_read(LAPIC_ID);  // Make sure the write has landed
+}
+
+static inline uint32_t lapic_id(void) {
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+// Busy-wait on the monotonic clock (interrupts may be off)
+static void delay_us(uint32_t us) {
+    uint64_t end = clock_ns() + (uint64_t)us * 1000;
+    while (clock_ns() < end) {
+        asm volatile ("pause");
+    }
+}
+
+// Acknowledge a local APIC interrupt
+void lapic_eoi(void) {
+    if (lapic) {
+        lapic_write(LAPIC_EOI, 0);
+    }
+}
+
+// Whether the BSP's local APIC is mapped and taking interrupts (MSI target)
+int lapic_present(void) {
+    return lapic != 0;
+}
+
+static void lapic_enable(void) {
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+}
+
+// Count the APIC timer (divide by 16) across TIMER_CALIBRATE_MS
+static void lapic_timer_calibrate(void) {
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIV16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_MASKED);
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    delay_us(TIMER_CALIBRATE_MS * 1000);
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+    
+    uint32_t per_ms = elapsed / TIMER_CALIBRATE_MS;
+    lapic_timer_count = per_ms * (1000 / TIMER_FREQUENCY);
+    
+    // One-shots are timed against clock_ns, which needs the TSC; the
+    // quotient fits 32 bits below 1e6 counts per ms
+    if (clock_tsc_khz() && per_ms > 0 && per_ms < 1000000) {
+        uint32_t mult, rem;
+        asm volatile ("divl %3" : "=a" (mult), "=d" (rem) : "a" (0), "r" (1000000), "d" (per_ms));
+        lapic_ns_mult = mult;
+        lapic_timer_oneshot = 1;
+    }
+}
+
+// Arm this CPU's one-shot for deadline (interrupts off)
+static void lapic_timer_arm(cpu_t* cpu, uint64_t deadline) {
+    uint64_t now = clock_ns();
+    uint64_t delta = deadline > now ? deadline - now : 0;
+    if (delta > 0xFFFFFFFF) {
+        delta = 0xFFFFFFFF;
+    }
+    uint32_t count = (uint32_t)(((uint64_t)(uint32_t)delta * lapic_ns_mult) >> 32);
+    cpu->timer_deadline = deadline;
+    lapic_write(LAPIC_TIMER_INIT, count ? count : 1);
+}
+
+// Start the scheduler tick on this CPU
+static void lapic_timer_start(cpu_t* cpu) {
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIV16);
+    if (!lapic_timer_oneshot) {
+        // Periodic scheduler tick at TIMER_FREQUENCY
+        lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | LAPIC_TIMER_VECTOR);
+        lapic_write(LAPIC_TIMER_INIT, lapic_timer_count);
+        return;
+    }
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_ONESHOT | LAPIC_TIMER_VECTOR);
+    cpu->slice_end = clock_ns() + TIMER_SLICE_NS;
+    lapic_timer_arm(cpu, cpu->slice_end);
+}
+
+// A slice that has run out starts the next one and ticks the scheduler.
+// Sleepers are woken by whichever CPU gets to their deadline first; on
+// an idle CPU that ticks too, so the sleeper is picked up at once.
+static int smp_timer_interrupt(void* ctx) {
+    (void)ctx;
+    cpu_t* cpu = smp_current_cpu();
+    percpu_inc(timer_interrupts);
+    lapic_eoi();
+    if (!lapic_timer_oneshot) {
+        return IRQ_HANDLED | IRQ_RESCHEDULE;
+    }
+    
+    uint64_t now = clock_ns();
+    int tick = 0;
+    if (now >= cpu->slice_end) {
+        cpu->slice_end = now + TIMER_SLICE_NS;
+        tick = 1;
+    }
+    if (timer_expire_sleepers() && cpu->idle && cpu->current == cpu->idle) {
+        tick = 1;
+    }
+    uint64_t deadline = timer_next_wake();
+    if (deadline > cpu->slice_end) {
+        deadline = cpu->slice_end;
+    }
+    if (profile_period_ns && deadline > now + profile_period_ns) {
+        deadline = now + profile_period_ns;     // The profiler's next sample
+    }
+    lapic_timer_arm(cpu, deadline);
+    return tick ? IRQ_HANDLED | IRQ_RESCHEDULE : IRQ_HANDLED;
+}
+
+void smp_timer_pull(uint64_t deadline) {
+    if (!lapic_timer_oneshot || !smp_active) {
+        return;
+    }
+    uint32_t flags = lock_irq_save();
+    cpu_t* cpu = smp_current_cpu();
+    if (cpu->online && cpu->slice_end && deadline < cpu->timer_deadline) {
+        lapic_timer_arm(cpu, deadline);
+    }
+    lock_irq_restore(flags);
+}
+
+static void lapic_send_ipi(uint32_t apic_id, uint32_t command) {
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, command);
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) {
+        asm volatile ("pause");
+    }
+}
+
+// Register the BSP and start every other processor
+void smp_init(void) {
+    extern struct gdt_ptr gdt_ptr;
+    extern struct idt_ptr idt_ptr;
+    
+    cpus[0].id = 0;
+    cpus[0].online = 1;
+    if (!cpus[0].page_directory) {
+        cpus[0].page_directory = kernel_page_directory;
+    }
+    if (smp_active) {
+        return;  // Already brought up
+    }
+    
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
+    if (!(edx & (1 << 9)) || !kernel_page_directory || !kstack_initialized) {
+        terminal_writestring("[SMP] No local APIC - running on the BSP only\n");
+        return;
+    }
+    
+    // Map the local APIC uncached into the shared kernel MMIO window
+    uint32_t base_lo, base_hi;
+    asm volatile ("rdmsr" : "=a" (base_lo), "=d" (base_hi) : "c" (IA32_APIC_BASE_MSR));
+    uint32_t lapic_phys = base_lo & 0xFFFFF000;
+    if (!lapic_phys) {
+        lapic_phys = LAPIC_DEFAULT_PHYS;
+    }
+    base_lo |= IA32_APIC_BASE_ENABLE;
+    asm volatile ("wrmsr" : : "a" (base_lo), "d" (base_hi), "c" (IA32_APIC_BASE_MSR));
+    vmm_map_page(kernel_page_directory, LAPIC_VIRT, lapic_phys,
+                 PAGE_PRESENT | PAGE_WRITABLE | PAGE_NOCACHE | PAGE_GLOBAL);
+    lapic = (volatile uint32_t*)LAPIC_VIRT;
+    
+    spin_lock_init(&shootdown_lock, "tlb_shootdown");
+    irq_register(LAPIC_TIMER_VECTOR - IRQ_VECTOR_BASE, smp_timer_interrupt, NULL);
+    irq_register(LAPIC_TLB_VECTOR - IRQ_VECTOR_BASE, smp_tlb_shootdown_irq, NULL);
+    cpus[0].apic_id = lapic_id();
+    lapic_enable();
+    lapic_timer_calibrate();
+    ioapic_init();
+    if (lapic_timer_oneshot) {
+        lapic_timer_start(&cpus[0]);    // Takes the scheduler tick over from the PIT
+    }
+    
+    // Copy the trampoline below 1MB and fill in its parameter block. The
+    // APs turn paging on while running it, so the master maps its page at
+    // its physical address until they are all in
+    uint8_t* dest = (uint8_t*)PHYS_TO_VIRT(SMP_TRAMPOLINE_ADDR);
+    vmm_map_page(kernel_page_directory, SMP_TRAMPOLINE_ADDR, SMP_TRAMPOLINE_ADDR,
+                 PAGE_PRESENT | PAGE_WRITABLE);
+    uint32_t size = (uint32_t)(smp_trampoline_end - smp_trampoline_start);
+    for (uint32_t i = 0; i < size; i++) {
+        dest[i] = smp_trampoline_start[i];
+    }
+    smp_trampoline_params_t* params = (smp_trampoline_params_t*)
+        (dest + (smp_trampoline_params - smp_trampoline_start));
+    uint32_t cr4;
+    asm volatile ("mov %%cr4, %0" : "=r" (cr4));
+    params->cr3 = VIRT_TO_PHYS(kernel_page_directory);
+    params->cr4 = cr4;
+    params->entry = (uint32_t)smp_ap_main;
+    params->next_cpu = 1;
+    params->gdt_limit = gdt_ptr.limit;
+    params->gdt_base = gdt_ptr.base;
+    params->idt_limit = idt_ptr.limit;
+    params->idt_base = idt_ptr.base;
+    params->stacks[0] = 0;
+    for (uint32_t i = 1; i < SMP_MAX_CPUS; i++) {
+        uint8_t* stack = (uint8_t*)kstack_alloc();
+        params->stacks[i] = stack ? (uint32_t)(stack + KSTACK_SIZE) : 0;
+    }
+    
+    // Each AP finds its cpu_t through GS once it has loaded its own GDT
+    smp_active = 1;
+    
+    terminal_writestring("[SMP] Starting application processors...\n");
+    lapic_send_ipi(0, LAPIC_ICR_INIT);
+    delay_us(10000);
+    for (int i = 0; i < 2; i++) {
+        lapic_send_ipi(0, LAPIC_ICR_STARTUP | (SMP_TRAMPOLINE_ADDR >> 12));
+        delay_us(200);
+    }
+    delay_us(100000);  // Let the APs check in
+    
+    // Park latecomers and hand back the stacks nobody claimed
+    uint32_t claimed = params->next_cpu;
+    params->next_cpu = SMP_MAX_CPUS;
+    for (uint32_t i = (claimed < SMP_MAX_CPUS ? claimed : SMP_MAX_CPUS); i < SMP_MAX_CPUS; i++) {
+        if (params->stacks[i]) {
+            kstack_free((void*)(params->stacks[i] - KSTACK_SIZE));
+            params->stacks[i] = 0;
+        }
+    }
+    // Every AP that got a slot has left it; latecomers halt with interrupts off
+    vmm_unmap_page(kernel_page_directory, SMP_TRAMPOLINE_ADDR);
+    
+    terminal_printf("[SMP] %d CPU(s) online\n", (int)smp_cpu_count);
+}
+
+// C entry for an application processor, on its own pool stack with the
+// kernel GDT, IDT and master page directory already loaded
+void smp_ap_main(uint32_t cpu_index) {
+    gdt_load_cpu(cpu_index);
+    cpu_t* cpu = &cpus[cpu_index];
+    cpu->id = cpu_index;
+    cpu->apic_id = lapic_id();
+    cpu->page_directory = kernel_page_directory;
+    lapic_enable();
+    vmm_pat_init();
+    fpu_init();
+    sysenter_init();
+    
+    cpu->idle = process_idle_task(cpu_index);
+    cpu->current = cpu->idle;
+    
+    lapic_timer_start(cpu);
+    
+    cpu->online = 1;
+    __sync_fetch_and_add(&smp_cpu_count, 1);
+    
+    // Idle loop: the timer tick pulls in (or steals) work, and so does a
+    // wake from a CPU that queued some
+    while (1) {
+        if (cpu_idle()) {
+            process_yield();
+        }
+    }
+}
+
+// Do this CPU's part of the current shootdown, if it has one. Besides the
+// IPI handler, a CPU waiting for shootdown_lock with interrupts off calls
+// this, so two CPUs shooting at each other can't deadlock. A few ranges
+// go out with invlpg; many pages, or more ranges than a batch holds,
+// with one full flush.
+static void tlb_flush_serve(cpu_t* cpu) {
+    uint32_t request;
+    while ((request = cpu->tlb_flush_request) != 0) {
+        struct page_directory* dir;
+        uint32_t ranges;
+        uint32_t pages;
+        uint32_t addr[SMP_TLB_BATCH_RANGES];
+        uint32_t count[SMP_TLB_BATCH_RANGES];
+        uint32_t sequence;
+        do {
+            sequence = shootdown_sequence;
+            __sync_synchronize();
+            dir = shootdown_batch.dir;
+            ranges = shootdown_batch.ranges;
+            pages = shootdown_batch.pages;
+            for (uint32_t i = 0; i < ranges && i < SMP_TLB_BATCH_RANGES; i++) {
+                addr[i] = shootdown_batch.addr[i];
+                count[i] = shootdown_batch.count[i];
+            }
+            __sync_synchronize();
+        } while ((sequence & 1) || sequence != shootdown_sequence);
+        
+        if (!dir || cpu->page_directory == dir) {
+            if (ranges > SMP_TLB_BATCH_RANGES || pages > VMM_INVLPG_THRESHOLD) {
+                vmm_flush_tlb_all();
+                cpu->tlb_full_flushes++;
+            } else {
+                for (uint32_t i = 0; i < ranges; i++) {
+                    vmm_invalidate_range(addr[i], count[i]);
+                }
+            }
+        }
+        cpu->tlb_shootdowns++;
+        // Done unless a newer request came meanwhile; that one goes round again
+        __sync_bool_compare_and_swap(&cpu->tlb_flush_request, request, 0);
+    }
+}
+
+static int smp_tlb_shootdown_irq(void* ctx) {
+    (void)ctx;
+    tlb_flush_serve(smp_current_cpu());
+    lapic_eoi();
+    return IRQ_HANDLED;
+}
+
+void smp_tlb_batch_init(tlb_batch_t* batch, struct page_directory* dir) {
+    batch->dir = dir;
+    batch->ranges = 0;
+    batch->pages = 0;
+    batch->frames = 0;
+}
+
+// Pages that follow the last range extend it
+void smp_tlb_batch_add(tlb_batch_t* batch, uint32_t virt_addr, uint32_t count) {
+    if (count == 0) {
+        return;
+    }
+    batch->pages += count;
+    uint32_t last = batch->ranges - 1;
+    if (batch->ranges > 0 && batch->ranges <= SMP_TLB_BATCH_RANGES &&
+        batch->addr[last] + batch->count[last] * PAGE_SIZE == virt_addr) {
+        batch->count[last] += count;
+    } else if (batch->ranges < SMP_TLB_BATCH_RANGES) {
+        batch->addr[batch->ranges] = virt_addr;
+        batch->count[batch->ranges++] = count;
+    } else {
+        batch->ranges = SMP_TLB_BATCH_RANGES + 1;   // Too scattered: everything goes
+    }
+}
+
+void smp_tlb_batch_free(tlb_batch_t* batch, uint32_t phys) {
+    if (batch->frames == SMP_TLB_BATCH_FRAMES) {
+        smp_tlb_batch_flush(batch);
+    }
+    batch->frame[batch->frames++] = phys;
+}
+
+// A directory only has TLB entries on CPUs that have it loaded (a CR3
+// switch drops the non-global ones), so only those are interrupted, and
+// one that loads another directory before it gets to the IPI is done
+// with: its generation moved on. Kernel-space mappings are global: a
+// batch for NULL reaches every CPU and waits for each.
+void smp_tlb_batch_flush(tlb_batch_t* batch) {
+    if (batch->pages > 0 && smp_active && smp_cpu_count > 1) {
+        uint32_t flags = lock_irq_save();
+        cpu_t* self = smp_current_cpu();
+        while (!spin_trylock(&shootdown_lock)) {
+            tlb_flush_serve(self);
+            asm volatile ("pause");
+        }
+        
+        shootdown_sequence++;
+        __sync_synchronize();
+        shootdown_batch.dir = batch->dir;
+        shootdown_batch.ranges = batch->ranges;
+        shootdown_batch.pages = batch->pages;
+        for (uint32_t i = 0; i < batch->ranges && i < SMP_TLB_BATCH_RANGES; i++) {
+            shootdown_batch.addr[i] = batch->addr[i];
+            shootdown_batch.count[i] = batch->count[i];
+        }
+        __sync_synchronize();
+        shootdown_sequence++;
+        if (shootdown_sequence == 0) {
+            shootdown_sequence = 2;     // 0 is no request
+        }
+        uint32_t sequence = shootdown_sequence;
+        
+        uint32_t targets = 0;
+        uint32_t generation[SMP_MAX_CPUS];
+        for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+            cpu_t* cpu = &cpus[i];
+            if (cpu == self || !cpu->online || (batch->dir && cpu->page_directory != batch->dir)) {
+                continue;
+            }
+            generation[i] = cpu->tlb_generation;
+            cpu->tlb_flush_request = sequence;
+            lapic_send_ipi(cpu->apic_id, LAPIC_ICR_FIXED | LAPIC_TLB_VECTOR);
+            targets |= 1u << i;
+        }
+        for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+            while ((targets & (1u << i)) && cpus[i].tlb_flush_request == sequence &&
+                   (!batch->dir || cpus[i].tlb_generation == generation[i])) {
+                asm volatile ("pause");
+            }
+        }
+        
+        spin_unlock(&shootdown_lock);
+        lock_irq_restore(flags);
+    }
+    
+    for (uint32_t i = 0; i < batch->frames; i++) {
+        pmm_free_page(batch->frame[i]);
+    }
+    smp_tlb_batch_init(batch, batch->dir);
+}
+
+void smp_tlb_shootdown(struct page_directory* dir, uint32_t virt_addr, uint32_t count) {
+    tlb_batch_t batch;
+    smp_tlb_batch_init(&batch, dir);
+    smp_tlb_batch_add(&batch, virt_addr, count);
+    smp_tlb_batch_flush(&batch);
+}
+
+// Debug function to dump per-CPU state
+void smp_dump(void) {
+    terminal_printf("CPUs online: %d%s\n", (int)smp_cpu_count,
+                    smp_active ? "" : " (local APIC not started)");
+    terminal_writestring("  CPU  APIC  Ticks   Timer   Steals  Stolen  Shootdowns  Current\n");
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        cpu_t* cpu = &cpus[i];
+        if (!cpu->online) {
+            continue;
+        }
+        terminal_printf("  %d    %d     %d    %d    %d     %d     %d          %s\n", (int)cpu->id,
+                        (int)cpu->apic_id, (int)cpu->ticks, (int)cpu->timer_interrupts, (int)cpu->steals,
+                        (int)cpu->stolen, (int)cpu->tlb_shootdowns,
+                        cpu->current ? cpu->current->info->name : "-");
+    }
+}
@@ -0,0 +1,158 @@
+// ClaudeOS Symmetric Multiprocessing - Day 21
+// Local APIC access, application processor bring-up and per-CPU data
+
+#ifndef SMP_H
+#define SMP_H
+
+#include "types.h"
+
+#define SMP_MAX_CPUS            8
+#define SMP_TRAMPOLINE_ADDR     0x8000      // Real-mode AP entry (SIPI vector 0x08)
+
+// Local APIC (mapped uncached into the kernel MMIO window)
+#define LAPIC_DEFAULT_PHYS      0xFEE00000
+#define LAPIC_VIRT              0xC1400000  // VMM_MMIO_START
+#define LAPIC_ID                0x020
+#define LAPIC_EOI               0x0B0
+#define LAPIC_SVR               0x0F0       // Spurious vector + software enable
+#define LAPIC_ICR_LOW           0x300
+#define LAPIC_ICR_HIGH          0x310
+#define LAPIC_LVT_TIMER         0x320
+#define LAPIC_TIMER_INIT        0x380
+#define LAPIC_TIMER_CURRENT     0x390
+#define LAPIC_TIMER_DIVIDE      0x3E0
+
+#define LAPIC_SVR_ENABLE        0x100
+#define LAPIC_ICR_PENDING       0x1000
+#define LAPIC_ICR_INIT          0x000C4500  // INIT, assert, all excluding self
+#define LAPIC_ICR_STARTUP       0x000C4600  // STARTUP, all excluding self (| vector)
+#define LAPIC_ICR_FIXED         0x00004000  // Fixed delivery, assert, to ICR_HIGH's APIC (| vector)
+#define LAPIC_TIMER_ONESHOT     0x00000
+#define LAPIC_TIMER_PERIODIC    0x20000
+#define LAPIC_TIMER_MASKED      0x10000
+#define LAPIC_TIMER_DIV16       0x3
+
+// Interrupt vectors used by the local APIC
+#define LAPIC_TIMER_VECTOR      48
+#define LAPIC_SPURIOUS_VECTOR   79          // Low nibble must be 0xF on P6
+#define LAPIC_TLB_VECTOR        49          // TLB shootdown IPI
+
+#define SMP_TLB_BATCH_RANGES    8           // Ranges one shootdown carries; past that, a full flush
+#define SMP_TLB_BATCH_FRAMES    32          // Frames a batch holds back until its flush
+
+struct process;
+struct page_directory;
+
+// Per-CPU state
+typedef struct cpu {
+    struct cpu* self;                   // This entry, for smp_current_cpu
+    uint32_t id;                        // Index in cpus[]
+    uint32_t apic_id;
+    int online;
+    struct process* current;            // Running process
+    struct process* idle;               // Runs when the queue is empty (APs; CPU 0 from proc init)
+    struct process* fpu_loaded;         // Process whose state is in this FPU
+    uint32_t sysenter_esp;              // Last value written to IA32_SYSENTER_ESP
+    struct page_directory* page_directory;  // Loaded address space
+    struct vm_space* vm_space;          // Its process's areas (NULL: kernel_vm_space only)
+    struct process* switched_from;      // Left on the last tick, requeued once off its stack
+    uint32_t ticks;                     // Scheduler ticks taken
+    uint64_t slice_end;                 // clock_ns the running slice ends at
+    uint64_t timer_deadline;            // clock_ns the local APIC one-shot is armed for
+    uint32_t timer_interrupts;          // Local APIC timer interrupts taken
+    uint32_t steals;                    // Successful steals from other CPUs
+    uint32_t stolen;                    // Processes taken by those steals
+    volatile uint32_t softirq_pending;  // Raised softirqs, one bit each
+    int in_softirq;                     // Running softirqs on the interrupted stack
+    int need_resched;                   // A wakeup outranks current: switch on interrupt exit
+    volatile uint32_t tlb_flush_request;  // Sequence of the shootdown waiting here, 0 if none
+    volatile uint32_t tlb_generation;   // Directory loads: moving on drops a shootdown's entries
+    uint32_t tlb_shootdowns;            // Remote shootdowns handled
+    uint32_t tlb_full_flushes;          // Of those, done by flushing everything
+    volatile uint32_t rcu_qs;           // RCU quiescent states, two each; odd while idle
+} cpu_t;
+
+// This CPU's cpu_t fields, each read or written with one GS-relative mov
+// (32-bit fields only). From gdt_init on the kernel runs with GS on
+// GDT_KERNEL_PERCPU, which every CPU's GDT bases at its own cpus[] entry,
+// so this needs neither the APIC ID nor a shared lookup table.
+#define percpu_read(field) ({ \
+    __typeof__(((cpu_t*)0)->field) percpu_value; \
+    _Static_assert(sizeof(percpu_value) == 4, "percpu_read on a field that isn't 32 bits"); \
+    asm volatile ("movl %%gs:%c1, %0" : "=r" (percpu_value) : "i" (__builtin_offsetof(cpu_t, field))); \
+    percpu_value; })
+#define percpu_write(field, value) \
+    asm volatile ("movl %0, %%gs:%c1" : : "ri" ((__typeof__(((cpu_t*)0)->field))(value)), \
+                  "i" (__builtin_offsetof(cpu_t, field)) : "memory")
+#define percpu_inc(field) \
+    asm volatile ("incl %%gs:%c0" : : "i" (__builtin_offsetof(cpu_t, field)) : "memory")
+#define percpu_add(field, n) \
+    asm volatile ("addl %0, %%gs:%c1" : : "ri" ((uint32_t)(n)), "i" (__builtin_offsetof(cpu_t, field)) : "memory")
+
+// SMP functions
+void smp_init(void);
+void lapic_eoi(void);
+int lapic_present(void);
+void smp_ap_main(uint32_t cpu_index);
+void smp_dump(void);
+
+// Per-CPU one-shot timer: each CPU arms its local APIC for the nearer of
+// its slice end and the earliest sleeper, so preemption and sleep wakeups
+// are no longer rounded to the PIT's 10ms tick. Without a TSC to measure
+// against, the local APIC stays periodic on the APs and the PIT drives
+// the BSP as before.
+void smp_timer_pull(uint64_t deadline); // Fire this CPU's timer by deadline (clock_ns)
+
+// TLB shootdowns, gathered: the pages unmapped or changed in one address
+// space go into a batch as ranges, and frames that may be freed only once
+// no TLB maps them wait in it too. smp_tlb_batch_flush then interrupts
+// the CPUs that have dir loaded (NULL: all of them) once for the lot, and
+// frees the frames. The caller flushes its own TLB, as vmm_unmap_page does.
+typedef struct {
+    struct page_directory* dir;
+    uint32_t ranges;                    // Entries of addr/count; past SMP_TLB_BATCH_RANGES, everything
+    uint32_t pages;                     // Over all of them
+    uint32_t addr[SMP_TLB_BATCH_RANGES];
+    uint32_t count[SMP_TLB_BATCH_RANGES];
+    uint32_t frames;
+    uint32_t frame[SMP_TLB_BATCH_FRAMES];
+} tlb_batch_t;
+
+void smp_tlb_batch_init(tlb_batch_t* batch, struct page_directory* dir);
+void smp_tlb_batch_add(tlb_batch_t* batch, uint32_t virt_addr, uint32_t count);
+void smp_tlb_batch_free(tlb_batch_t* batch, uint32_t phys);  // Flushes first when full
+void smp_tlb_batch_flush(tlb_batch_t* batch);  // Leaves it empty for reuse
+
+// One range at once
+void smp_tlb_shootdown(struct page_directory* dir, uint32_t virt_addr, uint32_t count);
+
+// SMP state (read-only access for external code)
+extern cpu_t cpus[SMP_MAX_CPUS];
+extern uint32_t smp_cpu_count;
+extern int smp_active;
+extern int lapic_timer_oneshot;         // Scheduler ticks come from the local APICs
+
+// CPU this code is running on
+static inline cpu_t* smp_current_cpu(void) {
+    return percpu_read(self);
+}
+
+// Trampoline (kernel/smp_trampoline.asm), copied to SMP_TRAMPOLINE_ADDR
+extern uint8_t smp_trampoline_start[];
+extern uint8_t smp_trampoline_end[];
+extern uint8_t smp_trampoline_params[];
+
+// Parameter block at smp_trampoline_params - keep in sync with the assembly
+typedef struct {
+    uint32_t cr3;
+    uint32_t cr4;
+    uint32_t entry;                     // smp_ap_main
+    uint32_t next_cpu;                  // Index handed to the next AP (atomic)
+    uint16_t gdt_limit;                 // Kernel GDT pointer
+    uint32_t gdt_base;
+    uint16_t idt_limit;                 // Kernel IDT pointer
+    uint32_t idt_base;
+    uint32_t stacks[SMP_MAX_CPUS];      // Stack top for each CPU index
+} __attribute__((packed)) smp_trampoline_params_t;
+
+#endif // SMP_H
@@ -0,0 +1,99 @@
+; ClaudeOS AP Trampoline - Day 21
+; Real-mode entry for application processors; copied to SMP_TRAMPOLINE_ADDR
+
+[BITS 16]
+
+global smp_trampoline_start
+global smp_trampoline_end
+global smp_trampoline_params
+
+section .text
+
+TRAMPOLINE_BASE equ 0x8000
+
+; Address of a trampoline label once copied to TRAMPOLINE_BASE
+%define REL(label) (TRAMPOLINE_BASE + (label) - smp_trampoline_start)
+
+; smp_trampoline_params_t offsets (kernel/smp.h)
+%define PARAM_CR3       0
+%define PARAM_CR4       4
+%define PARAM_ENTRY     8
+%define PARAM_NEXT_CPU  12
+%define PARAM_GDT       16
+%define PARAM_IDT       22
+%define PARAM_STACKS    28
+
+SMP_MAX_CPUS equ 8
+
+smp_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    
+    ; Flat protected mode with the trampoline's own GDT
+    lgdt [REL(tramp_gdt_ptr)]
+    mov eax, cr0
+    or eax, 1
+    mov cr0, eax
+    jmp dword 0x08:REL(tramp_protected)
+
+[BITS 32]
+tramp_protected:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    
+    ; Same paging setup as the BSP: CR4 extensions, master directory
+    mov eax, [REL(smp_trampoline_params) + PARAM_CR4]
+    mov cr4, eax
+    mov eax, [REL(smp_trampoline_params) + PARAM_CR3]
+    mov cr3, eax
+    mov eax, cr0
+    or eax, 0x80010000      ; PG and WP, as on the BSP
+    mov cr0, eax
+    
+    ; Switch to the kernel's GDT and IDT
+    lgdt [REL(smp_trampoline_params) + PARAM_GDT]
+    lidt [REL(smp_trampoline_params) + PARAM_IDT]
+    jmp 0x08:REL(tramp_kernel_gdt)
+
+tramp_kernel_gdt:
+    ; Claim a CPU index and its stack
+    mov eax, 1
+    lock xadd [REL(smp_trampoline_params) + PARAM_NEXT_CPU], eax
+    cmp eax, SMP_MAX_CPUS
+    jae .park
+    mov esp, [REL(smp_trampoline_params) + PARAM_STACKS + eax * 4]
+    test esp, esp
+    jz .park
+    
+    push eax                ; cpu_index
+    mov eax, [REL(smp_trampoline_params) + PARAM_ENTRY]
+    call eax                ; smp_ap_main - never returns
+
+.park:
+    cli
+    hlt
+    jmp .park
+
+align 8
+tramp_gdt:
+    dq 0                    ; Null descriptor
+    dq 0x00CF9A000000FFFF   ; Flat 32-bit code
+    dq 0x00CF92000000FFFF   ; Flat 32-bit data
+tramp_gdt_ptr:
+    dw tramp_gdt_ptr - tramp_gdt - 1
+    dd REL(tramp_gdt)
+
+align 4
+smp_trampoline_params:
+    times (PARAM_STACKS + SMP_MAX_CPUS * 4) db 0
+
+smp_trampoline_end:
+
+; GNU stack note section
+section .note.GNU-stack noalloc noexec nowrite progbits
@@ -0,0 +1,285 @@
+// ClaudeOS Deferred Work Implementation - Day 21
+// Per-CPU softirq bitmaps run on interrupt exit, plus the kworker queue
+
+#include "softirq.h"
+#include "smp.h"
+#include "lock.h"
+#include "process.h"
+#include "kernel.h"
+#include "pool.h"
+
+static softirq_handler_t softirq_handlers[SOFTIRQ_COUNT];
+static uint32_t softirq_runs[SMP_MAX_CPUS][SOFTIRQ_COUNT];
+static const char* softirq_names[SOFTIRQ_COUNT] = { "timer", "keyboard", "rcu" };
+
+// Work queue (FIFO). Interrupt handlers schedule work, so the lock is
+// always taken with interrupts off.
+static work_t* work_head = NULL;
+static work_t* work_tail = NULL;
+static spinlock_t work_lock;
+static int worker_pids[WORKQUEUE_WORKERS];
+static bool worker_idle[WORKQUEUE_WORKERS];     // Blocked waiting for work (work_lock)
+static bool workers_started = false;
+static uint32_t work_scheduled = 0;
+static uint32_t work_completed = 0;
+
+// One-shot jobs posted with queue_work; freed once they have run
+DEFINE_POOL(work_jobs, work_t, WORK_MAX_JOBS);
+
+void softirq_init(void) {
+    spin_lock_init(&work_lock, "workqueue");
+}
+
+// Install the bottom half for a softirq number
+void softirq_register(uint32_t nr, softirq_handler_t handler) {
+    if (nr < SOFTIRQ_COUNT) {
+        softirq_handlers[nr] = handler;
+    }
+}
+
+// Mark a softirq pending on this CPU; it runs when the current (or next)
+// interrupt returns
+void softirq_raise(uint32_t nr) {
+    if (nr >= SOFTIRQ_COUNT) {
+        return;
+    }
+    uint32_t flags = lock_irq_save();
+    smp_current_cpu()->softirq_pending |= (1u << nr);
+    lock_irq_restore(flags);
+}
+
+// Called by irq_handler with interrupts off, after the device has had its
+// EOI. Interrupts are enabled while the handlers run; an interrupt taken
+// meanwhile only raises its softirq, which the loop below picks up, and
+// the CPU is not rescheduled until the outermost exit.
+void softirq_irq_exit(void) {
+    cpu_t* cpu = smp_current_cpu();
+    if (!cpu->softirq_pending || cpu->in_softirq) {
+        return;
+    }
+
+    cpu->in_softirq = 1;
+    for (int round = 0; round < SOFTIRQ_MAX_ROUNDS && cpu->softirq_pending; round++) {
+        uint32_t pending = cpu->softirq_pending;
+        cpu->softirq_pending = 0;
+        asm volatile ("sti" : : : "memory");
+        for (uint32_t nr = 0; nr < SOFTIRQ_COUNT; nr++) {
+            if ((pending & (1u << nr)) && softirq_handlers[nr]) {
+                softirq_runs[cpu->id][nr]++;
+                softirq_handlers[nr]();
+            }
+        }
+        asm volatile ("cli" : : : "memory");
+    }
+    cpu->in_softirq = 0;
+}
+
+void work_init(work_t* work, void (*func)(void* arg), void* arg) {
+    work->func = func;
+    work->arg = arg;
+    work->next = NULL;
+    work->pending = 0;
+    work->running = 0;
+}
+
+// Wake one idle worker, if any (work_lock held); its PID, or INVALID_PID
+static int worker_claim_idle(void) {
+    for (int i = 0; i < WORKQUEUE_WORKERS; i++) {
+        if (worker_idle[i]) {
+            worker_idle[i] = false;
+            return worker_pids[i];
+        }
+    }
+    return INVALID_PID;
+}
+
+// Append work to the queue (work_lock held)
+static void work_enqueue(work_t* work) {
+    work->pending = 1;
+    work->next = NULL;
+    if (work_tail) {
+        work_tail->next = work;
+    } else {
+        work_head = work;
+    }
+    work_tail = work;
+    work_scheduled++;
+}
+
+// Queue a work item for the workers; returns -1 if it is already queued
+int work_schedule(work_t* work) {
+    if (!work || !work->func) {
+        return -1;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&work_lock);
+    if (work->pending) {
+        spin_unlock_irqrestore(&work_lock, flags);
+        return -1;
+    }
+    work_enqueue(work);
+    int wake_pid = worker_claim_idle();
+    spin_unlock_irqrestore(&work_lock, flags);
+
+    if (wake_pid != INVALID_PID) {
+        process_wake(process_find(wake_pid));
+    }
+    return 0;
+}
+
+int queue_work(void (*func)(void* arg), void* arg) {
+    if (!func) {
+        return -1;
+    }
+    uint32_t flags = spin_lock_irqsave(&work_lock);
+    work_t* job = work_jobs_alloc();
+    if (!job) {
+        spin_unlock_irqrestore(&work_lock, flags);
+        return -1;
+    }
+    work_init(job, func, arg);
+    work_enqueue(job);
+    int wake_pid = worker_claim_idle();
+    spin_unlock_irqrestore(&work_lock, flags);
+
+    if (wake_pid != INVALID_PID) {
+        process_wake(process_find(wake_pid));
+    }
+    return 0;
+}
+
+// The first queued item no worker is running, unlinked and marked running
+// (work_lock held). An item rescheduled while it runs waits in the queue
+// for that run to end, so a function never runs twice at once.
+static work_t* work_take_locked(void) {
+    work_t* prev = NULL;
+    work_t* work = work_head;
+    while (work && work->running) {
+        prev = work;
+        work = work->next;
+    }
+    if (!work) {
+        return NULL;
+    }
+    if (prev) {
+        prev->next = work->next;
+    } else {
+        work_head = work->next;
+    }
+    if (work_tail == work) {
+        work_tail = prev;
+    }
+    work->next = NULL;
+    work->pending = 0;  // Rescheduling from here on queues it again
+    work->running = 1;
+    return work;
+}
+
+static void work_finish(work_t* work) {
+    uint32_t flags = spin_lock_irqsave(&work_lock);
+    work->running = 0;
+    work_completed++;
+    work_jobs_free(work);   // Only a queue_work job is one of the pool's
+    spin_unlock_irqrestore(&work_lock, flags);
+}
+
+// Run every queued work item in the calling context
+void work_run_pending(void) {
+    while (1) {
+        uint32_t flags = spin_lock_irqsave(&work_lock);
+        work_t* work = work_take_locked();
+        spin_unlock_irqrestore(&work_lock, flags);
+        if (!work) {
+            return;
+        }
+        work->func(work->arg);
+        work_finish(work);
+    }
+}
+
+// A kworker: drain the queue, then block until work_schedule picks it
+static void worker_main(void* arg) {
+    int index = (int)(uint32_t)arg;
+    while (1) {
+        work_run_pending();
+
+        // Marked idle under the queue lock, so a racing work_schedule
+        // finds it
+        uint32_t flags = spin_lock_irqsave(&work_lock);
+        bool idle = true;
+        for (work_t* work = work_head; work; work = work->next) {
+            if (!work->running) {
+                idle = false;
+                break;
+            }
+        }
+        if (idle) {
+            worker_idle[index] = true;
+            process_prepare_block();
+        }
+        spin_unlock_irqrestore(&work_lock, flags);
+        if (idle) {
+            process_yield();
+        }
+    }
+}
+
+static bool worker_alive(int index) {
+    process_t* worker = workers_started ? process_find(worker_pids[index]) : NULL;
+    return worker && worker->state != PROCESS_TERMINATED;
+}
+
+// Start the workers once the process system is up
+void workqueue_start(void) {
+    if (!workers_started) {
+        for (int i = 0; i < WORKQUEUE_WORKERS; i++) {
+            worker_pids[i] = INVALID_PID;
+        }
+        workers_started = true;
+    }
+    for (int i = 0; i < WORKQUEUE_WORKERS; i++) {
+        if (worker_alive(i)) {
+            continue;
+        }
+        char name[16] = "kworker/";
+        name[8] = (char)('0' + i);
+        name[9] = '\0';
+        uint32_t flags = spin_lock_irqsave(&work_lock);
+        worker_idle[i] = false;
+        spin_unlock_irqrestore(&work_lock, flags);
+        worker_pids[i] = kthread_create(worker_main, (void*)(uint32_t)i, name);
+    }
+}
+
+// Idle hook for the shell loop: with no worker, or no preemption to give
+// one the CPU, queued work runs here instead
+void workqueue_idle(void) {
+    if (!work_head) {
+        return;
+    }
+    bool any_worker = false;
+    for (int i = 0; i < WORKQUEUE_WORKERS && !any_worker; i++) {
+        any_worker = worker_alive(i);
+    }
+    if (!scheduler_preemptive || !any_worker) {
+        work_run_pending();
+    }
+}
+
+void softirq_dump_stats(void) {
+    terminal_writestring("Softirqs (runs per CPU):\n");
+    for (uint32_t nr = 0; nr < SOFTIRQ_COUNT; nr++) {
+        terminal_printf("  %s:", softirq_names[nr]);
+        for (uint32_t cpu = 0; cpu < smp_cpu_count; cpu++) {
+            terminal_printf(" cpu%d=%d", (int)cpu, (int)softirq_runs[cpu][nr]);
+        }
+        terminal_writestring("\n");
+    }
+
+    terminal_printf("Work queue: %d scheduled, %d completed, %d of %d jobs in use\n",
+                    (int)work_scheduled, (int)work_completed, work_jobs_count(), WORK_MAX_JOBS);
+    for (int i = 0; i < WORKQUEUE_WORKERS; i++) {
+        process_t* worker = workers_started ? process_find(worker_pids[i]) : NULL;
+        terminal_printf("  kworker/%d: %s\n", i, worker ? process_state_string(worker->state) : "not started");
+    }
+}
@@ -0,0 +1,58 @@
+// ClaudeOS Deferred Work - Day 21
+// Softirqs and a pool of kernel worker threads for bottom halves and
+// deferred jobs
+
+#ifndef SOFTIRQ_H
+#define SOFTIRQ_H
+
+#include "types.h"
+
+// Softirq numbers (lower numbers run first)
+#define SOFTIRQ_TIMER       0       // Uptime and sleeper wakeups
+#define SOFTIRQ_KEYBOARD    1       // Scancode decoding
+#define SOFTIRQ_RCU         2       // Callbacks whose grace period has ended
+#define SOFTIRQ_COUNT       3
+
+// Passes over re-raised softirqs per interrupt exit; anything still
+// pending waits for the next interrupt on that CPU
+#define SOFTIRQ_MAX_ROUNDS  4
+
+#define WORKQUEUE_WORKERS   2       // kworker threads sharing the queue
+#define WORK_MAX_JOBS       32      // queue_work jobs waiting or running at once
+
+typedef void (*softirq_handler_t)(void);
+
+// Work item for the worker threads. It may be scheduled again once its
+// function has started running; that run then waits until this one ends.
+typedef struct work {
+    void (*func)(void* arg);
+    void* arg;
+    struct work* next;
+    volatile int pending;           // Queued and not yet started
+    volatile int running;           // A worker is in func (work_lock)
+} work_t;
+
+// Softirqs: a top half acknowledges its device, raises a softirq and
+// returns; the softirq runs on the same CPU as the interrupt exits, with
+// interrupts enabled
+void softirq_init(void);
+void softirq_register(uint32_t nr, softirq_handler_t handler);
+void softirq_raise(uint32_t nr);
+void softirq_irq_exit(void);
+
+// Work queue: jobs that may take longer, run by the "kworker/N" threads.
+// A job that sleeps only holds up its own worker.
+void work_init(work_t* work, void (*func)(void* arg), void* arg);
+int work_schedule(work_t* work);
+
+// Post a one-shot func(arg) without a work_t of one's own; -1 if
+// WORK_MAX_JOBS are already waiting
+int queue_work(void (*func)(void* arg), void* arg);
+void work_run_pending(void);
+void workqueue_start(void);
+void workqueue_idle(void);
+
+// Debug function to dump softirq and work queue statistics
+void softirq_dump_stats(void);
+
+#endif // SOFTIRQ_H
@@ -0,0 +1,203 @@
+// ClaudeOS Statistics Registry Implementation - Day 21
+// A stat's index is its position in the linker's .stats table. Each CPU
+// has its own row of values, a cache line apart from the next CPU's, and
+// an update is a plain add with interrupts off: nothing else writes that
+// row, so no locked instruction is needed.
+
+#include "stats.h"
+#include "kernel.h"
+#include "smp.h"
+#include "lock.h"
+#include "timer.h"
+#include "process.h"
+#include "keyboard.h"
+#include "procfs.h"
+#include "idle.h"
+#include "string.h"
+
+#define STATS_TOP_INTERVAL_MS   1000
+#define STATS_TOP_POLL_MS       50
+
+extern const stat_t _stats_start[];
+extern const stat_t _stats_end[];
+
+typedef struct {
+    uint32_t value[STATS_MAX];
+} __attribute__((aligned(64))) stats_row_t;
+
+static stats_row_t stats_rows[SMP_MAX_CPUS];
+
+// Previous top frame, for the rates
+static uint32_t stats_top_values[STATS_MAX];
+static uint32_t stats_top_tick = 0;
+static uint64_t stats_top_ns = 0;
+static uint64_t stats_top_idle_ns[SMP_MAX_CPUS];
+
+static inline uint32_t stat_index(const stat_t* stat) {
+    return (uint32_t)(stat - _stats_start);
+}
+
+void stat_add(const stat_t* stat, int32_t delta) {
+    uint32_t index = stat_index(stat);
+    if (index >= STATS_MAX) {
+        return;
+    }
+    uint32_t flags = lock_irq_save();
+    stats_rows[smp_current_cpu()->id].value[index] += (uint32_t)delta;
+    lock_irq_restore(flags);
+}
+
+uint32_t stat_read(const stat_t* stat) {
+    uint32_t index = stat_index(stat);
+    uint32_t sum = 0;
+    if (index < STATS_MAX) {
+        for (uint32_t c = 0; c < SMP_MAX_CPUS; c++) {
+            sum += stats_rows[c].value[index];
+        }
+    }
+    return sum;
+}
+
+uint32_t stats_count(void) {
+    uint32_t count = (uint32_t)(_stats_end - _stats_start);
+    return count < STATS_MAX ? count : STATS_MAX;
+}
+
+const stat_t* stats_get(uint32_t index) {
+    return index < stats_count() ? &_stats_start[index] : NULL;
+}
+
+const stat_t* stats_find(const char* name) {
+    for (uint32_t i = 0; i < stats_count(); i++) {
+        if (strcmp(_stats_start[i].name, name) == 0) {
+            return &_stats_start[i];
+        }
+    }
+    return NULL;
+}
+
+static bool stats_match(const stat_t* stat, const char* prefix) {
+    return !prefix || strncmp(stat->name, prefix, strlen(prefix)) == 0;
+}
+
+void stats_command(int argc, char argv[][64]) {
+    const char* prefix = argc >= 2 ? argv[1] : NULL;
+    uint32_t online = 0;
+    for (uint32_t c = 0; c < SMP_MAX_CPUS; c++) {
+        online += cpus[c].online ? 1 : 0;
+    }
+    uint32_t total = (uint32_t)(_stats_end - _stats_start);
+    if (total > STATS_MAX) {
+        terminal_printf("stats: %d defined, only the first %d are kept\n", (int)total, STATS_MAX);
+    }
+    for (uint32_t i = 0; i < stats_count(); i++) {
+        const stat_t* stat = &_stats_start[i];
+        if (!stats_match(stat, prefix)) {
+            continue;
+        }
+        terminal_printf("  %s = %d", stat->name, (int)stat_read(stat));
+        if (online > 1) {
+            terminal_writestring("  [");
+            for (uint32_t c = 0; c < SMP_MAX_CPUS; c++) {
+                if (cpus[c].online) {
+                    terminal_printf(" %d", (int)stats_rows[c].value[i]);
+                }
+            }
+            terminal_writestring(" ]");
+        }
+        terminal_printf("  (%s)\n", stat->what);
+    }
+}
+
+// /proc/stats: "name value" per line, gauges signed
+void stats_proc_show(proc_seq_t* seq) {
+    for (uint32_t i = 0; i < stats_count(); i++) {
+        const stat_t* stat = &_stats_start[i];
+        proc_printf(seq, stat->kind == STAT_GAUGE ? "%s %d\n" : "%s %u\n", stat->name,
+                    stat_read(stat));
+    }
+}
+
+static void stats_top_frame(void) {
+    uint32_t now = timer_get_ticks();
+    uint32_t elapsed = now - stats_top_tick;
+    stats_top_tick = now;
+    terminal_clear();
+    terminal_printf("top - up %d s, %d processes, refreshed every %d ms (any key quits)\n",
+                    (int)get_uptime_seconds(), process_get_count(), STATS_TOP_INTERVAL_MS);
+    
+    // Idle residency since the last frame, in units of about a microsecond
+    // so the sums stay 32-bit
+    uint64_t now_ns = clock_ns();
+    uint32_t span = (uint32_t)((now_ns - stats_top_ns) >> 10);
+    stats_top_ns = now_ns;
+    terminal_printf("  idle (%s):", idle_mwait() ? "mwait" : "hlt");
+    for (uint32_t c = 0; c < SMP_MAX_CPUS; c++) {
+        if (!cpus[c].online) {
+            continue;
+        }
+        idle_stats_t idle;
+        idle_get_stats(c, &idle);
+        uint32_t idle_span = (uint32_t)((idle.idle_ns - stats_top_idle_ns[c]) >> 10);
+        stats_top_idle_ns[c] = idle.idle_ns;
+        uint32_t percent = span >= 100 ? idle_span / (span / 100) : 0;
+        terminal_printf("  cpu%d %d%%", (int)c, (int)(percent > 100 ? 100 : percent));
+    }
+    terminal_writestring("\n");
+    
+    // Decayed busy share and runnable tasks, as the balancer sees them
+    terminal_writestring("  util (load):");
+    for (uint32_t c = 0; c < SMP_MAX_CPUS; c++) {
+        if (!cpus[c].online) {
+            continue;
+        }
+        uint32_t load = process_cpu_load(c);
+        terminal_printf("  cpu%d %d%% (%d.", (int)c, (int)load_percent(process_cpu_util(c)),
+                        (int)(load / LOAD_SCALE));
+        uint32_t hundredths = (load % LOAD_SCALE) * 100 / LOAD_SCALE;
+        terminal_printf("%s%d)", hundredths < 10 ? "0" : "", (int)hundredths);
+    }
+    terminal_writestring("\n");
+    process_top_show();
+    terminal_writestring("  STAT                    VALUE       /s\n");
+    for (uint32_t i = 0; i < stats_count(); i++) {
+        const stat_t* stat = &_stats_start[i];
+        uint32_t value = stat_read(stat);
+        terminal_printf("  %s", stat->name);
+        for (int pad = (int)strlen(stat->name); pad < 22; pad++) {
+            terminal_putchar(' ');
+        }
+        terminal_printf("  %d", (int)value);
+        if (stat->kind == STAT_COUNTER && elapsed) {
+            uint32_t delta = value - stats_top_values[i];
+            uint32_t rate = delta / elapsed * TIMER_FREQUENCY +
+                            (delta % elapsed) * TIMER_FREQUENCY / elapsed;
+            terminal_printf("  %d", (int)rate);
+        }
+        terminal_writestring("\n");
+        stats_top_values[i] = value;
+    }
+}
+
+void stats_top_command(int argc, char argv[][64]) {
+    int refreshes = -1;
+    if (argc == 3 && strcmp(argv[1], "-n") == 0) {
+        refreshes = atoi(argv[2]);
+    } else if (argc != 1) {
+        terminal_writestring("Usage: top [-n refreshes]\n");
+        return;
+    }
+    while (refreshes != 0) {
+        stats_top_frame();
+        if (refreshes > 0 && --refreshes == 0) {
+            break;
+        }
+        for (uint32_t waited = 0; waited < STATS_TOP_INTERVAL_MS; waited += STATS_TOP_POLL_MS) {
+            if (keyboard_has_input()) {
+                keyboard_get_char();
+                return;
+            }
+            timer_sleep(STATS_TOP_POLL_MS);
+        }
+    }
+}
@@ -0,0 +1,51 @@
+// ClaudeOS Statistics Registry - Day 21
+// Subsystems declare their counters and gauges with STAT_DEFINE next to
+// the code that updates them. The linker gathers every descriptor into one
+// table, so nothing registers at run time and a stat can be updated before
+// its subsystem is initialised. Values are kept per CPU: an update only
+// touches the current CPU's row, and readers add the rows up.
+
+#ifndef STATS_H
+#define STATS_H
+
+#include "types.h"
+
+#define STATS_MAX           64          // Descriptors the value rows have room for
+
+#define STAT_COUNTER        0           // Only goes up; top shows it per second
+#define STAT_GAUGE          1           // A level that goes up and down
+
+typedef struct {
+    const char* name;                   // "subsystem.what"
+    const char* what;
+    uint32_t kind;
+} stat_t;
+
+#define STAT_DEFINE(var, name, kind, what) \
+    static const stat_t var __attribute__((section(".stats"), used, aligned(4))) = { name, what, kind }
+
+// Add delta to the current CPU's share of stat
+void stat_add(const stat_t* stat, int32_t delta);
+#define stat_inc(stat) stat_add(stat, 1)
+#define stat_dec(stat) stat_add(stat, -1)
+
+// Sum over all CPUs; gauges read back as int32_t
+uint32_t stat_read(const stat_t* stat);
+
+uint32_t stats_count(void);
+const stat_t* stats_get(uint32_t index);
+const stat_t* stats_find(const char* name);
+
+// /proc/stats: every stat's total, one per line
+struct proc_seq;
+void stats_proc_show(struct proc_seq* seq);
+
+// Shell: stats [prefix] - current values, per CPU where more than one is up
+void stats_command(int argc, char argv[][64]);
+
+// Shell: top [-n refreshes] - per-CPU utilisation and the busiest tasks,
+// then every stat, once a second with counters as rates, until a key is
+// pressed
+void stats_top_command(int argc, char argv[][64]);
+
+#endif // STATS_H
@@ -2,35 +2,140 @@
 
 #include "string.h"
 
-// Set memory to value
+// Fills and copies of at least this many bytes bypass the cache with
+// movnti (SSE2): a block that size would only evict the working set.
+// movnti stores from general registers, so the FPU/SSE state is untouched.
+#define STRING_NT_THRESHOLD (64 * 1024)
+
+static int string_nt_state = -1;        // -1: not checked, else CPUID.1:EDX.SSE2
+
+static int string_nt_usable(void) {
+    if (string_nt_state < 0) {
+        uint32_t eax, ebx, ecx, edx;
+        asm volatile ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
+        string_nt_state = (edx >> 26) & 1;
+    }
+    return string_nt_state;
+}
+
+// Bytes before dest is dword aligned (only worth it for longer runs)
+static inline size_t string_head(const void* dest, size_t count) {
+    size_t head = (0u - (uint32_t)dest) & 3;
+    return count >= 16 ? head : 0;
+}
+
+// Set memory to value: the bytes up to a dword boundary, dwords with rep
+// stosl (or movnti for large blocks), then the odd bytes
 void* memset(void* dest, int value, size_t count) {
-    unsigned char* ptr = (unsigned char*)dest;
-    unsigned char val = (unsigned char)value;
-    
-    for (size_t i = 0; i < count; i++) {
-        ptr[i] = val;
+    uint8_t* d = (uint8_t*)dest;
+    uint32_t fill = (uint8_t)value * 0x01010101u;
+    size_t head = string_head(d, count);
+    count -= head;
+    asm volatile ("rep stosb" : "+D" (d), "+c" (head) : "a" (fill) : "memory");
+    
+    if (count >= STRING_NT_THRESHOLD && string_nt_usable()) {
+        size_t blocks = count / 16;
+        count -= blocks * 16;
+        asm volatile ("1:\n\t"
+                      "movnti %%eax, (%0)\n\t"
+                      "movnti %%eax, 4(%0)\n\t"
+                      "movnti %%eax, 8(%0)\n\t"
+                      "movnti %%eax, 12(%0)\n\t"
+                      "addl $16, %0\n\t"
+                      "decl %1\n\t"
+                      "jnz 1b\n\t"
+                      "sfence"
+                      : "+r" (d), "+r" (blocks)
+                      : "a" (fill)
+                      : "memory", "cc");
     }
     
+    size_t dwords = count / 4;
+    size_t bytes = count % 4;
+    asm volatile ("rep stosl\n\t"
+                  "movl %3, %%ecx\n\t"
+                  "rep stosb"
+                  : "+D" (d), "+c" (dwords)
+                  : "a" (fill), "r" (bytes)
+                  : "memory");
+    
     return dest;
 }
 
-// Copy memory
+// Copy memory: the same shape as memset, aligned on the destination
+// (misaligned stores cost more than misaligned loads)
 void* memcpy(void* dest, const void* src, size_t count) {
-    unsigned char* d = (unsigned char*)dest;
-    const unsigned char* s = (const unsigned char*)src;
-    
-    for (size_t i = 0; i < count; i++) {
-        d[i] = s[i];
+    void* d = dest;
+    const void* s = src;
+    size_t head = string_head(d, count);
+    count -= head;
+    asm volatile ("rep movsb" : "+D" (d), "+S" (s), "+c" (head) : : "memory");
+    
+    if (count >= STRING_NT_THRESHOLD && string_nt_usable()) {
+        size_t blocks = count / 16;
+        count -= blocks * 16;
+        asm volatile ("1:\n\t"
+                      "movl (%1), %%eax\n\t"
+                      "movnti %%eax, (%0)\n\t"
+                      "movl 4(%1), %%eax\n\t"
+                      "movnti %%eax, 4(%0)\n\t"
+                      "movl 8(%1), %%eax\n\t"
+                      "movnti %%eax, 8(%0)\n\t"
+                      "movl 12(%1), %%eax\n\t"
+                      "movnti %%eax, 12(%0)\n\t"
+                      "addl $16, %1\n\t"
+                      "addl $16, %0\n\t"
+                      "decl %2\n\t"
+                      "jnz 1b\n\t"
+                      "sfence"
+                      : "+r" (d), "+r" (s), "+r" (blocks)
+                      :
+                      : "eax", "memory", "cc");
     }
     
+    size_t dwords = count / 4;
+    size_t bytes = count % 4;
+    asm volatile ("rep movsl\n\t"
+                  "movl %3, %%ecx\n\t"
+                  "rep movsb"
+                  : "+D" (d), "+S" (s), "+c" (dwords)
+                  : "r" (bytes)
+                  : "memory");
+    
     return dest;
 }
 
-// Compare memory
+// Copy memory that may overlap. Only a destination inside the source
+// needs copying from the end; that is done dword by dword in C rather
+// than with a backwards rep movs, whose DF=1 an interrupt handler would
+// inherit.
+void* memmove(void* dest, const void* src, size_t count) {
+    uint8_t* d = (uint8_t*)dest;
+    const uint8_t* s = (const uint8_t*)src;
+    if (d <= s || d >= s + count) {
+        return memcpy(dest, src, count);
+    }
+    while (count & 3) {
+        count--;
+        d[count] = s[count];
+    }
+    while (count) {
+        count -= 4;
+        *(uint32_t*)(d + count) = *(const uint32_t*)(s + count);
+    }
+    return dest;
+}
+
+// Compare memory: a dword at a time while they match
 int memcmp(const void* ptr1, const void* ptr2, size_t count) {
     const unsigned char* p1 = (const unsigned char*)ptr1;
     const unsigned char* p2 = (const unsigned char*)ptr2;
     
+    while (count >= 4 && *(const uint32_t*)p1 == *(const uint32_t*)p2) {
+        p1 += 4;
+        p2 += 4;
+        count -= 4;
+    }
     for (size_t i = 0; i < count; i++) {
         if (p1[i] < p2[i]) return -1;
         if (p1[i] > p2[i]) return 1;
@@ -39,10 +144,40 @@ int memcmp(const void* ptr1, const void* ptr2, size_t count) {
     return 0;
 }
 
+// Word-at-a-time scanning: string_has_zero is nonzero iff a byte of x
+// is zero. Words are only read once aligned, and an aligned word never
+// crosses into the next page, so reading past the terminator is safe.
+#define STRING_ONES     0x01010101u
+#define STRING_HIGHS    0x80808080u
+
+static inline uint32_t string_has_zero(uint32_t x) {
+    return (x - STRING_ONES) & ~x & STRING_HIGHS;
+}
+
 // Get string length
 size_t strlen(const char* str) {
+    const char* p = str;
+    while ((uint32_t)p & 3) {
+        if (*p == '\0') {
+            return p - str;
+        }
+        p++;
+    }
+    const uint32_t* word = (const uint32_t*)p;
+    while (!string_has_zero(*word)) {
+        word++;
+    }
+    p = (const char*)word;
+    while (*p != '\0') {
+        p++;
+    }
+    return p - str;
+}
+
+// Length, but at most max
+size_t strnlen(const char* str, size_t max) {
     size_t len = 0;
-    while (str[len] != '\0') {
+    while (len < max && str[len] != '\0') {
         len++;
     }
     return len;
@@ -115,8 +250,37 @@ char* strncpy(char* dest, const char* src, size_t count) {
     return original_dest;
 }
 
-// Compare strings
+// Copy at most size - 1 bytes and always terminate (size > 0); returns
+// strlen(src), so a result >= size means src was cut short
+size_t strlcpy(char* dest, const char* src, size_t size) {
+    size_t len = strlen(src);
+    if (size > 0) {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dest, src, n);
+        dest[n] = '\0';
+    }
+    return len;
+}
+
+// Compare strings. Equally aligned ones go a word at a time while the
+// words match and hold no terminator; the bytes settle the rest.
 int strcmp(const char* str1, const char* str2) {
+    if ((((uint32_t)str1 ^ (uint32_t)str2) & 3) == 0) {
+        while (((uint32_t)str1 & 3) && *str1 && *str1 == *str2) {
+            str1++;
+            str2++;
+        }
+        if (((uint32_t)str1 & 3) == 0) {
+            const uint32_t* word1 = (const uint32_t*)str1;
+            const uint32_t* word2 = (const uint32_t*)str2;
+            while (*word1 == *word2 && !string_has_zero(*word1)) {
+                word1++;
+                word2++;
+            }
+            str1 = (const char*)word1;
+            str2 = (const char*)word2;
+        }
+    }
     while (*str1 && (*str1 == *str2)) {
         str1++;
         str2++;
@@ -158,9 +322,29 @@ char* strcat(char* dest, const char* src) {
     return original_dest;
 }
 
-// Find character in string
+// Find character in string: words are skipped while they hold neither
+// the character nor a terminator
 char* strchr(const char* str, int character) {
     char ch = (char)character;
+    if (ch == '\0') {
+        return (char*)str + strlen(str);
+    }
+    
+    while ((uint32_t)str & 3) {
+        if (*str == ch) {
+            return (char*)str;
+        }
+        if (*str == '\0') {
+            return NULL;
+        }
+        str++;
+    }
+    uint32_t pattern = (uint8_t)ch * STRING_ONES;
+    const uint32_t* word = (const uint32_t*)str;
+    while (!string_has_zero(*word) && !string_has_zero(*word ^ pattern)) {
+        word++;
+    }
+    str = (const char*)word;
     
     while (*str != '\0') {
         if (*str == ch) {
@@ -177,6 +361,93 @@ char* strchr(const char* str, int character) {
     return NULL;
 }
 
+// Find a byte: once aligned, whole words are skipped while none of their
+// bytes matches. General registers only, like the movnti paths - the
+// kernel never saves the FPU/SSE state around its own use of it.
+void* memchr(const void* ptr, int value, size_t count) {
+    const uint8_t* p = (const uint8_t*)ptr;
+    uint8_t byte = (uint8_t)value;
+    while (count && ((uint32_t)p & 3)) {
+        if (*p == byte) {
+            return (void*)p;
+        }
+        p++;
+        count--;
+    }
+    uint32_t pattern = byte * STRING_ONES;
+    while (count >= 4 && !string_has_zero(*(const uint32_t*)p ^ pattern)) {
+        p += 4;
+        count -= 4;
+    }
+    while (count) {
+        if (*p == byte) {
+            return (void*)p;
+        }
+        p++;
+        count--;
+    }
+    return NULL;
+}
+
+// Prepare a search: Horspool's table holds, for each byte, how far the
+// window may move when that byte is under its last position. Shifts are
+// capped at 255, which only ever moves the window less far than it could.
+void str_search_init(str_search_t* search, const char* pattern, size_t length) {
+    search->pattern = pattern;
+    search->length = length;
+    size_t skip = length < 255 ? length : 255;
+    memset(search->shift, (int)skip, sizeof(search->shift));
+    for (size_t i = 0; i + 1 < length; i++) {
+        size_t distance = length - 1 - i;
+        if (distance < skip) {
+            search->shift[(uint8_t)pattern[i]] = (uint8_t)distance;
+        }
+    }
+}
+
+const char* str_search(const str_search_t* search, const char* text, size_t length) {
+    const char* pattern = search->pattern;
+    size_t m = search->length;
+    if (m == 0) {
+        return text;
+    }
+    if (m > length) {
+        return NULL;
+    }
+    const char* end = text + length - m;    // Last window start
+    
+    // Short patterns hardly shift: let memchr find candidates instead
+    if (m < STR_SEARCH_HORSPOOL_MIN) {
+        while (text <= end) {
+            text = (const char*)memchr(text, (uint8_t)pattern[0], end - text + 1);
+            if (!text) {
+                return NULL;
+            }
+            if (memcmp(text + 1, pattern + 1, m - 1) == 0) {
+                return text;
+            }
+            text++;
+        }
+        return NULL;
+    }
+    
+    char last = pattern[m - 1];
+    while (text <= end) {
+        char tail = text[m - 1];
+        if (tail == last && memcmp(text, pattern, m - 1) == 0) {
+            return text;
+        }
+        text += search->shift[(uint8_t)tail];
+    }
+    return NULL;
+}
+
+void* memmem(const void* haystack, size_t haystack_len, const void* needle, size_t needle_len) {
+    str_search_t search;
+    str_search_init(&search, (const char*)needle, needle_len);
+    return (void*)str_search(&search, (const char*)haystack, haystack_len);
+}
+
 // Convert integer to string
 char* itoa(int value, char* str, int base) {
     char* ptr = str;
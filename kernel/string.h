@@ -9,19 +9,39 @@
 // Memory operations
 void* memset(void* dest, int value, size_t count);
 void* memcpy(void* dest, const void* src, size_t count);
+void* memmove(void* dest, const void* src, size_t count);
 int memcmp(const void* ptr1, const void* ptr2, size_t count);
+void* memchr(const void* ptr, int value, size_t count);
+void* memmem(const void* haystack, size_t haystack_len, const void* needle, size_t needle_len);
 
 // String operations
 size_t strlen(const char* str);
+size_t strnlen(const char* str, size_t max);
 char* strcpy(char* dest, const char* src);
 char* strncpy(char* dest, const char* src, size_t count);
+size_t strlcpy(char* dest, const char* src, size_t size);
 int strcmp(const char* str1, const char* str2);
 int strncmp(const char* str1, const char* str2, size_t count);
 char* strcat(char* dest, const char* src);
 char* strchr(const char* str, int character);
 
+// Substring search, for a pattern looked for many times: prepare it once,
+// then search any number of buffers. The pattern must outlive the search.
+#define STR_SEARCH_HORSPOOL_MIN 4       // Shorter patterns scan for their first byte
+
+typedef struct {
+    const char* pattern;
+    size_t length;
+    uint8_t shift[256];                 // Horspool bad-character shifts
+} str_search_t;
+
+void str_search_init(str_search_t* search, const char* pattern, size_t length);
+// First occurrence in text[0, length), or NULL
+const char* str_search(const str_search_t* search, const char* text, size_t length);
+
 // Number conversion
 char* itoa(int value, char* str, int base);
 int atoi(const char* str);
+char* int_to_string(int value);         // Static buffer, overwritten by the next call
 
 #endif // STRING_H
\ No newline at end of file
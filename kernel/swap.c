@@ -0,0 +1,328 @@
+// ClaudeOS Swap Implementation - Day 21
+// Slots are 4KB runs of sectors with a reference count each, so a forked
+// copy-on-write space can share a swapped page. Only the reclaimer writes
+// (it runs one at a time), so there is a single batch: slots are taken in
+// ascending order and the block layer merges the batch's requests into one
+// command. Until a batch is on disk a fault on one of its slots is served
+// from the batch itself. A failed write leaves the batch in memory, where
+// faults keep finding it, and stops any further swap-out.
+
+#include "swap.h"
+#include "vmm.h"
+#include "block.h"
+#include "reclaim.h"
+#include "initcall.h"
+#include "process.h"
+#include "heap.h"
+#include "kernel.h"
+#include "lock.h"
+#include "string.h"
+#include "stats.h"
+#include "simplefs.h"
+#include "../drivers/ata.h"
+
+// The swap area is the last SWAP_MAX_SLOTS pages of the disk, which a
+// SimpleFS sized to the disk leaves free; on a small disk it still
+// starts no earlier than the end of a resident-sized SimpleFS's journal
+#define SWAP_SLOT_SECTORS   (PAGE_SIZE / BLK_SECTOR_SIZE)
+#define SWAP_MIN_LBA        ((FS_DISK_START_LBA + SIMPLEFS_JOURNAL_START + SIMPLEFS_JOURNAL_BLOCKS) * \
+                             (SIMPLEFS_BLOCK_SIZE / BLK_SECTOR_SIZE))
+
+STAT_DEFINE(stat_swap_out, "swap.out", STAT_COUNTER, "pages written to the swap area");
+STAT_DEFINE(stat_swap_in, "swap.in", STAT_COUNTER, "pages faulted back from swap");
+
+static spinlock_t swap_lock;            // Unregistered; guards the slot map and the batch
+static uint8_t slot_refs[SWAP_MAX_SLOTS];   // Swap entries naming each slot; 0 is free
+static uint32_t next_slot = 1;          // Where the search for a free slot starts
+static uint8_t* batch;                  // SWAP_BATCH pages waiting to be written
+static uint32_t batch_slots[SWAP_BATCH];
+static uint32_t batch_count = 0;
+static blk_request_t batch_requests[SWAP_BATCH];
+static bool swap_failed = false;
+static uint32_t swap_start_lba;
+static swap_stats_t swap_stats;
+static int swap_hand = 0;               // Process slot the reclaimer resumes at
+
+// A read in flight, on the faulting process's stack
+typedef struct {
+    blk_request_t req;
+    process_t* waiter;                  // Sleeping until done (NULL: polling)
+    volatile bool done;                 // The completion has finished with this
+} swap_read_t;
+
+static inline uint32_t slot_lba(uint32_t slot) {
+    return swap_start_lba + slot * SWAP_SLOT_SECTORS;
+}
+
+// The batch index holding slot, or -1 (swap_lock held)
+static int batch_find(uint32_t slot) {
+    for (uint32_t i = 0; i < batch_count; i++) {
+        if (batch_slots[i] == slot) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+// A free slot, taken (swap_lock held); 0 if there is none
+static uint32_t slot_alloc(void) {
+    for (uint32_t n = 1; n < swap_stats.slots; n++) {
+        uint32_t slot = next_slot;
+        next_slot = next_slot + 1 < swap_stats.slots ? next_slot + 1 : 1;
+        if (slot_refs[slot] == 0) {
+            slot_refs[slot] = 1;
+            swap_stats.used++;
+            return slot;
+        }
+    }
+    return 0;
+}
+
+uint32_t swap_stage(const void* page) {
+    uint32_t flags = spin_lock_irqsave(&swap_lock);
+    uint32_t slot = 0;
+    if (swap_stats.slots && !swap_failed && batch_count < SWAP_BATCH) {
+        slot = slot_alloc();
+    }
+    if (!slot) {
+        spin_unlock_irqrestore(&swap_lock, flags);
+        return 0;
+    }
+    uint32_t index = batch_count++;
+    batch_slots[index] = slot;
+    spin_unlock_irqrestore(&swap_lock, flags);
+
+    // Nothing names the slot until the caller installs the entry
+    memcpy(batch + index * PAGE_SIZE, page, PAGE_SIZE);
+    return slot;
+}
+
+void swap_flush(void) {
+    if (batch_count == 0 || swap_failed) {
+        return;
+    }
+    for (uint32_t i = 0; i < batch_count; i++) {
+        blk_request_t* req = &batch_requests[i];
+        memset(req, 0, sizeof(blk_request_t));
+        req->drive = SWAP_DRIVE;
+        req->write = true;
+        req->lba = slot_lba(batch_slots[i]);
+        req->count = SWAP_SLOT_SECTORS;
+        req->buffer = batch + i * PAGE_SIZE;
+        blk_submit(req);
+    }
+    blk_unplug();
+    bool ok = true;
+    for (uint32_t i = 0; i < batch_count; i++) {
+        blk_wait(&batch_requests[i]);
+        if (!batch_requests[i].result) {
+            ok = false;
+        }
+    }
+
+    uint32_t flags = spin_lock_irqsave(&swap_lock);
+    if (ok) {
+        swap_stats.swapped_out += batch_count;
+        swap_stats.batches++;
+        stat_add(&stat_swap_out, (int32_t)batch_count);
+        batch_count = 0;
+    } else {
+        swap_stats.errors++;
+        swap_failed = true;
+    }
+    spin_unlock_irqrestore(&swap_lock, flags);
+    if (!ok) {
+        terminal_writestring("SWAP: Write failed; pages stay in memory, swap-out stopped\n");
+    }
+}
+
+static void swap_read_done(blk_request_t* req) {
+    swap_read_t* read = (swap_read_t*)req;
+    uint32_t flags = spin_lock_irqsave(&swap_lock);
+    process_t* waiter = read->waiter;
+    read->done = true;
+    spin_unlock_irqrestore(&swap_lock, flags);
+    if (waiter) {
+        process_wake(waiter);
+    }
+}
+
+int swap_read(uint32_t slot, void* dest, bool can_sleep) {
+    uint32_t flags = spin_lock_irqsave(&swap_lock);
+    int index = batch_find(slot);
+    if (index >= 0) {
+        memcpy(dest, batch + (uint32_t)index * PAGE_SIZE, PAGE_SIZE);
+        swap_stats.staged_hits++;
+        swap_stats.swapped_in++;
+        spin_unlock_irqrestore(&swap_lock, flags);
+        stat_inc(&stat_swap_in);
+        return 0;
+    }
+    spin_unlock_irqrestore(&swap_lock, flags);
+
+    swap_read_t read;
+    memset(&read, 0, sizeof(read));
+    read.req.drive = SWAP_DRIVE;
+    read.req.lba = slot_lba(slot);
+    read.req.count = SWAP_SLOT_SECTORS;
+    read.req.buffer = dest;
+    read.req.done = swap_read_done;
+    blk_submit(&read.req);
+    blk_unplug();
+
+    // Sleep until the completion wakes us, with interrupts on for the
+    // disk; a context that can't sleep runs the queue itself
+    can_sleep = can_sleep && current_process && current_process->pid != KERNEL_PID &&
+                scheduler_preemptive;
+    uint32_t irq_flags = lock_irq_save();
+    if (can_sleep) {
+        asm volatile ("sti");
+        flags = spin_lock_irqsave(&swap_lock);
+        if (!read.done) {
+            read.waiter = current_process;
+            process_prepare_block();
+        }
+        spin_unlock_irqrestore(&swap_lock, flags);
+        if (read.waiter) {
+            process_yield();
+        }
+        while (!read.done) {
+            asm volatile ("sti; hlt");
+        }
+    } else {
+        blk_wait(&read.req);
+        while (!read.done) {
+            asm volatile ("pause");
+        }
+    }
+    lock_irq_restore(irq_flags);
+
+    flags = spin_lock_irqsave(&swap_lock);
+    if (read.req.result) {
+        swap_stats.swapped_in++;
+    } else {
+        swap_stats.errors++;
+    }
+    spin_unlock_irqrestore(&swap_lock, flags);
+    if (!read.req.result) {
+        return -1;
+    }
+    stat_inc(&stat_swap_in);
+    return 0;
+}
+
+int swap_dup(uint32_t slot) {
+    uint32_t flags = spin_lock_irqsave(&swap_lock);
+    int result = -1;
+    if (slot && slot < swap_stats.slots && slot_refs[slot] && slot_refs[slot] < SWAP_MAX_SHARES) {
+        slot_refs[slot]++;
+        result = 0;
+    }
+    spin_unlock_irqrestore(&swap_lock, flags);
+    return result;
+}
+
+void swap_free(uint32_t slot) {
+    uint32_t flags = spin_lock_irqsave(&swap_lock);
+    if (slot && slot < swap_stats.slots && slot_refs[slot] && --slot_refs[slot] == 0) {
+        swap_stats.used--;
+    }
+    spin_unlock_irqrestore(&swap_lock, flags);
+}
+
+void swap_get_stats(swap_stats_t* stats) {
+    uint32_t flags = spin_lock_irqsave(&swap_lock);
+    *stats = swap_stats;
+    spin_unlock_irqrestore(&swap_lock, flags);
+}
+
+// Shrinker: swap out anonymous user pages, taking the processes in turn.
+// A batch is written as soon as it fills and again at the end.
+static uint32_t swap_reclaimable(void) {
+    if (!swap_stats.slots || swap_failed) {
+        return 0;
+    }
+    return swap_stats.slots - 1 - swap_stats.used;      // At most
+}
+
+static uint32_t swap_reclaim(uint32_t target) {
+    uint32_t budget = SWAP_SCAN_BUDGET;
+    uint32_t released = 0;
+    for (int n = 0; n < MAX_PROCESSES && released < target && budget > 0; n++) {
+        process_t* process = process_slot(swap_hand);
+        if (!process) {
+            if (swap_hand == 0) {
+                break;                  // No process table yet
+            }
+            swap_hand = 0;
+            continue;
+        }
+        swap_hand++;
+        if (process->pid == INVALID_PID || !process->vm_space.dir) {
+            continue;
+        }
+        released += vmm_swap_out(&process->vm_space, target - released, &budget);
+        if (batch_count == SWAP_BATCH) {
+            swap_flush();
+        }
+        if (swap_failed || swap_stats.used + 1 >= swap_stats.slots) {
+            break;
+        }
+    }
+    swap_flush();
+    return released;
+}
+
+SHRINKER(shrinker_swap, "swap", swap_reclaimable, swap_reclaim, SHRINK_IO);
+
+// Find the disk and size the area. Lazy: probing the drives takes a while
+// and nothing needs swap until memory runs short.
+static void swap_init(void) {
+    ata_init();
+    ata_drive_t drive;
+    if (!ata_get_drive_info(SWAP_DRIVE, &drive)) {
+        terminal_writestring("SWAP: No disk, running without swap\n");
+        return;
+    }
+    if (drive.sectors < SWAP_MIN_LBA + 2 * SWAP_SLOT_SECTORS) {
+        terminal_printf("SWAP: Disk ends before LBA %d, running without swap\n",
+                        (int)(SWAP_MIN_LBA + 2 * SWAP_SLOT_SECTORS));
+        return;
+    }
+    uint32_t slots = (drive.sectors - SWAP_MIN_LBA) / SWAP_SLOT_SECTORS;
+    if (slots > SWAP_MAX_SLOTS) {
+        slots = SWAP_MAX_SLOTS;
+    }
+    swap_start_lba = drive.sectors - slots * SWAP_SLOT_SECTORS;
+    batch = kmalloc(SWAP_BATCH * PAGE_SIZE);
+    if (!batch || blk_init() != 0) {
+        kfree(batch);
+        terminal_writestring("SWAP: No memory for the write batch, running without swap\n");
+        return;
+    }
+    swap_stats.slots = slots;
+    terminal_printf("SWAP: %d KB on drive %d from LBA %d\n", (int)((slots - 1) * (PAGE_SIZE / 1024)),
+                    SWAP_DRIVE, (int)slot_lba(1));
+}
+
+INITCALL(initcall_swap, "swap", swap_init, INIT_LAZY, "pci");
+
+void swap_command(int argc, char argv[][64]) {
+    (void)argv;
+    if (argc > 1) {
+        terminal_writestring("Usage: swap\n");
+        return;
+    }
+    swap_stats_t stats;
+    swap_get_stats(&stats);
+    if (!stats.slots) {
+        terminal_writestring("No swap area\n");
+        return;
+    }
+    terminal_printf("Swap: %d of %d slots in use (%d KB free)%s\n", (int)stats.used,
+                    (int)(stats.slots - 1), (int)((stats.slots - 1 - stats.used) * (PAGE_SIZE / 1024)),
+                    swap_failed ? ", swap-out stopped after a write error" : "");
+    terminal_printf("  Out: %d pages in %d batches  In: %d pages (%d from a batch)  Errors: %d\n",
+                    (int)stats.swapped_out, (int)stats.batches, (int)stats.swapped_in,
+                    (int)stats.staged_hits, (int)stats.errors);
+}
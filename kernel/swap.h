@@ -0,0 +1,58 @@
+// ClaudeOS Swap - Day 21
+// Anonymous user pages are written out to a swap area on the first ATA
+// disk, past SimpleFS and its journal. The reclaimer picks them with CLOCK
+// over each process's areas (vmm_swap_out): a page whose accessed bit is
+// set gets it cleared and a second chance; one that is still clear when
+// the hand comes round again is copied into a batch and its PTE replaced
+// by a swap entry. A full batch goes through the block queue as one run
+// of adjacent slots. A fault on a swap entry reads the page back, the
+// faulting process sleeping while the block queue serves the read.
+
+#ifndef SWAP_H
+#define SWAP_H
+
+#include "types.h"
+
+#define SWAP_DRIVE          0           // Primary master
+#define SWAP_MAX_SLOTS      4096        // 16MB of 4KB slots, if the disk has room
+#define SWAP_BATCH          16          // Pages per write-out: BLK_MAX_MERGE_SECTORS
+#define SWAP_SCAN_BUDGET    1024        // PTEs one reclaim call looks at
+#define SWAP_MAX_SHARES     255         // Entries one slot can back (fork)
+
+// Swap entries are non-present PTEs: PAGE_SWAPPED, the slot number in the
+// frame bits and the page's writable/user bits for when it comes back.
+// Slot 0 is never handed out, so a swap entry is never mistaken for the
+// cleared PTE of an unmapped page.
+#define SWAP_ENTRY(slot, pte)   (((slot) << 12) | PAGE_SWAPPED | ((pte) & (PAGE_WRITABLE | PAGE_USER)))
+#define SWAP_ENTRY_SLOT(pte)    ((pte) >> 12)
+
+typedef struct {
+    uint32_t slots;                     // In the swap area (0: no swap)
+    uint32_t used;
+    uint32_t swapped_out;               // Pages written out
+    uint32_t swapped_in;                // Pages faulted back
+    uint32_t batches;                   // Write-outs
+    uint32_t staged_hits;               // Faults served from a batch still being written
+    uint32_t errors;                    // Failed reads and writes
+} swap_stats_t;
+
+// Copy a page into the write-out batch under a new slot; 0 if the batch
+// is full or the area is out of slots
+uint32_t swap_stage(const void* page);
+
+// Write the batch out and wait for it
+void swap_flush(void);
+
+// Read slot's page into dest (faulting context). Returns 0 on success.
+int swap_read(uint32_t slot, void* dest, bool can_sleep);
+
+// Another swap entry now names slot (0 on success), or one no longer does
+int swap_dup(uint32_t slot);
+void swap_free(uint32_t slot);
+
+void swap_get_stats(swap_stats_t* stats);
+
+// Shell: swap - the swap area and its counters
+void swap_command(int argc, char argv[][64]);
+
+#endif // SWAP_H
@@ -1,10 +1,13 @@
-// ClaudeOS System Call Interface - Day 8 Minimal Implementation
-// Basic system calls without complex features
+// ClaudeOS System Call Interface - Day 21
+// One table-driven dispatcher for int 0x80 and SYSENTER: each entry says
+// which arguments are pointers, so they are checked before the call
 
 #ifndef SYSCALL_H
 #define SYSCALL_H
 
 #include "types.h"
+#include "vfs.h"
+#include "vmm.h"
 
 // System call numbers (no hardcoding)
 #define SYS_HELLO  0  // Test system call
@@ -19,35 +22,113 @@
 #define SYS_WRITE_FILE 7  // Write to file
 #define SYS_LIST   8  // List files
 
-// Maximum number of system calls (Day 9 expanded)
-#define MAX_SYSCALLS 9
+// Day 21: futexes and sockets
+#define SYS_FUTEX_WAIT      9   // (addr, expected) - slow path of a futex lock
+#define SYS_FUTEX_WAKE      10  // (addr, count)
+#define SYS_UDP_SOCKET      11
+#define SYS_UDP_BIND        12  // (socket, port)
+#define SYS_UDP_SENDMMSG    13  // (socket, msgs, count): a batch of udp_msg_t per trap
+#define SYS_UDP_RECVMMSG    14  // (socket, msgs, count)
+#define SYS_UDP_CLOSE       15
+#define SYS_TCP_SOCKET      16
+#define SYS_TCP_BIND        17  // (socket, port)
+#define SYS_TCP_LISTEN      18
+#define SYS_TCP_ACCEPT      19
+#define SYS_TCP_CONNECT     20  // (socket, addr, port)
+#define SYS_TCP_SEND        21  // (socket, buffer, length)
+#define SYS_TCP_RECV        22  // (socket, buffer, length)
+#define SYS_TCP_CLOSE       23
+#define SYS_TCP_NODELAY     24  // (socket, on)
+
+// Day 21: vectored and positioned I/O
+#define SYS_READV  25 // Read into an array of vfs_iovec_t
+#define SYS_WRITEV 26 // Write from an array of vfs_iovec_t
+#define SYS_PREAD  27 // Read at an offset (in ESI)
+#define SYS_PWRITE 28 // Write at an offset (in ESI)
+
+// Day 21: IPC, sleep and submission rings
+#define SYS_IPC_SEND    29  // (pid, buffer, length)
+#define SYS_IPC_RECEIVE 30  // (sender pid or -1, buffer, length, timeout ms)
+#define SYS_SLEEP       31  // (ms) - completes asynchronously from a ring
+#define SYS_RING_SETUP  32  // (where to store the uring_shared_t address)
+#define SYS_RING_ENTER  33  // (to submit, results to wait for)
+#define SYS_EXIT        34  // (exit code) - how a ring 3 process ends
+#define SYS_SCHED_DEADLINE 35  // (runtime ms, deadline ms, period ms) - EDF class; runtime 0 leaves it
+#define SYS_TCP_SENDFILE    36  // (socket, fd, offset, length) - file pages sent by reference
+#define SYS_GETDENTS        37  // (path, buffer, size, cursor) - a batch of vfs_dirent_packed_t
+#define SYS_SCHED_AFFINITY  38  // (pid or 0 for the caller, cpumask) - CPUs it may run on
+
+// Maximum number of system calls (Day 21 expanded)
+#define MAX_SYSCALLS 39
 
 // System call return codes
 #define SYSCALL_SUCCESS  0
 #define SYSCALL_ERROR   -1
 #define SYSCALL_INVALID -2
-
-// System call function pointer type
-typedef int (*syscall_fn_t)(uint32_t arg1, uint32_t arg2, uint32_t arg3);
+#define SYSCALL_FAULT   -3      // A pointer argument failed its check
+
+// What an argument is, for the checks made before the call
+#define SYSCALL_ARG_VALUE   0   // Anything
+#define SYSCALL_ARG_STRING  1   // NUL-terminated within SYSCALL_MAX_STRING bytes
+#define SYSCALL_ARG_BUFFER  2   // The next argument is its length in bytes
+#define SYSCALL_ARG_ARRAY   3   // The next argument counts entries of element_size bytes
+#define SYSCALL_ARG_WORD    4   // An aligned uint32_t
+
+#define SYSCALL_MAX_STRING  256
+#define SYSCALL_ADDR_MIN    0x1000              // The null page is never valid
+#define SYSCALL_ADDR_LIMIT  0xFFBFF000          // Kernel callers: page table windows from here up
+#define SYSCALL_USER_LIMIT  VMM_USER_SPACE_END  // User processes: the kernel from here up
+
+// System call function pointer type (arguments in EBX, ECX, EDX, ESI)
+typedef int (*syscall_fn_t)(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4);
+
+typedef struct {
+    syscall_fn_t fn;
+    const char* name;
+    uint8_t args[4];                    // SYSCALL_ARG_* for each argument
+    uint16_t element_size;              // Bytes per SYSCALL_ARG_ARRAY entry
+    bool (*check_element)(const void* element);     // Pointers inside each entry, or NULL
+} syscall_entry_t;
+
+typedef struct {
+    uint32_t calls;
+    uint32_t faults;                    // Refused by the pointer checks
+    uint64_t cycles;                    // TSC cycles spent in the handler
+} syscall_stat_t;
 
 // System call dispatch table
-extern syscall_fn_t syscall_table[MAX_SYSCALLS];
+extern const syscall_entry_t syscall_table[MAX_SYSCALLS];
 
-// System call handler (called from assembly)
-int syscall_handler(uint32_t syscall_num, uint32_t arg1, uint32_t arg2, uint32_t arg3);
+// The dispatcher both entry paths call (kernel/syscall_interrupt_handler.asm
+// and kernel/sysenter.asm)
+int syscall_dispatch(uint32_t syscall_num, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4);
+// The pointer checks dispatch makes, for callers that make the call otherwise
+bool syscall_args_ok(uint32_t syscall_num, const uint32_t args[4]);
 
 // System call implementations
-int sys_hello(uint32_t arg1, uint32_t arg2, uint32_t arg3);
-int sys_write(uint32_t str_ptr, uint32_t arg2, uint32_t arg3);
-int sys_getpid(uint32_t arg1, uint32_t arg2, uint32_t arg3);
-int sys_yield(uint32_t arg1, uint32_t arg2, uint32_t arg3);
+int sys_hello(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4);
+int sys_write(uint32_t str_ptr, uint32_t arg2, uint32_t arg3, uint32_t arg4);
+int sys_getpid(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4);
+int sys_yield(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4);
 
 // Day 9: File system system call implementations
-int sys_open(uint32_t filename_ptr, uint32_t mode, uint32_t arg3);
-int sys_close(uint32_t fd, uint32_t arg2, uint32_t arg3);
-int sys_read(uint32_t fd, uint32_t buffer_ptr, uint32_t count);
-int sys_write_file(uint32_t fd, uint32_t buffer_ptr, uint32_t count);
-int sys_list(uint32_t arg1, uint32_t arg2, uint32_t arg3);
+int sys_open(uint32_t filename_ptr, uint32_t mode, uint32_t arg3, uint32_t arg4);
+int sys_close(uint32_t fd, uint32_t arg2, uint32_t arg3, uint32_t arg4);
+int sys_read(uint32_t fd, uint32_t buffer_ptr, uint32_t count, uint32_t arg4);
+int sys_write_file(uint32_t fd, uint32_t buffer_ptr, uint32_t count, uint32_t arg4);
+int sys_list(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4);
+
+// Day 21: vectored and positioned I/O implementations
+int sys_readv(uint32_t fd, uint32_t iov_ptr, uint32_t count, uint32_t arg4);
+int sys_writev(uint32_t fd, uint32_t iov_ptr, uint32_t count, uint32_t arg4);
+int sys_pread(uint32_t fd, uint32_t buffer_ptr, uint32_t count, uint32_t offset);
+int sys_pwrite(uint32_t fd, uint32_t buffer_ptr, uint32_t count, uint32_t offset);
+int sys_getdents(uint32_t path_ptr, uint32_t buffer_ptr, uint32_t size, uint32_t cursor_ptr);
+
+// Day 21: rings
+int sys_ring_setup(uint32_t out_ptr, uint32_t arg2, uint32_t arg3, uint32_t arg4);
+int sys_ring_enter(uint32_t to_submit, uint32_t min_complete, uint32_t arg3, uint32_t arg4);
+int sys_exit(uint32_t exit_code, uint32_t arg2, uint32_t arg3, uint32_t arg4);
 
 // C wrapper functions
 int syscall_hello(void);
@@ -62,10 +143,28 @@ int syscall_read(int fd, void* buffer, size_t count);
 int syscall_write_file(int fd, const void* buffer, size_t count);
 int syscall_list(void);
 
-// System call initialization
+// Day 21: vectored and positioned I/O wrapper functions
+int syscall_readv(int fd, const vfs_iovec_t* iov, int count);
+int syscall_writev(int fd, const vfs_iovec_t* iov, int count);
+int syscall_pread(int fd, void* buffer, size_t count, uint32_t offset);
+int syscall_pwrite(int fd, const void* buffer, size_t count, uint32_t offset);
+int syscall_getdents(const char* path, void* buffer, size_t size, uint32_t* cursor);
+
+// Day 21: ring wrapper functions
+int syscall_ring_setup(uint32_t* ring_addr);
+int syscall_ring_enter(uint32_t to_submit, uint32_t min_complete);
+
+// System call initialization: the int 0x80 gate and SYSENTER
 void syscall_init(void);
 
+// Call the basic system calls through the table
+void test_syscalls(void);
+
+// Calls, faults and cycles per system call, summed over the CPUs
+void syscall_get_stats(syscall_stat_t stats[MAX_SYSCALLS]);
+void syscall_dump_stats(void);
+
 // External assembly handler
 extern void syscall_interrupt_handler(void);
 
-#endif // SYSCALL_H
\ No newline at end of file
+#endif // SYSCALL_H
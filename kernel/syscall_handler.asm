@@ -7,7 +7,7 @@
 global syscall_interrupt_handler
 
 ; Import C function
-extern syscall_handler
+extern syscall_dispatch
 
 section .text
 
@@ -17,6 +17,7 @@ section .text
 ;   EBX = argument 1
 ;   ECX = argument 2
 ;   EDX = argument 3
+;   ESI = argument 4
 ; Return value in EAX
 syscall_interrupt_handler:
     ; Save all registers (callee-saved)
@@ -39,17 +40,18 @@ syscall_interrupt_handler:
     
     ; Prepare arguments for C handler
     ; Note: Arguments are already in the right registers
-    ; EAX = syscall_num, EBX = arg1, ECX = arg2, EDX = arg3
+    ; EAX = syscall_num, EBX = arg1, ECX = arg2, EDX = arg3, ESI = arg4
     
     ; Push arguments in reverse order (C calling convention)
+    push esi        ; arg4
     push edx        ; arg3
     push ecx        ; arg2
     push ebx        ; arg1
     push eax        ; syscall_num
     
     ; Call C system call handler
-    call syscall_handler
-    add esp, 16     ; Clean up stack (4 arguments * 4 bytes)
+    call syscall_dispatch
+    add esp, 20     ; Clean up stack (5 arguments * 4 bytes)
     
     ; Save return value
     mov [esp + 28], eax  ; Store return value in saved EAX position
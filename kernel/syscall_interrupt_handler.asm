@@ -1,7 +1,9 @@
 ; ClaudeOS System Call Interrupt Handler - Day 8
 ; Assembly handler for INT 0x80 system calls
 
-extern syscall_handler
+extern syscall_dispatch
+
+%define GDT_KERNEL_PERCPU 0x28  ; kernel/gdt.h
 
 global syscall_interrupt_handler
 
@@ -13,36 +15,33 @@ syscall_interrupt_handler:
     push fs
     push gs
     
-    ; Save current ESP
-    mov esi, esp
-    
     ; Switch to kernel data segment
     mov ax, 0x10        ; Kernel data segment
     mov ds, ax
     mov es, ax
     mov fs, ax
-    mov gs, ax
+    mov ax, GDT_KERNEL_PERCPU
+    mov gs, ax          ; This CPU's cpu_t
     
     ; System call parameters are in registers:
     ; EAX = system call number
     ; EBX = arg1
     ; ECX = arg2  
     ; EDX = arg3
+    ; ESI = arg4
     
     ; Push arguments in reverse order for C calling convention
+    push esi            ; arg4
     push edx            ; arg3
     push ecx            ; arg2
     push ebx            ; arg1
     push eax            ; syscall_num
     
-    ; Call the C system call handler
-    call syscall_handler
-    
-    ; Clean up the stack (4 arguments = 16 bytes)
-    add esp, 16
+    ; Call the C system call dispatcher
+    call syscall_dispatch
     
-    ; Store return value in EAX (it's already there from syscall_handler)
-    ; EAX will be returned to the calling process
+    ; Clean up the stack (5 arguments = 20 bytes)
+    add esp, 20
     
     ; Restore segment registers
     pop gs
@@ -50,16 +49,10 @@ syscall_interrupt_handler:
     pop es
     pop ds
     
-    ; Restore all general-purpose registers except EAX (return value)
-    ; We need to manually restore to preserve EAX
-    add esp, 4          ; Skip saved EAX
-    pop ecx
-    pop edx
-    pop ebx
-    add esp, 4          ; Skip saved ESP
-    pop ebp
-    pop esi
-    pop edi
+    ; Restore all general-purpose registers, with the return value in
+    ; pusha's EAX slot (the last one it pushed sits 28 bytes up)
+    mov [esp + 28], eax
+    popa
     
-    ; Return from interrupt (preserves EAX with return value)
+    ; Return from interrupt (EAX holds the return value)
     iret
\ No newline at end of file
@@ -0,0 +1,100 @@
+; ClaudeOS Fast System Call Entry - Day 21
+; SYSENTER/SYSEXIT: the kernel side and the ring 3 stub that goes with it
+
+[BITS 32]
+
+global sysenter_entry
+global syscall_fast
+global sysenter_return
+
+extern syscall_dispatch
+
+; vdata_clock_t.flags in the shared clock page (kernel/vdata.h)
+%define VDATA_FLAGS             0xBFFFE024
+%define VDATA_FLAG_SYSENTER     1
+
+%define GDT_KERNEL_PERCPU       0x28    ; kernel/gdt.h
+
+section .text
+
+; SYSENTER lands here with CS = 0x08, SS = 0x10, ESP from IA32_SYSENTER_ESP
+; and interrupts off. The stub left:
+;   EAX = system call number
+;   EBX = argument 1
+;   ECX = argument 2
+;   EDX = argument 3
+;   ESI = argument 4
+;   EBP = its stack pointer (SYSEXIT needs it in ECX)
+; Return value in EAX; ESI, EDI and EBP survive the C call
+sysenter_entry:
+    push ebp            ; Caller's ESP
+    push ds
+    push es
+    push fs
+    push gs
+    
+    push esi            ; arg4
+    push edx            ; arg3
+    push ecx            ; arg2
+    push ebx            ; arg1
+    push eax            ; syscall_num
+    
+    ; Load kernel data segment, and the per-CPU one into GS
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov ax, GDT_KERNEL_PERCPU
+    mov gs, ax
+    
+    sti
+    call syscall_dispatch
+    cli
+    add esp, 20         ; Clean up stack (5 arguments * 4 bytes)
+    
+    pop gs
+    pop fs
+    pop es
+    pop ds
+    
+    ; SYSEXIT: back to ring 3 at EDX with ESP = ECX. The sti only takes
+    ; effect after the next instruction, so nothing lands in between.
+    pop ecx
+    mov edx, sysenter_return
+    sti
+    sysexit
+
+; The stub is part of the ring 3 image, so it learns whether SYSENTER is
+; set up from the shared clock page rather than from kernel data
+section .user_text
+
+; int syscall_fast(uint32_t num, uint32_t arg1, uint32_t arg2, uint32_t arg3,
+;                  uint32_t arg4)
+; Ring 3 only; falls back to int 0x80 on a CPU without SYSENTER
+syscall_fast:
+    push ebx
+    push esi
+    push ebp
+    mov eax, [esp + 16] ; num
+    mov ebx, [esp + 20] ; arg1
+    mov ecx, [esp + 24] ; arg2
+    mov edx, [esp + 28] ; arg3
+    mov esi, [esp + 32] ; arg4
+    test dword [VDATA_FLAGS], VDATA_FLAG_SYSENTER
+    jz syscall_fast_int80
+    mov ebp, esp
+    sysenter
+sysenter_return:
+    pop ebp
+    pop esi
+    pop ebx
+    ret
+syscall_fast_int80:
+    int 0x80
+    pop ebp
+    pop esi
+    pop ebx
+    ret
+
+; GNU stack note section (prevents executable stack warning)
+section .note.GNU-stack noalloc noexec nowrite progbits
@@ -0,0 +1,61 @@
+// ClaudeOS Fast System Calls Implementation - Day 21
+// The MSRs are per CPU, so each one is set as the CPU comes up and the
+// stack MSR follows the process running on it
+
+#include "sysenter.h"
+#include "kernel.h"
+#include "process.h"
+#include "smp.h"
+
+int sysenter_enabled = 0;
+
+// For the kernel task and idle tasks, which run on their CPU's boot stack
+static uint8_t sysenter_stacks[SMP_MAX_CPUS][SYSENTER_STACK_SIZE] __attribute__((aligned(16)));
+
+static inline void wrmsr(uint32_t msr, uint32_t value) {
+    asm volatile ("wrmsr" : : "a" (value), "d" (0), "c" (msr));
+}
+
+// CPUID.1:EDX.SEP, except on early Pentium Pros, which set it without
+// having the instructions
+static int sysenter_supported(void) {
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
+    uint32_t family = (eax >> 8) & 0xF;
+    uint32_t model = (eax >> 4) & 0xF;
+    uint32_t stepping = eax & 0xF;
+    if (family == 6 && model < 3 && stepping < 3) {
+        return 0;
+    }
+    return (edx & (1 << 11)) != 0;
+}
+
+void sysenter_init(void) {
+    cpu_t* cpu = smp_current_cpu();
+    if (cpu->id == 0) {
+        sysenter_enabled = sysenter_supported();
+        if (!sysenter_enabled) {
+            terminal_writestring("[SYSCALL] No SYSENTER - system calls stay on int 0x80\n");
+        }
+    }
+    if (!sysenter_enabled) {
+        return;
+    }
+    cpu->sysenter_esp = (uint32_t)sysenter_stacks[cpu->id] + SYSENTER_STACK_SIZE;
+    wrmsr(IA32_SYSENTER_CS, SYSENTER_KERNEL_CS);
+    wrmsr(IA32_SYSENTER_ESP, cpu->sysenter_esp);
+    wrmsr(IA32_SYSENTER_EIP, (uint32_t)sysenter_entry);
+}
+
+void sysenter_switch(process_t* next) {
+    if (!sysenter_enabled) {
+        return;
+    }
+    cpu_t* cpu = smp_current_cpu();
+    uint32_t top = next->stack ? (uint32_t)next->stack + next->stack_size
+                               : (uint32_t)sysenter_stacks[cpu->id] + SYSENTER_STACK_SIZE;
+    if (cpu->sysenter_esp != top) {
+        cpu->sysenter_esp = top;
+        wrmsr(IA32_SYSENTER_ESP, top);
+    }
+}
@@ -0,0 +1,40 @@
+// ClaudeOS Fast System Calls - Day 21
+// SYSENTER/SYSEXIT entry: the CPU loads the kernel CS, ESP and EIP from
+// MSRs instead of going through an IDT gate and an interrupt frame
+
+#ifndef SYSENTER_H
+#define SYSENTER_H
+
+#include "types.h"
+
+#define IA32_SYSENTER_CS    0x174
+#define IA32_SYSENTER_ESP   0x175
+#define IA32_SYSENTER_EIP   0x176
+
+// SYSENTER takes SS as CS + 8; SYSEXIT returns to CS + 16 and CS + 24 at
+// RPL 3, which is the GDT's user code and data
+#define SYSENTER_KERNEL_CS  0x08
+#define SYSENTER_STACK_SIZE 1024        // Per CPU, for processes without a kernel stack
+
+struct process;
+
+// Set the MSRs on this CPU (every CPU runs this, the BSP first)
+void sysenter_init(void);
+
+// Point IA32_SYSENTER_ESP at the kernel stack of the process being
+// switched to; the MSR is only written when that changes
+void sysenter_switch(struct process* next);
+
+// Ring 3 side, in the user image: the call goes in through SYSENTER, or
+// int 0x80 on a CPU without it. SYSEXIT always returns to ring 3, so
+// kernel code keeps calling through int 0x80. Number in EAX, arguments in
+// EBX, ECX, EDX, ESI.
+int syscall_fast(uint32_t syscall_num, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4);
+
+// State (read-only access for external code)
+extern int sysenter_enabled;
+
+// Assembly entry point (kernel/sysenter.asm)
+extern void sysenter_entry(void);
+
+#endif // SYSENTER_H
@@ -0,0 +1,1357 @@
+// ClaudeOS TCP Implementation - Day 21
+// Connections are found by a 4-tuple hash. Queued data stays in the send
+// buffer's packet buffers and every (re)transmission is a packet header
+// over them, so segmentation never copies the payload. sendfile's
+// segments go further: their payload is a page fragment over the file's
+// own page, which no layer copies on a NIC that gathers.
+
+#include "tcp.h"
+#include "ipv4.h"
+#include "process.h"
+#include "softirq.h"
+#include "kernel.h"
+#include "pool.h"
+#include "pmm.h"
+#include "vfs.h"
+
+#define TCP_OPTION_MSS      2
+
+// Where a queued segment sits in sequence space, kept in its buffer's cb
+typedef struct {
+    uint32_t seq;
+    bool sent;                          // Sealed: later writes start a new segment
+} tcp_seg_cb_t;
+
+// Addresses of a segment on the loopback queue
+typedef struct {
+    uint32_t src;
+    uint32_t dest;
+} tcp_local_cb_t;
+
+DEFINE_POOL(tcp_conns, tcp_conn_t, MAX_TCP_CONNECTIONS);
+static htable_node_t* tcp_hash_initial[TCP_HASH_BUCKETS];
+static htable_t tcp_hash;
+static uint8_t tcp_rcv_storage[MAX_TCP_CONNECTIONS][TCP_RCV_BUFFER];
+static spinlock_t tcp_lock;             // Unregistered; guards every connection
+static uint16_t next_ephemeral = TCP_EPHEMERAL_BASE;
+
+// Segments between local sockets, and the work item that feeds them back
+// in and runs expired timers (producers hold tcp_lock, so does the consumer)
+static ring_t tcp_loopback;
+static network_packet_t* tcp_loopback_slots[TCP_LOOPBACK_QUEUE];
+static work_t tcp_work;
+
+static uint32_t tcp_resets_sent = 0;
+static uint32_t tcp_bad = 0;            // Short or failing the checksum
+static uint32_t tcp_loopback_dropped = 0;
+
+static void tcp_push(tcp_conn_t* conn, bool force);
+
+static inline bool seq_lt(uint32_t a, uint32_t b) { return (int32_t)(a - b) < 0; }
+static inline bool seq_leq(uint32_t a, uint32_t b) { return (int32_t)(a - b) <= 0; }
+static inline bool seq_gt(uint32_t a, uint32_t b) { return (int32_t)(a - b) > 0; }
+
+static inline bool tick_reached(uint32_t now, uint32_t deadline) {
+    return (int32_t)(now - deadline) >= 0;
+}
+
+static inline bool tcp_can_sleep(process_t* process) {
+    return process && process->pid != KERNEL_PID && scheduler_preemptive;
+}
+
+static inline tcp_seg_cb_t* tcp_seg(network_packet_t* segment) {
+    return (tcp_seg_cb_t*)segment->cb;
+}
+
+// Sequence space a queued segment covers: its own bytes or its fragment's
+static inline uint32_t tcp_seg_len(network_packet_t* segment) {
+    return (uint32_t)network_packet_length(segment);
+}
+
+static inline network_packet_t* tcp_snd_at(tcp_conn_t* conn, uint32_t index) {
+    return conn->snd_buf[(conn->snd_head + index) & (TCP_SND_SEGMENTS - 1)];
+}
+
+static inline uint32_t tcp_hash_tuple(uint32_t local, uint16_t lport, uint32_t remote, uint16_t rport) {
+    return htable_hash_combine(htable_hash32(local ^ remote), ((uint32_t)rport << 16) | lport);
+}
+
+static inline uint32_t tcp_flight(tcp_conn_t* conn) {
+    return conn->snd_max - conn->snd_una;
+}
+
+// Connection for an arriving segment's 4-tuple (tcp_lock held)
+static tcp_conn_t* tcp_lookup(uint32_t local, uint16_t lport, uint32_t remote, uint16_t rport) {
+    uint32_t hash = tcp_hash_tuple(local, lport, remote, rport);
+    htable_node_t* node;
+    HTABLE_FOR_EACH_HASH(&tcp_hash, node, hash) {
+        tcp_conn_t* conn = HTABLE_ENTRY(node, tcp_conn_t, hash_node);
+        if (conn->local_port == lport && conn->remote_port == rport &&
+            conn->local_addr == local && conn->remote_addr == remote) {
+            return conn;
+        }
+    }
+    return NULL;
+}
+
+// Listeners take any local address; there are few, so they aren't hashed
+static tcp_conn_t* tcp_find_listener(uint16_t port) {
+    tcp_conn_t* conn;
+    POOL_FOR_EACH(tcp_conns, conn) {
+        if (conn->state == TCP_LISTEN && conn->local_port == port) {
+            return conn;
+        }
+    }
+    return NULL;
+}
+
+// Open connection by id, as the system calls see it (not closed, not
+// waiting for accept)
+static tcp_conn_t* tcp_find(int id) {
+    tcp_conn_t* conn = tcp_conns_lookup(id);
+    return conn && !conn->user_closed && !conn->parent ? conn : NULL;
+}
+
+static bool tcp_port_in_use(uint16_t port) {
+    tcp_conn_t* conn;
+    POOL_FOR_EACH(tcp_conns, conn) {
+        if (conn->local_port == port) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void tcp_hash_insert(tcp_conn_t* conn) {
+    htable_insert(&tcp_hash, &conn->hash_node,
+                  tcp_hash_tuple(conn->local_addr, conn->local_port, conn->remote_addr, conn->remote_port));
+}
+
+static void tcp_hash_remove(tcp_conn_t* conn) {
+    htable_remove(&tcp_hash, &conn->hash_node);
+}
+
+static void tcp_timer_fired(void* arg) {
+    (void)arg;
+    work_schedule(&tcp_work);  // Deadlines are checked there, under tcp_lock
+}
+
+// A fresh connection slot (tcp_lock held)
+static tcp_conn_t* tcp_alloc(void) {
+    tcp_conn_t* conn = tcp_conns_alloc();
+    if (!conn) {
+        return NULL;
+    }
+    uint8_t* bytes = (uint8_t*)conn;
+    for (size_t j = 0; j < sizeof(tcp_conn_t); j++) {
+        bytes[j] = 0;
+    }
+    conn->id = tcp_conns_handle(conn);
+    conn->owner_pid = current_process ? current_process->pid : KERNEL_PID;
+    conn->state = TCP_CLOSED;
+    conn->mss = TCP_MSS;
+    conn->rto = TCP_RTO_INITIAL;
+    conn->ssthresh = 0xFFFF;
+    conn->rcv_buf = tcp_rcv_storage[tcp_conns_index(conn)];
+    timer_event_init(&conn->rto_timer, tcp_timer_fired, NULL);
+    timer_event_init(&conn->delack_timer, tcp_timer_fired, NULL);
+    return conn;
+}
+
+static void tcp_drop_send_buffer(tcp_conn_t* conn) {
+    while (conn->snd_count > 0) {
+        network_free_packet(tcp_snd_at(conn, 0));
+        conn->snd_head = (conn->snd_head + 1) & (TCP_SND_SEGMENTS - 1);
+        conn->snd_count--;
+    }
+}
+
+static void tcp_stop_timers(tcp_conn_t* conn) {
+    conn->rto_armed = false;
+    conn->delack_armed = false;
+    timer_event_cancel(&conn->rto_timer);
+    timer_event_cancel(&conn->delack_timer);
+}
+
+static void tcp_wake(tcp_conn_t* conn) {
+    process_t* waiter = conn->waiter;
+    if (waiter) {
+        conn->waiter = NULL;
+        process_wake(waiter);
+    }
+}
+
+static void tcp_free(tcp_conn_t* conn) {
+    tcp_stop_timers(conn);
+    tcp_drop_send_buffer(conn);
+    tcp_conns_free(conn);
+}
+
+// Leave the accept queue or pending count of the listener (tcp_lock held)
+static void tcp_detach_child(tcp_conn_t* conn) {
+    tcp_conn_t* parent = conn->parent;
+    if (!parent) {
+        return;
+    }
+    if (conn->state == TCP_SYN_RECEIVED) {
+        parent->pending_children--;
+    }
+    for (uint32_t i = 0; i < parent->accept_count; i++) {
+        if (parent->accept_queue[i] == conn) {
+            parent->accept_queue[i] = parent->accept_queue[--parent->accept_count];
+            break;
+        }
+    }
+    conn->parent = NULL;
+}
+
+// Move to CLOSED; the slot goes once nobody can refer to it any more
+static void tcp_set_closed(tcp_conn_t* conn) {
+    bool orphan = conn->parent != NULL;
+    tcp_detach_child(conn);
+    if (conn->state != TCP_CLOSED && conn->state != TCP_LISTEN) {
+        tcp_hash_remove(conn);
+    }
+    conn->state = TCP_CLOSED;
+    tcp_stop_timers(conn);
+    tcp_drop_send_buffer(conn);
+    tcp_wake(conn);
+    if (conn->user_closed || orphan) {
+        tcp_free(conn);
+    }
+}
+
+static void tcp_arm_rto(tcp_conn_t* conn, uint32_t ticks) {
+    conn->rto_deadline = timer_get_ticks() + ticks;
+    conn->rto_armed = true;
+    timer_event_arm(&conn->rto_timer, ticks);
+}
+
+static void tcp_arm_delack(tcp_conn_t* conn) {
+    if (!conn->delack_armed) {
+        conn->delack_deadline = timer_get_ticks() + TCP_DELACK_TICKS;
+        conn->delack_armed = true;
+        timer_event_arm(&conn->delack_timer, TCP_DELACK_TICKS);
+    }
+}
+
+static uint16_t tcp_window(tcp_conn_t* conn) {
+    uint32_t space = TCP_RCV_BUFFER - conn->rcv_count;
+    return (uint16_t)(space > 0xFFFF ? 0xFFFF : space);
+}
+
+// Prepend a TCP header (the checksum is filled in by tcp_transmit)
+static tcp_header_t* tcp_push_header(network_packet_t* packet, uint16_t lport, uint16_t rport,
+                                     uint32_t seq, uint32_t ack, uint8_t flags, uint16_t window) {
+    tcp_header_t* tcp = (tcp_header_t*)network_packet_push(packet, TCP_HEADER_SIZE);
+    if (!tcp) {
+        return NULL;
+    }
+    tcp->src_port = net_htons(lport);
+    tcp->dest_port = net_htons(rport);
+    tcp->seq = net_htonl(seq);
+    tcp->ack = net_htonl(ack);
+    tcp->data_offset = (TCP_HEADER_SIZE / 4) << 4;
+    tcp->flags = flags;
+    tcp->window = net_htons(window);
+    tcp->checksum = 0;
+    tcp->urgent = 0;
+    return tcp;
+}
+
+// Checksum a finished segment and send it from local to remote; local
+// peers (iface NULL) get it, unsummed, through the loopback queue. Takes
+// over packet.
+static int tcp_transmit(network_interface_t* iface, uint32_t local, uint32_t remote,
+                        network_packet_t* packet) {
+    ipv4_l4_checksum(iface, packet, local, remote, IPV4_PROTO_TCP, TCP_CHECKSUM_OFFSET);
+    if (!iface) {
+        if (network_packet_linearize(packet) != 0) {
+            tcp_loopback_dropped++;
+            network_free_packet(packet);
+            return -1;
+        }
+        tcp_local_cb_t* cb = (tcp_local_cb_t*)packet->cb;
+        cb->src = local;
+        cb->dest = remote;
+        if (ring_push(&tcp_loopback, &packet) != 0) {
+            tcp_loopback_dropped++;
+            network_free_packet(packet);
+            return -1;
+        }
+        work_schedule(&tcp_work);
+        return 0;
+    }
+    return ipv4_output(iface, remote, IPV4_PROTO_TCP, packet);
+}
+
+// Send a segment on conn carrying packet's bytes (none if packet is NULL).
+// Every segment but a bare SYN acknowledges, which satisfies a pending
+// delayed ACK.
+static int tcp_output(tcp_conn_t* conn, network_packet_t* packet, uint32_t seq, uint8_t flags) {
+    if (!packet && !(packet = network_alloc_packet())) {
+        return -1;
+    }
+    if (flags & TCP_SYN) {
+        uint8_t* option = network_packet_push(packet, 4);
+        option[0] = TCP_OPTION_MSS;
+        option[1] = 4;
+        option[2] = (uint8_t)(TCP_MSS >> 8);
+        option[3] = (uint8_t)(TCP_MSS & 0xFF);
+    }
+    if (conn->state != TCP_SYN_SENT) {
+        flags |= TCP_ACK;
+    }
+    uint16_t window = tcp_window(conn);
+    tcp_header_t* tcp = tcp_push_header(packet, conn->local_port, conn->remote_port, seq,
+                                        (flags & TCP_ACK) ? conn->rcv_nxt : 0, flags, window);
+    if (!tcp) {
+        network_free_packet(packet);
+        return -1;
+    }
+    if (flags & TCP_SYN) {
+        tcp->data_offset = ((TCP_HEADER_SIZE + 4) / 4) << 4;
+    }
+    if (flags & TCP_ACK) {
+        conn->rcv_adv = conn->rcv_nxt + window;
+        conn->unacked_segments = 0;
+        conn->delack_armed = false;
+    }
+    conn->stats.segments_sent++;
+    return tcp_transmit(conn->iface, conn->local_addr, conn->remote_addr, packet);
+}
+
+static void tcp_send_ack(tcp_conn_t* conn) {
+    tcp_output(conn, NULL, conn->snd_nxt, TCP_ACK);
+}
+
+// Answer a segment no connection wants (RFC 793 reset generation)
+static void tcp_send_reset(uint32_t local, uint32_t remote, tcp_header_t* in, uint32_t seg_len) {
+    network_packet_t* packet = network_alloc_packet();
+    if (!packet) {
+        return;
+    }
+    uint32_t seq = 0, ack = 0;
+    uint8_t flags = TCP_RST;
+    if (in->flags & TCP_ACK) {
+        seq = net_ntohl(in->ack);
+    } else {
+        ack = net_ntohl(in->seq) + seg_len;
+        flags |= TCP_ACK;
+    }
+    if (!tcp_push_header(packet, net_ntohs(in->dest_port), net_ntohs(in->src_port), seq, ack, flags, 0)) {
+        network_free_packet(packet);
+        return;
+    }
+    tcp_resets_sent++;
+    tcp_transmit(ipv4_is_local(remote) ? NULL : ipv4_route(remote), local, remote, packet);
+}
+
+static void tcp_abort(tcp_conn_t* conn, bool send_reset) {
+    if (send_reset && conn->state >= TCP_SYN_RECEIVED) {
+        tcp_output(conn, NULL, conn->snd_nxt, TCP_RST);
+    }
+    conn->error = -1;
+    tcp_set_closed(conn);
+}
+
+// The last reference to a segment in flight gives back its send buffer
+// reference. This can run under the NIC's locks, so it takes none itself.
+static void tcp_segment_release(network_packet_t* packet) {
+    network_free_packet((network_packet_t*)packet->owner);
+}
+
+// Transmit queued segment index from offset bytes in, as a packet header
+// over the send buffer. Only bytes already acknowledged may lie between
+// the buffer's headroom and offset, as the headers are written over them.
+// A sendfile segment has no bytes of its own: the packet gets its own
+// reference on the page, trimmed by offset.
+static int tcp_send_segment(tcp_conn_t* conn, uint32_t index, uint32_t offset) {
+    network_packet_t* segment = tcp_snd_at(conn, index);
+    if (segment->refcount > 1) {
+        return -1;  // The last transmission is still queued; its headers are in use
+    }
+    uint32_t start = (uint32_t)(segment->data - segment->head);
+    network_packet_t* packet = network_attach_packet(segment->head, segment->capacity,
+                                                     start + segment->size,
+                                                     tcp_segment_release, segment);
+    if (!packet) {
+        return -1;
+    }
+    network_packet_get(segment);
+    if (segment->frag_frame) {
+        if (pmm_page_ref(segment->frag_frame) != 0 ||
+            network_packet_frag(packet, segment->frag_frame, segment->frag_offset + offset,
+                                segment->frag_size - offset) != 0) {
+            network_free_packet(packet);
+            return -1;
+        }
+        offset = 0;
+    }
+    network_packet_pull(packet, start + offset);
+
+    uint8_t flags = TCP_ACK;
+    if (index == conn->snd_count - 1) {
+        flags |= TCP_PSH;  // Everything queued goes out with this one
+    }
+    tcp_seg(segment)->sent = true;
+    return tcp_output(conn, packet, tcp_seg(segment)->seq + offset, flags);
+}
+
+// Queued segment holding seq, and how far into it seq is
+static int tcp_segment_for(tcp_conn_t* conn, uint32_t seq, uint32_t* offset) {
+    for (uint32_t i = 0; i < conn->snd_count; i++) {
+        network_packet_t* segment = tcp_snd_at(conn, i);
+        uint32_t first = tcp_seg(segment)->seq;
+        if (seq_leq(first, seq) && seq_lt(seq, first + tcp_seg_len(segment))) {
+            *offset = seq - first;
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static bool tcp_fin_state(tcp_conn_t* conn) {
+    return conn->state == TCP_FIN_WAIT_1 || conn->state == TCP_CLOSING || conn->state == TCP_LAST_ACK;
+}
+
+// Retransmit the oldest unacknowledged segment (fast or partial-ACK
+// retransmission); the FIN if that is all that is outstanding
+static void tcp_retransmit_head(tcp_conn_t* conn) {
+    conn->rtt_timing = false;  // Karn: no samples from retransmitted data
+    if (conn->snd_una == conn->snd_end && tcp_fin_state(conn)) {
+        tcp_output(conn, NULL, conn->snd_end, TCP_FIN);
+        conn->stats.retransmits++;
+        return;
+    }
+    uint32_t offset;
+    int index = tcp_segment_for(conn, conn->snd_una, &offset);
+    if (index >= 0 && tcp_send_segment(conn, (uint32_t)index, offset) == 0) {
+        conn->stats.retransmits++;
+    }
+}
+
+// Send what the windows and Nagle allow from snd_nxt on, then the FIN
+// once everything before it is out. force sends one segment past a
+// closed window, as a probe.
+static void tcp_push(tcp_conn_t* conn, bool force) {
+    if (conn->state < TCP_ESTABLISHED || conn->state == TCP_FIN_WAIT_2 || conn->state == TCP_TIME_WAIT) {
+        return;
+    }
+    uint32_t window = conn->cwnd < conn->snd_wnd ? conn->cwnd : conn->snd_wnd;
+    while (seq_lt(conn->snd_nxt, conn->snd_end)) {
+        uint32_t offset;
+        int index = tcp_segment_for(conn, conn->snd_nxt, &offset);
+        if (index < 0) {
+            break;
+        }
+        network_packet_t* segment = tcp_snd_at(conn, (uint32_t)index);
+        uint32_t length = tcp_seg_len(segment) - offset;
+        uint32_t flight = conn->snd_nxt - conn->snd_una;
+        if (flight + length > window && !force) {
+            if (flight == 0 && !conn->rto_armed) {
+                tcp_arm_rto(conn, conn->rto);  // Persist: probe the window later
+            }
+            break;
+        }
+        // Nagle: hold a short segment while anything is unacknowledged
+        if (length < conn->mss && flight > 0 && !conn->nodelay && !conn->fin_queued && !force) {
+            break;
+        }
+        if (tcp_send_segment(conn, (uint32_t)index, offset) != 0) {
+            break;
+        }
+        force = false;
+        if (seq_leq(conn->snd_max, conn->snd_nxt)) {
+            conn->stats.bytes_sent += length;
+            if (!conn->rtt_timing) {
+                conn->rtt_timing = true;
+                conn->rtt_seq = conn->snd_nxt;
+                conn->rtt_start = timer_get_ticks();
+            }
+        } else {
+            conn->stats.retransmits++;
+        }
+        conn->snd_nxt += length;
+        if (seq_gt(conn->snd_nxt, conn->snd_max)) {
+            conn->snd_max = conn->snd_nxt;
+        }
+        if (!conn->rto_armed) {
+            tcp_arm_rto(conn, conn->rto);
+        }
+    }
+
+    if (conn->fin_queued && conn->snd_nxt == conn->snd_end) {
+        tcp_output(conn, NULL, conn->snd_end, TCP_FIN);
+        conn->snd_nxt = conn->snd_end + 1;
+        if (seq_gt(conn->snd_nxt, conn->snd_max)) {
+            conn->snd_max = conn->snd_nxt;
+        }
+        if (conn->state == TCP_ESTABLISHED) {
+            conn->state = TCP_FIN_WAIT_1;
+        } else if (conn->state == TCP_CLOSE_WAIT) {
+            conn->state = TCP_LAST_ACK;
+        }
+        if (!conn->rto_armed) {
+            tcp_arm_rto(conn, conn->rto);
+        }
+    }
+}
+
+// RFC 6298 estimator over one RTT sample in ticks
+static void tcp_rtt_sample(tcp_conn_t* conn, uint32_t sample) {
+    if (conn->srtt == 0) {
+        conn->srtt = sample << 3;
+        conn->rttvar = sample << 1;
+    } else {
+        int32_t delta = (int32_t)sample - (int32_t)(conn->srtt >> 3);
+        conn->srtt += delta;
+        if (delta < 0) {
+            delta = -delta;
+        }
+        conn->rttvar += delta - (conn->rttvar >> 2);
+    }
+    uint32_t rto = (conn->srtt >> 3) + (conn->rttvar ? conn->rttvar : 1);
+    conn->rto = rto < TCP_RTO_MIN ? TCP_RTO_MIN : (rto > TCP_RTO_MAX ? TCP_RTO_MAX : rto);
+}
+
+static void tcp_enter_time_wait(tcp_conn_t* conn) {
+    conn->state = TCP_TIME_WAIT;
+    tcp_drop_send_buffer(conn);
+    tcp_arm_rto(conn, TCP_TIME_WAIT_TICKS);
+    tcp_wake(conn);
+}
+
+// Process the acknowledgment field of a segment in a synchronized state
+static void tcp_ack_input(tcp_conn_t* conn, uint32_t ack, uint16_t window, uint32_t seg_len, uint8_t flags) {
+    if (seq_gt(ack, conn->snd_max)) {
+        tcp_send_ack(conn);  // Acknowledges something we never sent
+        return;
+    }
+    if (seq_leq(ack, conn->snd_una)) {
+        // Duplicate: it carries nothing, moves nothing, and data is out
+        bool duplicate = ack == conn->snd_una && seg_len == 0 && !(flags & TCP_FIN) &&
+                         window == conn->snd_wnd && tcp_flight(conn) > 0;
+        conn->snd_wnd = window;
+        if (!duplicate) {
+            conn->dup_acks = 0;
+            tcp_push(conn, false);
+            return;
+        }
+        conn->dup_acks++;
+        conn->stats.dup_acks++;
+        if (conn->in_recovery) {
+            conn->cwnd += conn->mss;  // Another segment has left the network
+            tcp_push(conn, false);
+        } else if (conn->dup_acks == TCP_DUPACK_THRESHOLD && seq_gt(ack, conn->recover)) {
+            uint32_t half = tcp_flight(conn) / 2;
+            conn->ssthresh = half > 2u * conn->mss ? half : 2u * conn->mss;
+            conn->recover = conn->snd_max;
+            conn->in_recovery = true;
+            conn->cwnd = conn->ssthresh + TCP_DUPACK_THRESHOLD * conn->mss;
+            conn->stats.fast_retransmits++;
+            tcp_retransmit_head(conn);
+        }
+        return;
+    }
+
+    uint32_t acked = ack - conn->snd_una;
+    if (conn->rtt_timing && seq_gt(ack, conn->rtt_seq)) {
+        conn->rtt_timing = false;
+        tcp_rtt_sample(conn, timer_get_ticks() - conn->rtt_start);
+    }
+    conn->snd_una = ack;
+    if (seq_lt(conn->snd_nxt, ack)) {
+        conn->snd_nxt = ack;
+    }
+    while (conn->snd_count > 0) {
+        network_packet_t* segment = tcp_snd_at(conn, 0);
+        if (seq_gt(tcp_seg(segment)->seq + tcp_seg_len(segment), ack)) {
+            break;
+        }
+        network_free_packet(segment);  // Freed for good once any transmission is done
+        conn->snd_head = (conn->snd_head + 1) & (TCP_SND_SEGMENTS - 1);
+        conn->snd_count--;
+    }
+    conn->snd_wnd = window;
+    conn->dup_acks = 0;
+    conn->retries = 0;
+
+    if (conn->in_recovery) {
+        if (seq_leq(conn->recover, ack)) {
+            // Full ACK: deflate to ssthresh, or less if little is left in flight
+            uint32_t flight = tcp_flight(conn) + conn->mss;
+            conn->cwnd = flight < conn->ssthresh ? flight : conn->ssthresh;
+            conn->in_recovery = false;
+        } else {
+            // Partial ACK: the next hole was lost too
+            tcp_retransmit_head(conn);
+            conn->cwnd = (conn->cwnd > acked ? conn->cwnd - acked : 0) + conn->mss;
+        }
+    } else if (conn->cwnd < conn->ssthresh) {
+        conn->cwnd += acked < conn->mss ? acked : conn->mss;  // Slow start
+    } else {
+        uint32_t increase = (uint32_t)conn->mss * conn->mss / conn->cwnd;
+        conn->cwnd += increase ? increase : 1;  // Congestion avoidance
+    }
+
+    if (conn->snd_una == conn->snd_max) {
+        conn->rto_armed = false;
+        timer_event_cancel(&conn->rto_timer);
+    } else {
+        tcp_arm_rto(conn, conn->rto);
+    }
+    tcp_wake(conn);  // Send buffer space, or a close that completed
+}
+
+// Accept in-order payload into the receive buffer; returns whether the
+// segment must be acknowledged right away
+static bool tcp_data_input(tcp_conn_t* conn, uint32_t seq, const uint8_t* data, uint32_t length) {
+    if (seq_gt(seq, conn->rcv_nxt)) {
+        conn->stats.out_of_order++;
+        return true;  // A duplicate ACK tells the sender about the hole
+    }
+    uint32_t skip = conn->rcv_nxt - seq;
+    if (skip >= length) {
+        return true;  // Already have all of it
+    }
+    uint32_t space = TCP_RCV_BUFFER - conn->rcv_count;
+    uint32_t take = length - skip;
+    bool full = take > space;
+    if (full) {
+        take = space;
+    }
+    uint32_t tail = conn->rcv_head + conn->rcv_count;
+    for (uint32_t i = 0; i < take; i++) {
+        conn->rcv_buf[(tail + i) & (TCP_RCV_BUFFER - 1)] = data[skip + i];
+    }
+    conn->rcv_count += take;
+    conn->rcv_nxt += take;
+    conn->stats.bytes_received += take;
+    conn->unacked_segments++;
+    tcp_wake(conn);
+    // RFC 1122: ACK at least every second full-sized segment
+    return full || skip > 0 || conn->unacked_segments >= 2;
+}
+
+static uint16_t tcp_parse_mss(tcp_header_t* tcp, uint32_t header_size) {
+    uint8_t* option = (uint8_t*)tcp + TCP_HEADER_SIZE;
+    uint8_t* end = (uint8_t*)tcp + header_size;
+    while (option < end && *option != 0) {
+        if (*option == 1) {
+            option++;
+            continue;
+        }
+        if (option + 1 >= end || option[1] < 2 || option + option[1] > end) {
+            break;
+        }
+        if (option[0] == TCP_OPTION_MSS && option[1] == 4) {
+            uint16_t mss = (uint16_t)((option[2] << 8) | option[3]);
+            return mss && mss < TCP_MSS ? mss : TCP_MSS;
+        }
+        option += option[1];
+    }
+    return 536;  // RFC 1122 default without the option
+}
+
+static uint32_t tcp_initial_seq(tcp_conn_t* conn) {
+    // A 4 us clock (RFC 793) offset per connection
+    return ((uint32_t)clock_ns() >> 12) +
+           tcp_hash_tuple(conn->local_addr, conn->local_port, conn->remote_addr, conn->remote_port) * 0x10001u;
+}
+
+static void tcp_start_send_side(tcp_conn_t* conn) {
+    conn->iss = tcp_initial_seq(conn);
+    conn->snd_una = conn->iss;
+    conn->snd_nxt = conn->iss + 1;
+    conn->snd_max = conn->snd_nxt;
+    conn->snd_end = conn->snd_nxt;
+    conn->cwnd = TCP_INITIAL_CWND * TCP_MSS;
+}
+
+// Passive open: a SYN for a listener (tcp_lock held)
+static void tcp_listen_input(tcp_conn_t* listener, tcp_header_t* tcp, uint32_t header_size,
+                             uint32_t src, uint32_t dest) {
+    if (listener->accept_count + listener->pending_children >= TCP_BACKLOG) {
+        return;  // Full backlog: the peer retries its SYN
+    }
+    tcp_conn_t* conn = tcp_alloc();
+    if (!conn) {
+        return;
+    }
+    conn->owner_pid = listener->owner_pid;
+    conn->parent = listener;
+    conn->nodelay = listener->nodelay;
+    conn->local_addr = dest;
+    conn->local_port = listener->local_port;
+    conn->remote_addr = src;
+    conn->remote_port = net_ntohs(tcp->src_port);
+    conn->iface = ipv4_is_local(src) ? NULL : ipv4_route(src);
+    conn->irs = net_ntohl(tcp->seq);
+    conn->rcv_nxt = conn->irs + 1;
+    conn->mss = tcp_parse_mss(tcp, header_size);
+    conn->snd_wnd = net_ntohs(tcp->window);
+    tcp_start_send_side(conn);
+    conn->cwnd = TCP_INITIAL_CWND * conn->mss;
+    conn->state = TCP_SYN_RECEIVED;
+    listener->pending_children++;
+    tcp_hash_insert(conn);
+    tcp_output(conn, NULL, conn->iss, TCP_SYN);
+    tcp_arm_rto(conn, conn->rto);
+}
+
+// Segment for a connection in SYN_SENT
+static void tcp_syn_sent_input(tcp_conn_t* conn, tcp_header_t* tcp, uint32_t header_size) {
+    uint32_t ack = net_ntohl(tcp->ack);
+    bool ack_ok = (tcp->flags & TCP_ACK) && ack == conn->snd_nxt;
+    if ((tcp->flags & TCP_ACK) && !ack_ok) {
+        if (!(tcp->flags & TCP_RST)) {
+            tcp_output(conn, NULL, ack, TCP_RST);
+        }
+        return;
+    }
+    if (tcp->flags & TCP_RST) {
+        if (ack_ok) {
+            tcp_abort(conn, false);  // Refused
+        }
+        return;
+    }
+    if (!(tcp->flags & TCP_SYN)) {
+        return;
+    }
+    conn->irs = net_ntohl(tcp->seq);
+    conn->rcv_nxt = conn->irs + 1;
+    conn->mss = tcp_parse_mss(tcp, header_size);
+    conn->cwnd = TCP_INITIAL_CWND * conn->mss;
+    conn->snd_wnd = net_ntohs(tcp->window);
+    if (!ack_ok) {
+        conn->state = TCP_SYN_RECEIVED;  // Simultaneous open
+        tcp_output(conn, NULL, conn->iss, TCP_SYN);
+        return;
+    }
+    conn->snd_una = ack;
+    if (conn->retries == 0) {
+        tcp_rtt_sample(conn, timer_get_ticks() - conn->rtt_start);
+    }
+    conn->retries = 0;
+    conn->rto_armed = false;
+    timer_event_cancel(&conn->rto_timer);
+    conn->state = TCP_ESTABLISHED;
+    tcp_send_ack(conn);
+    tcp_wake(conn);
+}
+
+static void tcp_conn_input(tcp_conn_t* conn, tcp_header_t* tcp, uint32_t header_size,
+                           const uint8_t* payload, uint32_t length) {
+    uint32_t seq = net_ntohl(tcp->seq);
+    uint8_t flags = tcp->flags;
+    conn->stats.segments_received++;
+
+    if (conn->state == TCP_SYN_SENT) {
+        tcp_syn_sent_input(conn, tcp, header_size);
+        return;
+    }
+
+    // Out of the receive window: answer with an ACK (unless it's a reset)
+    uint32_t window = TCP_RCV_BUFFER - conn->rcv_count;
+    bool in_window = seq_leq(conn->rcv_nxt, seq + length) && seq_leq(seq, conn->rcv_nxt + window);
+    if (!in_window) {
+        if (!(flags & TCP_RST)) {
+            tcp_send_ack(conn);
+        }
+        return;
+    }
+    if (flags & TCP_RST) {
+        tcp_abort(conn, false);
+        return;
+    }
+    if (flags & TCP_SYN) {
+        if (conn->state == TCP_SYN_RECEIVED && seq == conn->irs) {
+            tcp_output(conn, NULL, conn->iss, TCP_SYN);  // Our SYN-ACK was lost
+        } else {
+            tcp_send_ack(conn);  // RFC 5961 challenge ACK
+        }
+        return;
+    }
+    if (!(flags & TCP_ACK)) {
+        return;
+    }
+
+    uint32_t ack = net_ntohl(tcp->ack);
+    if (conn->state == TCP_SYN_RECEIVED) {
+        if (!seq_lt(conn->snd_una, ack) || seq_gt(ack, conn->snd_max)) {
+            tcp_output(conn, NULL, ack, TCP_RST);
+            return;
+        }
+        conn->state = TCP_ESTABLISHED;
+        conn->snd_una = ack;
+        conn->retries = 0;
+        conn->rto_armed = false;
+        timer_event_cancel(&conn->rto_timer);
+        tcp_conn_t* parent = conn->parent;
+        if (parent) {
+            parent->pending_children--;
+            parent->accept_queue[parent->accept_count++] = conn;
+            tcp_wake(parent);
+        }
+    }
+    tcp_ack_input(conn, ack, net_ntohs(tcp->window), length, flags);
+    if (!tcp_conns_live(conn)) {
+        return;
+    }
+
+    // Our FIN acknowledged
+    bool fin_acked = tcp_fin_state(conn) && conn->snd_una == conn->snd_end + 1;
+    if (fin_acked && conn->state == TCP_FIN_WAIT_1) {
+        conn->state = TCP_FIN_WAIT_2;
+    } else if (fin_acked && conn->state == TCP_CLOSING) {
+        tcp_enter_time_wait(conn);
+    } else if (fin_acked && conn->state == TCP_LAST_ACK) {
+        tcp_set_closed(conn);
+        return;
+    }
+
+    bool ack_now = false;
+    if (length > 0 && (conn->state == TCP_ESTABLISHED || conn->state == TCP_FIN_WAIT_1 ||
+                       conn->state == TCP_FIN_WAIT_2)) {
+        ack_now = tcp_data_input(conn, seq, payload, length);
+    }
+    if ((flags & TCP_FIN) && seq + length == conn->rcv_nxt) {
+        // Everything before the FIN is in, so it is next in sequence
+        ack_now = true;
+        conn->rcv_nxt++;
+        conn->fin_received = true;
+        tcp_wake(conn);
+        if (conn->state == TCP_ESTABLISHED || conn->state == TCP_SYN_RECEIVED) {
+            conn->state = TCP_CLOSE_WAIT;
+        } else if (conn->state == TCP_FIN_WAIT_1) {
+            conn->state = TCP_CLOSING;
+        } else if (conn->state == TCP_FIN_WAIT_2) {
+            tcp_enter_time_wait(conn);
+        }
+    } else if ((flags & TCP_FIN) && conn->state == TCP_TIME_WAIT) {
+        ack_now = true;  // Our last ACK was lost
+        tcp_arm_rto(conn, TCP_TIME_WAIT_TICKS);
+    }
+
+    if (ack_now) {
+        tcp_send_ack(conn);
+    } else if (conn->unacked_segments > 0) {
+        tcp_arm_delack(conn);
+    }
+    tcp_push(conn, false);
+}
+
+void tcp_input(network_packet_t* packet, uint32_t src, uint32_t dest) {
+    tcp_header_t* tcp = (tcp_header_t*)packet->data;
+    uint32_t header_size = packet->size >= TCP_HEADER_SIZE ? (uint32_t)(tcp->data_offset >> 4) * 4 : 0;
+    uint32_t sum = (src >> 16) + (src & 0xFFFF) + (dest >> 16) + (dest & 0xFFFF) +
+                   IPV4_PROTO_TCP + packet->size;
+    if (header_size < TCP_HEADER_SIZE || header_size > packet->size ||
+        (!(packet->csum & NET_CSUM_L4_OK) &&
+         ipv4_checksum_fold(ipv4_checksum_add(sum, packet->data, packet->size)) != 0)) {
+        tcp_bad++;
+        network_free_packet(packet);
+        return;
+    }
+    uint32_t length = packet->size - header_size;
+    const uint8_t* payload = packet->data + header_size;
+    uint16_t lport = net_ntohs(tcp->dest_port);
+    uint16_t rport = net_ntohs(tcp->src_port);
+
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    tcp_conn_t* conn = tcp_lookup(dest, lport, src, rport);
+    if (conn) {
+        tcp_conn_input(conn, tcp, header_size, payload, length);
+    } else {
+        tcp_conn_t* listener = tcp_find_listener(lport);
+        if (listener && (tcp->flags & (TCP_SYN | TCP_ACK | TCP_RST)) == TCP_SYN) {
+            tcp_listen_input(listener, tcp, header_size, src, dest);
+        } else if (!(tcp->flags & TCP_RST)) {
+            uint32_t seg_len = length + ((tcp->flags & TCP_SYN) ? 1 : 0) + ((tcp->flags & TCP_FIN) ? 1 : 0);
+            tcp_send_reset(dest, src, tcp, seg_len);
+        }
+    }
+    spin_unlock_irqrestore(&tcp_lock, flags);
+    network_free_packet(packet);
+}
+
+// Retransmission, persist and TIME_WAIT deadlines (tcp_lock held)
+static void tcp_rto_expired(tcp_conn_t* conn) {
+    conn->rto_armed = false;
+    if (conn->state == TCP_TIME_WAIT) {
+        tcp_set_closed(conn);
+        return;
+    }
+    if (conn->retries++ >= TCP_MAX_RETRIES) {
+        tcp_abort(conn, true);
+        return;
+    }
+    conn->stats.timeouts++;
+    conn->rto = conn->rto * 2 > TCP_RTO_MAX ? TCP_RTO_MAX : conn->rto * 2;
+    if (conn->state == TCP_SYN_SENT || conn->state == TCP_SYN_RECEIVED) {
+        conn->stats.retransmits++;
+        tcp_output(conn, NULL, conn->iss, TCP_SYN);
+        tcp_arm_rto(conn, conn->rto);
+        return;
+    }
+    if (tcp_flight(conn) == 0) {
+        conn->retries = 0;
+        tcp_push(conn, true);  // Window probe
+        return;
+    }
+    // Loss: back to one segment and resend everything from snd_una
+    uint32_t half = tcp_flight(conn) / 2;
+    conn->ssthresh = half > 2u * conn->mss ? half : 2u * conn->mss;
+    conn->cwnd = conn->mss;
+    conn->recover = conn->snd_max;
+    conn->in_recovery = false;
+    conn->dup_acks = 0;
+    conn->rtt_timing = false;
+    conn->snd_nxt = conn->snd_una;
+    tcp_push(conn, false);
+    if (!conn->rto_armed) {
+        tcp_arm_rto(conn, conn->rto);
+    }
+}
+
+// Work item: loopback segments, then due timers
+static void tcp_work_run(void* arg) {
+    (void)arg;
+    for (;;) {
+        network_packet_t* packet;
+        uint32_t flags = spin_lock_irqsave(&tcp_lock);
+        int popped = ring_pop(&tcp_loopback, &packet);
+        spin_unlock_irqrestore(&tcp_lock, flags);
+        if (popped != 0) {
+            break;
+        }
+        tcp_local_cb_t* cb = (tcp_local_cb_t*)packet->cb;
+        tcp_input(packet, cb->src, cb->dest);
+    }
+
+    uint32_t now = timer_get_ticks();
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    tcp_conn_t* conn;
+    POOL_FOR_EACH(tcp_conns, conn) {
+        if (conn->delack_armed && tick_reached(now, conn->delack_deadline)) {
+            conn->stats.delayed_acks++;
+            tcp_send_ack(conn);
+        }
+        if (tcp_conns_live(conn) && conn->rto_armed && tick_reached(now, conn->rto_deadline)) {
+            tcp_rto_expired(conn);
+        }
+    }
+    spin_unlock_irqrestore(&tcp_lock, flags);
+}
+
+void tcp_init(void) {
+    htable_init(&tcp_hash, tcp_hash_initial, TCP_HASH_BUCKETS);
+    ring_init(&tcp_loopback, tcp_loopback_slots, TCP_LOOPBACK_QUEUE, sizeof(network_packet_t*));
+    work_init(&tcp_work, tcp_work_run, NULL);
+}
+
+int tcp_socket(void) {
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    tcp_conn_t* conn = tcp_alloc();
+    int id = conn ? conn->id : -1;
+    spin_unlock_irqrestore(&tcp_lock, flags);
+    return id;
+}
+
+int tcp_bind(int id, uint16_t port) {
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    tcp_conn_t* conn = tcp_find(id);
+    int result = -1;
+    if (conn && conn->state == TCP_CLOSED && !conn->local_port && port && !tcp_port_in_use(port)) {
+        conn->local_port = port;
+        result = 0;
+    }
+    spin_unlock_irqrestore(&tcp_lock, flags);
+    return result;
+}
+
+int tcp_listen(int id) {
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    tcp_conn_t* conn = tcp_find(id);
+    int result = -1;
+    if (conn && conn->state == TCP_CLOSED && conn->local_port) {
+        conn->state = TCP_LISTEN;
+        result = 0;
+    }
+    spin_unlock_irqrestore(&tcp_lock, flags);
+    return result;
+}
+
+// Sleep until the stack wakes conn's waiter. Called and returns with
+// tcp_lock held; TCP_WOULD_BLOCK if the caller can't sleep.
+static int tcp_wait(tcp_conn_t* conn, uint32_t* flags) {
+    process_t* process = current_process;
+    if (!tcp_can_sleep(process)) {
+        return TCP_WOULD_BLOCK;
+    }
+    conn->waiter = process;
+    process_prepare_block();
+    spin_unlock_irqrestore(&tcp_lock, *flags);
+
+    process_sleep_while(conn->waiter, process);
+    *flags = spin_lock_irqsave(&tcp_lock);
+    return 0;
+}
+
+int tcp_accept(int id) {
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    tcp_conn_t* listener = tcp_find(id);
+    int result = -1;
+    while (tcp_conns_live(listener) && listener->state == TCP_LISTEN) {
+        if (listener->accept_count > 0) {
+            tcp_conn_t* conn = listener->accept_queue[0];
+            listener->accept_queue[0] = listener->accept_queue[--listener->accept_count];
+            conn->parent = NULL;
+            conn->owner_pid = current_process ? current_process->pid : KERNEL_PID;
+            result = conn->id;
+            break;
+        }
+        if ((result = tcp_wait(listener, &flags)) != 0) {
+            break;
+        }
+        result = -1;
+    }
+    spin_unlock_irqrestore(&tcp_lock, flags);
+    return result;
+}
+
+// Callers that can't sleep get TCP_WOULD_BLOCK and call again until the
+// handshake finishes
+int tcp_connect(int id, uint32_t addr, uint16_t port) {
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    tcp_conn_t* conn = tcp_find(id);
+    if (!conn || (conn->state != TCP_CLOSED && conn->state != TCP_SYN_SENT &&
+                  conn->state != TCP_ESTABLISHED)) {
+        spin_unlock_irqrestore(&tcp_lock, flags);
+        return -1;
+    }
+    if (conn->state == TCP_CLOSED) {
+        if (conn->error || !port) {
+            spin_unlock_irqrestore(&tcp_lock, flags);
+            return -1;
+        }
+        conn->iface = NULL;
+        conn->local_addr = addr;
+        if (!ipv4_is_local(addr)) {
+            conn->iface = ipv4_route(addr);
+            if (!conn->iface) {
+                spin_unlock_irqrestore(&tcp_lock, flags);
+                return -1;  // No route
+            }
+            conn->local_addr = conn->iface->ip_address;
+        }
+        for (uint32_t tries = 0; !conn->local_port && tries < 0x10000 - TCP_EPHEMERAL_BASE; tries++) {
+            uint16_t candidate = next_ephemeral;
+            next_ephemeral = next_ephemeral == 0xFFFF ? TCP_EPHEMERAL_BASE : next_ephemeral + 1;
+            if (!tcp_port_in_use(candidate)) {
+                conn->local_port = candidate;
+            }
+        }
+        if (!conn->local_port) {
+            spin_unlock_irqrestore(&tcp_lock, flags);
+            return -1;
+        }
+        conn->remote_addr = addr;
+        conn->remote_port = port;
+        conn->snd_wnd = TCP_MSS;  // Until the SYN-ACK says otherwise
+        tcp_start_send_side(conn);
+        conn->state = TCP_SYN_SENT;
+        tcp_hash_insert(conn);
+        conn->rtt_start = timer_get_ticks();
+        tcp_output(conn, NULL, conn->iss, TCP_SYN);
+        tcp_arm_rto(conn, conn->rto);
+    }
+
+    int result = 0;
+    while (conn->state == TCP_SYN_SENT || conn->state == TCP_SYN_RECEIVED) {
+        if ((result = tcp_wait(conn, &flags)) != 0) {
+            break;
+        }
+    }
+    if (result == 0 && conn->state != TCP_ESTABLISHED && conn->state != TCP_CLOSE_WAIT) {
+        result = -1;  // Refused or timed out
+    }
+    spin_unlock_irqrestore(&tcp_lock, flags);
+    return result;
+}
+
+int tcp_set_nodelay(int id, bool nodelay) {
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    tcp_conn_t* conn = tcp_find(id);
+    if (conn) {
+        conn->nodelay = nodelay;
+        if (nodelay) {
+            tcp_push(conn, false);  // Release anything Nagle was holding
+        }
+    }
+    spin_unlock_irqrestore(&tcp_lock, flags);
+    return conn ? 0 : -1;
+}
+
+int tcp_send(int id, const void* buffer, uint32_t length) {
+    if (!buffer) {
+        return -1;
+    }
+    const uint8_t* src = (const uint8_t*)buffer;
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    tcp_conn_t* conn = tcp_find(id);
+    uint32_t queued = 0;
+    int result = -1;
+    while (tcp_conns_live(conn) && (conn->state == TCP_ESTABLISHED || conn->state == TCP_CLOSE_WAIT) &&
+           !conn->fin_queued) {
+        // Top up the last segment if it hasn't gone out, then add new ones
+        while (queued < length) {
+            network_packet_t* segment = conn->snd_count ? tcp_snd_at(conn, conn->snd_count - 1) : NULL;
+            if (!segment || tcp_seg(segment)->sent || segment->size >= conn->mss) {
+                if (conn->snd_count == TCP_SND_SEGMENTS || !(segment = network_alloc_packet())) {
+                    break;
+                }
+                tcp_seg(segment)->seq = conn->snd_end;
+                tcp_seg(segment)->sent = false;
+                conn->snd_buf[(conn->snd_head + conn->snd_count) & (TCP_SND_SEGMENTS - 1)] = segment;
+                conn->snd_count++;
+            }
+            uint32_t n = conn->mss - segment->size;
+            if (n > length - queued) {
+                n = length - queued;
+            }
+            uint8_t* dest = network_packet_put(segment, n);
+            for (uint32_t i = 0; i < n; i++) {
+                dest[i] = src[queued + i];
+            }
+            queued += n;
+            conn->snd_end += n;
+        }
+        if (queued > 0 || length == 0) {
+            tcp_push(conn, false);
+            result = (int)queued;
+            break;
+        }
+        if ((result = tcp_wait(conn, &flags)) != 0) {
+            break;  // Send buffer full
+        }
+        result = -1;
+    }
+    spin_unlock_irqrestore(&tcp_lock, flags);
+    return result;
+}
+
+// Queue size bytes at offset in frame as segments of their own, each with
+// a reference on it. Sleeps for send buffer space only if wait.
+static int tcp_queue_frame(int id, uint32_t frame, uint32_t offset, uint32_t size, bool wait) {
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    tcp_conn_t* conn = tcp_find(id);
+    uint32_t queued = 0;
+    int result = -1;
+    while (tcp_conns_live(conn) && (conn->state == TCP_ESTABLISHED || conn->state == TCP_CLOSE_WAIT) &&
+           !conn->fin_queued) {
+        while (queued < size && conn->snd_count < TCP_SND_SEGMENTS) {
+            uint32_t n = size - queued < conn->mss ? size - queued : conn->mss;
+            network_packet_t* segment = network_alloc_packet();
+            if (!segment) {
+                break;
+            }
+            if (pmm_page_ref(frame) != 0 || network_packet_frag(segment, frame, offset + queued, n) != 0) {
+                network_free_packet(segment);
+                break;
+            }
+            tcp_seg(segment)->seq = conn->snd_end;
+            tcp_seg(segment)->sent = true;      // tcp_send never tops it up
+            conn->snd_buf[(conn->snd_head + conn->snd_count) & (TCP_SND_SEGMENTS - 1)] = segment;
+            conn->snd_count++;
+            queued += n;
+            conn->snd_end += n;
+        }
+        if (queued > 0 || size == 0) {
+            tcp_push(conn, false);
+            result = (int)queued;
+            break;
+        }
+        if (!wait) {
+            result = 0;
+            break;
+        }
+        if ((result = tcp_wait(conn, &flags)) != 0) {
+            break;
+        }
+        result = -1;
+    }
+    spin_unlock_irqrestore(&tcp_lock, flags);
+    return result;
+}
+
+// One page at a time: pinned outside tcp_lock (a lazy page may be read
+// in from disk), queued, and let go, the segments keeping their own
+// references until they are acknowledged
+int tcp_sendfile(int id, int fd, uint32_t offset, uint32_t length) {
+    uint32_t queued = 0;
+    int result = 0;
+    while (queued < length) {
+        uint32_t frame;
+        int available = vfs_pin_page(fd, offset + queued, &frame);
+        if (available <= 0) {
+            result = available;
+            break;
+        }
+        uint32_t n = (uint32_t)available < length - queued ? (uint32_t)available : length - queued;
+        result = tcp_queue_frame(id, frame, (offset + queued) % PAGE_SIZE, n, queued == 0);
+        network_frame_put(frame);
+        if (result <= 0) {
+            break;
+        }
+        queued += (uint32_t)result;
+        if ((uint32_t)result < n) {
+            break;  // Send buffer full
+        }
+    }
+    return queued > 0 ? (int)queued : result;
+}
+
+int tcp_recv(int id, void* buffer, uint32_t length) {
+    if (!buffer) {
+        return -1;
+    }
+    uint8_t* dest = (uint8_t*)buffer;
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    tcp_conn_t* conn = tcp_find(id);
+    int result = -1;
+    while (tcp_conns_live(conn)) {
+        if (conn->rcv_count > 0) {
+            uint32_t n = conn->rcv_count < length ? conn->rcv_count : length;
+            for (uint32_t i = 0; i < n; i++) {
+                dest[i] = conn->rcv_buf[(conn->rcv_head + i) & (TCP_RCV_BUFFER - 1)];
+            }
+            conn->rcv_head = (conn->rcv_head + n) & (TCP_RCV_BUFFER - 1);
+            conn->rcv_count -= n;
+            result = (int)n;
+            // Tell the peer once the window has opened by a useful amount
+            uint32_t advertised = conn->rcv_adv - conn->rcv_nxt;
+            uint32_t space = TCP_RCV_BUFFER - conn->rcv_count;
+            if (conn->state >= TCP_ESTABLISHED && space > advertised && space - advertised >= 2u * conn->mss) {
+                tcp_send_ack(conn);
+            }
+            break;
+        }
+        if (conn->fin_received || conn->state == TCP_CLOSED) {
+            result = conn->error ? -1 : 0;  // End of stream
+            break;
+        }
+        if (conn->state < TCP_SYN_SENT || (result = tcp_wait(conn, &flags)) != 0) {
+            break;
+        }
+        result = -1;
+    }
+    spin_unlock_irqrestore(&tcp_lock, flags);
+    return result;
+}
+
+// Queued data is still delivered: the FIN follows it. The slot is freed
+// when the connection reaches CLOSED.
+int tcp_close(int id) {
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    tcp_conn_t* conn = tcp_find(id);
+    if (!conn) {
+        spin_unlock_irqrestore(&tcp_lock, flags);
+        return -1;
+    }
+    conn->user_closed = true;
+    tcp_wake(conn);
+    switch (conn->state) {
+        case TCP_LISTEN:
+            tcp_conn_t* child;
+            POOL_FOR_EACH(tcp_conns, child) {
+                if (child->parent == conn) {
+                    tcp_abort(child, true);
+                }
+            }
+            tcp_set_closed(conn);
+            break;
+        case TCP_CLOSED:
+        case TCP_SYN_SENT:
+            tcp_set_closed(conn);
+            break;
+        case TCP_SYN_RECEIVED:
+        case TCP_ESTABLISHED:
+        case TCP_CLOSE_WAIT:
+            conn->fin_queued = true;
+            tcp_push(conn, false);
+            break;
+        default:
+            break;  // Already closing
+    }
+    spin_unlock_irqrestore(&tcp_lock, flags);
+    return 0;
+}
+
+// Drop a killed process from any connection it sleeps on
+void tcp_cancel_wait(process_t* process) {
+    uint32_t flags = spin_lock_irqsave(&tcp_lock);
+    tcp_conn_t* conn;
+    POOL_FOR_EACH(tcp_conns, conn) {
+        if (conn->waiter == process) {
+            conn->waiter = NULL;
+        }
+    }
+    spin_unlock_irqrestore(&tcp_lock, flags);
+}
+
+// Close every connection an exiting process left open
+void tcp_release_owned(process_t* process) {
+    tcp_conn_t* conn;
+    POOL_FOR_EACH(tcp_conns, conn) {
+        if (!conn->user_closed && !conn->parent && conn->owner_pid == process->pid) {
+            tcp_close(conn->id);
+        }
+    }
+}
+
+static const char* tcp_state_string(tcp_state_t state) {
+    static const char* names[] = {
+        "CLOSED", "LISTEN", "SYN_SENT", "SYN_RECEIVED", "ESTABLISHED", "FIN_WAIT_1",
+        "FIN_WAIT_2", "CLOSE_WAIT", "CLOSING", "LAST_ACK", "TIME_WAIT"
+    };
+    return state <= TCP_TIME_WAIT ? names[state] : "?";
+}
+
+void tcp_list(void) {
+    terminal_writestring("TCP Connections:\n");
+    bool found_any = false;
+    tcp_conn_t* conn;
+    POOL_FOR_EACH(tcp_conns, conn) {
+        found_any = true;
+        char local[16], remote[16];
+        network_format_ip_address(conn->local_addr, local, sizeof(local));
+        network_format_ip_address(conn->remote_addr, remote, sizeof(remote));
+        tcp_stats_t* s = &conn->stats;
+        terminal_printf("  %d  %s:%d -> %s:%d  %s  pid %d%s\n", conn->id, local, (int)conn->local_port,
+                        remote, (int)conn->remote_port, tcp_state_string(conn->state),
+                        conn->owner_pid, conn->nodelay ? "  nodelay" : "");
+        if (conn->state == TCP_LISTEN) {
+            terminal_printf("     %d waiting for accept, %d in handshake\n",
+                            (int)conn->accept_count, (int)conn->pending_children);
+            continue;
+        }
+        terminal_printf("     tx %d segs %d bytes  rx %d segs %d bytes\n",
+                        (int)s->segments_sent, (int)s->bytes_sent,
+                        (int)s->segments_received, (int)s->bytes_received);
+        terminal_printf("     rexmit %d (%d fast, %d timeouts)  dupacks %d  delayed acks %d  out of order %d\n",
+                        (int)s->retransmits, (int)s->fast_retransmits, (int)s->timeouts,
+                        (int)s->dup_acks, (int)s->delayed_acks, (int)s->out_of_order);
+        terminal_printf("     cwnd %d ssthresh %d  srtt %d ms rto %d ms  snd_wnd %d  %d in flight, %d queued\n",
+                        (int)conn->cwnd, (int)conn->ssthresh,
+                        (int)((conn->srtt >> 3) * (1000 / TIMER_FREQUENCY)),
+                        (int)(conn->rto * (1000 / TIMER_FREQUENCY)), (int)conn->snd_wnd,
+                        (int)tcp_flight(conn), (int)(conn->snd_end - conn->snd_una));
+    }
+    if (!found_any) {
+        terminal_writestring("  none\n");
+    }
+    terminal_printf("  %d resets sent, %d malformed, %d loopback drops\n",
+                    (int)tcp_resets_sent, (int)tcp_bad, (int)tcp_loopback_dropped);
+}
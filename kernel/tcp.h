@@ -0,0 +1,188 @@
+// ClaudeOS TCP - Day 21
+// Stream connections over IPv4 with NewReno congestion control
+
+#ifndef TCP_H
+#define TCP_H
+
+#include "types.h"
+#include "network.h"
+#include "timer.h"
+#include "htable.h"
+
+#define MAX_TCP_CONNECTIONS 16
+#define TCP_HASH_BUCKETS    32          // Power of two; the table starts here and grows
+#define TCP_HEADER_SIZE     20
+#define TCP_CHECKSUM_OFFSET 16
+#define IPV4_PROTO_TCP      6
+#define TCP_MSS             1460        // 1500-byte MTU less IPv4 and TCP headers
+#define TCP_SND_SEGMENTS    16          // Send buffer, in segments (power of two)
+#define TCP_RCV_BUFFER      8192        // Receive buffer bytes (power of two)
+#define TCP_BACKLOG         4           // Connections waiting for accept
+#define TCP_LOOPBACK_QUEUE  64          // Segments between local sockets (power of two)
+#define TCP_EPHEMERAL_BASE  49152
+#define TCP_INITIAL_CWND    3           // Segments (RFC 3390 for a 1460-byte MSS)
+#define TCP_DUPACK_THRESHOLD 3
+
+// Timers, in ticks
+#define TCP_RTO_INITIAL     (TIMER_FREQUENCY)           // 1 s
+#define TCP_RTO_MIN         (TIMER_FREQUENCY / 5)       // 200 ms
+#define TCP_RTO_MAX         (60 * TIMER_FREQUENCY)
+#define TCP_DELACK_TICKS    (TIMER_FREQUENCY / 25)      // 40 ms
+#define TCP_TIME_WAIT_TICKS (2 * TIMER_FREQUENCY)       // A short 2*MSL
+#define TCP_MAX_RETRIES     8
+
+// Header flags
+#define TCP_FIN             0x01
+#define TCP_SYN             0x02
+#define TCP_RST             0x04
+#define TCP_PSH             0x08
+#define TCP_ACK             0x10
+
+// Result of a call that would have to wait when the caller can't sleep
+#define TCP_WOULD_BLOCK     -2
+
+struct process;
+
+typedef struct {
+    uint16_t src_port;
+    uint16_t dest_port;
+    uint32_t seq;
+    uint32_t ack;
+    uint8_t data_offset;                // Header words in the high nibble
+    uint8_t flags;
+    uint16_t window;
+    uint16_t checksum;
+    uint16_t urgent;
+} __attribute__((packed)) tcp_header_t;
+
+typedef enum {
+    TCP_CLOSED = 0,
+    TCP_LISTEN,
+    TCP_SYN_SENT,
+    TCP_SYN_RECEIVED,
+    TCP_ESTABLISHED,
+    TCP_FIN_WAIT_1,
+    TCP_FIN_WAIT_2,
+    TCP_CLOSE_WAIT,
+    TCP_CLOSING,
+    TCP_LAST_ACK,
+    TCP_TIME_WAIT
+} tcp_state_t;
+
+typedef struct {
+    uint32_t segments_sent;
+    uint32_t segments_received;
+    uint32_t bytes_sent;                // Payload, first transmissions only
+    uint32_t bytes_received;
+    uint32_t retransmits;
+    uint32_t timeouts;
+    uint32_t fast_retransmits;
+    uint32_t dup_acks;
+    uint32_t delayed_acks;              // ACKs that rode the delayed-ACK timer
+    uint32_t out_of_order;              // Segments dropped past rcv_nxt
+} tcp_stats_t;
+
+typedef struct tcp_conn {
+    int id;                             // Pool handle: reused slots get new ids
+    bool user_closed;                   // close() called; freed once CLOSED
+    bool nodelay;                       // Nagle off
+    int owner_pid;
+    tcp_state_t state;
+    uint32_t local_addr;
+    uint32_t remote_addr;
+    uint16_t local_port;
+    uint16_t remote_port;
+    htable_node_t hash_node;            // 4-tuple hash chain
+    struct tcp_conn* parent;            // Listener a passive open came from
+    network_interface_t* iface;         // NULL for local peers
+
+    // Send side. Each queued segment is a packet buffer holding up to an
+    // MSS of payload behind full headroom; transmission attaches a packet
+    // header over it and pushes the protocol headers in front.
+    network_packet_t* snd_buf[TCP_SND_SEGMENTS];
+    uint32_t snd_head;                  // Oldest unacknowledged segment
+    uint32_t snd_count;
+    uint32_t iss;
+    uint32_t snd_una;
+    uint32_t snd_nxt;
+    uint32_t snd_max;                   // Highest sequence ever sent
+    uint32_t snd_end;                   // Just past the last queued byte (the FIN's sequence)
+    uint32_t snd_wnd;                   // Peer's advertised window
+    uint16_t mss;
+    bool fin_queued;
+
+    // Congestion control (NewReno, RFC 6582)
+    uint32_t cwnd;
+    uint32_t ssthresh;
+    uint32_t recover;                   // snd_max when recovery began
+    bool in_recovery;
+    uint32_t dup_acks;
+
+    // RTT estimate in ticks scaled by 8 (srtt) and 4 (rttvar); one
+    // segment is timed at a time and never a retransmitted one (Karn)
+    uint32_t srtt;
+    uint32_t rttvar;
+    uint32_t rto;
+    uint32_t rtt_seq;
+    uint32_t rtt_start;
+    bool rtt_timing;
+    uint32_t retries;
+
+    // Receive side
+    uint8_t* rcv_buf;                   // TCP_RCV_BUFFER bytes
+    uint32_t rcv_head;                  // Next byte the reader takes
+    uint32_t rcv_count;
+    uint32_t irs;
+    uint32_t rcv_nxt;
+    uint32_t rcv_adv;                   // Window last advertised
+    uint32_t unacked_segments;          // In-order segments not yet ACKed
+    bool fin_received;
+
+    // Deadlines; both timers just kick the TCP work item, which checks these
+    uint32_t rto_deadline;
+    uint32_t delack_deadline;
+    bool rto_armed;
+    bool delack_armed;
+    timer_event_t rto_timer;
+    timer_event_t delack_timer;
+
+    // Listener: established children waiting for accept
+    struct tcp_conn* accept_queue[TCP_BACKLOG];
+    uint32_t accept_count;
+    uint32_t pending_children;          // Still in SYN_RECEIVED
+
+    struct process* waiter;             // Blocked in connect/accept/send/recv
+    int error;                          // Set when reset or timed out
+    tcp_stats_t stats;
+} tcp_conn_t;
+
+void tcp_init(void);
+
+int tcp_socket(void);
+int tcp_bind(int id, uint16_t port);
+int tcp_listen(int id);
+int tcp_accept(int id);                 // Returns the new connection's id
+int tcp_connect(int id, uint32_t addr, uint16_t port);
+int tcp_set_nodelay(int id, bool nodelay);
+int tcp_close(int id);
+
+// Both return the bytes moved; send queues what fits and recv returns
+// what is buffered, sleeping only when nothing can be moved at all.
+// recv returns 0 once the peer has closed and everything was read.
+int tcp_send(int id, const void* buffer, uint32_t length);
+int tcp_recv(int id, void* buffer, uint32_t length);
+
+// Queue length bytes of the open file fd from offset without copying
+// them: each segment refers to the file's page (which a write then copies
+// instead) until the peer acknowledges it. Returns the bytes queued, as
+// send does; 0 at the end of the file.
+int tcp_sendfile(int id, int fd, uint32_t offset, uint32_t length);
+
+// IPv4 input for protocol 6 (IP header already pulled)
+void tcp_input(network_packet_t* packet, uint32_t src, uint32_t dest);
+
+void tcp_cancel_wait(struct process* process);
+void tcp_release_owned(struct process* process);
+void tcp_list(void);
+
+#endif // TCP_H
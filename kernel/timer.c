@@ -4,41 +4,362 @@
 #include "timer.h"
 #include "pic.h"
 #include "kernel.h"
+#include "process.h"
+#include "lock.h"
+#include "softirq.h"
+#include "vdata.h"
+#include "printk.h"
+#include "smp.h"
+#include "irq.h"
+#include "idle.h"
 
 // Global timer tick counter
 static volatile uint32_t timer_ticks = 0;
+static uint32_t last_second_tick = 0;
+
+// Sleeping processes, earliest deadline (clock_ns) first. Any CPU can go
+// to sleep, so the queue has a lock besides the interrupt flag.
+static process_t* sleep_queue = NULL;
+static spinlock_t sleep_lock;
+
+// Timer wheel: the per-tick level, the coarser levels above it, and the
+// next tick to run
+static timer_event_t* timer_wheel[TIMER_WHEEL_SLOTS];
+static timer_event_t* timer_levels[TIMER_LEVELS][TIMER_LEVEL_SLOTS];
+static spinlock_t wheel_lock;           // Unregistered; left zeroed
+static uint32_t wheel_next = 1;
+static uint32_t wheel_pending = 0;
+static uint32_t wheel_fired = 0;
+static uint32_t wheel_cascaded = 0;     // Events moved down a level
+static uint32_t wheel_batches = 0;      // Passes that fired anything
+static uint32_t wheel_largest_batch = 0;
+
+// Tickless idle: PIT clocks in the armed one-shot (0 = periodic mode), and
+// clocks of an interrupted one-shot not yet worth a whole tick
+static volatile uint32_t oneshot_clocks = 0;
+static uint32_t oneshot_residual = 0;
+static uint32_t oneshot_count = 0;
+static uint32_t ticks_skipped = 0;
+
+// TSC clock: ns = cycles * tsc_mult >> CLOCK_NS_SHIFT, zero until calibrated
+static uint32_t tsc_khz = 0;
+static uint32_t tsc_mult = 0;
+static uint64_t tsc_base = 0;
 
 // Forward declaration for uptime update
 extern void update_uptime(void);
+static void timer_softirq(void);
+static int timer_irq(void* ctx);
 
-// Initialize the timer
-void timer_init(void) {
-    // Calculate divisor for desired frequency
-    uint32_t divisor = PIT_FREQUENCY / TIMER_FREQUENCY;
-    
-    // Send command byte to PIT
+// Wrap-safe "a is at or after b"
+static inline int tick_reached(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) >= 0;
+}
+
+static inline uint32_t irq_save(void) {
+    uint32_t flags;
+    asm volatile ("pushf; pop %0; cli" : "=r" (flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint32_t flags) {
+    asm volatile ("push %0; popf" : : "r" (flags) : "memory", "cc");
+}
+
+static void pit_set_periodic(void) {
+    uint32_t divisor = TIMER_TICK_DIVISOR;
     outb(PIT_COMMAND, PIT_SELECT_CHANNEL0 | PIT_ACCESS_LOHI | PIT_MODE_SQUAREWAVE | PIT_BCD_BINARY);
-    
-    // Send divisor (low byte first, then high byte)
     outb(PIT_CHANNEL0, divisor & 0xFF);
     outb(PIT_CHANNEL0, (divisor >> 8) & 0xFF);
+}
+
+// Interrupt once after clocks PIT input clocks (mode 0 fires a single IRQ)
+static void pit_set_oneshot(uint32_t clocks) {
+    outb(PIT_COMMAND, PIT_SELECT_CHANNEL0 | PIT_ACCESS_LOHI | PIT_MODE_TERMINALCOUNT | PIT_BCD_BINARY);
+    outb(PIT_CHANNEL0, clocks & 0xFF);
+    outb(PIT_CHANNEL0, (clocks >> 8) & 0xFF);
+}
+
+static uint16_t pit_read_count(void) {
+    outb(PIT_COMMAND, PIT_SELECT_CHANNEL0 | PIT_ACCESS_LATCH);
+    uint16_t count = inb(PIT_CHANNEL0);
+    count |= (uint16_t)inb(PIT_CHANNEL0) << 8;
+    return count;
+}
+
+// Move time forward by elapsed PIT clocks, leaving the periodic tick on
+static uint32_t oneshot_finish(uint32_t elapsed) {
+    oneshot_clocks = 0;
+    pit_set_periodic();
+    elapsed += oneshot_residual;
+    oneshot_residual = elapsed % TIMER_TICK_DIVISOR;
+    return elapsed / TIMER_TICK_DIVISOR;
+}
+
+// Queue a process to be woken at wake_ns (sleep_lock held)
+static void sleep_queue_insert(process_t* process, uint64_t wake_ns) {
+    process->wake_ns = wake_ns;
+    process_t** link = &sleep_queue;
+    while (*link && (*link)->wake_ns <= wake_ns) {
+        link = &(*link)->sleep_next;
+    }
+    process->sleep_next = *link;
+    *link = process;
+}
+
+// Wake every sleeper whose deadline has passed
+int timer_expire_sleepers(void) {
+    int woken = 0;
+    uint32_t flags = spin_lock_irqsave(&sleep_lock);
+    uint64_t now = clock_ns();
+    while (sleep_queue && sleep_queue->wake_ns <= now) {
+        process_t* process = sleep_queue;
+        sleep_queue = process->sleep_next;
+        process->sleep_next = NULL;
+        process_wake(process);
+        woken++;
+    }
+    spin_unlock_irqrestore(&sleep_lock, flags);
+    return woken;
+}
+
+uint64_t timer_next_wake(void) {
+    uint32_t flags = spin_lock_irqsave(&sleep_lock);
+    uint64_t wake = sleep_queue ? sleep_queue->wake_ns : TIMER_NO_WAKE;
+    spin_unlock_irqrestore(&sleep_lock, flags);
+    return wake;
+}
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Count TSC cycles across a TIMER_CALIBRATE_MS one-shot on PIT channel 2,
+// which is polled through port 0x61 and needs no interrupts
+static void tsc_calibrate(void) {
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
+    if (!(edx & (1 << 4))) {
+        return;  // No TSC
+    }
+    
+    uint8_t gate = inb(PIT_GATE_PORT);
+    outb(PIT_GATE_PORT, (gate & ~0x02) | 0x01);     // Gate on, speaker off
+    
+    uint32_t count = PIT_FREQUENCY / (1000 / TIMER_CALIBRATE_MS);
+    outb(PIT_COMMAND, PIT_SELECT_CHANNEL2 | PIT_ACCESS_LOHI | PIT_MODE_TERMINALCOUNT | PIT_BCD_BINARY);
+    outb(PIT_CHANNEL2, count & 0xFF);
+    outb(PIT_CHANNEL2, (count >> 8) & 0xFF);
+    
+    uint64_t start = rdtsc();
+    while (!(inb(PIT_GATE_PORT) & 0x20)) {
+        // Spin until channel 2's output goes high
+    }
+    uint64_t end = rdtsc();
+    outb(PIT_GATE_PORT, gate);
+    
+    uint32_t khz = (uint32_t)(end - start) / TIMER_CALIBRATE_MS;
+    if (khz <= (uint32_t)((1000000ULL << CLOCK_NS_SHIFT) >> 32)) {
+        return;  // Implausibly slow - keep the tick clock
+    }
     
-    // Enable timer IRQ (IRQ0)
-    pic_clear_mask(IRQ0_TIMER);
+    // mult = (1e6 << shift) / khz; the quotient fits 32 bits (checked above)
+    uint64_t scaled = 1000000ULL << CLOCK_NS_SHIFT;
+    uint32_t mult;
+    asm volatile ("divl %3" : "=a" (mult), "=d" (edx)
+                  : "a" ((uint32_t)scaled), "r" (khz), "d" ((uint32_t)(scaled >> 32)));
+    tsc_khz = khz;
+    tsc_mult = mult;
+    tsc_base = rdtsc();
 }
 
-// Timer interrupt handler
-void timer_handler(void) {
-    // Increment tick counter
-    timer_ticks++;
+// Initialize the timer
+void timer_init(void) {
+    spin_lock_init(&sleep_lock, "sleep_queue");
+    softirq_register(SOFTIRQ_TIMER, timer_softirq);
+    tsc_calibrate();
+    
+    // Periodic TIMER_FREQUENCY interrupts; idle switches to one-shots
+    pit_set_periodic();
+    irq_register(IRQ0_TIMER, timer_irq, NULL);
+}
+
+// Timer interrupt handler; the scheduler's tick too until the local APICs
+// take that over
+static int timer_irq(void* ctx) {
+    (void)ctx;
+    // A one-shot stands for every tick it covered
+    uint32_t elapsed = 1;
+    if (oneshot_clocks) {
+        elapsed = oneshot_finish(oneshot_clocks);
+        ticks_skipped += elapsed - 1;
+    }
+    timer_ticks += elapsed;
+    vdata_set_ticks(timer_ticks);
     
+    // The rest is left to the softirq
+    softirq_raise(SOFTIRQ_TIMER);
+    return lapic_timer_oneshot ? IRQ_HANDLED : IRQ_HANDLED | IRQ_RESCHEDULE;
+}
+
+// Hook event onto the head of a chain (wheel_lock held)
+static void wheel_link(timer_event_t** slot, timer_event_t* event) {
+    event->next = *slot;
+    if (*slot) {
+        (*slot)->pprev = &event->next;
+    }
+    *slot = event;
+    event->pprev = slot;
+}
+
+// Unhook an armed event (wheel_lock held)
+static void wheel_unlink(timer_event_t* event) {
+    *event->pprev = event->next;
+    if (event->next) {
+        event->next->pprev = event->pprev;
+    }
+    event->next = NULL;
+    event->pprev = NULL;
+}
+
+// The slot an event due at expires belongs in, seen from wheel_next: the
+// per-tick level within a lap, else the first level whose slots are
+// coarse enough. One already due goes in the next slot to run.
+static timer_event_t** wheel_slot(uint32_t expires) {
+    uint32_t delta = expires - wheel_next;
+    if ((int32_t)delta < 0) {
+        return &timer_wheel[wheel_next & (TIMER_WHEEL_SLOTS - 1)];
+    }
+    if (delta < TIMER_WHEEL_SLOTS) {
+        return &timer_wheel[expires & (TIMER_WHEEL_SLOTS - 1)];
+    }
+    uint32_t shift = TIMER_WHEEL_BITS;
+    for (uint32_t level = 0; level < TIMER_LEVELS - 1; level++) {
+        if (delta < (1u << (shift + TIMER_LEVEL_BITS))) {
+            return &timer_levels[level][(expires >> shift) & (TIMER_LEVEL_SLOTS - 1)];
+        }
+        shift += TIMER_LEVEL_BITS;
+    }
+    return &timer_levels[TIMER_LEVELS - 1][(expires >> shift) & (TIMER_LEVEL_SLOTS - 1)];
+}
+
+// Spread one coarse slot over the levels below it (wheel_lock held)
+static void wheel_cascade(uint32_t level, uint32_t index) {
+    timer_event_t* event = timer_levels[level][index];
+    timer_levels[level][index] = NULL;
+    while (event) {
+        timer_event_t* next = event->next;
+        event->pprev = NULL;
+        wheel_link(wheel_slot(event->expires), event);
+        wheel_cascaded++;
+        event = next;
+    }
+}
+
+// Run every event due up to now. The slots of every tick since the last
+// pass are gathered into one batch under a single hold of the lock, each
+// lap boundary cascading the coarse slot that has come round; the batch
+// is then fired in order, unlocked around each callback so it can re-arm
+// or cancel timers (those still in the batch included).
+static void run_timer_wheel(void) {
+    uint32_t now = timer_ticks;
+    timer_event_t* batch = NULL;
+    timer_event_t** tail = &batch;
+    uint32_t flags = spin_lock_irqsave(&wheel_lock);
+    while (tick_reached(now, wheel_next)) {
+        uint32_t index = wheel_next & (TIMER_WHEEL_SLOTS - 1);
+        uint32_t shift = TIMER_WHEEL_BITS;
+        for (uint32_t level = 0; level < TIMER_LEVELS && index == 0; level++) {
+            index = (wheel_next >> shift) & (TIMER_LEVEL_SLOTS - 1);
+            wheel_cascade(level, index);
+            shift += TIMER_LEVEL_BITS;
+        }
+        timer_event_t** slot = &timer_wheel[wheel_next & (TIMER_WHEEL_SLOTS - 1)];
+        if (*slot) {
+            // Append the whole chain; its first event now hangs off tail
+            *tail = *slot;
+            (*slot)->pprev = tail;
+            *slot = NULL;
+            while (*tail) {
+                tail = &(*tail)->next;
+            }
+        }
+        wheel_next++;
+    }
+
+    uint32_t fired = 0;
+    while (batch) {
+        timer_event_t* event = batch;
+        wheel_unlink(event);
+        wheel_pending--;
+        fired++;
+        spin_unlock_irqrestore(&wheel_lock, flags);
+        event->func(event->arg);
+        flags = spin_lock_irqsave(&wheel_lock);
+    }
+    if (fired) {
+        wheel_fired += fired;
+        wheel_batches++;
+        if (fired > wheel_largest_batch) {
+            wheel_largest_batch = fired;
+        }
+    }
+    spin_unlock_irqrestore(&wheel_lock, flags);
+}
+
+// Timer bottom half, run as IRQ0 returns
+static void timer_softirq(void) {
     // Update uptime every second (100 ticks = 1 second at 100Hz)
-    if (timer_ticks % 100 == 0) {
+    while (timer_ticks - last_second_tick >= TIMER_FREQUENCY) {
+        last_second_tick += TIMER_FREQUENCY;
         update_uptime();
     }
     
-    // Send EOI to PIC
-    pic_send_eoi(IRQ0_TIMER);
+    timer_expire_sleepers();
+    run_timer_wheel();
+    terminal_flush();   // Output that ended mid-line
+}
+
+void timer_event_init(timer_event_t* event, void (*func)(void* arg), void* arg) {
+    event->expires = 0;
+    event->func = func;
+    event->arg = arg;
+    event->next = NULL;
+    event->pprev = NULL;
+}
+
+// Fire event ticks from now (at least one tick)
+void timer_event_arm(timer_event_t* event, uint32_t ticks) {
+    timer_event_arm_at(event, timer_ticks + (ticks ? ticks : 1));
+}
+
+// Fire event at tick (on the next one if that has passed)
+void timer_event_arm_at(timer_event_t* event, uint32_t tick) {
+    uint32_t flags = spin_lock_irqsave(&wheel_lock);
+    if (event->pprev) {
+        wheel_unlink(event);
+    } else {
+        wheel_pending++;
+    }
+    event->expires = tick;
+    wheel_link(wheel_slot(tick), event);
+    spin_unlock_irqrestore(&wheel_lock, flags);
+}
+
+// A callback already running on another CPU is not waited for
+void timer_event_cancel(timer_event_t* event) {
+    uint32_t flags = spin_lock_irqsave(&wheel_lock);
+    if (event->pprev) {
+        wheel_unlink(event);
+        wheel_pending--;
+    }
+    spin_unlock_irqrestore(&wheel_lock, flags);
+}
+
+bool timer_event_pending(timer_event_t* event) {
+    return event->pprev != NULL;
 }
 
 // Get current tick count
@@ -46,15 +367,186 @@ uint32_t timer_get_ticks(void) {
     return timer_ticks;
 }
 
+// Halt until an interrupt, or at the latest until deadline. With nothing
+// runnable the periodic tick is replaced by a single one-shot, so the CPU
+// is not woken TIMER_FREQUENCY times a second for no work.
+static void idle_until(uint32_t deadline, int has_deadline) {
+    printk_drain(0);    // The log is written when there is nothing else to do
+    terminal_flush();   // Nothing may be left unshown for a whole one-shot
+    uint32_t flags = irq_save();
+    
+    if (process_has_ready()) {
+        irq_restore(flags);
+        cpu_idle();  // The scheduler needs its ticks
+        return;
+    }
+    
+    uint32_t ticks = TIMER_ONESHOT_MAX_TICKS;
+    if (has_deadline) {
+        uint32_t remaining = tick_reached(timer_ticks, deadline) ? 1 : deadline - timer_ticks;
+        if (remaining < ticks) {
+            ticks = remaining;
+        }
+    }
+    uint64_t wake = timer_next_wake();
+    if (wake != TIMER_NO_WAKE) {
+        uint64_t now = clock_ns();
+        if (wake <= now) {
+            ticks = 1;
+        } else if (wake - now < (uint64_t)ticks * TIMER_NS_PER_TICK) {
+            ticks = ((uint32_t)(wake - now) + TIMER_NS_PER_TICK - 1) / TIMER_NS_PER_TICK;
+        }
+    }
+    
+    if (ticks > 1) {
+        oneshot_clocks = ticks * TIMER_TICK_DIVISOR;
+        oneshot_count++;
+        pit_set_oneshot(oneshot_clocks);
+    }
+    cpu_idle();
+    asm volatile ("cli");
+    
+    // Woken early by another interrupt: account for the part that ran
+    if (oneshot_clocks) {
+        uint32_t armed = oneshot_clocks;
+        uint32_t left = pit_read_count();
+        // A count past armed means it wrapped: the one-shot fired and its
+        // IRQ is still pending, which will add the last tick itself
+        uint32_t elapsed = (left <= armed) ? armed - left : armed - TIMER_TICK_DIVISOR;
+        timer_ticks += oneshot_finish(elapsed);
+        vdata_set_ticks(timer_ticks);
+        timer_expire_sleepers();
+    }
+    irq_restore(flags);
+}
+
+// Idle entry for the shell loop
+void timer_idle(void) {
+    idle_until(0, 0);
+    
+    // A sleeper woke up - let it run now rather than at the end of the slice
+    if (scheduler_preemptive && process_has_ready()) {
+        process_yield();
+    }
+}
+
 // Wait for specified number of ticks
 void timer_wait(uint32_t ticks) {
-    uint32_t start_ticks = timer_ticks;
-    while (timer_ticks < start_ticks + ticks) {
-        asm volatile ("hlt");  // Halt until next interrupt
+    uint32_t deadline = timer_ticks + ticks;
+    while (!tick_reached(timer_ticks, deadline)) {
+        idle_until(deadline, 1);  // Halt until next interrupt
+    }
+}
+
+// Block the calling process until clock_ns reaches wake_ns. The kernel
+// task (and anything run without the scheduler) can't block, and waits
+// out ticks instead.
+static void timer_sleep_until(uint64_t wake_ns, uint32_t ticks) {
+    process_t* process = current_process;
+    if (!process || process->pid == KERNEL_PID || !scheduler_preemptive) {
+        timer_wait(ticks ? ticks : 1);
+        return;
+    }
+    
+    // Blocked before it is visible to the waker, so a wake can't be lost
+    uint32_t flags = spin_lock_irqsave(&sleep_lock);
+    process_prepare_block();
+    sleep_queue_insert(process, wake_ns);
+    smp_timer_pull(wake_ns);
+    spin_unlock_irqrestore(&sleep_lock, flags);
+    process_sleep_while(process->state, PROCESS_BLOCKED);
+}
+
+// Block the calling process for at least ms milliseconds
+void timer_sleep(uint32_t ms) {
+    timer_sleep_until(clock_ns() + (uint64_t)ms * 1000000, (ms * TIMER_FREQUENCY + 999) / 1000);
+}
+
+// The same in microseconds; only as fine as the tick without a TSC
+void timer_sleep_us(uint32_t us) {
+    uint32_t us_per_tick = 1000000 / TIMER_FREQUENCY;
+    timer_sleep_until(clock_ns() + (uint64_t)us * 1000, (us + us_per_tick - 1) / us_per_tick);
+}
+
+// Take a process off the sleep queue (it was killed while sleeping)
+// Have a process that is blocking on something else woken at tick at the
+// latest. Whoever wakes it first, it calls timer_cancel_sleep afterwards.
+void timer_wake_at(process_t* process, uint32_t tick) {
+    uint64_t wake_ns = clock_ns();
+    if (!tick_reached(timer_ticks, tick)) {
+        wake_ns += (uint64_t)(tick - timer_ticks) * TIMER_NS_PER_TICK;
+    }
+    uint32_t flags = spin_lock_irqsave(&sleep_lock);
+    sleep_queue_insert(process, wake_ns);
+    smp_timer_pull(wake_ns);
+    spin_unlock_irqrestore(&sleep_lock, flags);
+}
+
+void timer_cancel_sleep(process_t* process) {
+    uint32_t flags = spin_lock_irqsave(&sleep_lock);
+    process_t** link = &sleep_queue;
+    while (*link && *link != process) {
+        link = &(*link)->sleep_next;
     }
+    if (*link) {
+        *link = process->sleep_next;
+        process->sleep_next = NULL;
+    }
+    spin_unlock_irqrestore(&sleep_lock, flags);
+}
+
+// Raw TSC cycles since calibration (0 without a TSC)
+uint64_t clock_cycles(void) {
+    return tsc_khz ? rdtsc() - tsc_base : 0;
+}
+
+// Nanoseconds since boot; tick resolution when there's no usable TSC
+uint64_t clock_ns(void) {
+    if (!tsc_khz) {
+        return (uint64_t)timer_ticks * (1000000000 / TIMER_FREQUENCY);
+    }
+    // Split the multiply so 64-bit cycle counts can't overflow it
+    uint64_t cycles = rdtsc() - tsc_base;
+    uint64_t high = (uint64_t)(uint32_t)(cycles >> 32) * tsc_mult;
+    uint64_t low = (uint64_t)(uint32_t)cycles * tsc_mult;
+    return (high << (32 - CLOCK_NS_SHIFT)) + (low >> CLOCK_NS_SHIFT);
+}
+
+// Calibrated TSC frequency in kHz (0 if the tick clock is in use)
+uint32_t clock_tsc_khz(void) {
+    return tsc_khz;
+}
+
+// The cycles-to-ns factor and the TSC at clock zero, for vdata
+void clock_tsc_params(uint32_t* mult, uint64_t* base) {
+    *mult = tsc_mult;
+    *base = tsc_base;
 }
 
 // Get uptime in seconds
 uint32_t get_uptime_seconds(void) {
     return timer_ticks / TIMER_FREQUENCY;
-}
\ No newline at end of file
+}
+
+// Debug function to dump timer statistics
+void timer_dump_stats(void) {
+    int sleepers = 0;
+    for (process_t* p = sleep_queue; p; p = p->sleep_next) {
+        sleepers++;
+    }
+    terminal_writestring("Timer Statistics:\n");
+    terminal_printf("  Ticks: %d (%d Hz)\n", (int)timer_ticks, TIMER_FREQUENCY);
+    if (tsc_khz) {
+        terminal_printf("  TSC: %d kHz\n", (int)tsc_khz);
+    } else {
+        terminal_writestring("  TSC: not available (tick clock)\n");
+    }
+    terminal_printf("  Sleeping processes: %d\n", sleepers);
+    terminal_printf("  Scheduler tick: %s\n", lapic_timer_oneshot ? "per-CPU local APIC one-shots"
+                                                                 : "PIT (BSP), periodic local APIC (APs)");
+    terminal_printf("  Tickless one-shots: %d, ticks skipped: %d\n",
+                    (int)oneshot_count, (int)ticks_skipped);
+    terminal_printf("  Timer wheel: %d pending, %d fired in %d batches (largest %d), %d cascaded\n",
+                    (int)wheel_pending, (int)wheel_fired, (int)wheel_batches,
+                    (int)wheel_largest_batch, (int)wheel_cascaded);
+}
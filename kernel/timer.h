@@ -32,12 +32,69 @@
 // Timer frequency
 #define PIT_FREQUENCY           1193182  // PIT oscillator frequency (Hz)
 #define TIMER_FREQUENCY         100      // Desired timer frequency (Hz)
+#define TIMER_TICK_DIVISOR      (PIT_FREQUENCY / TIMER_FREQUENCY)
+#define TIMER_NS_PER_TICK       (1000000000 / TIMER_FREQUENCY)
+#define TIMER_SLICE_NS          TIMER_NS_PER_TICK   // Scheduler quantum unit
+
+// TSC calibration: the PIT channel 2 gate/status port and the window
+#define PIT_GATE_PORT           0x61     // Bit 0: channel 2 gate, bit 5: channel 2 output
+#define TIMER_CALIBRATE_MS      10
+#define CLOCK_NS_SHIFT          22       // Fixed-point shift of the cycles-to-ns factor
+
+// Tickless idle: the longest one-shot the 16-bit PIT counter can hold
+#define TIMER_ONESHOT_MAX_TICKS (0xFFFF / TIMER_TICK_DIVISOR)
+
+// Hierarchical timer wheel: a level of one slot per tick for the next
+// TIMER_WHEEL_SLOTS ticks, then levels whose slots each cover a whole lap
+// of the one below. Arming and cancelling are O(1); an event far out sits
+// untouched until its slot comes round and cascades it a level down, so
+// pending timers cost a tick nothing until they are nearly due.
+#define TIMER_WHEEL_BITS        8
+#define TIMER_WHEEL_SLOTS       (1u << TIMER_WHEEL_BITS)
+#define TIMER_LEVEL_BITS        6
+#define TIMER_LEVEL_SLOTS       (1u << TIMER_LEVEL_BITS)
+#define TIMER_LEVELS            4        // Above the first: 8 + 4 * 6 bits covers every tick
+
+// Callback timer. It runs once, in the timer softirq, and must not block;
+// it may re-arm itself.
+typedef struct timer_event {
+    uint32_t expires;                   // Tick it is due at
+    void (*func)(void* arg);
+    void* arg;
+    struct timer_event* next;
+    struct timer_event** pprev;         // NULL while not armed
+} timer_event_t;
 
 // Function declarations
 void timer_init(void);
-void timer_handler(void);
 uint32_t timer_get_ticks(void);
 void timer_wait(uint32_t ticks);
 uint32_t get_uptime_seconds(void);
 
+// High-resolution monotonic clock (TSC, falls back to ticks)
+uint64_t clock_cycles(void);
+uint64_t clock_ns(void);
+uint32_t clock_tsc_khz(void);
+void clock_tsc_params(uint32_t* mult, uint64_t* base);
+
+// Sleeping and tickless idle
+struct process;
+void timer_sleep(uint32_t ms);
+void timer_sleep_us(uint32_t us);
+void timer_wake_at(struct process* process, uint32_t tick);
+void timer_cancel_sleep(struct process* process);
+void timer_idle(void);
+
+// Sleep deadlines for the per-CPU one-shot timers
+#define TIMER_NO_WAKE           0xFFFFFFFFFFFFFFFFULL
+uint64_t timer_next_wake(void);         // clock_ns of the earliest sleeper, or TIMER_NO_WAKE
+int timer_expire_sleepers(void);        // Wake the due ones; returns how many
+
+void timer_event_init(timer_event_t* event, void (*func)(void* arg), void* arg);
+void timer_event_arm(timer_event_t* event, uint32_t ticks);    // Re-arms if pending
+void timer_event_arm_at(timer_event_t* event, uint32_t tick);  // At an absolute tick; likewise
+void timer_event_cancel(timer_event_t* event);
+bool timer_event_pending(timer_event_t* event);
+void timer_dump_stats(void);
+
 #endif // TIMER_H
\ No newline at end of file
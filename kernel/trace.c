@@ -0,0 +1,215 @@
+// ClaudeOS Static Tracepoints Implementation - Day 21
+// A CPU's ring is only written by that CPU, but an interrupt can trace in
+// the middle of a record, so slots are claimed with an atomic add and the
+// record filled in afterwards. Readers turn tracing off while they look.
+
+#include "trace.h"
+#include "kernel.h"
+#include "smp.h"
+#include "timer.h"
+#include "serial.h"
+#include "string.h"
+
+typedef struct {
+    volatile uint32_t head;             // Records ever written here
+    trace_record_t records[TRACE_RECORDS];
+} trace_ring_t;
+
+typedef struct {
+    const char* name;
+    const char* arg0;                   // How the dump labels each argument
+    const char* arg1;
+    bool arg1_hex;
+} trace_event_t;
+
+static const trace_event_t trace_events[TRACE_EVENTS] = {
+    { "switch",  "from",     "to",     false },
+    { "kmalloc", "size",     "at",     true  },
+    { "ipc",     "to",       "size",   false },
+    { "irq",     "vector",   "eip",    true  },
+    { "read",    "fd",       "size",   false },
+    { "create",  "pid",      "slot",   false },
+};
+
+volatile uint32_t trace_enabled_mask = 0;
+
+static trace_ring_t trace_rings[SMP_MAX_CPUS];
+static int trace_com2_ready = 0;        // 1 once serial_init found COM2, -1 if it didn't
+
+void trace_record(uint32_t event, uint32_t arg0, uint32_t arg1) {
+    uint32_t cpu = (uint32_t)(smp_current_cpu() - cpus);
+    trace_ring_t* ring = &trace_rings[cpu];
+    uint32_t slot = __sync_fetch_and_add(&ring->head, 1) & (TRACE_RECORDS - 1);
+    trace_record_t* record = &ring->records[slot];
+    record->tsc = clock_cycles();
+    record->cpu = (uint16_t)cpu;
+    record->event = (uint16_t)event;
+    record->arg0 = arg0;
+    record->arg1 = arg1;
+}
+
+// Oldest record still in a ring, and how many follow it
+static uint32_t trace_window(const trace_ring_t* ring, uint32_t* first) {
+    uint32_t head = ring->head;
+    uint32_t count = head < TRACE_RECORDS ? head : TRACE_RECORDS;
+    *first = head - count;
+    return count;
+}
+
+static int trace_event_by_name(const char* name) {
+    for (int e = 0; e < TRACE_EVENTS; e++) {
+        if (strcmp(trace_events[e].name, name) == 0) {
+            return e;
+        }
+    }
+    return -1;
+}
+
+static void trace_status(void) {
+    terminal_writestring("Tracepoints:");
+    for (int e = 0; e < TRACE_EVENTS; e++) {
+        terminal_printf(" %s%s", trace_events[e].name,
+                        (trace_enabled_mask & (1u << e)) ? "(on)" : "");
+    }
+    terminal_writestring("\n");
+    for (uint32_t c = 0; c < SMP_MAX_CPUS; c++) {
+        if (trace_rings[c].head) {
+            terminal_printf("  CPU %d: %d records written, %d kept\n", (int)c,
+                            (int)trace_rings[c].head,
+                            (int)(trace_rings[c].head < TRACE_RECORDS ? trace_rings[c].head
+                                                                      : TRACE_RECORDS));
+        }
+    }
+}
+
+// Nanoseconds between two TSC readings, saturating at 32 bits
+static uint32_t trace_delta_ns(uint64_t from, uint64_t to) {
+    uint32_t mult;
+    uint64_t base;
+    clock_tsc_params(&mult, &base);
+    uint64_t cycles = to - from;
+    if (cycles > 0xFFFFFFFF) {
+        return 0xFFFFFFFF;
+    }
+    uint64_t ns = ((uint64_t)(uint32_t)cycles * mult) >> CLOCK_NS_SHIFT;
+    return ns > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)ns;
+}
+
+// itoa takes an int, so addresses from 2GB up would come out negative
+static void trace_format_hex(uint32_t value, char* out) {
+    out[0] = '0';
+    out[1] = 'x';
+    for (int i = 0; i < 8; i++) {
+        out[2 + i] = "0123456789abcdef"[(value >> (28 - 4 * i)) & 0xF];
+    }
+    out[10] = '\0';
+}
+
+static void trace_dump(uint32_t last) {
+    for (uint32_t c = 0; c < SMP_MAX_CPUS; c++) {
+        const trace_ring_t* ring = &trace_rings[c];
+        uint32_t first;
+        uint32_t count = trace_window(ring, &first);
+        if (!count) {
+            continue;
+        }
+        if (count > last) {
+            first += count - last;
+            count = last;
+        }
+        terminal_printf("CPU %d (ns since the previous record):\n", (int)c);
+        uint64_t previous = ring->records[first & (TRACE_RECORDS - 1)].tsc;
+        for (uint32_t i = 0; i < count; i++) {
+            const trace_record_t* record = &ring->records[(first + i) & (TRACE_RECORDS - 1)];
+            uint32_t event = record->event;
+            uint32_t delta = trace_delta_ns(previous, record->tsc);
+            previous = record->tsc;
+            if (event >= TRACE_EVENTS) {
+                continue;
+            }
+            const trace_event_t* info = &trace_events[event];
+            char arg1[16];
+            if (info->arg1_hex) {
+                trace_format_hex(record->arg1, arg1);
+            } else {
+                itoa((int)record->arg1, arg1, 10);
+            }
+            terminal_printf("  +%d %s %s %d %s %s\n", (int)delta, info->name, info->arg0,
+                            (int)record->arg0, info->arg1, arg1);
+        }
+    }
+}
+
+// Header, then every CPU's records oldest first, as they sit in memory
+static void trace_send_serial(void) {
+    if (trace_com2_ready == 0) {
+        trace_com2_ready = serial_init(SERIAL_COM2_BASE) == 0 ? 1 : -1;
+    }
+    if (trace_com2_ready < 0) {
+        terminal_writestring("No UART at COM2\n");
+        return;
+    }
+    uint32_t total = 0;
+    for (uint32_t c = 0; c < SMP_MAX_CPUS; c++) {
+        uint32_t first;
+        total += trace_window(&trace_rings[c], &first);
+    }
+    uint32_t header[4] = { TRACE_SERIAL_MAGIC, clock_tsc_khz(), sizeof(trace_record_t), total };
+    serial_write(SERIAL_COM2_BASE, (const char*)header, sizeof(header));
+    for (uint32_t c = 0; c < SMP_MAX_CPUS; c++) {
+        const trace_ring_t* ring = &trace_rings[c];
+        uint32_t first;
+        uint32_t count = trace_window(ring, &first);
+        for (uint32_t i = 0; i < count; i++) {
+            const trace_record_t* record = &ring->records[(first + i) & (TRACE_RECORDS - 1)];
+            serial_write(SERIAL_COM2_BASE, (const char*)record, sizeof(trace_record_t));
+        }
+    }
+    terminal_printf("Sent %d records of %d bytes to COM2\n", (int)total, (int)sizeof(trace_record_t));
+}
+
+void trace_command(int argc, char argv[][64]) {
+    if (argc == 1) {
+        trace_status();
+        return;
+    }
+    if (strcmp(argv[1], "on") == 0 || strcmp(argv[1], "off") == 0) {
+        uint32_t mask = 0;
+        for (int i = 2; i < argc; i++) {
+            int event = trace_event_by_name(argv[i]);
+            if (event < 0) {
+                terminal_printf("Unknown event '%s'\n", argv[i]);
+                return;
+            }
+            mask |= 1u << event;
+        }
+        if (argc == 2) {
+            mask = (1u << TRACE_EVENTS) - 1;
+        }
+        if (argv[1][1] == 'n') {
+            trace_enabled_mask |= mask;
+        } else {
+            trace_enabled_mask &= ~mask;
+        }
+        trace_status();
+        return;
+    }
+
+    // Nothing is recorded while the rings are read
+    uint32_t enabled = trace_enabled_mask;
+    trace_enabled_mask = 0;
+    if (argc == 2 && strcmp(argv[1], "clear") == 0) {
+        for (uint32_t c = 0; c < SMP_MAX_CPUS; c++) {
+            trace_rings[c].head = 0;
+        }
+        terminal_writestring("Trace rings cleared\n");
+    } else if (argc <= 3 && strcmp(argv[1], "dump") == 0) {
+        int last = argc == 3 ? atoi(argv[2]) : 20;
+        trace_dump(last > 0 ? (uint32_t)last : 20);
+    } else if (argc == 2 && strcmp(argv[1], "serial") == 0) {
+        trace_send_serial();
+    } else {
+        terminal_writestring("Usage: trace [on|off [event...] | clear | dump [n] | serial]\n");
+    }
+    trace_enabled_mask = enabled;
+}
@@ -0,0 +1,47 @@
+// ClaudeOS Static Tracepoints - Day 21
+// TRACE(event, a, b) in a hot path costs one load and a not-taken branch
+// while its event is off. When on, it writes a fixed-size record - TSC,
+// CPU, event and two arguments - into the current CPU's ring, overwriting
+// the oldest. The shell's trace command turns events on, dumps the rings
+// or sends them over COM2 as the raw records.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "types.h"
+
+// Events (bit numbers in trace_enabled_mask) and their arguments
+#define TRACE_SWITCH        0           // From pid, to pid
+#define TRACE_KMALLOC       1           // Size, address
+#define TRACE_IPC_SEND      2           // Receiver pid, size
+#define TRACE_IRQ           3           // Vector, interrupted EIP
+#define TRACE_VFS_READ      4           // Descriptor, size asked for
+#define TRACE_PROC_CREATE   5           // New pid, process table slot
+#define TRACE_EVENTS        6
+
+#define TRACE_RECORDS       512         // Per CPU; a power of two
+#define TRACE_SERIAL_MAGIC  0x31435254  // "TRC1", ahead of the records on COM2
+
+typedef struct {
+    uint64_t tsc;
+    uint16_t cpu;
+    uint16_t event;
+    uint32_t arg0;
+    uint32_t arg1;
+} __attribute__((packed)) trace_record_t;
+
+extern volatile uint32_t trace_enabled_mask;
+
+#define TRACE(event, a, b) do { \
+    if (__builtin_expect(trace_enabled_mask & (1u << (event)), 0)) { \
+        trace_record((event), (uint32_t)(a), (uint32_t)(b)); \
+    } \
+} while (0)
+
+// Write a record; use TRACE() for the enable check
+void trace_record(uint32_t event, uint32_t arg0, uint32_t arg1);
+
+// Shell: trace [on|off [event...] | clear | dump [n] | serial]
+void trace_command(int argc, char argv[][64]);
+
+#endif // TRACE_H
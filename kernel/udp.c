@@ -0,0 +1,347 @@
+// ClaudeOS UDP Implementation - Day 21
+// Sockets are found by local port through a hash; datagrams to our own
+// addresses skip the wire and go straight to the receiving socket
+
+#include "udp.h"
+#include "ipv4.h"
+#include "process.h"
+#include "kernel.h"
+#include "string.h"
+#include "pool.h"
+
+#define UDP_PORT_HASH_BITS  5           // log2(UDP_PORT_BUCKETS)
+
+// Source of a queued datagram, kept in the packet's cb
+typedef struct {
+    uint32_t src;
+    uint16_t src_port;
+} udp_cb_t;
+
+DEFINE_POOL(udp_sockets, udp_socket_t, MAX_UDP_SOCKETS);
+static udp_socket_t* udp_ports[UDP_PORT_BUCKETS];
+static spinlock_t udp_lock;             // Unregistered; guards allocation and the port hash
+static uint16_t next_ephemeral = UDP_EPHEMERAL_BASE;
+static uint32_t udp_no_port = 0;        // Datagrams for ports nobody has bound
+static uint32_t udp_bad = 0;            // Short or failing the checksum
+
+static inline uint32_t udp_port_hash(uint16_t port) {
+    return ((uint32_t)port * 2654435761u) >> (32 - UDP_PORT_HASH_BITS);
+}
+
+static inline bool udp_can_sleep(process_t* process) {
+    return process && process->pid != KERNEL_PID && scheduler_preemptive;
+}
+
+static inline udp_cb_t* udp_cb(network_packet_t* packet) {
+    return (udp_cb_t*)packet->cb;
+}
+
+// Bound socket on port (udp_lock held)
+static udp_socket_t* udp_lookup(uint16_t port) {
+    for (udp_socket_t* sock = udp_ports[udp_port_hash(port)]; sock; sock = sock->next) {
+        if (sock->local_port == port) {
+            return sock;
+        }
+    }
+    return NULL;
+}
+
+static udp_socket_t* udp_find(int id) {
+    return udp_sockets_lookup(id);
+}
+
+int udp_socket(void) {
+    udp_socket_t* sock = NULL;
+    uint32_t flags = spin_lock_irqsave(&udp_lock);
+    sock = udp_sockets_alloc();
+    if (sock) {
+        sock->id = udp_sockets_handle(sock);
+    }
+    spin_unlock_irqrestore(&udp_lock, flags);
+    if (!sock) {
+        return -1;
+    }
+    sock->owner_pid = current_process ? current_process->pid : KERNEL_PID;
+    sock->local_port = 0;
+    sock->receiver = NULL;
+    sock->next = NULL;
+    sock->rx_datagrams = 0;
+    sock->tx_datagrams = 0;
+    sock->rx_dropped = 0;
+    ring_init(&sock->rx_ring, sock->rx_slots, UDP_RX_QUEUE, sizeof(network_packet_t*));
+    return sock->id;
+}
+
+// Hash sock on port (udp_lock held); port 0 picks a free ephemeral port
+static int udp_bind_locked(udp_socket_t* sock, uint16_t port) {
+    if (sock->local_port) {
+        return -1;  // Already bound
+    }
+    if (port == 0) {
+        for (uint32_t tries = 0; tries < 0x10000 - UDP_EPHEMERAL_BASE; tries++) {
+            uint16_t candidate = next_ephemeral;
+            next_ephemeral = next_ephemeral == 0xFFFF ? UDP_EPHEMERAL_BASE : next_ephemeral + 1;
+            if (!udp_lookup(candidate)) {
+                port = candidate;
+                break;
+            }
+        }
+        if (port == 0) {
+            return -1;
+        }
+    } else if (udp_lookup(port)) {
+        return -1;  // In use
+    }
+    sock->local_port = port;
+    uint32_t bucket = udp_port_hash(port);
+    sock->next = udp_ports[bucket];
+    udp_ports[bucket] = sock;
+    return 0;
+}
+
+int udp_bind(int id, uint16_t port) {
+    uint32_t flags = spin_lock_irqsave(&udp_lock);
+    udp_socket_t* sock = udp_find(id);
+    int result = sock ? udp_bind_locked(sock, port) : -1;
+    spin_unlock_irqrestore(&udp_lock, flags);
+    return result;
+}
+
+int udp_close(int id) {
+    uint32_t flags = spin_lock_irqsave(&udp_lock);
+    udp_socket_t* sock = udp_find(id);
+    if (!sock) {
+        spin_unlock_irqrestore(&udp_lock, flags);
+        return -1;
+    }
+    if (sock->local_port) {
+        udp_socket_t** link = &udp_ports[udp_port_hash(sock->local_port)];
+        while (*link && *link != sock) {
+            link = &(*link)->next;
+        }
+        if (*link) {
+            *link = sock->next;
+        }
+        sock->local_port = 0;
+    }
+    // Unhashed, so no producer can reach it any more
+    spin_lock(&sock->lock);
+    process_t* receiver = sock->receiver;
+    sock->receiver = NULL;
+    spin_unlock(&sock->lock);
+    network_packet_t* packet;
+    while (ring_pop(&sock->rx_ring, &packet) == 0) {
+        network_free_packet(packet);
+    }
+    udp_sockets_free(sock);
+    spin_unlock_irqrestore(&udp_lock, flags);
+
+    if (receiver) {
+        process_wake(receiver);  // Its receive fails now
+    }
+    return 0;
+}
+
+// Queue a datagram (data at the payload) on the socket bound to port
+static void udp_deliver(network_packet_t* packet, uint16_t port) {
+    uint32_t flags = spin_lock_irqsave(&udp_lock);
+    udp_socket_t* sock = udp_lookup(port);
+    if (!sock) {
+        udp_no_port++;
+        spin_unlock_irqrestore(&udp_lock, flags);
+        network_free_packet(packet);
+        return;
+    }
+    spin_lock(&sock->lock);
+    process_t* receiver = NULL;
+    bool queued = ring_push(&sock->rx_ring, &packet) == 0;
+    if (queued) {
+        sock->rx_datagrams++;
+        receiver = sock->receiver;
+        sock->receiver = NULL;
+    } else {
+        sock->rx_dropped++;
+    }
+    spin_unlock(&sock->lock);
+    spin_unlock_irqrestore(&udp_lock, flags);
+
+    if (!queued) {
+        network_free_packet(packet);
+    } else if (receiver) {
+        process_wake(receiver);
+    }
+}
+
+void udp_input(network_packet_t* packet, uint32_t src, uint32_t dest) {
+    udp_header_t* udp = (udp_header_t*)packet->data;
+    uint16_t length = packet->size >= UDP_HEADER_SIZE ? net_ntohs(udp->length) : 0;
+    if (length < UDP_HEADER_SIZE || length > packet->size) {
+        udp_bad++;
+        network_free_packet(packet);
+        return;
+    }
+    packet->size = length;
+    if (udp->checksum && !(packet->csum & NET_CSUM_L4_OK)) {
+        uint32_t sum = (src >> 16) + (src & 0xFFFF) + (dest >> 16) + (dest & 0xFFFF) +
+                       IPV4_PROTO_UDP + length;
+        if (ipv4_checksum_fold(ipv4_checksum_add(sum, packet->data, length)) != 0) {
+            udp_bad++;
+            network_free_packet(packet);
+            return;
+        }
+    }
+    udp_cb(packet)->src = src;
+    udp_cb(packet)->src_port = net_ntohs(udp->src_port);
+    uint16_t port = net_ntohs(udp->dest_port);
+    network_packet_pull(packet, UDP_HEADER_SIZE);
+    udp_deliver(packet, port);
+}
+
+int udp_send(int id, udp_msg_t* msgs, int count) {
+    if (!msgs || count <= 0) {
+        return -1;
+    }
+    uint32_t flags = spin_lock_irqsave(&udp_lock);
+    udp_socket_t* sock = udp_find(id);
+    if (sock && !sock->local_port) {
+        udp_bind_locked(sock, 0);  // Sending implies an ephemeral bind
+    }
+    uint16_t src_port = sock ? sock->local_port : 0;
+    spin_unlock_irqrestore(&udp_lock, flags);
+    if (!sock || !src_port) {
+        return -1;
+    }
+
+    // Consecutive datagrams to one address share a single route lookup
+    uint32_t routed_addr = 0;
+    network_interface_t* iface = NULL;
+    int sent = 0;
+    for (; sent < count; sent++) {
+        udp_msg_t* msg = &msgs[sent];
+        if (!msg->buffer || msg->length > UDP_MAX_PAYLOAD) {
+            break;
+        }
+        network_packet_t* packet = network_alloc_packet();
+        uint8_t* payload = packet ? network_packet_put(packet, msg->length) : NULL;
+        if (!payload) {
+            network_free_packet(packet);
+            break;
+        }
+        memcpy(payload, msg->buffer, msg->length);
+
+        if (ipv4_is_local(msg->addr)) {
+            udp_cb(packet)->src = msg->addr;
+            udp_cb(packet)->src_port = src_port;
+            udp_deliver(packet, msg->port);
+            sock->tx_datagrams++;
+            continue;
+        }
+
+        if (!iface || msg->addr != routed_addr) {
+            iface = ipv4_route(msg->addr);
+            routed_addr = msg->addr;
+        }
+        udp_header_t* udp = (udp_header_t*)network_packet_push(packet, UDP_HEADER_SIZE);
+        if (!iface || !udp) {
+            network_free_packet(packet);
+            break;
+        }
+        uint16_t length = (uint16_t)packet->size;
+        udp->src_port = net_htons(src_port);
+        udp->dest_port = net_htons(msg->port);
+        udp->length = net_htons(length);
+        ipv4_l4_checksum(iface, packet, iface->ip_address, msg->addr, IPV4_PROTO_UDP,
+                         UDP_CHECKSUM_OFFSET);
+        if (ipv4_output(iface, msg->addr, IPV4_PROTO_UDP, packet) != 0) {
+            break;
+        }
+        sock->tx_datagrams++;
+    }
+    return sent > 0 ? sent : -1;
+}
+
+int udp_recv(int id, udp_msg_t* msgs, int count) {
+    if (!msgs || count <= 0) {
+        return -1;
+    }
+    udp_socket_t* sock = udp_find(id);
+    if (!sock) {
+        return -1;
+    }
+
+    process_t* process = current_process;
+    uint32_t flags = spin_lock_irqsave(&sock->lock);
+    while (ring_empty(&sock->rx_ring)) {
+        if (!udp_sockets_live(sock) || sock->id != id) {
+            spin_unlock_irqrestore(&sock->lock, flags);
+            return -1;  // Closed while we slept
+        }
+        if (!udp_can_sleep(process)) {
+            spin_unlock_irqrestore(&sock->lock, flags);
+            return UDP_WOULD_BLOCK;
+        }
+        sock->receiver = process;
+        process_prepare_block();
+        spin_unlock_irqrestore(&sock->lock, flags);
+
+        process_sleep_while(sock->receiver, process);
+        flags = spin_lock_irqsave(&sock->lock);
+    }
+    spin_unlock_irqrestore(&sock->lock, flags);
+
+    // Whatever is queued, up to count, without waiting for more
+    int received = 0;
+    network_packet_t* packet;
+    while (received < count && ring_pop(&sock->rx_ring, &packet) == 0) {
+        udp_msg_t* msg = &msgs[received++];
+        uint32_t n = packet->size < msg->length ? packet->size : msg->length;
+        memcpy(msg->buffer, packet->data, n);
+        msg->length = n;
+        msg->addr = udp_cb(packet)->src;
+        msg->port = udp_cb(packet)->src_port;
+        network_free_packet(packet);
+    }
+    return received;
+}
+
+// Drop a killed process from any socket it sleeps on
+void udp_cancel_wait(process_t* process) {
+    udp_socket_t* sock;
+    POOL_FOR_EACH(udp_sockets, sock) {
+        if (sock->receiver != process) {
+            continue;
+        }
+        uint32_t flags = spin_lock_irqsave(&sock->lock);
+        if (sock->receiver == process) {
+            sock->receiver = NULL;
+        }
+        spin_unlock_irqrestore(&sock->lock, flags);
+    }
+}
+
+// Close every socket an exiting process left open
+void udp_release_owned(process_t* process) {
+    udp_socket_t* sock;
+    POOL_FOR_EACH(udp_sockets, sock) {
+        if (sock->owner_pid == process->pid) {
+            udp_close(sock->id);
+        }
+    }
+}
+
+void udp_list(void) {
+    terminal_writestring("UDP Sockets:\n");
+    bool found_any = false;
+    udp_socket_t* sock;
+    POOL_FOR_EACH(udp_sockets, sock) {
+        found_any = true;
+        terminal_printf("  %d  port %d  pid %d  rx %d (%d queued, %d dropped)  tx %d\n",
+                        sock->id, (int)sock->local_port, (int)sock->owner_pid,
+                        (int)sock->rx_datagrams, (int)ring_count(&sock->rx_ring),
+                        (int)sock->rx_dropped, (int)sock->tx_datagrams);
+    }
+    if (!found_any) {
+        terminal_writestring("  none\n");
+    }
+    terminal_printf("  %d datagrams to unbound ports, %d malformed\n", (int)udp_no_port, (int)udp_bad);
+}
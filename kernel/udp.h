@@ -0,0 +1,75 @@
+// ClaudeOS UDP Sockets - Day 21
+// Datagram sockets over IPv4 with batched send/receive system calls
+
+#ifndef UDP_H
+#define UDP_H
+
+#include "types.h"
+#include "lock.h"
+#include "ring.h"
+#include "network.h"
+
+#define MAX_UDP_SOCKETS     16
+#define UDP_PORT_BUCKETS    32          // Power of two
+#define UDP_RX_QUEUE        32          // Datagrams queued per socket (power of two)
+#define UDP_HEADER_SIZE     8
+#define UDP_CHECKSUM_OFFSET 6
+#define IPV4_PROTO_UDP      17
+#define UDP_EPHEMERAL_BASE  49152       // First port handed out by an implicit bind
+#define UDP_MAX_PAYLOAD     (MAX_PACKET_SIZE - 14 - 20 - UDP_HEADER_SIZE)
+
+// udp_recv result with nothing queued and a caller that can't sleep
+#define UDP_WOULD_BLOCK     -2
+
+struct process;
+
+typedef struct {
+    uint16_t src_port;
+    uint16_t dest_port;
+    uint16_t length;
+    uint16_t checksum;
+} __attribute__((packed)) udp_header_t;
+
+// One datagram in a batch. On send, addr/port name the destination and
+// length the bytes at buffer; on receive they are filled in with the
+// source and the bytes copied (a longer datagram is truncated).
+typedef struct {
+    uint32_t addr;                      // IPv4 address, host byte order
+    uint16_t port;
+    uint16_t reserved;
+    void* buffer;
+    uint32_t length;
+} udp_msg_t;
+
+typedef struct udp_socket {
+    int id;                             // Pool handle: reused slots get new ids
+    int owner_pid;
+    uint16_t local_port;                // 0 until bound
+    ring_t rx_ring;                     // Producers serialise on lock; the owner consumes
+    network_packet_t* rx_slots[UDP_RX_QUEUE];
+    spinlock_t lock;                    // Unregistered; left zeroed
+    struct process* receiver;           // Sleeping on an empty queue
+    struct udp_socket* next;            // Port hash chain
+    uint32_t rx_datagrams;
+    uint32_t tx_datagrams;
+    uint32_t rx_dropped;                // Queue full
+} udp_socket_t;
+
+int udp_socket(void);
+int udp_bind(int id, uint16_t port);
+int udp_close(int id);
+
+// Send or receive up to count datagrams in one call; both return the
+// number moved. Receive sleeps only until the first datagram arrives,
+// returning UDP_WOULD_BLOCK instead if the caller can't sleep.
+int udp_send(int id, udp_msg_t* msgs, int count);
+int udp_recv(int id, udp_msg_t* msgs, int count);
+
+// IPv4 input for protocol 17 (IP header already pulled)
+void udp_input(network_packet_t* packet, uint32_t src, uint32_t dest);
+
+void udp_cancel_wait(struct process* process);
+void udp_release_owned(struct process* process);
+void udp_list(void);
+
+#endif // UDP_H
@@ -0,0 +1,346 @@
+// ClaudeOS Submission/Completion Rings Implementation - Day 21
+// The kernel reaches each shared page through the direct map, so the
+// timer can post a completion whatever address space is loaded
+
+#include "uring.h"
+#include "syscall.h"
+#include "kernel.h"
+#include "process.h"
+#include "timer.h"
+#include "lock.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "vfs.h"
+#include "softirq.h"
+
+struct uring;
+
+typedef struct {
+    timer_event_t event;
+    struct uring* ring;
+    uint32_t user_data;
+    bool used;
+} uring_timer_t;
+
+typedef struct {
+    vfs_aio_t aio;                      // First: the done callback casts back
+    struct uring* ring;
+    uint32_t user_data;
+    volatile bool used;
+} uring_file_io_t;
+
+typedef struct uring {
+    bool in_use;
+    int owner_pid;
+    uint32_t frame;
+    uring_shared_t* shared;             // The frame, through the direct map
+    uring_shared_t* user;               // Where the owner sees it
+    spinlock_t lock;                    // Unregistered; guards the kernel's indices
+    uint32_t in_flight;                 // Taken, completion not yet posted
+    process_t* waiter;                  // In uring_enter, until enough results
+    uint32_t wait_for;
+    uring_timer_t timers[URING_MAX_TIMERS];
+    uring_file_io_t file_io[URING_MAX_FILE_IO];
+    volatile uint32_t file_io_pending;  // Keeps the slot from reuse until they land
+    uint32_t enters;
+    uint32_t submitted;
+    uint32_t completed;
+} uring_t;
+
+static uring_t urings[URING_MAX_RINGS];
+static spinlock_t uring_alloc_lock;     // Unregistered
+
+static inline bool uring_can_sleep(process_t* process) {
+    return process && process->pid != KERNEL_PID && scheduler_preemptive;
+}
+
+static uring_t* uring_find(int pid) {
+    for (int i = 0; i < URING_MAX_RINGS; i++) {
+        if (urings[i].in_use && urings[i].owner_pid == pid) {
+            return &urings[i];
+        }
+    }
+    return NULL;
+}
+
+static inline uint32_t uring_ready(uring_t* ring) {
+    return ring->shared->cq_tail - ring->shared->cq_head;
+}
+
+uring_shared_t* uring_setup(void) {
+    process_t* process = current_process ? current_process : process_find(KERNEL_PID);
+    if (!process) {
+        return NULL;
+    }
+    uring_t* ring = uring_find(process->pid);
+    if (ring) {
+        return ring->user;
+    }
+
+    uint32_t frame = pmm_alloc_zeroed_page();
+    if (!frame) {
+        return NULL;
+    }
+    uint32_t flags = spin_lock_irqsave(&uring_alloc_lock);
+    for (int i = 0; i < URING_MAX_RINGS && !ring; i++) {
+        if (!urings[i].in_use && urings[i].file_io_pending == 0) {
+            ring = &urings[i];
+            ring->in_use = true;
+            ring->owner_pid = process->pid;
+        }
+    }
+    spin_unlock_irqrestore(&uring_alloc_lock, flags);
+    if (!ring) {
+        pmm_free_page(frame);
+        return NULL;
+    }
+
+    ring->frame = frame;
+    ring->shared = (uring_shared_t*)PHYS_TO_VIRT(frame);
+    ring->shared->sq_entries = URING_SQ_ENTRIES;
+    ring->shared->cq_entries = URING_CQ_ENTRIES;
+    ring->in_flight = 0;
+    ring->waiter = NULL;
+    ring->enters = 0;
+    ring->submitted = 0;
+    ring->completed = 0;
+    for (int i = 0; i < URING_MAX_TIMERS; i++) {
+        ring->timers[i].used = false;
+    }
+
+    // A directory of its own gets the page at URING_VIRT; its teardown
+    // drops the mapping's reference and uring_release_owned the ring's
+    page_directory_t* dir = process->page_directory;
+    if (dir && dir != kernel_page_directory) {
+        pmm_page_ref(frame);
+        vmm_map_page(dir, URING_VIRT, frame, PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER);
+        ring->user = (uring_shared_t*)URING_VIRT;
+    } else {
+        ring->user = ring->shared;
+    }
+    return ring->user;
+}
+
+// Post a result (any context) and wake the waiter once it has enough
+static void uring_complete(uring_t* ring, uint32_t user_data, int result) {
+    uint32_t flags = spin_lock_irqsave(&ring->lock);
+    if (!ring->in_use) {
+        spin_unlock_irqrestore(&ring->lock, flags);
+        return;  // Released meanwhile
+    }
+    uring_shared_t* shared = ring->shared;
+    uring_cqe_t* cqe = &shared->cq[shared->cq_tail & (URING_CQ_ENTRIES - 1)];
+    cqe->user_data = user_data;
+    cqe->result = result;
+    asm volatile ("" ::: "memory");     // Entry before the index
+    shared->cq_tail++;
+    ring->in_flight--;
+    ring->completed++;
+    process_t* waiter = ring->waiter;
+    if (waiter && (uring_ready(ring) >= ring->wait_for || ring->in_flight == 0)) {
+        ring->waiter = NULL;
+        process_wake(waiter);
+    }
+    spin_unlock_irqrestore(&ring->lock, flags);
+}
+
+static void uring_timer_fire(void* arg) {
+    uring_timer_t* timer = (uring_timer_t*)arg;
+    if (!timer->used) {
+        return;
+    }
+    timer->used = false;
+    uring_complete(timer->ring, timer->user_data, 0);
+}
+
+// SYS_SLEEP completes from the timer instead of blocking the batch
+static int uring_sleep(uring_t* ring, uint32_t ms, uint32_t user_data) {
+    for (int i = 0; i < URING_MAX_TIMERS; i++) {
+        uring_timer_t* timer = &ring->timers[i];
+        if (timer->used) {
+            continue;
+        }
+        timer->ring = ring;
+        timer->user_data = user_data;
+        timer->used = true;
+        timer_event_init(&timer->event, uring_timer_fire, timer);
+        timer_event_arm(&timer->event, (ms * TIMER_FREQUENCY + 999) / 1000);
+        return 0;
+    }
+    return URING_ERROR_BUSY;
+}
+
+static void uring_file_io_done(vfs_aio_t* aio) {
+    uring_file_io_t* io = (uring_file_io_t*)aio;
+    uring_t* ring = io->ring;
+    uint32_t user_data = io->user_data;
+    io->used = false;
+    uring_complete(ring, user_data, aio->result);
+    __sync_fetch_and_sub(&ring->file_io_pending, 1);
+}
+
+// SYS_PREAD/SYS_PWRITE (fd, buffer, count, offset) as vfs_*_async: true
+// if it went out (uring_file_io_done posts the result), else false with
+// *result to post. With every slot busy the call is made in place.
+static bool uring_file_io(uring_t* ring, const uring_sqe_t* sqe, int* result) {
+    if (!syscall_args_ok(sqe->syscall, sqe->args)) {
+        *result = SYSCALL_FAULT;
+        return false;
+    }
+    for (int i = 0; i < URING_MAX_FILE_IO; i++) {
+        uring_file_io_t* io = &ring->file_io[i];
+        if (io->used) {
+            continue;
+        }
+        io->used = true;
+        io->ring = ring;
+        io->user_data = sqe->user_data;
+        io->aio.buffer = (void*)sqe->args[1];
+        io->aio.size = sqe->args[2];
+        io->aio.offset = sqe->args[3];
+        io->aio.done = uring_file_io_done;
+        __sync_fetch_and_add(&ring->file_io_pending, 1);
+        *result = sqe->syscall == SYS_PREAD ? vfs_read_async((int)sqe->args[0], &io->aio)
+                                            : vfs_write_async((int)sqe->args[0], &io->aio);
+        if (*result == VFS_SUCCESS) {
+            return true;
+        }
+        io->used = false;
+        __sync_fetch_and_sub(&ring->file_io_pending, 1);
+        return false;
+    }
+    *result = syscall_dispatch(sqe->syscall, sqe->args[0], sqe->args[1], sqe->args[2], sqe->args[3]);
+    return false;
+}
+
+// Take the next submission if its completion is sure to have room
+static bool uring_take(uring_t* ring, uring_sqe_t* sqe) {
+    uint32_t flags = spin_lock_irqsave(&ring->lock);
+    uring_shared_t* shared = ring->shared;
+    uint32_t head = shared->sq_head;
+    bool taken = false;
+    if (head != shared->sq_tail && uring_ready(ring) + ring->in_flight < URING_CQ_ENTRIES) {
+        *sqe = shared->sq[head & (URING_SQ_ENTRIES - 1)];
+        shared->sq_head = head + 1;
+        ring->in_flight++;
+        ring->submitted++;
+        taken = true;
+    }
+    spin_unlock_irqrestore(&ring->lock, flags);
+    return taken;
+}
+
+// Block until enough results are posted or nothing is left to post them
+static void uring_wait(uring_t* ring, uint32_t min_complete) {
+    process_t* process = current_process;
+    while (1) {
+        uint32_t flags = spin_lock_irqsave(&ring->lock);
+        if (uring_ready(ring) >= min_complete || ring->in_flight == 0) {
+            spin_unlock_irqrestore(&ring->lock, flags);
+            return;
+        }
+        if (!uring_can_sleep(process)) {
+            spin_unlock_irqrestore(&ring->lock, flags);
+            workqueue_idle();           // File I/O, when there is no worker to run it
+            asm volatile ("sti; hlt");  // Sleeps complete from the timer
+            continue;
+        }
+        ring->waiter = process;
+        ring->wait_for = min_complete;
+        process_prepare_block();
+        spin_unlock_irqrestore(&ring->lock, flags);
+        process_sleep_while(ring->waiter, process);
+    }
+}
+
+int uring_enter(uint32_t to_submit, uint32_t min_complete) {
+    process_t* process = current_process ? current_process : process_find(KERNEL_PID);
+    uring_t* ring = process ? uring_find(process->pid) : NULL;
+    if (!ring) {
+        return -1;
+    }
+    ring->enters++;
+
+    uint32_t taken = 0;
+    uring_sqe_t sqe;
+    while (taken < to_submit && uring_take(ring, &sqe)) {
+        taken++;
+        int result;
+        if (sqe.syscall == SYS_SLEEP) {
+            result = uring_sleep(ring, sqe.args[0], sqe.user_data);
+            if (result == 0) {
+                continue;  // Posted by uring_timer_fire
+            }
+        } else if ((sqe.syscall == SYS_PREAD || sqe.syscall == SYS_PWRITE) && ring->user == ring->shared) {
+            // Its buffers are mapped wherever the completion runs
+            if (uring_file_io(ring, &sqe, &result)) {
+                continue;  // Posted by uring_file_io_done
+            }
+        } else if (sqe.syscall == SYS_RING_SETUP || sqe.syscall == SYS_RING_ENTER) {
+            result = SYSCALL_INVALID;
+        } else {
+            result = syscall_dispatch(sqe.syscall, sqe.args[0], sqe.args[1], sqe.args[2], sqe.args[3]);
+        }
+        uring_complete(ring, sqe.user_data, result);
+    }
+
+    if (min_complete > URING_CQ_ENTRIES) {
+        min_complete = URING_CQ_ENTRIES;
+    }
+    uring_wait(ring, min_complete);
+    return (int)taken;
+}
+
+void uring_cancel_wait(process_t* process) {
+    for (int i = 0; i < URING_MAX_RINGS; i++) {
+        uring_t* ring = &urings[i];
+        if (!ring->in_use || ring->waiter != process) {
+            continue;
+        }
+        uint32_t flags = spin_lock_irqsave(&ring->lock);
+        if (ring->waiter == process) {
+            ring->waiter = NULL;
+        }
+        spin_unlock_irqrestore(&ring->lock, flags);
+    }
+}
+
+// Drop pending sleeps and the ring of an exiting process
+void uring_release_owned(process_t* process) {
+    uring_t* ring = uring_find(process->pid);
+    if (!ring) {
+        return;
+    }
+    uint32_t flags = spin_lock_irqsave(&ring->lock);
+    ring->in_use = false;
+    ring->waiter = NULL;
+    spin_unlock_irqrestore(&ring->lock, flags);
+    for (int i = 0; i < URING_MAX_TIMERS; i++) {
+        if (ring->timers[i].used) {
+            timer_event_cancel(&ring->timers[i].event);
+            ring->timers[i].used = false;
+        }
+    }
+    pmm_free_page(ring->frame);
+    ring->frame = 0;
+    ring->shared = NULL;
+}
+
+void uring_list(void) {
+    terminal_writestring("Submission rings:\n");
+    bool found_any = false;
+    for (int i = 0; i < URING_MAX_RINGS; i++) {
+        uring_t* ring = &urings[i];
+        if (!ring->in_use) {
+            continue;
+        }
+        found_any = true;
+        terminal_printf("  pid %d  %d enters, %d calls, %d done, %d in flight (%d file I/O), "
+                        "%d results waiting\n",
+                        ring->owner_pid, (int)ring->enters, (int)ring->submitted, (int)ring->completed,
+                        (int)ring->in_flight, (int)ring->file_io_pending, (int)uring_ready(ring));
+    }
+    if (!found_any) {
+        terminal_writestring("  none\n");
+    }
+}
@@ -0,0 +1,97 @@
+// ClaudeOS Submission/Completion Rings - Day 21
+// A page shared with the kernel holding a ring of system calls to make and
+// a ring of their results, so one ring_enter runs a whole batch. Each
+// submission is an ordinary system call (number and four arguments) and
+// goes through syscall_dispatch and its pointer checks; SYS_SLEEP is the
+// exception and completes later, from the timer. So do SYS_PREAD and
+// SYS_PWRITE on a ring whose process shares the kernel's directory (its
+// buffers are reachable from any context): they go to vfs_*_async, and
+// many file reads can be in flight from one task.
+
+#ifndef URING_H
+#define URING_H
+
+#include "types.h"
+
+#define URING_VIRT          0xBFFFC000  // Below the vdata pages
+#define URING_SQ_ENTRIES    64          // Powers of two
+#define URING_CQ_ENTRIES    128
+#define URING_MAX_RINGS     8           // One per process
+#define URING_MAX_TIMERS    8           // SYS_SLEEP submissions pending per ring
+#define URING_MAX_FILE_IO   16          // Asynchronous preads and pwrites per ring
+
+#define URING_ERROR_BUSY    -4          // Too many sleeps already pending
+
+typedef struct {
+    uint32_t syscall;                   // SYS_* number
+    uint32_t args[4];
+    uint32_t user_data;                 // Copied to the completion
+} uring_sqe_t;
+
+typedef struct {
+    uint32_t user_data;
+    int32_t result;                     // What the call returned
+} uring_cqe_t;
+
+// Indices run freely and are masked on access. The process writes
+// submissions and moves sq_tail and cq_head; the kernel moves sq_head and
+// cq_tail. A submission is only taken when its completion is sure to fit,
+// so the completion ring never overflows.
+typedef struct {
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint32_t reserved[10];
+    uring_sqe_t sq[URING_SQ_ENTRIES];
+    uring_cqe_t cq[URING_CQ_ENTRIES];
+} uring_shared_t;
+
+struct process;
+
+// The caller's ring, created and mapped on first use (at URING_VIRT, or at
+// its frame for processes in the kernel directory); NULL if none is free
+uring_shared_t* uring_setup(void);
+
+// Run up to to_submit queued calls, then wait until at least min_complete
+// results are waiting (or nothing is left in flight). Returns how many
+// calls were taken, -1 without a ring.
+int uring_enter(uint32_t to_submit, uint32_t min_complete);
+
+// Process side: queue one call (0 if the ring is full) and take one result
+static inline int uring_submit(uring_shared_t* ring, uint32_t syscall, uint32_t arg1, uint32_t arg2,
+                               uint32_t arg3, uint32_t arg4, uint32_t user_data) {
+    uint32_t tail = ring->sq_tail;
+    if (tail - ring->sq_head == ring->sq_entries) {
+        return 0;
+    }
+    uring_sqe_t* sqe = &ring->sq[tail & (URING_SQ_ENTRIES - 1)];
+    sqe->syscall = syscall;
+    sqe->args[0] = arg1;
+    sqe->args[1] = arg2;
+    sqe->args[2] = arg3;
+    sqe->args[3] = arg4;
+    sqe->user_data = user_data;
+    asm volatile ("" ::: "memory");     // Entry before the index
+    ring->sq_tail = tail + 1;
+    return 1;
+}
+
+static inline int uring_reap(uring_shared_t* ring, uring_cqe_t* cqe) {
+    uint32_t head = ring->cq_head;
+    if (head == ring->cq_tail) {
+        return 0;
+    }
+    asm volatile ("" ::: "memory");
+    *cqe = ring->cq[head & (URING_CQ_ENTRIES - 1)];
+    ring->cq_head = head + 1;
+    return 1;
+}
+
+void uring_cancel_wait(struct process* process);
+void uring_release_owned(struct process* process);
+void uring_list(void);
+
+#endif // URING_H
@@ -0,0 +1,35 @@
+// ClaudeOS User Mode Implementation - Day 21
+// The image frames are part of the kernel and shared by every process, so
+// each mapping takes a reference for vmm_destroy_directory to drop
+
+#include "user.h"
+#include "pmm.h"
+
+int user_map(page_directory_t* dir) {
+    uint32_t pages = ((uint32_t)_user_end - (uint32_t)_user_start) / PAGE_SIZE;
+    for (uint32_t i = 0; i < pages; i++) {
+        uint32_t frame = (uint32_t)_user_load_start + i * PAGE_SIZE;
+        if (pmm_page_ref(frame) != 0) {
+            return -1;
+        }
+        vmm_map_page(dir, USER_IMAGE_VIRT + i * PAGE_SIZE, frame, PAGE_PRESENT | PAGE_USER);
+    }
+    return user_map_stack(dir);
+}
+
+int user_map_stack(page_directory_t* dir) {
+    for (uint32_t i = 1; i <= USER_STACK_PAGES; i++) {
+        uint32_t frame = pmm_alloc_zeroed_page();
+        if (!frame) {
+            return -1;  // What was mapped goes with the directory
+        }
+        vmm_map_page(dir, USER_STACK_TOP - i * PAGE_SIZE, frame,
+                     PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER);
+    }
+    return 0;
+}
+
+bool user_is_entry(void (*entry)(void)) {
+    uint32_t addr = (uint32_t)entry;
+    return addr >= (uint32_t)_user_start && addr < (uint32_t)_user_end;
+}
@@ -0,0 +1,40 @@
+// ClaudeOS User Mode - Day 21
+// Ring 3 code lives in its own image section, linked at USER_IMAGE_VIRT
+// (see linker.ld) and mapped read-only into each user process's directory
+// next to a private stack. Everything it calls must be in that section
+// too, which in practice means system calls through syscall_fast.
+
+#ifndef USER_H
+#define USER_H
+
+#include "types.h"
+#include "vmm.h"
+
+#define USER_IMAGE_VIRT     0x40000000          // Must match linker.ld
+#define USER_STACK_TOP      0xBFFFB000          // Below the ring page, one unmapped page between
+#define USER_STACK_PAGES    2
+#define USER_STACK_BOTTOM   (USER_STACK_TOP - USER_STACK_PAGES * PAGE_SIZE)
+#define USER_EFLAGS         0x202               // IF set, IOPL 0: no port access
+
+// Place a function or constant in the ring 3 image. Code there is built
+// without optimisation, so inline helpers from the kernel's headers are
+// real calls into supervisor pages and can't be used.
+#define USER_TEXT   __attribute__((section(".user_text"), noinline))
+#define USER_RODATA __attribute__((section(".user_rodata")))
+
+// Linker symbols: the image as processes see it, and where it was loaded
+extern char _user_start[];
+extern char _user_end[];
+extern char _user_load_start[];
+
+// Map the image and a fresh stack into a process's own directory
+// (0 on success, -1 if out of frames)
+int user_map(page_directory_t* dir);
+
+// Just the stack, for programs loaded from a file
+int user_map_stack(page_directory_t* dir);
+
+// Whether entry lies in the ring 3 image
+bool user_is_entry(void (*entry)(void));
+
+#endif // USER_H
@@ -0,0 +1,48 @@
+// ClaudeOS Ring 3 Test Programs - Day 21
+// Everything these touch - code, strings, the system call stub - is in the
+// user image. The file is built without PIC, since the PC thunks and the
+// GOT would otherwise be kernel pages.
+
+#include "syscall.h"
+#include "sysenter.h"
+#include "user.h"
+
+static const char user_hello_message[] USER_RODATA = "Hello from ring 3\n";
+static const char user_fault_message[] USER_RODATA = "Ring 3: writing to kernel memory...\n";
+static const char user_badptr_passed[] USER_RODATA = "Ring 3: unmapped pointers refused\n";
+static const char user_badptr_failed[] USER_RODATA = "Ring 3: FAILED - an unmapped pointer was accepted\n";
+
+#define USER_UNMAPPED   0x20000000      // Below the image, in no process's areas
+
+USER_TEXT void test_user_hello(void) {
+    for (int i = 0; i < 3; i++) {
+        syscall_fast(SYS_WRITE, (uint32_t)user_hello_message, 0, 0, 0);
+        syscall_fast(SYS_SLEEP, 100, 0, 0, 0);
+    }
+    syscall_fast(SYS_EXIT, 0, 0, 0, 0);
+}
+
+// The page fault ends this process and nothing else
+USER_TEXT void test_user_fault(void) {
+    syscall_fast(SYS_WRITE, (uint32_t)user_fault_message, 0, 0, 0);
+    *(volatile uint32_t*)0x100000 = 0;
+    syscall_fast(SYS_EXIT, 1, 0, 0, 0);
+}
+
+// In range but unmapped, as a string, a buffer and an iovec base: each
+// call must come back SYSCALL_FAULT rather than fault in the kernel
+USER_TEXT void test_user_badptr(void) {
+    vfs_iovec_t iov = { (void*)USER_UNMAPPED, 16 };
+    int failures = 0;
+    if (syscall_fast(SYS_WRITE, USER_UNMAPPED, 0, 0, 0) != SYSCALL_FAULT) {
+        failures++;
+    }
+    if (syscall_fast(SYS_READ, 0, USER_UNMAPPED, 16, 0) != SYSCALL_FAULT) {
+        failures++;
+    }
+    if (syscall_fast(SYS_READV, 0, (uint32_t)&iov, 1, 0) != SYSCALL_FAULT) {
+        failures++;
+    }
+    syscall_fast(SYS_WRITE, (uint32_t)(failures ? user_badptr_failed : user_badptr_passed), 0, 0, 0);
+    syscall_fast(SYS_EXIT, failures, 0, 0, 0);
+}
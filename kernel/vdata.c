@@ -0,0 +1,77 @@
+// ClaudeOS Shared Data Pages Implementation - Day 21
+// The kernel writes the frames through the direct map; address spaces
+// only ever see them read-only at VDATA_VIRT
+
+#include "vdata.h"
+#include "kernel.h"
+#include "process.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "sysenter.h"
+
+static uint32_t clock_frame = 0;
+static vdata_clock_t* clock_page = NULL;   // NULL until vdata_init
+
+// One frame holding the PIDs, mapped read-only into dir
+static void vdata_map_process(page_directory_t* dir, int pid, int parent_pid) {
+    uint32_t frame = pmm_alloc_zeroed_page();
+    if (!frame) {
+        return;
+    }
+    vdata_process_t* page = (vdata_process_t*)PHYS_TO_VIRT(frame);
+    page->pid = pid;
+    page->parent_pid = parent_pid;
+    vmm_map_page(dir, VDATA_PROCESS_VIRT, frame, PAGE_PRESENT | PAGE_USER);
+}
+
+void vdata_init(void) {
+    if (clock_page || !kernel_page_directory) {
+        return;
+    }
+    clock_frame = pmm_alloc_zeroed_page();
+    if (!clock_frame) {
+        terminal_writestring("[VDATA] No frame for the clock page\n");
+        return;
+    }
+    vdata_clock_t* page = (vdata_clock_t*)PHYS_TO_VIRT(clock_frame);
+    uint64_t base;
+    page->tick_frequency = TIMER_FREQUENCY;
+    page->tsc_khz = clock_tsc_khz();
+    clock_tsc_params(&page->tsc_mult, &base);
+    page->tsc_shift = CLOCK_NS_SHIFT;
+    page->tsc_base_low = (uint32_t)base;
+    page->tsc_base_high = (uint32_t)(base >> 32);
+    page->ticks = timer_get_ticks();
+    page->uptime_seconds = page->ticks / TIMER_FREQUENCY;
+    page->flags = sysenter_enabled ? VDATA_FLAG_SYSENTER : 0;
+    clock_page = page;
+
+    // The kernel task and anything sharing its directory see PID 0
+    vmm_map_page(kernel_page_directory, VDATA_VIRT, clock_frame, PAGE_PRESENT | PAGE_USER);
+    vdata_map_process(kernel_page_directory, 0, INVALID_PID);
+}
+
+void vdata_map(process_t* process) {
+    page_directory_t* dir = process->page_directory;
+    if (!clock_page || !dir || dir == kernel_page_directory) {
+        return;
+    }
+    // vmm_destroy_directory drops one reference per mapping
+    pmm_page_ref(clock_frame);
+    vmm_map_page(dir, VDATA_VIRT, clock_frame, PAGE_PRESENT | PAGE_USER);
+    vdata_map_process(dir, process->pid, process->parent_pid);
+}
+
+// Called with interrupts off by the one CPU that counts ticks
+void vdata_set_ticks(uint32_t ticks) {
+    vdata_clock_t* page = clock_page;
+    if (!page) {
+        return;
+    }
+    page->sequence++;
+    asm volatile ("" ::: "memory");
+    page->ticks = ticks;
+    page->uptime_seconds = ticks / TIMER_FREQUENCY;
+    asm volatile ("" ::: "memory");
+    page->sequence++;
+}
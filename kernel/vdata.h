@@ -0,0 +1,92 @@
+// ClaudeOS Shared Data Pages - Day 21
+// Read-only pages mapped into every address space so getpid, uptime and
+// clock reads need no system call: one clock page shared by all, which the
+// timer updates under a sequence count, and one page per process
+
+#ifndef VDATA_H
+#define VDATA_H
+
+#include "types.h"
+#include "timer.h"
+
+#define VDATA_VIRT          0xBFFFE000          // Clock page, one frame for everyone
+#define VDATA_PROCESS_VIRT  (VDATA_VIRT + 4096) // This process's page
+
+typedef struct {
+    volatile uint32_t sequence;         // Odd while the kernel is writing
+    volatile uint32_t ticks;
+    volatile uint32_t uptime_seconds;
+    uint32_t tick_frequency;
+    uint32_t tsc_khz;                   // 0: no TSC, use the ticks
+    uint32_t tsc_mult;                  // ns = (cycles * tsc_mult) >> tsc_shift
+    uint32_t tsc_shift;
+    uint32_t tsc_base_low;              // TSC at clock zero
+    uint32_t tsc_base_high;
+    uint32_t flags;                     // VDATA_FLAG_* (offset read by kernel/sysenter.asm)
+} vdata_clock_t;
+
+#define VDATA_FLAG_SYSENTER 1           // syscall_fast may use SYSENTER
+
+typedef struct {
+    int32_t pid;
+    int32_t parent_pid;
+} vdata_process_t;
+
+struct process;
+
+// Map the pages into the kernel directory (after vmm_init)
+void vdata_init(void);
+
+// Map them into a new process's directory, its page holding its PIDs
+void vdata_map(struct process* process);
+
+// Timer side: publish a new tick count
+void vdata_set_ticks(uint32_t ticks);
+
+// Reader side, safe at any privilege level once the pages are mapped
+static inline const volatile vdata_clock_t* vdata_clock(void) {
+    return (const volatile vdata_clock_t*)VDATA_VIRT;
+}
+
+static inline int vdata_getpid(void) {
+    return ((const volatile vdata_process_t*)VDATA_PROCESS_VIRT)->pid;
+}
+
+static inline uint32_t vdata_ticks(void) {
+    return vdata_clock()->ticks;
+}
+
+static inline uint32_t vdata_uptime(void) {
+    return vdata_clock()->uptime_seconds;
+}
+
+// clock_ns() without entering the kernel
+static inline uint64_t vdata_clock_ns(void) {
+    const volatile vdata_clock_t* clock = vdata_clock();
+    uint32_t sequence, ticks, khz, mult, shift, base_low, base_high;
+    do {
+        while ((sequence = clock->sequence) & 1) {
+            asm volatile ("pause");
+        }
+        asm volatile ("" ::: "memory");
+        ticks = clock->ticks;
+        khz = clock->tsc_khz;
+        mult = clock->tsc_mult;
+        shift = clock->tsc_shift;
+        base_low = clock->tsc_base_low;
+        base_high = clock->tsc_base_high;
+        asm volatile ("" ::: "memory");
+    } while (clock->sequence != sequence);
+
+    if (!khz) {
+        return (uint64_t)ticks * (1000000000 / TIMER_FREQUENCY);
+    }
+    uint32_t lo, hi;
+    asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+    uint64_t cycles = (((uint64_t)hi << 32) | lo) - (((uint64_t)base_high << 32) | base_low);
+    uint64_t high = (uint64_t)(uint32_t)(cycles >> 32) * mult;
+    uint64_t low = (uint64_t)(uint32_t)cycles * mult;
+    return (high << (32 - shift)) + (low >> shift);
+}
+
+#endif // VDATA_H
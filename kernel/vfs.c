@@ -0,0 +1,782 @@
+// ClaudeOS Virtual File System Implementation - Day 21
+// Paths are normalized, then handed to the mount that is their longest
+// prefix with that prefix cut off. Descriptors live here, for every file
+// system at once: each names a mount, the file system's handle and the
+// position, so backends only ever see reads and writes at an offset.
+// Every process has its own descriptor table, which only it touches while
+// it runs and cleanup empties after it has gone.
+
+#include "vfs.h"
+#include "kernel.h"
+#include "lock.h"
+#include "slab.h"
+#include "string.h"
+#include "process.h"
+#include "trace.h"
+
+#define VFS_FD_WORDS        (VFS_MAX_FD / 32)
+#define VFS_STATIC_TABLES   4           // Seeded tables, so the shell opens files without a heap
+
+typedef struct vfs_mount {
+    char path[VFS_MAX_PATH];            // Normalized: "/", or no trailing slash
+    uint32_t length;
+    const vfs_ops_t* ops;
+    void* data;
+    uint32_t users;                     // Open files, and calls under way
+    bool in_use;
+} vfs_mount_t;
+
+typedef struct {
+    vfs_mount_t* mount;
+    int32_t handle;
+    uint32_t position;
+    uint32_t flags;
+    bool in_use;
+} vfs_file_t;
+
+// A process's descriptors. free_map has a bit set for every free fd, so
+// the lowest one is a bsf away and exit visits only the open ones.
+typedef struct vfs_fd_table {
+    vfs_file_t files[VFS_MAX_FD];
+    uint32_t free_map[VFS_FD_WORDS];
+    uint32_t open;
+} vfs_fd_table_t;
+
+static spinlock_t vfs_lock;             // Unregistered; guards the mount table
+static vfs_mount_t vfs_mounts[VFS_MAX_MOUNTS];
+static kmem_cache_t vfs_table_cache;
+static vfs_fd_table_t vfs_table_storage[VFS_STATIC_TABLES];
+static bool vfs_cache_ready = false;
+
+void vfs_init(void) {
+    memset(vfs_mounts, 0, sizeof(vfs_mounts));
+    if (!vfs_cache_ready) {
+        kmem_cache_init(&vfs_table_cache, "vfs_fd_table", sizeof(vfs_fd_table_t), NULL);
+        kmem_cache_seed(&vfs_table_cache, vfs_table_storage, VFS_STATIC_TABLES);
+        vfs_cache_ready = true;
+    }
+}
+
+static inline uint32_t vfs_lowest_bit(uint32_t value) {
+    uint32_t index;
+    asm volatile ("bsf %1, %0" : "=r" (index) : "rm" (value));
+    return index;
+}
+
+// The process file calls act for (the kernel task before the scheduler has
+// a current process)
+static process_t* vfs_caller(void) {
+    return current_process ? current_process : process_find(KERNEL_PID);
+}
+
+// The caller's table, created on first use (NULL if out of memory)
+static vfs_fd_table_t* vfs_table(bool create) {
+    process_t* process = vfs_caller();
+    if (!process) {
+        return NULL;
+    }
+    if (!process->files && create) {
+        vfs_fd_table_t* table = (vfs_fd_table_t*)kmem_cache_alloc(&vfs_table_cache);
+        if (!table) {
+            return NULL;
+        }
+        memset(table, 0, sizeof(vfs_fd_table_t));
+        memset(table->free_map, 0xFF, sizeof(table->free_map));
+        process->files = table;
+    }
+    return process->files;
+}
+
+// Lowest free descriptor, marked in use; -1 when all are taken
+static int vfs_fd_alloc(vfs_fd_table_t* table) {
+    for (uint32_t w = 0; w < VFS_FD_WORDS; w++) {
+        if (table->free_map[w]) {
+            uint32_t bit = vfs_lowest_bit(table->free_map[w]);
+            table->free_map[w] &= ~(1u << bit);
+            table->open++;
+            table->files[w * 32 + bit].in_use = true;
+            return (int)(w * 32 + bit);
+        }
+    }
+    return -1;
+}
+
+static void vfs_fd_free(vfs_fd_table_t* table, int fd) {
+    table->files[fd].in_use = false;
+    table->files[fd].mount = NULL;
+    table->free_map[fd / 32] |= 1u << (fd % 32);
+    table->open--;
+}
+
+// Append one component to a path being normalized, applying "." and ".."
+static int vfs_push(char* out, uint32_t* len, const char* name, uint32_t name_len) {
+    if (name_len == 0 || (name_len == 1 && name[0] == '.')) {
+        return VFS_SUCCESS;
+    }
+    if (name_len == 2 && name[0] == '.' && name[1] == '.') {
+        while (*len > 0 && out[*len - 1] != '/') {
+            (*len)--;
+        }
+        if (*len > 0) {
+            (*len)--;
+        }
+        out[*len] = '\0';
+        return VFS_SUCCESS;
+    }
+    if (name_len >= VFS_MAX_NAME || *len + 1 + name_len >= VFS_MAX_PATH) {
+        return VFS_ERROR_INVALID_PATH;
+    }
+    out[(*len)++] = '/';
+    memcpy(out + *len, name, name_len);
+    *len += name_len;
+    out[*len] = '\0';
+    return VFS_SUCCESS;
+}
+
+// Absolute form of path without ".", ".." or repeated and trailing slashes
+static int vfs_normalize(const char* path, char* out) {
+    if (!path || path[0] == '\0') {
+        return VFS_ERROR_INVALID_PATH;
+    }
+    uint32_t len = 0;
+    out[0] = '\0';
+    while (*path) {
+        const char* end = path;
+        while (*end && *end != '/') {
+            end++;
+        }
+        int result = vfs_push(out, &len, path, (uint32_t)(end - path));
+        if (result != VFS_SUCCESS) {
+            return result;
+        }
+        path = *end ? end + 1 : end;
+    }
+    if (len == 0) {
+        out[0] = '/';
+        out[1] = '\0';
+    }
+    return VFS_SUCCESS;
+}
+
+// Mount serving a normalized path (vfs_lock held)
+static vfs_mount_t* vfs_find_mount(const char* path) {
+    vfs_mount_t* best = NULL;
+    for (uint32_t i = 0; i < VFS_MAX_MOUNTS; i++) {
+        vfs_mount_t* mount = &vfs_mounts[i];
+        if (!mount->in_use || (best && mount->length <= best->length)) {
+            continue;
+        }
+        if (mount->length == 1 ||
+            (strncmp(path, mount->path, mount->length) == 0 &&
+             (path[mount->length] == '\0' || path[mount->length] == '/'))) {
+            best = mount;
+        }
+    }
+    return best;
+}
+
+// Normalize path and take a use of the mount serving it; rest points into
+// normalized at the path within the mount. NULL (with *result set) if
+// nothing serves it.
+static vfs_mount_t* vfs_get_mount(const char* path, char* normalized, const char** rest, int* result) {
+    *result = vfs_normalize(path, normalized);
+    if (*result != VFS_SUCCESS) {
+        return NULL;
+    }
+    uint32_t flags = spin_lock_irqsave(&vfs_lock);
+    vfs_mount_t* mount = vfs_find_mount(normalized);
+    if (mount) {
+        mount->users++;
+    }
+    spin_unlock_irqrestore(&vfs_lock, flags);
+    if (!mount) {
+        *result = VFS_ERROR_NOT_FOUND;
+        return NULL;
+    }
+    const char* within = mount->length == 1 ? normalized : normalized + mount->length;
+    *rest = *within ? within : "/";
+    return mount;
+}
+
+static void vfs_put_mount(vfs_mount_t* mount) {
+    uint32_t flags = spin_lock_irqsave(&vfs_lock);
+    mount->users--;
+    spin_unlock_irqrestore(&vfs_lock, flags);
+}
+
+static vfs_file_t* vfs_get_file(int fd) {
+    vfs_fd_table_t* table = vfs_table(false);
+    if (!table || fd < 0 || fd >= VFS_MAX_FD || !table->files[fd].in_use || !table->files[fd].mount) {
+        return NULL;
+    }
+    return &table->files[fd];
+}
+
+int vfs_mount(const char* path, const vfs_ops_t* ops, void* data) {
+    char normalized[VFS_MAX_PATH];
+    if (!ops || path[0] != '/') {
+        return VFS_ERROR_INVALID_PATH;
+    }
+    int result = vfs_normalize(path, normalized);
+    if (result != VFS_SUCCESS) {
+        return result;
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&vfs_lock);
+    vfs_mount_t* free_slot = NULL;
+    for (uint32_t i = 0; i < VFS_MAX_MOUNTS; i++) {
+        if (vfs_mounts[i].in_use && strcmp(vfs_mounts[i].path, normalized) == 0) {
+            spin_unlock_irqrestore(&vfs_lock, flags);
+            return VFS_ERROR_EXISTS;
+        }
+        if (!vfs_mounts[i].in_use && !free_slot) {
+            free_slot = &vfs_mounts[i];
+        }
+    }
+    if (!free_slot) {
+        spin_unlock_irqrestore(&vfs_lock, flags);
+        return VFS_ERROR_NO_SPACE;
+    }
+    strcpy(free_slot->path, normalized);
+    free_slot->length = strlen(normalized);
+    free_slot->ops = ops;
+    free_slot->data = data;
+    free_slot->users = 0;
+    free_slot->in_use = true;
+    spin_unlock_irqrestore(&vfs_lock, flags);
+    return VFS_SUCCESS;
+}
+
+int vfs_unmount(const char* path) {
+    char normalized[VFS_MAX_PATH];
+    int result = vfs_normalize(path, normalized);
+    if (result != VFS_SUCCESS) {
+        return result;
+    }
+    result = VFS_ERROR_NOT_FOUND;
+    uint32_t flags = spin_lock_irqsave(&vfs_lock);
+    for (uint32_t i = 0; i < VFS_MAX_MOUNTS; i++) {
+        if (vfs_mounts[i].in_use && strcmp(vfs_mounts[i].path, normalized) == 0) {
+            if (vfs_mounts[i].users > 0) {
+                result = VFS_ERROR_BUSY;
+            } else {
+                vfs_mounts[i].in_use = false;
+                result = VFS_SUCCESS;
+            }
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&vfs_lock, flags);
+    return result;
+}
+
+int vfs_open(const char* path, uint32_t open_flags) {
+    char normalized[VFS_MAX_PATH];
+    const char* rest;
+    int result;
+    vfs_mount_t* mount = vfs_get_mount(path, normalized, &rest, &result);
+    if (!mount) {
+        return result;
+    }
+    
+    // Claim a descriptor first, so a full table doesn't open the file
+    vfs_fd_table_t* table = vfs_table(true);
+    int fd = table ? vfs_fd_alloc(table) : -1;
+    if (fd < 0) {
+        vfs_put_mount(mount);
+        return VFS_ERROR_NO_FD;
+    }
+    
+    int32_t handle;
+    result = mount->ops->open(mount->data, rest, open_flags, &handle);
+    if (result < 0) {
+        vfs_fd_free(table, fd);
+        vfs_put_mount(mount);
+        return result;
+    }
+    vfs_file_t* file = &table->files[fd];
+    file->handle = handle;
+    file->position = 0;
+    file->flags = open_flags;
+    file->mount = mount;            // Keeps the use taken above until close
+    return fd;
+}
+
+int vfs_close(int fd) {
+    vfs_file_t* file = vfs_get_file(fd);
+    if (!file) {
+        return VFS_ERROR_INVALID_FD;
+    }
+    vfs_mount_t* mount = file->mount;
+    int result = mount->ops->close(mount->data, file->handle);
+    vfs_fd_free(vfs_table(false), fd);
+    vfs_put_mount(mount);
+    return result;
+}
+
+// Close everything an exiting process left open and give its table back:
+// one pass over the descriptors its free map says are in use
+void vfs_release_owned(process_t* process) {
+    vfs_fd_table_t* table = process->files;
+    if (!table) {
+        return;
+    }
+    process->files = NULL;
+    for (uint32_t w = 0; w < VFS_FD_WORDS; w++) {
+        uint32_t open = ~table->free_map[w];
+        while (open) {
+            uint32_t bit = vfs_lowest_bit(open);
+            open &= open - 1;
+            vfs_file_t* file = &table->files[w * 32 + bit];
+            if (file->mount) {
+                file->mount->ops->close(file->mount->data, file->handle);
+                vfs_put_mount(file->mount);
+            }
+        }
+    }
+    kmem_cache_free(&vfs_table_cache, table);
+}
+
+// Open a file for the kernel itself: no descriptor, so any process may
+// read it (a mapped executable is read from whichever process faults)
+int vfs_kopen(const char* path, vfs_kfile_t* file) {
+    char normalized[VFS_MAX_PATH];
+    const char* rest;
+    int result;
+    vfs_mount_t* mount = vfs_get_mount(path, normalized, &rest, &result);
+    if (!mount) {
+        return result;
+    }
+    result = mount->ops->open(mount->data, rest, VFS_O_READ, &file->handle);
+    if (result < 0) {
+        vfs_put_mount(mount);
+        return result;
+    }
+    file->mount = mount;            // Keeps the use taken above until vfs_kclose
+    return VFS_SUCCESS;
+}
+
+int vfs_kread(vfs_kfile_t* file, void* buffer, uint32_t size, uint32_t offset) {
+    if (!file->mount) {
+        return VFS_ERROR_INVALID_FD;
+    }
+    return file->mount->ops->read(file->mount->data, file->handle, offset, buffer, size);
+}
+
+int vfs_ksize(vfs_kfile_t* file) {
+    if (!file->mount) {
+        return VFS_ERROR_INVALID_FD;
+    }
+    return file->mount->ops->size(file->mount->data, file->handle);
+}
+
+void vfs_kclose(vfs_kfile_t* file) {
+    vfs_mount_t* mount = file->mount;
+    if (!mount) {
+        return;
+    }
+    file->mount = NULL;
+    mount->ops->close(mount->data, file->handle);
+    vfs_put_mount(mount);
+}
+
+// The file behind fd if it was opened for access, else NULL with *result set
+static vfs_file_t* vfs_get_file_for(int fd, uint32_t access, int* result) {
+    vfs_file_t* file = vfs_get_file(fd);
+    if (!file) {
+        *result = VFS_ERROR_INVALID_FD;
+        return NULL;
+    }
+    if (!(file->flags & access)) {
+        *result = VFS_ERROR_PERMISSION;
+        return NULL;
+    }
+    return file;
+}
+
+// Move iov's buffers through the file from offset, stopping at the first
+// short transfer; the bytes moved, or the error if none were
+static int vfs_transfer(vfs_file_t* file, bool write, const vfs_iovec_t* iov, int count, uint32_t offset) {
+    if (count < 0 || count > VFS_MAX_IOV || (count > 0 && !iov)) {
+        return VFS_ERROR_INVALID;
+    }
+    vfs_mount_t* mount = file->mount;
+    uint32_t moved = 0;
+    for (int i = 0; i < count; i++) {
+        if (iov[i].length == 0) {
+            continue;
+        }
+        int result = write ? mount->ops->write(mount->data, file->handle, offset + moved, iov[i].base, iov[i].length)
+                           : mount->ops->read(mount->data, file->handle, offset + moved, iov[i].base, iov[i].length);
+        if (result < 0) {
+            return moved > 0 ? (int)moved : result;
+        }
+        moved += (uint32_t)result;
+        if ((uint32_t)result < iov[i].length) {
+            break;
+        }
+    }
+    return (int)moved;
+}
+
+int vfs_read(int fd, void* buffer, uint32_t size) {
+    TRACE(TRACE_VFS_READ, fd, size);
+    vfs_iovec_t iov = { buffer, size };
+    return vfs_readv(fd, &iov, 1);
+}
+
+int vfs_write(int fd, const void* buffer, uint32_t size) {
+    vfs_iovec_t iov = { (void*)buffer, size };
+    return vfs_writev(fd, &iov, 1);
+}
+
+int vfs_readv(int fd, const vfs_iovec_t* iov, int count) {
+    int result;
+    vfs_file_t* file = vfs_get_file_for(fd, VFS_O_READ, &result);
+    if (!file) {
+        return result;
+    }
+    result = vfs_transfer(file, false, iov, count, file->position);
+    if (result > 0) {
+        file->position += (uint32_t)result;
+    }
+    return result;
+}
+
+int vfs_writev(int fd, const vfs_iovec_t* iov, int count) {
+    int result;
+    vfs_file_t* file = vfs_get_file_for(fd, VFS_O_WRITE, &result);
+    if (!file) {
+        return result;
+    }
+    if (file->flags & VFS_O_APPEND) {
+        int end = file->mount->ops->size(file->mount->data, file->handle);
+        if (end < 0) {
+            return end;
+        }
+        file->position = (uint32_t)end;
+    }
+    result = vfs_transfer(file, true, iov, count, file->position);
+    if (result > 0) {
+        file->position += (uint32_t)result;
+    }
+    return result;
+}
+
+int vfs_pread(int fd, void* buffer, uint32_t size, uint32_t offset) {
+    int result;
+    vfs_file_t* file = vfs_get_file_for(fd, VFS_O_READ, &result);
+    if (!file) {
+        return result;
+    }
+    vfs_iovec_t iov = { buffer, size };
+    return vfs_transfer(file, false, &iov, 1, offset);
+}
+
+int vfs_pwrite(int fd, const void* buffer, uint32_t size, uint32_t offset) {
+    int result;
+    vfs_file_t* file = vfs_get_file_for(fd, VFS_O_WRITE, &result);
+    if (!file) {
+        return result;
+    }
+    vfs_iovec_t iov = { (void*)buffer, size };
+    return vfs_transfer(file, true, &iov, 1, offset);
+}
+
+int vfs_pin_page(int fd, uint32_t offset, uint32_t* frame) {
+    int result;
+    vfs_file_t* file = vfs_get_file_for(fd, VFS_O_READ, &result);
+    if (!file) {
+        return result;
+    }
+    if (!file->mount->ops->pin) {
+        return VFS_ERROR_NOT_SUPPORTED;
+    }
+    return file->mount->ops->pin(file->mount->data, file->handle, offset, frame);
+}
+
+void vfs_aio_complete(vfs_aio_t* aio, int result) {
+    vfs_put_mount(aio->mount);
+    aio->result = result;
+    aio->done(aio);
+}
+
+// Without a submit of its own a file system's calls are made in a worker,
+// so the submitter goes on while they wait
+static void vfs_aio_work(void* arg) {
+    vfs_aio_t* aio = (vfs_aio_t*)arg;
+    const vfs_ops_t* ops = aio->mount->ops;
+    int result = aio->write ? ops->write(aio->mount->data, aio->handle, aio->offset, aio->buffer, aio->size)
+                            : ops->read(aio->mount->data, aio->handle, aio->offset, aio->buffer, aio->size);
+    vfs_aio_complete(aio, result);
+}
+
+// The request holds a use of the mount of its own, so it may outlive the
+// descriptor it came through
+static int vfs_submit(int fd, vfs_aio_t* aio, bool write) {
+    int result;
+    vfs_file_t* file = vfs_get_file_for(fd, write ? VFS_O_WRITE : VFS_O_READ, &result);
+    if (!file) {
+        return result;
+    }
+    if (!aio || !aio->done || (aio->size > 0 && !aio->buffer)) {
+        return VFS_ERROR_INVALID;
+    }
+    vfs_mount_t* mount = file->mount;
+    aio->write = write;
+    aio->mount = mount;
+    aio->handle = file->handle;
+    aio->result = 0;
+    uint32_t flags = spin_lock_irqsave(&vfs_lock);
+    mount->users++;
+    spin_unlock_irqrestore(&vfs_lock, flags);
+
+    if (mount->ops->submit) {
+        result = mount->ops->submit(mount->data, aio->handle, aio);
+        if (result < 0) {
+            vfs_put_mount(mount);
+        }
+        return result < 0 ? result : VFS_SUCCESS;
+    }
+    work_init(&aio->work, vfs_aio_work, aio);
+    work_schedule(&aio->work);
+    return VFS_SUCCESS;
+}
+
+int vfs_read_async(int fd, vfs_aio_t* aio) {
+    return vfs_submit(fd, aio, false);
+}
+
+int vfs_write_async(int fd, vfs_aio_t* aio) {
+    return vfs_submit(fd, aio, true);
+}
+
+// Positions past the end are refused, as SimpleFS does
+int vfs_seek(int fd, int32_t offset, int whence) {
+    vfs_file_t* file = vfs_get_file(fd);
+    if (!file) {
+        return VFS_ERROR_INVALID_FD;
+    }
+    int size = file->mount->ops->size(file->mount->data, file->handle);
+    if (size < 0) {
+        return size;
+    }
+    int32_t base;
+    switch (whence) {
+        case VFS_SEEK_SET: base = 0; break;
+        case VFS_SEEK_CUR: base = (int32_t)file->position; break;
+        case VFS_SEEK_END: base = size; break;
+        default: return VFS_ERROR_INVALID_SEEK;
+    }
+    if ((offset < 0 && base + offset < 0) || (offset > 0 && offset > size - base)) {
+        return VFS_ERROR_INVALID_SEEK;
+    }
+    file->position = (uint32_t)(base + offset);
+    return (int)file->position;
+}
+
+int vfs_stat(const char* path, vfs_stat_t* stat) {
+    char normalized[VFS_MAX_PATH];
+    const char* rest;
+    int result;
+    vfs_mount_t* mount = vfs_get_mount(path, normalized, &rest, &result);
+    if (!mount) {
+        return result;
+    }
+    result = mount->ops->stat(mount->data, rest, stat);
+    vfs_put_mount(mount);
+    return result;
+}
+
+int vfs_mkdir(const char* path) {
+    char normalized[VFS_MAX_PATH];
+    const char* rest;
+    int result;
+    vfs_mount_t* mount = vfs_get_mount(path, normalized, &rest, &result);
+    if (!mount) {
+        return result;
+    }
+    if (strcmp(rest, "/") == 0) {
+        result = VFS_ERROR_EXISTS;  // A mount point
+    } else {
+        result = mount->ops->mkdir ? mount->ops->mkdir(mount->data, rest) : VFS_ERROR_NOT_SUPPORTED;
+    }
+    vfs_put_mount(mount);
+    return result;
+}
+
+int vfs_unlink(const char* path) {
+    char normalized[VFS_MAX_PATH];
+    const char* rest;
+    int result;
+    vfs_mount_t* mount = vfs_get_mount(path, normalized, &rest, &result);
+    if (!mount) {
+        return result;
+    }
+    if (strcmp(rest, "/") == 0) {
+        result = VFS_ERROR_BUSY;
+    } else {
+        result = mount->ops->unlink ? mount->ops->unlink(mount->data, rest) : VFS_ERROR_NOT_SUPPORTED;
+    }
+    vfs_put_mount(mount);
+    return result;
+}
+
+// The name mount is found under in the normalized directory path dir, or
+// NULL if it isn't directly inside it. vfs_lock held.
+static const char* vfs_mount_name_in(const vfs_mount_t* mount, const char* dir, uint32_t dir_length) {
+    if (!mount->in_use || mount->length == 1) {
+        return NULL;
+    }
+    // The parent is everything before the last slash ("/" for /tmp)
+    uint32_t slash = mount->length;
+    while (slash > 0 && mount->path[slash - 1] != '/') {
+        slash--;
+    }
+    uint32_t parent_length = slash > 1 ? slash - 1 : 1;
+    if (parent_length != dir_length || strncmp(mount->path, dir, dir_length) != 0) {
+        return NULL;
+    }
+    return mount->path + slash;
+}
+
+// Add the mount points directly inside a normalized directory path to a
+// listing of count entries
+static int vfs_add_mount_points(const char* dir, vfs_dirent_t* entries, int count, int max_entries) {
+    uint32_t dir_length = strlen(dir);
+    uint32_t flags = spin_lock_irqsave(&vfs_lock);
+    for (uint32_t i = 0; i < VFS_MAX_MOUNTS && count < max_entries; i++) {
+        const char* name = vfs_mount_name_in(&vfs_mounts[i], dir, dir_length);
+        if (!name) {
+            continue;
+        }
+        bool listed = false;
+        for (int j = 0; j < count && !listed; j++) {
+            listed = strcmp(entries[j].name, name) == 0;
+        }
+        if (!listed) {
+            memset(&entries[count], 0, sizeof(vfs_dirent_t));
+            strncpy(entries[count].name, name, VFS_MAX_NAME - 1);
+            entries[count].type = VFS_TYPE_DIR;
+            count++;
+        }
+    }
+    spin_unlock_irqrestore(&vfs_lock, flags);
+    return count;
+}
+
+int vfs_readdir(const char* path, vfs_dirent_t* entries, int max_entries) {
+    char normalized[VFS_MAX_PATH];
+    const char* rest;
+    int result;
+    vfs_mount_t* mount = vfs_get_mount(path, normalized, &rest, &result);
+    if (!mount) {
+        return result;
+    }
+    uint32_t cursor = 0;
+    result = mount->ops->readdir(mount->data, rest, &cursor, entries, max_entries);
+    vfs_put_mount(mount);
+    if (result < 0) {
+        return result;
+    }
+    return vfs_add_mount_points(normalized, entries, result, max_entries);
+}
+
+// Entries asked of a file system per round of vfs_getdents
+#define VFS_GETDENTS_BATCH  8
+
+// Append entry's record at used bytes into out; returns the new length
+static uint32_t vfs_pack_dirent(uint8_t* out, uint32_t used, const char* name, uint32_t size, uint8_t type) {
+    vfs_dirent_packed_t* record = (vfs_dirent_packed_t*)(out + used);
+    uint32_t name_length = strnlen(name, VFS_MAX_NAME - 1);
+    uint32_t length = (sizeof(vfs_dirent_packed_t) + name_length + 1 + 3) & ~3u;
+    record->length = (uint16_t)length;
+    record->type = type;
+    record->name_length = (uint8_t)name_length;
+    record->size = size;
+    memcpy(record->name, name, name_length);
+    memset(record->name + name_length, 0, length - sizeof(vfs_dirent_packed_t) - name_length);
+    return used + length;
+}
+
+// Whether the file system under mount has its own entry name in directory
+// rest, which then lists it already
+static bool vfs_has_entry(vfs_mount_t* mount, const char* rest, const char* name) {
+    char path[VFS_MAX_PATH];
+    uint32_t rest_length = strlen(rest);
+    if (rest_length + 1 + strlen(name) >= VFS_MAX_PATH) {
+        return false;
+    }
+    memcpy(path, rest, rest_length);
+    if (rest_length > 1) {
+        path[rest_length++] = '/';
+    }
+    strcpy(path + rest_length, name);
+    vfs_stat_t stat;
+    return mount->ops->stat(mount->data, path, &stat) == VFS_SUCCESS;
+}
+
+// The file system's entries come a batch at a time, as many as are sure to
+// fit; the mount points inside the directory follow them.
+int vfs_getdents(const char* path, uint32_t* cursor, void* buffer, uint32_t size) {
+    char normalized[VFS_MAX_PATH];
+    const char* rest;
+    int result;
+    vfs_mount_t* mount = vfs_get_mount(path, normalized, &rest, &result);
+    if (!mount) {
+        return result;
+    }
+    uint8_t* out = (uint8_t*)buffer;
+    uint32_t used = 0;
+    vfs_dirent_t batch[VFS_GETDENTS_BATCH];
+    while (*cursor < VFS_CURSOR_MOUNTS) {
+        uint32_t room = (size - used) / VFS_DIRENT_PACKED_MAX;
+        if (room == 0) {
+            break;
+        }
+        if (room > VFS_GETDENTS_BATCH) {
+            room = VFS_GETDENTS_BATCH;
+        }
+        uint32_t next = *cursor;
+        int count = mount->ops->readdir(mount->data, rest, &next, batch, (int)room);
+        if (count < 0) {
+            vfs_put_mount(mount);
+            return used > 0 ? (int)used : count;
+        }
+        for (int i = 0; i < count; i++) {
+            used = vfs_pack_dirent(out, used, batch[i].name, batch[i].size, batch[i].type);
+        }
+        *cursor = count > 0 && next < VFS_CURSOR_MOUNTS ? next : VFS_CURSOR_MOUNTS;
+    }
+    
+    uint32_t dir_length = strlen(normalized);
+    while (*cursor >= VFS_CURSOR_MOUNTS && *cursor - VFS_CURSOR_MOUNTS < VFS_MAX_MOUNTS &&
+           size - used >= VFS_DIRENT_PACKED_MAX) {
+        char name[VFS_MAX_NAME];
+        uint32_t flags = spin_lock_irqsave(&vfs_lock);
+        const char* found = vfs_mount_name_in(&vfs_mounts[*cursor - VFS_CURSOR_MOUNTS], normalized, dir_length);
+        if (found) {
+            strlcpy(name, found, VFS_MAX_NAME);
+        }
+        spin_unlock_irqrestore(&vfs_lock, flags);
+        (*cursor)++;
+        if (found && !vfs_has_entry(mount, rest, name)) {
+            used = vfs_pack_dirent(out, used, name, 0, VFS_TYPE_DIR);
+        }
+    }
+    vfs_put_mount(mount);
+    return (int)used;
+}
+
+void vfs_dump_mounts(void) {
+    terminal_writestring("Mounted file systems:\n");
+    vfs_fd_table_t* table = vfs_table(false);
+    uint32_t open_files = table ? table->open : 0;
+    for (uint32_t i = 0; i < VFS_MAX_MOUNTS; i++) {
+        if (vfs_mounts[i].in_use) {
+            terminal_printf("  %s on %s (%d in use)\n", vfs_mounts[i].ops->name, vfs_mounts[i].path,
+                            (int)vfs_mounts[i].users);
+        }
+    }
+    terminal_printf("  %d of %d descriptors open in this process\n", (int)open_files, VFS_MAX_FD);
+}
@@ -0,0 +1,196 @@
+// ClaudeOS Virtual File System - Day 21
+// One path namespace over every file system, each mounted at a directory
+// and reached through its vfs_ops_t; descriptors are per process
+
+#ifndef VFS_H
+#define VFS_H
+
+#include "types.h"
+#include "softirq.h"
+
+#define VFS_MAX_MOUNTS      8
+#define VFS_MAX_FD          64          // Per process; a multiple of 32
+#define VFS_MAX_PATH        256
+#define VFS_MAX_NAME        56
+#define VFS_MAX_IOV         16          // Buffers in one readv/writev
+
+// Open flags (the same bits as SimpleFS's O_*)
+#define VFS_O_READ          0x01
+#define VFS_O_WRITE         0x02
+#define VFS_O_CREATE        0x04
+#define VFS_O_TRUNCATE      0x08
+#define VFS_O_APPEND        0x10
+
+#define VFS_SEEK_SET        0
+#define VFS_SEEK_CUR        1
+#define VFS_SEEK_END        2
+
+#define VFS_TYPE_FILE       0
+#define VFS_TYPE_DIR        1
+
+// vfs_getdents cursors from here on are the VFS's, past the file
+// system's entries: this plus the mount slot to look at next
+#define VFS_CURSOR_MOUNTS   0x80000000u
+
+// Results: the numbers of SimpleFS's FS_ERROR_*, so its codes pass through
+#define VFS_SUCCESS             0
+#define VFS_ERROR_NOT_FOUND     -1
+#define VFS_ERROR_EXISTS        -2
+#define VFS_ERROR_NO_SPACE      -3
+#define VFS_ERROR_INVALID_PATH  -4
+#define VFS_ERROR_NOT_DIR       -5
+#define VFS_ERROR_IS_DIR        -6
+#define VFS_ERROR_NO_FD         -7
+#define VFS_ERROR_INVALID_FD    -8
+#define VFS_ERROR_READ_ONLY     -9
+#define VFS_ERROR_PERMISSION    -10
+#define VFS_ERROR_INVALID_SEEK  -11
+#define VFS_ERROR_NOT_SUPPORTED -12
+#define VFS_ERROR_BUSY          -13     // Unmounting with files open
+#define VFS_ERROR_INVALID       -14     // Bad argument (e.g. too many buffers)
+
+typedef struct {
+    char name[VFS_MAX_NAME];
+    uint32_t size;
+    uint8_t type;                       // VFS_TYPE_*
+} vfs_dirent_t;
+
+// vfs_getdents' records, packed back to back. Each is length bytes (a
+// multiple of 4) and its name is NUL-terminated.
+typedef struct {
+    uint16_t length;                    // Of the whole record: the next one starts there
+    uint8_t type;                       // VFS_TYPE_*
+    uint8_t name_length;                // Without the NUL
+    uint32_t size;
+    char name[];
+} vfs_dirent_packed_t;
+
+#define VFS_DIRENT_PACKED_MAX   ((sizeof(vfs_dirent_packed_t) + VFS_MAX_NAME + 3) & ~3u)
+
+typedef struct {
+    uint32_t size;
+    uint8_t type;
+} vfs_stat_t;
+
+// One buffer of a vectored read or write
+typedef struct {
+    void* base;
+    uint32_t length;
+} vfs_iovec_t;
+
+struct vfs_aio;
+struct vfs_mount;
+
+// An asynchronous read or write of size bytes at offset. The submitter
+// owns it, and buffer, until done runs with result set (the bytes moved,
+// or an error): from the work queue, a disk completion, or before the
+// submission returns when nothing had to wait.
+typedef struct vfs_aio {
+    void* buffer;
+    uint32_t size;
+    uint32_t offset;
+    void (*done)(struct vfs_aio* aio);
+    void* private_data;
+    int result;
+    // The VFS's own
+    bool write;
+    struct vfs_mount* mount;            // Held until done
+    int32_t handle;
+    work_t work;
+} vfs_aio_t;
+
+// A file system's side of the VFS. Paths are relative to its mount and
+// always start with '/'; data is what it was mounted with. Files are
+// named by a handle of the file system's choosing, and the VFS keeps the
+// position: reads and writes say where they go.
+typedef struct vfs_ops {
+    const char* name;
+    int (*open)(void* data, const char* path, uint32_t flags, int32_t* handle);
+    int (*close)(void* data, int32_t handle);
+    int (*read)(void* data, int32_t handle, uint32_t offset, void* buffer, uint32_t size);
+    int (*write)(void* data, int32_t handle, uint32_t offset, const void* buffer, uint32_t size);
+    int (*size)(void* data, int32_t handle);
+    int (*stat)(void* data, const char* path, vfs_stat_t* stat);
+    // Up to max_entries of a directory's entries from *cursor (0: the
+    // first), leaving *cursor where the next call goes on; 0 at the end.
+    // The cursor is the file system's own, below VFS_CURSOR_MOUNTS.
+    int (*readdir)(void* data, const char* path, uint32_t* cursor, vfs_dirent_t* entries, int max_entries);
+    int (*mkdir)(void* data, const char* path);     // NULL: not supported
+    int (*unlink)(void* data, const char* path);    // NULL: not supported
+    // The page frame holding the byte at offset, with a PMM reference for
+    // the caller (so a later write copies the page rather than change it);
+    // returns how many file bytes it holds from offset, 0 at the end.
+    // NULL: data isn't kept in page frames.
+    int (*pin)(void* data, int32_t handle, uint32_t offset, uint32_t* frame);
+    // Start aio and return 0, finishing it later with vfs_aio_complete; an
+    // error fails it at once, without done. NULL: the VFS runs read or
+    // write for it on the work queue.
+    int (*submit)(void* data, int32_t handle, struct vfs_aio* aio);
+} vfs_ops_t;
+
+struct process;
+
+// A file the kernel holds open outside any descriptor table
+typedef struct {
+    struct vfs_mount* mount;            // NULL when closed
+    int32_t handle;
+} vfs_kfile_t;
+
+void vfs_init(void);
+
+// Attach a file system at an absolute directory path ("/" included). A
+// path is served by the mount that is its longest prefix.
+int vfs_mount(const char* path, const vfs_ops_t* ops, void* data);
+int vfs_unmount(const char* path);
+
+// Descriptors are the calling process's own. Relative paths start at the
+// root.
+int vfs_open(const char* path, uint32_t flags);
+int vfs_close(int fd);
+int vfs_read(int fd, void* buffer, uint32_t size);
+int vfs_write(int fd, const void* buffer, uint32_t size);
+int vfs_seek(int fd, int32_t offset, int whence);   // New position, or an error
+
+// Several buffers in one call, filled or drained in order from the
+// position; a short transfer ends it. Returns the bytes moved.
+int vfs_readv(int fd, const vfs_iovec_t* iov, int count);
+int vfs_writev(int fd, const vfs_iovec_t* iov, int count);
+
+// At offset, leaving the position alone (pwrite ignores VFS_O_APPEND)
+int vfs_pread(int fd, void* buffer, uint32_t size, uint32_t offset);
+int vfs_pwrite(int fd, const void* buffer, uint32_t size, uint32_t offset);
+
+// The file's page at offset, by reference, for zero-copy senders: the
+// bytes it holds from offset % PAGE_SIZE on (0 at the end), with *frame
+// referenced until the caller's pmm_free_page
+int vfs_pin_page(int fd, uint32_t offset, uint32_t* frame);
+
+// Asynchronous pread and pwrite: 0 once aio (buffer, size, offset and
+// done filled in) is under way, else an error and done never runs. Many
+// may be in flight on one descriptor; VFS_O_APPEND doesn't apply.
+int vfs_read_async(int fd, vfs_aio_t* aio);
+int vfs_write_async(int fd, vfs_aio_t* aio);
+void vfs_aio_complete(vfs_aio_t* aio, int result);     // The file system's side
+
+int vfs_stat(const char* path, vfs_stat_t* stat);
+int vfs_mkdir(const char* path);
+int vfs_unlink(const char* path);
+// Entries of a directory, mount points in it included; returns how many
+int vfs_readdir(const char* path, vfs_dirent_t* entries, int max_entries);
+// The same in batches: as many vfs_dirent_packed_t as fit in size bytes,
+// from *cursor (0 to start) on, which is left where the next batch
+// begins. Returns the bytes filled, 0 once the listing is done.
+int vfs_getdents(const char* path, uint32_t* cursor, void* buffer, uint32_t size);
+
+// Kernel-held files, read-only and positionless; usable from any process
+int vfs_kopen(const char* path, vfs_kfile_t* file);
+int vfs_kread(vfs_kfile_t* file, void* buffer, uint32_t size, uint32_t offset);
+int vfs_ksize(vfs_kfile_t* file);
+void vfs_kclose(vfs_kfile_t* file);
+
+// Close a terminated process's descriptors (from cleanup)
+void vfs_release_owned(struct process* process);
+
+void vfs_dump_mounts(void);
+
+#endif // VFS_H
@@ -0,0 +1,130 @@
+// ClaudeOS Virtio Implementation - Day 21
+// A queue's descriptor table, avail ring and used ring sit in one
+// physically contiguous run, as the legacy interface wants it, with the
+// used ring on the next page boundary. Interrupt suppression with
+// EVENT_IDX asks for an event the used index has already passed; without
+// it the avail ring's NO_INTERRUPT flag does the same, less precisely.
+
+#include "virtio.h"
+#include "pic.h"
+#include "pmm.h"
+#include "string.h"
+
+static inline void virtio_barrier(void) {
+    asm volatile ("" : : : "memory");   // x86 keeps stores (and loads) in order
+}
+
+// Whether moving an index from old to new crossed event (the virtio
+// spec's vring_need_event, all in 16-bit wrapping arithmetic)
+static inline bool virtq_need_event(uint16_t event, uint16_t new_idx, uint16_t old_idx) {
+    return (uint16_t)(new_idx - event - 1) < (uint16_t)(new_idx - old_idx);
+}
+
+uint32_t virtio_negotiate(uint16_t io, uint32_t wanted) {
+    outb(io + VIRTIO_PCI_STATUS, 0);
+    outb(io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    outb(io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+    uint32_t features = inl(io + VIRTIO_PCI_HOST_FEATURES) & wanted;
+    outl(io + VIRTIO_PCI_GUEST_FEATURES, features);
+    return features;
+}
+
+void virtio_driver_ok(uint16_t io) {
+    outb(io + VIRTIO_PCI_STATUS,
+         VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+}
+
+void virtio_fail(uint16_t io) {
+    outb(io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_FAILED);
+}
+
+void virtio_map(uint32_t virt, uint32_t phys, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        vmm_map_page(kernel_page_directory, virt + i * PAGE_SIZE, phys + i * PAGE_SIZE,
+                     PAGE_PRESENT | PAGE_WRITABLE | PAGE_GLOBAL);
+    }
+    vmm_invalidate_range(virt, count);
+}
+
+int virtq_setup(virtq_t* q, uint16_t io, uint16_t index, uint32_t min_size, bool event_idx,
+                uint32_t virt) {
+    outw(io + VIRTIO_PCI_QUEUE_SEL, index);
+    uint32_t size = inw(io + VIRTIO_PCI_QUEUE_SIZE);
+    // The ring size is the device's call
+    if (size == 0 || size < min_size || size > VIRTQ_MAX_SIZE || (size & (size - 1))) {
+        return -1;
+    }
+    uint32_t used_offset = PAGE_ALIGN(sizeof(virtq_desc_t) * size +
+                                      sizeof(virtq_avail_t) + 2 * size + 2);
+    uint32_t bytes = used_offset + PAGE_ALIGN(sizeof(virtq_used_t) +
+                                              sizeof(virtq_used_elem_t) * size + 2);
+    uint32_t pages = bytes / PAGE_SIZE;
+    uint32_t phys = pmm_alloc_pages(pages, 1);
+    if (!phys) {
+        return -1;
+    }
+    virtio_map(virt, phys, pages);
+    memset((void*)virt, 0, bytes);
+
+    q->io = io;
+    q->index = index;
+    q->size = (uint16_t)size;
+    q->event_idx = event_idx;
+    q->desc = (volatile virtq_desc_t*)virt;
+    q->avail = (volatile virtq_avail_t*)(virt + sizeof(virtq_desc_t) * size);
+    q->used = (volatile virtq_used_t*)(virt + used_offset);
+    q->used_event = &q->avail->ring[size];
+    q->avail_event = (volatile uint16_t*)&q->used->ring[size];
+    q->avail_idx = 0;
+    q->last_used = 0;
+    q->kicks = 0;
+    q->kicks_saved = 0;
+    outl(io + VIRTIO_PCI_QUEUE_PFN, phys / PAGE_SIZE);
+    return 0;
+}
+
+void virtq_publish(virtq_t* q, uint16_t old) {
+    virtio_barrier();                   // Ring entries before the index
+    q->avail->idx = q->avail_idx;
+    // The device may be about to sleep: the index must be visible before
+    // its avail_event (or flags) is read, and x86 reorders that pair
+    __sync_synchronize();
+    bool kick = q->event_idx ? virtq_need_event(*q->avail_event, q->avail_idx, old)
+                             : !(q->used->flags & VIRTQ_USED_F_NO_NOTIFY);
+    if (kick) {
+        outw(q->io + VIRTIO_PCI_QUEUE_NOTIFY, q->index);
+        q->kicks++;
+    } else {
+        q->kicks_saved++;
+    }
+}
+
+bool virtq_take(virtq_t* q, uint32_t* head, uint32_t* length) {
+    if (q->last_used == q->used->idx) {
+        return false;
+    }
+    virtio_barrier();                   // The index before the entry it covers
+    volatile virtq_used_elem_t* elem = &q->used->ring[q->last_used & (q->size - 1)];
+    *head = elem->id;
+    *length = elem->length;
+    q->last_used++;
+    return true;
+}
+
+void virtq_quiet(virtq_t* q) {
+    if (q->event_idx) {
+        *q->used_event = (uint16_t)(q->last_used - 1);
+    } else {
+        q->avail->flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
+    }
+}
+
+bool virtq_arm(virtq_t* q) {
+    if (q->event_idx) {
+        *q->used_event = q->last_used;
+    } else {
+        q->avail->flags = 0;
+    }
+    __sync_synchronize();               // The request out before the index is read
+    return q->used->idx != q->last_used;
+}
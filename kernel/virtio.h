@@ -0,0 +1,129 @@
+// ClaudeOS Virtio - Day 21
+// What the legacy (0.9.5) PCI virtio drivers share: the port I/O register
+// block, feature negotiation, and split virtqueues with event-index
+// notification and interrupt suppression. Under a hypervisor every
+// emulated register access is a VM exit; here the rings live in guest
+// memory and the only exits are queue notifications, which the device
+// can turn down while it is already working through a ring.
+
+#ifndef VIRTIO_H
+#define VIRTIO_H
+
+#include "types.h"
+#include "vmm.h"
+
+#define VIRTIO_VENDOR_ID            0x1AF4
+
+// Legacy register block (I/O BAR 0, MSI-X off)
+#define VIRTIO_PCI_HOST_FEATURES    0x00
+#define VIRTIO_PCI_GUEST_FEATURES   0x04
+#define VIRTIO_PCI_QUEUE_PFN        0x08
+#define VIRTIO_PCI_QUEUE_SIZE       0x0C
+#define VIRTIO_PCI_QUEUE_SEL        0x0E
+#define VIRTIO_PCI_QUEUE_NOTIFY     0x10
+#define VIRTIO_PCI_STATUS           0x12
+#define VIRTIO_PCI_ISR              0x13        // Reading acknowledges
+#define VIRTIO_PCI_CONFIG           0x14        // Device-specific config
+
+// Device status bits
+#define VIRTIO_STATUS_ACKNOWLEDGE   0x01
+#define VIRTIO_STATUS_DRIVER        0x02
+#define VIRTIO_STATUS_DRIVER_OK     0x04
+#define VIRTIO_STATUS_FAILED        0x80
+
+#define VIRTIO_ISR_QUEUE            0x01
+#define VIRTIO_ISR_CONFIG           0x02
+
+// Transport feature bits
+#define VIRTIO_RING_F_INDIRECT_DESC (1u << 28)  // A descriptor may point at a table
+#define VIRTIO_RING_F_EVENT_IDX     (1u << 29)  // used_event / avail_event
+
+// Split virtqueue
+#define VIRTQ_DESC_F_NEXT           1
+#define VIRTQ_DESC_F_WRITE          2           // Device writes this buffer
+#define VIRTQ_DESC_F_INDIRECT       4
+#define VIRTQ_AVAIL_F_NO_INTERRUPT  1           // Without EVENT_IDX
+#define VIRTQ_USED_F_NO_NOTIFY      1
+#define VIRTQ_MAX_SIZE              1024        // Largest device ring we map
+#define VIRTQ_MAX_PAGES             8           // What a VIRTQ_MAX_SIZE ring takes
+
+// Naturally aligned, as the device lays them out
+typedef struct {
+    uint32_t addr_low;
+    uint32_t addr_high;
+    uint32_t length;
+    uint16_t flags;
+    uint16_t next;
+} virtq_desc_t;
+
+// Followed by ring[size] and, with EVENT_IDX, used_event
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+} virtq_avail_t;
+
+typedef struct {
+    uint32_t id;                        // Head descriptor of the chain
+    uint32_t length;                    // Bytes the device wrote
+} virtq_used_elem_t;
+
+// Followed by ring[size] and, with EVENT_IDX, avail_event
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    virtq_used_elem_t ring[];
+} virtq_used_t;
+
+typedef struct {
+    uint16_t io;                    // Device's register block
+    uint16_t index;                 // Queue number, for notifications
+    uint16_t size;                  // Entries, as the device fixed it
+    bool event_idx;
+    volatile virtq_desc_t* desc;
+    volatile virtq_avail_t* avail;
+    volatile virtq_used_t* used;
+    volatile uint16_t* used_event;  // Driver: interrupt once used->idx passes this
+    volatile uint16_t* avail_event; // Device: notify once avail->idx passes this
+    uint16_t avail_idx;             // Entries added, published or not
+    uint16_t last_used;             // Used entries taken back
+    uint32_t kicks;
+    uint32_t kicks_saved;           // Publishes the device didn't need told about
+} virtq_t;
+
+// Reset the device, announce a driver and agree on the features both
+// sides know; returns them
+uint32_t virtio_negotiate(uint16_t io, uint32_t wanted);
+void virtio_driver_ok(uint16_t io);
+void virtio_fail(uint16_t io);
+
+// Map count pages of phys at virt. Virtio memory is ordinary RAM the host
+// reads, so it stays cached.
+void virtio_map(uint32_t virt, uint32_t phys, uint32_t count);
+
+// Allocate queue index (VIRTQ_MAX_PAGES of window at virt) and hand it to
+// the device; -1 if the device's ring is missing or under min_size
+int virtq_setup(virtq_t* q, uint16_t io, uint16_t index, uint32_t min_size, bool event_idx,
+                uint32_t virt);
+
+static inline void virtq_add(virtq_t* q, uint16_t head) {
+    q->avail->ring[q->avail_idx & (q->size - 1)] = head;
+    q->avail_idx++;
+}
+
+// Publish what was added since old in one index write, and notify only
+// if the device asked to hear about it
+void virtq_publish(virtq_t* q, uint16_t old);
+
+// Take the next used entry back: true with its head and length, false
+// once the device has nothing more
+bool virtq_take(virtq_t* q, uint32_t* head, uint32_t* length);
+
+// Ask for no interrupts until further notice
+void virtq_quiet(virtq_t* q);
+
+// Ask for an interrupt at the next used entry. Entries used before the
+// device saw that raise none, so true means some are waiting already.
+bool virtq_arm(virtq_t* q);
+
+#endif // VIRTIO_H
@@ -0,0 +1,409 @@
+// ClaudeOS Virtio Network Driver Implementation - Day 21
+// The two-descriptor chains are built once at open. A receive poll hands
+// every finished buffer on and puts all the refills back with a single
+// avail index write and at most one notification. The transmit queue
+// never asks for an interrupt: completions are reclaimed on the next
+// send. The receive queue asks only while the network layer isn't polling.
+
+#include "virtio_net.h"
+#include "pci.h"
+#include "pic.h"
+#include "pmm.h"
+#include "irq.h"
+#include "lock.h"
+#include "softirq.h"
+#include "kernel.h"
+#include "string.h"
+
+typedef struct {
+    pci_device_t* pci;
+    network_interface_t* iface;
+    bool ready;
+    bool link_up;
+    uint16_t io;                    // Legacy register block
+    uint32_t features;              // Negotiated
+    virtq_t rx;
+    virtq_t tx;
+    uint8_t* headers;               // RX slots' headers, then TX slots'
+    uint32_t headers_phys;
+    uint8_t* rx_pool[VIRTIO_NET_RX_BUFFERS];        // Every RX buffer, by index
+    uint32_t rx_pool_phys[VIRTIO_NET_RX_BUFFERS];
+    uint8_t rx_slot_buffer[VIRTIO_NET_RX_SLOTS];    // Pool index behind each slot
+    uint8_t rx_spare[VIRTIO_NET_RX_BUFFERS];        // Stack of buffers nobody holds
+    uint32_t rx_spare_count;
+    spinlock_t rx_spare_lock;       // Unregistered; consumers return buffers from any context
+    uint8_t* tx_bounce[VIRTIO_NET_TX_SLOTS];        // For frames that aren't DMA-able in place
+    uint32_t tx_bounce_phys[VIRTIO_NET_TX_SLOTS];
+    network_packet_t* tx_packets[VIRTIO_NET_TX_SLOTS];  // Sent in place; freed on reclaim
+    uint8_t tx_free[VIRTIO_NET_TX_SLOTS];           // Stack of idle TX slots
+    uint32_t tx_free_count;
+    spinlock_t tx_lock;             // Unregistered; left zeroed
+    uint32_t irqs;
+    uint32_t rx_batches;            // Polls that found packets
+    uint32_t rx_packets;
+    uint32_t rx_errors;
+    uint32_t rx_starved;            // Frames dropped with every spare lent out
+    uint32_t tx_packets_sent;
+    uint32_t tx_bounced;
+    uint32_t tx_reclaims;           // Reclaim passes that freed something
+    uint32_t tx_full;
+    uint32_t tx_csum_offloaded;
+} virtio_net_t;
+
+static virtio_net_t vnet;
+
+#define VIRTIO_NET_TX_HEADERS       (VIRTIO_NET_RX_SLOTS * VIRTIO_NET_HDR_STRIDE)
+
+// Map a fresh frame at virt and split it into VIRTIO_NET_BUFFER_SIZE buffers
+static int vnet_alloc_buffers(uint32_t virt, uint8_t** buffers, uint32_t* phys_out, uint32_t count) {
+    for (uint32_t i = 0; i < count; i += VIRTIO_NET_BUFFERS_PER_PAGE) {
+        uint32_t phys = pmm_alloc_page();
+        if (!phys) {
+            return -1;
+        }
+        virtio_map(virt, phys, 1);
+        for (uint32_t j = 0; j < VIRTIO_NET_BUFFERS_PER_PAGE && i + j < count; j++) {
+            buffers[i + j] = (uint8_t*)(virt + j * VIRTIO_NET_BUFFER_SIZE);
+            phys_out[i + j] = phys + j * VIRTIO_NET_BUFFER_SIZE;
+        }
+        virt += PAGE_SIZE;
+    }
+    return 0;
+}
+
+// Slot i: descriptor 2i is its header, 2i+1 its buffer
+static void vnet_chain(virtq_t* q, uint32_t slot, uint32_t header_phys, uint16_t write) {
+    volatile virtq_desc_t* header = &q->desc[2 * slot];
+    header->addr_low = header_phys;
+    header->addr_high = 0;
+    header->length = sizeof(virtio_net_hdr_t);
+    header->flags = VIRTQ_DESC_F_NEXT | write;
+    header->next = (uint16_t)(2 * slot + 1);
+    q->desc[2 * slot + 1].addr_high = 0;
+    q->desc[2 * slot + 1].flags = write;
+    q->desc[2 * slot + 1].next = 0;
+}
+
+// Give back the TX slots the device has finished with (tx_lock held)
+static void vnet_tx_reclaim(void) {
+    virtq_t* q = &vnet.tx;
+    bool freed = false;
+    uint32_t head, length;
+    while (virtq_take(q, &head, &length)) {
+        uint32_t slot = head / 2;
+        if (slot >= VIRTIO_NET_TX_SLOTS) {
+            continue;
+        }
+        network_free_packet(vnet.tx_packets[slot]);
+        vnet.tx_packets[slot] = NULL;
+        vnet.tx_free[vnet.tx_free_count++] = (uint8_t)slot;
+        freed = true;
+    }
+    if (freed) {
+        vnet.tx_reclaims++;
+        virtq_quiet(q);
+    }
+}
+
+// Physical address of a frame if it is contiguous in memory, else 0
+static uint32_t vnet_dma_address(const uint8_t* data, size_t size) {
+    uint32_t virt = (uint32_t)data;
+    uint32_t phys = vmm_get_physical_address(kernel_page_directory, virt);
+    for (uint32_t page = (virt & ~(PAGE_SIZE - 1)) + PAGE_SIZE; phys && page < virt + size;
+         page += PAGE_SIZE) {
+        if (vmm_get_physical_address(kernel_page_directory, page) != phys + (page - virt)) {
+            return 0;
+        }
+    }
+    return phys;
+}
+
+// A page fragment would need a third descriptor the fixed chains don't
+// have, so frames carrying one go through the bounce buffer
+static int vnet_transmit(network_interface_t* iface, network_packet_t* packet) {
+    (void)iface;
+    if (!vnet.ready || network_packet_length(packet) > VIRTIO_NET_BUFFER_SIZE) {
+        network_free_packet(packet);
+        return -1;
+    }
+    uint32_t flags = spin_lock_irqsave(&vnet.tx_lock);
+    vnet_tx_reclaim();
+    if (vnet.tx_free_count == 0) {
+        vnet.tx_full++;
+        spin_unlock_irqrestore(&vnet.tx_lock, flags);
+        network_free_packet(packet);
+        return -1;
+    }
+
+    uint32_t slot = vnet.tx_free[--vnet.tx_free_count];
+    virtio_net_hdr_t* header = (virtio_net_hdr_t*)(vnet.headers + VIRTIO_NET_TX_HEADERS +
+                                                   slot * VIRTIO_NET_HDR_STRIDE);
+    memset(header, 0, sizeof(*header));
+    if ((packet->csum & NET_CSUM_PARTIAL) && (vnet.features & VIRTIO_NET_F_CSUM)) {
+        // The L4 field holds the pseudo-header sum, which is what the
+        // device expects to finish
+        header->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        header->csum_start = (uint16_t)(packet->csum_start - (uint32_t)(packet->data - packet->head));
+        header->csum_offset = packet->csum_offset;
+        vnet.tx_csum_offloaded++;
+    }
+
+    volatile virtq_desc_t* desc = &vnet.tx.desc[2 * slot + 1];
+    uint32_t size = (uint32_t)network_packet_length(packet);
+    uint32_t phys = packet->frag_frame ? 0 : vnet_dma_address(packet->data, packet->size);
+    if (phys) {
+        vnet.tx_packets[slot] = packet;
+    } else {
+        memcpy(vnet.tx_bounce[slot], packet->data, packet->size);
+        if (packet->frag_frame) {
+            memcpy(vnet.tx_bounce[slot] + packet->size,
+                   (uint8_t*)PHYS_TO_VIRT(packet->frag_frame) + packet->frag_offset, packet->frag_size);
+        }
+        phys = vnet.tx_bounce_phys[slot];
+        vnet.tx_bounced++;
+        network_free_packet(packet);
+    }
+    desc->addr_low = phys;
+    desc->length = size;
+
+    uint16_t old = vnet.tx.avail_idx;
+    virtq_add(&vnet.tx, (uint16_t)(2 * slot));
+    virtq_publish(&vnet.tx, old);
+    vnet.tx_packets_sent++;
+    spin_unlock_irqrestore(&vnet.tx_lock, flags);
+    return 0;
+}
+
+// Last reference to a received packet dropped: its buffer is a spare again
+static void vnet_rx_release(network_packet_t* packet) {
+    uint32_t index = ((uint32_t)packet->head - (uint32_t)vnet.rx_pool[0]) / VIRTIO_NET_BUFFER_SIZE;
+    uint32_t flags = spin_lock_irqsave(&vnet.rx_spare_lock);
+    vnet.rx_spare[vnet.rx_spare_count++] = index;
+    spin_unlock_irqrestore(&vnet.rx_spare_lock, flags);
+}
+
+// Poll: lend each filled buffer to the network layer as a packet, put a
+// spare behind its slot, and hand the whole batch back at once
+static int vnet_poll(network_interface_t* iface, int budget) {
+    (void)iface;
+    if (!vnet.ready) {
+        return 0;
+    }
+    virtq_t* q = &vnet.rx;
+    uint16_t old = q->avail_idx;
+    int done = 0;
+    uint32_t head, length;                  // length: header included
+    while (done < budget && virtq_take(q, &head, &length)) {
+        uint32_t slot = head / 2;
+        done++;
+        if (slot >= VIRTIO_NET_RX_SLOTS) {
+            vnet.rx_errors++;
+            continue;
+        }
+        if (length <= sizeof(virtio_net_hdr_t)) {
+            vnet.rx_errors++;
+            virtq_add(q, (uint16_t)(2 * slot));
+            continue;
+        }
+
+        // Frames nobody can take keep their buffer
+        uint32_t flags = spin_lock_irqsave(&vnet.rx_spare_lock);
+        int spare = vnet.rx_spare_count > 0 ? vnet.rx_spare[--vnet.rx_spare_count] : -1;
+        spin_unlock_irqrestore(&vnet.rx_spare_lock, flags);
+        network_packet_t* packet = NULL;
+        if (spare >= 0) {
+            packet = network_attach_packet(vnet.rx_pool[vnet.rx_slot_buffer[slot]],
+                                           VIRTIO_NET_BUFFER_SIZE,
+                                           length - sizeof(virtio_net_hdr_t),
+                                           vnet_rx_release, &vnet);
+        }
+        if (packet) {
+            vnet.rx_slot_buffer[slot] = (uint8_t)spare;
+            q->desc[2 * slot + 1].addr_low = vnet.rx_pool_phys[spare];
+            network_deliver_packet(vnet.iface->id, packet);
+            vnet.rx_packets++;
+        } else {
+            if (spare >= 0) {
+                flags = spin_lock_irqsave(&vnet.rx_spare_lock);
+                vnet.rx_spare[vnet.rx_spare_count++] = spare;
+                spin_unlock_irqrestore(&vnet.rx_spare_lock, flags);
+            }
+            vnet.rx_starved++;
+        }
+        virtq_add(q, (uint16_t)(2 * slot));
+    }
+    if (q->avail_idx != old) {
+        vnet.rx_batches++;
+        virtq_publish(q, old);
+    }
+    return done;
+}
+
+// Frames used before unmasking raise no interrupt, so the poll runs again
+static void vnet_rx_irq(network_interface_t* iface, bool enable) {
+    if (!enable) {
+        virtq_quiet(&vnet.rx);
+    } else if (virtq_arm(&vnet.rx)) {
+        virtq_quiet(&vnet.rx);
+        work_schedule(&iface->poll_work);
+    }
+}
+
+// Top half: reading the ISR byte acknowledges and deasserts the line
+static int vnet_irq(void* ctx) {
+    (void)ctx;
+    uint8_t cause = inb(vnet.io + VIRTIO_PCI_ISR);
+    if (!cause) {
+        return IRQ_NONE;    // Another device on a shared line
+    }
+    vnet.irqs++;
+    if ((cause & VIRTIO_ISR_CONFIG) && (vnet.features & VIRTIO_NET_F_STATUS)) {
+        vnet.link_up = (inw(vnet.io + VIRTIO_PCI_CONFIG + VIRTIO_NET_CONFIG_STATUS) &
+                        VIRTIO_NET_S_LINK_UP) != 0;
+    }
+    if (cause & VIRTIO_ISR_QUEUE) {
+        network_rx_interrupt(vnet.iface);   // Only the RX queue asks for interrupts
+    }
+    return IRQ_HANDLED;
+}
+
+// Header page, then the RX pool, then the TX bounce buffers
+static int vnet_alloc_rings(uint32_t virt) {
+    uint32_t phys = pmm_alloc_page();
+    if (!phys) {
+        return -1;
+    }
+    virtio_map(virt, phys, 1);
+    vnet.headers = (uint8_t*)virt;
+    vnet.headers_phys = phys;
+    memset(vnet.headers, 0, PAGE_SIZE);
+    virt += PAGE_SIZE;
+
+    if (vnet_alloc_buffers(virt, vnet.rx_pool, vnet.rx_pool_phys, VIRTIO_NET_RX_BUFFERS) != 0) {
+        return -1;
+    }
+    virt += VIRTIO_NET_RX_BUFFERS / VIRTIO_NET_BUFFERS_PER_PAGE * PAGE_SIZE;
+    if (vnet_alloc_buffers(virt, vnet.tx_bounce, vnet.tx_bounce_phys, VIRTIO_NET_TX_SLOTS) != 0) {
+        return -1;
+    }
+
+    // The first buffers sit behind the RX slots; the rest are spares
+    for (uint32_t i = 0; i < VIRTIO_NET_RX_SLOTS; i++) {
+        vnet_chain(&vnet.rx, i, vnet.headers_phys + i * VIRTIO_NET_HDR_STRIDE, VIRTQ_DESC_F_WRITE);
+        vnet.rx_slot_buffer[i] = (uint8_t)i;
+        vnet.rx.desc[2 * i + 1].addr_low = vnet.rx_pool_phys[i];
+        vnet.rx.desc[2 * i + 1].length = VIRTIO_NET_BUFFER_SIZE;
+        virtq_add(&vnet.rx, (uint16_t)(2 * i));
+    }
+    vnet.rx_spare_count = 0;
+    for (uint32_t i = VIRTIO_NET_RX_SLOTS; i < VIRTIO_NET_RX_BUFFERS; i++) {
+        vnet.rx_spare[vnet.rx_spare_count++] = (uint8_t)i;
+    }
+    vnet.tx_free_count = 0;
+    for (uint32_t i = 0; i < VIRTIO_NET_TX_SLOTS; i++) {
+        vnet_chain(&vnet.tx, i, vnet.headers_phys + VIRTIO_NET_TX_HEADERS + i * VIRTIO_NET_HDR_STRIDE, 0);
+        vnet.tx_packets[i] = NULL;
+        vnet.tx_free[vnet.tx_free_count++] = (uint8_t)(VIRTIO_NET_TX_SLOTS - 1 - i);
+    }
+    return 0;
+}
+
+// Interface open: needs the kernel page directory for the DMA window
+static int vnet_open(network_interface_t* iface) {
+    if (vnet.ready) {
+        return 0;
+    }
+    if (!kernel_page_directory || !(vnet.pci->bars[0] & PCI_BAR_IO)) {
+        return -1;
+    }
+    pci_enable_bus_master(vnet.pci);
+    vnet.io = (uint16_t)(vnet.pci->bars[0] & 0xFFFC);
+
+    vnet.features = virtio_negotiate(vnet.io, VIRTIO_NET_FEATURES);
+    bool event_idx = (vnet.features & VIRTIO_RING_F_EVENT_IDX) != 0;
+
+    // Every slot needs two descriptors
+    uint32_t virt = VIRTIO_NET_DMA_VIRT;
+    if (virtq_setup(&vnet.rx, vnet.io, VIRTIO_NET_RX_QUEUE, 2 * VIRTIO_NET_RX_SLOTS, event_idx,
+                    virt) != 0 ||
+        virtq_setup(&vnet.tx, vnet.io, VIRTIO_NET_TX_QUEUE, 2 * VIRTIO_NET_TX_SLOTS, event_idx,
+                    virt + VIRTQ_MAX_PAGES * PAGE_SIZE) != 0 ||
+        vnet_alloc_rings(virt + 2 * VIRTQ_MAX_PAGES * PAGE_SIZE) != 0) {
+        virtio_fail(vnet.io);
+        return -1;
+    }
+    virtq_quiet(&vnet.tx);
+
+    if (vnet.features & VIRTIO_NET_F_MAC) {
+        for (int i = 0; i < 6; i++) {
+            iface->mac_address[i] = inb(vnet.io + VIRTIO_PCI_CONFIG + VIRTIO_NET_CONFIG_MAC + i);
+        }
+    } else {
+        static const uint8_t fallback[6] = { 0x52, 0x54, 0x00, 0x12, 0x34, 0x56 };
+        memcpy(iface->mac_address, fallback, 6);
+    }
+    vnet.link_up = !(vnet.features & VIRTIO_NET_F_STATUS) ||
+                   (inw(vnet.io + VIRTIO_PCI_CONFIG + VIRTIO_NET_CONFIG_STATUS) & VIRTIO_NET_S_LINK_UP);
+
+    vnet.iface = iface;
+    iface->features = (vnet.features & VIRTIO_NET_F_CSUM) ? NET_FEATURE_TX_CSUM : 0;
+    vnet.ready = true;
+    pic_route_pci(vnet.pci->irq_line);
+    irq_register(vnet.pci->irq_line, vnet_irq, NULL);
+    virtio_driver_ok(vnet.io);
+    virtq_publish(&vnet.rx, 0);     // Every RX slot, in one go
+    return 0;
+}
+
+static int vnet_set_affinity(network_interface_t* iface, uint32_t cpu) {
+    (void)iface;
+    return pci_set_affinity(vnet.pci, cpu);
+}
+
+static const net_driver_t virtio_net_driver = {
+    "virtio-net",
+    vnet_open,
+    vnet_transmit,
+    vnet_poll,
+    vnet_rx_irq,
+    vnet_set_affinity
+};
+
+int virtio_net_probe(network_interface_t* iface) {
+    pci_device_t* dev = pci_find_device(VIRTIO_VENDOR_ID, VIRTIO_NET_DEVICE_ID);
+    if (!dev || (vnet.pci && vnet.iface && vnet.iface != iface)) {
+        return -1;
+    }
+    vnet.pci = dev;
+    vnet.iface = iface;
+    iface->driver = &virtio_net_driver;
+    iface->driver_data = &vnet;
+    return 0;
+}
+
+void virtio_net_dump_stats(void) {
+    if (!vnet.pci) {
+        terminal_writestring("virtio-net: no device\n");
+        return;
+    }
+    terminal_printf("virtio-net (irq %d): %s, link %s, event index %s\n", vnet.pci->irq_line,
+                    vnet.ready ? "up" : "down", vnet.link_up ? "up" : "down",
+                    vnet.rx.event_idx ? "on" : "off");
+    if (!vnet.ready) {
+        return;
+    }
+    terminal_printf("  IRQs: %d  RX: %d packets in %d batches, %d errors, %d starved\n",
+                    (int)vnet.irqs, (int)vnet.rx_packets, (int)vnet.rx_batches,
+                    (int)vnet.rx_errors, (int)vnet.rx_starved);
+    terminal_printf("  RX buffers lent out: %d/%d\n",
+                    (int)(VIRTIO_NET_RX_BUFFERS - VIRTIO_NET_RX_SLOTS - vnet.rx_spare_count),
+                    VIRTIO_NET_RX_BUFFERS - VIRTIO_NET_RX_SLOTS);
+    terminal_printf("  TX: %d packets (%d bounced), %d in flight, %d reclaim passes, %d ring full\n",
+                    (int)vnet.tx_packets_sent, (int)vnet.tx_bounced,
+                    (int)(VIRTIO_NET_TX_SLOTS - vnet.tx_free_count), (int)vnet.tx_reclaims,
+                    (int)vnet.tx_full);
+    terminal_printf("  Notifications: RX %d sent, %d suppressed; TX %d sent, %d suppressed\n",
+                    (int)vnet.rx.kicks, (int)vnet.rx.kicks_saved,
+                    (int)vnet.tx.kicks, (int)vnet.tx.kicks_saved);
+    terminal_printf("  Checksum offload: %d TX\n", (int)vnet.tx_csum_offloaded);
+}
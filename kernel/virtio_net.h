@@ -0,0 +1,63 @@
+// ClaudeOS Virtio Network Driver - Day 21
+// Legacy virtio-net over PCI port I/O: one receive and one transmit
+// split virtqueue, in place of the e1000's per-register VM exits
+
+#ifndef VIRTIO_NET_H
+#define VIRTIO_NET_H
+
+#include "types.h"
+#include "virtio.h"
+#include "network.h"
+
+#define VIRTIO_NET_DEVICE_ID        0x1000      // Transitional network device
+
+// Feature bits
+#define VIRTIO_NET_F_CSUM           (1u << 0)   // Device finishes checksums we leave partial
+#define VIRTIO_NET_F_MAC            (1u << 5)   // MAC in the config space
+#define VIRTIO_NET_F_STATUS         (1u << 16)  // Link state in the config space
+#define VIRTIO_NET_FEATURES         (VIRTIO_NET_F_CSUM | VIRTIO_NET_F_MAC | VIRTIO_NET_F_STATUS | \
+                                     VIRTIO_RING_F_EVENT_IDX)
+
+// Config space (after VIRTIO_PCI_CONFIG)
+#define VIRTIO_NET_CONFIG_MAC       0
+#define VIRTIO_NET_CONFIG_STATUS    6
+#define VIRTIO_NET_S_LINK_UP        0x01
+
+#define VIRTIO_NET_RX_QUEUE         0
+#define VIRTIO_NET_TX_QUEUE         1
+
+#define VIRTIO_NET_HDR_F_NEEDS_CSUM 1
+
+// Every packet is a chain of two descriptors, the header and the frame
+// (legacy devices without ANY_LAYOUT insist on a descriptor of its own
+// for the header), fixed up front: slot i owns descriptors 2i and 2i+1
+#define VIRTIO_NET_RX_SLOTS         32
+#define VIRTIO_NET_TX_SLOTS         32
+#define VIRTIO_NET_BUFFER_SIZE      2048
+#define VIRTIO_NET_BUFFERS_PER_PAGE (PAGE_SIZE / VIRTIO_NET_BUFFER_SIZE)
+#define VIRTIO_NET_HDR_STRIDE       16          // Each slot's header, padded
+
+// Received buffers are lent to the network layer as they are; the spares
+// refill slots while consumers still hold packets
+#define VIRTIO_NET_RX_BUFFERS       (VIRTIO_NET_RX_SLOTS * 2)
+
+// Kernel virtual layout, above the e1000's DMA area: both rings, the
+// header page, the RX pool and the TX bounce buffers
+#define VIRTIO_NET_DMA_VIRT         (VMM_MMIO_START + 0x80000)
+
+// Without MRG_RXBUF; it is the whole first descriptor of every chain
+typedef struct {
+    uint8_t flags;
+    uint8_t gso_type;
+    uint16_t hdr_length;
+    uint16_t gso_size;
+    uint16_t csum_start;
+    uint16_t csum_offset;
+} __attribute__((packed)) virtio_net_hdr_t;
+
+// Bind iface to the first virtio-net device on the PCI bus (-1 if there
+// is none). The device is brought up later by the interface's open.
+int virtio_net_probe(network_interface_t* iface);
+void virtio_net_dump_stats(void);
+
+#endif // VIRTIO_NET_H
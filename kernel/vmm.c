@@ -3,43 +3,121 @@
 
 #include "vmm.h"
 #include "pmm.h"
+#include "slab.h"
+#include "heap.h"
+#include "swap.h"
+#include "string.h"
 #include "kernel.h"
 
-// Temporary define for kernel virtual base (identity mapping)
-#define KERNEL_VIRTUAL_BASE 0x00000000
-#define PAGE_SIZE 4096
-
 // Current page directory
-page_directory_t* current_page_directory = 0;
+page_directory_t* kernel_page_directory = 0;
+int vmm_large_pages_enabled = 0;
+int vmm_global_pages_enabled = 0;
+int vmm_pat_enabled = 0;
+
+// Kernel address space and its area descriptors
+vm_space_t kernel_vm_space = {0, 0, 0, 0, 0, 0, 0};
+static kmem_cache_t vma_cache;
+static vm_area_t vma_storage[VMA_MAX_STATIC];
+static int vma_cache_ready = 0;
 
 // Assembly function to load page directory (we'll implement this)
 extern void vmm_load_page_directory(uint32_t page_dir_phys);
 extern void vmm_enable_paging(void);
 extern void vmm_flush_tlb(void);
+extern void vmm_invalidate_page(uint32_t virt_addr);
+
+// The loaded directory is reached through its recursive slot; others (and
+// the one vmm_init is still building) through the direct map
+static inline int use_recursive(page_directory_t* dir) {
+    return dir && dir == current_page_directory;
+}
+
+static inline page_directory_t* directory_view(page_directory_t* dir) {
+    return use_recursive(dir) ? (page_directory_t*)VMM_PAGE_DIR_VIRT : dir;
+}
+
+// Point the last PDE of a directory at itself
+static void set_recursive_entry(page_directory_t* dir, uint32_t dir_phys) {
+    page_directory_entry_t* entry = &dir->tables[VMM_RECURSIVE_INDEX];
+    entry->present = 1;
+    entry->writable = 1;
+    entry->user = 0;
+    entry->table = dir_phys >> 12;
+}
+
+// Copy a kernel-space PDE from the master directory. Returns non-zero if
+// the master has that entry.
+static int sync_kernel_entry(page_directory_t* dir, uint32_t dir_index) {
+    uint32_t master = ((uint32_t*)directory_view(kernel_page_directory)->tables)[dir_index];
+    if (!(master & PAGE_PRESENT)) {
+        return 0;
+    }
+    ((uint32_t*)directory_view(dir)->tables)[dir_index] = master;
+    return 1;
+}
+
+static inline int is_kernel_pde(uint32_t dir_index) {
+    return dir_index >= VMM_KERNEL_PDE_FIRST && dir_index < VMM_KERNEL_PDE_FIRST + VMM_KERNEL_PDE_COUNT;
+}
+
+static inline int is_kernel_entry(page_directory_t* dir, uint32_t dir_index) {
+    return is_kernel_pde(dir_index) && kernel_page_directory && dir != kernel_page_directory;
+}
 
 // Get page table from page directory
 static page_table_t* get_page_table(page_directory_t* dir, uint32_t virt_addr, int create) {
     uint32_t dir_index = GET_PAGE_DIR_INDEX(virt_addr);
-    page_directory_entry_t* dir_entry = &dir->tables[dir_index];
+    if (dir_index == VMM_RECURSIVE_INDEX) {
+        return 0;  // Reserved for the recursive mapping
+    }
+    
+    // Kernel-space tables always belong to the master directory, so every
+    // address space sees the same kernel mappings
+    if (is_kernel_entry(dir, dir_index) && !sync_kernel_entry(dir, dir_index)) {
+        if (!create || !get_page_table(kernel_page_directory, virt_addr, 1)) {
+            return 0;
+        }
+        sync_kernel_entry(dir, dir_index);
+    }
+    
+    int recursive = use_recursive(dir);
+    page_directory_entry_t* dir_entry = &directory_view(dir)->tables[dir_index];
+    page_table_t* table_view = (page_table_t*)(VMM_PAGE_TABLES_VIRT + dir_index * PAGE_SIZE);
     
     if (!dir_entry->present) {
         if (!create) {
             return 0;  // Page table doesn't exist
         }
         
-        // Allocate new page table
-        uint32_t table_phys = pmm_alloc_page();
+        if (recursive) {
+            // Any frame will do - the table is zeroed through its recursive address
+            uint32_t table_phys = pmm_alloc_page();
+            if (!table_phys) {
+                return 0;  // Out of memory
+            }
+            dir_entry->present = 1;
+            dir_entry->writable = 1;
+            dir_entry->user = 1;
+            dir_entry->table = table_phys >> 12;
+            vmm_invalidate_page((uint32_t)table_view);
+            
+            uint32_t count = PAGE_SIZE / 4;
+            uint32_t dest = (uint32_t)table_view;
+            asm volatile ("rep stosl"
+                          : "+D" (dest), "+c" (count)
+                          : "a" (0)
+                          : "memory");
+            return table_view;
+        }
+        
+        // Allocate new page table (already zeroed by the PMM)
+        uint32_t table_phys = pmm_alloc_zeroed_page();
         if (!table_phys) {
             return 0;  // Out of memory
         }
         
-        // Clear the page table
-        // Use a safer approach: zero the entire 4KB page
-        uint8_t* table_ptr = (uint8_t*)table_phys;
-        for (int i = 0; i < PAGE_SIZE; i++) {
-            table_ptr[i] = 0;
-        }
-        page_table_t* table = (page_table_t*)table_phys;
+        page_table_t* table = (page_table_t*)PHYS_TO_VIRT(table_phys);
         
         // Set up directory entry
         dir_entry->present = 1;
@@ -50,55 +128,368 @@ static page_table_t* get_page_table(page_directory_t* dir, uint32_t virt_addr, i
         return table;
     }
     
-    return (page_table_t*)(dir_entry->table << 12);
+    if (dir_entry->page_size) {
+        return 0;  // 4MB page - there is no table
+    }
+    if (recursive) {
+        return table_view;
+    }
+    return (page_table_t*)PHYS_TO_VIRT(dir_entry->table << 12);
+}
+
+// Return the large-page PDE covering virt_addr, or 0
+static page_directory_entry_t* get_large_entry(page_directory_t* dir, uint32_t virt_addr) {
+    page_directory_entry_t* entry = &directory_view(dir)->tables[GET_PAGE_DIR_INDEX(virt_addr)];
+    return (entry->present && entry->page_size) ? entry : 0;
+}
+
+// Turn on CR4.PSE and CR4.PGE where CPUID reports support
+static void enable_paging_extensions(void) {
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
+    uint32_t cr4;
+    asm volatile ("mov %%cr4, %0" : "=r" (cr4));
+    if (edx & (1 << 3)) {
+        cr4 |= 0x10;    // PSE - 4MB pages
+        vmm_large_pages_enabled = 1;
+    }
+    if (edx & (1 << 13)) {
+        cr4 |= 0x80;    // PGE - global pages
+        vmm_global_pages_enabled = 1;
+    }
+    asm volatile ("mov %0, %%cr4" : : "r" (cr4));
 }
 
-// Initialize virtual memory manager
+// PA4 keeps its power-on write-back until here and no PTE selects it
+// before, so no mapping changes type under the caches' feet. Every CPU
+// must agree on the table.
+#define IA32_PAT        0x277
+#define PAT_WC          0x01
+
+void vmm_pat_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
+    if (!(edx & (1 << 16))) {
+        return;
+    }
+    uint32_t lo, hi;
+    asm volatile ("rdmsr" : "=a" (lo), "=d" (hi) : "c" (IA32_PAT));
+    hi = (hi & ~0xFFu) | PAT_WC;      // PA4: bits 32-39
+    asm volatile ("wrmsr" : : "a" (lo), "d" (hi), "c" (IA32_PAT));
+    vmm_pat_enabled = 1;
+}
+
+// Flush every TLB entry. A CR3 reload keeps global entries, so toggle
+// CR4.PGE instead once global pages are in use.
+void vmm_flush_tlb_all(void) {
+    if (!vmm_global_pages_enabled) {
+        vmm_flush_tlb();
+        return;
+    }
+    uint32_t cr4;
+    asm volatile ("mov %%cr4, %0" : "=r" (cr4));
+    asm volatile ("mov %0, %%cr4" : : "r" (cr4 & ~0x80) : "memory");
+    asm volatile ("mov %0, %%cr4" : : "r" (cr4) : "memory");
+}
+
+// Invalidate count pages starting at virt_addr
+void vmm_invalidate_range(uint32_t virt_addr, uint32_t count) {
+    if (count > VMM_INVLPG_THRESHOLD) {
+        vmm_flush_tlb_all();
+        return;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        vmm_invalidate_page(virt_addr + i * PAGE_SIZE);
+    }
+}
+
+// Initialize virtual memory manager. Paging has been on since entry.asm,
+// on a boot directory that also maps the low 4MB at 0; the master built
+// here maps only kernel space, and replaces it for good.
 void vmm_init(void) {
+    if (kernel_page_directory) {
+        terminal_writestring("VMM: Already initialized\n");
+        return;
+    }
     terminal_writestring("VMM: Initializing virtual memory manager...\n");
     
+    enable_paging_extensions();
+    vmm_pat_init();
+    
     // Create kernel page directory
-    uint32_t page_dir_phys = pmm_alloc_page();
+    uint32_t page_dir_phys = pmm_alloc_zeroed_page();
     if (!page_dir_phys) {
         kernel_panic("VMM: Failed to allocate page directory");
     }
     
-    // Clear page directory using safe memory access
-    uint8_t* dir_ptr = (uint8_t*)page_dir_phys;
-    for (int i = 0; i < PAGE_SIZE; i++) {
-        dir_ptr[i] = 0;
-    }
+    page_directory_t* dir = (page_directory_t*)PHYS_TO_VIRT(page_dir_phys);
+    set_recursive_entry(dir, page_dir_phys);
     
-    current_page_directory = (page_directory_t*)page_dir_phys;
+    // The direct map, which holds the kernel image
+    vmm_map_kernel(dir);
     
-    // Identity map first 4MB (kernel space)
-    vmm_identity_map_kernel(current_page_directory);
+    // The MMIO window's table exists from the start so every directory
+    // shares it - the page fault path itself reads the local APIC
+    get_page_table(dir, VMM_MMIO_START, 1);
+    
+    kernel_page_directory = dir;
+    vmm_switch_page_directory(dir);
+    
+    // Area descriptors come from static storage so faults work before the heap
+    if (!vma_cache_ready) {
+        kmem_cache_init(&vma_cache, "vm_area", sizeof(vm_area_t), 0);
+        kmem_cache_seed(&vma_cache, vma_storage, VMA_MAX_STATIC);
+        vma_cache_ready = 1;
+    }
+    vmm_release_areas(&kernel_vm_space);
+    kernel_vm_space.dir = current_page_directory;
+    kernel_vm_space.faults_handled = 0;
+    kernel_vm_space.faults_failed = 0;
+    kernel_vm_space.cow_copies = 0;
+    kernel_vm_space.zero_maps = 0;
+    kernel_vm_space.swap_hand = 0;
     
     terminal_writestring("VMM: Virtual memory manager initialized\n");
 }
 
 // Create a new page directory
 page_directory_t* vmm_create_page_directory(void) {
-    uint32_t page_dir_phys = pmm_alloc_page();
+    uint32_t page_dir_phys = pmm_alloc_zeroed_page();
     if (!page_dir_phys) {
         return 0;
     }
     
-    // Clear page directory using safe memory access
-    uint8_t* dir_ptr = (uint8_t*)page_dir_phys;
-    for (int i = 0; i < PAGE_SIZE; i++) {
-        dir_ptr[i] = 0;
-    }
-    
-    page_directory_t* dir = (page_directory_t*)page_dir_phys;
+    page_directory_t* dir = (page_directory_t*)PHYS_TO_VIRT(page_dir_phys);
+    set_recursive_entry(dir, page_dir_phys);
     
     return dir;
 }
 
+// Create a directory for a new process. The kernel PDEs are copied from
+// the master, so the kernel page tables are shared rather than rebuilt.
+page_directory_t* vmm_create_process_directory(void) {
+    page_directory_t* dir = vmm_create_page_directory();
+    if (!dir || !kernel_page_directory) {
+        return dir;
+    }
+    uint32_t* master = (uint32_t*)directory_view(kernel_page_directory)->tables;
+    uint32_t* entries = (uint32_t*)dir->tables;
+    for (uint32_t i = VMM_KERNEL_PDE_FIRST; i < VMM_KERNEL_PDE_FIRST + VMM_KERNEL_PDE_COUNT; i++) {
+        entries[i] = master[i];
+    }
+    return dir;
+}
+
 // Switch to different page directory
 void vmm_switch_page_directory(page_directory_t* dir) {
     current_page_directory = dir;
-    vmm_load_page_directory((uint32_t)dir);
+    vmm_load_page_directory(VIRT_TO_PHYS(dir));
+    percpu_inc(tlb_generation);   // The last directory's entries are gone
+}
+
+// Make a frame addressable. Inside the direct map that is where it already
+// is; otherwise it is mapped at the scratch slot until release_window().
+// Only one window may be open at a time.
+static void* open_window(uint32_t phys) {
+    if (phys + PAGE_SIZE <= PMM_DIRECT_LIMIT) {
+        return PHYS_TO_VIRT(phys);
+    }
+    vmm_map_page(current_page_directory, VMM_SCRATCH_VIRT, phys, PAGE_PRESENT | PAGE_WRITABLE);
+    vmm_invalidate_page(VMM_SCRATCH_VIRT);
+    return (void*)VMM_SCRATCH_VIRT;
+}
+
+static void release_window(void* window) {
+    if ((uint32_t)window == VMM_SCRATCH_VIRT) {
+        vmm_unmap_page(current_page_directory, VMM_SCRATCH_VIRT);
+    }
+}
+
+// Clone an address space copy-on-write. Kernel page tables are shared;
+// every other present page is mapped read-only in both directories with
+// an extra PMM reference, and copied by the fault handler when written.
+page_directory_t* vmm_clone_directory(page_directory_t* src) {
+    page_directory_t* dir = vmm_create_page_directory();
+    if (!dir) {
+        return 0;
+    }
+    
+    uint32_t* src_entries = (uint32_t*)directory_view(src)->tables;
+    uint32_t* dst_entries = (uint32_t*)dir->tables;
+    int parent_changed = 0;
+    
+    for (uint32_t i = 0; i < VMM_RECURSIVE_INDEX; i++) {
+        uint32_t pde = src_entries[i];
+        if (!(pde & PAGE_PRESENT)) {
+            continue;
+        }
+        if (is_kernel_pde(i) || (pde & PAGE_LARGE)) {
+            dst_entries[i] = pde;  // Shared kernel mapping
+            continue;
+        }
+        
+        uint32_t table_phys = pmm_alloc_zeroed_page();
+        if (!table_phys) {
+            vmm_destroy_directory(dir);
+            return 0;
+        }
+        uint32_t* src_table = (uint32_t*)get_page_table(src, i << 22, 0);
+        uint32_t* dst_table = (uint32_t*)PHYS_TO_VIRT(table_phys);
+        dst_entries[i] = table_phys | (pde & 0xFFF);
+        
+        for (uint32_t j = 0; j < PAGES_PER_TABLE; j++) {
+            uint32_t pte = src_table[j];
+            if (!(pte & PAGE_PRESENT)) {
+                if (!(pte & PAGE_SWAPPED)) {
+                    continue;
+                }
+                if (swap_dup(SWAP_ENTRY_SLOT(pte)) != 0) {
+                    vmm_destroy_directory(dir);
+                    return 0;  // Slot shared too many times
+                }
+                dst_table[j] = pte;  // Both entries name the slot
+                continue;
+            }
+            if (pmm_page_ref(pte & ~0xFFF) != 0) {
+                vmm_destroy_directory(dir);
+                return 0;  // Frame shared too many times
+            }
+            if (pte & PAGE_WRITABLE) {
+                pte = (pte & ~PAGE_WRITABLE) | PAGE_COW;
+                src_table[j] = pte;
+                parent_changed = 1;
+            }
+            dst_table[j] = pte;
+        }
+    }
+    
+    // The parent's writable translations are now stale
+    if (parent_changed && use_recursive(src)) {
+        vmm_flush_tlb_all();
+    }
+    return dir;
+}
+
+// Free a directory that is not loaded, dropping its references on every
+// page below the recursive slot that is not shared kernel space
+void vmm_destroy_directory(page_directory_t* dir) {
+    if (!dir || dir == current_page_directory) {
+        return;
+    }
+    
+    uint32_t* entries = (uint32_t*)dir->tables;
+    for (uint32_t i = 0; i < VMM_RECURSIVE_INDEX; i++) {
+        uint32_t pde = entries[i];
+        if (is_kernel_pde(i) || !(pde & PAGE_PRESENT) || (pde & PAGE_LARGE)) {
+            continue;
+        }
+        uint32_t table_phys = pde & ~0xFFF;
+        uint32_t* table = (uint32_t*)open_window(table_phys);
+        for (uint32_t j = 0; j < PAGES_PER_TABLE; j++) {
+            if (table[j] & PAGE_PRESENT) {
+                pmm_free_page(table[j] & ~0xFFF);
+            } else if (table[j] & PAGE_SWAPPED) {
+                swap_free(SWAP_ENTRY_SLOT(table[j]));
+            }
+        }
+        release_window(table);
+        pmm_free_page(table_phys);
+    }
+    pmm_free_page(VIRT_TO_PHYS(dir));
+}
+
+// Resolve a write to a copy-on-write page in the loaded directory
+static int resolve_cow(uint32_t fault_addr) {
+    page_table_t* table = get_page_table(current_page_directory, fault_addr, 0);
+    if (!table) {
+        return -1;
+    }
+    uint32_t* pte = (uint32_t*)&table->pages[GET_PAGE_TABLE_INDEX(fault_addr)];
+    if (!(*pte & PAGE_PRESENT) || !(*pte & PAGE_COW)) {
+        return -1;
+    }
+    
+    uint32_t page_addr = PAGE_FLOOR(fault_addr);
+    uint32_t old_phys = *pte & ~0xFFF;
+    
+    // Last owner keeps the frame and just gets write access back
+    if (pmm_page_shares(old_phys) == 0) {
+        *pte = (*pte & ~PAGE_COW) | PAGE_WRITABLE;
+        vmm_invalidate_page(page_addr);
+        return 0;
+    }
+    
+    uint32_t new_phys = pmm_alloc_page();
+    if (!new_phys) {
+        return -1;  // Out of physical memory
+    }
+    uint32_t src = page_addr;
+    uint32_t dest = (uint32_t)open_window(new_phys);
+    void* window = (void*)dest;
+    uint32_t count = PAGE_SIZE / 4;
+    asm volatile ("rep movsl"
+                  : "+S" (src), "+D" (dest), "+c" (count)
+                  :
+                  : "memory");
+    release_window(window);
+    
+    *pte = new_phys | ((*pte & 0xFFF & ~PAGE_COW) | PAGE_WRITABLE);
+    vmm_invalidate_page(page_addr);
+    pmm_free_page(old_phys);  // Drop this directory's share
+    kernel_vm_space.cow_copies++;
+    return 0;
+}
+
+// Bring a swapped-out page of the loaded directory back. Returns 1 if the
+// PTE is not a swap entry (a demand-zero fault), otherwise 0 once the
+// access can be retried or -1.
+static int resolve_swap(uint32_t fault_addr, uint32_t err_code) {
+    page_table_t* table = get_page_table(current_page_directory, fault_addr, 0);
+    if (!table) {
+        return 1;
+    }
+    volatile uint32_t* pte = (volatile uint32_t*)&table->pages[GET_PAGE_TABLE_INDEX(fault_addr)];
+    uint32_t entry = *pte;
+    if (entry & PAGE_PRESENT) {
+        return 0;  // Another CPU got here first
+    }
+    if (!(entry & PAGE_SWAPPED) || SWAP_ENTRY_SLOT(entry) == 0) {
+        // A frame still named but not present is being copied out
+        return (entry & ~0xFFF) ? 0 : 1;
+    }
+    
+    // The read may sleep, so it goes to a buffer of its own
+    uint32_t slot = SWAP_ENTRY_SLOT(entry);
+    void* buffer = kmalloc_page();
+    if (!buffer) {
+        return -1;
+    }
+    if (swap_read(slot, buffer, (err_code & PF_USER) != 0) != 0) {
+        kfree_page(buffer);
+        return -1;
+    }
+    if (*pte != entry) {
+        kfree_page(buffer);
+        return 0;
+    }
+    uint32_t phys = pmm_alloc_page();
+    if (!phys) {
+        kfree_page(buffer);
+        return -1;  // Out of physical memory
+    }
+    
+    // Writable until filled, like a demand-zero page
+    uint32_t page_addr = PAGE_FLOOR(fault_addr);
+    *pte = phys | PAGE_PRESENT | PAGE_WRITABLE | (entry & PAGE_USER);
+    vmm_invalidate_page(page_addr);
+    memcpy((void*)page_addr, buffer, PAGE_SIZE);
+    if (!(entry & PAGE_WRITABLE)) {
+        *pte &= ~PAGE_WRITABLE;
+        vmm_invalidate_page(page_addr);
+    }
+    kfree_page(buffer);
+    swap_free(slot);
+    return 0;
 }
 
 // Map virtual address to physical address
@@ -111,10 +502,98 @@ void vmm_map_page(page_directory_t* dir, uint32_t virt_addr, uint32_t phys_addr,
     uint32_t table_index = GET_PAGE_TABLE_INDEX(virt_addr);
     page_table_entry_t* page = &table->pages[table_index];
     
+    int was_present = page->present;
     page->present = (flags & PAGE_PRESENT) ? 1 : 0;
     page->writable = (flags & PAGE_WRITABLE) ? 1 : 0;
     page->user = (flags & PAGE_USER) ? 1 : 0;
+    page->global = (flags & PAGE_GLOBAL) ? 1 : 0;
+    page->writethrough = (flags & PAGE_WRITETHROUGH) ? 1 : 0;
+    page->cache_disabled = (flags & PAGE_NOCACHE) ? 1 : 0;
+    page->page_size = (flags & PAGE_WRITECOMBINE) ? 1 : 0;     // The PAT bit in a PTE
     page->frame = phys_addr >> 12;  // Physical frame number
+    
+    // Replacing a live translation must drop the stale TLB entry
+    if (was_present && use_recursive(dir)) {
+        vmm_invalidate_page(virt_addr);
+    }
+}
+
+// Map count consecutive pages to a physically contiguous run. Each page
+// table is looked up once and filled in a tight loop, with a single TLB
+// invalidation at the end. Returns 0 on success, -1 if a table could not
+// be created (pages before it stay mapped).
+int vmm_map_range(page_directory_t* dir, uint32_t virt_addr, uint32_t phys_addr, uint32_t count, uint32_t flags) {
+    uint32_t entry_flags = flags & (PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER | PAGE_GLOBAL |
+                                    PAGE_WRITETHROUGH | PAGE_NOCACHE | PAGE_WRITECOMBINE);
+    uint32_t first = virt_addr;
+    uint32_t remaining = count;
+    int replaced = 0;
+    
+    while (remaining > 0) {
+        page_table_t* table = get_page_table(dir, virt_addr, 1);
+        if (!table) {
+            return -1;  // Failed to get/create page table
+        }
+        
+        // Fill up to the end of this table
+        uint32_t index = GET_PAGE_TABLE_INDEX(virt_addr);
+        uint32_t batch = PAGES_PER_TABLE - index;
+        if (batch > remaining) {
+            batch = remaining;
+        }
+        uint32_t* entries = (uint32_t*)&table->pages[index];
+        for (uint32_t i = 0; i < batch; i++) {
+            replaced |= entries[i] & PAGE_PRESENT;
+            entries[i] = (phys_addr & ~0xFFF) | entry_flags;
+            phys_addr += PAGE_SIZE;
+        }
+        
+        virt_addr += batch * PAGE_SIZE;
+        remaining -= batch;
+    }
+    
+    if (replaced && use_recursive(dir)) {
+        vmm_invalidate_range(first, count);
+    }
+    return 0;
+}
+
+// Map a 4MB page. Both addresses must be 4MB aligned and the directory
+// slot must be empty. Returns 0 on success, -1 otherwise.
+int vmm_map_large_page(page_directory_t* dir, uint32_t virt_addr, uint32_t phys_addr, uint32_t flags) {
+    uint32_t dir_index = GET_PAGE_DIR_INDEX(virt_addr);
+    if (!vmm_large_pages_enabled || dir_index == VMM_RECURSIVE_INDEX ||
+        (virt_addr & (LARGE_PAGE_SIZE - 1)) || (phys_addr & (LARGE_PAGE_SIZE - 1))) {
+        return -1;
+    }
+    
+    // Kernel-space large pages go into the master and are copied from there
+    if (is_kernel_entry(dir, dir_index)) {
+        if (vmm_map_large_page(kernel_page_directory, virt_addr, phys_addr, flags) != 0) {
+            return -1;
+        }
+        sync_kernel_entry(dir, dir_index);
+        if (use_recursive(dir)) {
+            vmm_invalidate_page(virt_addr);
+        }
+        return 0;
+    }
+    
+    page_directory_entry_t* entry = &directory_view(dir)->tables[dir_index];
+    if (entry->present) {
+        return -1;  // Already backed by a page table or large page
+    }
+    
+    entry->writable = (flags & PAGE_WRITABLE) ? 1 : 0;
+    entry->user = (flags & PAGE_USER) ? 1 : 0;
+    entry->page_size = 1;
+    entry->global = (flags & PAGE_GLOBAL) ? 1 : 0;
+    entry->table = phys_addr >> 12;
+    entry->present = (flags & PAGE_PRESENT) ? 1 : 0;
+    if (use_recursive(dir)) {
+        vmm_invalidate_page(virt_addr);
+    }
+    return 0;
 }
 
 // Unmap virtual address
@@ -131,11 +610,16 @@ void vmm_unmap_page(page_directory_t* dir, uint32_t virt_addr) {
     page->frame = 0;
     
     // Flush TLB for this page
-    vmm_flush_tlb();
+    vmm_invalidate_page(virt_addr);
 }
 
 // Get physical address from virtual address
 uint32_t vmm_get_physical_address(page_directory_t* dir, uint32_t virt_addr) {
+    page_directory_entry_t* large = get_large_entry(dir, virt_addr);
+    if (large) {
+        return (large->table << 12) | (virt_addr & (LARGE_PAGE_SIZE - 1));
+    }
+    
     page_table_t* table = get_page_table(dir, virt_addr, 0);
     if (!table) {
         return 0;  // Page table doesn't exist
@@ -152,7 +636,24 @@ uint32_t vmm_get_physical_address(page_directory_t* dir, uint32_t virt_addr) {
 }
 
 // Check if page is present
+// Raw 4KB page-table entry for an address (0 if it has no table, or is
+// covered by a large page)
+uint32_t vmm_get_page_entry(page_directory_t* dir, uint32_t virt_addr) {
+    if (get_large_entry(dir, virt_addr)) {
+        return 0;
+    }
+    page_table_t* table = get_page_table(dir, virt_addr, 0);
+    if (!table) {
+        return 0;
+    }
+    return ((uint32_t*)table->pages)[GET_PAGE_TABLE_INDEX(virt_addr)];
+}
+
 int vmm_is_page_present(page_directory_t* dir, uint32_t virt_addr) {
+    if (get_large_entry(dir, virt_addr)) {
+        return 1;
+    }
+    
     page_table_t* table = get_page_table(dir, virt_addr, 0);
     if (!table) {
         return 0;  // Page table doesn't exist
@@ -162,15 +663,376 @@ int vmm_is_page_present(page_directory_t* dir, uint32_t virt_addr) {
     return table->pages[table_index].present;
 }
 
-// Identity map kernel space (first 4MB)
-void vmm_identity_map_kernel(page_directory_t* dir) {
-    // Map first 4MB (1024 pages) with identity mapping
-    for (uint32_t i = 0; i < 1024; i++) {
-        uint32_t phys_addr = i * PAGE_SIZE;
-        uint32_t virt_addr = phys_addr;
-        
-        vmm_map_page(dir, virt_addr, phys_addr, PAGE_PRESENT | PAGE_WRITABLE);
+// Map the first 4MB of physical memory at KERNEL_VIRT_BASE
+void vmm_map_kernel(page_directory_t* dir) {
+    // One 4MB PDE saves a page table and keeps the kernel in a single TLB entry
+    if (vmm_map_large_page(dir, KERNEL_VIRT_BASE, 0, PAGE_PRESENT | PAGE_WRITABLE | PAGE_GLOBAL) == 0) {
+        terminal_writestring("VMM: Kernel mapped at 0xC0000000 (0-4MB, large page)\n");
+        return;
     }
     
-    terminal_writestring("VMM: Kernel identity mapping complete (0-4MB)\n");
-}
\ No newline at end of file
+    // Map first 4MB (1024 pages) one page at a time
+    vmm_map_range(dir, KERNEL_VIRT_BASE, 0, PMM_DIRECT_LIMIT / PAGE_SIZE,
+                  PAGE_PRESENT | PAGE_WRITABLE | PAGE_GLOBAL);
+    
+    terminal_writestring("VMM: Kernel mapped at 0xC0000000 (0-4MB)\n");
+}
+
+// Register a file-backed (or, with no fill callback, demand-zero) area
+vm_area_t* vmm_add_file_area(vm_space_t* space, uint32_t start, uint32_t size, uint32_t flags,
+                             vma_fill_t fill, void* backing, uint32_t file_offset) {
+    if (!space || !vma_cache_ready || size == 0 || (start & 0xFFF)) {
+        return 0;
+    }
+    uint32_t end = start + PAGE_ALIGN(size);
+    if (end <= start) {
+        return 0;  // Wraps the address space
+    }
+    
+    // Keep the list sorted and reject overlaps
+    vm_area_t** link = &space->areas;
+    while (*link && (*link)->start < end) {
+        if ((*link)->end > start) {
+            return 0;  // Overlaps an existing area
+        }
+        link = &(*link)->next;
+    }
+    
+    vm_area_t* area = (vm_area_t*)kmem_cache_alloc(&vma_cache);
+    if (!area) {
+        return 0;
+    }
+    area->start = start;
+    area->end = end;
+    area->flags = flags;
+    area->type = fill ? VMA_FILE : VMA_ANONYMOUS;
+    area->fill = fill;
+    area->writeback = 0;
+    area->backing = backing;
+    area->file_offset = file_offset;
+    area->faults = 0;
+    area->next = *link;
+    *link = area;
+    return area;
+}
+
+// Register a demand-zero area
+vm_area_t* vmm_add_area(vm_space_t* space, uint32_t start, uint32_t size, uint32_t flags) {
+    return vmm_add_file_area(space, start, size, flags, 0, 0, 0);
+}
+
+// Hand the pages of an area written since they were faulted in (or last
+// synced) to its writeback callback. The dirty bit is cleared before each
+// page is copied out, so a store racing the copy is caught next time.
+int vmm_sync_area(vm_area_t* area) {
+    if (!area || !area->writeback) {
+        return 0;
+    }
+    int result = 0;
+    for (uint32_t addr = area->start; addr < area->end; addr += PAGE_SIZE) {
+        page_table_t* table = get_page_table(current_page_directory, addr, 0);
+        if (!table) {
+            continue;
+        }
+        uint32_t* pte = &((uint32_t*)table->pages)[GET_PAGE_TABLE_INDEX(addr)];
+        if ((*pte & (PAGE_PRESENT | PAGE_DIRTY)) != (PAGE_PRESENT | PAGE_DIRTY)) {
+            continue;
+        }
+        *pte &= ~PAGE_DIRTY;
+        vmm_invalidate_page(addr);
+        if (area->writeback(area, area->file_offset + (addr - area->start), (const void*)addr) != 0) {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+// Remove an area and release every page that was faulted in, writing
+// shared pages back first
+int vmm_remove_area(vm_space_t* space, uint32_t start) {
+    if (!space) {
+        return -1;
+    }
+    vm_area_t** link = &space->areas;
+    while (*link && (*link)->start != start) {
+        link = &(*link)->next;
+    }
+    vm_area_t* area = *link;
+    if (!area) {
+        return -1;
+    }
+    vmm_sync_area(area);
+    
+    // Pages were faulted into whichever directory was loaded. Other CPUs
+    // may have them cached (any, for the kernel's shared mappings), so the
+    // frames go back only after one shootdown for the lot.
+    tlb_batch_t batch;
+    smp_tlb_batch_init(&batch, space == &kernel_vm_space ? NULL : current_page_directory);
+    for (uint32_t addr = area->start; addr < area->end; addr += PAGE_SIZE) {
+        if (vmm_is_page_present(current_page_directory, addr)) {
+            uint32_t phys = vmm_get_physical_address(current_page_directory, addr) & ~0xFFF;
+            vmm_unmap_page(current_page_directory, addr);
+            smp_tlb_batch_add(&batch, addr, 1);
+            smp_tlb_batch_free(&batch, phys);
+        } else if (vmm_get_page_entry(current_page_directory, addr) & PAGE_SWAPPED) {
+            page_table_t* table = get_page_table(current_page_directory, addr, 0);
+            uint32_t* pte = (uint32_t*)&table->pages[GET_PAGE_TABLE_INDEX(addr)];
+            swap_free(SWAP_ENTRY_SLOT(*pte));
+            *pte = 0;
+        }
+    }
+    smp_tlb_batch_flush(&batch);
+    
+    *link = area->next;
+    kmem_cache_free(&vma_cache, area);
+    return 0;
+}
+
+// Drop every area descriptor of a space whose directory is about to be
+// destroyed; the directory releases the pages themselves
+void vmm_release_areas(vm_space_t* space) {
+    while (space->areas) {
+        vm_area_t* area = space->areas;
+        space->areas = area->next;
+        kmem_cache_free(&vma_cache, area);
+    }
+}
+
+// Find the area containing addr
+vm_area_t* vmm_find_area(vm_space_t* space, uint32_t addr) {
+    for (vm_area_t* area = space ? space->areas : 0; area; area = area->next) {
+        if (addr < area->start) {
+            break;
+        }
+        if (addr < area->end) {
+            return area;
+        }
+    }
+    return 0;
+}
+
+// Resolve a page fault. Returns 0 if the faulting access can be retried,
+// -1 if the access is invalid.
+int vmm_handle_page_fault(uint32_t fault_addr, uint32_t err_code) {
+    vm_space_t* space = smp_current_cpu()->vm_space;
+    
+    // A kernel PDE added to the master after this directory was created
+    uint32_t dir_index = GET_PAGE_DIR_INDEX(fault_addr);
+    if (!(err_code & PF_PRESENT) && is_kernel_entry(current_page_directory, dir_index) &&
+        !(((uint32_t*)directory_view(current_page_directory)->tables)[dir_index] & PAGE_PRESENT) &&
+        sync_kernel_entry(current_page_directory, dir_index)) {
+        return 0;
+    }
+    
+    // Writes to shared frames get a private copy
+    if ((err_code & (PF_PRESENT | PF_WRITE)) == (PF_PRESENT | PF_WRITE) &&
+        resolve_cow(fault_addr) == 0) {
+        return 0;
+    }
+    
+    // The running process's own areas first, then the kernel's
+    vm_area_t* area = space ? vmm_find_area(space, fault_addr) : 0;
+    if (!area) {
+        space = &kernel_vm_space;
+        area = vmm_find_area(space, fault_addr);
+    }
+    
+    // Only not-present faults inside an area with matching rights are serviced
+    if (!area || (err_code & PF_PRESENT) ||
+        ((err_code & PF_WRITE) && !(area->flags & VMA_WRITE)) ||
+        ((err_code & PF_USER) && !(area->flags & VMA_USER))) {
+        space->faults_failed++;
+        return -1;
+    }
+    
+    // Anonymous pages may have been swapped out
+    if (area->type == VMA_ANONYMOUS) {
+        int swapped = resolve_swap(fault_addr, err_code);
+        if (swapped <= 0) {
+            if (swapped == 0) {
+                space->faults_handled++;
+            } else {
+                space->faults_failed++;
+            }
+            return swapped;
+        }
+    }
+    
+    uint32_t page_addr = PAGE_FLOOR(fault_addr);
+    uint32_t user = (area->flags & VMA_USER) ? PAGE_USER : 0;
+    
+    // Reading untouched user memory maps the shared zero page; a write to
+    // a writable area then copies it like any copy-on-write frame
+    uint32_t zero_page = pmm_get_zero_page();
+    if (area->type == VMA_ANONYMOUS && user && !(err_code & PF_WRITE) && zero_page) {
+        page_table_t* table = get_page_table(current_page_directory, page_addr, 1);
+        if (!table) {
+            space->faults_failed++;
+            return -1;
+        }
+        ((uint32_t*)table->pages)[GET_PAGE_TABLE_INDEX(page_addr)] =
+            zero_page | PAGE_PRESENT | user | ((area->flags & VMA_WRITE) ? PAGE_COW : 0);
+        area->faults++;
+        space->zero_maps++;
+        space->faults_handled++;
+        return 0;
+    }
+    
+    uint32_t phys = pmm_alloc_page();
+    if (!phys) {
+        space->faults_failed++;
+        return -1;  // Out of physical memory
+    }
+    
+    // Map writable first so the page can be filled through its own address
+    vmm_map_page(current_page_directory, page_addr, phys, PAGE_PRESENT | PAGE_WRITABLE | user);
+    
+    if (area->type == VMA_FILE) {
+        uint32_t offset = area->file_offset + (page_addr - area->start);
+        if (area->fill(area, offset, (void*)page_addr) != 0) {
+            vmm_unmap_page(current_page_directory, page_addr);
+            pmm_free_page(phys);
+            space->faults_failed++;
+            return -1;
+        }
+    } else {
+        uint32_t count = PAGE_SIZE / 4;
+        uint32_t dest = page_addr;
+        asm volatile ("rep stosl"
+                      : "+D" (dest), "+c" (count)
+                      : "a" (0)
+                      : "memory");
+    }
+    
+    if (!(area->flags & VMA_WRITE)) {
+        vmm_map_page(current_page_directory, page_addr, phys, PAGE_PRESENT | user);
+    } else if (area->writeback) {
+        // Filling it dirtied the page; only the caller's stores count
+        page_table_t* table = get_page_table(current_page_directory, page_addr, 0);
+        ((uint32_t*)table->pages)[GET_PAGE_TABLE_INDEX(page_addr)] &= ~PAGE_DIRTY;
+        vmm_invalidate_page(page_addr);
+    }
+    
+    area->faults++;
+    space->faults_handled++;
+    return 0;
+}
+
+// The page table holding an address's PTE, or 0 if it has none. The
+// loaded directory's tables are reached through the recursive slot;
+// another's only inside the direct map, as the scratch window is needed
+// for the frames themselves.
+static uint32_t* swap_table(page_directory_t* dir, uint32_t addr) {
+    if (use_recursive(dir)) {
+        return (uint32_t*)get_page_table(dir, addr, 0);
+    }
+    uint32_t pde = ((uint32_t*)dir->tables)[GET_PAGE_DIR_INDEX(addr)];
+    if (!(pde & PAGE_PRESENT) || (pde & PAGE_LARGE) || (pde & ~0xFFF) + PAGE_SIZE > PMM_DIRECT_LIMIT) {
+        return 0;
+    }
+    return (uint32_t*)PHYS_TO_VIRT(pde & ~0xFFF);
+}
+
+// One PTE under the CLOCK hand: 1 if its frame was swapped out and freed,
+// 0 if it was passed over, -1 if the swap area takes no more for now
+static int swap_out_page(page_directory_t* dir, volatile uint32_t* pte, uint32_t addr) {
+    uint32_t entry = *pte;
+    if (!(entry & PAGE_PRESENT) || (entry & PAGE_COW) || pmm_page_shares(entry & ~0xFFF) != 0) {
+        return 0;  // Shared frames stay put
+    }
+    if (entry & PAGE_ACCESSED) {
+        __sync_fetch_and_and(pte, ~PAGE_ACCESSED);  // Second chance
+        if (use_recursive(dir)) {
+            vmm_invalidate_page(addr);
+        }
+        return 0;
+    }
+    
+    // Not present before the copy, so no store can land after it
+    if (!__sync_bool_compare_and_swap(pte, entry, entry & ~PAGE_PRESENT)) {
+        return 0;  // Touched meanwhile
+    }
+    if (use_recursive(dir)) {
+        vmm_invalidate_page(addr);
+    }
+    smp_tlb_shootdown(dir, addr, 1);
+    
+    uint32_t phys = entry & ~0xFFF;
+    void* window = open_window(phys);
+    uint32_t slot = swap_stage(window);
+    release_window(window);
+    if (!slot) {
+        *pte = entry;
+        return -1;
+    }
+    *pte = SWAP_ENTRY(slot, entry);
+    pmm_free_page(phys);
+    return 1;
+}
+
+static inline int swap_candidate(vm_area_t* area) {
+    return area->type == VMA_ANONYMOUS &&
+           (area->flags & (VMA_USER | VMA_WRITE)) == (VMA_USER | VMA_WRITE);
+}
+
+uint32_t vmm_swap_out(vm_space_t* space, uint32_t max, uint32_t* budget) {
+    uint32_t freed = 0;
+    uint32_t start = space->swap_hand;
+    int wrapped = 0;
+    vm_area_t* area = space->areas;
+    
+    while (freed < max && *budget > 0) {
+        while (area && (!swap_candidate(area) || area->end <= space->swap_hand)) {
+            area = area->next;
+        }
+        if (!area) {
+            if (wrapped) {
+                break;
+            }
+            wrapped = 1;  // Round again from the bottom, as far as start
+            space->swap_hand = 0;
+            area = space->areas;
+            continue;
+        }
+        
+        uint32_t addr = space->swap_hand > area->start ? space->swap_hand : area->start;
+        uint32_t table_end = (addr | (LARGE_PAGE_SIZE - 1)) + 1;
+        uint32_t* table = swap_table(space->dir, addr);
+        (*budget)--;
+        if (!table) {
+            space->swap_hand = table_end;  // Nothing was ever faulted in here
+        } else {
+            uint32_t end = area->end < table_end ? area->end : table_end;
+            for (; addr < end && freed < max && *budget > 0; addr += PAGE_SIZE) {
+                (*budget)--;
+                int result = swap_out_page(space->dir, &table[GET_PAGE_TABLE_INDEX(addr)], addr);
+                if (result < 0) {
+                    space->swap_hand = addr;
+                    return freed;
+                }
+                freed += result;
+            }
+            space->swap_hand = addr;
+        }
+        if (wrapped && space->swap_hand >= start) {
+            break;
+        }
+    }
+    return freed;
+}
+
+// Debug function to list the areas of an address space
+void vmm_dump_areas(vm_space_t* space) {
+    terminal_writestring("VMM Areas:\n");
+    terminal_printf("  Faults handled: %d, failed: %d, copy-on-write copies: %d, zero page maps: %d\n",
+                    (int)space->faults_handled, (int)space->faults_failed, (int)space->cow_copies,
+                    (int)space->zero_maps);
+    for (vm_area_t* area = space->areas; area; area = area->next) {
+        terminal_printf("  %dKB at %dKB  %s%s  %s  faults: %d\n",
+                        (int)((area->end - area->start) / 1024), (int)(area->start / 1024),
+                        (area->flags & VMA_WRITE) ? "rw" : "r-",
+                        (area->flags & VMA_USER) ? "u" : "k",
+                        area->type == VMA_FILE ? "file" : "anon",
+                        (int)area->faults);
+    }
+}
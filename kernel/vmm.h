@@ -5,19 +5,60 @@
 #define VMM_H
 
 #include "types.h"
+#include "pmm.h"
+#include "smp.h"
 
 // Page directory and table entry flags
 #define PAGE_PRESENT    0x001
 #define PAGE_WRITABLE   0x002
 #define PAGE_USER       0x004
+#define PAGE_WRITETHROUGH 0x008
+#define PAGE_NOCACHE    0x010       // Device memory (MMIO)
 #define PAGE_ACCESSED   0x020
 #define PAGE_DIRTY      0x040
+#define PAGE_LARGE      0x080       // PDE maps a 4MB page (needs CR4.PSE)
+#define PAGE_WRITECOMBINE 0x080     // PTE: PAT entry 4, write-combining once vmm_pat_init ran
+#define PAGE_GLOBAL     0x100       // Survives CR3 reloads (needs CR4.PGE)
+#define PAGE_COW        0x200       // OS-available bit: read-only until written, then copied
+#define PAGE_SWAPPED    0x400       // OS-available bit, not present: the frame bits name a swap slot
+
+#define LARGE_PAGE_SIZE 0x400000
+
+// Ranges longer than this are invalidated with one full TLB flush
+#define VMM_INVLPG_THRESHOLD 32
 
 // Virtual memory constants
 #define PAGES_PER_TABLE 1024
 #define PAGES_PER_DIR   1024
 #define PAGE_TABLE_SIZE 4096
 
+// Recursive mapping: the last PDE points at the directory itself, so while
+// a directory is loaded its page tables appear at fixed virtual addresses
+#define VMM_RECURSIVE_INDEX     1023
+#define VMM_PAGE_TABLES_VIRT    0xFFC00000  // Table i at VMM_PAGE_TABLES_VIRT + i * 4KB
+#define VMM_PAGE_DIR_VIRT       0xFFFFF000  // The directory itself
+#define VMM_SCRATCH_VIRT        0xFFBFF000  // One-page window for frames outside the direct map
+
+// Uncached device windows (local APIC, ...) above the kernel stack region
+#define VMM_MMIO_START          0xC1400000
+#define VMM_MMIO_SIZE           0x400000
+
+// Linear framebuffer, then the console's RAM back buffer (kernel/fbcon.h)
+#define VMM_FB_START            0xC1800000
+#define VMM_FB_SIZE             0x1000000
+
+// Direct map (the kernel image included), heap, slab, kernel stack, MMIO
+// and framebuffer regions - page tables in this range are shared by every directory
+// rather than copied on clone, and their pages are global
+#define VMM_KERNEL_SPACE_START  KERNEL_VIRT_BASE
+#define VMM_KERNEL_SPACE_END    0xC2800000
+#define VMM_KERNEL_PDE_FIRST    (VMM_KERNEL_SPACE_START >> 22)
+#define VMM_KERNEL_PDE_COUNT    ((VMM_KERNEL_SPACE_END - VMM_KERNEL_SPACE_START) >> 22)
+
+// Process address spaces get everything below the kernel but the null page
+#define VMM_USER_SPACE_START    0x1000
+#define VMM_USER_SPACE_END      KERNEL_VIRT_BASE
+
 // Get page directory/table indices from virtual address
 #define GET_PAGE_DIR_INDEX(addr)   (((addr) >> 22) & 0x3FF)
 #define GET_PAGE_TABLE_INDEX(addr) (((addr) >> 12) & 0x3FF)
@@ -57,28 +98,122 @@ typedef struct {
     page_table_entry_t pages[PAGES_PER_TABLE];
 } page_table_t;
 
-typedef struct {
+typedef struct page_directory {
     page_directory_entry_t tables[PAGES_PER_DIR];
 } page_directory_t;
 
+// Virtual memory areas - describe how an unmapped range should be
+// populated, so the page-fault handler can fill it on first touch
+#define VMA_READ        0x1
+#define VMA_WRITE       0x2
+#define VMA_USER        0x4
+
+#define VMA_MAX_STATIC  32          // Area descriptors available before the heap exists
+
+// Page-fault error code bits pushed by the CPU
+#define PF_PRESENT      0x1         // 0 = not-present page, 1 = protection violation
+#define PF_WRITE        0x2
+#define PF_USER         0x4
+
+typedef enum {
+    VMA_ANONYMOUS = 0,              // Demand-zero memory
+    VMA_FILE = 1                    // Filled from a backing object
+} vma_type_t;
+
+struct vm_area;
+
+// Fill one page of a file-backed area; page is already mapped writable.
+// Returns 0 on success, -1 on error.
+typedef int (*vma_fill_t)(struct vm_area* area, uint32_t offset, void* page);
+
+// Write one dirty page of a shared file-backed area back to its object.
+// Returns 0 on success, -1 on error.
+typedef int (*vma_writeback_t)(struct vm_area* area, uint32_t offset, const void* page);
+
+typedef struct vm_area {
+    uint32_t start;                 // Page aligned
+    uint32_t end;                   // Exclusive, page aligned
+    uint32_t flags;                 // VMA_READ / VMA_WRITE / VMA_USER
+    vma_type_t type;
+    vma_fill_t fill;                // VMA_FILE only
+    vma_writeback_t writeback;      // Set for shared writable file areas
+    void* backing;                  // Passed through to fill
+    uint32_t file_offset;           // Offset of start within the backing object
+    uint32_t faults;                // Pages populated on demand
+    struct vm_area* next;           // Sorted by start address
+} vm_area_t;
+
+// An address space: a page directory plus the areas it may fault in
+typedef struct vm_space {
+    page_directory_t* dir;
+    vm_area_t* areas;
+    uint32_t faults_handled;
+    uint32_t faults_failed;
+    uint32_t cow_copies;            // Shared frames copied on write
+    uint32_t zero_maps;             // Reads served by mapping the shared zero page
+    uint32_t swap_hand;             // Where the swap-out CLOCK resumes
+} vm_space_t;
+
 // Virtual memory manager functions
 void vmm_init(void);
 page_directory_t* vmm_create_page_directory(void);
 void vmm_switch_page_directory(page_directory_t* dir);
+page_directory_t* vmm_create_process_directory(void);
+page_directory_t* vmm_clone_directory(page_directory_t* src);
+void vmm_destroy_directory(page_directory_t* dir);
 void vmm_map_page(page_directory_t* dir, uint32_t virt_addr, uint32_t phys_addr, uint32_t flags);
 void vmm_unmap_page(page_directory_t* dir, uint32_t virt_addr);
+int vmm_map_range(page_directory_t* dir, uint32_t virt_addr, uint32_t phys_addr, uint32_t count, uint32_t flags);
+int vmm_map_large_page(page_directory_t* dir, uint32_t virt_addr, uint32_t phys_addr, uint32_t flags);
 uint32_t vmm_get_physical_address(page_directory_t* dir, uint32_t virt_addr);
 int vmm_is_page_present(page_directory_t* dir, uint32_t virt_addr);
+uint32_t vmm_get_page_entry(page_directory_t* dir, uint32_t virt_addr);
+
+// Area management and demand paging
+vm_area_t* vmm_add_area(vm_space_t* space, uint32_t start, uint32_t size, uint32_t flags);
+vm_area_t* vmm_add_file_area(vm_space_t* space, uint32_t start, uint32_t size, uint32_t flags,
+                             vma_fill_t fill, void* backing, uint32_t file_offset);
+int vmm_remove_area(vm_space_t* space, uint32_t start);
+void vmm_release_areas(vm_space_t* space);
+int vmm_sync_area(vm_area_t* area);
+vm_area_t* vmm_find_area(vm_space_t* space, uint32_t addr);
+int vmm_handle_page_fault(uint32_t fault_addr, uint32_t err_code);
+void vmm_dump_areas(vm_space_t* space);
 
-// Identity mapping function for kernel
-void vmm_identity_map_kernel(page_directory_t* dir);
+// Swap out up to max of space's anonymous user pages, CLOCK fashion from
+// its hand, looking at no more than *budget PTEs (decremented); returns
+// the frames freed
+uint32_t vmm_swap_out(vm_space_t* space, uint32_t max, uint32_t* budget);
+
+// Direct map of the low frames (and the kernel image) at KERNEL_VIRT_BASE
+void vmm_map_kernel(page_directory_t* dir);
 
 // Assembly functions for paging operations
 extern void vmm_load_page_directory(uint32_t page_dir_phys);
 extern void vmm_enable_paging(void);
 extern void vmm_flush_tlb(void);
+extern void vmm_invalidate_page(uint32_t virt_addr);
+
+// Program PAT entry 4 as write-combining, where CPUID reports a PAT; each
+// CPU runs it once, the BSP from vmm_init
+void vmm_pat_init(void);
+
+// TLB maintenance
+void vmm_invalidate_range(uint32_t virt_addr, uint32_t count);
+void vmm_flush_tlb_all(void);
+
+// Current page directory, and the master directory that owns every
+// kernel-space PDE (other directories copy those entries from it)
+#define current_page_directory (smp_current_cpu()->page_directory)   // Per CPU
+extern page_directory_t* kernel_page_directory;
+
+// Set once CR4.PSE is on and 4MB pages can be used
+extern int vmm_large_pages_enabled;
+extern int vmm_global_pages_enabled;
+extern int vmm_pat_enabled;             // PAGE_WRITECOMBINE means write-combining
 
-// Current page directory
-extern page_directory_t* current_page_directory;
+// Kernel address space, searched for faults in processes without areas of
+// their own (and for addresses outside those areas)
+extern vm_space_t kernel_vm_space;
 
 #endif // VMM_H
\ No newline at end of file
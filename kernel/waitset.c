@@ -0,0 +1,384 @@
+// ClaudeOS Wait Set Implementation - Day 21
+// Objects push their watchers onto a ready list; waits only scan that list
+
+#include "waitset.h"
+#include "process.h"
+#include "ipc.h"
+#include "pipe.h"
+#include "network.h"
+#include "timer.h"
+#include "lock.h"
+
+static waitset_t waitset_pool[MAX_WAITSETS];
+static int next_waitset_id = 1;
+
+// Guards every watcher list and ready list. Taken inside the objects' own
+// locks (a mailbox, ipc_lock, a pipe) and from the NIC interrupt, so
+// always with interrupts off. Left unregistered, like the pipe table lock.
+static spinlock_t waitset_lock;
+
+// Level check for an entry whose object still exists (waitset_lock held)
+static bool wait_entry_ready(wait_entry_t* entry) {
+    switch (entry->type) {
+        case WAIT_MESSAGE: {
+            mailbox_t* mailbox = (mailbox_t*)entry->object;
+            return mailbox->tail != mailbox->head;
+        }
+        case WAIT_SEMAPHORE:
+            return ((semaphore_t*)entry->object)->value > 0;
+        case WAIT_PIPE: {
+            pipe_t* pipe = (pipe_t*)entry->object;
+            return pipe_available(pipe) > 0 || !pipe->write_open;
+        }
+        case WAIT_NET_RX:
+            return network_rx_pending((network_interface_t*)entry->object);
+        default:
+            return false;
+    }
+}
+
+// Put an entry on its set's ready list and wake the set's sleeper
+// (waitset_lock held)
+static void waitset_queue(wait_entry_t* entry) {
+    waitset_t* set = entry->set;
+    if (!entry->queued) {
+        entry->queued = true;
+        entry->ready_next = NULL;
+        if (set->ready_tail) {
+            set->ready_tail->ready_next = entry;
+        } else {
+            set->ready_head = entry;
+        }
+        set->ready_tail = entry;
+    }
+    process_t* waiter = set->waiter;
+    if (waiter) {
+        set->waiter = NULL;
+        set->wakeups++;
+        process_wake(waiter);
+    }
+}
+
+// Attach an entry to the object it watches. The object's owner calls this
+// under its own lock, so the object can't be freed halfway.
+void waitset_link(wait_entry_t* entry, wait_source_t* source, void* object) {
+    uint32_t flags = spin_lock_irqsave(&waitset_lock);
+    entry->source = source;
+    entry->object = object;
+    entry->source_next = source->watchers;
+    source->watchers = entry;
+    if (wait_entry_ready(entry)) {
+        waitset_queue(entry);  // Already fired before anyone watched
+    }
+    spin_unlock_irqrestore(&waitset_lock, flags);
+}
+
+// Detach an entry from its object and the ready list (waitset_lock held)
+static void waitset_unlink(wait_entry_t* entry) {
+    if (entry->source) {
+        wait_entry_t** link = &entry->source->watchers;
+        while (*link && *link != entry) {
+            link = &(*link)->source_next;
+        }
+        if (*link) {
+            *link = entry->source_next;
+        }
+        entry->source = NULL;
+    }
+    if (entry->queued) {
+        waitset_t* set = entry->set;
+        wait_entry_t* prev = NULL;
+        for (wait_entry_t* e = set->ready_head; e; prev = e, e = e->ready_next) {
+            if (e != entry) {
+                continue;
+            }
+            if (prev) {
+                prev->ready_next = e->ready_next;
+            } else {
+                set->ready_head = e->ready_next;
+            }
+            if (set->ready_tail == e) {
+                set->ready_tail = prev;
+            }
+            break;
+        }
+        entry->queued = false;
+    }
+    entry->object = NULL;
+    entry->in_use = false;
+}
+
+void waitset_notify(wait_source_t* source) {
+    // An entry linked after this check is tested for readiness as it links
+    if (!source->watchers) {
+        return;
+    }
+    uint32_t flags = spin_lock_irqsave(&waitset_lock);
+    for (wait_entry_t* entry = source->watchers; entry; entry = entry->source_next) {
+        waitset_queue(entry);
+    }
+    spin_unlock_irqrestore(&waitset_lock, flags);
+}
+
+// The object is being freed: every watcher reports a hangup once
+void waitset_source_gone(wait_source_t* source) {
+    uint32_t flags = spin_lock_irqsave(&waitset_lock);
+    wait_entry_t* entry = source->watchers;
+    source->watchers = NULL;
+    while (entry) {
+        wait_entry_t* next = entry->source_next;
+        entry->source = NULL;
+        entry->object = NULL;
+        entry->source_next = NULL;
+        waitset_queue(entry);
+        entry = next;
+    }
+    spin_unlock_irqrestore(&waitset_lock, flags);
+}
+
+waitset_t* waitset_create(void) {
+    process_t* owner = current_process;
+    waitset_t* set = NULL;
+    uint32_t flags = spin_lock_irqsave(&waitset_lock);
+    for (int i = 0; i < MAX_WAITSETS; i++) {
+        if (!waitset_pool[i].in_use) {
+            set = &waitset_pool[i];
+            break;
+        }
+    }
+    if (set) {
+        set->id = next_waitset_id++;
+        set->in_use = true;
+        set->owner_pid = owner ? owner->pid : KERNEL_PID;
+        set->ready_head = NULL;
+        set->ready_tail = NULL;
+        set->waiter = NULL;
+        set->wakeups = 0;
+        for (int i = 0; i < WAITSET_MAX_ENTRIES; i++) {
+            set->entries[i].in_use = false;
+            set->entries[i].queued = false;
+            set->entries[i].source = NULL;
+            set->entries[i].set = set;
+        }
+    }
+    spin_unlock_irqrestore(&waitset_lock, flags);
+    return set;
+}
+
+void waitset_destroy(waitset_t* set) {
+    if (!set || !set->in_use) {
+        return;
+    }
+    uint32_t flags = spin_lock_irqsave(&waitset_lock);
+    for (int i = 0; i < WAITSET_MAX_ENTRIES; i++) {
+        if (set->entries[i].in_use) {
+            waitset_unlink(&set->entries[i]);
+        }
+    }
+    set->waiter = NULL;
+    set->in_use = false;
+    spin_unlock_irqrestore(&waitset_lock, flags);
+}
+
+// Watch an object; returns 0, or -1 if it doesn't exist, is already
+// watched by this set, or the set is full
+int waitset_add(waitset_t* set, int type, int id, uint32_t cookie) {
+    if (!set || !set->in_use || type < WAIT_MESSAGE || type > WAIT_NET_RX) {
+        return -1;
+    }
+    if (type == WAIT_MESSAGE) {
+        id = 0;
+    }
+
+    wait_entry_t* entry = NULL;
+    bool duplicate = false;
+    uint32_t flags = spin_lock_irqsave(&waitset_lock);
+    for (int i = 0; i < WAITSET_MAX_ENTRIES; i++) {
+        wait_entry_t* e = &set->entries[i];
+        if (e->in_use) {
+            duplicate |= (e->type == type && e->id == id);
+        } else if (!entry) {
+            entry = e;
+        }
+    }
+    if (entry && !duplicate) {
+        entry->in_use = true;
+    }
+    spin_unlock_irqrestore(&waitset_lock, flags);
+    if (!entry || duplicate) {
+        return -1;
+    }
+    entry->type = type;
+    entry->id = id;
+    entry->cookie = cookie;
+    entry->queued = false;
+    entry->source = NULL;
+    entry->object = NULL;
+
+    int result = -1;
+    switch (type) {
+        case WAIT_MESSAGE: {
+            // The owner's mailbox goes away only with the owner (and its sets)
+            process_t* owner = process_find(set->owner_pid);
+            mailbox_t* mailbox = owner ? ipc_process_mailbox(owner) : NULL;
+            if (mailbox) {
+                waitset_link(entry, &mailbox->watchers, mailbox);
+                result = 0;
+            }
+            break;
+        }
+        case WAIT_SEMAPHORE:
+            result = ipc_watch_semaphore(id, entry);
+            break;
+        case WAIT_PIPE:
+            result = pipe_watch(id, entry);
+            break;
+        case WAIT_NET_RX: {
+            // Interface slots are static; network_init hangs up their watchers
+            network_interface_t* iface = network_find_interface(id);
+            if (iface) {
+                waitset_link(entry, &iface->rx_watchers, iface);
+                result = 0;
+            }
+            break;
+        }
+    }
+    if (result != 0) {
+        entry->in_use = false;
+    }
+    return result;
+}
+
+int waitset_remove(waitset_t* set, int type, int id) {
+    if (!set || !set->in_use) {
+        return -1;
+    }
+    if (type == WAIT_MESSAGE) {
+        id = 0;
+    }
+    int result = -1;
+    uint32_t flags = spin_lock_irqsave(&waitset_lock);
+    for (int i = 0; i < WAITSET_MAX_ENTRIES; i++) {
+        wait_entry_t* entry = &set->entries[i];
+        if (entry->in_use && entry->type == type && entry->id == id) {
+            waitset_unlink(entry);
+            result = 0;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&waitset_lock, flags);
+    return result;
+}
+
+// Report up to max ready entries (waitset_lock held). Entries no longer
+// ready are dropped from the list; reported ones move to its back, so a
+// small max still gets round to all of them.
+static int waitset_collect(waitset_t* set, wait_event_t* events, int max) {
+    int count = 0;
+    wait_entry_t* kept_head = NULL;
+    wait_entry_t* kept_tail = NULL;
+    while (set->ready_head && count < max) {
+        wait_entry_t* entry = set->ready_head;
+        set->ready_head = entry->ready_next;
+        if (!set->ready_head) {
+            set->ready_tail = NULL;
+        }
+        entry->ready_next = NULL;
+
+        bool gone = (entry->source == NULL);
+        if (!gone && !wait_entry_ready(entry)) {
+            entry->queued = false;  // Consumed since it fired
+            continue;
+        }
+        events[count].type = entry->type;
+        events[count].id = entry->id;
+        events[count].cookie = entry->cookie;
+        events[count].hangup = gone;
+        count++;
+        if (gone) {
+            entry->queued = false;
+            entry->in_use = false;
+            continue;
+        }
+        if (kept_tail) {
+            kept_tail->ready_next = entry;
+        } else {
+            kept_head = entry;
+        }
+        kept_tail = entry;
+    }
+    if (kept_head) {
+        if (set->ready_tail) {
+            set->ready_tail->ready_next = kept_head;
+        } else {
+            set->ready_head = kept_head;
+        }
+        set->ready_tail = kept_tail;
+    }
+    return count;
+}
+
+int waitset_wait(waitset_t* set, wait_event_t* events, int max, uint32_t timeout_ms) {
+    if (!set || !set->in_use || !events || max <= 0) {
+        return -1;
+    }
+
+    process_t* process = current_process;
+    int can_sleep = timeout_ms && process && process->pid != KERNEL_PID && scheduler_preemptive;
+    int forever = (timeout_ms == IPC_WAIT_FOREVER);
+    uint32_t deadline = 0;
+    if (can_sleep && !forever) {
+        uint32_t ticks = (timeout_ms / 1000) * TIMER_FREQUENCY +
+                         ((timeout_ms % 1000) * TIMER_FREQUENCY + 999) / 1000;
+        deadline = timer_get_ticks() + ticks;
+    }
+
+    while (1) {
+        uint32_t flags = spin_lock_irqsave(&waitset_lock);
+        int count = waitset_collect(set, events, max);
+        if (count > 0 || !can_sleep ||
+            (!forever && (int32_t)(timer_get_ticks() - deadline) >= 0)) {
+            spin_unlock_irqrestore(&waitset_lock, flags);
+            return count;
+        }
+
+        // Blocked before the lock drops, so a notify can't be missed
+        set->waiter = process;
+        process_prepare_block();
+        if (!forever) {
+            timer_wake_at(process, deadline);
+        }
+        spin_unlock_irqrestore(&waitset_lock, flags);
+        process_sleep_while(process->state, PROCESS_BLOCKED);
+
+        // Woken by an object or by the deadline: clear whichever didn't fire
+        if (!forever) {
+            timer_cancel_sleep(process);
+        }
+        flags = spin_lock_irqsave(&waitset_lock);
+        if (set->waiter == process) {
+            set->waiter = NULL;
+        }
+        spin_unlock_irqrestore(&waitset_lock, flags);
+    }
+}
+
+void waitset_cancel_wait(process_t* process) {
+    uint32_t flags = spin_lock_irqsave(&waitset_lock);
+    for (int i = 0; i < MAX_WAITSETS; i++) {
+        if (waitset_pool[i].in_use && waitset_pool[i].waiter == process) {
+            waitset_pool[i].waiter = NULL;
+        }
+    }
+    spin_unlock_irqrestore(&waitset_lock, flags);
+}
+
+// Free the sets of a process that is being cleaned up
+void waitset_release_owned(process_t* process) {
+    for (int i = 0; i < MAX_WAITSETS; i++) {
+        waitset_t* set = &waitset_pool[i];
+        if (set->in_use && set->owner_pid == process->pid) {
+            waitset_destroy(set);
+        }
+    }
+}
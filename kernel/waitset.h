@@ -0,0 +1,84 @@
+// ClaudeOS Wait Sets - Day 21
+// Sleep on several IPC objects at once (an epoll-style interest list)
+
+#ifndef WAITSET_H
+#define WAITSET_H
+
+#include "types.h"
+
+#define MAX_WAITSETS            8
+#define WAITSET_MAX_ENTRIES     16      // Objects one set can watch
+
+// Event types (what id names)
+#define WAIT_MESSAGE    1               // A message in the owner's mailbox (id ignored)
+#define WAIT_SEMAPHORE  2               // Semaphore id has a unit free
+#define WAIT_PIPE       3               // Pipe id has data, or its writer closed
+#define WAIT_NET_RX     4               // Interface id has received packets
+
+struct process;
+struct wait_entry;
+struct waitset;
+
+// Embedded in every object a set can watch: the entries watching it
+typedef struct wait_source {
+    struct wait_entry* watchers;
+} wait_source_t;
+
+// One registered interest
+typedef struct wait_entry {
+    int type;
+    int id;
+    uint32_t cookie;                    // Caller's tag, handed back with the event
+    void* object;                       // Semaphore, mailbox, pipe or interface
+    wait_source_t* source;              // NULL once the object is gone
+    struct waitset* set;
+    bool in_use;
+    bool queued;                        // On the set's ready list
+    struct wait_entry* source_next;
+    struct wait_entry* ready_next;
+} wait_entry_t;
+
+typedef struct waitset {
+    int id;
+    bool in_use;
+    int owner_pid;
+    wait_entry_t entries[WAITSET_MAX_ENTRIES];
+    wait_entry_t* ready_head;           // Entries whose object has fired
+    wait_entry_t* ready_tail;
+    struct process* waiter;             // Owner sleeping in waitset_wait
+    uint32_t wakeups;
+} waitset_t;
+
+// What waitset_wait reports
+typedef struct {
+    int type;
+    int id;
+    uint32_t cookie;
+    bool hangup;                        // The object was destroyed (the entry is dropped)
+} wait_event_t;
+
+// Sets belong to the creating process and go away when it does
+waitset_t* waitset_create(void);
+void waitset_destroy(waitset_t* set);
+int waitset_add(waitset_t* set, int type, int id, uint32_t cookie);
+int waitset_remove(waitset_t* set, int type, int id);
+
+// Sleep up to timeout_ms (IPC_WAIT_FOREVER: no limit) until a watched
+// object is ready, and report up to max of them. Readiness is level
+// triggered: an object still ready next time is reported again. Only the
+// ready list is looked at, never the whole interest list. Returns the
+// event count (0 on timeout, or right away for a caller that can't
+// sleep), or -1 for a bad set.
+int waitset_wait(waitset_t* set, wait_event_t* events, int max, uint32_t timeout_ms);
+
+// Hooks for the objects themselves: attach an entry (under the object's
+// own lock), something became ready, or the object is about to be freed
+void waitset_link(wait_entry_t* entry, wait_source_t* source, void* object);
+void waitset_notify(wait_source_t* source);
+void waitset_source_gone(wait_source_t* source);
+
+// Process teardown
+void waitset_cancel_wait(struct process* process);
+void waitset_release_owned(struct process* process);
+
+#endif // WAITSET_H